@@ -0,0 +1,84 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef AUDIO_BUFFER_POOL_H
+#define AUDIO_BUFFER_POOL_H
+
+#include "CodalConfig.h"
+#include "ManagedBuffer.h"
+
+// The number of audio buffers that may be recycled, shared by all stages of the audio pipeline.
+// Buffers are created on demand, so only as many as the pipeline keeps in flight are ever taken from the heap.
+#ifndef CONFIG_AUDIO_BUFFER_POOL_SIZE
+#define CONFIG_AUDIO_BUFFER_POOL_SIZE           8
+#endif
+
+// The size of each pooled buffer, in bytes. Requests for other sizes are served from the heap.
+#ifndef CONFIG_AUDIO_BUFFER_POOL_BUFFER_SIZE
+#define CONFIG_AUDIO_BUFFER_POOL_BUFFER_SIZE    512
+#endif
+
+namespace codal
+{
+    /**
+     * Usage statistics for the audio buffer pool.
+     */
+    struct AudioBufferPoolStats
+    {
+        uint16_t        capacity;                   // The number of buffers the pool may hold.
+        uint16_t        created;                    // The number of buffers created so far.
+        uint32_t        recycled;                   // The number of allocations satisfied by a released buffer.
+        uint32_t        misses;                     // The number of allocations served from the heap instead.
+    };
+
+    /**
+     * A small pool of recycled, equally sized ManagedBuffers used for audio data.
+     *
+     * Each stage of the audio pipeline generates a new buffer for every DMA period, often in interrupt context.
+     * Rather than taking each from the heap, buffers are retained by the pool and handed out again once every other
+     * reference to them has been released, so the steady state audio path performs no heap allocation at all.
+     */
+    class AudioBufferPool
+    {
+        public:
+
+        /**
+         * Allocates a buffer, recycling one from the pool if possible.
+         *
+         * @param size The size of the buffer required, in bytes.
+         *
+         * @return A buffer of the given size. Unlike ManagedBuffer(size), its contents are undefined.
+         */
+        static ManagedBuffer allocate(int size);
+
+        /**
+         * Retrieves the usage statistics of the pool.
+         *
+         * @param stats The structure to fill in.
+         */
+        static void getStats(AudioBufferPoolStats &stats);
+    };
+}
+
+#endif
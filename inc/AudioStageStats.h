@@ -0,0 +1,120 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef AUDIO_STAGE_STATS_H
+#define AUDIO_STAGE_STATS_H
+
+#include "CodalConfig.h"
+#include "Timer.h"
+
+// Collect timing and underrun statistics at each stage of the audio pipeline.
+// This adds a few timer reads to every pull(), so is disabled by default.
+#ifndef CONFIG_AUDIO_STATS
+#define CONFIG_AUDIO_STATS 0
+#endif
+
+namespace codal
+{
+    /**
+     * Timing and underrun statistics for one stage of the audio pipeline, updated on each pull().
+     * All times are in microseconds.
+     */
+    struct AudioStageStats
+    {
+        uint32_t            pulls;                  // The number of buffers provided by this stage.
+        uint32_t            underruns;              // The number of times this stage had no data when data was expected.
+        uint32_t            late;                   // The number of pulls that arrived over a quarter of a buffer later than expected.
+        uint32_t            lastTime;               // The time taken by the most recent pull.
+        uint32_t            maxTime;                // The longest time taken by any pull.
+        uint32_t            totalTime;              // The total time spent in pull, for computing a mean or CPU load.
+        uint32_t            maxInterval;            // The longest time between the start of consecutive pulls.
+        uint32_t            maxAge;                 // The longest time a buffer was waiting to be pulled, after being announced.
+        CODAL_TIMESTAMP     lastPull;               // The time at which the most recent pull started, or 0 if none have.
+
+        /**
+         * Clears all statistics.
+         */
+        void reset();
+
+        /**
+         * Records the start of a pull.
+         *
+         * @param period The expected time between pulls, or 0 if unknown.
+         * @return A timestamp to pass to end().
+         */
+        CODAL_TIMESTAMP begin(uint32_t period = 0)
+        {
+            CODAL_TIMESTAMP now = system_timer_current_time_us();
+
+            if (lastPull)
+            {
+                uint32_t interval = (uint32_t) (now - lastPull);
+                if (interval > maxInterval)
+                    maxInterval = interval;
+
+                if (period && interval > period + period / 4)
+                    late++;
+            }
+
+            lastPull = now;
+            return now;
+        }
+
+        /**
+         * Records the end of a pull.
+         *
+         * @param start The timestamp returned by begin().
+         */
+        void end(CODAL_TIMESTAMP start)
+        {
+            lastTime = (uint32_t) (system_timer_current_time_us() - start);
+            if (lastTime > maxTime)
+                maxTime = lastTime;
+            totalTime += lastTime;
+            pulls++;
+        }
+
+        /**
+         * Records the age of a buffer as it is pulled.
+         *
+         * @param announced The time at which the buffer was announced with pullRequest().
+         */
+        void age(CODAL_TIMESTAMP announced)
+        {
+            uint32_t a = (uint32_t) (system_timer_current_time_us() - announced);
+
+            if (a > maxAge)
+                maxAge = a;
+        }
+
+        /**
+         * Writes the statistics to DMESG.
+         *
+         * @param name The name of the stage, to prefix the output with.
+         */
+        void print(const char *name);
+    };
+}
+
+#endif
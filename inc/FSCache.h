@@ -25,10 +25,18 @@ DEALINGS IN THE SOFTWARE.
 #include "CodalCompat.h"
 
 #define FSCACHE_FLAG_PINNED				0x01
+#define FSCACHE_FLAG_PROTECTED			0x02		// The block has been used again since it was first evicted.
+#define FSCACHE_FLAG_DIRTY				0x04		// The block holds writes not yet made to FLASH.
+
+#define FSCACHE_NO_ADDRESS				0xFFFFFFFF
 
 #define CODAL_FS_CACHE_VALIDATE			1
 #define CODAL_FS_DEFAULT_CACHE_SZE		4
 
+#ifndef CODAL_FS_CACHE_READ_AHEAD
+#define CODAL_FS_CACHE_READ_AHEAD		1			// The number of following blocks loaded along with a block that follows on from the last one loaded.
+#endif
+
 namespace codal
 {
 	struct CacheEntry
@@ -36,9 +44,79 @@ namespace codal
 		uint32_t address;
 		uint16_t lastUsed;
 		uint16_t flags;
+		uint16_t dirtyStart;	// Offset of the first byte of the block not yet written to FLASH.
+		uint16_t dirtyEnd;		// Offset of the end of the bytes of the block not yet written to FLASH.
 		uint8_t  *page;
 	};
 
+	class FSCache;
+
+	struct FSCachePoolStatistics
+	{
+		uint32_t budget;		// The most bytes of pages the caches in the pool may hold between them.
+		uint32_t used;			// The bytes of pages currently held.
+		uint32_t highWater;		// The most bytes of pages held at any one time.
+		uint32_t reclaims;		// Pages released by one cache to make room for a page in another.
+	};
+
+	/**
+	 * A byte budget shared by a number of FSCache instances, in place of each holding pages up to its own size.
+	 *
+	 * A cache that needs a page beyond the budget takes one from whichever cache in the pool holds the least valuable:
+	 * a page of the cache with the lowest priority, preferring probationary pages to protected ones, and then the
+	 * least recently used. Pinned pages are never taken. RAM then follows the caches that are in use, rather than being
+	 * divided between them in advance.
+	 */
+	class FSCachePool
+	{
+		friend class FSCache;
+
+		private:
+			FSCache *caches;		// The caches sharing the budget.
+			uint16_t clock;			// Operation counter shared by the caches, so that their pages' ages can be compared.
+			FSCachePoolStatistics stats;
+
+			/**
+			 * Accounts for a page, if the budget allows.
+			 * @param bytes the size of the page.
+			 * @param force true to account for the page even if this exceeds the budget.
+			 * @return true if the page may be allocated.
+			 */
+			bool reserve(int bytes, bool force = false);
+
+			/**
+			 * Accounts for the release of a page.
+			 * @param bytes the size of the page.
+			 */
+			void release(int bytes);
+
+			/**
+			 * Selects the least valuable page held by any cache in the pool.
+			 * @param owner set to the cache holding the page.
+			 * @return the entry holding the page, or NULL if every page is pinned.
+			 */
+			CacheEntry *selectVictim(FSCache *&owner);
+
+		public:
+			/**
+			 * @param budget the most bytes of pages the caches in the pool may hold between them.
+			 */
+			FSCachePool(uint32_t budget);
+
+			/**
+			 * Retrieves the budget, and the use made of it since the pool was created.
+			 */
+			FSCachePoolStatistics getStatistics();
+	};
+
+	struct FSCacheStatistics
+	{
+		uint32_t hits;			// Lookups satisfied from the cache.
+		uint32_t misses;		// Lookups that read a block from FLASH.
+		uint32_t evictions;		// Blocks discarded to make room for another.
+		uint32_t writes;		// Write operations made to FLASH.
+	};
+
 	class FSCache
 	{
 		private:
@@ -47,6 +125,44 @@ namespace codal
 			int blockSize;
 			int cacheSize;
 			uint16_t operationCount;
+			uint32_t *ghosts;
+			int ghostHead;
+			int probationSize;
+			CacheEntry *lastEntry;
+			uint32_t lastMiss;
+			bool writeBack;
+			FSCacheStatistics stats;
+			FSCachePool *pool;			// The pool whose budget this cache's pages count towards, or NULL.
+			FSCache *nextPooled;		// The next cache sharing the same pool.
+			int priority;				// Pages of the caches in a pool with the lowest priority are taken first.
+			uint16_t *clock;			// The operation counter in use: our own, or that shared by the pool.
+
+			/**
+			 * Discards the block held in the given cache entry, writing any changes it holds to FLASH first.
+			 * The entry's page is kept, to hold another block.
+			 */
+			void evictEntry(CacheEntry *c);
+
+			/**
+			 * Discards the block held in the given cache entry, and frees its page.
+			 */
+			void releaseEntry(CacheEntry *c);
+
+			friend class FSCachePool;
+
+			/**
+			 * Selects a cache entry to hold the given block, evicting another block if necessary.
+			 * The contents of the entry's page are left for the caller to fill.
+			 * @param address the logical address of the block to cache.
+			 * @return a pointer to the selected cache entry.
+			 */
+			CacheEntry *allocateEntry(uint32_t address);
+
+			/**
+			 * Writes any changes held in the given cache entry to FLASH.
+			 * @return DEVICE_OK on success, or the error returned by the NVMController.
+			 */
+			int flushEntry(CacheEntry *c);
 
 		public:
 		  /**
@@ -57,15 +173,38 @@ namespace codal
 			FSCache(NVMController &nvm, int blockSize, int size = CODAL_FS_DEFAULT_CACHE_SZE);
 
 			/**
-			 * Clear all cache entries, and free any allocated RAM.
+			 * Clear all cache entries, and free any allocated RAM. Any changes held in the cache are written first.
 			 */
 			void clear();
 
 			/**
-			 * Erase a single page of FLASH memory at the given address
+			 * Erase the cached blocks of the page of FLASH memory at the given address.
+			 * The caller is responsible for erasing the page itself.
 			 */
 			int erase(uint32_t address);
 
+			/**
+			 * Determines if writes are held in the cache until flush() is called, or the block is evicted,
+			 * rather than being written through to FLASH immediately.
+			 * Successive writes to the same block are then made in a single FLASH write operation.
+			 * @param enable true to hold writes in the cache, false to write through.
+			 */
+			void setWriteBack(bool enable);
+
+			/**
+			 * Shares a budget for pages with other caches, in place of holding up to size pages regardless of them.
+			 * The cache is cleared first. The cache still holds no more than size pages.
+			 * @param pool the pool to join, or NULL to leave the current pool.
+			 * @param priority the pages of the caches in a pool with the lowest priority are taken first.
+			 */
+			void setPool(FSCachePool *pool, int priority = 0);
+
+			/**
+			 * Write any changes held in the cache to FLASH.
+			 * @return DEVICE_OK on success, or the error returned by the NVMController.
+			 */
+			int flush();
+
 			/**
 			 * Read the given area of memory into the buffer provided,
 			 * paging the data in from FLASH as needed.
@@ -97,12 +236,28 @@ namespace codal
 			CacheEntry *getCacheEntry(uint32_t address);
 
 			/**
-			 * Page a given block into the cache, replacing the LRU block if necessary.
+			 * Page a given block into the cache, replacing another block if necessary.
+			 * Blocks are first held on probation, and are evicted in the order they were loaded.
+			 * Blocks used again soon after being evicted are protected, and are evicted least recently used first.
+			 * This prevents a scan through storage from displacing the blocks in regular use.
+			 * A block that follows on from the last one loaded is loaded in a single read along with the
+			 * CODAL_FS_CACHE_READ_AHEAD blocks that follow it.
 			 * @param address the logical address of the block to cache.
 			 * @return a pointer to the relevant cache entry.
 			 */
 			CacheEntry *cachePage(uint32_t address);
 
+			/**
+			 * Retrieves the number of cache hits, misses and evictions since the cache was created,
+			 * or the statistics were last reset. Each miss costs a read of one block from FLASH.
+			 */
+			FSCacheStatistics getStatistics();
+
+			/**
+			 * Resets the cache hit, miss and eviction counts to zero.
+			 */
+			void resetStatistics();
+
 			void debug(bool verbose = true);
 			void debug(CacheEntry *c, bool verbose = true);
 	};
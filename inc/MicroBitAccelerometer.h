@@ -31,6 +31,10 @@ DEALINGS IN THE SOFTWARE.
 #include "codal-core/inc/types/CoordinateSystem.h"
 #include "MicroBitI2C.h"
 
+// LSM303 accelerometer status register, and its new data available flag.
+#define MICROBIT_ACCELEROMETER_LSM303_STATUS_REG_A      0x27
+#define MICROBIT_ACCELEROMETER_LSM303_ZYXDA             0x08
+
 
 namespace codal
 {
@@ -42,6 +46,9 @@ namespace codal
       public:
 
         static Accelerometer* driver;                     // The instance of an Accelerometer driver.
+        static MicroBitI2C* i2cBus;                       // The bus the detected driver was found on, or NULL before autodetection.
+        static Pin* interruptPin;                         // The interrupt line shared by the on-board motion sensors.
+        static CoordinateSpace* sensorSpace;              // The orientation of the detected sensor.
 
         /**
          * Constructor.
@@ -75,6 +82,15 @@ namespace codal
          */
         static Accelerometer& autoDetect(MicroBitI2C &i2c); 
 
+        /**
+         * MicroBitIrqDispatcher source for the combined IRQ line. Reads the LSM303 status register, and
+         * if a new sample is available, updates the driver.
+         *
+         * @param context Unused.
+         * @return MICROBIT_IRQ_HANDLED if a sample was read, MICROBIT_IRQ_NONE otherwise.
+         */
+        static int irqDataReady(void *context);
+
         /**
          * Configures the accelerometer for G range and sample rate defined
          * in this object. The nearest values are chosen to those defined
@@ -0,0 +1,148 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef MICROBIT_ACCELEROMETER_FIFO_H
+#define MICROBIT_ACCELEROMETER_FIFO_H
+
+#include "CodalConfig.h"
+#include "CodalComponent.h"
+#include "MicroBitAccelerometer.h"
+#include "MicroBitComponentIds.h"
+
+// The default number of samples the sensor buffers before signalling that a batch is ready (1..31).
+#ifndef CONFIG_ACCELEROMETER_FIFO_WATERMARK
+#define CONFIG_ACCELEROMETER_FIFO_WATERMARK             16
+#endif
+
+// The depth of the LSM303 accelerometer's hardware FIFO.
+#define MICROBIT_ACCELEROMETER_FIFO_DEPTH               32
+
+// LSM303 accelerometer registers used to manage the FIFO.
+#define MICROBIT_ACCELEROMETER_FIFO_CTRL_REG3_A         0x22
+#define MICROBIT_ACCELEROMETER_FIFO_CTRL_REG4_A         0x23
+#define MICROBIT_ACCELEROMETER_FIFO_CTRL_REG5_A         0x24
+#define MICROBIT_ACCELEROMETER_FIFO_OUT_X_L_A           0x28
+#define MICROBIT_ACCELEROMETER_FIFO_FIFO_CTRL_REG_A     0x2E
+#define MICROBIT_ACCELEROMETER_FIFO_FIFO_SRC_REG_A      0x2F
+
+// Events
+#define MICROBIT_ACCELEROMETER_FIFO_EVT_DATA            1       // A batch of samples has been added to the buffer.
+
+// Status Flags
+#define MICROBIT_ACCELEROMETER_FIFO_STATUS_RUNNING      0x01
+
+namespace codal
+{
+    /**
+     * Batched reading of the on-board accelerometer, using the sensor's hardware FIFO.
+     *
+     * Once started, the sensor buffers samples itself and signals once the watermark is reached. All waiting samples
+     * are then read in a single I2C transfer, converted to milli-g, and appended to a ring buffer supplied by the caller,
+     * with one MICROBIT_ACCELEROMETER_FIFO_EVT_DATA event per batch rather than per sample.
+     *
+     * While batching, the sensor's data ready interrupt is disabled, so the usual Accelerometer readings are not updated.
+     * Only the LSM303 is supported.
+     */
+    class MicroBitAccelerometerFifo : public CodalComponent
+    {
+        Sample3D            *buffer;                // The caller supplied ring buffer.
+        int                 capacity;               // The number of samples the ring buffer can hold.
+        int                 head;                   // The index of the oldest sample in the ring buffer.
+        int                 count;                  // The number of samples in the ring buffer.
+        int                 fullScale;              // The full scale range of the sensor, in milli-g.
+        uint32_t            overruns;               // The number of samples lost, in the sensor or the ring buffer.
+        uint8_t             ctrlReg3;               // CTRL_REG3_A before batching started, to be restored.
+
+        public:
+
+        /**
+         * Constructor.
+         *
+         * @param buffer The ring buffer to store samples in.
+         * @param capacity The number of samples buffer can hold.
+         * @param id The ID of this component, used for its events.
+         */
+        MicroBitAccelerometerFifo(Sample3D *buffer, int capacity, uint16_t id = MICROBIT_ID_ACCELEROMETER_FIFO);
+
+        /**
+         * Destructor. Batching is stopped.
+         */
+        ~MicroBitAccelerometerFifo();
+
+        /**
+         * Starts batching samples, at the sensor's currently configured period and range.
+         *
+         * @param watermark The number of samples the sensor buffers before a batch is read, from 1 to 31.
+         * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the watermark is out of range,
+         * DEVICE_NOT_SUPPORTED if no LSM303 is present, or DEVICE_I2C_ERROR.
+         */
+        int start(int watermark = CONFIG_ACCELEROMETER_FIFO_WATERMARK);
+
+        /**
+         * Stops batching, and restores the sensor's normal data ready interrupt.
+         *
+         * @return DEVICE_OK on success, or DEVICE_I2C_ERROR.
+         */
+        int stop();
+
+        /**
+         * Determines if samples are being batched.
+         */
+        bool isRunning();
+
+        /**
+         * Reads all samples waiting in the sensor into the ring buffer, without waiting for the watermark.
+         * This is also done automatically whenever the sensor signals that a batch is ready.
+         *
+         * @return The number of samples read, or DEVICE_I2C_ERROR.
+         */
+        int drain();
+
+        /**
+         * Determines the number of samples waiting in the ring buffer.
+         */
+        int available();
+
+        /**
+         * Removes the oldest samples from the ring buffer.
+         *
+         * @param samples The array to copy samples into.
+         * @param length The maximum number of samples to copy.
+         * @return The number of samples copied.
+         */
+        int read(Sample3D *samples, int length);
+
+        /**
+         * Determines the number of samples lost, because the sensor's FIFO or the ring buffer was full.
+         */
+        uint32_t getOverruns();
+
+        /**
+         * Checks the sensor's interrupt line, and reads a batch if one is ready.
+         */
+        virtual void idleCallback() override;
+    };
+}
+
+#endif
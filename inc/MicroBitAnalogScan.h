@@ -0,0 +1,138 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef MICROBIT_ANALOG_SCAN_H
+#define MICROBIT_ANALOG_SCAN_H
+
+#include "CodalConfig.h"
+#include "CodalComponent.h"
+#include "DataStream.h"
+#include "NRF52ADC.h"
+#include "NRF52Pin.h"
+#include "MicroBitComponentIds.h"
+
+// The largest number of pins in a scan group. The SAADC has eight channels, one of which may be in use by the microphone.
+#ifndef CONFIG_MICROBIT_ANALOG_SCAN_MAX_PINS
+#define CONFIG_MICROBIT_ANALOG_SCAN_MAX_PINS            8
+#endif
+
+// Events
+#define MICROBIT_ANALOG_SCAN_EVT_COMPLETE               1       // The requested number of samples has been taken from every pin.
+
+// Status Flags
+#define MICROBIT_ANALOG_SCAN_STATUS_RUNNING             0x01
+#define MICROBIT_ANALOG_SCAN_STATUS_COMPLETE            0x02
+
+namespace codal
+{
+    class MicroBitAnalogScan;
+
+    /**
+     * Receives the stream of one ADC channel on behalf of a MicroBitAnalogScan.
+     */
+    class MicroBitAnalogScanSink : public DataSink
+    {
+        public:
+        MicroBitAnalogScan      *scan;              // The scan group this channel belongs to.
+        int                     index;              // The position of this channel in the scan group.
+
+        virtual int pullRequest() override;
+    };
+
+    /**
+     * Samples a group of analog pins together, at a fixed rate.
+     *
+     * Every pin in the group is added to the SAADC scan list, so the hardware converts them all in one scan per
+     * sample period and writes the results by EasyDMA into the ADC's double buffers. The processor is only involved
+     * once per DMA buffer, to interleave each block of results into the caller's buffer as frames of one sample per pin.
+     *
+     * The sample period of the ADC is shared by all of its channels, including the microphone.
+     */
+    class MicroBitAnalogScan : public CodalComponent
+    {
+        NRF52ADC                &adc;               // The ADC to sample with.
+        NRF52Pin                *pins[CONFIG_MICROBIT_ANALOG_SCAN_MAX_PINS];
+        NRF52ADCChannel         *channels[CONFIG_MICROBIT_ANALOG_SCAN_MAX_PINS];
+        MicroBitAnalogScanSink  sinks[CONFIG_MICROBIT_ANALOG_SCAN_MAX_PINS];
+        int                     written[CONFIG_MICROBIT_ANALOG_SCAN_MAX_PINS];
+        int                     pinCount;           // The number of pins in the group.
+        int16_t                 *buffer;            // The caller supplied buffer of interleaved samples.
+        int                     frames;             // The number of frames buffer can hold.
+        int                     period;             // The ADC sample period before the scan started, in microseconds.
+
+        public:
+
+        /**
+         * Constructor.
+         *
+         * @param adc The ADC to sample with.
+         * @param id The ID of this component, used for its events.
+         */
+        MicroBitAnalogScan(NRF52ADC &adc, uint16_t id = MICROBIT_ID_ANALOG_SCAN);
+
+        /**
+         * Destructor. Any scan in progress is stopped.
+         */
+        ~MicroBitAnalogScan();
+
+        /**
+         * Starts sampling the given pins. MICROBIT_ANALOG_SCAN_EVT_COMPLETE is raised once buffer is full.
+         *
+         * @param pins The pins to sample.
+         * @param pinCount The number of pins, from 1 to CONFIG_MICROBIT_ANALOG_SCAN_MAX_PINS.
+         * @param buffer The buffer to store samples in, as frames of pinCount samples. Samples are as delivered by each
+         * pin's ADC channel, in DATASTREAM_FORMAT_16BIT_SIGNED.
+         * @param frames The number of frames to take.
+         * @param rate The number of frames per second, or 0 to keep the ADC's current sample rate.
+         *
+         * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if any parameter is out of range, DEVICE_BUSY if a scan is
+         * already in progress, or DEVICE_NO_RESOURCES if the ADC has no channel free for a pin.
+         */
+        int start(NRF52Pin **pins, int pinCount, int16_t *buffer, int frames, int rate = 0);
+
+        /**
+         * Stops sampling, releasing the pins' ADC channels and restoring the ADC's sample rate.
+         */
+        void stop();
+
+        /**
+         * Determines if every requested sample has been taken.
+         */
+        bool isComplete();
+
+        /**
+         * Determines the number of complete frames in the buffer.
+         */
+        int getFrameCount();
+
+        /**
+         * Copies a block of samples from an ADC channel into the buffer.
+         *
+         * @param index The position of the channel in the scan group.
+         */
+        int receive(int index);
+    };
+}
+
+#endif
@@ -34,9 +34,12 @@ DEALINGS IN THE SOFTWARE.
 #include "StreamSplitter.h"
 #include "LevelDetectorSPL.h"
 #include "LowPassFilter.h"
+#include "StreamDecimator.h"
 
 // Status Flags
 #define MICROBIT_AUDIO_STATUS_DEEPSLEEP       0x0001
+#define MICROBIT_AUDIO_STATUS_PAUSED          0x0002
+#define MICROBIT_AUDIO_STATUS_MIC_READY       0x0004
 #define CONFIG_DEFAULT_MICROPHONE_GAIN        0.1f
 
 
@@ -45,6 +48,49 @@ DEALINGS IN THE SOFTWARE.
 #define CONFIG_AUDIO_MIXER_OUTPUT_LATENCY_US              (uint32_t) ((CONFIG_MIXER_BUFFER_SIZE/2) * (1000000.0f/44100.0f))
 #endif
 
+// Time the mixer must be silent before the PWM output is stopped to save power (milliseconds).
+// Output restarts as soon as any mixer channel has data. Zero keeps the output running at all times.
+#ifndef CONFIG_AUDIO_MIXER_IDLE_TIMEOUT
+#define CONFIG_AUDIO_MIXER_IDLE_TIMEOUT                   0
+#endif
+
+// Sample rate of the PWM output, in Hz. This is also the PWM carrier frequency, so should be well above the audible range.
+#ifndef CONFIG_AUDIO_OUTPUT_SAMPLE_RATE
+#define CONFIG_AUDIO_OUTPUT_SAMPLE_RATE                   44100
+#endif
+
+// Largest factor by which the mixer may reduce its output sample rate when only lower rate channels are playing.
+// The PWM repeats each sample to match, so that its carrier frequency is unchanged. 1 keeps the full rate at all times.
+#ifndef CONFIG_AUDIO_MAX_SAMPLE_RATE_DIVIDER
+#define CONFIG_AUDIO_MAX_SAMPLE_RATE_DIVIDER              4
+#endif
+
+// Sample rate of the microphone ADC channel, in Hz.
+#ifndef CONFIG_AUDIO_MIC_SAMPLE_RATE
+#define CONFIG_AUDIO_MIC_SAMPLE_RATE                      CONFIG_MIXER_DEFAULT_CHANNEL_SAMPLERATE
+#endif
+
+// Size of each block of microphone samples delivered by the ADC, in bytes. Smaller blocks reduce latency
+// at the cost of more frequent processing. Zero leaves the ADC driver default in place.
+#ifndef CONFIG_AUDIO_MIC_BLOCK_SIZE
+#define CONFIG_AUDIO_MIC_BLOCK_SIZE                       0
+#endif
+
+// If non-zero, the 8 bit microphone stream is produced by a single StreamDecimator stage that combines this many
+// ADC samples into each output sample, instead of by a StreamNormalizer. The level detector always reads the raw
+// splitter channel directly, so this only affects the processed (8 bit) stream.
+#ifndef CONFIG_AUDIO_MIC_DECIMATION
+#define CONFIG_AUDIO_MIC_DECIMATION                       0
+#endif
+
+// If non-zero, the microphone ADC channel and its processing pipeline (splitters, normaliser or decimator, and level
+// detector) are only created when first requested through getMicrophone(), getSplitter(), getRawSplitter() or
+// getLevelSPL(), so programs that never use the microphone pay no heap for it. The mic, splitter, rawSplitter and
+// levelSPL members are NULL until then. Zero creates the pipeline in the constructor.
+#ifndef CONFIG_AUDIO_MIC_DEMAND_INIT
+#define CONFIG_AUDIO_MIC_DEMAND_INIT                      0
+#endif
+
 namespace codal
 {
     /**
@@ -55,8 +101,9 @@ namespace codal
         public:
         static MicroBitAudio    *instance;      // Primary instance of MicroBitAudio, on demand activated.
         Mixer2                  mixer;          // Multi channel audio mixer
-        NRF52ADCChannel *mic;                   // Microphone ADC Channel from uBit.IO
-        StreamNormalizer        *processor;     // Stream Normaliser instance
+        NRF52ADCChannel *mic;                   // Microphone ADC Channel from uBit.IO (NULL until initMicrophone())
+        StreamNormalizer        *processor;     // Stream Normaliser instance (NULL if the decimator is in use)
+        StreamDecimator         *decimator;     // Stream Decimator instance (NULL if the normaliser is in use)
         StreamSplitter          *splitter;      // Stream Splitter instance (8bit normalized output)
         StreamSplitter          *rawSplitter;   // Stream Splitter instance (raw input)
         LevelDetectorSPL        *levelSPL;      // Level Detector SPL instance
@@ -77,6 +124,24 @@ namespace codal
 
         int micDriverTimeout;
 
+        /**
+         * Stops and releases the PWM output driver, if it is running.
+         */
+        void releaseOutput();
+
+        /**
+          * Catch events from the mixer, to stop the output after a period of silence and restart it on demand.
+          * @param MicroBitEvent
+          */
+        void onMixerEvent(MicroBitEvent);
+
+        /**
+          * Catch changes to the mixer's output rate, and have the PWM repeat each sample to match.
+          * Called immediately, from the context of the mixer, before the first buffer at the new rate is delivered.
+          * @param MicroBitEvent
+          */
+        void onMixerRateChange(MicroBitEvent);
+
         public:
         SoundExpressions soundExpressions;      // SoundExpression intepreter
         SoundOutputPin   virtualOutputPin;      // Virtual PWM channel (backward compatibility).
@@ -96,6 +161,41 @@ namespace codal
          */
         static void requestActivation();
 
+        /**
+         * Creates the microphone ADC channel and its processing pipeline, if this has not already been done.
+         *
+         * @return DEVICE_OK on success.
+         */
+        int initMicrophone();
+
+        /**
+         * Provides the microphone ADC channel, creating the microphone pipeline if necessary.
+         *
+         * @return The microphone ADC channel.
+         */
+        NRF52ADCChannel *getMicrophone();
+
+        /**
+         * Provides the splitter of the processed (8 bit) microphone stream, creating the microphone pipeline if necessary.
+         *
+         * @return The splitter of the processed microphone stream.
+         */
+        StreamSplitter *getSplitter();
+
+        /**
+         * Provides the splitter of the raw microphone stream, creating the microphone pipeline if necessary.
+         *
+         * @return The splitter of the raw microphone stream.
+         */
+        StreamSplitter *getRawSplitter();
+
+        /**
+         * Provides the sound pressure level detector, creating the microphone pipeline if necessary.
+         *
+         * @return The sound pressure level detector.
+         */
+        LevelDetectorSPL *getLevelSPL();
+
         /**
           * Catch events from the splitter
           * @param MicroBitEvent
@@ -32,6 +32,14 @@ DEALINGS IN THE SOFTWARE.
 
 #include "MicroBitBLEChar.h"
 
+// Characteristic property for values that are only kept up to date while the service is active.
+// With lazy activation, reads are authorised so that the first one activates the service.
+#if CONFIG_ENABLED(MICROBIT_BLE_LAZY_SERVICES)
+#define microbit_propREAD_LIVE      ( microbit_propREAD | microbit_propREADAUTH)
+#else
+#define microbit_propREAD_LIVE      microbit_propREAD
+#endif
+
 /**
   * Class definition for MicroBitBLEService.
   * Provides a base class for the BLE sevices.
@@ -91,8 +99,92 @@ class MicroBitBLEService
       * Set  params->data and params->length to update the value
       */
     virtual void onConfirmation( const microbit_ble_evt_hvc_t *params);
+
+    /**
+      * Callback. Invoked when queued notifications have been transmitted.
+      * The event is not specific to a characteristic, or to this service.
+      */
+    virtual void onNotificationComplete( const microbit_ble_evt_hvn_tx_complete_t *params);
+
+    /**
+      * Asks for writes and confirmations to be handled in a fiber, rather than in SoftDevice event context.
+      * Call from the constructor of a service whose callbacks raise events, allocate memory, or take a long time.
+      * Authorize requests, connection events and notification completions are still handled immediately.
+      */
+    void DeferEvents();
+
+    /**
+      * Invoked when the service is first used on a connection: when a client subscribes to, reads with
+      * authorisation or writes one of its characteristics, or on connection if MICROBIT_BLE_LAZY_SERVICES is disabled.
+      * Services start sensors and event listeners here, rather than in their constructor.
+      */
+    virtual void onActivate();
+
+    /**
+      * Invoked when the connection on which the service was activated closes.
+      */
+    virtual void onDeactivate();
+
+    /**
+      * Activates the service immediately if a device is already connected and MICROBIT_BLE_LAZY_SERVICES is disabled.
+      * Call at the end of the constructor of a service that implements onActivate().
+      */
+    void ActivateIfConnected();
     
     public:
+
+    /**
+      * Determines if the service has been activated on the current connection.
+      */
+    bool getActive() { return bs_active; }
+
+    /**
+      * Determines the number of GATT attributes the service occupies in the SoftDevice attribute table,
+      * including its declaration and every characteristic's declaration, value and descriptors.
+      */
+    int getAttributeCount() { return bs_last_handle ? bs_last_handle - bs_service_handle + 1 : 0; }
+
+    /**
+      * Determines the application RAM reserved for the service's characteristic values, in bytes.
+      */
+    int getValueBytes() { return bs_value_bytes; }
+
+    /**
+      * Determines if this service's writes and confirmations are handled in a fiber.
+      */
+    bool getDeferred() { return bs_deferred; }
+
+    /**
+      * Determines the ATT MTU negotiated with the connected device.
+      * @return the ATT MTU, in bytes. This is 23 until a larger MTU has been negotiated.
+      */
+    static uint16_t getATTMTU() { return bs_att_mtu; }
+
+    /**
+      * Records the ATT MTU negotiated with the connected device.
+      * @param mtu the ATT MTU, in bytes.
+      * @note Called by MicroBitBLEManager when the MTU changes, or a device disconnects.
+      */
+    static void setATTMTU( uint16_t mtu) { bs_att_mtu = mtu; }
+
+    /**
+      * Determines the largest characteristic value that can currently be sent in a single notification or indication.
+      * @return the maximum payload, in bytes. This is 20 until a larger MTU has been negotiated.
+      */
+    static uint16_t getMaxPayload() { return bs_att_mtu - 3; }
+
+    /**
+      * Determines the connection interval in use by the connected device.
+      * @return the connection interval, in milliseconds rounded up, or 0 if no device is connected.
+      */
+    static uint16_t getConnectionInterval() { return ( bs_conn_interval * 5 + 3) / 4; }
+
+    /**
+      * Records the connection interval in use by the connected device.
+      * @param interval the connection interval, in units of 1.25 milliseconds, or 0 if no device is connected.
+      * @note Called by MicroBitBLEManager when a device connects, disconnects or updates its connection parameters.
+      */
+    static void setConnectionInterval( uint16_t interval) { bs_conn_interval = interval; }
     
     microbit_gaphandle_t getConnectionHandle();
     
@@ -132,11 +224,26 @@ class MicroBitBLEService
     virtual void onAuthorizeRead(       const microbit_ble_evt_t *p_ble_evt);
     virtual void onAuthorizeWrite(      const microbit_ble_evt_t *p_ble_evt);
     virtual void onHVC(                 const microbit_ble_evt_t *p_ble_evt);
+    virtual void onHVNTxComplete(       const microbit_ble_evt_t *p_ble_evt);
+
+    private:
+
+    /**
+      * Activates the service, if it is not already active.
+      */
+    void activate();
 
     protected:
 
     uint8_t                     bs_uuid_type;
     microbit_servicehandle_t    bs_service_handle;
+    bool                        bs_deferred;
+    bool                        bs_active;
+    uint16_t                    bs_last_handle;
+    uint16_t                    bs_value_bytes;
+
+    static uint16_t             bs_att_mtu;
+    static uint16_t             bs_conn_interval;
 
     static const uint8_t        bs_base_uuid[16];
 };
@@ -31,12 +31,30 @@ DEALINGS IN THE SOFTWARE.
 #if CONFIG_ENABLED(DEVICE_BLE)
 
 #include "MicroBitBLEService.h"
+#include "MicroBitComponentIds.h"
 
 
 #ifndef MICROBIT_BLE_SERVICES_MAX
 #define MICROBIT_BLE_SERVICES_MAX 20
 #endif
 
+// The number of write and confirmation events that can be waiting for services that defer their handling to a fiber.
+#ifndef MICROBIT_BLE_SERVICES_DEFER_QUEUE
+#define MICROBIT_BLE_SERVICES_DEFER_QUEUE 4
+#endif
+
+// The largest event that can be deferred, in bytes. Larger events are handled immediately.
+#ifndef MICROBIT_BLE_SERVICES_DEFER_EVT_SIZE
+#define MICROBIT_BLE_SERVICES_DEFER_EVT_SIZE ( sizeof( microbit_ble_evt_t) + MICROBIT_BLE_MAX_PAYLOAD)
+#endif
+
+#define MICROBIT_BLE_SERVICES_EVT_DEFERRED      1
+
+// The total number of characteristics, across all services, in the attribute routing table.
+#ifndef MICROBIT_BLE_SERVICES_CHARACTERISTICS_MAX
+#define MICROBIT_BLE_SERVICES_CHARACTERISTICS_MAX 48
+#endif
+
 #ifndef MICROBIT_BLE_SERVICES_OBSERVER_PRIO
 #define MICROBIT_BLE_SERVICES_OBSERVER_PRIO 2
 #endif
@@ -67,11 +85,76 @@ class MicroBitBLEServices
 
     void AddService(    MicroBitBLEService *service);
     void RemoveService( MicroBitBLEService *service);
+
+    /**
+      * Adds the attribute handles of a newly created characteristic to the routing table.
+      * @param service the service that owns the characteristic.
+      * @param idx the index of the characteristic in the service.
+      */
+    void AddCharacteristic( MicroBitBLEService *service, int idx);
+
+    /**
+      * Finds the characteristic that an attribute handle belongs to.
+      * @param handle the attribute handle.
+      * @param idx set to the index of the characteristic in its service.
+      * @return the service that owns the attribute, or NULL if it isn't one of ours.
+      */
+    MicroBitBLEService *FindHandle( uint16_t handle, int *idx);
+
+    /**
+      * Starts the fiber that handles events for services that defer them, if it is not already running.
+      */
+    void StartDeferred();
+
+    /**
+      * Writes the attribute table and characteristic value RAM used by each service to DMESG.
+      */
+    void Report();
     
     void onBleEvent( microbit_ble_evt_t const * p_ble_evt);
 
+    private:
+
+    /**
+      * Queues an event for a service that defers its handling to a fiber.
+      * Called from SoftDevice event context, which is the only producer.
+      * @return true if the event was queued, or false if it must be handled immediately.
+      */
+    bool Defer( MicroBitBLEService *service, microbit_ble_evt_t const * p_ble_evt);
+
+    /**
+      * Handles queued events, then waits for more. The fiber is the only consumer.
+      */
+    static void deferredFiber( void *param);
+
+    public:
+
+    // A range of attribute handles owned by one characteristic, from its declaration to its last descriptor.
+    typedef struct
+    {
+        uint16_t             start;
+        uint16_t             end;
+        MicroBitBLEService   *service;
+        int                  idx;
+    } bs_handle_range_t;
+
     int                  bs_services_count;
     MicroBitBLEService   *bs_services[ MICROBIT_BLE_SERVICES_MAX];
+
+    int                  bs_ranges_count;
+    bs_handle_range_t    bs_ranges[ MICROBIT_BLE_SERVICES_CHARACTERISTICS_MAX];     // Sorted by start handle.
+
+    // An event waiting to be handled by the deferred fiber.
+    typedef struct
+    {
+        MicroBitBLEService   *service;                                              // NULL if the service has been removed.
+        uint32_t             evt[ ( MICROBIT_BLE_SERVICES_DEFER_EVT_SIZE + 3) / 4];
+    } bs_deferred_t;
+
+    bs_deferred_t        bs_deferred[ MICROBIT_BLE_SERVICES_DEFER_QUEUE + 1];
+    volatile uint8_t     bs_deferred_head;                                          // Written only in SoftDevice event context.
+    volatile uint8_t     bs_deferred_tail;                                          // Written only by the deferred fiber.
+    bool                 bs_deferred_fiber;
 };
 
 
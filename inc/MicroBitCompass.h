@@ -30,6 +30,10 @@ DEALINGS IN THE SOFTWARE.
 #include "CoordinateSystem.h"
 #include "MicroBitAccelerometer.h"
 
+// LSM303 magnetometer status register, and its new data available flag.
+#define MICROBIT_COMPASS_LSM303_STATUS_REG_M            0x67
+#define MICROBIT_COMPASS_LSM303_ZYXDA                   0x08
+
 namespace codal
 {
     /**
@@ -61,6 +65,15 @@ namespace codal
          */
         static Compass& autoDetect(MicroBitI2C &i2c);
 
+        /**
+         * MicroBitIrqDispatcher source for the combined IRQ line. Reads the LSM303 status register, and
+         * if a new sample is available, updates the driver.
+         *
+         * @param context Unused.
+         * @return MICROBIT_IRQ_HANDLED if a sample was read, MICROBIT_IRQ_NONE otherwise.
+         */
+        static int irqDataReady(void *context);
+
         /**
          * Configures the device for the sample rate defined
          * in this object. The nearest values are chosen to those defined
@@ -33,8 +33,55 @@ DEALINGS IN THE SOFTWARE.
 #include "MicroBitDisplay.h"
 #include "MicroBitStorage.h"
 
+// The number of well spaced samples required before an online calibration is applied.
+#ifndef CONFIG_COMPASS_CALIBRATOR_ONLINE_MIN_SAMPLES
+#define CONFIG_COMPASS_CALIBRATOR_ONLINE_MIN_SAMPLES        32
+#endif
+
+// The weight given to past samples on each update of the online fit (0..1). Lower values track drift faster.
+#ifndef CONFIG_COMPASS_CALIBRATOR_ONLINE_FORGETTING
+#define CONFIG_COMPASS_CALIBRATOR_ONLINE_FORGETTING         0.998f
+#endif
+
+// The minimum distance between samples used by the online fit, as a fraction of the field strength.
+#ifndef CONFIG_COMPASS_CALIBRATOR_ONLINE_SPACING
+#define CONFIG_COMPASS_CALIBRATOR_ONLINE_SPACING            0.1f
+#endif
+
+// The largest ratio between the longest and shortest axes of a plausible fit.
+#ifndef CONFIG_COMPASS_CALIBRATOR_ONLINE_MAX_ELLIPTICITY
+#define CONFIG_COMPASS_CALIBRATOR_ONLINE_MAX_ELLIPTICITY    1.5f
+#endif
+
+// The number of samples used by the online fit between updates of the compass calibration.
+#ifndef CONFIG_COMPASS_CALIBRATOR_ONLINE_UPDATE_INTERVAL
+#define CONFIG_COMPASS_CALIBRATOR_ONLINE_UPDATE_INTERVAL    8
+#endif
+
+// The distance the centre of the online fit moves before the calibration is saved again, as a fraction of the field strength.
+#ifndef CONFIG_COMPASS_CALIBRATOR_ONLINE_PERSIST_SHIFT
+#define CONFIG_COMPASS_CALIBRATOR_ONLINE_PERSIST_SHIFT      0.05f
+#endif
+
 namespace codal
 {
+    /**
+     * State of an online, recursive least squares fit of an axis aligned ellipsoid to compass samples.
+     * Samples are normalised by the strength of the first, to keep the fit well conditioned in single precision.
+     */
+    struct CompassCalibrationFit
+    {
+        float                   theta[6];           // Coefficients of Ax^2 + By^2 + Cz^2 + Dx + Ey + Fz = 1.
+        float                   P[6][6];            // The covariance of the coefficients.
+        float                   minimum[3];         // The smallest normalised sample seen on each axis.
+        float                   maximum[3];         // The largest normalised sample seen on each axis.
+        float                   last[3];            // The last normalised sample used.
+        float                   norm;               // The strength of the first sample, used to normalise the rest.
+        float                   persisted[3];       // The normalised centre when the calibration was last saved.
+        uint32_t                samples;            // The number of samples used.
+        bool                    saved;              // true if this fit has been saved to storage.
+    };
+
     /**
      * Class definition for an interactive compass calibration algorithm.
      *
@@ -53,6 +100,7 @@ namespace codal
         Accelerometer&          accelerometer;
         MicroBitDisplay&        display;
         MicroBitStorage*        storage;
+        CompassCalibrationFit*  online;             // The online calibration state, or NULL if disabled.
 
         public:
 
@@ -101,6 +149,33 @@ namespace codal
       * This function is, by design, synchronous and only returns once calibration is complete.
       */
     void calibrateUX(MicroBitEvent);
+
+    /**
+      * Enables or disables online calibration. Once enabled, every new compass sample refines an ellipsoid fit in the
+      * background, and the compass calibration is updated (and saved, if storage is available) whenever a plausible
+      * fit covering enough of the sphere is found. The interactive calibrateUX routine is then skipped if such a fit exists.
+      *
+      * @param enabled true to enable online calibration, false to disable it and discard its state.
+      *
+      * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if the state could not be allocated.
+      */
+    int setOnlineCalibration(bool enabled);
+
+    /**
+      * Determines if online calibration is enabled.
+      */
+    bool isOnlineCalibrationEnabled();
+
+    /**
+      * Discards all samples gathered by online calibration, and starts a new fit.
+      * The current compass calibration is unchanged.
+      */
+    void resetOnlineCalibration();
+
+    /**
+      * Determines the number of samples the online calibration has used since it was enabled or reset.
+      */
+    int getOnlineSampleCount();
      /**
       * Calculates an independent X, Y, Z scale factor and centre for a given set of data points,
       * assumed to be on a bounding sphere
@@ -141,6 +216,17 @@ namespace codal
      */
     static Sample3D approximateCentre(Sample3D *data, int samples);
 
+    /*
+     * Performs a linear least squares fit of a sphere to the given data points.
+     *
+     * @param data an array containing sample points
+     * @param samples the number of sample points in the 'data' array.
+     * @param centre the fitted centre point, if successful.
+     *
+     * @return true on success, or false if the points do not define a sphere (e.g. they are coplanar).
+     */
+    static bool fitSphere(Sample3D *data, int samples, Sample3D &centre);
+
     /**
      * Calculates an independent scale factor for X,Y and Z axes that places the given data points on a bounding sphere
      *
@@ -153,6 +239,21 @@ namespace codal
      * to the surface of the containing sphere.
      */
     static CompassCalibration spherify(Sample3D centre, Sample3D *data, int samples);
+
+    /**
+     * Event handler, called when a new compass sample is available.
+     * Updates the online fit, and applies it to the compass periodically.
+     */
+    void onCompassData(MicroBitEvent);
+
+    /**
+     * Derives a calibration from the online fit.
+     *
+     * @param result The calibration to populate.
+     *
+     * @return true if the fit is plausible and the samples cover enough of the sphere, false otherwise.
+     */
+    bool getOnlineCalibration(CompassCalibration &result);
 };
 }
 
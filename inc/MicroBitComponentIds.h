@@ -0,0 +1,58 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef MICROBIT_COMPONENT_IDS_H
+#define MICROBIT_COMPONENT_IDS_H
+
+/**
+ * Component IDs used by the micro:bit specific drivers in this library.
+ *
+ * Every component that raises events on the message bus needs an ID of its own, or its listeners will be woken by
+ * another component's events. Allocate new IDs here, in order, rather than in the component's own header.
+ *
+ * IDs already taken elsewhere: 1000 and 1200 (bluetooth/ExternalEvents.h), 3001 (DEVICE_ID_MICROPHONE),
+ * 3010-3019 (SoundEmojiSynthesizer.h) and 3030 (DEVICE_ID_MIXER).
+ */
+#define DEVICE_ID_SPECTRUM_ANALYZER             3031
+#define DEVICE_ID_SAMPLE_PLAYER                 3032
+#define MICROBIT_ID_ACCELEROMETER_FIFO          3033
+#define MICROBIT_ID_IRQ_DISPATCHER              3034
+#define MICROBIT_ID_ORIENTATION                 3035
+#define MICROBIT_ID_ANALOG_SCAN                 3036
+#define MICROBIT_ID_PIN_CAPTURE                 3037
+#define MICROBIT_ID_EVENT_THROTTLE              3038
+#define MICROBIT_ID_IO_PIN_SERVICE              3039
+#define MICROBIT_RADIO_ID_DATAGRAM_DELIVERED    3040
+#define MICROBIT_RADIO_ID_DATAGRAM_FAILED       3041
+#define MICROBIT_ID_BLE_LED_SERVICE             3042
+#define MICROBIT_ID_EVENT_TRACE                 3043
+#define MICROBIT_ID_SERIAL_QUEUE                3044
+#define MICROBIT_ID_RADIO_BRIDGE                3045
+#define MICROBIT_ID_NEOPIXEL                    3046
+#define MICROBIT_ID_TOUCH_SCANNER               3047
+#define MICROBIT_ID_BLE_SERVICES                3048
+#define MICROBIT_ID_BLE_SCANNER                 3049
+#define MICROBIT_ID_RADIO_INTERNAL              3050    // Timer events private to MicroBitRadio and its protocol handlers.
+
+#endif
@@ -130,6 +130,23 @@
     #define MBFS_CACHE_SIZE        0
 #endif
 
+//
+// Number of directories for which the file system holds an in-RAM hash index of filenames.
+// Each index holds two pointers for every file in the directory. Must be at least one.
+//
+#ifndef MBFS_DIRECTORY_INDEX_COUNT
+    #define MBFS_DIRECTORY_INDEX_COUNT  2
+#endif
+
+//
+// Interval, in milliseconds, between the steps of the background compaction of deleted blocks.
+// Each step refreshes at most one physical page. Set to zero to disable background compaction,
+// such that deleted blocks are only reclaimed when the file system runs out of unused blocks.
+//
+#ifndef MBFS_COMPACTION_PERIOD
+    #define MBFS_COMPACTION_PERIOD  500
+#endif
+
 // Address of the end of the current program in FLASH memory.
 // This is recorded by the C/C++ linker, but the symbol name varies depending on which compiler is used.
 #if defined(__arm)
@@ -227,6 +244,38 @@
     #define MICROBIT_BLE_ADVERTISING_INTERVAL        50
 #endif
 
+// Define the number of additional advertising sets that can be added with MicroBitBLEManager::addAdvertisingSet()
+#ifndef MICROBIT_BLE_ADVERTISING_SETS
+    #define MICROBIT_BLE_ADVERTISING_SETS           2
+#endif
+
+// Define the maximum length of the data in an additional advertising set, in bytes.
+// Legacy advertising sets are limited to 31 bytes; extended advertising sets may use up to 255.
+#ifndef MICROBIT_BLE_ADVERTISING_DATA_MAX
+    #define MICROBIT_BLE_ADVERTISING_DATA_MAX       64
+#endif
+
+// Define the default time each advertising set is broadcast for before moving to the next, in ms
+#ifndef MICROBIT_BLE_ADVERTISING_DWELL
+    #define MICROBIT_BLE_ADVERTISING_DWELL          250
+#endif
+
+// Define the Bluetooth company identifier placed in connectionless telemetry advertising (MicroBitBLEManager::startTelemetry).
+// 0xFFFF is reserved by the Bluetooth SIG for testing; products should use their own.
+#ifndef MICROBIT_BLE_TELEMETRY_COMPANY_ID
+    #define MICROBIT_BLE_TELEMETRY_COMPANY_ID       0xFFFF
+#endif
+
+// Define the default period at which connectionless telemetry readings are refreshed, in ms
+#ifndef MICROBIT_BLE_TELEMETRY_PERIOD
+    #define MICROBIT_BLE_TELEMETRY_PERIOD           1000
+#endif
+
+// Define the default advertising interval used for connectionless telemetry, in ms
+#ifndef MICROBIT_BLE_TELEMETRY_INTERVAL
+    #define MICROBIT_BLE_TELEMETRY_INTERVAL         500
+#endif
+
 // Define the default maximum number of BLE bonds
 #ifndef MICROBIT_BLE_MAXIMUM_BONDS
     #define MICROBIT_BLE_MAXIMUM_BONDS              4
@@ -268,6 +317,26 @@
 #define MICROBIT_BLE_UTILITY_SERVICE 0
 #endif
 
+// Enable/Disable lazy activation of BLE services.
+// When enabled, services start their sensors and event listeners only once a connected client
+// subscribes to, reads or writes one of their characteristics, rather than on every connection.
+// Set '1' to enable.
+#ifndef MICROBIT_BLE_LAZY_SERVICES
+#define MICROBIT_BLE_LAZY_SERVICES 1
+#endif
+
+// The default period at which MicroBitSensorService samples its sensors, in milliseconds.
+#ifndef MICROBIT_BLE_SENSOR_PERIOD
+#define MICROBIT_BLE_SENSOR_PERIOD 20
+#endif
+
+// Enable/Disable the BLE scanner: MicroBitBLEScanner
+// This needs a SoftDevice with the observer role, such as S140. The default S113 is peripheral only.
+// Set '1' to enable.
+#ifndef MICROBIT_BLE_SCANNER
+#define MICROBIT_BLE_SCANNER 0
+#endif
+
 // Enable/Disable Nordic Firmware style BLE based UART implimentation.
 // The default codal implimentation reverses the TX/RX ids  
 // Set to '1' to enable
@@ -275,6 +344,73 @@
     #define MICROBIT_BLE_NORDIC_STYLE_UART 0
 #endif
 
+// The largest ATT MTU to negotiate with a connected device, in bytes.
+// Each notification, indication or write can carry up to the ATT MTU - 3 bytes of data. Larger values
+// need more SoftDevice RAM, and are limited to NRF_SDH_BLE_GATT_MAX_MTU_SIZE in the SDK configuration.
+// 23 is the BLE 4.0 default, and disables MTU exchange.
+#ifndef MICROBIT_BLE_ATT_MTU
+    #define MICROBIT_BLE_ATT_MTU 247
+#endif
+
+// The link layer data length to request with BLE 4.2 data length extension, in bytes (27..251).
+// An ATT MTU of 247 fits in a single 251 byte link layer packet.
+#ifndef MICROBIT_BLE_DATA_LENGTH
+    #define MICROBIT_BLE_DATA_LENGTH 251
+#endif
+
+// The largest characteristic value that can be sent in a single packet, for sizing buffers.
+#define MICROBIT_BLE_MAX_PAYLOAD                    (MICROBIT_BLE_ATT_MTU - 3)
+
+// The connection mode to use outside bulk transfers (see MicroBitBLEManager::setConnectionMode()).
+// 0: MICROBIT_BLE_CONNECTION_DEFAULT, 10-20ms interval
+// 2: MICROBIT_BLE_CONNECTION_IDLE, 100-200ms interval with slave latency, for lower power while connected
+#ifndef MICROBIT_BLE_CONNECTION_MODE
+    #define MICROBIT_BLE_CONNECTION_MODE 0
+#endif
+
+// The time after the last bulk transfer before a connection returns to MICROBIT_BLE_CONNECTION_MODE, in milliseconds.
+#ifndef MICROBIT_BLE_BULK_TIMEOUT
+    #define MICROBIT_BLE_BULK_TIMEOUT 2000
+#endif
+
+// Hold back garbage collection of the bond storage while a device is connected.
+// Collection rewrites whole flash pages, and the bond and system attribute writes waiting on it are
+// committed together once the connection closes, rather than competing with it for radio time.
+// Set to 1 to enable, 0 to collect as soon as the peer manager finds storage full.
+#ifndef MICROBIT_BLE_DEFER_FLASH_CLEAN
+    #define MICROBIT_BLE_DEFER_FLASH_CLEAN 1
+#endif
+
+// The longest a connected device can hold back garbage collection of the bond storage, in milliseconds.
+#ifndef MICROBIT_BLE_FLASH_CLEAN_TIMEOUT
+    #define MICROBIT_BLE_FLASH_CLEAN_TIMEOUT 30000
+#endif
+
+// Enable/Disable notifications on the BLE UART TX characteristic.
+// Indications must be confirmed by the peer before the next packet is sent, which limits throughput
+// to one packet per connection interval. A peer that subscribes to notifications instead has as many
+// packets queued per connection event as the SoftDevice will accept.
+// Set to '1' to enable
+#ifndef MICROBIT_BLE_UART_NOTIFY
+    #define MICROBIT_BLE_UART_NOTIFY 0
+#endif
+
+// The number of notifications the SoftDevice can queue on each connection.
+// Larger values allow more packets per connection event, at the cost of SoftDevice RAM.
+#ifndef MICROBIT_BLE_HVN_TX_QUEUE_SIZE
+#if CONFIG_ENABLED(MICROBIT_BLE_UART_NOTIFY)
+    #define MICROBIT_BLE_HVN_TX_QUEUE_SIZE 6
+#else
+    #define MICROBIT_BLE_HVN_TX_QUEUE_SIZE 1
+#endif
+#endif
+
+// The number of micro:bit events the BLE event service can hold while waiting for the SoftDevice to accept them.
+// Events that arrive while the queue is full are dropped, and counted (see MicroBitEventService::getOverflowCount()).
+#ifndef MICROBIT_BLE_EVENT_SERVICE_QUEUE_SIZE
+    #define MICROBIT_BLE_EVENT_SERVICE_QUEUE_SIZE 32
+#endif
+
 // Configure the radio maximum packet size
 // TODO: Update the range here once issue codal-microbit-v2#383 has been resolved
 // https://github.com/lancaster-university/codal-microbit-v2/issues/383
@@ -298,6 +434,46 @@
     #define MICROBIT_USB_SERIAL_WAKE 0
 #endif
 
+// Record the time taken by each phase of MicroBit::init() into noinit memory.
+// The profile can be printed with uBit.printBootProfile().
+//
+// Set to '1' to enable
+#ifndef MICROBIT_BOOT_PROFILE
+    #define MICROBIT_BOOT_PROFILE 1
+#endif
+
+// Shorten MicroBit::init() for devices that wake, take a reading and sleep again:
+// - the power on delay for the interface chip runs concurrently with the rest of init(), and is only awaited
+//   before the interface chip is first used.
+// - CodalComponent::init() is deferred until a component is first listened to, or the scheduler first idles.
+// - the pairing mode probe only waits for the buttons to settle if both are held down.
+// - init() returns as soon as the Bluetooth stack is running, without descheduling.
+//
+// Set to '1' to enable
+#ifndef MICROBIT_FAST_BOOT
+    #define MICROBIT_FAST_BOOT 0
+#endif
+
+// Run timing critical code marked MICROBIT_RAMFUNC (radio interrupt handlers, display refresh and the audio
+// mixer inner loops) from RAM, for consistent interrupt latency free of flash wait states and cache misses.
+// Such code is linked into the .data section, so is copied to RAM along with initialised data at startup.
+// Costs a few kilobytes of RAM.
+//
+// Set to '0' to leave everything in flash.
+#ifndef MICROBIT_CODE_IN_RAM
+    #define MICROBIT_CODE_IN_RAM 1
+#endif
+
+#if CONFIG_ENABLED(MICROBIT_CODE_IN_RAM)
+    #define MICROBIT_RAMFUNC __attribute__((noinline, long_call, section(".ramfunc")))
+#else
+    #define MICROBIT_RAMFUNC
+#endif
+
+// Code marked MICROBIT_COLDFUNC only runs once, or rarely (initialisation, diagnostics), and is placed at the end of
+// flash so that it does not share instruction cache lines with code that runs often.
+#define MICROBIT_COLDFUNC __attribute__((cold, section(".coldtext")))
+
 #endif
 
 // Defines default behaviour of triple-tap-reset-to-pair feature.
@@ -28,6 +28,7 @@ DEALINGS IN THE SOFTWARE.
 #include "codal-core/inc/types/Event.h"
 #include "CodalDevice.h"
 #include "MicroBitConfig.h"
+#include "MicroBitRandom.h"
 
 #define MICROBIT_NAME_LENGTH                    5
 #define MICROBIT_NAME_CODE_LETTERS              5
@@ -67,6 +68,19 @@ namespace codal
          * @endcode
          */
        virtual int seedRandom(uint32_t seed) override;
+
+       /**
+         * Generate a random number in the given range, from the default pseudo random stream, without modulo bias.
+         *
+         * @param max the upper range to generate a number for. This number cannot be negative.
+         *
+         * @return A random, natural number between 0 and the max-1. Or DEVICE_INVALID_PARAMETER if max is <= 0.
+         *
+         * @code
+         * uBit.random(200); //a number between 0 and 199
+         * @endcode
+         */
+       int random(int max);
     };
 
     /**
@@ -125,8 +139,8 @@ namespace codal
 
     /**
      * Generate a random number in the given range.
-     * We use a simple Galois LFSR random number generator here,
-     * as a Galois LFSR is sufficient for our applications, and much more lightweight
+     * We use a xoshiro128++ pseudo random number generator here (see MicroBitRandom.h),
+     * as it is sufficient for our applications, and much more lightweight
      * than the hardware random number generator built int the processor, which takes
      * a long time and uses a lot of energy.
      *
@@ -146,16 +160,15 @@ namespace codal
     /**
      * Seed the random number generator (RNG).
      *
-     * This function uses the NRF51822's in built cryptographic random number generator to seed a Galois LFSR.
-     * We do this as the hardware RNG is relatively high power, and is locked out by the BLE stack internally,
-     * with a less than optimal application interface. A Galois LFSR is sufficient for our
-     * applications, and much more lightweight.
+     * This function uses the NRF52833's in built cryptographic random number generator to seed the pseudo random streams.
+     * We do this as the hardware RNG is relatively high power, and is shared with the BLE stack.
+     * A xoshiro128++ generator is sufficient for our applications, and much more lightweight.
      */
     void microbit_seed_random();
 
     /**
      * Seed the pseudo random number generator (RNG) using the given 32-bit value.
-     * This function does not use the NRF51822's in built cryptographic random number generator.
+     * This function does not use the NRF52833's in built cryptographic random number generator.
      *
      * @param seed The value to use as a seed.
      */
@@ -30,6 +30,17 @@ DEALINGS IN THE SOFTWARE.
 #include "codal-core/inc/types/Event.h"
 #include "NRF52LedMatrix.h"
 #include "AnimatedDisplay.h"
+#include "ManagedString.h"
+#include "Image.h"
+
+// The longest string, in characters, that scrollStrip() prerenders. Each character takes 30 bytes.
+// Longer strings are scrolled by AnimatedDisplay::scroll() instead.
+#ifndef CONFIG_MICROBIT_DISPLAY_STRIP_MAX_LENGTH
+#define CONFIG_MICROBIT_DISPLAY_STRIP_MAX_LENGTH    64
+#endif
+
+// The number of blank columns between characters in a prerendered strip.
+#define MICROBIT_DISPLAY_STRIP_SPACING              1
 
 namespace codal
 {
@@ -56,6 +67,68 @@ namespace codal
          * Destructor.
          */
         ~MicroBitDisplay();
+
+        /**
+         * Scrolls the given string across the display, from right to left, blocking until it has gone.
+         *
+         * Unlike AnimatedDisplay::scroll(), the whole string is rendered into a single strip once, and each step
+         * of the scroll is a copy of a window of that strip into the display image. The strip is kept, so scrolling
+         * the same string again renders nothing. Strings longer than CONFIG_MICROBIT_DISPLAY_STRIP_MAX_LENGTH
+         * are scrolled with AnimatedDisplay::scroll().
+         *
+         * @param s The string to scroll.
+         * @param delay The time between each step of the scroll, in milliseconds.
+         * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the delay is not positive.
+         *
+         * @code
+         * display.scrollStrip("TICKER: 21C 54%");
+         * @endcode
+         */
+        int scrollStrip(ManagedString s, int delay = DEFAULT_SCROLL_SPEED);
+
+        /**
+         * Scrolls the given string across the display, from right to left, without blocking.
+         * A DISPLAY_EVT_ANIMATION_COMPLETE event is raised once the string has gone.
+         *
+         * @param s The string to scroll.
+         * @param delay The time between each step of the scroll, in milliseconds.
+         * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the delay is not positive.
+         */
+        int scrollStripAsync(ManagedString s, int delay = DEFAULT_SCROLL_SPEED);
+
+        /**
+         * Stops any scroll started by scrollStrip() or scrollStripAsync(), leaving the display as it is.
+         */
+        void stopScrollStrip();
+
+        private:
+
+        ManagedString   stripText;          // The string held in strip.
+        Image           strip;              // The prerendered strip, one character every BITMAP_FONT_WIDTH + MICROBIT_DISPLAY_STRIP_SPACING columns.
+        int             stripDelay;         // The time between each step of the scroll, in milliseconds.
+        uint16_t        stripGeneration;    // Incremented each time a scroll starts or stops, so that an older scroll can see it is no longer wanted.
+        uint16_t        stripClaimed;       // The generation of the scroll most recently started, so that it is only performed once.
+
+        /**
+         * Renders the given string into strip, unless it is there already.
+         *
+         * @param s The string to render.
+         */
+        void renderStrip(ManagedString s);
+
+        /**
+         * Performs a scroll of strip across the display, unless it is superseded.
+         *
+         * @param generation The value of stripGeneration when the scroll was started.
+         */
+        void runStrip(uint16_t generation);
+
+        /**
+         * Body of the fiber that performs scrollStripAsync().
+         *
+         * @param display The MicroBitDisplay to scroll.
+         */
+        static void stripFiber(void *display);
     };
 }
 
@@ -0,0 +1,174 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef MICROBIT_ENERGY_H
+#define MICROBIT_ENERGY_H
+
+#include "CodalConfig.h"
+
+// Estimate the energy used by each subsystem, from the time it spends active and the measured supply voltage.
+// Components report their transitions between active and idle, which adds a timer read to each, so this is disabled by default.
+#ifndef CONFIG_MICROBIT_ENERGY_ACCOUNTING
+#define CONFIG_MICROBIT_ENERGY_ACCOUNTING 0
+#endif
+
+// The supply voltage assumed when the interface chip cannot provide one (millivolts).
+#ifndef CONFIG_MICROBIT_ENERGY_DEFAULT_MILLIVOLTS
+#define CONFIG_MICROBIT_ENERGY_DEFAULT_MILLIVOLTS 3300
+#endif
+
+// The modelled current drawn by each subsystem while active, over and above the idle board (microamps).
+// These are typical figures, and should be calibrated against a meter with setEnergyModel() for accurate attribution.
+#ifndef CONFIG_MICROBIT_ENERGY_CURRENT_CPU
+#define CONFIG_MICROBIT_ENERGY_CURRENT_CPU      3000    // The processor running from FLASH at 64MHz.
+#endif
+
+#ifndef CONFIG_MICROBIT_ENERGY_CURRENT_RADIO
+#define CONFIG_MICROBIT_ENERGY_CURRENT_RADIO    6500    // The transceiver powered up, receiving or transmitting at 0dBm.
+#endif
+
+#ifndef CONFIG_MICROBIT_ENERGY_CURRENT_DISPLAY
+#define CONFIG_MICROBIT_ENERGY_CURRENT_DISPLAY  10000   // One row of the LED matrix strobed at full brightness.
+#endif
+
+#ifndef CONFIG_MICROBIT_ENERGY_CURRENT_AUDIO
+#define CONFIG_MICROBIT_ENERGY_CURRENT_AUDIO    20000   // The PWM output running, driving the speaker.
+#endif
+
+#ifndef CONFIG_MICROBIT_ENERGY_CURRENT_FLASH
+#define CONFIG_MICROBIT_ENERGY_CURRENT_FLASH    5000    // The interface chip servicing a flash storage transaction.
+#endif
+
+// The subsystems whose energy is accounted for.
+#define MICROBIT_ENERGY_CPU                 0
+#define MICROBIT_ENERGY_RADIO               1
+#define MICROBIT_ENERGY_DISPLAY             2
+#define MICROBIT_ENERGY_AUDIO               3
+#define MICROBIT_ENERGY_FLASH               4
+#define MICROBIT_ENERGY_SUBSYSTEMS          5
+
+// Report a subsystem becoming active or idle, or active for the duration of a scope. Both compile to nothing
+// unless CONFIG_MICROBIT_ENERGY_ACCOUNTING is enabled.
+#if CONFIG_ENABLED(CONFIG_MICROBIT_ENERGY_ACCOUNTING)
+#define MICROBIT_ENERGY_STATE(subsystem, active)    codal::microbit_energy_state(subsystem, active)
+#define MICROBIT_ENERGY_SCOPE(subsystem)            codal::MicroBitEnergyScope _energyScope(subsystem)
+#else
+#define MICROBIT_ENERGY_STATE(subsystem, active)    ((void)0)
+#define MICROBIT_ENERGY_SCOPE(subsystem)            ((void)0)
+#endif
+
+namespace codal
+{
+    /**
+      * The energy attributed to one subsystem since the accounts were last reset.
+      */
+    struct MicroBitEnergyUsage
+    {
+        const char          *name;                  // The name of the subsystem.
+        uint32_t            current;                // The modelled current drawn while active, in microamps.
+        uint32_t            activations;            // The number of times the subsystem became active.
+        CODAL_TIMESTAMP     activeTime;             // The total time spent active, in microseconds.
+        uint64_t            energy;                 // The energy used while active, in microjoules.
+    };
+
+    /**
+      * The energy accounts of all subsystems.
+      */
+    struct MicroBitEnergyReport
+    {
+        CODAL_TIMESTAMP     period;                 // The time covered by the accounts, in microseconds.
+        uint32_t            milliVolts;             // The most recently sampled supply voltage.
+        uint32_t            samples;                // The number of supply voltage samples taken.
+        uint64_t            energy;                 // The total energy of all subsystems, in microjoules.
+        MicroBitEnergyUsage subsystems[MICROBIT_ENERGY_SUBSYSTEMS];
+    };
+
+    /**
+      * Accounts for a subsystem as active for the duration of its scope. Use MICROBIT_ENERGY_SCOPE(subsystem),
+      * which compiles to nothing unless CONFIG_MICROBIT_ENERGY_ACCOUNTING is enabled.
+      */
+    class MicroBitEnergyScope
+    {
+        int                 subsystem;
+
+        public:
+
+        /**
+          * Constructor. Marks the subsystem active.
+          *
+          * @param subsystem One of MICROBIT_ENERGY_*.
+          */
+        MicroBitEnergyScope(int subsystem);
+
+        /**
+          * Destructor. Marks the subsystem idle.
+          */
+        ~MicroBitEnergyScope();
+    };
+
+    /**
+      * Records a subsystem becoming active or idle. Reporting the state the subsystem is already in has no effect,
+      * so callers need not track it themselves. Safe to call from interrupt context.
+      *
+      * @param subsystem One of MICROBIT_ENERGY_*.
+      * @param active true if the subsystem is now drawing its modelled current, false otherwise.
+      */
+    void microbit_energy_state(int subsystem, bool active);
+
+    /**
+      * Converts the time each subsystem has spent active since the previous sample into energy, at the given supply voltage.
+      * MicroBitPowerManager calls this whenever it reads the power telemetry of the interface chip.
+      *
+      * @param milliVolts The supply voltage, or zero to use CONFIG_MICROBIT_ENERGY_DEFAULT_MILLIVOLTS.
+      */
+    void microbit_energy_sample(uint32_t milliVolts);
+
+    /**
+      * Sets the modelled current drawn by a subsystem while active. Energy already accounted for is unchanged.
+      *
+      * @param subsystem One of MICROBIT_ENERGY_*.
+      * @param microAmps The current drawn, in microamps.
+      *
+      * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the subsystem is unknown, or DEVICE_NOT_SUPPORTED
+      *         if CONFIG_MICROBIT_ENERGY_ACCOUNTING is disabled.
+      */
+    int microbit_energy_set_current(int subsystem, uint32_t microAmps);
+
+    /**
+      * Retrieves the energy accounts of all subsystems. Time spent active since the last sample is costed at the
+      * most recently sampled voltage.
+      *
+      * @param report The structure to fill in.
+      *
+      * @return DEVICE_OK on success, or DEVICE_NOT_SUPPORTED if CONFIG_MICROBIT_ENERGY_ACCOUNTING is disabled.
+      */
+    int microbit_energy_get_report(MicroBitEnergyReport &report);
+
+    /**
+      * Clears the energy accounts. Subsystems that are active remain so, and are accounted for from now.
+      */
+    void microbit_energy_reset();
+}
+
+#endif
@@ -0,0 +1,142 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef MICROBIT_EVENT_THROTTLE_H
+#define MICROBIT_EVENT_THROTTLE_H
+
+#include "CodalConfig.h"
+#include "CodalComponent.h"
+#include "Event.h"
+#include "MicroBitComponentIds.h"
+
+// Status Flags
+#define MICROBIT_EVENT_THROTTLE_STATUS_PENDING          0x01    // Source events are waiting to be delivered.
+
+namespace codal
+{
+    enum class EventThrottleMode
+    {
+        RateLimit,          // The first source event in each period is delivered immediately. The rest are dropped.
+        Latest,             // At most one event is delivered per period, carrying the value of the latest source event.
+        Batch               // One event is delivered per batch of source events, or at the end of a period with fewer.
+    };
+
+    /**
+     * Limits the rate at which a high frequency source of events reaches its listeners.
+     *
+     * Source events are received immediately and coalesced, and events with this component's ID, carrying the value of
+     * the latest source event, are raised on the default event bus in their place. Listeners of the throttle therefore
+     * see a bounded event rate however fast the source is, and the scheduler's event queue is not swamped.
+     * Each throttle must be given its own ID.
+     *
+     * @code
+     * MicroBitEventThrottle throttle(MICROBIT_ID_ACCELEROMETER, MICROBIT_ACCELEROMETER_EVT_DATA_UPDATE, 100);
+     * uBit.messageBus.listen(MICROBIT_ID_EVENT_THROTTLE, DEVICE_EVT_ANY, onAccelerometer);
+     * @endcode
+     */
+    class MicroBitEventThrottle : public CodalComponent
+    {
+        uint16_t                source;             // The ID of the source of events.
+        uint16_t                value;              // The value of source events to throttle, or DEVICE_EVT_ANY.
+        EventThrottleMode       mode;               // How source events are coalesced.
+        uint32_t                period;             // The minimum time between delivered events, in milliseconds.
+        int                     batchSize;          // The number of source events delivered together in Batch mode.
+        uint16_t                latest;             // The value of the latest source event.
+        int                     pending;            // The number of source events not yet delivered.
+        int                     delivered;          // The number of source events coalesced into the last delivered event.
+        uint32_t                dropped;            // The number of source events dropped in RateLimit mode.
+        CODAL_TIMESTAMP         lastDelivery;       // The time the last event was delivered.
+        CODAL_TIMESTAMP         deadline;           // The time by which pending source events are delivered.
+
+        public:
+
+        /**
+         * Constructor.
+         *
+         * @param source The ID of the source of events.
+         * @param value The value of source events to throttle, or DEVICE_EVT_ANY.
+         * @param period The minimum time between delivered events, in milliseconds.
+         * @param mode How source events are coalesced.
+         * @param id The ID of this component, used for the events it delivers. This must differ from source.
+         */
+        MicroBitEventThrottle(uint16_t source, uint16_t value, uint32_t period, EventThrottleMode mode = EventThrottleMode::Latest, uint16_t id = MICROBIT_ID_EVENT_THROTTLE);
+
+        /**
+         * Destructor.
+         */
+        ~MicroBitEventThrottle();
+
+        /**
+         * Sets the minimum time between delivered events.
+         *
+         * @param period The period, in milliseconds.
+         */
+        void setPeriod(uint32_t period);
+
+        /**
+         * Determines the minimum time between delivered events, in milliseconds.
+         */
+        uint32_t getPeriod();
+
+        /**
+         * Sets the number of source events delivered together in Batch mode.
+         *
+         * @param size The batch size.
+         * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if size is less than 1.
+         */
+        int setBatchSize(int size);
+
+        /**
+         * Determines the number of source events coalesced into the last delivered event.
+         * Listeners in Batch mode use this to determine the size of the batch.
+         */
+        int getCount();
+
+        /**
+         * Determines the number of source events dropped in RateLimit mode.
+         */
+        uint32_t getDropped();
+
+        /**
+         * Delivers any pending source events once they are due.
+         */
+        virtual void periodicCallback() override;
+
+        private:
+
+        /**
+         * Event handler, called immediately for every source event.
+         */
+        void onSourceEvent(Event evt);
+
+        /**
+         * Raises an event in place of the pending source events.
+         *
+         * @param now The current time, in milliseconds.
+         */
+        void deliver(CODAL_TIMESTAMP now);
+    };
+}
+
+#endif
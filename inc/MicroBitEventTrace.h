@@ -0,0 +1,165 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef MICROBIT_EVENT_TRACE_H
+#define MICROBIT_EVENT_TRACE_H
+
+#include "CodalConfig.h"
+#include "CodalComponent.h"
+#include "Serial.h"
+#include "MicroBitComponentIds.h"
+
+// Record compact binary trace events from hot paths, including interrupt handlers, for streaming to a host.
+// This adds a timer read and a few stores to each traced point, so is disabled by default.
+#ifndef CONFIG_MICROBIT_EVENT_TRACE
+#define CONFIG_MICROBIT_EVENT_TRACE 0
+#endif
+
+// The number of records the ring can hold. Must be a power of two. Records are dropped, and counted, when it is full.
+#ifndef CONFIG_MICROBIT_EVENT_TRACE_SIZE
+#define CONFIG_MICROBIT_EVENT_TRACE_SIZE 128
+#endif
+
+// The period at which a running MicroBitEventTraceStream drains the ring to the serial port (milliseconds).
+#ifndef CONFIG_MICROBIT_EVENT_TRACE_PERIOD
+#define CONFIG_MICROBIT_EVENT_TRACE_PERIOD 20
+#endif
+
+// The most records sent in a single packet.
+#ifndef CONFIG_MICROBIT_EVENT_TRACE_PACKET
+#define CONFIG_MICROBIT_EVENT_TRACE_PACKET 16
+#endif
+
+#define MICROBIT_EVENT_TRACE_EVT_DRAIN          1
+
+// Trace event ids. Ids from MICROBIT_EVENT_TRACE_USER upwards are free for application use.
+// MICROBIT_EVENT_TRACE_END is added to the id of a point that marks the end of a traced region.
+#define MICROBIT_EVENT_TRACE_RADIO_IRQ          0x0001  // a: EVENTS_READY | EVENTS_END << 1
+#define MICROBIT_EVENT_TRACE_RADIO_RX           0x0002  // a: RXMATCH | CRCSTATUS << 8, b: RSSISAMPLE
+#define MICROBIT_EVENT_TRACE_LED_RENDER         0x0003  // a: the row just strobed, b: the strobe period (timer ticks)
+#define MICROBIT_EVENT_TRACE_USER               0x4000
+#define MICROBIT_EVENT_TRACE_END                0x8000
+
+// Framing of the packets written to the serial port. See MicroBitEventTraceStream.
+#define MICROBIT_EVENT_TRACE_SYNC0              0xA5
+#define MICROBIT_EVENT_TRACE_SYNC1              0x5A
+
+#if CONFIG_ENABLED(CONFIG_MICROBIT_EVENT_TRACE)
+#define MICROBIT_EVENT_TRACE(id, a, b)          codal::microbit_event_trace(id, a, b)
+#else
+#define MICROBIT_EVENT_TRACE(id, a, b)          ((void)0)
+#endif
+
+namespace codal
+{
+    /**
+      * A single trace event, as held in the ring and sent to the host (little endian).
+      */
+    struct MicroBitEventTraceRecord
+    {
+        uint32_t            time;                   // The time of the event, in microseconds since reset (modulo 2^32).
+        uint16_t            id;                     // One of MICROBIT_EVENT_TRACE_*, or an application id.
+        uint16_t            a;                      // First argument, as defined by the id.
+        uint32_t            b;                      // Second argument, as defined by the id.
+    } __attribute__((packed));
+
+    /**
+      * Records a trace event. Lock free, and safe to call from any interrupt priority.
+      * Use MICROBIT_EVENT_TRACE(), which compiles to nothing unless CONFIG_MICROBIT_EVENT_TRACE is enabled.
+      *
+      * @param id The event id.
+      * @param a The first argument.
+      * @param b The second argument.
+      */
+    void microbit_event_trace(uint16_t id, uint16_t a, uint32_t b);
+
+    /**
+      * Removes the oldest trace events from the ring. Must only be called from thread context.
+      *
+      * @param records The buffer to fill.
+      * @param count The most records to remove.
+      *
+      * @return The number of records removed.
+      */
+    int microbit_event_trace_read(MicroBitEventTraceRecord *records, int count);
+
+    /**
+      * Determines how many trace events have been lost because the ring was full, and resets the count.
+      *
+      * @return The number of events dropped since the last call.
+      */
+    uint32_t microbit_event_trace_dropped();
+
+    /**
+      * Drains the trace ring to a serial port in the background, as a sequence of packets:
+      *
+      *   SYNC0 SYNC1 <count:1> <dropped:2> <record:12>*count <checksum:1>
+      *
+      * where dropped is the number of events lost since the previous packet (saturating at 65535), and checksum
+      * is the sum, modulo 256, of every byte from count onwards, up to the checksum itself. samples/EventTrace/trace_decode.py decodes the stream.
+      */
+    class MicroBitEventTraceStream : public CodalComponent
+    {
+        Serial                  &serial;            // The serial port to write to.
+        uint32_t                period;             // The drain period, or 0 if stopped.
+
+        /**
+          * Sends any trace events in the ring. Runs in its own fiber on each drain period.
+          */
+        void onDrain(Event e);
+
+        public:
+
+        /**
+          * Constructor.
+          *
+          * @param serial The serial port to stream trace events to.
+          */
+        MicroBitEventTraceStream(Serial &serial);
+
+        /**
+          * Starts streaming trace events.
+          *
+          * @param period The period at which to drain the ring, in milliseconds.
+          *
+          * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if period is not positive, or DEVICE_NOT_SUPPORTED
+          * if CONFIG_MICROBIT_EVENT_TRACE is disabled.
+          */
+        int start(int period = CONFIG_MICROBIT_EVENT_TRACE_PERIOD);
+
+        /**
+          * Stops streaming trace events. Events continue to be recorded into the ring until it is full.
+          *
+          * @return DEVICE_OK.
+          */
+        int stop();
+
+        /**
+          * Destructor.
+          */
+        ~MicroBitEventTraceStream();
+    };
+}
+
+#endif
@@ -37,6 +37,30 @@ class MicroBitFile
     int fileHandle;
     ManagedString fileName;
 
+    uint8_t *readBuffer;        // Data read ahead from the file, or NULL if reads are not buffered.
+    int readBufferSize;         // The size of readBuffer, in bytes.
+    int readLength;             // The number of bytes held in readBuffer.
+    int readIndex;              // The index in readBuffer of the next byte to return.
+
+    uint8_t *writeBuffer;       // Data not yet written to the file, or NULL if writes are not buffered.
+    int writeBufferSize;        // The size of writeBuffer, in bytes.
+    int writeLength;            // The number of bytes held in writeBuffer.
+
+    /**
+      * Refills the read buffer from the current position of the underlying file.
+      *
+      * @return the number of bytes read into the buffer, or an error code from MicroBitFileSystem::read().
+      */
+    int fillReadBuffer();
+
+    /**
+      * Writes out any buffered data, and discards any data read ahead, leaving the position of the
+      * underlying file matching the position seen by the caller.
+      *
+      * @return MICROBIT_OK on success, or an error code from the file system.
+      */
+    int syncBuffers();
+
     public:
 
     /**
@@ -48,6 +72,23 @@ class MicroBitFile
       */
     MicroBitFile(ManagedString fileName, int mode = READ | WRITE | CREATE);
 
+    /**
+      * Configures buffering of reads and writes, to reduce the number of calls made to the file system.
+      *
+      * Reads are made a buffer at a time, with read(), readUntil() and readLine() returning data from the buffer.
+      * Writes are held in the buffer until it is full, or the file is flushed, closed or repositioned.
+      * n.b. Errors from buffered writes are reported by the call that writes them to the file system.
+      *
+      * @param readSize the size of the read buffer in bytes, or zero to read directly from the file. Defaults to zero.
+      *
+      * @param writeSize the size of the write buffer in bytes, or zero to write directly to the file. Defaults to zero.
+      *
+      * @return MICROBIT_OK on success, MICROBIT_NOT_SUPPORTED if the current file handle is invalid,
+      *         MICROBIT_INVALID_PARAMETER if either size is negative, or MICROBIT_NO_RESOURCES if the
+      *         buffers could not be allocated.
+      */
+    int setBuffering(int readSize, int writeSize = 0);
+
     /**
       * Seeks to a position in this MicroBitFile instance from the beginning of the file.
       *
@@ -119,6 +160,52 @@ class MicroBitFile
       */
     ManagedString read(int size);
 
+    /**
+      * Reads from the file into a given buffer, up to the given delimiter. The delimiter is consumed,
+      * but not stored. Reading stops early if the buffer fills.
+      *
+      * @param buffer a pointer to the buffer where data will be stored.
+      *
+      * @param size the number of bytes that can be safely stored in the buffer.
+      *
+      * @param delimiter the character at which to stop reading.
+      *
+      * @return the number of bytes stored, MICROBIT_NO_DATA at the end of the file, MICROBIT_NOT_SUPPORTED
+      *         if the current file handle is invalid, or MICROBIT_INVALID_PARAMETER if buffer is invalid,
+      *         or the size given is less than 0.
+      */
+    int readUntil(char *buffer, int size, char delimiter);
+
+    /**
+      * Reads from the file up to the given delimiter. The delimiter is consumed, but not returned.
+      *
+      * @param delimiter the character at which to stop reading.
+      *
+      * @return a ManagedString containing the bytes before the delimiter, or an empty ManagedString
+      *         at the end of the file or on error.
+      */
+    ManagedString readUntil(char delimiter);
+
+    /**
+      * Reads a line of text from the file. The line ending ("\n" or "\r\n") is consumed, but not returned.
+      *
+      * @return a ManagedString containing the line, or an empty ManagedString at the end of the file or on error.
+      */
+    ManagedString readLine();
+
+    /**
+      * Describe where the data of this file lies in FLASH, from the current position to the end of the file,
+      * so that it can be read in place without copying. See MicroBitFileSystem::getExtents().
+      *
+      * @param extents array to store the extents in.
+      *
+      * @param count the number of extents that can be stored in the array.
+      *
+      * @return the number of extents stored, MICROBIT_NOT_SUPPORTED if the current file handle is invalid,
+      *         or MICROBIT_INVALID_PARAMETER if the array is invalid.
+      */
+    int getExtents(FileExtent *extents, int count);
+
     /**
       * Removes this MicroBitFile from the MicroBitFileSystem.
       *
@@ -24,6 +24,7 @@ DEALINGS IN THE SOFTWARE.
 
 #include "MicroBitConfig.h"
 #include "MicroBitFlash.h"
+#include "CodalFiber.h"
 
 
 // Configuration options.
@@ -35,6 +36,7 @@ DEALINGS IN THE SOFTWARE.
 #define MB_WRITE    0x02
 #define MB_CREAT    0x04
 #define MB_APPEND   0x08
+#define MB_CONTIGUOUS 0x10
 
 // seek() flags.
 #define MB_SEEK_SET 0x01
@@ -43,6 +45,8 @@ DEALINGS IN THE SOFTWARE.
 
 // Status flags
 #define MBFS_STATUS_INITIALISED           0x01
+#define MBFS_STATUS_COMPACTING            0x02
+#define MBFS_STATUS_EXTENTS               0x04        // Extents returned by getExtents() are valid until the next write.
 
 // FileTable codes
 #define MBFS_UNUSED                       0xFFFF
@@ -83,6 +87,21 @@ struct Directory
     DirectoryEntry entry[0];
 };
 
+//
+// A DirectoryIndex is an in-RAM hash table of the entries of one directory, built on demand to speed up lookups.
+//
+struct DirectoryIndex
+{
+    // the directory indexed, or NULL if the index is not valid.
+    const DirectoryEntry *directory;
+
+    // the number of slots in the table. Always a power of two.
+    uint16_t size;
+
+    // open addressed table of the valid entries of the directory, by filename hash. Unused slots are NULL.
+    DirectoryEntry **table;
+};
+
 //
 // A FileDescriptor holds contextual information needed for each OPEN file.
 //
@@ -100,6 +119,12 @@ struct FileDescriptor
     // the current file size. n.b. this may be different to that stored in the DirectoryEntry.
     uint32_t length;
 
+    // the last block accessed, from which the file table walk to the next seek position resumes. Zero if none.
+    uint16_t block;
+
+    // the position in the file of the start of that block, in bytes.
+    uint32_t blockPosition;
+
     // the directory entry of this file. 
     DirectoryEntry *dirent;
 
@@ -114,6 +139,18 @@ struct FileDescriptor
     uint8_t cache[MBFS_CACHE_SIZE];
 };
 
+//
+// A FileExtent describes a run of a file's data that is stored contiguously in FLASH, and can be read in place.
+//
+struct FileExtent
+{
+    // the address of the data in FLASH.
+    const uint8_t *data;
+
+    // the number of bytes in the run.
+    uint32_t length;
+};
+
 /**
   * @brief Class definition for the MicroBit File system
   *
@@ -155,6 +192,25 @@ class MicroBitFileSystem
     // Chain of open files.
     FileDescriptor *openFiles;
 
+    // Bitmap of the blocks in use, mirroring the file table. One bit per block.
+    uint32_t *usedMap;
+
+    // Bitmap of the blocks marked as DELETED in the file table. One bit per block.
+    uint32_t *deletedMap;
+
+    // Bitmap of the physical pages refreshed since their blocks were last DELETED. One bit per page.
+    uint32_t *refreshedMap;
+
+    // Number of times each physical page has been erased since the file system was initialised.
+    uint16_t *eraseCount;
+
+    // Indexes of the entries of the most recently searched directories, and the next to be replaced.
+    DirectoryIndex directoryIndex[MBFS_DIRECTORY_INDEX_COUNT];
+    uint8_t nextDirectoryIndex;
+
+    // Serialises API calls with each other and with the background compaction fiber, as FLASH operations may yield.
+    codal::FiberLock mutex;
+
     /**
       * Initialize the flash storage system
       *
@@ -179,9 +235,10 @@ class MicroBitFileSystem
     /**
       * Allocate a free logical block.
       * A round robin algorithm is used to even out the wear on the physical device.
+      * @param hint A block to allocate in preference to the round robin choice, if it is free. Zero for none.
       * @return NULL on error, page address on success
       */
-    uint16_t getFreeBlock();
+    uint16_t getFreeBlock(uint16_t hint = 0);
 
     /**
     * Allocates a free physical block.
@@ -190,6 +247,131 @@ class MicroBitFileSystem
     */
     uint32_t* getFreePage();
 
+    /**
+    * Rebuild the bitmaps of used and deleted blocks from the file table, allocating them if necessary.
+    *
+    * @return MICROBIT_OK on success, or MICROBIT_NO_RESOURCES if the bitmaps could not be allocated.
+    */
+    int buildBlockMap();
+
+    /**
+    * Record the state of a block in the bitmaps, according to its file table entry.
+    *
+    * @param block The block to update.
+    * @param value The value stored in the file table for that block.
+    */
+    void setBlockState(uint16_t block, uint16_t value);
+
+    /**
+    * Find the first block that is neither used nor deleted, starting at the given block and
+    * wrapping around the filesystem space if we reach the end.
+    *
+    * @param start The block to start searching from.
+    *
+    * @return The block number of a free block, or zero if none is available.
+    */
+    uint16_t findFreeBlock(uint16_t start);
+
+    /**
+    * Determine if any of the given range of blocks is marked in a bitmap.
+    *
+    * @param map The bitmap to test.
+    * @param start The first block of the range.
+    * @param count The number of blocks in the range.
+    *
+    * @return true if any block in the range is marked, false otherwise.
+    */
+    bool isBlockMarked(uint32_t *map, uint16_t start, int count);
+
+    /**
+    * Find a run of consecutive blocks that are neither used nor deleted.
+    *
+    * @param count The number of blocks in the run.
+    *
+    * @return The first block of the run, or zero if no run of that length is available.
+    */
+    uint16_t findFreeRun(int count);
+
+    /**
+    * Erase a physical page of the file system, recording the erase for wear levelling.
+    *
+    * @param page The address of the page to erase.
+    */
+    void erasePage(uint32_t *page);
+
+    /**
+    * Start the background compaction fiber, if it is not already running.
+    */
+    void startCompaction();
+
+    /**
+    * Body of the background compaction fiber. Performs one step of compaction per MBFS_COMPACTION_PERIOD,
+    * and exits once there is nothing left to reclaim.
+    *
+    * @param fs The MicroBitFileSystem to compact.
+    */
+    static void compactionFiber(void *fs);
+
+    /**
+    * Implements open(). The caller must hold the mutex.
+    */
+    int _open(char const * filename, uint32_t flags);
+
+    /**
+    * Implements flush(). The caller must hold the mutex.
+    */
+    int _flush(int fd);
+
+    /**
+    * Implements close(). The caller must hold the mutex.
+    */
+    int _close(int fd);
+
+    /**
+    * Implements seek(). The caller must hold the mutex.
+    */
+    int _seek(int fd, int offset, uint8_t flags);
+
+    /**
+    * Implements write(). The caller must hold the mutex.
+    */
+    int _write(int fd, uint8_t* buffer, int size);
+
+    /**
+    * Implements read(). The caller must hold the mutex.
+    */
+    int _read(int fd, uint8_t* buffer, int size);
+
+    /**
+    * Implements getExtents(). The caller must hold the mutex.
+    */
+    int _getExtents(int fd, FileExtent *extents, int count);
+
+    /**
+    * Implements preallocate(). The caller must hold the mutex.
+    */
+    int _preallocate(int fd, uint32_t size);
+
+    /**
+    * Implements remove(). The caller must hold the mutex.
+    */
+    int _remove(char const * filename);
+
+    /**
+    * Implements createDirectory(). The caller must hold the mutex.
+    */
+    int _createDirectory(char const *name);
+
+    /**
+    * Implements compact(). The caller must hold the mutex.
+    */
+    int _compact();
+
+    /**
+    * Implements getEraseCount(). The caller must hold the mutex.
+    */
+    int _getEraseCount(int page);
+
     /**
     * Retrieve the DirectoryEntry assoiated with the given file's DIRECTORY (not the file itself).
     *
@@ -206,6 +388,28 @@ class MicroBitFileSystem
     * @return A pointer to the DirectoryEntry for the given file, or NULL if no entry is found.
     */
     DirectoryEntry* getDirectoryEntry(char const * filename, const DirectoryEntry *directory = NULL);
+
+    /**
+    * Retrieve the hash index of the valid entries of the given directory, building it if necessary.
+    * The least recently built index is replaced if all are in use.
+    *
+    * @param directory The directory to index.
+    * @return The index of the directory, or NULL if there is not enough memory to hold it.
+    */
+    DirectoryIndex* getDirectoryIndex(const DirectoryEntry *directory);
+
+    /**
+    * Discard all directory indexes. Must be called whenever a DirectoryEntry is created, moved or deleted.
+    */
+    void invalidateDirectoryIndex();
+
+    /**
+    * Calculate the hash of a filename, as used by the directory index.
+    *
+    * @param name The filename, without any path.
+    * @return The hash of the filename.
+    */
+    static uint16_t hashFilename(const char *name);
     
     /**
     * Create a new DirectoryEntry with the given filename and flags.
@@ -272,6 +476,17 @@ class MicroBitFileSystem
     */
     uint16_t getNextFileBlock(uint16_t block);
 
+    /**
+    * Determine the block holding the seek position of the given file.
+    * The file table is walked from the last block accessed, unless the seek position lies before it.
+    *
+    * @param file The file to locate the seek position of.
+    * @param offset Set to the offset of the seek position within the returned block.
+    *
+    * @return The block number of the block holding the seek position.
+    */
+    uint16_t getSeekBlock(FileDescriptor *file, uint32_t &offset);
+
     /**
     * Determine the logical block that contains the given address.
     *
@@ -358,6 +573,8 @@ class MicroBitFileSystem
       *  - MB_READ : read from the file.
       *  - MB_WRITE : write to the file.
       *  - MB_CREAT : create a new file, if it doesn't already exist.
+      *  - MB_CONTIGUOUS : grow the file into the block following its last block where that is free,
+      *    in preference to spreading its blocks across the device for wear levelling.
       *
       * If a file is opened that doesn't exist, and MB_CREAT isn't passed,
       * an error is returned, otherwise the file is created.
@@ -490,6 +707,55 @@ class MicroBitFileSystem
       */
     int read(int fd, uint8_t* buffer, int size);
 
+    /**
+      * Describe where the data of a file is held in FLASH, so that it can be read in place without copying.
+      *
+      * The data from the current seek position to the end of the file is described as a list of contiguous
+      * extents, in file order. A file held in consecutive blocks is described by a single extent.
+      * The seek position of the file handle is not changed.
+      *
+      * n.b. The extents are only valid until the file system is next written to, as blocks may then
+      * be recycled and erased. Background compaction is held off until then.
+      *
+      * @param fd File handle, obtained with open()
+      * @param extents array to store the extents in.
+      * @param count the number of extents that can be stored in the array.
+      * @return the number of extents stored on success, MICROBIT_NOT_SUPPORTED if the file
+      *         system is not initialised, MICROBIT_INVALID_PARAMETER if the given file handle
+      *         or array is invalid. If the array fills, the extents stored describe the start of the data only.
+      *
+      * @code
+      * MicroBitFileSystem f;
+      * FileExtent e;
+      * int fd = f.open("image.bin", MB_READ);
+      * if(f.getExtents(fd, &e, 1) == 1 && e.length == f.seek(fd, 0, MB_SEEK_END))
+      *    process(e.data, e.length);
+      * @endcode
+      */
+    int getExtents(int fd, FileExtent *extents, int count);
+
+    /**
+      * Reserve space for a file to grow into, as a run of consecutive blocks where space allows.
+      *
+      * Blocks are taken from those immediately following the end of the file if they are free,
+      * or from the first free run long enough elsewhere, so that data written into them can be read
+      * back in place as a single extent. If no such run exists, the space is reserved a block at a time.
+      * The length of the file is unchanged, and reserved space is released when the file is removed.
+      *
+      * @param fd File handle, obtained with open()
+      * @param size the number of bytes the file should be able to hold.
+      * @return MICROBIT_OK on success, MICROBIT_NOT_SUPPORTED if the file system is not initialised,
+      *         MICROBIT_INVALID_PARAMETER if the given file handle is invalid, or MICROBIT_NO_RESOURCES
+      *         if there is not enough free space.
+      *
+      * @code
+      * MicroBitFileSystem f;
+      * int fd = f.open("image.bin", MB_WRITE | MB_CREAT | MB_CONTIGUOUS);
+      * f.preallocate(fd, 4096);
+      * @endcode
+      */
+    int preallocate(int fd, uint32_t size);
+
     /**
       * Remove a file from the system, and free allocated assets
       * (including assigned blocks which are returned for use by other files).
@@ -508,6 +774,30 @@ class MicroBitFileSystem
       */
     int remove(char const * filename);
 
+    /**
+      * Perform one step of the compaction of deleted blocks. The next physical page holding
+      * deleted blocks is refreshed, or once all such pages are refreshed, the file table itself,
+      * returning the deleted blocks to use.
+      *
+      * This is normally called by a background fiber, so that the cost of reclaiming space is
+      * not paid by a call to write() that runs out of unused blocks.
+      *
+      * @return MICROBIT_OK if a step was performed, MICROBIT_NO_DATA if there is nothing to
+      *         reclaim, MICROBIT_BUSY if extents obtained by getExtents() are still valid,
+      *         or MICROBIT_NOT_SUPPORTED if the file system is not initialised.
+      */
+    int compact();
+
+    /**
+      * Determine how many times a physical page of the file system has been erased since
+      * the file system was initialised.
+      *
+      * @param page The index of the page in the file system, or -1 for the total over all pages.
+      *
+      * @return The number of erases, or MICROBIT_INVALID_PARAMETER if the page is invalid.
+      */
+    int getEraseCount(int page = -1);
+
     /**
     * Creates a new directory with the given name and location
     *
@@ -0,0 +1,137 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef MICROBIT_HEAP_STATS_H
+#define MICROBIT_HEAP_STATS_H
+
+#include "CodalConfig.h"
+#include "Serial.h"
+
+// Account the heap used by each subsystem of the runtime, which tags the allocations it owns.
+// This adds a few instructions to every tagged allocation and release, so is disabled by default.
+#ifndef CONFIG_MICROBIT_HEAP_STATS
+#define CONFIG_MICROBIT_HEAP_STATS 0
+#endif
+
+// Subsystems that tag their heap allocations.
+#define MICROBIT_HEAP_TAG_OTHER         0       // Tagged, but not owned by any of the subsystems below.
+#define MICROBIT_HEAP_TAG_RADIO         1       // MicroBitRadio, MicroBitMeshRadio and their frame pool.
+#define MICROBIT_HEAP_TAG_AUDIO         2       // MicroBitAudio pipeline, Mixer2 channels and synthesizer tables.
+#define MICROBIT_HEAP_TAG_STORAGE       3       // MicroBitLog buffers and FSCache pages.
+#define MICROBIT_HEAP_TAG_BLE           4       // Bluetooth services and their buffers.
+#define MICROBIT_HEAP_TAG_COUNT         5
+
+// The arguments are not evaluated when CONFIG_MICROBIT_HEAP_STATS is disabled, so never pass an expression
+// with side effects (such as the allocation itself): store the pointer first, then track it.
+#if CONFIG_ENABLED(CONFIG_MICROBIT_HEAP_STATS)
+#define MICROBIT_HEAP_TRACK(tag, ptr)       codal::microbit_heap_track(tag, ptr)
+#define MICROBIT_HEAP_UNTRACK(tag, ptr)     codal::microbit_heap_untrack(tag, ptr)
+#else
+#define MICROBIT_HEAP_TRACK(tag, ptr)       ((void)0)
+#define MICROBIT_HEAP_UNTRACK(tag, ptr)     ((void)0)
+#endif
+
+namespace codal
+{
+    /**
+      * Heap usage of one subsystem. All sizes are in bytes, and include the allocator's own block header.
+      */
+    struct MicroBitHeapTagStats
+    {
+        uint32_t            current;                // The heap currently held.
+        uint32_t            peak;                   // The most heap held at any one time.
+        uint32_t            allocations;            // The number of allocations made.
+        uint32_t            releases;               // The number of allocations released.
+        uint32_t            failures;               // The number of allocations that could not be satisfied.
+    };
+
+    /**
+      * A snapshot of the state of the heap as a whole. All sizes are in bytes.
+      */
+    struct MicroBitHeapFragmentation
+    {
+        uint32_t            total;                  // The size of all heaps.
+        uint32_t            free;                   // The space not currently allocated.
+        uint32_t            largest;                // The largest single allocation that could be satisfied.
+        uint32_t            freeBlocks;             // The number of separate free regions.
+        int                 fragmentation;          // The proportion of free space unusable by an allocation of the largest size, in percent.
+    };
+
+    /**
+      * Records an allocation made on behalf of a subsystem. Use MICROBIT_HEAP_TRACK(), which compiles to nothing
+      * unless CONFIG_MICROBIT_HEAP_STATS is enabled.
+      *
+      * @param tag The subsystem that owns the allocation, one of MICROBIT_HEAP_TAG_*.
+      * @param ptr The pointer returned by the allocator, or NULL if the allocation failed.
+      *
+      * @note This may be called from interrupt context.
+      */
+    void microbit_heap_track(int tag, void *ptr);
+
+    /**
+      * Records the release of an allocation previously passed to microbit_heap_track(). Must be called
+      * before the memory is freed. Use MICROBIT_HEAP_UNTRACK().
+      *
+      * @param tag The subsystem that owns the allocation, one of MICROBIT_HEAP_TAG_*.
+      * @param ptr The pointer about to be freed. NULL is ignored.
+      */
+    void microbit_heap_untrack(int tag, void *ptr);
+
+    /**
+      * Retrieves the heap usage of a subsystem.
+      *
+      * @param tag The subsystem of interest, one of MICROBIT_HEAP_TAG_*.
+      *
+      * @return the statistics for the given subsystem, or NULL if tag is out of range or CONFIG_MICROBIT_HEAP_STATS is disabled.
+      */
+    MicroBitHeapTagStats *microbit_heap_get_stats(int tag);
+
+    /**
+      * Walks the heap to determine how much of it is free, and how fragmented that free space is.
+      *
+      * @param f The structure to populate.
+      *
+      * @return DEVICE_OK on success, or DEVICE_NOT_SUPPORTED if CONFIG_MICROBIT_HEAP_STATS is disabled.
+      */
+    int microbit_heap_get_fragmentation(MicroBitHeapFragmentation &f);
+
+    /**
+      * Resets the peak usage of each subsystem to its current usage, and clears the allocation counts.
+      */
+    void microbit_heap_reset_stats();
+
+    /**
+      * Writes the heap usage of each subsystem, followed by the fragmentation of the heap, to the given serial port:
+      *
+      *   HEAP tag=<name> current=<n> peak=<n> allocations=<n> releases=<n> failures=<n>
+      *   HEAP total=<n> free=<n> largest=<n> free_blocks=<n> fragmentation_pct=<n>
+      *
+      * @param serial The serial port to write to, typically uBit.serial.
+      *
+      * @return DEVICE_OK on success, or DEVICE_NOT_SUPPORTED if CONFIG_MICROBIT_HEAP_STATS is disabled.
+      */
+    int microbit_heap_print(Serial &serial);
+}
+
+#endif
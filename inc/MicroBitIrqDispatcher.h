@@ -0,0 +1,156 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef MICROBIT_IRQ_DISPATCHER_H
+#define MICROBIT_IRQ_DISPATCHER_H
+
+#include "CodalConfig.h"
+#include "CodalComponent.h"
+#include "Pin.h"
+#include "Event.h"
+#include "MicroBitComponentIds.h"
+
+// The maximum number of sources that can share the interrupt line.
+#ifndef CONFIG_MICROBIT_IRQ_DISPATCHER_SOURCES
+#define CONFIG_MICROBIT_IRQ_DISPATCHER_SOURCES          4
+#endif
+
+// The maximum number of sources serviced for a single edge, should the line remain asserted after each.
+#ifndef CONFIG_MICROBIT_IRQ_DISPATCHER_MAX_PASSES
+#define CONFIG_MICROBIT_IRQ_DISPATCHER_MAX_PASSES       4
+#endif
+
+// Values returned by an interrupt source's handler.
+#define MICROBIT_IRQ_NONE                               0       // The source did not assert the line.
+#define MICROBIT_IRQ_HANDLED                            1       // The source asserted the line, and has been serviced.
+#define MICROBIT_IRQ_DEFERRED                           2       // The source asserted the line, but will be serviced elsewhere.
+
+// Status Flags
+#define MICROBIT_IRQ_DISPATCHER_STATUS_RUNNING          0x01
+
+namespace codal
+{
+    /**
+     * Checks if a given source asserted the shared interrupt line, and if so services it.
+     *
+     * @param context The context given when the source was added.
+     * @return MICROBIT_IRQ_NONE, MICROBIT_IRQ_HANDLED or MICROBIT_IRQ_DEFERRED.
+     */
+    typedef int (*MicroBitIrqHandler)(void *context);
+
+    struct MicroBitIrqSource
+    {
+        MicroBitIrqHandler      handler;            // Checks and services the source.
+        void                    *context;           // Passed to the handler.
+        uint32_t                count;              // The number of times the source was found to be responsible.
+    };
+
+    /**
+     * Arbiter for an interrupt line shared by several devices, such as the combined IRQ line driven
+     * by the motion sensors and the USB interface chip.
+     *
+     * On each falling edge, sources are checked in the order they were added, and the first to claim the
+     * interrupt is serviced. Sources should therefore be added cheapest check first. If the line is still
+     * asserted afterwards, the sources are checked again. Attribution of each interrupt is recorded,
+     * along with any that no source claimed.
+     */
+    class MicroBitIrqDispatcher : public CodalComponent
+    {
+        Pin                     &irq;               // The shared interrupt line.
+        MicroBitIrqSource       sources[CONFIG_MICROBIT_IRQ_DISPATCHER_SOURCES];
+        int                     sourceCount;        // The number of sources added.
+        uint32_t                edges;              // The number of edges seen.
+        uint32_t                spurious;           // The number of interrupts no source claimed.
+
+        public:
+
+        /**
+         * Constructor.
+         *
+         * @param irq The active low interrupt line to arbitrate.
+         * @param id The ID of this component.
+         */
+        MicroBitIrqDispatcher(Pin &irq, uint16_t id = MICROBIT_ID_IRQ_DISPATCHER);
+
+        /**
+         * Destructor.
+         */
+        ~MicroBitIrqDispatcher();
+
+        /**
+         * Adds a source to the end of the list checked on each interrupt.
+         *
+         * @param handler The function that checks and services the source.
+         * @param context Passed to the handler.
+         * @return The index of the source on success, DEVICE_INVALID_PARAMETER if handler is NULL,
+         * or DEVICE_NO_RESOURCES if CONFIG_MICROBIT_IRQ_DISPATCHER_SOURCES have already been added.
+         */
+        int addSource(MicroBitIrqHandler handler, void *context = NULL);
+
+        /**
+         * Enables edge events on the interrupt line, and services any interrupt already pending.
+         *
+         * @return DEVICE_OK on success.
+         */
+        int start();
+
+        /**
+         * Determines the number of interrupts attributed to the given source.
+         *
+         * @param source The index returned when the source was added.
+         * @return The number of interrupts, or 0 if source is out of range.
+         */
+        uint32_t getCount(int source);
+
+        /**
+         * Determines the number of interrupts no source claimed.
+         */
+        uint32_t getSpuriousCount();
+
+        /**
+         * Determines the number of falling edges seen on the interrupt line.
+         */
+        uint32_t getEdgeCount();
+
+        /**
+         * Clears all attribution statistics.
+         */
+        void resetStats();
+
+        /**
+         * Writes the attribution statistics to DMESG.
+         */
+        void printStats();
+
+        private:
+
+        /**
+         * Event handler, called when the interrupt line is asserted.
+         * Services sources until the line is released, or no source claims it.
+         */
+        void onIrq(Event evt);
+    };
+}
+
+#endif
@@ -0,0 +1,100 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef MICROBIT_IRQ_PRIORITY_H
+#define MICROBIT_IRQ_PRIORITY_H
+
+#include "CodalConfig.h"
+#include "nrf.h"
+
+// Named sets of interrupt priorities for the peripherals used by the runtime, suited to different workloads.
+#define MICROBIT_IRQ_PROFILE_DEFAULT        0       // Balanced: display and touch sensing first, then audio and radio.
+#define MICROBIT_IRQ_PROFILE_RADIO          1       // Radio relays: the radio preempts everything but the Bluetooth stack.
+#define MICROBIT_IRQ_PROFILE_AUDIO          2       // Audio synthesis: speaker PCM and the microphone preempt the display and radio.
+#define MICROBIT_IRQ_PROFILE_LOGGER         3       // Data logging: the ADC and its sample timer preempt everything else.
+#define MICROBIT_IRQ_PROFILE_COUNT          4
+
+// The profile applied by MicroBit::init().
+#ifndef MICROBIT_IRQ_PRIORITY_PROFILE
+#define MICROBIT_IRQ_PRIORITY_PROFILE MICROBIT_IRQ_PROFILE_DEFAULT
+#endif
+
+// The number of interrupts whose priority can be overridden individually.
+#ifndef MICROBIT_IRQ_PRIORITY_OVERRIDES
+#define MICROBIT_IRQ_PRIORITY_OVERRIDES 8
+#endif
+
+namespace codal
+{
+    /**
+      * Selects the priority profile, and applies it to every peripheral interrupt used by the runtime.
+      * Priorities set with microbit_irq_set_priority() take precedence over the profile.
+      *
+      * May be called before MicroBit::init(), which applies the profile most recently selected.
+      *
+      * @param profile One of MICROBIT_IRQ_PROFILE_*.
+      *
+      * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the profile is unknown.
+      */
+    int microbit_irq_set_profile(int profile);
+
+    /**
+      * Determines the priority profile in use.
+      *
+      * @return One of MICROBIT_IRQ_PROFILE_*.
+      */
+    int microbit_irq_get_profile();
+
+    /**
+      * Sets the priority of a single interrupt, overriding the profile. The override persists across
+      * later calls to microbit_irq_set_profile(), until cleared with microbit_irq_clear_priority().
+      *
+      * May be called before MicroBit::init(), which applies any overrides along with the profile.
+      *
+      * @param irq The interrupt to configure.
+      * @param priority The priority, where lower values preempt higher ones. With Bluetooth enabled, priorities 0 and 1
+      * are reserved for the SoftDevice.
+      *
+      * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the priority is out of range or reserved, DEVICE_NOT_SUPPORTED
+      * if the interrupt is owned by the running Bluetooth stack, or DEVICE_NO_RESOURCES if there is no room to record the override.
+      */
+    int microbit_irq_set_priority(IRQn_Type irq, int priority);
+
+    /**
+      * Removes any override of the priority of an interrupt, restoring the priority given by the profile in use.
+      *
+      * @param irq The interrupt to restore.
+      *
+      * @return DEVICE_OK.
+      */
+    int microbit_irq_clear_priority(IRQn_Type irq);
+
+    /**
+      * Applies the selected profile and any overrides to the NVIC. Called by MicroBit::init().
+      * Interrupts owned by the Bluetooth stack are left alone whilst it is running.
+      */
+    void microbit_irq_apply();
+}
+
+#endif
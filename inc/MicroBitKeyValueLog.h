@@ -0,0 +1,335 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef MICROBIT_KEY_VALUE_LOG_H
+#define MICROBIT_KEY_VALUE_LOG_H
+
+#include "CodalConfig.h"
+#include "ManagedString.h"
+#include "NVMController.h"
+#include "CodalFiber.h"
+#include "KeyValueStorage.h"
+
+// The number of pages of flash the log is spread across, including the one kept free for compaction. At least two.
+#ifndef CONFIG_MICROBIT_KEY_VALUE_LOG_PAGES
+#define CONFIG_MICROBIT_KEY_VALUE_LOG_PAGES         4
+#endif
+
+// The number of slots in the RAM index. Must be a power of two. Up to half of the slots may hold keys.
+#ifndef CONFIG_MICROBIT_KEY_VALUE_LOG_INDEX_SIZE
+#define CONFIG_MICROBIT_KEY_VALUE_LOG_INDEX_SIZE    64
+#endif
+
+// Interval, in milliseconds, between the steps of background compaction. Set to zero to disable background
+// compaction, such that space is only reclaimed when a put() or remove() runs out of room.
+#ifndef CONFIG_MICROBIT_KEY_VALUE_LOG_COMPACTION_PERIOD
+#define CONFIG_MICROBIT_KEY_VALUE_LOG_COMPACTION_PERIOD 500
+#endif
+
+#define MICROBIT_KEY_VALUE_LOG_MAGIC                0x4B564C31      // "KVL1", the first word of each page in use.
+
+#define MICROBIT_KEY_VALUE_LOG_STATUS_LOADED        0x01
+#define MICROBIT_KEY_VALUE_LOG_STATUS_COMPACTING    0x02
+
+// Values of an index slot that do not refer to a record.
+#define MICROBIT_KEY_VALUE_LOG_SLOT_EMPTY           0xFFFF
+#define MICROBIT_KEY_VALUE_LOG_SLOT_REMOVED         0xFFFE
+
+// The value length of a record that removes its key.
+#define MICROBIT_KEY_VALUE_LOG_REMOVED              0xFF
+
+// The largest record, in words.
+#define MICROBIT_KEY_VALUE_LOG_RECORD_WORDS         (1 + (KEY_VALUE_MAX_KEY_LEN + 3) / 4 + (KEY_VALUE_MAX_VALUE_LEN + 3) / 4)
+
+namespace codal
+{
+    /**
+     * The header of each record in the log, followed by the key, then the value, each padded to a whole word.
+     * An erased header marks the end of the records in a page.
+     */
+    struct KeyValueLogRecord
+    {
+        uint8_t         keyLength;          // The length of the key, excluding its terminator.
+        uint8_t         valueLength;        // The length of the value, or MICROBIT_KEY_VALUE_LOG_REMOVED.
+        uint16_t        check;              // A checksum of the lengths, key and value, to detect interrupted writes.
+    };
+
+    /**
+     * A log structured key value store.
+     *
+     * An alternative to MicroBitStorage for values that change often. Rather than rewriting a page of flash
+     * for every update, each put() and remove() appends a single record to a log spread over several pages,
+     * so that an update costs one flash write and no erase. An index of the latest record of each key is held
+     * in RAM, rebuilt from the log when the store is first used, so that get() never searches flash.
+     *
+     * When the log fills, the live records of its oldest page are copied forward and that page is erased.
+     * This normally happens on a background fiber, shortly after the last free page is taken into use,
+     * so that the erase is rarely paid for by a put(). One page is always kept free for this purpose.
+     *
+     * The store shares the KeyValuePair format and key and value limits of MicroBitStorage, but not its
+     * flash format, so it must be given pages of its own.
+     *
+     * @code
+     * NRF52FlashManager settingsFlash(MICROBIT_DEFAULT_SCRATCH_PAGE - CONFIG_MICROBIT_KEY_VALUE_LOG_PAGES * MICROBIT_CODEPAGESIZE,
+     *                                 CONFIG_MICROBIT_KEY_VALUE_LOG_PAGES, MICROBIT_CODEPAGESIZE);
+     * MicroBitKeyValueLog settings(settingsFlash);
+     *
+     * uint32_t boots = 0;
+     * KeyValuePair *p = settings.get("boots");
+     * if (p != NULL)
+     *     memcpy(&boots, p->value, sizeof(boots));
+     * delete p;
+     *
+     * boots++;
+     * settings.put("boots", (uint8_t *)&boots, sizeof(boots));
+     * @endcode
+     */
+    class MicroBitKeyValueLog
+    {
+        NVMController   &controller;        // The flash holding the log, from logical address zero.
+        uint32_t        pageSize;           // The size of each page, in bytes.
+        int             pages;              // The number of pages the log is spread across.
+        uint32_t        *sequence;          // The sequence number of each page, or zero if the page is free.
+        uint32_t        nextSequence;       // The sequence number given to the next page taken into use.
+        int             active;             // The page records are appended to, or -1 if none.
+        uint32_t        writePosition;      // The address of the end of the records in the active page.
+        int             count;              // The number of keys in the store.
+        int             removed;            // The number of index slots marked MICROBIT_KEY_VALUE_LOG_SLOT_REMOVED.
+        uint8_t         status;
+        FiberLock       mutex;              // Serialises access to the log between API calls and the compaction fiber.
+        uint16_t        index[CONFIG_MICROBIT_KEY_VALUE_LOG_INDEX_SIZE];    // The word address of the latest record of each key.
+
+        public:
+
+        /**
+         * Constructor.
+         *
+         * @param controller The flash to hold the log. Every page it provides is used, up to the given number of pages.
+         * @param pages The number of pages to spread the log across. Defaults to CONFIG_MICROBIT_KEY_VALUE_LOG_PAGES.
+         */
+        MicroBitKeyValueLog(NVMController &controller, int pages = CONFIG_MICROBIT_KEY_VALUE_LOG_PAGES);
+
+        /**
+         * Destructor.
+         */
+        ~MicroBitKeyValueLog();
+
+        /**
+         * Store the given value against the given key, replacing any value it already has.
+         * Nothing is written if the value is unchanged.
+         *
+         * @param key A NULL terminated string of up to KEY_VALUE_MAX_KEY_LEN - 1 characters.
+         * @param data The value to store.
+         * @param dataSize The size of the value, of up to KEY_VALUE_MAX_VALUE_LEN bytes.
+         *
+         * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the key or value is too large, or
+         *         DEVICE_NO_RESOURCES if the index or log is full.
+         */
+        int put(const char *key, uint8_t *data, int dataSize);
+
+        /**
+         * Store the given value against the given key, replacing any value it already has.
+         *
+         * @param key A string of up to KEY_VALUE_MAX_KEY_LEN - 1 characters.
+         * @param data The value to store.
+         * @param dataSize The size of the value, of up to KEY_VALUE_MAX_VALUE_LEN bytes.
+         *
+         * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the key or value is too large, or
+         *         DEVICE_NO_RESOURCES if the index or log is full.
+         */
+        int put(ManagedString key, uint8_t *data, int dataSize);
+
+        /**
+         * Retrieve the value stored against the given key.
+         *
+         * @param key The key to look up.
+         *
+         * @return A new KeyValuePair holding the key and its value, which the caller must delete, or NULL if the key is not present.
+         *         Bytes of the value beyond those stored are zero.
+         */
+        KeyValuePair* get(const char *key);
+
+        /**
+         * Retrieve the value stored against the given key.
+         *
+         * @param key The key to look up.
+         *
+         * @return A new KeyValuePair holding the key and its value, which the caller must delete, or NULL if the key is not present.
+         */
+        KeyValuePair* get(ManagedString key);
+
+        /**
+         * Remove the given key, and its value, from the store.
+         *
+         * @param key The key to remove.
+         *
+         * @return DEVICE_OK on success, DEVICE_NO_DATA if the key is not present, or DEVICE_NO_RESOURCES if the log is full.
+         */
+        int remove(const char *key);
+
+        /**
+         * Remove the given key, and its value, from the store.
+         *
+         * @param key The key to remove.
+         *
+         * @return DEVICE_OK on success, DEVICE_NO_DATA if the key is not present, or DEVICE_NO_RESOURCES if the log is full.
+         */
+        int remove(ManagedString key);
+
+        /**
+         * Determine the number of keys in the store.
+         *
+         * @return The number of keys.
+         */
+        int size();
+
+        /**
+         * Erase every page of the log, removing all keys.
+         *
+         * @return DEVICE_OK on success.
+         */
+        int wipe();
+
+        /**
+         * Perform one step of compaction: the live records of the oldest page are copied forward, and that page is erased.
+         * This is normally called by the background compaction fiber.
+         *
+         * @return DEVICE_OK if a page was reclaimed, DEVICE_NO_DATA if no page needs reclaiming, or DEVICE_NO_RESOURCES
+         *         if there is no room to copy the live records of the oldest page.
+         */
+        int compact();
+
+        private:
+
+        /**
+         * Rebuild the index and page state from the log, erasing any page that does not hold a valid log.
+         * This is done the first time the store is used.
+         */
+        void load();
+
+        /**
+         * Replay the records of the given page into the index, and determine the end of those records.
+         *
+         * @param page The page to replay.
+         *
+         * @return The address at which the next record may be written in the page.
+         */
+        uint32_t replay(int page);
+
+        /**
+         * Read the record at the given address.
+         *
+         * @param address The address of the record.
+         * @param limit The end of the page holding the record.
+         * @param buffer Set to the record. Must hold MICROBIT_KEY_VALUE_LOG_RECORD_WORDS words.
+         *
+         * @return The size of the record in bytes, or zero if there is no further record in the page.
+         */
+        uint32_t readRecord(uint32_t address, uint32_t limit, uint32_t *buffer);
+
+        /**
+         * Find the index slot for the given key.
+         *
+         * @param key The key to look up.
+         * @param length The length of the key.
+         * @param empty If not NULL, set to the first slot the key could be inserted at, if it is not present.
+         *
+         * @return The index of the slot holding the key, or -1 if it is not present.
+         */
+        int find(const char *key, int length, int *empty = NULL);
+
+        /**
+         * Record the record at the given address as the latest for its key, or remove its key.
+         *
+         * @param address The address of the record.
+         * @param key The key of the record.
+         * @param length The length of the key.
+         * @param remove true if the record removes its key.
+         *
+         * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if the index is full.
+         */
+        int updateIndex(uint32_t address, const char *key, int length, bool remove);
+
+        /**
+         * Rebuild the index in place, discarding the slots of removed keys.
+         */
+        void rehash();
+
+        /**
+         * Append a record to the log, taking a new page into use or compacting the log if the active page is full.
+         *
+         * @param key The key of the record.
+         * @param length The length of the key.
+         * @param data The value of the record.
+         * @param dataSize The length of the value, or MICROBIT_KEY_VALUE_LOG_REMOVED.
+         * @param reserve The number of free pages that must remain after a new page is taken into use.
+         *
+         * @return The address of the record on success, or zero if the log is full.
+         */
+        uint32_t append(const char *key, int length, const uint8_t *data, int dataSize, int reserve = 1);
+
+        /**
+         * Copy the live records of the oldest page forward, and erase it. The caller must hold the mutex.
+         *
+         * @return DEVICE_OK if a page was reclaimed, DEVICE_NO_DATA if no page needs reclaiming, or
+         *         DEVICE_NO_RESOURCES if there is no room to copy the live records of the oldest page.
+         */
+        int reclaim();
+
+        /**
+         * Take a free page into use as the active page.
+         *
+         * @param reserve The number of free pages that must remain afterwards.
+         *
+         * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if not enough pages are free.
+         */
+        int activate(int reserve);
+
+        /**
+         * Determine the number of free pages.
+         */
+        int freePages();
+
+        /**
+         * Determine the page in use with the lowest sequence number.
+         *
+         * @return The oldest page, or -1 if no page is in use.
+         */
+        int oldestPage();
+
+        /**
+         * Start the background compaction fiber, if it is not already running.
+         */
+        void startCompaction();
+
+        /**
+         * Body of the background compaction fiber.
+         *
+         * @param log The MicroBitKeyValueLog to compact.
+         */
+        static void compactionFiber(void *log);
+    };
+}
+
+#endif
@@ -94,7 +94,8 @@ DEALINGS IN THE SOFTWARE.
 
 #include "MicroBitUSBFlashManager.h"
 #include "FSCache.h"
-#include "NRF52Serial.h"
+#include "MicroBitSerialQueue.h"
+#include "MicroBitLogFormat.h"
 #include "ManagedString.h"
 
 #ifndef CONFIG_MICROBIT_LOG_METADATA_SIZE
@@ -114,20 +115,70 @@ DEALINGS IN THE SOFTWARE.
 #define CONFIG_MICROBIT_LOG_FULL_ERASE_BY_DEFAULT    false
 #endif
 
+#ifndef CONFIG_MICROBIT_LOG_DEFAULT_DECIMALS
+#define CONFIG_MICROBIT_LOG_DEFAULT_DECIMALS    2
+#endif
+
 #ifndef CONFIG_MICROBIT_LOG_INVALID_CHAR_VALUE
 #define CONFIG_MICROBIT_LOG_INVALID_CHAR_VALUE  '_'
 #endif
 
+#ifndef CONFIG_MICROBIT_LOG_WRITE_BEHIND_SIZE
+#define CONFIG_MICROBIT_LOG_WRITE_BEHIND_SIZE   1024
+#endif
+
+#ifndef CONFIG_MICROBIT_LOG_WRITE_BEHIND_HIGH_WATER
+#define CONFIG_MICROBIT_LOG_WRITE_BEHIND_HIGH_WATER 512
+#endif
+
+#ifndef CONFIG_MICROBIT_LOG_PRE_ERASE_PAGES
+#define CONFIG_MICROBIT_LOG_PRE_ERASE_PAGES     1
+#endif
+
+#ifndef CONFIG_MICROBIT_LOG_WRITE_BEHIND_PERIOD_MS
+#define CONFIG_MICROBIT_LOG_WRITE_BEHIND_PERIOD_MS  1000
+#endif
+
 #define MICROBIT_LOG_VERSION                "UBIT_LOG_FS_V_002\n"           // MUST be 18 characters.
 #define MICROBIT_LOG_JOURNAL_ENTRY_SIZE     8
+#define MICROBIT_LOG_ROW_BUFFER_GRANULARITY 32                              // Row buffer allocations are rounded up to a multiple of this size.
+#define MICROBIT_LOG_SCAN_CHUNK_SIZE        32                              // The number of bytes read at a time when searching for the end of the data.
+#define MICROBIT_LOG_INITIAL_COLUMNS        8                               // The number of columns space is first allocated for. Doubled as required.
+#define MICROBIT_LOG_NO_COLUMN              0xFFFF                          // Marks a column handle that no longer refers to a column.
+#define MICROBIT_LOG_ROLL_SHIFT             24                              // Bit position of the wrap count in a journalled data length.
+#define MICROBIT_LOG_ROLL_OFFSET_MASK       0x00FFFFFF                      // The offset of the end of the data within a journalled data length.
+
+//
+// Binary record format. Field values are stored as tagged tokens, with all other bytes held below 0x80.
+// Numbers are stored as a magnitude in big endian groups of seven bits, terminated by the next tag.
+// No byte of 0xFF is ever written, as this marks the end of the data.
+//
+#define MICROBIT_LOG_BINARY_ROW_END         0x81                            // Terminates a row. Also written at the start of the data of a binary log.
+#define MICROBIT_LOG_BINARY_EMPTY           0x90                            // An empty field.
+#define MICROBIT_LOG_BINARY_EMPTY_RUN_MAX   16                              // Tags 0x91 to 0x9F hold a run of 2 to this many empty fields.
+#define MICROBIT_LOG_BINARY_POSITIVE        0xA0                            // A non-negative number. The low four bits hold the number of decimal places.
+#define MICROBIT_LOG_BINARY_NEGATIVE        0xB0                            // A negative number. The low four bits hold the number of decimal places.
+#define MICROBIT_LOG_BINARY_TEXT            0xC0                            // A text field, followed by its characters.
+#define MICROBIT_LOG_BINARY_ESCAPE          0xC1                            // A character of 0x80 or above, followed by its low seven bits.
+#define MICROBIT_LOG_BINARY_MAX_DIGITS      18                              // The most digits a number may have to be stored in binary form.
+#define MICROBIT_LOG_BINARY_NUMBER_SIZE     11                              // The largest encoded size of a number, including its tag.
+#define MICROBIT_LOG_TOKEN_SIZE             32                              // Space for the CSV rendering of any one binary token.
 
 #define MICROBIT_LOG_STATUS_INITIALIZED     0x0001
 #define MICROBIT_LOG_STATUS_ROW_STARTED     0x0002
 #define MICROBIT_LOG_STATUS_FULL            0x0004
 #define MICROBIT_LOG_STATUS_SERIAL_MIRROR   0x0008
+#define MICROBIT_LOG_STATUS_WRITE_BEHIND    0x0010
+#define MICROBIT_LOG_STATUS_BACKGROUND_FIBER 0x0020
+#define MICROBIT_LOG_STATUS_CSV_LENGTH      0x0040
+#define MICROBIT_LOG_STATUS_PRE_ERASE       0x0080
+#define MICROBIT_LOG_STATUS_ROLLING         0x0100
+#define MICROBIT_LOG_STATUS_ROLL_SKIP       0x0200
 
 
 #define MICROBIT_LOG_EVT_LOG_FULL           1
+#define MICROBIT_LOG_EVT_FLUSH              2
+#define MICROBIT_LOG_EVT_PRE_ERASE          3
 
 namespace codal
 {
@@ -144,6 +195,29 @@ namespace codal
         public:
         ManagedString key;
         ManagedString value;
+        char number[MICROBIT_LOG_NUMBER_SIZE];     // A numeric value, formatted in place. Used in preference to value if not empty.
+        uint16_t handle;                            // The handle by which this column is known, independent of its position.
+
+        ColumnEntry()
+        {
+            number[0] = 0;
+            handle = MICROBIT_LOG_NO_COLUMN;
+        }
+
+        const char *getValue()
+        {
+            return number[0] ? number : value.toCharArray();
+        }
+
+        int getValueLength()
+        {
+            return number[0] ? strlen(number) : value.length();
+        }
+
+        bool hasValue()
+        {
+            return number[0] || value.length();
+        }
     };
 
     
@@ -184,6 +258,19 @@ namespace codal
     };
 
 
+    enum class LogFormat
+    {
+        CSV = 0,          // Rows are stored as lines of CSV text
+        Binary = 1        // Rows are stored as compact binary records, rendered as CSV when read
+    };
+
+    struct LogDecoder
+    {
+        uint32_t    address;    // Logical address of the next byte to decode.
+        uint32_t    offset;     // Offset in the rendered CSV of the first character of that byte.
+        bool        inRow;      // true if a binary row has been started, but not yet terminated.
+    };
+
     enum class DataFormat
     {
         HTMLHeader = 0,   // The HTML header without the data
@@ -191,6 +278,83 @@ namespace codal
         CSV = 2           // CSV data
     };
 
+    /**
+     * Read position within the data of a MicroBitLog, for streaming it sequentially.
+     * Each cursor holds the block of data around its position, so that small sequential reads
+     * are served from RAM, and the log itself is only accessed once per CONFIG_MICROBIT_LOG_CACHE_BLOCK_SIZE bytes.
+     */
+    class MicroBitLogCursor
+    {
+        friend class MicroBitLog;
+
+        DataFormat  format;                                         // The format of the data being read.
+        uint32_t    index;                                          // The index of the next byte to read.
+        uint32_t    length;                                         // The complete length of the data, as returned from getDataLength.
+        uint32_t    blockIndex;                                     // The index of the first byte held in block.
+        uint32_t    blockLength;                                    // The number of valid bytes held in block.
+        bool        open;                                           // true if the cursor has been opened.
+        uint8_t     block[CONFIG_MICROBIT_LOG_CACHE_BLOCK_SIZE];    // The block of data around index.
+
+        public:
+
+        /**
+         * Constructor.
+         * The cursor must be opened with MicroBitLog::openCursor() before use.
+         */
+        MicroBitLogCursor()
+        {
+            format = DataFormat::CSV;
+            index = 0;
+            length = 0;
+            blockIndex = 0;
+            blockLength = 0;
+            open = false;
+        }
+
+        /**
+         * Moves the cursor to the given index. Seeking within the block already held does not access the log.
+         *
+         * @param index the index of the next byte to read.
+         */
+        void seek(uint32_t index)
+        {
+            this->index = index;
+        }
+
+        /**
+         * Determines the index of the next byte to be read.
+         *
+         * @return the index of the cursor.
+         */
+        uint32_t getIndex()
+        {
+            return index;
+        }
+
+        /**
+         * Determines the complete length of the data being read, as determined when the cursor was opened.
+         *
+         * @return the length of the data, or zero if the cursor is not open.
+         */
+        uint32_t getLength()
+        {
+            return open ? length : 0;
+        }
+
+        /**
+         * Determines if the cursor is open for the given data.
+         *
+         * @param format the format of the data.
+         * @param length the complete length of the data.
+         *
+         * @return true if the cursor has been opened for the given format and length, false otherwise.
+         */
+        bool isOpen(DataFormat format, uint32_t length)
+        {
+            return open && this->format == format && this->length == length;
+        }
+    };
+
     /**
      * Class definition for MicroBitLog. A simple text only, append only, single file log file system.
      * Also contains a key/value pair abstraction to enable dynamic creation of CSV based logfiles.
@@ -200,10 +364,17 @@ namespace codal
         private:
         MicroBitUSBFlashManager         &flash;             // Non-volatile memory controller to use for storage.
         MicroBitPowerManager            &power;             // To obtain the Interface chip firmware (DAPLink) version.
-        NRF52Serial                     &serial;            // Reference to serial port used for data mirroring.
+        MicroBitSerialQueue             &serial;            // Queue in front of the serial port used for data mirroring.
         FSCache                         cache;              // Write through RAM cache.
         uint32_t                        status;             // Status flags.
         FiberLock                       mutex;              // Mutual exclusion primitive to serialise APi calls.
+        FiberLock                       flushLock;          // Mutual exclusion primitive to serialise access to flash storage with the background fiber.
+
+        uint8_t*                        writeBehindBuffer;  // Ring buffer in which rows are staged before being written to flash, or NULL if disabled.
+        uint32_t                        writeBehindHead;    // Index in writeBehindBuffer at which the next row will be staged.
+        uint32_t                        writeBehindTail;    // Index in writeBehindBuffer of the oldest staged data.
+        uint32_t                        writeBehindLength;  // Number of bytes currently staged in writeBehindBuffer.
+        uint32_t                        writeBehindHighWater; // Number of staged bytes at which a background flush is started.
 
         uint32_t                        startAddress;       // Logical address of the start of the Log file system.
         uint32_t                        journalPages;       // Number of physical pages allocated to journalling.
@@ -212,15 +383,29 @@ namespace codal
         uint32_t                        dataStart;          // Logical address of the start of the Data section.
         uint32_t                        dataEnd;            // Logical address of the end of valid data.
         uint32_t                        logEnd;             // Logical address of the end of the file system space.
+        uint32_t                        erasedEnd;          // Logical address of the end of the pages known to be erased beyond dataEnd.
+        uint32_t                        ringEnd;            // Logical address of the end of the pages a rolling log wraps around.
+        uint32_t                        oldest;             // Logical address of the oldest data held. Only differs from dataStart in rolling logs.
+        uint32_t                        rollCount;          // The number of times a rolling log has wrapped around, modulo 255.
+        uint32_t                        rollSkip;           // The length of the partial row at the start of the data of a rolled log.
         uint32_t                        headingStart;       // Logical address of the start of the column header data. Zero if no data is present.
         uint32_t                        headingLength;      // The length (in bytes) of the column header data.
         uint32_t                        headingCount;       // Total number of headings in the current log.
+        uint32_t                        headingCapacity;    // The number of headings space has been allocated for in rowData.
+        uint16_t*                       columnIndex;        // The position in rowData of the column with each handle.
+        uint32_t                        columnHandles;      // The number of column handles issued.
+        uint32_t                        columnIndexSize;    // The number of handles space has been allocated for in columnIndex.
         bool                            headingsChanged;    // Flag to indicate if a row has been added that contains new columns.
         bool                            timeStampChanged;   // Flag to indicate if a timestamp format has changed.
 
         struct ColumnEntry*             rowData;            // Collection of key/value pairs. Used to accumulate each data row.
+        char*                           rowBuffer;          // Reusable buffer into which each line of CSV is serialized.
+        uint32_t                        rowBufferSize;      // The size of rowBuffer, in bytes.
         struct MicroBitLogMetaData      metaData;           // Snapshot of the metadata held in flash storage.
         TimeStampFormat                 timeStampFormat;    // The format of timestamp to log on each row.
+        LogFormat                       logFormat;          // The format in which rows are stored.
+        uint32_t                        csvLength;          // The length of the data when rendered as CSV. Only valid in binary logs.
+        LogDecoder                      decoder;            // The position of the last read of a binary log, from which the next read resumes.
         ManagedString                   timeStampHeading;   // The title of the timestamp column, including units.
 
         const static uint8_t            header[2048];       // static header to prepend to FS in physical storage.
@@ -230,7 +415,7 @@ namespace codal
         /**
          * Constructor.
          */
-        MicroBitLog(MicroBitUSBFlashManager &flash, MicroBitPowerManager &power, NRF52Serial &serial);
+        MicroBitLog(MicroBitUSBFlashManager &flash, MicroBitPowerManager &power, MicroBitSerialQueue &serial);
 
         /**
          * Destructor.
@@ -251,6 +436,32 @@ namespace codal
          */
         bool isFull();
 
+        /**
+         * Determines how much of the space available for data the log is using.
+         * A log is not created if none is present.
+         *
+         * @return the percentage of the data area in use, from 0 to 100, or DEVICE_NO_DATA if no log is present.
+         * A rolling log that has wrapped around is reported as 100.
+         */
+        int getFillLevel();
+
+        /**
+         * Retrieves the hit, miss and eviction counts of the cache in front of flash storage.
+         * Each miss costs a read of one cache block from the interface chip.
+         *
+         * @return the cache statistics since the log was created.
+         */
+        FSCacheStatistics getCacheStatistics();
+
+        /**
+         * Shares the RAM used to cache flash storage with other caches, within the budget of the given pool.
+         * By default, the log's cache holds up to four blocks of its own. Blocks held in the cache are written out first.
+         *
+         * @param pool the pool to join, or NULL to return to a cache of the log's own.
+         * @param priority the pages of the caches in a pool with the lowest priority are taken first.
+         */
+        void setCachePool(FSCachePool *pool, int priority = 0);
+
         /**
          * Sets the visibility of the MY_DATA.HTM file on the MICROBIT drive.
          * Only updates the persistent state of this visibility if it has changed.
@@ -293,6 +504,89 @@ namespace codal
          */
         void setSerialMirroring(bool enable);
 
+        /**
+         * Enables or disables write-behind buffering of the log.
+         *
+         * When enabled, completed rows are staged in a RAM buffer of CONFIG_MICROBIT_LOG_WRITE_BEHIND_SIZE bytes
+         * and endRow() returns without waiting for flash storage. A background fiber writes staged data to
+         * flash once highWater bytes are waiting, every CONFIG_MICROBIT_LOG_WRITE_BEHIND_PERIOD_MS milliseconds,
+         * or when flush() is called. A row is only written synchronously if the buffer is full.
+         *
+         * Staged data is lost if power is removed before it is written. Use sync() where durability matters.
+         *
+         * @param enable true to enable write-behind buffering, false to write each row directly to flash.
+         * @param highWater the number of staged bytes at which a background flush is started.
+         *
+         * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if highWater is larger than the buffer,
+         * or DEVICE_NO_RESOURCES if the buffer could not be allocated.
+         */
+        int setWriteBehind(bool enable, uint32_t highWater = CONFIG_MICROBIT_LOG_WRITE_BEHIND_HIGH_WATER);
+
+        /**
+         * Selects the format in which rows are stored.
+         *
+         * LogFormat::Binary stores each numeric value as a scaled integer in a few bytes, typically fitting around
+         * three times as many rows into the log. Consecutive empty fields are stored as a run, so rows of wide tables
+         * that populate only a few columns take little more space than those columns. readData() and getDataLength() render binary rows as CSV, so
+         * readers see the same data in either format. The MY_DATA.HTM file on the MICROBIT drive only shows data
+         * logged in CSV format.
+         *
+         * The format is a property of the log, and can only be changed while the log is empty. A binary log is
+         * recognised as such after a reset.
+         *
+         * @param format the format in which to store rows.
+         *
+         * @return DEVICE_OK on success, or DEVICE_INVALID_STATE if the log already holds data in another format.
+         */
+        int setFormat(LogFormat format);
+
+        /**
+         * Determines the format in which rows are stored.
+         *
+         * @return the format of the log.
+         */
+        LogFormat getFormat();
+
+        /**
+         * Determines whether the log rolls over when it fills, rather than stopping.
+         *
+         * A rolling log erases the page holding its oldest data to make room for new rows, so that it always
+         * holds the most recent data. readData() and getDataLength() render a log that has rolled over as the
+         * current column headings followed by the complete rows that remain. The MY_DATA.HTM file on the MICROBIT
+         * drive only shows the rows written since the log last wrapped around.
+         *
+         * Only CSV logs can roll over. Once a log has rolled over, it remains a rolling log until it is cleared,
+         * and is recognised as such after a reset.
+         *
+         * @param enable true to roll over when the log fills, false to stop.
+         *
+         * @return DEVICE_OK on success, or DEVICE_INVALID_STATE if the log is binary, full or has already rolled over.
+         */
+        int setRolling(bool enable);
+
+        /**
+         * Determines whether the log rolls over when it fills.
+         *
+         * @return true if the log is a rolling log, false otherwise.
+         */
+        bool isRolling();
+
+        /**
+         * Requests that any staged data is written to flash by the background fiber.
+         * Returns immediately, without waiting for the data to be written.
+         *
+         * @return DEVICE_OK on success.
+         */
+        int flush();
+
+        /**
+         * Writes any staged data to flash, and waits for it to complete.
+         * When this method returns, all previously logged rows are held in persistent storage.
+         *
+         * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if the log became full.
+         */
+        int sync();
+
 
         /**
          * Creates a new row in the log, ready to be populated by logData()
@@ -319,6 +613,127 @@ namespace codal
          */
         int logData(ManagedString key, ManagedString value);
 
+        /**
+         * Populates the current row with the given key and integer value.
+         * The value is formatted in place, without the use of ManagedString.
+         *
+         * @param key the name of the key column) to set.
+         * @param value the value to insert
+         *
+         * @return DEVICE_OK on success.
+         */
+        int logData(const char *key, int value);
+
+        /**
+         * Populates the current row with the given key and unsigned integer value.
+         * The value is formatted in place, without the use of ManagedString.
+         *
+         * @param key the name of the key column) to set.
+         * @param value the value to insert
+         *
+         * @return DEVICE_OK on success.
+         */
+        int logData(const char *key, unsigned int value);
+
+        /**
+         * Populates the current row with the given key and floating point value.
+         * The value is formatted in place, without the use of ManagedString.
+         *
+         * @param key the name of the key column) to set.
+         * @param value the value to insert
+         * @param decimals the number of decimal places to log, up to MICROBIT_LOG_MAX_DECIMALS.
+         *
+         * @return DEVICE_OK on success.
+         */
+        int logData(const char *key, double value, int decimals = CONFIG_MICROBIT_LOG_DEFAULT_DECIMALS);
+
+        /**
+         * Declares a column, if it does not already exist, and returns a handle by which it may be populated.
+         * Populating a row through column handles avoids searching for each column by name.
+         *
+         * Handles remain valid until the log is cleared, even as further columns are added.
+         *
+         * @param key the name of the column.
+         *
+         * @return the handle of the column on success, or DEVICE_NO_RESOURCES if there is insufficient memory.
+         *
+         * @code
+         * int x = log.getColumn("x");
+         * int y = log.getColumn("y");
+         *
+         * while(1)
+         * {
+         *     log.beginRow();
+         *     log.logData(x, accelerometer.getX());
+         *     log.logData(y, accelerometer.getY());
+         *     log.endRow();
+         * }
+         * @endcode
+         */
+        int getColumn(ManagedString key);
+
+        /**
+         * Declares several columns at once, in order, and returns their handles.
+         *
+         * @param keys the names of the columns.
+         * @param count the number of columns.
+         * @param handles an array of count entries, into which the handle of each column is placed.
+         *
+         * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the arrays are invalid, or DEVICE_NO_RESOURCES if there is insufficient memory.
+         */
+        int getColumns(const char * const *keys, int count, int *handles);
+
+        /**
+         * Populates the current row with the given value, in the column with the given handle.
+         *
+         * @param column the handle of the column to set, as returned by getColumn().
+         * @param value the value to insert
+         *
+         * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the handle is invalid.
+         */
+        int logData(int column, ManagedString value);
+
+        /**
+         * Populates the current row with the given value, in the column with the given handle.
+         *
+         * @param column the handle of the column to set, as returned by getColumn().
+         * @param value the value to insert
+         *
+         * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the handle is invalid.
+         */
+        int logData(int column, const char *value);
+
+        /**
+         * Populates the current row with the given integer value, in the column with the given handle.
+         *
+         * @param column the handle of the column to set, as returned by getColumn().
+         * @param value the value to insert
+         *
+         * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the handle is invalid.
+         */
+        int logData(int column, int value);
+
+        /**
+         * Populates the current row with the given unsigned integer value, in the column with the given handle.
+         *
+         * @param column the handle of the column to set, as returned by getColumn().
+         * @param value the value to insert
+         *
+         * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the handle is invalid.
+         */
+        int logData(int column, unsigned int value);
+
+        /**
+         * Populates the current row with the given floating point value, in the column with the given handle.
+         *
+         * @param column the handle of the column to set, as returned by getColumn().
+         * @param value the value to insert
+         * @param decimals the number of decimal places to log, up to MICROBIT_LOG_MAX_DECIMALS.
+         *
+         * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the handle or number of decimals is invalid.
+         */
+        int logData(int column, double value, int decimals = CONFIG_MICROBIT_LOG_DEFAULT_DECIMALS);
+
         /**
          * Complete a row in the log, and pushes to persistent storage.
          * @return DEVICE_OK on success.
@@ -361,6 +776,55 @@ namespace codal
          */
         int readData(void *data, uint32_t index, uint32_t len, DataFormat format, uint32_t length);
 
+        /**
+         * Prepares a cursor to read the recorded data sequentially, from the beginning.
+         * @param cursor the cursor to open
+         * @param format the data format
+         *          DataFormat::HTMLHeader = 0,   - The HTML header without data
+         *          DataFormat::HTML = 1,               - The entire HTML file with data
+         *          DataFormat::CSV = 2                   - CSV data
+         * @param length expected complete length returned from getDataLength, or zero to use the current length
+         * @return DEVICE_OK on success
+         */
+        int openCursor(MicroBitLogCursor &cursor, DataFormat format, uint32_t length = 0);
+
+        /**
+         * Read the recorded data from the position of the given cursor, and advance the cursor.
+         * Whole blocks of CONFIG_MICROBIT_LOG_CACHE_BLOCK_SIZE bytes are read ahead into the cursor, so that
+         * subsequent small reads do not access the log.
+         * @param cursor an open cursor
+         * @param data pointer to memory to store the data
+         * @param len length of the data to fetch
+         * @return the number of bytes read, which is less than len only at the end of the data;
+         * DEVICE_INVALID_STATE if the cursor is not open; DEVICE_INVALID_PARAMETER if data is not available for the request
+         */
+        int read(MicroBitLogCursor &cursor, void *data, uint32_t len);
+
+        /**
+         * Determines the sequence number of the end of the log: the number of bytes stored since the log was last
+         * cleared, including any staged data. It increases with every row added, including when a rolling log
+         * discards its oldest data, so a host can tell whether anything has been added since it last looked.
+         * A value lower than one seen previously means the log has been cleared.
+         *
+         * @return the sequence number.
+         */
+        uint32_t getSequence();
+
+        /**
+         * Calculates the CRC32 of part of the recorded data, as read through readData(), so that a host
+         * can check whether a copy it already holds is still current without reading it again.
+         * @param crc set to the CRC32 of the data
+         * @param index  the index into the data
+         * @param len length of the data to include
+         * @param format the data format
+         *          DataFormat::HTMLHeader = 0,   - The HTML header without data
+         *          DataFormat::HTML = 1,               - The entire HTML file with data
+         *          DataFormat::CSV = 2                   - CSV data
+         * @param length expected complete length returned from getDataLength
+         * @return DEVICE_OK on success; DEVICE_INVALID_PARAMETER if data is not available for the request
+         */
+        int getCRC(uint32_t &crc, uint32_t index, uint32_t len, DataFormat format, uint32_t length);
+
     private:
 
         /**
@@ -368,6 +832,85 @@ namespace codal
          */
         void init();
 
+        /**
+         * Load an existing filesystem, or format a new one if not found.
+         * The caller must hold flushLock.
+         */
+        void mount();
+
+        /**
+         * Acquires exclusive access to flash storage, having first written out any staged data.
+         * Must be followed by a call to releaseStorage().
+         *
+         * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if the log became full.
+         */
+        int acquireStorage();
+
+        /**
+         * Releases exclusive access to flash storage, acquired through acquireStorage() or flushLock.
+         * Changes held in the cache are written to flash first, so the writes to a cache block between the two
+         * are coalesced into a single flash write, other than where the journal moves on (see _writeData()).
+         */
+        void releaseStorage();
+
+        /**
+         * Erases the next page ahead of the end of the data, if fewer than CONFIG_MICROBIT_LOG_PRE_ERASE_PAGES
+         * pages are already erased. The caller must hold flushLock.
+         *
+         * @return true if more pages remain to be erased, false otherwise.
+         */
+        bool preErase();
+
+        /**
+         * Erases the given page of the data section. In a rolling log, erasing the page holding the oldest
+         * data discards it. The caller must hold flushLock.
+         *
+         * @param page the logical address of the page to erase.
+         */
+        void erasePage(uint32_t page);
+
+        /**
+         * Determines the page following the given one, wrapping around in a rolling log.
+         *
+         * @param page the logical address of a page in the data section.
+         * @return the logical address of the following page.
+         */
+        uint32_t nextPage(uint32_t page);
+
+        /**
+         * Maps an address beyond the end of the ring of a rolling log back to the start of the data section.
+         *
+         * @param address a logical address, possibly beyond ringEnd.
+         * @return the logical address it refers to.
+         */
+        uint32_t ringAddress(uint32_t address);
+
+        /**
+         * Locates the oldest data of a rolling log, in the first page after dataEnd that is not erased.
+         *
+         * @return the logical address of the oldest data.
+         */
+        uint32_t findOldest();
+
+        /**
+         * Determines if a rolling log has discarded any of its data.
+         *
+         * @return true if the log has wrapped around or no longer starts at dataStart, false otherwise.
+         */
+        bool isRolled();
+
+        /**
+         * Starts the fiber that writes staged data and erases pages in the background, if it is not already running.
+         */
+        void startBackgroundFiber();
+
+        /**
+         * Locates the live journal entry by binary search, reading only a few entries.
+         *
+         * @return the logical address of the live journal entry, or zero if none could be found.
+         */
+        uint32_t findJournalEntry();
+
         /*
          * Private APIs methods.
          * These methods enable the functionality of the public APIs, but assume mutual exclusion has already been acquired.
@@ -380,8 +923,58 @@ namespace codal
         int _beginRow();
         int _endRow();
         int _logData(ManagedString key, ManagedString value);
+        int _logNumber(const char *key, const char *value);
+        int _logNumber(int column, const char *value);
+        int _logData(int column, ManagedString value);
+        int _getColumn(ManagedString key);
         int _logString(const char *s);
         int _logString(ManagedString s);
+        int _sync();
+
+        /**
+         * Appends the given data to the log, staging it if write-behind buffering is enabled.
+         *
+         * @param data the data to append.
+         * @param l the number of bytes to append.
+         * @param rendered the length of the data when rendered as CSV.
+         *
+         * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if the log is full.
+         */
+        int _append(const char *data, uint32_t l, uint32_t rendered);
+
+        /**
+         * Sends the given line of CSV over the serial port, if serial mirroring is enabled.
+         *
+         * @param data the line, including its trailing newline.
+         * @param l the length of the line.
+         */
+        void mirror(const char *data, uint32_t l);
+
+        /**
+         * Writes the given data to the end of the log in flash, updating the journal as required.
+         *
+         * @param data the data to write.
+         * @param l the number of bytes to write.
+         *
+         * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if the log is full.
+         */
+        int _writeData(const char *data, uint32_t l);
+
+        /**
+         * Writes all staged data to flash, in batches of at most one flash page.
+         * The caller must hold flushLock.
+         *
+         * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if the log became full.
+         */
+        int flushWriteBehind();
+
+        /**
+         * Entry point of the fiber that writes staged data to flash and erases pages ahead of the data
+         * in the background.
+         *
+         * @param log the MicroBitLog instance to service.
+         */
+        static void backgroundFiber(void *log);
 
         int _readData(uint8_t *data, uint32_t index, uint32_t len, DataFormat format, uint32_t length);
         
@@ -399,6 +992,80 @@ namespace codal
          */
         int _readSource( uint8_t *&data, uint32_t &index, uint32_t &len, uint32_t &srcIndex, const void *srcPtr, uint32_t srcAddress, uint32_t srcLen);
 
+        /**
+         * Read the data of a binary or rolled log, rendered as CSV
+         * @param data pointer reference to memory to store the data
+         * @param index  reference to the index into the data
+         * @param len reference to the length of the data to fetch
+         * @param srcIndex reference to the index where the rendered data should begin
+         * @param srcLen the length of the rendered data
+         * @return DEVICE_OK on success; DEVICE_INVALID_PARAMETER if data is not available for the request
+         * @note On success, the referenced pointers, indices and lengths are updated ready for the next call
+         */
+        int _readRendered( uint8_t *&data, uint32_t &index, uint32_t &len, uint32_t &srcIndex, uint32_t srcLen);
+
+        /**
+         * Renders part of the data of a binary log as CSV. Reads that follow on from the previous one resume
+         * where it finished; otherwise, the data is decoded from its start. Rolled CSV logs are rendered by renderRolled().
+         *
+         * @param offset the offset into the rendered CSV of the first character to read.
+         * @param data the buffer to fill.
+         * @param len the number of characters to read.
+         * @return DEVICE_OK on success; DEVICE_INVALID_PARAMETER if data is not available for the request
+         */
+        int renderData(uint32_t offset, uint8_t *data, uint32_t len);
+
+        /**
+         * Decodes the next token of a binary log, and renders it as CSV.
+         *
+         * @param d the decoder state, updated to follow the token. The offset is not changed.
+         * @param out a buffer of MICROBIT_LOG_TOKEN_SIZE characters, to hold the rendered token.
+         * @return the length of the rendered token.
+         */
+        int renderToken(LogDecoder &d, char *out);
+
+        /**
+         * Determines the length of the data when rendered as CSV, decoding the whole log if necessary.
+         *
+         * @return the length of the rendered data.
+         */
+        uint32_t _csvLength();
+
+        /**
+         * Determines the length of the data when read through readData().
+         *
+         * @return the length of the data, rendered as CSV.
+         */
+        uint32_t _dataLength();
+
+        /**
+         * Determines the number of bytes held, from the oldest data to dataEnd.
+         *
+         * @return the length of the stored data.
+         */
+        uint32_t storedLength();
+
+        /**
+         * Reads stored data, in the order it was written, from the oldest data onwards.
+         *
+         * @param offset the offset from the oldest data held.
+         * @param data the buffer to fill.
+         * @param len the number of bytes to read.
+         * @return DEVICE_OK on success, or the error returned by the cache.
+         */
+        int readStored(uint32_t offset, uint8_t *data, uint32_t len);
+
+        /**
+         * Renders part of the data of a rolled log as CSV: the current headings, followed by the stored data
+         * from the first complete row onwards.
+         *
+         * @param offset the offset into the rendered CSV of the first character to read.
+         * @param data the buffer to fill.
+         * @param len the number of characters to read.
+         * @return DEVICE_OK on success; DEVICE_INVALID_PARAMETER if data is not available for the request
+         */
+        int renderRolled(uint32_t offset, uint8_t *data, uint32_t len);
+
         /**
          * Add the given heading to the list of headings in use. If the heading already exists,
          * this method has no effect.
@@ -409,6 +1076,44 @@ namespace codal
          */
         void addHeading(ManagedString key, ManagedString value, bool head = false);
 
+        /**
+         * Issues a new column handle, growing columnIndex if necessary.
+         *
+         * @return the new handle, or MICROBIT_LOG_NO_COLUMN if there is insufficient memory.
+         */
+        uint16_t newColumnHandle();
+
+        /**
+         * Rebuilds columnIndex, following any change in the position of columns in rowData.
+         */
+        void indexColumns();
+
+        /**
+         * Serializes either the column headings or the values of the current row into rowBuffer as a line of CSV.
+         * The buffer is only reallocated if the line will not fit, so once it has grown to fit the widest row
+         * no further allocation takes place.
+         *
+         * @param headings true to serialize the column headings, false to serialize the values of the current row.
+         * @return the length of the line, excluding its NULL terminator, or DEVICE_NO_RESOURCES if there is insufficient memory.
+         */
+        int serializeRow(bool headings);
+
+        /**
+         * Serializes the values of the current row into rowBuffer as a binary record.
+         *
+         * @param rendered set to the length of the row when rendered as CSV.
+         * @return the length of the record, or DEVICE_NO_RESOURCES if there is insufficient memory.
+         */
+        int serializeBinaryRow(uint32_t &rendered);
+
+        /**
+         * Ensures rowBuffer holds at least the given number of bytes.
+         *
+         * @param length the number of bytes required.
+         * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if there is insufficient memory.
+         */
+        int reserveRowBuffer(uint32_t length);
+
         /**
          * Clean the given buffer of invalid LogFS symbols ("-->" and optionally ",\t\n")
          *
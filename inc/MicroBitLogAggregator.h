@@ -0,0 +1,208 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef MICROBIT_LOG_AGGREGATOR_H
+#define MICROBIT_LOG_AGGREGATOR_H
+
+#include "CodalConfig.h"
+#include "ManagedString.h"
+#include "MicroBitLog.h"
+
+// The number of columns an aggregator may summarise.
+#ifndef CONFIG_MICROBIT_LOG_AGGREGATE_COLUMNS
+#define CONFIG_MICROBIT_LOG_AGGREGATE_COLUMNS   8
+#endif
+
+// The default length of each window, in milliseconds.
+#ifndef CONFIG_MICROBIT_LOG_AGGREGATE_PERIOD_MS
+#define CONFIG_MICROBIT_LOG_AGGREGATE_PERIOD_MS 60000
+#endif
+
+// Statistics that may be logged for each column, at the end of each window. Each is logged in a column named
+// after the column summarised, with a suffix of _min, _max, _mean or _count.
+#define MICROBIT_LOG_AGGREGATE_MIN              0x01
+#define MICROBIT_LOG_AGGREGATE_MAX              0x02
+#define MICROBIT_LOG_AGGREGATE_MEAN             0x04
+#define MICROBIT_LOG_AGGREGATE_COUNT            0x08
+#define MICROBIT_LOG_AGGREGATE_ALL              0x0F
+
+#define MICROBIT_LOG_AGGREGATE_STATUS_ROW_STARTED   0x01
+#define MICROBIT_LOG_AGGREGATE_STATUS_TRIPPED       0x02
+
+namespace codal
+{
+    /**
+     * The state of one summarised column.
+     */
+    struct LogAggregateColumn
+    {
+        ManagedString   key;                // The name of the column, or empty if this entry is unused.
+        uint8_t         stats;              // The MICROBIT_LOG_AGGREGATE_* statistics logged.
+        uint8_t         decimals;           // The number of decimal places each statistic is logged with.
+        bool            thresholds;         // true if raw rows are logged when a sample lies outside low..high.
+        bool            present;            // true if the current row holds a sample for this column.
+        double          low;                // The lowest sample that does not trip the threshold.
+        double          high;               // The highest sample that does not trip the threshold.
+        double          sample;             // The sample in the current row.
+        double          min;                // The smallest sample in the current window.
+        double          max;                // The largest sample in the current window.
+        double          sum;                // The sum of the samples in the current window.
+        uint32_t        count;              // The number of samples in the current window.
+    };
+
+    /**
+     * An aggregating front end to MicroBitLog.
+     *
+     * Rows are built exactly as they are with MicroBitLog, but the samples of each column are accumulated over a window
+     * of time or a number of rows, and only one row summarising each window is written to the log. Optionally, a row is
+     * also written as it stands when any of its samples lies outside a given range, so that exceptional readings are kept
+     * in full. Logging a high rate sensor this way writes a tiny fraction of the data to flash.
+     *
+     * @code
+     * MicroBitLogAggregator aggregator(uBit.log);
+     *
+     * aggregator.addColumn("temperature", MICROBIT_LOG_AGGREGATE_MIN | MICROBIT_LOG_AGGREGATE_MAX | MICROBIT_LOG_AGGREGATE_MEAN);
+     * aggregator.setThreshold("temperature", 0, 40);
+     * aggregator.setWindow(60000);
+     *
+     * while(1)
+     * {
+     *     aggregator.beginRow();
+     *     aggregator.logData("temperature", uBit.thermometer.getTemperature());
+     *     aggregator.endRow();
+     *     uBit.sleep(100);
+     * }
+     * @endcode
+     */
+    class MicroBitLogAggregator
+    {
+        MicroBitLog                 &log;               // The log summary rows are written to.
+        LogAggregateColumn          columns[CONFIG_MICROBIT_LOG_AGGREGATE_COLUMNS];
+        uint32_t                    period;             // The length of a window in milliseconds, or zero if windows are not timed.
+        uint32_t                    windowRows;         // The number of rows in a window, or zero if windows are not counted.
+        uint32_t                    rows;               // The number of rows in the current window.
+        CODAL_TIMESTAMP             windowStart;        // The time at which the first row of the current window was started.
+        uint8_t                     status;             // Status flags.
+
+        /**
+         * Finds the column with the given name.
+         *
+         * @return The column, or NULL if it is not summarised.
+         */
+        LogAggregateColumn *find(const char *key);
+
+        /**
+         * Writes the current row to the log as it stands.
+         *
+         * @return DEVICE_OK on success, or the error reported by the log.
+         */
+        int logRaw();
+
+        public:
+
+        /**
+         * Constructor.
+         *
+         * @param log The log to write summary rows to.
+         */
+        MicroBitLogAggregator(MicroBitLog &log);
+
+        /**
+         * Summarises the given column. Samples logged for columns that are not summarised are ignored.
+         *
+         * @param key The name of the column.
+         * @param stats The statistics to log for it, as a combination of the MICROBIT_LOG_AGGREGATE_* flags.
+         * @param decimals The number of decimal places to log them with, up to MICROBIT_LOG_MAX_DECIMALS.
+         *
+         * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the parameters are invalid, or DEVICE_NO_RESOURCES
+         *         if CONFIG_MICROBIT_LOG_AGGREGATE_COLUMNS columns are already summarised.
+         */
+        int addColumn(const char *key, int stats = MICROBIT_LOG_AGGREGATE_ALL, int decimals = CONFIG_MICROBIT_LOG_DEFAULT_DECIMALS);
+
+        /**
+         * Configures the length of each window. A window ends with the first row completed once either limit is reached.
+         *
+         * @param period The length of a window in milliseconds, or zero if windows are not timed.
+         * @param rows The number of rows in a window, or zero if windows are not counted.
+         *
+         * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if both are zero.
+         */
+        int setWindow(uint32_t period, uint32_t rows = 0);
+
+        /**
+         * Logs every row in which the given column's sample lies outside the given range in full, as well as summarising it.
+         *
+         * @param key The name of a summarised column.
+         * @param low The lowest sample that does not trip the threshold.
+         * @param high The highest sample that does not trip the threshold.
+         *
+         * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the column is not summarised or the range is empty.
+         */
+        int setThreshold(const char *key, double low, double high);
+
+        /**
+         * Stops logging rows in full for the given column.
+         *
+         * @param key The name of a summarised column.
+         *
+         * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the column is not summarised.
+         */
+        int clearThreshold(const char *key);
+
+        /**
+         * Starts a new row. Any samples in a row that was not completed are discarded.
+         *
+         * @return DEVICE_OK on success.
+         */
+        int beginRow();
+
+        /**
+         * Places a sample in the current row.
+         *
+         * @param key The name of a summarised column.
+         * @param value The sample.
+         *
+         * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the column is not summarised, or DEVICE_INVALID_STATE
+         *         if no row has been started.
+         */
+        int logData(const char *key, double value);
+
+        /**
+         * Completes the current row, adding its samples to the window. If the row trips a threshold, it is logged in full.
+         * If the window is complete, a summary row is logged and a new window started.
+         *
+         * @return DEVICE_OK on success, DEVICE_INVALID_STATE if no row has been started, or the error reported by the log.
+         */
+        int endRow();
+
+        /**
+         * Logs a summary row for the current window, however far it has progressed, and starts a new window.
+         *
+         * @return DEVICE_OK on success, DEVICE_NO_DATA if the window is empty, or the error reported by the log.
+         */
+        int flush();
+    };
+}
+
+#endif
@@ -0,0 +1,72 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+
+#ifndef MICROBIT_LOG_FORMAT_H
+#define MICROBIT_LOG_FORMAT_H
+
+#include <stdint.h>
+
+#define MICROBIT_LOG_NUMBER_SIZE            24                              // Space for a formatted number, including its NULL terminator.
+#define MICROBIT_LOG_MAX_DECIMALS           6                               // The most decimal places a floating point value may be logged with.
+
+/**
+ * The number formatters used by MicroBitLog. They write into a fixed buffer rather than building a ManagedString,
+ * and depend on nothing else in the runtime, so they can also be built and tested on the host.
+ */
+namespace codal
+{
+    /**
+     * Formats an unsigned integer as decimal.
+     *
+     * @param buf the buffer to write to, which must have space for 21 characters.
+     * @param n the value to format.
+     * @param digits the minimum number of digits to write, padded with leading zeros.
+     * @return the number of characters written, excluding the NULL terminator.
+     */
+    int logFormatUnsigned(char *buf, uint64_t n, int digits = 1);
+
+    /**
+     * Formats a signed integer as decimal.
+     *
+     * @param buf the buffer to write to, which must have space for 21 characters.
+     * @param n the value to format.
+     * @return the number of characters written, excluding the NULL terminator.
+     */
+    int logFormatInteger(char *buf, int64_t n);
+
+    /**
+     * Formats a floating point value as decimal, rounded to the given number of decimal places. Values too large for
+     * their integer part to fit, from 1e15 upwards, are written in exponent form, with the same number of decimal places
+     * in the mantissa (for example "1.50e+15"). Only infinite values are written as "Infinity".
+     *
+     * @param buf the buffer to write to, which must have space for MICROBIT_LOG_NUMBER_SIZE characters.
+     * @param v the value to format.
+     * @param decimals the number of decimal places, up to MICROBIT_LOG_MAX_DECIMALS.
+     * @return the number of characters written, excluding the NULL terminator.
+     */
+    int logFormatFloat(char *buf, double v, int decimals);
+}
+
+#endif
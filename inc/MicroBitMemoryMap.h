@@ -36,6 +36,31 @@ DEALINGS IN THE SOFTWARE.
 #define REGION_MAKECODE 2
 #define REGION_PYTHON   3 
 
+// Phases of MicroBit::init() recorded by the boot profiler.
+#define MICROBIT_BOOT_PHASE_INIT        0       // init() entered.
+#define MICROBIT_BOOT_PHASE_KL27        1       // Power on delay for the interface chip complete.
+#define MICROBIT_BOOT_PHASE_BOOTLOADER  2       // Bootloader settings validated.
+#define MICROBIT_BOOT_PHASE_STORAGE     3       // Reflash policy applied to user storage.
+#define MICROBIT_BOOT_PHASE_SCHEDULER   4       // Fiber scheduler running.
+#define MICROBIT_BOOT_PHASE_COMPONENTS  5       // CodalComponent::init() called on all components.
+#define MICROBIT_BOOT_PHASE_IRQ         6       // Combined IRQ line arbitration started.
+#define MICROBIT_BOOT_PHASE_PAIRING     7       // Pairing mode probe complete.
+#define MICROBIT_BOOT_PHASE_BLE         8       // Bluetooth stack or high frequency clock started.
+#define MICROBIT_BOOT_PHASE_COMPLETE    9       // init() about to return.
+#define MICROBIT_BOOT_PHASE_COUNT       10
+
+#define MICROBIT_BOOT_PROFILE_MAGIC     0xB007F11E
+
+/**
+ * Boot phase timestamps, held in noinit memory so that they survive a reset until the next call to init().
+ */
+struct MicroBitBootProfile
+{
+  volatile uint32_t  magic;                                 // MICROBIT_BOOT_PROFILE_MAGIC once valid.
+  volatile uint32_t  phases;                                // Bitmask of the phases recorded in time[].
+  volatile uint32_t  time[MICROBIT_BOOT_PHASE_COUNT];       // Time each phase completed, in microseconds since reset.
+};
+
 /**
  * Structure definition for the reserved, noinit memory segment placed at the end of memory.
  */
@@ -45,6 +70,7 @@ struct MicroBitNoInitMemoryRegion
   volatile uint32_t  reserved1;
   volatile uint32_t  reserved2;
   volatile uint32_t  reserved3;
+  MicroBitBootProfile bootProfile;
 };
 
 /**
@@ -98,6 +124,16 @@ class MicroBitMemoryMap
 
     uint8_t regionCount = 0;
 
+    // The memory map found by the first instance, shared by all later instances until invalidated.
+    static MemoryMapStore cachedStore;
+    static uint8_t cachedRegionCount;
+    static bool cacheValid;
+
+    // CRC32 of each page of the application region, and a bitmap of those that are up to date.
+    // Allocated on first use, and maintained until the device is reset.
+    static uint32_t *pageHashes;
+    static uint32_t *pageHashValid;
+
     public:
 
     MemoryMapStore memoryMapStore;
@@ -109,6 +145,33 @@ class MicroBitMemoryMap
       */
     MicroBitMemoryMap();
 
+    /**
+      * Discards the cached memory map, such that the next instance created searches the FLASH memory again.
+      * This should be called whenever the program regions of FLASH memory are rewritten.
+      */
+    static void invalidate();
+
+    /**
+      * Determines the CRC32 of a page of the application region, such that a host can compare
+      * page hashes and transfer only those pages that have changed.
+      * Hashes are cached, and only recalculated when invalidated by invalidatePage().
+      *
+      * @param address the address of the start of the page.
+      * @param hash set to the CRC32 of the page.
+      *
+      * @return MICROBIT_OK on success, or MICROBIT_INVALID_PARAMETER if the address is not the start
+      * of a page in the application region.
+      */
+    static int getPageHash(uint32_t address, uint32_t &hash);
+
+    /**
+      * Marks the cached hash of the page holding the given address as out of date.
+      * This should be called whenever that page is erased or written.
+      *
+      * @param address an address within the page.
+      */
+    static void invalidatePage(uint32_t address);
+
     /**
      * Function for adding a Region to the end of the MemoryMap
      *
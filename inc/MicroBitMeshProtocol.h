@@ -0,0 +1,272 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef MICROBIT_MESH_PROTOCOL_H
+#define MICROBIT_MESH_PROTOCOL_H
+
+#include <stdint.h>
+
+/**
+ * The hardware independent decisions of the MicroBitMeshRadio flooding protocol: duplicate suppression, the relay
+ * policy and unicast routing. MicroBitMeshRadio applies these from its interrupt handler, and the host side simulator
+ * in samples/MeshSimulator applies the same code to many simulated nodes. This file must therefore not depend on CODAL
+ * or the nRF52, and takes the time and any randomness it needs from its caller.
+ */
+
+// Duplicate suppression configuration.
+// Each node remembers the most recent sequence number seen from up to this many originators.
+#ifndef MICROBIT_MESH_RADIO_ORIGIN_TABLE_SIZE
+#define MICROBIT_MESH_RADIO_ORIGIN_TABLE_SIZE        16
+#endif
+
+// Time after which an originator is forgotten, in milliseconds. This allows an originator that has been reset
+// (and hence restarted its sequence numbers) to be heard again.
+#ifndef MICROBIT_MESH_RADIO_ORIGIN_TIMEOUT_MS
+#define MICROBIT_MESH_RADIO_ORIGIN_TIMEOUT_MS        10000
+#endif
+
+// Unicast routing configuration.
+// Every accepted flood tells us how many hops we are from its originator, which is kept alongside the originator's
+// duplicate suppression record as the route back to it. Routes not refreshed by a flood for this long are not used.
+#ifndef MICROBIT_MESH_RADIO_ROUTE_TIMEOUT_MS
+#define MICROBIT_MESH_RADIO_ROUTE_TIMEOUT_MS         30000
+#endif
+
+// The number of hops beyond the shortest known path a unicast frame may take. Widening the path adds relays
+// that can cover for one that is missing or out of range, at the cost of airtime.
+#ifndef MICROBIT_MESH_RADIO_ROUTE_SLACK
+#define MICROBIT_MESH_RADIO_ROUTE_SLACK              1
+#endif
+
+// Neighbour table configuration.
+// A flood heard before it has been relayed (at zero hops) was sent by its originator, which is therefore a neighbour.
+// The link to each of up to this many neighbours is measured passively from the floods they originate.
+#ifndef MICROBIT_MESH_RADIO_NEIGHBOUR_TABLE_SIZE
+#define MICROBIT_MESH_RADIO_NEIGHBOUR_TABLE_SIZE     16
+#endif
+
+// Time after which a neighbour not heard directly is forgotten, in milliseconds.
+#ifndef MICROBIT_MESH_RADIO_NEIGHBOUR_TIMEOUT_MS
+#define MICROBIT_MESH_RADIO_NEIGHBOUR_TIMEOUT_MS     30000
+#endif
+
+// The number of a neighbour's floods over which its delivery ratio is measured. Older floods are given less weight.
+#ifndef MICROBIT_MESH_RADIO_NEIGHBOUR_PDR_WINDOW
+#define MICROBIT_MESH_RADIO_NEIGHBOUR_PDR_WINDOW     32
+#endif
+
+// Relay link quality thresholds that disable the check.
+#define MICROBIT_MESH_RADIO_RELAY_RSSI_ANY           -128
+#define MICROBIT_MESH_RADIO_RELAY_PDR_ANY            0
+
+// A unicast frame carries its destination, hop budget and inner protocol at the start of its payload.
+#define MICROBIT_MESH_RADIO_PROTOCOL_UNICAST         6
+#define MICROBIT_MESH_RADIO_UNICAST_HEADER_SIZE      4
+
+// The hop budget of a unicast frame sent without a route, which is flooded across the whole mesh.
+#define MICROBIT_MESH_RADIO_ROUTE_FLOOD              0xFF
+
+namespace codal
+{
+    struct MeshOriginRecord
+    {
+        uint16_t        origin;                             // Identifier of the originator, or 0 if this record is unused.
+        uint8_t         seqNo;                              // The most recent sequence number accepted from this originator.
+        uint32_t        lastSeen;                           // The time at which that frame was accepted, in milliseconds.
+        uint8_t         copies;                             // The number of redundant copies of that frame heard since.
+        uint8_t         distance;                           // The number of hops that frame took to reach us, and so our distance back to the originator.
+    };
+
+    struct MeshNeighbour
+    {
+        uint16_t        id;                                 // Originator id of the neighbour, or 0 if this record is unused.
+        int8_t          rssi;                               // Smoothed signal strength of the frames heard directly from it, in dBm.
+        uint8_t         pdr;                                // Percentage of its recent floods that reached us directly.
+        uint32_t        lastSeen;                           // The time at which it was last heard directly, in milliseconds.
+
+        int16_t         rssiAverage;                        // Smoothed signal strength, in 1/16 dBm.
+        uint8_t         seqNo;                              // The sequence number of the latest flood accepted from it.
+        uint8_t         expected;                           // The number of its floods within the measurement window.
+        uint8_t         received;                           // The number of those heard directly.
+    };
+
+    struct MeshUnicastHeader
+    {
+        uint16_t        destination;                        // Identifier of the node this frame is for.
+        uint8_t         budget;                             // The most hops the frame may take, or MICROBIT_MESH_RADIO_ROUTE_FLOOD.
+        uint8_t         protocol;                           // The protocol of the payload that follows.
+    } __attribute__((packed));
+
+    class MicroBitMeshProtocol
+    {
+        MeshOriginRecord        origins[MICROBIT_MESH_RADIO_ORIGIN_TABLE_SIZE]; // Recently heard originators, used to suppress duplicates.
+        MeshNeighbour           neighbours[MICROBIT_MESH_RADIO_NEIGHBOUR_TABLE_SIZE]; // Nodes recently heard directly.
+        uint8_t                 priorCopies;        // The number of copies heard of the previous flood from the originator of the frame just accepted.
+
+        /**
+         * Determines if any neighbour heard recently has a link that meets the relay link quality thresholds.
+         *
+         * @param now The current time, in milliseconds.
+         *
+         * @return true if such a neighbour exists, or if no neighbour has been heard recently.
+         */
+        bool hasRelayLink(uint32_t now);
+
+        public:
+        uint16_t                originId;           // Our identifier, placed in the frames we originate.
+        uint8_t                 relayProbability;   // The percentage of new frames we relay.
+        uint8_t                 relayCopyThreshold; // Skip relaying if this many copies of the originator's last flood were heard (0 to disable).
+        int8_t                  relayRssiThreshold; // Skip relaying unless a neighbour's link is at least this strong, in dBm.
+        uint8_t                 relayPdrThreshold;  // Skip relaying unless a neighbour's delivery ratio is at least this percentage.
+
+        /**
+         * Constructor.
+         *
+         * @param originId Our identifier, which must not be zero.
+         */
+        MicroBitMeshProtocol(uint16_t originId = 1);
+
+        /**
+         * Forgets every originator, and so every route, and every neighbour.
+         */
+        void reset();
+
+        /**
+         * Determines if a received frame is new, or a duplicate of one we have already seen.
+         * A record of the latest sequence number heard from each originator is kept, compared so
+         * that wraparound of the 8 bit sequence number is handled. If the frame is new, the record is updated.
+         *
+         * @param origin The originator of the frame.
+         *
+         * @param seqNo The sequence number of the frame.
+         *
+         * @param now The current time, in milliseconds.
+         *
+         * @return true if the frame is new and should be processed, false if it should be discarded.
+         */
+        bool compareSeqNo(uint16_t origin, uint8_t seqNo, uint32_t now);
+
+        /**
+         * Records the distance back to the originator of a newly accepted frame, as the route to use
+         * for unicast frames sent to it. Must be called immediately after compareSeqNo() accepts the frame.
+         *
+         * @param origin The originator of the frame.
+         *
+         * @param hops The number of times the frame was relayed before reaching us.
+         */
+        void learnRoute(uint16_t origin, uint8_t hops);
+
+        /**
+         * Updates the neighbour table with a newly accepted frame. Must be called immediately after compareSeqNo() accepts the frame.
+         *
+         * Frames that have not been relayed add or refresh their originator as a neighbour, and its signal strength.
+         * Frames from a known neighbour that have been relayed, or that follow a gap in its sequence numbers, are
+         * floods it sent that did not reach us directly, and lower its delivery ratio.
+         *
+         * @param origin The originator of the frame.
+         *
+         * @param seqNo The sequence number of the frame.
+         *
+         * @param hops The number of times the frame was relayed before reaching us.
+         *
+         * @param rssi The signal strength of the frame, in dBm.
+         *
+         * @param now The current time, in milliseconds.
+         */
+        void learnNeighbour(uint16_t origin, uint8_t seqNo, uint8_t hops, int rssi, uint32_t now);
+
+        /**
+         * Retrieves the neighbours heard directly within MICROBIT_MESH_RADIO_NEIGHBOUR_TIMEOUT_MS.
+         *
+         * @param neighbours The array to fill in.
+         *
+         * @param max The number of entries in the array.
+         *
+         * @param now The current time, in milliseconds.
+         *
+         * @return The number of entries filled in.
+         */
+        int getNeighbours(MeshNeighbour *neighbours, int max, uint32_t now);
+
+        /**
+         * Finds the route to the given node.
+         *
+         * @param destination The originator id of the node.
+         *
+         * @param now The current time, in milliseconds.
+         *
+         * @return The node's origin record, or NULL if no flood has been heard from it within MICROBIT_MESH_RADIO_ROUTE_TIMEOUT_MS.
+         */
+        MeshOriginRecord *getRoute(uint16_t destination, uint32_t now);
+
+        /**
+         * Forgets the route to the given node, so that frames sent to it are flooded until a flood from it is next heard.
+         *
+         * @param destination The originator id of the node.
+         */
+        void forgetRoute(uint16_t destination);
+
+        /**
+         * Determines the hop budget to give a unicast frame we originate.
+         *
+         * @param destination The originator id of the node the frame is for.
+         *
+         * @param now The current time, in milliseconds.
+         *
+         * @return The known distance to the destination plus MICROBIT_MESH_RADIO_ROUTE_SLACK, or MICROBIT_MESH_RADIO_ROUTE_FLOOD
+         *         if no route is known.
+         */
+        uint8_t getBudget(uint16_t destination, uint32_t now);
+
+        /**
+         * Applies the hop limit, relay policy and unicast routing to a newly accepted frame. Must be called
+         * immediately after compareSeqNo() accepts the frame.
+         *
+         * Routed unicast frames are only relayed by nodes that lie within the frame's hop budget of both its originator
+         * and its destination, which (with the budget set to the originator's distance from the destination) are those on
+         * the shortest paths between the two. As every such node relays the same, unmodified frame, concurrent relays still
+         * interfere constructively.
+         *
+         * Other frames are not relayed by a node whose links to all its neighbours fall below the relay link quality thresholds,
+         * as such a node is at the edge of the mesh, and its relays are heard unreliably, if at all.
+         *
+         * @param protocol The protocol of the frame.
+         *
+         * @param payload The payload of the frame.
+         *
+         * @param hops The number of times the frame was relayed before reaching us.
+         *
+         * @param ttl The hop limit of the frame.
+         *
+         * @param now The current time, in milliseconds.
+         *
+         * @param roll A uniformly distributed random number in the range 0..99, used for probabilistic relaying.
+         *
+         * @return true if this node should relay the frame, false if it should only be delivered.
+         */
+        bool shouldRelay(uint8_t protocol, const uint8_t *payload, uint8_t hops, uint8_t ttl, uint32_t now, int roll);
+    };
+}
+
+#endif
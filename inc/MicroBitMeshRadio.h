@@ -29,6 +29,7 @@ DEALINGS IN THE SOFTWARE.
 namespace codal
 {
     class MicroBitMeshRadio;
+    class MicroBitRadioBridge;
     struct SequencedFrameBuffer;
 }
 
@@ -39,6 +40,9 @@ namespace codal
 #include "MicroBitRadio.h"
 #include "MicroBitMeshRadioDatagram.h"
 #include "MicroBitMeshRadioEvent.h"
+#include "MicroBitMeshRadioFragment.h"
+#include "MicroBitMeshRadioAggregate.h"
+#include "MicroBitMeshProtocol.h"
 
 /**
  * Provides a simple broadcast radio abstraction, built upon the raw nrf51822 RADIO module.
@@ -46,37 +50,105 @@ namespace codal
  * The nrf51822 RADIO module supports a number of proprietary modes of operation in addition to the typical BLE usage.
  * This class uses one of these modes to enable simple, point to multipoint communication directly between micro:bits.
  *
- * TODO: The protocols implemented here do not currently perform any significant form of energy management,
- * which means that they will consume far more energy than their BLE equivalent. Later versions of the protocol
- * should look to address this through energy efficient broadcast techniques / sleep scheduling. In particular, the GLOSSY
- * approach to efficienct rebroadcast and network synchronisation would likely provide an effective future step.
+ * By default the receiver is left on permanently, which consumes far more energy than the BLE equivalent.
+ * setDutyCycle() may be used to instead wake the receiver only for short receive windows, kept aligned across
+ * the mesh by the time reference implied by each flood.
  *
- * TODO: Meshing should also be considered - again a GLOSSY approach may be effective here, and highly complementary to
- * the master/slave arachitecture of BLE.
+ * Meshing follows the GLOSSY approach: every node relays each new frame exactly MICROBIT_MESH_RADIO_RELAY_DELAY_US
+ * after it is received, with the hop count carried in the frame. Relays at the same distance from the originator therefore
+ * transmit concurrently and interfere constructively, and every node can derive the start time of the flood for free.
+ *
+ * Each flood also tells every node its distance from the originator. sendTo() uses this to confine a frame for a single
+ * node to the relays lying on the shortest paths to it, rather than the whole mesh, falling back to a flood if no route is known.
  *
  * TODO: This implementation only operates whilst the BLE stack is disabled. The nrf51822 provides a timeslot API to allow
  * BLE to cohabit with other protocols. Future work to allow this colocation would be benefical, and would also allow for the
  * creation of wireless BLE bridges.
  *
- * NOTE: This API does not contain any form of encryption, authentication or authorization. It's purpose is solely for use as a
- * teaching aid to demonstrate how simple communications operates, and to provide a sandpit through which learning can take place.
- * For serious applications, BLE should be considered a substantially more secure alternative.
+ * NOTE: By default this API does not contain any form of encryption, authentication or authorization. It's purpose is solely
+ * for use as a teaching aid to demonstrate how simple communications operates, and to provide a sandpit through which learning
+ * can take place. Giving a group a key through cipher.setKey() seals the payload of every flood sent to it with AES-CCM, bound
+ * to its originator and sequence number. Relays need no key. The routing header of unicast frames is read by every relay, so
+ * remains in the clear, but is authenticated with the payload. The hop count, time synchronization and route advertisement
+ * floods are read and updated by every relay, so remain in the clear and unauthenticated.
  */
 
 // Status Flags
 #define MICROBIT_MESH_RADIO_STATUS_INITIALISED       0x0001
 #define MICROBIT_MESH_RADIO_STATUS_DEEPSLEEP_IRQ     0x0002
 #define MICROBIT_MESH_RADIO_STATUS_DEEPSLEEP_INIT    0x0004
+#define MICROBIT_MESH_RADIO_STATUS_DUTY_CYCLE        0x0008
+#define MICROBIT_MESH_RADIO_STATUS_ASLEEP            0x0010
+#define MICROBIT_MESH_RADIO_STATUS_SCHEDULE_LISTENER 0x0020
+#define MICROBIT_MESH_RADIO_STATUS_TX_SLOT           0x0040
+#define MICROBIT_MESH_RADIO_STATUS_TIMESYNC_ROOT     0x0080
+#define MICROBIT_MESH_RADIO_STATUS_TIMESYNC_LISTENER 0x0100
+#define MICROBIT_MESH_RADIO_STATUS_HOP_LISTENER      0x0200
+#define MICROBIT_MESH_RADIO_STATUS_ROUTE_LISTENER    0x0400
+
+// Radio activity, as tracked by the interrupt handler.
+#define MICROBIT_MESH_RADIO_STATE_RX                 0       // Listening, or receiving a frame.
+#define MICROBIT_MESH_RADIO_STATE_RELAY              1       // Waiting for the relay slot of a received frame, or relaying it.
+#define MICROBIT_MESH_RADIO_STATE_TX                 2       // Originating a flood from the transmit queue.
 
 // Default configuration values
 #define MICROBIT_MESH_RADIO_BASE_ADDRESS             0x7542744d // uBtM
 #define MICROBIT_MESH_RADIO_DEFAULT_GROUP            0
 #define MICROBIT_MESH_RADIO_DEFAULT_TX_POWER         6
 #define MICROBIT_MESH_RADIO_DEFAULT_FREQUENCY        8 // up a freq, avoid normal radio
-#define MICROBIT_MESH_RADIO_HEADER_SIZE              4
+#define MICROBIT_MESH_RADIO_HEADER_SIZE              9
 #define MICROBIT_MESH_RADIO_MAXIMUM_RX_BUFFERS       4
+#define MICROBIT_MESH_RADIO_MAXIMUM_TX_BUFFERS       4
+
+// The default hop limit given to the floods we originate.
+#ifndef MICROBIT_MESH_RADIO_DEFAULT_TTL
+#define MICROBIT_MESH_RADIO_DEFAULT_TTL              8
+#endif
 #define MICROBIT_MESH_RADIO_POWER_LEVELS             8
 
+// Flood timing configuration.
+// Relays retransmit a fixed delay after the end of a reception. The delay is measured and applied
+// by TIMER0 and PPI rather than by software, so that all relays at the same hop distance transmit
+// within a fraction of a microsecond of one another (Glossy style constructive interference).
+// The delay must exceed the worst case interrupt latency plus the radio TX ramp up time.
+#ifndef MICROBIT_MESH_RADIO_RELAY_DELAY_US
+#define MICROBIT_MESH_RADIO_RELAY_DELAY_US           200
+#endif
+
+// Duty cycle configuration.
+// Receive windows open at a common time across the mesh. Originators wait this long after their window opens
+// before starting a flood, which gives receivers whose schedule is slightly behind time to wake up.
+#ifndef MICROBIT_MESH_RADIO_DUTY_CYCLE_GUARD_US
+#define MICROBIT_MESH_RADIO_DUTY_CYCLE_GUARD_US      2000
+#endif
+
+// Time for which the end of a receive window is deferred if a relay is in progress when it is due.
+#define MICROBIT_MESH_RADIO_DUTY_CYCLE_EXTEND_US     1000
+
+// Time synchronization configuration.
+// If no synchronization flood is heard from the current root for this long, the network clock is considered lost,
+// and another root may be adopted.
+#ifndef MICROBIT_MESH_RADIO_TIMESYNC_TIMEOUT_MS
+#define MICROBIT_MESH_RADIO_TIMESYNC_TIMEOUT_MS      60000
+#endif
+
+// The largest clock rate difference from the root we believe, in parts per billion. Larger estimates are discarded as noise.
+#define MICROBIT_MESH_RADIO_TIMESYNC_MAX_SKEW_PPB    1000000
+
+// The longest the radio is waited for to finish relaying or originating a flood, before it is reconfigured.
+#ifndef MICROBIT_MESH_RADIO_IDLE_TIMEOUT_MS
+#define MICROBIT_MESH_RADIO_IDLE_TIMEOUT_MS          100
+#endif
+
+// Frequency hopping configuration.
+// Time for which a hop is deferred if the radio is busy with a frame when it is due.
+#define MICROBIT_MESH_RADIO_HOP_DEFER_US             250
+
+// TODO: Replace this with a resource allocated version
+#ifndef MICROBIT_MESH_RADIO_PPI_CHANNEL_BASE
+#define MICROBIT_MESH_RADIO_PPI_CHANNEL_BASE         14
+#endif
+
 // Max packet size is configurable, so ensure maximum value is not exceeded
 // TODO: Update this value once issue codal-microbit-v2#383 is resolved
 // https://github.com/lancaster-university/codal-microbit-v2/issues/383
@@ -87,25 +159,55 @@ namespace codal
 // Known Protocol Numbers
 #define MICROBIT_MESH_RADIO_PROTOCOL_DATAGRAM        1       // A simple, single frame datagram. a little like UDP but with smaller packets. :-)
 #define MICROBIT_MESH_RADIO_PROTOCOL_EVENTBUS        2       // Transparent propogation of events from one micro:bit to another.
+#define MICROBIT_MESH_RADIO_PROTOCOL_DATAGRAM_BATCH  3       // Several small datagrams, carried in a single frame.
+#define MICROBIT_MESH_RADIO_PROTOCOL_FRAGMENT        4       // Part of a larger message, or a request for missing parts.
+#define MICROBIT_MESH_RADIO_PROTOCOL_TIMESYNC        5       // The time at which the flood was started, by the network time root.
+// MICROBIT_MESH_RADIO_PROTOCOL_UNICAST (6), a frame for a single destination relayed only along the route to it, is defined in MicroBitMeshProtocol.h.
+#define MICROBIT_MESH_RADIO_PROTOCOL_ROUTE           7       // An empty flood, sent so that the rest of the mesh learns its route to the originator.
+#define MICROBIT_MESH_RADIO_PROTOCOL_AGGREGATE       8       // An aggregation query, or a partial result, for immediate neighbours only.
 
 // Events
 #define MICROBIT_MESH_RADIO_EVT_DATAGRAM             1       // Event to signal that a new datagram has been received.
+#define MICROBIT_MESH_RADIO_EVT_WINDOW_OPEN          2       // Internal event to signal the start of a duty cycled receive window.
+#define MICROBIT_MESH_RADIO_EVT_WINDOW_CLOSE         3       // Internal event to signal the end of a duty cycled receive window.
+#define MICROBIT_MESH_RADIO_EVT_TX_SLOT              4       // Internal event to signal that new floods may be started in this window.
+#define MICROBIT_MESH_RADIO_EVT_TX_COMPLETE          5       // Event to signal that a queued frame has been transmitted.
+#define MICROBIT_MESH_RADIO_EVT_DATAGRAM_FLUSH       6       // Internal event to signal that aggregated datagrams are due to be sent.
+#define MICROBIT_MESH_RADIO_EVT_FRAGMENTED           7       // Event to signal that a fragmented message has been fully reassembled.
+#define MICROBIT_MESH_RADIO_EVT_FRAGMENT_TIMEOUT     8       // Internal event to signal that stalled reassemblies should be checked.
+#define MICROBIT_MESH_RADIO_EVT_FRAGMENT_RESEND      9       // Internal event to signal that fragments have been re-requested.
+#define MICROBIT_MESH_RADIO_EVT_TIMESYNC             10      // Internal event to signal that the network time root should send a synchronization flood.
+#define MICROBIT_MESH_RADIO_EVT_HOP                  11      // Internal event to signal the end of a frequency hopping slot.
+#define MICROBIT_MESH_RADIO_EVT_ROUTE_ADVERTISE      12      // Internal event to signal that a route advertisement flood is due.
+#define MICROBIT_MESH_RADIO_EVT_AGGREGATE_QUERY      13      // Event to signal that an aggregation query has arrived, and our reading will soon be reported.
+#define MICROBIT_MESH_RADIO_EVT_AGGREGATED           14      // Event to signal that an aggregation query we issued is complete.
+#define MICROBIT_MESH_RADIO_EVT_AGGREGATE_FORWARD    15      // Internal event to signal that an aggregation query should be passed on.
+#define MICROBIT_MESH_RADIO_EVT_AGGREGATE_REPORT     16      // Internal event to signal that our partial aggregation result is due.
 
 namespace codal
 {
 
 
+    // As for FrameBuffer, the frame as sent on air starts at the length field, and everything before it is local to this device.
     struct SequencedFrameBuffer
     {
-        uint8_t         length;                             // The length of the remaining bytes in the packet. includes protocol/version/group fields, excluding the length field itself.
+        CODAL_TIMESTAMP timestamp;                          // The time at which this frame was received, in local microseconds.
+        SequencedFrameBuffer     *next;                     // Linkage, to allow this and other protocols to queue packets pending processing.
+        int             rssi;                               // Received signal strength of this frame.
+
+        uint8_t         length __attribute__((aligned(4))); // The length of the remaining bytes in the packet. includes protocol/version/group fields, excluding the length field itself.
         uint8_t         version;                            // Protocol version code.
         uint8_t         group;                              // ID of the group to which this packet belongs.
         uint8_t         protocol;                           // Inner protocol number c.f. those issued by IANA for IP protocols
-        uint8_t         seqNo;
+        uint16_t        origin;                             // Identifier of the node that started this flood.
+        uint8_t         seqNo;                              // Sequence number of this flood, as assigned by the originator.
+        uint8_t         hops;                               // The number of times this frame has been relayed. Incremented by each relay.
+        uint8_t         ttl;                                // The maximum number of hops this frame may travel from its originator.
 
         uint8_t         payload[MICROBIT_RADIO_MAX_PACKET_SIZE];    // User / higher layer protocol data
-        SequencedFrameBuffer     *next;                              // Linkage, to allow this and other protocols to queue packets pending processing.
-        int             rssi;                               // Received signal strength of this frame.
+
+        static void *operator new(size_t size) noexcept;    // Frames are allocated from the MicroBitRadioFramePool.
+        static void operator delete(void *p);
     };
 
     class MicroBitMeshRadio : CodalComponent
@@ -113,16 +215,75 @@ namespace codal
         uint8_t                 band;       // The radio transmission and reception frequency band.
         uint8_t                 power;      // The radio output power level of the transmitter.
         uint8_t                 group;      // The radio group to which this micro:bit belongs.
+        uint8_t                 rate;       // The data rate in use, one of MICROBIT_RADIO_DATA_RATE_*.
         uint8_t                 queueDepth; // The number of packets in the receiver queue.
         int                     rssi;
         SequencedFrameBuffer             *rxQueue;   // A linear list of incoming packets, queued awaiting processing.
         SequencedFrameBuffer             *rxBuf;     // A pointer to the buffer being actively used by the RADIO hardware.
-        bool blockTransmit;
-        int                     currentSeqNo;
+        SequencedFrameBuffer    *txQueue;   // A linear list of frames we have originated, queued awaiting transmission.
+        uint8_t                 txQueueDepth; // The number of frames in the transmit queue.
+        volatile uint8_t        state;      // The current activity of the radio, one of MICROBIT_MESH_RADIO_STATE_*.
+        uint8_t                 currentSeqNo; // The sequence number of the last flood we originated.
+        uint8_t                 ttl;        // The hop limit given to the frames we originate.
+        MicroBitMeshProtocol    protocol;   // Duplicate suppression, relay policy and routing state, shared with the host side simulator.
+        uint8_t                 lastHops;   // The hop count of the most recently accepted frame.
+        CODAL_TIMESTAMP         floodStart; // Estimated start time of the most recently accepted flood, in local microseconds.
+        uint32_t                dutyPeriod; // The interval between the start of successive receive windows, in microseconds. Zero if the receiver is always on.
+        uint32_t                dutyWindow; // The length of each receive window, in microseconds.
+        CODAL_TIMESTAMP         windowAnchor; // The start time of a receive window, in local microseconds, from which all others are derived.
+        uint16_t                syncRoot;   // The originator of the network clock we follow, or zero if unsynchronized.
+        uint8_t                 syncSamples; // The number of synchronization floods heard from syncRoot, saturating.
+        uint32_t                syncPeriod; // The interval between the synchronization floods we originate, in milliseconds, or zero if not root.
+        int32_t                 syncSkew;   // The estimated rate of the root's clock relative to ours, in parts per billion.
+        CODAL_TIMESTAMP         syncLocal;  // The start of the last synchronization flood, in local microseconds.
+        CODAL_TIMESTAMP         syncTime;   // The start of the last synchronization flood, in network (root) microseconds.
+        uint8_t                 channel;    // The frequency band currently in use, which differs from band whilst hopping.
+        uint32_t                hopDwell;   // The length of each hopping slot, in microseconds.
+        RadioLinkStats          stats;      // Link statistics, gathered since the radio was enabled.
+        MicroBitRadioBridge     *bridge;    // The gateway bridge that received frames are forwarded to, or NULL.
+
+        /**
+         * Determines the time against which hopping slots are measured: the network clock if we have one,
+         * otherwise our own.
+         *
+         * @return The current time, in microseconds.
+         */
+        CODAL_TIMESTAMP getHopTime();
+
+        /**
+         * Determines the frequency band to use now, according to the hopping schedule.
+         *
+         * @return The frequency band to use.
+         */
+        uint8_t getHopChannel();
+
+        /**
+         * Event handler, called at the end of each hopping slot to retune the radio.
+         */
+        void onHop(Event);
+
+        /**
+         * Schedules the opening of the next duty cycled receive window, based on the current window anchor.
+         */
+        void scheduleWindow();
+
+        /**
+         * Waits for any flood being relayed or originated to complete, then disables the RADIO interrupt so that no
+         * other can begin whilst the RADIO is reconfigured. The caller must re-enable the interrupt.
+         *
+         * @return MICROBIT_OK with the RADIO interrupt disabled, or MICROBIT_BUSY if the radio did not return to
+         *         receiving within MICROBIT_MESH_RADIO_IDLE_TIMEOUT_MS.
+         */
+        int waitForIdle();
 
         public:
         MicroBitMeshRadioDatagram   datagram;   // A simple datagram service.
         MicroBitMeshRadioEvent      event;      // A simple event handling service.
+        MicroBitMeshRadioFragment   fragment;   // A service for messages too large for a single frame.
+        MicroBitMeshRadioAggregate  aggregate;  // A service for combining readings from every node in a single round.
+        MicroBitRadioHopping        hopping;    // The frequency hopping schedule, and its per channel statistics.
+        MicroBitRadioPowerControl   powerControl; // The adaptive transmit power control loop.
+        MicroBitRadioCipher         cipher;     // Authenticated encryption of the floods of groups given a key.
         static MicroBitMeshRadio    *instance;  // A singleton reference, used purely by the interrupt service routine.
 
         /**
@@ -144,16 +305,72 @@ namespace codal
          */
         int setTransmitPower(int power);
 
+        /**
+         * Determines the output power level of the transmitter.
+         *
+         * @return a value in the range 0..7, where 0 is the lowest power and 7 is the highest.
+         */
+        int getTransmitPower();
+
+        /**
+         * Enables or disables adaptive transmit power control. When enabled, the power level is adjusted automatically
+         * to the lowest that achieves the given delivery rate to the other members of the mesh, based on the outcome of
+         * transmissions reported through reportDelivery(). As the mesh floods frames without acknowledgement, the outcome
+         * must be reported by the application, for instance from replies at the application level. The level set by
+         * setTransmitPower() is the starting point, and the loop starts afresh whenever the group is changed.
+         *
+         * @param enable true to enable adaptive power control, false to hold the current level.
+         *
+         * @param target The percentage of transmission attempts that should succeed, in the range 1 - 100.
+         *
+         * @return MICROBIT_OK on success, or MICROBIT_INVALID_PARAMETER if the target is out of range.
+         */
+        int setAdaptivePower(bool enable, int target = MICROBIT_RADIO_POWER_CONTROL_DEFAULT_TARGET);
+
+        /**
+         * Reports the outcome of one or more transmissions to the adaptive transmit power control loop.
+         * Does nothing unless adaptive power control is enabled.
+         *
+         * @param delivered The number of transmission attempts known to have succeeded.
+         *
+         * @param lost The number of transmission attempts known to have failed.
+         *
+         * @param rssi The signal strength of the reply confirming delivery, in dBm as given by getRSSI(), or zero if unknown.
+         */
+        void reportDelivery(int delivered, int lost, int rssi = 0);
+
         /**
          * Change the transmission and reception band of the radio to the given channel
          *
          * @param band a frequency band in the range 0 - 100. Each step is 1MHz wide, based at 2400MHz.
          *
          * @return MICROBIT_OK on success, or MICROBIT_INVALID_PARAMETER if the value is out of range,
-         *         or MICROBIT_NOT_SUPPORTED if the BLE stack is running.
+         *         MICROBIT_NOT_SUPPORTED if the BLE stack is running, or MICROBIT_BUSY if a flood in progress did not complete.
          */
         int setFrequencyBand(int band);
 
+        /**
+         * Change the data rate at which frames are sent and received. All members of a mesh must use the same data rate.
+         *
+         * Higher data rates reduce airtime, and so collisions, energy use and the time a flood takes to cross the mesh,
+         * whereas the long range rates greatly extend the distance covered by each hop. Flood timing is derived from
+         * the airtime at the current rate.
+         *
+         * @param rate One of MICROBIT_RADIO_DATA_RATE_1MBIT (the default), MICROBIT_RADIO_DATA_RATE_2MBIT,
+         *             MICROBIT_RADIO_DATA_RATE_LR_500KBIT or MICROBIT_RADIO_DATA_RATE_LR_125KBIT.
+         *
+         * @return MICROBIT_OK on success, or MICROBIT_INVALID_PARAMETER if the value is out of range,
+         *         MICROBIT_NOT_SUPPORTED if the BLE stack is running, or MICROBIT_BUSY if a flood in progress did not complete.
+         */
+        int setDataRate(int rate);
+
+        /**
+         * Determines the data rate at which frames are sent and received.
+         *
+         * @return One of MICROBIT_RADIO_DATA_RATE_*.
+         */
+        int getDataRate();
+
         /**
          * Retrieve a pointer to the currently allocated receive buffer. This is the area of memory
          * actively being used by the radio hardware to store incoming data.
@@ -165,11 +382,35 @@ namespace codal
         /**
          * Attempt to queue a buffer received by the radio hardware, if sufficient space is available.
          *
-         * @return MICROBIT_OK on success, or MICROBIT_NO_RESOURCES if a replacement receiver buffer
-         *         could not be allocated (either by policy or memory exhaustion).
+         * The frame is copied into a buffer trimmed to its length, and the receive buffer kept for the radio hardware to reuse.
+         *
+         * @return MICROBIT_OK on success, MICROBIT_INVALID_PARAMETER if there is no receive buffer, or MICROBIT_NO_RESOURCES
+         *         if the frame could not be copied (either by policy or memory exhaustion).
          */
         int queueRxBuf();
 
+        /**
+         * Records the reception of a frame in the link statistics, along with the time at which it was received.
+         *
+         * @param valid true if the frame passed its CRC check, false otherwise.
+         *
+         * @param duplicate true if the frame was valid, but a copy of one already received.
+         *
+         * @note should only be called from RADIO_IRQHandler...
+         */
+        void recordReceive(bool valid, bool duplicate);
+
+        /**
+         * Records the transmission of a frame in the link statistics.
+         *
+         * @param length The length field of the frame transmitted.
+         *
+         * @param relay true if the frame was relayed on behalf of another node, false if we originated it.
+         *
+         * @note should only be called from RADIO_IRQHandler...
+         */
+        void recordTransmit(uint8_t length, bool relay);
+
         /**
          * Sets the RSSI for the most recent packet.
          * The value is measured in -dbm. The higher the value, the stronger the signal.
@@ -190,6 +431,20 @@ namespace codal
          */
         int getRSSI();
 
+        /**
+         * Retrieves the link statistics gathered since the radio was enabled, or since they were last reset.
+         *
+         * @param stats The structure to fill in.
+         *
+         * @return MICROBIT_OK on success.
+         */
+        int getStats(RadioLinkStats &stats);
+
+        /**
+         * Resets all link statistics to zero.
+         */
+        void resetStats();
+
         /**
          * Initialises the radio for use as a multipoint sender/receiver
          *
@@ -219,6 +474,15 @@ namespace codal
          */
         virtual void idleCallback();
 
+        /**
+         * Hands every frame received to the given bridge, in place of the protocol handlers, or stops doing so.
+         *
+         * @param bridge The bridge to forward frames to, or NULL to deliver them as normal.
+         *
+         * @note called by MicroBitRadioBridge::start() and MicroBitRadioBridge::stop().
+         */
+        void setBridge(MicroBitRadioBridge *bridge);
+
         /**
          * Determines the number of packets ready to be processed.
          *
@@ -239,16 +503,350 @@ namespace codal
         SequencedFrameBuffer* recv();
 
         /**
-         * Transmits the given buffer onto the broadcast radio.
-         * The call will wait until the transmission of the packet has completed before returning.
+         * Queues the given buffer for transmission onto the broadcast radio, as the originator of a new flood.
+         * The call returns immediately. The frame is sent by the radio interrupt handler as soon as the radio is
+         * not busy receiving or relaying, and a MICROBIT_MESH_RADIO_EVT_TX_COMPLETE event is raised once it has gone.
          *
-         * @param data The packet contents to transmit.
+         * @param buffer The packet contents to transmit. The contents are copied, so the buffer may be reused immediately.
          *
-         * @return MICROBIT_OK on success, or MICROBIT_NOT_SUPPORTED if the BLE stack is running.
+         * @param ttl The hop limit to give the frame, or zero to use the limit set by setTTL(). A limit of one reaches
+         *        immediate neighbours only. Defaults to zero.
+         *
+         * @return MICROBIT_OK on success, MICROBIT_INVALID_PARAMETER if the buffer is invalid or too long to seal, MICROBIT_NO_RESOURCES
+         *         if the transmit queue is full or memory is exhausted, or MICROBIT_NOT_SUPPORTED if the BLE stack is running.
+         */
+        int send(SequencedFrameBuffer *buffer, int ttl = 0);
+
+        /**
+         * Determines the number of frames waiting to be transmitted.
+         *
+         * @return The number of frames in the transmit queue, including any currently being sent.
+         */
+        int txPending();
+
+        /**
+         * Retrieve a pointer to the frame at the head of the transmit queue.
+         *
+         * @return a pointer to the next frame to transmit, or NULL if the queue is empty.
+         */
+        SequencedFrameBuffer * getTxBuf();
+
+        /**
+         * Determines if the frame at the head of the transmit queue may be sent now.
+         * Frames may be sent whilst we're listening, but if we're duty cycled, only at the start of a receive window.
+         *
+         * @return true if transmission may start.
+         *
+         * @note should only be called from RADIO_IRQHandler...
+         */
+        bool transmitReady();
+
+        /**
+         * Releases the frame at the head of the transmit queue, once it has been sent.
+         *
+         * @note should only be called from RADIO_IRQHandler...
+         */
+        void transmitComplete();
+
+        /**
+         * Determines the current activity of the radio.
+         *
+         * @return MICROBIT_MESH_RADIO_STATE_RX, MICROBIT_MESH_RADIO_STATE_RELAY or MICROBIT_MESH_RADIO_STATE_TX.
+         */
+        uint8_t getState();
+
+        /**
+         * Records the current activity of the radio.
+         *
+         * @param state The new state.
+         *
+         * @note should only be called from RADIO_IRQHandler...
+         */
+        void setState(uint8_t state);
+
+        /**
+         * Determines if a received frame is new, or a duplicate of one we have already seen.
+         * A record of the latest sequence number heard from each originator is kept, compared so
+         * that wraparound of the 8 bit sequence number is handled. If the frame is new, the record is updated.
+         *
+         * @param origin The originator of the frame.
+         *
+         * @param seqNo The sequence number of the frame.
+         *
+         * @return true if the frame is new and should be processed, false if it should be discarded.
+         *
+         * @note should only be called from RADIO_IRQHandler...
+         */
+        bool compareSeqNo(uint16_t origin, uint8_t seqNo);
+
+        /**
+         * Applies the hop limit, relay policy and unicast routing to a newly accepted frame.
+         *
+         * @param frame The frame just received.
+         *
+         * @return true if this node should relay the frame, false if it should only be delivered.
+         *
+         * @note should only be called from RADIO_IRQHandler, immediately after compareSeqNo() accepts the frame.
+         */
+        bool shouldRelay(SequencedFrameBuffer *frame);
+
+        /**
+         * Records the distance back to the originator of a newly accepted frame, as the route to use
+         * for unicast frames sent to it.
+         *
+         * @param frame The frame just received.
+         *
+         * @note should only be called from RADIO_IRQHandler, immediately after compareSeqNo() accepts the frame.
+         */
+        void learnRoute(SequencedFrameBuffer *frame);
+
+        /**
+         * Updates the neighbour table with a newly accepted frame, and the signal strength it was received with.
+         *
+         * @param frame The frame just received.
+         *
+         * @note should only be called from RADIO_IRQHandler, immediately after compareSeqNo() accepts the frame and setRSSI().
+         */
+        void learnNeighbour(SequencedFrameBuffer *frame);
+
+        /**
+         * Retrieves the nodes heard directly within MICROBIT_MESH_RADIO_NEIGHBOUR_TIMEOUT_MS, and the quality of our link
+         * from each. Neighbours are learned passively, from the floods they originate.
+         *
+         * @param neighbours The array to fill in.
+         *
+         * @param max The number of entries in the array.
+         *
+         * @return The number of entries filled in, or MICROBIT_INVALID_PARAMETER if the array is invalid.
+         */
+        int getNeighbours(MeshNeighbour *neighbours, int max);
+
+        /**
+         * Determines the number of hops to the given node, as learned from the floods it originates.
+         *
+         * @param destination The originator id of the node.
+         *
+         * @return The number of hops, where 1 is a direct neighbour, or DEVICE_NO_DATA if no flood has been heard
+         *         from it within MICROBIT_MESH_RADIO_ROUTE_TIMEOUT_MS.
+         */
+        int getRouteDistance(uint16_t destination);
+
+        /**
+         * Forgets the route to the given node. Frames sent to it are flooded until a flood from it is next heard.
+         * Should be called when a unicast exchange with the node fails, such as when an application level
+         * acknowledgement does not arrive.
+         *
+         * @param destination The originator id of the node.
+         */
+        void reportRouteFailure(uint16_t destination);
+
+        /**
+         * Queues the given buffer for transmission to a single node. If a route to the node is known, the frame is only
+         * relayed by the nodes on the route, otherwise it is flooded. Either way, only the destination delivers it.
+         * The call returns immediately, as for send().
+         *
+         * @param destination The originator id of the node to send to.
+         *
+         * @param buffer The packet contents to transmit. The payload is limited to MICROBIT_RADIO_MAX_PACKET_SIZE -
+         *        MICROBIT_MESH_RADIO_UNICAST_HEADER_SIZE bytes. The contents are copied, so the buffer may be reused immediately.
+         *
+         * @return MICROBIT_OK on success, MICROBIT_INVALID_PARAMETER if the buffer or destination is invalid, MICROBIT_NO_RESOURCES
+         *         if the transmit queue is full or memory is exhausted, or MICROBIT_NOT_SUPPORTED if the BLE stack is running.
+         */
+        int sendTo(uint16_t destination, SequencedFrameBuffer *buffer);
+
+        /**
+         * Periodically floods an empty frame, so that the rest of the mesh keeps its route to this node up to date.
+         * This is only needed by nodes that receive unicast frames but send little themselves, such as a gateway
+         * collecting telemetry. Any other flood from the node serves the same purpose.
+         *
+         * @param period The interval between advertisements, in milliseconds, or zero to stop advertising.
+         *
+         * @return MICROBIT_OK on success.
+         */
+        int setRouteAdvertisement(uint32_t period);
+
+        /**
+         * Sets the hop limit given to floods originated by this node.
+         *
+         * @param ttl The maximum number of hops a flood may travel from this node, in the range 1..255.
+         * A value of 1 means only direct neighbours will receive our floods.
+         *
+         * @return MICROBIT_OK on success, or MICROBIT_INVALID_PARAMETER if the value is out of range.
+         */
+        int setTTL(int ttl);
+
+        /**
+         * Configures the policy this node uses to decide whether to relay new frames. By default, within the hop
+         * limit, every new frame is relayed. In dense meshes this wastes airtime, which can be reclaimed by
+         * relaying only a proportion of frames, or by not relaying when neighbours are evidently doing so.
+         *
+         * @param probability The percentage of new frames that are relayed, in the range 0..100.
+         *
+         * @param copyThreshold If non-zero, frames are not relayed if at least this many redundant copies of the
+         *        previous flood from the same originator were heard. Zero disables this check.
+         *
+         * @return MICROBIT_OK on success, or MICROBIT_INVALID_PARAMETER if either value is out of range.
+         */
+        int setRelayPolicy(int probability, int copyThreshold = 0);
+
+        /**
+         * Configures the link quality this node needs to one of its neighbours in order to relay floods. A node whose links
+         * to all its neighbours are weaker than this is at the edge of the mesh, where its relays are heard unreliably and
+         * reach few nodes that don't already have the frame, so it only delivers them. By default, there is no such requirement.
+         *
+         * @param rssi The signal strength a neighbour must be heard with, in dBm, or MICROBIT_MESH_RADIO_RELAY_RSSI_ANY.
+         *
+         * @param pdr The percentage of a neighbour's floods that must be heard directly, or MICROBIT_MESH_RADIO_RELAY_PDR_ANY.
+         *
+         * @return MICROBIT_OK on success, or MICROBIT_INVALID_PARAMETER if either value is out of range.
+         */
+        int setRelayLinkThreshold(int rssi, int pdr = MICROBIT_MESH_RADIO_RELAY_PDR_ANY);
+
+        /**
+         * Determines the identifier used by this node as the originator of the floods it sends.
+         *
+         * @return The originator id of this node.
+         */
+        uint16_t getOriginId();
+
+        /**
+         * Records the timing of a newly accepted frame, and derives the time at which the originator
+         * started the flood. As every hop of a flood takes exactly the same time (the airtime of the frame
+         * plus MICROBIT_MESH_RADIO_RELAY_DELAY_US), the hop count carried in the frame is sufficient
+         * to compute this reference without any additional synchronisation traffic.
+         *
+         * @param rxEnd The local time, in microseconds, at which the frame finished arriving.
+         *
+         * @param frame The frame just received.
+         *
+         * @note should only be called from RADIO_IRQHandler...
          */
-        int send(SequencedFrameBuffer *buffer);
+        void setFloodTiming(CODAL_TIMESTAMP rxEnd, SequencedFrameBuffer *frame);
 
-        bool compareSeqNo(int neqSeq);
+        /**
+         * Updates our estimate of the network clock from a synchronization frame. The flood timing
+         * for the frame must already have been recorded using setFloodTiming().
+         *
+         * @param frame The synchronization frame just received.
+         *
+         * @note should only be called from RADIO_IRQHandler...
+         */
+        void setNetworkTime(SequencedFrameBuffer *frame);
+
+        /**
+         * Determines the time at which the most recently received flood was started by its originator.
+         * All nodes that received the same flood share a common estimate of this time, which may be used
+         * as a network wide time reference.
+         *
+         * @return The estimated start time of the last flood, in microseconds on the local system timer,
+         *         or 0 if no flood has yet been received.
+         */
+        CODAL_TIMESTAMP getFloodStartTime();
+
+        /**
+         * Determines the number of times the most recently received frame was relayed before reaching us.
+         *
+         * @return The hop count of the last frame received, where 0 indicates the frame was heard directly from its originator.
+         */
+        int getHopCount();
+
+        /**
+         * Configures a duty cycled listening schedule. Rather than leaving the receiver on permanently, the radio
+         * wakes for a short receive window once every period, and is powered down otherwise.
+         *
+         * Windows are kept aligned across the mesh using the time reference carried by each flood. To make this work,
+         * floods are only originated at the start of a window: whilst duty cycling is active, queued frames are held
+         * back until the next window opens, and only one is sent per window.
+         *
+         * @param period The interval between the start of successive receive windows, in milliseconds, or zero to leave the receiver on permanently.
+         *
+         * @param window The length of each receive window, in milliseconds. This should be long enough for a flood to propagate across the whole mesh.
+         *
+         * @return MICROBIT_OK on success, or MICROBIT_INVALID_PARAMETER if the window is zero, not shorter than the period, or
+         *         no longer than MICROBIT_MESH_RADIO_DUTY_CYCLE_GUARD_US.
+         */
+        int setDutyCycle(uint32_t period, uint32_t window);
+
+        /**
+         * Determines if the receiver is currently listening, or is powered down between duty cycled receive windows.
+         *
+         * @return true if the radio is enabled and in a receive window (or not duty cycled), false otherwise.
+         */
+        bool isListening();
+
+        /**
+         * Configures the mesh to hop between several frequency bands, rather than using a single band.
+         *
+         * Hopping slots are aligned to the network clock, so a root must be established with setTimeSyncRoot(). Until the
+         * clock is available, we dwell on each channel in turn for a full pass of the schedule, so as to hear the root.
+         * Floods are only originated where they can complete before the end of the current slot. Reception statistics
+         * are kept for each channel (see hopping). The root blacklists channels suffering heavy loss, and distributes its
+         * blacklist with the network clock.
+         *
+         * @param channels The frequency bands to hop between, each in the range 0 - 100, or NULL to disable hopping.
+         *
+         * @param count The number of channels, up to MICROBIT_RADIO_HOPPING_MAX_CHANNELS.
+         *
+         * @param dwell The length of each slot, in milliseconds. This should be long enough for several floods to propagate across the mesh.
+         *
+         * @return MICROBIT_OK on success, MICROBIT_INVALID_PARAMETER if the parameters are out of range,
+         *         or MICROBIT_NOT_SUPPORTED if the BLE stack is running.
+         */
+        int setHopping(const uint8_t *channels, int count, uint32_t dwell = MICROBIT_RADIO_HOPPING_DEFAULT_DWELL_MS);
+
+        /**
+         * Determines the frequency band currently in use.
+         *
+         * @return The band set by setFrequencyBand(), or if hopping, the band of the current slot.
+         */
+        int getChannel();
+
+        /**
+         * Makes this micro:bit the root of the network clock, or stops it from being so.
+         *
+         * The root periodically originates a synchronization flood, stamped with its local time as transmission begins.
+         * Every receiver compares this with its own estimate of when the flood started, and so tracks both the offset
+         * and the drift of its clock against the root's. If more than one root is active, the one with the lowest
+         * origin identifier is followed.
+         *
+         * @param period The interval between synchronization floods, in milliseconds, or zero to stop acting as root.
+         *
+         * @return MICROBIT_OK on success.
+         */
+        int setTimeSyncRoot(uint32_t period);
+
+        /**
+         * Determines the current time on the network clock, maintained by the root set with setTimeSyncRoot().
+         *
+         * @return The network time in microseconds, or 0 if no root has been heard within MICROBIT_MESH_RADIO_TIMESYNC_TIMEOUT_MS.
+         */
+        CODAL_TIMESTAMP getNetworkTime();
+
+        /**
+         * Determines if the network clock is available.
+         *
+         * @return true if we are the root, or have recently heard from it, false otherwise.
+         */
+        bool isTimeSynchronized();
+
+        /**
+         * Stamps a synchronization frame we originate with the current time, as its transmission begins.
+         *
+         * @param frame The frame about to be transmitted.
+         *
+         * @note should only be called from RADIO_IRQHandler...
+         */
+        void setTransmitTime(SequencedFrameBuffer *frame);
+
+        /**
+         * Calculates the time taken to transmit a frame of the given length, at the current data rate.
+         *
+         * @param length The length field of the frame.
+         *
+         * @return The airtime of the frame, in microseconds.
+         */
+        uint32_t getAirtime(uint8_t length);
 
         /**
           * Puts the component in (or out of) sleep (low power) mode.
@@ -256,10 +854,21 @@ namespace codal
         virtual int setSleep(bool doSleep) override;
 
         /**
-         * Block or unblock the transmission function
-         * @param transmit true to block, false to unblock
+         * Event handlers used to implement the duty cycled listening schedule.
+         */
+        void onWindowOpen(Event);
+        void onWindowClose(Event);
+        void onTransmitSlot(Event);
+
+        /**
+         * Event handler, used by the network time root to originate synchronization floods.
+         */
+        void onTimeSync(Event);
+
+        /**
+         * Event handler, used to originate route advertisement floods.
          */
-        void setBlockTransmit(bool transmit);
+        void onRouteAdvertisement(Event);
     };
 }
 
@@ -0,0 +1,238 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef MICROBIT_MESH_RADIO_AGGREGATE_H
+#define MICROBIT_MESH_RADIO_AGGREGATE_H
+
+#include "CodalConfig.h"
+#include "MicroBitMeshRadio.h"
+
+// The time a query allows for partial results to be gathered, unless another is given.
+#ifndef MICROBIT_MESH_RADIO_AGGREGATE_DEFAULT_WINDOW_MS
+#define MICROBIT_MESH_RADIO_AGGREGATE_DEFAULT_WINDOW_MS 2000
+#endif
+
+// The deepest a node may be in the aggregation tree, in hops from the root. The window is split into this many
+// reporting slots, one per depth, so that each node hears from all of its children before reporting to its parent.
+#ifndef MICROBIT_MESH_RADIO_AGGREGATE_MAX_DEPTH
+#define MICROBIT_MESH_RADIO_AGGREGATE_MAX_DEPTH         8
+#endif
+
+// The longest a node waits before passing a query on, spreading out the transmissions of nodes that heard it together.
+#ifndef MICROBIT_MESH_RADIO_AGGREGATE_JITTER_MS
+#define MICROBIT_MESH_RADIO_AGGREGATE_JITTER_MS         20
+#endif
+
+// The number of buckets in a histogram query.
+#define MICROBIT_MESH_RADIO_AGGREGATE_BUCKETS           8
+
+// Aggregation packet types.
+#define MICROBIT_MESH_RADIO_AGGREGATE_TYPE_QUERY        0       // A query, passed from each node to its neighbours on the way out from the root.
+#define MICROBIT_MESH_RADIO_AGGREGATE_TYPE_PARTIAL      1       // A partial result, passed from each node to its parent on the way back.
+
+// Aggregation packet layout. A partial result is a MeshAggregatePartial, followed by the sum, minimum and maximum
+// (as 32 bit values) for scalar queries, or by the count in each bucket (as 16 bit values) for histogram queries.
+#define MICROBIT_MESH_RADIO_AGGREGATE_QUERY_SIZE        14
+#define MICROBIT_MESH_RADIO_AGGREGATE_PARTIAL_SIZE      8
+#define MICROBIT_MESH_RADIO_AGGREGATE_SCALAR_SIZE       (MICROBIT_MESH_RADIO_AGGREGATE_PARTIAL_SIZE + 12)
+#define MICROBIT_MESH_RADIO_AGGREGATE_HISTOGRAM_SIZE    (MICROBIT_MESH_RADIO_AGGREGATE_PARTIAL_SIZE + 2 * MICROBIT_MESH_RADIO_AGGREGATE_BUCKETS)
+
+// Query flags.
+#define MICROBIT_MESH_RADIO_AGGREGATE_FLAG_HISTOGRAM    0x01    // Readings are counted into buckets, rather than summed.
+
+namespace codal
+{
+    /**
+     * The result of an aggregation query, or the partial result of part of the mesh.
+     */
+    struct MeshAggregateResult
+    {
+        uint16_t        count;                                              // The number of readings.
+        int32_t         sum;                                                // The sum of the readings. Not gathered by histogram queries.
+        int32_t         min;                                                // The smallest reading. Not gathered by histogram queries.
+        int32_t         max;                                                // The largest reading. Not gathered by histogram queries.
+        uint16_t        histogram[MICROBIT_MESH_RADIO_AGGREGATE_BUCKETS];   // The number of readings in each bucket, for histogram queries.
+    };
+
+    struct MeshAggregateQuery
+    {
+        uint8_t         type;                               // MICROBIT_MESH_RADIO_AGGREGATE_TYPE_QUERY.
+        uint8_t         queryId;                            // The identifier of the query, assigned by the root.
+        uint16_t        root;                               // The originator id of the root.
+        uint8_t         depth;                              // The sender's depth in the tree, where the root is 0.
+        uint8_t         flags;                              // MICROBIT_MESH_RADIO_AGGREGATE_FLAG_* values.
+        uint16_t        remaining;                          // The time until the root's window closes, in milliseconds, as the query was sent.
+        uint16_t        slot;                               // The length of each depth's reporting slot, in milliseconds.
+        int16_t         low;                                // The smallest reading counted into the first histogram bucket.
+        uint16_t        width;                              // The range of readings counted into each histogram bucket.
+    } __attribute__((packed));
+
+    struct MeshAggregatePartial
+    {
+        uint8_t         type;                               // MICROBIT_MESH_RADIO_AGGREGATE_TYPE_PARTIAL.
+        uint8_t         queryId;                            // The identifier of the query.
+        uint16_t        root;                               // The originator id of the root.
+        uint16_t        parent;                             // The originator id of the node that should merge this result.
+        uint16_t        count;                              // The number of readings merged into this result.
+    } __attribute__((packed));
+
+    /**
+     * Provides in network aggregation of readings held by every node of the mesh, such as a sum, minimum, maximum,
+     * count or histogram, in a single round.
+     *
+     * A root issues a query, which each node passes on to its neighbours once, so building a tree in which every node's
+     * parent is the neighbour it first heard the query from. Results then flow back up the tree: the window is divided
+     * into one slot per depth, and each node reports a single partial result, merging its own reading with those of its
+     * children, in the slot before its parent's. Each node therefore sends one frame on the way out and one on the way
+     * back, to its immediate neighbours only, however many nodes there are.
+     *
+     * @note This API does not contain any form of encryption, authentication or authorisation. Its purpose is solely for use as a
+     * teaching aid to demonstrate how simple communications operates, and to provide a sandpit through which learning can take place.
+     * For serious applications, BLE should be considered a substantially more secure alternative.
+     */
+    class MicroBitMeshRadioAggregate
+    {
+        MicroBitMeshRadio       &radio;                     // The underlying radio module used to send and receive data.
+        MeshAggregateQuery      query;                      // The query in progress, as we will pass it on (or have passed it on).
+        MeshAggregateResult     partial;                    // Our reading, merged with those of our children so far.
+        uint16_t                parent;                     // The originator id of our parent, or zero if we are the root.
+        uint32_t                deadline;                   // The time at which the root's window closes, in local milliseconds.
+        uint8_t                 nextQueryId;                // The identifier to give the next query we issue as root.
+        int32_t                 reading;                    // Our own reading.
+        bool                    hasReading;                 // Set if we have a reading to contribute.
+        bool                    active;                     // Set whilst a query is in progress.
+        bool                    listening;                  // Set once our internal event handlers have been registered.
+
+        /**
+         * Registers our internal event handlers, if not already done.
+         */
+        void listen();
+
+        /**
+         * Starts taking part in a query: resets our partial result, and schedules passing the
+         * query on and reporting our result.
+         */
+        void begin();
+
+        /**
+         * Merges a reading into a partial result.
+         */
+        void add(MeshAggregateResult &result, int32_t value);
+
+        /**
+         * Handles a received query, joining the tree if the query is new.
+         */
+        void queryReceived(SequencedFrameBuffer *packet);
+
+        /**
+         * Handles a received partial result, merging it into ours if it was sent to us.
+         */
+        void partialReceived(SequencedFrameBuffer *packet);
+
+        /**
+         * Passes the query on to our neighbours, with the time remaining until the root's window closes.
+         *
+         * @return DEVICE_OK on success, DEVICE_INVALID_STATE if the window has closed, or an error returned by MicroBitMeshRadio::send().
+         */
+        int forward();
+
+        /**
+         * Event handler, called to pass the query on to our neighbours.
+         */
+        void onForward(Event);
+
+        /**
+         * Event handler, called at our reporting slot to send our partial result to our parent, or at the end of
+         * the window if we are the root.
+         */
+        void onReport(Event);
+
+        /**
+         * Issues a query as root, and waits for its window to close.
+         */
+        int issue(MeshAggregateResult &result, uint8_t flags, int low, int width, uint32_t window);
+
+        public:
+
+        /**
+         * Constructor.
+         *
+         * @param r The underlying radio module used to send and receive data.
+         */
+        MicroBitMeshRadioAggregate(MicroBitMeshRadio &r);
+
+        /**
+         * Sets the reading this node contributes to queries. A MICROBIT_MESH_RADIO_EVT_AGGREGATE_QUERY event is raised
+         * as each query arrives, so the reading can be brought up to date before it is reported.
+         *
+         * @param value The reading.
+         */
+        void setReading(int32_t value);
+
+        /**
+         * Withdraws this node's reading. The node still passes on the results of others.
+         */
+        void clearReading();
+
+        /**
+         * Gathers the count, sum, minimum and maximum of the readings of every node that can be reached within
+         * MICROBIT_MESH_RADIO_AGGREGATE_MAX_DEPTH hops, including our own. Blocks the calling fiber until the window closes.
+         *
+         * @param result The structure to fill in.
+         *
+         * @param window The time allowed for results to be gathered, in milliseconds. Larger windows allow more time for each depth.
+         *
+         * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the window is out of range, DEVICE_BUSY if a
+         *         query is already in progress, or an error returned by MicroBitMeshRadio::send().
+         */
+        int gather(MeshAggregateResult &result, uint32_t window = MICROBIT_MESH_RADIO_AGGREGATE_DEFAULT_WINDOW_MS);
+
+        /**
+         * Gathers a histogram of the readings of every node that can be reached within MICROBIT_MESH_RADIO_AGGREGATE_MAX_DEPTH
+         * hops, including our own. Readings below the first bucket are counted in it, as are those above the last in the last.
+         * Blocks the calling fiber until the window closes.
+         *
+         * @param result The structure to fill in.
+         *
+         * @param low The smallest reading counted into the first bucket.
+         *
+         * @param width The range of readings counted into each bucket.
+         *
+         * @param window The time allowed for results to be gathered, in milliseconds.
+         *
+         * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if a parameter is out of range, DEVICE_BUSY if a
+         *         query is already in progress, or an error returned by MicroBitMeshRadio::send().
+         */
+        int gatherHistogram(MeshAggregateResult &result, int low, int width, uint32_t window = MICROBIT_MESH_RADIO_AGGREGATE_DEFAULT_WINDOW_MS);
+
+        /**
+         * Protocol handler callback. This is called when the radio receives a packet marked as an aggregation packet.
+         *
+         * This function processes this packet, joining queries and merging partial results.
+         */
+        void packetReceived();
+    };
+}
+
+#endif
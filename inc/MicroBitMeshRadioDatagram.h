@@ -30,6 +30,14 @@ DEALINGS IN THE SOFTWARE.
 #include "MicroBitMeshRadio.h"
 #include "ManagedString.h"
 
+// The maximum number of datagrams held awaiting recv().
+#ifndef MICROBIT_MESH_RADIO_DATAGRAM_MAXIMUM_RX_BUFFERS
+#define MICROBIT_MESH_RADIO_DATAGRAM_MAXIMUM_RX_BUFFERS     8
+#endif
+
+// Each datagram in an aggregated frame is preceeded by a single length byte.
+#define MICROBIT_MESH_RADIO_DATAGRAM_BATCH_ITEM_HEADER      1
+
 namespace codal
 {
     /**
@@ -47,6 +55,21 @@ namespace codal
     {
         MicroBitMeshRadio        &radio;     // The underlying radio module used to send and receive data.
         SequencedFrameBuffer     *rxQueue;   // A linear list of incoming packets, queued awaiting processing.
+        SequencedFrameBuffer     *txBatch;   // Datagrams aggregated into a single frame, awaiting transmission.
+        uint32_t                 batchDeadline; // The longest time a datagram may wait in txBatch, in milliseconds. Zero if aggregation is disabled.
+
+        /**
+         * Adds the given packet to the tail of the receive queue, and signals its arrival.
+         * If the queue is full, the packet is discarded.
+         *
+         * @param packet The packet to queue.
+         */
+        void queuePacket(SequencedFrameBuffer *packet);
+
+        /**
+         * Event handler, called when aggregated datagrams have waited for the configured deadline.
+         */
+        void onFlushDeadline(Event);
 
         public:
 
@@ -87,50 +110,107 @@ namespace codal
         /**
          * Transmits the given buffer onto the broadcast radio.
          *
-         * This is a synchronous call that will wait until the transmission of the packet
-         * has completed before returning.
+         * The packet is queued for transmission, and this call returns immediately. A MICROBIT_MESH_RADIO_EVT_TX_COMPLETE
+         * event is raised once it has been sent.
          *
          * @param buffer The packet contents to transmit.
          *
          * @param len The number of bytes to transmit.
          *
-         * @return MICROBIT_OK on success, or MICROBIT_INVALID_PARAMETER if the buffer is invalid,
-         *         or the number of bytes to transmit is greater than `MICROBIT_MESH_RADIO_MAX_PACKET_SIZE + MICROBIT_MESH_RADIO_HEADER_SIZE`.
+         * @return MICROBIT_OK on success, MICROBIT_NO_RESOURCES if the transmit queue is full, or MICROBIT_INVALID_PARAMETER if the buffer is invalid,
+         *         or the number of bytes to transmit is greater than `MICROBIT_RADIO_MAX_PACKET_SIZE`.
          */
         int send(uint8_t *buffer, int len);
 
         /**
          * Transmits the given string onto the broadcast radio.
          *
-         * This is a synchronous call that will wait until the transmission of the packet
-         * has completed before returning.
+         * The packet is queued for transmission, and this call returns immediately. A MICROBIT_MESH_RADIO_EVT_TX_COMPLETE
+         * event is raised once it has been sent.
          *
          * @param data The packet contents to transmit.
          *
-         * @return MICROBIT_OK on success, or MICROBIT_INVALID_PARAMETER if the buffer is invalid,
-         *         or the number of bytes to transmit is greater than `MICROBIT_MESH_RADIO_MAX_PACKET_SIZE + MICROBIT_MESH_RADIO_HEADER_SIZE`.
+         * @return MICROBIT_OK on success, MICROBIT_NO_RESOURCES if the transmit queue is full, or MICROBIT_INVALID_PARAMETER if the buffer is invalid,
+         *         or the number of bytes to transmit is greater than `MICROBIT_RADIO_MAX_PACKET_SIZE`.
          */
         int send(PacketBuffer data);
 
         /**
          * Transmits the given string onto the broadcast radio.
          *
-         * This is a synchronous call that will wait until the transmission of the packet
-         * has completed before returning.
+         * The packet is queued for transmission, and this call returns immediately. A MICROBIT_MESH_RADIO_EVT_TX_COMPLETE
+         * event is raised once it has been sent.
          *
          * @param data The packet contents to transmit.
          *
-         * @return MICROBIT_OK on success, or MICROBIT_INVALID_PARAMETER if the buffer is invalid,
-         *         or the number of bytes to transmit is greater than `MICROBIT_MESH_RADIO_MAX_PACKET_SIZE + MICROBIT_MESH_RADIO_HEADER_SIZE`.
+         * @return MICROBIT_OK on success, MICROBIT_NO_RESOURCES if the transmit queue is full, or MICROBIT_INVALID_PARAMETER if the buffer is invalid,
+         *         or the number of bytes to transmit is greater than `MICROBIT_RADIO_MAX_PACKET_SIZE`.
          */
         int send(ManagedString data);
 
+        /**
+         * Transmits the given buffer to a single node, along the route to it if one is known (see MicroBitMeshRadio::sendTo()).
+         * Datagrams sent this way are never aggregated.
+         *
+         * @param destination The originator id of the node to send to.
+         *
+         * @param buffer The packet contents to transmit.
+         *
+         * @param len The number of bytes to transmit.
+         *
+         * @return MICROBIT_OK on success, MICROBIT_NO_RESOURCES if the transmit queue is full, or MICROBIT_INVALID_PARAMETER if the buffer
+         *         or destination is invalid, or the number of bytes to transmit is greater than
+         *         `MICROBIT_RADIO_MAX_PACKET_SIZE - MICROBIT_MESH_RADIO_UNICAST_HEADER_SIZE`.
+         */
+        int sendTo(uint16_t destination, uint8_t *buffer, int len);
+
+        /**
+         * Transmits the given buffer to a single node, along the route to it if one is known (see MicroBitMeshRadio::sendTo()).
+         * Datagrams sent this way are never aggregated.
+         *
+         * @param destination The originator id of the node to send to.
+         *
+         * @param data The packet contents to transmit.
+         *
+         * @return MICROBIT_OK on success, MICROBIT_NO_RESOURCES if the transmit queue is full, or MICROBIT_INVALID_PARAMETER if the buffer
+         *         or destination is invalid, or the number of bytes to transmit is greater than
+         *         `MICROBIT_RADIO_MAX_PACKET_SIZE - MICROBIT_MESH_RADIO_UNICAST_HEADER_SIZE`.
+         */
+        int sendTo(uint16_t destination, PacketBuffer data);
+
+        /**
+         * Enables or disables aggregation of outgoing datagrams. Every datagram sent normally costs a flood of its own
+         * across the whole mesh. When aggregation is enabled, small datagrams are instead packed together into a single frame,
+         * which is sent when it is full, or once the oldest datagram in it has waited for the given deadline.
+         * Receivers split the frame back into individual datagrams, so this is transparent to recv().
+         *
+         * @param deadline The longest time, in milliseconds, a datagram may be held awaiting others. Zero disables aggregation,
+         *        and sends any datagrams already held.
+         *
+         * @return MICROBIT_OK on success.
+         */
+        int setAggregation(uint32_t deadline);
+
+        /**
+         * Sends any aggregated datagrams immediately, without waiting for the frame to fill or the deadline to expire.
+         *
+         * @return MICROBIT_OK on success, or the error returned by MicroBitMeshRadio::send().
+         */
+        int flush();
+
         /**
          * Protocol handler callback. This is called when the radio receives a packet marked as a datagram.
          *
          * This function process this packet, and queues it for user reception.
          */
         void packetReceived();
+
+        /**
+         * Protocol handler callback. This is called when the radio receives a packet containing aggregated datagrams.
+         *
+         * This function splits the packet into its individual datagrams, and queues each for user reception.
+         */
+        void batchReceived();
     };
 }
 
@@ -0,0 +1,192 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 British Broadcasting Corporation.
+This software is provided by Lancaster University by arrangement with the BBC.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef MICROBIT_MESH_RADIO_FRAGMENT_H
+#define MICROBIT_MESH_RADIO_FRAGMENT_H
+
+#include "CodalConfig.h"
+#include "MicroBitMeshRadio.h"
+#include "PacketBuffer.h"
+
+// The largest message that may be sent as a sequence of fragments.
+#ifndef MICROBIT_MESH_RADIO_FRAGMENT_MAX_SIZE
+#define MICROBIT_MESH_RADIO_FRAGMENT_MAX_SIZE           1024
+#endif
+
+// The number of messages that may be reassembled (or held awaiting recv()) at once.
+#ifndef MICROBIT_MESH_RADIO_FRAGMENT_REASSEMBLY_BUFFERS
+#define MICROBIT_MESH_RADIO_FRAGMENT_REASSEMBLY_BUFFERS 2
+#endif
+
+// The time a partially received message may go without new fragments before missing fragments are re-requested.
+#ifndef MICROBIT_MESH_RADIO_FRAGMENT_TIMEOUT_MS
+#define MICROBIT_MESH_RADIO_FRAGMENT_TIMEOUT_MS         500
+#endif
+
+// The number of times missing fragments are re-requested before a partially received message is abandoned.
+#ifndef MICROBIT_MESH_RADIO_FRAGMENT_MAX_RETRIES
+#define MICROBIT_MESH_RADIO_FRAGMENT_MAX_RETRIES        3
+#endif
+
+// The time to wait before retrying when the transmit queue is full.
+#ifndef MICROBIT_MESH_RADIO_FRAGMENT_TX_BACKOFF_MS
+#define MICROBIT_MESH_RADIO_FRAGMENT_TX_BACKOFF_MS      5
+#endif
+
+// Fragment packet types.
+#define MICROBIT_MESH_RADIO_FRAGMENT_TYPE_DATA          0       // Carries one fragment of a message.
+#define MICROBIT_MESH_RADIO_FRAGMENT_TYPE_NACK          1       // Requests the retransmission of missing fragments.
+
+// Fragment packet layout.
+#define MICROBIT_MESH_RADIO_FRAGMENT_HEADER_SIZE        4       // type, message id, fragment index, fragment count.
+#define MICROBIT_MESH_RADIO_FRAGMENT_DATA_SIZE          (MICROBIT_RADIO_MAX_PACKET_SIZE - MICROBIT_MESH_RADIO_FRAGMENT_HEADER_SIZE)
+#define MICROBIT_MESH_RADIO_FRAGMENT_MAX_FRAGMENTS      ((MICROBIT_MESH_RADIO_FRAGMENT_MAX_SIZE + MICROBIT_MESH_RADIO_FRAGMENT_DATA_SIZE - 1) / MICROBIT_MESH_RADIO_FRAGMENT_DATA_SIZE)
+#define MICROBIT_MESH_RADIO_FRAGMENT_BITMAP_SIZE        ((MICROBIT_MESH_RADIO_FRAGMENT_MAX_FRAGMENTS + 7) / 8)
+#define MICROBIT_MESH_RADIO_FRAGMENT_NACK_SIZE          (4 + MICROBIT_MESH_RADIO_FRAGMENT_BITMAP_SIZE)  // type, message id, origin, missing bitmap.
+
+namespace codal
+{
+    /**
+     * The state of a message being reassembled from its fragments.
+     */
+    struct MeshReassemblyBuffer
+    {
+        uint16_t        origin;                                             // The originator of the message, zero if this buffer is unused.
+        uint8_t         msgId;                                              // The message identifier assigned by the originator.
+        uint8_t         count;                                              // The total number of fragments in the message.
+        uint16_t        length;                                             // The length of the message, known once its last fragment has been received.
+        uint8_t         retries;                                            // The number of times missing fragments have been re-requested.
+        bool            complete;                                           // Set once every fragment has been received.
+        uint32_t        lastSeen;                                           // The system time (ms) at which a fragment was last received.
+        uint8_t         received[MICROBIT_MESH_RADIO_FRAGMENT_BITMAP_SIZE]; // Bitmap of the fragments received so far.
+        uint8_t         *data;                                              // The message, as reassembled so far.
+    };
+
+    /**
+     * Provides the ability to send messages of up to MICROBIT_MESH_RADIO_FRAGMENT_MAX_SIZE bytes over the mesh.
+     *
+     * Messages are split into fragments, each sent as its own flood. Receivers reassemble them into a bounded set of
+     * buffers, and if a message stalls, broadcast a request naming only the fragments they are missing. The sender
+     * retains its most recent message so that it can answer such requests.
+     *
+     * @note This API does not contain any form of encryption, authentication or authorisation. Its purpose is solely for use as a
+     * teaching aid to demonstrate how simple communications operates, and to provide a sandpit through which learning can take place.
+     * For serious applications, BLE should be considered a substantially more secure alternative.
+     */
+    class MicroBitMeshRadioFragment
+    {
+        MicroBitMeshRadio       &radio;                                             // The underlying radio module used to send and receive data.
+        MeshReassemblyBuffer    rxBuffers[MICROBIT_MESH_RADIO_FRAGMENT_REASSEMBLY_BUFFERS]; // Messages being reassembled, or awaiting recv().
+        PacketBuffer            txMessage;                                          // The most recent message sent, retained to answer re-requests.
+        uint8_t                 txMsgId;                                            // The identifier of txMessage.
+        uint8_t                 txResend[MICROBIT_MESH_RADIO_FRAGMENT_BITMAP_SIZE]; // Fragments of txMessage that have been re-requested.
+        bool                    listening;                                          // Set once our internal event handlers have been registered.
+
+        /**
+         * Registers our internal event handlers, if not already done.
+         */
+        void listen();
+
+        /**
+         * Transmits a single fragment of txMessage, waiting for space in the transmit queue if necessary.
+         *
+         * @param index The index of the fragment to transmit.
+         *
+         * @return MICROBIT_OK on success, or the error returned by MicroBitMeshRadio::send().
+         */
+        int sendFragment(int index);
+
+        /**
+         * Handles a received data fragment, adding it to the appropriate reassembly buffer.
+         */
+        void dataReceived(SequencedFrameBuffer *packet);
+
+        /**
+         * Handles a received re-request, scheduling retransmission of any fragments of ours that are missing.
+         */
+        void nackReceived(SequencedFrameBuffer *packet);
+
+        /**
+         * Event handler, called periodically while messages are being reassembled, to re-request missing fragments.
+         */
+        void onTimeout(Event);
+
+        /**
+         * Event handler, called to retransmit fragments which have been re-requested.
+         */
+        void onResend(Event);
+
+        public:
+
+        /**
+         * Constructor.
+         *
+         * @param r The underlying radio module used to send and receive data.
+         */
+        MicroBitMeshRadioFragment(MicroBitMeshRadio &r);
+
+        /**
+         * Transmits the given buffer onto the mesh, as a sequence of fragments.
+         *
+         * This call blocks the calling fiber until every fragment has been queued for transmission.
+         *
+         * @param buffer The message to transmit.
+         *
+         * @param len The number of bytes to transmit.
+         *
+         * @return MICROBIT_OK on success, or MICROBIT_INVALID_PARAMETER if the buffer is invalid,
+         *         or the number of bytes to transmit is greater than `MICROBIT_MESH_RADIO_FRAGMENT_MAX_SIZE`.
+         */
+        int send(uint8_t *buffer, int len);
+
+        /**
+         * Transmits the given buffer onto the mesh, as a sequence of fragments.
+         *
+         * This call blocks the calling fiber until every fragment has been queued for transmission.
+         *
+         * @param data The message to transmit.
+         *
+         * @return MICROBIT_OK on success, or MICROBIT_INVALID_PARAMETER if the buffer is invalid,
+         *         or the number of bytes to transmit is greater than `MICROBIT_MESH_RADIO_FRAGMENT_MAX_SIZE`.
+         */
+        int send(PacketBuffer data);
+
+        /**
+         * Retrieves the oldest fully reassembled message.
+         *
+         * @return the message received, or an empty PacketBuffer if no message is available.
+         */
+        PacketBuffer recv();
+
+        /**
+         * Protocol handler callback. This is called when the radio receives a packet marked as a fragment.
+         *
+         * This function processes this packet, reassembling messages and answering re-requests.
+         */
+        void packetReceived();
+    };
+}
+
+#endif
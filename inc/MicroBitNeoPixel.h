@@ -0,0 +1,193 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef MICROBIT_NEOPIXEL_H
+#define MICROBIT_NEOPIXEL_H
+
+#include "CodalConfig.h"
+#include "CodalComponent.h"
+#include "NRF52Pin.h"
+#include "MicroBitComponentIds.h"
+
+// Hardware resources used to stream pixel data. NRF_PWM2 generates the waveform; its sequence end events are routed
+// through PPI to an event generator (EGU4), whose interrupt refills the sequence buffers.
+#ifndef MICROBIT_NEOPIXEL_PPI_CHANNEL_BASE
+#define MICROBIT_NEOPIXEL_PPI_CHANNEL_BASE              10
+#endif
+
+// The number of pixels expanded into each of the two PWM sequence buffers at a time. Each pixel byte occupies 16 bytes
+// of sequence buffer, and each buffer must be refilled within the time taken to send the other (30us per 24 bit pixel).
+#ifndef CONFIG_MICROBIT_NEOPIXEL_CHUNK_PIXELS
+#define CONFIG_MICROBIT_NEOPIXEL_CHUNK_PIXELS           16
+#endif
+
+// The time the data line is held low after each frame, so that the strip latches it, in microseconds.
+#ifndef CONFIG_MICROBIT_NEOPIXEL_RESET_US
+#define CONFIG_MICROBIT_NEOPIXEL_RESET_US               300
+#endif
+
+// Events
+#define MICROBIT_NEOPIXEL_EVT_SENT                      1       // A frame has been sent, and show() can swap buffers without waiting.
+
+// Status Flags
+#define MICROBIT_NEOPIXEL_STATUS_QUEUED                 0x01    // The front buffer is waiting to be, or is being, sent.
+
+namespace codal
+{
+    /**
+     * A WS2812 (NeoPixel) strip, driven from any pin without blocking the processor.
+     *
+     * Each strip has two frame buffers. Pixels are drawn into the back buffer, and show() swaps it to the front, where it
+     * is sent in the background while the next frame is drawn. The waveform is generated by NRF_PWM2 under EasyDMA,
+     * from two small sequence buffers that are refilled from the front buffer by a short interrupt as each is played,
+     * so interrupts are never disabled and long strips need only a few hundred bytes of sequence memory.
+     *
+     * Any number of strips may be created. They share the one PWM peripheral, and frames are sent one strip at a time,
+     * in the order show() was called. MICROBIT_NEOPIXEL_EVT_SENT is raised on a strip's id as each of its frames completes.
+     */
+    class MicroBitNeoPixel : public CodalComponent
+    {
+        NRF52Pin                &pin;               // The pin the strip is connected to.
+        uint8_t                 *buffer[2];         // The two frame buffers, in wire (GRB or GRBW) order.
+        uint8_t                 back;               // The index of the frame buffer being drawn into.
+        uint8_t                 bytesPerPixel;      // 3 for RGB pixels, or 4 for RGBW pixels.
+        uint16_t                length;             // The number of pixels in the strip.
+        volatile uint32_t       position;           // The index of the next byte of the front buffer to be expanded.
+        MicroBitNeoPixel        *next;              // The next strip waiting to be sent.
+
+        static MicroBitNeoPixel *queue;             // The strip being sent, followed by those waiting.
+        static uint16_t         *sequence;          // The two PWM sequence buffers, or NULL until first used.
+        static volatile int     sequencesLeft;      // The number of sequence playbacks remaining in the current frame.
+
+        /**
+         * Allocates the sequence buffers and configures the PPI and EGU resources, if this has not already been done.
+         *
+         * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if there is insufficient memory.
+         */
+        static int enable();
+
+        /**
+         * Starts sending the front buffer of the strip at the head of the queue.
+         *
+         * @note must be called with interrupts disabled, or from the EGU interrupt.
+         */
+        static void begin();
+
+        /**
+         * Expands the next bytes of the front buffer of the strip being sent into one of the sequence buffers.
+         *
+         * @param index The sequence buffer to fill, 0 or 1.
+         */
+        static void refill(int index);
+
+        /**
+         * Releases the pin of the strip just sent, raises its MICROBIT_NEOPIXEL_EVT_SENT event, and starts the next.
+         *
+         * @note should only be called from the EGU interrupt.
+         */
+        static void finish();
+
+        public:
+
+        /**
+         * Called each time a PWM sequence has been played.
+         *
+         * @param index The sequence that has ended, 0 or 1.
+         *
+         * @note should only be called from SWI4_EGU4_IRQHandler...
+         */
+        static void onSequenceEnd(int index);
+
+        /**
+         * Constructor. The pin is driven low, and both frame buffers are cleared.
+         *
+         * @param pin The pin the strip is connected to.
+         * @param length The number of pixels in the strip.
+         * @param bytesPerPixel 3 for RGB pixels, or 4 for RGBW pixels.
+         * @param id The ID of this component, used for its events.
+         */
+        MicroBitNeoPixel(NRF52Pin &pin, int length, int bytesPerPixel = 3, uint16_t id = MICROBIT_ID_NEOPIXEL);
+
+        /**
+         * Destructor. Waits for any frame being sent to complete.
+         */
+        ~MicroBitNeoPixel();
+
+        /**
+         * Determines the number of pixels in the strip.
+         *
+         * @return The number of pixels, or 0 if the frame buffers could not be allocated.
+         */
+        int getLength();
+
+        /**
+         * Provides direct access to the back buffer, for drawing the next frame. Each pixel is stored as green, red,
+         * blue (and white) bytes, in the order the strip expects them. The buffer changes each time show() is called.
+         *
+         * @return The back buffer, or NULL if the frame buffers could not be allocated.
+         */
+        uint8_t *getBuffer();
+
+        /**
+         * Sets the colour of a pixel in the back buffer.
+         *
+         * @param index The pixel to set, from 0.
+         * @param red The red component, 0-255.
+         * @param green The green component, 0-255.
+         * @param blue The blue component, 0-255.
+         * @param white The white component, 0-255, which is ignored by RGB pixels.
+         *
+         * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if index is out of range.
+         */
+        int setPixel(int index, uint8_t red, uint8_t green, uint8_t blue, uint8_t white = 0);
+
+        /**
+         * Sets every pixel in the back buffer to off.
+         */
+        void clear();
+
+        /**
+         * Makes the back buffer the next frame to be sent, and returns without waiting for it to be sent. If the
+         * previous frame of this strip is still being sent, waits for that to complete first. The new back buffer
+         * holds a copy of the frame just shown, so it can be updated incrementally.
+         *
+         * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if the strip's buffers could not be allocated.
+         */
+        int show();
+
+        /**
+         * Determines if a frame of this strip is waiting to be, or is being, sent.
+         *
+         * @return true if a frame is in flight, false otherwise.
+         */
+        bool isBusy();
+
+        /**
+         * Blocks the calling fiber until any frame of this strip in flight has been sent.
+         */
+        void waitForIdle();
+    };
+}
+
+#endif
@@ -0,0 +1,177 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef MICROBIT_ORIENTATION_H
+#define MICROBIT_ORIENTATION_H
+
+#include "CodalConfig.h"
+#include "CodalComponent.h"
+#include "Accelerometer.h"
+#include "Compass.h"
+#include "MicroBitComponentIds.h"
+
+// The default period between orientation updates, in milliseconds.
+#ifndef CONFIG_MICROBIT_ORIENTATION_PERIOD_MS
+#define CONFIG_MICROBIT_ORIENTATION_PERIOD_MS           20
+#endif
+
+// The default weight given to each new measurement (0..1). Lower values are smoother, but slower to respond.
+#ifndef CONFIG_MICROBIT_ORIENTATION_GAIN
+#define CONFIG_MICROBIT_ORIENTATION_GAIN                0.1f
+#endif
+
+// Events
+#define MICROBIT_ORIENTATION_EVT_DATA_UPDATE            1       // The orientation has been updated.
+
+// Status Flags
+#define MICROBIT_ORIENTATION_STATUS_RUNNING             0x01    // Updates are requested.
+#define MICROBIT_ORIENTATION_STATUS_FIBER               0x02    // The update fiber is running.
+#define MICROBIT_ORIENTATION_STATUS_VALID               0x04    // At least one update has been made.
+
+namespace codal
+{
+    /**
+     * A rotation, as a unit quaternion.
+     */
+    struct MicroBitQuaternion
+    {
+        float w;
+        float x;
+        float y;
+        float z;
+    };
+
+    /**
+     * Fuses accelerometer and compass readings into a single, smoothed orientation.
+     *
+     * A dedicated fiber samples both sensors at a fixed rate, and each pair of samples gives an absolute
+     * orientation, in the same north-east-down frame as Compass::heading(). Successive measurements are blended
+     * on the unit quaternion sphere, so that noise is filtered without wrap around artefacts near north.
+     * The results are cached, so any number of readers share the cost of one update per period, and always
+     * see a consistent pitch, roll and heading.
+     */
+    class MicroBitOrientation : public CodalComponent
+    {
+        Accelerometer           &accelerometer;     // The accelerometer to sample.
+        Compass                 &compass;           // The compass to sample.
+        MicroBitQuaternion      q;                  // The current orientation.
+        float                   pitch;              // The current pitch, in degrees.
+        float                   roll;               // The current roll, in degrees.
+        float                   heading;            // The current heading, in degrees.
+        float                   gain;               // The weight given to each new measurement.
+        uint32_t                period;             // The period between updates, in milliseconds.
+
+        public:
+
+        /**
+         * Constructor.
+         *
+         * @param accelerometer The accelerometer to sample.
+         * @param compass The compass to sample. This should be calibrated for the heading to be meaningful.
+         * @param id The ID of this component, used for its events.
+         */
+        MicroBitOrientation(Accelerometer &accelerometer, Compass &compass, uint16_t id = MICROBIT_ID_ORIENTATION);
+
+        /**
+         * Destructor. Updates are stopped, waiting for the update fiber to exit if necessary.
+         */
+        ~MicroBitOrientation();
+
+        /**
+         * Starts updating the orientation at a fixed rate.
+         *
+         * @return DEVICE_OK on success.
+         */
+        int start();
+
+        /**
+         * Stops updating the orientation. The last values remain available.
+         */
+        void stop();
+
+        /**
+         * Sets the period between updates.
+         *
+         * @param period The period, in milliseconds.
+         * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if period is zero.
+         */
+        int setPeriod(uint32_t period);
+
+        /**
+         * Determines the period between updates, in milliseconds.
+         */
+        uint32_t getPeriod();
+
+        /**
+         * Sets the weight given to each new measurement.
+         *
+         * @param gain A value greater than 0 and at most 1. 1 disables smoothing.
+         * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if gain is out of range.
+         */
+        int setGain(float gain);
+
+        /**
+         * Samples both sensors and updates the orientation now. This is normally done by the update fiber.
+         *
+         * @return DEVICE_OK on success.
+         */
+        int update();
+
+        /**
+         * Determines if an orientation is available.
+         */
+        bool isValid();
+
+        /**
+         * Determines the current orientation, as the rotation from the north-east-down frame to the device.
+         */
+        MicroBitQuaternion getQuaternion();
+
+        /**
+         * Determines the current pitch, in degrees (-90..90).
+         */
+        float getPitch();
+
+        /**
+         * Determines the current roll, in degrees (-180..180).
+         */
+        float getRoll();
+
+        /**
+         * Determines the current tilt compensated heading, in degrees clockwise from magnetic north (0..360).
+         */
+        float getHeading();
+
+        private:
+
+        /**
+         * Entry point of the update fiber.
+         *
+         * @param orientation The MicroBitOrientation instance to update.
+         */
+        static void updateFiber(void *orientation);
+    };
+}
+
+#endif
@@ -0,0 +1,162 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef MICROBIT_PIN_CAPTURE_H
+#define MICROBIT_PIN_CAPTURE_H
+
+#include "CodalConfig.h"
+#include "CodalComponent.h"
+#include "NRF52Pin.h"
+#include "NRFLowLevelTimer.h"
+#include "MicroBitComponentIds.h"
+
+// Hardware resources used for capture.
+// TODO: Replace these with a resource allocated version
+#ifndef MICROBIT_PIN_CAPTURE_GPIOTE_CHANNEL
+#define MICROBIT_PIN_CAPTURE_GPIOTE_CHANNEL             7
+#endif
+
+#ifndef MICROBIT_PIN_CAPTURE_PPI_CHANNEL
+#define MICROBIT_PIN_CAPTURE_PPI_CHANNEL                12
+#endif
+
+#ifndef MICROBIT_PIN_CAPTURE_EGU_CHANNEL
+#define MICROBIT_PIN_CAPTURE_EGU_CHANNEL                0
+#endif
+
+// The default number of edges captured before MICROBIT_PIN_CAPTURE_EVT_DATA is raised.
+#ifndef CONFIG_MICROBIT_PIN_CAPTURE_WATERMARK
+#define CONFIG_MICROBIT_PIN_CAPTURE_WATERMARK           16
+#endif
+
+// Flag set in a captured edge if the pin was high after it.
+#define MICROBIT_PIN_CAPTURE_LEVEL_HIGH                 0x80000000
+#define MICROBIT_PIN_CAPTURE_TIME_MASK                  0x7FFFFFFF
+
+// Events
+#define MICROBIT_PIN_CAPTURE_EVT_DATA                   1       // At least the watermark number of edges are waiting to be read.
+
+// Status Flags
+#define MICROBIT_PIN_CAPTURE_STATUS_RUNNING             0x01
+#define MICROBIT_PIN_CAPTURE_STATUS_SIGNALLED           0x02    // MICROBIT_PIN_CAPTURE_EVT_DATA has been raised, but not read.
+#define MICROBIT_PIN_CAPTURE_STATUS_LEVEL               0x04    // The level of the pin after the last edge.
+
+namespace codal
+{
+    /**
+     * Captures the time of every edge on a pin, with hardware accuracy.
+     *
+     * Each edge is detected by a GPIOTE channel, which captures the value of a dedicated, free running 1MHz timer
+     * through PPI. The same PPI channel triggers an event generator (EGU3) interrupt that only copies the captured
+     * value into a ring buffer, so the timestamps are exact however busy the processor is, and no fiber, event or
+     * pin interrupt is involved per edge. MICROBIT_PIN_CAPTURE_EVT_DATA is raised once per batch of edges.
+     *
+     * The timer must not be used for anything else while capturing. On the micro:bit, NRF_TIMER0 is free if neither
+     * Bluetooth nor the mesh radio is in use.
+     */
+    class MicroBitPinCapture : public CodalComponent
+    {
+        NRF52Pin                &pin;               // The pin to capture.
+        NRFLowLevelTimer        &timer;             // The timer used to timestamp edges.
+        uint32_t                *buffer;            // The caller supplied ring buffer of edges.
+        int                     capacity;           // The number of edges the ring buffer can hold.
+        volatile int            head;               // The index at which the next edge is written.
+        volatile int            count;              // The number of edges in the ring buffer.
+        int                     watermark;          // The number of edges that triggers MICROBIT_PIN_CAPTURE_EVT_DATA.
+        uint32_t                overruns;           // The number of edges lost because the ring buffer was full.
+
+        public:
+
+        static MicroBitPinCapture   *instance;      // A singleton reference, used purely by the interrupt service routine.
+
+        /**
+         * Constructor.
+         *
+         * @param pin The pin to capture.
+         * @param timer A timer dedicated to capture.
+         * @param buffer The ring buffer to store edges in.
+         * @param capacity The number of edges buffer can hold.
+         * @param id The ID of this component, used for its events.
+         */
+        MicroBitPinCapture(NRF52Pin &pin, NRFLowLevelTimer &timer, uint32_t *buffer, int capacity, uint16_t id = MICROBIT_ID_PIN_CAPTURE);
+
+        /**
+         * Destructor. Capture is stopped.
+         */
+        ~MicroBitPinCapture();
+
+        /**
+         * Starts capturing edges. The timer is restarted from zero.
+         *
+         * @param watermark The number of edges that triggers MICROBIT_PIN_CAPTURE_EVT_DATA.
+         * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if watermark is out of range, or DEVICE_BUSY if
+         * another MicroBitPinCapture is running.
+         */
+        int start(int watermark = CONFIG_MICROBIT_PIN_CAPTURE_WATERMARK);
+
+        /**
+         * Stops capturing edges, and releases the hardware. Edges already captured remain available.
+         */
+        void stop();
+
+        /**
+         * Determines if edges are being captured.
+         */
+        bool isRunning();
+
+        /**
+         * Determines the current time on the capture timebase, in microseconds.
+         */
+        uint32_t getTime();
+
+        /**
+         * Determines the number of edges waiting to be read.
+         */
+        int available();
+
+        /**
+         * Removes the oldest edges from the ring buffer. Each is the time of the edge in microseconds from start()
+         * (MICROBIT_PIN_CAPTURE_TIME_MASK), with MICROBIT_PIN_CAPTURE_LEVEL_HIGH set for a rising edge.
+         *
+         * @param edges The array to copy edges into.
+         * @param length The maximum number of edges to copy.
+         * @return The number of edges copied.
+         */
+        int read(uint32_t *edges, int length);
+
+        /**
+         * Determines the number of edges lost because the ring buffer was full.
+         */
+        uint32_t getOverruns();
+
+        /**
+         * Records the edge just captured by the timer.
+         *
+         * @note should only be called from SWI3_EGU3_IRQHandler...
+         */
+        void onEdge();
+    };
+}
+
+#endif
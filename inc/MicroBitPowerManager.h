@@ -28,6 +28,7 @@ DEALINGS IN THE SOFTWARE.
 #include "MicroBitConfig.h"
 #include "MicroBitCompat.h"
 #include "MicroBitIO.h"
+#include "MicroBitEnergy.h"
 #include "codal-core/inc/core/CodalComponent.h"
 #include "codal-core/inc/driver-models/I2C.h"
 #include "codal-core/inc/driver-models/Pin.h"
@@ -47,6 +48,14 @@ DEALINGS IN THE SOFTWARE.
 #define MICROBIT_UIPM_MAX_RETRIES                   20
 #define MICROBIT_USB_INTERFACE_IRQ_THRESHOLD        30
 
+//
+// Time the combined IRQ line must be held low before the USB interface chip is queried (milliseconds).
+// Other sensors sharing the line are much more likely to be the source of short pulses.
+//
+#ifndef MICROBIT_USB_INTERFACE_IRQ_HOLD_TIME
+#define MICROBIT_USB_INTERFACE_IRQ_HOLD_TIME        5
+#endif
+
 //
 // Command codes for the USB Interface Chip
 //
@@ -136,6 +145,41 @@ typedef struct {
     float estimatedPowerConsumption;
 } MicroBitPowerData;
 
+//
+// Reasons for waking from deep sleep
+//
+typedef enum {
+    WAKEUP_TIMER = 0,                                           // The requested sleep period expired.
+    WAKEUP_INTERFACE,                                           // The combined IRQ line was asserted, e.g. by the USB interface chip.
+    WAKEUP_OTHER,                                               // Any other interrupt, such as a wake up pin.
+    WAKEUP_REASON_COUNT
+} MicroBitWakeUpReason;
+
+//
+// Time spent in each power state, and the number of times each was entered.
+//
+typedef struct {
+    CODAL_TIMESTAMP activeTime;                                 // Time spent running code, in microseconds.
+    CODAL_TIMESTAMP idleTime;                                   // Time spent waiting for events while the scheduler is idle, in microseconds.
+    CODAL_TIMESTAMP deepSleepTime;                              // Time spent in deep sleep, in microseconds.
+    uint32_t idleCount;                                         // Number of times the scheduler waited for an event.
+    uint32_t deepSleepCount;                                    // Number of times deep sleep was entered.
+    uint32_t wakeUps[WAKEUP_REASON_COUNT];                      // Number of wake ups from deep sleep, by MicroBitWakeUpReason.
+} MicroBitPowerStatistics;
+
+//
+// A recurring wake up registered with scheduleWakeUp().
+//
+typedef struct {
+    uint16_t id;                                                // Event source raised when the task is due (zero if unused).
+    uint16_t value;                                             // Event value raised when the task is due.
+    uint32_t period;                                            // Time between runs, in milliseconds.
+    uint32_t slack;                                             // Time a run may be delayed to share a wake up with another task, in milliseconds.
+    CODAL_TIMESTAMP due;                                        // Time of the next run, in milliseconds.
+    CodalComponent **components;                                // Components the task needs resumed from deep sleep, or NULL for all.
+    int componentCount;                                         // Number of entries in components.
+} MicroBitWakeTask;
+
 //
 // USB Interface Chip Power States
 //
@@ -148,7 +192,10 @@ typedef struct {
 #define MICROBIT_USB_INTERFACE_AWAITING_RESPONSE   0x01
 #define MICROBIT_USB_INTERFACE_VERSION_LOADED      0x02
 #define MICROBIT_USB_INTERFACE_ALWAYS_NOP          0x04
+#define MICROBIT_USB_INTERFACE_IRQ_DISPATCHED      0x10
 #define MICROBIT_USB_INTERFACE_BUSY_FLAG_SUPPORTED 0x20
+#define MICROBIT_USB_INTERFACE_IRQ_EVENTS          0x40
+#define MICROBIT_POWER_PARTIAL_WAKE                0x80
 
 //
 // Minimum deep sleep time (milliseconds)
@@ -164,6 +211,32 @@ typedef struct {
 #define CONFIG_MINIMUM_POWER_ON_TIME  500
 #endif
 
+//
+// Maximum age of cached power telemetry (milliseconds).
+// When non-zero, the power source, USB status and power data are read from the interface chip
+// together and served from that snapshot until it expires. Zero queries the interface chip on every call.
+//
+#ifndef CONFIG_MICROBIT_POWER_TELEMETRY_CACHE_TIME
+#define CONFIG_MICROBIT_POWER_TELEMETRY_CACHE_TIME  0
+#endif
+
+//
+// Maximum number of recurring wake up tasks that can be registered with scheduleWakeUp().
+//
+#ifndef CONFIG_MICROBIT_POWER_WAKE_TASKS
+#define CONFIG_MICROBIT_POWER_WAKE_TASKS  4
+#endif
+
+//
+// Timer event value used to run the wake up scheduler. Never used for deepSleep(uint32_t) timers.
+//
+#define MICROBIT_POWER_EVT_WAKE_TASKS  0xFFFF
+
+namespace codal
+{
+    class MicroBitLog;
+}
+
 
 /**
  * Class definition for MicroBitPowerManager.
@@ -242,6 +315,21 @@ class MicroBitPowerManager : public CodalComponent
          * @return the current status of the USB interface on this micro:bit
          */
         MicroBitUSBStatus getUSBStatus();
+
+        /**
+         * Reads the power source, USB status and power data from the interface chip in a single burst,
+         * and records them in the powerSource, usbStatus and powerData member variables.
+         *
+         * @note This will query the USB interface chip via I2C, and wait for completion.
+         *
+         * @return DEVICE_OK on success, or DEVICE_I2C_ERROR if the interface chip did not respond.
+         */
+        int updateTelemetry();
+
+        /**
+         * Discards any cached power telemetry, so that the next request queries the interface chip.
+         */
+        void invalidateTelemetry();
         
         /**
          * Attempts to issue a control packet to the USB interface chip.
@@ -296,8 +384,36 @@ class MicroBitPowerManager : public CodalComponent
 
         /**
          * Service any IRQ requests raised by the USB interface chip.
+         *
+         * @return true if a request was read from the USB interface chip, false otherwise.
+         */
+        bool readInterfaceRequest();
+
+        /**
+         * Indicates that the combined IRQ line is arbitrated by a MicroBitIrqDispatcher, using irqAwaitingResponse()
+         * and irqInterfaceRequest() as its sources. The line is then no longer polled or listened to here.
+         *
+         * @param dispatched true if the line is serviced by a dispatcher, false otherwise.
+         */
+        void setIrqDispatched(bool dispatched);
+
+        /**
+         * MicroBitIrqDispatcher source, claiming the combined IRQ line while a subsystem awaits a response
+         * from the USB interface chip. This requires no I2C transaction, so should be checked first.
+         *
+         * @param context The MicroBitPowerManager instance.
+         * @return MICROBIT_IRQ_DEFERRED if a response is awaited, MICROBIT_IRQ_NONE otherwise.
+         */
+        static int irqAwaitingResponse(void *context);
+
+        /**
+         * MicroBitIrqDispatcher source, servicing any request raised by the USB interface chip.
+         * This requires a complete UIPM transaction, so should be checked last.
+         *
+         * @param context The MicroBitPowerManager instance.
+         * @return MICROBIT_IRQ_HANDLED if a request was read, MICROBIT_IRQ_NONE otherwise.
          */
-        void readInterfaceRequest();
+        static int irqInterfaceRequest(void *context);
 
         /**
          * A periodic callback invoked by the fiber scheduler idle thread.
@@ -314,6 +430,13 @@ class MicroBitPowerManager : public CodalComponent
          */
         void awaitingPacket(bool awaiting);
 
+        /**
+         * Determines if edge events are raised on the combined IRQ line, either for us or for a MicroBitIrqDispatcher.
+         *
+         * @return true if a falling edge of the line raises DEVICE_PIN_EVT_FALL, false if it is only polled.
+         */
+        bool interfaceEventsEnabled();
+
         /**
          * Destructor.
          */
@@ -370,6 +493,43 @@ class MicroBitPowerManager : public CodalComponent
          */
         void deepSleepAsync();
 
+        /**
+         * Registers a recurring task that must wake the device from deep sleep.
+         * When the task is due, an event with the given id and value is raised.
+         *
+         * Each run may be delayed by up to the given slack so that it can share a single wake up with
+         * other tasks, reducing the number of times the device leaves deep sleep.
+         *
+         * @param id The id of the event to raise. Must be non-zero.
+         * @param value The value of the event to raise.
+         * @param period The time between runs, in milliseconds. The first run is one period from now.
+         * @param slack The time each run may be delayed to coalesce with other tasks, in milliseconds.
+         * @param components The components the task needs, or NULL if the device should fully resume from deep sleep.
+         * If every task due on a timed wake up lists its components, only those are resumed, and the device returns to
+         * deep sleep as soon as the scheduler is idle. The array must remain valid while the task is registered.
+         * @param componentCount The number of entries in components.
+         *
+         * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if id or period is zero, or DEVICE_NO_RESOURCES if all
+         * CONFIG_MICROBIT_POWER_WAKE_TASKS tasks are in use. Registering an existing id and value updates its schedule.
+         */
+        int scheduleWakeUp(uint16_t id, uint16_t value, uint32_t period, uint32_t slack = 0, CodalComponent **components = NULL, int componentCount = 0);
+
+        /**
+         * Removes a recurring task previously registered with scheduleWakeUp().
+         *
+         * @param id The id of the task's event.
+         * @param value The value of the task's event.
+         *
+         * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if no such task is registered.
+         */
+        int cancelWakeUp(uint16_t id, uint16_t value);
+
+        /**
+         * Resumes any components left in deep sleep by a partial wake up for a wake up task.
+         * Code that runs during a partial wake up and needs the rest of the device should call this first.
+         */
+        void resumeAll();
+
         /**
          * Enable power down during deepSleep
          * The default is enabled.
@@ -414,12 +574,106 @@ class MicroBitPowerManager : public CodalComponent
          */
         void cancelDeepSleep();
 
+        /**
+         * For library use.
+         * Waits for an event or interrupt while the scheduler is idle, recording the time spent for getStatistics().
+         */
+        void waitForEvent();
+
+        /**
+         * Determines the time spent active, idle and in deep sleep since the statistics were last reset,
+         * along with the reasons for waking from deep sleep.
+         *
+         * @return the current power state statistics.
+         */
+        MicroBitPowerStatistics getStatistics();
+
+        /**
+         * Resets the power state statistics.
+         */
+        void resetStatistics();
+
+        /**
+         * Estimates the energy used by each subsystem since the accounts were last reset.
+         * The supply voltage is read from the interface chip first, so that time spent active since the last reading is costed at a current figure.
+         * @note Energy is attributed from the modelled current of each subsystem, see setEnergyModel(), as the interface chip measures voltage but not current.
+         * @param report The structure to fill in.
+         * @return DEVICE_OK on success, or DEVICE_NOT_SUPPORTED if CONFIG_MICROBIT_ENERGY_ACCOUNTING is disabled.
+         */
+        int getEnergyUsage(codal::MicroBitEnergyReport &report);
+
+        /**
+         * Clears the energy accounts of all subsystems.
+         */
+        void resetEnergyUsage();
+
+        /**
+         * Sets the current a subsystem is modelled as drawing while active, for example from a calibration against a meter.
+         * @param subsystem One of MICROBIT_ENERGY_*.
+         * @param microAmps The current drawn, in microamps.
+         * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the subsystem is unknown, or DEVICE_NOT_SUPPORTED if CONFIG_MICROBIT_ENERGY_ACCOUNTING is disabled.
+         */
+        int setEnergyModel(int subsystem, uint32_t microAmps);
+
+        /**
+         * Writes the energy used by each subsystem to the data log as a single row, with columns energy_<subsystem>_mj,
+         * energy_total_mj and supply_mv.
+         * @param log The data log to write to.
+         * @return DEVICE_OK on success, DEVICE_NOT_SUPPORTED if CONFIG_MICROBIT_ENERGY_ACCOUNTING is disabled, or an error from the log.
+         */
+        int logEnergyUsage(codal::MicroBitLog &log);
+
         private:
 
         /**
           * Listener
           */
         void listener(Event evt);
+
+        /**
+         * Enable edge events on the combined IRQ line, such that requests from the USB interface chip are
+         * serviced without polling.
+         */
+        void enableInterfaceEvents();
+
+        /**
+         * Event handler, called when the combined IRQ line is asserted.
+         * Services any request from the USB interface chip, if the line remains asserted.
+         */
+        void onInterfaceIrq(Event evt);
+
+        /**
+         * Event handler, called when the wake up scheduler timer fires.
+         * Raises the events of all tasks that are due, and rearms the timer.
+         */
+        void onWakeTasks(Event evt);
+
+        /**
+         * Arms a single wake up timer for the next group of recurring tasks.
+         * The timer fires at the latest time that keeps every task within its slack,
+         * so that all tasks due by then can be run together.
+         */
+        void scheduleWakeTasks();
+
+        /**
+         * Determines which components to resume after a timed wake up from deep sleep.
+         * A partial wake up is used only if the wake up scheduler's timer woke us, and every task due
+         * declares the components it needs.
+         *
+         * @param wakeUpTime The time the device was due to wake, in microseconds.
+         * @param needed Bitmap of indexes into CodalComponent::components, set for each component to resume.
+         *
+         * @return true if only the components in needed should be resumed, false to resume all components.
+         */
+        bool selectWakeComponents(CODAL_TIMESTAMP wakeUpTime, uint32_t *needed);
+
+        /**
+         * Invokes the deep sleep callback of each component in the given bitmap.
+         *
+         * @param reason The deep sleep callback reason to pass.
+         * @param components Bitmap of indexes into CodalComponent::components.
+         */
+        void deepSleepComponents(deepSleepCallbackReason reason, uint32_t *components);
         void listen();
         void ignore();
         
@@ -447,6 +701,26 @@ class MicroBitPowerManager : public CodalComponent
         int                     powerDownDisableCount;
         CODAL_TIMESTAMP         powerUpTime;
         uint16_t                eventValue;
+        MicroBitPowerStatistics statistics;
+        CODAL_TIMESTAMP         statisticsStart;
+        CODAL_TIMESTAMP         telemetryTime;                      // Time the cached telemetry was read, in milliseconds (zero if invalid).
+        MicroBitWakeTask        wakeTasks[CONFIG_MICROBIT_POWER_WAKE_TASKS];  // Recurring wake up tasks.
+        CODAL_TIMESTAMP         wakeTasksTime;                      // Time the wake up scheduler's timer is due, in microseconds (zero if not armed).
+        uint32_t                suspended[(DEVICE_COMPONENT_COUNT + 31) / 32];  // Components left in deep sleep by a partial wake up.
+        deepSleepCallbackReason suspendedReason;                    // Callback reason used to resume the suspended components.
+
+        /**
+         * Determines if the cached power telemetry may be used, refreshing it if it has expired.
+         *
+         * @return true if the powerSource, usbStatus and powerData member variables are current, false if the caller should query the interface chip itself.
+         */
+        bool useTelemetry();
+
+        /**
+         * Passes the supply voltage in the most recent power telemetry to the energy accounts.
+         * The battery voltage is used when running from battery alone, and VIN otherwise.
+         */
+        void sampleEnergy();
 
         /**
          * Check if there are suitable wake-up sources for deep sleep
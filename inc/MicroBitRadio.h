@@ -29,6 +29,7 @@ DEALINGS IN THE SOFTWARE.
 namespace codal
 {
     class MicroBitRadio;
+    class MicroBitRadioBridge;
     struct FrameBuffer;
 }
 
@@ -36,8 +37,14 @@ namespace codal
 #include "codal-core/inc/types/Event.h"
 #include "PacketBuffer.h"
 #include "MicroBitConfig.h"
+#include "MicroBitComponentIds.h"
 #include "MicroBitRadioDatagram.h"
 #include "MicroBitRadioEvent.h"
+#include "MicroBitRadioHopping.h"
+#include "MicroBitRadioFramePool.h"
+#include "MicroBitRadioCapture.h"
+#include "MicroBitRadioPowerControl.h"
+#include "MicroBitRadioCipher.h"
 
 /**
  * Provides a simple broadcast radio abstraction, built upon the raw nrf51822 RADIO module.
@@ -53,19 +60,24 @@ namespace codal
  * TODO: Meshing should also be considered - again a GLOSSY approach may be effective here, and highly complementary to
  * the master/slave arachitecture of BLE.
  *
- * TODO: This implementation only operates whilst the BLE stack is disabled. The nrf51822 provides a timeslot API to allow
- * BLE to cohabit with other protocols. Future work to allow this colocation would be benefical, and would also allow for the
- * creation of wireless BLE bridges.
+ * If the BLE stack is running when the radio is enabled, the RADIO hardware is shared with it using the SoftDevice timeslot API.
+ * Timeslots are requested back to back, and extended for as long as BLE allows, so reception continues between BLE
+ * connection events and frames sent are transmitted in the next gap. This allows for the creation of wireless BLE bridges.
+ * Frequency hopping is not available whilst sharing the RADIO in this way.
  *
- * NOTE: This API does not contain any form of encryption, authentication or authorization. It's purpose is solely for use as a
- * teaching aid to demonstrate how simple communications operates, and to provide a sandpit through which learning can take place.
- * For serious applications, BLE should be considered a substantially more secure alternative.
+ * NOTE: By default this API does not contain any form of encryption, authentication or authorization. It's purpose is solely
+ * for use as a teaching aid to demonstrate how simple communications operates, and to provide a sandpit through which learning
+ * can take place. Giving a group a key through cipher.setKey() seals every frame sent to it with AES-CCM, so that frames from
+ * anyone without the key (or replayed) are discarded; there is no key exchange, so keys must be distributed by other means.
  */
 
 // Status Flags
 #define MICROBIT_RADIO_STATUS_INITIALISED       0x0001
 #define MICROBIT_RADIO_STATUS_DEEPSLEEP_IRQ     0x0002
 #define MICROBIT_RADIO_STATUS_DEEPSLEEP_INIT    0x0004
+#define MICROBIT_RADIO_STATUS_HOP_LISTENER      0x0008
+#define MICROBIT_RADIO_STATUS_TIMESLOT          0x0010
+#define MICROBIT_RADIO_STATUS_CAPTURE_LISTENER  0x0020
 
 // Default configuration values
 #define MICROBIT_RADIO_BASE_ADDRESS             0x75626974
@@ -74,8 +86,61 @@ namespace codal
 #define MICROBIT_RADIO_DEFAULT_FREQUENCY        7
 #define MICROBIT_RADIO_HEADER_SIZE              4
 #define MICROBIT_RADIO_MAXIMUM_RX_BUFFERS       4
+#define MICROBIT_RADIO_RX_RING_SIZE             (MICROBIT_RADIO_MAXIMUM_RX_BUFFERS + 1)     // One slot is always lent to the RADIO hardware.
 #define MICROBIT_RADIO_POWER_LEVELS             8
 
+// Data rates (physical layer modes). All members of a group must use the same data rate.
+#define MICROBIT_RADIO_DATA_RATE_1MBIT          0       // Nordic proprietary 1Mbit/s, as used by all earlier micro:bits.
+#define MICROBIT_RADIO_DATA_RATE_2MBIT          1       // Nordic proprietary 2Mbit/s. Half the airtime, at the cost of some range.
+#define MICROBIT_RADIO_DATA_RATE_LR_500KBIT     2       // Coded (long range) PHY at 500kbit/s.
+#define MICROBIT_RADIO_DATA_RATE_LR_125KBIT     3       // Coded (long range) PHY at 125kbit/s. The greatest range, at eight times the airtime.
+
+#ifndef MICROBIT_RADIO_DEFAULT_DATA_RATE
+#define MICROBIT_RADIO_DEFAULT_DATA_RATE        MICROBIT_RADIO_DATA_RATE_1MBIT
+#endif
+
+// A transmission is only started within a timeslot if the airtime of a frame of the largest size, plus this much, remains.
+// This allows for the transmitter to ramp up, and the return to reception.
+#define MICROBIT_RADIO_TIMESLOT_TX_MARGIN_US    300
+
+// Frequency hopping configuration.
+// Having heard nothing (and sent nothing) for this long, we assume we've lost the hopping schedule of our group,
+// and dwell on each channel in turn for a full pass of the schedule until we next hear something.
+#ifndef MICROBIT_RADIO_HOPPING_SYNC_TIMEOUT_MS
+#define MICROBIT_RADIO_HOPPING_SYNC_TIMEOUT_MS  2000
+#endif
+
+// Transmissions are not started this close to the end of a slot, so they are not lost to receivers that have already hopped.
+#define MICROBIT_RADIO_HOPPING_GUARD_US         1000
+
+// Timeslot configuration, used to share the RADIO with the BLE stack.
+// Set MICROBIT_RADIO_TIMESLOT to 0 to keep the previous behaviour, where the radio is unavailable whilst BLE is running.
+#ifndef MICROBIT_RADIO_TIMESLOT
+#define MICROBIT_RADIO_TIMESLOT                 1
+#endif
+
+#if defined(SOFTDEVICE_PRESENT) && CONFIG_ENABLED(MICROBIT_RADIO_TIMESLOT)
+#define MICROBIT_RADIO_TIMESLOT_SUPPORTED       1
+#else
+#define MICROBIT_RADIO_TIMESLOT_SUPPORTED       0
+#endif
+
+// The length of each timeslot requested from (or extension granted by) the SoftDevice, in microseconds.
+#ifndef MICROBIT_RADIO_TIMESLOT_LENGTH_US
+#define MICROBIT_RADIO_TIMESLOT_LENGTH_US       10000
+#endif
+
+// The time before the end of a timeslot at which we ask for it to be extended, or otherwise give it up.
+#define MICROBIT_RADIO_TIMESLOT_MARGIN_US       1000
+
+// The longest we'll wait for a timeslot to be granted, before asking again.
+#define MICROBIT_RADIO_TIMESLOT_TIMEOUT_US      100000
+
+// The longest send() waits for a timeslot in which to transmit a frame, before giving up on it.
+#ifndef MICROBIT_RADIO_TIMESLOT_TX_TIMEOUT_MS
+#define MICROBIT_RADIO_TIMESLOT_TX_TIMEOUT_MS   500
+#endif
+
 // Max packet size is configurable, so ensure maximum value is not exceeded
 // TODO: Update this value once issue codal-microbit-v2#383 is resolved
 // https://github.com/lancaster-university/codal-microbit-v2/issues/383
@@ -86,22 +151,75 @@ namespace codal
 // Known Protocol Numbers
 #define MICROBIT_RADIO_PROTOCOL_DATAGRAM        1       // A simple, single frame datagram. a little like UDP but with smaller packets. :-)
 #define MICROBIT_RADIO_PROTOCOL_EVENTBUS        2       // Transparent propogation of events from one micro:bit to another.
+#define MICROBIT_RADIO_PROTOCOL_EVENTBUS_BATCH  3       // Several events, carried as (id, value) pairs in a single frame.
+#define MICROBIT_RADIO_PROTOCOL_DATAGRAM_ARQ    4       // An addressed datagram, or its acknowledgement.
 
 // Events
 #define MICROBIT_RADIO_EVT_DATAGRAM             1       // Event to signal that a new datagram has been received.
 
+// Internal events, raised on MICROBIT_ID_RADIO_INTERNAL rather than the radio's own ID. MicroBitMeshRadio shares
+// DEVICE_ID_RADIO, and cancelling its timers must not cancel ours.
+#define MICROBIT_RADIO_EVT_HOP                  2       // Internal event to signal the end of a frequency hopping slot.
+#define MICROBIT_RADIO_EVT_EVENT_FLUSH          3       // Internal event to signal that batched events are due to be sent.
+#define MICROBIT_RADIO_EVT_ARQ_TIMER            4       // Internal event to signal that unacknowledged datagrams should be checked.
+#define MICROBIT_RADIO_EVT_CAPTURE_SCAN         5       // Internal event to signal that a capture should move on to the next set of groups.
+#define MICROBIT_RADIO_EVT_TX_DONE              6       // Internal event to signal that a frame handed to the timeslot handler has gone, or may have timed out.
+
 namespace codal
 {
+    /**
+     * Configures the modulation and packet format of the RADIO for the given data rate.
+     * The RADIO must be disabled.
+     *
+     * @param rate The data rate to use, one of MICROBIT_RADIO_DATA_RATE_*.
+     *
+     * @param maxLength The largest value of the length field of frames to be received.
+     */
+    void microbit_radio_set_data_rate(uint8_t rate, uint8_t maxLength);
+
+    /**
+     * Calculates the time taken to transmit a frame, from the start of its preamble to the end of its CRC.
+     *
+     * @param rate The data rate in use, one of MICROBIT_RADIO_DATA_RATE_*.
+     *
+     * @param length The length field of the frame.
+     *
+     * @return The airtime of the frame, in microseconds.
+     */
+    uint32_t microbit_radio_airtime(uint8_t rate, uint8_t length);
+
+    // The frame as sent on air starts at the length field, which is the buffer handed to the RADIO's EasyDMA. Everything
+    // before it is local to this device, so that frames may be stored trimmed to their length, without the unused payload.
     struct FrameBuffer
     {
-        uint8_t         length;                             // The length of the remaining bytes in the packet. includes protocol/version/group fields, excluding the length field itself.
+        CODAL_TIMESTAMP timestamp;                          // The time at which this frame was received, in local microseconds.
+        FrameBuffer     *next;                              // Linkage, to allow this and other protocols to queue packets pending processing.
+        uint8_t         rssi;                               // Received signal strength of this frame.
+
+        uint8_t         length __attribute__((aligned(4))); // The length of the remaining bytes in the packet. includes protocol/version/group fields, excluding the length field itself.
         uint8_t         version;                            // Protocol version code.
         uint8_t         group;                              // ID of the group to which this packet belongs.
         uint8_t         protocol;                           // Inner protocol number c.f. those issued by IANA for IP protocols
 
         uint8_t         payload[MICROBIT_RADIO_MAX_PACKET_SIZE];    // User / higher layer protocol data
-        FrameBuffer     *next;                              // Linkage, to allow this and other protocols to queue packets pending processing.
-        uint8_t         rssi;                               // Received signal strength of this frame.
+
+        static void *operator new(size_t size) noexcept;    // Frames are allocated from the MicroBitRadioFramePool.
+        static void operator delete(void *p);
+    };
+
+    /**
+     * Counters describing the health of a radio link, maintained by the interrupt service routine.
+     */
+    struct RadioLinkStats
+    {
+        uint32_t        rxFrames;                           // The number of frames received with a valid CRC.
+        uint32_t        rxCrcErrors;                        // The number of frames received with an invalid CRC.
+        uint32_t        rxOverflows;                        // The number of valid frames discarded, as the receive queue was full.
+        uint32_t        rxDuplicates;                       // The number of valid frames discarded as copies of a frame already received (mesh only).
+        uint32_t        txFrames;                           // The number of frames transmitted, including any relayed.
+        uint32_t        txRelays;                           // The number of frames relayed on behalf of others (mesh only).
+        uint32_t        airtime;                            // The total time spent transmitting, in microseconds.
+        CODAL_TIMESTAMP lastRxTime;                         // The time at which the last valid frame was received, in local microseconds.
     };
 
 
@@ -110,14 +228,92 @@ namespace codal
         uint8_t                 band;       // The radio transmission and reception frequency band.
         uint8_t                 power;      // The radio output power level of the transmitter.
         uint8_t                 group;      // The radio group to which this micro:bit belongs.
-        uint8_t                 queueDepth; // The number of packets in the receiver queue.
+        uint8_t                 rate;       // The data rate in use, one of MICROBIT_RADIO_DATA_RATE_*.
         int                     rssi;
-        FrameBuffer             *rxQueue;   // A linear list of incoming packets, queued awaiting processing.
-        FrameBuffer             *rxBuf;     // A pointer to the buffer being actively used by the RADIO hardware.
+        FrameBuffer             *rxRing;    // A ring of receive buffers, allocated when the radio is first enabled.
+        volatile uint8_t        rxHead;     // The slot being filled by the RADIO hardware. Only ever advanced by the ISR.
+        volatile uint8_t        rxTail;     // The oldest slot awaiting processing. Only ever advanced outside the ISR.
+        uint8_t                 channel;    // The frequency band currently in use, which differs from band whilst hopping.
+        uint32_t                hopDwell;   // The length of each hopping slot, in microseconds.
+        CODAL_TIMESTAMP         hopOrigin;  // The start time of slot zero of the hopping schedule, in local microseconds.
+        CODAL_TIMESTAMP         hopActive;  // The last time the hopping schedule was confirmed by reception or transmission, in local microseconds.
+        RadioLinkStats          stats;      // Link statistics, gathered since the radio was enabled.
+        FrameBuffer * volatile  txPending;  // A frame awaiting transmission in the next timeslot, when sharing the RADIO with BLE.
+        MicroBitRadioBridge     *bridge;    // The gateway bridge that received frames are forwarded to, or NULL.
+        volatile bool           inTimeslot; // Set whilst the SoftDevice has granted us the RADIO hardware.
+        volatile bool           reconfigure; // Set when settings have changed, and should be applied to the hardware in the next timeslot.
+
+        /**
+         * Determines how the RADIO hardware may be used.
+         *
+         * @return MICROBIT_OK if we may use the hardware freely, MICROBIT_BUSY if it is shared with the BLE stack and
+         *         may only be used within timeslots, or MICROBIT_NOT_SUPPORTED if the BLE stack is running and the
+         *         hardware cannot be shared.
+         */
+        int hardwareAccess();
+
+        /**
+         * Asks for any change in settings to be applied to the hardware at the next opportunity within a timeslot.
+         */
+        void requestReconfigure();
+
+        /**
+         * Programs the RADIO hardware with our current settings, and starts reception.
+         * The RADIO must be disabled, and its interrupt not yet enabled.
+         */
+        void configure();
+
+        /**
+         * Programs the address matching of the RADIO hardware, for our group and any groups being captured.
+         */
+        void setAddresses();
+
+        /**
+         * Transmits the given frame, waiting for the transmission to complete, and then resumes reception.
+         * The RADIO interrupt must be disabled, or the caller running at a higher priority.
+         *
+         * @param buffer The frame to transmit.
+         */
+        void transmit(FrameBuffer *buffer);
+
+        /**
+         * Restarts the radio on the given frequency band.
+         *
+         * @param channel The frequency band to use.
+         */
+        void tune(uint8_t channel);
+
+        /**
+         * Determines the frequency band to use at the given time, according to the hopping schedule.
+         *
+         * @param t The time, in local microseconds.
+         *
+         * @return The frequency band to use.
+         */
+        uint8_t getHopChannel(CODAL_TIMESTAMP t);
+
+        /**
+         * Schedules the end of the current hopping slot.
+         */
+        void scheduleHop();
+
+        /**
+         * Event handler, called at the end of each hopping slot to retune the radio.
+         */
+        void onHop(Event);
+
+        /**
+         * Event handler, called periodically whilst capturing from every group, to move on to the next set of groups.
+         */
+        void onCaptureScan(Event);
 
         public:
         MicroBitRadioDatagram   datagram;   // A simple datagram service.
         MicroBitRadioEvent      event;      // A simple event handling service.
+        MicroBitRadioHopping    hopping;    // The frequency hopping schedule, and its per channel statistics.
+        MicroBitRadioCapture    capture;    // A capture of raw traffic from other groups, for diagnostics.
+        MicroBitRadioPowerControl powerControl; // The adaptive transmit power control loop.
+        MicroBitRadioCipher     cipher;     // Authenticated encryption of the frames of groups given a key. Not available with BLE.
         static MicroBitRadio    *instance;  // A singleton reference, used purely by the interrupt service routine.
 
         /**
@@ -139,16 +335,169 @@ namespace codal
          */
         int setTransmitPower(int power);
 
+        /**
+         * Determines the output power level of the transmitter.
+         *
+         * @return a value in the range 0..7, where 0 is the lowest power and 7 is the highest.
+         */
+        int getTransmitPower();
+
+        /**
+         * Enables or disables adaptive transmit power control. When enabled, the power level is adjusted automatically
+         * to the lowest that achieves the given delivery rate to the other members of the group, based on the outcome of
+         * transmissions reported through reportDelivery(). Reliable datagrams (see MicroBitRadioDatagram::sendReliable())
+         * report their acknowledgements automatically. The level set by setTransmitPower() is the starting point,
+         * and the loop starts afresh whenever the group is changed.
+         *
+         * @param enable true to enable adaptive power control, false to hold the current level.
+         *
+         * @param target The percentage of transmission attempts that should succeed, in the range 1 - 100.
+         *
+         * @return MICROBIT_OK on success, or MICROBIT_INVALID_PARAMETER if the target is out of range.
+         */
+        int setAdaptivePower(bool enable, int target = MICROBIT_RADIO_POWER_CONTROL_DEFAULT_TARGET);
+
+        /**
+         * Reports the outcome of one or more transmissions to the adaptive transmit power control loop.
+         * Does nothing unless adaptive power control is enabled.
+         *
+         * @param delivered The number of transmission attempts known to have succeeded.
+         *
+         * @param lost The number of transmission attempts known to have failed.
+         *
+         * @param rssi The signal strength of the reply confirming delivery, in dBm as given by getRSSI(), or zero if unknown.
+         */
+        void reportDelivery(int delivered, int lost, int rssi = 0);
+
         /**
          * Change the transmission and reception band of the radio to the given channel
          *
          * @param band a frequency band in the range 0 - 100. Each step is 1MHz wide, based at 2400MHz.
          *
          * @return MICROBIT_OK on success, or MICROBIT_INVALID_PARAMETER if the value is out of range,
-         *         or MICROBIT_NOT_SUPPORTED if the BLE stack is running.
+         *         or MICROBIT_NOT_SUPPORTED if the BLE stack is running and the RADIO cannot be shared.
          */
         int setFrequencyBand(int band);
 
+        /**
+         * Change the data rate at which frames are sent and received. All members of a group must use the same data rate.
+         *
+         * Higher data rates reduce airtime, and so collisions and energy use, whereas the long range rates greatly extend
+         * the distance over which frames can be received.
+         *
+         * @param rate One of MICROBIT_RADIO_DATA_RATE_1MBIT (the default), MICROBIT_RADIO_DATA_RATE_2MBIT,
+         *             MICROBIT_RADIO_DATA_RATE_LR_500KBIT or MICROBIT_RADIO_DATA_RATE_LR_125KBIT.
+         *
+         * @return MICROBIT_OK on success, or MICROBIT_INVALID_PARAMETER if the value is out of range,
+         *         or MICROBIT_NOT_SUPPORTED if the BLE stack is running and the RADIO cannot be shared.
+         */
+        int setDataRate(int rate);
+
+        /**
+         * Determines the data rate at which frames are sent and received.
+         *
+         * @return One of MICROBIT_RADIO_DATA_RATE_*.
+         */
+        int getDataRate();
+
+        /**
+         * Calculates the time taken to transmit a frame at the current data rate.
+         *
+         * @param length The length field of the frame.
+         *
+         * @return The airtime of the frame, in microseconds.
+         */
+        uint32_t getAirtime(uint8_t length);
+
+        /**
+         * Configures the radio to hop between several frequency bands, rather than using a single band.
+         *
+         * Time is divided into slots, and all members of a group visit the given channels in the same pseudo random order,
+         * one per slot. Receivers align their slots to the transmissions they hear. Reception statistics are kept
+         * for each channel (see hopping), but every channel stays in the schedule, as the group has no means to agree on which to drop.
+         *
+         * @param channels The frequency bands to hop between, each in the range 0 - 100, or NULL to disable hopping.
+         *
+         * @param count The number of channels, up to MICROBIT_RADIO_HOPPING_MAX_CHANNELS.
+         *
+         * @param dwell The length of each slot, in milliseconds.
+         *
+         * @return MICROBIT_OK on success, MICROBIT_INVALID_PARAMETER if the parameters are out of range,
+         *         or MICROBIT_NOT_SUPPORTED if the BLE stack is running.
+         */
+        int setHopping(const uint8_t *channels, int count, uint32_t dwell = MICROBIT_RADIO_HOPPING_DEFAULT_DWELL_MS);
+
+        /**
+         * Starts capturing every frame heard on the current channel from the given groups, or from every group in turn,
+         * in addition to our own. Frames are timestamped as they are received and recorded into capture, from which they
+         * may be exported in bulk using capture.exportTo(). Frames sent to our own group continue to be processed as normal.
+         *
+         * The RADIO can listen to eight groups at once. When capturing from every group, it moves on to the next seven
+         * every MICROBIT_RADIO_CAPTURE_SCAN_DWELL_MS.
+         *
+         * @param groups The groups to capture, or NULL to capture every group in turn.
+         *
+         * @param count The number of groups, up to MICROBIT_RADIO_CAPTURE_MAX_GROUPS.
+         *
+         * @return MICROBIT_OK on success, MICROBIT_INVALID_PARAMETER if the parameters are out of range,
+         *         MICROBIT_NO_RESOURCES if there is insufficient memory, or MICROBIT_NOT_SUPPORTED if the BLE stack
+         *         is running and the RADIO cannot be shared.
+         */
+        int startCapture(const uint8_t *groups = NULL, int count = 0);
+
+        /**
+         * Stops capturing frames from other groups. Frames already captured may still be exported.
+         *
+         * @return MICROBIT_OK on success, or MICROBIT_NOT_SUPPORTED if the BLE stack is running and the RADIO cannot be shared.
+         */
+        int stopCapture();
+
+        /**
+         * Determines the frequency band currently in use.
+         *
+         * @return The band set by setFrequencyBand(), or if hopping, the band of the current slot.
+         */
+        int getChannel();
+
+        /**
+         * Records the reception of a frame, and if we are not yet following the hopping schedule of our group,
+         * adopts that of the sender.
+         *
+         * @param valid true if the frame passed its CRC check, false otherwise.
+         *
+         * @note should only be called from RADIO_IRQHandler...
+         */
+        void setHopTiming(bool valid);
+
+        /**
+         * Called at the start of a timeslot granted by the SoftDevice. Configures the RADIO, and starts reception.
+         *
+         * @note should only be called from the timeslot signal handler...
+         */
+        void timeslotStart();
+
+        /**
+         * Called when a timeslot granted by the SoftDevice is about to end. Stops the RADIO.
+         *
+         * @note should only be called from the timeslot signal handler...
+         */
+        void timeslotEnd();
+
+        /**
+         * Called when a timeslot we asked for could not be granted. Asks again, provided we still want one.
+         *
+         * @note should only be called from the SoC event handler...
+         */
+        void timeslotRenew();
+
+        /**
+         * Called within a timeslot whenever the RADIO needs attention. Applies any change in settings,
+         * and transmits any frame awaiting transmission, if enough time remains.
+         *
+         * @note should only be called from the timeslot signal handler...
+         */
+        void timeslotService();
+
         /**
          * Retrieve a pointer to the currently allocated receive buffer. This is the area of memory
          * actively being used by the radio hardware to store incoming data.
@@ -159,12 +508,24 @@ namespace codal
 
         /**
          * Attempt to queue a buffer received by the radio hardware, if sufficient space is available.
+         * The radio hardware should then be pointed at the buffer given by getRxBuf().
+         *
+         * @return MICROBIT_OK on success, or MICROBIT_NO_RESOURCES if the receive queue is full,
+         *         in which case the current receive buffer will be reused.
          *
-         * @return MICROBIT_OK on success, or MICROBIT_NO_RESOURCES if a replacement receiver buffer
-         *         could not be allocated (either by policy or memory exhaustion).
+         * @note should only be called from RADIO_IRQHandler...
          */
         int queueRxBuf();
 
+        /**
+         * Records the reception of a frame in the link statistics, along with the time at which it was received.
+         *
+         * @param valid true if the frame passed its CRC check, false otherwise.
+         *
+         * @note should only be called from RADIO_IRQHandler...
+         */
+        void recordReceive(bool valid);
+
         /**
          * Sets the RSSI for the most recent packet.
          * The value is measured in -dbm. The higher the value, the stronger the signal.
@@ -186,16 +547,32 @@ namespace codal
         int getRSSI();
 
         /**
-         * Initialises the radio for use as a multipoint sender/receiver
+         * Retrieves the link statistics gathered since the radio was enabled, or since they were last reset.
          *
-         * @return MICROBIT_OK on success, MICROBIT_NOT_SUPPORTED if the BLE stack is running.
+         * @param stats The structure to fill in.
+         *
+         * @return MICROBIT_OK on success.
+         */
+        int getStats(RadioLinkStats &stats);
+
+        /**
+         * Resets all link statistics to zero.
+         */
+        void resetStats();
+
+        /**
+         * Initialises the radio for use as a multipoint sender/receiver.
+         *
+         * If the BLE stack is running, the RADIO hardware is shared with it using the SoftDevice timeslot API.
+         *
+         * @return MICROBIT_OK on success, MICROBIT_NOT_SUPPORTED if the BLE stack is running and the RADIO cannot be shared.
          */
         int enable();
 
         /**
          * Disables the radio for use as a multipoint sender/receiver.
          *
-         * @return MICROBIT_OK on success, MICROBIT_NOT_SUPPORTED if the BLE stack is running.
+         * @return MICROBIT_OK on success, MICROBIT_NOT_SUPPORTED if the BLE stack is running and the RADIO cannot be shared.
          */
         int disable();
 
@@ -204,7 +581,7 @@ namespace codal
          *
          * @param group The group to join. A micro:bit can only listen to one group ID at any time.
          *
-         * @return MICROBIT_OK on success, or MICROBIT_NOT_SUPPORTED if the BLE stack is running.
+         * @return MICROBIT_OK on success, or MICROBIT_NOT_SUPPORTED if the BLE stack is running and the RADIO cannot be shared.
          */
         int setGroup(uint8_t group);
 
@@ -214,6 +591,15 @@ namespace codal
          */
         virtual void idleCallback();
 
+        /**
+         * Hands every frame received to the given bridge, in place of the protocol handlers, or stops doing so.
+         *
+         * @param bridge The bridge to forward frames to, or NULL to deliver them as normal.
+         *
+         * @note called by MicroBitRadioBridge::start() and MicroBitRadioBridge::stop().
+         */
+        void setBridge(MicroBitRadioBridge *bridge);
+
         /**
          * Determines the number of packets ready to be processed.
          *
@@ -233,13 +619,32 @@ namespace codal
          */
         FrameBuffer* recv();
 
+        /**
+         * Retrieves the next packet from the receive buffer, without copying or dequeuing it.
+         *
+         * The buffer returned remains owned by the radio, and is valid only until release() is called.
+         * This avoids any memory allocation, and may be used in place of recv() by protocol handlers.
+         *
+         * @return The buffer containing the packet. If no data is available, NULL is returned.
+         */
+        FrameBuffer* peek();
+
+        /**
+         * Returns the buffer lent out by peek() to the radio, making it available for reception.
+         * Does nothing if no data is available.
+         */
+        void release();
+
         /**
          * Transmits the given buffer onto the broadcast radio.
          * The call will wait until the transmission of the packet has completed before returning.
          *
          * @param data The packet contents to transmit.
          *
-         * @return MICROBIT_OK on success, or MICROBIT_NOT_SUPPORTED if the BLE stack is running.
+         * When sharing the RADIO with the BLE stack, the frame is transmitted in the next timeslot.
+         *
+         * @return MICROBIT_OK on success, MICROBIT_NOT_SUPPORTED if the BLE stack is running and the RADIO cannot be shared,
+         *         or MICROBIT_BUSY if the RADIO is shared and no timeslot was granted within MICROBIT_RADIO_TIMESLOT_TX_TIMEOUT_MS.
          */
         int send(FrameBuffer *buffer);
 
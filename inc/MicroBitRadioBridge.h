@@ -0,0 +1,198 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef MICROBIT_RADIO_BRIDGE_H
+#define MICROBIT_RADIO_BRIDGE_H
+
+#include "CodalConfig.h"
+#include "CodalComponent.h"
+#include "NRF52Serial.h"
+#include "MicroBitSerialQueue.h"
+#include "MicroBitRadio.h"
+#include "MicroBitMeshRadio.h"
+#include "MicroBitComponentIds.h"
+
+// The baud rate the serial port is switched to whilst bridging. A busy channel carries far more than the
+// default 115200 baud can, so the interface chip's fastest rate is used.
+#ifndef MICROBIT_RADIO_BRIDGE_BAUD
+#define MICROBIT_RADIO_BRIDGE_BAUD                  1000000
+#endif
+
+// Record types, carried in the first byte of every record in either direction.
+#define MICROBIT_RADIO_BRIDGE_TYPE_RADIO            0x01    // A MicroBitRadio frame, starting with its length field.
+#define MICROBIT_RADIO_BRIDGE_TYPE_MESH             0x02    // A MicroBitMeshRadio frame, starting with its length field.
+
+// Record flags, in records sent to the host.
+#define MICROBIT_RADIO_BRIDGE_FLAG_DROPPED          0x01    // One or more frames were lost before this one, as the serial queue was full.
+
+// Record format. Records sent to the host are [type][flags][rssi][timestamp (4 bytes, little endian)][length][frame...],
+// and records from the host are [type][length][frame...]. Every record is COBS encoded and followed by a zero byte,
+// so a reader can synchronise on the next zero regardless of any other output sharing the serial port.
+#define MICROBIT_RADIO_BRIDGE_HEADER_SIZE           7
+#define MICROBIT_RADIO_BRIDGE_MAX_FRAME             (MICROBIT_MESH_RADIO_HEADER_SIZE + MICROBIT_RADIO_MAX_PACKET_SIZE)
+#define MICROBIT_RADIO_BRIDGE_MAX_RECORD            (MICROBIT_RADIO_BRIDGE_HEADER_SIZE + MICROBIT_RADIO_BRIDGE_MAX_FRAME)
+#define MICROBIT_RADIO_BRIDGE_MAX_ENCODED           (MICROBIT_RADIO_BRIDGE_MAX_RECORD + MICROBIT_RADIO_BRIDGE_MAX_RECORD / 254 + 2)
+
+#define MICROBIT_RADIO_BRIDGE_STATUS_ENABLED        0x01
+
+namespace codal
+{
+    /**
+     * Statistics describing a radio bridge.
+     */
+    struct RadioBridgeStats
+    {
+        uint32_t        forwarded;              // The number of frames received from the radio and queued for the host.
+        uint32_t        dropped;                // The number of frames received from the radio and lost, as the serial queue was full.
+        uint32_t        injected;               // The number of frames received from the host and transmitted.
+        uint32_t        errors;                 // The number of records received from the host that were malformed, or could not be sent.
+    };
+
+    /**
+     * Bridges a MicroBitRadio or MicroBitMeshRadio to a host computer over the serial port, for gateways.
+     *
+     * Whilst bridging, every frame the radio receives is taken straight from its receive queue, timestamped and
+     * framed as a binary record, and queued for the interrupt driven serial transmitter without any formatting or
+     * per frame allocation. In the reverse direction, records sent by the host are decoded and transmitted.
+     * Frames are not delivered to the radio's own protocols (datagram, event and so on) whilst bridging.
+     */
+    class MicroBitRadioBridge : public CodalComponent
+    {
+        NRF52Serial             &serial;                                    // The serial port to the host.
+        MicroBitSerialQueue     &queue;                                     // The non-blocking transmit queue in front of that port.
+        MicroBitRadio           *radio;                                     // The radio being bridged, or NULL.
+        MicroBitMeshRadio       *mesh;                                      // The mesh radio being bridged, or NULL.
+        uint8_t                 input[MICROBIT_RADIO_BRIDGE_MAX_ENCODED];   // The encoded record being received from the host.
+        uint16_t                inputLength;                                // The number of bytes held in input.
+        bool                    overflow;                                   // Set if frames have been dropped since the last record.
+        RadioBridgeStats        stats;
+
+        /**
+         * Frames and queues a record for the host.
+         *
+         * @param type The record type, one of MICROBIT_RADIO_BRIDGE_TYPE_*.
+         *
+         * @param frame The frame, starting with its length field.
+         *
+         * @param rssi The received signal strength of the frame, in -dBm.
+         *
+         * @param timestamp The time at which the frame was received, in local microseconds.
+         */
+        void forward(uint8_t type, const uint8_t *frame, uint8_t rssi, CODAL_TIMESTAMP timestamp);
+
+        /**
+         * Decodes and transmits a complete record received from the host.
+         *
+         * @param len The number of encoded bytes in input, excluding the terminating zero.
+         */
+        void inject(int len);
+
+        /**
+         * Switches the serial port to the bridge baud rate, and starts taking frames from the radio.
+         */
+        int begin(int baud);
+
+        public:
+
+        /**
+         * Constructor.
+         *
+         * Creates an idle bridge.
+         *
+         * @param serial The serial port to the host.
+         *
+         * @param queue The transmit queue in front of that serial port.
+         *
+         * @param id The unique EventModel id of this component. Defaults to MICROBIT_ID_RADIO_BRIDGE.
+         */
+        MicroBitRadioBridge(NRF52Serial &serial, MicroBitSerialQueue &queue, uint16_t id = MICROBIT_ID_RADIO_BRIDGE);
+
+        /**
+         * Starts bridging the given radio, which should already be enabled.
+         *
+         * @param radio The radio to bridge.
+         *
+         * @param baud The baud rate to use on the serial port. Defaults to MICROBIT_RADIO_BRIDGE_BAUD.
+         *
+         * @return DEVICE_OK on success, or DEVICE_BUSY if a radio is already being bridged.
+         */
+        int start(MicroBitRadio &radio, int baud = MICROBIT_RADIO_BRIDGE_BAUD);
+
+        /**
+         * Starts bridging the given mesh radio, which should already be enabled. Frames are forwarded as they are
+         * received, relays included, before unicast frames are filtered by destination.
+         *
+         * @param radio The mesh radio to bridge.
+         *
+         * @param baud The baud rate to use on the serial port. Defaults to MICROBIT_RADIO_BRIDGE_BAUD.
+         *
+         * @return DEVICE_OK on success, or DEVICE_BUSY if a radio is already being bridged.
+         */
+        int start(MicroBitMeshRadio &radio, int baud = MICROBIT_RADIO_BRIDGE_BAUD);
+
+        /**
+         * Stops bridging. The radio returns to delivering frames to its own protocols.
+         */
+        void stop();
+
+        /**
+         * Determines if a radio is being bridged.
+         *
+         * @return true if bridging, false otherwise.
+         */
+        bool isEnabled();
+
+        /**
+         * Forwards a frame received by the bridged radio to the host.
+         *
+         * @param frame The frame just taken from the radio's receive queue.
+         *
+         * @note called by MicroBitRadio::idleCallback() whilst bridging.
+         */
+        void forward(FrameBuffer *frame);
+
+        /**
+         * Forwards a frame received by the bridged mesh radio to the host.
+         *
+         * @param frame The frame just taken from the radio's receive queue.
+         *
+         * @note called by MicroBitMeshRadio::idleCallback() whilst bridging.
+         */
+        void forward(SequencedFrameBuffer *frame);
+
+        /**
+         * Retrieves the statistics of the bridge, since it was constructed.
+         *
+         * @param stats The structure to fill in.
+         */
+        void getStats(RadioBridgeStats &stats);
+
+        /**
+         * Reads and injects records from the host when the scheduler is idle.
+         */
+        virtual void idleCallback() override;
+    };
+}
+
+#endif
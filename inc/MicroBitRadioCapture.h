@@ -0,0 +1,208 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 British Broadcasting Corporation.
+This software is provided by Lancaster University by arrangement with the BBC.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef MICROBIT_RADIO_CAPTURE_H
+#define MICROBIT_RADIO_CAPTURE_H
+
+#include "CodalConfig.h"
+#include "NRF52Serial.h"
+
+// The size of the ring into which captured frames are recorded, in bytes. Must be a power of two, as positions in the
+// ring are reduced with a mask, and at least 512 bytes, so that a record of the largest possible frame fits.
+// Storage is taken from the heap the first time capture is started, and retained thereafter.
+#ifndef MICROBIT_RADIO_CAPTURE_BUFFER_SIZE
+#define MICROBIT_RADIO_CAPTURE_BUFFER_SIZE      4096
+#endif
+
+#if MICROBIT_RADIO_CAPTURE_BUFFER_SIZE < 512 || (MICROBIT_RADIO_CAPTURE_BUFFER_SIZE & (MICROBIT_RADIO_CAPTURE_BUFFER_SIZE - 1)) != 0
+    #error "MICROBIT_RADIO_CAPTURE_BUFFER_SIZE must be a power of two, of at least 512 bytes"
+#endif
+
+// When capturing from all groups, the time spent listening to each set of groups before moving on to the next.
+#ifndef MICROBIT_RADIO_CAPTURE_SCAN_DWELL_MS
+#define MICROBIT_RADIO_CAPTURE_SCAN_DWELL_MS    50
+#endif
+
+// The RADIO can match eight addresses at once. The first is always our own group, leaving seven for others.
+#define MICROBIT_RADIO_CAPTURE_ADDRESSES        8
+#define MICROBIT_RADIO_CAPTURE_MAX_GROUPS       (MICROBIT_RADIO_CAPTURE_ADDRESSES - 1)
+
+// Record format. Each record is an eight byte header, followed by the frame as received,
+// starting with its length field: [sync][flags][rssi][group][timestamp (4 bytes, little endian)][length][frame...]
+#define MICROBIT_RADIO_CAPTURE_SYNC             0xA5
+#define MICROBIT_RADIO_CAPTURE_HEADER_SIZE      8
+
+// Record flags
+#define MICROBIT_RADIO_CAPTURE_FLAG_CRC_OK      0x01    // The frame passed its CRC check.
+#define MICROBIT_RADIO_CAPTURE_FLAG_DROPPED     0x02    // One or more frames were lost before this one, as the ring was full.
+
+namespace codal
+{
+    /**
+     * Statistics describing a radio capture.
+     */
+    struct RadioCaptureStats
+    {
+        uint32_t        captured;               // The number of frames recorded into the ring.
+        uint32_t        dropped;                // The number of frames lost, as the ring was full.
+        uint32_t        pending;                // The number of bytes in the ring, awaiting export.
+    };
+
+    /**
+     * A capture of raw radio traffic, for diagnosing deployments, used by MicroBitRadio.
+     *
+     * Frames heard on any of a set of groups, or on every group in turn, are timestamped in the interrupt service routine
+     * and recorded into a large preallocated ring in a compact binary format. The ring is drained in bulk over a serial port,
+     * with no per frame allocation, so that bursts of traffic on a busy channel can be kept up with.
+     *
+     * This class holds no hardware state of its own; the radio programs its address matching from getPrefix() and getAddressMask().
+     */
+    class MicroBitRadioCapture
+    {
+        uint8_t                 *buffer;                                    // The ring of records, allocated when capture is first started.
+        volatile uint32_t       head;                                       // The total number of bytes written to the ring. Only ever advanced by the ISR.
+        volatile uint32_t       tail;                                       // The total number of bytes exported from the ring. Only ever advanced outside the ISR.
+        uint8_t                 groups[MICROBIT_RADIO_CAPTURE_ADDRESSES];   // The group matched by each logical address of the RADIO.
+        uint8_t                 count;                                      // The number of logical addresses in use.
+        bool                    enabled;                                    // Set whilst capture is in progress.
+        bool                    scanning;                                   // Set if capturing from every group in turn.
+        bool                    overflow;                                   // Set if frames have been dropped since the last record.
+        uint32_t                captured;                                   // The number of frames recorded.
+        uint32_t                dropped;                                    // The number of frames lost.
+
+        /**
+         * Fills the logical addresses other than our own with the next groups in turn.
+         *
+         * @param from The group at which to start.
+         */
+        void fill(uint8_t from);
+
+        public:
+
+        /**
+         * Constructor.
+         *
+         * Creates an idle capture. No memory is allocated until capture is started.
+         */
+        MicroBitRadioCapture();
+
+        /**
+         * Starts capturing frames. Any records still awaiting export are discarded.
+         *
+         * @param list The groups to capture, in addition to our own, or NULL to capture every group in turn.
+         *
+         * @param n The number of groups in the list, up to MICROBIT_RADIO_CAPTURE_MAX_GROUPS.
+         *
+         * @param own The group to which this micro:bit belongs.
+         *
+         * @return MICROBIT_OK on success, MICROBIT_INVALID_PARAMETER if the list is invalid,
+         *         or MICROBIT_NO_RESOURCES if the ring could not be allocated.
+         */
+        int start(const uint8_t *list, int n, uint8_t own);
+
+        /**
+         * Stops capturing frames. Records already captured remain in the ring, and may still be exported.
+         */
+        void stop();
+
+        /**
+         * Determines if capture is in progress.
+         *
+         * @return true if frames are being captured, false otherwise.
+         */
+        bool isEnabled();
+
+        /**
+         * Determines if every group is being captured in turn.
+         *
+         * @return true if scanning, false otherwise.
+         */
+        bool isScanning();
+
+        /**
+         * Updates the group to which this micro:bit belongs, which is always captured.
+         *
+         * @param own The new group.
+         */
+        void setGroup(uint8_t own);
+
+        /**
+         * When scanning, moves on to the next set of groups.
+         */
+        void nextWindow();
+
+        /**
+         * Determines the value of the RADIO PREFIX0 or PREFIX1 register, which hold the groups of logical addresses 0 - 3 and 4 - 7.
+         *
+         * @param n The register, 0 or 1.
+         *
+         * @return The register value.
+         */
+        uint32_t getPrefix(int n);
+
+        /**
+         * Determines the value of the RADIO RXADDRESSES register.
+         *
+         * @return A bitmask, where bit n enables logical address n.
+         */
+        uint32_t getAddressMask();
+
+        /**
+         * Records a frame into the ring, or counts it as dropped if there is no space.
+         *
+         * @param frame The frame as received by the RADIO, starting with its length field.
+         *
+         * @param address The logical address on which the frame was received.
+         *
+         * @param rssi The received signal strength of the frame, in -dBm.
+         *
+         * @param valid true if the frame passed its CRC check, false otherwise.
+         *
+         * @note should only be called from RADIO_IRQHandler...
+         */
+        void record(const uint8_t *frame, uint32_t address, uint8_t rssi, bool valid);
+
+        /**
+         * Sends all records awaiting export over the given serial port, as a raw binary stream.
+         * Records are not split into calls of their own, so a reader should synchronise on MICROBIT_RADIO_CAPTURE_SYNC.
+         *
+         * @param serial The serial port to use.
+         *
+         * @return The number of bytes sent, or an error from Serial::send().
+         */
+        int exportTo(NRF52Serial &serial);
+
+        /**
+         * Retrieves the statistics of the current capture.
+         *
+         * @param stats The structure to fill in.
+         *
+         * @return MICROBIT_OK on success.
+         */
+        int getStats(RadioCaptureStats &stats);
+    };
+}
+
+#endif
@@ -0,0 +1,193 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef MICROBIT_RADIO_CIPHER_H
+#define MICROBIT_RADIO_CIPHER_H
+
+#include "CodalConfig.h"
+#include "MicroBitConfig.h"
+
+// The number of groups that may be given a key at once.
+#ifndef CONFIG_MICROBIT_RADIO_CIPHER_KEYS
+#define CONFIG_MICROBIT_RADIO_CIPHER_KEYS       4
+#endif
+
+// The number of senders whose last frame counter is remembered, to reject replayed frames.
+#ifndef CONFIG_MICROBIT_RADIO_CIPHER_SENDERS
+#define CONFIG_MICROBIT_RADIO_CIPHER_SENDERS    8
+#endif
+
+// The version code of a sealed frame. Frames are handed to protocol handlers with the version restored to 1.
+#define MICROBIT_RADIO_VERSION_SECURE           2
+
+// Sealed frame format. The payload becomes [clear bytes][session (4 bytes)][counter (4 bytes)][ciphertext][MIC (4 bytes)],
+// where the clear bytes are a protocol header that relays must read. They are not encrypted, but are bound into the nonce,
+// so they are authenticated along with the rest of the frame.
+#define MICROBIT_RADIO_CIPHER_CLEAR_MAX         4
+#define MICROBIT_RADIO_CIPHER_KEY_SIZE          16
+#define MICROBIT_RADIO_CIPHER_NONCE_SIZE        8
+#define MICROBIT_RADIO_CIPHER_MIC_SIZE          4
+#define MICROBIT_RADIO_CIPHER_OVERHEAD          (MICROBIT_RADIO_CIPHER_NONCE_SIZE + MICROBIT_RADIO_CIPHER_MIC_SIZE)
+
+// The largest plaintext the CCM peripheral can process, including its MIC.
+#define MICROBIT_RADIO_CIPHER_MAX_LENGTH        251
+
+namespace codal
+{
+    /**
+     * A key held by a MicroBitRadioCipher.
+     */
+    struct RadioCipherKey
+    {
+        uint8_t         key[MICROBIT_RADIO_CIPHER_KEY_SIZE];
+        uint8_t         group;                  // The group the key belongs to.
+        bool            used;                   // True if this entry holds a key.
+    };
+
+    /**
+     * The last frame counter seen from a sender, used to reject replayed frames.
+     */
+    struct RadioCipherSender
+    {
+        uint32_t        session;                // The random session identifier chosen by the sender, or 0 if unused.
+        uint32_t        counter;                // The counter of the newest frame accepted from the session.
+        uint32_t        lastUsed;               // The value of the cipher's clock when a frame was last accepted, for eviction.
+        uint8_t         group;                  // The group the session was heard on.
+    };
+
+    /**
+     * Authenticated encryption of radio frames with per group keys, using the CCM peripheral (AES-128 CCM with a
+     * 32 bit MIC, as used by Bluetooth LE). Used by MicroBitRadio and MicroBitMeshRadio.
+     *
+     * Each frame carries the sender's random session identifier, chosen afresh whenever the device starts, and a
+     * counter that increments with every frame, which together form the nonce. Receivers reject frames that fail
+     * authentication, or that do not advance the counter of a recently heard session.
+     *
+     * The CCM peripheral encrypts and decrypts in memory under EasyDMA, taking around a microsecond per byte, during
+     * which the processor merely waits. It cannot be used while the BLE stack is running.
+     */
+    class MicroBitRadioCipher
+    {
+        RadioCipherKey          keys[CONFIG_MICROBIT_RADIO_CIPHER_KEYS];
+        RadioCipherSender       senders[CONFIG_MICROBIT_RADIO_CIPHER_SENDERS];
+        uint8_t                 *work;                  // The CCM configuration, input, output and scratch areas, or NULL until first used.
+        uint32_t                session;                // Our session identifier.
+        uint32_t                counter;                // The counter given to the next frame we seal.
+        uint32_t                clock;                  // Incremented with every frame accepted, to find the least recently heard sender.
+        uint32_t                rejected;               // The number of frames rejected.
+
+        /**
+         * Finds the key of a group.
+         *
+         * @return The key, or NULL if the group has none.
+         */
+        RadioCipherKey *findKey(uint8_t group);
+
+        /**
+         * Runs the CCM peripheral over the input area, into the output area.
+         *
+         * @param key The key to use.
+         * @param session The session identifier of the sender.
+         * @param counter The frame counter of the sender.
+         * @param context Up to 24 bits of further data identifying the frame, which is bound into the nonce.
+         * @param clear The bytes of the frame left in the clear, which are bound into the nonce.
+         * @param clearLength The number of clear bytes, up to MICROBIT_RADIO_CIPHER_CLEAR_MAX.
+         * @param decrypt true to decrypt and authenticate, false to encrypt.
+         *
+         * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if decrypting and the frame failed authentication.
+         */
+        int crypt(RadioCipherKey *key, uint32_t session, uint32_t counter, uint32_t context, const uint8_t *clear, int clearLength, bool decrypt);
+
+        /**
+         * Determines if a frame counter is newer than any seen before from its session, and if so records it.
+         *
+         * @return true if the frame should be accepted, false if it is a replay.
+         */
+        bool accept(uint8_t group, uint32_t session, uint32_t counter);
+
+        public:
+
+        /**
+         * Constructor. No keys are held, so frames are sent in the clear.
+         */
+        MicroBitRadioCipher();
+
+        /**
+         * Sets or removes the key of a group. Frames sent to a group with a key are sealed, and sealed frames received
+         * from it are opened; frames for other groups are sent and received in the clear, as before.
+         *
+         * @param group The group of interest.
+         * @param key The 16 byte key, or NULL to remove the key of the group.
+         *
+         * @return DEVICE_OK on success, DEVICE_NO_RESOURCES if CONFIG_MICROBIT_RADIO_CIPHER_KEYS groups already have a
+         * key or there is insufficient memory, or DEVICE_NOT_SUPPORTED if the BLE stack is running.
+         */
+        int setKey(uint8_t group, const uint8_t *key);
+
+        /**
+         * Determines if a group has a key.
+         */
+        bool isEnabled(uint8_t group);
+
+        /**
+         * Seals a payload, encrypting and authenticating it.
+         *
+         * @param group The group the frame is being sent to. Must have a key.
+         * @param protocol The protocol field of the frame, which is authenticated.
+         * @param context Up to 24 bits of further header data of the frame to authenticate, or 0.
+         * @param in The payload to seal.
+         * @param length The length of the payload.
+         * @param clear The number of bytes at the start of the payload to leave in the clear, up to MICROBIT_RADIO_CIPHER_CLEAR_MAX.
+         * They are authenticated, but not encrypted.
+         * @param out The buffer to store the sealed payload in, which must have room for length + MICROBIT_RADIO_CIPHER_OVERHEAD bytes.
+         * It may not be the same as in.
+         *
+         * @return The length of the sealed payload, DEVICE_INVALID_PARAMETER if the lengths are out of range,
+         * DEVICE_NOT_SUPPORTED if the group has no key or the BLE stack is running.
+         */
+        int seal(uint8_t group, uint8_t protocol, uint32_t context, const uint8_t *in, int length, int clear, uint8_t *out);
+
+        /**
+         * Opens a sealed payload in place, checking its authenticity and that it is not a replay.
+         *
+         * @param group The group the frame was received on.
+         * @param protocol The protocol field of the frame.
+         * @param context The further header data given to seal().
+         * @param data The sealed payload, which is replaced by the plaintext.
+         * @param length The length of the sealed payload.
+         * @param clear The number of bytes at the start of the payload that were left in the clear.
+         *
+         * @return The length of the plaintext payload, DEVICE_INVALID_PARAMETER if the frame failed authentication or is a
+         * replay, or DEVICE_NOT_SUPPORTED if the group has no key or the BLE stack is running.
+         */
+        int open(uint8_t group, uint8_t protocol, uint32_t context, uint8_t *data, int length, int clear);
+
+        /**
+         * Determines the number of sealed frames rejected, as they failed authentication or were replayed, and resets the count.
+         */
+        uint32_t getRejected();
+    };
+}
+
+#endif
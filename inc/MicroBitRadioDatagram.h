@@ -29,9 +29,69 @@ DEALINGS IN THE SOFTWARE.
 #include "CodalConfig.h"
 #include "MicroBitRadio.h"
 #include "ManagedString.h"
+#include "MicroBitComponentIds.h"
+
+// Reliable delivery configuration.
+// The number of unacknowledged datagrams that may be outstanding to any one destination.
+#ifndef MICROBIT_RADIO_ARQ_WINDOW
+#define MICROBIT_RADIO_ARQ_WINDOW               4
+#endif
+
+// The number of unacknowledged datagrams that may be outstanding in total.
+#ifndef MICROBIT_RADIO_ARQ_TX_SLOTS
+#define MICROBIT_RADIO_ARQ_TX_SLOTS             8
+#endif
+
+// The number of peers for which sequence state is held.
+#ifndef MICROBIT_RADIO_ARQ_PEERS
+#define MICROBIT_RADIO_ARQ_PEERS                4
+#endif
+
+// The time to wait for an acknowledgement before the first retransmission. This doubles with each retry.
+#ifndef MICROBIT_RADIO_ARQ_TIMEOUT_MS
+#define MICROBIT_RADIO_ARQ_TIMEOUT_MS           20
+#endif
+
+// The number of retransmissions before delivery is deemed to have failed.
+#ifndef MICROBIT_RADIO_ARQ_MAX_RETRIES
+#define MICROBIT_RADIO_ARQ_MAX_RETRIES          5
+#endif
+
+#define MICROBIT_RADIO_ARQ_TYPE_DATA            0
+#define MICROBIT_RADIO_ARQ_TYPE_ACK             1
+#define MICROBIT_RADIO_ARQ_HEADER_SIZE          6       // type, source, destination, sequence number.
+#define MICROBIT_RADIO_ARQ_MAX_PAYLOAD          (MICROBIT_RADIO_MAX_PACKET_SIZE - MICROBIT_RADIO_ARQ_HEADER_SIZE)
+
+// Delivery status is raised as MICROBIT_RADIO_ID_DATAGRAM_DELIVERED or MICROBIT_RADIO_ID_DATAGRAM_FAILED,
+// with the ticket returned by sendReliable() as the event value.
 
 namespace codal
 {
+    /**
+     * A datagram awaiting acknowledgement.
+     */
+    struct RadioArqSlot
+    {
+        uint16_t        ticket;                 // The identifier given to the sender, or zero if this slot is unused.
+        uint16_t        destination;            // The address the datagram is for.
+        uint8_t         seqNo;                  // The sequence number of the datagram.
+        uint8_t         retries;                // The number of times the datagram has been retransmitted.
+        uint8_t         length;                 // The length of the payload.
+        CODAL_TIMESTAMP deadline;               // The time (ms) at which the datagram will be retransmitted, if not acknowledged.
+        uint8_t         payload[MICROBIT_RADIO_ARQ_MAX_PAYLOAD];
+    };
+
+    /**
+     * Sequence state held for each peer we exchange reliable datagrams with.
+     */
+    struct RadioArqPeer
+    {
+        uint16_t        address;                // The address of the peer, or zero if this record is unused.
+        uint8_t         txSeqNo;                // The sequence number of the last datagram we sent to the peer.
+        uint8_t         rxSeqNo;                // The highest sequence number received from the peer.
+        uint32_t        rxSeen;                 // Bitmap of recently received sequence numbers, where bit n represents rxSeqNo - n.
+    };
+
     /**
      * Provides a simple broadcast radio abstraction, built upon the raw nrf51822 RADIO module.
      *
@@ -46,7 +106,61 @@ namespace codal
     class MicroBitRadioDatagram
     {
         MicroBitRadio   &radio;     // The underlying radio module used to send and receive data.
-        FrameBuffer     *rxQueue;   // A linear list of incoming packets, queued awaiting processing.
+        PacketData      *rxQueue[MICROBIT_RADIO_MAXIMUM_RX_BUFFERS];  // Incoming packets awaiting collection, held ready for a PacketBuffer to adopt.
+        uint8_t         rxQueueHead;  // The index of the oldest packet in rxQueue.
+        uint8_t         rxQueueDepth; // The number of packets in rxQueue.
+        uint16_t        address;    // Our address, as used by reliable delivery.
+        uint16_t        nextTicket; // The ticket to be given to the next reliable datagram.
+        uint8_t         peerVictim; // The peer record to be reused next, when all are in use.
+        bool            arqListening; // Set once the ARQ timer handler has been registered.
+        RadioArqSlot    arqSlots[MICROBIT_RADIO_ARQ_TX_SLOTS];  // Datagrams awaiting acknowledgement.
+        RadioArqPeer    arqPeers[MICROBIT_RADIO_ARQ_PEERS];     // Sequence state for the peers we know.
+
+        /**
+         * Adds the given packet to the tail of the receive queue, and signals its arrival.
+         * If the queue is full, the packet is discarded.
+         *
+         * @param packet The packet to queue. The queue takes over the caller's reference.
+         */
+        void queuePacket(PacketData *packet);
+
+        /**
+         * Removes the packet at the head of the receive queue.
+         *
+         * @return The packet, whose reference passes to the caller, or NULL if the queue is empty.
+         */
+        PacketData *dequeuePacket();
+
+        /**
+         * Finds the sequence state for the given peer, creating it if necessary.
+         *
+         * @param peer The address of the peer.
+         *
+         * @return The peer record.
+         */
+        RadioArqPeer *getPeer(uint16_t peer);
+
+        /**
+         * Transmits a reliable datagram, or an acknowledgement.
+         *
+         * @param type MICROBIT_RADIO_ARQ_TYPE_DATA or MICROBIT_RADIO_ARQ_TYPE_ACK.
+         *
+         * @param destination The address the frame is for.
+         *
+         * @param seqNo The sequence number of the datagram.
+         *
+         * @param payload The datagram contents, or NULL for an acknowledgement.
+         *
+         * @param len The length of the payload.
+         *
+         * @return MICROBIT_OK on success, or the error returned by MicroBitRadio::send().
+         */
+        int sendArqFrame(uint8_t type, uint16_t destination, uint8_t seqNo, uint8_t *payload, int len);
+
+        /**
+         * Event handler, called periodically whilst datagrams await acknowledgement, to retransmit them.
+         */
+        void onArqTimer(Event);
 
         public:
 
@@ -84,6 +198,26 @@ namespace codal
          */
         PacketBuffer recv();
 
+        /**
+         * Retrieves several packets at once, in order of arrival. The receive queue is detached in a single
+         * pass, so draining it costs one call rather than one per packet, and each packet is handed over without copying.
+         *
+         * @param out An array of PacketBuffers into which the packets received are placed.
+         *
+         * @param max The number of PacketBuffers in the array.
+         *
+         * @return The number of packets retrieved, which may be zero, or MICROBIT_INVALID_PARAMETER if the array is invalid.
+         *
+         * @code
+         * PacketBuffer packets[MICROBIT_RADIO_MAXIMUM_RX_BUFFERS];
+         * int n = uBit.radio.datagram.recv(packets, MICROBIT_RADIO_MAXIMUM_RX_BUFFERS);
+         *
+         * for (int i = 0; i < n; i++)
+         *     process(packets[i]);
+         * @endcode
+         */
+        int recv(PacketBuffer *out, int max);
+
         /**
          * Transmits the given buffer onto the broadcast radio.
          *
@@ -125,6 +259,39 @@ namespace codal
          */
         int send(ManagedString data);
 
+        /**
+         * Transmits the given buffer to a single micro:bit, retransmitting it until it is acknowledged.
+         *
+         * Up to MICROBIT_RADIO_ARQ_WINDOW datagrams may be outstanding to each destination. Retransmissions back off
+         * exponentially. Once the datagram is acknowledged, a MICROBIT_RADIO_ID_DATAGRAM_DELIVERED event is raised,
+         * or if MICROBIT_RADIO_ARQ_MAX_RETRIES retransmissions go unacknowledged, a MICROBIT_RADIO_ID_DATAGRAM_FAILED event.
+         * In either case, the event value is the ticket returned by this call. The datagram is received through recv() as usual.
+         *
+         * @param destination The address of the recipient, as returned by its getAddress().
+         *
+         * @param buffer The packet contents to transmit.
+         *
+         * @param len The number of bytes to transmit, up to MICROBIT_RADIO_ARQ_MAX_PAYLOAD.
+         *
+         * @return A positive ticket identifying the datagram on success, MICROBIT_INVALID_PARAMETER if the parameters are invalid,
+         *         or MICROBIT_NO_RESOURCES if too many datagrams are already outstanding.
+         */
+        int sendReliable(uint16_t destination, uint8_t *buffer, int len);
+
+        /**
+         * Determines our address, as used for reliable delivery.
+         *
+         * @return The address of this micro:bit, derived from its serial number.
+         */
+        uint16_t getAddress();
+
+        /**
+         * Protocol handler callback. This is called when the radio receives a reliable datagram or an acknowledgement.
+         *
+         * Datagrams addressed to us are acknowledged, and unless they are duplicates, queued for user reception.
+         */
+        void reliableReceived();
+
         /**
          * Protocol handler callback. This is called when the radio receives a packet marked as a datagram.
          *
@@ -29,6 +29,10 @@ DEALINGS IN THE SOFTWARE.
 #include "MicroBitRadio.h"
 #include "codal-core/inc/types/Event.h"
 
+// Each event in a batch is carried as a 16 bit id, followed by a 16 bit value.
+#define MICROBIT_RADIO_EVENT_BATCH_ITEM_SIZE    4
+#define MICROBIT_RADIO_EVENT_BATCH_SIZE         (MICROBIT_RADIO_MAX_PACKET_SIZE / MICROBIT_RADIO_EVENT_BATCH_ITEM_SIZE)
+
 namespace codal
 {
     /**
@@ -48,6 +52,16 @@ namespace codal
     {
         bool            suppressForwarding;     // A private flag used to prevent event forwarding loops.
         MicroBitRadio   &radio;                 // A reference to the underlying radio module to use.
+        uint32_t        batchInterval;          // The longest time an event may wait in the batch, in milliseconds. Zero if batching is disabled.
+        bool            coalesce;               // If set, a batched event replaces any earlier one with the same id.
+        uint8_t         batchCount;             // The number of events in the batch.
+        uint32_t        batchDropped;           // The number of events discarded because the batch was full.
+        uint16_t        batch[MICROBIT_RADIO_EVENT_BATCH_SIZE * 2];    // Events awaiting transmission, as (id, value) pairs.
+
+        /**
+         * Event handler, called when batched events have waited for the configured interval.
+         */
+        void onFlushDeadline(Event);
 
         public:
 
@@ -125,6 +139,43 @@ namespace codal
          */
         int ignore(uint16_t id, uint16_t value, EventModel &eventBus);
 
+        /**
+         * Enables or disables batching of forwarded events. Normally, every event forwarded costs a radio frame of its own,
+         * sent synchronously as the event is raised. When batching is enabled, events are instead collected and sent several
+         * to a frame, when the frame is full or once the oldest has waited for the given interval. Only the id and value
+         * of each event are carried.
+         *
+         * @param interval The longest time, in milliseconds, an event may be held awaiting others. Zero disables batching,
+         *        and sends any events already held.
+         *
+         * @param coalesce If true, an event replaces any held event with the same id, so only the latest value of each is sent.
+         *
+         * @return MICROBIT_OK on success.
+         */
+        int setBatching(uint32_t interval, bool coalesce = false);
+
+        /**
+         * Sends any batched events immediately.
+         *
+         * @return MICROBIT_OK on success, or the error returned by MicroBitRadio::send().
+         */
+        int flush();
+
+        /**
+         * Determines how many events have been discarded because they were raised while the batch was full and
+         * awaiting transmission.
+         *
+         * @return The number of events dropped since this MicroBitRadioEvent was created.
+         */
+        uint32_t getDroppedEvents();
+
+        /**
+         * Protocol handler callback. This is called when the radio receives a packet containing a batch of events.
+         *
+         * This function fires each event contained inside onto the default EventModel.
+         */
+        void batchReceived();
+
         /**
          * Protocol handler callback. This is called when the radio receives a packet marked as using the event protocol.
          *
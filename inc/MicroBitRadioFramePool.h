@@ -0,0 +1,157 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 British Broadcasting Corporation.
+This software is provided by Lancaster University by arrangement with the BBC.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef MICROBIT_RADIO_FRAME_POOL_H
+#define MICROBIT_RADIO_FRAME_POOL_H
+
+#include "CodalConfig.h"
+#include "MicroBitConfig.h"
+
+// The largest payload held by a block of the small size class. Frames no longer than this once trimmed to their
+// length are queued in small blocks, so that only frames that need it occupy a block sized for the largest packet.
+#ifndef MICROBIT_RADIO_FRAME_POOL_SMALL_PAYLOAD
+#define MICROBIT_RADIO_FRAME_POOL_SMALL_PAYLOAD 32
+#endif
+
+// The number of small blocks in the pool. There is no need for a small size class unless packets may be larger.
+#ifndef MICROBIT_RADIO_FRAME_POOL_SMALL_SIZE
+#if MICROBIT_RADIO_MAX_PACKET_SIZE > MICROBIT_RADIO_FRAME_POOL_SMALL_PAYLOAD
+#define MICROBIT_RADIO_FRAME_POOL_SMALL_SIZE    24
+#else
+#define MICROBIT_RADIO_FRAME_POOL_SMALL_SIZE    0
+#endif
+#endif
+
+// The number of full sized radio frames that may be allocated at any one time, shared by all radio protocols.
+// With a small size class, full sized blocks are needed only for DMA targets, frames under construction and long frames.
+// Storage for the whole pool is taken from the heap in a single allocation, the first time a frame is needed.
+#ifndef MICROBIT_RADIO_FRAME_POOL_SIZE
+#if MICROBIT_RADIO_FRAME_POOL_SMALL_SIZE > 0
+#define MICROBIT_RADIO_FRAME_POOL_SIZE          8
+#else
+#define MICROBIT_RADIO_FRAME_POOL_SIZE          24
+#endif
+#endif
+
+namespace codal
+{
+    struct FrameBuffer;
+    struct SequencedFrameBuffer;
+
+    /**
+     * Usage statistics for the radio frame pool.
+     */
+    struct RadioFramePoolStats
+    {
+        uint16_t        capacity;                   // The number of full sized frames the pool holds.
+        uint16_t        inUse;                      // The number of full sized frames currently allocated.
+        uint16_t        highWater;                  // The largest number of full sized frames allocated at any one time.
+        uint16_t        smallCapacity;              // The number of small frames the pool holds.
+        uint16_t        smallInUse;                 // The number of small frames currently allocated.
+        uint16_t        smallHighWater;             // The largest number of small frames allocated at any one time.
+        uint32_t        failures;                   // The number of allocations refused, as the pool was exhausted.
+    };
+
+    /**
+     * A fixed capacity pool of blocks in two size classes, from which FrameBuffer and SequencedFrameBuffer objects are allocated.
+     *
+     * Radio frames are allocated and freed at a high rate, often in interrupt context. Taking them from a pool
+     * rather than the general heap makes allocation O(1) and safe from interrupt context, and prevents the heap from
+     * fragmenting over time.
+     *
+     * Full sized blocks hold a frame of the largest packet size. Frames that are queued once received are cloned into
+     * a block just large enough for their length, so that a large maximum packet size costs RAM only for the frames that use it.
+     */
+    class MicroBitRadioFramePool
+    {
+        public:
+
+        /**
+         * Allocates a block from the pool.
+         *
+         * @param size The size of the object to be held, which may be no larger than the largest radio frame.
+         *
+         * @return A pointer to the block, or NULL if the pool is exhausted or the size too large.
+         *
+         * @note A small block is used if the size allows and one is free, and a full sized block otherwise.
+         */
+        static void *allocate(size_t size);
+
+        /**
+         * Allocates a small block from the pool, for use by storage other than radio frames, such as PacketBuffer.
+         *
+         * @param size The size of the object to be held.
+         *
+         * @return A pointer to the block, or NULL if the size is too large, no small block is free or the pool is not yet in use.
+         *
+         * @note Unlike allocate(), this never reserves the pool's storage, never takes a full sized block and is not counted
+         *       as a failure when refused, so callers are expected to fall back to the heap.
+         */
+        static void *allocateSmall(size_t size);
+
+        /**
+         * Determines if a block of memory was allocated from the pool.
+         *
+         * @param block The memory to test.
+         *
+         * @return true if the memory lies within the pool, false otherwise.
+         */
+        static bool contains(const void *block);
+
+        /**
+         * Copies a frame into a block trimmed to its length. The payload beyond the length is not copied, and must not be used.
+         *
+         * @param frame The frame to copy.
+         *
+         * @return The copy, to be released with delete, or NULL if the pool is exhausted.
+         */
+        static FrameBuffer *clone(const FrameBuffer *frame);
+
+        /**
+         * Copies a frame into a block trimmed to its length. The payload beyond the length is not copied, and must not be used.
+         *
+         * @param frame The frame to copy.
+         *
+         * @return The copy, to be released with delete, or NULL if the pool is exhausted.
+         */
+        static SequencedFrameBuffer *clone(const SequencedFrameBuffer *frame);
+
+        /**
+         * Returns a block to the pool.
+         *
+         * @param block A block previously returned by allocate(), or NULL.
+         */
+        static void release(void *block);
+
+        /**
+         * Retrieves the usage statistics of the pool.
+         *
+         * @param stats The structure to fill in.
+         */
+        static void getStats(RadioFramePoolStats &stats);
+    };
+}
+
+#endif
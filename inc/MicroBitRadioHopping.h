@@ -0,0 +1,224 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 British Broadcasting Corporation.
+This software is provided by Lancaster University by arrangement with the BBC.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef MICROBIT_RADIO_HOPPING_H
+#define MICROBIT_RADIO_HOPPING_H
+
+#include "CodalConfig.h"
+
+// The largest number of channels a hopping schedule may use.
+#define MICROBIT_RADIO_HOPPING_MAX_CHANNELS             16
+
+// The default time spent on each channel before hopping to the next.
+#ifndef MICROBIT_RADIO_HOPPING_DEFAULT_DWELL_MS
+#define MICROBIT_RADIO_HOPPING_DEFAULT_DWELL_MS         20
+#endif
+
+// A channel is only judged once this many frames have been heard on it since it was last judged.
+#ifndef MICROBIT_RADIO_HOPPING_MIN_SAMPLES
+#define MICROBIT_RADIO_HOPPING_MIN_SAMPLES              16
+#endif
+
+// The percentage of corrupt frames above which a channel is blacklisted.
+#ifndef MICROBIT_RADIO_HOPPING_LOSS_THRESHOLD
+#define MICROBIT_RADIO_HOPPING_LOSS_THRESHOLD           40
+#endif
+
+// The number of passes through the schedule a blacklisted channel sits out, before being tried again.
+#ifndef MICROBIT_RADIO_HOPPING_BLACKLIST_CYCLES
+#define MICROBIT_RADIO_HOPPING_BLACKLIST_CYCLES         64
+#endif
+
+// Blacklisting never reduces the schedule below this many channels.
+#define MICROBIT_RADIO_HOPPING_MIN_CHANNELS             2
+
+// A change to the blacklist takes effect at least this many passes through the schedule after it is decided,
+// so that it can be distributed to every device following the schedule first.
+#ifndef MICROBIT_RADIO_HOPPING_BLACKLIST_DELAY
+#define MICROBIT_RADIO_HOPPING_BLACKLIST_DELAY          2
+#endif
+
+namespace codal
+{
+    /**
+     * Reception statistics for a single channel of a hopping schedule.
+     */
+    struct RadioChannelStats
+    {
+        uint8_t         channel;                // The frequency band, as used by setFrequencyBand().
+        bool            blacklisted;            // Set if the channel is in the most recently decided blacklist.
+        uint32_t        received;               // The number of valid frames received on this channel.
+        uint32_t        errors;                 // The number of corrupt frames received on this channel.
+    };
+
+    /**
+     * A frequency hopping schedule, shared by MicroBitRadio and MicroBitMeshRadio.
+     *
+     * The schedule visits a list of channels in a pseudo random order derived from the radio group, so that
+     * devices in the same group agree on the channel to use in any given time slot, and neighbouring groups
+     * tend not to collide. Reception is monitored per channel, and channels suffering high loss may be
+     * blacklisted, in which case their slots are handed to the next usable channel in the sequence.
+     *
+     * Every device following a schedule must skip the same channels, so only one of them may judge the channels.
+     * Its blacklist is distributed to the others with the pass through the schedule (the epoch) from which it applies,
+     * and until then the previous blacklist remains in effect.
+     *
+     * This class holds no timing of its own; the radios map their notion of time onto slot numbers.
+     */
+    class MicroBitRadioHopping
+    {
+        uint8_t         channels[MICROBIT_RADIO_HOPPING_MAX_CHANNELS];  // The channels in the schedule, as configured.
+        uint8_t         sequence[MICROBIT_RADIO_HOPPING_MAX_CHANNELS];  // The channels in the schedule, in hopping order.
+        uint8_t         count;                                          // The number of channels in the schedule, or zero if hopping is disabled.
+        uint32_t        blacklist;                                      // Bitmask of the positions in the sequence skipped before epoch.
+        uint32_t        pending;                                        // Bitmask of the positions in the sequence skipped from epoch.
+        uint32_t        epoch;                                          // The pass through the schedule from which pending applies.
+        uint8_t         penalty[MICROBIT_RADIO_HOPPING_MAX_CHANNELS];   // Passes remaining before each blacklisted channel is tried again.
+        uint16_t        sampled[MICROBIT_RADIO_HOPPING_MAX_CHANNELS];   // Frames heard on each channel since it was last judged.
+        uint16_t        corrupt[MICROBIT_RADIO_HOPPING_MAX_CHANNELS];   // Corrupt frames heard on each channel since it was last judged.
+        uint32_t        received[MICROBIT_RADIO_HOPPING_MAX_CHANNELS];  // Valid frames ever heard on each channel.
+        uint32_t        errors[MICROBIT_RADIO_HOPPING_MAX_CHANNELS];    // Corrupt frames ever heard on each channel.
+
+        public:
+
+        /**
+         * Constructor.
+         *
+         * Creates an empty schedule, with hopping disabled.
+         */
+        MicroBitRadioHopping();
+
+        /**
+         * Configures the channels to hop across. Any statistics and blacklist are reset.
+         *
+         * @param list The frequency bands to use, each in the range 0 - 100, or NULL to disable hopping.
+         *
+         * @param n The number of channels in the list, up to MICROBIT_RADIO_HOPPING_MAX_CHANNELS.
+         *
+         * @param group The radio group, used to derive the hopping order.
+         *
+         * @return MICROBIT_OK on success, or MICROBIT_INVALID_PARAMETER if the list is invalid.
+         */
+        int setChannels(const uint8_t *list, int n, uint8_t group);
+
+        /**
+         * Derives the hopping order for the given radio group. Any statistics and blacklist are reset.
+         *
+         * @param group The radio group.
+         */
+        void setGroup(uint8_t group);
+
+        /**
+         * Determines if hopping is enabled.
+         *
+         * @return true if a channel list has been configured, false otherwise.
+         */
+        bool isEnabled();
+
+        /**
+         * Determines the number of channels (and hence slots) in one pass through the schedule.
+         *
+         * @return The number of channels configured.
+         */
+        int getChannelCount();
+
+        /**
+         * Determines the channel to use in the given time slot, skipping any that are blacklisted.
+         *
+         * @param slot The time slot number.
+         *
+         * @return The frequency band to use.
+         */
+        uint8_t getChannel(uint32_t slot);
+
+        /**
+         * Determines where in the sequence a given channel is visited.
+         *
+         * @param channel The frequency band.
+         *
+         * @return The position of the channel in the sequence, or -1 if it is not part of the schedule.
+         */
+        int getPosition(uint8_t channel);
+
+        /**
+         * Records the reception of a frame.
+         *
+         * @param channel The frequency band on which the frame was received.
+         *
+         * @param valid true if the frame passed its CRC check, false otherwise.
+         *
+         * @note may be called from interrupt context.
+         */
+        void recordReceive(uint8_t channel, bool valid);
+
+        /**
+         * Judges each channel on the frames heard since it was last judged, blacklisting those with excessive loss
+         * and rehabilitating those that have served their time. Should be called once per pass through the schedule,
+         * by the one device whose blacklist the others follow. Does nothing while an earlier change is yet to take effect.
+         *
+         * @param slot The current time slot number.
+         *
+         * @param delay The number of passes through the schedule before any change takes effect, at least
+         *        MICROBIT_RADIO_HOPPING_BLACKLIST_DELAY.
+         */
+        void updateBlacklist(uint32_t slot, uint32_t delay = MICROBIT_RADIO_HOPPING_BLACKLIST_DELAY);
+
+        /**
+         * Determines the most recently decided blacklist, which applies from getBlacklistEpoch().
+         *
+         * @return A bitmask, where bit n represents position n of the sequence.
+         */
+        uint32_t getBlacklist();
+
+        /**
+         * Determines the pass through the schedule from which getBlacklist() applies.
+         *
+         * @return The pass number, being the slot number divided by getChannelCount().
+         */
+        uint32_t getBlacklistEpoch();
+
+        /**
+         * Adopts a blacklist determined elsewhere, for instance by the node coordinating a mesh.
+         *
+         * @param mask A bitmask, where bit n represents position n of the sequence.
+         *
+         * @param epoch The pass through the schedule from which the blacklist applies.
+         */
+        void setBlacklist(uint32_t mask, uint32_t epoch);
+
+        /**
+         * Retrieves the reception statistics of a channel.
+         *
+         * @param position The position of the channel in the sequence, in the range 0 .. getChannelCount() - 1.
+         *
+         * @param stats The structure to fill in.
+         *
+         * @return MICROBIT_OK on success, or MICROBIT_INVALID_PARAMETER if the position is out of range.
+         */
+        int getStats(int position, RadioChannelStats &stats);
+    };
+}
+
+#endif
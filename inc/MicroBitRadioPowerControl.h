@@ -0,0 +1,120 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 British Broadcasting Corporation.
+This software is provided by Lancaster University by arrangement with the BBC.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef MICROBIT_RADIO_POWER_CONTROL_H
+#define MICROBIT_RADIO_POWER_CONTROL_H
+
+#include "CodalConfig.h"
+
+// The number of transmission attempts over which the delivery rate is judged.
+#ifndef MICROBIT_RADIO_POWER_CONTROL_WINDOW
+#define MICROBIT_RADIO_POWER_CONTROL_WINDOW             16
+#endif
+
+// The default percentage of transmission attempts that should succeed.
+#ifndef MICROBIT_RADIO_POWER_CONTROL_DEFAULT_TARGET
+#define MICROBIT_RADIO_POWER_CONTROL_DEFAULT_TARGET     90
+#endif
+
+// Power is only reduced whilst every peer heard from is received more strongly than this, in -dBm.
+// This leaves a margin above the sensitivity of the receiver for the next step down.
+#ifndef MICROBIT_RADIO_POWER_CONTROL_RSSI_THRESHOLD
+#define MICROBIT_RADIO_POWER_CONTROL_RSSI_THRESHOLD     70
+#endif
+
+namespace codal
+{
+    /**
+     * A closed loop controlling transmit power, shared by MicroBitRadio and MicroBitMeshRadio.
+     *
+     * The loop is fed with the outcome of transmissions, and the signal strength of the replies that confirm them.
+     * Once per window of attempts, power is raised a level if fewer than the target percentage succeeded,
+     * or lowered a level if the target was met and all replies were heard with plenty of margin. A transmission
+     * that fails outright raises power immediately. The lowest level that sustains the target is therefore found,
+     * which reduces both interference between neighbouring groups and energy use.
+     *
+     * This class holds no hardware state of its own; the radios apply the levels it chooses.
+     */
+    class MicroBitRadioPowerControl
+    {
+        bool            enabled;                // Set if the loop is active.
+        uint8_t         target;                 // The percentage of attempts that should succeed.
+        uint8_t         maxLevel;               // The highest power level that may be chosen.
+        uint8_t         weakest;                // The weakest reply heard in this window, in -dBm, or zero if none.
+        uint16_t        attempts;               // The number of transmission attempts in this window.
+        uint16_t        losses;                 // The number of those attempts that went unconfirmed.
+
+        public:
+
+        /**
+         * Constructor.
+         *
+         * Creates a loop that is disabled.
+         */
+        MicroBitRadioPowerControl();
+
+        /**
+         * Enables or disables the loop. Any observations gathered so far are discarded.
+         *
+         * @param enable true to enable the loop, false to disable it.
+         *
+         * @param target The percentage of transmission attempts that should succeed, in the range 1 - 100.
+         *
+         * @param maxLevel The highest power level the loop may choose.
+         *
+         * @return MICROBIT_OK on success, or MICROBIT_INVALID_PARAMETER if the target is out of range.
+         */
+        int configure(bool enable, int target, int maxLevel);
+
+        /**
+         * Discards any observations gathered so far, for instance when the set of peers changes.
+         */
+        void reset();
+
+        /**
+         * Determines if the loop is active.
+         *
+         * @return true if enabled, false otherwise.
+         */
+        bool isEnabled();
+
+        /**
+         * Records the outcome of one or more transmission attempts, and determines the power level to use next.
+         *
+         * @param level The power level currently in use.
+         *
+         * @param delivered The number of attempts known to have succeeded.
+         *
+         * @param lost The number of attempts known to have failed.
+         *
+         * @param rssi The signal strength of the reply confirming delivery, in dBm, or zero if unknown.
+         *
+         * @return The power level to use, which is unchanged if the loop is disabled.
+         */
+        int update(int level, int delivered, int lost, int rssi);
+    };
+}
+
+#endif
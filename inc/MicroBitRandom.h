@@ -0,0 +1,129 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef MICROBIT_RANDOM_H
+#define MICROBIT_RANDOM_H
+
+#include "CodalConfig.h"
+
+// The size of a pool of hardware entropy, refilled in the background by the RNG interrupt whilst Bluetooth is not
+// running, and drawn on by microbit_random_entropy(). The RNG only runs whilst the pool is less than full.
+//
+// Set to '0' to disable the pool, in which case entropy is read from the RNG on demand.
+#ifndef CONFIG_MICROBIT_RANDOM_POOL_SIZE
+#define CONFIG_MICROBIT_RANDOM_POOL_SIZE 0
+#endif
+
+// Independent pseudo random streams, so that one subsystem's use of randomness does not perturb another's.
+#define MICROBIT_RANDOM_STREAM_DEFAULT      0       // microbit_random(), uBit.random() and application code.
+#define MICROBIT_RANDOM_STREAM_AUDIO        1       // Sound expression randomisation.
+#define MICROBIT_RANDOM_STREAM_RADIO        2       // Radio sequence numbers, backoff jitter and relay decisions.
+#define MICROBIT_RANDOM_STREAM_COUNT        3
+
+namespace codal
+{
+    /**
+      * The state of one pseudo random stream (xoshiro128++). Must not be all zero.
+      */
+    struct MicroBitRandomState
+    {
+        uint32_t            s[4];
+    };
+
+    extern MicroBitRandomState microbit_random_state[MICROBIT_RANDOM_STREAM_COUNT];
+
+    /**
+      * Generates the next 32 bits of a pseudo random stream.
+      *
+      * Each stream should only be used from one context (thread, or a given interrupt priority); concurrent use
+      * does not fail, but may repeat values.
+      *
+      * @param stream One of MICROBIT_RANDOM_STREAM_*.
+      *
+      * @return A uniformly distributed 32 bit value.
+      */
+    inline uint32_t microbit_random_next(int stream)
+    {
+        uint32_t *s = microbit_random_state[stream].s;
+        uint32_t x = s[0] + s[3];
+        uint32_t r = ((x << 7) | (x >> 25)) + s[0];
+        uint32_t t = s[1] << 9;
+
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+        s[2] ^= t;
+        s[3] = (s[3] << 11) | (s[3] >> 21);
+
+        return r;
+    }
+
+    /**
+      * Generates a pseudo random number in the range 0 to max-1, without modulo bias.
+      *
+      * @param stream One of MICROBIT_RANDOM_STREAM_*.
+      * @param max The upper bound, which must be greater than zero.
+      *
+      * @return A uniformly distributed value between 0 and max-1, or 0 if max is zero.
+      */
+    inline uint32_t microbit_random_range(int stream, uint32_t max)
+    {
+        // Lemire's multiply and shift, rejecting the few products that would otherwise bias the result.
+        uint64_t m = (uint64_t) microbit_random_next(stream) * max;
+
+        if ((uint32_t) m < max)
+        {
+            uint32_t threshold = -max % max;
+
+            while ((uint32_t) m < threshold)
+                m = (uint64_t) microbit_random_next(stream) * max;
+        }
+
+        return (uint32_t) (m >> 32);
+    }
+
+    /**
+      * Seeds every pseudo random stream from a single 32 bit value. Each stream is given a distinct state.
+      *
+      * @param seed The value to seed from.
+      */
+    void microbit_random_seed(uint32_t seed);
+
+    /**
+      * Reads true random bytes from the hardware random number generator, via the entropy pool if one is
+      * configured, or the SoftDevice whilst Bluetooth is running.
+      *
+      * This is slow relative to the pseudo random streams, and intended for seeding and key generation.
+      *
+      * @param buffer The buffer to fill.
+      * @param len The number of bytes to read.
+      *
+      * @return The number of bytes read, which is less than len only if the entropy pool or SoftDevice has
+      * run short and is unable to supply them without blocking an interrupt handler.
+      */
+    int microbit_random_entropy(uint8_t *buffer, int len);
+}
+
+#endif
@@ -0,0 +1,203 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef MICROBIT_SCHEDULER_TRACE_H
+#define MICROBIT_SCHEDULER_TRACE_H
+
+#include "CodalConfig.h"
+#include "Serial.h"
+#include "MessageBus.h"
+
+// Trace the time taken by each component's idleCallback(), the outcome of each scheduler idle pass,
+// how late sleeping fibers are woken, and the depth of the event queue.
+// This adds two timer reads to every idle callback, so is disabled by default.
+#ifndef CONFIG_MICROBIT_SCHEDULER_TRACE
+#define CONFIG_MICROBIT_SCHEDULER_TRACE 0
+#endif
+
+// The number of records held in the trace buffer. Once full, the oldest records are overwritten.
+#ifndef CONFIG_MICROBIT_SCHEDULER_TRACE_SIZE
+#define CONFIG_MICROBIT_SCHEDULER_TRACE_SIZE 64
+#endif
+
+// The number of distinct components whose idle callbacks are summarised. Further components are only traced.
+#ifndef CONFIG_MICROBIT_SCHEDULER_TRACE_COMPONENTS
+#define CONFIG_MICROBIT_SCHEDULER_TRACE_COMPONENTS 16
+#endif
+
+// Idle callbacks shorter than this are summarised, but not written to the trace buffer (microseconds).
+#ifndef CONFIG_MICROBIT_SCHEDULER_TRACE_THRESHOLD
+#define CONFIG_MICROBIT_SCHEDULER_TRACE_THRESHOLD 100
+#endif
+
+// Types of trace record.
+#define MICROBIT_TRACE_IDLE_CALLBACK        1       // source: component id, value: duration (us)
+#define MICROBIT_TRACE_WAIT                 2       // source: MICROBIT_TRACE_WAIT_*, value: time spent waiting (us)
+#define MICROBIT_TRACE_WAKE                 3       // source: 0, value: time a sleeping fiber ran after its deadline (us)
+#define MICROBIT_TRACE_QUEUE                4       // source: listeners busy, value: events queued behind them
+
+// Outcomes of a scheduler idle pass, as recorded by MICROBIT_TRACE_WAIT.
+#define MICROBIT_TRACE_WAIT_EVENT           0       // Waited for an interrupt.
+#define MICROBIT_TRACE_WAIT_DEEPSLEEP       1       // Entered deep sleep.
+#define MICROBIT_TRACE_WAIT_BLE_CONNECTED   2       // Deep sleep was requested, but refused while connected. Waited for an interrupt.
+#define MICROBIT_TRACE_WAIT_NOT_READY       3       // Deep sleep was requested, but a component was busy. Waited for an interrupt.
+#define MICROBIT_TRACE_WAIT_COUNT           4
+
+#if CONFIG_ENABLED(CONFIG_MICROBIT_SCHEDULER_TRACE)
+#define MICROBIT_TRACE_IDLE(id)     codal::MicroBitIdleTrace _idleTrace(id)
+#else
+#define MICROBIT_TRACE_IDLE(id)     ((void)0)
+#endif
+
+namespace codal
+{
+    /**
+      * A single record in the trace buffer.
+      */
+    struct MicroBitTraceRecord
+    {
+        uint32_t            time;                   // The time the traced operation began, in microseconds since reset.
+        uint16_t            type;                   // One of MICROBIT_TRACE_*.
+        uint16_t            source;                 // The component or reason the record relates to.
+        uint32_t            value;                  // A duration in microseconds, or a count, as given by the type.
+    };
+
+    /**
+      * A summary of the idle callbacks of one component. All times are in microseconds.
+      */
+    struct MicroBitIdleStats
+    {
+        uint16_t            id;                     // The id of the component.
+        uint32_t            calls;                  // The number of idle callbacks made.
+        uint32_t            totalTime;              // The total time spent in them.
+        uint32_t            maxTime;                // The longest single callback.
+    };
+
+    /**
+      * A summary of scheduler behaviour since the trace was last reset. All times are in microseconds.
+      */
+    struct MicroBitSchedulerStats
+    {
+        uint32_t            waits[MICROBIT_TRACE_WAIT_COUNT];   // The number of idle passes with each outcome.
+        uint32_t            immediateWakes;         // Waits for an interrupt that returned at once, as an event was already pending.
+        uint32_t            waitTime;               // The total time spent waiting in idle passes, with the processor asleep.
+        uint32_t            wakes;                  // The number of sleeping fibers woken.
+        uint32_t            wakeLatencyTotal;       // The total time those fibers ran after their deadline.
+        uint32_t            wakeLatencyMax;         // The longest time a fiber ran after its deadline.
+        uint16_t            queueDepth;             // The most events seen queued behind busy listeners.
+        uint16_t            busyListeners;          // The most listeners seen busy at once.
+    };
+
+    /**
+      * Times an idle callback for the duration of its scope. Use MICROBIT_TRACE_IDLE(id) at the start of idleCallback(),
+      * which compiles to nothing unless CONFIG_MICROBIT_SCHEDULER_TRACE is enabled.
+      */
+    class MicroBitIdleTrace
+    {
+        uint16_t            id;
+        uint32_t            start;
+
+        public:
+
+        /**
+          * Constructor. Starts timing.
+          *
+          * @param id The id of the component whose idle callback is being timed.
+          */
+        MicroBitIdleTrace(uint16_t id);
+
+        /**
+          * Destructor. Records the time taken.
+          */
+        ~MicroBitIdleTrace();
+    };
+
+    /**
+      * Adds a record to the trace buffer.
+      *
+      * @param type One of MICROBIT_TRACE_*.
+      * @param source The component or reason the record relates to.
+      * @param start The time the operation began, in microseconds since reset.
+      * @param value A duration in microseconds, or a count, as given by the type.
+      */
+    void microbit_trace_record(uint16_t type, uint16_t source, uint32_t start, uint32_t value);
+
+    /**
+      * Records the outcome of a scheduler idle pass.
+      *
+      * @param reason One of MICROBIT_TRACE_WAIT_*.
+      * @param start The time the pass began waiting, in microseconds since reset.
+      */
+    void microbit_trace_wait(int reason, uint32_t start);
+
+    /**
+      * Records a sleeping fiber being scheduled.
+      *
+      * @param deadline The time the fiber asked to be woken, in microseconds since reset.
+      */
+    void microbit_trace_wake(uint32_t deadline);
+
+    /**
+      * Samples the depth of the event queue: the events held back by listeners that are still busy with an earlier one.
+      *
+      * @param bus The message bus to sample.
+      */
+    void microbit_trace_queue(MessageBus &bus);
+
+    /**
+      * Retrieves the idle callback summary of a component.
+      *
+      * @param n The index of the component, in order of its first idle callback.
+      *
+      * @return The summary, or NULL if n is out of range or CONFIG_MICROBIT_SCHEDULER_TRACE is disabled.
+      */
+    MicroBitIdleStats *microbit_trace_get_idle_stats(int n);
+
+    /**
+      * Retrieves the scheduler summary.
+      *
+      * @return The summary, or NULL if CONFIG_MICROBIT_SCHEDULER_TRACE is disabled.
+      */
+    MicroBitSchedulerStats *microbit_trace_get_scheduler_stats();
+
+    /**
+      * Clears the trace buffer and all summaries.
+      */
+    void microbit_trace_reset();
+
+    /**
+      * Writes the summaries and the trace buffer, oldest record first, to the given serial port or to DMESG:
+      *
+      *   TRACE idle id=<n> calls=<n> total_us=<n> mean_us=<n> max_us=<n>
+      *   TRACE sched wait=<n> deepsleep=<n> ble_connected=<n> not_ready=<n> immediate=<n> wait_us=<n> wakes=<n> wake_mean_us=<n> wake_max_us=<n> queue_max=<n> busy_max=<n>
+      *   TRACE t=<us> type=<n> source=<n> value=<n>
+      *
+      * @param serial The serial port to write to, or NULL to write to DMESG.
+      *
+      * @return DEVICE_OK on success, or DEVICE_NOT_SUPPORTED if CONFIG_MICROBIT_SCHEDULER_TRACE is disabled.
+      */
+    int microbit_trace_dump(Serial *serial = NULL);
+}
+
+#endif
@@ -0,0 +1,141 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef MICROBIT_SERIAL_QUEUE_H
+#define MICROBIT_SERIAL_QUEUE_H
+
+#include "CodalConfig.h"
+#include "CodalComponent.h"
+#include "Serial.h"
+#include "MicroBitComponentIds.h"
+
+// Queue serial output from data logging and DMESG, so that it is sent in the background without blocking the sender.
+// Set to '0' to send directly, blocking until the serial port has accepted the data.
+#ifndef CONFIG_MICROBIT_SERIAL_QUEUE
+#define CONFIG_MICROBIT_SERIAL_QUEUE 1
+#endif
+
+// The size of each of the two queue buffers, in bytes. Allocated when the queue is first used, at which point the
+// transmit buffer of the serial port is also enlarged to match (up to the 255 bytes it supports).
+#ifndef CONFIG_MICROBIT_SERIAL_QUEUE_SIZE
+#define CONFIG_MICROBIT_SERIAL_QUEUE_SIZE 256
+#endif
+
+#define MICROBIT_SERIAL_QUEUE_STATUS_DRAINING      0x01
+
+namespace codal
+{
+    /**
+      * A non-blocking transmit queue in front of a serial port, shared by the runtime's background serial output.
+      *
+      * Data is appended to one of two buffers, from any context, while the other is handed to the serial port's
+      * interrupt driven transmit buffer. The buffers swap as each drains, so senders only wait for a memcpy, and
+      * throughput is limited only by the baud rate. Writes that do not fit are dropped whole, and counted.
+      */
+    class MicroBitSerialQueue : public CodalComponent
+    {
+        Serial                  &serial;            // The serial port to send to.
+        uint8_t                 *buffer[2];         // The two queue buffers, or NULL until first used.
+        uint16_t                length[2];          // The number of bytes held in each buffer.
+        uint16_t                sent;               // The number of bytes of the draining buffer accepted by the serial port.
+        uint8_t                 filling;            // The index of the buffer being appended to.
+        uint32_t                dropped;            // The number of bytes dropped because the queue was full.
+
+        /**
+          * Allocates the queue buffers, if this has not already been done.
+          *
+          * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if there is insufficient memory.
+          */
+        int allocate();
+
+        /**
+          * Appends data to the filling buffer, if there is room for all of it.
+          *
+          * @return DEVICE_OK on success, DEVICE_NO_RESOURCES if the data would not fit.
+          */
+        int append(const uint8_t *data, int len, const uint8_t *tail, int tailLen);
+
+        public:
+
+        /**
+          * Constructor.
+          *
+          * @param serial The serial port to send to.
+          */
+        MicroBitSerialQueue(Serial &serial);
+
+        /**
+          * Queues data to be sent. Safe to call from interrupt context.
+          *
+          * @param data The data to send.
+          * @param len The number of bytes to send.
+          *
+          * @return len on success, DEVICE_INVALID_PARAMETER if data is NULL or len is negative, or DEVICE_NO_RESOURCES
+          * if the queue is full, in which case none of the data is queued.
+          */
+        int send(const uint8_t *data, int len);
+
+        /**
+          * Queues a line of text to be sent, followed by a carriage return and line feed. The line and its
+          * terminator are queued, or dropped, together. Safe to call from interrupt context.
+          *
+          * @param data The line to send, without a terminator.
+          * @param len The number of bytes in the line.
+          *
+          * @return len + 2 on success, DEVICE_INVALID_PARAMETER if data is NULL or len is negative, or DEVICE_NO_RESOURCES
+          * if the queue is full, in which case none of the line is queued.
+          */
+        int sendLine(const uint8_t *data, int len);
+
+        /**
+          * Hands as much queued data as possible to the serial port. Called whenever data is queued from thread
+          * context, and when the scheduler is idle.
+          */
+        void drain();
+
+        /**
+          * Blocks the calling fiber until all queued data has been handed to the serial port.
+          */
+        void flush();
+
+        /**
+          * Determines the number of bytes dropped because the queue was full, and resets the count.
+          *
+          * @return The number of bytes dropped since the last call.
+          */
+        uint32_t getDropped();
+
+        /**
+          * Drains the queue when the scheduler is idle.
+          */
+        virtual void idleCallback() override;
+
+        /**
+          * Destructor.
+          */
+        ~MicroBitSerialQueue();
+    };
+}
+
+#endif
@@ -28,11 +28,22 @@ DEALINGS IN THE SOFTWARE.
 
 #define MICROBIT_THERMOMETER_PERIOD             1000
 
+// The default number of conversions averaged into each sample.
+#ifndef CONFIG_MICROBIT_THERMOMETER_OVERSAMPLE
+#define CONFIG_MICROBIT_THERMOMETER_OVERSAMPLE  1
+#endif
+
 /*
  * Temperature events
  */
 #define MICROBIT_THERMOMETER_EVT_UPDATE         1
 
+/*
+ * Status flags
+ */
+#define MICROBIT_THERMOMETER_STATUS_CONVERTING  0x01        // A conversion is in progress in the background.
+#define MICROBIT_THERMOMETER_STATUS_VALID       0x02        // At least one sample has been taken.
+
 namespace codal
 {
     /**
@@ -48,9 +59,14 @@ namespace codal
         uint32_t                samplePeriod;
         int16_t                 temperature;
         int16_t                 offset;
+        int32_t                 accumulator;    // The sum of the conversions taken towards the next sample.
+        uint8_t                 conversions;    // The number of conversions taken towards the next sample.
+        uint8_t                 oversample;     // The number of conversions averaged into each sample.
 
         public:
 
+        static MicroBitThermometer  *instance;  // A singleton reference, used purely by the interrupt service routine.
+
         /**
          * Constructor.
          * Create new MicroBitThermometer that gives an indication of the current temperature.
@@ -98,6 +114,21 @@ namespace codal
          */
         int getCalibration();
 
+        /**
+         * Sets the number of conversions averaged into each sample.
+         * Conversions are taken back to back by the hardware in the background, so this costs no processor time.
+         *
+         * @param count the number of conversions, from 1 to 255.
+         *
+         * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if count is out of range.
+         */
+        int setOversampling(int count);
+
+        /**
+         * Determines the number of conversions averaged into each sample.
+         */
+        int getOversampling();
+
         /**
          * Gets the current temperature of the microbit.
          *
@@ -113,6 +144,10 @@ namespace codal
          * Updates the temperature sample of this instance of MicroBitThermometer
          * only if isSampleNeeded() indicates that an update is required.
          *
+         * Other than for the very first sample, or while Bluetooth is running, this only starts a conversion.
+         * The sample is updated and MICROBIT_THERMOMETER_EVT_UPDATE raised from interrupt context once it completes,
+         * so the previous sample is reported until then.
+         *
          * This call also will add the thermometer to fiber components to receive
          * periodic callbacks.
          *
@@ -120,6 +155,14 @@ namespace codal
          */
         int updateSample();
 
+        /**
+         * Called when a background conversion completes. Starts another if oversampling,
+         * otherwise records the sample.
+         *
+         * @note should only be called from TEMP_IRQHandler...
+         */
+        void conversionComplete();
+
         /**
          * Periodic callback from MicroBit idle thread.
          */
@@ -133,6 +176,13 @@ namespace codal
          * @return 1 if we're due to take a temperature reading, 0 otherwise.
          */
         int isSampleNeeded();
+
+        /**
+         * Records a new sample, schedules the next and raises MICROBIT_THERMOMETER_EVT_UPDATE.
+         *
+         * @param value the sample, in quarters of a degree celsius.
+         */
+        void recordSample(int32_t value);
     };
 }
 
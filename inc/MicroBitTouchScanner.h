@@ -0,0 +1,273 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef MICROBIT_TOUCH_SCANNER_H
+#define MICROBIT_TOUCH_SCANNER_H
+
+#include "CodalConfig.h"
+#include "CodalComponent.h"
+#include "NRF52Pin.h"
+#include "NRFLowLevelTimer.h"
+#include "Button.h"
+#include "MicroBitComponentIds.h"
+
+// Hardware resources used to time the pins. Each pin measured in parallel needs one GPIOTE channel, one PPI channel
+// and one capture register of the timer, up to MICROBIT_TOUCH_SCANNER_MAX_WIDTH pins. The defaults avoid the display
+// (GPIOTE 1-5, PPI 3-7), MicroBitNeoPixel (PPI 10-11) and the mesh radio (PPI 14-15), but share GPIOTE channel 7
+// with MicroBitPinCapture.
+// TODO: Replace these with a resource allocated version
+#define MICROBIT_TOUCH_SCANNER_MAX_WIDTH                4
+
+#ifndef MICROBIT_TOUCH_SCANNER_GPIOTE_CHANNELS
+#define MICROBIT_TOUCH_SCANNER_GPIOTE_CHANNELS          0x000000C1
+#endif
+
+#ifndef MICROBIT_TOUCH_SCANNER_PPI_CHANNELS
+#define MICROBIT_TOUCH_SCANNER_PPI_CHANNELS             0x00000107
+#endif
+
+// The maximum number of pins that can be added to a scanner.
+#ifndef CONFIG_MICROBIT_TOUCH_SCANNER_MAX_PINS
+#define CONFIG_MICROBIT_TOUCH_SCANNER_MAX_PINS          8
+#endif
+
+// The default time between the start of each scan, in milliseconds.
+#ifndef CONFIG_MICROBIT_TOUCH_SCANNER_PERIOD
+#define CONFIG_MICROBIT_TOUCH_SCANNER_PERIOD            10
+#endif
+
+// The time the pins are held low before each measurement, and the longest rise time measured, in microseconds.
+#ifndef CONFIG_MICROBIT_TOUCH_SCANNER_DISCHARGE_US
+#define CONFIG_MICROBIT_TOUCH_SCANNER_DISCHARGE_US      20
+#endif
+
+#ifndef CONFIG_MICROBIT_TOUCH_SCANNER_TIMEOUT_US
+#define CONFIG_MICROBIT_TOUCH_SCANNER_TIMEOUT_US        2000
+#endif
+
+// The default rise time above a pin's baseline that counts as a touch, in timer ticks (0.25us).
+#ifndef CONFIG_MICROBIT_TOUCH_SCANNER_THRESHOLD
+#define CONFIG_MICROBIT_TOUCH_SCANNER_THRESHOLD         200
+#endif
+
+// The smoothing applied to each reading (each scan moves the filtered value 1/2^n of the way to the new reading),
+// and to the baseline of untouched pins, which tracks slow drift.
+#ifndef CONFIG_MICROBIT_TOUCH_SCANNER_FILTER_SHIFT
+#define CONFIG_MICROBIT_TOUCH_SCANNER_FILTER_SHIFT      1
+#endif
+
+#ifndef CONFIG_MICROBIT_TOUCH_SCANNER_BASELINE_SHIFT
+#define CONFIG_MICROBIT_TOUCH_SCANNER_BASELINE_SHIFT    6
+#endif
+
+// The default number of consecutive scans that must agree before a pin changes state.
+#ifndef CONFIG_MICROBIT_TOUCH_SCANNER_DEBOUNCE
+#define CONFIG_MICROBIT_TOUCH_SCANNER_DEBOUNCE          2
+#endif
+
+// Events, raised on each pin's own id.
+#define MICROBIT_TOUCH_SCANNER_EVT_DOWN                 DEVICE_BUTTON_EVT_DOWN
+#define MICROBIT_TOUCH_SCANNER_EVT_UP                   DEVICE_BUTTON_EVT_UP
+
+// Status Flags
+#define MICROBIT_TOUCH_SCANNER_STATUS_RUNNING           0x01
+
+// Scan phases
+#define MICROBIT_TOUCH_SCANNER_PHASE_IDLE               0       // Waiting for the next scan.
+#define MICROBIT_TOUCH_SCANNER_PHASE_DISCHARGE          1       // The pins of a pass are being held low.
+#define MICROBIT_TOUCH_SCANNER_PHASE_MEASURE            2       // The pins of a pass are charging.
+
+namespace codal
+{
+    /**
+     * The state of one pin of a MicroBitTouchScanner.
+     */
+    struct MicroBitTouchChannel
+    {
+        NRF52Pin                *pin;               // The pin, or NULL if this entry is unused.
+        uint16_t                id;                 // The id events for this pin are raised on.
+        uint16_t                threshold;          // The rise time above baseline that counts as a touch, in ticks.
+        uint32_t                raw;                // The rise time measured by the last scan, in ticks.
+        int32_t                 filtered;           // The smoothed rise time, in sixteenths of a tick.
+        int32_t                 baseline;           // The untouched rise time, in sixteenths of a tick, or 0 until the first scan.
+        uint8_t                 changing;           // The number of consecutive scans that disagree with pressed.
+        bool                    pressed;            // The debounced state of the pin.
+    };
+
+    /**
+     * Measures a set of capacitive touch pins in parallel, with hardware timing.
+     *
+     * Each scan discharges every pin, then releases them together and lets their pull-up resistors charge them. The
+     * rising edge of each pin captures a dedicated timer through GPIOTE and PPI, so the rise times are exact however
+     * busy the processor is. Pins beyond the number of channels available (three by default) are measured in a further
+     * pass of the same scan. Filtering, baseline tracking and debounce are then applied to every pin in one block, and
+     * MICROBIT_TOUCH_SCANNER_EVT_DOWN or MICROBIT_TOUCH_SCANNER_EVT_UP raised on a pin's id as its state changes.
+     *
+     * Each scan costs two timer interrupts per pass plus one, whatever the number of pins; the timer is otherwise idle.
+     * The timer must not be used for anything else while scanning. On the micro:bit, capTouchTimer (NRF_TIMER3) can be
+     * used if no TouchButton is in use, and the pins must not be otherwise accessed while the scanner is running.
+     */
+    class MicroBitTouchScanner : public CodalComponent
+    {
+        NRFLowLevelTimer        &timer;             // The timer used to time the pins.
+        MicroBitTouchChannel    channels[CONFIG_MICROBIT_TOUCH_SCANNER_MAX_PINS];
+        uint8_t                 gpiote[MICROBIT_TOUCH_SCANNER_MAX_WIDTH];   // The GPIOTE channel of each parallel measurement.
+        uint8_t                 ppi[MICROBIT_TOUCH_SCANNER_MAX_WIDTH];      // The PPI channel of each parallel measurement.
+        uint8_t                 width;              // The number of pins measured in each pass.
+        volatile uint8_t        count;              // The number of pins added.
+        uint8_t                 pass;               // The index of the first pin of the pass in progress.
+        uint8_t                 passLength;         // The number of pins in the pass in progress.
+        uint8_t                 phase;              // One of MICROBIT_TOUCH_SCANNER_PHASE_*.
+        uint8_t                 debounce;           // The number of consecutive scans that must agree to change state.
+        uint16_t                period;             // The time between the start of each scan, in milliseconds.
+        uint32_t                releaseTime;        // The timer value when the pins of the current pass were released.
+        uint32_t                releaseMask[2];     // The pins of the current pass, on each GPIO port.
+
+        /**
+         * Configures and discharges the pins of the pass starting at the given pin, ready to be measured.
+         */
+        void discharge(int first);
+
+        /**
+         * Releases the pins of the current pass, and starts timing them.
+         */
+        void release();
+
+        /**
+         * Returns every pin to an input.
+         */
+        void releaseAll();
+
+        /**
+         * Collects the rise times of the current pass.
+         */
+        void collect();
+
+        /**
+         * Filters the readings of every pin, and raises an event for each that has changed state.
+         */
+        void process();
+
+        public:
+
+        static MicroBitTouchScanner *instance;      // A singleton reference, used purely by the interrupt service routine.
+
+        /**
+         * Constructor.
+         *
+         * @param timer A timer dedicated to scanning.
+         * @param id The ID of this component.
+         */
+        MicroBitTouchScanner(NRFLowLevelTimer &timer, uint16_t id = MICROBIT_ID_TOUCH_SCANNER);
+
+        /**
+         * Destructor. Scanning is stopped.
+         */
+        ~MicroBitTouchScanner();
+
+        /**
+         * Adds a pin to the set scanned. This can be done while scanning.
+         *
+         * @param pin The pin to add.
+         * @param id The id events for this pin are raised on. Defaults to the pin's own id.
+         * @param threshold The rise time above the pin's untouched baseline that counts as a touch, in 0.25us ticks.
+         *
+         * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the pin is already added, or DEVICE_NO_RESOURCES
+         * if CONFIG_MICROBIT_TOUCH_SCANNER_MAX_PINS pins have been added.
+         */
+        int addPin(NRF52Pin &pin, uint16_t id = 0, int threshold = CONFIG_MICROBIT_TOUCH_SCANNER_THRESHOLD);
+
+        /**
+         * Removes a pin from the set scanned, leaving it as an input.
+         *
+         * @param pin The pin to remove.
+         *
+         * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the pin has not been added.
+         */
+        int removePin(NRF52Pin &pin);
+
+        /**
+         * Starts scanning. Each pin's baseline is taken from its first reading, so pins should be untouched when scanning starts.
+         *
+         * @return DEVICE_OK on success, DEVICE_NOT_SUPPORTED if no GPIOTE or PPI channels are configured, or DEVICE_BUSY
+         * if another MicroBitTouchScanner is running.
+         */
+        int start();
+
+        /**
+         * Stops scanning, and releases the hardware. The pins are left as inputs.
+         */
+        void stop();
+
+        /**
+         * Sets the time between the start of each scan.
+         *
+         * @param period The scan period, in milliseconds.
+         *
+         * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if period is less than 1ms or more than 1000ms.
+         */
+        int setPeriod(int period);
+
+        /**
+         * Determines the time between the start of each scan, in milliseconds.
+         */
+        int getPeriod();
+
+        /**
+         * Sets the number of consecutive scans that must agree before a pin changes state.
+         *
+         * @param scans The number of scans, from 1 to 255.
+         *
+         * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if scans is out of range.
+         */
+        int setDebounce(int scans);
+
+        /**
+         * Determines the filtered rise time of a pin above its untouched baseline.
+         *
+         * @param pin The pin of interest.
+         *
+         * @return The rise time above baseline in 0.25us ticks (which may be negative), or 0 if the pin has not been added.
+         */
+        int getValue(NRF52Pin &pin);
+
+        /**
+         * Determines if a pin is touched, after debouncing.
+         *
+         * @param pin The pin of interest.
+         *
+         * @return true if the pin is touched, false otherwise.
+         */
+        bool isPressed(NRF52Pin &pin);
+
+        /**
+         * Advances the scan. Called on each compare event of the timer.
+         *
+         * @note should only be called from the timer interrupt...
+         */
+        void onCompare();
+    };
+}
+
+#endif
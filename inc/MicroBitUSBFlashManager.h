@@ -53,6 +53,13 @@ DEALINGS IN THE SOFTWARE.
 #define MICROBIT_USB_FLASH_MAX_RX_RETRIES           20
 #endif
 
+//
+// Time to wait for the interface chip to signal a response on each RX attempt, in microseconds.
+//
+#ifndef MICROBIT_USB_FLASH_RX_TIMEOUT_US
+#define MICROBIT_USB_FLASH_RX_TIMEOUT_US            5000
+#endif
+
 #ifndef MICROBIT_USB_FLASH_MAX_FLASH_STORAGE
 #define MICROBIT_USB_FLASH_MAX_FLASH_STORAGE        0x1F000
 #endif
@@ -98,6 +105,12 @@ typedef struct
 #define MICROBIT_USB_FLASH_USE_NULL_TRANSACTION     0x10
 #define MICROBIT_USB_FLASH_BUSY_FLAG_SUPPORTED      0x20
 #define MICROBIT_USB_FLASH_100MS_AFTER_ERASE        0x40
+#define MICROBIT_USB_FLASH_IRQ_LISTENER             0x80
+
+//
+// Events
+//
+#define MICROBIT_USB_FLASH_EVT_RESPONSE             1               // Internal event to signal that a response may be ready, or the wait for one has timed out.
 
 
 /**
@@ -284,6 +297,19 @@ class MicroBitUSBFlashManager : public CodalComponent, public NVMController
          */
         ManagedBuffer transact(int command);
 
+        /**
+         * Waits for the interface chip to signal that a response is ready, by asserting the combined IRQ line.
+         * The calling fiber sleeps until the line falls, or the timeout expires.
+         * @param timeout the maximum time to wait, in microseconds.
+         * @return true if the IRQ line is asserted, false if the timeout expired.
+         */
+        bool awaitResponse(uint32_t timeout);
+
+        /**
+         * Event handler, called when the combined IRQ line is asserted. Wakes any fiber in awaitResponse().
+         */
+        void onInterfaceIrq(Event);
+
         /**
          * Determines if the given char is valid for an 8.3 filename.
          */
@@ -40,6 +40,10 @@ namespace codal {
 static constexpr int SynthBlockSize = 256;
 static constexpr int SynthSampleRate = 44100;
 static constexpr float SynthSampleRate_f = static_cast<float>(SynthSampleRate);
+// voices quieter than this stop early, half an lsb of the 10 bit output
+static constexpr float SynthVoiceSilence = 0.5f/511.f;
+// share of each block period that voice rendering is allowed to use
+static constexpr float SynthCpuBudget = 0.6f;
 
 /** 
  * Class containing certain precalculated synth data.
@@ -152,6 +156,13 @@ public:
      * @reeturn filtered sample
      */
     float process(float x, FilterType f = FilterType::LPF);
+    /**
+     * Filter a block of samples in place.
+     * @param buf samples to filter
+     * @param num number of samples
+     * @param f filter type to use
+     */
+    void process(float* buf, int num, FilterType f = FilterType::LPF);
     /**
      * Resets internal filter history.
      */
@@ -184,6 +195,12 @@ public:
      * @return envelope value
      */
     float process();
+    /**
+     * Generate a block of envelope values.
+     * @param out buffer to store envelope values in
+     * @param num number of values to generate
+     */
+    void process(float* out, int num);
     /** 
      * Set envelope gate state. 
      * @param g gate status. True for active gate. 
@@ -194,6 +211,11 @@ public:
      * @return envelope value
      */
     bool done() const;
+    /**
+     * Determine if the envelope is still in its attack phase.
+     * @return true if attacking
+     */
+    bool attacking() const;
     /** 
      * Set envelope times and levels.
      * @param a attack time in seconds
@@ -220,6 +242,7 @@ class Oscillator
 {
     float acc_ = 0.f, delta_ = 0.f, pw_ = 0.f;
     OscType wave_ = OscType::Saw;
+    void shape(float* buf, int num) const;
 public:
     /**
      * Generate a oscillator sample.
@@ -232,6 +255,19 @@ public:
      * @return oscillator sample 
      */
     float processPM(float pm);
+    /**
+     * Generate a block of oscillator samples.
+     * @param out buffer to store samples in
+     * @param num number of samples to generate
+     */
+    void process(float* out, int num);
+    /**
+     * Generate a block of oscillator samples with phase modulation.
+     * @param pm phase modulation values in range -1 to 1, may be the same buffer as out
+     * @param out buffer to store samples in
+     * @param num number of samples to generate
+     */
+    void processPM(const float* pm, float* out, int num);
     /**
      * Set oscillator frequency.
      * @param f frequency in hz
@@ -252,7 +288,9 @@ public:
 /**
  * A single synthesizer voice.
  * All parameter modulations except the amplitude envelope are computed once per block
- * to save on processing time.
+ * to save on processing time. Each stage (oscillators, filter, envelope) is rendered a
+ * whole block at a time into shared scratch buffers, which keeps the inner loops short
+ * and free of branches.
  */
 class Voice
 {
@@ -268,10 +306,13 @@ class Voice
     bool stopping_ = false; // set to true after we've received a note off
     const SynthPreset* preset_ = nullptr;
     int32_t noise_;         // linear congruential noise state
+    uint32_t age_ = 0;      // number of blocks rendered since the note was triggered
+    // scratch buffers shared by all voices, as voices are always rendered one at a time
+    static float oscbuf_[SynthBlockSize];
+    static float envbuf_[SynthBlockSize];
     void apply_preset();
     void set_note(float note);
-    // per sample process
-    float process();
+    void render(float* buf, int num);
 public:
     Voice();
     /** 
@@ -302,6 +343,20 @@ public:
     * @return true if not is in release phase, false if not
     */
     bool isStopping() const;
+    /**
+    * Get the current output level of the voice.
+    * @return amplitude, including gain and velocity
+    */
+    float getLevel() const;
+    /**
+    * Get the age of the note.
+    * @return number of blocks rendered since the note was triggered
+    */
+    uint32_t getAge() const;
+    /**
+    * Deactivate the voice immediately, without a release phase.
+    */
+    void kill();
 };
 
 /** 
@@ -312,9 +367,12 @@ class PolySynth
     Voice* voice_;
     float mixbuf_[SynthBlockSize];
     int numVoices_;
+    int maxVoices_;         // voices that fit in the cpu budget
+    float voiceCost_ = 0.f; // smoothed render time of one voice for a full block, in microseconds
 
     int findVoice(int8_t note);
     Voice& alloc(int note);
+    Voice& victim();
     void process_noclip(float* buf, int num);
 public:
     PolySynth(int num_voices);
@@ -333,6 +391,13 @@ public:
     */
     void noteOff(int8_t note);
     /**
+    * Get the number of voices that can currently be rendered within the real-time budget.
+    * This is derived from the measured cost of rendering each voice, and never exceeds
+    * the number of voices the synthesizer was created with.
+    * @return voice limit
+    */
+    int getVoiceLimit() const;
+    /**
     * Synthesize a buffer of sound, float buffer version.
     * @param buf buffer of floats to render sound to
     * @param num number of samples to generate
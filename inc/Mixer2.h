@@ -26,6 +26,7 @@ DEALINGS IN THE SOFTWARE.
 #define CODAL_MIXER2_H
 
 #include "DataStream.h"
+#include "AudioStageStats.h"
 
 #ifndef CONFIG_MIXER_BUFFER_SIZE
 #define CONFIG_MIXER_BUFFER_SIZE 512
@@ -39,6 +40,21 @@ DEALINGS IN THE SOFTWARE.
 #define CONFIG_MIXER_DEFAULT_SAMPLERATE 44100
 #endif
 
+// Mix using integer arithmetic rather than floating point.
+// Samples are accumulated with CONFIG_MIXER_FIXED_POINT_BITS fractional bits, using a single combined gain per channel.
+#ifndef CONFIG_MIXER_FIXED_POINT
+#define CONFIG_MIXER_FIXED_POINT 0
+#endif
+
+#ifndef CONFIG_MIXER_FIXED_POINT_BITS
+#define CONFIG_MIXER_FIXED_POINT_BITS 8
+#endif
+
+// Use linear interpolation when resampling new channels, rather than nearest neighbour.
+#ifndef CONFIG_MIXER_DEFAULT_INTERPOLATION
+#define CONFIG_MIXER_DEFAULT_INTERPOLATION 0
+#endif
+
 // The default sample rate, for when the user does not supply us with anything
 // This applies to both ADC input rates and mixer output rates.
 //
@@ -52,11 +68,26 @@ DEALINGS IN THE SOFTWARE.
 
 #define DEVICE_MIXER_EVT_SILENCE 1
 #define DEVICE_MIXER_EVT_SOUND   2
+#define DEVICE_MIXER_EVT_WAKE    3
+#define DEVICE_MIXER_EVT_RATE    4
 
 
 namespace codal
 {
 
+// The type of the mixer's accumulator.
+#if CONFIG_ENABLED(CONFIG_MIXER_FIXED_POINT)
+typedef int32_t MixerSample;
+#else
+typedef float MixerSample;
+#endif
+
+class MixerChannel;
+class Mixer2;
+
+// An inner loop that mixes samples from a channel into the accumulator, specialised by input format and sample rate.
+typedef void (*MixerKernel)(MixerSample *out, int len, MixerChannel *ch);
+
 class MixerChannel : public DataSink
 {
 private:
@@ -77,8 +108,19 @@ private:
     float           volume;                     // Volume leve of channel, in the range 0..CONFIG_MIXER_INTERNAL_RANGE
     int             format;                     // Format of the data recieved on this channel (e.g. DATASTREAM_FORMAT_16BIT_UNSIGNED...)
     int             bytesPerSample;             // The number of bytes used in the input stream for each sample (optimisation)
+    MixerKernel     kernel;                     // The inner loop used to mix this channel, chosen for its format and sample rate.
+    int             ratio;                      // Integer resampling ratio used by the kernel, if any (optimisation)
+    bool            interpolate;                // Use linear interpolation when resampling.
+    int32_t         previous;                   // The last sample of the previous buffer, for interpolation.
+    CODAL_TIMESTAMP startTime;                  // The time at which the channel is scheduled to start playing, or zero to start at once.
 
     MixerChannel    *next;                      // Internal Linkage - list of all mixer channels
+    Mixer2          *mixer;                     // The mixer this channel belongs to.
+
+#if CONFIG_ENABLED(CONFIG_AUDIO_STATS)
+    AudioStageStats stats;                      // Timing of pulls from the DataSource, and the channel's underruns.
+    CODAL_TIMESTAMP requestTime;                // The time at which the oldest outstanding pull request was received.
+#endif
 
     friend class    Mixer2;
 
@@ -124,13 +166,58 @@ public:
      * @return float 
      */
     float getSampleRate() { return this->rate; }
+
+    /**
+     * @brief Schedules the channel to start playing at the given time.
+     *
+     * Data arriving on the channel is held back until then, and the first sample is mixed at the
+     * position in the output buffer that is played out at that time, rather than at the start of
+     * the next buffer. Applies once: after the channel starts, its data is mixed as it arrives.
+     *
+     * @param time The system time, in microseconds, at which the first sample should be heard, or zero to start at once.
+     */
+    void setStartTime( CODAL_TIMESTAMP time ) { this->startTime = time; }
+
+    /**
+     * @brief Determines the time at which the channel is scheduled to start playing.
+     *
+     * @return The system time, in microseconds, or zero if the channel is not waiting to start.
+     */
+    CODAL_TIMESTAMP getStartTime() { return this->startTime; }
+
+    /**
+     * @brief Enables or disables linear interpolation when this channel is resampled.
+     * Interpolation reduces aliasing, at the cost of a little CPU and one input sample of latency.
+     * Channels whose rate is an exact integer multiple of the output rate are unaffected.
+     *
+     * @param enable true to interpolate, false to use the nearest sample.
+     */
+    void setInterpolation( bool enable ) {
+        this->interpolate = enable;
+        this->skip = 0.0f;      // Reselect the mixing kernel on the next pull.
+    }
+
+    /**
+     * @brief Determines if this channel uses linear interpolation when resampled.
+     */
+    bool getInterpolation() { return this->interpolate; }
+
+#if CONFIG_ENABLED(CONFIG_AUDIO_STATS)
+    /**
+     * @brief Provides the statistics of this channel.
+     * Pull times are those of the upstream DataSource, so include all the work done to render its buffers.
+     * An underrun is recorded each time the channel runs out of data part way through a mixer buffer,
+     * which includes once at the end of each stream.
+     */
+    AudioStageStats &getStats() { return this->stats; }
+#endif
 };
 
 class Mixer2 : public DataSource
 {
     MixerChannel    *channels;
     DataSink        *downStream;
-    float           mix[CONFIG_MIXER_BUFFER_SIZE];
+    MixerSample     mix[CONFIG_MIXER_BUFFER_SIZE];
     float           outputRange;
     float           outputRate;
     int             outputFormat;
@@ -139,8 +226,19 @@ class Mixer2 : public DataSource
     uint32_t        orMask;
     float           silenceLevel;
     bool            silent;
+    bool            paused;
+    ManagedBuffer   silenceBuffer;              // Pre-rendered output for periods of silence, or empty if not yet rendered.
+    ManagedBuffer   emptyBuffer;                // Pre-rendered output for when there are no channels.
     CODAL_TIMESTAMP silenceStartTime;
     CODAL_TIMESTAMP silenceEndTime;
+    float           baseRate;                   // The highest output rate when the rate is adaptive.
+    int             maxDivider;                 // The largest divider of baseRate that may be used, or 1 if the rate is fixed.
+    int             divider;                    // The divider of baseRate currently in use.
+    uint32_t        outputLatency;              // Time from a pull to the first sample of its buffer being heard (us), or zero for one buffer period.
+#if CONFIG_ENABLED(CONFIG_AUDIO_STATS)
+    AudioStageStats stats;                      // Timing of the mixer's own pulls, and the total underruns of its channels.
+    int             activeChannels;             // The number of channels mixed into the most recent buffer.
+#endif
 
 public:
     /**
@@ -167,6 +265,14 @@ public:
      */
     MixerChannel *addChannel(DataSource &stream, float sampleRate = CONFIG_MIXER_DEFAULT_CHANNEL_SAMPLERATE, int sampleRange = CONFIG_MIXER_INTERNAL_RANGE);
 
+    /**
+     * Finds the channel connected to the given stream.
+     *
+     * @param stream The DataSource feeding the channel.
+     * @return The channel, or NULL if the stream is not connected to the mixer.
+     */
+    MixerChannel *getChannel(DataSource &stream);
+
     /**
      * Removes a channel from the mixer
      * 
@@ -292,9 +398,131 @@ public:
      */
     CODAL_TIMESTAMP getSilenceEndTime();
 
+    /**
+     * Records that the downstream sink has stopped pulling from the mixer, for example to save power during silence.
+     * While paused, the first pull request received on any channel raises a DEVICE_MIXER_EVT_WAKE event,
+     * so that the sink can be restarted.
+     *
+     * @param paused true if the downstream sink is paused, false if it is pulling normally.
+     */
+    void setPaused(bool paused);
+
+    /**
+     * Determines if the downstream sink has been recorded as paused.
+     *
+     * @return true if paused, false otherwise.
+     */
+    bool isPaused();
+
+    /**
+     * Lets the output sample rate follow the channels being mixed, rather than remaining fixed.
+     *
+     * Whenever the mixer is silent and a channel has data to mix, the output rate is set to the lowest
+     * baseRate / n, for n up to maxDivider, that is no lower than the rate of any channel with data.
+     * Rendering fewer samples for low rate content saves CPU time, and downstream DMA and interrupts.
+     * Changes are only made during silence, so are never heard. A DEVICE_MIXER_EVT_RATE event is raised
+     * after each change, so that the downstream component can follow it; listeners should be registered
+     * with MESSAGE_BUS_LISTENER_IMMEDIATE, so that they are called before the next buffer is delivered.
+     *
+     * @param baseRate The highest output rate, in samples per second.
+     * @param maxDivider The largest divider that may be applied to baseRate. 1 fixes the output rate at baseRate.
+     * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if either parameter is out of range.
+     */
+    int setAdaptiveSampleRate(float baseRate, int maxDivider);
+
+    /**
+     * Determines the divider of the adaptive base rate currently applied to the output.
+     *
+     * @return the divider in use, or 1 if the output sample rate is not adaptive.
+     */
+    int getSampleRateDivider();
+
+    /**
+     * Defines the time between a pull from the mixer and the first sample of the buffer it returns
+     * being heard, used to place channels scheduled with MixerChannel::setStartTime().
+     *
+     * @param latency The latency in microseconds, or zero to use the duration of one buffer, which matches
+     * a downstream component that double buffers, pulling each buffer as the previous one starts to play.
+     * @return DEVICE_OK on success.
+     */
+    int setOutputLatency(uint32_t latency);
+
+    /**
+     * Determines the number of channels attached to the mixer.
+     *
+     * @return the number of channels, whether or not they are currently producing audio.
+     */
+    int getChannelCount();
+
+#if CONFIG_ENABLED(CONFIG_AUDIO_STATS)
+    /**
+     * Provides the statistics of the mixer itself.
+     * Pull times include the time taken by all upstream components to render the buffers that were mixed,
+     * and a pull is late if it arrived over a quarter of a buffer after it was due.
+     *
+     * @return the statistics of the mixer.
+     */
+    AudioStageStats &getStats();
+
+    /**
+     * Determines the number of channels mixed into the most recent buffer.
+     *
+     * @return the number of channels that contributed samples.
+     */
+    int getActiveChannelCount();
+
+    /**
+     * Clears the statistics of the mixer and all of its channels.
+     */
+    void resetStats();
+
+    /**
+     * Writes the statistics of the mixer and each of its channels to DMESG.
+     */
+    void printStats();
+#endif
+
 
     private:
     void configureChannel(MixerChannel *c);
+
+    /**
+     * Chooses the adaptive output rate for the channels that have data, while the mixer is silent.
+     */
+    void adaptSampleRate();
+
+    /**
+     * Discards any pre-rendered silence, following a change in output configuration.
+     */
+    void invalidateSilence();
+
+    friend class MixerChannel;
+
+    /**
+     * Chooses the inner loop used to mix a channel, based on its input format and whether it is resampled.
+     * Must be called whenever the channel's format or skip changes.
+     */
+    void selectKernel(MixerChannel *c);
+
+    /**
+     * Inner loop for a native 8 or 16 bit input format.
+     * @tparam T The C type of one input sample.
+     * @tparam mode The resampling strategy used.
+     */
+    template <typename T, int mode>
+    static void mixKernel(MixerSample *out, int len, MixerChannel *ch);
+
+    /**
+     * Inner loop for any input format, reading each sample through StreamNormalizer.
+     */
+    static void mixGeneric(MixerSample *out, int len, MixerChannel *ch);
+
+    /**
+     * Writes the accumulator to an output buffer of native 8 or 16 bit samples.
+     * @tparam T The C type of one output sample.
+     */
+    template <typename T>
+    void packSamples(uint8_t *w, int len);
 };
 
 } // namespace codal
@@ -34,6 +34,21 @@ DEALINGS IN THE SOFTWARE.
 #define NRF52_LED_MATRIX_MAXIMUM_COLUMNS        5                   // The maximum number of LEDMatrix columns supported by the hardware.
 #define NRF52_LED_MATRIX_LIGHTSENSE_STROBES     4                   // Multiple of strobe period to use for light sense
 
+// The default gamma applied to greyscale pixel values. 1.0 gives a linear response; around 2.2 appears perceptually uniform.
+#ifndef CONFIG_NRF52_LED_MATRIX_GAMMA
+#define CONFIG_NRF52_LED_MATRIX_GAMMA           1.0f
+#endif
+
+// The number of frames to wait between refreshes while there is nothing to display, and no light sensing to do.
+#ifndef CONFIG_NRF52_LED_MATRIX_IDLE_FRAMES
+#define CONFIG_NRF52_LED_MATRIX_IDLE_FRAMES     4
+#endif
+
+// Light sensing enabled on demand by readLightLevel() is disabled again once no reading has been taken for this long (ms).
+#ifndef CONFIG_NRF52_LED_MATRIX_LIGHT_SENSE_TIMEOUT
+#define CONFIG_NRF52_LED_MATRIX_LIGHT_SENSE_TIMEOUT     5000
+#endif
+
 
 // TODO: Replace this with a resource allocated version
 #define NRF52_LEDMATRIX_GPIOTE_CHANNEL_BASE     1
@@ -41,6 +56,10 @@ DEALINGS IN THE SOFTWARE.
 
 #define NRF52_LEDMATRIX_STATUS_RESET            0x01
 #define NRF52_LEDMATRIX_STATUS_LIGHTREADY       0x02
+#define NRF52_LEDMATRIX_STATUS_DOUBLE_BUFFER    0x04
+#define NRF52_LEDMATRIX_STATUS_SWAP_PENDING     0x08
+#define NRF52_LEDMATRIX_STATUS_AUTO_LIGHT_SENSE 0x10
+#define NRF52_LEDMATRIX_STATUS_FRAME_DIRTY      0x20
 
 namespace codal
 {
@@ -60,10 +79,21 @@ namespace codal
         uint32_t            timerPeriod;        // The period of the hardware timer.
         uint32_t            quantum;            // The length of time allotted to each brightness level.
         uint32_t            lightLevel;         // Record of the last light level sampled.
+        uint32_t            lightSenseTime;     // The time of the last call to readLightLevel(), in milliseconds.
+        uint32_t            slotPeriod;         // The length of the current timeslot, which spans any run of unlit rows.
         
         int8_t              gpiote[NRF52_LED_MATRIX_MAXIMUM_COLUMNS];            // GPIOTE channels used by output columns.
         int8_t              ppi[NRF52_LED_MATRIX_MAXIMUM_COLUMNS];               // PPI channels used by output columns.
 
+        uint16_t            *pixelIndex;        // For each row and column, the index of its pixel in the screen buffer at the current rotation.
+        bool                blackAndWhite;      // Whether pixels are clipped to full or zero brightness in the current mode.
+        float               gamma;              // The gamma applied to greyscale pixel values.
+        uint16_t            levels[256];        // The timer compare value for each pixel value, at the current brightness, mode and gamma.
+        uint8_t             *frontBuffer;       // The frame being displayed, when double buffered.
+        uint8_t             *pendingBuffer;     // The frame to display from the start of the next refresh, when double buffered.
+        uint16_t            *frameTable;        // The timer compare value of each row and column of the front buffer, when double buffered.
+        uint32_t            frameLit;           // A bit for each row of the front buffer with any lit pixels, when double buffered.
+
         public:
         /**
          * Configure the next frame to be drawn.
@@ -163,6 +193,20 @@ namespace codal
          */
         int readLightLevel();
 
+        /**
+         * Defines the gamma applied to greyscale pixel values, so that they can be made to appear evenly spaced in brightness.
+         * Pixel values are mapped through a table, so this adds no work to each refresh.
+         *
+         * @param gamma The exponent applied to normalised pixel values. 1.0 is linear; around 2.2 appears perceptually uniform.
+         * @return DEVICE_OK, or DEVICE_INVALID_PARAMETER if gamma is not positive.
+         */
+        int setGamma(float gamma);
+
+        /**
+         * Determines the gamma applied to greyscale pixel values.
+         */
+        float getGamma();
+
         /**
          * Puts the component in (or out of) sleep (low power) mode.
          */
@@ -172,6 +216,61 @@ namespace codal
          * Destructor for CodalDisplay, where we deregister this instance from the array of system components.
          */
         ~NRF52LEDMatrix();
+
+        /**
+         * Enables or disables double buffering.
+         *
+         * When double buffered, the display shows the frame most recently passed to it with swap(), rather than
+         * the live contents of image. Fibers can therefore draw into image at any time without partial updates
+         * appearing on the display.
+         *
+         * @param enable true to double buffer, false to display image directly.
+         * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if the frame buffers could not be allocated.
+         */
+        int setDoubleBuffering(bool enable);
+
+        /**
+         * Determines if the display is double buffered.
+         */
+        bool isDoubleBuffered();
+
+        /**
+         * Presents the current contents of image, when double buffered.
+         * The image is copied straight away, so may be drawn into again as soon as this returns. It is displayed
+         * from the start of the next refresh, so a frame is never shown partly updated.
+         * If a frame from a previous call has not yet been displayed, it is replaced.
+         *
+         * @return DEVICE_OK on success, or DEVICE_NOT_SUPPORTED if double buffering is not enabled.
+         */
+        int swap();
+
+        /**
+         * Determines if a frame passed to swap() is waiting for the next refresh.
+         */
+        bool isSwapPending();
+
+        private:
+
+        /**
+         * Rebuilds pixelIndex for the current rotation, so that render() need only look pixels up.
+         */
+        void updatePixelIndex();
+
+        /**
+         * Rebuilds levels for the current brightness, mode and gamma, so that render() need only look the timings up.
+         */
+        void updateLevels();
+
+        /**
+         * Determines if a row has no lit pixels, and so need not be strobed.
+         */
+        bool isRowDark(int row, const uint8_t *screenBuffer);
+
+        /**
+         * Rebuilds frameTable and frameLit from the front buffer, if it has changed since they were last built.
+         * Called at the start of each refresh when double buffered, so that rows of an unchanged frame are simply loaded.
+         */
+        void updateFrameTable();
     };
 }
 
@@ -98,6 +98,20 @@ namespace codal
          */
         PacketBuffer(uint8_t *data, int length, int rssi = 0);
 
+        /**
+         * Constructor.
+         * Creates a PacketBuffer that takes ownership of existing packet data, without copying it.
+         *
+         * @param data The packet data to adopt, as returned by allocate(). The caller's reference passes to
+         *             the PacketBuffer, so its reference count is not incremented.
+         *
+         * @code
+         * PacketData *d = PacketBuffer::allocate(buf, 3);
+         * PacketBuffer p(d);              // Refers to d, which is freed along with the last PacketBuffer to refer to it.
+         * @endcode
+         */
+        PacketBuffer(PacketData *data);
+
         /**
          * Copy Constructor.
          * Add ourselves as a reference to an existing PacketBuffer.
@@ -122,6 +136,32 @@ namespace codal
          */
         void init(uint8_t *data, int length, int rssi);
 
+        /**
+         * Allocates packet data of the given size, holding a single reference, which a PacketBuffer may later adopt.
+         * This allows a packet to be built in place, and handed on without further allocation or copying.
+         *
+         * @param data The data with which to fill the buffer, or NULL to leave it uninitialised.
+         *
+         * @param length The length of the buffer to create.
+         *
+         * @param rssi The radio signal strength at the time this packet was recieved. Defaults to 0.
+         *
+         * @return The packet data, or NULL if insufficient memory is available.
+         *
+         * @note Short packets are held in the radio frame pool once the radio is in use, so must be released with release().
+         */
+        static PacketData *allocate(uint8_t *data, int length, int rssi = 0);
+
+        /**
+         * Releases a reference to packet data, returning its storage to wherever it was allocated from once no references remain.
+         *
+         * Packet data returned by allocate() must be released through this method, rather than RefCounted::decr(),
+         * as it may be held in the radio frame pool rather than the heap.
+         *
+         * @param data The packet data to release.
+         */
+        static void release(PacketData *data);
+
         /**
          * Destructor.
          *
@@ -0,0 +1,207 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef SAMPLE_PLAYER_H
+#define SAMPLE_PLAYER_H
+
+#include "CodalConfig.h"
+#include "CodalComponent.h"
+#include "DataStream.h"
+#include "MicroBitComponentIds.h"
+
+// The size of each buffer provided downstream, in bytes (of 16 bit output samples).
+#ifndef CONFIG_SAMPLE_PLAYER_BLOCK_SIZE
+#define CONFIG_SAMPLE_PLAYER_BLOCK_SIZE         256
+#endif
+
+#ifndef CONFIG_SAMPLE_PLAYER_DEFAULT_SAMPLE_RATE
+#define CONFIG_SAMPLE_PLAYER_DEFAULT_SAMPLE_RATE    11000
+#endif
+
+// The range of the samples provided by a SamplePlayer, to pass to Mixer2::addChannel().
+#define SAMPLE_PLAYER_SAMPLE_RANGE              65535
+
+// Encodings of stored samples
+#define SAMPLE_PLAYER_ENCODING_PCM8             1               // Unsigned 8 bit PCM, as used by 8 bit WAV files.
+#define SAMPLE_PLAYER_ENCODING_PCM8_SIGNED      2               // Signed 8 bit PCM.
+#define SAMPLE_PLAYER_ENCODING_IMA_ADPCM        3               // A raw stream of 4 bit IMA ADPCM codes, low nibble first, starting from silence.
+
+// Events
+#define SAMPLE_PLAYER_EVT_DONE                  1               // Playback has completed, or been stopped.
+#define SAMPLE_PLAYER_EVT_REFILL                2               // Internal: the next block should be read from the file system.
+
+// Status Flags
+#define SAMPLE_PLAYER_STATUS_PLAYING            0x01
+#define SAMPLE_PLAYER_STATUS_FILE               0x02            // Samples are being read from a file, rather than memory.
+
+namespace codal
+{
+    /**
+     * A DataSource that streams stored audio samples, a block at a time, so that long sounds need little RAM.
+     *
+     * Samples may be read from memory (typically a const array in flash) or a file in MicroBitFileSystem,
+     * stored as 8 bit PCM or IMA ADPCM. Output is always 16 bit signed, so that a player can switch between encodings
+     * without reconfiguring its mixer channel.
+     *
+     * Blocks from memory are decoded as they are pulled. Blocks from a file are read ahead in fiber context,
+     * as file system access is not safe in the audio interrupt.
+     *
+     * @code
+     * SamplePlayer player;
+     * uBit.audio.mixer.addChannel(player, 8000, SAMPLE_PLAYER_SAMPLE_RANGE);
+     * player.setSampleRate(8000);
+     * player.play(clip, sizeof(clip), SAMPLE_PLAYER_ENCODING_IMA_ADPCM);
+     * @endcode
+     */
+    class SamplePlayer : public DataSource, public CodalComponent
+    {
+        DataSink            *downStream;            // Our downstream component.
+        ManagedBuffer       next;                   // The next block to provide downstream, or empty if not yet ready.
+        const uint8_t       *data;                  // The samples being played, if played from memory.
+        int                 fd;                     // The file being played, if played from a file.
+        uint32_t            length;                 // The length of the encoded samples, in bytes, if played from memory.
+        uint32_t            position;               // The number of encoded bytes consumed so far.
+        int                 encoding;               // The encoding of the samples being played.
+        float               sampleRate;             // The sample rate of the samples being played.
+        int32_t             predictor;              // IMA ADPCM decoder state: the last sample decoded.
+        int                 stepIndex;              // IMA ADPCM decoder state: the index of the current step size.
+
+        public:
+
+        /**
+         * Constructor.
+         *
+         * @param id The ID of this component, used for its events.
+         */
+        SamplePlayer(uint16_t id = DEVICE_ID_SAMPLE_PLAYER);
+
+        /**
+         * Destructor.
+         */
+        ~SamplePlayer();
+
+        /**
+         * Starts playing samples held in memory, such as a const array linked into flash.
+         * The data is not copied, and so must remain valid until playback completes.
+         * Any sound currently playing is stopped.
+         *
+         * @param data The encoded samples.
+         * @param length The length of the encoded samples, in bytes.
+         * @param encoding The encoding of the samples, e.g. SAMPLE_PLAYER_ENCODING_PCM8.
+         *
+         * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the encoding is not supported.
+         */
+        int play(const uint8_t *data, int length, int encoding = SAMPLE_PLAYER_ENCODING_PCM8);
+
+        /**
+         * Starts playing samples held in a file in MicroBitFileSystem::defaultFileSystem.
+         * Any sound currently playing is stopped.
+         *
+         * @param filename The name of the file.
+         * @param encoding The encoding of the samples, e.g. SAMPLE_PLAYER_ENCODING_PCM8.
+         *
+         * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the file cannot be opened or the encoding is not supported,
+         * or DEVICE_NOT_SUPPORTED if there is no file system.
+         */
+        int play(const char *filename, int encoding = SAMPLE_PLAYER_ENCODING_PCM8);
+
+        /**
+         * Stops playback. A SAMPLE_PLAYER_EVT_DONE event is raised if a sound was playing.
+         */
+        void stop();
+
+        /**
+         * Determines if a sound is being played.
+         *
+         * @return true if playing, false otherwise.
+         */
+        bool isPlaying();
+
+        /**
+         * Defines the sample rate of the samples being played.
+         * This should match the rate of the mixer channel the player is attached to.
+         *
+         * @param sampleRate The sample rate, in Hz.
+         * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the rate is not positive.
+         */
+        int setSampleRate(float sampleRate);
+
+        /**
+         * Determines the sample rate of the samples being played.
+         */
+        virtual float getSampleRate();
+
+        /**
+         * Provide the next available ManagedBuffer to our downstream caller, if available.
+         */
+        virtual ManagedBuffer pull();
+
+        /**
+         * Define a downstream component for data stream.
+         *
+         * @sink The component that data will be delivered to, when it is available
+         */
+        virtual void connect(DataSink &sink);
+
+        /**
+         * Determines if this source is connected to a downstream component.
+         */
+        virtual bool isConnected();
+
+        /**
+         * Determines the data format of the output, which is always DATASTREAM_FORMAT_16BIT_SIGNED.
+         */
+        virtual int getFormat();
+
+        private:
+
+        /**
+         * Prepares the block to be provided by the next pull(), and announces it downstream.
+         * Playback is completed if there are no more samples.
+         *
+         * @param encoded The next encoded bytes, or NULL if there are none.
+         * @param len The number of encoded bytes available.
+         */
+        void decode(const uint8_t *encoded, int len);
+
+        /**
+         * Reads and decodes the next block from the file being played. Called in fiber context via the event bus.
+         */
+        void onRefill(Event);
+
+        /**
+         * Determines the number of encoded bytes that make up one output block.
+         */
+        int encodedBlockSize();
+
+        /**
+         * Stops playback and releases the file being played, if any.
+         *
+         * @return true if a sound was playing.
+         */
+        bool release();
+    };
+}
+
+#endif
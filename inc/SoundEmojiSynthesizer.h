@@ -26,6 +26,7 @@ DEALINGS IN THE SOFTWARE.
 #define SOUND_EMOJI_SYNTHESIZER_H
 
 #include "DataStream.h"
+#include "AudioStageStats.h"
 
 #ifndef CONFIG_EMOJI_SYNTHESIZER_OUTPUT_BUFFER_DEPTH
 #define CONFIG_EMOJI_SYNTHESIZER_OUTPUT_BUFFER_DEPTH  3
@@ -34,6 +35,11 @@ DEALINGS IN THE SOFTWARE.
 #define EMOJI_SYNTHESIZER_SAMPLE_RATE         44100
 #define EMOJI_SYNTHESIZER_TONE_WIDTH          1024
 #define EMOJI_SYNTHESIZER_TONE_WIDTH_F        1024.0f
+
+// Fractional bits of the fixed point phase used by the tone kernels.
+// EMOJI_SYNTHESIZER_TONE_WIDTH << EMOJI_SYNTHESIZER_PHASE_BITS is 2^32, so the phase wraps around the toneprint for free.
+#define EMOJI_SYNTHESIZER_PHASE_BITS          22
+#define EMOJI_SYNTHESIZER_PHASE_SCALE_F       4194304.0f
 #define EMOJI_SYNTHESIZER_BUFFER_SIZE         512
 
 #define EMOJI_SYNTHESIZER_TONE_EFFECT_PARAMETERS        2
@@ -196,6 +202,12 @@ namespace codal
         */
         void stop();
 
+        /**
+        * Determines if a sound effect is scheduled or being played.
+        * @return true if this synthesizer is busy, false if a call to play() would start immediately.
+        */
+        bool isPlaying();
+
         /**
         * Define the size of the audio buffer to hold. The larger the buffer, the lower the CPU overhead, but the longer the delay.
         * @param size The new bufer size to use.
@@ -246,6 +258,14 @@ namespace codal
          */
         void allowEmptyBuffers(bool mode);
 
+#if CONFIG_ENABLED(CONFIG_AUDIO_STATS)
+        /**
+         * Provides the timing statistics of this synthesizer's pull().
+         * An underrun is recorded each time an empty buffer is provided while a sound effect is scheduled.
+         */
+        AudioStageStats &getStats() { return stats; }
+#endif
+
 
         private:
 
@@ -263,6 +283,32 @@ namespace codal
         */
         ManagedBuffer fillOutputBuffer();
 
+        /**
+         * Render samples of the current effect's toneprint at a fixed frequency and volume.
+         * Known toneprints are rendered by a specialised loop; any other uses the toneprint function.
+         *
+         * @param sample The buffer to write samples to.
+         * @param count The number of samples to write.
+         * @param skip The toneprint phase increment per sample.
+         * @param gain The volume scaling to apply to each sample.
+         * @param offset The offset to add to each sample after scaling.
+         */
+        void renderTone(uint16_t *sample, int count, float skip, float gain, float offset);
+
+        /**
+         * Builds the shared sine wavetable from Synthesizer::SineTone, if any effect in the given buffer needs it.
+         * This is done when an effect is scheduled, so that no allocation takes place in interrupt context.
+         *
+         * @param sound A buffer containing an array of one or more SoundEffects.
+         */
+        static void prepareTones(ManagedBuffer sound);
+
+        static uint16_t         *sineTable;             // One period of Synthesizer::SineTone, or NULL until first needed.
+
+#if CONFIG_ENABLED(CONFIG_AUDIO_STATS)
+        AudioStageStats         stats;                  // Timing of our pull() operations.
+#endif
+
     };
 }
 
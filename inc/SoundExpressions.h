@@ -27,9 +27,64 @@ DEALINGS IN THE SOFTWARE.
 
 #include "ManagedString.h"
 #include "SoundEmojiSynthesizer.h"
+#include "Mixer2.h"
+
+//
+// The number of compiled sound expressions to keep, so that repeatedly playing the same
+// expression string does not parse it each time. Set to 0 to disable the cache.
+//
+#ifndef CONFIG_SOUND_EXPRESSION_CACHE_SIZE
+#define CONFIG_SOUND_EXPRESSION_CACHE_SIZE      4
+#endif
+
+//
+// The maximum number of sound expressions that can play at the same time, up to 10.
+// Each synthesizer beyond the first is only created, and attached to the mixer, when
+// a sound is played while all the others are busy.
+//
+#ifndef CONFIG_SOUND_EXPRESSION_VOICES
+#define CONFIG_SOUND_EXPRESSION_VOICES          3
+#endif
+
+#if CONFIG_SOUND_EXPRESSION_VOICES < 1 || CONFIG_SOUND_EXPRESSION_VOICES > 10
+    #error "CONFIG_SOUND_EXPRESSION_VOICES must be between 1 and 10"
+#endif
 
 namespace codal
 {
+    /**
+     * A single sound expression effect, decoded from its 72 character decimal encoding.
+     * Randomness has not yet been applied, so one compiled effect can be played many times.
+     * Fields hold -1 where the encoding was not a valid decimal number.
+     */
+    struct SoundExpressionEffect
+    {
+        int16_t wave;
+        int16_t volume;
+        int16_t frequency;
+        int16_t duration;
+        int16_t shape;
+        int16_t endFrequency;
+        int16_t endVolume;
+        int16_t steps;
+        int16_t fxChoice;
+        int16_t fxParam;
+        int16_t fxnSteps;
+        int16_t frequencyRandom;
+        int16_t endFrequencyRandom;
+        int16_t volumeRandom;
+        int16_t endVolumeRandom;
+        int16_t durationRandom;
+        int16_t fxParamRandom;
+        int16_t fxnStepsRandom;
+    };
+
+    struct SoundExpressionCacheEntry
+    {
+        ManagedString       sound;                              // The expression string.
+        ManagedBuffer       effects;                            // The compiled SoundExpressionEffects, or empty if the expression is invalid.
+        uint32_t            lastUsed;                           // Value of cacheTime when last used, or 0 if the entry is free.
+    };
 
     class SoundExpressions
     {
@@ -37,8 +92,11 @@ namespace codal
 
         /**
           * Default Constructor.
+          *
+          * @param synth The synthesizer used to play sound expressions.
+          * @param mixer The mixer to attach further synthesizers to, so that sounds can overlap. If NULL, sounds are always played in turn on synth.
           */
-        SoundExpressions(SoundEmojiSynthesizer &synth);
+        SoundExpressions(SoundEmojiSynthesizer &synth, Mixer2 *mixer = NULL);
 
         /**
           * Destructor.
@@ -74,19 +132,48 @@ namespace codal
          * Does not block unless a sound effect is already queued.
          */
         void playAsync(ManagedBuffer sound);
+
+        /**
+         * Plays a sound encoded as a series of decimal encoded effects or specified by name, starting at the given time.
+         * Does not block. The sound starts at the exact sample played out at that time, rather than with the next
+         * mixer buffer, if an idle synthesizer is available. Otherwise, it queues behind the sound already playing.
+         * @param sound a string representing the sound effect to play, in the form descripbed by parseSoundExperession().
+         * @param time the system time, in microseconds, at which the sound should be heard.
+         */
+        void playAsync(ManagedString sound, CODAL_TIMESTAMP time);
+
+        /**
+         * Plays a sound encoded as an array of one or more SoundEffect structures, starting at the given time.
+         * Does not block unless a sound effect is already queued.
+         * @param sound the sound effects to play.
+         * @param time the system time, in microseconds, at which the sound should be heard.
+         */
+        void playAsync(ManagedBuffer sound, CODAL_TIMESTAMP time);
         
         /**
-         * Stops the currently playing sound.
+         * Stops all currently playing sounds.
          */
         void stop();
 
         private:
         SoundEmojiSynthesizer &synth;
+        Mixer2 *mixer;
+        SoundEmojiSynthesizer *voices[CONFIG_SOUND_EXPRESSION_VOICES];
+        MixerChannel *channels[CONFIG_SOUND_EXPRESSION_VOICES];
+#if CONFIG_SOUND_EXPRESSION_CACHE_SIZE > 0
+        SoundExpressionCacheEntry cache[CONFIG_SOUND_EXPRESSION_CACHE_SIZE];
+        uint32_t cacheTime;
+#endif
 
         static int parseDigits(const char *input, const int digits);
         static int applyRandom(int value, int rand);
-        static ManagedString lookupBuiltIn(ManagedString sound);
-        bool parseSoundExpression(const char *soundChars, SoundEffect *fx);
+        SoundEmojiSynthesizer &allocate();
+        ManagedBuffer createSoundEffects(ManagedString sound);
+        static const SoundExpressionEffect *lookupBuiltIn(ManagedString sound, int &count);
+        ManagedBuffer lookupCompiled(ManagedString sound);
+        static ManagedBuffer compileSoundExpression(ManagedString sound);
+        static bool parseSoundExpression(const char *soundChars, SoundExpressionEffect *effect);
+        static void buildSoundEffect(const SoundExpressionEffect *effect, SoundEffect *fx);
 
     };
 }
@@ -30,6 +30,7 @@ DEALINGS IN THE SOFTWARE.
 #include "CodalComponent.h"
 #include "MicroBitCompat.h"
 #include "Mixer2.h"
+#include "AudioStageStats.h"
 
 #ifndef CONFIG_SOUND_OUTPUT_PIN_PERIOD
 #define CONFIG_SOUND_OUTPUT_PIN_PERIOD  5
@@ -80,6 +81,13 @@ namespace codal
         uint8_t*                bufferWritePos;
         float                   position;
         int                     volume;
+        ManagedBuffer           toneBuffer;             // Whole periods of a steady tone, reused for as long as the tone is unchanged.
+        int                     toneVolume;             // Volume that toneBuffer was rendered at.
+        uint32_t                toneSkip;               // Period (in samples, less one) that toneBuffer was rendered at.
+        uint32_t                tonePhase;              // Position within the period that toneBuffer starts (and ends) at.
+#if CONFIG_ENABLED(CONFIG_AUDIO_STATS)
+        AudioStageStats         stats;                  // Timing of our pull() operations.
+#endif
 
     public:
 
@@ -174,6 +182,13 @@ namespace codal
          */
         bool isConnected();
 
+#if CONFIG_ENABLED(CONFIG_AUDIO_STATS)
+        /**
+         * Provides the timing statistics of this pin's pull().
+         */
+        AudioStageStats &getStats() { return stats; }
+#endif
+
         private:
 
         /**
@@ -188,6 +203,28 @@ namespace codal
          * @param all true if the entre buffer is to be filled, false to fill the nuffer to the current timepoint
          */
         void updateOutputBuffer(bool all = false);
+
+        /**
+         * Render a square wave, one run of equal samples at a time.
+         * A period is skip + 1 samples long, and is high for the first skip / 2 of them.
+         *
+         * @param buffer the buffer to write to.
+         * @param length the number of samples to write.
+         * @param phase the position within the period of the first sample.
+         * @param skip the period of the wave in samples, less one.
+         * @param level the value of high samples.
+         *
+         * @return the position within the period following the last sample written.
+         */
+        static uint32_t renderSquareWave(uint8_t *buffer, int length, uint32_t phase, uint32_t skip, int level);
+
+        /**
+         * Provides a buffer of whole periods of the current tone, starting and ending at the current position.
+         * The buffer is only rendered again when the tone changes.
+         *
+         * @return the tone buffer, or an empty buffer if the period of the tone is too long to fit.
+         */
+        ManagedBuffer steadyTone();
     };
 }
 
@@ -0,0 +1,183 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef SPECTRUM_ANALYZER_H
+#define SPECTRUM_ANALYZER_H
+
+#include "CodalConfig.h"
+#include "CodalComponent.h"
+#include "DataStream.h"
+#include "MicroBitComponentIds.h"
+
+// The default number of samples in each analysis window. Must be a power of two, from 16 to 1024.
+#ifndef CONFIG_SPECTRUM_ANALYZER_WINDOW_SIZE
+#define CONFIG_SPECTRUM_ANALYZER_WINDOW_SIZE    256
+#endif
+
+// The number of frequency bands that can be monitored for energy events.
+#ifndef CONFIG_SPECTRUM_ANALYZER_BANDS
+#define CONFIG_SPECTRUM_ANALYZER_BANDS          4
+#endif
+
+// Events
+#define SPECTRUM_ANALYZER_EVT_FRAME             1               // A new spectrum has been computed.
+#define SPECTRUM_ANALYZER_EVT_PROCESS           2               // Internal: a window of samples is ready to be transformed.
+#define SPECTRUM_ANALYZER_EVT_BAND_HIGH         0x10            // Added to the band index: the band's energy has risen above its threshold.
+#define SPECTRUM_ANALYZER_EVT_BAND_LOW          0x20            // Added to the band index: the band's energy has fallen below half its threshold.
+
+// Status Flags
+#define SPECTRUM_ANALYZER_STATUS_BUSY           0x01            // A window is waiting to be transformed, or is being transformed.
+
+namespace codal
+{
+    /**
+     * A frequency band monitored by a SpectrumAnalyzer.
+     */
+    struct SpectrumBand
+    {
+        uint16_t            lowBin;                 // The first FFT bin in the band.
+        uint16_t            highBin;                // The last FFT bin in the band, or 0 if the band is unused.
+        uint32_t            threshold;              // Energy above which a SPECTRUM_ANALYZER_EVT_BAND_HIGH event is raised.
+        uint32_t            energy;                 // The mean energy of the band's bins in the last frame.
+        bool                high;                   // True if the band's energy is above its threshold.
+    };
+
+    /**
+     * A spectral analysis stage for an audio stream, such as a channel of MicroBitAudio::splitter.
+     *
+     * Samples are gathered into windows, and each window is transformed with a fixed point (Q15) FFT in fiber context,
+     * within the event bus, so that no work is done in the audio interrupt beyond copying samples. After each window the
+     * energy of each configured band is updated, and events raised as bands cross their thresholds.
+     *
+     * @code
+     * SpectrumAnalyzer spectrum(*uBit.audio.getSplitter()->createChannel(), CONFIG_AUDIO_MIC_SAMPLE_RATE);
+     * spectrum.setBand(0, 1500, 3000, 200);
+     * uBit.messageBus.listen(DEVICE_ID_SPECTRUM_ANALYZER, SPECTRUM_ANALYZER_EVT_BAND_HIGH + 0, onWhistle);
+     * @endcode
+     */
+    class SpectrumAnalyzer : public CodalComponent, public DataSink
+    {
+        DataSource          &upstream;              // The component providing our audio data.
+        float               sampleRate;             // The sample rate of the input, in Hz.
+        int                 windowSize;             // The number of samples in each window.
+        int                 windowBits;             // log2(windowSize).
+        int                 windowPosition;         // The number of samples gathered into the current window.
+        int16_t             *window;                // Samples being gathered, in Q15.
+        int16_t             *re;                    // Real part of the window being transformed.
+        int16_t             *im;                    // Imaginary part of the window being transformed.
+        int16_t             *cosTable;              // cos(2 pi k / windowSize) for k < windowSize / 2, in Q15.
+        int16_t             *sinTable;              // sin(2 pi k / windowSize) for k < windowSize / 2, in Q15.
+        uint32_t            *power;                 // Power of each bin of the last spectrum.
+        int                 peakBin;                // The strongest bin of the last spectrum, excluding DC.
+        SpectrumBand        bands[CONFIG_SPECTRUM_ANALYZER_BANDS];
+
+        public:
+
+        /**
+         * Constructor.
+         *
+         * @param source The component that will provide audio data.
+         * @param sampleRate The sample rate of the source, in Hz.
+         * @param windowSize The number of samples in each analysis window. Must be a power of two from 16 to 1024.
+         * @param id The ID of this component, used for its events.
+         */
+        SpectrumAnalyzer(DataSource &source, float sampleRate, int windowSize = CONFIG_SPECTRUM_ANALYZER_WINDOW_SIZE, uint16_t id = DEVICE_ID_SPECTRUM_ANALYZER);
+
+        /**
+         * Destructor.
+         */
+        ~SpectrumAnalyzer();
+
+        /**
+         * Callback provided when data is ready.
+         */
+        virtual int pullRequest();
+
+        /**
+         * Defines a frequency band to monitor.
+         *
+         * @param band The index of the band, below CONFIG_SPECTRUM_ANALYZER_BANDS.
+         * @param lowFrequency The lowest frequency of the band, in Hz.
+         * @param highFrequency The highest frequency of the band, in Hz.
+         * @param threshold The mean bin energy above which SPECTRUM_ANALYZER_EVT_BAND_HIGH + band is raised.
+         * SPECTRUM_ANALYZER_EVT_BAND_LOW + band is raised once the energy falls below half of this.
+         *
+         * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the band or its frequencies are out of range.
+         */
+        int setBand(int band, int lowFrequency, int highFrequency, uint32_t threshold);
+
+        /**
+         * Stops monitoring a frequency band.
+         *
+         * @param band The index of the band.
+         * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the band is out of range.
+         */
+        int clearBand(int band);
+
+        /**
+         * Determines the mean bin energy of a band in the last spectrum.
+         *
+         * @param band The index of the band.
+         * @return The energy, or DEVICE_INVALID_PARAMETER if the band is out of range.
+         */
+        int getBandEnergy(int band);
+
+        /**
+         * Determines the power of a single bin of the last spectrum.
+         *
+         * @param bin The bin, below windowSize / 2. Bin k is centred on k * sampleRate / windowSize Hz.
+         * @return The squared magnitude of the bin, or 0 if the bin is out of range.
+         */
+        uint32_t getPower(int bin);
+
+        /**
+         * Determines the frequency of the strongest component of the last spectrum, ignoring DC.
+         *
+         * @return The centre frequency of the strongest bin, in Hz.
+         */
+        int getPeakFrequency();
+
+        /**
+         * Determines the width of each bin of the spectrum.
+         *
+         * @return The frequency resolution, in Hz.
+         */
+        float getResolution();
+
+        private:
+
+        /**
+         * Transforms the pending window, and updates the band energies. Called in fiber context via the event bus.
+         */
+        void onProcess(Event);
+
+        /**
+         * Performs an in place, scaled, radix-2 decimation in time FFT of re and im.
+         * Each stage halves its outputs, so the result is the transform divided by windowSize, which cannot overflow.
+         */
+        void transform();
+    };
+}
+
+#endif
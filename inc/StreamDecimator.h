@@ -0,0 +1,121 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef STREAM_DECIMATOR_H
+#define STREAM_DECIMATOR_H
+
+#include "CodalConfig.h"
+#include "DataStream.h"
+
+namespace codal
+{
+    /**
+     * A single stage that removes DC offset, applies gain and decimates an audio stream, such as the raw microphone ADC data.
+     *
+     * This does the job of a StreamNormalizer, but in one pass: each output sample is the mean of `decimation` input samples,
+     * scaled in fixed point. When the stage holds the only reference to an upstream buffer the result is written into that buffer
+     * in place; otherwise (for example behind a StreamSplitter) it is written to a buffer from the AudioBufferPool.
+     */
+    class StreamDecimator : public DataSource, public DataSink
+    {
+        DataSource          &upstream;                  // The component providing our input data.
+        DataSink            *downStream;                // The component we deliver data to.
+        int                 outputFormat;               // DATASTREAM_FORMAT_8BIT_SIGNED or DATASTREAM_FORMAT_16BIT_SIGNED.
+        int                 decimation;                 // The number of input samples combined into each output sample.
+        int32_t             gain;                       // Gain in 16.16 fixed point.
+        int32_t             zeroOffset;                 // Running estimate of the DC offset of the input.
+        bool                normalize;                  // True if the DC offset should be removed.
+        bool                calibrated;                 // True once zeroOffset has been initialised from the input.
+
+        public:
+
+        /**
+         * Constructor.
+         *
+         * @param source The component that will provide data.
+         * @param gain The gain to apply to each sample.
+         * @param normalize True if the DC offset of the input should be removed.
+         * @param format The format of the output: DATASTREAM_FORMAT_8BIT_SIGNED or DATASTREAM_FORMAT_16BIT_SIGNED.
+         * @param decimation The number of input samples to combine into each output sample (1 for none).
+         */
+        StreamDecimator(DataSource &source, float gain = 1.0f, bool normalize = true, int format = DATASTREAM_FORMAT_8BIT_SIGNED, int decimation = 1);
+
+        /**
+         * Callback provided when data is ready.
+         */
+        virtual int pullRequest();
+
+        /**
+         * Provide the next available ManagedBuffer to our downstream caller, if available.
+         */
+        virtual ManagedBuffer pull();
+
+        /**
+         * Define a downstream component for data stream.
+         *
+         * @param sink The component that data will be delivered to, when it is availiable
+         */
+        virtual void connect(DataSink &sink);
+
+        /**
+         * Determines if this source is connected to a downstream component.
+         *
+         * @return true if a downstream is connected.
+         */
+        bool isConnected();
+
+        /**
+         * Determine the data format of the buffers streamed out of this component.
+         */
+        virtual int getFormat();
+
+        /**
+         * Defines the gain applied to each sample.
+         *
+         * @param gain The new gain.
+         * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the gain is negative.
+         */
+        int setGain(float gain);
+
+        /**
+         * Determines the gain applied to each sample.
+         */
+        float getGain();
+
+        /**
+         * Defines the number of input samples combined into each output sample.
+         *
+         * @param decimation The new decimation factor, 1 or more.
+         * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the factor is out of range.
+         */
+        int setDecimation(int decimation);
+
+        /**
+         * Determines the number of input samples combined into each output sample.
+         */
+        int getDecimation();
+    };
+}
+
+#endif
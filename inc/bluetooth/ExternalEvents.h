@@ -35,6 +35,7 @@ DEALINGS IN THE SOFTWARE.
 
 #define MICROBIT_BLE_EVT_CONNECTED      1
 #define MICROBIT_BLE_EVT_DISCONNECTED   2
+#define MICROBIT_BLE_EVT_TELEMETRY      3
 
 #include "MESEvents.h"
 
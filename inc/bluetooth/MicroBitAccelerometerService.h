@@ -32,6 +32,7 @@ DEALINGS IN THE SOFTWARE.
 
 #include "MicroBitBLEManager.h"
 #include "MicroBitBLEService.h"
+#include "MicroBitBLESampleBatch.h"
 #include "MicroBitAccelerometer.h"
 #include "EventModel.h"
 
@@ -54,14 +55,19 @@ class MicroBitAccelerometerService : public MicroBitBLEService
     private:
 
     /**
-      * Invoked when BLE connects.
+      * Invoked when a client first uses the service on a connection.
       */
-    void onConnect( const microbit_ble_evt_t *p_ble_evt);
+    void onActivate();
 
     /**
-      * Invoked when BLE disconnects.
+      * Invoked when the connection the service was activated on closes.
       */
-    void onDisconnect( const microbit_ble_evt_t *p_ble_evt);
+    void onDeactivate();
+
+    /**
+      * Callback. Invoked when a live value is read, with MICROBIT_BLE_LAZY_SERVICES enabled.
+      */
+    void onDataRead( microbit_onDataRead_t *params);
 
     /**
       * Callback. Invoked when any of our attributes are written via BLE.
@@ -69,9 +75,10 @@ class MicroBitAccelerometerService : public MicroBitBLEService
     void onDataWritten( const microbit_ble_evt_write_t *params);
 
     /**
-      * Helper function to read the values
+      * Helper function to read the values, and add them to the batch characteristic if it is in use.
+      * @return true if the batch characteristic should be sent.
       */
-    void readXYZ();
+    bool readXYZ();
     
     /**
       * Set up or tear down event listers
@@ -88,12 +95,16 @@ class MicroBitAccelerometerService : public MicroBitBLEService
     // memory for our 8 bit control characteristics.
     uint16_t            accelerometerDataCharacteristicBuffer[3];
     uint16_t            accelerometerPeriodCharacteristicBuffer;
+
+    // Samples collected for the batch characteristic.
+    MicroBitBLESampleBatch  batch;
     
     // Index for each charactersitic in arrays of handles and UUIDs
     typedef enum mbbs_cIdx
     {
         mbbs_cIdxDATA,
         mbbs_cIdxPERIOD,
+        mbbs_cIdxBATCH,
         mbbs_cIdxCOUNT
     } mbbs_cIdx;
     
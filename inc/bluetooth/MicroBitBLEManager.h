@@ -55,6 +55,18 @@ DEALINGS IN THE SOFTWARE.
 // CodalComponent status flags
 #define MICROBIT_BLE_STATUS_DISCONNECT          0x04
 #define MICROBIT_BLE_STATUS_SHUTDOWN            0x08
+#define MICROBIT_BLE_STATUS_BULK                0x10
+#define MICROBIT_BLE_STATUS_ADV_SETS            0x20
+#define MICROBIT_BLE_STATUS_FLASH_CLEAN         0x40
+#define MICROBIT_BLE_STATUS_DATABASE_CHECK      0x80
+
+// The status flags that need the idle callback.
+#define MICROBIT_BLE_STATUS_IDLE_USERS          ( MICROBIT_BLE_STATUS_BULK | MICROBIT_BLE_STATUS_ADV_SETS | MICROBIT_BLE_STATUS_FLASH_CLEAN | MICROBIT_BLE_STATUS_DATABASE_CHECK)
+
+// Connection modes, trading throughput against power while connected.
+#define MICROBIT_BLE_CONNECTION_DEFAULT         0       // 10-20ms interval, no slave latency.
+#define MICROBIT_BLE_CONNECTION_BULK            1       // 7.5-15ms interval, no slave latency, 2M PHY.
+#define MICROBIT_BLE_CONNECTION_IDLE            2       // 100-200ms interval, slave latency 4.
 
 // micro:bit Modes
 // The micro:bit may be in different states: running a user's application or into BLE pairing mode
@@ -62,6 +74,32 @@ DEALINGS IN THE SOFTWARE.
 #define MICROBIT_MODE_PAIRING                   0
 #define MICROBIT_MODE_APPLICATION               1
 
+// The version of MicroBitBLETelemetry broadcast by startTelemetry().
+#define MICROBIT_BLE_TELEMETRY_VERSION          1
+
+/**
+  * The readings broadcast by MicroBitBLEManager::startTelemetry(), as manufacturer specific data following
+  * the MICROBIT_BLE_TELEMETRY_COMPANY_ID company identifier. Multi-byte fields are little endian.
+  */
+typedef struct __attribute__((packed))
+{
+    uint8_t     version;                // MICROBIT_BLE_TELEMETRY_VERSION.
+    uint8_t     sequence;               // Incremented at each refresh, so that a scanner can ignore repeats.
+    uint32_t    serial;                 // The micro:bit's serial number, identifying it without a connection.
+    int8_t      temperature;            // Degrees Celsius.
+    int8_t      acceleration[3];        // X, Y and Z, in units of 16 milli-g.
+    uint8_t     logFill;                // Percentage of the data log in use, or 0xFF if there is no log.
+    uint16_t    battery;                // Battery voltage in millivolts, or 0 if not known.
+} MicroBitBLETelemetry;
+
+namespace codal
+{
+    class Accelerometer;
+    class MicroBitThermometer;
+    class MicroBitLog;
+}
+
+class MicroBitPowerManager;
 class MicroBitBLEManager;
 typedef MicroBitBLEManager BLEDevice;
 
@@ -202,6 +240,58 @@ class MicroBitBLEManager : public CodalComponent
      */
     bool getConnected();
 
+    /**
+     * Sets the connection mode used when no bulk transfer is in progress, and requests it from the
+     * connected device. The connection parameters are negotiated, so the device may choose others.
+     *
+     * @param mode MICROBIT_BLE_CONNECTION_DEFAULT, MICROBIT_BLE_CONNECTION_BULK or MICROBIT_BLE_CONNECTION_IDLE.
+     *
+     * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the mode is not recognised.
+     *
+     * @code
+     * // reduce power for a connection that only sends occasional events.
+     * bleManager.setConnectionMode(MICROBIT_BLE_CONNECTION_IDLE);
+     * @endcode
+     */
+    int setConnectionMode(int mode);
+
+    /**
+     * Determines the connection mode last requested from the connected device.
+     *
+     * @return MICROBIT_BLE_CONNECTION_DEFAULT, MICROBIT_BLE_CONNECTION_BULK or MICROBIT_BLE_CONNECTION_IDLE.
+     */
+    int getConnectionMode();
+
+    /**
+     * Determines the connection mode used when no bulk transfer is in progress.
+     *
+     * @return the mode last given to setConnectionMode(), or MICROBIT_BLE_CONNECTION_MODE.
+     */
+    int getRestingConnectionMode();
+
+    /**
+     * Indicates that a bulk transfer is in progress. The connection is switched to MICROBIT_BLE_CONNECTION_BULK,
+     * and returns to the mode set by setConnectionMode() MICROBIT_BLE_BULK_TIMEOUT milliseconds after the last call.
+     * Services call this as they send or receive large amounts of data.
+     */
+    void bulkTransfer();
+
+    /**
+     * Holds back garbage collection of the bond storage until the connection closes,
+     * or MICROBIT_BLE_FLASH_CLEAN_TIMEOUT milliseconds have passed.
+     *
+     * @note for internal use only. Called from the peer manager event handler.
+     */
+    void deferFlashClean();
+
+    /**
+     * Compares the layout of the GATT database with the one last seen, and asks bonded peers to rediscover our
+     * services if it differs.
+     *
+     * @note for internal use only. Called from the idle callback once the first peer connects.
+     */
+    void checkDatabaseHash();
+
 #if CONFIG_ENABLED(MICROBIT_BLE_EDDYSTONE_URL)
     /**
       * Set the content of Eddystone URL frames
@@ -269,6 +359,95 @@ class MicroBitBLEManager : public CodalComponent
     */
     uint8_t getCurrentMode();
 
+    /**
+      * Adds an advertising set, which is broadcast in turn with the micro:bit's own advertising and any other sets.
+      * The SoftDevice runs one advertising set at a time, so the sets are rotated, each broadcasting for its dwell time.
+      * Additional sets are not connectable, and keep being broadcast while the micro:bit is connected.
+      *
+      * @param data the advertising data, as a sequence of AD structures (length, type, value).
+      *
+      * @param length the length of the data, up to 31 bytes, or MICROBIT_BLE_ADVERTISING_DATA_MAX for extended advertising.
+      *
+      * @param interval_ms the advertising interval used while the set is broadcast, in milliseconds.
+      *
+      * @param dwell_ms the time the set is broadcast for before moving to the next, in milliseconds.
+      *
+      * @param extended true to use BLE 5 extended advertising, which carries larger payloads but is only seen by BLE 5 scanners.
+      *
+      * @return the identifier of the set (1 or more), DEVICE_INVALID_PARAMETER, DEVICE_NOT_SUPPORTED if extended
+      * advertising is not available, or DEVICE_NO_RESOURCES if MICROBIT_BLE_ADVERTISING_SETS sets are already in use.
+      */
+    int addAdvertisingSet(const uint8_t *data, int length, uint16_t interval_ms = MICROBIT_BLE_ADVERTISING_INTERVAL, uint16_t dwell_ms = MICROBIT_BLE_ADVERTISING_DWELL, bool extended = false);
+
+    /**
+      * Replaces the data broadcast by an advertising set. A set that is being broadcast is updated in place, without restarting it.
+      *
+      * @param set the identifier returned by addAdvertisingSet().
+      *
+      * @param data the advertising data, as a sequence of AD structures.
+      *
+      * @param length the length of the data, within the limit of the set's advertising type.
+      *
+      * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER.
+      */
+    int updateAdvertisingSet(int set, const uint8_t *data, int length);
+
+    /**
+      * Changes how often, and for how long in each rotation, an advertising set is broadcast.
+      *
+      * @param set the identifier returned by addAdvertisingSet(), or 0 for the micro:bit's own advertising.
+      * For set 0 only the dwell time is used; its interval is chosen by the function that configured it.
+      *
+      * @param interval_ms the advertising interval used while the set is broadcast, in milliseconds.
+      *
+      * @param dwell_ms the time the set is broadcast for before moving to the next, in milliseconds.
+      *
+      * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER.
+      */
+    int setAdvertisingSetInterval(int set, uint16_t interval_ms, uint16_t dwell_ms);
+
+    /**
+      * Stops broadcasting an advertising set, and frees it for reuse.
+      *
+      * @param set the identifier returned by addAdvertisingSet().
+      *
+      * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER.
+      */
+    int removeAdvertisingSet(int set);
+
+    /**
+      * Starts broadcasting sensor readings in a MicroBitBLETelemetry advertising set, so that a scanner can
+      * monitor many micro:bits without connecting to each. The readings are refreshed every period_ms, and the
+      * advertising data is replaced in place, without restarting advertising.
+      *
+      * @param accelerometer the accelerometer to report.
+      *
+      * @param thermometer the thermometer to report.
+      *
+      * @param log the data log whose fill level is reported, or NULL.
+      *
+      * @param power the power manager used to read the battery voltage, or NULL.
+      *
+      * @param period_ms how often the readings are refreshed, in milliseconds.
+      *
+      * @param interval_ms the advertising interval used while the readings are broadcast, in milliseconds.
+      *
+      * @return DEVICE_OK on success, or an error code from addAdvertisingSet().
+      *
+      * @code
+      * uBit.bleManager.startTelemetry(uBit.accelerometer, uBit.thermometer, &uBit.log, &uBit.power);
+      * @endcode
+      */
+    int startTelemetry(Accelerometer &accelerometer, MicroBitThermometer &thermometer, MicroBitLog *log = NULL, MicroBitPowerManager *power = NULL,
+                       uint16_t period_ms = MICROBIT_BLE_TELEMETRY_PERIOD, uint16_t interval_ms = MICROBIT_BLE_TELEMETRY_INTERVAL);
+
+    /**
+      * Stops broadcasting sensor readings started by startTelemetry().
+      *
+      * @return DEVICE_OK on success, or DEVICE_INVALID_STATE if telemetry is not running.
+      */
+    int stopTelemetry();
+
     /**
      * Control whether advertising will be restarted on disconnection
      */
@@ -290,6 +469,15 @@ class MicroBitBLEManager : public CodalComponent
     * Ensure service changed indication pending for all peers
     */
     void servicesChanged();
+
+    /**
+     * Determines the hash of the GATT database layout, computed once the first peer connects.
+     * Bonded peers are only sent a service changed indication when this differs from the layout last seen.
+     *
+     * @return a CRC32 of the handle, UUID and permissions of every attribute and the properties of every
+     *         characteristic, or 0 before the first connection.
+     */
+    uint32_t getDatabaseHash() { return databaseHash; }
       
   private:
     /**
@@ -306,6 +494,13 @@ class MicroBitBLEManager : public CodalComponent
     */
     void showManagementModeAnimation(MicroBitDisplay &display);
 
+    /**
+    * Requests the connection parameters and PHY of the given mode from the connected device.
+    *
+    * @param mode the connection mode to request.
+    */
+    void applyConnectionMode(int mode);
+
     int pairingStatus;
     ManagedString passKey;
     ManagedString gapName;
@@ -320,6 +515,24 @@ class MicroBitBLEManager : public CodalComponent
     uint8_t currentMode = MICROBIT_MODE_APPLICATION;
 
     bool advertiseOnDisconnect = true;
+
+    int connectionMode = MICROBIT_BLE_CONNECTION_MODE;                  // The mode used outside bulk transfers.
+    int activeConnectionMode = MICROBIT_BLE_CONNECTION_DEFAULT;         // The mode last requested.
+    unsigned long bulkTime = 0;                                         // The time of the last call to bulkTransfer().
+    unsigned long flashCleanTime = 0;                                   // When garbage collection was first held back.
+    uint32_t databaseHash = 0;                                          // The GATT database layout hash, from the first connection.
+
+    /**
+      * Refreshes the readings broadcast by startTelemetry(). Runs in its own fiber, as reading the battery waits on I2C.
+      */
+    void onTelemetryTimer(MicroBitEvent);
+
+    int telemetrySet = 0;                                               // The advertising set used for telemetry, or 0.
+    Accelerometer *telemetryAccelerometer = NULL;
+    MicroBitThermometer *telemetryThermometer = NULL;
+    MicroBitLog *telemetryLog = NULL;
+    MicroBitPowerManager *telemetryPower = NULL;
+    MicroBitBLETelemetry telemetry;
 };
 
 #endif
@@ -0,0 +1,128 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef MICROBIT_BLE_SAMPLE_BATCH_H
+#define MICROBIT_BLE_SAMPLE_BATCH_H
+
+#include "MicroBitConfig.h"
+
+#if CONFIG_ENABLED(DEVICE_BLE)
+
+#include "CodalComponent.h"
+
+// The size of the header at the start of each batch, holding the time of the first sample.
+#define MICROBIT_BLE_SAMPLE_BATCH_HEADER            4
+
+// The size of each sample in a batch of 3D samples: a 16 bit time offset followed by 16 bit X, Y and Z values.
+#define MICROBIT_BLE_SAMPLE_BATCH_RECORD            8
+
+// The size of the time offset at the start of every record.
+#define MICROBIT_BLE_SAMPLE_BATCH_OFFSET            2
+
+/**
+  * Class definition for MicroBitBLESampleBatch.
+  * Collects sensor samples into a single characteristic value, so that a service can send
+  * as many samples per notification as the negotiated ATT MTU allows.
+  *
+  * A batch is laid out as a little endian uint32_t holding the time of the first sample in milliseconds,
+  * followed by one record per sample: a uint16_t offset from that time in milliseconds, then the sample's values.
+  * For 3D samples these are int16_t X, Y and Z.
+  */
+class MicroBitBLESampleBatch
+{
+    public:
+
+    /**
+      * Constructor.
+      * Create an empty batch.
+      *
+      * @param recordSize the size of each record, including its time offset. Defaults to a 3D sample.
+      */
+    MicroBitBLESampleBatch( uint16_t recordSize = MICROBIT_BLE_SAMPLE_BATCH_RECORD);
+
+    /**
+      * Changes the size of each record, and discards any samples held.
+      *
+      * @param recordSize the size of each record, including its time offset.
+      */
+    void setRecordSize( uint16_t recordSize);
+
+    /**
+      * Discards any samples held, and restarts the pacing interval.
+      */
+    void reset();
+
+    /**
+      * Adds a sample to the batch.
+      *
+      * @param x the X value of the sample.
+      * @param y the Y value of the sample.
+      * @param z the Z value of the sample.
+      *
+      * @return true if the batch should now be sent: either it is full, or at least one connection
+      * interval has passed since the last batch was sent.
+      */
+    bool add( int16_t x, int16_t y, int16_t z);
+
+    /**
+      * Adds a sample to the batch.
+      *
+      * @param values the values of the sample: the record size less MICROBIT_BLE_SAMPLE_BATCH_OFFSET bytes.
+      *
+      * @return true if the batch should now be sent: either it is full, or at least one connection
+      * interval has passed since the last batch was sent.
+      */
+    bool add( const void *values);
+
+    /**
+      * Determines if the batch holds as many samples as fit in a single notification.
+      */
+    bool full();
+
+    /**
+      * The number of samples held.
+      */
+    int count() { return samples; }
+
+    /**
+      * The characteristic value for the samples held.
+      */
+    const uint8_t *data() { return buffer; }
+
+    /**
+      * The length of the characteristic value for the samples held, in bytes.
+      */
+    uint16_t length() { return samples ? MICROBIT_BLE_SAMPLE_BATCH_HEADER + samples * record : 0; }
+
+    private:
+
+    uint8_t             buffer[ MICROBIT_BLE_MAX_PAYLOAD];
+    uint16_t            samples;
+    uint16_t            record;                                     // The size of each record, in bytes.
+    CODAL_TIMESTAMP     start;                                      // The time of the first sample held.
+    CODAL_TIMESTAMP     sent;                                       // The time the batch was last sent or reset.
+};
+
+#endif
+#endif
@@ -0,0 +1,248 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef MICROBIT_BLE_SCANNER_H
+#define MICROBIT_BLE_SCANNER_H
+
+#include "MicroBitConfig.h"
+
+#if CONFIG_ENABLED(DEVICE_BLE) && CONFIG_ENABLED(MICROBIT_BLE_SCANNER)
+
+#include "CodalComponent.h"
+#include "ble_gap.h"
+#include "MicroBitComponentIds.h"
+
+// Raised when a batch of advertisement reports is ready to read().
+#define MICROBIT_BLE_SCANNER_EVT_REPORTS        1
+
+// The number of advertisement reports held until they are read.
+#ifndef MICROBIT_BLE_SCANNER_QUEUE_SIZE
+#define MICROBIT_BLE_SCANNER_QUEUE_SIZE         16
+#endif
+
+// The number of service UUID and manufacturer filters.
+#ifndef MICROBIT_BLE_SCANNER_FILTERS
+#define MICROBIT_BLE_SCANNER_FILTERS            4
+#endif
+
+// The number of recent advertisements remembered for duplicate suppression.
+#ifndef MICROBIT_BLE_SCANNER_DUPLICATES
+#define MICROBIT_BLE_SCANNER_DUPLICATES         16
+#endif
+
+#ifndef MICROBIT_BLE_SCANNER_OBSERVER_PRIO
+#define MICROBIT_BLE_SCANNER_OBSERVER_PRIO      2
+#endif
+
+// Filter types
+#define MICROBIT_BLE_SCANNER_FILTER_SERVICE         1       // A 16 bit service UUID, in a UUID list or service data (such as Eddystone's 0xFEAA).
+#define MICROBIT_BLE_SCANNER_FILTER_MANUFACTURER    2       // The company identifier at the start of manufacturer specific data.
+
+/**
+  * An advertisement received by MicroBitBLEScanner.
+  */
+typedef struct
+{
+    uint32_t    time;                                       // When the advertisement was received, in milliseconds.
+    uint8_t     address[ BLE_GAP_ADDR_LEN];                 // The advertiser's address, least significant byte first.
+    uint8_t     addressType;                                // BLE_GAP_ADDR_TYPE_...
+    int8_t      rssi;                                       // The received signal strength, in dBm.
+    uint8_t     length;                                     // The length of data.
+    uint8_t     data[ BLE_GAP_ADV_SET_DATA_SIZE_MAX];       // The advertising data, as a sequence of AD structures.
+} MicroBitBLEScanReport;
+
+/**
+  * Class definition for MicroBitBLEScanner.
+  * Collects advertisements from nearby devices, such as other micro:bits broadcasting Eddystone frames or
+  * MicroBitBLEManager advertising sets. Advertisements are filtered, and duplicates suppressed, in SoftDevice
+  * event context, and the rest are held in a ring to be read in batches, so that scanning many
+  * advertisers does not raise an event for each one.
+  */
+class MicroBitBLEScanner : public CodalComponent
+{
+    public:
+
+    static MicroBitBLEScanner *scanner;                     // The scanner receiving advertisement reports, if any.
+
+    /**
+      * Constructor.
+      *
+      * @param id the event bus id to raise MICROBIT_BLE_SCANNER_EVT_REPORTS on. Defaults to MICROBIT_ID_BLE_SCANNER.
+      */
+    MicroBitBLEScanner( uint16_t id = MICROBIT_ID_BLE_SCANNER);
+
+    /**
+      * Destructor.
+      */
+    ~MicroBitBLEScanner();
+
+    /**
+      * Starts scanning, once MicroBitBLEManager has been initialised.
+      *
+      * @param interval_ms the time between the start of each scan window, in milliseconds.
+      * @param window_ms the time spent listening in each interval, in milliseconds. Equal to the interval for continuous scanning.
+      *
+      * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the window is longer than the interval,
+      * or DEVICE_NOT_SUPPORTED if the SoftDevice refuses to scan.
+      */
+    int start( uint16_t interval_ms = 100, uint16_t window_ms = 100);
+
+    /**
+      * Stops scanning. Reports already received can still be read.
+      *
+      * @return DEVICE_OK.
+      */
+    int stop();
+
+    /**
+      * Determines if the scanner is running.
+      */
+    bool isScanning();
+
+    /**
+      * Adds a filter. Once any filter is set, only advertisements that match at least one are reported.
+      *
+      * @param type MICROBIT_BLE_SCANNER_FILTER_SERVICE or MICROBIT_BLE_SCANNER_FILTER_MANUFACTURER.
+      * @param value the 16 bit service UUID or company identifier to match.
+      *
+      * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER, or DEVICE_NO_RESOURCES if MICROBIT_BLE_SCANNER_FILTERS are in use.
+      */
+    int addFilter( int type, uint16_t value);
+
+    /**
+      * Removes all filters, so that every advertisement is reported.
+      */
+    void clearFilters();
+
+    /**
+      * Sets the weakest signal to report. Advertisements received with a lower RSSI are ignored.
+      *
+      * @param rssi the threshold in dBm, or -128 to report everything (the default).
+      */
+    void setRSSIThreshold( int8_t rssi);
+
+    /**
+      * Sets how long repeats of the same advertisement from the same device are suppressed for.
+      *
+      * @param window_ms the suppression time in milliseconds, or 0 to report every advertisement. Defaults to 1000.
+      */
+    void setDuplicateWindow( uint16_t window_ms);
+
+    /**
+      * Sets when MICROBIT_BLE_SCANNER_EVT_REPORTS is raised: once count reports are waiting, or period_ms after
+      * the oldest waiting report arrived, whichever is sooner.
+      *
+      * @param count the number of reports to wait for, from 1 to MICROBIT_BLE_SCANNER_QUEUE_SIZE. Defaults to 8.
+      * @param period_ms the longest time a report waits before the event is raised. Defaults to 500.
+      *
+      * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER.
+      */
+    int setBatch( int count, uint16_t period_ms);
+
+    /**
+      * Determines the number of reports waiting to be read.
+      */
+    int available();
+
+    /**
+      * Reads waiting reports, oldest first.
+      *
+      * @param reports the array to copy reports into.
+      * @param max the size of the array.
+      *
+      * @return the number of reports copied.
+      */
+    int read( MicroBitBLEScanReport *reports, int max);
+
+    /**
+      * Determines the number of reports dropped because the ring was full.
+      */
+    uint32_t getDropped() { return dropped; }
+
+    /**
+      * Raises MICROBIT_BLE_SCANNER_EVT_REPORTS once the oldest waiting report has waited for the batch period.
+      */
+    virtual void idleCallback() override;
+
+    /**
+      * Filters and queues an advertisement report, then resumes scanning.
+      * Called in SoftDevice event context.
+      *
+      * @param report the report from the SoftDevice.
+      */
+    void onAdvReport( const ble_gap_evt_adv_report_t *report);
+
+    private:
+
+    /**
+      * Determines if advertising data matches any of the filters.
+      */
+    bool matches( const uint8_t *data, int length);
+
+    /**
+      * Determines if an advertisement repeats one seen within the duplicate window, and remembers it if not.
+      */
+    bool duplicate( const ble_gap_evt_adv_report_t *report, uint32_t now);
+
+    /**
+      * Raises MICROBIT_BLE_SCANNER_EVT_REPORTS, unless it has been raised since reports were last read.
+      */
+    void notify();
+
+    typedef struct
+    {
+        uint8_t     type;
+        uint16_t    value;
+    } Filter;
+
+    typedef struct
+    {
+        uint32_t    hash;
+        uint32_t    time;
+    } Seen;
+
+    Filter                  filters[ MICROBIT_BLE_SCANNER_FILTERS];
+    int                     filterCount;
+    int8_t                  rssiThreshold;
+    uint16_t                duplicateWindow;
+    int                     batchCount;
+    uint16_t                batchPeriod;
+
+    Seen                    seen[ MICROBIT_BLE_SCANNER_DUPLICATES];
+    int                     seenNext;
+
+    MicroBitBLEScanReport   queue[ MICROBIT_BLE_SCANNER_QUEUE_SIZE + 1];
+    volatile uint8_t        head;                           // Written only in SoftDevice event context.
+    volatile uint8_t        tail;                           // Written only by read().
+    volatile bool           notified;
+    uint32_t                dropped;
+
+    bool                    scanning;
+    ble_gap_scan_params_t   params;
+    uint8_t                 buffer[ BLE_GAP_SCAN_BUFFER_MIN];
+    ble_data_t              scanData;
+};
+
+#endif
+#endif
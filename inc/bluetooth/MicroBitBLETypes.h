@@ -102,6 +102,7 @@ typedef uint16_t                     microbit_charhandle_t;
 typedef ble_evt_t                    microbit_ble_evt_t;
 typedef ble_gatts_evt_write_t        microbit_ble_evt_write_t;
 typedef ble_gatts_evt_hvc_t          microbit_ble_evt_hvc_t;
+typedef ble_gatts_evt_hvn_tx_complete_t microbit_ble_evt_hvn_tx_complete_t;
 
 typedef enum microbit_prop_t
 {
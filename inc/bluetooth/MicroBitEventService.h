@@ -83,19 +83,45 @@ class MicroBitEventService : public MicroBitBLEService, MicroBitComponent
       */
     void onDataRead( microbit_onDataRead_t *params);
 
+    /**
+      * Determines how many events have been dropped because the queue of events waiting to be sent was full.
+      * @return the number of events dropped since the service was created.
+      */
+    uint32_t getOverflowCount() { return overflowCount; }
+
     private:
 
+    /**
+      * Callback. Invoked when queued notifications have been transmitted, freeing space for more.
+      */
+    void onNotificationComplete( const microbit_ble_evt_hvn_tx_complete_t *params);
+
+    /**
+      * Sends queued events, packing as many as fit into each notification, until the queue is empty
+      * or the SoftDevice has no room for more.
+      */
+    void sendEvents();
+
     // messageBus we're using.
 	EventModel	        &messageBus;
 
     // memory for our event characteristics.
     EventServiceEvent   clientEventBuffer;
-    EventServiceEvent   microBitEventBuffer;
+    EventServiceEvent   microBitEventBuffer[ MICROBIT_BLE_MAX_PAYLOAD / sizeof(EventServiceEvent)];
     EventServiceEvent   microBitRequirementsBuffer;
     EventServiceEvent   clientRequirementsBuffer;
 
     // Message bus offset last sent to the client...
     uint16_t messageBusListenerOffset;
+
+    // Events waiting to be sent. Events are added from fiber context, and sent from either fiber or interrupt context.
+    EventServiceEvent   eventQueue[ MICROBIT_BLE_EVENT_SERVICE_QUEUE_SIZE + 1];
+    volatile uint16_t   eventQueueHead;
+    volatile uint16_t   eventQueueTail;
+    volatile bool       sending;
+    volatile bool       sendPending;
+    uint32_t            overflowCount;
+    bool                overflowing;            // Set from the first event dropped until the queue next has room.
     
     // Index for each charactersitic in arrays of handles and UUIDs
     typedef enum mbbs_cIdx
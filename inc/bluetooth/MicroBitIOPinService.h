@@ -33,11 +33,23 @@ DEALINGS IN THE SOFTWARE.
 #include "MicroBitBLEManager.h"
 #include "MicroBitBLEService.h"
 #include "MicroBitIO.h"
+#include "MicroBitAnalogScan.h"
+#include "MicroBitComponentIds.h"
 
 #define MICROBIT_IO_PIN_SERVICE_PINCOUNT       19
 #define MICROBIT_IO_PIN_SERVICE_DATA_SIZE      10
 #define MICROBIT_PWM_PIN_SERVICE_DATA_SIZE     2
 
+// The interval between scans of the pins configured as analog inputs, in milliseconds.
+#ifndef MICROBIT_IO_PIN_SERVICE_ANALOG_PERIOD
+#define MICROBIT_IO_PIN_SERVICE_ANALOG_PERIOD  20
+#endif
+
+// The change in an analog input, in the 8 bit units reported over BLE, needed to send a notification.
+#ifndef MICROBIT_IO_PIN_SERVICE_ANALOG_THRESHOLD
+#define MICROBIT_IO_PIN_SERVICE_ANALOG_THRESHOLD 1
+#endif
+
 /**
   * Name value pair definition, as used to read and write pin values over BLE.
   */
@@ -84,6 +96,36 @@ class MicroBitIOPinService : public MicroBitBLEService, MicroBitComponent
 
     private:
 
+    /**
+      * Enables edge events on the pins configured as digital inputs, and builds the list of pins
+      * configured as analog inputs to scan. Called whenever the IO or AD configuration changes.
+      */
+    void configureInputs();
+
+    /**
+      * Callback. Invoked on a rising or falling edge of a digital input.
+      */
+    void onPinEvent(MicroBitEvent e);
+
+    /**
+      * Callback. Invoked when a scan of the analog inputs has completed.
+      */
+    void onAnalogScan(MicroBitEvent e);
+
+    /**
+      * Starts a scan of the pins configured as analog inputs.
+      */
+    void startAnalogScan();
+
+    /**
+      * Records a new sample from an analog input, marking the pin as changed if it differs
+      * from the value last sent by at least MICROBIT_IO_PIN_SERVICE_ANALOG_THRESHOLD.
+      *
+      * @param i the enumeration of the pin
+      * @param value the sample, in the range 0..1023
+      */
+    void analogUpdate(int i, int value);
+
     /**
       * Callback. Invoked when any of our attributes are written via BLE.
       */
@@ -148,6 +190,23 @@ class MicroBitIOPinService : public MicroBitBLEService, MicroBitComponent
 
     // Historic information about our pin data data.
     uint8_t             ioPinServiceIOData[MICROBIT_IO_PIN_SERVICE_PINCOUNT];
+
+    // Pins with edge events enabled, and pins with a change not yet sent. Bits may be set from interrupt context.
+    uint32_t            edgeInputs;
+    volatile uint32_t   digitalChanged;
+    uint32_t            analogChanged;
+
+    // The latest sample from each analog input.
+    uint8_t             analogData[MICROBIT_IO_PIN_SERVICE_PINCOUNT];
+
+    // The pins configured as analog inputs, sampled together in one SAADC scan.
+    MicroBitAnalogScan  *analogScan;
+    NRF52Pin            *analogPins[CONFIG_MICROBIT_ANALOG_SCAN_MAX_PINS];
+    uint8_t             analogPinIndex[CONFIG_MICROBIT_ANALOG_SCAN_MAX_PINS];
+    int16_t             analogSamples[CONFIG_MICROBIT_ANALOG_SCAN_MAX_PINS];
+    int                 analogCount;
+    bool                analogScanSupported;
+    CODAL_TIMESTAMP     analogScanTime;
     
     // Index for each charactersitic in arrays of handles and UUIDs
     typedef enum mbbs_cIdx
@@ -33,11 +33,25 @@ DEALINGS IN THE SOFTWARE.
 #include "MicroBitBLEManager.h"
 #include "MicroBitBLEService.h"
 #include "MicroBitDisplay.h"
+#include "MicroBitComponentIds.h"
 
 // Defines the buffer size for scrolling text over BLE, hence also defines
 // the maximum string length that can be scrolled via the BLE service.
 #define MICROBIT_BLE_MAXIMUM_SCROLLTEXT         20
 
+#define MICROBIT_BLE_LED_EVT_PRESENT            1
+
+// Frame stream packets. The first byte holds the packet type, optionally with MICROBIT_BLE_LED_FRAME_HOLD.
+// MICROBIT_BLE_LED_FRAME_RUN:   start index, then brightness values for consecutive pixels from there.
+// MICROBIT_BLE_LED_FRAME_PAIRS: pairs of pixel index and brightness value.
+// Pixels are indexed row by row, from 0 at the top left to 24 at the bottom right.
+#define MICROBIT_BLE_LED_FRAME_RUN              0x00
+#define MICROBIT_BLE_LED_FRAME_PAIRS            0x01
+#define MICROBIT_BLE_LED_FRAME_HOLD             0x80        // More packets follow for this frame, so don't show it yet.
+
+// The largest frame stream packet: a type byte and a pair for every pixel.
+#define MICROBIT_BLE_LED_FRAME_SIZE             51
+
 
 /**
   * Class definition for the custom MicroBit LED Service.
@@ -69,12 +83,31 @@ class MicroBitLEDService : public MicroBitBLEService
 
     private:
 
+    /**
+      * Shows the frame built from the stream, unless one was shown less than a connection interval ago.
+      * In that case it is shown once the interval has passed, by which time it may have been replaced.
+      */
+    void presentFrame();
+
+    /**
+      * Shows a frame held back by presentFrame().
+      */
+    void onPresent( MicroBitEvent);
+
     MicroBitDisplay     &display;
 
     // memory for our characteristics.
     uint8_t             matrixValue[5];
     uint16_t            speedValue;
     uint8_t             textValue[MICROBIT_BLE_MAXIMUM_SCROLLTEXT];
+    uint8_t             frameValue[MICROBIT_BLE_LED_FRAME_SIZE];
+
+    // The frame being built from the stream, and the state of its presentation.
+    uint8_t             frame[25];
+    bool                frameStreaming;
+    bool                framePending;
+    bool                frameScheduled;
+    CODAL_TIMESTAMP     frameTime;
 
     // Index for each charactersitic in arrays of handles and UUIDs
     typedef enum mbbs_cIdx
@@ -82,6 +115,7 @@ class MicroBitLEDService : public MicroBitBLEService
         mbbs_cIdxMATRIX,
         mbbs_cIdxTEXT,
         mbbs_cIdxSPEED,
+        mbbs_cIdxFRAME,
         mbbs_cIdxCOUNT
     } mbbs_cIdx;
     
@@ -32,6 +32,7 @@ DEALINGS IN THE SOFTWARE.
 
 #include "MicroBitBLEManager.h"
 #include "MicroBitBLEService.h"
+#include "MicroBitBLESampleBatch.h"
 #include "MicroBitCompass.h"
 #include "EventModel.h"
 
@@ -60,9 +61,10 @@ class MicroBitMagnetometerService : public MicroBitBLEService
     private:
 
     /**
-     * Fetch magnetometer values to characteristic buffers
+     * Fetch magnetometer values to characteristic buffers, and add them to the batch characteristic if it is in use.
+     * @return true if the batch characteristic should be sent.
      */
-    void read();
+    bool read();
 
     /**
       * Set up or tear down event listers
@@ -70,14 +72,19 @@ class MicroBitMagnetometerService : public MicroBitBLEService
     void listen( bool yes);
 
     /**
-      * Invoked when BLE connects.
+      * Invoked when a client first uses the service on a connection.
       */
-    void onConnect( const microbit_ble_evt_t *p_ble_evt);
+    void onActivate();
 
     /**
-      * Invoked when BLE disconnects.
+      * Invoked when the connection the service was activated on closes.
       */
-    void onDisconnect( const microbit_ble_evt_t *p_ble_evt);
+    void onDeactivate();
+
+    /**
+      * Callback. Invoked when a live value is read, with MICROBIT_BLE_LAZY_SERVICES enabled.
+      */
+    void onDataRead( microbit_onDataRead_t *params);
     
     /**
       * Callback. Invoked when any of our attributes are written via BLE.
@@ -115,6 +122,9 @@ class MicroBitMagnetometerService : public MicroBitBLEService
     uint16_t            magnetometerPeriodCharacteristicBuffer;
     uint8_t             magnetometerCalibrationCharacteristicBuffer;
 
+    // Samples collected for the batch characteristic.
+    MicroBitBLESampleBatch  batch;
+
     // Index for each charactersitic in arrays of handles and UUIDs
     typedef enum mbbs_cIdx
     {
@@ -122,6 +132,7 @@ class MicroBitMagnetometerService : public MicroBitBLEService
         mbbs_cIdxBEARING,
         mbbs_cIdxPERIOD,
         mbbs_cIdxCALIB,
+        mbbs_cIdxBATCH,
         mbbs_cIdxCOUNT
     } mbbs_cIdx;
     
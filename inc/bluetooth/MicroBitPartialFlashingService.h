@@ -46,6 +46,13 @@ DEALINGS IN THE SOFTWARE.
 #define REGION_INFO 0x00
 #define FLASH_DATA  0x01
 #define END_OF_TRANSMISSION 0x02
+#define PAGE_HASH   0x03
+
+// Number of 64 byte blocks a client may send before waiting for each to be acknowledged.
+// Advertised to clients in the MICROBIT_STATUS response. Must be less than 31.
+#ifndef MICROBIT_PARTIAL_FLASHING_WINDOW
+#define MICROBIT_PARTIAL_FLASHING_WINDOW 4
+#endif
 
 // BLE Utilities
 #define MICROBIT_STATUS 0xEE
@@ -102,12 +109,22 @@ class MicroBitPartialFlashingService : public MicroBitBLEService
     uint8_t packetCount = 0;
     uint8_t blockPacketCount = 0;
 
-    // Keep track of blocks of data
-    uint32_t block[16];
+    // A 64 byte block of data, and the address it is to be written to.
+    struct FlashBlock
+    {
+        uint32_t offset;
+        uint32_t data[16];
+    };
+
+    // Keep track of blocks of data. Complete blocks wait in the ring from blockTail until written,
+    // while the block at blockHead is being filled.
+    FlashBlock block[MICROBIT_PARTIAL_FLASHING_WINDOW];
     uint8_t  blockNum = 0;
-    uint32_t offset   = 0;
+    uint8_t  blockHead = 0;
+    uint8_t  blockTail = 0;
+    volatile uint8_t blockCount = 0;
     
-    uint8_t characteristicValue[ 20];
+    uint8_t characteristicValue[ MICROBIT_BLE_MAX_PAYLOAD];
 
     // Index for each charactersitic in arrays of handles and UUIDs
     typedef enum mbbs_cIdx
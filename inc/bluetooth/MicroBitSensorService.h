@@ -0,0 +1,138 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef MICROBIT_SENSOR_SERVICE_H
+#define MICROBIT_SENSOR_SERVICE_H
+
+#include "MicroBitConfig.h"
+
+#if CONFIG_ENABLED(DEVICE_BLE)
+
+#include "MicroBitBLEManager.h"
+#include "MicroBitBLEService.h"
+#include "MicroBitBLESampleBatch.h"
+#include "MicroBitAccelerometer.h"
+#include "MicroBitCompass.h"
+#include "MicroBitThermometer.h"
+#include "EventModel.h"
+
+// Bits of the sensors characteristic, selecting the values in each record of the data characteristic.
+// Values appear in each record in this order, after the record's time offset.
+#define MICROBIT_SENSOR_SERVICE_TEMPERATURE     0x01        // int8_t, degrees Celsius.
+#define MICROBIT_SENSOR_SERVICE_BUTTONS         0x02        // uint8_t, bit 0 set while button A is pressed, bit 1 for button B.
+#define MICROBIT_SENSOR_SERVICE_ACCELEROMETER   0x04        // int16_t X, Y and Z, in milli-g.
+#define MICROBIT_SENSOR_SERVICE_MAGNETOMETER    0x08        // int16_t X, Y and Z, as the magnetometer service reports them.
+#define MICROBIT_SENSOR_SERVICE_ALL             0x0F
+
+/**
+  * Class definition for the MicroBit BLE Sensor Service.
+  * Samples the thermometer, buttons, accelerometer and magnetometer together on a common clock, and notifies
+  * the samples as packed records on a single characteristic, as many to each notification as the MTU allows.
+  * This costs one notification per batch, rather than one for each sensor at each of their own rates.
+  */
+class MicroBitSensorService : public MicroBitBLEService
+{
+    public:
+
+    /**
+      * Constructor.
+      * Create a representation of the SensorService
+      * @param _ble The instance of a BLE device that we're running on.
+      * @param _accelerometer An instance of Accelerometer.
+      * @param _compass An instance of Compass.
+      * @param _thermometer An instance of MicroBitThermometer.
+      * @param _buttonA The button reported in bit 0 of the button state.
+      * @param _buttonB The button reported in bit 1 of the button state.
+      */
+    MicroBitSensorService( BLEDevice &_ble, codal::Accelerometer &_accelerometer, codal::Compass &_compass,
+                           MicroBitThermometer &_thermometer, codal::Button &_buttonA, codal::Button &_buttonB);
+
+    private:
+
+    /**
+      * Invoked when a client first uses the service on a connection.
+      */
+    void onActivate();
+
+    /**
+      * Invoked when the connection the service was activated on closes.
+      */
+    void onDeactivate();
+
+    /**
+      * Callback. Invoked when any of our attributes are written via BLE.
+      */
+    void onDataWritten( const microbit_ble_evt_write_t *params);
+
+    /**
+      * Starts or stops the sample clock.
+      */
+    void listen( bool yes);
+
+    /**
+      * Sample clock callback. Reads every selected sensor, and sends the batch when it is due.
+      */
+    void sample( MicroBitEvent e);
+
+    codal::Accelerometer    &accelerometer;
+    codal::Compass          &compass;
+    MicroBitThermometer     &thermometer;
+    codal::Button           &buttonA;
+    codal::Button           &buttonB;
+
+    // memory for our control characteristics.
+    uint16_t            sensorPeriodCharacteristicBuffer;
+    uint8_t             sensorSelectCharacteristicBuffer;
+
+    // The event value of our sample clock, on DEVICE_ID_NOTIFY.
+    uint16_t            clockEvent;
+
+    // Records collected for the data characteristic.
+    MicroBitBLESampleBatch  batch;
+
+    // Index for each charactersitic in arrays of handles and UUIDs
+    typedef enum mbbs_cIdx
+    {
+        mbbs_cIdxDATA,
+        mbbs_cIdxPERIOD,
+        mbbs_cIdxSENSORS,
+        mbbs_cIdxCOUNT
+    } mbbs_cIdx;
+
+    // UUIDs for our service and characteristics
+    static const uint16_t serviceUUID;
+    static const uint16_t charUUID[ mbbs_cIdxCOUNT];
+
+    // Data for each characteristic when they are held by Soft Device.
+    MicroBitBLEChar      chars[ mbbs_cIdxCOUNT];
+
+    public:
+
+    int              characteristicCount()          { return mbbs_cIdxCOUNT; };
+    MicroBitBLEChar *characteristicPtr( int idx)    { return &chars[ idx]; };
+};
+
+
+#endif
+#endif
@@ -59,14 +59,19 @@ class MicroBitTemperatureService : public MicroBitBLEService
     void listen( bool yes);
 
     /**
-      * Invoked when BLE connects.
+      * Invoked when a client first uses the service on a connection.
       */
-    void onConnect( const microbit_ble_evt_t *p_ble_evt);
+    void onActivate();
 
     /**
-      * Invoked when BLE disconnects.
+      * Invoked when the connection the service was activated on closes.
       */
-    void onDisconnect( const microbit_ble_evt_t *p_ble_evt);
+    void onDeactivate();
+
+    /**
+      * Callback. Invoked when a live value is read, with MICROBIT_BLE_LAZY_SERVICES enabled.
+      */
+    void onDataRead( microbit_onDataRead_t *params);
 
     /**
       * Callback. Invoked when any of our attributes are written via BLE.
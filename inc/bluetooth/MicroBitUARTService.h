@@ -34,7 +34,9 @@ DEALINGS IN THE SOFTWARE.
 #include "MicroBitBLEService.h"
 #include "MicroBitSerial.h"
 
+#ifndef MICROBIT_UART_S_DEFAULT_BUF_SIZE
 #define MICROBIT_UART_S_DEFAULT_BUF_SIZE    20
+#endif
 
 #define MICROBIT_UART_S_EVT_DELIM_MATCH     1
 #define MICROBIT_UART_S_EVT_HEAD_MATCH      2
@@ -51,11 +53,11 @@ class MicroBitUARTService : public MicroBitBLEService
 
     uint8_t* txBuffer;
 
-    uint8_t rxBufferHead;
-    uint8_t rxBufferTail;
-    uint8_t rxBufferSize;
+    volatile uint16_t rxBufferHead;
+    volatile uint16_t rxBufferTail;
+    uint16_t rxBufferSize;
 
-    uint8_t txBufferSize;
+    uint16_t txBufferSize;
 
     uint32_t rxCharacteristicHandle;
 
@@ -65,11 +67,14 @@ class MicroBitUARTService : public MicroBitBLEService
     //a variable used when a user calls the eventAfter() method.
     int rxBuffHeadMatch;
     
-    uint8_t txBufferHead;
-    uint8_t txBufferTail;
+    uint16_t txBufferHead;
+    uint16_t txBufferTail;
 
     // the number of bytes from the tx buffer that have been sent, pending confirmation
-    uint8_t txValueSize;
+    uint16_t txValueSize;
+
+    // the number of notifications queued in the SoftDevice, pending transmission
+    uint8_t txNotifyPending;
 
     bool waitingForEmpty;
 
@@ -82,6 +87,11 @@ class MicroBitUARTService : public MicroBitBLEService
       * A callback function for whenever a Bluetooth device consumes our TX Buffer
       */
     void onConfirmation( const microbit_ble_evt_hvc_t *params);
+
+    /**
+      * A callback function for whenever queued notifications have been transmitted
+      */
+    void onNotificationComplete( const microbit_ble_evt_hvn_tx_complete_t *params);
     
     
     /**
@@ -90,18 +100,13 @@ class MicroBitUARTService : public MicroBitBLEService
     void onDataWritten(const microbit_ble_evt_write_t *params);
 
     /**
-      * An internal method that copies values from a circular buffer to a linear buffer.
+      * An internal method that finds the first received character matching one of the given delimeters.
       *
-      * @param circularBuff a pointer to the source circular buffer
-      * @param circularBuffSize the size of the circular buffer
-      * @param linearBuff a pointer to the destination linear buffer
-      * @param tailPosition the tail position in the circular buffer you want to copy from
-      * @param headPosition the head position in the circular buffer you want to copy to
+      * @param delimeters the characters to match against
       *
-      * @note this method assumes that the linear buffer has the appropriate amount of
-      *       memory to contain the copy operation
+      * @return the offset of the match from the start of the unread data, or -1 if there is no match.
       */
-    void circularCopy(uint8_t *circularBuff, uint8_t circularBuffSize, uint8_t *linearBuff, uint16_t tailPosition, uint16_t headPosition);
+    int findDelimeter(ManagedString delimeters);
 
     /**
       * An internal method that sends the next block from the tx buffer.
@@ -109,6 +114,25 @@ class MicroBitUARTService : public MicroBitBLEService
       */
     bool sendNext();
 
+    /**
+      * An internal method that queues notifications from the tx buffer until it is empty
+      * or the SoftDevice queue is full.
+      * @return true if at least one notification is queued
+      */
+    bool sendNotifications();
+
+    /**
+      * Determines if the connected device has subscribed to the TX characteristic.
+      * @return true if indications or notifications are enabled.
+      */
+    bool txEnabled();
+
+    /**
+      * Determines if data should be sent with notifications, rather than indications.
+      * @return true if the connected device has enabled notifications and not indications.
+      */
+    bool notifyMode();
+
     public:
 
     /**
@@ -117,9 +141,10 @@ class MicroBitUARTService : public MicroBitBLEService
      * @param rxBufferSize the size of the rxBuffer
      * @param txBufferSize the size of the txBuffer
      *
-     * @note The default size is MICROBIT_UART_S_DEFAULT_BUF_SIZE (20 bytes).
+     * @note The default size is MICROBIT_UART_S_DEFAULT_BUF_SIZE (20 bytes). Sizes of several
+     *       packets allow bulk transfers from the connected device without dropping data.
      */
-    MicroBitUARTService(BLEDevice &_ble, uint8_t rxBufferSize = MICROBIT_UART_S_DEFAULT_BUF_SIZE, uint8_t txBufferSize = MICROBIT_UART_S_DEFAULT_BUF_SIZE);
+    MicroBitUARTService(BLEDevice &_ble, uint16_t rxBufferSize = MICROBIT_UART_S_DEFAULT_BUF_SIZE, uint16_t txBufferSize = MICROBIT_UART_S_DEFAULT_BUF_SIZE);
 
     /**
       * Retreives a single character from our RxBuffer.
@@ -156,7 +181,7 @@ class MicroBitUARTService : public MicroBitBLEService
       *                         device.
       *
       * @return the number of characters written, or MICROBIT_NOT_SUPPORTED if there is
-      *         no connected device, or the connected device has not enabled indications.
+      *         no connected device, or the connected device has not enabled indications or notifications.
       */
     int putc(char c, MicroBitSerialMode mode = SYNC_SLEEP);
 
@@ -178,7 +203,7 @@ class MicroBitUARTService : public MicroBitBLEService
       *                         device.
       *
       * @return the number of characters written, or MICROBIT_NOT_SUPPORTED if there is
-      *         no connected device, or the connected device has not enabled indications.
+      *         no connected device, or the connected device has not enabled indications or notifications.
       */
     int send(const uint8_t *buf, int length, MicroBitSerialMode mode = SYNC_SLEEP);
 
@@ -199,7 +224,7 @@ class MicroBitUARTService : public MicroBitBLEService
       *                         device.
       *
       * @return the number of characters written, or MICROBIT_NOT_SUPPORTED if there is
-      *         no connected device, or the connected device has not enabled indications.
+      *         no connected device, or the connected device has not enabled indications or notifications.
       */
     int send(ManagedString s, MicroBitSerialMode mode = SYNC_SLEEP);
 
@@ -318,6 +343,37 @@ class MicroBitUARTService : public MicroBitBLEService
       * @return The currently buffered number of bytes in our txBuff.
       */
     int txBufferedSize();
+
+    /**
+      * Provides direct access to the received data at the front of our rxBuff, without copying it.
+      * Data that wraps around the end of the buffer is returned by a further call, once this region has
+      * been released with consume().
+      *
+      * @param data set to point to the first unread character.
+      *
+      * @return the number of contiguous characters available at data, or 0 if there are none.
+      *
+      * @code
+      * const uint8_t *data;
+      * int len;
+      *
+      * while ((len = uart.readSpan(&data)) > 0)
+      * {
+      *     process(data, len);
+      *     uart.consume(len);
+      * }
+      * @endcode
+      */
+    int readSpan(const uint8_t **data);
+
+    /**
+      * Releases characters from the front of our rxBuff, typically after processing them through readSpan().
+      *
+      * @param len the number of characters to release.
+      *
+      * @return the number of characters released, which is less than len if fewer were buffered.
+      */
+    int consume(int len);
     
     // Index for each charactersitic in arrays of handles and UUIDs
     typedef enum mbbs_cIdx
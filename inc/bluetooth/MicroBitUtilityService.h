@@ -104,6 +104,12 @@ class MicroBitUtilityService : public MicroBitBLEService
      */
     void onDataWritten(const microbit_ble_evt_write_t *params);
 
+    /**
+     * Callback. Invoked when queued notifications have been transmitted.
+     * Resume a log stream that was waiting for space in the SoftDevice queue.
+     */
+    void onNotificationComplete( const microbit_ble_evt_hvn_tx_complete_t *params);
+
     /**
      * Callback. Invoked when a registered event occurs.
      */
@@ -115,7 +121,7 @@ class MicroBitUtilityService : public MicroBitBLEService
     MicroBitStorage     &storage;
     MicroBitLog         &log;
 
-    uint8_t characteristicValue[ 20];
+    uint8_t characteristicValue[ MICROBIT_BLE_MAX_PAYLOAD];
 
     // Index for each charactersitic in arrays of handles and UUIDs
     typedef enum mbbs_cIdx
@@ -170,6 +176,24 @@ class MicroBitUtilityService : public MicroBitBLEService
      * @return DEVICE_OK if finished
      */
     int processLogRead();
+
+    /**
+     * Process request typeLogStream
+     * @return DEVICE_OK if finished, or DEVICE_BUSY to resume when queued notifications have been sent
+     */
+    int processLogStream();
+
+    /**
+     * Process request typeLogSync
+     * @return DEVICE_OK if finished
+     */
+    int processLogSync();
+
+    /**
+     * Process request typeLogCRC
+     * @return DEVICE_OK if finished
+     */
+    int processLogCRC();
 };
 
 
@@ -26,6 +26,7 @@ DEALINGS IN THE SOFTWARE.
 #define MICROBIT_UTILITY_TYPES_H
 
 #include <stdint.h>
+#include "MicroBitConfig.h"
 
 /* Define types for the MicroBitUtilityService
  *
@@ -36,7 +37,7 @@ DEALINGS IN THE SOFTWARE.
  *
  * reply_t    - Reply from service to client.
  *              job   (1 byte)          - see below
- *              data  (up to 19 bytes)  - depends on request type
+ *              data  (up to 19 bytes, or the negotiated ATT MTU - 4)  - depends on request type
  *
  * job        - Synchronize requests and replies.
  *              Enables the client to ignore replies to a previous request, and detect missing reply packets.
@@ -58,6 +59,38 @@ DEALINGS IN THE SOFTWARE.
  *              length    (4 bytes)         - length of whole file, from request type 1 (Log file length)
  * reply        data      (up to 19 bytes)  - 1 or more reply packets, to total batchlen bytes
  *
+ * type 3     - Log file stream
+ * request      format    (1 byte)          - 0 = HTML header; 1 = HTML; 2 = CSV
+ *              flags     (1 byte)          - bit 0 (streamFlagRLE) = run length encode the data
+ *              index     (4 bytes)         - unsigned integer index into file to start from, e.g. the length
+ *                                            previously downloaded, to fetch only the rows added since
+ *              length    (4 bytes)         - length of whole file, from request type 1, or zero for the current length
+ * reply        data      (up to 19 bytes, or the negotiated ATT MTU - 4)
+ *                                          - a reply packet for each block of data from index to the end of the file,
+ *                                            sent without waiting for further requests, followed by a reply packet
+ *                                            with no data to mark the end of the stream.
+ *                                            With streamFlagRLE, a run of bytes is sent as streamRLEEscape, count
+ *                                            (1 byte), value. The escape value never occurs in UTF-8 text. Runs do
+ *                                            not span packets.
+ *
+ * type 4     - Log file sync state
+ * request      format    (1 byte)          - 0 = HTML header; 1 = HTML; 2 = CSV
+ * reply        sequence  (4 bytes)         - unsigned integer that increases whenever data is added to the log.
+ *                                            A lower value than seen before means the log has been cleared.
+ *              length    (4 bytes)         - unsigned integer log data length, as for request type 1
+ *
+ * type 5     - Log file data CRC
+ * request      format    (1 byte)          - 0 = HTML header; 1 = HTML; 2 = CSV
+ *              reserved  (1 byte)          - set to zero
+ *              index     (4 bytes)         - unsigned integer index into file
+ *              batchlen  (4 bytes)         - unsigned size in bytes to include
+ *              length    (4 bytes)         - length of whole file, from request type 1 or 4
+ * reply        crc       (4 bytes)         - CRC32 of the data, as would be returned by request type 2
+ *
+ * To sync a copy of the log after reconnecting, a host requests the sync state. If the sequence number is
+ * unchanged, its copy is current. Otherwise it requests the CRC of each block of its copy, fetches only the
+ * blocks that differ, then streams from the end of its copy to fetch the rows added since.
+ *
  */
 namespace MicroBitUtility
 {
@@ -65,7 +98,10 @@ namespace MicroBitUtility
     {
         requestTypeNone,
         requestTypeLogLength,           // reply data = 4 bytes log data length
-        requestTypeLogRead              // reply data = up to 19 bytes of log data
+        requestTypeLogRead,             // reply data = up to 19 bytes of log data, more if a larger ATT MTU is negotiated
+        requestTypeLogStream,           // reply data = log data from index to the end, in as many packets as needed
+        requestTypeLogSync,             // reply data = 4 bytes sequence number, 4 bytes log data length
+        requestTypeLogCRC               // reply data = 4 bytes CRC32 of a range of log data
     } requestType_t;
 
     typedef struct request_t
@@ -79,7 +115,7 @@ namespace MicroBitUtility
     {
         uint8_t  job;                   // Service cycles low nibble i.e client job + { 0x00, 0x01, 0x02, ..., 0x0E, 0x00, ... }
                                         // low nibble == 0x0F (jobLowERR) indicates error and data = 4 bytes signed integer error
-        uint8_t  data[19];
+        uint8_t  data[ MICROBIT_BLE_MAX_PAYLOAD - 1];
     } reply_t;
     
     typedef enum requestLogFormat
@@ -106,6 +142,19 @@ namespace MicroBitUtility
         uint32_t batchlen;              // size in bytes to return
         uint32_t length;                // length of whole file, from requestTypeLogLength
     } requestLogRead_t;
+
+    typedef struct requestLogStream_t
+    {
+        uint8_t  job;
+        uint8_t  type;                  // requestType_t
+        uint8_t  format;                // requestLogFormat
+        uint8_t  flags;                 // streamFlag...
+        uint32_t index;                 // index into data to start from
+        uint32_t length;                // length of whole file, from requestTypeLogLength, or zero for the current length
+    } requestLogStream_t;
+
+    const uint8_t streamFlagRLE = 0x01;
+    const uint8_t streamRLEEscape = 0xFF;
     
     const uint8_t jobLowMAX = 0x0E;
     const uint8_t jobLowERR = 0x0F;     // reply data = 4 bytes signed integer error
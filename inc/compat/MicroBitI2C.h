@@ -27,9 +27,33 @@ DEALINGS IN THE SOFTWARE.
 
 #include "MicroBitCompat.h"
 
+// Record per address transaction counts, byte counts and bus busy time on each MicroBitI2C bus.
+// This adds two timer reads to every transaction, so is disabled by default.
+#ifndef CONFIG_MICROBIT_I2C_STATS
+#define CONFIG_MICROBIT_I2C_STATS 0
+#endif
+
+// The number of distinct device addresses tracked per bus. Transactions to further addresses are only counted in the totals.
+#ifndef CONFIG_MICROBIT_I2C_STATS_ADDRESSES
+#define CONFIG_MICROBIT_I2C_STATS_ADDRESSES 6
+#endif
+
 namespace codal
 {
 
+/**
+  * Bus utilisation statistics for one I2C device address. All times are in microseconds.
+  */
+struct MicroBitI2CStats
+{
+    uint16_t            address;                // The (8 bit) address of the device, or 0 for the totals of the whole bus.
+    uint32_t            transactions;           // The number of transactions addressed to the device.
+    uint32_t            errors;                 // The number of those transactions that failed.
+    uint32_t            bytes;                  // The number of data bytes read and written, including register addresses.
+    uint32_t            busyTime;               // The total time spent in transactions.
+    uint32_t            maxTime;                // The longest single transaction.
+};
+
 /**
   * Class definition for MicroBit I2C
   *
@@ -70,6 +94,109 @@ class MicroBitI2C : public NRF52I2C
       */
      MicroBitI2C(PinNumber sda, PinNumber scl);
 
+#if CONFIG_ENABLED(CONFIG_MICROBIT_I2C_STATS)
+    /**
+      * Issues a write command, recording its duration against the given address.
+      *
+      * @param address The 8-bit I2C address of the device to write to
+      * @param data pointer to the bytes to write
+      * @param len the number of bytes to write
+      * @param repeated Suppresses the generation of a STOP condition if set. Default: false;
+      *
+      * @return DEVICE_OK on success, DEVICE_I2C_ERROR if the the write request failed.
+      */
+    virtual int write(uint16_t address, uint8_t *data, int len, bool repeated = false) override;
+
+    /**
+      * Issues a read command, recording its duration against the given address.
+      *
+      * @param address The 8-bit I2C address of the device to read from
+      * @param data pointer to store the bytes read
+      * @param len the number of bytes to read
+      * @param repeated Suppresses the generation of a STOP condition if set. Default: false;
+      *
+      * @return DEVICE_OK on success, DEVICE_I2C_ERROR if the the read request failed.
+      */
+    virtual int read(uint16_t address, uint8_t *data, int len, bool repeated = false) override;
+
+    /**
+      * Writes a single byte to a register, recording its duration against the given address.
+      *
+      * @param address The 8-bit I2C address of the device to write to
+      * @param reg The address of the register to write to.
+      * @param value The value to write.
+      *
+      * @return DEVICE_OK on success, DEVICE_I2C_ERROR if the the write request failed.
+      */
+    virtual int writeRegister(uint16_t address, uint8_t reg, uint8_t value) override;
+
+    /**
+      * Reads from a register, recording the duration of the whole combined transaction against the given address.
+      *
+      * @param address The 8-bit I2C address of the device to read from
+      * @param reg The first register to read.
+      * @param data pointer to store the bytes read
+      * @param length the number of bytes to read
+      * @param repeated Use a repeated START between the register write and the read. Default: true;
+      *
+      * @return DEVICE_OK on success, DEVICE_I2C_ERROR if the the read request failed.
+      */
+    virtual int readRegister(uint16_t address, uint8_t reg, uint8_t *data, int length, bool repeated = true) override;
+#endif
+
+    /**
+      * Determines the statistics recorded for one device address.
+      *
+      * @param address The 8-bit I2C address of the device, or 0 for the totals of the whole bus.
+      *
+      * @return the statistics for the given address, or NULL if no transactions have been recorded for it,
+      * or if CONFIG_MICROBIT_I2C_STATS is disabled.
+      */
+    MicroBitI2CStats *getStats(uint16_t address = 0);
+
+    /**
+      * Determines the proportion of time the bus has been busy since statistics were last reset.
+      *
+      * @return the bus utilisation in hundredths of a percent (0..10000), or 0 if CONFIG_MICROBIT_I2C_STATS is disabled.
+      */
+    int getUtilisation();
+
+    /**
+      * Clears all statistics, and starts a new measurement window for getUtilisation().
+      */
+    void resetStats();
+
+    /**
+      * Writes the statistics of each device address to DMESG.
+      *
+      * @param name The name of the bus, to prefix the output with.
+      */
+    void printStats(const char *name);
+
+#if CONFIG_ENABLED(CONFIG_MICROBIT_I2C_STATS)
+    private:
+    MicroBitI2CStats        total;                                          // Totals for the whole bus.
+    MicroBitI2CStats        stats[CONFIG_MICROBIT_I2C_STATS_ADDRESSES];     // Per address statistics, in order of first use.
+    CODAL_TIMESTAMP         windowStart;                                    // The time at which statistics were last reset.
+    int                     depth;                                          // Nesting of transactions, so that a readRegister() implemented through read() and write() is counted once.
+
+    /**
+      * Marks the start of a transaction.
+      *
+      * @return a timestamp to pass to end().
+      */
+    CODAL_TIMESTAMP begin();
+
+    /**
+      * Records a completed transaction.
+      *
+      * @param address The 8-bit I2C address of the device.
+      * @param bytes The number of bytes transferred.
+      * @param start The timestamp returned by begin().
+      * @param result The result of the transaction.
+      */
+    void end(uint16_t address, int bytes, CODAL_TIMESTAMP start, int result);
+#endif
 };
 
 }
@@ -47,6 +47,10 @@ static const uint32_t reflash_status = 0xffffffff;
 
 static volatile MicroBitNoInitMemoryRegion __attribute__ ((section (".noinit"))) microbit_no_init_memory_region;
 
+static const char *boot_phase_names[MICROBIT_BOOT_PHASE_COUNT] = {
+    "init", "kl27", "bootloader", "storage", "scheduler", "components", "irq", "pairing", "ble", "complete"
+};
+
 /**
   * Constructor.
   *
@@ -70,6 +74,7 @@ MicroBit::MicroBit() :
     touchSensor(capTouchTimer),
     io(adc, touchSensor),
     serial(io.usbTx, io.usbRx, NRF_UARTE0),
+    serialQueue(serial),
     _i2c(io.sda, io.scl),
     i2c(io.P20, io.P19),
     power(_i2c, io, systemTimer),
@@ -89,12 +94,14 @@ MicroBit::MicroBit() :
     thermometer(),
     accelerometer(MicroBitAccelerometer::autoDetect(_i2c)),
     compass(MicroBitCompass::autoDetect(_i2c)),
+    irqDispatcher(io.irq1),
     compassCalibrator(compass, accelerometer, display, storage),
     audio(io.P0, io.speaker, adc, io.microphone, io.runmic),
-    log(flash, power, serial)
+    log(flash, power, serialQueue)
 {
     // Clear our status
     status = 0;
+    interfaceReadyTime = 0;
 
     /*
     // Ensure NFC pins are configured as GPIO. If not, update the non-volatile UICR.
@@ -161,18 +168,30 @@ MicroBit::MicroBit() :
   * @note This method must be called before user code utilises any functionality
   *       contained within the GenuinoZero class.
   */
-int MicroBit::init()
+MICROBIT_COLDFUNC int MicroBit::init()
 {
     if (status & DEVICE_INITIALIZED)
         return DEVICE_NOT_SUPPORTED;
 
     status |= DEVICE_INITIALIZED;
 
+#if CONFIG_ENABLED(MICROBIT_BOOT_PROFILE)
+    microbit_no_init_memory_region.bootProfile.magic = MICROBIT_BOOT_PROFILE_MAGIC;
+    microbit_no_init_memory_region.bootProfile.phases = 0;
+#endif
+    recordBootPhase(MICROBIT_BOOT_PHASE_INIT);
+
     // On a hard reset, wait for the USB interface chip to come online.
     if(NRF_POWER->RESETREAS == 0)
     {
         microbit_no_init_memory_region.resetClickCount = 0;
+#if CONFIG_ENABLED(MICROBIT_FAST_BOOT)
+        // Carry on with anything that doesn't need the interface chip, and wait out the remainder on first use.
+        interfaceReadyTime = system_timer_current_time_us() + KL27_POWER_ON_DELAY * 1000;
+#else
         target_wait(KL27_POWER_ON_DELAY);
+        recordBootPhase(MICROBIT_BOOT_PHASE_KL27);
+#endif
     }
     else
     {
@@ -183,19 +202,21 @@ int MicroBit::init()
     // Ensure BLE bootloader settings are up to date.
     // n.b. this only performs a write operation if the settings stored in FLASH are out of date.
     MicroBitPartialFlashingService::validateBootloaderSettings();
+    recordBootPhase(MICROBIT_BOOT_PHASE_BOOTLOADER);
 #endif
 
     // Determine if we have been reprogrammed. If so, follow configured policy on erasing any persistent user data.
     eraseUserStorage();
+    recordBootPhase(MICROBIT_BOOT_PHASE_STORAGE);
 
     // Bring up fiber scheduler.
     scheduler_init(messageBus);
+    recordBootPhase(MICROBIT_BOOT_PHASE_SCHEDULER);
 
-    for(int i = 0; i < DEVICE_COMPONENT_COUNT; i++)
-    {
-        if(CodalComponent::components[i])
-            CodalComponent::components[i]->init();
-    }
+    // In a fast boot, components are initialised on first use, or once the scheduler first idles.
+#if !CONFIG_ENABLED(MICROBIT_FAST_BOOT)
+    initComponents();
+#endif
 
     // Seed our random number generator
     seedRandom();
@@ -213,24 +234,14 @@ int MicroBit::init()
     status |= DEVICE_COMPONENT_STATUS_IDLE_TICK;
     status |= DEVICE_COMPONENT_STATUS_SYSTEM_TICK;
 
-    // Set IRQ priorities for peripherals we use.
-    // Note that low values have highest priority, and only 2, 3, 4, 5 and 7 are available with SoftDevice enabled.
-
-    NVIC_SetPriority(TIMER1_IRQn, 7);         // System timer (general purpose)
-    NVIC_SetPriority(TIMER2_IRQn, 5);         // ADC timer.
-    NVIC_SetPriority(TIMER3_IRQn, 3);         // Cap touch.
-    NVIC_SetPriority(TIMER4_IRQn, 3);         // Display and Light Sensing.
-
-    NVIC_SetPriority(SAADC_IRQn, 5);          // Analogue to Digital Converter (microphone etc)
-    NVIC_SetPriority(PWM0_IRQn, 5);           // General Purpose PWM on edge connector (servo, square wave sounds)
-    NVIC_SetPriority(PWM1_IRQn, 4);           // PCM audio on speaker (high definition sound)
-    NVIC_SetPriority(PWM2_IRQn, 3);           // Waveform Generation (neopixel)
+    // Set IRQ priorities for peripherals we use, from the selected profile and any overrides.
+    // See MicroBitIrqPriority.h.
+    microbit_irq_apply();
 
-    NVIC_SetPriority(RADIO_IRQn, 4);          // Packet radio
-    NVIC_SetPriority(UARTE0_UART0_IRQn, 2);   // Serial port
-    NVIC_SetPriority(GPIOTE_IRQn, 2);         // Pin interrupt events
-
-    power.readInterfaceRequest();
+    // The IRQ line is arbitrated with the help of the interface chip. In a fast boot, bring up Bluetooth first.
+#if !CONFIG_ENABLED(MICROBIT_FAST_BOOT)
+    initIrqDispatcher();
+#endif
 
 #if CONFIG_ENABLED(DEVICE_BLE) && CONFIG_ENABLED(MICROBIT_BLE_PAIRING_MODE)
     int i=0;
@@ -238,7 +249,6 @@ int MicroBit::init()
     // If a RebootMode Key has been set boot straight into BLE mode
     KeyValuePair* RebootMode = storage.get("RebootMode");
     KeyValuePair* flashIncomplete = storage.get("flashIncomplete");
-    sleep(100);
     // Animation
     uint8_t x = 0; uint8_t y = 0;
     bool triple_reset = 0;
@@ -247,6 +257,14 @@ int MicroBit::init()
     triple_reset = (microbit_no_init_memory_region.resetClickCount == 3);
 #endif
 
+#if CONFIG_ENABLED(MICROBIT_FAST_BOOT)
+    // Only give the buttons time to settle if both are already held down.
+    if (io.P5.getDigitalValue() == 0 && io.P11.getDigitalValue() == 0)
+        sleep(100);
+#else
+    sleep(100);
+#endif
+
     while (((triple_reset || (buttonA.isPressed() && buttonB.isPressed())) && i<25) || RebootMode != NULL || flashIncomplete != NULL)
     {
         display.image.setPixelValue(x,y,255);
@@ -280,6 +298,8 @@ int MicroBit::init()
             bleManager.pairingMode(display, buttonA);
         }
     }
+
+    recordBootPhase(MICROBIT_BOOT_PHASE_PAIRING);
 #endif
 
 #if CONFIG_ENABLED(DEVICE_BLE) && CONFIG_ENABLED(MICROBIT_BLE_ENABLED)
@@ -299,12 +319,142 @@ int MicroBit::init()
     NRF_CLOCK->TASKS_HFCLKSTART = 1;
     while (NRF_CLOCK->EVENTS_HFCLKSTARTED == 0);
 #endif
+    recordBootPhase(MICROBIT_BOOT_PHASE_BLE);
 
+#if CONFIG_ENABLED(MICROBIT_FAST_BOOT)
+    initIrqDispatcher();
+#else
     // Deschedule for a little while, just to allow for any components that finialise initialisation
     // as a background task, and to allow the power mamanger to repsonse to background events from the KL27
     // before any user code begins running.
     
     sleep(10);
+#endif
+
+    recordBootPhase(MICROBIT_BOOT_PHASE_COMPLETE);
+
+    return DEVICE_OK;
+}
+
+/**
+  * Calls init() on every registered CodalComponent, if this has not already been done.
+  */
+MICROBIT_COLDFUNC void MicroBit::initComponents()
+{
+    if (status & MICROBIT_COMPONENTS_INITIALIZED)
+        return;
+
+    status |= MICROBIT_COMPONENTS_INITIALIZED;
+
+    for(int i = 0; i < DEVICE_COMPONENT_COUNT; i++)
+    {
+        if(CodalComponent::components[i])
+            CodalComponent::components[i]->init();
+    }
+
+    recordBootPhase(MICROBIT_BOOT_PHASE_COMPONENTS);
+}
+
+/**
+  * Registers the sources of the combined IRQ line, and starts arbitrating it.
+  */
+MICROBIT_COLDFUNC void MicroBit::initIrqDispatcher()
+{
+    // Arbitrate the combined IRQ line, checking the cheapest sources first: a pending KL27 transaction
+    // needs no I2C at all, the motion sensors a single register read, and a KL27 request a full UIPM exchange.
+    irqDispatcher.addSource(MicroBitPowerManager::irqAwaitingResponse, &power);
+
+    if (LSM303Accelerometer::isDetected(_i2c, LSM303_A_DEFAULT_ADDR))
+    {
+        irqDispatcher.addSource(MicroBitAccelerometer::irqDataReady);
+        irqDispatcher.addSource(MicroBitCompass::irqDataReady);
+    }
+
+    irqDispatcher.addSource(MicroBitPowerManager::irqInterfaceRequest, &power);
+    power.setIrqDispatched(true);
+
+    awaitInterfaceChip();
+    power.readInterfaceRequest();
+    irqDispatcher.start();
+
+    recordBootPhase(MICROBIT_BOOT_PHASE_IRQ);
+}
+
+/**
+  * Waits for the remainder of the power on delay of the interface chip, if one is outstanding.
+  */
+void MicroBit::awaitInterfaceChip()
+{
+    if (interfaceReadyTime == 0)
+        return;
+
+    CODAL_TIMESTAMP now = system_timer_current_time_us();
+
+    if (now < interfaceReadyTime)
+        sleep((uint32_t)((interfaceReadyTime - now + 999) / 1000));
+
+    interfaceReadyTime = 0;
+    recordBootPhase(MICROBIT_BOOT_PHASE_KL27);
+}
+
+/**
+  * Records the completion of a phase of init() in the boot profile.
+  *
+  * @param phase The phase completed, one of MICROBIT_BOOT_PHASE_*.
+  */
+void MicroBit::recordBootPhase(int phase)
+{
+#if CONFIG_ENABLED(MICROBIT_BOOT_PROFILE)
+    microbit_no_init_memory_region.bootProfile.time[phase] = (uint32_t) system_timer_current_time_us();
+    microbit_no_init_memory_region.bootProfile.phases |= (1 << phase);
+#endif
+}
+
+/**
+  * Determines when a phase of the most recent call to init() completed.
+  *
+  * @param phase The phase of interest, one of MICROBIT_BOOT_PHASE_*.
+  *
+  * @return The time the phase completed, in microseconds since reset, DEVICE_INVALID_PARAMETER if phase
+  *         is out of range, or DEVICE_NO_DATA if the phase was not recorded.
+  */
+int MicroBit::getBootPhaseTime(int phase)
+{
+    if (phase < 0 || phase >= MICROBIT_BOOT_PHASE_COUNT)
+        return DEVICE_INVALID_PARAMETER;
+
+    if (microbit_no_init_memory_region.bootProfile.magic != MICROBIT_BOOT_PROFILE_MAGIC || !(microbit_no_init_memory_region.bootProfile.phases & (1 << phase)))
+        return DEVICE_NO_DATA;
+
+    return (int) microbit_no_init_memory_region.bootProfile.time[phase];
+}
+
+/**
+  * Prints the time at which each phase of the most recent call to init() completed, and the time spent in it,
+  * to the serial port.
+  *
+  * @return DEVICE_OK on success, or DEVICE_NOT_SUPPORTED if no boot profile has been recorded.
+  */
+MICROBIT_COLDFUNC int MicroBit::printBootProfile()
+{
+    if (microbit_no_init_memory_region.bootProfile.magic != MICROBIT_BOOT_PROFILE_MAGIC)
+        return DEVICE_NOT_SUPPORTED;
+
+    uint32_t last = 0;
+
+    for (int i = 0; i < MICROBIT_BOOT_PHASE_COUNT; i++)
+    {
+        int t = getBootPhaseTime(i);
+
+        if (t < 0)
+        {
+            serial.printf("BOOT %s: -\r\n", boot_phase_names[i]);
+            continue;
+        }
+
+        serial.printf("BOOT %s: %d us (+%d us)\r\n", boot_phase_names[i], t, (int)((uint32_t)t - last));
+        last = (uint32_t)t;
+    }
 
     return DEVICE_OK;
 }
@@ -326,6 +476,8 @@ void MicroBit::onP0ListenerRegisteredEvent(Event evt)
   */
 void MicroBit::onListenerRegisteredEvent(Event evt)
 {
+    initComponents();
+
     switch(evt.value)
     {
         case DEVICE_ID_BUTTON_AB:
@@ -369,13 +521,13 @@ void MicroBit::onListenerRegisteredEvent(Event evt)
             // The level detector uses lazy instantiation, we just need to read the data once to start it running.
             //audio.level->getValue();
             // The level detector requires that we enable constant listening, otherwise no events will be emitted.
-            audio.levelSPL->activateForEvents( true );
+            audio.getLevelSPL()->activateForEvents( true );
             break;
 
         case DEVICE_ID_MICROPHONE:
             // A listener has been registered for the level detector SPL.
             // The level detector SPL uses lazy instantiation, we just need to read the data once to start it running.
-            audio.levelSPL->getValue();
+            audio.getLevelSPL()->getValue();
             break;
     }
 }
@@ -386,24 +538,45 @@ void MicroBit::onListenerRegisteredEvent(Event evt)
 */
 void MicroBit::schedulerIdle()
 {
+#if CONFIG_ENABLED(CONFIG_MICROBIT_SCHEDULER_TRACE)
+    uint32_t start = (uint32_t) system_timer_current_time_us();
+#endif
+    int reason = MICROBIT_TRACE_WAIT_EVENT;
+
     if ( power.waitingForDeepSleep())
     {
 #if CONFIG_ENABLED(DEVICE_BLE) && CONFIG_ENABLED(MICROBIT_BLE_ENABLED)
         if ( bleManager.getConnected())
         {
             power.cancelDeepSleep();
-            target_wait_for_event();
+            power.waitForEvent();
+#if CONFIG_ENABLED(CONFIG_MICROBIT_SCHEDULER_TRACE)
+            microbit_trace_wait(MICROBIT_TRACE_WAIT_BLE_CONNECTED, start);
+#endif
             return;
         }
 #endif
         if ( power.readyForDeepSleep())
         {
             if ( power.startDeepSleep() == DEVICE_OK)
+            {
+#if CONFIG_ENABLED(CONFIG_MICROBIT_SCHEDULER_TRACE)
+                microbit_trace_wait(MICROBIT_TRACE_WAIT_DEEPSLEEP, start);
+#endif
                 return;
+            }
         }
+
+        reason = MICROBIT_TRACE_WAIT_NOT_READY;
     }
 
-    target_wait_for_event();
+    power.waitForEvent();
+
+#if CONFIG_ENABLED(CONFIG_MICROBIT_SCHEDULER_TRACE)
+    microbit_trace_wait(reason, start);
+#else
+    (void)reason;
+#endif
 }
 
 /**
@@ -413,6 +586,15 @@ void MicroBit::schedulerIdle()
   */
 void MicroBit::idleCallback()
 {
+    MICROBIT_TRACE_IDLE(CodalComponent::id);
+
+#if CONFIG_ENABLED(CONFIG_MICROBIT_SCHEDULER_TRACE)
+    microbit_trace_queue(messageBus);
+#endif
+
+    // Complete any initialisation deferred by a fast boot.
+    initComponents();
+
 #if CONFIG_ENABLED(DMESG_SERIAL_DEBUG)
 #if DEVICE_DMESG_BUFFER_SIZE > 0
     codal_dmesg_flush();
@@ -442,7 +624,7 @@ void MicroBit::periodicCallback()
  *
  * @param forceErase Force an erase of user data, even if we have not detected a reflash event.
  */
-void MicroBit::eraseUserStorage(bool forceErase)
+MICROBIT_COLDFUNC void MicroBit::eraseUserStorage(bool forceErase)
 {
     uint32_t zero = 0;
     uint32_t reset_value;
@@ -460,6 +642,7 @@ void MicroBit::eraseUserStorage(bool forceErase)
 
     // Determine if our flash contains a recognised file system. If so, invalidate it.
 #if CONFIG_ENABLED(CONFIG_MICROBIT_ERASE_USER_DATA_ON_REFLASH)
+    awaitInterfaceChip();
     log.invalidate();
 #endif
 }
@@ -470,8 +653,7 @@ void microbit_dmesg_flush()
 #if DEVICE_DMESG_BUFFER_SIZE > 0
     if (codalLogStore.ptr > 0 && microbit_device_instance)
     {
-        for (uint32_t i=0; i<codalLogStore.ptr; i++)
-            ((MicroBit *)microbit_device_instance)->serial.putc(codalLogStore.buffer[i]);
+        ((MicroBit *)microbit_device_instance)->serialQueue.send((uint8_t *)codalLogStore.buffer, codalLogStore.ptr);
 
         codalLogStore.ptr = 0;
     }
@@ -62,10 +62,20 @@ DEALINGS IN THE SOFTWARE.
 #include "MicroBitAccelerometer.h"
 #include "MicroBitCompass.h"
 #include "MicroBitPowerManager.h"
+#include "MicroBitIrqDispatcher.h"
 #include "NRF52FlashManager.h"
 #include "MicroBitUSBFlashManager.h"
 #include "MicroBitLog.h"
+#include "MicroBitLogAggregator.h"
 #include "MicroBitAudio.h"
+#include "MicroBitHeapStats.h"
+#include "MicroBitSchedulerTrace.h"
+#include "MicroBitEventTrace.h"
+#include "MicroBitIrqPriority.h"
+#include "MicroBitSerialQueue.h"
+#include "MicroBitRadioBridge.h"
+#include "MicroBitNeoPixel.h"
+#include "MicroBitTouchScanner.h"
 #include "StreamNormalizer.h"
 #include "LevelDetector.h"
 #include "LevelDetectorSPL.h"
@@ -79,6 +89,7 @@ DEALINGS IN THE SOFTWARE.
 #include "MicroBitLEDService.h"
 #include "MicroBitAccelerometerService.h"
 #include "MicroBitMagnetometerService.h"
+#include "MicroBitSensorService.h"
 #include "MicroBitButtonService.h"
 #include "MicroBitIOPinService.h"
 #include "MicroBitTemperatureService.h"
@@ -88,10 +99,12 @@ DEALINGS IN THE SOFTWARE.
 #endif
 
 #include "MicroBitStorage.h"
+#include "MicroBitKeyValueLog.h"
 
 
 // Status flag values
 #define DEVICE_INITIALIZED                    0x01
+#define MICROBIT_COMPONENTS_INITIALIZED       0x02
 
 // Power on delay time (in milliseconds) applied after a hard power-on reset only.
 #define KL27_POWER_ON_DELAY                    1000
@@ -123,6 +136,32 @@ namespace codal
              */
             void onP0ListenerRegisteredEvent(Event evt);
 
+            /**
+             * Calls init() on every registered CodalComponent, if this has not already been done.
+             */
+            void initComponents();
+
+            /**
+             * Registers the sources of the combined IRQ line, and starts arbitrating it.
+             */
+            void initIrqDispatcher();
+
+            /**
+             * Waits for the remainder of the power on delay of the interface chip, if one is outstanding.
+             * Called before any operation that talks to the interface chip during init().
+             */
+            void awaitInterfaceChip();
+
+            /**
+             * Records the completion of a phase of init() in the boot profile.
+             *
+             * @param phase The phase completed, one of MICROBIT_BOOT_PHASE_*.
+             */
+            void recordBootPhase(int phase);
+
+            // Time at which the interface chip is ready following a hard reset, in microseconds, or 0 if it is ready now.
+            CODAL_TIMESTAMP             interfaceReadyTime;
+
             // Pin ranges used for LED matrix display.
 
         public:
@@ -143,6 +182,7 @@ namespace codal
             NRF52TouchSensor            touchSensor;
             MicroBitIO                  io;
             NRF52Serial                 serial;
+            MicroBitSerialQueue         serialQueue;            // Non-blocking output for data log mirroring and DMESG
             MicroBitI2C                 _i2c;                   //Internal I2C for motion sensors
             MicroBitI2C                 i2c;                    //External I2C for edge connector
             MicroBitPowerManager        power;
@@ -162,6 +202,7 @@ namespace codal
             MicroBitThermometer         thermometer;
             Accelerometer&              accelerometer;
             Compass&                    compass;
+            MicroBitIrqDispatcher       irqDispatcher;          // Arbiter for the combined IRQ line
             MicroBitCompassCalibrator   compassCalibrator;
             MicroBitAudio               audio;
             MicroBitLog                 log;
@@ -249,6 +290,28 @@ namespace codal
              * @param forceErase Force an erase of user data, even if we have not detected a reflash event.
              */
             void eraseUserStorage(bool forceErase = false);
+
+            /**
+             * Determines when a phase of the most recent call to init() completed.
+             *
+             * @param phase The phase of interest, one of MICROBIT_BOOT_PHASE_*.
+             *
+             * @return The time the phase completed, in microseconds since reset, DEVICE_INVALID_PARAMETER if phase
+             *         is out of range, or DEVICE_NO_DATA if the phase was not recorded.
+             */
+            int getBootPhaseTime(int phase);
+
+            /**
+             * Prints the time at which each phase of the most recent call to init() completed, and the time spent in it,
+             * to the serial port.
+             *
+             * @return DEVICE_OK on success, or DEVICE_NOT_SUPPORTED if no boot profile has been recorded.
+             *
+             * @code
+             * uBit.printBootProfile();
+             * @endcode
+             */
+            int printBootProfile();
     };
 
 
@@ -300,7 +363,13 @@ namespace codal
      */
     inline void MicroBit::sleep(uint32_t milliseconds)
     {
+#if CONFIG_ENABLED(CONFIG_MICROBIT_SCHEDULER_TRACE)
+        uint32_t deadline = (uint32_t) system_timer_current_time_us() + milliseconds * 1000;
+        fiber_sleep(milliseconds);
+        microbit_trace_wake(deadline);
+#else
         fiber_sleep(milliseconds);
+#endif
     }
 
     /**
@@ -327,8 +396,8 @@ using namespace codal;
 
 #define MIC_DEVICE NRF52ADCChannel*
 #define MIC_INIT \
-    : microphone(uBit.audio.mic) \
-    , level(* uBit.audio.levelSPL)
+    : microphone(uBit.audio.getMicrophone()) \
+    , level(* uBit.audio.getLevelSPL())
 
 #define MIC_ENABLE //uBit.audio.deactivateLevelSPL(); //uBit.io.runmic.setDigitalValue(1); uBit.io.runmic.setHighDrive(true); microphone->setGain(7,0)
 
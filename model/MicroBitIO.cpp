@@ -30,6 +30,8 @@ DEALINGS IN THE SOFTWARE.
 #include "CodalConfig.h"
 #include "CodalDmesg.h"
 #include "MicroBitIO.h"
+#include "MicroBitAnalogScan.h"
+#include "CodalFiber.h"
 
 using namespace codal;
 
@@ -319,3 +321,42 @@ void MicroBitIO::pinsDetect( bool setWakeups, bool enableWakeups, bool disableOt
     NRF_GPIOTE->EVENTS_PORT = 0;
     NRF_GPIOTE->INTENSET = intenset;
 }
+
+/**
+ * Samples a group of analog pins together at a fixed rate, using the SAADC in scan mode.
+ * The calling fiber is blocked until every sample has been taken. See MicroBitAnalogScan for a non-blocking equivalent.
+ *
+ * @param pins The pins to sample, e.g. { &io.P0, &io.P1, &io.P2 }.
+ * @param pinCount The number of pins.
+ * @param buffer The buffer to store samples in, as frames of pinCount samples each.
+ * @param frames The number of frames to take.
+ * @param rate The number of frames per second, or 0 to keep the ADC's current sample rate.
+ *
+ * @return DEVICE_OK on success, or an error code as for MicroBitAnalogScan::start().
+ */
+int MicroBitIO::sampleAnalog(NRF52Pin **pins, int pinCount, int16_t *buffer, int frames, int rate)
+{
+    MicroBitAnalogScan scan(*NRF52Pin::adc);
+
+    int result = scan.start(pins, pinCount, buffer, frames, rate);
+
+    if (result != DEVICE_OK)
+        return result;
+
+    // The scan completes from the ADC interrupt, so check and wait atomically to avoid missing its event.
+    target_disable_irq();
+
+    while (!scan.isComplete())
+    {
+        fiber_wake_on_event(scan.id, MICROBIT_ANALOG_SCAN_EVT_COMPLETE);
+        target_enable_irq();
+        schedule();
+        target_disable_irq();
+    }
+
+    target_enable_irq();
+
+    scan.stop();
+
+    return DEVICE_OK;
+}
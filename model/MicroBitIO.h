@@ -431,6 +431,20 @@ namespace codal
              */
             virtual int deepSleepCallback( deepSleepCallbackReason reason, deepSleepCallbackData *data) override;
 
+            /**
+             * Samples a group of analog pins together at a fixed rate, using the SAADC in scan mode.
+             * The calling fiber is blocked until every sample has been taken. See MicroBitAnalogScan for a non-blocking equivalent.
+             *
+             * @param pins The pins to sample, e.g. { &io.P0, &io.P1, &io.P2 }.
+             * @param pinCount The number of pins.
+             * @param buffer The buffer to store samples in, as frames of pinCount samples each.
+             * @param frames The number of frames to take.
+             * @param rate The number of frames per second, or 0 to keep the ADC's current sample rate.
+             *
+             * @return DEVICE_OK on success, or an error code as for MicroBitAnalogScan::start().
+             */
+            int sampleAnalog(NRF52Pin **pins, int pinCount, int16_t *buffer, int frames, int rate = 0);
+
         private:
             ManagedBuffer     savedStatus;
 
@@ -0,0 +1,134 @@
+#!/usr/bin/env python3
+"""
+Host side of the Bluetooth benchmark in samples/BLEBenchmark/main.cpp.
+
+Connects to a micro:bit running the benchmark, and for each connection mode, PHY and data length
+asks the device to reconfigure the link, then measures round trip latency, notification throughput and
+write without response throughput. Results are printed here, and by the device over serial.
+
+Requires the bleak package (pip install bleak). The ATT MTU is negotiated by the host operating
+system, and is reported by the device.
+
+    python3 ble_benchmark.py [--name "BBC micro:bit"] [--duration 3000] [--pings 100]
+"""
+
+import argparse
+import asyncio
+import struct
+import time
+
+from bleak import BleakClient, BleakScanner
+
+BASE = "b5e1{:04x}-6d2a-4c41-9b3e-4f5a1c8d7e20"
+CONTROL = BASE.format(0x0002)
+DATA = BASE.format(0x0003)
+SINK = BASE.format(0x0004)
+
+CMD_PING = 0x01
+CMD_CONFIG = 0x02
+CMD_NOTIFY = 0x03
+CMD_WRITE_START = 0x04
+CMD_WRITE_END = 0x05
+CMD_PING_RESULT = 0x06
+CMD_DONE = 0x07
+
+MODES = {"default": 0, "bulk": 1, "idle": 2}
+PHYS = (1, 2)
+DATA_LENGTHS = (27, 251)
+
+
+class Bench:
+    def __init__(self, client):
+        self.client = client
+        self.replies = asyncio.Queue()
+        self.notified = 0
+
+    async def start(self):
+        await self.client.start_notify(CONTROL, lambda _, d: self.replies.put_nowait(bytes(d)))
+        await self.client.start_notify(DATA, self.on_data)
+
+    def on_data(self, _, data):
+        self.notified += len(data)
+
+    async def command(self, *payload, reply=None):
+        await self.client.write_gatt_char(CONTROL, bytes(payload), response=True)
+        while reply is not None:
+            r = await asyncio.wait_for(self.replies.get(), 30)
+            if r[0] == reply:
+                return r
+
+    async def ping(self, count):
+        times = []
+        for seq in range(count):
+            t = time.perf_counter()
+            await self.client.write_gatt_char(CONTROL, struct.pack("<BH", CMD_PING, seq), response=False)
+            while True:
+                r = await asyncio.wait_for(self.replies.get(), 5)
+                if r[0] == CMD_PING and struct.unpack_from("<H", r, 1)[0] == seq:
+                    break
+            times.append(int((time.perf_counter() - t) * 1000000))
+        times.sort()
+        result = (len(times), times[len(times) // 2], times[(len(times) * 99) // 100], times[-1])
+        await self.command(CMD_PING_RESULT, *struct.pack("<HIII", *result))
+        return result
+
+    async def notify(self, duration):
+        self.notified = 0
+        r = await self.command(CMD_NOTIFY, *struct.pack("<H", duration), reply=CMD_NOTIFY)
+        return struct.unpack_from("<III", r, 1) + (self.notified,)
+
+    async def write(self, duration, size):
+        await self.command(CMD_WRITE_START)
+        payload = bytes(range(size))
+        end = time.perf_counter() + duration / 1000
+        while time.perf_counter() < end:
+            await self.client.write_gatt_char(SINK, payload, response=False)
+        r = await self.command(CMD_WRITE_END, reply=CMD_WRITE_END)
+        return struct.unpack_from("<III", r, 1)
+
+
+def rate(count, us):
+    return int(count * 1000000 / us) if us else 0
+
+
+async def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--name", default="BBC micro:bit", help="advertised name prefix of the device")
+    parser.add_argument("--duration", type=int, default=3000, help="length of each throughput test, in milliseconds")
+    parser.add_argument("--pings", type=int, default=100, help="number of round trips timed per configuration")
+    parser.add_argument("--modes", default="default,bulk,idle", help="comma separated connection modes to test")
+    args = parser.parse_args()
+
+    device = await BleakScanner.find_device_by_filter(lambda d, _: (d.name or "").startswith(args.name), timeout=20)
+    if device is None:
+        raise SystemExit("no device found advertising as " + args.name)
+
+    async with BleakClient(device) as client:
+        bench = Bench(client)
+        await bench.start()
+        size = min(max(client.mtu_size - 3, 20), 244)
+        print("connected to {} mtu={}".format(device.address, client.mtu_size))
+
+        for mode in args.modes.split(","):
+            for phy in PHYS:
+                for dle in DATA_LENGTHS:
+                    await bench.command(CMD_CONFIG, MODES[mode], phy, dle)
+                    # Allow the connection parameter, PHY and data length procedures to complete.
+                    await asyncio.sleep(2)
+
+                    label = "mode={} phy={} dle={}".format(mode, phy, dle)
+                    pings, p50, p99, worst = await bench.ping(args.pings)
+                    print("{} ping pings={} p50_us={} p99_us={} max_us={}".format(label, pings, p50, p99, worst))
+
+                    packets, sent, us, received = await bench.notify(args.duration)
+                    print("{} notify packets={} bytes={} received={} bytes_per_s={}".format(
+                        label, packets, sent, received, rate(sent, us)))
+
+                    packets, written, us = await bench.write(args.duration, size)
+                    print("{} write packets={} bytes={} bytes_per_s={}".format(label, packets, written, rate(written, us)))
+
+        await bench.command(CMD_DONE)
+
+
+if __name__ == "__main__":
+    asyncio.run(main())
@@ -0,0 +1,368 @@
+/*
+ * Bluetooth throughput and latency benchmark.
+ *
+ * Adds a benchmark GATT service, driven by samples/BLEBenchmark/ble_benchmark.py on a host computer,
+ * which measures notification throughput, write without response throughput and round trip latency
+ * at each combination of connection mode, PHY and data length the host asks for. Build this file in
+ * place of samples/main.cpp, with MICROBIT_BLE_ENABLED set. Results are written to the serial port,
+ * one line per test, as space separated key=value pairs:
+ *
+ *   BENCH name=notify mode=<n> phy=<n> dle=<n> mtu=<n> interval_ms=<n> packets=<n> bytes=<n> time_us=<n>
+ *         bytes_per_s=<n> packets_per_event=<n.nn> event_util_pct=<n.nn>
+ *   BENCH name=write mode=<n> phy=<n> dle=<n> mtu=<n> interval_ms=<n> packets=<n> bytes=<n> time_us=<n>
+ *         bytes_per_s=<n> packets_per_event=<n.nn> event_util_pct=<n.nn>
+ *   BENCH name=ping mode=<n> phy=<n> dle=<n> mtu=<n> interval_ms=<n> pings=<n> p50_us=<n> p99_us=<n> max_us=<n>
+ *
+ * followed by a single "BENCH done" line once the host has finished. Ping latencies are measured by the
+ * host and reported back to the device, so that all results appear in one place.
+ *
+ * event_util_pct estimates the fraction of each connection interval spent on air, from the packet sizes,
+ * PHY and data length in use. It includes the empty packets sent in reply and the inter frame spaces.
+ */
+
+#include "MicroBit.h"
+#include "MicroBitBLEService.h"
+#include "nrf_sdh_ble.h"
+
+MicroBit uBit;
+
+#define BENCH_CONTROL_SIZE      20                              // Size of the control characteristic value.
+#define BENCH_DATA_SIZE         244                             // Largest notification or write, for a 247 byte ATT MTU.
+#define BENCH_OBSERVER_PRIO     3                               // SoftDevice observer priority used to track PHY and data length.
+
+// Commands written to the control characteristic. Each reply is notified on the control characteristic
+// with the same command byte.
+#define BENCH_CMD_PING          0x01                            // [cmd, seq16]: reply immediately with the same bytes.
+#define BENCH_CMD_CONFIG        0x02                            // [cmd, mode, phy, dle]: request a connection mode, PHY (1 or 2) and data length.
+#define BENCH_CMD_NOTIFY        0x03                            // [cmd, ms16]: notify on the data characteristic for ms. Reply [cmd, packets32, bytes32, us32].
+#define BENCH_CMD_WRITE_START   0x04                            // [cmd]: reset the sink counters.
+#define BENCH_CMD_WRITE_END     0x05                            // [cmd]: reply [cmd, packets32, bytes32, us32] for the writes since WRITE_START.
+#define BENCH_CMD_PING_RESULT   0x06                            // [cmd, pings16, p50_32, p99_32, max_32]: host measured round trip times, in microseconds.
+#define BENCH_CMD_DONE          0x07                            // [cmd]: the host has finished.
+
+static const uint8_t benchBaseUUID[16] =
+{ 0xb5,0xe1,0x00,0x00,0x6d,0x2a,0x4c,0x41,0x9b,0x3e,0x4f,0x5a,0x1c,0x8d,0x7e,0x20 };
+
+static uint16_t benchNotifyEvent;
+
+/**
+ * The benchmark service. Control commands are handled in SoftDevice event context where they are
+ * time critical (ping, and counting data writes), and in the main fiber otherwise.
+ */
+class BenchService : public MicroBitBLEService
+{
+    public:
+
+    BenchService()
+    {
+        RegisterBaseUUID( benchBaseUUID);
+        CreateService( 0x0001);
+
+        CreateCharacteristic( cIdxCONTROL, 0x0002, control, BENCH_CONTROL_SIZE, BENCH_CONTROL_SIZE,
+                              microbit_propWRITE | microbit_propWRITE_WITHOUT | microbit_propNOTIFY);
+
+        CreateCharacteristic( cIdxDATA, 0x0003, data, BENCH_DATA_SIZE, BENCH_DATA_SIZE, microbit_propNOTIFY);
+
+        CreateCharacteristic( cIdxSINK, 0x0004, sink, BENCH_DATA_SIZE, BENCH_DATA_SIZE, microbit_propWRITE_WITHOUT);
+
+        for (int i = 0; i < BENCH_DATA_SIZE; i++)
+            data[i] = i;
+
+        command = 0;
+        sending = false;
+        filling = false;
+        packets = 0;
+        bytes = 0;
+        start = 0;
+        end = 0;
+    }
+
+    /**
+     * Notifies on the data characteristic until the SoftDevice queue is full, or the test ends.
+     * Called from the main fiber to start, then from SoftDevice event context as the queue drains.
+     */
+    void fill()
+    {
+        target_disable_irq();
+        bool busy = filling;
+        filling = true;
+        target_enable_irq();
+
+        if (busy)
+            return;
+
+        uint16_t length = min( getMaxPayload(), BENCH_DATA_SIZE);
+
+        while (sending && system_timer_current_time_us() < end)
+        {
+            if (!notifyChrValue( cIdxDATA, data, length))
+                break;
+
+            packets++;
+            bytes += length;
+        }
+
+        filling = false;
+    }
+
+    void onNotificationComplete( const microbit_ble_evt_hvn_tx_complete_t *)
+    {
+        if (sending)
+            fill();
+    }
+
+    void onDataWritten( const microbit_ble_evt_write_t *params)
+    {
+        if (params->handle == valueHandle( cIdxSINK))
+        {
+            CODAL_TIMESTAMP t = system_timer_current_time_us();
+
+            if (packets == 0)
+                start = t;
+
+            end = t;
+            packets++;
+            bytes += params->len;
+            return;
+        }
+
+        if (params->handle != valueHandle( cIdxCONTROL) || params->len == 0)
+            return;
+
+        // Reply to pings straight away, so that they measure the stack rather than the scheduler.
+        if (params->data[0] == BENCH_CMD_PING)
+        {
+            notifyChrValue( cIdxCONTROL, params->data, params->len);
+            return;
+        }
+
+        // Anything else waits for the main fiber, one command at a time.
+        if (command)
+            return;
+
+        memcpy( control, params->data, min( params->len, BENCH_CONTROL_SIZE));
+        command = params->data[0];
+        MicroBitEvent( DEVICE_ID_NOTIFY, benchNotifyEvent);
+    }
+
+    /**
+     * Notifies a test result on the control characteristic.
+     */
+    void reply( uint8_t cmd, uint32_t elapsed)
+    {
+        uint8_t r[13];
+        uint32_t p = packets;
+        uint32_t b = bytes;
+
+        r[0] = cmd;
+        memcpy( r + 1, &p, 4);
+        memcpy( r + 5, &b, 4);
+        memcpy( r + 9, &elapsed, 4);
+        notifyChrValue( cIdxCONTROL, r, sizeof(r));
+    }
+
+    typedef enum cIdx
+    {
+        cIdxCONTROL,
+        cIdxDATA,
+        cIdxSINK,
+        cIdxCOUNT
+    } cIdx;
+
+    uint8_t                     control[ BENCH_CONTROL_SIZE];
+    uint8_t                     data[ BENCH_DATA_SIZE];
+    uint8_t                     sink[ BENCH_DATA_SIZE];
+
+    volatile uint8_t            command;
+    volatile bool               sending;
+    volatile bool               filling;
+    volatile uint32_t           packets;
+    volatile uint32_t           bytes;
+    volatile CODAL_TIMESTAMP    start;
+    volatile CODAL_TIMESTAMP    end;
+
+    MicroBitBLEChar             chars[ cIdxCOUNT];
+
+    int              characteristicCount()          { return cIdxCOUNT; };
+    MicroBitBLEChar *characteristicPtr( int idx)    { return &chars[ idx]; };
+};
+
+static BenchService *bench;
+static int benchMode = MICROBIT_BLE_CONNECTION_DEFAULT;
+static volatile int benchPHY = 1;
+static volatile int benchDLE = 27;
+
+/**
+ * Tracks the PHY and data length actually in use, which the central may choose regardless of what we ask for.
+ */
+static void benchOnBleEvent( ble_evt_t const *p_ble_evt, void *)
+{
+    switch (p_ble_evt->header.evt_id)
+    {
+        case BLE_GAP_EVT_CONNECTED:
+            benchPHY = 1;
+            benchDLE = 27;
+            break;
+
+        case BLE_GAP_EVT_PHY_UPDATE:
+            if (p_ble_evt->evt.gap_evt.params.phy_update.status == BLE_HCI_STATUS_CODE_SUCCESS)
+                benchPHY = p_ble_evt->evt.gap_evt.params.phy_update.tx_phy == BLE_GAP_PHY_2MBPS ? 2 : 1;
+            break;
+
+        case BLE_GAP_EVT_DATA_LENGTH_UPDATE:
+            benchDLE = p_ble_evt->evt.gap_evt.params.data_length_update.effective_params.max_tx_octets;
+            break;
+    }
+}
+
+NRF_SDH_BLE_OBSERVER( bench_obs, BENCH_OBSERVER_PRIO, benchOnBleEvent, NULL);
+
+/**
+ * Estimates the time on air of one ATT packet of the given payload, in microseconds, including
+ * the empty packet sent in reply to each link layer fragment and both inter frame spaces.
+ */
+static uint32_t airTime( int payload)
+{
+    int pdu = payload + 7;                                      // L2CAP and ATT headers.
+    int dle = benchDLE > 27 ? benchDLE : 27;
+    int preamble = benchPHY == 2 ? 2 : 1;
+    uint32_t t = 0;
+
+    while (pdu > 0)
+    {
+        int fragment = pdu < dle ? pdu : dle;
+
+        // Preamble, access address, header and CRC around the fragment, then an empty reply.
+        t += ((preamble + 4 + 2 + fragment + 3) + (preamble + 4 + 2 + 3)) * 8 / benchPHY + 300;
+        pdu -= fragment;
+    }
+
+    return t;
+}
+
+static void printSettings( const char *name)
+{
+    uBit.serial.printf("BENCH name=%s mode=%d phy=%d dle=%d mtu=%d interval_ms=%d",
+        name, benchMode, (int)benchPHY, (int)benchDLE, (int)MicroBitBLEService::getATTMTU(), (int)MicroBitBLEService::getConnectionInterval());
+}
+
+/**
+ * Reports a completed throughput test.
+ *
+ * @param name The name of the test.
+ * @param elapsed The length of the test, in microseconds.
+ */
+static void report( const char *name, uint32_t elapsed)
+{
+    uint32_t packets = bench->packets;
+    uint32_t bytes = bench->bytes;
+    uint32_t interval = MicroBitBLEService::getConnectionInterval() * 1000;
+
+    // Packets per connection event, and the percentage of each event spent on air, both in hundredths.
+    uint32_t perEvent = elapsed ? (uint32_t)(((uint64_t)packets * interval * 100) / elapsed) : 0;
+    uint32_t util = interval ? (uint32_t)(((uint64_t)perEvent * airTime( packets ? bytes / packets : 0) * 100) / interval) : 0;
+
+    printSettings( name);
+    uBit.serial.printf(" packets=%d bytes=%d time_us=%d bytes_per_s=%d packets_per_event=%d.%02d event_util_pct=%d.%02d\r\n",
+        (int)packets, (int)bytes, (int)elapsed, (int)(((uint64_t)bytes * 1000000) / (elapsed ? elapsed : 1)),
+        (int)(perEvent / 100), (int)(perEvent % 100), (int)(util / 100), (int)(util % 100));
+}
+
+static uint32_t read32( const uint8_t *p)
+{
+    uint32_t v;
+    memcpy( &v, p, 4);
+    return v;
+}
+
+static void configure( const uint8_t *c)
+{
+    benchMode = c[1];
+    uBit.bleManager.setConnectionMode( benchMode);
+
+    ble_gap_phys_t phys;
+    phys.tx_phys = c[2] == 2 ? BLE_GAP_PHY_2MBPS : BLE_GAP_PHY_1MBPS;
+    phys.rx_phys = phys.tx_phys;
+    sd_ble_gap_phy_update( bench->getConnectionHandle(), &phys);
+
+    ble_gap_data_length_params_t dl;
+    memset( &dl, 0, sizeof(dl));
+    dl.max_tx_octets = c[3] ? c[3] : BLE_GAP_DATA_LENGTH_AUTO;
+    dl.max_rx_octets = dl.max_tx_octets;
+    dl.max_tx_time_us = BLE_GAP_DATA_LENGTH_AUTO;
+    dl.max_rx_time_us = BLE_GAP_DATA_LENGTH_AUTO;
+    sd_ble_gap_data_length_update( bench->getConnectionHandle(), &dl, NULL);
+}
+
+static void runNotify( uint16_t duration)
+{
+    bench->packets = 0;
+    bench->bytes = 0;
+    bench->start = system_timer_current_time_us();
+    bench->end = bench->start + duration * 1000;
+    bench->sending = true;
+
+    bench->fill();
+    uBit.sleep(duration);
+    bench->sending = false;
+
+    // Let the queue drain before replying, so that the reply is not lost.
+    uBit.sleep(100);
+
+    uint32_t elapsed = (uint32_t)(bench->end - bench->start);
+    report( "notify", elapsed);
+    bench->reply( BENCH_CMD_NOTIFY, elapsed);
+}
+
+int
+main()
+{
+    uBit.init();
+
+    uBit.serial.printf("BENCH start\r\n");
+
+    benchNotifyEvent = allocateNotifyEvent();
+    bench = new BenchService();
+
+    while (1)
+    {
+        fiber_wait_for_event( DEVICE_ID_NOTIFY, benchNotifyEvent);
+
+        const uint8_t *c = bench->control;
+
+        switch (bench->command)
+        {
+            case BENCH_CMD_CONFIG:
+                configure( c);
+                break;
+
+            case BENCH_CMD_NOTIFY:
+                runNotify( c[1] | (c[2] << 8));
+                break;
+
+            case BENCH_CMD_WRITE_START:
+                bench->packets = 0;
+                bench->bytes = 0;
+                bench->start = 0;
+                bench->end = 0;
+                break;
+
+            case BENCH_CMD_WRITE_END:
+                report( "write", (uint32_t)(bench->end - bench->start));
+                bench->reply( BENCH_CMD_WRITE_END, (uint32_t)(bench->end - bench->start));
+                break;
+
+            case BENCH_CMD_PING_RESULT:
+                printSettings( "ping");
+                uBit.serial.printf(" pings=%d p50_us=%d p99_us=%d max_us=%d\r\n",
+                    c[1] | (c[2] << 8), (int)read32( c + 3), (int)read32( c + 7), (int)read32( c + 11));
+                break;
+
+            case BENCH_CMD_DONE:
+                uBit.serial.printf("BENCH done\r\n");
+                break;
+        }
+
+        bench->command = 0;
+    }
+}
@@ -0,0 +1,39 @@
+/*
+ * Binary event trace example.
+ *
+ * Streams hot path trace events (radio interrupts, display refresh, and an application defined
+ * event around each radio send) to the serial port, for decoding on the host with trace_decode.py
+ * in this directory. Build this file in place of samples/main.cpp, with CONFIG_MICROBIT_EVENT_TRACE
+ * enabled. The serial port carries only binary trace packets once streaming starts, so nothing
+ * else should be printed to it.
+ */
+
+#include "MicroBit.h"
+
+MicroBit uBit;
+MicroBitEventTraceStream trace(uBit.serial);
+
+#define TRACE_SEND              (MICROBIT_EVENT_TRACE_USER + 1)
+
+int
+main()
+{
+    uBit.init();
+    uBit.serial.setBaud(1000000);
+    uBit.radio.enable();
+
+    uBit.display.scroll("T");
+
+    if (trace.start() != DEVICE_OK)
+        uBit.display.scroll("TRACE DISABLED");
+
+    for (uint32_t sequence = 0;; sequence++)
+    {
+        MICROBIT_EVENT_TRACE(TRACE_SEND, 0, sequence);
+        uBit.radio.datagram.send("trace");
+        MICROBIT_EVENT_TRACE(TRACE_SEND | MICROBIT_EVENT_TRACE_END, 0, sequence);
+
+        uBit.display.image.setPixelValue(sequence % 5, 2, (sequence / 5) & 1 ? 0 : 255);
+        uBit.sleep(50);
+    }
+}
@@ -0,0 +1,118 @@
+#!/usr/bin/env python3
+"""
+Host side decoder for the binary event trace stream written by MicroBitEventTraceStream.
+
+Reads packets from a serial port (or a file captured from one), checks their framing and checksum,
+and prints one line per trace event, with the time since the previous event. Regions bracketed by
+a begin and end event (the id, and the id with MICROBIT_EVENT_TRACE_END set) also show their duration.
+
+Requires the pyserial package (pip install pyserial) when reading from a serial port.
+
+    python3 trace_decode.py /dev/ttyACM0 [--baud 1000000]
+    python3 trace_decode.py --file capture.bin
+"""
+
+import argparse
+import struct
+import sys
+
+SYNC = b"\xa5\x5a"
+HEADER = struct.Struct("<BH")
+RECORD = struct.Struct("<IHHI")
+
+TRACE_USER = 0x4000
+TRACE_END = 0x8000
+
+NAMES = {
+    0x0001: "radio_irq",
+    0x0002: "radio_rx",
+    0x0003: "led_render",
+}
+
+
+def name(id):
+    base = id & ~TRACE_END
+    if base >= TRACE_USER:
+        label = "user+{}".format(base - TRACE_USER)
+    else:
+        label = NAMES.get(base, "0x{:04x}".format(base))
+    return label + (".end" if id & TRACE_END else "")
+
+
+def packets(read):
+    """Yields (dropped, records) for each valid packet, resynchronising on any corruption. Ends when read() returns None."""
+    buffer = b""
+    while True:
+        data = read()
+        if data is None:
+            return
+        buffer += data
+
+        while True:
+            start = buffer.find(SYNC)
+            if start < 0:
+                buffer = buffer[-1:]
+                break
+            buffer = buffer[start:]
+            if len(buffer) < 2 + HEADER.size:
+                break
+
+            count, dropped = HEADER.unpack_from(buffer, 2)
+            length = 2 + HEADER.size + count * RECORD.size
+            if len(buffer) < length + 1:
+                break
+
+            if sum(buffer[2:length]) & 0xFF != buffer[length]:
+                print("# checksum error, resynchronising", file=sys.stderr)
+                buffer = buffer[1:]
+                continue
+
+            records = [RECORD.unpack_from(buffer, 2 + HEADER.size + i * RECORD.size) for i in range(count)]
+            buffer = buffer[length + 1:]
+            yield dropped, records
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("port", nargs="?", help="serial port the micro:bit is attached to")
+    parser.add_argument("--baud", type=int, default=1000000, help="serial baud rate")
+    parser.add_argument("--file", help="decode a captured stream from a file instead of a serial port")
+    args = parser.parse_args()
+
+    if args.file:
+        source = open(args.file, "rb")
+        read = lambda: source.read(4096) or None
+    elif args.port:
+        import serial
+        source = serial.Serial(args.port, args.baud, timeout=1)
+        read = lambda: source.read(max(1, source.in_waiting))
+    else:
+        parser.error("a serial port or --file is required")
+
+    previous = None
+    begin = {}
+
+    try:
+        for dropped, records in packets(read):
+            if dropped:
+                print("# {} events dropped".format(dropped))
+
+            for time, id, a, b in records:
+                delta = (time - previous) & 0xFFFFFFFF if previous is not None else 0
+                previous = time
+                line = "{:10d} +{:<8d} {:<16s} a={:<6d} b={}".format(time, delta, name(id), a, b)
+
+                if id & TRACE_END:
+                    start = begin.pop(id & ~TRACE_END, None)
+                    if start is not None:
+                        line += " duration_us={}".format((time - start) & 0xFFFFFFFF)
+                else:
+                    begin[id] = time
+
+                print(line)
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()
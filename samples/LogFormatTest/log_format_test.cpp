@@ -0,0 +1,91 @@
+/*
+ * Host side test of the MicroBitLog number formatters.
+ *
+ * Checks the values logged by logData(key, double, decimals) around the point at which they switch to exponent form,
+ * and the values that are not finite. This is a host program, not a micro:bit sample. Build and run it with:
+ *
+ *   g++ -std=c++11 -O2 -I../../inc log_format_test.cpp ../../source/MicroBitLogFormat.cpp -o log_format_test
+ *   ./log_format_test
+ *
+ * Results are written as one line per case, as space separated key=value pairs:
+ *
+ *   TEST name=format_float decimals=<n> expected=<s> actual=<s> result=pass|fail
+ *
+ * followed by a single "TEST done passed=<n> failed=<n>" line. The exit status is non-zero if any case failed.
+ */
+
+#include "MicroBitLogFormat.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+
+using namespace codal;
+
+struct FormatCase
+{
+    double          value;
+    int             decimals;
+    const char      *expected;
+};
+
+static const FormatCase cases[] =
+{
+    { 0.0,                      0,  "0" },
+    { 3.14159,                  2,  "3.14" },
+    { -2.5,                     1,  "-2.5" },
+    { 0.05,                     1,  "0.1" },
+
+    // The largest values written in full, with the widest output that fits the buffer.
+    { 999999999999999.0,        0,  "999999999999999" },
+    { -999999999999999.0,       6,  "-999999999999999.000000" },
+
+    // From 1e15, in exponent form.
+    { 1e15,                     0,  "1e+15" },
+    { 1e15,                     2,  "1.00e+15" },
+    { -1e15,                    6,  "-1.000000e+15" },
+    { 1.5e15,                   2,  "1.50e+15" },
+    { 1.2345678e16,             3,  "1.235e+16" },
+
+    // Rounding that carries into the next power of ten.
+    { 999999999999999.875,      0,  "1e+15" },
+    { 9.9999999e15,             2,  "1.00e+16" },
+
+    // The extremes of the finite range.
+    { 1.5e300,                  3,  "1.500e+300" },
+    { DBL_MAX,                  2,  "1.80e+308" },
+    { -DBL_MAX,                 6,  "-1.797693e+308" },
+
+    // Only values that are not finite have names.
+    { INFINITY,                 2,  "Infinity" },
+    { -INFINITY,                2,  "-Infinity" },
+    { NAN,                      2,  "NaN" },
+};
+
+int main()
+{
+    int passed = 0;
+    int failed = 0;
+
+    for (unsigned int i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+    {
+        // Fill the buffer past its end, to catch a formatter writing more than MICROBIT_LOG_NUMBER_SIZE characters.
+        char buf[MICROBIT_LOG_NUMBER_SIZE + 8];
+        memset(buf, '#', sizeof(buf));
+
+        int l = logFormatFloat(buf, cases[i].value, cases[i].decimals);
+        bool pass = strcmp(buf, cases[i].expected) == 0 && l == (int) strlen(buf) && buf[MICROBIT_LOG_NUMBER_SIZE] == '#';
+
+        printf("TEST name=format_float decimals=%d expected=%s actual=%s result=%s\n",
+            cases[i].decimals, cases[i].expected, l < MICROBIT_LOG_NUMBER_SIZE ? buf : "<overflow>", pass ? "pass" : "fail");
+
+        if (pass)
+            passed++;
+        else
+            failed++;
+    }
+
+    printf("TEST done passed=%d failed=%d\n", passed, failed);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,264 @@
+/*
+ * Data log power loss test.
+ *
+ * Checks that MicroBitLog recovers consistently from a power loss part way through writing a row. Each trial logs
+ * a number of rows, then logs one more with every flash write after the first N dropped, as if power had been lost
+ * at that point, and resets the micro:bit. After the reset the log is mounted again, and must hold every row logged
+ * before the interrupted one, in order, followed by at most the start of that row.
+ *
+ * The cache writes changed blocks out in the order of its slots, not the order in which they were changed. Trials
+ * start from every number of rows up to LOG_TEST_ROWS, which places the data and journal blocks in either order in
+ * the cache, and from each of these every value of N is tried, until the row completes without losing a write.
+ * Build this file in place of samples/main.cpp. Progress is kept in the key value store across resets, and results
+ * are written to the serial port, one line per trial, as space separated key=value pairs:
+ *
+ *   TEST name=log_recovery rows=<n> cut=<n> recovered_rows=<n> result=pass|fail
+ *
+ * followed by a single "TEST done passed=<n> failed=<n>" line. Hold button A during a reset to start again.
+ *
+ * @warning This test clears the data log, and resets the micro:bit once for every trial.
+ */
+
+#include "MicroBit.h"
+
+MicroBit uBit;
+
+#ifndef LOG_TEST_ROWS
+#define LOG_TEST_ROWS           24                              // The most rows logged before the interrupted one.
+#endif
+
+#define LOG_TEST_STATE_KEY      "logtest"
+#define LOG_TEST_LINE_SIZE      80
+
+/**
+ * Interface chip storage that can lose power: once cut, writes and erases report success but are not made.
+ */
+class PowerCutFlash : public MicroBitUSBFlashManager
+{
+    int remaining;                      // The writes and erases still to be made, or -1 for all of them.
+    bool lost;                          // Set once a write or erase has been dropped.
+
+    public:
+    PowerCutFlash(MicroBitI2C &i2c, MicroBitIO &ioPins, MicroBitPowerManager &powerManager) : MicroBitUSBFlashManager(i2c, ioPins, powerManager)
+    {
+        remaining = -1;
+        lost = false;
+    }
+
+    /**
+     * Loses power after the given number of further writes and erases.
+     */
+    void cutAfter(int operations)
+    {
+        remaining = operations;
+    }
+
+    /**
+     * Determines if power has been lost, and a write or erase dropped.
+     */
+    bool isCut()
+    {
+        return lost;
+    }
+
+    virtual int write(uint32_t address, uint32_t *data, uint32_t length) override
+    {
+        if (!powered())
+            return DEVICE_OK;
+
+        return MicroBitUSBFlashManager::write(address, data, length);
+    }
+
+    virtual int erase(uint32_t page) override
+    {
+        if (!powered())
+            return DEVICE_OK;
+
+        return MicroBitUSBFlashManager::erase(page);
+    }
+
+    private:
+    bool powered()
+    {
+        if (remaining < 0)
+            return true;
+
+        if (remaining == 0)
+        {
+            lost = true;
+            return false;
+        }
+
+        remaining--;
+        return true;
+    }
+};
+
+struct LogTestState
+{
+    uint16_t rows;                      // The rows logged before the interrupted one.
+    uint16_t cut;                       // The writes and erases of the interrupted row that were made.
+    uint16_t passed;
+    uint16_t failed;
+    uint8_t pending;                    // Set if the log holds an interrupted trial, to be checked.
+    uint8_t lost;                       // Set if the interrupted row lost a write.
+};
+
+PowerCutFlash flash(uBit._i2c, uBit.io, uBit.power);
+MicroBitLog testLog(flash, uBit.power, uBit.serialQueue);
+
+static char expected[LOG_TEST_LINE_SIZE];
+
+/**
+ * Renders the given row as it appears in the CSV data, without its line ending.
+ */
+static int renderRow(int row)
+{
+    int l = sprintf(expected, "%d,", row);
+    int length = 16 + (row * 7) % 40;
+
+    for (int i = 0; i < length; i++)
+        expected[l++] = 'a' + (row + i) % 26;
+
+    expected[l] = 0;
+    return l;
+}
+
+static void logRow(int row)
+{
+    renderRow(row);
+
+    testLog.beginRow();
+    testLog.logData("n", row);
+    testLog.logData("payload", strchr(expected, ',') + 1);
+    testLog.endRow();
+}
+
+/**
+ * Checks that the recovered log holds the rows logged before the interrupted trial, and at most the start of the interrupted row.
+ *
+ * @param state the trial to check.
+ * @param rows set to the number of complete rows recovered.
+ * @return true if the log is consistent.
+ */
+static bool checkLog(LogTestState &state, int &rows)
+{
+    uint32_t length = testLog.getDataLength(DataFormat::CSV);
+    uint8_t *data = (uint8_t *) malloc(length + 1);
+
+    rows = -1;
+
+    if (data == NULL || testLog.readData(data, 0, length, DataFormat::CSV, length) != DEVICE_OK)
+    {
+        free(data);
+        return false;
+    }
+
+    data[length] = 0;
+
+    bool consistent = true;
+    char *line = (char *) data;
+
+    // The headings come first, followed by one line per row.
+    for (rows = -1; consistent && *line; rows++)
+    {
+        char *end = strchr(line, '\n');
+
+        if (rows < 0)
+            strcpy(expected, "n,payload");
+        else
+            renderRow(rows);
+
+        if (end != NULL)
+            *end = 0;
+
+        int l = strlen(line);
+        if (l > 0 && line[l - 1] == '\r')
+            line[--l] = 0;
+
+        // Only the interrupted row may be incomplete.
+        if (end == NULL)
+        {
+            consistent = rows == state.rows && strncmp(line, expected, l) == 0;
+            break;
+        }
+
+        consistent = rows <= state.rows && strcmp(line, expected) == 0;
+        line = end + 1;
+    }
+
+    free(data);
+
+    return consistent && rows >= state.rows;
+}
+
+static void saveState(LogTestState &state)
+{
+    uBit.storage.put(LOG_TEST_STATE_KEY, (uint8_t *) &state, sizeof(state));
+}
+
+int main()
+{
+    uBit.init();
+
+    LogTestState state;
+    memset(&state, 0, sizeof(state));
+    state.rows = 1;
+
+    KeyValuePair *stored = uBit.storage.get(LOG_TEST_STATE_KEY);
+
+    if (stored != NULL && !uBit.buttonA.isPressed())
+        memcpy(&state, stored->value, sizeof(state));
+
+    delete stored;
+
+    if (state.pending)
+    {
+        int rows;
+        bool pass = checkLog(state, rows);
+
+        uBit.serial.printf("TEST name=log_recovery rows=%d cut=%d recovered_rows=%d result=%s\r\n",
+            state.rows, state.cut, rows, pass ? "pass" : "fail");
+
+        if (pass)
+            state.passed++;
+        else
+            state.failed++;
+
+        // Once the row completes without losing power, move on to the next number of rows.
+        if (state.lost)
+        {
+            state.cut++;
+        }
+        else
+        {
+            state.cut = 0;
+            state.rows++;
+        }
+
+        state.pending = 0;
+        saveState(state);
+    }
+
+    if (state.rows > LOG_TEST_ROWS)
+    {
+        uBit.serial.printf("TEST done passed=%d failed=%d\r\n", state.passed, state.failed);
+        uBit.display.scroll(state.failed ? "FAIL" : "PASS");
+        release_fiber();
+    }
+
+    testLog.clear(false);
+    testLog.setTimeStamp(TimeStampFormat::None);
+
+    for (int i = 0; i < state.rows; i++)
+        logRow(i);
+
+    flash.cutAfter(state.cut);
+    logRow(state.rows);
+
+    state.lost = flash.isCut();
+    state.pending = 1;
+    saveState(state);
+
+    microbit_reset();
+}
@@ -0,0 +1,367 @@
+/*
+ * Host side simulator for the MicroBitMeshRadio flooding protocol.
+ *
+ * Runs the same duplicate suppression, relay policy and unicast routing code as the device
+ * (source/MicroBitMeshProtocol.cpp) on a simulated mesh of many nodes, and measures how the protocol
+ * scales with the number of nodes. This is a host program, not a micro:bit sample. Build and run it with:
+ *
+ *   g++ -std=c++11 -O2 -I../../inc mesh_sim.cpp ../../source/MicroBitMeshProtocol.cpp -o mesh_sim
+ *   ./mesh_sim [--topology line|grid|random] [--nodes 5,10,20,50,100,200] [--frames 200] [--loss 10]
+ *              [--ttl 8] [--relay-probability 100] [--copy-threshold 0] [--mode flood|unicast]
+ *              [--advertise-ms 5000] [--relay-rssi -128] [--relay-pdr 0] [--seed 1]
+ *
+ * Transmission is modelled in slots, as the device relays each frame a fixed time after receiving it.
+ * Every node that accepted a frame in one slot relays it in the next, and as concurrent relays of the
+ * same frame interfere constructively, a node hears the frame in a slot if the transmission from any one
+ * of its neighbours reaches it. Each transmission is lost independently with the given percentage, and links become
+ * weaker and lossier towards the edge of radio range, where the signal strength falls from -50 to -90dBm and the loss
+ * rises to three times that given. Nodes learn their neighbours and the quality of their links from the floods they hear,
+ * and with --relay-rssi or --relay-pdr set, nodes with no neighbour meeting those thresholds do not relay.
+ *
+ * In flood mode, each flood is started by a random node and is for every other node. In unicast mode,
+ * node 1 is a gateway that floods a route advertisement every --advertise-ms, and each frame is sent to
+ * it by a random node. Results are written as one line per node count, as space separated key=value pairs:
+ *
+ *   SIM topology=<t> mode=<m> nodes=<n> ttl=<n> loss_pct=<n> relay_rssi=<n> relay_pdr=<n> frames=<n> delivery_pct=<n.nn> latency_mean_us=<n>
+ *       latency_p95_us=<n> hops_max=<n> tx_per_frame=<n.nn> duplicates_per_rx=<n.nn>
+ *
+ * followed by a single "SIM done" line.
+ */
+
+#include "MicroBitMeshProtocol.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <random>
+#include <vector>
+
+using namespace codal;
+
+#define SIM_SLOT_US             500                             // Time from the start of one transmission to the start of its relay.
+#define SIM_FRAME_INTERVAL_MS   100                             // Time between successive frames.
+#define SIM_RANDOM_DEGREE       8.0                             // Mean number of neighbours of each node in the random topology.
+
+// Protocols carried by simulated frames, as defined in MicroBitMeshRadio.h.
+#define SIM_PROTOCOL_DATAGRAM   1
+#define SIM_PROTOCOL_ROUTE      7
+
+struct SimOptions
+{
+    const char          *topology = "grid";
+    const char          *mode = "flood";
+    std::vector<int>    nodes = { 5, 10, 20, 50, 100, 200 };
+    int                 frames = 200;
+    int                 loss = 10;                              // Percentage of transmissions lost on each link.
+    int                 ttl = 8;
+    int                 relayProbability = 100;
+    int                 copyThreshold = 0;
+    int                 advertise = 5000;                       // Interval between gateway route advertisements, in milliseconds.
+    int                 relayRssi = MICROBIT_MESH_RADIO_RELAY_RSSI_ANY;
+    int                 relayPdr = MICROBIT_MESH_RADIO_RELAY_PDR_ANY;
+    unsigned            seed = 1;
+};
+
+struct SimNode
+{
+    MicroBitMeshProtocol    protocol;
+    std::vector<int>        neighbours;
+    std::vector<int>        rssi;                               // Signal strength of the link from each neighbour, in dBm.
+    std::vector<int>        loss;                               // Percentage of transmissions lost on the link from each neighbour.
+    uint8_t                 seqNo = 0;
+};
+
+// A frame in flight, as received: the mesh header fields the protocol inspects, and the payload of unicast frames.
+struct SimFrame
+{
+    uint16_t            origin;
+    uint8_t             seqNo;
+    uint8_t             protocol;
+    uint8_t             ttl;
+    uint8_t             payload[MICROBIT_MESH_RADIO_UNICAST_HEADER_SIZE];
+};
+
+struct SimResult
+{
+    uint64_t            expected = 0;                           // Deliveries that should have happened.
+    uint64_t            delivered = 0;
+    uint64_t            transmissions = 0;
+    uint64_t            receptions = 0;
+    uint64_t            duplicates = 0;                         // Receptions of a frame the node had already accepted.
+    int                 hopsMax = 0;
+    std::vector<uint32_t> latency;
+};
+
+static std::mt19937 rng;
+
+static int uniform(int max)
+{
+    return std::uniform_int_distribution<int>(0, max - 1)(rng);
+}
+
+/**
+ * Places the nodes, and connects each to those within radio range of it.
+ */
+static void buildTopology(std::vector<SimNode> &nodes, const SimOptions &opt)
+{
+    const char *topology = opt.topology;
+    int n = nodes.size();
+    std::vector<double> x(n), y(n);
+    double range;
+
+    if (strcmp(topology, "line") == 0)
+    {
+        for (int i = 0; i < n; i++)
+            x[i] = i, y[i] = 0;
+        range = 1.5;
+    }
+    else if (strcmp(topology, "random") == 0)
+    {
+        std::uniform_real_distribution<double> d(0.0, 1.0);
+        for (int i = 0; i < n; i++)
+            x[i] = d(rng), y[i] = d(rng);
+        range = sqrt(SIM_RANDOM_DEGREE / (M_PI * n));
+    }
+    else
+    {
+        int width = (int) ceil(sqrt((double) n));
+        for (int i = 0; i < n; i++)
+            x[i] = i % width, y[i] = i / width;
+        range = 1.5;
+    }
+
+    // Links are symmetric, so node i's list of neighbours also describes the links from them to i.
+    for (int i = 0; i < n; i++)
+    {
+        for (int j = 0; j < n; j++)
+        {
+            double d = hypot(x[i] - x[j], y[i] - y[j]) / range;
+
+            if (i != j && d <= 1.0)
+            {
+                nodes[i].neighbours.push_back(j);
+                nodes[i].rssi.push_back(-50 - (int)(40 * d));
+                nodes[i].loss.push_back(std::min(100, (int)(opt.loss * (1.0 + 2.0 * d * d))));
+            }
+        }
+    }
+}
+
+/**
+ * Runs one frame from its originator to completion.
+ *
+ * @param destination The index of the node the frame is for, or -1 if it is for every node.
+ * @param record true if the frame counts towards the results.
+ */
+static void runFrame(std::vector<SimNode> &nodes, const SimOptions &opt, SimResult &result, uint32_t now, int source, int destination, uint8_t protocol, bool record)
+{
+    int n = nodes.size();
+    SimNode &src = nodes[source];
+    SimFrame f;
+
+    f.origin = src.protocol.originId;
+    f.seqNo = ++src.seqNo;
+    f.protocol = protocol;
+    f.ttl = opt.ttl;
+
+    if (protocol == MICROBIT_MESH_RADIO_PROTOCOL_UNICAST)
+    {
+        MeshUnicastHeader h;
+        h.destination = nodes[destination].protocol.originId;
+        h.budget = src.protocol.getBudget(h.destination, now);
+        h.protocol = 0;
+        memcpy(f.payload, &h, sizeof(MeshUnicastHeader));
+    }
+
+    if (record)
+        result.expected += destination < 0 ? n - 1 : 1;
+
+    std::vector<char> sending(n, 0);
+    std::vector<int> heard(n, 0);                               // The strongest signal each node heard in this slot, or 0.
+    sending[source] = 1;
+
+    // Frames are relayed at most ttl - 1 times, so the flood is over by then in any case.
+    for (int hops = 0; hops < opt.ttl; hops++)
+    {
+        std::fill(heard.begin(), heard.end(), 0);
+        bool any = false;
+
+        for (int i = 0; i < n; i++)
+        {
+            if (!sending[i])
+                continue;
+
+            if (record)
+                result.transmissions++;
+
+            for (size_t k = 0; k < nodes[i].neighbours.size(); k++)
+            {
+                int j = nodes[i].neighbours[k];
+
+                if (uniform(100) >= nodes[i].loss[k] && (heard[j] == 0 || nodes[i].rssi[k] > heard[j]))
+                    heard[j] = nodes[i].rssi[k];
+            }
+        }
+
+        std::fill(sending.begin(), sending.end(), 0);
+
+        for (int j = 0; j < n; j++)
+        {
+            if (!heard[j])
+                continue;
+
+            MicroBitMeshProtocol &p = nodes[j].protocol;
+
+            if (record)
+                result.receptions++;
+
+            if (!p.compareSeqNo(f.origin, f.seqNo, now))
+            {
+                if (record && j != source)
+                    result.duplicates++;
+                continue;
+            }
+
+            p.learnRoute(f.origin, hops);
+            p.learnNeighbour(f.origin, f.seqNo, hops, heard[j], now);
+            sending[j] = p.shouldRelay(f.protocol, f.payload, hops, f.ttl, now, uniform(100));
+            any |= sending[j];
+
+            if (record && (destination < 0 || destination == j))
+            {
+                result.delivered++;
+                result.latency.push_back((hops + 1) * SIM_SLOT_US);
+                result.hopsMax = std::max(result.hopsMax, hops + 1);
+            }
+        }
+
+        if (!any)
+            break;
+    }
+}
+
+static void simulate(const SimOptions &opt, int count)
+{
+    std::vector<SimNode> nodes(count);
+    SimResult result;
+    bool unicast = strcmp(opt.mode, "unicast") == 0;
+    uint32_t now = 0;
+    uint32_t advertised = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        nodes[i].protocol.originId = i + 1;
+        nodes[i].protocol.relayProbability = opt.relayProbability;
+        nodes[i].protocol.relayCopyThreshold = opt.copyThreshold;
+        nodes[i].protocol.relayRssiThreshold = opt.relayRssi;
+        nodes[i].protocol.relayPdrThreshold = opt.relayPdr;
+    }
+
+    buildTopology(nodes, opt);
+
+    if (unicast)
+        runFrame(nodes, opt, result, now, 0, -1, SIM_PROTOCOL_ROUTE, false);
+
+    for (int f = 0; f < opt.frames; f++)
+    {
+        now += SIM_FRAME_INTERVAL_MS;
+
+        if (unicast)
+        {
+            // The gateway's route advertisements are overhead, and are not counted in the results.
+            if (now - advertised >= (uint32_t) opt.advertise)
+            {
+                runFrame(nodes, opt, result, now, 0, -1, SIM_PROTOCOL_ROUTE, false);
+                advertised = now;
+            }
+
+            runFrame(nodes, opt, result, now, 1 + uniform(count - 1), 0, MICROBIT_MESH_RADIO_PROTOCOL_UNICAST, true);
+        }
+        else
+        {
+            runFrame(nodes, opt, result, now, uniform(count), -1, SIM_PROTOCOL_DATAGRAM, true);
+        }
+    }
+
+    std::sort(result.latency.begin(), result.latency.end());
+
+    uint64_t total = 0;
+    for (uint32_t l : result.latency)
+        total += l;
+
+    size_t delivered = result.latency.size();
+
+    printf("SIM topology=%s mode=%s nodes=%d ttl=%d loss_pct=%d relay_rssi=%d relay_pdr=%d frames=%d delivery_pct=%.2f latency_mean_us=%d"
+        " latency_p95_us=%d hops_max=%d tx_per_frame=%.2f duplicates_per_rx=%.2f\n",
+        opt.topology, opt.mode, count, opt.ttl, opt.loss, opt.relayRssi, opt.relayPdr, opt.frames,
+        result.expected ? 100.0 * result.delivered / result.expected : 0.0,
+        delivered ? (int)(total / delivered) : 0, delivered ? (int) result.latency[(delivered * 95) / 100] : 0,
+        result.hopsMax, (double) result.transmissions / opt.frames,
+        result.receptions ? (double) result.duplicates / result.receptions : 0.0);
+}
+
+static std::vector<int> parseList(const char *s)
+{
+    std::vector<int> values;
+
+    while (*s)
+    {
+        values.push_back(atoi(s));
+        while (*s && *s != ',')
+            s++;
+        if (*s)
+            s++;
+    }
+
+    return values;
+}
+
+int main(int argc, char **argv)
+{
+    SimOptions opt;
+
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        const char *arg = argv[i];
+        const char *value = argv[i + 1];
+
+        if (strcmp(arg, "--topology") == 0) opt.topology = value;
+        else if (strcmp(arg, "--mode") == 0) opt.mode = value;
+        else if (strcmp(arg, "--nodes") == 0) opt.nodes = parseList(value);
+        else if (strcmp(arg, "--frames") == 0) opt.frames = atoi(value);
+        else if (strcmp(arg, "--loss") == 0) opt.loss = atoi(value);
+        else if (strcmp(arg, "--ttl") == 0) opt.ttl = atoi(value);
+        else if (strcmp(arg, "--relay-probability") == 0) opt.relayProbability = atoi(value);
+        else if (strcmp(arg, "--copy-threshold") == 0) opt.copyThreshold = atoi(value);
+        else if (strcmp(arg, "--advertise-ms") == 0) opt.advertise = atoi(value);
+        else if (strcmp(arg, "--relay-rssi") == 0) opt.relayRssi = atoi(value);
+        else if (strcmp(arg, "--relay-pdr") == 0) opt.relayPdr = atoi(value);
+        else if (strcmp(arg, "--seed") == 0) opt.seed = strtoul(value, NULL, 0);
+        else
+        {
+            fprintf(stderr, "unknown option %s\n", arg);
+            return 1;
+        }
+    }
+
+    if (opt.ttl < 1 || opt.ttl > 255 || opt.frames < 1 || opt.relayProbability < 0 || opt.relayProbability > 100
+        || opt.relayRssi < -128 || opt.relayRssi > 0 || opt.relayPdr < 0 || opt.relayPdr > 100)
+    {
+        fprintf(stderr, "invalid option value\n");
+        return 1;
+    }
+
+    for (int count : opt.nodes)
+    {
+        if (count < 2)
+            continue;
+
+        rng.seed(opt.seed);
+        simulate(opt, count);
+    }
+
+    printf("SIM done\n");
+    return 0;
+}
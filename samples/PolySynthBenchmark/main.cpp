@@ -0,0 +1,100 @@
+/*
+ * PolySynth benchmark.
+ *
+ * Measures the cost of rendering the MicroSynth PolySynth with an increasing number of
+ * active voices. Build this file in place of samples/main.cpp, with CODAL_POLYSYNTH enabled.
+ * Results are written to the serial port, one line per voice count, as space separated key=value pairs:
+ *
+ *   BENCH name=<name> voices=<n> blocks=<n> time_us=<n> block_us=<n> p50_us=<n> p99_us=<n> load_pct=<n> limit=<n>
+ *
+ * followed by a single "BENCH done" line. load_pct is the share of the CPU needed to render
+ * the synth in real time at SynthSampleRate, so anything below 100 leaves headroom. limit is the
+number of voices PolySynth will allow at the measured cost, which may shed voices from the larger runs.
+ */
+
+#include "MicroBit.h"
+#include "MicroSynth.h"
+
+MicroBit uBit;
+
+#define BENCH_BLOCKS            100                             // Blocks of SynthBlockSize samples timed per benchmark.
+#define BENCH_MAX_VOICES        12
+
+static uint32_t latency[BENCH_BLOCKS];
+static uint16_t output[SynthBlockSize];
+
+// A reasonably expensive patch: pulse and saw with PM, noise, and a modulated resonant filter.
+static const SynthPreset preset = {
+    OscType::Pulse, OscType::Saw,       // osc1Shape, osc2Shape
+    7.f,                                // osc2Transpose
+    0.5f, 0.4f,                         // osc1Vol, osc2Vol
+    0.f, 0.f,                           // osc1Pw, osc2Pw
+    0.3f, 0.f,                          // osc1Pwm, osc2Pwm
+    0.1f,                               // fmAmount
+    FilterType::LPF,                    // filterType
+    0.5f, 0.6f,                         // filterCutoff, filterReso
+    0.4f, 0.2f, 0.3f,                   // filterEnv, filterLfo, filterKeyFollow
+    0.01f, 0.3f, 0.7f, 0.5f,            // envA, envD, envS, envR
+    OscType::Triangle, 3.f,             // lfoShape, lfoFreq
+    5.f, 0.1f,                          // vibFreq, vibAmount
+    0.1f,                               // gain
+    0.f,                                // tune
+    0.05f,                              // noise
+    false                               // ampGate
+};
+
+static int compareLatency(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+/**
+ * Renders BENCH_BLOCKS blocks with the given number of held notes, and reports the result.
+ *
+ * @param voices The number of voices to keep active.
+ */
+static void benchmarkVoices(int voices)
+{
+    PolySynth synth(voices);
+    uint64_t total = 0;
+
+    for (int i = 0; i < voices; i++)
+        synth.noteOn(48 + i * 3, 1.f, 0.f, &preset);
+
+    for (int i = 0; i < BENCH_BLOCKS; i++)
+    {
+        CODAL_TIMESTAMP start = system_timer_current_time_us();
+        synth.process(output, SynthBlockSize);
+        latency[i] = system_timer_current_time_us() - start;
+        total += latency[i];
+    }
+
+    qsort(latency, BENCH_BLOCKS, sizeof(uint32_t), compareLatency);
+
+    uint32_t time = total ? (uint32_t)total : 1;
+    uint32_t block = time / BENCH_BLOCKS;
+    uint32_t period = (uint32_t)(((uint64_t)SynthBlockSize * 1000000) / SynthSampleRate);
+
+    uBit.serial.printf("BENCH name=polysynth voices=%d blocks=%d time_us=%d block_us=%d p50_us=%d p99_us=%d load_pct=%d limit=%d\r\n",
+        voices, BENCH_BLOCKS, (int)time, (int)block, (int)latency[BENCH_BLOCKS / 2],
+        (int)latency[(BENCH_BLOCKS * 99) / 100], (int)((block * 100) / period), synth.getVoiceLimit());
+}
+
+int
+main()
+{
+    uBit.init();
+
+    uBit.serial.printf("BENCH start\r\n");
+
+    for (int voices = 1; voices <= BENCH_MAX_VOICES; voices = voices < 4 ? voices * 2 : voices + 2)
+        benchmarkVoices(voices);
+
+    uBit.serial.printf("BENCH done\r\n");
+
+    while(1)
+        uBit.sleep(1000);
+}
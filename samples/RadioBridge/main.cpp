@@ -0,0 +1,52 @@
+/*
+ * Radio to serial gateway example.
+ *
+ * Forwards every frame received on the radio to the serial port as framed binary records, with the
+ * signal strength and time of each, and transmits frames sent by the host. Use radio_bridge.py in this
+ * directory on the host to print received frames, or send datagrams. Build this file in place of
+ * samples/main.cpp. The serial port runs at MICROBIT_RADIO_BRIDGE_BAUD whilst bridging.
+ *
+ * Button A toggles the bridge on and off. The display shows a pixel for each second in which frames
+ * were forwarded, and a cross if any were dropped.
+ */
+
+#include "MicroBit.h"
+
+MicroBit uBit;
+MicroBitRadioBridge bridge(uBit.serial, uBit.serialQueue);
+
+static void onButtonA(MicroBitEvent)
+{
+    if (bridge.isEnabled())
+        bridge.stop();
+    else
+        bridge.start(uBit.radio);
+}
+
+int
+main()
+{
+    uBit.init();
+    uBit.radio.enable();
+
+    uBit.messageBus.listen(MICROBIT_ID_BUTTON_A, MICROBIT_BUTTON_EVT_CLICK, onButtonA);
+    bridge.start(uBit.radio);
+
+    RadioBridgeStats last;
+    bridge.getStats(last);
+
+    for (int second = 0;; second++)
+    {
+        RadioBridgeStats stats;
+
+        uBit.sleep(1000);
+        bridge.getStats(stats);
+
+        if (stats.dropped != last.dropped)
+            uBit.display.print('X');
+        else
+            uBit.display.image.setPixelValue(second % 5, (second / 5) % 5, stats.forwarded != last.forwarded ? 255 : 0);
+
+        last = stats;
+    }
+}
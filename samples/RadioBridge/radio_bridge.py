@@ -0,0 +1,122 @@
+#!/usr/bin/env python3
+"""
+Host side of the radio to serial gateway in samples/RadioBridge/main.cpp.
+
+Reads the COBS framed records written by MicroBitRadioBridge, and prints one line per frame received
+by the gateway's radio, with its signal strength and the gateway's receive timestamp. Datagrams may
+also be sent on the gateway's radio. Records are delimited by zero bytes, so any text sharing the
+serial port (such as DMESG output) is skipped.
+
+Requires the pyserial package (pip install pyserial).
+
+    python3 radio_bridge.py /dev/ttyACM0 [--baud 1000000] [--send "hello"] [--mesh]
+"""
+
+import argparse
+import struct
+import sys
+
+import serial
+
+TYPE_RADIO = 0x01
+TYPE_MESH = 0x02
+FLAG_DROPPED = 0x01
+HEADER = struct.Struct("<BBBI")
+RADIO_HEADER = struct.Struct("<BBBB")
+MESH_HEADER = struct.Struct("<BBBBHBBB")
+PROTOCOL_DATAGRAM = 1
+
+
+def cobs_encode(data):
+    out = bytearray()
+    block = bytearray()
+    for b in data:
+        if b == 0:
+            out += bytes([len(block) + 1]) + block
+            block = bytearray()
+            continue
+        block.append(b)
+        if len(block) == 254:
+            out += b"\xff" + block
+            block = bytearray()
+    out += bytes([len(block) + 1]) + block
+    return bytes(out) + b"\x00"
+
+
+def cobs_decode(data):
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        code = data[i]
+        if code == 0 or i + code > len(data):
+            return None
+        out += data[i + 1:i + code]
+        i += code
+        if code != 0xFF and i < len(data):
+            out.append(0)
+    return bytes(out)
+
+
+def describe(record):
+    if len(record) < HEADER.size + 1:
+        return None
+    kind, flags, rssi, timestamp = HEADER.unpack_from(record)
+    frame = record[HEADER.size:]
+    line = "t_us={} rssi=-{}".format(timestamp, rssi)
+    if flags & FLAG_DROPPED:
+        line += " dropped_before=1"
+    if kind == TYPE_RADIO and len(frame) >= RADIO_HEADER.size:
+        _, version, group, protocol = RADIO_HEADER.unpack_from(frame)
+        payload = frame[RADIO_HEADER.size:]
+        return "RX radio {} group={} protocol={} payload={}".format(line, group, protocol, payload.hex())
+    if kind == TYPE_MESH and len(frame) >= MESH_HEADER.size:
+        _, version, group, protocol, origin, seq, hops, ttl = MESH_HEADER.unpack_from(frame)
+        payload = frame[MESH_HEADER.size:]
+        return "RX mesh {} group={} protocol={} origin=0x{:04x} seq={} hops={} ttl={} payload={}".format(
+            line, group, protocol, origin, seq, hops, ttl, payload.hex())
+    return None
+
+
+def datagram(text, mesh):
+    payload = text.encode()
+    if mesh:
+        # The gateway fills in the origin, sequence number, hop count and hop limit as it sends the frame.
+        frame = MESH_HEADER.pack(MESH_HEADER.size - 1 + len(payload), 1, 0, PROTOCOL_DATAGRAM, 0, 0, 0, 0) + payload
+        return cobs_encode(bytes([TYPE_MESH]) + frame)
+    frame = RADIO_HEADER.pack(RADIO_HEADER.size - 1 + len(payload), 1, 0, PROTOCOL_DATAGRAM) + payload
+    return cobs_encode(bytes([TYPE_RADIO]) + frame)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("port", help="serial port of the gateway")
+    parser.add_argument("--baud", type=int, default=1000000, help="baud rate, as MICROBIT_RADIO_BRIDGE_BAUD")
+    parser.add_argument("--send", help="send this text as a datagram, then continue printing received frames")
+    parser.add_argument("--mesh", action="store_true", help="the gateway is bridging a MicroBitMeshRadio")
+    args = parser.parse_args()
+
+    port = serial.Serial(args.port, args.baud, timeout=1)
+
+    if args.send is not None:
+        port.write(datagram(args.send, args.mesh))
+
+    # Discard anything before the first delimiter, as we may have joined part way through a record.
+    pending = bytearray()
+    synced = False
+    while True:
+        pending += port.read(max(1, port.in_waiting))
+        while b"\x00" in pending:
+            encoded, _, pending = bytes(pending).partition(b"\x00")
+            pending = bytearray(pending)
+            if not synced:
+                synced = True
+                continue
+            record = cobs_decode(encoded)
+            line = describe(record) if record else None
+            if line:
+                print(line)
+                sys.stdout.flush()
+
+
+if __name__ == "__main__":
+    main()
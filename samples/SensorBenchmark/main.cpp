@@ -0,0 +1,173 @@
+/*
+ * Sensor sampling benchmark.
+ *
+ * Sweeps the sample period of the accelerometer and compass, and measures the rate at which
+ * new samples are delivered, the latency of reading a sample, and the load each rate places
+ * on the internal I2C bus. Build this file in place of samples/main.cpp, with
+ * CONFIG_MICROBIT_I2C_STATS enabled. Results are written to the serial port, one line per
+ * rate, as space separated key=value pairs:
+ *
+ *   BENCH name=<sensor> period_ms=<n> updates=<n> updates_per_s=<n> p50_us=<n> p99_us=<n> max_us=<n>
+ *         i2c_transactions=<n> i2c_bytes=<n> i2c_errors=<n> i2c_busy_us=<n> i2c_util_pct=<n.nn>
+ *
+ * then one line per I2C device address seen in a final window with both sensors running:
+ *
+ *   BENCH name=i2c address=<0xnn> transactions=<n> bytes=<n> errors=<n> busy_us=<n> mean_us=<n> max_us=<n>
+ *
+ * followed by a single "BENCH done" line.
+ */
+
+#include "MicroBit.h"
+
+MicroBit uBit;
+
+#define BENCH_SAMPLES           200                             // Maximum number of reads timed per rate.
+#define BENCH_WINDOW_MS         2000                            // Time spent at each rate.
+
+static const int periods[] = { 80, 40, 20, 10, 5, 2, 1 };      // Requested sample periods, in milliseconds.
+
+static uint32_t latency[BENCH_SAMPLES];
+static volatile uint32_t updates;
+
+static int compareLatency(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+static void onUpdate(MicroBitEvent)
+{
+    updates++;
+}
+
+/**
+ * Reports a completed rate, given the latency of each of its reads in latency[].
+ *
+ * @param name The name of the sensor.
+ * @param period The sample period actually in use, in milliseconds.
+ * @param ops The number of reads timed.
+ * @param elapsed The length of the measurement window, in microseconds.
+ */
+static void report(const char *name, int period, int ops, uint32_t elapsed)
+{
+    MicroBitI2CStats *bus = uBit._i2c.getStats();
+    int util = uBit._i2c.getUtilisation();
+
+    qsort(latency, ops, sizeof(uint32_t), compareLatency);
+
+    uBit.serial.printf("BENCH name=%s period_ms=%d updates=%d updates_per_s=%d p50_us=%d p99_us=%d max_us=%d",
+        name, period, (int)updates, (int)(((uint64_t)updates * 1000000) / (elapsed ? elapsed : 1)),
+        ops ? (int)latency[ops / 2] : 0, ops ? (int)latency[(ops * 99) / 100] : 0, ops ? (int)latency[ops - 1] : 0);
+
+    if (bus)
+        uBit.serial.printf(" i2c_transactions=%d i2c_bytes=%d i2c_errors=%d i2c_busy_us=%d i2c_util_pct=%d.%02d",
+            (int)bus->transactions, (int)bus->bytes, (int)bus->errors, (int)bus->busyTime, util / 100, util % 100);
+
+    uBit.serial.printf("\r\n");
+}
+
+/**
+ * Reads a sensor as fast as it can deliver new data for BENCH_WINDOW_MS, at each period in turn.
+ *
+ * @param name The name of the sensor.
+ * @param id The event bus id that the sensor raises its data update events on.
+ * @param evt The value of the sensor's data update event.
+ * @param setPeriod Sets the sensor's sample period, in milliseconds.
+ * @param getPeriod Determines the sample period actually in use, in milliseconds.
+ * @param read Reads a sample from the sensor.
+ */
+static void sweep(const char *name, uint16_t id, uint16_t evt, void (*setPeriod)(int), int (*getPeriod)(), void (*read)())
+{
+    uBit.messageBus.listen(id, evt, onUpdate, MESSAGE_BUS_LISTENER_IMMEDIATE);
+
+    for (int p : periods)
+    {
+        setPeriod(p);
+
+        int period = getPeriod();
+        int ops = 0;
+
+        // Discard anything in flight from the previous rate.
+        read();
+        uBit.sleep(period);
+
+        updates = 0;
+        uBit._i2c.resetStats();
+        CODAL_TIMESTAMP start = system_timer_current_time_us();
+        CODAL_TIMESTAMP end = start + BENCH_WINDOW_MS * 1000;
+
+        while (system_timer_current_time_us() < end)
+        {
+            CODAL_TIMESTAMP t = system_timer_current_time_us();
+            read();
+            t = system_timer_current_time_us() - t;
+
+            if (ops < BENCH_SAMPLES)
+                latency[ops++] = (uint32_t)t;
+            else
+                latency[uBit.random(BENCH_SAMPLES)] = (uint32_t)t;
+
+            // Poll at twice the sample rate, so that every sample is collected without saturating the bus.
+            fiber_sleep(period > 1 ? period / 2 : 1);
+        }
+
+        report(name, period, ops, (uint32_t)(system_timer_current_time_us() - start));
+    }
+
+    uBit.messageBus.ignore(id, evt, onUpdate);
+}
+
+static void accelerometerSetPeriod(int period) { uBit.accelerometer.setPeriod(period); }
+static int accelerometerGetPeriod() { return uBit.accelerometer.getPeriod(); }
+static void accelerometerRead() { uBit.accelerometer.getSample(); }
+
+static void compassSetPeriod(int period) { uBit.compass.setPeriod(period); }
+static int compassGetPeriod() { return uBit.compass.getPeriod(); }
+static void compassRead() { uBit.compass.getSample(); }
+
+static void reportAddresses()
+{
+    // The sweeps reset the statistics at each rate, so take one more window with both sensors at their default rate.
+    uBit.accelerometer.setPeriod(20);
+    uBit.compass.setPeriod(20);
+    uBit._i2c.resetStats();
+
+    for (int i = 0; i < BENCH_WINDOW_MS / 10; i++)
+    {
+        uBit.accelerometer.getSample();
+        uBit.compass.getSample();
+        uBit.sleep(10);
+    }
+
+    for (uint16_t address = 2; address < 256; address += 2)
+    {
+        MicroBitI2CStats *s = uBit._i2c.getStats(address);
+
+        if (s)
+            uBit.serial.printf("BENCH name=i2c address=0x%x transactions=%d bytes=%d errors=%d busy_us=%d mean_us=%d max_us=%d\r\n",
+                (int)s->address, (int)s->transactions, (int)s->bytes, (int)s->errors, (int)s->busyTime,
+                (int)(s->busyTime / s->transactions), (int)s->maxTime);
+    }
+}
+
+int
+main()
+{
+    uBit.init();
+
+    uBit.serial.printf("BENCH start\r\n");
+
+    if (uBit._i2c.getStats() == NULL)
+        uBit.serial.printf("BENCH note=i2c_stats_disabled\r\n");
+
+    sweep("accelerometer", DEVICE_ID_ACCELEROMETER, ACCELEROMETER_EVT_DATA_UPDATE, accelerometerSetPeriod, accelerometerGetPeriod, accelerometerRead);
+    sweep("compass", DEVICE_ID_COMPASS, COMPASS_EVT_DATA_UPDATE, compassSetPeriod, compassGetPeriod, compassRead);
+    reportAddresses();
+
+    uBit.serial.printf("BENCH done\r\n");
+
+    while(1)
+        uBit.sleep(1000);
+}
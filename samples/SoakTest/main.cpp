@@ -0,0 +1,406 @@
+/*
+ * Concurrent workload soak test.
+ *
+ * Runs a configurable mix of mesh radio traffic, audio synthesis, display animation and data logging at the
+ * same time, so that interactions between their interrupts, fibers and I2C traffic show up under a sustained load.
+ * Build this file in place of samples/main.cpp, ideally with CONFIG_AUDIO_STATS and CONFIG_MICROBIT_SCHEDULER_TRACE
+ * enabled, and run it on two or more micro:bits so that each receives the others' mesh traffic.
+ *
+ * The workloads in use are a bitmask of SOAK_MESH, SOAK_AUDIO, SOAK_DISPLAY and SOAK_LOG, given by SOAK_WORKLOADS.
+ * With SOAK_SWEEP enabled, every combination is run in turn. Button A moves on to the next combination at any time.
+ * Results are written to the serial port at the end of each window of SOAK_WINDOW_MS, as space separated key=value pairs:
+ *
+ *   BENCH name=soak window=<n> mix=<n> uptime_s=<n> idle_pct=<n.nn>
+ *         mesh_tx=<n> mesh_rx=<n> mesh_lost=<n> mesh_drop_pct=<n.nn> mesh_crc_errors=<n> mesh_overflows=<n>
+ *         audio_pulls=<n> audio_late=<n> audio_underruns=<n> audio_max_us=<n>
+ *         display_frames=<n> display_late=<n>
+ *         log_rows=<n> log_p50_us=<n> log_p99_us=<n> log_max_us=<n> log_clears=<n>
+ *
+ * followed by a single "BENCH done" line once SOAK_DURATION_S has elapsed, if it is not zero.
+ * mesh_lost counts gaps in the sequence numbers received from each other node. Missed audio deadlines are the late
+ * and underrun counts of the mixer, and idle_pct is the share of the window the scheduler spent waiting for an event.
+ * Statistics that are not compiled in are reported as -1.
+ *
+ * Bluetooth is not part of the mix, as the mesh radio and the BLE stack cannot share the radio.
+ *
+ * @warning This test clears the data log whenever it fills.
+ */
+
+#include "MicroBit.h"
+
+MicroBit uBit;
+
+#define SOAK_MESH               0x01
+#define SOAK_AUDIO              0x02
+#define SOAK_DISPLAY            0x04
+#define SOAK_LOG                0x08
+#define SOAK_ALL                0x0F
+
+#ifndef SOAK_WORKLOADS
+#define SOAK_WORKLOADS          SOAK_ALL                        // The workloads to run, unless sweeping.
+#endif
+
+#ifndef SOAK_SWEEP
+#define SOAK_SWEEP              0                               // Set to 1 to run every combination of workloads in turn.
+#endif
+
+#ifndef SOAK_SWEEP_WINDOWS
+#define SOAK_SWEEP_WINDOWS      3                               // Windows spent on each combination when sweeping.
+#endif
+
+#ifndef SOAK_WINDOW_MS
+#define SOAK_WINDOW_MS          10000                           // Time covered by each report.
+#endif
+
+#ifndef SOAK_DURATION_S
+#define SOAK_DURATION_S         0                               // Length of the test in seconds, or zero to run until reset.
+#endif
+
+#ifndef SOAK_MESH_INTERVAL_MS
+#define SOAK_MESH_INTERVAL_MS   20                              // Time between datagrams sent by each node.
+#endif
+
+#ifndef SOAK_MESH_PAYLOAD
+#define SOAK_MESH_PAYLOAD       16                              // Size of each datagram, in bytes (at least 8).
+#endif
+
+#ifndef SOAK_DISPLAY_FRAME_MS
+#define SOAK_DISPLAY_FRAME_MS   20                              // Time between frames of the display animation.
+#endif
+
+#ifndef SOAK_LOG_INTERVAL_MS
+#define SOAK_LOG_INTERVAL_MS    50                              // Time between rows written to the data log.
+#endif
+
+#define SOAK_SAMPLES            256                             // Maximum number of log rows timed per window.
+#define SOAK_NODES              8                               // Maximum number of other nodes whose traffic is tracked.
+
+struct SoakNode
+{
+    uint32_t            serial;                                 // The serial number of the node.
+    uint32_t            sequence;                               // The last sequence number received from it.
+};
+
+struct SoakCounters
+{
+    uint32_t            meshTx;
+    uint32_t            meshRx;
+    uint32_t            meshLost;
+    uint32_t            displayFrames;
+    uint32_t            displayLate;
+    uint32_t            logRows;
+    uint32_t            logClears;
+};
+
+static const char * const sounds[] = { "giggle", "happy", "hello", "spring", "twinkle", "yawn" };
+
+static volatile uint8_t workloads;
+static SoakCounters counters;
+static SoakNode nodes[SOAK_NODES];
+static int nodeCount;
+static uint32_t latency[SOAK_SAMPLES];
+static int latencyCount;
+
+static int compareLatency(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+static void putWord(uint8_t *p, uint32_t v)
+{
+    p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+static uint32_t getWord(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/**
+ * Changes the mix of workloads, enabling or disabling the mesh radio as needed.
+ *
+ * @param mix The new bitmask of workloads.
+ */
+static void setWorkloads(uint8_t mix)
+{
+    if ((mix & SOAK_MESH) && !(workloads & SOAK_MESH))
+        uBit.meshRadio.enable();
+
+    if (!(mix & SOAK_MESH) && (workloads & SOAK_MESH))
+        uBit.meshRadio.disable();
+
+    if (!(mix & SOAK_DISPLAY))
+        uBit.display.clear();
+
+    workloads = mix;
+}
+
+/**
+ * Determines the next combination of workloads, skipping the empty one.
+ */
+static uint8_t nextWorkloads(uint8_t mix)
+{
+    return (mix % SOAK_ALL) + 1;
+}
+
+static void onButtonA(MicroBitEvent)
+{
+    setWorkloads(nextWorkloads(workloads));
+}
+
+/**
+ * Counts each datagram received, and any gap in the sequence numbers of the node that sent it.
+ */
+static void onDatagram(MicroBitEvent)
+{
+    uint8_t buf[SOAK_MESH_PAYLOAD];
+
+    while (uBit.meshRadio.datagram.recv(buf, sizeof(buf)) >= 8)
+    {
+        uint32_t serial = getWord(&buf[0]);
+        uint32_t sequence = getWord(&buf[4]);
+        int i;
+
+        counters.meshRx++;
+
+        for (i = 0; i < nodeCount && nodes[i].serial != serial; i++);
+
+        if (i == nodeCount)
+        {
+            if (nodeCount == SOAK_NODES)
+                continue;
+
+            nodes[nodeCount].serial = serial;
+            nodes[nodeCount].sequence = sequence;
+            nodeCount++;
+            continue;
+        }
+
+        if ((int32_t)(sequence - nodes[i].sequence) > 1)
+            counters.meshLost += sequence - nodes[i].sequence - 1;
+
+        if ((int32_t)(sequence - nodes[i].sequence) > 0)
+            nodes[i].sequence = sequence;
+    }
+}
+
+static void meshWorkload()
+{
+    uint8_t buf[SOAK_MESH_PAYLOAD];
+    uint32_t serial = microbit_serial_number();
+    uint32_t sequence = 0;
+
+    // Sequence numbers advance only when a datagram is accepted, so that gaps seen by a receiver are frames lost in the air.
+    while(1)
+    {
+        if (workloads & SOAK_MESH)
+        {
+            for (int i = 8; i < SOAK_MESH_PAYLOAD; i++)
+                buf[i] = sequence + i;
+
+            putWord(&buf[0], serial);
+            putWord(&buf[4], sequence);
+
+            if (uBit.meshRadio.datagram.send(buf, sizeof(buf)) == DEVICE_OK)
+            {
+                counters.meshTx++;
+                sequence++;
+            }
+        }
+
+        uBit.sleep(SOAK_MESH_INTERVAL_MS);
+    }
+}
+
+static void audioWorkload()
+{
+    for (int i = 0;; i = (i + 1) % (int)(sizeof(sounds) / sizeof(sounds[0])))
+    {
+        if (workloads & SOAK_AUDIO)
+            uBit.audio.soundExpressions.play(sounds[i]);
+        else
+            uBit.sleep(100);
+    }
+}
+
+static void displayWorkload()
+{
+    CODAL_TIMESTAMP due = system_timer_current_time();
+
+    for (int frame = 0;; frame++)
+    {
+        if (workloads & SOAK_DISPLAY)
+        {
+            // A diagonal wave of brightness, so that every row and a range of levels are in use.
+            for (int y = 0; y < 5; y++)
+                for (int x = 0; x < 5; x++)
+                    uBit.display.image.setPixelValue(x, y, ((frame + x + y) * 32) & 0xFF);
+
+            counters.displayFrames++;
+        }
+
+        due += SOAK_DISPLAY_FRAME_MS;
+
+        CODAL_TIMESTAMP now = system_timer_current_time();
+
+        // A frame is late if it starts over a whole frame after it was due, and the animation then catches up.
+        if (now > due + SOAK_DISPLAY_FRAME_MS)
+        {
+            if (workloads & SOAK_DISPLAY)
+                counters.displayLate++;
+
+            due = now;
+        }
+
+        if (due > now)
+            uBit.sleep(due - now);
+    }
+}
+
+static void logWorkload()
+{
+    for (int row = 0;; row++)
+    {
+        if (workloads & SOAK_LOG)
+        {
+            if (uBit.log.isFull())
+            {
+                uBit.log.clear(false);
+                counters.logClears++;
+            }
+
+            CODAL_TIMESTAMP t = system_timer_current_time_us();
+
+            uBit.log.beginRow();
+            uBit.log.logData("row", row);
+            uBit.log.logData("temperature", uBit.thermometer.getTemperature());
+            uBit.log.logData("x", uBit.accelerometer.getX());
+            uBit.log.endRow();
+
+            t = system_timer_current_time_us() - t;
+
+            if (latencyCount < SOAK_SAMPLES)
+                latency[latencyCount++] = (uint32_t)t;
+            else
+                latency[uBit.random(SOAK_SAMPLES)] = (uint32_t)t;
+
+            counters.logRows++;
+        }
+
+        uBit.sleep(SOAK_LOG_INTERVAL_MS);
+    }
+}
+
+/**
+ * Clears all statistics, at the start of a window.
+ */
+static void resetWindow()
+{
+    memset(&counters, 0, sizeof(counters));
+    latencyCount = 0;
+
+    uBit.meshRadio.resetStats();
+    microbit_trace_reset();
+#if CONFIG_ENABLED(CONFIG_AUDIO_STATS)
+    uBit.audio.mixer.resetStats();
+#endif
+}
+
+/**
+ * Reports the statistics gathered over a window.
+ *
+ * @param window The number of the window.
+ * @param mix The workloads that ran throughout the window.
+ * @param elapsed The length of the window, in microseconds.
+ */
+static void report(int window, uint8_t mix, uint32_t elapsed)
+{
+    SoakCounters c = counters;
+    RadioLinkStats link;
+    MicroBitSchedulerStats *sched = microbit_trace_get_scheduler_stats();
+
+    uBit.meshRadio.getStats(link);
+
+    int idle = sched ? (int)(((uint64_t)sched->waitTime * 10000) / (elapsed ? elapsed : 1)) : -1;
+    int drop = (c.meshRx + c.meshLost) ? (int)(((uint64_t)c.meshLost * 10000) / (c.meshRx + c.meshLost)) : 0;
+
+    uBit.serial.printf("BENCH name=soak window=%d mix=%d uptime_s=%d", window, mix, (int)(system_timer_current_time() / 1000));
+
+    if (idle < 0)
+        uBit.serial.printf(" idle_pct=-1");
+    else
+        uBit.serial.printf(" idle_pct=%d.%02d", idle / 100, idle % 100);
+
+    uBit.serial.printf(" mesh_tx=%d mesh_rx=%d mesh_lost=%d mesh_drop_pct=%d.%02d mesh_crc_errors=%d mesh_overflows=%d",
+        (int)c.meshTx, (int)c.meshRx, (int)c.meshLost, drop / 100, drop % 100, (int)link.rxCrcErrors, (int)link.rxOverflows);
+
+#if CONFIG_ENABLED(CONFIG_AUDIO_STATS)
+    AudioStageStats &audio = uBit.audio.mixer.getStats();
+    uBit.serial.printf(" audio_pulls=%d audio_late=%d audio_underruns=%d audio_max_us=%d",
+        (int)audio.pulls, (int)audio.late, (int)audio.underruns, (int)audio.maxTime);
+#else
+    uBit.serial.printf(" audio_pulls=-1 audio_late=-1 audio_underruns=-1 audio_max_us=-1");
+#endif
+
+    uBit.serial.printf(" display_frames=%d display_late=%d", (int)c.displayFrames, (int)c.displayLate);
+
+    int ops = latencyCount;
+    qsort(latency, ops, sizeof(uint32_t), compareLatency);
+
+    uBit.serial.printf(" log_rows=%d log_p50_us=%d log_p99_us=%d log_max_us=%d log_clears=%d\r\n",
+        (int)c.logRows, ops ? (int)latency[ops / 2] : 0, ops ? (int)latency[(ops * 99) / 100] : 0,
+        ops ? (int)latency[ops - 1] : 0, (int)c.logClears);
+}
+
+int
+main()
+{
+    uBit.init();
+
+    uBit.serial.printf("BENCH start\r\n");
+
+    if (microbit_trace_get_scheduler_stats() == NULL)
+        uBit.serial.printf("BENCH note=scheduler_trace_disabled\r\n");
+
+#if !CONFIG_ENABLED(CONFIG_AUDIO_STATS)
+    uBit.serial.printf("BENCH note=audio_stats_disabled\r\n");
+#endif
+
+    uBit.log.setTimeStamp(TimeStampFormat::Milliseconds);
+    uBit.messageBus.listen(DEVICE_ID_RADIO, MICROBIT_MESH_RADIO_EVT_DATAGRAM, onDatagram);
+    uBit.messageBus.listen(DEVICE_ID_BUTTON_A, DEVICE_BUTTON_EVT_CLICK, onButtonA);
+
+    setWorkloads(SOAK_SWEEP ? 1 : SOAK_WORKLOADS);
+
+    create_fiber(meshWorkload);
+    create_fiber(audioWorkload);
+    create_fiber(displayWorkload);
+    create_fiber(logWorkload);
+
+    CODAL_TIMESTAMP end = system_timer_current_time() + (CODAL_TIMESTAMP)SOAK_DURATION_S * 1000;
+
+    for (int window = 0; SOAK_DURATION_S == 0 || system_timer_current_time() < end; window++)
+    {
+        uint8_t mix = workloads;
+
+        resetWindow();
+        CODAL_TIMESTAMP start = system_timer_current_time_us();
+        uBit.sleep(SOAK_WINDOW_MS);
+
+        // A window in which the mix was changed by button A describes neither mix, so is not reported.
+        if (workloads == mix)
+            report(window, mix, (uint32_t)(system_timer_current_time_us() - start));
+
+        if (SOAK_SWEEP && (window + 1) % SOAK_SWEEP_WINDOWS == 0)
+            setWorkloads(nextWorkloads(workloads));
+    }
+
+    setWorkloads(0);
+    uBit.serial.printf("BENCH done\r\n");
+
+    while(1)
+        uBit.sleep(1000);
+}
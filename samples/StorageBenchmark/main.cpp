@@ -0,0 +1,246 @@
+/*
+ * Storage benchmark.
+ *
+ * Measures the throughput and latency of the storage stack: MicroBitLog, FSCache,
+ * MicroBitFileSystem and the MicroBitUSBFlashManager interface chip transactions.
+ * Build this file in place of samples/main.cpp. Results are written to the serial port,
+ * one line per benchmark, as space separated key=value pairs:
+ *
+ *   BENCH name=<name> ops=<n> bytes=<n> time_us=<n> ops_per_s=<n> bytes_per_s=<n> p50_us=<n> p99_us=<n>
+ *
+ * followed by a single "BENCH done" line.
+ *
+ * @warning This benchmark clears the data log, and uses the FLASH above the program for a file system.
+ */
+
+#include "MicroBit.h"
+#include "MicroBitFileSystem.h"
+
+MicroBit uBit;
+
+#define BENCH_SAMPLES           200                             // Operations timed per benchmark.
+#define BENCH_BLOCK_SIZE        64                              // Bytes per file system read/write.
+#define BENCH_FILE_SIZE         (BENCH_SAMPLES * BENCH_BLOCK_SIZE)
+#define BENCH_FS_PAGES          32                              // FLASH pages given to the file system.
+
+static uint32_t latency[BENCH_SAMPLES];
+static uint8_t buffer[BENCH_BLOCK_SIZE];
+
+static int compareLatency(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+/**
+ * Reports a completed benchmark, given the latency of each of its operations in latency[].
+ *
+ * @param name The name of the benchmark.
+ * @param ops The number of operations timed.
+ * @param bytes The number of bytes transferred by those operations.
+ */
+static void report(const char *name, int ops, uint32_t bytes)
+{
+    uint64_t total = 0;
+
+    for (int i = 0; i < ops; i++)
+        total += latency[i];
+
+    qsort(latency, ops, sizeof(uint32_t), compareLatency);
+
+    uint32_t time = total ? (uint32_t)total : 1;
+    uint32_t opsPerSecond = (uint32_t)(((uint64_t)ops * 1000000) / time);
+    uint32_t bytesPerSecond = (uint32_t)(((uint64_t)bytes * 1000000) / time);
+
+    uBit.serial.printf("BENCH name=%s ops=%d bytes=%d time_us=%d ops_per_s=%d bytes_per_s=%d p50_us=%d p99_us=%d\r\n",
+        name, ops, (int)bytes, (int)time, (int)opsPerSecond, (int)bytesPerSecond,
+        (int)latency[ops / 2], (int)latency[(ops * 99) / 100]);
+}
+
+static void reportCache(const char *name, FSCacheStatistics stats)
+{
+    uint32_t lookups = stats.hits + stats.misses;
+
+    uBit.serial.printf("BENCH name=%s hits=%d misses=%d evictions=%d writes=%d hit_rate_pct=%d\r\n",
+        name, (int)stats.hits, (int)stats.misses, (int)stats.evictions, (int)stats.writes,
+        lookups ? (int)((stats.hits * 100) / lookups) : 0);
+}
+
+static void benchmarkLog()
+{
+    uint32_t bytes = 0;
+
+    uBit.log.clear(false);
+    uBit.log.setTimeStamp(TimeStampFormat::None);
+
+    int temperature = uBit.log.getColumn("temperature");
+    int level = uBit.log.getColumn("level");
+
+    // Time the individual logData() calls, which are buffered in RAM.
+    for (int i = 0; i < BENCH_SAMPLES; i++)
+    {
+        uBit.log.beginRow();
+
+        CODAL_TIMESTAMP start = system_timer_current_time_us();
+        uBit.log.logData(temperature, i);
+        latency[i] = system_timer_current_time_us() - start;
+
+        uBit.log.logData(level, BENCH_SAMPLES - i);
+        uBit.log.endRow();
+    }
+    report("log_data", BENCH_SAMPLES, 0);
+
+    // Time endRow(), which writes the row to FLASH.
+    for (int i = 0; i < BENCH_SAMPLES; i++)
+    {
+        uBit.log.beginRow();
+        uBit.log.logData(temperature, i);
+        uBit.log.logData(level, BENCH_SAMPLES - i);
+
+        uint32_t before = uBit.log.getDataLength(DataFormat::CSV);
+        CODAL_TIMESTAMP start = system_timer_current_time_us();
+        uBit.log.endRow();
+        latency[i] = system_timer_current_time_us() - start;
+
+        bytes += uBit.log.getDataLength(DataFormat::CSV) - before;
+    }
+    report("log_end_row", BENCH_SAMPLES, bytes);
+
+    reportCache("log_cache", uBit.log.getCacheStatistics());
+}
+
+static void benchmarkCache()
+{
+    uint32_t pageSize = uBit.flash.getPageSize();
+    uint32_t start = uBit.flash.getFlashStart();
+    FSCache cache(uBit.flash, pageSize, 4);
+
+    // Reads from a small working set, interleaved with a scan through the rest of the storage.
+    // A good replacement policy keeps the working set cached despite the scan.
+    for (int i = 0; i < BENCH_SAMPLES; i++)
+    {
+        uint32_t address = (i & 1) ? start + (i % 3) * pageSize : start + (4 + i) * pageSize;
+
+        CODAL_TIMESTAMP t = system_timer_current_time_us();
+        cache.read(address, buffer, BENCH_BLOCK_SIZE);
+        latency[i] = system_timer_current_time_us() - t;
+    }
+    report("cache_read", BENCH_SAMPLES, BENCH_SAMPLES * BENCH_BLOCK_SIZE);
+
+    reportCache("cache", cache.getStatistics());
+}
+
+static void benchmarkFileSystem()
+{
+    MicroBitFileSystem fs(0, BENCH_FS_PAGES);
+    int fd;
+
+    fs.remove("bench.dat");
+
+    // Sequential write
+    fd = fs.open("bench.dat", MB_WRITE | MB_CREAT);
+    for (int i = 0; i < BENCH_SAMPLES; i++)
+    {
+        memset(buffer, i, BENCH_BLOCK_SIZE);
+
+        CODAL_TIMESTAMP start = system_timer_current_time_us();
+        fs.write(fd, buffer, BENCH_BLOCK_SIZE);
+        latency[i] = system_timer_current_time_us() - start;
+    }
+    fs.close(fd);
+    report("fs_seq_write", BENCH_SAMPLES, BENCH_FILE_SIZE);
+
+    // Sequential read
+    fd = fs.open("bench.dat", MB_READ);
+    for (int i = 0; i < BENCH_SAMPLES; i++)
+    {
+        CODAL_TIMESTAMP start = system_timer_current_time_us();
+        fs.read(fd, buffer, BENCH_BLOCK_SIZE);
+        latency[i] = system_timer_current_time_us() - start;
+    }
+    report("fs_seq_read", BENCH_SAMPLES, BENCH_FILE_SIZE);
+
+    // Random read
+    for (int i = 0; i < BENCH_SAMPLES; i++)
+    {
+        int offset = (uBit.random(BENCH_SAMPLES)) * BENCH_BLOCK_SIZE;
+
+        CODAL_TIMESTAMP start = system_timer_current_time_us();
+        fs.seek(fd, offset, MB_SEEK_SET);
+        fs.read(fd, buffer, BENCH_BLOCK_SIZE);
+        latency[i] = system_timer_current_time_us() - start;
+    }
+    fs.close(fd);
+    report("fs_rand_read", BENCH_SAMPLES, BENCH_FILE_SIZE);
+
+    // Random write
+    fd = fs.open("bench.dat", MB_WRITE);
+    for (int i = 0; i < BENCH_SAMPLES; i++)
+    {
+        int offset = (uBit.random(BENCH_SAMPLES)) * BENCH_BLOCK_SIZE;
+        memset(buffer, ~i, BENCH_BLOCK_SIZE);
+
+        CODAL_TIMESTAMP start = system_timer_current_time_us();
+        fs.seek(fd, offset, MB_SEEK_SET);
+        fs.write(fd, buffer, BENCH_BLOCK_SIZE);
+        latency[i] = system_timer_current_time_us() - start;
+    }
+    fs.close(fd);
+    report("fs_rand_write", BENCH_SAMPLES, BENCH_FILE_SIZE);
+
+    fs.remove("bench.dat");
+}
+
+static void benchmarkUSBFlash()
+{
+    uint32_t address = uBit.flash.getFlashStart();
+    uint32_t words = BENCH_BLOCK_SIZE / 4;
+
+    // Single transaction reads.
+    for (int i = 0; i < BENCH_SAMPLES; i++)
+    {
+        CODAL_TIMESTAMP start = system_timer_current_time_us();
+        uBit.flash.read((uint32_t *)buffer, address, words);
+        latency[i] = system_timer_current_time_us() - start;
+    }
+    report("usb_flash_read", BENCH_SAMPLES, BENCH_SAMPLES * BENCH_BLOCK_SIZE);
+
+    // Single transaction writes. Pages are erased as they are reached, so erase time appears in the tail latency.
+    uint32_t pageSize = uBit.flash.getPageSize();
+    memset(buffer, 0x55, BENCH_BLOCK_SIZE);
+
+    for (int i = 0; i < BENCH_SAMPLES; i++)
+    {
+        uint32_t a = address + i * BENCH_BLOCK_SIZE;
+
+        CODAL_TIMESTAMP start = system_timer_current_time_us();
+        if (a % pageSize == 0)
+            uBit.flash.erase(a);
+        uBit.flash.write(a, (uint32_t *)buffer, words);
+        latency[i] = system_timer_current_time_us() - start;
+    }
+    report("usb_flash_write", BENCH_SAMPLES, BENCH_SAMPLES * BENCH_BLOCK_SIZE);
+
+    // The data log was overwritten.
+    uBit.log.invalidate();
+}
+
+int
+main()
+{
+    uBit.init();
+
+    uBit.serial.printf("BENCH start\r\n");
+
+    benchmarkLog();
+    benchmarkCache();
+    benchmarkFileSystem();
+    benchmarkUSBFlash();
+
+    uBit.serial.printf("BENCH done\r\n");
+
+    while(1)
+        uBit.sleep(1000);
+}
@@ -0,0 +1,117 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "AudioBufferPool.h"
+#include "codal_target_hal.h"
+
+using namespace codal;
+
+/**
+ * A small pool of recycled, equally sized ManagedBuffers used for audio data.
+ *
+ * Each stage of the audio pipeline generates a new buffer for every DMA period, often in interrupt context.
+ * Rather than taking each from the heap, buffers are retained by the pool and handed out again once every other
+ * reference to them has been released, so the steady state audio path performs no heap allocation at all.
+ */
+
+static ManagedBuffer *pool = NULL;                  // The pooled buffers, allocated on first use.
+static AudioBufferPoolStats poolStats = {CONFIG_AUDIO_BUFFER_POOL_SIZE, 0, 0, 0};
+
+/**
+ * Determines if the pool holds the only reference to the given buffer.
+ *
+ * Reference counts hold two per reference, plus a low bit that is always set. Taking a temporary
+ * reference with leakData() means a buffer referenced only by the pool shows a count of two references.
+ */
+static bool isReleased(ManagedBuffer &b)
+{
+    BufferData *data = b.leakData();
+    bool released = data->refCount == ((2 << 1) | 1);
+    data->decr();
+
+    return released;
+}
+
+/**
+  * Allocates a buffer, recycling one from the pool if possible.
+  *
+  * @param size The size of the buffer required, in bytes.
+  *
+  * @return A buffer of the given size. Unlike ManagedBuffer(size), its contents are undefined.
+  */
+ManagedBuffer AudioBufferPool::allocate(int size)
+{
+    if (size != CONFIG_AUDIO_BUFFER_POOL_BUFFER_SIZE)
+        return ManagedBuffer(size);
+
+    if (pool == NULL)
+    {
+        pool = new ManagedBuffer[CONFIG_AUDIO_BUFFER_POOL_SIZE];
+
+        if (pool == NULL)
+            return ManagedBuffer(size);
+    }
+
+    target_disable_irq();
+
+    for (int i = 0; i < poolStats.created; i++)
+    {
+        if (isReleased(pool[i]))
+        {
+            ManagedBuffer b = pool[i];
+            poolStats.recycled++;
+            target_enable_irq();
+
+            return b;
+        }
+    }
+
+    target_enable_irq();
+
+    // Grow the pool until it reaches its capacity. Beyond that, fall back to the heap.
+    ManagedBuffer b(size);
+
+    target_disable_irq();
+
+    if (poolStats.created < poolStats.capacity)
+        pool[poolStats.created++] = b;
+    else
+        poolStats.misses++;
+
+    target_enable_irq();
+
+    return b;
+}
+
+/**
+  * Retrieves the usage statistics of the pool.
+  *
+  * @param stats The structure to fill in.
+  */
+void AudioBufferPool::getStats(AudioBufferPoolStats &stats)
+{
+    target_disable_irq();
+    stats = poolStats;
+    target_enable_irq();
+}
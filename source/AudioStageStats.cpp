@@ -0,0 +1,55 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "AudioStageStats.h"
+#include "CodalDmesg.h"
+
+using namespace codal;
+
+/**
+ * Clears all statistics.
+ */
+void AudioStageStats::reset()
+{
+    pulls = 0;
+    underruns = 0;
+    late = 0;
+    lastTime = 0;
+    maxTime = 0;
+    totalTime = 0;
+    maxInterval = 0;
+    maxAge = 0;
+    lastPull = 0;
+}
+
+/**
+ * Writes the statistics to DMESG.
+ *
+ * @param name The name of the stage, to prefix the output with.
+ */
+void AudioStageStats::print(const char *name)
+{
+    DMESG("%s: pulls %d underruns %d late %d time %d/%d/%d us interval %d us age %d us", name, (int) pulls, (int) underruns, (int) late,
+        (int) lastTime, (int) (pulls ? totalTime / pulls : 0), (int) maxTime, (int) maxInterval, (int) maxAge);
+}
@@ -19,6 +19,7 @@ DEALINGS IN THE SOFTWARE.
 */
 #include "FSCache.h"
 #include "CodalDmesg.h"
+#include "MicroBitHeapStats.h"
 
 using namespace codal;
 
@@ -33,21 +34,46 @@ FSCache::FSCache(NVMController &nvm, int blockSize, int size) : flash(nvm), bloc
 {
 	// Initialise space to hold our cached pages.
 	cache = (CacheEntry *) malloc(sizeof(CacheEntry)*size);
+	MICROBIT_HEAP_TRACK(MICROBIT_HEAP_TAG_STORAGE, cache);
 	memset(cache, 0, sizeof(CacheEntry)*size);
 
 	// Reset operation counter (used for least-recently-used cache replacement policy)
 	operationCount = 0;
+	clock = &operationCount;
+	pool = NULL;
+	nextPooled = NULL;
+	priority = 0;
+
+	// Track the addresses of recently evicted probationary blocks. Those used again are protected.
+	ghosts = (uint32_t *) malloc(sizeof(uint32_t)*size);
+	MICROBIT_HEAP_TRACK(MICROBIT_HEAP_TAG_STORAGE, ghosts);
+	memset(ghosts, 0xFF, sizeof(uint32_t)*size);
+	ghostHead = 0;
+	probationSize = size > 1 ? size / 2 : 1;
+
+	lastEntry = NULL;
+	lastMiss = FSCACHE_NO_ADDRESS;
+	writeBack = false;
+	resetStatistics();
 }
 
 /**
-* Clear all cache entries, and free any allocated RAM.
+* Clear all cache entries, and free any allocated RAM. Any changes held in the cache are written first.
 */
 void FSCache::clear()
 {
+	flush();
+
 	for (int i = 0; i < cacheSize; i++)
 	{
 		if (cache[i].page != NULL)
+		{
+			MICROBIT_HEAP_UNTRACK(MICROBIT_HEAP_TAG_STORAGE, cache[i].page);
 			free(cache[i].page);
+
+			if (pool)
+				pool->release(blockSize);
+		}
 	}
 
 	// reset all state.
@@ -56,20 +82,27 @@ void FSCache::clear()
 	// Reset operation counter (used for least-recently-used cache replacement policy)
 	operationCount = 0;
 
+	memset(ghosts, 0xFF, sizeof(uint32_t)*cacheSize);
+	ghostHead = 0;
+	lastEntry = NULL;
+	lastMiss = FSCACHE_NO_ADDRESS;
 }
 
 /**
-* Erase a single block at the given address in CACHE memory only, (assuming it is loaded into cache)
+* Erase the cached blocks of the page at the given address in CACHE memory only, (assuming they are loaded into cache)
+* Any changes held for those blocks are discarded, as the page is about to be erased.
 */
 int FSCache::erase(uint32_t address)
 {
-	CacheEntry *c = getCacheEntry(address);
+	uint32_t page = address / flash.getPageSize();
 
-	// Erase the page in our cache (if it is present)
-	if (c != NULL)
+	for (int i = 0; i < cacheSize; i++)
 	{
-		memset(c->page, 0xFF, blockSize);
-		c->lastUsed = ++operationCount;
+		if (cache[i].page && cache[i].address / flash.getPageSize() == page)
+		{
+			memset(cache[i].page, 0xFF, blockSize);
+			cache[i].flags &= ~FSCACHE_FLAG_DIRTY;
+		}
 	}
 
 	return DEVICE_OK;
@@ -165,8 +198,28 @@ int FSCache::write(uint32_t address, const void *data, int len)
 		// update cache.
 		memcpy(c->page + offset, (uint8_t *)data + bytesCopied, l);
 
-		// Write through (maintaining 32-bit aligned operations)
-		flash.write(alignedStart, (uint32_t *)(c->page + (alignedStart % blockSize)), (alignedEnd - alignedStart)/4);
+		if (writeBack)
+		{
+			// Extend the range of the block to be written later (maintaining 32-bit aligned operations)
+			uint16_t start = alignedStart - block;
+			uint16_t end = alignedEnd - block;
+
+			if (!(c->flags & FSCACHE_FLAG_DIRTY))
+			{
+				c->dirtyStart = start;
+				c->dirtyEnd = end;
+				c->flags |= FSCACHE_FLAG_DIRTY;
+			}
+
+			c->dirtyStart = min(c->dirtyStart, start);
+			c->dirtyEnd = max(c->dirtyEnd, end);
+		}
+		else
+		{
+			// Write through (maintaining 32-bit aligned operations)
+			flash.write(alignedStart, (uint32_t *)(c->page + (alignedStart % blockSize)), (alignedEnd - alignedStart)/4);
+			stats.writes++;
+		}
 
 		// Move to next page
 		bytesCopied += l;
@@ -205,45 +258,302 @@ int FSCache::unpin(uint32_t address)
 }
 
 /**
-* Page a given block into the cache, replacing the LRU block if necessary.
+* Page a given block into the cache, replacing another block if necessary.
+* Blocks are first held on probation, and are evicted in the order they were loaded.
+* Blocks used again soon after being evicted are protected, and are evicted least recently used first.
+* This prevents a scan through storage from displacing the blocks in regular use.
+* A block that follows on from the last one loaded is loaded in a single read along with the
+* CODAL_FS_CACHE_READ_AHEAD blocks that follow it.
 * @param address the logical address of the block to cache.
 */
 CacheEntry* FSCache::cachePage(uint32_t address)
 {
-	CacheEntry *lru = NULL;
+	CacheEntry *c = NULL;
+	uint8_t *buffer = NULL;
+	int count = 1;
 
 	// Ensure the page is not already in the cache. If so, then nothing to do...
-	lru = getCacheEntry(address);
-	if (lru)
-		return lru;
+	c = getCacheEntry(address);
+	if (c)
+	{
+		stats.hits++;
+		return c;
+	}
+
+	stats.misses++;
+
+	// If this block follows on from the last one loaded, read ahead. Blocks that are already cached are never reloaded,
+	// as they may hold changes not yet written to FLASH.
+	if (address == lastMiss + blockSize)
+	{
+		while (count <= CODAL_FS_CACHE_READ_AHEAD && count < cacheSize && address + (count + 1) * blockSize < flash.getFlashEnd() && getCacheEntry(address + count * blockSize) == NULL)
+			count++;
+	}
+
+	if (count > 1)
+	{
+		buffer = (uint8_t *) malloc(count * blockSize);
+		MICROBIT_HEAP_TRACK(MICROBIT_HEAP_TAG_STORAGE, buffer);
+
+		if (buffer == NULL)
+			count = 1;
+	}
+
+	lastMiss = address + (count - 1) * blockSize;
+
+	CacheEntry *entries[CODAL_FS_CACHE_READ_AHEAD + 1];
+	for (int i = 0; i < count; i++)
+	{
+		// Pin the entries as we go, so that they don't replace one another.
+		entries[i] = allocateEntry(address + i * blockSize);
+		entries[i]->flags |= FSCACHE_FLAG_PINNED;
+	}
+
+	if (buffer)
+	{
+		flash.read((uint32_t *)buffer, address, count * blockSize / 4);
+
+		for (int i = 0; i < count; i++)
+			memcpy(entries[i]->page, buffer + i * blockSize, blockSize);
+
+		MICROBIT_HEAP_UNTRACK(MICROBIT_HEAP_TAG_STORAGE, buffer);
+		free(buffer);
+	}
+	else
+	{
+		flash.read((uint32_t *)entries[0]->page, address, blockSize / 4);
+	}
+
+	for (int i = 0; i < count; i++)
+		entries[i]->flags &= ~FSCACHE_FLAG_PINNED;
+
+	c = entries[0];
+	lastEntry = c;
+
+	return c;
+}
+
+/**
+* Selects a cache entry to hold the given block, evicting another block if necessary.
+* The contents of the entry's page are left for the caller to fill.
+* @param address the logical address of the block to cache.
+* @return a pointer to the selected cache entry.
+*/
+CacheEntry* FSCache::allocateEntry(uint32_t address)
+{
+	CacheEntry *c = NULL;
+	CacheEntry *oldest = NULL;
+	CacheEntry *lru = NULL;
+	int probationCount = 0;
+	bool protect = false;
 
-	// Determine the LRU block to replace, or prefereably unused block.
-	lru = &cache[0];
+	// Determine the best block to replace, or prefereably unused block.
 	for (int i = 0; i < cacheSize; i++)
 	{
 		// Simply return the first empty block we find
 		if (cache[i].page == NULL)
 		{
-			lru = &cache[i];
+			c = &cache[i];
+			break;
+		}
+
+		if (cache[i].flags & FSCACHE_FLAG_PINNED)
+			continue;
+
+		// Otherwise, record the oldest probationary block and the least recently used protected block.
+		uint16_t age = *clock - cache[i].lastUsed;
+
+		if (cache[i].flags & FSCACHE_FLAG_PROTECTED)
+		{
+			if (lru == NULL || age > (uint16_t)(*clock - lru->lastUsed))
+				lru = &cache[i];
+		}
+		else
+		{
+			probationCount++;
+			if (oldest == NULL || age > (uint16_t)(*clock - oldest->lastUsed))
+				oldest = &cache[i];
+		}
+	}
+
+	// An unused entry needs a new page. In a pool, that page must fit the shared budget, so take one from
+	// the least valuable held by any cache in the pool. If that is one of ours, reuse it as it stands.
+	if (c && pool)
+	{
+		while (!pool->reserve(blockSize))
+		{
+			FSCache *owner;
+			CacheEntry *victim = pool->selectVictim(owner);
+
+			if (victim == NULL)
+			{
+				pool->reserve(blockSize, true);
+				break;
+			}
+
+			if (owner == this)
+			{
+				c = victim;
+				evictEntry(c);
+				break;
+			}
+
+			owner->releaseEntry(victim);
+			pool->stats.reclaims++;
+		}
+	}
+
+	if (c == NULL)
+	{
+		// Evict a probationary block unless there are only a few, so that protected blocks are not starved of space.
+		if (oldest && (probationCount >= probationSize || lru == NULL))
+			c = oldest;
+		else
+			c = lru ? lru : &cache[0];
+
+		evictEntry(c);
+	}
+
+	for (int i = 0; i < cacheSize; i++)
+	{
+		if (ghosts[i] == address)
+		{
+			ghosts[i] = FSCACHE_NO_ADDRESS;
+			protect = true;
 			break;
 		}
+	}
+
+	// We now have the best block to replace. Update metadata ready for the block to be loaded from storage.
+	// Any changes held in the old block have been written, so all old values are soft state.
+	c->address = address;
+	c->flags = protect ? FSCACHE_FLAG_PROTECTED : 0;
+	c->lastUsed = ++*clock;
+	if (c->page == NULL)
+	{
+		c->page = (uint8_t *) malloc(blockSize);
+		MICROBIT_HEAP_TRACK(MICROBIT_HEAP_TAG_STORAGE, c->page);
+	}
+
+	return c;
+}
 
-		// Alternatively, record the least recently used block
-		if (!(cache[i].flags & FSCACHE_FLAG_PINNED) && (operationCount - cache[i].lastUsed > operationCount - lru->lastUsed))
-			lru = &cache[i];
+/**
+* Discards the block held in the given cache entry, writing any changes it holds to FLASH first.
+* The entry's page is kept, to hold another block.
+*/
+void FSCache::evictEntry(CacheEntry *c)
+{
+	// Remember an evicted probationary block, so that it is protected if it is used again soon.
+	if (!(c->flags & FSCACHE_FLAG_PROTECTED))
+	{
+		ghosts[ghostHead] = c->address;
+		ghostHead = (ghostHead + 1) % cacheSize;
 	}
 
-	// We now have the best block to replace. Update metadata and load in the block from storage.
-	// We are a write through cache, so all old values are soft state.
-	lru->address = address;
-	lru->flags = 0;
-	lru->lastUsed = ++operationCount;
-	if (lru->page == NULL)
-		lru->page = (uint8_t *) malloc(blockSize);
+	flushEntry(c);
+	stats.evictions++;
+}
+
+/**
+* Discards the block held in the given cache entry, and frees its page.
+*/
+void FSCache::releaseEntry(CacheEntry *c)
+{
+	evictEntry(c);
 
-	flash.read((uint32_t *)lru->page, address, blockSize / 4);
+	MICROBIT_HEAP_UNTRACK(MICROBIT_HEAP_TAG_STORAGE, c->page);
+	free(c->page);
+	c->page = NULL;
+	c->flags = 0;
 
-	return lru;
+	if (pool)
+		pool->release(blockSize);
+}
+
+/**
+* Writes any changes held in the given cache entry to FLASH.
+* @return DEVICE_OK on success, or the error returned by the NVMController.
+*/
+int FSCache::flushEntry(CacheEntry *c)
+{
+	int r = DEVICE_OK;
+
+	if (c->page && (c->flags & FSCACHE_FLAG_DIRTY))
+	{
+		r = flash.write(c->address + c->dirtyStart, (uint32_t *)(c->page + c->dirtyStart), (c->dirtyEnd - c->dirtyStart)/4);
+		c->flags &= ~FSCACHE_FLAG_DIRTY;
+		stats.writes++;
+	}
+
+	return r;
+}
+
+/**
+* Write any changes held in the cache to FLASH.
+* @return DEVICE_OK on success, or the error returned by the NVMController.
+*/
+int FSCache::flush()
+{
+	int r = DEVICE_OK;
+
+	for (int i = 0; i < cacheSize; i++)
+	{
+		int result = flushEntry(&cache[i]);
+
+		if (r == DEVICE_OK)
+			r = result;
+	}
+
+	return r;
+}
+
+/**
+* Determines if writes are held in the cache until flush() is called, or the block is evicted,
+* rather than being written through to FLASH immediately.
+* Successive writes to the same block are then made in a single FLASH write operation.
+* @param enable true to hold writes in the cache, false to write through.
+*/
+void FSCache::setWriteBack(bool enable)
+{
+	if (!enable)
+		flush();
+
+	writeBack = enable;
+}
+
+/**
+* Shares a budget for pages with other caches, in place of holding up to size pages regardless of them.
+* The cache is cleared first. The cache still holds no more than size pages.
+* @param pool the pool to join, or NULL to leave the current pool.
+* @param priority the pages of the caches in a pool with the lowest priority are taken first.
+*/
+void FSCache::setPool(FSCachePool *pool, int priority)
+{
+	clear();
+
+	if (this->pool)
+	{
+		FSCache **p = &this->pool->caches;
+
+		while (*p && *p != this)
+			p = &(*p)->nextPooled;
+
+		if (*p)
+			*p = nextPooled;
+	}
+
+	this->pool = pool;
+	this->priority = priority;
+	this->nextPooled = NULL;
+	this->clock = &operationCount;
+
+	if (pool)
+	{
+		nextPooled = pool->caches;
+		pool->caches = this;
+		clock = &pool->clock;
+	}
 }
 
 /**
@@ -253,20 +563,53 @@ CacheEntry* FSCache::cachePage(uint32_t address)
 */
 CacheEntry *FSCache::getCacheEntry(uint32_t address)
 {
-	for (int i = 0; i < cacheSize; i++)
+	CacheEntry *c = NULL;
+
+	// Successive operations are usually on the same block, so check the last one used first.
+	if (lastEntry && lastEntry->address == address && lastEntry->page)
+		c = lastEntry;
+
+	for (int i = 0; c == NULL && i < cacheSize; i++)
 	{
 		if (cache[i].address == address && cache[i].page)
-		{
-			cache[i].lastUsed = ++operationCount;
-			return &cache[i];
-		}
+			c = &cache[i];
 	}
 
-	return NULL;
+	if (c == NULL)
+		return NULL;
+
+	// Probationary blocks are evicted in the order they were loaded, so only protected blocks record their use.
+	if (c->flags & FSCACHE_FLAG_PROTECTED)
+		c->lastUsed = ++*clock;
+
+	lastEntry = c;
+	return c;
+}
+
+/**
+* Retrieves the number of cache hits, misses and evictions since the cache was created,
+* or the statistics were last reset. Each miss costs a read of one block from FLASH.
+*/
+FSCacheStatistics FSCache::getStatistics()
+{
+	return stats;
+}
+
+/**
+* Resets the cache hit, miss and eviction counts to zero.
+*/
+void FSCache::resetStatistics()
+{
+	stats.hits = 0;
+	stats.misses = 0;
+	stats.evictions = 0;
+	stats.writes = 0;
 }
 
 void FSCache::debug(bool verbose)
 {
+	DMESG("FSCache: [hits: %d] [misses: %d] [evictions: %d] [writes: %d]\n", stats.hits, stats.misses, stats.evictions, stats.writes);
+
 	for (int i = 0; i < cacheSize; i++)
 		debug(&cache[i], verbose);
 }
@@ -296,4 +639,92 @@ void FSCache::debug(CacheEntry *c, bool verbose)
 
 		DMESGN("\n\n");
 	}
-}
\ No newline at end of file
+}
+/**
+ * A byte budget shared by a number of FSCache instances, in place of each holding pages up to its own size.
+ *
+ * @param budget the most bytes of pages the caches in the pool may hold between them.
+ */
+FSCachePool::FSCachePool(uint32_t budget)
+{
+	caches = NULL;
+	clock = 0;
+	stats.budget = budget;
+	stats.used = 0;
+	stats.highWater = 0;
+	stats.reclaims = 0;
+}
+
+/**
+* Accounts for a page, if the budget allows.
+* @param bytes the size of the page.
+* @param force true to account for the page even if this exceeds the budget.
+* @return true if the page may be allocated.
+*/
+bool FSCachePool::reserve(int bytes, bool force)
+{
+	if (!force && stats.used + bytes > stats.budget)
+		return false;
+
+	stats.used += bytes;
+	if (stats.used > stats.highWater)
+		stats.highWater = stats.used;
+
+	return true;
+}
+
+/**
+* Accounts for the release of a page.
+* @param bytes the size of the page.
+*/
+void FSCachePool::release(int bytes)
+{
+	stats.used -= bytes;
+}
+
+/**
+* Selects the least valuable page held by any cache in the pool: a page of the cache with the lowest priority,
+* preferring probationary pages to protected ones, and then the least recently used.
+* @param owner set to the cache holding the page.
+* @return the entry holding the page, or NULL if every page is pinned.
+*/
+CacheEntry *FSCachePool::selectVictim(FSCache *&owner)
+{
+	CacheEntry *victim = NULL;
+	int victimPriority = 0;
+	int victimProtected = 0;
+	uint16_t victimAge = 0;
+
+	for (FSCache *f = caches; f; f = f->nextPooled)
+	{
+		for (int i = 0; i < f->cacheSize; i++)
+		{
+			CacheEntry *c = &f->cache[i];
+
+			if (c->page == NULL || (c->flags & FSCACHE_FLAG_PINNED))
+				continue;
+
+			int p = (c->flags & FSCACHE_FLAG_PROTECTED) ? 1 : 0;
+			uint16_t age = clock - c->lastUsed;
+
+			if (victim == NULL || f->priority < victimPriority || (f->priority == victimPriority && (p < victimProtected || (p == victimProtected && age > victimAge))))
+			{
+				victim = c;
+				owner = f;
+				victimPriority = f->priority;
+				victimProtected = p;
+				victimAge = age;
+			}
+		}
+	}
+
+	return victim;
+}
+
+/**
+* Retrieves the budget, and the use made of it since the pool was created.
+*/
+FSCachePoolStatistics FSCachePool::getStatistics()
+{
+	return stats;
+}
@@ -32,11 +32,15 @@ DEALINGS IN THE SOFTWARE.
 #include "MicroBitError.h"
 #include "LSM303Accelerometer.h"
 #include "LSM303Magnetometer.h"
+#include "MicroBitIrqDispatcher.h"
 
 
 using namespace codal;
 
 Accelerometer* MicroBitAccelerometer::driver = NULL;
+MicroBitI2C* MicroBitAccelerometer::i2cBus = NULL;
+Pin* MicroBitAccelerometer::interruptPin = NULL;
+CoordinateSpace* MicroBitAccelerometer::sensorSpace = NULL;
 
 
 MicroBitAccelerometer::MicroBitAccelerometer(MicroBitI2C &i2c, CoordinateSpace &coordinateSpace, uint16_t id) : Accelerometer(coordinateSpace, id)
@@ -80,12 +84,31 @@ Accelerometer& MicroBitAccelerometer::autoDetect(MicroBitI2C &i2c)
         }
         MicroBitCompass::driver->setAccelerometer( *MicroBitAccelerometer::driver );
 
+        // Record the resources in use, for components such as MicroBitAccelerometerFifo that talk to the sensor directly.
+        MicroBitAccelerometer::i2cBus = &i2c;
+        MicroBitAccelerometer::interruptPin = &irq1;
+        MicroBitAccelerometer::sensorSpace = &coordinateSpace;
+
         autoDetectCompleted = true;
     }
 
     return *driver;
 }
 
+int MicroBitAccelerometer::irqDataReady(void *)
+{
+    uint8_t status;
+
+    if (i2cBus == NULL || i2cBus->readRegister(LSM303_A_DEFAULT_ADDR, MICROBIT_ACCELEROMETER_LSM303_STATUS_REG_A, &status, 1) != DEVICE_OK)
+        return MICROBIT_IRQ_NONE;
+
+    if (!(status & MICROBIT_ACCELEROMETER_LSM303_ZYXDA))
+        return MICROBIT_IRQ_NONE;
+
+    driver->requestUpdate();
+    return MICROBIT_IRQ_HANDLED;
+}
+
 int MicroBitAccelerometer::configure()
 {
     if ( MicroBitAccelerometer::driver == this )
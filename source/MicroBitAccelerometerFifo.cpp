@@ -0,0 +1,238 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "MicroBitAccelerometerFifo.h"
+#include "LSM303Accelerometer.h"
+#include "ErrorNo.h"
+#include "MicroBitSchedulerTrace.h"
+
+using namespace codal;
+
+/**
+ * Constructor.
+ *
+ * @param buffer The ring buffer to store samples in.
+ * @param capacity The number of samples buffer can hold.
+ * @param id The ID of this component, used for its events.
+ */
+MicroBitAccelerometerFifo::MicroBitAccelerometerFifo(Sample3D *buffer, int capacity, uint16_t id)
+{
+    this->id = id;
+    this->buffer = buffer;
+    this->capacity = capacity;
+    this->head = 0;
+    this->count = 0;
+    this->fullScale = 2000;
+    this->overruns = 0;
+    this->ctrlReg3 = 0;
+}
+
+/**
+ * Destructor. Batching is stopped.
+ */
+MicroBitAccelerometerFifo::~MicroBitAccelerometerFifo()
+{
+    stop();
+}
+
+/**
+ * Starts batching samples, at the sensor's currently configured period and range.
+ *
+ * @param watermark The number of samples the sensor buffers before a batch is read, from 1 to 31.
+ * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the watermark is out of range,
+ * DEVICE_NOT_SUPPORTED if no LSM303 is present, or DEVICE_I2C_ERROR.
+ */
+int MicroBitAccelerometerFifo::start(int watermark)
+{
+    MicroBitI2C *i2c = MicroBitAccelerometer::i2cBus;
+    uint8_t ctrl4, ctrl5;
+
+    if (watermark < 1 || watermark >= MICROBIT_ACCELEROMETER_FIFO_DEPTH || buffer == NULL || capacity <= 0)
+        return DEVICE_INVALID_PARAMETER;
+
+    if (i2c == NULL || !LSM303Accelerometer::isDetected(*i2c, LSM303_A_DEFAULT_ADDR))
+        return DEVICE_NOT_SUPPORTED;
+
+    if (isRunning())
+        stop();
+
+    if (i2c->readRegister(LSM303_A_DEFAULT_ADDR, MICROBIT_ACCELEROMETER_FIFO_CTRL_REG3_A, &ctrlReg3, 1) != DEVICE_OK ||
+        i2c->readRegister(LSM303_A_DEFAULT_ADDR, MICROBIT_ACCELEROMETER_FIFO_CTRL_REG4_A, &ctrl4, 1) != DEVICE_OK ||
+        i2c->readRegister(LSM303_A_DEFAULT_ADDR, MICROBIT_ACCELEROMETER_FIFO_CTRL_REG5_A, &ctrl5, 1) != DEVICE_OK)
+        return DEVICE_I2C_ERROR;
+
+    // Samples are left justified, so the range alone defines their scale: +/-2g, 4g, 8g or 16g.
+    fullScale = 2000 << ((ctrl4 >> 4) & 0x03);
+
+    // Enable the FIFO in stream mode, and signal the watermark on INT1 in place of data ready.
+    if (i2c->writeRegister(LSM303_A_DEFAULT_ADDR, MICROBIT_ACCELEROMETER_FIFO_FIFO_CTRL_REG_A, 0x00) != DEVICE_OK ||
+        i2c->writeRegister(LSM303_A_DEFAULT_ADDR, MICROBIT_ACCELEROMETER_FIFO_CTRL_REG5_A, ctrl5 | 0x40) != DEVICE_OK ||
+        i2c->writeRegister(LSM303_A_DEFAULT_ADDR, MICROBIT_ACCELEROMETER_FIFO_FIFO_CTRL_REG_A, 0x80 | watermark) != DEVICE_OK ||
+        i2c->writeRegister(LSM303_A_DEFAULT_ADDR, MICROBIT_ACCELEROMETER_FIFO_CTRL_REG3_A, (ctrlReg3 & ~0x10) | 0x04) != DEVICE_OK)
+        return DEVICE_I2C_ERROR;
+
+    status |= MICROBIT_ACCELEROMETER_FIFO_STATUS_RUNNING | DEVICE_COMPONENT_STATUS_IDLE_TICK;
+
+    return DEVICE_OK;
+}
+
+/**
+ * Stops batching, and restores the sensor's normal data ready interrupt.
+ *
+ * @return DEVICE_OK on success, or DEVICE_I2C_ERROR.
+ */
+int MicroBitAccelerometerFifo::stop()
+{
+    MicroBitI2C *i2c = MicroBitAccelerometer::i2cBus;
+    uint8_t ctrl5;
+
+    if (!isRunning())
+        return DEVICE_OK;
+
+    status &= ~(MICROBIT_ACCELEROMETER_FIFO_STATUS_RUNNING | DEVICE_COMPONENT_STATUS_IDLE_TICK);
+
+    if (i2c->writeRegister(LSM303_A_DEFAULT_ADDR, MICROBIT_ACCELEROMETER_FIFO_CTRL_REG3_A, ctrlReg3) != DEVICE_OK ||
+        i2c->writeRegister(LSM303_A_DEFAULT_ADDR, MICROBIT_ACCELEROMETER_FIFO_FIFO_CTRL_REG_A, 0x00) != DEVICE_OK ||
+        i2c->readRegister(LSM303_A_DEFAULT_ADDR, MICROBIT_ACCELEROMETER_FIFO_CTRL_REG5_A, &ctrl5, 1) != DEVICE_OK ||
+        i2c->writeRegister(LSM303_A_DEFAULT_ADDR, MICROBIT_ACCELEROMETER_FIFO_CTRL_REG5_A, ctrl5 & ~0x40) != DEVICE_OK)
+        return DEVICE_I2C_ERROR;
+
+    return DEVICE_OK;
+}
+
+/**
+ * Determines if samples are being batched.
+ */
+bool MicroBitAccelerometerFifo::isRunning()
+{
+    return status & MICROBIT_ACCELEROMETER_FIFO_STATUS_RUNNING;
+}
+
+/**
+ * Reads all samples waiting in the sensor into the ring buffer, without waiting for the watermark.
+ * This is also done automatically whenever the sensor signals that a batch is ready.
+ *
+ * @return The number of samples read, or DEVICE_I2C_ERROR.
+ */
+int MicroBitAccelerometerFifo::drain()
+{
+    MicroBitI2C *i2c = MicroBitAccelerometer::i2cBus;
+    int16_t data[MICROBIT_ACCELEROMETER_FIFO_DEPTH * 3];
+    uint8_t src;
+
+    if (!isRunning())
+        return 0;
+
+    if (i2c->readRegister(LSM303_A_DEFAULT_ADDR, MICROBIT_ACCELEROMETER_FIFO_FIFO_SRC_REG_A, &src, 1) != DEVICE_OK)
+        return DEVICE_I2C_ERROR;
+
+    // FSS holds the number of unread samples, and OVRN is set if the FIFO is full and the oldest is being overwritten.
+    int samples = (src & 0x20) ? 0 : (src & 0x1F) + ((src & 0x40) ? 1 : 0);
+
+    if (src & 0x40)
+        overruns++;
+
+    if (samples == 0)
+        return 0;
+
+    // The output registers wrap around while the FIFO is enabled, so the whole batch can be read in one transfer.
+    if (i2c->readRegister(LSM303_A_DEFAULT_ADDR, MICROBIT_ACCELEROMETER_FIFO_OUT_X_L_A | 0x80, (uint8_t *) data, samples * 6) != DEVICE_OK)
+        return DEVICE_I2C_ERROR;
+
+    for (int i = 0; i < samples; i++)
+    {
+        Sample3D s;
+        s.x = (data[i * 3] * fullScale) >> 15;
+        s.y = (data[i * 3 + 1] * fullScale) >> 15;
+        s.z = (data[i * 3 + 2] * fullScale) >> 15;
+
+        if (MicroBitAccelerometer::sensorSpace)
+            s = MicroBitAccelerometer::sensorSpace->transform(s);
+
+        // If the ring is full, discard the oldest sample.
+        if (count == capacity)
+        {
+            head = (head + 1) % capacity;
+            count--;
+            overruns++;
+        }
+
+        buffer[(head + count) % capacity] = s;
+        count++;
+    }
+
+    Event(id, MICROBIT_ACCELEROMETER_FIFO_EVT_DATA);
+
+    return samples;
+}
+
+/**
+ * Determines the number of samples waiting in the ring buffer.
+ */
+int MicroBitAccelerometerFifo::available()
+{
+    return count;
+}
+
+/**
+ * Removes the oldest samples from the ring buffer.
+ *
+ * @param samples The array to copy samples into.
+ * @param length The maximum number of samples to copy.
+ * @return The number of samples copied.
+ */
+int MicroBitAccelerometerFifo::read(Sample3D *samples, int length)
+{
+    int n = min(length, count);
+
+    for (int i = 0; i < n; i++)
+    {
+        samples[i] = buffer[head];
+        head = (head + 1) % capacity;
+    }
+
+    count -= n;
+
+    return n;
+}
+
+/**
+ * Determines the number of samples lost, because the sensor's FIFO or the ring buffer was full.
+ */
+uint32_t MicroBitAccelerometerFifo::getOverruns()
+{
+    return overruns;
+}
+
+/**
+ * Checks the sensor's interrupt line, and reads a batch if one is ready.
+ */
+void MicroBitAccelerometerFifo::idleCallback()
+{
+    MICROBIT_TRACE_IDLE(CodalComponent::id);
+
+    // The interrupt line is shared, so it is only a hint that a batch may be ready. drain() checks the FIFO itself.
+    if (isRunning() && MicroBitAccelerometer::interruptPin && MicroBitAccelerometer::interruptPin->isActive())
+        drain();
+}
@@ -0,0 +1,200 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "MicroBitAnalogScan.h"
+#include "ErrorNo.h"
+
+using namespace codal;
+
+int MicroBitAnalogScanSink::pullRequest()
+{
+    return scan->receive(index);
+}
+
+/**
+ * Constructor.
+ *
+ * @param adc The ADC to sample with.
+ * @param id The ID of this component, used for its events.
+ */
+MicroBitAnalogScan::MicroBitAnalogScan(NRF52ADC &adc, uint16_t id) : adc(adc)
+{
+    this->id = id;
+    this->pinCount = 0;
+    this->buffer = NULL;
+    this->frames = 0;
+    this->period = 0;
+
+    for (int i = 0; i < CONFIG_MICROBIT_ANALOG_SCAN_MAX_PINS; i++)
+    {
+        sinks[i].scan = this;
+        sinks[i].index = i;
+    }
+}
+
+/**
+ * Destructor. Any scan in progress is stopped.
+ */
+MicroBitAnalogScan::~MicroBitAnalogScan()
+{
+    stop();
+}
+
+/**
+ * Starts sampling the given pins. MICROBIT_ANALOG_SCAN_EVT_COMPLETE is raised once buffer is full.
+ *
+ * @param pins The pins to sample.
+ * @param pinCount The number of pins, from 1 to CONFIG_MICROBIT_ANALOG_SCAN_MAX_PINS.
+ * @param buffer The buffer to store samples in, as frames of pinCount samples. Samples are as delivered by each
+ * pin's ADC channel, in DATASTREAM_FORMAT_16BIT_SIGNED.
+ * @param frames The number of frames to take.
+ * @param rate The number of frames per second, or 0 to keep the ADC's current sample rate.
+ *
+ * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if any parameter is out of range, DEVICE_BUSY if a scan is
+ * already in progress, or DEVICE_NO_RESOURCES if the ADC has no channel free for a pin.
+ */
+int MicroBitAnalogScan::start(NRF52Pin **pins, int pinCount, int16_t *buffer, int frames, int rate)
+{
+    if (pins == NULL || pinCount < 1 || pinCount > CONFIG_MICROBIT_ANALOG_SCAN_MAX_PINS || buffer == NULL || frames <= 0 || rate < 0)
+        return DEVICE_INVALID_PARAMETER;
+
+    if (status & MICROBIT_ANALOG_SCAN_STATUS_RUNNING)
+        return DEVICE_BUSY;
+
+    this->pinCount = 0;
+    this->buffer = buffer;
+    this->frames = frames;
+    this->period = adc.getSamplePeriod();
+    status &= ~MICROBIT_ANALOG_SCAN_STATUS_COMPLETE;
+    status |= MICROBIT_ANALOG_SCAN_STATUS_RUNNING;
+
+    if (rate > 0)
+        adc.setSamplePeriod(1000000 / rate);
+
+    // Add every pin to the scan list before connecting to any, so that all of their streams start on the same scan.
+    for (int i = 0; i < pinCount; i++)
+    {
+        this->pins[i] = pins[i];
+        this->channels[i] = adc.getChannel(*pins[i], false);
+        this->written[i] = 0;
+
+        if (this->channels[i] == NULL)
+        {
+            stop();
+            return DEVICE_NO_RESOURCES;
+        }
+
+        this->pinCount++;
+    }
+
+    for (int i = 0; i < pinCount; i++)
+    {
+        channels[i]->output.connect(sinks[i]);
+        adc.activateChannel(channels[i]);
+    }
+
+    return DEVICE_OK;
+}
+
+/**
+ * Stops sampling, releasing the pins' ADC channels and restoring the ADC's sample rate.
+ */
+void MicroBitAnalogScan::stop()
+{
+    if (!(status & MICROBIT_ANALOG_SCAN_STATUS_RUNNING))
+        return;
+
+    status &= ~MICROBIT_ANALOG_SCAN_STATUS_RUNNING;
+
+    for (int i = 0; i < pinCount; i++)
+    {
+        channels[i]->output.disconnect();
+        adc.releaseChannel(*pins[i]);
+    }
+
+    pinCount = 0;
+
+    if (period != adc.getSamplePeriod())
+        adc.setSamplePeriod(period);
+}
+
+/**
+ * Determines if every requested sample has been taken.
+ */
+bool MicroBitAnalogScan::isComplete()
+{
+    return (status & MICROBIT_ANALOG_SCAN_STATUS_COMPLETE) != 0;
+}
+
+/**
+ * Determines the number of complete frames in the buffer.
+ */
+int MicroBitAnalogScan::getFrameCount()
+{
+    int count = frames;
+
+    for (int i = 0; i < pinCount; i++)
+        if (written[i] < count)
+            count = written[i];
+
+    return isComplete() ? frames : count;
+}
+
+/**
+ * Copies a block of samples from an ADC channel into the buffer.
+ *
+ * @param index The position of the channel in the scan group.
+ */
+int MicroBitAnalogScan::receive(int index)
+{
+    ManagedBuffer b = channels[index]->output.pull();
+
+    if (!(status & MICROBIT_ANALOG_SCAN_STATUS_RUNNING) || index >= pinCount)
+        return DEVICE_OK;
+
+    int16_t *data = (int16_t *) &b[0];
+    int16_t *out = buffer + written[index] * pinCount + index;
+    int n = min(b.length() / 2, frames - written[index]);
+
+    for (int i = 0; i < n; i++)
+    {
+        *out = *data++;
+        out += pinCount;
+    }
+
+    written[index] += n;
+
+    if (n == 0 || isComplete())
+        return DEVICE_OK;
+
+    for (int i = 0; i < pinCount; i++)
+        if (written[i] < frames)
+            return DEVICE_OK;
+
+    // The buffer is full. The channels are released by stop(), from fiber context, as this is called from the ADC interrupt.
+    status |= MICROBIT_ANALOG_SCAN_STATUS_COMPLETE;
+    Event(id, MICROBIT_ANALOG_SCAN_EVT_COMPLETE);
+
+    return DEVICE_OK;
+}
@@ -30,12 +30,20 @@ DEALINGS IN THE SOFTWARE.
 #include "SoundExpressions.h"
 #include "SoundEmojiSynthesizer.h"
 #include "StreamSplitter.h"
+#include "MicroBitHeapStats.h"
+#include "MicroBitEnergy.h"
 
 using namespace codal;
 
 MicroBitAudio* MicroBitAudio::instance = NULL;
 
 MicroBitAudio::MicroBitAudio(NRF52Pin &pin, NRF52Pin &speaker, NRF52ADC &adc, NRF52Pin &microphone, NRF52Pin &runmic):
+    mic(NULL),
+    processor(NULL),
+    decimator(NULL),
+    splitter(NULL),
+    rawSplitter(NULL),
+    levelSPL(NULL),
     micEnabled(false),
     speakerEnabled(true),
     pinEnabled(true),
@@ -47,7 +55,7 @@ MicroBitAudio::MicroBitAudio(NRF52Pin &pin, NRF52Pin &speaker, NRF52ADC &adc, NR
     adc(adc),
     microphone(microphone),
     runmic(runmic),
-    soundExpressions(synth),
+    soundExpressions(synth, &mixer),
     virtualOutputPin(mixer)
 {
     // If we are the first instance created, schedule it for on demand activation
@@ -56,8 +64,29 @@ MicroBitAudio::MicroBitAudio(NRF52Pin &pin, NRF52Pin &speaker, NRF52ADC &adc, NR
 
     synth.allowEmptyBuffers(true);
 
+    if(EventModel::defaultEventBus)
+    {
+        EventModel::defaultEventBus->listen(DEVICE_ID_MIXER, DEVICE_EVT_ANY, this, &MicroBitAudio::onMixerEvent);
+        EventModel::defaultEventBus->listen(DEVICE_ID_MIXER, DEVICE_MIXER_EVT_RATE, this, &MicroBitAudio::onMixerRateChange, MESSAGE_BUS_LISTENER_IMMEDIATE);
+    }
+
+#if !CONFIG_ENABLED(CONFIG_AUDIO_MIC_DEMAND_INIT)
+    initMicrophone();
+#endif
+}
+
+int MicroBitAudio::initMicrophone()
+{
+    if (status & MICROBIT_AUDIO_STATUS_MIC_READY)
+        return DEVICE_OK;
+
+    status |= MICROBIT_AUDIO_STATUS_MIC_READY;
+
     mic = adc.getChannel(microphone, false);
-    adc.setSamplePeriod( 1e6 / CONFIG_MIXER_DEFAULT_CHANNEL_SAMPLERATE );
+    adc.setSamplePeriod( 1e6 / CONFIG_AUDIO_MIC_SAMPLE_RATE );
+#if CONFIG_AUDIO_MIC_BLOCK_SIZE > 0
+    adc.setDmaBufferSize( CONFIG_AUDIO_MIC_BLOCK_SIZE );
+#endif
     mic->setGain(7, 0);
 
     // Implementers note: The order that the pipeline comes up here is quite sensitive. If we connect up to splitters after starting to
@@ -72,20 +101,36 @@ MicroBitAudio::MicroBitAudio(NRF52Pin &pin, NRF52Pin &speaker, NRF52ADC &adc, NR
 
     //Initilise input splitter
     rawSplitter = new StreamSplitter(mic->output);
-
-    //Initilise stream normalizer
+    MICROBIT_HEAP_TRACK(MICROBIT_HEAP_TAG_AUDIO, rawSplitter);
+
+    //Initilise stream normalizer, or the single pass decimator in its place
+#if CONFIG_AUDIO_MIC_DECIMATION > 0
+    processor = NULL;
+    decimator = new StreamDecimator(*rawSplitter->createChannel(), 0.08f, true, DATASTREAM_FORMAT_8BIT_SIGNED, CONFIG_AUDIO_MIC_DECIMATION);
+    MICROBIT_HEAP_TRACK(MICROBIT_HEAP_TAG_AUDIO, decimator);
+#else
     processor = new StreamNormalizer(*rawSplitter->createChannel(), 0.08f, true, DATASTREAM_FORMAT_8BIT_SIGNED, 10);
+    MICROBIT_HEAP_TRACK(MICROBIT_HEAP_TAG_AUDIO, processor);
+    decimator = NULL;
+#endif
 
     //Initilise level detector SPL and attach to splitter
     //levelSPL = new LevelDetectorSPL(*rawSplitter->createChannel(), 85.0, 65.0, 16.0, 0, DEVICE_ID_MICROPHONE, false);
     levelSPL = new LevelDetectorSPL(*rawSplitter->createChannel(), 85.0, 65.0, 16.0, 52.0, DEVICE_ID_SYSTEM_LEVEL_DETECTOR, false);
+    MICROBIT_HEAP_TRACK(MICROBIT_HEAP_TAG_AUDIO, levelSPL);
 
     // Connect to the rawSplitter. This must come AFTER the processor, to prevent the processor's channel activation starting the microphone
     if(EventModel::defaultEventBus)
         EventModel::defaultEventBus->listen(rawSplitter->id, DEVICE_EVT_ANY, this, &MicroBitAudio::onSplitterEvent, MESSAGE_BUS_LISTENER_IMMEDIATE);
 
     //Initilise stream splitter
+#if CONFIG_AUDIO_MIC_DECIMATION > 0
+    splitter = new StreamSplitter(*decimator, DEVICE_ID_SPLITTER);
+    MICROBIT_HEAP_TRACK(MICROBIT_HEAP_TAG_AUDIO, splitter);
+#else
     splitter = new StreamSplitter(processor->output, DEVICE_ID_SPLITTER);
+    MICROBIT_HEAP_TRACK(MICROBIT_HEAP_TAG_AUDIO, splitter);
+#endif
 
     // Connect to the splitter - this COULD come after we create it, before we add any stages, as these are dynamic and will only connect on-demand, but just in case
     // we're going to follow the schema set out above, to be 100% sure.
@@ -93,6 +138,70 @@ MicroBitAudio::MicroBitAudio(NRF52Pin &pin, NRF52Pin &speaker, NRF52ADC &adc, NR
         EventModel::defaultEventBus->listen(DEVICE_ID_SPLITTER, DEVICE_EVT_ANY, this, &MicroBitAudio::onSplitterEvent, MESSAGE_BUS_LISTENER_IMMEDIATE);
         EventModel::defaultEventBus->listen(DEVICE_ID_NOTIFY, mic->output.emitFlowEvents(), this, &MicroBitAudio::onSplitterEvent, MESSAGE_BUS_LISTENER_IMMEDIATE);
     }
+
+    return DEVICE_OK;
+}
+
+NRF52ADCChannel *MicroBitAudio::getMicrophone()
+{
+    initMicrophone();
+    return mic;
+}
+
+StreamSplitter *MicroBitAudio::getSplitter()
+{
+    initMicrophone();
+    return splitter;
+}
+
+StreamSplitter *MicroBitAudio::getRawSplitter()
+{
+    initMicrophone();
+    return rawSplitter;
+}
+
+LevelDetectorSPL *MicroBitAudio::getLevelSPL()
+{
+    initMicrophone();
+    return levelSPL;
+}
+
+void MicroBitAudio::onMixerEvent(MicroBitEvent e)
+{
+    // A channel has data while the output is stopped, so restart it.
+    if (e.value == DEVICE_MIXER_EVT_WAKE)
+    {
+        if (status & MICROBIT_AUDIO_STATUS_PAUSED)
+            enable();
+
+        return;
+    }
+
+    // Stop the output if the mixer remains silent for long enough.
+    if (e.value == DEVICE_MIXER_EVT_SILENCE && CONFIG_AUDIO_MIXER_IDLE_TIMEOUT > 0)
+    {
+        CODAL_TIMESTAMP start = mixer.getSilenceStartTime();
+
+        fiber_sleep(CONFIG_AUDIO_MIXER_IDLE_TIMEOUT);
+
+        if (pwm && mixer.isSilent() && mixer.getSilenceStartTime() == start)
+        {
+            status |= MICROBIT_AUDIO_STATUS_PAUSED;
+            mixer.setPaused(true);
+            releaseOutput();
+        }
+    }
+}
+
+void MicroBitAudio::onMixerRateChange(MicroBitEvent)
+{
+    // Lower output rates are made by repeating each sample for more PWM periods, leaving the carrier frequency
+    // and sample range unchanged, and reducing the rate at which the PWM fetches samples and raises interrupts.
+    if (pwm)
+    {
+        NRF_PWM1->SEQ[0].REFRESH = mixer.getSampleRateDivider() - 1;
+        NRF_PWM1->SEQ[1].REFRESH = mixer.getSampleRateDivider() - 1;
+    }
 }
 
 void MicroBitAudio::onSplitterEvent(MicroBitEvent e){
@@ -103,6 +212,7 @@ void MicroBitAudio::onSplitterEvent(MicroBitEvent e){
 }
 
 void MicroBitAudio::activateMic(){
+    initMicrophone();
     runmic.setDigitalValue(1);
     runmic.setHighDrive(true);
     adc.activateChannel(mic);
@@ -116,18 +226,32 @@ void MicroBitAudio::deactivateMic(){
 }
 
 void MicroBitAudio::setMicrophoneGain(int gain){
-    processor->setGain(gain/100);
+    initMicrophone();
+
+    if (processor)
+        processor->setGain(gain/100);
+
+    if (decimator)
+        decimator->setGain(gain/100);
 }
 
 int MicroBitAudio::enable()
 { 
+    if (status & MICROBIT_AUDIO_STATUS_PAUSED)
+    {
+        status &= ~MICROBIT_AUDIO_STATUS_PAUSED;
+        mixer.setPaused(false);
+    }
+
     if (pwm == NULL)
     {
-        pwm = new NRF52PWM( NRF_PWM1, mixer, 44100 );
+        pwm = new NRF52PWM( NRF_PWM1, mixer, CONFIG_AUDIO_OUTPUT_SAMPLE_RATE );
+        MICROBIT_HEAP_TRACK(MICROBIT_HEAP_TAG_AUDIO, pwm);
         pwm->setDecoderMode( PWM_DECODER_LOAD_Common );
 
         mixer.setSampleRange( pwm->getSampleRange() );
         mixer.setOrMask( 0x8000 );
+        mixer.setAdaptiveSampleRate( CONFIG_AUDIO_OUTPUT_SAMPLE_RATE, CONFIG_AUDIO_MAX_SAMPLE_RATE_DIVIDER );
 
         setSpeakerEnabled( speakerEnabled );
         setPinEnabled( pinEnabled );
@@ -135,6 +259,8 @@ int MicroBitAudio::enable()
         if ( soundExpressionChannel == NULL )
             soundExpressionChannel = mixer.addChannel(synth);
     }
+
+    MICROBIT_ENERGY_STATE(MICROBIT_ENERGY_AUDIO, true);
     return DEVICE_OK;
 }
 
@@ -144,6 +270,7 @@ int MicroBitAudio::disable()
     setPinEnabled( false );
 
     pwm->disable();
+    MICROBIT_ENERGY_STATE(MICROBIT_ENERGY_AUDIO, false);
 
     return DEVICE_OK;
 }
@@ -224,6 +351,21 @@ MicroBitAudio::~MicroBitAudio()
     }
 }
 
+void MicroBitAudio::releaseOutput()
+{
+    if (pwm)
+    {
+        NVIC_DisableIRQ(PWM1_IRQn);
+        pwm->disable();
+        MICROBIT_ENERGY_STATE(MICROBIT_ENERGY_AUDIO, false);
+        pwm->disconnectPin(speaker);
+        pwm->disconnectPin(*pin);
+        MICROBIT_HEAP_UNTRACK(MICROBIT_HEAP_TAG_AUDIO, pwm);
+        delete pwm;
+        pwm = NULL;
+    }
+}
+
 int MicroBitAudio::setSleep(bool doSleep)
 {
     if (doSleep)
@@ -231,12 +373,7 @@ int MicroBitAudio::setSleep(bool doSleep)
       if (pwm)
       {
           status |= MICROBIT_AUDIO_STATUS_DEEPSLEEP;
-          NVIC_DisableIRQ(PWM1_IRQn);
-          pwm->disable();
-          pwm->disconnectPin(speaker);
-          pwm->disconnectPin(*pin);
-          delete pwm;
-          pwm = NULL;
+          releaseOutput();
       }
       deactivateMic();
     }
@@ -247,7 +384,10 @@ int MicroBitAudio::setSleep(bool doSleep)
           status &= ~MICROBIT_AUDIO_STATUS_DEEPSLEEP;
           enable();
       }
-      activateMic();
+
+      // Don't bring up a microphone pipeline that has yet to be used.
+      if (status & MICROBIT_AUDIO_STATUS_MIC_READY)
+          activateMic();
     }
    
     return DEVICE_OK;
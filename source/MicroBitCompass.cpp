@@ -30,6 +30,7 @@ DEALINGS IN THE SOFTWARE.
 #include "MicroBitDevice.h"
 #include "MicroBitError.h"
 #include "LSM303Magnetometer.h"
+#include "MicroBitIrqDispatcher.h"
 
 using namespace codal;
 
@@ -52,6 +53,21 @@ Compass& MicroBitCompass::autoDetect(MicroBitI2C &i2c)
     return *MicroBitCompass::driver;
 }
 
+int MicroBitCompass::irqDataReady(void *)
+{
+    MicroBitI2C *i2c = MicroBitAccelerometer::i2cBus;
+    uint8_t status;
+
+    if (i2c == NULL || i2c->readRegister(LSM303_M_DEFAULT_ADDR, MICROBIT_COMPASS_LSM303_STATUS_REG_M, &status, 1) != DEVICE_OK)
+        return MICROBIT_IRQ_NONE;
+
+    if (!(status & MICROBIT_COMPASS_LSM303_ZYXDA))
+        return MICROBIT_IRQ_NONE;
+
+    driver->requestUpdate();
+    return MICROBIT_IRQ_HANDLED;
+}
+
 int MicroBitCompass::configure()
 {
     if ( MicroBitCompass::driver == this )
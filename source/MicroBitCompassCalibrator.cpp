@@ -31,6 +31,13 @@ using namespace codal;
 
 #define CALIBRATION_INCREMENT     200
 
+// The maximum number of hill climb steps taken to refine a least squares centre estimate.
+#define CALIBRATION_MAX_STEPS     16
+
+// The largest total covariance of the online fit. Beyond this, past samples are no longer forgotten, so
+// that the fit cannot become unstable while the device is held still.
+#define CALIBRATION_ONLINE_MAX_COVARIANCE   1000.0f
+
 /**
   * Constructor.
   *
@@ -51,6 +58,7 @@ using namespace codal;
 MicroBitCompassCalibrator::MicroBitCompassCalibrator(Compass& _compass, Accelerometer& _accelerometer, MicroBitDisplay& _display) : compass(_compass), accelerometer(_accelerometer), display(_display)
 {
     this->storage = NULL;
+    this->online = NULL;
 
     if (EventModel::defaultEventBus)
         EventModel::defaultEventBus->listen(MICROBIT_ID_COMPASS, MICROBIT_COMPASS_EVT_CALIBRATE, this, &MicroBitCompassCalibrator::calibrateUX, MESSAGE_BUS_LISTENER_IMMEDIATE);
@@ -75,6 +83,7 @@ MicroBitCompassCalibrator::MicroBitCompassCalibrator(Compass& _compass, Accelero
 MicroBitCompassCalibrator::MicroBitCompassCalibrator(Compass& _compass, Accelerometer& _accelerometer, MicroBitDisplay& _display, MicroBitStorage &storage) : compass(_compass), accelerometer(_accelerometer), display(_display)
 {
     this->storage = &storage;
+    this->online = NULL;
 
     //Attempt to load any stored calibration datafor the compass.
     KeyValuePair *calibrationData =  this->storage->get("compassCal");
@@ -246,14 +255,22 @@ Sample3D MicroBitCompassCalibrator::approximateCentre(Sample3D *data, int sample
     centre.y = centre.y / samples;
     centre.z = centre.z / samples;
 
-    // Start hill climb in the centre of mass.
-    c = centre;
+    // Start hill climb from a least squares fit if we can, as it is usually within a step or two of the best centre.
+    // Otherwise, start in the centre of mass, and climb for as long as it takes.
+    int steps = -1;
+
+    if (fitSphere(data, samples, c))
+        steps = CALIBRATION_MAX_STEPS;
+    else
+        c = centre;
+
+    best = c;
 
     // calculate the nearest and furthest point to us.
     score = measureScore(c, data, samples);
 
     // iteratively attempt to improve position...
-    while (1)
+    while (steps-- != 0)
     {
         for (int x = -CALIBRATION_INCREMENT; x <= CALIBRATION_INCREMENT; x=x+CALIBRATION_INCREMENT)
         {
@@ -285,6 +302,86 @@ Sample3D MicroBitCompassCalibrator::approximateCentre(Sample3D *data, int sample
     return c;
 }
 
+/*
+ * Performs a linear least squares fit of a sphere to the given data points.
+ *
+ * @param data an array containing sample points
+ * @param samples the number of sample points in the 'data' array.
+ * @param centre the fitted centre point, if successful.
+ *
+ * @return true on success, or false if the points do not define a sphere (e.g. they are coplanar).
+ */
+bool MicroBitCompassCalibrator::fitSphere(Sample3D *data, int samples, Sample3D &centre)
+{
+    // Each point p on a sphere of centre c satisfies |p|^2 = 2p.c + (r^2 - |c|^2), which is linear in c.
+    // Points are taken relative to their mean to reduce the dynamic range, and the normal equations are
+    // accumulated in double precision, as raw magnetometer readings are large.
+    double mean[3] = { 0, 0, 0 };
+    double m[4][5] = { { 0 } };
+
+    if (samples < 4)
+        return false;
+
+    for (int i = 0; i < samples; i++)
+    {
+        mean[0] += data[i].x;
+        mean[1] += data[i].y;
+        mean[2] += data[i].z;
+    }
+
+    for (int k = 0; k < 3; k++)
+        mean[k] /= samples;
+
+    for (int i = 0; i < samples; i++)
+    {
+        double u[3] = { data[i].x - mean[0], data[i].y - mean[1], data[i].z - mean[2] };
+        double row[5] = { 2 * u[0], 2 * u[1], 2 * u[2], 1, u[0] * u[0] + u[1] * u[1] + u[2] * u[2] };
+
+        for (int r = 0; r < 4; r++)
+            for (int k = 0; k < 5; k++)
+                m[r][k] += row[r] * row[k];
+    }
+
+    // Solve the 4x4 system by Gaussian elimination with partial pivoting.
+    double scale = m[0][0] + m[1][1] + m[2][2] + m[3][3];
+
+    for (int col = 0; col < 4; col++)
+    {
+        int pivot = col;
+
+        for (int r = col + 1; r < 4; r++)
+            if (fabs(m[r][col]) > fabs(m[pivot][col]))
+                pivot = r;
+
+        if (fabs(m[pivot][col]) <= 1e-12 * scale)
+            return false;
+
+        for (int k = 0; k < 5; k++)
+        {
+            double t = m[col][k];
+            m[col][k] = m[pivot][k];
+            m[pivot][k] = t;
+        }
+
+        for (int r = 0; r < 4; r++)
+        {
+            if (r == col)
+                continue;
+
+            double f = m[r][col] / m[col][col];
+
+            for (int k = col; k < 5; k++)
+                m[r][k] -= f * m[col][k];
+        }
+    }
+
+    centre.x = (int)(mean[0] + m[0][4] / m[0][0]);
+    centre.y = (int)(mean[1] + m[1][4] / m[1][1]);
+    centre.z = (int)(mean[2] + m[2][4] / m[2][2]);
+
+    return true;
+}
+
 /**
  * Performs a simple game that in parallel, calibrates the compass.
  *
@@ -309,6 +406,15 @@ void MicroBitCompassCalibrator::calibrateUX(MicroBitEvent)
     const int TIME_STEP = 100;
     const int MSG_TIME = 155 * TIME_STEP; //We require MSG_TIME % TIME_STEP == 0
 
+    // If the online fit is good enough, there is no need to trouble the user.
+    CompassCalibration online;
+
+    if (getOnlineCalibration(online))
+    {
+        compass.setCalibration(online);
+        return;
+    }
+
     target_wait(100);
 
     static const Point perimeter[PERIMETER_POINTS] = {{0,0}, {1,0}, {2,0}, {3,0}, {4,0}, {0,1}, {1,1}, {2,1}, {3,1}, {4,1}, {0,2}, {1,2}, {2,2}, {3,2}, {4,2}, {0,3}, {1,3}, {2,3}, {3,3}, {4,3}, {0,4}, {1,4}, {2,4}, {3,4}, {4,4}};
@@ -425,3 +531,239 @@ void MicroBitCompassCalibrator::calibrateUX(MicroBitEvent)
     // Retore the display brightness to the level it was at before this function was called.
     display.setBrightness(displayBrightness);
 }
+
+/**
+  * Enables or disables online calibration. Once enabled, every new compass sample refines an ellipsoid fit in the
+  * background, and the compass calibration is updated (and saved, if storage is available) whenever a plausible
+  * fit covering enough of the sphere is found. The interactive calibrateUX routine is then skipped if such a fit exists.
+  *
+  * @param enabled true to enable online calibration, false to disable it and discard its state.
+  *
+  * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if the state could not be allocated.
+  */
+int MicroBitCompassCalibrator::setOnlineCalibration(bool enabled)
+{
+    if (enabled && online == NULL)
+    {
+        online = (CompassCalibrationFit *) malloc(sizeof(CompassCalibrationFit));
+
+        if (online == NULL)
+            return DEVICE_NO_RESOURCES;
+
+        resetOnlineCalibration();
+
+        if (EventModel::defaultEventBus)
+            EventModel::defaultEventBus->listen(MICROBIT_ID_COMPASS, MICROBIT_COMPASS_EVT_DATA_UPDATE, this, &MicroBitCompassCalibrator::onCompassData, MESSAGE_BUS_LISTENER_IMMEDIATE);
+    }
+
+    if (!enabled && online != NULL)
+    {
+        if (EventModel::defaultEventBus)
+            EventModel::defaultEventBus->ignore(MICROBIT_ID_COMPASS, MICROBIT_COMPASS_EVT_DATA_UPDATE, this, &MicroBitCompassCalibrator::onCompassData);
+
+        free(online);
+        online = NULL;
+    }
+
+    return DEVICE_OK;
+}
+
+/**
+  * Determines if online calibration is enabled.
+  */
+bool MicroBitCompassCalibrator::isOnlineCalibrationEnabled()
+{
+    return online != NULL;
+}
+
+/**
+  * Discards all samples gathered by online calibration, and starts a new fit.
+  * The current compass calibration is unchanged.
+  */
+void MicroBitCompassCalibrator::resetOnlineCalibration()
+{
+    if (online == NULL)
+        return;
+
+    memset(online, 0, sizeof(CompassCalibrationFit));
+
+    // Start from a unit sphere about the origin, with little confidence in it.
+    for (int i = 0; i < 3; i++)
+        online->theta[i] = 1.0f;
+
+    for (int i = 0; i < 6; i++)
+        online->P[i][i] = 100.0f;
+}
+
+/**
+  * Determines the number of samples the online calibration has used since it was enabled or reset.
+  */
+int MicroBitCompassCalibrator::getOnlineSampleCount()
+{
+    return online ? online->samples : 0;
+}
+
+/**
+ * Event handler, called when a new compass sample is available.
+ * Updates the online fit, and applies it to the compass periodically.
+ */
+void MicroBitCompassCalibrator::onCompassData(MicroBitEvent)
+{
+    if (online == NULL)
+        return;
+
+    CompassCalibrationFit &fit = *online;
+    Sample3D s = compass.getSample(RAW);
+
+    if (fit.norm == 0.0f)
+    {
+        fit.norm = sqrtf((float)s.x * s.x + (float)s.y * s.y + (float)s.z * s.z);
+
+        if (fit.norm == 0.0f)
+            return;
+    }
+
+    float v[3] = { s.x / fit.norm, s.y / fit.norm, s.z / fit.norm };
+
+    // Ignore samples close to the last used, so that the fit is not dominated by the device being held still.
+    if (fit.samples > 0)
+    {
+        float dx = v[0] - fit.last[0];
+        float dy = v[1] - fit.last[1];
+        float dz = v[2] - fit.last[2];
+
+        if (dx * dx + dy * dy + dz * dz < CONFIG_COMPASS_CALIBRATOR_ONLINE_SPACING * CONFIG_COMPASS_CALIBRATOR_ONLINE_SPACING)
+            return;
+    }
+
+    for (int i = 0; i < 3; i++)
+    {
+        if (fit.samples == 0 || v[i] < fit.minimum[i])
+            fit.minimum[i] = v[i];
+
+        if (fit.samples == 0 || v[i] > fit.maximum[i])
+            fit.maximum[i] = v[i];
+
+        fit.last[i] = v[i];
+    }
+
+    // Recursive least squares update of the fit, for this sample.
+    float phi[6] = { v[0] * v[0], v[1] * v[1], v[2] * v[2], v[0], v[1], v[2] };
+    float Pphi[6];
+    float denominator = CONFIG_COMPASS_CALIBRATOR_ONLINE_FORGETTING;
+    float error = 1.0f;
+    float trace = 0.0f;
+
+    for (int i = 0; i < 6; i++)
+    {
+        Pphi[i] = 0.0f;
+
+        for (int j = 0; j < 6; j++)
+            Pphi[i] += fit.P[i][j] * phi[j];
+
+        denominator += phi[i] * Pphi[i];
+        error -= phi[i] * fit.theta[i];
+        trace += fit.P[i][i];
+    }
+
+    float forget = trace < CALIBRATION_ONLINE_MAX_COVARIANCE ? 1.0f / CONFIG_COMPASS_CALIBRATOR_ONLINE_FORGETTING : 1.0f;
+
+    for (int i = 0; i < 6; i++)
+    {
+        float k = Pphi[i] / denominator;
+
+        fit.theta[i] += k * error;
+
+        // P is symmetric, so Pphi is also the transpose of phi'P.
+        for (int j = 0; j < 6; j++)
+            fit.P[i][j] = (fit.P[i][j] - k * Pphi[j]) * forget;
+    }
+
+    fit.samples++;
+
+    if (fit.samples % CONFIG_COMPASS_CALIBRATOR_ONLINE_UPDATE_INTERVAL)
+        return;
+
+    CompassCalibration cal;
+
+    if (!getOnlineCalibration(cal))
+        return;
+
+    compass.setCalibration(cal);
+
+    // Save the calibration the first time a fit is found, and again only once it has moved appreciably, to limit FLASH wear.
+    float c[3] = { cal.centre.x / fit.norm, cal.centre.y / fit.norm, cal.centre.z / fit.norm };
+    float dx = c[0] - fit.persisted[0];
+    float dy = c[1] - fit.persisted[1];
+    float dz = c[2] - fit.persisted[2];
+
+    if (storage && (!fit.saved || dx * dx + dy * dy + dz * dz > CONFIG_COMPASS_CALIBRATOR_ONLINE_PERSIST_SHIFT * CONFIG_COMPASS_CALIBRATOR_ONLINE_PERSIST_SHIFT))
+    {
+        storage->put("compassCal", (uint8_t *) &cal, sizeof(CompassCalibration));
+
+        memcpy(fit.persisted, c, sizeof(c));
+        fit.saved = true;
+    }
+}
+
+/**
+ * Derives a calibration from the online fit.
+ *
+ * @param result The calibration to populate.
+ *
+ * @return true if the fit is plausible and the samples cover enough of the sphere, false otherwise.
+ */
+bool MicroBitCompassCalibrator::getOnlineCalibration(CompassCalibration &result)
+{
+    if (online == NULL || online->samples < CONFIG_COMPASS_CALIBRATOR_ONLINE_MIN_SAMPLES)
+        return false;
+
+    float *theta = online->theta;
+    float centre[3];
+    float axis[3];
+    float g = 1.0f;
+
+    for (int i = 0; i < 3; i++)
+    {
+        if (theta[i] <= 0.0f)
+            return false;
+
+        centre[i] = -theta[i+3] / (2.0f * theta[i]);
+        g += theta[i] * centre[i] * centre[i];
+    }
+
+    float longest = 0.0f;
+    float shortest = 0.0f;
+
+    for (int i = 0; i < 3; i++)
+    {
+        axis[i] = sqrtf(g / theta[i]);
+
+        if (i == 0 || axis[i] > longest)
+            longest = axis[i];
+
+        if (i == 0 || axis[i] < shortest)
+            shortest = axis[i];
+    }
+
+    if (longest > shortest * CONFIG_COMPASS_CALIBRATOR_ONLINE_MAX_ELLIPTICITY)
+        return false;
+
+    // Require samples spanning at least half of the ellipsoid on every axis, so that the fit is not an extrapolation.
+    for (int i = 0; i < 3; i++)
+        if (online->maximum[i] - online->minimum[i] < axis[i])
+            return false;
+
+    // As with spherify, scale each axis out onto the enclosing sphere.
+    result.centre.x = (int)(centre[0] * online->norm);
+    result.centre.y = (int)(centre[1] * online->norm);
+    result.centre.z = (int)(centre[2] * online->norm);
+
+    result.scale.x = (int)(1024 * longest / axis[0]);
+    result.scale.y = (int)(1024 * longest / axis[1]);
+    result.scale.z = (int)(1024 * longest / axis[2]);
+
+    result.radius = (int)(longest * online->norm);
+
+    return true;
+}
@@ -24,6 +24,7 @@ DEALINGS IN THE SOFTWARE.
 
 #include "MicroBitConfig.h"
 #include "MicroBitDevice.h"
+#include "ErrorNo.h"
 #include "nrf.h"
 #include "hal/nrf_gpio.h"
 #include "cmsis_compiler.h"
@@ -68,25 +69,8 @@ void MicroBitDevice::seedRandom()
 {
     uint32_t r = 0xBBC5EED;
 
-    if(!ble_running())
-    {
-        // Start the Random number generator. No need to leave it running... I hope. :-)
-        NRF_RNG->TASKS_START = 1;
-
-        for(int i = 0; i < 4; i++)
-        {
-            // Clear the VALRDY EVENT
-            NRF_RNG->EVENTS_VALRDY = 0;
-
-            // Wait for a number ot be generated.
-            while(NRF_RNG->EVENTS_VALRDY == 0);
-
-            r = (r << 8) | ((int) NRF_RNG->VALUE);
-        }
-
-        // Disable the generator to save power.
-        NRF_RNG->TASKS_STOP = 1;
-    }
+    // Whilst Bluetooth is running the RNG belongs to the SoftDevice, which shares it with us.
+    microbit_random_entropy((uint8_t *)&r, sizeof(r));
 
     seedRandom(r);
 }
@@ -102,13 +86,34 @@ void MicroBitDevice::seedRandom()
   */
 int MicroBitDevice::seedRandom(uint32_t seed)
 {
+    microbit_random_seed(seed);
+
     return CodalDevice::seedRandom(seed);
 }
 
+/**
+  * Generate a random number in the given range, from the default pseudo random stream, without modulo bias.
+  *
+  * @param max the upper range to generate a number for. This number cannot be negative.
+  *
+  * @return A random, natural number between 0 and the max-1. Or DEVICE_INVALID_PARAMETER if max is <= 0.
+  *
+  * @code
+  * uBit.random(200); //a number between 0 and 199
+  * @endcode
+  */
+int MicroBitDevice::random(int max)
+{
+    if (max <= 0)
+        return DEVICE_INVALID_PARAMETER;
+
+    return microbit_random_range(MICROBIT_RANDOM_STREAM_DEFAULT, max);
+}
+
 
 int microbit_random(int max)
 {
-    return microbit_device_instance ? microbit_device_instance->random(max) : 0;
+    return max > 0 ? (int) microbit_random_range(MICROBIT_RANDOM_STREAM_DEFAULT, max) : DEVICE_INVALID_PARAMETER;
 }
 
 
@@ -195,10 +200,9 @@ __NO_RETURN void microbit_reset()
 /**
   * Seed the random number generator (RNG).
   *
-  * This function uses the NRF52833's in built cryptographic random number generator to seed a Galois LFSR.
-  * We do this as the hardware RNG is relatively high power, and is locked out by the BLE stack internally,
-  * with a less than optimal application interface. A Galois LFSR is sufficient for our
-  * applications, and much more lightweight.
+  * This function uses the NRF52833's in built cryptographic random number generator to seed the pseudo random streams.
+  * We do this as the hardware RNG is relatively high power, and is shared with the BLE stack.
+  * A xoshiro128++ generator is sufficient for our applications, and much more lightweight.
   */
 void microbit_seed_random()
 {
@@ -28,6 +28,8 @@ DEALINGS IN THE SOFTWARE.
  */
 #include "MicroBitDisplay.h"
 #include "NRFLowLevelTimer.h"
+#include "CodalFiber.h"
+#include "BitmapFont.h"
 
 using namespace codal;
 
@@ -42,6 +44,9 @@ using namespace codal;
   */
 MicroBitDisplay::MicroBitDisplay(const MatrixMap &map, uint16_t id) : NRF52LEDMatrix(*new NRFLowLevelTimer(NRF_TIMER4, TIMER4_IRQn), map, id, DisplayMode::DISPLAY_MODE_GREYSCALE), AnimatedDisplay(*this, id)
 {
+    this->stripDelay = DEFAULT_SCROLL_SPEED;
+    this->stripGeneration = 0;
+    this->stripClaimed = 0;
 }
 
 /**
@@ -50,3 +55,129 @@ MicroBitDisplay::MicroBitDisplay(const MatrixMap &map, uint16_t id) : NRF52LEDMa
 MicroBitDisplay::~MicroBitDisplay()
 {
 }
+
+/**
+ * Renders the given string into strip, unless it is there already.
+ *
+ * @param s The string to render.
+ */
+void MicroBitDisplay::renderStrip(ManagedString s)
+{
+    if (s == stripText && strip.getWidth() > 0)
+        return;
+
+    int step = BITMAP_FONT_WIDTH + MICROBIT_DISPLAY_STRIP_SPACING;
+
+    strip = Image(s.length() * step, BITMAP_FONT_HEIGHT);
+
+    for (int i = 0; i < s.length(); i++)
+        strip.print(s.charAt(i), i * step, 0);
+
+    stripText = s;
+}
+
+/**
+ * Performs a scroll of strip across the display, unless it is superseded.
+ *
+ * @param generation The value of stripGeneration when the scroll was started.
+ */
+void MicroBitDisplay::runStrip(uint16_t generation)
+{
+    int width = image.getWidth();
+
+    // Slide the strip in from the right hand edge, until it has left on the left.
+    for (int x = 1; x <= strip.getWidth() + width && generation == stripGeneration; x++)
+    {
+        image.clear();
+        image.paste(strip, width - x, 0, 0);
+
+        if (isDoubleBuffered())
+            swap();
+
+        fiber_sleep(stripDelay);
+    }
+
+    if (generation == stripGeneration)
+        Event(NRF52LEDMatrix::id, DISPLAY_EVT_ANIMATION_COMPLETE);
+}
+
+/**
+ * Body of the fiber that performs scrollStripAsync().
+ *
+ * @param display The MicroBitDisplay to scroll.
+ */
+void MicroBitDisplay::stripFiber(void *display)
+{
+    MicroBitDisplay *d = (MicroBitDisplay *)display;
+
+    // Only the most recent of any scrolls requested before this fiber first ran is performed.
+    if (d->stripClaimed == d->stripGeneration)
+        return;
+
+    d->stripClaimed = d->stripGeneration;
+    d->runStrip(d->stripClaimed);
+}
+
+/**
+ * Scrolls the given string across the display, from right to left, blocking until it has gone.
+ *
+ * Unlike AnimatedDisplay::scroll(), the whole string is rendered into a single strip once, and each step
+ * of the scroll is a copy of a window of that strip into the display image. The strip is kept, so scrolling
+ * the same string again renders nothing. Strings longer than CONFIG_MICROBIT_DISPLAY_STRIP_MAX_LENGTH
+ * are scrolled with AnimatedDisplay::scroll().
+ *
+ * @param s The string to scroll.
+ * @param delay The time between each step of the scroll, in milliseconds.
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the delay is not positive.
+ */
+int MicroBitDisplay::scrollStrip(ManagedString s, int delay)
+{
+    if (delay <= 0)
+        return DEVICE_INVALID_PARAMETER;
+
+    if (s.length() > CONFIG_MICROBIT_DISPLAY_STRIP_MAX_LENGTH)
+        return scroll(s, delay);
+
+    stopAnimation();
+    renderStrip(s);
+
+    stripDelay = delay;
+    stripClaimed = ++stripGeneration;
+    runStrip(stripClaimed);
+
+    return DEVICE_OK;
+}
+
+/**
+ * Scrolls the given string across the display, from right to left, without blocking.
+ * A DISPLAY_EVT_ANIMATION_COMPLETE event is raised once the string has gone.
+ *
+ * @param s The string to scroll.
+ * @param delay The time between each step of the scroll, in milliseconds.
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the delay is not positive.
+ */
+int MicroBitDisplay::scrollStripAsync(ManagedString s, int delay)
+{
+    if (delay <= 0)
+        return DEVICE_INVALID_PARAMETER;
+
+    if (s.length() > CONFIG_MICROBIT_DISPLAY_STRIP_MAX_LENGTH)
+        return scrollAsync(s, delay);
+
+    stopAnimation();
+    renderStrip(s);
+
+    stripDelay = delay;
+    stripGeneration++;
+    create_fiber(stripFiber, this);
+
+    return DEVICE_OK;
+}
+
+/**
+ * Stops any scroll started by scrollStrip() or scrollStripAsync(), leaving the display as it is.
+ */
+void MicroBitDisplay::stopScrollStrip()
+{
+    stripGeneration++;
+}
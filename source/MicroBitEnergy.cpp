@@ -0,0 +1,305 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "MicroBitEnergy.h"
+#include "ErrorNo.h"
+#include "Timer.h"
+#include "codal_target_hal.h"
+
+using namespace codal;
+
+#if CONFIG_ENABLED(CONFIG_MICROBIT_ENERGY_ACCOUNTING)
+
+/**
+ * Per subsystem energy accounting.
+ *
+ * The interface chip measures the supply voltage, but not the current drawn, so energy is attributed from a model:
+ * each subsystem draws a known current while active. Components report their transitions, and the time each
+ * subsystem spends active is costed at the supply voltage measured when the power telemetry is next read.
+ */
+
+struct EnergyAccount
+{
+    uint32_t            current;                    // The modelled current drawn while active, in microamps.
+    uint32_t            activations;                // The number of times the subsystem became active.
+    CODAL_TIMESTAMP     activeTime;                 // The active time of completed activations, in microseconds.
+    CODAL_TIMESTAMP     since;                      // The time the current activation began, if active.
+    CODAL_TIMESTAMP     sampledTime;                // The active time already converted to energy.
+    uint64_t            energy;                     // The energy used, in nanojoules.
+    bool                active;                     // true if the subsystem is currently active.
+};
+
+static const char * const energy_names[MICROBIT_ENERGY_SUBSYSTEMS] = { "cpu", "radio", "display", "audio", "flash" };
+
+// The processor is running from reset, and every other subsystem starts idle.
+static EnergyAccount energy_accounts[MICROBIT_ENERGY_SUBSYSTEMS] = {
+    {CONFIG_MICROBIT_ENERGY_CURRENT_CPU, 1, 0, 0, 0, 0, true},
+    {CONFIG_MICROBIT_ENERGY_CURRENT_RADIO, 0, 0, 0, 0, 0, false},
+    {CONFIG_MICROBIT_ENERGY_CURRENT_DISPLAY, 0, 0, 0, 0, 0, false},
+    {CONFIG_MICROBIT_ENERGY_CURRENT_AUDIO, 0, 0, 0, 0, 0, false},
+    {CONFIG_MICROBIT_ENERGY_CURRENT_FLASH, 0, 0, 0, 0, 0, false}
+};
+
+static CODAL_TIMESTAMP energy_start = 0;                                        // The time the accounts were last reset.
+static uint32_t energy_millivolts = CONFIG_MICROBIT_ENERGY_DEFAULT_MILLIVOLTS;  // The most recently sampled supply voltage.
+static uint32_t energy_samples = 0;                                             // Samples taken since the last reset.
+
+/**
+  * Determines the total time an account has been active, including any activation in progress.
+  */
+static CODAL_TIMESTAMP activeTime(EnergyAccount &a, CODAL_TIMESTAMP now)
+{
+    return a.activeTime + (a.active ? now - a.since : 0);
+}
+
+/**
+  * Determines the energy used by drawing a current for a period, in nanojoules.
+  * Whole seconds and the remainder are costed separately, so that long periods cannot overflow.
+  */
+static uint64_t cost(uint32_t microAmps, uint32_t milliVolts, CODAL_TIMESTAMP time)
+{
+    uint64_t nanoWatts = (uint64_t) microAmps * milliVolts;
+
+    return nanoWatts * (time / 1000000) + (nanoWatts * (time % 1000000)) / 1000000;
+}
+
+/**
+  * Converts the time each subsystem has spent active since it was last costed into energy, at the given supply voltage.
+  * Must be called with interrupts disabled.
+  */
+static void settle(uint32_t milliVolts)
+{
+    CODAL_TIMESTAMP now = system_timer_current_time_us();
+
+    for (int i = 0; i < MICROBIT_ENERGY_SUBSYSTEMS; i++)
+    {
+        EnergyAccount &a = energy_accounts[i];
+        CODAL_TIMESTAMP t = activeTime(a, now);
+
+        a.energy += cost(a.current, milliVolts, t - a.sampledTime);
+        a.sampledTime = t;
+    }
+}
+
+/**
+  * Constructor. Marks the subsystem active.
+  *
+  * @param subsystem One of MICROBIT_ENERGY_*.
+  */
+MicroBitEnergyScope::MicroBitEnergyScope(int subsystem)
+{
+    this->subsystem = subsystem;
+    microbit_energy_state(subsystem, true);
+}
+
+/**
+  * Destructor. Marks the subsystem idle.
+  */
+MicroBitEnergyScope::~MicroBitEnergyScope()
+{
+    microbit_energy_state(subsystem, false);
+}
+
+/**
+  * Records a subsystem becoming active or idle. Reporting the state the subsystem is already in has no effect,
+  * so callers need not track it themselves. Safe to call from interrupt context.
+  *
+  * @param subsystem One of MICROBIT_ENERGY_*.
+  * @param active true if the subsystem is now drawing its modelled current, false otherwise.
+  */
+void codal::microbit_energy_state(int subsystem, bool active)
+{
+    if (subsystem < 0 || subsystem >= MICROBIT_ENERGY_SUBSYSTEMS)
+        return;
+
+    EnergyAccount &a = energy_accounts[subsystem];
+
+    target_disable_irq();
+
+    if (a.active != active)
+    {
+        CODAL_TIMESTAMP now = system_timer_current_time_us();
+
+        if (active)
+        {
+            a.since = now;
+            a.activations++;
+        }
+        else
+        {
+            a.activeTime += now - a.since;
+        }
+
+        a.active = active;
+    }
+
+    target_enable_irq();
+}
+
+/**
+  * Converts the time each subsystem has spent active since the previous sample into energy, at the given supply voltage.
+  * MicroBitPowerManager calls this whenever it reads the power telemetry of the interface chip.
+  *
+  * @param milliVolts The supply voltage, or zero to use CONFIG_MICROBIT_ENERGY_DEFAULT_MILLIVOLTS.
+  */
+void codal::microbit_energy_sample(uint32_t milliVolts)
+{
+    if (milliVolts == 0)
+        milliVolts = CONFIG_MICROBIT_ENERGY_DEFAULT_MILLIVOLTS;
+
+    target_disable_irq();
+
+    // Time active since the last sample is costed at the voltage measured now, as the nearest measurement to it.
+    settle(milliVolts);
+
+    energy_millivolts = milliVolts;
+    energy_samples++;
+
+    target_enable_irq();
+}
+
+/**
+  * Sets the modelled current drawn by a subsystem while active. Energy already accounted for is unchanged.
+  *
+  * @param subsystem One of MICROBIT_ENERGY_*.
+  * @param microAmps The current drawn, in microamps.
+  *
+  * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the subsystem is unknown, or DEVICE_NOT_SUPPORTED
+  *         if CONFIG_MICROBIT_ENERGY_ACCOUNTING is disabled.
+  */
+int codal::microbit_energy_set_current(int subsystem, uint32_t microAmps)
+{
+    if (subsystem < 0 || subsystem >= MICROBIT_ENERGY_SUBSYSTEMS)
+        return DEVICE_INVALID_PARAMETER;
+
+    // Cost any time at the old current first, so the change applies only from now.
+    target_disable_irq();
+
+    settle(energy_millivolts);
+    energy_accounts[subsystem].current = microAmps;
+
+    target_enable_irq();
+
+    return DEVICE_OK;
+}
+
+/**
+  * Retrieves the energy accounts of all subsystems. Time spent active since the last sample is costed at the
+  * most recently sampled voltage.
+  *
+  * @param report The structure to fill in.
+  *
+  * @return DEVICE_OK on success, or DEVICE_NOT_SUPPORTED if CONFIG_MICROBIT_ENERGY_ACCOUNTING is disabled.
+  */
+int codal::microbit_energy_get_report(MicroBitEnergyReport &report)
+{
+    target_disable_irq();
+
+    CODAL_TIMESTAMP now = system_timer_current_time_us();
+
+    report.period = now - energy_start;
+    report.milliVolts = energy_millivolts;
+    report.samples = energy_samples;
+    report.energy = 0;
+
+    for (int i = 0; i < MICROBIT_ENERGY_SUBSYSTEMS; i++)
+    {
+        EnergyAccount &a = energy_accounts[i];
+        MicroBitEnergyUsage &u = report.subsystems[i];
+        CODAL_TIMESTAMP t = activeTime(a, now);
+
+        u.name = energy_names[i];
+        u.current = a.current;
+        u.activations = a.activations;
+        u.activeTime = t;
+        u.energy = (a.energy + cost(a.current, energy_millivolts, t - a.sampledTime)) / 1000;
+
+        report.energy += u.energy;
+    }
+
+    target_enable_irq();
+
+    return DEVICE_OK;
+}
+
+/**
+  * Clears the energy accounts. Subsystems that are active remain so, and are accounted for from now.
+  */
+void codal::microbit_energy_reset()
+{
+    target_disable_irq();
+
+    CODAL_TIMESTAMP now = system_timer_current_time_us();
+
+    for (int i = 0; i < MICROBIT_ENERGY_SUBSYSTEMS; i++)
+    {
+        EnergyAccount &a = energy_accounts[i];
+
+        a.activations = a.active ? 1 : 0;
+        a.activeTime = 0;
+        a.since = now;
+        a.sampledTime = 0;
+        a.energy = 0;
+    }
+
+    energy_start = now;
+    energy_samples = 0;
+
+    target_enable_irq();
+}
+
+#else
+
+MicroBitEnergyScope::MicroBitEnergyScope(int subsystem)
+{
+    this->subsystem = subsystem;
+}
+
+MicroBitEnergyScope::~MicroBitEnergyScope()
+{
+}
+
+void codal::microbit_energy_state(int, bool)
+{
+}
+
+void codal::microbit_energy_sample(uint32_t)
+{
+}
+
+int codal::microbit_energy_set_current(int, uint32_t)
+{
+    return DEVICE_NOT_SUPPORTED;
+}
+
+int codal::microbit_energy_get_report(MicroBitEnergyReport &)
+{
+    return DEVICE_NOT_SUPPORTED;
+}
+
+void codal::microbit_energy_reset()
+{
+}
+
+#endif
@@ -0,0 +1,192 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "MicroBitEventThrottle.h"
+#include "EventModel.h"
+#include "Timer.h"
+#include "ErrorNo.h"
+
+using namespace codal;
+
+/**
+ * Constructor.
+ *
+ * @param source The ID of the source of events.
+ * @param value The value of source events to throttle, or DEVICE_EVT_ANY.
+ * @param period The minimum time between delivered events, in milliseconds.
+ * @param mode How source events are coalesced.
+ * @param id The ID of this component, used for the events it delivers. This must differ from source.
+ */
+MicroBitEventThrottle::MicroBitEventThrottle(uint16_t source, uint16_t value, uint32_t period, EventThrottleMode mode, uint16_t id)
+{
+    this->id = id;
+    this->source = source;
+    this->value = value;
+    this->mode = mode;
+    this->period = period;
+    this->batchSize = 1;
+    this->latest = 0;
+    this->pending = 0;
+    this->delivered = 0;
+    this->dropped = 0;
+    this->lastDelivery = 0;
+    this->deadline = 0;
+
+    if (EventModel::defaultEventBus)
+        EventModel::defaultEventBus->listen(source, value, this, &MicroBitEventThrottle::onSourceEvent, MESSAGE_BUS_LISTENER_IMMEDIATE);
+}
+
+/**
+ * Destructor.
+ */
+MicroBitEventThrottle::~MicroBitEventThrottle()
+{
+    status &= ~DEVICE_COMPONENT_STATUS_SYSTEM_TICK;
+
+    if (EventModel::defaultEventBus)
+        EventModel::defaultEventBus->ignore(source, value, this, &MicroBitEventThrottle::onSourceEvent);
+}
+
+/**
+ * Sets the minimum time between delivered events.
+ *
+ * @param period The period, in milliseconds.
+ */
+void MicroBitEventThrottle::setPeriod(uint32_t period)
+{
+    this->period = period;
+}
+
+/**
+ * Determines the minimum time between delivered events, in milliseconds.
+ */
+uint32_t MicroBitEventThrottle::getPeriod()
+{
+    return period;
+}
+
+/**
+ * Sets the number of source events delivered together in Batch mode.
+ *
+ * @param size The batch size.
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if size is less than 1.
+ */
+int MicroBitEventThrottle::setBatchSize(int size)
+{
+    if (size < 1)
+        return DEVICE_INVALID_PARAMETER;
+
+    batchSize = size;
+    return DEVICE_OK;
+}
+
+/**
+ * Determines the number of source events coalesced into the last delivered event.
+ * Listeners in Batch mode use this to determine the size of the batch.
+ */
+int MicroBitEventThrottle::getCount()
+{
+    return delivered;
+}
+
+/**
+ * Determines the number of source events dropped in RateLimit mode.
+ */
+uint32_t MicroBitEventThrottle::getDropped()
+{
+    return dropped;
+}
+
+/**
+ * Event handler, called immediately for every source event.
+ */
+void MicroBitEventThrottle::onSourceEvent(Event evt)
+{
+    CODAL_TIMESTAMP now = system_timer_current_time();
+    bool due = now - lastDelivery >= period;
+
+    target_disable_irq();
+
+    latest = evt.value;
+
+    if (mode == EventThrottleMode::RateLimit && !due)
+    {
+        dropped++;
+        target_enable_irq();
+        return;
+    }
+
+    if (pending++ == 0)
+        deadline = (mode == EventThrottleMode::Batch ? now : lastDelivery) + period;
+
+    if (mode == EventThrottleMode::Batch ? pending >= batchSize : due)
+    {
+        target_enable_irq();
+        deliver(now);
+        return;
+    }
+
+    // Deliver whatever is pending from the scheduler tick, once it is due.
+    status |= MICROBIT_EVENT_THROTTLE_STATUS_PENDING | DEVICE_COMPONENT_STATUS_SYSTEM_TICK;
+
+    target_enable_irq();
+}
+
+/**
+ * Delivers any pending source events once they are due.
+ */
+void MicroBitEventThrottle::periodicCallback()
+{
+    CODAL_TIMESTAMP now = system_timer_current_time();
+
+    if (!(status & MICROBIT_EVENT_THROTTLE_STATUS_PENDING))
+    {
+        status &= ~DEVICE_COMPONENT_STATUS_SYSTEM_TICK;
+        return;
+    }
+
+    if (now >= deadline)
+        deliver(now);
+}
+
+/**
+ * Raises an event in place of the pending source events.
+ *
+ * @param now The current time, in milliseconds.
+ */
+void MicroBitEventThrottle::deliver(CODAL_TIMESTAMP now)
+{
+    target_disable_irq();
+
+    delivered = pending;
+    pending = 0;
+    lastDelivery = now;
+    status &= ~MICROBIT_EVENT_THROTTLE_STATUS_PENDING;
+
+    uint16_t v = latest;
+
+    target_enable_irq();
+
+    Event(id, v);
+}
@@ -0,0 +1,245 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "MicroBitEventTrace.h"
+#include "EventModel.h"
+#include "ErrorNo.h"
+#include "Timer.h"
+#include "codal_target_hal.h"
+
+using namespace codal;
+
+#if CONFIG_ENABLED(CONFIG_MICROBIT_EVENT_TRACE)
+
+#if (CONFIG_MICROBIT_EVENT_TRACE_SIZE & (CONFIG_MICROBIT_EVENT_TRACE_SIZE - 1)) != 0
+#error "CONFIG_MICROBIT_EVENT_TRACE_SIZE must be a power of two"
+#endif
+
+// Slots are reserved by advancing trace_head, so writers at any interrupt priority never block one another.
+// A writer that is interrupted between reserving and filling a slot always completes before thread mode resumes,
+// and fibers are cooperative, so every slot below trace_head is complete whenever the (thread mode) reader runs.
+static MicroBitEventTraceRecord trace_ring[CONFIG_MICROBIT_EVENT_TRACE_SIZE];
+static volatile uint32_t trace_head = 0;                                          // Slots reserved by writers.
+static volatile uint32_t trace_tail = 0;                                          // Slots consumed by the reader.
+static volatile uint32_t trace_dropped = 0;                                       // Events lost since the last call to microbit_event_trace_dropped().
+
+/**
+  * Records a trace event. Lock free, and safe to call from any interrupt priority.
+  * Use MICROBIT_EVENT_TRACE(), which compiles to nothing unless CONFIG_MICROBIT_EVENT_TRACE is enabled.
+  *
+  * @param id The event id.
+  * @param a The first argument.
+  * @param b The second argument.
+  */
+void codal::microbit_event_trace(uint16_t id, uint16_t a, uint32_t b)
+{
+    uint32_t time = (uint32_t) system_timer_current_time_us();
+    uint32_t slot = trace_head;
+
+    do {
+        if (slot - trace_tail >= CONFIG_MICROBIT_EVENT_TRACE_SIZE)
+        {
+            __atomic_fetch_add(&trace_dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    } while (!__atomic_compare_exchange_n(&trace_head, &slot, slot + 1, true, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+    MicroBitEventTraceRecord *r = &trace_ring[slot & (CONFIG_MICROBIT_EVENT_TRACE_SIZE - 1)];
+    r->time = time;
+    r->id = id;
+    r->a = a;
+    r->b = b;
+}
+
+/**
+  * Removes the oldest trace events from the ring. Must only be called from thread context.
+  *
+  * @param records The buffer to fill.
+  * @param count The most records to remove.
+  *
+  * @return The number of records removed.
+  */
+int codal::microbit_event_trace_read(MicroBitEventTraceRecord *records, int count)
+{
+    uint32_t tail = trace_tail;
+    uint32_t available = __atomic_load_n(&trace_head, __ATOMIC_ACQUIRE) - tail;
+    int n = 0;
+
+    while (n < count && (uint32_t) n < available)
+    {
+        records[n] = trace_ring[(tail + n) & (CONFIG_MICROBIT_EVENT_TRACE_SIZE - 1)];
+        n++;
+    }
+
+    __atomic_store_n(&trace_tail, tail + n, __ATOMIC_RELEASE);
+
+    return n;
+}
+
+/**
+  * Determines how many trace events have been lost because the ring was full, and resets the count.
+  *
+  * @return The number of events dropped since the last call.
+  */
+uint32_t codal::microbit_event_trace_dropped()
+{
+    return __atomic_exchange_n(&trace_dropped, 0, __ATOMIC_RELAXED);
+}
+
+/**
+  * Constructor.
+  *
+  * @param serial The serial port to stream trace events to.
+  */
+MicroBitEventTraceStream::MicroBitEventTraceStream(Serial &serial) : serial(serial)
+{
+    this->id = MICROBIT_ID_EVENT_TRACE;
+    this->period = 0;
+}
+
+/**
+  * Starts streaming trace events.
+  *
+  * @param period The period at which to drain the ring, in milliseconds.
+  *
+  * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if period is not positive, or DEVICE_NOT_SUPPORTED
+  * if CONFIG_MICROBIT_EVENT_TRACE is disabled.
+  */
+int MicroBitEventTraceStream::start(int period)
+{
+    if (period <= 0)
+        return DEVICE_INVALID_PARAMETER;
+
+    if (this->period == 0 && EventModel::defaultEventBus)
+        EventModel::defaultEventBus->listen(id, MICROBIT_EVENT_TRACE_EVT_DRAIN, this, &MicroBitEventTraceStream::onDrain, MESSAGE_BUS_LISTENER_DROP_IF_BUSY);
+
+    system_timer_cancel_event(id, MICROBIT_EVENT_TRACE_EVT_DRAIN);
+    system_timer_event_every(period, id, MICROBIT_EVENT_TRACE_EVT_DRAIN);
+    this->period = period;
+
+    return DEVICE_OK;
+}
+
+/**
+  * Stops streaming trace events. Events continue to be recorded into the ring until it is full.
+  *
+  * @return DEVICE_OK.
+  */
+int MicroBitEventTraceStream::stop()
+{
+    if (period)
+    {
+        system_timer_cancel_event(id, MICROBIT_EVENT_TRACE_EVT_DRAIN);
+
+        if (EventModel::defaultEventBus)
+            EventModel::defaultEventBus->ignore(id, MICROBIT_EVENT_TRACE_EVT_DRAIN, this, &MicroBitEventTraceStream::onDrain);
+
+        period = 0;
+    }
+
+    return DEVICE_OK;
+}
+
+/**
+  * Sends any trace events in the ring. Runs in its own fiber on each drain period.
+  */
+void MicroBitEventTraceStream::onDrain(Event)
+{
+    uint8_t packet[5 + CONFIG_MICROBIT_EVENT_TRACE_PACKET * sizeof(MicroBitEventTraceRecord) + 1];
+    MicroBitEventTraceRecord *records = (MicroBitEventTraceRecord *) &packet[5];
+    uint32_t dropped = microbit_event_trace_dropped();
+    int count;
+
+    // Send a packet even if the ring is empty when events have been lost, so that the host can report the gap.
+    while ((count = microbit_event_trace_read(records, CONFIG_MICROBIT_EVENT_TRACE_PACKET)) > 0 || dropped)
+    {
+        uint16_t d = dropped > 0xFFFF ? 0xFFFF : dropped;
+        int length = 5 + count * sizeof(MicroBitEventTraceRecord);
+        uint8_t checksum = 0;
+
+        packet[0] = MICROBIT_EVENT_TRACE_SYNC0;
+        packet[1] = MICROBIT_EVENT_TRACE_SYNC1;
+        packet[2] = count;
+        packet[3] = d & 0xFF;
+        packet[4] = d >> 8;
+
+        for (int i = 2; i < length; i++)
+            checksum += packet[i];
+
+        packet[length] = checksum;
+        serial.send(packet, length + 1, SYNC_SLEEP);
+
+        dropped = 0;
+    }
+}
+
+/**
+  * Destructor.
+  */
+MicroBitEventTraceStream::~MicroBitEventTraceStream()
+{
+    stop();
+}
+
+#else
+
+void codal::microbit_event_trace(uint16_t, uint16_t, uint32_t)
+{
+}
+
+int codal::microbit_event_trace_read(MicroBitEventTraceRecord *, int)
+{
+    return 0;
+}
+
+uint32_t codal::microbit_event_trace_dropped()
+{
+    return 0;
+}
+
+MicroBitEventTraceStream::MicroBitEventTraceStream(Serial &serial) : serial(serial)
+{
+    this->id = MICROBIT_ID_EVENT_TRACE;
+    this->period = 0;
+}
+
+int MicroBitEventTraceStream::start(int)
+{
+    return DEVICE_NOT_SUPPORTED;
+}
+
+int MicroBitEventTraceStream::stop()
+{
+    return DEVICE_OK;
+}
+
+void MicroBitEventTraceStream::onDrain(Event)
+{
+}
+
+MicroBitEventTraceStream::~MicroBitEventTraceStream()
+{
+}
+
+#endif
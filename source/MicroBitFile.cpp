@@ -32,6 +32,13 @@ DEALINGS IN THE SOFTWARE.
 MicroBitFile::MicroBitFile(ManagedString fileName, int mode)
 {
     this->fileName = fileName;
+    this->readBuffer = NULL;
+    this->readBufferSize = 0;
+    this->readLength = 0;
+    this->readIndex = 0;
+    this->writeBuffer = NULL;
+    this->writeBufferSize = 0;
+    this->writeLength = 0;
 
     MicroBitFileSystem* fs;
 
@@ -43,6 +50,91 @@ MicroBitFile::MicroBitFile(ManagedString fileName, int mode)
     fileHandle = fs->open(fileName.toCharArray(), mode);
 }
 
+/**
+  * Configures buffering of reads and writes, to reduce the number of calls made to the file system.
+  *
+  * Reads are made a buffer at a time, with read(), readUntil() and readLine() returning data from the buffer.
+  * Writes are held in the buffer until it is full, or the file is flushed, closed or repositioned.
+  * n.b. Errors from buffered writes are reported by the call that writes them to the file system.
+  *
+  * @param readSize the size of the read buffer in bytes, or zero to read directly from the file. Defaults to zero.
+  *
+  * @param writeSize the size of the write buffer in bytes, or zero to write directly to the file. Defaults to zero.
+  *
+  * @return MICROBIT_OK on success, MICROBIT_NOT_SUPPORTED if the current file handle is invalid,
+  *         MICROBIT_INVALID_PARAMETER if either size is negative, or MICROBIT_NO_RESOURCES if the
+  *         buffers could not be allocated.
+  */
+int MicroBitFile::setBuffering(int readSize, int writeSize)
+{
+    if(fileHandle < 0)
+        return MICROBIT_NOT_SUPPORTED;
+
+    if(readSize < 0 || writeSize < 0)
+        return MICROBIT_INVALID_PARAMETER;
+
+    int ret = syncBuffers();
+
+    if(ret < 0)
+        return ret;
+
+    if(readBuffer)
+        free(readBuffer);
+
+    if(writeBuffer)
+        free(writeBuffer);
+
+    readBuffer = readSize ? (uint8_t *) malloc(readSize) : NULL;
+    writeBuffer = writeSize ? (uint8_t *) malloc(writeSize) : NULL;
+    readBufferSize = readBuffer ? readSize : 0;
+    writeBufferSize = writeBuffer ? writeSize : 0;
+
+    if(readBufferSize != readSize || writeBufferSize != writeSize)
+        return MICROBIT_NO_RESOURCES;
+
+    return MICROBIT_OK;
+}
+
+/**
+  * Refills the read buffer from the current position of the underlying file.
+  *
+  * @return the number of bytes read into the buffer, or an error code from MicroBitFileSystem::read().
+  */
+int MicroBitFile::fillReadBuffer()
+{
+    int ret = MicroBitFileSystem::defaultFileSystem->read(fileHandle, readBuffer, readBufferSize);
+
+    readIndex = 0;
+    readLength = ret > 0 ? ret : 0;
+
+    return ret;
+}
+
+/**
+  * Writes out any buffered data, and discards any data read ahead, leaving the position of the
+  * underlying file matching the position seen by the caller.
+  *
+  * @return MICROBIT_OK on success, or an error code from the file system.
+  */
+int MicroBitFile::syncBuffers()
+{
+    int ret = MICROBIT_OK;
+
+    if(writeLength)
+    {
+        ret = MicroBitFileSystem::defaultFileSystem->write(fileHandle, writeBuffer, writeLength);
+        writeLength = 0;
+    }
+
+    if(readIndex < readLength && ret >= 0)
+        ret = MicroBitFileSystem::defaultFileSystem->seek(fileHandle, readIndex - readLength, MB_SEEK_CUR);
+
+    readIndex = 0;
+    readLength = 0;
+
+    return ret < 0 ? ret : MICROBIT_OK;
+}
+
 /**
   * Seeks to a position in this MicroBitFile instance from the beginning of the file.
   *
@@ -59,6 +151,11 @@ int MicroBitFile::setPosition(int offset)
     if(offset < 0)
         return MICROBIT_INVALID_PARAMETER;
 
+    int ret = syncBuffers();
+
+    if(ret < 0)
+        return ret;
+
     return MicroBitFileSystem::defaultFileSystem->seek(fileHandle, offset, MB_SEEK_SET);
 }
 
@@ -72,7 +169,13 @@ int MicroBitFile::getPosition()
     if(fileHandle < 0)
         return MICROBIT_NOT_SUPPORTED;
 
-    return MicroBitFileSystem::defaultFileSystem->seek(fileHandle, 0, MB_SEEK_CUR);
+    int ret = MicroBitFileSystem::defaultFileSystem->seek(fileHandle, 0, MB_SEEK_CUR);
+
+    if(ret < 0)
+        return ret;
+
+    // Account for data held in our buffers.
+    return ret + writeLength - (readLength - readIndex);
 }
 
 /**
@@ -91,7 +194,38 @@ int MicroBitFile::write(const char *bytes, int len)
     if(fileHandle < 0)
         return MICROBIT_NOT_SUPPORTED;
 
-    return MicroBitFileSystem::defaultFileSystem->write(fileHandle, (uint8_t*)bytes, len);
+    // Write directly if we're unbuffered.
+    if(writeBuffer == NULL)
+        return MicroBitFileSystem::defaultFileSystem->write(fileHandle, (uint8_t*)bytes, len);
+
+    if(len < 0 || bytes == NULL)
+        return MICROBIT_INVALID_PARAMETER;
+
+    // Return the file to the position seen by the caller, if we've read ahead.
+    if(readLength)
+    {
+        int ret = syncBuffers();
+
+        if(ret < 0)
+            return ret;
+    }
+
+    // Make space in the buffer if needed. Writes too large to buffer are passed straight through.
+    if(len > writeBufferSize - writeLength)
+    {
+        int ret = syncBuffers();
+
+        if(ret < 0)
+            return ret;
+
+        if(len >= writeBufferSize)
+            return MicroBitFileSystem::defaultFileSystem->write(fileHandle, (uint8_t*)bytes, len);
+    }
+
+    memcpy(writeBuffer + writeLength, bytes, len);
+    writeLength += len;
+
+    return len;
 }
 
 /**
@@ -119,6 +253,10 @@ int MicroBitFile::read()
     if(fileHandle < 0)
         return MICROBIT_NOT_SUPPORTED;
 
+    // Fast path for data already buffered.
+    if(readIndex < readLength)
+        return readBuffer[readIndex++];
+
     char c;
 
     int ret = read( &c, 1);
@@ -147,7 +285,171 @@ int MicroBitFile::read(char *buffer, int size)
     if(size < 0 || buffer == NULL)
         return MICROBIT_INVALID_PARAMETER;
 
-    return MicroBitFileSystem::defaultFileSystem->read(fileHandle, (uint8_t*)buffer, size);
+    // Read directly if we're unbuffered.
+    if(readBuffer == NULL && writeLength == 0)
+        return MicroBitFileSystem::defaultFileSystem->read(fileHandle, (uint8_t*)buffer, size);
+
+    // Write out any buffered data before reading.
+    if(writeLength)
+    {
+        int ret = syncBuffers();
+
+        if(ret < 0)
+            return ret;
+
+        if(readBuffer == NULL)
+            return MicroBitFileSystem::defaultFileSystem->read(fileHandle, (uint8_t*)buffer, size);
+    }
+
+    int bytesCopied = 0;
+
+    while(bytesCopied < size)
+    {
+        if(readIndex == readLength)
+        {
+            // Large reads are made directly, once the buffer is empty.
+            if(size - bytesCopied >= readBufferSize)
+            {
+                int ret = MicroBitFileSystem::defaultFileSystem->read(fileHandle, (uint8_t*)buffer + bytesCopied, size - bytesCopied);
+
+                if(ret < 0)
+                    return bytesCopied ? bytesCopied : ret;
+
+                return bytesCopied + ret;
+            }
+
+            int ret = fillReadBuffer();
+
+            if(ret < 0)
+                return bytesCopied ? bytesCopied : ret;
+
+            if(ret == 0)
+                break;
+        }
+
+        int l = min(size - bytesCopied, readLength - readIndex);
+        memcpy(buffer + bytesCopied, readBuffer + readIndex, l);
+        readIndex += l;
+        bytesCopied += l;
+    }
+
+    return bytesCopied;
+}
+
+/**
+  * Reads from the file into a given buffer, up to the given delimiter. The delimiter is consumed,
+  * but not stored. Reading stops early if the buffer fills.
+  *
+  * @param buffer a pointer to the buffer where data will be stored.
+  *
+  * @param size the number of bytes that can be safely stored in the buffer.
+  *
+  * @param delimiter the character at which to stop reading.
+  *
+  * @return the number of bytes stored, MICROBIT_NO_DATA at the end of the file, MICROBIT_NOT_SUPPORTED
+  *         if the current file handle is invalid, or MICROBIT_INVALID_PARAMETER if buffer is invalid,
+  *         or the size given is less than 0.
+  */
+int MicroBitFile::readUntil(char *buffer, int size, char delimiter)
+{
+    if(fileHandle < 0)
+        return MICROBIT_NOT_SUPPORTED;
+
+    if(size < 0 || buffer == NULL)
+        return MICROBIT_INVALID_PARAMETER;
+
+    int count = 0;
+    bool found = false;
+
+    while(count < size && !found)
+    {
+        // Without a read buffer, read one character at a time.
+        if(readBuffer == NULL)
+        {
+            int c = read();
+
+            if(c < 0)
+                break;
+
+            if(c == (uint8_t)delimiter)
+                found = true;
+            else
+                buffer[count++] = c;
+
+            continue;
+        }
+
+        if(readIndex == readLength)
+        {
+            if(writeLength && syncBuffers() < 0)
+                break;
+
+            if(fillReadBuffer() <= 0)
+                break;
+        }
+
+        // Scan the buffered data for the delimiter.
+        uint8_t *start = readBuffer + readIndex;
+        int l = min(size - count, readLength - readIndex);
+        uint8_t *end = (uint8_t *)memchr(start, delimiter, l);
+
+        if(end)
+        {
+            l = end - start;
+            found = true;
+        }
+
+        memcpy(buffer + count, start, l);
+        count += l;
+        readIndex += found ? l + 1 : l;
+    }
+
+    if(count == 0 && !found)
+        return MICROBIT_NO_DATA;
+
+    return count;
+}
+
+/**
+  * Reads from the file up to the given delimiter. The delimiter is consumed, but not returned.
+  *
+  * @param delimiter the character at which to stop reading.
+  *
+  * @return a ManagedString containing the bytes before the delimiter, or an empty ManagedString
+  *         at the end of the file or on error.
+  */
+ManagedString MicroBitFile::readUntil(char delimiter)
+{
+    ManagedString s;
+    char buff[32];
+    int ret;
+
+    // Read in chunks, until one ends before filling up.
+    do
+    {
+        ret = readUntil(buff, sizeof(buff), delimiter);
+
+        if(ret > 0)
+            s = s + ManagedString(buff, ret);
+
+    } while(ret == (int)sizeof(buff));
+
+    return s;
+}
+
+/**
+  * Reads a line of text from the file. The line ending ("\n" or "\r\n") is consumed, but not returned.
+  *
+  * @return a ManagedString containing the line, or an empty ManagedString at the end of the file or on error.
+  */
+ManagedString MicroBitFile::readLine()
+{
+    ManagedString s = readUntil('\n');
+
+    if(s.length() > 0 && s.charAt(s.length() - 1) == '\r')
+        return s.substring(0, s.length() - 1);
+
+    return s;
 }
 
 /**
@@ -172,6 +474,30 @@ ManagedString MicroBitFile::read(int size)
     return ManagedString(buff,ret);
 }
 
+/**
+  * Describe where the data of this file lies in FLASH, from the current position to the end of the file,
+  * so that it can be read in place without copying. See MicroBitFileSystem::getExtents().
+  *
+  * @param extents array to store the extents in.
+  *
+  * @param count the number of extents that can be stored in the array.
+  *
+  * @return the number of extents stored, MICROBIT_NOT_SUPPORTED if the current file handle is invalid,
+  *         or MICROBIT_INVALID_PARAMETER if the array is invalid.
+  */
+int MicroBitFile::getExtents(FileExtent *extents, int count)
+{
+    if(fileHandle < 0)
+        return MICROBIT_NOT_SUPPORTED;
+
+    int ret = syncBuffers();
+
+    if(ret < 0)
+        return ret;
+
+    return MicroBitFileSystem::defaultFileSystem->getExtents(fileHandle, extents, count);
+}
+
 /**
   * Removes this MicroBitFile from the MicroBitFileSystem.
   *
@@ -208,7 +534,12 @@ int MicroBitFile::append(const char *bytes, int len)
     if(fileHandle < 0)
         return MICROBIT_NOT_SUPPORTED;
 
-    int ret =  MicroBitFileSystem::defaultFileSystem->seek(fileHandle, 0, MB_SEEK_END);
+    int ret = syncBuffers();
+
+    if(ret < 0)
+        return ret;
+
+    ret =  MicroBitFileSystem::defaultFileSystem->seek(fileHandle, 0, MB_SEEK_END);
 
     if(ret < 0)
         return ret;
@@ -266,6 +597,8 @@ int MicroBitFile::close()
     if(fileHandle < 0)
         return MICROBIT_NOT_SUPPORTED;
 
+    syncBuffers();
+
     int ret = MicroBitFileSystem::defaultFileSystem->close(fileHandle);
 
     if(ret < 0)
@@ -288,6 +621,11 @@ int MicroBitFile::flush()
     if(fileHandle < 0)
         return MICROBIT_NOT_SUPPORTED;
 
+    int ret = syncBuffers();
+
+    if(ret < 0)
+        return ret;
+
     return MicroBitFileSystem::defaultFileSystem->flush(fileHandle);
 }
 
@@ -297,4 +635,10 @@ int MicroBitFile::flush()
 MicroBitFile::~MicroBitFile()
 {
     close();
+
+    if(readBuffer)
+        free(readBuffer);
+
+    if(writeBuffer)
+        free(writeBuffer);
 }
@@ -24,6 +24,7 @@ DEALINGS IN THE SOFTWARE.
 #include "MicroBitFlash.h"
 #include "MicroBitStorage.h"        
 #include "MicroBitCompat.h"
+#include "CodalFiber.h"
 #include "ErrorNo.h"
 
 static uint32_t *defaultScratchPage = (uint32_t *)MICROBIT_DEFAULT_SCRATCH_PAGE;
@@ -33,29 +34,34 @@ MicroBitFileSystem* MicroBitFileSystem::defaultFileSystem = NULL;
 /**
   * Allocate a free logical block.
   * This is chosen at random from the blocks available, to even out the wear on the physical device.
+  * @param hint A block to allocate in preference to the round robin choice, if it is free. Zero for none.
   * @return a valid, unused block address on success, or zero if no space is available.
   */
-uint16_t MicroBitFileSystem::getFreeBlock()
+uint16_t MicroBitFileSystem::getFreeBlock(uint16_t hint)
 {
-    // Walk the File Table and allocate the first free block - starting immediately after the last block allocated,
+    // Honour the caller's preference if we can, such that files can be laid out contiguously.
+    if (hint && hint < fileSystemSize && !isBlockMarked(usedMap, hint, 1) && !isBlockMarked(deletedMap, hint, 1))
+    {
+        lastBlockAllocated = hint;
+        return hint;
+    }
+
+    // Search the block maps for the first free block - starting immediately after the last block allocated,
     // and wrapping around the filesystem space if we reach the end.
-    uint16_t block;
-    uint16_t deletedBlock = 0;
+    uint16_t block = findFreeBlock((lastBlockAllocated + 1) % fileSystemSize);
 
-    for (block = (lastBlockAllocated + 1) % fileSystemSize; block != lastBlockAllocated; block++)
+    if (block)
     {
-        if (fileSystemTable[block] == MBFS_UNUSED)
-        {
-            lastBlockAllocated = block;
-            return block;
-        }
-
-        if (fileSystemTable[block] == MBFS_DELETED)
-            deletedBlock = block;
+        lastBlockAllocated = block;
+        return block;
     }
 
     // if no UNUSED blocks are available, try to recycle one marked as DELETED.
-    block = deletedBlock;
+    for (int w = 0; block == 0 && w < (fileSystemSize + 31) / 32; w++)
+    {
+        if (deletedMap[w])
+            block = w * 32 + __builtin_ctz(deletedMap[w]);
+    }
 
     // If no blocks are available - either UNUSED or marked as DELETED, then we're out of space and there's nothing we can do.
     if (block)
@@ -78,7 +84,7 @@ uint16_t MicroBitFileSystem::getFreeBlock()
   */
 uint32_t* MicroBitFileSystem::getFreePage()
 {
-    // Walk the file table, starting at the last allocated block, looking for an unused page.
+    // Search the block maps, starting at the last allocated block, looking for an unused page.
     int blocksPerPage = (MICROBIT_CODEPAGESIZE / MBFS_BLOCK_SIZE);
 
     // get a handle on the next physical page.
@@ -86,33 +92,18 @@ uint32_t* MicroBitFileSystem::getFreePage()
     uint16_t page = (currentPage + blocksPerPage) % fileSystemSize;
     uint16_t recyclablePage = 0;
 
-    // Walk around the file table, looking for a free page.
+    uint16_t freePage = currentPage;
+
+    // Walk around the file table, looking for the least worn free page.
     while (page != currentPage)
     {
-        bool empty = true;
-        bool deleted = false;
-        uint16_t next;
-
-        for (int i = 0; i < blocksPerPage; i++)
-        {
-            next = getNextFileBlock(page + i);
-            
-            if (next == MBFS_DELETED)
-                deleted = true;
-            
-            else if (next != MBFS_UNUSED)
-            {
-                empty = false;
-                break;
-            }
-        }
+        // A page can only be reused if none of its blocks are in use.
+        bool used = isBlockMarked(usedMap, page, blocksPerPage);
+        bool deleted = !used && isBlockMarked(deletedMap, page, blocksPerPage);
 
         // See if we found one...
-        if (empty)
-        {
-            lastBlockAllocated = page;
-            return getBlock(page);
-        }
+        if (!used && !deleted && (freePage == currentPage || eraseCount[page / blocksPerPage] < eraseCount[freePage / blocksPerPage]))
+            freePage = page;
 
         // make note of the first unused but un-erased page we find (if any).
         if (deleted && !recyclablePage)
@@ -121,16 +112,22 @@ uint32_t* MicroBitFileSystem::getFreePage()
         page = (page + blocksPerPage) % fileSystemSize;
     }
 
+    if (freePage != currentPage)
+    {
+        lastBlockAllocated = freePage;
+        return getBlock(freePage);
+    }
+
     // No empty pages are available, but we may be able to recycle one.
     if (recyclablePage)
     {
         uint32_t *address = getBlock(recyclablePage);
-        flash.erase_page(address);
+        erasePage(address);
         return address;
     }
 
     // Nothing available at all. Use the default.
-    flash.erase_page(defaultScratchPage);
+    erasePage(defaultScratchPage);
     return defaultScratchPage;
 }
 
@@ -178,6 +175,15 @@ int MicroBitFileSystem::init(uint32_t flashStart, int flashPages)
     lastBlockAllocated = 0;
     rootDirectory = NULL;
     openFiles = NULL;
+    usedMap = NULL;
+    deletedMap = NULL;
+    refreshedMap = NULL;
+    eraseCount = NULL;
+    nextDirectoryIndex = 0;
+    for (int i = 0; i < MBFS_DIRECTORY_INDEX_COUNT; i++)
+        directoryIndex[i].table = NULL;
+
+    invalidateDirectoryIndex();
 
     // If we have a zero length, then dynamically determine our geometry.
     if (flashStart == 0)
@@ -208,6 +214,10 @@ int MicroBitFileSystem::init(uint32_t flashStart, int flashPages)
         format();
     }
 
+    // Bring the RAM copy of the block states up to date.
+    if (buildBlockMap() != MICROBIT_OK)
+        return MICROBIT_NO_RESOURCES;
+
     // indicate that we have a valid FileSystem
     status = MBFS_STATUS_INITIALISED;
     return MICROBIT_OK;
@@ -300,6 +310,23 @@ DirectoryEntry* MicroBitFileSystem::getDirectoryEntry(char const * filename, con
     if (directory == NULL)
         directory = rootDirectory;
 
+    // Look the file up in the index of the directory, building it if necessary.
+    DirectoryIndex *index = getDirectoryIndex(directory);
+
+    if (index)
+    {
+        uint16_t mask = index->size - 1;
+
+        for (uint16_t i = hashFilename(file) & mask; index->table[i]; i = (i + 1) & mask)
+        {
+            if (strcmp(index->table[i]->file_name, file) == 0)
+                return index->table[i];
+        }
+
+        return NULL;
+    }
+
+    // If there isn't enough memory for an index, fall back to searching the directory itself.
     block = directory->first_block;
     dir = (Directory *) getBlock(block);
     dirent = &dir->entry[0];
@@ -328,6 +355,120 @@ DirectoryEntry* MicroBitFileSystem::getDirectoryEntry(char const * filename, con
     return NULL;
 }
 
+/**
+  * Retrieve the hash index of the valid entries of the given directory, building it if necessary.
+  * The least recently built index is replaced if all are in use.
+  *
+  * @param directory The directory to index.
+  * @return The index of the directory, or NULL if there is not enough memory to hold it.
+  */
+DirectoryIndex* MicroBitFileSystem::getDirectoryIndex(const DirectoryEntry *directory)
+{
+    DirectoryIndex *index;
+    uint16_t count = 0;
+    uint16_t size = 8;
+
+    for (int i = 0; i < MBFS_DIRECTORY_INDEX_COUNT; i++)
+    {
+        if (directoryIndex[i].directory == directory)
+            return &directoryIndex[i];
+    }
+
+    // Replace the oldest index.
+    index = &directoryIndex[nextDirectoryIndex];
+    nextDirectoryIndex = (nextDirectoryIndex + 1) % MBFS_DIRECTORY_INDEX_COUNT;
+
+    if (index->table)
+        free(index->table);
+
+    index->directory = NULL;
+    index->table = NULL;
+
+    // Make two passes over the directory: one to size the table, and one to fill it.
+    for (int pass = 0; pass < 2; pass++)
+    {
+        uint16_t block = directory->first_block;
+
+        while (block != MBFS_EOF)
+        {
+            DirectoryEntry *dirent = (DirectoryEntry *)getBlock(block);
+
+            for (uint16_t entry = 0; entry < MBFS_BLOCK_SIZE / sizeof(DirectoryEntry); entry++, dirent++)
+            {
+                // Unused entries are erased, and so appear valid. Skip them by their unwritten name.
+                if (!(dirent->flags & MBFS_DIRECTORY_ENTRY_VALID) || dirent->file_name[0] == (char)0xFF)
+                    continue;
+
+                if (pass == 0)
+                {
+                    count++;
+                    continue;
+                }
+
+                uint16_t mask = size - 1;
+                uint16_t i = hashFilename(dirent->file_name) & mask;
+
+                while (index->table[i])
+                    i = (i + 1) & mask;
+
+                index->table[i] = dirent;
+            }
+
+            block = getNextFileBlock(block);
+        }
+
+        if (pass == 0)
+        {
+            // Keep the table no more than half full, so that searches are short.
+            while (size < count * 2)
+                size *= 2;
+
+            index->table = (DirectoryEntry **) malloc(size * sizeof(DirectoryEntry *));
+            if (index->table == NULL)
+                return NULL;
+
+            memset(index->table, 0, size * sizeof(DirectoryEntry *));
+        }
+    }
+
+    index->directory = directory;
+    index->size = size;
+
+    return index;
+}
+
+/**
+  * Discard all directory indexes. Must be called whenever a DirectoryEntry is created, moved or deleted.
+  */
+void MicroBitFileSystem::invalidateDirectoryIndex()
+{
+    for (int i = 0; i < MBFS_DIRECTORY_INDEX_COUNT; i++)
+    {
+        if (directoryIndex[i].table)
+            free(directoryIndex[i].table);
+
+        directoryIndex[i].directory = NULL;
+        directoryIndex[i].size = 0;
+        directoryIndex[i].table = NULL;
+    }
+}
+
+/**
+  * Calculate the hash of a filename, as used by the directory index.
+  *
+  * @param name The filename, without any path.
+  * @return The hash of the filename.
+  */
+uint16_t MicroBitFileSystem::hashFilename(const char *name)
+{
+    uint16_t hash = 5381;
+
+    for (int i = 0; i < MBFS_FILENAME_LENGTH && name[i]; i++)
+        hash = (hash << 5) + hash + name[i];
+
+    return hash;
+}
+
 /**
   * Determine the number of logical blocks required to hold the file table.
   *
@@ -401,9 +542,335 @@ uint16_t MicroBitFileSystem::getBlockNumber(void *address)
 int MicroBitFileSystem::fileTableWrite(uint16_t block, uint16_t value)
 {
     flash.flash_write(&fileSystemTable[block], &value, 2);
+    setBlockState(block, value);
+
+    // The page holding a newly deleted block needs refreshing before the block can be reused.
+    if (value == MBFS_DELETED && refreshedMap)
+    {
+        int page = block / (MICROBIT_CODEPAGESIZE / MBFS_BLOCK_SIZE);
+        refreshedMap[page / 32] &= ~(1UL << (page % 32));
+
+        startCompaction();
+    }
+
     return MICROBIT_OK;
 }
 
+/**
+  * Rebuild the bitmaps of used and deleted blocks from the file table, allocating them if necessary.
+  *
+  * @return MICROBIT_OK on success, or MICROBIT_NO_RESOURCES if the bitmaps could not be allocated.
+  */
+int MicroBitFileSystem::buildBlockMap()
+{
+    int size = ((fileSystemSize + 31) / 32) * sizeof(uint32_t);
+    int pages = fileSystemSize / (MICROBIT_CODEPAGESIZE / MBFS_BLOCK_SIZE);
+
+    if (usedMap == NULL)
+        usedMap = (uint32_t *) malloc(size);
+
+    if (deletedMap == NULL)
+        deletedMap = (uint32_t *) malloc(size);
+
+    if (refreshedMap == NULL)
+        refreshedMap = (uint32_t *) malloc(((pages + 31) / 32) * sizeof(uint32_t));
+
+    if (eraseCount == NULL)
+    {
+        eraseCount = (uint16_t *) malloc(pages * sizeof(uint16_t));
+
+        if (eraseCount)
+            memset(eraseCount, 0, pages * sizeof(uint16_t));
+    }
+
+    if (usedMap == NULL || deletedMap == NULL || refreshedMap == NULL || eraseCount == NULL)
+        return MICROBIT_NO_RESOURCES;
+
+    memset(usedMap, 0, size);
+    memset(deletedMap, 0, size);
+    memset(refreshedMap, 0, ((pages + 31) / 32) * sizeof(uint32_t));
+
+    for (uint16_t block = 0; block < fileSystemSize; block++)
+        setBlockState(block, fileSystemTable[block]);
+
+    return MICROBIT_OK;
+}
+
+/**
+  * Record the state of a block in the bitmaps, according to its file table entry.
+  *
+  * @param block The block to update.
+  * @param value The value stored in the file table for that block.
+  */
+void MicroBitFileSystem::setBlockState(uint16_t block, uint16_t value)
+{
+    uint32_t bit = 1UL << (block % 32);
+
+    if (usedMap == NULL)
+        return;
+
+    usedMap[block / 32] &= ~bit;
+    deletedMap[block / 32] &= ~bit;
+
+    if (value == MBFS_DELETED)
+        deletedMap[block / 32] |= bit;
+
+    else if (value != MBFS_UNUSED)
+        usedMap[block / 32] |= bit;
+}
+
+/**
+  * Find the first block that is neither used nor deleted, starting at the given block and
+  * wrapping around the filesystem space if we reach the end.
+  *
+  * @param start The block to start searching from.
+  *
+  * @return The block number of a free block, or zero if none is available.
+  */
+uint16_t MicroBitFileSystem::findFreeBlock(uint16_t start)
+{
+    int words = (fileSystemSize + 31) / 32;
+    int w = start / 32;
+    uint32_t mask = 0xFFFFFFFF << (start % 32);
+
+    // Test a word at a time. The first word is visited twice, to cover the blocks before the start.
+    for (int i = 0; i <= words; i++)
+    {
+        uint32_t free = ~(usedMap[w] | deletedMap[w]) & mask;
+
+        // Ignore bits beyond the end of the file system.
+        if (w == words - 1 && fileSystemSize % 32)
+            free &= (1UL << (fileSystemSize % 32)) - 1;
+
+        if (free)
+            return w * 32 + __builtin_ctz(free);
+
+        mask = 0xFFFFFFFF;
+        w = (w + 1) % words;
+    }
+
+    return 0;
+}
+
+/**
+  * Determine if any of the given range of blocks is marked in a bitmap.
+  *
+  * @param map The bitmap to test.
+  * @param start The first block of the range.
+  * @param count The number of blocks in the range.
+  *
+  * @return true if any block in the range is marked, false otherwise.
+  */
+bool MicroBitFileSystem::isBlockMarked(uint32_t *map, uint16_t start, int count)
+{
+    while (count > 0)
+    {
+        int bit = start % 32;
+        int n = min(count, 32 - bit);
+        uint32_t mask = (n == 32 ? 0xFFFFFFFF : ((1UL << n) - 1)) << bit;
+
+        if (map[start / 32] & mask)
+            return true;
+
+        start += n;
+        count -= n;
+    }
+
+    return false;
+}
+
+/**
+  * Find a run of consecutive blocks that are neither used nor deleted.
+  *
+  * @param count The number of blocks in the run.
+  *
+  * @return The first block of the run, or zero if no run of that length is available.
+  */
+uint16_t MicroBitFileSystem::findFreeRun(int count)
+{
+    uint16_t start = findFreeBlock(0);
+    int run = 0;
+
+    if (start == 0 || count <= 0)
+        return 0;
+
+    // Runs cannot wrap around the end of the file system, so scan forward from the first free block.
+    for (int block = start; block < fileSystemSize; block++)
+    {
+        if (isBlockMarked(usedMap, block, 1) || isBlockMarked(deletedMap, block, 1))
+        {
+            run = 0;
+            continue;
+        }
+
+        if (run == 0)
+            start = block;
+
+        if (++run == count)
+            return start;
+    }
+
+    return 0;
+}
+
+/**
+  * Erase a physical page of the file system, recording the erase for wear levelling.
+  *
+  * @param page The address of the page to erase.
+  */
+void MicroBitFileSystem::erasePage(uint32_t *page)
+{
+    flash.erase_page(page);
+
+    // The default scratch page lies outside the file system, and is not tracked.
+    if (eraseCount && page >= (uint32_t *)fileSystemTable && page < getBlock(fileSystemSize))
+    {
+        int p = getBlockNumber(page) / (MICROBIT_CODEPAGESIZE / MBFS_BLOCK_SIZE);
+
+        if (eraseCount[p] < 0xFFFF)
+            eraseCount[p]++;
+
+        // An erased page no longer holds any deleted data.
+        refreshedMap[p / 32] |= 1UL << (p % 32);
+    }
+}
+
+/**
+  * Start the background compaction fiber, if it is not already running.
+  */
+void MicroBitFileSystem::startCompaction()
+{
+#if MBFS_COMPACTION_PERIOD > 0
+    if ((status & MBFS_STATUS_COMPACTING) == 0 && fiber_scheduler_running())
+    {
+        status |= MBFS_STATUS_COMPACTING;
+        create_fiber(compactionFiber, this);
+    }
+#endif
+}
+
+/**
+  * Body of the background compaction fiber. Performs one step of compaction per MBFS_COMPACTION_PERIOD,
+  * and exits once there is nothing left to reclaim.
+  *
+  * @param fs The MicroBitFileSystem to compact.
+  */
+void MicroBitFileSystem::compactionFiber(void *fs)
+{
+    MicroBitFileSystem *f = (MicroBitFileSystem *)fs;
+
+    // Refresh one page per step, so that other fibers are never delayed by more than one page refresh.
+    // Each step holds the file system's mutex, so never runs part way through another operation.
+    int result;
+
+    do {
+        fiber_sleep(MBFS_COMPACTION_PERIOD);
+        result = f->compact();
+    } while (result == MICROBIT_OK || result == MICROBIT_BUSY);
+
+    f->status &= ~MBFS_STATUS_COMPACTING;
+}
+
+/**
+  * Perform one step of the compaction of deleted blocks. The next physical page holding
+  * deleted blocks is refreshed, or once all such pages are refreshed, the file table itself,
+  * returning the deleted blocks to use.
+  *
+  * This is normally called by a background fiber, so that the cost of reclaiming space is
+  * not paid by a call to write() that runs out of unused blocks.
+  *
+  * @return MICROBIT_OK if a step was performed, MICROBIT_NO_DATA if there is nothing to
+  *         reclaim, MICROBIT_BUSY if extents obtained by getExtents() are still valid,
+  *         or MICROBIT_NOT_SUPPORTED if the file system is not initialised.
+  */
+int MicroBitFileSystem::compact()
+{
+    int result;
+
+    mutex.wait();
+    result = _compact();
+    mutex.notify();
+
+    return result;
+}
+
+/**
+  * Implements compact(). The caller must hold the mutex.
+  */
+int MicroBitFileSystem::_compact()
+{
+    int blocksPerPage = MICROBIT_CODEPAGESIZE / MBFS_BLOCK_SIZE;
+
+    if ((status & MBFS_STATUS_INITIALISED) == 0)
+        return MICROBIT_NOT_SUPPORTED;
+
+    // Pages described by extents must stay in place until the file system is next written to.
+    if (status & MBFS_STATUS_EXTENTS)
+        return MICROBIT_BUSY;
+
+    if (!isBlockMarked(deletedMap, 0, fileSystemSize))
+        return MICROBIT_NO_DATA;
+
+    // Refresh the first page still holding deleted data.
+    for (uint16_t block = 0; block < fileSystemSize; block += blocksPerPage)
+    {
+        int page = block / blocksPerPage;
+
+        if ((refreshedMap[page / 32] & (1UL << (page % 32))) == 0 && isBlockMarked(deletedMap, block, blocksPerPage))
+        {
+            recycleBlock(block);
+            return MICROBIT_OK;
+        }
+    }
+
+    // All deleted data is erased, so the file table can now return the deleted blocks to UNUSED.
+    recycleFileTable();
+
+    return MICROBIT_OK;
+}
+
+/**
+  * Determine how many times a physical page of the file system has been erased since
+  * the file system was initialised.
+  *
+  * @param page The index of the page in the file system, or -1 for the total over all pages.
+  *
+  * @return The number of erases, or MICROBIT_INVALID_PARAMETER if the page is invalid.
+  */
+int MicroBitFileSystem::getEraseCount(int page)
+{
+    int result;
+
+    mutex.wait();
+    result = _getEraseCount(page);
+    mutex.notify();
+
+    return result;
+}
+
+/**
+  * Implements getEraseCount(). The caller must hold the mutex.
+  */
+int MicroBitFileSystem::_getEraseCount(int page)
+{
+    int pages = fileSystemSize / (MICROBIT_CODEPAGESIZE / MBFS_BLOCK_SIZE);
+    int total = 0;
+
+    if ((status & MBFS_STATUS_INITIALISED) == 0)
+        return MICROBIT_NOT_SUPPORTED;
+
+    if (page >= pages || page < -1)
+        return MICROBIT_INVALID_PARAMETER;
+
+    if (page >= 0)
+        return eraseCount[page];
+
+    for (int i = 0; i < pages; i++)
+        total += eraseCount[i];
+
+    return total;
+}
+
 
 
 /**
@@ -464,6 +931,9 @@ DirectoryEntry* MicroBitFileSystem::getDirectoryOf(char const * filename)
   */
 int MicroBitFileSystem::recycleBlock(uint16_t block, int type)
 {
+    // Entries marked for deletion will be recycled, so the directory index must be rebuilt.
+    invalidateDirectoryIndex();
+
     uint32_t *page = getPage(block);
     uint32_t* scratch = getFreePage();
     uint8_t *write = (uint8_t *)scratch;
@@ -518,9 +988,9 @@ int MicroBitFileSystem::recycleBlock(uint16_t block, int type)
     }
 
     // Now refresh the page originally holding the block.
-    flash.erase_page(page);
+    erasePage(page);
     flash.flash_write(page, scratch, MICROBIT_CODEPAGESIZE);
-    flash.erase_page(scratch);
+    erasePage(scratch);
 
     return MICROBIT_OK;
 }
@@ -541,6 +1011,12 @@ int MicroBitFileSystem::recycleFileTable()
         if (block % (MICROBIT_CODEPAGESIZE / MBFS_BLOCK_SIZE) == 0)
             pageRecycled = false;
 
+        // Pages already refreshed in the background hold no deleted data, and are skipped.
+        int page = block / (MICROBIT_CODEPAGESIZE / MBFS_BLOCK_SIZE);
+
+        if (refreshedMap[page / 32] & (1UL << (page % 32)))
+            pageRecycled = true;
+
         if (fileSystemTable[block] == MBFS_DELETED && !pageRecycled)
         {
             recycleBlock(block);
@@ -552,6 +1028,9 @@ int MicroBitFileSystem::recycleFileTable()
     for (uint16_t block = 0; getPage(block) < (uint32_t *)rootDirectory; block += MICROBIT_CODEPAGESIZE / MBFS_BLOCK_SIZE)
         recycleBlock(block);
 
+    // All DELETED entries are now UNUSED.
+    buildBlockMap();
+
     return MICROBIT_OK;
 }
 
@@ -697,6 +1176,7 @@ DirectoryEntry* MicroBitFileSystem::createFile(char const * filename, DirectoryE
     // Push the new data back to FLASH memory
     flash.flash_write(dirent, &d, sizeof(DirectoryEntry));
     fileTableWrite(d.first_block, MBFS_EOF);
+    invalidateDirectoryIndex();
     return dirent;
 }
 
@@ -741,6 +1221,24 @@ FileDescriptor* MicroBitFileSystem::getFileDescriptor(int fd, bool remove)
   * @return MICROBIT_OK on success, MICROBIT_INVALID_PARAMETER if the path is invalid, or MICROBT_NO_RESOURCES if the FileSystem is full.
   */
 int MicroBitFileSystem::createDirectory(char const *name)
+{
+    int result;
+
+    mutex.wait();
+
+    // Extents obtained by getExtents() are no longer valid, so compaction may erase the pages they describe.
+    status &= ~MBFS_STATUS_EXTENTS;
+
+    result = _createDirectory(name);
+    mutex.notify();
+
+    return result;
+}
+
+/**
+  * Implements createDirectory(). The caller must hold the mutex.
+  */
+int MicroBitFileSystem::_createDirectory(char const *name)
 {
     DirectoryEntry* directory;        // Directory holding this file.
     DirectoryEntry* dirent;            // Entry in the direcoty of this file.
@@ -780,6 +1278,8 @@ int MicroBitFileSystem::createDirectory(char const *name)
   *  - MB_READ : read from the file.
   *  - MB_WRITE : write to the file.
   *  - MB_CREAT : create a new file, if it doesn't already exist.
+  *  - MB_CONTIGUOUS : grow the file into the block following its last block where that is free,
+  *    in preference to spreading its blocks across the device for wear levelling.
   *
   * If a file is opened that doesn't exist, and MB_CREAT isn't passed,
   * an error is returned, otherwise the file is created.
@@ -798,6 +1298,25 @@ int MicroBitFileSystem::createDirectory(char const *name)
   * @endcode
   */
 int MicroBitFileSystem::open(char const * filename, uint32_t flags)
+{
+    int result;
+
+    mutex.wait();
+
+    // Creating a file writes to the file system, after which extents obtained by getExtents() are no longer valid.
+    if (flags & MB_CREAT)
+        status &= ~MBFS_STATUS_EXTENTS;
+
+    result = _open(filename, flags);
+    mutex.notify();
+
+    return result;
+}
+
+/**
+  * Implements open(). The caller must hold the mutex.
+  */
+int MicroBitFileSystem::_open(char const * filename, uint32_t flags)
 {
     FileDescriptor *file;               // File Descriptor of this file.
     DirectoryEntry* directory;          // Directory holding this file.
@@ -865,6 +1384,8 @@ int MicroBitFileSystem::open(char const * filename, uint32_t flags)
     file->dirent = dirent;
     file->directory = directory;
     file->cacheLength = 0;
+    file->block = 0;
+    file->blockPosition = 0;
 
     // Add the file descriptor to the chain of open files.
     file->next = openFiles;
@@ -894,6 +1415,20 @@ int MicroBitFileSystem::open(char const * filename, uint32_t flags)
   * @endcode
   */
 int MicroBitFileSystem::flush(int fd)
+{
+    int result;
+
+    mutex.wait();
+    result = _flush(fd);
+    mutex.notify();
+
+    return result;
+}
+
+/**
+  * Implements flush(). The caller must hold the mutex.
+  */
+int MicroBitFileSystem::_flush(int fd)
 {
     // Protect against accidental re-initialisation
     if ((status & MBFS_STATUS_INITIALISED) == 0)
@@ -931,6 +1466,7 @@ int MicroBitFileSystem::flush(int fd)
             flash.flash_write(&file->dirent->flags, &value, 2);
             newDirent = createDirectoryEntry(file->directory);
             flash.flash_write(newDirent, &d, sizeof(DirectoryEntry));
+            invalidateDirectoryIndex();
         }
     }
 
@@ -960,9 +1496,23 @@ int MicroBitFileSystem::flush(int fd)
   * @endcode
   */
 int MicroBitFileSystem::close(int fd)
+{
+    int result;
+
+    mutex.wait();
+    result = _close(fd);
+    mutex.notify();
+
+    return result;
+}
+
+/**
+  * Implements close(). The caller must hold the mutex.
+  */
+int MicroBitFileSystem::_close(int fd)
 {
     // Firstly, ensure all unwritten data is flushed.
-    int r = flush(fd);
+    int r = _flush(fd);
 
     // If the flush called failed on validation, pass the error code onto the caller.
     if (r != MICROBIT_OK)
@@ -999,6 +1549,20 @@ int MicroBitFileSystem::close(int fd)
   * @endcode
   */
 int MicroBitFileSystem::seek(int fd, int offset, uint8_t flags)
+{
+    int result;
+
+    mutex.wait();
+    result = _seek(fd, offset, flags);
+    mutex.notify();
+
+    return result;
+}
+
+/**
+  * Implements seek(). The caller must hold the mutex.
+  */
+int MicroBitFileSystem::_seek(int fd, int offset, uint8_t flags)
 {
     FileDescriptor *file;
     int position;
@@ -1058,6 +1622,20 @@ int MicroBitFileSystem::seek(int fd, int offset, uint8_t flags)
   * @endcode
   */
 int MicroBitFileSystem::read(int fd, uint8_t* buffer, int size)
+{
+    int result;
+
+    mutex.wait();
+    result = _read(fd, buffer, size);
+    mutex.notify();
+
+    return result;
+}
+
+/**
+  * Implements read(). The caller must hold the mutex.
+  */
+int MicroBitFileSystem::_read(int fd, uint8_t* buffer, int size)
 {
     FileDescriptor *file;
     uint16_t block;
@@ -1065,7 +1643,6 @@ int MicroBitFileSystem::read(int fd, uint8_t* buffer, int size)
     uint8_t *writePointer;
 
     uint32_t offset;
-    uint32_t position = 0;
     int bytesCopied = 0;
     int segmentLength;
 
@@ -1086,22 +1663,16 @@ int MicroBitFileSystem::read(int fd, uint8_t* buffer, int size)
     size = min(size, file->length - file->seek);
 
     // Find the read position.
-    block = file->dirent->first_block; 
-
-    // Walk the file table until we reach the start block
-    while (file->seek - position > MBFS_BLOCK_SIZE)
-    {
-        block = getNextFileBlock(block);
-        position += MBFS_BLOCK_SIZE;
-    }
-
-    // Once we have the correct start block, handle the byte offset.
-    offset = file->seek - position;
+    block = getSeekBlock(file, offset);
 
     // Now, start copying bytes into the requested buffer.
     writePointer = buffer;
     while (bytesCopied < size)
     {
+        // Record the block we're in, so that the next operation can resume from it.
+        file->block = block;
+        file->blockPosition = file->seek + bytesCopied - offset;
+
         // First, determine if we need to write a partial block.
         readPointer = (uint8_t *)getBlock(block) + offset;
         segmentLength = min(size - bytesCopied, MBFS_BLOCK_SIZE - offset);
@@ -1125,6 +1696,243 @@ int MicroBitFileSystem::read(int fd, uint8_t* buffer, int size)
     return bytesCopied;
 }
 
+/**
+  * Describe where the data of a file is held in FLASH, so that it can be read in place without copying.
+  *
+  * The data from the current seek position to the end of the file is described as a list of contiguous
+  * extents, in file order. A file held in consecutive blocks is described by a single extent.
+  * The seek position of the file handle is not changed.
+  *
+  * n.b. The extents are only valid until the file system is next written to, as blocks may then
+  * be recycled and erased. Background compaction is held off until then.
+  *
+  * @param fd File handle, obtained with open()
+  * @param extents array to store the extents in.
+  * @param count the number of extents that can be stored in the array.
+  * @return the number of extents stored on success, MICROBIT_NOT_SUPPORTED if the file
+  *         system is not initialised, MICROBIT_INVALID_PARAMETER if the given file handle
+  *         or array is invalid. If the array fills, the extents stored describe the start of the data only.
+  *
+  * @code
+  * MicroBitFileSystem f;
+  * FileExtent e;
+  * int fd = f.open("image.bin", MB_READ);
+  * if(f.getExtents(fd, &e, 1) == 1 && e.length == f.seek(fd, 0, MB_SEEK_END))
+  *    process(e.data, e.length);
+  * @endcode
+  */
+int MicroBitFileSystem::getExtents(int fd, FileExtent *extents, int count)
+{
+    int result;
+
+    mutex.wait();
+    result = _getExtents(fd, extents, count);
+    mutex.notify();
+
+    return result;
+}
+
+/**
+  * Implements getExtents(). The caller must hold the mutex.
+  */
+int MicroBitFileSystem::_getExtents(int fd, FileExtent *extents, int count)
+{
+    FileDescriptor *file;
+    uint16_t block;
+    uint32_t offset;
+    uint32_t remaining;
+    int extentCount = 0;
+
+    // Protect against accidental re-initialisation
+    if ((status & MBFS_STATUS_INITIALISED) == 0)
+        return MICROBIT_NOT_SUPPORTED;
+
+    // Ensure the file is open.
+    file = getFileDescriptor(fd);
+
+    if (file == NULL || extents == NULL || count <= 0)
+        return MICROBIT_INVALID_PARAMETER;
+
+    // Flush any data in the writeback cache, so that it is held in FLASH.
+    writeBack(file);
+
+    remaining = file->length - file->seek;
+
+    if (remaining == 0)
+        return 0;
+
+    block = getSeekBlock(file, offset);
+
+    while (remaining > 0)
+    {
+        const uint8_t *data = (uint8_t *)getBlock(block) + offset;
+        uint32_t segmentLength = min(remaining, MBFS_BLOCK_SIZE - offset);
+
+        if (segmentLength > 0)
+        {
+            // Start a new extent, unless this block follows on from the last one.
+            if (extentCount == 0 || extents[extentCount-1].data + extents[extentCount-1].length != data)
+            {
+                if (extentCount == count)
+                    break;
+
+                extents[extentCount].data = data;
+                extents[extentCount].length = 0;
+                extentCount++;
+            }
+
+            extents[extentCount-1].length += segmentLength;
+            remaining -= segmentLength;
+        }
+
+        if (remaining > 0)
+        {
+            block = getNextFileBlock(block);
+            offset = 0;
+        }
+    }
+
+    // Hold off compaction, which would otherwise move the data from under the extents.
+    if (extentCount > 0)
+        status |= MBFS_STATUS_EXTENTS;
+
+    return extentCount;
+}
+
+/**
+  * Reserve space for a file to grow into, as a run of consecutive blocks where space allows.
+  *
+  * Blocks are taken from those immediately following the end of the file if they are free,
+  * or from the first free run long enough elsewhere, so that data written into them can be read
+  * back in place as a single extent. If no such run exists, the space is reserved a block at a time.
+  * The length of the file is unchanged, and reserved space is released when the file is removed.
+  *
+  * @param fd File handle, obtained with open()
+  * @param size the number of bytes the file should be able to hold.
+  * @return MICROBIT_OK on success, MICROBIT_NOT_SUPPORTED if the file system is not initialised,
+  *         MICROBIT_INVALID_PARAMETER if the given file handle is invalid, or MICROBIT_NO_RESOURCES
+  *         if there is not enough free space.
+  *
+  * @code
+  * MicroBitFileSystem f;
+  * int fd = f.open("image.bin", MB_WRITE | MB_CREAT | MB_CONTIGUOUS);
+  * f.preallocate(fd, 4096);
+  * @endcode
+  */
+int MicroBitFileSystem::preallocate(int fd, uint32_t size)
+{
+    int result;
+
+    mutex.wait();
+
+    // Extents obtained by getExtents() are no longer valid, so compaction may erase the pages they describe.
+    status &= ~MBFS_STATUS_EXTENTS;
+
+    result = _preallocate(fd, size);
+    mutex.notify();
+
+    return result;
+}
+
+/**
+  * Implements preallocate(). The caller must hold the mutex.
+  */
+int MicroBitFileSystem::_preallocate(int fd, uint32_t size)
+{
+    FileDescriptor *file;
+    uint16_t lastBlock;
+    uint16_t run;
+    int blocks = 1;
+    int needed;
+
+    // Protect against accidental re-initialisation
+    if ((status & MBFS_STATUS_INITIALISED) == 0)
+        return MICROBIT_NOT_SUPPORTED;
+
+    // Ensure the file is open.
+    file = getFileDescriptor(fd);
+
+    if (file == NULL)
+        return MICROBIT_INVALID_PARAMETER;
+
+    // Determine how many blocks the file already holds, and the last of them.
+    lastBlock = file->dirent->first_block;
+    while (getNextFileBlock(lastBlock) != MBFS_EOF)
+    {
+        lastBlock = getNextFileBlock(lastBlock);
+        blocks++;
+    }
+
+    needed = (size + MBFS_BLOCK_SIZE - 1) / MBFS_BLOCK_SIZE - blocks;
+
+    if (needed <= 0)
+        return MICROBIT_OK;
+
+    // Prefer to extend the file in place, otherwise find a run of blocks elsewhere.
+    if (lastBlock + needed < fileSystemSize && !isBlockMarked(usedMap, lastBlock + 1, needed) && !isBlockMarked(deletedMap, lastBlock + 1, needed))
+        run = lastBlock + 1;
+    else
+        run = findFreeRun(needed);
+
+    if (run)
+    {
+        // Chain the run together before linking it to the file, so that the file is never left pointing at an unterminated chain.
+        for (int i = 0; i < needed - 1; i++)
+            fileTableWrite(run + i, run + i + 1);
+
+        fileTableWrite(run + needed - 1, MBFS_EOF);
+        fileTableWrite(lastBlock, run);
+
+        lastBlockAllocated = run + needed - 1;
+        return MICROBIT_OK;
+    }
+
+    // No run is long enough, so reserve what space there is a block at a time.
+    while (needed--)
+    {
+        uint16_t newBlock = getFreeBlock(lastBlock + 1);
+        if (newBlock == 0)
+            return MICROBIT_NO_RESOURCES;
+
+        fileTableWrite(newBlock, MBFS_EOF);
+        fileTableWrite(lastBlock, newBlock);
+        lastBlock = newBlock;
+    }
+
+    return MICROBIT_OK;
+}
+
+/**
+  * Determine the block holding the seek position of the given file.
+  * The file table is walked from the last block accessed, unless the seek position lies before it.
+  *
+  * @param file The file to locate the seek position of.
+  * @param offset Set to the offset of the seek position within the returned block.
+  *
+  * @return The block number of the block holding the seek position.
+  */
+uint16_t MicroBitFileSystem::getSeekBlock(FileDescriptor *file, uint32_t &offset)
+{
+    // Start from the beginning of the file if we have no better place to start.
+    if (file->block == 0 || file->seek < file->blockPosition)
+    {
+        file->block = file->dirent->first_block;
+        file->blockPosition = 0;
+    }
+
+    // Walk the file table until we reach the start block
+    while (file->seek - file->blockPosition > MBFS_BLOCK_SIZE)
+    {
+        file->block = getNextFileBlock(file->block);
+        file->blockPosition += MBFS_BLOCK_SIZE;
+    }
+
+    // Once we have the correct start block, handle the byte offset.
+    offset = file->seek - file->blockPosition;
+
+    return file->block;
+}
+
 /**
   * Flush a given file's cache back to FLASH memory.
   *
@@ -1158,28 +1966,21 @@ int MicroBitFileSystem::writeBuffer(FileDescriptor *file, uint8_t *buffer, int s
     uint8_t *writePointer;
 
     uint32_t offset;
-    uint32_t position = 0;
     int bytesCopied = 0;
     int segmentLength;
 
-    // Find the read position.
-    block = file->dirent->first_block;
-
-    // Walk the file table until we reach the start block
-    while (file->seek - position > MBFS_BLOCK_SIZE)
-    {
-        block = getNextFileBlock(block);
-        position += MBFS_BLOCK_SIZE;
-    }
-
-    // Once we have the correct start block, handle the byte offset.
-    offset = file->seek - position;
+    // Find the write position.
+    block = getSeekBlock(file, offset);
     writePointer = (uint8_t *)getBlock(block) + offset;
 
     // Now, start copying bytes from the requested buffer.
     readPointer = buffer;
     while (bytesCopied < size)
     {
+        // Record the block we're in, so that the next operation can resume from it.
+        file->block = block;
+        file->blockPosition = file->seek + bytesCopied - offset;
+
         // First, determine if we need to write a partial block.
         segmentLength = min(size - bytesCopied, MBFS_BLOCK_SIZE - offset);
 
@@ -1192,12 +1993,19 @@ int MicroBitFileSystem::writeBuffer(FileDescriptor *file, uint8_t *buffer, int s
 
         if (offset == MBFS_BLOCK_SIZE && bytesCopied < size)
         {
-            newBlock = getFreeBlock();
-            if (newBlock == 0)
-                break;
+            // Move into the next block of the file if it already has one (overwritten or preallocated),
+            // otherwise extend the file, keeping it contiguous if we've been asked to.
+            newBlock = getNextFileBlock(block);
 
-            fileTableWrite(newBlock, MBFS_EOF);
-            fileTableWrite(block, newBlock);
+            if (newBlock == MBFS_EOF)
+            {
+                newBlock = getFreeBlock((file->flags & MB_CONTIGUOUS) ? block + 1 : 0);
+                if (newBlock == 0)
+                    break;
+
+                fileTableWrite(newBlock, MBFS_EOF);
+                fileTableWrite(block, newBlock);
+            }
 
             block = newBlock;
 
@@ -1261,6 +2069,24 @@ bool MicroBitFileSystem::isValidFilename(const char *name)
   * @endcode
   */
 int MicroBitFileSystem::write(int fd, uint8_t* buffer, int size)
+{
+    int result;
+
+    mutex.wait();
+
+    // Extents obtained by getExtents() are no longer valid, so compaction may erase the pages they describe.
+    status &= ~MBFS_STATUS_EXTENTS;
+
+    result = _write(fd, buffer, size);
+    mutex.notify();
+
+    return result;
+}
+
+/**
+  * Implements write(). The caller must hold the mutex.
+  */
+int MicroBitFileSystem::_write(int fd, uint8_t* buffer, int size)
 {
     FileDescriptor *file;
     int bytesCopied = 0;
@@ -1320,7 +2146,25 @@ int MicroBitFileSystem::write(int fd, uint8_t* buffer, int size)
   */
 int MicroBitFileSystem::remove(char const * filename)
 {
-    int fd = open(filename, MB_READ);
+    int result;
+
+    mutex.wait();
+
+    // Extents obtained by getExtents() are no longer valid, so compaction may erase the pages they describe.
+    status &= ~MBFS_STATUS_EXTENTS;
+
+    result = _remove(filename);
+    mutex.notify();
+
+    return result;
+}
+
+/**
+  * Implements remove(). The caller must hold the mutex.
+  */
+int MicroBitFileSystem::_remove(char const * filename)
+{
+    int fd = _open(filename, MB_READ);
     uint16_t block, nextBlock;
     uint16_t value;
 
@@ -1343,6 +2187,7 @@ int MicroBitFileSystem::remove(char const * filename)
     // Mark the directory entry of this file as invalid.
     value = MBFS_DIRECTORY_ENTRY_DELETED;
     flash.flash_write(&file->dirent->flags, &value, 2);
+    invalidateDirectoryIndex();
 
     // release file metadata
     delete file;
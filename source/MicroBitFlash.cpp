@@ -22,6 +22,7 @@ DEALINGS IN THE SOFTWARE.
 #include "MicroBitConfig.h"
 #include "MicroBitFlash.h"
 #include "MicroBitDevice.h"
+#include "CodalFiber.h"
 #include "ErrorNo.h"                
 
 #ifdef SOFTDEVICE_PRESENT
@@ -59,6 +60,8 @@ extern "C" void btle_set_user_evt_handler(void (*func)(uint32_t));
 //#endif
 
 static volatile bool flash_op_complete = false;
+static volatile bool flash_op_failed = false;
+static volatile bool flash_op_active = false;
 
 /*
  * When SoftDevice is present,
@@ -72,10 +75,67 @@ static void nvmc_event_handler(uint32_t sys_evt, void *)
 {
     if (sys_evt == NRF_EVT_FLASH_OPERATION_SUCCESS)
         flash_op_complete = true;
+
+    if (sys_evt == NRF_EVT_FLASH_OPERATION_ERROR)
+    {
+        flash_op_failed = true;
+        flash_op_complete = true;
+    }
 }
 
 NRF_SDH_SOC_OBSERVER( microbitflash_soc_observer, 0, nvmc_event_handler, NULL);
 
+/*
+ * Determine if the caller may yield to the scheduler while waiting for the SoftDevice.
+ * This is only possible from fiber context, once the scheduler is running.
+ */
+static bool flash_can_yield()
+{
+    return fiber_scheduler_running() && __get_IPSR() == 0;
+}
+
+/*
+ * Wait for the given number of milliseconds, letting other fibers run if possible.
+ */
+static void flash_wait_ms(int ms)
+{
+    if (flash_can_yield())
+        fiber_sleep(ms);
+    else
+        system_timer_wait_ms(ms);
+}
+
+/*
+ * Have the SoftDevice erase a page (if buffer is NULL) or write the given words, and wait for the operation to complete.
+ * The operation completes asynchronously, so other fibers are scheduled while we wait. The operation is retried if the
+ * SoftDevice was unable to complete it (e.g. when the radio timeslots left insufficient time).
+ */
+static void sd_flash_operation(uint32_t *addr, uint32_t *buffer, int size)
+{
+    // Only one operation may be outstanding. Wait for any started by another fiber to complete.
+    while (flash_op_active)
+        flash_wait_ms(1);
+
+    flash_op_active = true;
+
+    do {
+        flash_op_complete = false;
+        flash_op_failed = false;
+
+        while ((buffer ? sd_flash_write(addr, buffer, size) : sd_flash_page_erase(((uint32_t)addr)/MICROBIT_CODEPAGESIZE)) != NRF_SUCCESS)
+            flash_wait_ms(10);
+
+        // Wait for SoftDevice to diable the operation when it completes...
+        while(!flash_op_complete)
+        {
+            if (flash_can_yield())
+                schedule();
+        }
+    } while (flash_op_failed);
+
+    flash_op_active = false;
+}
+
 #endif
 
 /**
@@ -117,18 +177,7 @@ void MicroBitFlash::erase_page(uint32_t* pg_addr)
 {
 #ifdef SOFTDEVICE_PRESENT
     if (ble_running())
-    {
-        flash_op_complete = false;
-        while(1)
-        {
-            if (sd_flash_page_erase(((uint32_t)pg_addr)/MICROBIT_CODEPAGESIZE) == NRF_SUCCESS)
-                break;
-
-            system_timer_wait_ms(10);
-        }
-        // Wait for SoftDevice to diable the write operation when it completes...
-        while(!flash_op_complete);
-    }
+        sd_flash_operation(pg_addr, NULL, 0);
     else
 #endif
     {
@@ -162,18 +211,7 @@ void MicroBitFlash::flash_burn(uint32_t* addr, uint32_t* buffer, int size)
     {
         // Schedule SoftDevice to write this memory for us, and wait for it to complete.
         // This happens ASYNCHRONOUSLY when SD is enabled (and synchronously if disabled!!)
-        flash_op_complete = false;
-
-        while(1)
-        {
-            if (sd_flash_write(addr, buffer, size) == NRF_SUCCESS)
-                break;
-
-            system_timer_wait_ms(10);
-        }
-
-        // Wait for SoftDevice to diable the write operation when it completes...
-        while(!flash_op_complete);
+        sd_flash_operation(addr, buffer, size);
     }
     else
 #endif
@@ -0,0 +1,280 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "MicroBitHeapStats.h"
+#include "CodalHeapAllocator.h"
+#include "ErrorNo.h"
+#include "codal_target_hal.h"
+#include <string.h>
+
+using namespace codal;
+
+#if CONFIG_ENABLED(CONFIG_MICROBIT_HEAP_STATS)
+
+#if CONFIG_ENABLED(DEVICE_HEAP_ALLOCATOR)
+
+#ifndef DEVICE_HEAP_BLOCK_FREE
+#define DEVICE_HEAP_BLOCK_FREE 0x80000000
+#endif
+
+// The heap regions maintained by the CODAL allocator.
+extern HeapDefinition heap[];
+extern uint8_t heap_count;
+
+/**
+  * Determines the heap consumed by an allocation, from the header word the CODAL allocator places before it.
+  */
+static uint32_t heap_block_size(void *ptr)
+{
+    PROCESSOR_WORD_TYPE *block = ((PROCESSOR_WORD_TYPE *) ptr) - 1;
+    return (*block & ~DEVICE_HEAP_BLOCK_FREE) * sizeof(PROCESSOR_WORD_TYPE);
+}
+
+#else
+
+#include <malloc.h>
+
+static uint32_t heap_block_size(void *ptr)
+{
+    return malloc_usable_size(ptr);
+}
+
+#endif
+
+static const char *heap_tag_names[MICROBIT_HEAP_TAG_COUNT] = { "other", "radio", "audio", "storage", "ble" };
+static MicroBitHeapTagStats heap_stats[MICROBIT_HEAP_TAG_COUNT];
+
+/**
+  * Records an allocation made on behalf of a subsystem.
+  *
+  * @param tag The subsystem that owns the allocation, one of MICROBIT_HEAP_TAG_*.
+  * @param ptr The pointer returned by the allocator, or NULL if the allocation failed.
+  */
+void codal::microbit_heap_track(int tag, void *ptr)
+{
+    if (tag < 0 || tag >= MICROBIT_HEAP_TAG_COUNT)
+        tag = MICROBIT_HEAP_TAG_OTHER;
+
+    MicroBitHeapTagStats *s = &heap_stats[tag];
+
+    target_disable_irq();
+
+    if (ptr == NULL)
+    {
+        s->failures++;
+    }
+    else
+    {
+        s->allocations++;
+        s->current += heap_block_size(ptr);
+
+        if (s->current > s->peak)
+            s->peak = s->current;
+    }
+
+    target_enable_irq();
+}
+
+/**
+  * Records the release of an allocation previously passed to microbit_heap_track().
+  *
+  * @param tag The subsystem that owns the allocation, one of MICROBIT_HEAP_TAG_*.
+  * @param ptr The pointer about to be freed. NULL is ignored.
+  */
+void codal::microbit_heap_untrack(int tag, void *ptr)
+{
+    if (ptr == NULL)
+        return;
+
+    if (tag < 0 || tag >= MICROBIT_HEAP_TAG_COUNT)
+        tag = MICROBIT_HEAP_TAG_OTHER;
+
+    MicroBitHeapTagStats *s = &heap_stats[tag];
+    uint32_t size = heap_block_size(ptr);
+
+    target_disable_irq();
+
+    s->releases++;
+    s->current = s->current > size ? s->current - size : 0;
+
+    target_enable_irq();
+}
+
+/**
+  * Retrieves the heap usage of a subsystem.
+  *
+  * @param tag The subsystem of interest, one of MICROBIT_HEAP_TAG_*.
+  *
+  * @return the statistics for the given subsystem, or NULL if tag is out of range.
+  */
+MicroBitHeapTagStats *codal::microbit_heap_get_stats(int tag)
+{
+    if (tag < 0 || tag >= MICROBIT_HEAP_TAG_COUNT)
+        return NULL;
+
+    return &heap_stats[tag];
+}
+
+/**
+  * Walks the heap to determine how much of it is free, and how fragmented that free space is.
+  *
+  * @param f The structure to populate.
+  *
+  * @return DEVICE_OK on success.
+  */
+int codal::microbit_heap_get_fragmentation(MicroBitHeapFragmentation &f)
+{
+    memset(&f, 0, sizeof(f));
+
+#if CONFIG_ENABLED(DEVICE_HEAP_ALLOCATOR)
+    // Hold off interrupts, so that the heap is not modified beneath us.
+    target_disable_irq();
+
+    for (int i = 0; i < heap_count; i++)
+    {
+        PROCESSOR_WORD_TYPE *block = heap[i].heap_start;
+
+        f.total += (heap[i].heap_end - heap[i].heap_start) * sizeof(PROCESSOR_WORD_TYPE);
+
+        // Adjacent free blocks are only merged by the allocator on demand, so treat a run of them as one region.
+        uint32_t run = 0;
+
+        while (block < heap[i].heap_end)
+        {
+            PROCESSOR_WORD_TYPE words = *block & ~DEVICE_HEAP_BLOCK_FREE;
+
+            if (words == 0)
+                break;
+
+            if (*block & DEVICE_HEAP_BLOCK_FREE)
+            {
+                if (run == 0)
+                    f.freeBlocks++;
+
+                run += words * sizeof(PROCESSOR_WORD_TYPE);
+                f.free += words * sizeof(PROCESSOR_WORD_TYPE);
+            }
+            else
+            {
+                run = 0;
+            }
+
+            // The usable size of a region excludes the single header word of the block that would be created in it.
+            if (run > f.largest + sizeof(PROCESSOR_WORD_TYPE))
+                f.largest = run - sizeof(PROCESSOR_WORD_TYPE);
+
+            block += words;
+        }
+    }
+
+    target_enable_irq();
+#else
+    struct mallinfo m = mallinfo();
+
+    f.total = m.arena;
+    f.free = m.fordblks;
+    f.largest = m.fordblks;
+    f.freeBlocks = m.ordblks;
+#endif
+
+    f.fragmentation = f.free ? 100 - (int)(((uint64_t)f.largest * 100) / f.free) : 0;
+
+    return DEVICE_OK;
+}
+
+/**
+  * Resets the peak usage of each subsystem to its current usage, and clears the allocation counts.
+  */
+void codal::microbit_heap_reset_stats()
+{
+    target_disable_irq();
+
+    for (int i = 0; i < MICROBIT_HEAP_TAG_COUNT; i++)
+    {
+        heap_stats[i].peak = heap_stats[i].current;
+        heap_stats[i].allocations = 0;
+        heap_stats[i].releases = 0;
+        heap_stats[i].failures = 0;
+    }
+
+    target_enable_irq();
+}
+
+/**
+  * Writes the heap usage of each subsystem, followed by the fragmentation of the heap, to the given serial port.
+  *
+  * @param serial The serial port to write to, typically uBit.serial.
+  *
+  * @return DEVICE_OK on success.
+  */
+int codal::microbit_heap_print(Serial &serial)
+{
+    MicroBitHeapFragmentation f;
+
+    for (int i = 0; i < MICROBIT_HEAP_TAG_COUNT; i++)
+    {
+        MicroBitHeapTagStats s = heap_stats[i];
+
+        serial.printf("HEAP tag=%s current=%d peak=%d allocations=%d releases=%d failures=%d\r\n", heap_tag_names[i],
+            (int)s.current, (int)s.peak, (int)s.allocations, (int)s.releases, (int)s.failures);
+    }
+
+    microbit_heap_get_fragmentation(f);
+
+    serial.printf("HEAP total=%d free=%d largest=%d free_blocks=%d fragmentation_pct=%d\r\n",
+        (int)f.total, (int)f.free, (int)f.largest, (int)f.freeBlocks, f.fragmentation);
+
+    return DEVICE_OK;
+}
+
+#else
+
+void codal::microbit_heap_track(int, void *)
+{
+}
+
+void codal::microbit_heap_untrack(int, void *)
+{
+}
+
+MicroBitHeapTagStats *codal::microbit_heap_get_stats(int)
+{
+    return NULL;
+}
+
+int codal::microbit_heap_get_fragmentation(MicroBitHeapFragmentation &)
+{
+    return DEVICE_NOT_SUPPORTED;
+}
+
+void codal::microbit_heap_reset_stats()
+{
+}
+
+int codal::microbit_heap_print(Serial &)
+{
+    return DEVICE_NOT_SUPPORTED;
+}
+
+#endif
@@ -0,0 +1,180 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "MicroBitIrqDispatcher.h"
+#include "EventModel.h"
+#include "CodalDmesg.h"
+#include "ErrorNo.h"
+
+using namespace codal;
+
+/**
+ * Constructor.
+ *
+ * @param irq The active low interrupt line to arbitrate.
+ * @param id The ID of this component.
+ */
+MicroBitIrqDispatcher::MicroBitIrqDispatcher(Pin &irq, uint16_t id) : irq(irq)
+{
+    this->id = id;
+    this->sourceCount = 0;
+    resetStats();
+}
+
+/**
+ * Destructor.
+ */
+MicroBitIrqDispatcher::~MicroBitIrqDispatcher()
+{
+    if (status & MICROBIT_IRQ_DISPATCHER_STATUS_RUNNING)
+        EventModel::defaultEventBus->ignore(irq.id, DEVICE_PIN_EVT_FALL, this, &MicroBitIrqDispatcher::onIrq);
+}
+
+/**
+ * Adds a source to the end of the list checked on each interrupt.
+ *
+ * @param handler The function that checks and services the source.
+ * @param context Passed to the handler.
+ * @return The index of the source on success, DEVICE_INVALID_PARAMETER if handler is NULL,
+ * or DEVICE_NO_RESOURCES if CONFIG_MICROBIT_IRQ_DISPATCHER_SOURCES have already been added.
+ */
+int MicroBitIrqDispatcher::addSource(MicroBitIrqHandler handler, void *context)
+{
+    if (handler == NULL)
+        return DEVICE_INVALID_PARAMETER;
+
+    if (sourceCount >= CONFIG_MICROBIT_IRQ_DISPATCHER_SOURCES)
+        return DEVICE_NO_RESOURCES;
+
+    sources[sourceCount].handler = handler;
+    sources[sourceCount].context = context;
+    sources[sourceCount].count = 0;
+
+    return sourceCount++;
+}
+
+/**
+ * Enables edge events on the interrupt line, and services any interrupt already pending.
+ *
+ * Other users of the line only read its level, which remains available with edge events enabled. The power manager
+ * re-enables edge events after using the line to wake from deep sleep.
+ *
+ * @return DEVICE_OK on success.
+ */
+int MicroBitIrqDispatcher::start()
+{
+    if (!(status & MICROBIT_IRQ_DISPATCHER_STATUS_RUNNING))
+        EventModel::defaultEventBus->listen(irq.id, DEVICE_PIN_EVT_FALL, this, &MicroBitIrqDispatcher::onIrq);
+
+    status |= MICROBIT_IRQ_DISPATCHER_STATUS_RUNNING;
+    irq.eventOn(DEVICE_PIN_EVENT_ON_EDGE);
+
+    // The line may have been asserted before edge events were enabled. There will be no further edge.
+    if (irq.isActive())
+        Event(irq.id, DEVICE_PIN_EVT_FALL);
+
+    return DEVICE_OK;
+}
+
+/**
+ * Event handler, called when the interrupt line is asserted.
+ * Services sources until the line is released, or no source claims it.
+ */
+void MicroBitIrqDispatcher::onIrq(Event)
+{
+    edges++;
+
+    for (int pass = 0; pass < CONFIG_MICROBIT_IRQ_DISPATCHER_MAX_PASSES && irq.isActive(); pass++)
+    {
+        int result = MICROBIT_IRQ_NONE;
+
+        for (int i = 0; i < sourceCount && result == MICROBIT_IRQ_NONE; i++)
+        {
+            result = sources[i].handler(sources[i].context);
+
+            if (result != MICROBIT_IRQ_NONE)
+                sources[i].count++;
+        }
+
+        if (result == MICROBIT_IRQ_NONE)
+            spurious++;
+
+        // Nothing more can be done until the source responsible releases the line.
+        if (result != MICROBIT_IRQ_HANDLED)
+            break;
+    }
+}
+
+/**
+ * Determines the number of interrupts attributed to the given source.
+ *
+ * @param source The index returned when the source was added.
+ * @return The number of interrupts, or 0 if source is out of range.
+ */
+uint32_t MicroBitIrqDispatcher::getCount(int source)
+{
+    if (source < 0 || source >= sourceCount)
+        return 0;
+
+    return sources[source].count;
+}
+
+/**
+ * Determines the number of interrupts no source claimed.
+ */
+uint32_t MicroBitIrqDispatcher::getSpuriousCount()
+{
+    return spurious;
+}
+
+/**
+ * Determines the number of falling edges seen on the interrupt line.
+ */
+uint32_t MicroBitIrqDispatcher::getEdgeCount()
+{
+    return edges;
+}
+
+/**
+ * Clears all attribution statistics.
+ */
+void MicroBitIrqDispatcher::resetStats()
+{
+    edges = 0;
+    spurious = 0;
+
+    for (int i = 0; i < sourceCount; i++)
+        sources[i].count = 0;
+}
+
+/**
+ * Writes the attribution statistics to DMESG.
+ */
+void MicroBitIrqDispatcher::printStats()
+{
+    DMESG("IRQ: edges %d spurious %d", (int) edges, (int) spurious);
+
+    for (int i = 0; i < sourceCount; i++)
+        DMESG("IRQ: source %d count %d", i, (int) sources[i].count);
+}
@@ -0,0 +1,222 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "MicroBitIrqPriority.h"
+#include "MicroBitDevice.h"
+#include "ErrorNo.h"
+
+using namespace codal;
+
+struct MicroBitIrqPriorityMap
+{
+    IRQn_Type           irq;
+    uint8_t             priority[MICROBIT_IRQ_PROFILE_COUNT];
+};
+
+struct MicroBitIrqPriorityOverride
+{
+    IRQn_Type           irq;
+    uint8_t             priority;
+    bool                used;                       // True if this entry holds an override.
+};
+
+// Note that low values have highest priority, and only 2, 3, 4, 5 and 7 are available with SoftDevice enabled.
+static const MicroBitIrqPriorityMap irq_priority_map[] = {
+    //                                  DEFAULT RADIO   AUDIO   LOGGER
+    { TIMER1_IRQn,                      { 7,      7,      7,      7 } },     // System timer (general purpose)
+    { TIMER2_IRQn,                      { 5,      5,      5,      2 } },     // ADC timer.
+    { TIMER3_IRQn,                      { 3,      4,      5,      5 } },     // Cap touch.
+    { TIMER4_IRQn,                      { 3,      4,      5,      5 } },     // Display and Light Sensing.
+    { SAADC_IRQn,                       { 5,      5,      3,      2 } },     // Analogue to Digital Converter (microphone etc)
+    { PWM0_IRQn,                        { 5,      5,      5,      5 } },     // General Purpose PWM on edge connector (servo, square wave sounds)
+    { PWM1_IRQn,                        { 4,      5,      2,      5 } },     // PCM audio on speaker (high definition sound)
+    { PWM2_IRQn,                        { 3,      3,      3,      3 } },     // Waveform Generation (neopixel)
+    { SWI4_EGU4_IRQn,                   { 3,      3,      3,      3 } },     // MicroBitNeoPixel sequence refill
+    { RADIO_IRQn,                       { 4,      2,      5,      5 } },     // Packet radio
+    { UARTE0_UART0_IRQn,                { 2,      3,      3,      3 } },     // Serial port
+    { GPIOTE_IRQn,                      { 2,      3,      3,      3 } },     // Pin interrupt events
+};
+
+// Interrupts owned by the SoftDevice whilst it is enabled. Their priorities are set by the SoftDevice, and must not be changed.
+static const IRQn_Type irq_softdevice_reserved[] = {
+    POWER_CLOCK_IRQn, RADIO_IRQn, TIMER0_IRQn, RTC0_IRQn, TEMP_IRQn, RNG_IRQn, ECB_IRQn, CCM_AAR_IRQn, SWI5_EGU5_IRQn, MWU_IRQn
+};
+
+static int irq_profile = MICROBIT_IRQ_PRIORITY_PROFILE;
+static MicroBitIrqPriorityOverride irq_overrides[MICROBIT_IRQ_PRIORITY_OVERRIDES];
+
+/**
+  * Finds the override recorded for an interrupt.
+  *
+  * @param irq The interrupt to look up.
+  * @param allocate If true, allocate an unused entry if there is no override for irq.
+  *
+  * @return The entry, or NULL if none was found (or none is free).
+  */
+static MicroBitIrqPriorityOverride *microbit_irq_find_override(IRQn_Type irq, bool allocate)
+{
+    MicroBitIrqPriorityOverride *unused = NULL;
+
+    for (int i = 0; i < MICROBIT_IRQ_PRIORITY_OVERRIDES; i++)
+    {
+        if (!irq_overrides[i].used)
+        {
+            if (unused == NULL)
+                unused = &irq_overrides[i];
+        }
+        else if (irq_overrides[i].irq == irq)
+        {
+            return &irq_overrides[i];
+        }
+    }
+
+    return allocate ? unused : NULL;
+}
+
+/**
+  * Determines if the priority of an interrupt is currently controlled by the SoftDevice.
+  *
+  * @param irq The interrupt to test.
+  *
+  * @return true if the Bluetooth stack is running and owns irq, false otherwise.
+  */
+static bool microbit_irq_is_reserved(IRQn_Type irq)
+{
+    if (!ble_running())
+        return false;
+
+    for (IRQn_Type r : irq_softdevice_reserved)
+        if (r == irq)
+            return true;
+
+    return false;
+}
+
+/**
+  * Selects the priority profile, and applies it to every peripheral interrupt used by the runtime.
+  * Priorities set with microbit_irq_set_priority() take precedence over the profile.
+  *
+  * May be called before MicroBit::init(), which applies the profile most recently selected.
+  *
+  * @param profile One of MICROBIT_IRQ_PROFILE_*.
+  *
+  * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the profile is unknown.
+  */
+int codal::microbit_irq_set_profile(int profile)
+{
+    if (profile < 0 || profile >= MICROBIT_IRQ_PROFILE_COUNT)
+        return DEVICE_INVALID_PARAMETER;
+
+    irq_profile = profile;
+    microbit_irq_apply();
+
+    return DEVICE_OK;
+}
+
+/**
+  * Determines the priority profile in use.
+  *
+  * @return One of MICROBIT_IRQ_PROFILE_*.
+  */
+int codal::microbit_irq_get_profile()
+{
+    return irq_profile;
+}
+
+/**
+  * Sets the priority of a single interrupt, overriding the profile. The override persists across
+  * later calls to microbit_irq_set_profile(), until cleared with microbit_irq_clear_priority().
+  *
+  * May be called before MicroBit::init(), which applies any overrides along with the profile.
+  *
+  * @param irq The interrupt to configure.
+  * @param priority The priority, where lower values preempt higher ones. With Bluetooth enabled, priorities 0 and 1
+  * are reserved for the SoftDevice.
+  *
+  * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the priority is out of range or reserved, DEVICE_NOT_SUPPORTED
+  * if the interrupt is owned by the running Bluetooth stack, or DEVICE_NO_RESOURCES if there is no room to record the override.
+  */
+int codal::microbit_irq_set_priority(IRQn_Type irq, int priority)
+{
+    if (irq < 0 || priority < 0 || priority >= (1 << __NVIC_PRIO_BITS))
+        return DEVICE_INVALID_PARAMETER;
+
+    if (microbit_irq_is_reserved(irq))
+        return DEVICE_NOT_SUPPORTED;
+
+#if CONFIG_ENABLED(DEVICE_BLE)
+    if (priority < 2)
+        return DEVICE_INVALID_PARAMETER;
+#endif
+
+    MicroBitIrqPriorityOverride *o = microbit_irq_find_override(irq, true);
+
+    if (o == NULL)
+        return DEVICE_NO_RESOURCES;
+
+    o->irq = irq;
+    o->priority = priority;
+    o->used = true;
+    NVIC_SetPriority(irq, priority);
+
+    return DEVICE_OK;
+}
+
+/**
+  * Removes any override of the priority of an interrupt, restoring the priority given by the profile in use.
+  *
+  * @param irq The interrupt to restore.
+  *
+  * @return DEVICE_OK.
+  */
+int codal::microbit_irq_clear_priority(IRQn_Type irq)
+{
+    MicroBitIrqPriorityOverride *o = microbit_irq_find_override(irq, false);
+
+    if (o)
+    {
+        o->used = false;
+
+        for (const MicroBitIrqPriorityMap &m : irq_priority_map)
+            if (m.irq == irq && !microbit_irq_is_reserved(irq))
+                NVIC_SetPriority(irq, m.priority[irq_profile]);
+    }
+
+    return DEVICE_OK;
+}
+
+/**
+  * Applies the selected profile and any overrides to the NVIC. Called by MicroBit::init().
+  * Interrupts owned by the Bluetooth stack are left alone whilst it is running.
+  */
+void codal::microbit_irq_apply()
+{
+    for (const MicroBitIrqPriorityMap &m : irq_priority_map)
+        if (!microbit_irq_is_reserved(m.irq))
+            NVIC_SetPriority(m.irq, m.priority[irq_profile]);
+
+    for (int i = 0; i < MICROBIT_IRQ_PRIORITY_OVERRIDES; i++)
+        if (irq_overrides[i].used && !microbit_irq_is_reserved(irq_overrides[i].irq))
+            NVIC_SetPriority(irq_overrides[i].irq, irq_overrides[i].priority);
+}
@@ -0,0 +1,794 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "MicroBitKeyValueLog.h"
+#include "ErrorNo.h"
+#include <stdlib.h>
+#include <string.h>
+
+using namespace codal;
+
+/**
+ * Compute the checksum of a record, over its lengths, key and value.
+ */
+static uint16_t keyValueLogChecksum(const uint32_t *buffer)
+{
+    const KeyValueLogRecord *r = (const KeyValueLogRecord *)buffer;
+    const uint8_t *key = (const uint8_t *)(buffer + 1);
+    const uint8_t *value = key + ((r->keyLength + 3) & ~3);
+    int valueLength = r->valueLength == MICROBIT_KEY_VALUE_LOG_REMOVED ? 0 : r->valueLength;
+    uint16_t check = 0x1D0F;
+
+    check = ((check << 5) | (check >> 11)) ^ r->keyLength;
+    check = ((check << 5) | (check >> 11)) ^ r->valueLength;
+
+    for (int i = 0; i < r->keyLength; i++)
+        check = ((check << 5) | (check >> 11)) ^ key[i];
+
+    for (int i = 0; i < valueLength; i++)
+        check = ((check << 5) | (check >> 11)) ^ value[i];
+
+    return check;
+}
+
+/**
+ * Constructor.
+ *
+ * @param controller The flash to hold the log. Every page it provides is used, up to the given number of pages.
+ * @param pages The number of pages to spread the log across. Defaults to CONFIG_MICROBIT_KEY_VALUE_LOG_PAGES.
+ */
+MicroBitKeyValueLog::MicroBitKeyValueLog(NVMController &controller, int pages) : controller(controller)
+{
+    this->pageSize = controller.getPageSize();
+    this->pages = pages;
+
+    // Use no more pages than the controller provides, and no more than the index can address.
+    if (this->pages > (int)(controller.getFlashSize() / pageSize))
+        this->pages = controller.getFlashSize() / pageSize;
+
+    while (this->pages > 0 && (this->pages * pageSize) / 4 >= MICROBIT_KEY_VALUE_LOG_SLOT_REMOVED)
+        this->pages--;
+
+    this->sequence = (uint32_t *) malloc(this->pages * sizeof(uint32_t));
+    this->nextSequence = 1;
+    this->active = -1;
+    this->writePosition = 0;
+    this->count = 0;
+    this->removed = 0;
+    this->status = 0;
+}
+
+/**
+ * Destructor.
+ */
+MicroBitKeyValueLog::~MicroBitKeyValueLog()
+{
+    free(sequence);
+}
+
+/**
+ * Rebuild the index and page state from the log, erasing any page that does not hold a valid log.
+ * This is done the first time the store is used.
+ */
+void MicroBitKeyValueLog::load()
+{
+    uint32_t buffer[MICROBIT_KEY_VALUE_LOG_RECORD_WORDS];
+    uint32_t last = 0;
+
+    memset(index, 0xFF, sizeof(index));
+    count = 0;
+    removed = 0;
+    active = -1;
+    nextSequence = 1;
+
+    for (int p = 0; p < pages; p++)
+    {
+        uint32_t base = p * pageSize;
+        bool erased = true;
+
+        controller.read(buffer, base, 2);
+        sequence[p] = 0;
+
+        if (buffer[0] == MICROBIT_KEY_VALUE_LOG_MAGIC && buffer[1] != 0 && buffer[1] != 0xFFFFFFFF)
+        {
+            sequence[p] = buffer[1];
+
+            if (buffer[1] >= nextSequence)
+                nextSequence = buffer[1] + 1;
+
+            continue;
+        }
+
+        // Anything other than a fully erased page is left over from an interrupted operation, or something else entirely.
+        for (uint32_t a = base; erased && a < base + pageSize; a += sizeof(buffer))
+        {
+            uint32_t words = min((int)(sizeof(buffer) / 4), (int)((base + pageSize - a) / 4));
+            controller.read(buffer, a, words);
+
+            for (uint32_t i = 0; i < words; i++)
+                if (buffer[i] != 0xFFFFFFFF)
+                    erased = false;
+        }
+
+        if (!erased)
+            controller.erase(base);
+    }
+
+    // Replay the pages in the order they were written, such that later records take precedence.
+    while (true)
+    {
+        int next = -1;
+
+        for (int p = 0; p < pages; p++)
+            if (sequence[p] > last && (next < 0 || sequence[p] < sequence[next]))
+                next = p;
+
+        if (next < 0)
+            break;
+
+        active = next;
+        writePosition = replay(next);
+        last = sequence[next];
+    }
+
+    status |= MICROBIT_KEY_VALUE_LOG_STATUS_LOADED;
+}
+
+/**
+ * Replay the records of the given page into the index, and determine the end of those records.
+ *
+ * @param page The page to replay.
+ *
+ * @return The address at which the next record may be written in the page.
+ */
+uint32_t MicroBitKeyValueLog::replay(int page)
+{
+    uint32_t buffer[MICROBIT_KEY_VALUE_LOG_RECORD_WORDS];
+    uint32_t limit = (page + 1) * pageSize;
+    uint32_t address = page * pageSize + 8;
+    uint32_t size;
+
+    while ((size = readRecord(address, limit, buffer)) > 0)
+    {
+        KeyValueLogRecord *r = (KeyValueLogRecord *)buffer;
+
+        // Skip any record that was not completely written.
+        if (r->check == keyValueLogChecksum(buffer))
+            updateIndex(address, (char *)(buffer + 1), r->keyLength, r->valueLength == MICROBIT_KEY_VALUE_LOG_REMOVED);
+
+        address += size;
+    }
+
+    // If the records end in anything other than erased flash, nothing more can be written to this page.
+    if (address + 4 <= limit)
+    {
+        controller.read(buffer, address, 1);
+
+        if (buffer[0] != 0xFFFFFFFF)
+            return limit;
+    }
+
+    return address;
+}
+
+/**
+ * Read the record at the given address.
+ *
+ * @param address The address of the record.
+ * @param limit The end of the page holding the record.
+ * @param buffer Set to the record. Must hold MICROBIT_KEY_VALUE_LOG_RECORD_WORDS words.
+ *
+ * @return The size of the record in bytes, or zero if there is no further record in the page.
+ */
+uint32_t MicroBitKeyValueLog::readRecord(uint32_t address, uint32_t limit, uint32_t *buffer)
+{
+    KeyValueLogRecord *r = (KeyValueLogRecord *)buffer;
+
+    if (address + 4 > limit)
+        return 0;
+
+    controller.read(buffer, address, 1);
+
+    if (r->keyLength == 0 || r->keyLength >= KEY_VALUE_MAX_KEY_LEN)
+        return 0;
+
+    if (r->valueLength > KEY_VALUE_MAX_VALUE_LEN && r->valueLength != MICROBIT_KEY_VALUE_LOG_REMOVED)
+        return 0;
+
+    int valueLength = r->valueLength == MICROBIT_KEY_VALUE_LOG_REMOVED ? 0 : r->valueLength;
+    uint32_t words = 1 + (r->keyLength + 3) / 4 + (valueLength + 3) / 4;
+
+    if (address + words * 4 > limit)
+        return 0;
+
+    controller.read(buffer + 1, address + 4, words - 1);
+
+    return words * 4;
+}
+
+/**
+ * Find the index slot for the given key.
+ *
+ * @param key The key to look up.
+ * @param length The length of the key.
+ * @param empty If not NULL, set to the first slot the key could be inserted at, if it is not present.
+ *
+ * @return The index of the slot holding the key, or -1 if it is not present.
+ */
+int MicroBitKeyValueLog::find(const char *key, int length, int *empty)
+{
+    uint32_t buffer[MICROBIT_KEY_VALUE_LOG_RECORD_WORDS];
+    KeyValueLogRecord *r = (KeyValueLogRecord *)buffer;
+    uint32_t hash = 2166136261UL;
+
+    for (int i = 0; i < length; i++)
+        hash = (hash ^ (uint8_t)key[i]) * 16777619UL;
+
+    if (empty)
+        *empty = -1;
+
+    for (int i = 0; i < CONFIG_MICROBIT_KEY_VALUE_LOG_INDEX_SIZE; i++)
+    {
+        int slot = (hash + i) & (CONFIG_MICROBIT_KEY_VALUE_LOG_INDEX_SIZE - 1);
+        uint16_t v = index[slot];
+
+        if (v == MICROBIT_KEY_VALUE_LOG_SLOT_EMPTY || v == MICROBIT_KEY_VALUE_LOG_SLOT_REMOVED)
+        {
+            if (empty && *empty < 0)
+                *empty = slot;
+
+            if (v == MICROBIT_KEY_VALUE_LOG_SLOT_EMPTY)
+                return -1;
+
+            continue;
+        }
+
+        readRecord(v * 4, pages * pageSize, buffer);
+
+        if (r->keyLength == length && memcmp(buffer + 1, key, length) == 0)
+            return slot;
+    }
+
+    return -1;
+}
+
+/**
+ * Record the record at the given address as the latest for its key, or remove its key.
+ *
+ * @param address The address of the record.
+ * @param key The key of the record.
+ * @param length The length of the key.
+ * @param remove true if the record removes its key.
+ *
+ * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if the index is full.
+ */
+int MicroBitKeyValueLog::updateIndex(uint32_t address, const char *key, int length, bool remove)
+{
+    int empty;
+    int slot = find(key, length, &empty);
+
+    if (slot >= 0)
+    {
+        if (remove)
+        {
+            index[slot] = MICROBIT_KEY_VALUE_LOG_SLOT_REMOVED;
+            removed++;
+            count--;
+        }
+        else
+        {
+            index[slot] = address / 4;
+        }
+
+        return DEVICE_OK;
+    }
+
+    if (remove)
+        return DEVICE_OK;
+
+    if (count >= CONFIG_MICROBIT_KEY_VALUE_LOG_INDEX_SIZE / 2)
+        return DEVICE_NO_RESOURCES;
+
+    // Keep probe sequences short, by discarding the slots of removed keys once they build up.
+    if (removed > CONFIG_MICROBIT_KEY_VALUE_LOG_INDEX_SIZE / 4)
+    {
+        rehash();
+        find(key, length, &empty);
+    }
+
+    if (index[empty] == MICROBIT_KEY_VALUE_LOG_SLOT_REMOVED)
+        removed--;
+
+    index[empty] = address / 4;
+    count++;
+
+    return DEVICE_OK;
+}
+
+/**
+ * Rebuild the index in place, discarding the slots of removed keys.
+ */
+void MicroBitKeyValueLog::rehash()
+{
+    uint32_t buffer[MICROBIT_KEY_VALUE_LOG_RECORD_WORDS];
+    KeyValueLogRecord *r = (KeyValueLogRecord *)buffer;
+    uint16_t old[CONFIG_MICROBIT_KEY_VALUE_LOG_INDEX_SIZE];
+
+    memcpy(old, index, sizeof(index));
+    memset(index, 0xFF, sizeof(index));
+    removed = 0;
+
+    for (int i = 0; i < CONFIG_MICROBIT_KEY_VALUE_LOG_INDEX_SIZE; i++)
+    {
+        int empty;
+
+        if (old[i] == MICROBIT_KEY_VALUE_LOG_SLOT_EMPTY || old[i] == MICROBIT_KEY_VALUE_LOG_SLOT_REMOVED)
+            continue;
+
+        readRecord(old[i] * 4, pages * pageSize, buffer);
+        find((char *)(buffer + 1), r->keyLength, &empty);
+        index[empty] = old[i];
+    }
+}
+
+/**
+ * Determine the number of free pages.
+ */
+int MicroBitKeyValueLog::freePages()
+{
+    int free = 0;
+
+    for (int p = 0; p < pages; p++)
+        if (sequence[p] == 0)
+            free++;
+
+    return free;
+}
+
+/**
+ * Determine the page in use with the lowest sequence number.
+ *
+ * @return The oldest page, or -1 if no page is in use.
+ */
+int MicroBitKeyValueLog::oldestPage()
+{
+    int oldest = -1;
+
+    for (int p = 0; p < pages; p++)
+        if (sequence[p] && (oldest < 0 || sequence[p] < sequence[oldest]))
+            oldest = p;
+
+    return oldest;
+}
+
+/**
+ * Take a free page into use as the active page.
+ *
+ * @param reserve The number of free pages that must remain afterwards.
+ *
+ * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if not enough pages are free.
+ */
+int MicroBitKeyValueLog::activate(int reserve)
+{
+    if (freePages() <= reserve)
+        return DEVICE_NO_RESOURCES;
+
+    // Take pages in turn, to spread the wear across them.
+    for (int i = 1; i <= pages; i++)
+    {
+        int p = (active + i + pages) % pages;
+
+        if (sequence[p] == 0)
+        {
+            uint32_t header[2] = { MICROBIT_KEY_VALUE_LOG_MAGIC, nextSequence };
+
+            controller.write(p * pageSize, header, 2);
+            sequence[p] = nextSequence++;
+            active = p;
+            writePosition = p * pageSize + sizeof(header);
+
+            return DEVICE_OK;
+        }
+    }
+
+    return DEVICE_NO_RESOURCES;
+}
+
+/**
+ * Append a record to the log, taking a new page into use or compacting the log if the active page is full.
+ *
+ * @param key The key of the record.
+ * @param length The length of the key.
+ * @param data The value of the record.
+ * @param dataSize The length of the value, or MICROBIT_KEY_VALUE_LOG_REMOVED.
+ * @param reserve The number of free pages that must remain after a new page is taken into use.
+ *
+ * @return The address of the record on success, or zero if the log is full.
+ */
+uint32_t MicroBitKeyValueLog::append(const char *key, int length, const uint8_t *data, int dataSize, int reserve)
+{
+    uint32_t buffer[MICROBIT_KEY_VALUE_LOG_RECORD_WORDS];
+    KeyValueLogRecord *r = (KeyValueLogRecord *)buffer;
+    int keyWords = (length + 3) / 4;
+    int valueLength = dataSize == MICROBIT_KEY_VALUE_LOG_REMOVED ? 0 : dataSize;
+    uint32_t size = (1 + keyWords + (valueLength + 3) / 4) * 4;
+
+    memset(buffer, 0, sizeof(buffer));
+    r->keyLength = length;
+    r->valueLength = dataSize;
+    memcpy(buffer + 1, key, length);
+    if (valueLength)
+        memcpy(buffer + 1 + keyWords, data, valueLength);
+
+    r->check = keyValueLogChecksum(buffer);
+
+    for (int attempt = 0; ; attempt++)
+    {
+        if (active >= 0 && writePosition + size <= (active + 1) * pageSize)
+        {
+            uint32_t address = writePosition;
+
+            controller.write(address, buffer, size / 4);
+            writePosition += size;
+
+            return address;
+        }
+
+        if (activate(reserve) == DEVICE_OK)
+            continue;
+
+        // Out of pages. Reclaim the oldest, unless we're already doing so.
+        if (reserve == 0 || attempt > pages || reclaim() != DEVICE_OK)
+            return 0;
+    }
+}
+
+/**
+ * Copy the live records of the oldest page forward, and erase it. The caller must hold the mutex.
+ *
+ * @return DEVICE_OK if a page was reclaimed, DEVICE_NO_DATA if no page needs reclaiming, or
+ *         DEVICE_NO_RESOURCES if there is no room to copy the live records of the oldest page.
+ */
+int MicroBitKeyValueLog::reclaim()
+{
+    uint32_t buffer[MICROBIT_KEY_VALUE_LOG_RECORD_WORDS];
+    KeyValueLogRecord *r = (KeyValueLogRecord *)buffer;
+    int oldest = oldestPage();
+
+    if (oldest < 0 || freePages() > 1)
+        return DEVICE_NO_DATA;
+
+    // Never copy records into the page being reclaimed.
+    if (oldest == active && activate(0) != DEVICE_OK)
+        return DEVICE_NO_RESOURCES;
+
+    uint32_t limit = (oldest + 1) * pageSize;
+    uint32_t address = oldest * pageSize + 8;
+    uint32_t size;
+
+    // Copy forward each record that is still the latest for its key. Removals are dropped, as there is no older page
+    // left holding a value for them to hide.
+    while ((size = readRecord(address, limit, buffer)) > 0)
+    {
+        int slot = -1;
+
+        if (r->valueLength != MICROBIT_KEY_VALUE_LOG_REMOVED && r->check == keyValueLogChecksum(buffer))
+            slot = find((char *)(buffer + 1), r->keyLength);
+
+        if (slot >= 0 && index[slot] == address / 4)
+        {
+            uint32_t copy = append((char *)(buffer + 1), r->keyLength, (uint8_t *)(buffer + 1 + (r->keyLength + 3) / 4), r->valueLength, 0);
+
+            if (copy == 0)
+                return DEVICE_NO_RESOURCES;
+
+            index[slot] = copy / 4;
+        }
+
+        address += size;
+    }
+
+    controller.erase(oldest * pageSize);
+    sequence[oldest] = 0;
+
+    return DEVICE_OK;
+}
+
+/**
+ * Store the given value against the given key, replacing any value it already has.
+ * Nothing is written if the value is unchanged.
+ *
+ * @param key A NULL terminated string of up to KEY_VALUE_MAX_KEY_LEN - 1 characters.
+ * @param data The value to store.
+ * @param dataSize The size of the value, of up to KEY_VALUE_MAX_VALUE_LEN bytes.
+ *
+ * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the key or value is too large, or
+ *         DEVICE_NO_RESOURCES if the index or log is full.
+ */
+int MicroBitKeyValueLog::put(const char *key, uint8_t *data, int dataSize)
+{
+    uint32_t buffer[MICROBIT_KEY_VALUE_LOG_RECORD_WORDS];
+    KeyValueLogRecord *r = (KeyValueLogRecord *)buffer;
+    int length = key ? strlen(key) : 0;
+    int result = DEVICE_OK;
+
+    if (length == 0 || length >= KEY_VALUE_MAX_KEY_LEN || dataSize < 0 || dataSize > KEY_VALUE_MAX_VALUE_LEN || (data == NULL && dataSize > 0))
+        return DEVICE_INVALID_PARAMETER;
+
+    mutex.wait();
+
+    if (!(status & MICROBIT_KEY_VALUE_LOG_STATUS_LOADED))
+        load();
+
+    int slot = find(key, length);
+
+    if (slot >= 0)
+    {
+        readRecord(index[slot] * 4, pages * pageSize, buffer);
+
+        // Spare the flash if the value is unchanged.
+        if (r->valueLength == dataSize && memcmp(buffer + 1 + (length + 3) / 4, data, dataSize) == 0)
+        {
+            mutex.notify();
+            return DEVICE_OK;
+        }
+    }
+    else if (count >= CONFIG_MICROBIT_KEY_VALUE_LOG_INDEX_SIZE / 2)
+    {
+        mutex.notify();
+        return DEVICE_NO_RESOURCES;
+    }
+
+    uint32_t address = append(key, length, data, dataSize);
+
+    if (address)
+        updateIndex(address, key, length, false);
+    else
+        result = DEVICE_NO_RESOURCES;
+
+    if (freePages() <= 1)
+        startCompaction();
+
+    mutex.notify();
+    return result;
+}
+
+/**
+ * Store the given value against the given key, replacing any value it already has.
+ *
+ * @param key A string of up to KEY_VALUE_MAX_KEY_LEN - 1 characters.
+ * @param data The value to store.
+ * @param dataSize The size of the value, of up to KEY_VALUE_MAX_VALUE_LEN bytes.
+ *
+ * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the key or value is too large, or
+ *         DEVICE_NO_RESOURCES if the index or log is full.
+ */
+int MicroBitKeyValueLog::put(ManagedString key, uint8_t *data, int dataSize)
+{
+    return put(key.toCharArray(), data, dataSize);
+}
+
+/**
+ * Retrieve the value stored against the given key.
+ *
+ * @param key The key to look up.
+ *
+ * @return A new KeyValuePair holding the key and its value, which the caller must delete, or NULL if the key is not present.
+ *         Bytes of the value beyond those stored are zero.
+ */
+KeyValuePair* MicroBitKeyValueLog::get(const char *key)
+{
+    uint32_t buffer[MICROBIT_KEY_VALUE_LOG_RECORD_WORDS];
+    KeyValueLogRecord *r = (KeyValueLogRecord *)buffer;
+    KeyValuePair *pair = NULL;
+    int length = key ? strlen(key) : 0;
+
+    if (length == 0 || length >= KEY_VALUE_MAX_KEY_LEN)
+        return NULL;
+
+    mutex.wait();
+
+    if (!(status & MICROBIT_KEY_VALUE_LOG_STATUS_LOADED))
+        load();
+
+    int slot = find(key, length);
+
+    if (slot >= 0)
+    {
+        readRecord(index[slot] * 4, pages * pageSize, buffer);
+
+        pair = new KeyValuePair();
+        memset(pair, 0, sizeof(KeyValuePair));
+        memcpy(pair->key, key, length);
+        memcpy(pair->value, buffer + 1 + (length + 3) / 4, r->valueLength);
+    }
+
+    mutex.notify();
+    return pair;
+}
+
+/**
+ * Retrieve the value stored against the given key.
+ *
+ * @param key The key to look up.
+ *
+ * @return A new KeyValuePair holding the key and its value, which the caller must delete, or NULL if the key is not present.
+ */
+KeyValuePair* MicroBitKeyValueLog::get(ManagedString key)
+{
+    return get(key.toCharArray());
+}
+
+/**
+ * Remove the given key, and its value, from the store.
+ *
+ * @param key The key to remove.
+ *
+ * @return DEVICE_OK on success, DEVICE_NO_DATA if the key is not present, or DEVICE_NO_RESOURCES if the log is full.
+ */
+int MicroBitKeyValueLog::remove(const char *key)
+{
+    int length = key ? strlen(key) : 0;
+    int result = DEVICE_OK;
+
+    if (length == 0 || length >= KEY_VALUE_MAX_KEY_LEN)
+        return DEVICE_NO_DATA;
+
+    mutex.wait();
+
+    if (!(status & MICROBIT_KEY_VALUE_LOG_STATUS_LOADED))
+        load();
+
+    if (find(key, length) < 0)
+    {
+        mutex.notify();
+        return DEVICE_NO_DATA;
+    }
+
+    uint32_t address = append(key, length, NULL, MICROBIT_KEY_VALUE_LOG_REMOVED);
+
+    if (address)
+        updateIndex(address, key, length, true);
+    else
+        result = DEVICE_NO_RESOURCES;
+
+    if (freePages() <= 1)
+        startCompaction();
+
+    mutex.notify();
+    return result;
+}
+
+/**
+ * Remove the given key, and its value, from the store.
+ *
+ * @param key The key to remove.
+ *
+ * @return DEVICE_OK on success, DEVICE_NO_DATA if the key is not present, or DEVICE_NO_RESOURCES if the log is full.
+ */
+int MicroBitKeyValueLog::remove(ManagedString key)
+{
+    return remove(key.toCharArray());
+}
+
+/**
+ * Determine the number of keys in the store.
+ *
+ * @return The number of keys.
+ */
+int MicroBitKeyValueLog::size()
+{
+    mutex.wait();
+
+    if (!(status & MICROBIT_KEY_VALUE_LOG_STATUS_LOADED))
+        load();
+
+    int n = count;
+
+    mutex.notify();
+    return n;
+}
+
+/**
+ * Erase every page of the log, removing all keys.
+ *
+ * @return DEVICE_OK on success.
+ */
+int MicroBitKeyValueLog::wipe()
+{
+    mutex.wait();
+
+    if (!(status & MICROBIT_KEY_VALUE_LOG_STATUS_LOADED))
+        load();
+
+    // Free pages are known to be erased already.
+    for (int p = 0; p < pages; p++)
+    {
+        if (sequence[p])
+            controller.erase(p * pageSize);
+
+        sequence[p] = 0;
+    }
+
+    memset(index, 0xFF, sizeof(index));
+    count = 0;
+    removed = 0;
+    active = -1;
+    nextSequence = 1;
+
+    mutex.notify();
+    return DEVICE_OK;
+}
+
+/**
+ * Perform one step of compaction: the live records of the oldest page are copied forward, and that page is erased.
+ * This is normally called by the background compaction fiber.
+ *
+ * @return DEVICE_OK if a page was reclaimed, DEVICE_NO_DATA if no page needs reclaiming, or DEVICE_NO_RESOURCES
+ *         if there is no room to copy the live records of the oldest page.
+ */
+int MicroBitKeyValueLog::compact()
+{
+    mutex.wait();
+
+    if (!(status & MICROBIT_KEY_VALUE_LOG_STATUS_LOADED))
+        load();
+
+    int result = reclaim();
+
+    mutex.notify();
+    return result;
+}
+
+/**
+ * Start the background compaction fiber, if it is not already running.
+ */
+void MicroBitKeyValueLog::startCompaction()
+{
+#if CONFIG_MICROBIT_KEY_VALUE_LOG_COMPACTION_PERIOD > 0
+    if ((status & MICROBIT_KEY_VALUE_LOG_STATUS_COMPACTING) == 0 && fiber_scheduler_running())
+    {
+        status |= MICROBIT_KEY_VALUE_LOG_STATUS_COMPACTING;
+        create_fiber(compactionFiber, this);
+    }
+#endif
+}
+
+/**
+ * Body of the background compaction fiber. Reclaims pages one at a time, once per
+ * CONFIG_MICROBIT_KEY_VALUE_LOG_COMPACTION_PERIOD, until a page is free besides the one kept in reserve.
+ *
+ * @param log The MicroBitKeyValueLog to compact.
+ */
+void MicroBitKeyValueLog::compactionFiber(void *log)
+{
+    MicroBitKeyValueLog *l = (MicroBitKeyValueLog *)log;
+    int steps = 0;
+
+    do {
+        fiber_sleep(CONFIG_MICROBIT_KEY_VALUE_LOG_COMPACTION_PERIOD);
+    } while (l->compact() == DEVICE_OK && ++steps < l->pages);
+
+    l->status &= ~MICROBIT_KEY_VALUE_LOG_STATUS_COMPACTING;
+}
@@ -24,6 +24,8 @@ DEALINGS IN THE SOFTWARE.
 
 #include "MicroBitLog.h"
 #include "CodalDmesg.h"
+#include "crc32.h"
+#include "MicroBitHeapStats.h"
 #include <new>
 
 #define ARRAY_LEN(array)    (sizeof(array) / sizeof(array[0]))
@@ -55,7 +57,7 @@ static void writeNum(char *buf, uint32_t n)
 /**
  * Constructor.
  */
-MicroBitLog::MicroBitLog(MicroBitUSBFlashManager &flash, MicroBitPowerManager &power, NRF52Serial &serial) : flash(flash), power(power), serial(serial), cache(flash, CONFIG_MICROBIT_LOG_CACHE_BLOCK_SIZE, 4)
+MicroBitLog::MicroBitLog(MicroBitUSBFlashManager &flash, MicroBitPowerManager &power, MicroBitSerialQueue &serial) : flash(flash), power(power), serial(serial), cache(flash, CONFIG_MICROBIT_LOG_CACHE_BLOCK_SIZE, 4)
 {
     this->journalPages = 0;
     this->status = 0;
@@ -66,11 +68,33 @@ MicroBitLog::MicroBitLog(MicroBitUSBFlashManager &flash, MicroBitPowerManager &p
     this->headingStart = 0;
     this->headingLength = 0;
     this->headingCount = 0;
+    this->headingCapacity = 0;
+    this->columnIndex = NULL;
+    this->columnHandles = 0;
+    this->columnIndexSize = 0;
+    this->writeBehindBuffer = NULL;
+    this->writeBehindHead = 0;
+    this->writeBehindTail = 0;
+    this->writeBehindLength = 0;
+    this->writeBehindHighWater = CONFIG_MICROBIT_LOG_WRITE_BEHIND_HIGH_WATER;
+    this->logFormat = LogFormat::CSV;
+    this->csvLength = 0;
+    this->decoder.address = 0;
     this->logEnd = 0;
+    this->erasedEnd = 0;
+    this->ringEnd = 0;
+    this->oldest = 0;
+    this->rollCount = 0;
+    this->rollSkip = 0;
     this->headingsChanged = false;
     this->timeStampChanged = false;
     this->rowData = NULL;
+    this->rowBuffer = NULL;
+    this->rowBufferSize = 0;
     this->timeStampFormat = TimeStampFormat::None;
+
+    // Writes are held in the cache until flash storage is released.
+    cache.setWriteBack(true);
 }
 
 /**
@@ -82,6 +106,23 @@ void MicroBitLog::init()
     if (status & MICROBIT_LOG_STATUS_INITIALIZED)
         return;
 
+    flushLock.wait();
+    mount();
+    releaseStorage();
+
+    if (CONFIG_MICROBIT_LOG_PRE_ERASE_PAGES > 0)
+        startBackgroundFiber();
+}
+
+/**
+ * Load an existing filesystem, or format a new one if not found.
+ * The caller must hold flushLock.
+ */
+void MicroBitLog::mount()
+{
+    if (status & MICROBIT_LOG_STATUS_INITIALIZED)
+        return;
+
     if (_isPresent())
     {
         // We have a valid file system.
@@ -91,39 +132,104 @@ void MicroBitLog::init()
         dataEnd = dataStart;
 
         // Load the last entry in the journal.
-        uint32_t journalEntryAddress = journalHead;
+        uint32_t journalEntryAddress = findJournalEntry();
         bool valid = false;
+        uint32_t journalled = 0;
 
-        while(journalEntryAddress < dataStart)
+        if (journalEntryAddress)
         {
             cache.read(journalEntryAddress, j.length, MICROBIT_LOG_JOURNAL_ENTRY_SIZE);
+            journalHead = journalEntryAddress;
+            journalled = strtoul(j.length, NULL, 16);
+        }
+        else
+        {
+            // The journal does not have the expected layout (e.g. an update was interrupted). Scan it in full.
+            journalEntryAddress = journalHead;
 
-            // If we have a valid reading follwed by an unused entry, we're done.
-            if (j.containsOnly(0xFF) && valid)
-                break;
-
-            // Parse valid entries. We continue processing to the last valid entry, just in case.
-            if (!j.containsOnly(0x00))
+            while(journalEntryAddress < dataStart)
             {
-                journalHead = journalEntryAddress;
-                dataEnd = dataStart + strtoul(j.length, NULL, 16);
-                valid = true;
-            }
+                cache.read(journalEntryAddress, j.length, MICROBIT_LOG_JOURNAL_ENTRY_SIZE);
 
-            journalEntryAddress += MICROBIT_LOG_JOURNAL_ENTRY_SIZE;
+                // If we have a valid reading follwed by an unused entry, we're done.
+                if (j.containsOnly(0xFF) && valid)
+                    break;
+
+                // Parse valid entries. We continue processing to the last valid entry, just in case.
+                if (!j.containsOnly(0x00))
+                {
+                    journalHead = journalEntryAddress;
+                    journalled = strtoul(j.length, NULL, 16);
+                    valid = true;
+                }
+
+                journalEntryAddress += MICROBIT_LOG_JOURNAL_ENTRY_SIZE;
+            }
         }
 
-        // Walk the page indicated by dataEnd, and increment until an unused byte (0xFF) is found.
+        // The top byte of the journalled length counts the times a rolling log has wrapped around.
+        rollCount = journalled >> MICROBIT_LOG_ROLL_SHIFT;
+        dataEnd = dataStart + (journalled & MICROBIT_LOG_ROLL_OFFSET_MASK);
+        ringEnd = (logEnd / flash.getPageSize()) * flash.getPageSize();
+
+        // A log that has wrapped around, or has erased its first page in order to, is a rolling log.
         uint8_t d = 0;
+        cache.read(dataStart, &d, 1);
+
+        bool rolled = rollCount > 0 || (dataEnd > dataStart && d == 0xFF);
+        bool wrapped = false;
+
+        if (rolled)
+            status |= MICROBIT_LOG_STATUS_ROLLING;
+
+        status &= ~MICROBIT_LOG_STATUS_ROLL_SKIP;
+
+        // Walk forward from the journalled position until an unused byte (0xFF) is found.
+        // This is normally within the final cache block, so read in chunks rather than a byte at a time.
+        uint8_t chunk[MICROBIT_LOG_SCAN_CHUNK_SIZE];
         while(dataEnd < logEnd)
         {
-            cache.read(dataEnd, &d, 1);
-            if (d == 0xFF)
+            uint32_t limit = (status & MICROBIT_LOG_STATUS_ROLLING) ? ringEnd : logEnd;
+            uint32_t l = min(limit - dataEnd, (uint32_t)MICROBIT_LOG_SCAN_CHUNK_SIZE);
+            uint32_t i = 0;
+
+            cache.read(dataEnd, chunk, l);
+
+            while (i < l && chunk[i] != 0xFF)
+                i++;
+
+            dataEnd += i;
+
+            if (i < l)
                 break;
 
-            dataEnd++;
+            // A rolling log continues from the start of the data section, even if the journal has yet to record it.
+            if (dataEnd == ringEnd && (status & MICROBIT_LOG_STATUS_ROLLING))
+            {
+                if (wrapped)
+                    break;
+
+                dataEnd = dataStart;
+                rollCount = rollCount == 0xFF ? 1 : rollCount + 1;
+                rolled = true;
+                wrapped = true;
+            }
+        }
+
+        oldest = rolled ? findOldest() : dataStart;
+
+        // Only the remainder of the page holding dataEnd is known to be erased.
+        erasedEnd = ((dataEnd / flash.getPageSize()) + 1) * flash.getPageSize();
+
+        // Binary logs are identified by a row terminator at the start of their data. Rolling logs are always CSV.
+        if (dataEnd > dataStart && !rolled)
+        {
+            cache.read(dataStart, &d, 1);
+            logFormat = d == MICROBIT_LOG_BINARY_ROW_END ? LogFormat::Binary : LogFormat::CSV;
         }
 
+        decoder.address = 0;
+
         // Determine if we have any column headers defined
         // If so, parse them.
         uint32_t start = startAddress + sizeof(MicroBitLogMetaData);
@@ -154,6 +260,11 @@ void MicroBitLog::init()
             headingCount = 0;
 
             char *headers = (char *) malloc(headingLength);
+
+            // Without the memory to hold the headings, leave the log unmounted, so that the next call tries again.
+            if (headers == NULL)
+                return;
+
             cache.read(start, headers, headingLength);
 
             // Count the number of comma separated headers.
@@ -170,15 +281,27 @@ void MicroBitLog::init()
             // Allocate a RAM buffer to hold key/value pairs matching those defined
             rowData = (ColumnEntry *) malloc(sizeof(ColumnEntry) * headingCount);
 
+            if (rowData == NULL)
+            {
+                free(headers);
+                headingCount = 0;
+                return;
+            }
+
+            MICROBIT_HEAP_TRACK(MICROBIT_HEAP_TAG_STORAGE, rowData);
+            headingCapacity = headingCount;
+
             // Populate each entry.
             int i=0;
             for (uint32_t h=0; h<headingCount; h++)
             {
                 new (&rowData[h]) ColumnEntry;
                 rowData[h].key = ManagedString(&headers[i]);
+                rowData[h].handle = newColumnHandle();
                 i = i + rowData[h].key.length() + 1;
             }
 
+            indexColumns();
             free(headers);
         }
 
@@ -196,6 +319,62 @@ void MicroBitLog::init()
     _setVisibility(true);
 }
 
+/**
+ * Locates the live journal entry by binary search, reading only a few entries.
+ *
+ * Entries are written in sequence, and each is zeroed once it is superseded. So within the page holding the
+ * live entry, zeroed entries precede it and unused (0xFF) entries follow it. Every other journal page is either
+ * entirely zeroed or entirely unused, which can be determined from its first and last entries.
+ *
+ * @return the logical address of the live journal entry, or zero if none could be found.
+ */
+uint32_t MicroBitLog::findJournalEntry()
+{
+    JournalEntry j;
+    uint32_t pageSize = flash.getPageSize();
+    uint32_t entriesPerPage = pageSize / MICROBIT_LOG_JOURNAL_ENTRY_SIZE;
+
+    for (uint32_t page = journalStart; page < dataStart; page += pageSize)
+    {
+        // Skip unused pages...
+        cache.read(page, j.length, MICROBIT_LOG_JOURNAL_ENTRY_SIZE);
+        if (j.containsOnly(0xFF))
+            continue;
+
+        // ... and pages whose entries have all been superseded.
+        cache.read(page + pageSize - MICROBIT_LOG_JOURNAL_ENTRY_SIZE, j.length, MICROBIT_LOG_JOURNAL_ENTRY_SIZE);
+        if (j.containsOnly(0x00))
+            continue;
+
+        // Find the first unused entry in this page. The first entry is known to be in use.
+        uint32_t low = 1;
+        uint32_t high = entriesPerPage;
+
+        while (low < high)
+        {
+            uint32_t mid = (low + high) / 2;
+
+            cache.read(page + mid * MICROBIT_LOG_JOURNAL_ENTRY_SIZE, j.length, MICROBIT_LOG_JOURNAL_ENTRY_SIZE);
+
+            if (j.containsOnly(0xFF))
+                high = mid;
+            else
+                low = mid + 1;
+        }
+
+        // The live entry immediately precedes it.
+        uint32_t address = page + (low - 1) * MICROBIT_LOG_JOURNAL_ENTRY_SIZE;
+        cache.read(address, j.length, MICROBIT_LOG_JOURNAL_ENTRY_SIZE);
+
+        if (j.containsOnly(0x00) || j.containsOnly(0xFF))
+            return 0;
+
+        return address;
+    }
+
+    return 0;
+}
+
 /**
  * Sets the visibility of the MY_DATA.HTM file on the MICROBIT drive.
  * Only updates the persistent state of this visibility if it has changed.
@@ -205,7 +384,9 @@ void MicroBitLog::init()
 void MicroBitLog::setVisibility(bool visible)
 {
     mutex.wait();
+    acquireStorage();
     _setVisibility(visible);
+    releaseStorage();
     mutex.notify();
 }
 
@@ -239,15 +420,23 @@ void MicroBitLog::_setVisibility(bool visible)
 void MicroBitLog::clear(bool fullErase)
 {
     mutex.wait();
+    flushLock.wait();
     _clear(fullErase);
+    releaseStorage();
     mutex.notify();
 }
 
 /**
  * Reset all data stored in persistent storage.
+ * The caller must hold flushLock.
  */
 void MicroBitLog::_clear(bool fullErase)
 {
+    // Discard any staged data.
+    writeBehindHead = 0;
+    writeBehindTail = 0;
+    writeBehindLength = 0;
+
     // Calculate where our metadata should start.
     startAddress = sizeof(header);
     journalPages = CONFIG_MICROBIT_LOG_JOURNAL_SIZE / flash.getPageSize();
@@ -256,7 +445,13 @@ void MicroBitLog::_clear(bool fullErase)
     dataStart = journalStart + CONFIG_MICROBIT_LOG_JOURNAL_SIZE;
     dataEnd = dataStart;
     logEnd = flash.getFlashEnd() - sizeof(uint32_t);
-    status &= MICROBIT_LOG_STATUS_SERIAL_MIRROR;
+    ringEnd = (logEnd / flash.getPageSize()) * flash.getPageSize();
+    oldest = dataStart;
+    rollCount = 0;
+    status &= (MICROBIT_LOG_STATUS_SERIAL_MIRROR | MICROBIT_LOG_STATUS_WRITE_BEHIND | MICROBIT_LOG_STATUS_BACKGROUND_FIBER | MICROBIT_LOG_STATUS_ROLLING);
+    status |= MICROBIT_LOG_STATUS_CSV_LENGTH;
+    csvLength = 0;
+    decoder.address = 0;
     
     // Remove any cached state around column headings
     headingsChanged = false;
@@ -264,9 +459,12 @@ void MicroBitLog::_clear(bool fullErase)
     headingStart = 0;
     headingCount = 0;
     headingLength = 0;
+    headingCapacity = 0;
+    columnHandles = 0;
 
     if (rowData)
     {
+        MICROBIT_HEAP_UNTRACK(MICROBIT_HEAP_TAG_STORAGE, rowData);
         free(rowData);
         rowData = NULL;
     }
@@ -276,9 +474,13 @@ void MicroBitLog::_clear(bool fullErase)
     flash.write(logEnd, &zero, 1);
 
     // Erase all pages associated with the header, all meta data and the first page of data storage.
+    // This is issued as a single request, so that interface chips supporting multi-page erase can do so in one command.
     cache.clear();
-    for (uint32_t p = flash.getFlashStart(); p <= (fullErase ? logEnd : dataStart); p += flash.getPageSize())
-        flash.erase(p);
+    uint32_t p = flash.getFlashStart() + (((fullErase ? logEnd : dataStart) - flash.getFlashStart()) / flash.getPageSize() + 1) * flash.getPageSize();
+    flash.erase(flash.getFlashStart(), (p - flash.getFlashStart()) / 4);
+
+    // The pages a rolling log wraps around to are not erased until it reaches them again.
+    erasedEnd = min(p, ringEnd);
 
     // Serialise and write header (if we have one)
     // n.b. we use flash.write() here to avoid unecessary preheating of the cache.
@@ -385,9 +587,12 @@ void MicroBitLog::_setTimeStamp(TimeStampFormat format)
         {
             // Remove the Timestamp column from the list of headings.
             for (uint32_t i=1; i<headingCount; i++)
-                rowData[i-1].key = rowData[i].key;
+                rowData[i-1] = rowData[i];
 
             headingCount--;
+            rowData[headingCount].key = ManagedString::EmptyString;
+            rowData[headingCount].value = ManagedString::EmptyString;
+            indexColumns();
         }
     }
 
@@ -412,259 +617,1272 @@ void MicroBitLog::setSerialMirroring(bool enable)
 }
 
 /**
- * Creates a new row in the log, ready to be populated by logData()
- * 
- * @return DEVICE_OK on success.
+ * Enables or disables write-behind buffering of the log.
+ *
+ * When enabled, completed rows are staged in a RAM buffer of CONFIG_MICROBIT_LOG_WRITE_BEHIND_SIZE bytes
+ * and endRow() returns without waiting for flash storage. A background fiber writes staged data to
+ * flash once highWater bytes are waiting, every CONFIG_MICROBIT_LOG_WRITE_BEHIND_PERIOD_MS milliseconds,
+ * or when flush() is called. A row is only written synchronously if the buffer is full.
+ *
+ * Staged data is lost if power is removed before it is written. Use sync() where durability matters.
+ *
+ * @param enable true to enable write-behind buffering, false to write each row directly to flash.
+ * @param highWater the number of staged bytes at which a background flush is started.
+ *
+ * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if highWater is larger than the buffer,
+ * or DEVICE_NO_RESOURCES if the buffer could not be allocated.
  */
-int MicroBitLog::beginRow()
+int MicroBitLog::setWriteBehind(bool enable, uint32_t highWater)
 {
-    int r;
+    if (enable && (highWater == 0 || highWater > CONFIG_MICROBIT_LOG_WRITE_BEHIND_SIZE))
+        return DEVICE_INVALID_PARAMETER;
 
     mutex.wait();
-    r = _beginRow();
-    mutex.notify();
 
-    return r;
-}
+    if (enable)
+    {
+        writeBehindHighWater = highWater;
 
+        if (writeBehindBuffer == NULL)
+        {
+            writeBehindBuffer = (uint8_t *) malloc(CONFIG_MICROBIT_LOG_WRITE_BEHIND_SIZE);
 
-/**
- * Creates a new row in the log, ready to be populated by logData()
- * 
- * @return DEVICE_OK on success.
- */
-int MicroBitLog::_beginRow()
-{
-    init();
+            if (writeBehindBuffer == NULL)
+            {
+                mutex.notify();
+                return DEVICE_NO_RESOURCES;
+            }
 
-    // If beginRow is called during an open transaction, implicity perform an endRow before proceeding.
-    if (status & MICROBIT_LOG_STATUS_ROW_STARTED)
-        _endRow();
+            MICROBIT_HEAP_TRACK(MICROBIT_HEAP_TAG_STORAGE, writeBehindBuffer);
 
-    // Reset all values, ready to populate with a new row.
-    for (uint32_t i=0; i<headingCount; i++)
-        rowData[i].value = ManagedString();
+            writeBehindHead = 0;
+            writeBehindTail = 0;
+            writeBehindLength = 0;
+        }
 
-    // indicate that we've started a new row.
-    status |= MICROBIT_LOG_STATUS_ROW_STARTED;
+        startBackgroundFiber();
+
+        if (!(status & MICROBIT_LOG_STATUS_WRITE_BEHIND))
+        {
+            status |= MICROBIT_LOG_STATUS_WRITE_BEHIND;
+            system_timer_event_every(CONFIG_MICROBIT_LOG_WRITE_BEHIND_PERIOD_MS, MICROBIT_ID_LOG, MICROBIT_LOG_EVT_FLUSH);
+        }
+    }
+    else if (status & MICROBIT_LOG_STATUS_WRITE_BEHIND)
+    {
+        system_timer_cancel_event(MICROBIT_ID_LOG, MICROBIT_LOG_EVT_FLUSH);
+        status &= ~MICROBIT_LOG_STATUS_WRITE_BEHIND;
+
+        // Write out anything still staged before releasing the buffer.
+        _sync();
+
+        MICROBIT_HEAP_UNTRACK(MICROBIT_HEAP_TAG_STORAGE, writeBehindBuffer);
+        free(writeBehindBuffer);
+        writeBehindBuffer = NULL;
+    }
+
+    mutex.notify();
 
     return DEVICE_OK;
 }
 
 /**
- * Populates the current row with the given key/value pair.
- * @param key the name of the key column) to set.
- * @param value the value to insert 
- * 
- * @return DEVICE_OK on success.
+ * Selects the format in which rows are stored.
+ *
+ * LogFormat::Binary stores each numeric value as a scaled integer in a few bytes, typically fitting around
+ * three times as many rows into the log. readData() and getDataLength() render binary rows as CSV, so
+ * readers see the same data in either format. The MY_DATA.HTM file on the MICROBIT drive only shows data
+ * logged in CSV format.
+ *
+ * The format is a property of the log, and can only be changed while the log is empty. A binary log is
+ * recognised as such after a reset.
+ *
+ * @param format the format in which to store rows.
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_STATE if the log already holds data in another format,
+ * or is a rolling log.
  */
-int MicroBitLog::logData(const char *key, const char *value)
+int MicroBitLog::setFormat(LogFormat format)
 {
-    return logData(ManagedString(key), ManagedString(value));
+    int r = DEVICE_OK;
+
+    mutex.wait();
+    init();
+
+    if (format != logFormat)
+    {
+        if (dataEnd != dataStart || writeBehindLength || (status & MICROBIT_LOG_STATUS_ROLLING))
+            r = DEVICE_INVALID_STATE;
+        else
+            logFormat = format;
+    }
+
+    mutex.notify();
+
+    return r;
 }
 
 /**
- * Populates the current row with the given key/value pair.
- * @param key the name of the key column) to set.
- * @param value the value to insert 
+ * Determines the format in which rows are stored.
  *
- * @return DEVICE_OK on success.
+ * @return the format of the log.
  */
-int MicroBitLog::logData(ManagedString key, ManagedString value)
+LogFormat MicroBitLog::getFormat()
 {
-    int r;
+    LogFormat f;
 
     mutex.wait();
-    r = _logData(key, value);
+    init();
+    f = logFormat;
     mutex.notify();
 
-    return r;
+    return f;
 }
 
 /**
- * Populates the current row with the given key/value pair.
- * @param key the name of the key column) to set.
- * @param value the value to insert 
+ * Determines whether the log rolls over when it fills, rather than stopping.
  *
- * @return DEVICE_OK on success.
+ * A rolling log erases the page holding its oldest data to make room for new rows, so that it always
+ * holds the most recent data. readData() and getDataLength() render a log that has rolled over as the
+ * current column headings followed by the complete rows that remain. The MY_DATA.HTM file on the MICROBIT
+ * drive only shows the rows written since the log last wrapped around.
+ *
+ * Only CSV logs can roll over. Once a log has rolled over, it remains a rolling log until it is cleared,
+ * and is recognised as such after a reset.
+ *
+ * @param enable true to roll over when the log fills, false to stop.
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_STATE if the log is binary, full or has already rolled over.
  */
-int MicroBitLog::_logData(ManagedString key, ManagedString value)
+int MicroBitLog::setRolling(bool enable)
 {
-    // Perform lazy instatiation if necessary.
-    init();
-
-    // If logData is called before explicitly beginning a row, do so implicitly.
-    if (!(status & MICROBIT_LOG_STATUS_ROW_STARTED))
-        _beginRow();
-
-    ManagedString k = cleanBuffer(key.toCharArray(), key.length());
-    ManagedString v = cleanBuffer(value.toCharArray(), value.length());
-
-    if (k.length())
-        key = k;
+    int r = DEVICE_OK;
 
-    if (v.length())
-        value = v;
+    mutex.wait();
+    init();
+    acquireStorage();
 
-    // Add the given key/value pair into our cumulative row data. 
-    bool added = false;
-    for (uint32_t i=0; i<headingCount; i++)
+    if (enable)
     {
-        if(rowData[i].key == key)
+        // The last page, holding the FULL indicator, is not part of the ring.
+        if (logFormat == LogFormat::Binary || (status & MICROBIT_LOG_STATUS_FULL) || dataEnd >= ringEnd)
         {
-            rowData[i].value = value;
-            added = true;
-            break;
+            r = DEVICE_INVALID_STATE;
+        }
+        else
+        {
+            status |= MICROBIT_LOG_STATUS_ROLLING;
+
+            // Pages beyond ringEnd would otherwise be taken as erased pages at the start of the data.
+            if (erasedEnd > ringEnd)
+                erasedEnd = ringEnd;
         }
     }
+    else
+    {
+        if (isRolled())
+            r = DEVICE_INVALID_STATE;
+        else
+            status &= ~MICROBIT_LOG_STATUS_ROLLING;
+    }
 
-    // If the requested heading is not available, add it.
-    if (!added)
-        addHeading(key, value);
+    releaseStorage();
+    mutex.notify();
 
-    return DEVICE_OK;
+    return r;
 }
 
 /**
- * Complete a row in the log, and pushes to persistent storage.
- * @return DEVICE_OK on success.
+ * Determines whether the log rolls over when it fills.
+ *
+ * @return true if the log is a rolling log, false otherwise.
  */
-int MicroBitLog::endRow()
+bool MicroBitLog::isRolling()
 {
-    int r;
+    bool rolling;
 
     mutex.wait();
-    r = _endRow();
+    init();
+    rolling = (status & MICROBIT_LOG_STATUS_ROLLING) != 0;
     mutex.notify();
 
-    return r;
+    return rolling;
 }
 
 /**
- * Complete a row in the log, and pushes to persistent storage.
+ * Requests that any staged data is written to flash by the background fiber.
+ * Returns immediately, without waiting for the data to be written.
+ *
  * @return DEVICE_OK on success.
  */
-int MicroBitLog::_endRow()
+int MicroBitLog::flush()
 {
-    if (!(status & MICROBIT_LOG_STATUS_ROW_STARTED))
-        return DEVICE_INVALID_STATE;
-
-    init();
+    if (writeBehindLength)
+        Event(MICROBIT_ID_LOG, MICROBIT_LOG_EVT_FLUSH);
 
-    // Add the timestamp column, if we need one and it does not already exist.
-    // Add at the front, unless data has already been written.
-    if (timeStampChanged)
-    {
-        timeStampChanged = false;
-        if (timeStampFormat != TimeStampFormat::None)
-            addHeading(timeStampHeading, ManagedString::EmptyString, dataStart == dataEnd);
-    }
-
-    // Special case the condition where no values are present.
-    // We suppress injecting a pointless timestamp in these cases.
-    bool validData = false;
-
-    for (uint32_t i=0; i<headingCount; i++)
-    {
-        if(rowData[i].value != ManagedString::EmptyString)
-        {
-            validData = true;
-            break;
-        }
-    }
+    return DEVICE_OK;
+}
 
-    // Insert timestamp field if requested.
-    if (validData && timeStampFormat != TimeStampFormat::None)
-    {
-        // handle 32 bit overflow and fractional components of timestamp
-        CODAL_TIMESTAMP t = system_timer_current_time() / (CODAL_TIMESTAMP)timeStampFormat;
-        int billions = t / (CODAL_TIMESTAMP) 1000000000;
-        int units = t % (CODAL_TIMESTAMP) 1000000000;
-        int fraction = 0;
+/**
+ * Writes any staged data to flash, and waits for it to complete.
+ * When this method returns, all previously logged rows are held in persistent storage.
+ *
+ * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if the log became full.
+ */
+int MicroBitLog::sync()
+{
+    int r;
 
-        if ((int)timeStampFormat > 1)
-        {
-            fraction = units % 100;
-            units = units / 100;
-            billions = billions / 100;
-        }
+    mutex.wait();
+    r = _sync();
+    mutex.notify();
 
-        ManagedString u(units);
-        ManagedString f(fraction);
-        ManagedString s;
-        f = padString(f, 2);
+    return r;
+}
 
-        if (billions)
-        {
-            s = s + billions;
-            u = padString(u, 9);
-        }
+/**
+ * Writes any staged data to flash, and waits for it to complete.
+ *
+ * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if the log became full.
+ */
+int MicroBitLog::_sync()
+{
+    int r;
 
-        s = s + u;
+    r = acquireStorage();
+    releaseStorage();
 
-        // Add two decimal places for anything other than milliseconds.
-        if ((int)timeStampFormat > 1)
-            s = s + "." + f;
+    return r;
+}
 
-        _logData(timeStampHeading, s);
+/**
+ * Acquires exclusive access to flash storage, having first written out any staged data.
+ * Must be followed by a call to releaseStorage().
+ *
+ * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if the log became full.
+ */
+int MicroBitLog::acquireStorage()
+{
+    flushLock.wait();
+    return flushWriteBehind();
+}
+
+/**
+ * Releases exclusive access to flash storage, acquired through acquireStorage() or flushLock.
+ * Changes held in the cache are written to flash first, so the writes to a cache block between the two
+ * are coalesced into a single flash write, other than where the journal moves on (see _writeData()).
+ */
+void MicroBitLog::releaseStorage()
+{
+    cache.flush();
+    flushLock.notify();
+}
+
+/**
+ * Erases the next page ahead of the end of the data, if fewer than CONFIG_MICROBIT_LOG_PRE_ERASE_PAGES
+ * pages are already erased. The caller must hold flushLock.
+ *
+ * @return true if more pages remain to be erased, false otherwise.
+ */
+bool MicroBitLog::preErase()
+{
+    if (!(status & MICROBIT_LOG_STATUS_INITIALIZED))
+        return false;
+
+    uint32_t pageSize = flash.getPageSize();
+    uint32_t target = ((dataEnd / pageSize) + 1 + CONFIG_MICROBIT_LOG_PRE_ERASE_PAGES) * pageSize;
+
+    bool rolling = (status & MICROBIT_LOG_STATUS_ROLLING) != 0;
+
+    if (erasedEnd >= target || (!rolling && erasedEnd >= logEnd))
+        return false;
+
+    erasePage(ringAddress(erasedEnd));
+    erasedEnd += pageSize;
+
+    return erasedEnd < target && (rolling || erasedEnd < logEnd);
+}
+
+/**
+ * Erases the given page of the data section. In a rolling log, erasing the page holding the oldest
+ * data discards it. The caller must hold flushLock.
+ *
+ * @param page the logical address of the page to erase.
+ */
+void MicroBitLog::erasePage(uint32_t page)
+{
+    if ((status & MICROBIT_LOG_STATUS_ROLLING) && page == oldest)
+    {
+        // The discarded data may have been read into the cache.
+        cache.erase(page);
+        oldest = nextPage(page);
+        status &= ~MICROBIT_LOG_STATUS_ROLL_SKIP;
+    }
+
+    flash.erase(page);
+}
+
+/**
+ * Determines the page following the given one, wrapping around in a rolling log.
+ *
+ * @param page the logical address of a page in the data section.
+ * @return the logical address of the following page.
+ */
+uint32_t MicroBitLog::nextPage(uint32_t page)
+{
+    return ringAddress(page + flash.getPageSize());
+}
+
+/**
+ * Maps an address beyond the end of the ring of a rolling log back to the start of the data section.
+ *
+ * @param address a logical address, possibly beyond ringEnd.
+ * @return the logical address it refers to.
+ */
+uint32_t MicroBitLog::ringAddress(uint32_t address)
+{
+    if ((status & MICROBIT_LOG_STATUS_ROLLING) && address >= ringEnd)
+        return address - (ringEnd - dataStart);
+
+    return address;
+}
+
+/**
+ * Locates the oldest data of a rolling log, in the first page after dataEnd that is not erased.
+ *
+ * @return the logical address of the oldest data.
+ */
+uint32_t MicroBitLog::findOldest()
+{
+    uint32_t page = (dataEnd / flash.getPageSize()) * flash.getPageSize();
+    uint8_t d;
+
+    // Data is written from the start of each page, so a page whose first byte is unused holds no data.
+    for (uint32_t p = nextPage(page); p != page; p = nextPage(p))
+    {
+        cache.read(p, &d, 1);
+
+        if (d != 0xFF)
+            return p;
+    }
+
+    return page;
+}
+
+/**
+ * Determines if a rolling log has discarded any of its data.
+ *
+ * @return true if the log has wrapped around or no longer starts at dataStart, false otherwise.
+ */
+bool MicroBitLog::isRolled()
+{
+    return rollCount > 0 || oldest != dataStart;
+}
+
+/**
+ * Starts the fiber that writes staged data and erases pages in the background, if it is not already running.
+ */
+void MicroBitLog::startBackgroundFiber()
+{
+    if (!(status & MICROBIT_LOG_STATUS_BACKGROUND_FIBER))
+    {
+        status |= MICROBIT_LOG_STATUS_BACKGROUND_FIBER;
+        create_fiber(backgroundFiber, this);
+    }
+}
+
+/**
+ * Writes all staged data to flash, in batches of at most one flash page.
+ * The caller must hold flushLock.
+ *
+ * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if the log became full.
+ */
+int MicroBitLog::flushWriteBehind()
+{
+    int r = DEVICE_OK;
+
+    while (writeBehindLength && r == DEVICE_OK)
+    {
+        // Take the largest contiguous run of staged data, up to the size of one page.
+        // Rows staged while this batch is being written are appended at the head, and do not disturb it.
+        uint32_t l = min(writeBehindLength, CONFIG_MICROBIT_LOG_WRITE_BEHIND_SIZE - writeBehindTail);
+        l = min(l, flash.getPageSize());
+
+        r = _writeData((const char *) &writeBehindBuffer[writeBehindTail], l);
+
+        writeBehindTail = (writeBehindTail + l) % CONFIG_MICROBIT_LOG_WRITE_BEHIND_SIZE;
+        writeBehindLength -= l;
+    }
+
+    // If the log has filled, there is nowhere for the remaining data to go.
+    // Any rendered length accounted for the lost data must be recalculated.
+    if (r != DEVICE_OK)
+    {
+        writeBehindTail = writeBehindHead;
+        writeBehindLength = 0;
+        status &= ~MICROBIT_LOG_STATUS_CSV_LENGTH;
+    }
+
+    return r;
+}
+
+/**
+ * Entry point of the fiber that writes staged data to flash and erases pages ahead of the data
+ * in the background.
+ *
+ * n.b. This fiber takes only flushLock, so rows can continue to be staged while it is busy.
+ * Any other access to flash storage must also hold flushLock.
+ *
+ * @param log the MicroBitLog instance to service.
+ */
+void MicroBitLog::backgroundFiber(void *log)
+{
+    MicroBitLog *l = (MicroBitLog *)log;
+    bool more;
+
+    while (1)
+    {
+        fiber_wait_for_event(MICROBIT_ID_LOG, DEVICE_EVT_ANY);
+
+        l->flushLock.wait();
+        l->flushWriteBehind();
+        l->releaseStorage();
+
+        // Erase one page at a time, so that foreground access to storage is never delayed by more than one erase.
+        do {
+            l->flushLock.wait();
+            l->status &= ~MICROBIT_LOG_STATUS_PRE_ERASE;
+            more = l->preErase();
+            l->releaseStorage();
+        } while (more);
+    }
+}
+
+/**
+ * Creates a new row in the log, ready to be populated by logData()
+ * 
+ * @return DEVICE_OK on success.
+ */
+int MicroBitLog::beginRow()
+{
+    int r;
+
+    mutex.wait();
+    r = _beginRow();
+    mutex.notify();
+
+    return r;
+}
+
+
+/**
+ * Creates a new row in the log, ready to be populated by logData()
+ * 
+ * @return DEVICE_OK on success.
+ */
+int MicroBitLog::_beginRow()
+{
+    init();
+
+    // If beginRow is called during an open transaction, implicity perform an endRow before proceeding.
+    if (status & MICROBIT_LOG_STATUS_ROW_STARTED)
+        _endRow();
+
+    // Reset all values, ready to populate with a new row.
+    for (uint32_t i=0; i<headingCount; i++)
+    {
+        rowData[i].value = ManagedString();
+        rowData[i].number[0] = 0;
+    }
+
+    // indicate that we've started a new row.
+    status |= MICROBIT_LOG_STATUS_ROW_STARTED;
+
+    return DEVICE_OK;
+}
+
+/**
+ * Populates the current row with the given key/value pair.
+ * @param key the name of the key column) to set.
+ * @param value the value to insert 
+ * 
+ * @return DEVICE_OK on success.
+ */
+int MicroBitLog::logData(const char *key, const char *value)
+{
+    return logData(ManagedString(key), ManagedString(value));
+}
+
+/**
+ * Populates the current row with the given key/value pair.
+ * @param key the name of the key column) to set.
+ * @param value the value to insert 
+ *
+ * @return DEVICE_OK on success.
+ */
+int MicroBitLog::logData(ManagedString key, ManagedString value)
+{
+    int r;
+
+    mutex.wait();
+    r = _logData(key, value);
+    mutex.notify();
+
+    return r;
+}
+
+/**
+ * Populates the current row with the given key/value pair.
+ * @param key the name of the key column) to set.
+ * @param value the value to insert 
+ *
+ * @return DEVICE_OK on success.
+ */
+int MicroBitLog::_logData(ManagedString key, ManagedString value)
+{
+    // Perform lazy instatiation if necessary.
+    init();
+
+    // If logData is called before explicitly beginning a row, do so implicitly.
+    if (!(status & MICROBIT_LOG_STATUS_ROW_STARTED))
+        _beginRow();
+
+    ManagedString k = cleanBuffer(key.toCharArray(), key.length());
+    ManagedString v = cleanBuffer(value.toCharArray(), value.length());
+
+    if (k.length())
+        key = k;
+
+    if (v.length())
+        value = v;
+
+    // Add the given key/value pair into our cumulative row data. 
+    bool added = false;
+    for (uint32_t i=0; i<headingCount; i++)
+    {
+        if(rowData[i].key == key)
+        {
+            rowData[i].value = value;
+            rowData[i].number[0] = 0;
+            added = true;
+            break;
+        }
+    }
+
+    // If the requested heading is not available, add it.
+    if (!added)
+        addHeading(key, value);
+
+    return DEVICE_OK;
+}
+
+/**
+ * Populates the current row with the given key and integer value.
+ * The value is formatted in place, without the use of ManagedString.
+ *
+ * @param key the name of the key column) to set.
+ * @param value the value to insert
+ *
+ * @return DEVICE_OK on success.
+ */
+int MicroBitLog::logData(const char *key, int value)
+{
+    char number[MICROBIT_LOG_NUMBER_SIZE];
+    int r;
+
+    logFormatInteger(number, value);
+
+    mutex.wait();
+    r = _logNumber(key, number);
+    mutex.notify();
+
+    return r;
+}
+
+/**
+ * Populates the current row with the given key and unsigned integer value.
+ * The value is formatted in place, without the use of ManagedString.
+ *
+ * @param key the name of the key column) to set.
+ * @param value the value to insert
+ *
+ * @return DEVICE_OK on success.
+ */
+int MicroBitLog::logData(const char *key, unsigned int value)
+{
+    char number[MICROBIT_LOG_NUMBER_SIZE];
+    int r;
+
+    logFormatUnsigned(number, value);
+
+    mutex.wait();
+    r = _logNumber(key, number);
+    mutex.notify();
+
+    return r;
+}
+
+/**
+ * Populates the current row with the given key and floating point value.
+ * The value is formatted in place, without the use of ManagedString.
+ *
+ * @param key the name of the key column) to set.
+ * @param value the value to insert
+ * @param decimals the number of decimal places to log, up to MICROBIT_LOG_MAX_DECIMALS.
+ *
+ * @return DEVICE_OK on success.
+ */
+int MicroBitLog::logData(const char *key, double value, int decimals)
+{
+    char number[MICROBIT_LOG_NUMBER_SIZE];
+    int r;
+
+    if (decimals < 0 || decimals > MICROBIT_LOG_MAX_DECIMALS)
+        return DEVICE_INVALID_PARAMETER;
+
+    logFormatFloat(number, value, decimals);
+
+    mutex.wait();
+    r = _logNumber(key, number);
+    mutex.notify();
+
+    return r;
+}
+
+/**
+ * Populates the current row with the given key and preformatted numeric value.
+ * Numbers cannot contain separators or "-->" symbols, so the value is stored without cleaning.
+ *
+ * @param key the name of the key column) to set.
+ * @param value the formatted value, at most MICROBIT_LOG_NUMBER_SIZE - 1 characters.
+ *
+ * @return DEVICE_OK on success.
+ */
+int MicroBitLog::_logNumber(const char *key, const char *value)
+{
+    // Perform lazy instatiation if necessary.
+    init();
+
+    // If logData is called before explicitly beginning a row, do so implicitly.
+    if (!(status & MICROBIT_LOG_STATUS_ROW_STARTED))
+        _beginRow();
+
+    for (uint32_t i=0; i<headingCount; i++)
+        if (strcmp(rowData[i].key.toCharArray(), key) == 0)
+            return _logNumber(rowData[i].handle, value);
+
+    // A new column, or a key in need of cleaning. Take the general path.
+    return _logData(ManagedString(key), ManagedString(value));
+}
+
+/**
+ * Populates the current row with the given preformatted numeric value, in the column with the given handle.
+ *
+ * @param column the handle of the column to set.
+ * @param value the formatted value, at most MICROBIT_LOG_NUMBER_SIZE - 1 characters.
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the handle is invalid.
+ */
+int MicroBitLog::_logNumber(int column, const char *value)
+{
+    init();
+
+    if (column < 0 || (uint32_t)column >= columnHandles || columnIndex[column] == MICROBIT_LOG_NO_COLUMN)
+        return DEVICE_INVALID_PARAMETER;
+
+    if (!(status & MICROBIT_LOG_STATUS_ROW_STARTED))
+        _beginRow();
+
+    ColumnEntry &c = rowData[columnIndex[column]];
+
+    c.value = ManagedString::EmptyString;
+    strcpy(c.number, value);
+
+    return DEVICE_OK;
+}
+
+/**
+ * Populates the current row with the given value, in the column with the given handle.
+ *
+ * @param column the handle of the column to set.
+ * @param value the value to insert
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the handle is invalid.
+ */
+int MicroBitLog::_logData(int column, ManagedString value)
+{
+    init();
+
+    if (column < 0 || (uint32_t)column >= columnHandles || columnIndex[column] == MICROBIT_LOG_NO_COLUMN)
+        return DEVICE_INVALID_PARAMETER;
+
+    if (!(status & MICROBIT_LOG_STATUS_ROW_STARTED))
+        _beginRow();
+
+    ManagedString v = cleanBuffer(value.toCharArray(), value.length());
+    ColumnEntry &c = rowData[columnIndex[column]];
+
+    c.value = v.length() ? v : value;
+    c.number[0] = 0;
+
+    return DEVICE_OK;
+}
+
+/**
+ * Declares a column, if it does not already exist, and returns a handle by which it may be populated.
+ * Populating a row through column handles avoids searching for each column by name.
+ *
+ * Handles remain valid until the log is cleared, even as further columns are added.
+ *
+ * @param key the name of the column.
+ *
+ * @return the handle of the column on success, or DEVICE_NO_RESOURCES if there is insufficient memory.
+ */
+int MicroBitLog::getColumn(ManagedString key)
+{
+    int r;
+
+    mutex.wait();
+    r = _getColumn(key);
+    mutex.notify();
+
+    return r;
+}
+
+/**
+ * Declares several columns at once, in order, and returns their handles.
+ *
+ * @param keys the names of the columns.
+ * @param count the number of columns.
+ * @param handles an array of count entries, into which the handle of each column is placed.
+ *
+ * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the arrays are invalid, or DEVICE_NO_RESOURCES if there is insufficient memory.
+ */
+int MicroBitLog::getColumns(const char * const *keys, int count, int *handles)
+{
+    if (keys == NULL || handles == NULL || count < 0)
+        return DEVICE_INVALID_PARAMETER;
+
+    int r = DEVICE_OK;
+
+    mutex.wait();
+
+    for (int i = 0; i < count && r == DEVICE_OK; i++)
+    {
+        handles[i] = _getColumn(ManagedString(keys[i]));
+
+        if (handles[i] < 0)
+            r = handles[i];
+    }
+
+    mutex.notify();
+
+    return r;
+}
+
+/**
+ * Declares a column, if it does not already exist, and returns its handle.
+ *
+ * @param key the name of the column.
+ *
+ * @return the handle of the column on success, or DEVICE_NO_RESOURCES if there is insufficient memory.
+ */
+int MicroBitLog::_getColumn(ManagedString key)
+{
+    init();
+
+    ManagedString k = cleanBuffer(key.toCharArray(), key.length());
+
+    if (k.length())
+        key = k;
+
+    addHeading(key, ManagedString::EmptyString);
+
+    for (uint32_t i=0; i<headingCount; i++)
+        if (rowData[i].key == key)
+            return rowData[i].handle == MICROBIT_LOG_NO_COLUMN ? DEVICE_NO_RESOURCES : rowData[i].handle;
+
+    return DEVICE_NO_RESOURCES;
+}
+
+/**
+ * Populates the current row with the given value, in the column with the given handle.
+ *
+ * @param column the handle of the column to set, as returned by getColumn().
+ * @param value the value to insert
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the handle is invalid.
+ */
+int MicroBitLog::logData(int column, ManagedString value)
+{
+    int r;
+
+    mutex.wait();
+    r = _logData(column, value);
+    mutex.notify();
+
+    return r;
+}
+
+/**
+ * Populates the current row with the given value, in the column with the given handle.
+ *
+ * @param column the handle of the column to set, as returned by getColumn().
+ * @param value the value to insert
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the handle is invalid.
+ */
+int MicroBitLog::logData(int column, const char *value)
+{
+    return logData(column, ManagedString(value));
+}
+
+/**
+ * Populates the current row with the given integer value, in the column with the given handle.
+ *
+ * @param column the handle of the column to set, as returned by getColumn().
+ * @param value the value to insert
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the handle is invalid.
+ */
+int MicroBitLog::logData(int column, int value)
+{
+    char number[MICROBIT_LOG_NUMBER_SIZE];
+    int r;
+
+    logFormatInteger(number, value);
+
+    mutex.wait();
+    r = _logNumber(column, number);
+    mutex.notify();
+
+    return r;
+}
+
+/**
+ * Populates the current row with the given unsigned integer value, in the column with the given handle.
+ *
+ * @param column the handle of the column to set, as returned by getColumn().
+ * @param value the value to insert
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the handle is invalid.
+ */
+int MicroBitLog::logData(int column, unsigned int value)
+{
+    char number[MICROBIT_LOG_NUMBER_SIZE];
+    int r;
+
+    logFormatUnsigned(number, value);
+
+    mutex.wait();
+    r = _logNumber(column, number);
+    mutex.notify();
+
+    return r;
+}
+
+/**
+ * Populates the current row with the given floating point value, in the column with the given handle.
+ *
+ * @param column the handle of the column to set, as returned by getColumn().
+ * @param value the value to insert
+ * @param decimals the number of decimal places to log, up to MICROBIT_LOG_MAX_DECIMALS.
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the handle or number of decimals is invalid.
+ */
+int MicroBitLog::logData(int column, double value, int decimals)
+{
+    char number[MICROBIT_LOG_NUMBER_SIZE];
+    int r;
+
+    if (decimals < 0 || decimals > MICROBIT_LOG_MAX_DECIMALS)
+        return DEVICE_INVALID_PARAMETER;
+
+    logFormatFloat(number, value, decimals);
+
+    mutex.wait();
+    r = _logNumber(column, number);
+    mutex.notify();
+
+    return r;
+}
+
+/**
+ * Complete a row in the log, and pushes to persistent storage.
+ * @return DEVICE_OK on success.
+ */
+int MicroBitLog::endRow()
+{
+    int r;
+
+    mutex.wait();
+    r = _endRow();
+    mutex.notify();
+
+    return r;
+}
+
+/**
+ * Complete a row in the log, and pushes to persistent storage.
+ * @return DEVICE_OK on success.
+ */
+int MicroBitLog::_endRow()
+{
+    if (!(status & MICROBIT_LOG_STATUS_ROW_STARTED))
+        return DEVICE_INVALID_STATE;
+
+    init();
+
+    // Add the timestamp column, if we need one and it does not already exist.
+    // Add at the front, unless data has already been written.
+    if (timeStampChanged)
+    {
+        timeStampChanged = false;
+        if (timeStampFormat != TimeStampFormat::None)
+            addHeading(timeStampHeading, ManagedString::EmptyString, dataStart == dataEnd);
+    }
+
+    // Special case the condition where no values are present.
+    // We suppress injecting a pointless timestamp in these cases.
+    bool validData = false;
+
+    for (uint32_t i=0; i<headingCount; i++)
+    {
+        if(rowData[i].hasValue())
+        {
+            validData = true;
+            break;
+        }
+    }
+
+    // Insert timestamp field if requested.
+    if (validData && timeStampFormat != TimeStampFormat::None)
+    {
+        // Timestamps are in hundredths of the given unit, other than milliseconds.
+        CODAL_TIMESTAMP t = system_timer_current_time() / (CODAL_TIMESTAMP)timeStampFormat;
+        char s[MICROBIT_LOG_NUMBER_SIZE];
+
+        if ((int)timeStampFormat > 1)
+        {
+            int l = logFormatUnsigned(s, t / 100);
+            s[l++] = '.';
+            logFormatUnsigned(&s[l], t % 100, 2);
+        }
+        else
+        {
+            logFormatUnsigned(s, t);
+        }
+
+        _logNumber(timeStampHeading.toCharArray(), s);
+    }
+
+    // If new columns have been added since the last row, update persistent storage accordingly.
+    if (headingsChanged)
+    {
+        // If this is the first time we have logged any headings, place them just after the metadata block
+        if (headingStart == 0)
+            headingStart = startAddress + sizeof(MicroBitLogMetaData);
+
+        // create new headers
+        int length = serializeRow(true);
+
+        if (length < 0)
+            return length;
+
+        ManagedBuffer zero(headingLength);
+
+        // Ensure no staged data is being written while the headings are rewritten.
+        acquireStorage();
+        cache.write(headingStart, &zero[0], headingLength);
+        headingStart += headingLength;
+        cache.write(headingStart, rowBuffer, length);
+        headingLength = length;
+        releaseStorage();
+
+        _logString(rowBuffer);
+
+        headingsChanged = false;
+    }
+
+    // Serialize data to CSV
+    bool empty = true;
+
+    for (uint32_t i=0; i<headingCount;i++)
+    {
+        if (rowData[i].hasValue())
+        {
+            empty = false;
+            break;
+        }
+    }
+
+    if (!empty && logFormat == LogFormat::Binary)
+    {
+        uint32_t rendered;
+        int length;
+
+        if (status & MICROBIT_LOG_STATUS_SERIAL_MIRROR)
+        {
+            length = serializeRow(false);
+
+            if (length < 0)
+                return length;
+
+            mirror(rowBuffer, length);
+        }
+
+        length = serializeBinaryRow(rendered);
+
+        if (length < 0)
+            return length;
+
+        _append(rowBuffer, length, rendered);
     }
+    else if (!empty)
+    {
+        int length = serializeRow(false);
 
-    // If new columns have been added since the last row, update persistent storage accordingly.
-    ManagedString sep = ",";
+        if (length < 0)
+            return length;
 
-    if (headingsChanged)
+        _logString(rowBuffer);
+    }
+
+    status &= ~MICROBIT_LOG_STATUS_ROW_STARTED;
+
+    if (status & MICROBIT_LOG_STATUS_FULL)
+        return DEVICE_NO_RESOURCES;
+
+    return DEVICE_OK;
+}
+
+/**
+ * Serializes either the column headings or the values of the current row into rowBuffer as a line of CSV.
+ * The buffer is only reallocated if the line will not fit, so once it has grown to fit the widest row
+ * no further allocation takes place.
+ *
+ * @param headings true to serialize the column headings, false to serialize the values of the current row.
+ * @return the length of the line, excluding its NULL terminator, or DEVICE_NO_RESOURCES if there is insufficient memory.
+ */
+int MicroBitLog::serializeRow(bool headings)
+{
+    // Each field is followed by a separator or the newline, and the line by a NULL terminator.
+    uint32_t length = headingCount ? 1 : 2;
+
+    for (uint32_t i=0; i<headingCount; i++)
+        length += (headings ? rowData[i].key.length() : rowData[i].getValueLength()) + 1;
+
+    if (reserveRowBuffer(length) != DEVICE_OK)
+        return DEVICE_NO_RESOURCES;
+
+    char *p = rowBuffer;
+
+    for (uint32_t i=0; i<headingCount; i++)
     {
-        // If this is the first time we have logged any headings, place them just after the metadata block
-        if (headingStart == 0)
-            headingStart = startAddress + sizeof(MicroBitLogMetaData);
+        int l = headings ? rowData[i].key.length() : rowData[i].getValueLength();
 
-        // create new headers
-        ManagedString h;
-        ManagedBuffer zero(headingLength);
+        memcpy(p, headings ? rowData[i].key.toCharArray() : rowData[i].getValue(), l);
+        p += l;
+
+        if (i + 1 != headingCount)
+            *p++ = ',';
+    }
+
+    *p++ = '\n';
+    *p = 0;
+
+    return p - rowBuffer;
+}
+
+/**
+ * Ensures rowBuffer holds at least the given number of bytes.
+ *
+ * @param length the number of bytes required.
+ * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if there is insufficient memory.
+ */
+int MicroBitLog::reserveRowBuffer(uint32_t length)
+{
+    if (length > rowBufferSize)
+    {
+        uint32_t size = (length + MICROBIT_LOG_ROW_BUFFER_GRANULARITY - 1) & ~(MICROBIT_LOG_ROW_BUFFER_GRANULARITY - 1);
+        char *b = (char *) malloc(size);
+
+        if (b == NULL)
+            return DEVICE_NO_RESOURCES;
+
+        MICROBIT_HEAP_TRACK(MICROBIT_HEAP_TAG_STORAGE, b);
 
-        for (uint32_t i=0; i<headingCount;i++)
+        if (rowBuffer)
         {
-            h = h + rowData[i].key;
-            if (i + 1 != headingCount)
-                h = h + sep;
+            MICROBIT_HEAP_UNTRACK(MICROBIT_HEAP_TAG_STORAGE, rowBuffer);
+            free(rowBuffer);
         }
-        h = h + "\n";
-        
-        cache.write(headingStart, &zero[0], headingLength);
-        headingStart += headingLength;
-        cache.write(headingStart, h.toCharArray(), h.length());
-        headingLength = h.length();
 
-        _logString(h);
+        rowBuffer = b;
+        rowBufferSize = size;
+    }
+
+    return DEVICE_OK;
+}
 
-        headingsChanged = false;
+/**
+ * Encodes the given text for storage in a binary log, escaping any character of 0x80 or above.
+ *
+ * @param s the text to encode.
+ * @param len the length of the text.
+ * @param out the buffer to write to, of at least twice len bytes.
+ * @return the length of the encoded text.
+ */
+static int encodeText(const char *s, int len, uint8_t *out)
+{
+    uint8_t *p = out;
+
+    for (int i=0; i<len; i++)
+    {
+        uint8_t c = s[i];
+
+        if (c & 0x80)
+        {
+            *p++ = MICROBIT_LOG_BINARY_ESCAPE;
+            c &= 0x7F;
+        }
+
+        *p++ = c;
     }
 
-    // Serialize data to CSV
-    ManagedString row;
-    bool empty = true;
+    return p - out;
+}
 
-    for (uint32_t i=0; i<headingCount;i++)
+/**
+ * Encodes the given formatted number as a binary token, if it can be rendered back to exactly the same text.
+ *
+ * @param s the number to encode, e.g. "-12.50".
+ * @param len the length of the number.
+ * @param out the buffer to write to, of at least MICROBIT_LOG_BINARY_NUMBER_SIZE bytes.
+ * @return the length of the token, or zero if the text cannot be stored as a number.
+ */
+static int encodeNumber(const char *s, int len, uint8_t *out)
+{
+    const char *p = s;
+    const char *end = s + len;
+    bool negative = false;
+    uint64_t magnitude = 0;
+    int digits = 0;
+    int decimals = -1;
+
+    if (p < end && *p == '-')
     {
-        row = row + rowData[i].value;
-         
-        if (rowData[i].value.length())
-            empty = false;
+        negative = true;
+        p++;
+    }
 
-        if (i + 1 != headingCount)
-            row = row + sep;
+    if (p == end || *p < '0' || *p > '9')
+        return 0;
+
+    // Leading zeroes would not be reproduced, so such values are stored as text.
+    if (*p == '0' && p+1 < end && p[1] != '.')
+        return 0;
+
+    for (; p < end; p++)
+    {
+        if (*p == '.')
+        {
+            if (decimals >= 0)
+                return 0;
+
+            decimals = 0;
+            continue;
+        }
+
+        if (*p < '0' || *p > '9' || ++digits > MICROBIT_LOG_BINARY_MAX_DIGITS)
+            return 0;
+
+        magnitude = magnitude * 10 + (*p - '0');
+
+        if (decimals >= 0)
+            decimals++;
     }
-    row = row + "\n";
 
-    if (!empty)
-        _logString(row);
+    if (decimals == 0 || decimals > 15)
+        return 0;
 
-    status &= ~MICROBIT_LOG_STATUS_ROW_STARTED;
+    if (decimals < 0)
+        decimals = 0;
 
-    if (status & MICROBIT_LOG_STATUS_FULL)
+    uint8_t groups[MICROBIT_LOG_BINARY_NUMBER_SIZE - 1];
+    int g = 0;
+    int n = 0;
+
+    do {
+        groups[g++] = magnitude & 0x7F;
+        magnitude >>= 7;
+    } while (magnitude);
+
+    out[n++] = (negative ? MICROBIT_LOG_BINARY_NEGATIVE : MICROBIT_LOG_BINARY_POSITIVE) + decimals;
+
+    while (g)
+        out[n++] = groups[--g];
+
+    return n;
+}
+
+/**
+ * Serializes the values of the current row into rowBuffer as a binary record.
+ *
+ * @param rendered set to the length of the row when rendered as CSV.
+ * @return the length of the record, or DEVICE_NO_RESOURCES if there is insufficient memory.
+ */
+int MicroBitLog::serializeBinaryRow(uint32_t &rendered)
+{
+    // Each field is at most a tag and its escaped text, or an encoded number. The row is followed by its terminator.
+    uint32_t length = 1;
+
+    for (uint32_t i=0; i<headingCount; i++)
+        length += max(MICROBIT_LOG_BINARY_NUMBER_SIZE, 1 + 2 * rowData[i].getValueLength());
+
+    if (reserveRowBuffer(length) != DEVICE_OK)
         return DEVICE_NO_RESOURCES;
 
-    return DEVICE_OK;
+    uint8_t *p = (uint8_t *)rowBuffer;
+    rendered = headingCount;
+
+    for (uint32_t i=0; i<headingCount; i++)
+    {
+        const char *v = rowData[i].getValue();
+        int l = rowData[i].getValueLength();
+        int n = 0;
+
+        rendered += l;
+
+        if (l == 0)
+        {
+            // Store consecutive empty fields as a single tag, as rows of wide tables often populate only a few columns.
+            int run = 1;
+
+            while (run < MICROBIT_LOG_BINARY_EMPTY_RUN_MAX && i + 1 < headingCount && rowData[i + 1].getValueLength() == 0)
+            {
+                run++;
+                i++;
+            }
+
+            *p++ = MICROBIT_LOG_BINARY_EMPTY + run - 1;
+            continue;
+        }
+
+        n = encodeNumber(v, l, p);
+
+        if (n == 0)
+        {
+            *p++ = MICROBIT_LOG_BINARY_TEXT;
+            n = encodeText(v, l, p);
+        }
+
+        p += n;
+    }
+
+    *p++ = MICROBIT_LOG_BINARY_ROW_END;
+
+    return p - (uint8_t *)rowBuffer;
 }
 
 /**
@@ -723,17 +1941,152 @@ int MicroBitLog::_logString(const char *s)
 {  
     init();
 
-    uint32_t oldDataEnd = dataEnd;
     uint32_t l = strlen(s);
     const char *data = s;
 
+    // If we can't write a whole line of data, then treat the log as full.
+    if (!(status & MICROBIT_LOG_STATUS_ROLLING) && l > logEnd - dataEnd - writeBehindLength)
+    {
+        int r;
+
+        acquireStorage();
+        r = _writeData(data, l);
+        releaseStorage();
+
+        return r;
+    }
+
+    ManagedString cleaned = cleanBuffer(data, l, false);
+    if (cleaned.length())
+        data = cleaned.toCharArray();
+
+    // If requested, log the data over the serial port
+    mirror(data, l);
+
+    // In a binary log, characters that could be mistaken for binary tokens must be escaped.
+    if (logFormat == LogFormat::Binary)
+    {
+        uint32_t escaped = 0;
+
+        for (uint32_t i=0; i<l; i++)
+            if (data[i] & 0x80)
+                escaped++;
+
+        if (escaped)
+        {
+            uint8_t *b = (uint8_t *) malloc(l + escaped);
+
+            if (b == NULL)
+                return DEVICE_NO_RESOURCES;
+
+            encodeText(data, l, b);
+
+            int r = _append((const char *)b, l + escaped, l);
+            free(b);
+
+            return r;
+        }
+    }
+
+    return _append(data, l, l);
+}
+
+/**
+ * Sends the given line of CSV over the serial port, if serial mirroring is enabled.
+ *
+ * @param data the line, including its trailing newline.
+ * @param l the length of the line.
+ */
+void MicroBitLog::mirror(const char *data, uint32_t l)
+{
+    if (status & MICROBIT_LOG_STATUS_SERIAL_MIRROR && l > 0)
+    {
+        serial.sendLine((uint8_t *)data, l-1);
+    }
+}
+
+/**
+ * Appends the given data to the log, staging it if write-behind buffering is enabled.
+ *
+ * @param data the data to append.
+ * @param l the number of bytes to append.
+ * @param rendered the length of the data when rendered as CSV.
+ *
+ * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if the log is full.
+ */
+int MicroBitLog::_append(const char *data, uint32_t l, uint32_t rendered)
+{
+    int r;
+
+    // Identify a binary log by a row terminator at the start of its data.
+    if (logFormat == LogFormat::Binary && dataStart == dataEnd && writeBehindLength == 0)
+    {
+        char marker = MICROBIT_LOG_BINARY_ROW_END;
+
+        r = _append(&marker, 1, 0);
+
+        if (r != DEVICE_OK)
+            return r;
+    }
+
+    // If write-behind is enabled, stage the data for the background fiber to write.
+    // Data that will not fit in the log is passed through, so that the log is marked as full.
+    if (writeBehindBuffer && l <= CONFIG_MICROBIT_LOG_WRITE_BEHIND_SIZE && ((status & MICROBIT_LOG_STATUS_ROLLING) || l <= logEnd - dataEnd - writeBehindLength))
+    {
+        // If there's no room, wait for the staged data to be written.
+        if (l > CONFIG_MICROBIT_LOG_WRITE_BEHIND_SIZE - writeBehindLength)
+            _sync();
+
+        while (l > 0)
+        {
+            uint32_t lengthToCopy = min(l, CONFIG_MICROBIT_LOG_WRITE_BEHIND_SIZE - writeBehindHead);
+
+            memcpy(&writeBehindBuffer[writeBehindHead], data, lengthToCopy);
+            writeBehindHead = (writeBehindHead + lengthToCopy) % CONFIG_MICROBIT_LOG_WRITE_BEHIND_SIZE;
+            writeBehindLength += lengthToCopy;
+            data += lengthToCopy;
+            l -= lengthToCopy;
+        }
+
+        if (writeBehindLength >= writeBehindHighWater)
+            Event(MICROBIT_ID_LOG, MICROBIT_LOG_EVT_FLUSH);
+
+        csvLength += rendered;
+        return DEVICE_OK;
+    }
+
+    // Otherwise, write through to flash, after any data that is already staged.
+    acquireStorage();
+    r = _writeData(data, l);
+    releaseStorage();
+
+    if (r == DEVICE_OK)
+        csvLength += rendered;
+    else
+        status &= ~MICROBIT_LOG_STATUS_CSV_LENGTH;
+
+    return r;
+}
+
+/**
+ * Writes the given data to the end of the log in flash, updating the journal as required.
+ *
+ * @param data the data to write.
+ * @param l the number of bytes to write.
+ *
+ * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if the log is full.
+ */
+int MicroBitLog::_writeData(const char *data, uint32_t l)
+{
+    uint32_t oldDataEnd = dataEnd;
+
     // If this is the first log entry written, ensure that the file visibility is activated.
     // (it may have been disabled following a full erase)
-    if (dataStart == dataEnd)
+    if (dataStart == dataEnd && !rollCount)
         _setVisibility(true);
 
-    // If we can't write a whole line of data, then treat the log as full.
-    if (l > logEnd - dataEnd)
+    // If we can't write a whole line of data, then treat the log as full. Rolling logs never fill.
+    if (!(status & MICROBIT_LOG_STATUS_ROLLING) && l > logEnd - dataEnd)
     {
         if (!(status & MICROBIT_LOG_STATUS_FULL))
         {
@@ -745,17 +2098,6 @@ int MicroBitLog::_logString(const char *s)
         return DEVICE_NO_RESOURCES;
     }
 
-    ManagedString cleaned = cleanBuffer(data, l, false);
-    if (cleaned.length())
-        data = cleaned.toCharArray();
-
-    // If requested, log the data over the serial port
-    if (status & MICROBIT_LOG_STATUS_SERIAL_MIRROR && l > 0)
-    {
-        serial.send((uint8_t *)data, l-1);
-        serial.send((uint8_t *)"\r\n", 2);
-    }
-
     while (l > 0)
     {
         uint32_t spaceOnPage = flash.getPageSize() - (dataEnd % flash.getPageSize());
@@ -765,10 +2107,15 @@ int MicroBitLog::_logString(const char *s)
         // If we're going to fill (or overspill) the current page, erase the next one ready for use.
         if (spaceOnPage <= l && dataEnd+spaceOnPage < logEnd)
         {
-            uint32_t nextPage = ((dataEnd / flash.getPageSize()) + 1) * flash.getPageSize();
+            uint32_t next = ((dataEnd / flash.getPageSize()) + 1) * flash.getPageSize();
 
-            //DMESG("   ERASING PAGE %p", nextPage);
-            flash.erase(nextPage);
+            // Unless it has already been erased in the background.
+            if (next >= erasedEnd)
+            {
+                //DMESG("   ERASING PAGE %p", next);
+                erasePage(ringAddress(next));
+                erasedEnd = next + flash.getPageSize();
+            }
         }
 
         // Perform a write through cache update
@@ -779,6 +2126,14 @@ int MicroBitLog::_logString(const char *s)
         dataEnd += lengthToWrite;
         data += lengthToWrite;
         l -= lengthToWrite;
+
+        // A rolling log wraps around to the start of the data section, into the page erased above.
+        if ((status & MICROBIT_LOG_STATUS_ROLLING) && dataEnd == ringEnd)
+        {
+            dataEnd = dataStart;
+            erasedEnd = erasedEnd > ringEnd ? erasedEnd - (ringEnd - dataStart) : dataStart;
+            rollCount = rollCount == 0xFF ? 1 : rollCount + 1;
+        }
     }
 
     // Write a new entry into the log journal if we crossed a cache block boundary
@@ -806,10 +2161,16 @@ int MicroBitLog::_logString(const char *s)
             flash.erase(journalHead);
         }
 
+        // The cache writes its blocks out in slot order, not the order they were changed. Write the data out before the
+        // journal entry that covers it, and that entry before the old one is invalidated, so that a power loss leaves
+        // the journal describing data that is in flash.
+        cache.flush();
+
         // Write journal entry
         JournalEntry je;
-        writeNum(je.length, ((dataEnd-dataStart) / CONFIG_MICROBIT_LOG_CACHE_BLOCK_SIZE) * CONFIG_MICROBIT_LOG_CACHE_BLOCK_SIZE);
+        writeNum(je.length, (rollCount << MICROBIT_LOG_ROLL_SHIFT) + ((dataEnd-dataStart) / CONFIG_MICROBIT_LOG_CACHE_BLOCK_SIZE) * CONFIG_MICROBIT_LOG_CACHE_BLOCK_SIZE);
         cache.write(journalHead, &je, MICROBIT_LOG_JOURNAL_ENTRY_SIZE);
+        cache.flush();
 
         // Invalidate the old one
         JournalEntry empty;
@@ -818,6 +2179,17 @@ int MicroBitLog::_logString(const char *s)
         cache.write(oldJournalHead, &empty, MICROBIT_LOG_JOURNAL_ENTRY_SIZE);
     }
 
+    // Once past half way through a page, have the background fiber erase ahead, so that crossing into the next page
+    // does not wait for an erase. Waiting until then avoids repeating erases on logs that are mounted for only a few writes.
+    uint32_t pageSize = flash.getPageSize();
+
+    if (CONFIG_MICROBIT_LOG_PRE_ERASE_PAGES > 0 && !(status & MICROBIT_LOG_STATUS_PRE_ERASE) &&
+        dataEnd % pageSize >= pageSize / 2 && ((status & MICROBIT_LOG_STATUS_ROLLING) || erasedEnd < logEnd) && erasedEnd < ((dataEnd / pageSize) + 1 + CONFIG_MICROBIT_LOG_PRE_ERASE_PAGES) * pageSize)
+    {
+        status |= MICROBIT_LOG_STATUS_PRE_ERASE;
+        Event(MICROBIT_ID_LOG, MICROBIT_LOG_EVT_PRE_ERASE);
+    }
+
     // Return NO_RESOURCES if we ran out of FLASH space.
     if (l == 0)
         return DEVICE_OK;
@@ -864,31 +2236,105 @@ void MicroBitLog::addHeading(ManagedString key, ManagedString value, bool head)
         if (rowData[i].key == key)
             return;
 
-    ColumnEntry* newRowData = (ColumnEntry *) malloc(sizeof(ColumnEntry) * (headingCount+1));
-    int columnShift = head ? 1 : 0;
+    // Grow our collection of columns geometrically, so that adding columns one by one does not cost quadratic time.
+    if (headingCount == headingCapacity)
+    {
+        uint32_t capacity = headingCapacity ? headingCapacity * 2 : MICROBIT_LOG_INITIAL_COLUMNS;
+        ColumnEntry* newRowData = (ColumnEntry *) malloc(sizeof(ColumnEntry) * capacity);
+
+        if (newRowData == NULL)
+            return;
+
+        MICROBIT_HEAP_TRACK(MICROBIT_HEAP_TAG_STORAGE, newRowData);
+
+        for (uint32_t i=0; i<headingCount; i++)
+        {
+            new (&newRowData[i]) ColumnEntry;
+            newRowData[i] = rowData[i];
+            rowData[i].key = ManagedString::EmptyString;
+            rowData[i].value = ManagedString::EmptyString;
+        }
+
+        if (rowData)
+        {
+            MICROBIT_HEAP_UNTRACK(MICROBIT_HEAP_TAG_STORAGE, rowData);
+            free(rowData);
+        }
+
+        rowData = newRowData;
+        headingCapacity = capacity;
+    }
+
+    uint16_t handle = newColumnHandle();
+
+    if (handle == MICROBIT_LOG_NO_COLUMN)
+        return;
+
+    new (&rowData[headingCount]) ColumnEntry;
+
+    // Make room at the front, if requested.
     int newColumn = head ? 0 : headingCount;
 
-    for (uint32_t i=0; i<headingCount; i++)
-    {
-        new (&newRowData[i+columnShift]) ColumnEntry;
-        newRowData[i+columnShift].key = rowData[i].key;
-        newRowData[i+columnShift].value = rowData[i].value;
-        rowData[i].key = ManagedString::EmptyString;
-        rowData[i].value = ManagedString::EmptyString;
-    }   
-    
-    if (rowData)
-        free(rowData);
+    for (int i=headingCount; i>newColumn; i--)
+        rowData[i] = rowData[i-1];
 
-    new (&newRowData[newColumn]) ColumnEntry;
-    newRowData[newColumn].key = key;
-    newRowData[newColumn].value = value;
+    rowData[newColumn].key = key;
+    rowData[newColumn].value = value;
+    rowData[newColumn].number[0] = 0;
+    rowData[newColumn].handle = handle;
     headingCount++;
 
-    rowData = newRowData;
+    indexColumns();
     headingsChanged = true;
 }
 
+/**
+ * Issues a new column handle, growing columnIndex if necessary.
+ *
+ * @return the new handle, or MICROBIT_LOG_NO_COLUMN if there is insufficient memory.
+ */
+uint16_t MicroBitLog::newColumnHandle()
+{
+    if (columnHandles >= MICROBIT_LOG_NO_COLUMN)
+        return MICROBIT_LOG_NO_COLUMN;
+
+    if (columnHandles == columnIndexSize)
+    {
+        uint32_t size = columnIndexSize ? columnIndexSize * 2 : MICROBIT_LOG_INITIAL_COLUMNS;
+        uint16_t *newIndex = (uint16_t *) malloc(sizeof(uint16_t) * size);
+
+        if (newIndex == NULL)
+            return MICROBIT_LOG_NO_COLUMN;
+
+        MICROBIT_HEAP_TRACK(MICROBIT_HEAP_TAG_STORAGE, newIndex);
+
+        if (columnIndex)
+        {
+            memcpy(newIndex, columnIndex, sizeof(uint16_t) * columnHandles);
+            MICROBIT_HEAP_UNTRACK(MICROBIT_HEAP_TAG_STORAGE, columnIndex);
+            free(columnIndex);
+        }
+
+        columnIndex = newIndex;
+        columnIndexSize = size;
+    }
+
+    return columnHandles++;
+}
+
+/**
+ * Rebuilds columnIndex, following any change in the position of columns in rowData.
+ */
+void MicroBitLog::indexColumns()
+{
+    for (uint32_t h=0; h<columnHandles; h++)
+        columnIndex[h] = MICROBIT_LOG_NO_COLUMN;
+
+    for (uint32_t i=0; i<headingCount; i++)
+        if (rowData[i].handle != MICROBIT_LOG_NO_COLUMN)
+            columnIndex[rowData[i].handle] = i;
+}
+
 /**
  * Marks an existing Log as invalid. The log will be cleared with the default settings the next time
  * a user attempts to use it. If no valid log is present, this method has no effect.
@@ -896,7 +2342,9 @@ void MicroBitLog::addHeading(ManagedString key, ManagedString value, bool head)
 void MicroBitLog::invalidate()
 {
     mutex.wait();
+    acquireStorage();
     _invalidate();
+    releaseStorage();
     mutex.notify();
 }
 
@@ -933,7 +2381,9 @@ bool MicroBitLog::isPresent()
 {
     bool r;
     mutex.wait();
+    flushLock.wait();
     r = _isPresent();
+    flushLock.notify();
     mutex.notify();
 
     return r;
@@ -989,6 +2439,64 @@ bool MicroBitLog::isFull()
     return (status & MICROBIT_LOG_STATUS_FULL);
 }
 
+/**
+ * Determines how much of the space available for data the log is using.
+ * A log is not created if none is present.
+ *
+ * @return the percentage of the data area in use, from 0 to 100, or DEVICE_NO_DATA if no log is present.
+ * A rolling log that has wrapped around is reported as 100.
+ */
+int MicroBitLog::getFillLevel()
+{
+    mutex.wait();
+
+    flushLock.wait();
+    bool present = _isPresent();
+    flushLock.notify();
+
+    if (!present)
+    {
+        mutex.notify();
+        return DEVICE_NO_DATA;
+    }
+
+    init();
+
+    uint32_t total = logEnd - dataStart;
+    uint32_t used = (rollCount || (status & MICROBIT_LOG_STATUS_FULL)) ? total : dataEnd - dataStart;
+
+    mutex.notify();
+
+    return total ? (int)(((uint64_t)used * 100) / total) : 0;
+}
+
+/**
+ * Retrieves the hit, miss and eviction counts of the cache in front of flash storage.
+ * Each miss costs a read of one cache block from the interface chip.
+ *
+ * @return the cache statistics since the log was created.
+ */
+FSCacheStatistics MicroBitLog::getCacheStatistics()
+{
+    return cache.getStatistics();
+}
+
+/**
+ * Shares the RAM used to cache flash storage with other caches, within the budget of the given pool.
+ * By default, the log's cache holds up to four blocks of its own. Blocks held in the cache are written out first.
+ *
+ * @param pool the pool to join, or NULL to return to a cache of the log's own.
+ * @param priority the pages of the caches in a pool with the lowest priority are taken first.
+ */
+void MicroBitLog::setCachePool(FSCachePool *pool, int priority)
+{
+    mutex.wait();
+    flushLock.wait();
+    cache.setPool(pool, priority);
+    flushLock.notify();
+    mutex.notify();
+}
+
 /**
  * Get the length of the recorded data
  * @param format the data format
@@ -1002,9 +2510,10 @@ uint32_t MicroBitLog::getDataLength(DataFormat format)
     uint32_t r = 0;
     mutex.wait();
     init();
+    acquireStorage();
     uint32_t hdr = sizeof(header);
     uint32_t mtr = sizeof(MicroBitLogMetaData);
-    uint32_t csv = dataEnd - dataStart;
+    uint32_t csv = _dataLength();
     switch (format)
     {
         case DataFormat::HTMLHeader:
@@ -1017,6 +2526,7 @@ uint32_t MicroBitLog::getDataLength(DataFormat format)
             r = csv;
             break;
     }
+    releaseStorage();
     mutex.notify();
     return r;
 }
@@ -1037,11 +2547,141 @@ int MicroBitLog::readData(void *data, uint32_t index, uint32_t len, DataFormat f
 {
     int r;
     mutex.wait();
+    init();
+    acquireStorage();
     r = _readData((uint8_t *) data, index, len, format, length);
+    releaseStorage();
     mutex.notify();
     return r;
 }
 
+/**
+ * Prepares a cursor to read the recorded data sequentially, from the beginning.
+ * @param cursor the cursor to open
+ * @param format the data format
+ *          DataFormat::HTMLHeader = 0,   - The HTML header without data
+ *          DataFormat::HTML = 1,               - The entire HTML file with data
+ *          DataFormat::CSV = 2                   - CSV data
+ * @param length expected complete length returned from getDataLength, or zero to use the current length
+ * @return DEVICE_OK on success
+ */
+int MicroBitLog::openCursor(MicroBitLogCursor &cursor, DataFormat format, uint32_t length)
+{
+    cursor.format = format;
+    cursor.length = length ? length : getDataLength(format);
+    cursor.index = 0;
+    cursor.blockIndex = 0;
+    cursor.blockLength = 0;
+    cursor.open = true;
+
+    return DEVICE_OK;
+}
+
+/**
+ * Read the recorded data from the position of the given cursor, and advance the cursor.
+ * Whole blocks of CONFIG_MICROBIT_LOG_CACHE_BLOCK_SIZE bytes are read ahead into the cursor, so that
+ * subsequent small reads do not access the log.
+ * @param cursor an open cursor
+ * @param data pointer to memory to store the data
+ * @param len length of the data to fetch
+ * @return the number of bytes read, which is less than len only at the end of the data;
+ * DEVICE_INVALID_STATE if the cursor is not open; DEVICE_INVALID_PARAMETER if data is not available for the request
+ */
+int MicroBitLog::read(MicroBitLogCursor &cursor, void *data, uint32_t len)
+{
+    uint8_t *p = (uint8_t *) data;
+    int count = 0;
+
+    if (!cursor.open)
+        return DEVICE_INVALID_STATE;
+
+    while (len && cursor.index < cursor.length)
+    {
+        // If the cursor has moved outside of the block it holds, read the block containing it.
+        if (cursor.index < cursor.blockIndex || cursor.index >= cursor.blockIndex + cursor.blockLength)
+        {
+            uint32_t start = cursor.index - (cursor.index % CONFIG_MICROBIT_LOG_CACHE_BLOCK_SIZE);
+            uint32_t l = min(cursor.length - start, (uint32_t)CONFIG_MICROBIT_LOG_CACHE_BLOCK_SIZE);
+
+            cursor.blockLength = 0;
+
+            int r = readData(cursor.block, start, l, cursor.format, cursor.length);
+            if (r != DEVICE_OK)
+                return r;
+
+            cursor.blockIndex = start;
+            cursor.blockLength = l;
+        }
+
+        uint32_t offset = cursor.index - cursor.blockIndex;
+        uint32_t l = min(len, cursor.blockLength - offset);
+
+        memcpy(p, &cursor.block[offset], l);
+        p += l;
+        len -= l;
+        count += l;
+        cursor.index += l;
+    }
+
+    return count;
+}
+
+/**
+ * Determines the sequence number of the end of the log: the number of bytes stored since the log was last
+ * cleared, including any staged data. It increases with every row added, including when a rolling log
+ * discards its oldest data, so a host can tell whether anything has been added since it last looked.
+ * A value lower than one seen previously means the log has been cleared.
+ *
+ * @return the sequence number.
+ */
+uint32_t MicroBitLog::getSequence()
+{
+    mutex.wait();
+    init();
+
+    // Each time a rolling log wraps around, a whole ring of data has been written. rollCount wraps at 255,
+    // but by then the sequence number has passed through the whole of its range many times over.
+    uint32_t sequence = rollCount * (ringEnd - dataStart) + (dataEnd - dataStart) + writeBehindLength;
+
+    mutex.notify();
+    return sequence;
+}
+
+/**
+ * Calculates the CRC32 of part of the recorded data, as read through readData(), so that a host
+ * can check whether a copy it already holds is still current without reading it again.
+ * @param crc set to the CRC32 of the data
+ * @param index  the index into the data
+ * @param len length of the data to include
+ * @param format the data format
+ *          DataFormat::HTMLHeader = 0,   - The HTML header without data
+ *          DataFormat::HTML = 1,               - The entire HTML file with data
+ *          DataFormat::CSV = 2                   - CSV data
+ * @param length expected complete length returned from getDataLength
+ * @return DEVICE_OK on success; DEVICE_INVALID_PARAMETER if data is not available for the request
+ */
+int MicroBitLog::getCRC(uint32_t &crc, uint32_t index, uint32_t len, DataFormat format, uint32_t length)
+{
+    uint8_t block[CONFIG_MICROBIT_LOG_CACHE_BLOCK_SIZE];
+
+    crc = 0;
+
+    while (len)
+    {
+        uint32_t l = min(len, (uint32_t)sizeof(block));
+
+        int r = readData(block, index, l, format, length);
+        if (r != DEVICE_OK)
+            return r;
+
+        crc = crc32_compute(block, l, &crc);
+        index += l;
+        len -= l;
+    }
+
+    return DEVICE_OK;
+}
+
 int MicroBitLog::_readData(uint8_t *data, uint32_t index, uint32_t len, DataFormat format, uint32_t length)
 {
     int r = DEVICE_OK;
@@ -1052,7 +2692,8 @@ int MicroBitLog::_readData(uint8_t *data, uint32_t index, uint32_t len, DataForm
     uint32_t mtr = sizeof(MicroBitLogMetaData);
 
     // Check if there is less data than expected
-    uint32_t dataMax = dataEnd - dataStart;
+    bool rendered = logFormat == LogFormat::Binary || isRolled();
+    uint32_t dataMax = _dataLength();
     uint32_t dataLen = dataMax;
     switch (format)
     {
@@ -1089,12 +2730,18 @@ int MicroBitLog::_readData(uint8_t *data, uint32_t index, uint32_t len, DataForm
         case DataFormat::HTML:
             _readSource( data, index, len, pos, header, 0, hdr);
             _readSource( data, index, len, pos, &meta,  0, mtr);
-            r = _readSource( data, index, len, pos, NULL, dataStart, dataLen);
+            if (rendered)
+                r = _readRendered( data, index, len, pos, dataLen);
+            else
+                r = _readSource( data, index, len, pos, NULL, dataStart, dataLen);
             if (r == DEVICE_OK)
               _readSource( data, index, len, pos, &end, 0, sizeof(end));
             break;
         case DataFormat::CSV:
-            r = _readSource( data, index, len, pos, NULL, dataStart, dataLen);
+            if (rendered)
+                r = _readRendered( data, index, len, pos, dataLen);
+            else
+                r = _readSource( data, index, len, pos, NULL, dataStart, dataLen);
             break;
     }
     return r;
@@ -1139,12 +2786,340 @@ int MicroBitLog::_readSource( uint8_t *&data, uint32_t &index, uint32_t &len, ui
     return r;
 }
 
+/**
+ * Read the data of a binary or rolled log, rendered as CSV
+ * @param data pointer reference to memory to store the data
+ * @param index  reference to the index into the data
+ * @param len reference to the length of the data to fetch
+ * @param srcIndex reference to the index where the rendered data should begin
+ * @param srcLen the length of the rendered data
+ * @return DEVICE_OK on success; DEVICE_INVALID_PARAMETER if data is not available for the request
+ * @note On success, the referenced pointers, indices and lengths are updated ready for the next call
+ */
+int MicroBitLog::_readRendered( uint8_t *&data, uint32_t &index, uint32_t &len, uint32_t &srcIndex, uint32_t srcLen)
+{
+    int r = DEVICE_OK;
+    uint32_t next = srcIndex + srcLen;
+    uint32_t length = index < next ? next - index : 0;
+    if ( length > len)
+        length = len;
+
+    if ( length)
+        r = renderData(index - srcIndex, data, length);
+
+    if ( r == DEVICE_OK)
+    {
+        data    += length;
+        index   += length;
+        len     -= length;
+
+        srcIndex = next;
+    }
+    return r;
+}
+
+/**
+ * Renders part of the data of a binary log as CSV. Reads that follow on from the previous one resume
+ * where it finished; otherwise, the data is decoded from its start. Rolled CSV logs are rendered by renderRolled().
+ *
+ * @param offset the offset into the rendered CSV of the first character to read.
+ * @param data the buffer to fill.
+ * @param len the number of characters to read.
+ * @return DEVICE_OK on success; DEVICE_INVALID_PARAMETER if data is not available for the request
+ */
+int MicroBitLog::renderData(uint32_t offset, uint8_t *data, uint32_t len)
+{
+    char token[MICROBIT_LOG_TOKEN_SIZE];
+
+    if (logFormat != LogFormat::Binary)
+        return renderRolled(offset, data, len);
+
+    if (decoder.address < dataStart || offset < decoder.offset)
+    {
+        decoder.address = dataStart;
+        decoder.offset = 0;
+        decoder.inRow = false;
+    }
+
+    while (len)
+    {
+        if (decoder.address >= dataEnd)
+            return DEVICE_INVALID_PARAMETER;
+
+        LogDecoder next = decoder;
+        uint32_t end = decoder.offset + renderToken(next, token);
+
+        // Copy whatever part of this token was requested.
+        if (end > offset)
+        {
+            uint32_t skip = offset - decoder.offset;
+            uint32_t length = min(end - offset, len);
+
+            memcpy(data, &token[skip], length);
+            data += length;
+            offset += length;
+            len -= length;
+        }
+
+        // Only move past tokens that have been consumed completely, so the next read can resume from here.
+        if (end > offset)
+            break;
+
+        decoder = next;
+        decoder.offset = end;
+    }
+
+    return DEVICE_OK;
+}
+
+/**
+ * Decodes the next token of a binary log, and renders it as CSV.
+ *
+ * @param d the decoder state, updated to follow the token. The offset is not changed.
+ * @param out a buffer of MICROBIT_LOG_TOKEN_SIZE characters, to hold the rendered token.
+ * @return the length of the rendered token.
+ */
+int MicroBitLog::renderToken(LogDecoder &d, char *out)
+{
+    uint8_t c;
+    int l = 0;
+
+    cache.read(d.address++, &c, 1);
+
+    // Plain characters, and escaped characters, are rendered as they are.
+    if (c < 0x80)
+    {
+        out[0] = c;
+        return 1;
+    }
+
+    if (c == MICROBIT_LOG_BINARY_ESCAPE)
+    {
+        if (d.address < dataEnd)
+            cache.read(d.address++, &c, 1);
+
+        out[0] = c | 0x80;
+        return 1;
+    }
+
+    if (c == MICROBIT_LOG_BINARY_ROW_END)
+    {
+        if (!d.inRow)
+            return 0;
+
+        d.inRow = false;
+        out[0] = '\n';
+        return 1;
+    }
+
+    // Anything else begins a field.
+    if (d.inRow)
+        out[l++] = ',';
+
+    d.inRow = true;
+
+    // A run of empty fields renders the separators of the fields that follow the first.
+    if (c > MICROBIT_LOG_BINARY_EMPTY && c < MICROBIT_LOG_BINARY_EMPTY + MICROBIT_LOG_BINARY_EMPTY_RUN_MAX)
+    {
+        for (int i = MICROBIT_LOG_BINARY_EMPTY; i < c; i++)
+            out[l++] = ',';
+
+        return l;
+    }
+
+    if (c >= MICROBIT_LOG_BINARY_POSITIVE && c < MICROBIT_LOG_BINARY_NEGATIVE + 16)
+    {
+        int decimals = c & 0x0F;
+        uint64_t magnitude = 0;
+        uint8_t g;
+
+        if (c >= MICROBIT_LOG_BINARY_NEGATIVE)
+            out[l++] = '-';
+
+        for (int i=0; i < MICROBIT_LOG_BINARY_NUMBER_SIZE - 1 && d.address < dataEnd; i++)
+        {
+            cache.read(d.address, &g, 1);
+
+            if (g & 0x80)
+                break;
+
+            magnitude = (magnitude << 7) | g;
+            d.address++;
+        }
+
+        // Render at least one digit before the decimal point, then insert it before the last decimals digits.
+        int digits = logFormatUnsigned(&out[l], magnitude, decimals + 1);
+
+        if (decimals)
+        {
+            memmove(&out[l + digits - decimals + 1], &out[l + digits - decimals], decimals);
+            out[l + digits - decimals] = '.';
+            l++;
+        }
+
+        l += digits;
+    }
+
+    // Empty fields and text fields render only their separator. The characters of text fields follow as plain characters.
+    return l;
+}
+
+/**
+ * Determines the length of the data when rendered as CSV, decoding the whole log if necessary.
+ *
+ * @return the length of the rendered data.
+ */
+uint32_t MicroBitLog::_csvLength()
+{
+    if (!(status & MICROBIT_LOG_STATUS_CSV_LENGTH))
+    {
+        char token[MICROBIT_LOG_TOKEN_SIZE];
+        LogDecoder d;
+
+        d.address = dataStart;
+        d.offset = 0;
+        d.inRow = false;
+
+        while (d.address < dataEnd)
+            d.offset += renderToken(d, token);
+
+        csvLength = d.offset;
+        status |= MICROBIT_LOG_STATUS_CSV_LENGTH;
+    }
+
+    return csvLength;
+}
+
+/**
+ * Determines the length of the data when read through readData().
+ *
+ * @return the length of the data, rendered as CSV.
+ */
+uint32_t MicroBitLog::_dataLength()
+{
+    if (logFormat == LogFormat::Binary)
+        return _csvLength();
+
+    if (!isRolled())
+        return dataEnd - dataStart;
+
+    // Find the end of the partial row at the start of the data, whose beginning has been discarded.
+    if (!(status & MICROBIT_LOG_STATUS_ROLL_SKIP))
+    {
+        uint8_t chunk[MICROBIT_LOG_SCAN_CHUNK_SIZE];
+        uint32_t length = storedLength();
+
+        rollSkip = 0;
+        while (rollSkip < length)
+        {
+            uint32_t l = min(length - rollSkip, (uint32_t)MICROBIT_LOG_SCAN_CHUNK_SIZE);
+            uint32_t i = 0;
+
+            readStored(rollSkip, chunk, l);
+
+            while (i < l && chunk[i] != '\n')
+                i++;
+
+            rollSkip += i;
+
+            if (i < l)
+            {
+                rollSkip++;
+                break;
+            }
+        }
+
+        status |= MICROBIT_LOG_STATUS_ROLL_SKIP;
+    }
+
+    return headingLength + storedLength() - rollSkip;
+}
+
+/**
+ * Determines the number of bytes held, from the oldest data to dataEnd.
+ *
+ * @return the length of the stored data.
+ */
+uint32_t MicroBitLog::storedLength()
+{
+    if (oldest > dataEnd)
+        return (ringEnd - oldest) + (dataEnd - dataStart);
+
+    return dataEnd - oldest;
+}
+
+/**
+ * Reads stored data, in the order it was written, from the oldest data onwards.
+ *
+ * @param offset the offset from the oldest data held.
+ * @param data the buffer to fill.
+ * @param len the number of bytes to read.
+ * @return DEVICE_OK on success, or the error returned by the cache.
+ */
+int MicroBitLog::readStored(uint32_t offset, uint8_t *data, uint32_t len)
+{
+    uint32_t address = ringAddress(oldest + offset);
+
+    while (len)
+    {
+        // Data held before the end of the ring continues from the start of the data section.
+        uint32_t l = address < ringEnd ? min(len, ringEnd - address) : len;
+        int r = cache.read(address, data, l);
+
+        if (r != DEVICE_OK)
+            return r;
+
+        address = ringAddress(address + l);
+        data += l;
+        len -= l;
+    }
+
+    return DEVICE_OK;
+}
+
+/**
+ * Renders part of the data of a rolled log as CSV: the current headings, followed by the stored data
+ * from the first complete row onwards.
+ *
+ * @param offset the offset into the rendered CSV of the first character to read.
+ * @param data the buffer to fill.
+ * @param len the number of characters to read.
+ * @return DEVICE_OK on success; DEVICE_INVALID_PARAMETER if data is not available for the request
+ */
+int MicroBitLog::renderRolled(uint32_t offset, uint8_t *data, uint32_t len)
+{
+    if (offset + len > _dataLength())
+        return DEVICE_INVALID_PARAMETER;
+
+    if (offset < headingLength)
+    {
+        uint32_t l = min(len, headingLength - offset);
+
+        cache.read(headingStart + offset, data, l);
+        offset += l;
+        data += l;
+        len -= l;
+    }
+
+    if (len == 0)
+        return DEVICE_OK;
+
+    return readStored(offset - headingLength + rollSkip, data, len);
+}
+
 /**
  * Destructor.
  */
 MicroBitLog::~MicroBitLog()
 {
+    if (rowBuffer)
+        free(rowBuffer);
+
+    if (columnIndex)
+        free(columnIndex);
 
+    if (writeBehindBuffer)
+        free(writeBehindBuffer);
 }
 
 const uint8_t MicroBitLog::header[2048] = {0x3c,0x6d,0x65,0x74,0x61,0x20,0x63,0x68,0x61,0x72,0x73,0x65,0x74,0x3d,0x75,0x74,0x66,0x2d,0x38,0x3e,0x3c,0x73,0x74,0x79,0x6c,0x65,0x3e,0x2e,0x62,0x62,0x7b,0x64,0x69,0x73,0x70,0x6c,0x61,0x79,0x3a,0x66,0x6c,0x65,0x78,0x7d,0x2e,0x62,0x62,0x3e,0x2a,0x2b,0x2a,0x7b,0x6d,0x61,0x72,0x67,0x69,0x6e,0x2d,0x6c,0x65,0x66,0x74,0x3a,0x31,0x30,0x70,0x78,0x7d,0x62,0x6f,0x64,0x79,0x7b,0x66,0x6f,0x6e,0x74,0x2d,0x66,0x61,0x6d,0x69,0x6c,0x79,0x3a,0x73,0x61,0x6e,0x73,0x2d,0x73,0x65,0x72,0x69,0x66,0x3b,0x6d,0x61,0x72,0x67,0x69,0x6e,0x3a,0x31,0x65,0x6d,0x7d,0x74,0x61,0x62,0x6c,0x65,0x7b,0x62,0x6f,0x72,0x64,0x65,0x72,0x2d,0x63,0x6f,0x6c,0x6c,0x61,0x70,0x73,0x65,0x3a,0x63,0x6f,0x6c,0x6c,0x61,0x70,0x73,0x65,0x3b,0x6d,0x61,0x72,0x67,0x69,0x6e,0x2d,0x74,0x6f,0x70,0x3a,0x31,0x65,0x6d,0x3b,0x74,0x65,0x78,0x74,0x2d,0x61,0x6c,0x69,0x67,0x6e,0x3a,0x72,0x69,0x67,0x68,0x74,0x7d,0x74,0x72,0x3a,0x66,0x69,0x72,0x73,0x74,0x2d,0x63,0x68,0x69,0x6c,0x64,0x7b,0x66,0x6f,0x6e,0x74,0x2d,0x77,0x65,0x69,0x67,0x68,0x74,0x3a,0x37,0x30,0x30,0x7d,0x74,0x64,0x7b,0x62,0x6f,0x72,0x64,0x65,0x72,0x3a,0x31,0x70,0x78,0x20,0x73,0x6f,0x6c,0x69,0x64,0x20,0x23,0x64,0x64,0x64,0x3b,0x70,0x61,0x64,0x64,0x69,0x6e,0x67,0x3a,0x38,0x70,0x78,0x3b,0x6d,0x69,0x6e,0x2d,0x77,0x69,0x64,0x74,0x68,0x3a,0x38,0x63,0x68,0x7d,0x69,0x66,0x72,0x61,0x6d,0x65,0x7b,0x64,0x69,0x73,0x70,0x6c,0x61,0x79,0x3a,0x6e,0x6f,0x6e,0x65,0x7d,0x3c,0x2f,0x73,0x74,0x79,0x6c,0x65,0x3e,0x3c,0x6c,0x69,0x6e,0x6b,0x20,0x72,0x65,0x6c,0x3d,0x73,0x74,0x79,0x6c,0x65,0x73,0x68,0x65,0x65,0x74,0x20,0x68,0x72,0x65,0x66,0x3d,0x68,0x74,0x74,0x70,0x73,0x3a,0x2f,0x2f,0x6d,0x69,0x63,0x72,0x6f,0x62,0x69,0x74,0x2e,0x6f,0x72,0x67,0x2f,0x64,0x6c,0x2f,0x32,0x2f,0x64,0x6c,0x2e,0x63,0x73,0x73,0x3e,0x3c,0x73,0x63,0x72,0x69,0x70,0x74,0x3e,0x6c,0x65,0x74,0x20,0x77,0x3d,0x77,0x69,0x6e,0x64,0x6f,0x77,0x2c,0x64,0x3d,0x64,0x6f,0x63,0x75,0x6d,0x65,0x6e,0x74,0x2c,0x6c,0x3d,0x77,0x2e,0x6c,0x6f,0x63,0x61,0x74,0x69,0x6f,0x6e,0x2c,0x6e,0x3d,0x6e,0x75,0x6c,0x6c,0x2c,0x63,0x73,0x76,0x3d,0x22,0x22,0x2c,0x74,0x61,0x67,0x3d,0x64,0x2e,0x63,0x72,0x65,0x61,0x74,0x65,0x45,0x6c,0x65,0x6d,0x65,0x6e,0x74,0x2e,0x62,0x69,0x6e,0x64,0x28,0x64,0x29,0x3b,0x77,0x2e,0x64,0x6c,0x3d,0x7b,0x64,0x6f,0x77,0x6e,0x6c,0x6f,0x61,0x64,0x3a,0x66,0x75,0x6e,0x63,0x74,0x69,0x6f,0x6e,0x28,0x29,0x7b,0x6c,0x65,0x74,0x20,0x65,0x3d,0x74,0x61,0x67,0x28,0x22,0x61,0x22,0x29,0x3b,0x65,0x2e,0x64,0x6f,0x77,0x6e,0x6c,0x6f,0x61,0x64,0x3d,0x22,0x6d,0x69,0x63,0x72,0x6f,0x62,0x69,0x74,0x2e,0x63,0x73,0x76,0x22,0x2c,0x65,0x2e,0x68,0x72,0x65,0x66,0x3d,0x55,0x52,0x4c,0x2e,0x63,0x72,0x65,0x61,0x74,0x65,0x4f,0x62,0x6a,0x65,0x63,0x74,0x55,0x52,0x4c,0x28,0x6e,0x65,0x77,0x20,0x42,0x6c,0x6f,0x62,0x28,0x5b,0x63,0x73,0x76,0x5d,0x2c,0x7b,0x74,0x79,0x70,0x65,0x3a,0x22,0x74,0x65,0x78,0x74,0x2f,0x63,0x73,0x76,0x22,0x7d,0x29,0x29,0x2c,0x65,0x2e,0x63,0x6c,0x69,0x63,0x6b,0x28,0x29,0x2c,0x65,0x2e,0x72,0x65,0x6d,0x6f,0x76,0x65,0x28,0x29,0x7d,0x2c,0x63,0x6f,0x70,0x79,0x3a,0x66,0x75,0x6e,0x63,0x74,0x69,0x6f,0x6e,0x28,0x29,0x7b,0x6e,0x61,0x76,0x69,0x67,0x61,0x74,0x6f,0x72,0x2e,0x63,0x6c,0x69,0x70,0x62,0x6f,0x61,0x72,0x64,0x2e,0x77,0x72,0x69,0x74,0x65,0x54,0x65,0x78,0x74,0x28,0x63,0x73,0x76,0x2e,0x72,0x65,0x70,0x6c,0x61,0x63,0x65,0x28,0x2f,0x5c,0x2c,0x2f,0x67,0x2c,0x22,0x5c,0x74,0x22,0x29,0x29,0x7d,0x2c,0x75,0x70,0x64,0x61,0x74,0x65,0x3a,0x61,0x6c,0x65,0x72,0x74,0x2e,0x62,0x69,0x6e,0x64,0x28,0x6e,0x2c,0x22,0x55,0x6e,0x70,0x6c,0x75,0x67,0x20,0x79,0x6f,0x75,0x72,0x20,0x6d,0x69,0x63,0x72,0x6f,0x3a,0x62,0x69,0x74,0x2c,0x20,0x74,0x68,0x65,0x6e,0x20,0x70,0x6c,0x75,0x67,0x20,0x69,0x74,0x20,0x62,0x61,0x63,0x6b,0x20,0x69,0x6e,0x20,0x61,0x6e,0x64,0x20,0x77,0x61,0x69,0x74,0x22,0x29,0x2c,0x63,0x6c,0x65,0x61,0x72,0x3a,0x61,0x6c,0x65,0x72,0x74,0x2e,0x62,0x69,0x6e,0x64,0x28,0x6e,0x2c,0x22,0x54,0x68,0x65,0x20,0x6c,0x6f,0x67,0x20,0x69,0x73,0x20,0x63,0x6c,0x65,0x61,0x72,0x65,0x64,0x20,0x77,0x68,0x65,0x6e,0x20,0x79,0x6f,0x75,0x20,0x72,0x65,0x66,0x6c,0x61,0x73,0x68,0x20,0x79,0x6f,0x75,0x72,0x20,0x6d,0x69,0x63,0x72,0x6f,0x3a,0x62,0x69,0x74,0x22,0x29,0x2c,0x6c,0x6f,0x61,0x64,0x3a,0x66,0x75,0x6e,0x63,0x74,0x69,0x6f,0x6e,0x28,0x29,0x7b,0x6c,0x65,0x74,0x20,0x61,0x3d,0x64,0x2e,0x71,0x75,0x65,0x72,0x79,0x53,0x65,0x6c,0x65,0x63,0x74,0x6f,0x72,0x28,0x22,0x23,0x77,0x22,0x29,0x2c,0x69,0x3d,0x64,0x2e,0x64,0x6f,0x63,0x75,0x6d,0x65,0x6e,0x74,0x45,0x6c,0x65,0x6d,0x65,0x6e,0x74,0x2e,0x6f,0x75,0x74,0x65,0x72,0x48,0x54,0x4d,0x4c,0x2e,0x73,0x70,0x6c,0x69,0x74,0x28,0x22,0x46,0x53,0x5f,0x53,0x54,0x41,0x52,0x54,0x22,0x29,0x5b,0x32,0x5d,0x3b,0x69,0x66,0x28,0x2f,0x5e,0x55,0x42,0x49,0x54,0x5f,0x4c,0x4f,0x47,0x5f,0x46,0x53,0x5f,0x56,0x5f,0x30,0x30,0x32,0x2f,0x2e,0x74,0x65,0x73,0x74,0x28,0x69,0x29,0x29,0x7b,0x6c,0x65,0x74,0x20,0x74,0x3d,0x70,0x61,0x72,0x73,0x65,0x49,0x6e,0x74,0x3b,0x74,0x68,0x69,0x73,0x2e,0x64,0x61,0x70,0x56,0x65,0x72,0x3d,0x74,0x28,0x69,0x2e,0x73,0x75,0x62,0x73,0x74,0x72,0x28,0x34,0x30,0x2c,0x34,0x29,0x2c,0x31,0x30,0x29,0x3b,0x76,0x61,0x72,0x20,0x6e,0x3d,0x74,0x28,0x69,0x2e,0x73,0x75,0x62,0x73,0x74,0x72,0x28,0x32,0x39,0x2c,0x31,0x30,0x29,0x2c,0x31,0x36,0x29,0x2d,0x32,0x30,0x34,0x38,0x3b,0x6c,0x65,0x74,0x20,0x65,0x3d,0x30,0x3b,0x66,0x6f,0x72,0x28,0x3b,0x36,0x35,0x35,0x33,0x33,0x21,0x3d,0x69,0x2e,0x63,0x68,0x61,0x72,0x43,0x6f,0x64,0x65,0x41,0x74,0x28,0x6e,0x2b,0x65,0x29,0x3b,0x29,0x65,0x2b,0x2b,0x3b,0x63,0x73,0x76,0x3d,0x69,0x2e,0x73,0x75,0x62,0x73,0x74,0x72,0x28,0x6e,0x2c,0x65,0x29,0x3b,0x6c,0x65,0x74,0x20,0x72,0x3d,0x30,0x3b,0x66,0x6f,0x72,0x28,0x6c,0x65,0x74,0x20,0x65,0x3d,0x30,0x3b,0x65,0x3c,0x69,0x2e,0x6c,0x65,0x6e,0x67,0x74,0x68,0x3b,0x2b,0x2b,0x65,0x29,0x72,0x3d,0x33,0x31,0x2a,0x72,0x2b,0x69,0x2e,0x63,0x68,0x61,0x72,0x43,0x6f,0x64,0x65,0x41,0x74,0x28,0x65,0x29,0x2c,0x72,0x7c,0x3d,0x30,0x3b,0x76,0x61,0x72,0x20,0x6f,0x3d,0x6c,0x2e,0x68,0x72,0x65,0x66,0x2e,0x73,0x70,0x6c,0x69,0x74,0x28,0x22,0x3f,0x22,0x29,0x5b,0x31,0x5d,0x3b,0x69,0x66,0x28,0x76,0x6f,0x69,0x64,0x20,0x30,0x21,0x3d,0x3d,0x6f,0x29,0x6f,0x21,0x3d,0x72,0x26,0x26,0x70,0x61,0x72,0x65,0x6e,0x74,0x2e,0x70,0x6f,0x73,0x74,0x4d,0x65,0x73,0x73,0x61,0x67,0x65,0x28,0x22,0x64,0x69,0x66,0x66,0x22,0x2c,0x22,0x2a,0x22,0x29,0x3b,0x65,0x6c,0x73,0x65,0x7b,0x6f,0x3d,0x74,0x28,0x69,0x2e,0x73,0x75,0x62,0x73,0x74,0x72,0x28,0x31,0x38,0x2c,0x31,0x30,0x29,0x2c,0x31,0x36,0x29,0x3b,0x22,0x46,0x55,0x4c,0x22,0x3d,0x3d,0x3d,0x69,0x2e,0x73,0x75,0x62,0x73,0x74,0x72,0x28,0x6f,0x2d,0x32,0x30,0x34,0x38,0x2b,0x31,0x2c,0x33,0x29,0x26,0x26,0x28,0x61,0x2e,0x61,0x70,0x70,0x65,0x6e,0x64,0x43,0x68,0x69,0x6c,0x64,0x28,0x74,0x61,0x67,0x28,0x22,0x70,0x22,0x29,0x29,0x2e,0x69,0x6e,0x6e,0x65,0x72,0x54,0x65,0x78,0x74,0x3d,0x22,0x4c,0x4f,0x47,0x20,0x46,0x55,0x4c,0x4c,0x22,0x29,0x3b,0x6c,0x65,0x74,0x20,0x6e,0x3d,0x61,0x2e,0x61,0x70,0x70,0x65,0x6e,0x64,0x43,0x68,0x69,0x6c,0x64,0x28,0x74,0x61,0x67,0x28,0x22,0x74,0x61,0x62,0x6c,0x65,0x22,0x29,0x29,0x3b,0x63,0x73,0x76,0x2e,0x73,0x70,0x6c,0x69,0x74,0x28,0x22,0x5c,0x6e,0x22,0x29,0x2e,0x66,0x6f,0x72,0x45,0x61,0x63,0x68,0x28,0x66,0x75,0x6e,0x63,0x74,0x69,0x6f,0x6e,0x28,0x65,0x29,0x7b,0x6c,0x65,0x74,0x20,0x74,0x3d,0x6e,0x2e,0x69,0x6e,0x73,0x65,0x72,0x74,0x52,0x6f,0x77,0x28,0x29,0x3b,0x65,0x26,0x26,0x65,0x2e,0x73,0x70,0x6c,0x69,0x74,0x28,0x22,0x2c,0x22,0x29,0x2e,0x66,0x6f,0x72,0x45,0x61,0x63,0x68,0x28,0x66,0x75,0x6e,0x63,0x74,0x69,0x6f,0x6e,0x28,0x65,0x29,0x7b,0x74,0x2e,0x69,0x6e,0x73,0x65,0x72,0x74,0x43,0x65,0x6c,0x6c,0x28,0x29,0x2e,0x69,0x6e,0x6e,0x65,0x72,0x54,0x65,0x78,0x74,0x3d,0x65,0x7d,0x29,0x7d,0x29,0x2c,0x77,0x2e,0x6f,0x6e,0x6d,0x65,0x73,0x73,0x61,0x67,0x65,0x3d,0x66,0x75,0x6e,0x63,0x74,0x69,0x6f,0x6e,0x28,0x65,0x29,0x7b,0x22,0x64,0x69,0x66,0x66,0x22,0x3d,0x3d,0x65,0x2e,0x64,0x61,0x74,0x61,0x26,0x26,0x6c,0x2e,0x72,0x65,0x6c,0x6f,0x61,0x64,0x28,0x29,0x7d,0x3b,0x6c,0x65,0x74,0x20,0x65,0x3b,0x73,0x65,0x74,0x49,0x6e,0x74,0x65,0x72,0x76,0x61,0x6c,0x28,0x66,0x75,0x6e,0x63,0x74,0x69,0x6f,0x6e,0x28,0x29,0x7b,0x65,0x26,0x26,0x65,0x2e,0x72,0x65,0x6d,0x6f,0x76,0x65,0x28,0x29,0x2c,0x65,0x3d,0x61,0x2e,0x61,0x70,0x70,0x65,0x6e,0x64,0x43,0x68,0x69,0x6c,0x64,0x28,0x74,0x61,0x67,0x28,0x22,0x69,0x66,0x72,0x61,0x6d,0x65,0x22,0x29,0x29,0x2c,0x65,0x2e,0x73,0x72,0x63,0x3d,0x6c,0x2e,0x68,0x72,0x65,0x66,0x2b,0x22,0x3f,0x22,0x2b,0x72,0x7d,0x2c,0x35,0x65,0x33,0x29,0x7d,0x7d,0x7d,0x7d,0x3c,0x2f,0x73,0x63,0x72,0x69,0x70,0x74,0x3e,0x3c,0x73,0x63,0x72,0x69,0x70,0x74,0x20,0x73,0x72,0x63,0x3d,0x68,0x74,0x74,0x70,0x73,0x3a,0x2f,0x2f,0x6d,0x69,0x63,0x72,0x6f,0x62,0x69,0x74,0x2e,0x6f,0x72,0x67,0x2f,0x64,0x6c,0x2f,0x32,0x2f,0x64,0x6c,0x2e,0x6a,0x73,0x3e,0x3c,0x2f,0x73,0x63,0x72,0x69,0x70,0x74,0x3e,0x3c,0x74,0x69,0x74,0x6c,0x65,0x3e,0x6d,0x69,0x63,0x72,0x6f,0x3a,0x62,0x69,0x74,0x20,0x64,0x61,0x74,0x61,0x20,0x6c,0x6f,0x67,0x3c,0x2f,0x74,0x69,0x74,0x6c,0x65,0x3e,0x3c,0x62,0x6f,0x64,0x79,0x20,0x6f,0x6e,0x6c,0x6f,0x61,0x64,0x3d,0x64,0x6c,0x2e,0x6c,0x6f,0x61,0x64,0x28,0x29,0x3e,0x3c,0x64,0x69,0x76,0x20,0x69,0x64,0x3d,0x77,0x3e,0x3c,0x68,0x31,0x3e,0x6d,0x69,0x63,0x72,0x6f,0x3a,0x62,0x69,0x74,0x20,0x64,0x61,0x74,0x61,0x20,0x6c,0x6f,0x67,0x3c,0x2f,0x68,0x31,0x3e,0x3c,0x64,0x69,0x76,0x20,0x63,0x6c,0x61,0x73,0x73,0x3d,0x62,0x62,0x3e,0x3c,0x62,0x75,0x74,0x74,0x6f,0x6e,0x20,0x6f,0x6e,0x63,0x6c,0x69,0x63,0x6b,0x3d,0x64,0x6c,0x2e,0x64,0x6f,0x77,0x6e,0x6c,0x6f,0x61,0x64,0x28,0x29,0x3e,0x44,0x6f,0x77,0x6e,0x6c,0x6f,0x61,0x64,0x3c,0x2f,0x62,0x75,0x74,0x74,0x6f,0x6e,0x3e,0x3c,0x62,0x75,0x74,0x74,0x6f,0x6e,0x20,0x6f,0x6e,0x63,0x6c,0x69,0x63,0x6b,0x3d,0x64,0x6c,0x2e,0x63,0x6f,0x70,0x79,0x28,0x29,0x3e,0x43,0x6f,0x70,0x79,0x3c,0x2f,0x62,0x75,0x74,0x74,0x6f,0x6e,0x3e,0x3c,0x62,0x75,0x74,0x74,0x6f,0x6e,0x20,0x6f,0x6e,0x63,0x6c,0x69,0x63,0x6b,0x3d,0x64,0x6c,0x2e,0x75,0x70,0x64,0x61,0x74,0x65,0x28,0x29,0x3e,0x55,0x70,0x64,0x61,0x74,0x65,0x20,0x64,0x61,0x74,0x61,0x26,0x6d,0x6c,0x64,0x72,0x3b,0x3c,0x2f,0x62,0x75,0x74,0x74,0x6f,0x6e,0x3e,0x3c,0x62,0x75,0x74,0x74,0x6f,0x6e,0x20,0x6f,0x6e,0x63,0x6c,0x69,0x63,0x6b,0x3d,0x64,0x6c,0x2e,0x63,0x6c,0x65,0x61,0x72,0x28,0x29,0x3e,0x43,0x6c,0x65,0x61,0x72,0x20,0x6c,0x6f,0x67,0x26,0x6d,0x6c,0x64,0x72,0x3b,0x3c,0x2f,0x62,0x75,0x74,0x74,0x6f,0x6e,0x3e,0x3c,0x2f,0x64,0x69,0x76,0x3e,0x3c,0x70,0x20,0x69,0x64,0x3d,0x76,0x3e,0x4f,0x66,0x66,0x6c,0x69,0x6e,0x65,0x3a,0x20,0x6e,0x6f,0x20,0x76,0x69,0x73,0x75,0x61,0x6c,0x20,0x70,0x72,0x65,0x76,0x69,0x65,0x77,0x3c,0x2f,0x64,0x69,0x76,0x3e,0x20,0x20,0x20,0x3c,0x21,0x2d,0x2d,0x46,0x53,0x5f,0x53,0x54,0x41,0x52,0x54};
@@ -0,0 +1,338 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "MicroBitLogAggregator.h"
+#include "Timer.h"
+#include "ErrorNo.h"
+#include <string.h>
+
+using namespace codal;
+
+/**
+ * Constructor.
+ *
+ * @param log The log to write summary rows to.
+ */
+MicroBitLogAggregator::MicroBitLogAggregator(MicroBitLog &log) : log(log)
+{
+    this->period = CONFIG_MICROBIT_LOG_AGGREGATE_PERIOD_MS;
+    this->windowRows = 0;
+    this->rows = 0;
+    this->windowStart = 0;
+    this->status = 0;
+
+    for (int i = 0; i < CONFIG_MICROBIT_LOG_AGGREGATE_COLUMNS; i++)
+    {
+        columns[i].stats = 0;
+        columns[i].thresholds = false;
+        columns[i].present = false;
+        columns[i].count = 0;
+    }
+}
+
+/**
+ * Finds the column with the given name.
+ *
+ * @return The column, or NULL if it is not summarised.
+ */
+LogAggregateColumn *MicroBitLogAggregator::find(const char *key)
+{
+    if (key == NULL)
+        return NULL;
+
+    for (int i = 0; i < CONFIG_MICROBIT_LOG_AGGREGATE_COLUMNS; i++)
+        if (columns[i].stats && strcmp(columns[i].key.toCharArray(), key) == 0)
+            return &columns[i];
+
+    return NULL;
+}
+
+/**
+ * Summarises the given column. Samples logged for columns that are not summarised are ignored.
+ *
+ * @param key The name of the column.
+ * @param stats The statistics to log for it, as a combination of the MICROBIT_LOG_AGGREGATE_* flags.
+ * @param decimals The number of decimal places to log them with, up to MICROBIT_LOG_MAX_DECIMALS.
+ *
+ * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the parameters are invalid, or DEVICE_NO_RESOURCES
+ *         if CONFIG_MICROBIT_LOG_AGGREGATE_COLUMNS columns are already summarised.
+ */
+int MicroBitLogAggregator::addColumn(const char *key, int stats, int decimals)
+{
+    if (key == NULL || *key == 0 || (stats & MICROBIT_LOG_AGGREGATE_ALL) == 0 || (stats & ~MICROBIT_LOG_AGGREGATE_ALL))
+        return DEVICE_INVALID_PARAMETER;
+
+    if (decimals < 0 || decimals > MICROBIT_LOG_MAX_DECIMALS)
+        return DEVICE_INVALID_PARAMETER;
+
+    LogAggregateColumn *c = find(key);
+
+    for (int i = 0; c == NULL && i < CONFIG_MICROBIT_LOG_AGGREGATE_COLUMNS; i++)
+        if (columns[i].stats == 0)
+            c = &columns[i];
+
+    if (c == NULL)
+        return DEVICE_NO_RESOURCES;
+
+    // Redeclaring a column changes the statistics logged, but keeps the samples of the current window.
+    if (c->stats == 0)
+    {
+        c->key = key;
+        c->thresholds = false;
+        c->present = false;
+        c->count = 0;
+    }
+
+    c->stats = stats;
+    c->decimals = decimals;
+
+    return DEVICE_OK;
+}
+
+/**
+ * Configures the length of each window. A window ends with the first row completed once either limit is reached.
+ *
+ * @param period The length of a window in milliseconds, or zero if windows are not timed.
+ * @param rows The number of rows in a window, or zero if windows are not counted.
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if both are zero.
+ */
+int MicroBitLogAggregator::setWindow(uint32_t period, uint32_t rows)
+{
+    if (period == 0 && rows == 0)
+        return DEVICE_INVALID_PARAMETER;
+
+    this->period = period;
+    this->windowRows = rows;
+
+    return DEVICE_OK;
+}
+
+/**
+ * Logs every row in which the given column's sample lies outside the given range in full, as well as summarising it.
+ *
+ * @param key The name of a summarised column.
+ * @param low The lowest sample that does not trip the threshold.
+ * @param high The highest sample that does not trip the threshold.
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the column is not summarised or the range is empty.
+ */
+int MicroBitLogAggregator::setThreshold(const char *key, double low, double high)
+{
+    LogAggregateColumn *c = find(key);
+
+    if (c == NULL || low > high)
+        return DEVICE_INVALID_PARAMETER;
+
+    c->low = low;
+    c->high = high;
+    c->thresholds = true;
+
+    return DEVICE_OK;
+}
+
+/**
+ * Stops logging rows in full for the given column.
+ *
+ * @param key The name of a summarised column.
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the column is not summarised.
+ */
+int MicroBitLogAggregator::clearThreshold(const char *key)
+{
+    LogAggregateColumn *c = find(key);
+
+    if (c == NULL)
+        return DEVICE_INVALID_PARAMETER;
+
+    c->thresholds = false;
+
+    return DEVICE_OK;
+}
+
+/**
+ * Starts a new row. Any samples in a row that was not completed are discarded.
+ *
+ * @return DEVICE_OK on success.
+ */
+int MicroBitLogAggregator::beginRow()
+{
+    for (int i = 0; i < CONFIG_MICROBIT_LOG_AGGREGATE_COLUMNS; i++)
+        columns[i].present = false;
+
+    if (rows == 0)
+        windowStart = system_timer_current_time();
+
+    status = MICROBIT_LOG_AGGREGATE_STATUS_ROW_STARTED;
+
+    return DEVICE_OK;
+}
+
+/**
+ * Places a sample in the current row.
+ *
+ * @param key The name of a summarised column.
+ * @param value The sample.
+ *
+ * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the column is not summarised, or DEVICE_INVALID_STATE
+ *         if no row has been started.
+ */
+int MicroBitLogAggregator::logData(const char *key, double value)
+{
+    LogAggregateColumn *c = find(key);
+
+    if (c == NULL)
+        return DEVICE_INVALID_PARAMETER;
+
+    if (!(status & MICROBIT_LOG_AGGREGATE_STATUS_ROW_STARTED))
+        return DEVICE_INVALID_STATE;
+
+    c->sample = value;
+    c->present = true;
+
+    if (c->thresholds && (value < c->low || value > c->high))
+        status |= MICROBIT_LOG_AGGREGATE_STATUS_TRIPPED;
+
+    return DEVICE_OK;
+}
+
+/**
+ * Writes the current row to the log as it stands.
+ *
+ * @return DEVICE_OK on success, or the error reported by the log.
+ */
+int MicroBitLogAggregator::logRaw()
+{
+    log.beginRow();
+
+    for (int i = 0; i < CONFIG_MICROBIT_LOG_AGGREGATE_COLUMNS; i++)
+    {
+        LogAggregateColumn *c = &columns[i];
+
+        if (c->stats && c->present)
+            log.logData(c->key.toCharArray(), c->sample, c->decimals);
+    }
+
+    return log.endRow();
+}
+
+/**
+ * Completes the current row, adding its samples to the window. If the row trips a threshold, it is logged in full.
+ * If the window is complete, a summary row is logged and a new window started.
+ *
+ * @return DEVICE_OK on success, DEVICE_INVALID_STATE if no row has been started, or the error reported by the log.
+ */
+int MicroBitLogAggregator::endRow()
+{
+    int result = DEVICE_OK;
+
+    if (!(status & MICROBIT_LOG_AGGREGATE_STATUS_ROW_STARTED))
+        return DEVICE_INVALID_STATE;
+
+    for (int i = 0; i < CONFIG_MICROBIT_LOG_AGGREGATE_COLUMNS; i++)
+    {
+        LogAggregateColumn *c = &columns[i];
+
+        if (!c->stats || !c->present)
+            continue;
+
+        if (c->count == 0)
+        {
+            c->min = c->max = c->sum = c->sample;
+        }
+        else
+        {
+            if (c->sample < c->min)
+                c->min = c->sample;
+
+            if (c->sample > c->max)
+                c->max = c->sample;
+
+            c->sum += c->sample;
+        }
+
+        c->count++;
+    }
+
+    if (status & MICROBIT_LOG_AGGREGATE_STATUS_TRIPPED)
+        result = logRaw();
+
+    status = 0;
+    rows++;
+
+    if ((windowRows && rows >= windowRows) || (period && system_timer_current_time() - windowStart >= period))
+    {
+        int r = flush();
+
+        if (result == DEVICE_OK && r != DEVICE_NO_DATA)
+            result = r;
+    }
+
+    return result;
+}
+
+/**
+ * Logs a summary row for the current window, however far it has progressed, and starts a new window.
+ *
+ * @return DEVICE_OK on success, DEVICE_NO_DATA if the window is empty, or the error reported by the log.
+ */
+int MicroBitLogAggregator::flush()
+{
+    bool empty = true;
+
+    for (int i = 0; i < CONFIG_MICROBIT_LOG_AGGREGATE_COLUMNS; i++)
+        if (columns[i].stats && columns[i].count)
+            empty = false;
+
+    rows = 0;
+
+    if (empty)
+        return DEVICE_NO_DATA;
+
+    log.beginRow();
+
+    for (int i = 0; i < CONFIG_MICROBIT_LOG_AGGREGATE_COLUMNS; i++)
+    {
+        LogAggregateColumn *c = &columns[i];
+
+        if (!c->stats || c->count == 0)
+            continue;
+
+        if (c->stats & MICROBIT_LOG_AGGREGATE_MIN)
+            log.logData((c->key + "_min").toCharArray(), c->min, c->decimals);
+
+        if (c->stats & MICROBIT_LOG_AGGREGATE_MAX)
+            log.logData((c->key + "_max").toCharArray(), c->max, c->decimals);
+
+        if (c->stats & MICROBIT_LOG_AGGREGATE_MEAN)
+            log.logData((c->key + "_mean").toCharArray(), c->sum / c->count, c->decimals);
+
+        if (c->stats & MICROBIT_LOG_AGGREGATE_COUNT)
+            log.logData((c->key + "_count").toCharArray(), (unsigned int) c->count);
+
+        c->count = 0;
+    }
+
+    return log.endRow();
+}
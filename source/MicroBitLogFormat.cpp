@@ -0,0 +1,169 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+
+#include "MicroBitLogFormat.h"
+#include <string.h>
+#include <math.h>
+
+using namespace codal;
+
+// The smallest value whose integer part has too many digits to be written in full.
+#define LOG_FORMAT_EXPONENT_THRESHOLD       1000000000000000ULL
+
+/**
+ * Formats an unsigned integer as decimal.
+ *
+ * @param buf the buffer to write to, which must have space for 21 characters.
+ * @param n the value to format.
+ * @param digits the minimum number of digits to write, padded with leading zeros.
+ * @return the number of characters written, excluding the NULL terminator.
+ */
+int codal::logFormatUnsigned(char *buf, uint64_t n, int digits)
+{
+    char reversed[20];
+    int l = 0;
+
+    do {
+        reversed[l++] = '0' + (n % 10);
+        n /= 10;
+    } while (n || l < digits);
+
+    for (int i = 0; i < l; i++)
+        buf[i] = reversed[l - i - 1];
+
+    buf[l] = 0;
+    return l;
+}
+
+/**
+ * Formats a signed integer as decimal.
+ *
+ * @param buf the buffer to write to, which must have space for 21 characters.
+ * @param n the value to format.
+ * @return the number of characters written, excluding the NULL terminator.
+ */
+int codal::logFormatInteger(char *buf, int64_t n)
+{
+    if (n >= 0)
+        return logFormatUnsigned(buf, n);
+
+    buf[0] = '-';
+    return 1 + logFormatUnsigned(buf + 1, -(uint64_t)n);
+}
+
+/**
+ * Formats a floating point value as decimal, rounded to the given number of decimal places. Values too large for
+ * their integer part to fit, from 1e15 upwards, are written in exponent form, with the same number of decimal places
+ * in the mantissa (for example "1.50e+15"). Only infinite values are written as "Infinity".
+ *
+ * @param buf the buffer to write to, which must have space for MICROBIT_LOG_NUMBER_SIZE characters.
+ * @param v the value to format.
+ * @param decimals the number of decimal places, up to MICROBIT_LOG_MAX_DECIMALS.
+ * @return the number of characters written, excluding the NULL terminator.
+ */
+int codal::logFormatFloat(char *buf, double v, int decimals)
+{
+    int l = 0;
+
+    if (v != v)
+    {
+        strcpy(buf, "NaN");
+        return 3;
+    }
+
+    if (v < 0)
+    {
+        buf[l++] = '-';
+        v = -v;
+    }
+
+    if (isinf(v))
+    {
+        strcpy(&buf[l], "Infinity");
+        return l + 8;
+    }
+
+    uint64_t scale = 1;
+    for (int i = 0; i < decimals; i++)
+        scale *= 10;
+
+    if (v < (double) LOG_FORMAT_EXPONENT_THRESHOLD)
+    {
+        uint64_t whole = (uint64_t) v;
+        uint64_t fraction = (uint64_t) ((v - (double) whole) * (double) scale + 0.5);
+
+        if (fraction >= scale)
+        {
+            whole++;
+            fraction -= scale;
+        }
+
+        // Rounding up may carry into a digit too many, in which case the value is written in exponent form below.
+        if (whole < LOG_FORMAT_EXPONENT_THRESHOLD)
+        {
+            l += logFormatUnsigned(&buf[l], whole);
+
+            if (decimals > 0)
+            {
+                buf[l++] = '.';
+                l += logFormatUnsigned(&buf[l], fraction, decimals);
+            }
+
+            return l;
+        }
+    }
+
+    // Find the power of ten at or below the value. Past 1e308, power * 10 overflows to infinity, which ends the search.
+    int exponent = 15;
+    double power = (double) LOG_FORMAT_EXPONENT_THRESHOLD;
+
+    while (v >= power * 10)
+    {
+        power *= 10;
+        exponent++;
+    }
+
+    uint64_t mantissa = (uint64_t) (v / power * (double) scale + 0.5);
+
+    if (mantissa >= 10 * scale)
+    {
+        mantissa /= 10;
+        exponent++;
+    }
+
+    l += logFormatUnsigned(&buf[l], mantissa / scale);
+
+    if (decimals > 0)
+    {
+        buf[l++] = '.';
+        l += logFormatUnsigned(&buf[l], mantissa % scale, decimals);
+    }
+
+    buf[l++] = 'e';
+    buf[l++] = '+';
+    l += logFormatUnsigned(&buf[l], exponent);
+
+    return l;
+}
@@ -42,6 +42,12 @@ DEALINGS IN THE SOFTWARE.
 
 #define MAX_STRING_LENGTH 100
 
+MicroBitMemoryMap::MemoryMapStore MicroBitMemoryMap::cachedStore;
+uint8_t MicroBitMemoryMap::cachedRegionCount = 0;
+bool MicroBitMemoryMap::cacheValid = false;
+uint32_t *MicroBitMemoryMap::pageHashes = NULL;
+uint32_t *MicroBitMemoryMap::pageHashValid = NULL;
+
 /**
   * Default constructor.
   *
@@ -49,9 +55,99 @@ DEALINGS IN THE SOFTWARE.
   */
 MicroBitMemoryMap::MicroBitMemoryMap()
 {
+      // The regions only change when the device is reprogrammed, so search the FLASH memory only once.
+      if (cacheValid)
+      {
+          memoryMapStore = cachedStore;
+          regionCount = cachedRegionCount;
+          return;
+      }
+
       // Find Hashes
       findHashes();
 
+      cachedStore = memoryMapStore;
+      cachedRegionCount = regionCount;
+      cacheValid = true;
+}
+
+/**
+  * Discards the cached memory map, such that the next instance created searches the FLASH memory again.
+  * This should be called whenever the program regions of FLASH memory are rewritten.
+  */
+void MicroBitMemoryMap::invalidate()
+{
+    cacheValid = false;
+}
+
+/**
+  * Determines the CRC32 of a page of the application region, such that a host can compare
+  * page hashes and transfer only those pages that have changed.
+  * Hashes are cached, and only recalculated when invalidated by invalidatePage().
+  *
+  * @param address the address of the start of the page.
+  * @param hash set to the CRC32 of the page.
+  *
+  * @return MICROBIT_OK on success, or MICROBIT_INVALID_PARAMETER if the address is not the start
+  * of a page in the application region.
+  */
+int MicroBitMemoryMap::getPageHash(uint32_t address, uint32_t &hash)
+{
+    uint32_t pages = (MICROBIT_APP_REGION_END - MICROBIT_APP_REGION_START) / MICROBIT_CODEPAGESIZE;
+
+    if (address % MICROBIT_CODEPAGESIZE || address < MICROBIT_APP_REGION_START || address >= MICROBIT_APP_REGION_END)
+        return MICROBIT_INVALID_PARAMETER;
+
+    uint32_t page = (address - MICROBIT_APP_REGION_START) / MICROBIT_CODEPAGESIZE;
+
+    if (pageHashes == NULL)
+    {
+        pageHashes = (uint32_t *) malloc(pages * sizeof(uint32_t));
+        pageHashValid = (uint32_t *) malloc(((pages + 31) / 32) * sizeof(uint32_t));
+
+        if (pageHashes == NULL || pageHashValid == NULL)
+        {
+            free(pageHashes);
+            free(pageHashValid);
+            pageHashes = NULL;
+            pageHashValid = NULL;
+        }
+        else
+        {
+            memset(pageHashValid, 0, ((pages + 31) / 32) * sizeof(uint32_t));
+        }
+    }
+
+    // If we have no table, simply calculate the hash each time.
+    if (pageHashes == NULL || pageHashValid == NULL)
+    {
+        hash = crc32_compute((const uint8_t *) address, MICROBIT_CODEPAGESIZE, NULL);
+        return MICROBIT_OK;
+    }
+
+    if ((pageHashValid[page / 32] & (1UL << (page % 32))) == 0)
+    {
+        pageHashes[page] = crc32_compute((const uint8_t *) address, MICROBIT_CODEPAGESIZE, NULL);
+        pageHashValid[page / 32] |= 1UL << (page % 32);
+    }
+
+    hash = pageHashes[page];
+    return MICROBIT_OK;
+}
+
+/**
+  * Marks the cached hash of the page holding the given address as out of date.
+  * This should be called whenever that page is erased or written.
+  *
+  * @param address an address within the page.
+  */
+void MicroBitMemoryMap::invalidatePage(uint32_t address)
+{
+    if (pageHashValid == NULL || address < MICROBIT_APP_REGION_START || address >= MICROBIT_APP_REGION_END)
+        return;
+
+    uint32_t page = (address - MICROBIT_APP_REGION_START) / MICROBIT_CODEPAGESIZE;
+    pageHashValid[page / 32] &= ~(1UL << (page % 32));
 }
 
 /**
@@ -0,0 +1,389 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "MicroBitMeshProtocol.h"
+#include <string.h>
+
+using namespace codal;
+
+/**
+  * Constructor.
+  *
+  * @param originId Our identifier, which must not be zero.
+  */
+MicroBitMeshProtocol::MicroBitMeshProtocol(uint16_t originId)
+{
+    this->originId = originId;
+    this->relayProbability = 100;
+    this->relayCopyThreshold = 0;
+    this->relayRssiThreshold = MICROBIT_MESH_RADIO_RELAY_RSSI_ANY;
+    this->relayPdrThreshold = MICROBIT_MESH_RADIO_RELAY_PDR_ANY;
+    reset();
+}
+
+/**
+  * Forgets every originator, and so every route, and every neighbour.
+  */
+void MicroBitMeshProtocol::reset()
+{
+    this->priorCopies = 0;
+    memset(this->origins, 0, sizeof(this->origins));
+    memset(this->neighbours, 0, sizeof(this->neighbours));
+}
+
+/**
+  * Determines if a received frame is new, or a duplicate of one we have already seen.
+  * A record of the latest sequence number heard from each originator is kept, compared so
+  * that wraparound of the 8 bit sequence number is handled. If the frame is new, the record is updated.
+  *
+  * @param origin The originator of the frame.
+  *
+  * @param seqNo The sequence number of the frame.
+  *
+  * @param now The current time, in milliseconds.
+  *
+  * @return true if the frame is new and should be processed, false if it should be discarded.
+  */
+bool MicroBitMeshProtocol::compareSeqNo(uint16_t origin, uint8_t seqNo, uint32_t now)
+{
+    // Discard our own floods as they are relayed back to us, and anything with an invalid origin.
+    if (origin == originId || origin == 0)
+        return false;
+
+    MeshOriginRecord *victim = &origins[0];
+
+    for (int i = 0; i < MICROBIT_MESH_RADIO_ORIGIN_TABLE_SIZE; i++)
+    {
+        MeshOriginRecord *r = &origins[i];
+
+        if (r->origin == origin)
+        {
+            // A frame is newer if it lies within the half of the sequence space ahead of the last one accepted.
+            // Records we haven't refreshed for a while are treated as stale, in case the originator has restarted.
+            if ((int8_t)(seqNo - r->seqNo) <= 0 && now - r->lastSeen < MICROBIT_MESH_RADIO_ORIGIN_TIMEOUT_MS)
+            {
+                // Keep count of the redundant copies of the current flood we hear, as a measure of local density.
+                if (seqNo == r->seqNo && r->copies < 255)
+                    r->copies++;
+
+                return false;
+            }
+
+            priorCopies = r->copies;
+            r->seqNo = seqNo;
+            r->lastSeen = now;
+            r->copies = 0;
+            return true;
+        }
+
+        // Track the best record to reuse should this be a new originator: an empty one, else the least recently heard.
+        if (victim->origin != 0 && (r->origin == 0 || now - r->lastSeen > now - victim->lastSeen))
+            victim = r;
+    }
+
+    victim->origin = origin;
+    victim->seqNo = seqNo;
+    victim->lastSeen = now;
+    victim->copies = 0;
+    victim->distance = 0;
+    priorCopies = 0;
+
+    return true;
+}
+
+/**
+  * Records the distance back to the originator of a newly accepted frame, as the route to use
+  * for unicast frames sent to it. Must be called immediately after compareSeqNo() accepts the frame.
+  *
+  * @param origin The originator of the frame.
+  *
+  * @param hops The number of times the frame was relayed before reaching us.
+  */
+void MicroBitMeshProtocol::learnRoute(uint16_t origin, uint8_t hops)
+{
+    // The first copy of a flood to arrive has come the shortest way, as every hop takes the same time.
+    // compareSeqNo() has just refreshed the originator's record, so the route is as fresh as the record.
+    for (int i = 0; i < MICROBIT_MESH_RADIO_ORIGIN_TABLE_SIZE; i++)
+    {
+        if (origins[i].origin == origin)
+        {
+            origins[i].distance = hops + 1;
+            return;
+        }
+    }
+}
+
+/**
+  * Updates the neighbour table with a newly accepted frame. Must be called immediately after compareSeqNo() accepts the frame.
+  *
+  * Frames that have not been relayed add or refresh their originator as a neighbour, and its signal strength.
+  * Frames from a known neighbour that have been relayed, or that follow a gap in its sequence numbers, are
+  * floods it sent that did not reach us directly, and lower its delivery ratio.
+  *
+  * @param origin The originator of the frame.
+  *
+  * @param seqNo The sequence number of the frame.
+  *
+  * @param hops The number of times the frame was relayed before reaching us.
+  *
+  * @param rssi The signal strength of the frame, in dBm.
+  *
+  * @param now The current time, in milliseconds.
+  */
+void MicroBitMeshProtocol::learnNeighbour(uint16_t origin, uint8_t seqNo, uint8_t hops, int rssi, uint32_t now)
+{
+    MeshNeighbour *n = NULL;
+    MeshNeighbour *victim = &neighbours[0];
+
+    for (int i = 0; i < MICROBIT_MESH_RADIO_NEIGHBOUR_TABLE_SIZE; i++)
+    {
+        MeshNeighbour *r = &neighbours[i];
+
+        if (r->id == origin)
+        {
+            n = r;
+            break;
+        }
+
+        if (victim->id != 0 && (r->id == 0 || now - r->lastSeen > now - victim->lastSeen))
+            victim = r;
+    }
+
+    // Only a frame heard directly tells us a node is a neighbour.
+    if (n == NULL || now - n->lastSeen >= MICROBIT_MESH_RADIO_NEIGHBOUR_TIMEOUT_MS)
+    {
+        if (hops != 0)
+        {
+            if (n)
+                n->id = 0;
+
+            return;
+        }
+
+        if (n == NULL)
+            n = victim;
+
+        n->id = origin;
+        n->rssiAverage = rssi * 16;
+        n->expected = 0;
+        n->received = 0;
+    }
+    else
+    {
+        // Count the floods we missed altogether since the last one accepted. A large gap is most likely a restart.
+        int missed = (uint8_t)(seqNo - n->seqNo) - 1;
+
+        if (missed > 0 && missed < MICROBIT_MESH_RADIO_NEIGHBOUR_PDR_WINDOW)
+            n->expected += missed;
+    }
+
+    n->seqNo = seqNo;
+    n->expected++;
+
+    if (hops == 0)
+    {
+        // An exponentially weighted moving average, with a weight of 1/4 given to the latest frame.
+        n->rssiAverage += (rssi * 16 - n->rssiAverage) / 4;
+        n->rssi = (n->rssiAverage - 8) / 16;
+        n->lastSeen = now;
+        n->received++;
+    }
+
+    // Age the measurement, so that the ratio follows changes in the link.
+    if (n->expected >= MICROBIT_MESH_RADIO_NEIGHBOUR_PDR_WINDOW)
+    {
+        n->expected /= 2;
+        n->received /= 2;
+    }
+
+    n->pdr = n->expected ? (n->received * 100) / n->expected : 0;
+}
+
+/**
+  * Retrieves the neighbours heard directly within MICROBIT_MESH_RADIO_NEIGHBOUR_TIMEOUT_MS.
+  *
+  * @param neighbours The array to fill in.
+  *
+  * @param max The number of entries in the array.
+  *
+  * @param now The current time, in milliseconds.
+  *
+  * @return The number of entries filled in.
+  */
+int MicroBitMeshProtocol::getNeighbours(MeshNeighbour *neighbours, int max, uint32_t now)
+{
+    int count = 0;
+
+    for (int i = 0; i < MICROBIT_MESH_RADIO_NEIGHBOUR_TABLE_SIZE && count < max; i++)
+    {
+        MeshNeighbour *r = &this->neighbours[i];
+
+        if (r->id != 0 && now - r->lastSeen < MICROBIT_MESH_RADIO_NEIGHBOUR_TIMEOUT_MS)
+            neighbours[count++] = *r;
+    }
+
+    return count;
+}
+
+/**
+  * Determines if any neighbour heard recently has a link that meets the relay link quality thresholds.
+  *
+  * @param now The current time, in milliseconds.
+  *
+  * @return true if such a neighbour exists, or if no neighbour has been heard recently.
+  */
+bool MicroBitMeshProtocol::hasRelayLink(uint32_t now)
+{
+    bool known = false;
+
+    for (int i = 0; i < MICROBIT_MESH_RADIO_NEIGHBOUR_TABLE_SIZE; i++)
+    {
+        MeshNeighbour *r = &neighbours[i];
+
+        if (r->id == 0 || now - r->lastSeen >= MICROBIT_MESH_RADIO_NEIGHBOUR_TIMEOUT_MS)
+            continue;
+
+        if (r->rssi >= relayRssiThreshold && r->pdr >= relayPdrThreshold)
+            return true;
+
+        known = true;
+    }
+
+    // Until we've heard from any neighbour, we have no evidence that our links are poor.
+    return !known;
+}
+
+/**
+  * Finds the route to the given node.
+  *
+  * @param destination The originator id of the node.
+  *
+  * @param now The current time, in milliseconds.
+  *
+  * @return The node's origin record, or NULL if no flood has been heard from it within MICROBIT_MESH_RADIO_ROUTE_TIMEOUT_MS.
+  */
+MeshOriginRecord *MicroBitMeshProtocol::getRoute(uint16_t destination, uint32_t now)
+{
+    for (int i = 0; i < MICROBIT_MESH_RADIO_ORIGIN_TABLE_SIZE; i++)
+    {
+        MeshOriginRecord *r = &origins[i];
+
+        if (r->origin == destination && destination != 0)
+            return (r->distance && now - r->lastSeen < MICROBIT_MESH_RADIO_ROUTE_TIMEOUT_MS) ? r : NULL;
+    }
+
+    return NULL;
+}
+
+/**
+  * Forgets the route to the given node, so that frames sent to it are flooded until a flood from it is next heard.
+  *
+  * @param destination The originator id of the node.
+  */
+void MicroBitMeshProtocol::forgetRoute(uint16_t destination)
+{
+    for (int i = 0; i < MICROBIT_MESH_RADIO_ORIGIN_TABLE_SIZE; i++)
+        if (origins[i].origin == destination)
+            origins[i].distance = 0;
+}
+
+/**
+  * Determines the hop budget to give a unicast frame we originate.
+  *
+  * @param destination The originator id of the node the frame is for.
+  *
+  * @param now The current time, in milliseconds.
+  *
+  * @return The known distance to the destination plus MICROBIT_MESH_RADIO_ROUTE_SLACK, or MICROBIT_MESH_RADIO_ROUTE_FLOOD
+  *         if no route is known.
+  */
+uint8_t MicroBitMeshProtocol::getBudget(uint16_t destination, uint32_t now)
+{
+    MeshOriginRecord *r = getRoute(destination, now);
+
+    if (r == NULL || r->distance + MICROBIT_MESH_RADIO_ROUTE_SLACK >= MICROBIT_MESH_RADIO_ROUTE_FLOOD)
+        return MICROBIT_MESH_RADIO_ROUTE_FLOOD;
+
+    return r->distance + MICROBIT_MESH_RADIO_ROUTE_SLACK;
+}
+
+/**
+  * Applies the hop limit, relay policy and unicast routing to a newly accepted frame. Must be called
+  * immediately after compareSeqNo() accepts the frame.
+  *
+  * Other frames are not relayed by a node whose links to all its neighbours fall below the relay link quality thresholds,
+  * as such a node is at the edge of the mesh, and its relays are heard unreliably, if at all.
+  *
+  * @param protocol The protocol of the frame.
+  *
+  * @param payload The payload of the frame.
+  *
+  * @param hops The number of times the frame was relayed before reaching us.
+  *
+  * @param ttl The hop limit of the frame.
+  *
+  * @param now The current time, in milliseconds.
+  *
+  * @param roll A uniformly distributed random number in the range 0..99, used for probabilistic relaying.
+  *
+  * @return true if this node should relay the frame, false if it should only be delivered.
+  */
+bool MicroBitMeshProtocol::shouldRelay(uint8_t protocol, const uint8_t *payload, uint8_t hops, uint8_t ttl, uint32_t now, int roll)
+{
+    // Frames heard at a distance of ttl hops from their originator are not carried any further.
+    if (hops + 1 >= ttl)
+        return false;
+
+    // Unicast frames with a route are carried only by the nodes on it. Those without one are flooded as usual.
+    if (protocol == MICROBIT_MESH_RADIO_PROTOCOL_UNICAST)
+    {
+        MeshUnicastHeader h;
+        memcpy(&h, payload, sizeof(MeshUnicastHeader));
+
+        if (h.destination == originId)
+            return false;
+
+        if (h.budget != MICROBIT_MESH_RADIO_ROUTE_FLOOD)
+        {
+            // Without a route of our own we can't tell if we're on the path, so leave the frame to nodes that can.
+            MeshOriginRecord *r = getRoute(h.destination, now);
+
+            // The frame has come hops + 1 from its originator to reach us.
+            return r != NULL && hops + 1 + r->distance <= h.budget;
+        }
+    }
+
+    // If we heard plenty of redundant copies of this originator's last flood, our neighbours have it covered.
+    // Sitting this one out lowers the count we'll hear next time, so relaying rotates amongst dense neighbours.
+    if (relayCopyThreshold && priorCopies >= relayCopyThreshold)
+        return false;
+
+    if ((relayRssiThreshold != MICROBIT_MESH_RADIO_RELAY_RSSI_ANY || relayPdrThreshold != MICROBIT_MESH_RADIO_RELAY_PDR_ANY) && !hasRelayLink(now))
+        return false;
+
+    if (relayProbability < 100 && roll >= relayProbability)
+        return false;
+
+    return true;
+}
@@ -28,7 +28,13 @@ DEALINGS IN THE SOFTWARE.
 #include "CodalComponent.h"
 #include "ErrorNo.h"
 #include "CodalFiber.h"
+#include "Timer.h"
+#include "EventModel.h"
 #include "nrf.h"
+#include "MicroBitSchedulerTrace.h"
+#include "MicroBitRadioBridge.h"
+#include "MicroBitEnergy.h"
+#include <stddef.h>
 
 #define DEBUG false
 
@@ -42,117 +48,171 @@ const uint8_t MICROBIT_RADIO_POWER_LEVEL[] = {0xD8, 0xEC, 0xF0, 0xF4, 0xF8, 0xFC
   * The nrf51822 RADIO module supports a number of proprietary modes of operation in addition to the typical BLE usage.
   * This class uses one of these modes to enable simple, point to multipoint communication directly between micro:bits.
   *
-  * TODO: The protocols implemented here do not currently perform any significant form of energy management,
-  * which means that they will consume far more energy than their BLE equivalent. Later versions of the protocol
-  * should look to address this through energy efficient broadcast techniques / sleep scheduling. In particular, the GLOSSY
-  * approach to efficient rebroadcast and network synchronisation would likely provide an effective future step.
+  * By default the receiver is left on permanently, which consumes far more energy than the BLE equivalent.
+  * setDutyCycle() may be used to instead wake the receiver only for short receive windows, kept aligned across
+  * the mesh by the time reference implied by each flood.
   *
-  * TODO: Meshing should also be considered - again a GLOSSY approach may be effective here, and highly complementary to
-  * the master/slave arachitecture of BLE.
+  * Meshing follows the GLOSSY approach: every node relays each new frame exactly MICROBIT_MESH_RADIO_RELAY_DELAY_US
+  * after it is received, with the hop count carried in the frame. Relays at the same distance from the originator therefore
+  * transmit concurrently and interfere constructively, and every node can derive the start time of the flood for free.
   *
   * TODO: This implementation may only operated whilst the BLE stack is disabled. The nrf51822 provides a timeslot API to allow
   * BLE to cohabit with other protocols. Future work to allow this colocation would be benefical, and would also allow for the
   * creation of wireless BLE bridges.
   *
-  * NOTE: This API does not contain any form of encryption, authentication or authorisation. Its purpose is solely for use as a
-  * teaching aid to demonstrate how simple communications operates, and to provide a sandpit through which learning can take place.
-  * For serious applications, BLE should be considered a substantially more secure alternative.
+  * NOTE: By default this API does not contain any form of encryption, authentication or authorisation. Giving a group a key
+  * through cipher.setKey() seals the payload of every flood sent to it, and authenticates the routing header of its unicast
+  * frames, which stays in the clear for relays to read. The hop count, time synchronisation and route advertisement floods
+  * remain unauthenticated. For serious applications, BLE should be considered a substantially more secure alternative.
   */
 
 MicroBitMeshRadio* MicroBitMeshRadio::instance = NULL;
-bool blockRx = false;
-extern "C" void mesh_RADIO_IRQHandler(void)
+
+// PPI channels used to provide hardware timed relays.
+#define MESH_PPI_RX_END_TIMER_START     (MICROBIT_MESH_RADIO_PPI_CHANNEL_BASE)
+#define MESH_PPI_TIMER_RADIO_START      (MICROBIT_MESH_RADIO_PPI_CHANNEL_BASE + 1)
+
+// Radio SHORTS used whilst receiving, and whilst preparing to relay a frame.
+#define MESH_SHORTS_RX                  (RADIO_SHORTS_ADDRESS_RSSISTART_Msk | RADIO_SHORTS_DISABLED_RXEN_Msk)
+#define MESH_SHORTS_RELAY               (RADIO_SHORTS_ADDRESS_RSSISTART_Msk | RADIO_SHORTS_DISABLED_TXEN_Msk)
+
+/**
+  * Places the RADIO into its DISABLED state, and detaches the relay timer.
+  * Must be called with the RADIO interrupt disabled.
+  */
+static void mesh_radio_power_down()
+{
+    NRF_PPI->CHENCLR = 1 << MESH_PPI_RX_END_TIMER_START;
+    NRF_TIMER0->TASKS_STOP = 1;
+    NRF_TIMER0->TASKS_CLEAR = 1;
+
+    NRF_RADIO->SHORTS = RADIO_SHORTS_ADDRESS_RSSISTART_Msk;
+    NRF_RADIO->EVENTS_DISABLED = 0;
+    NRF_RADIO->TASKS_DISABLE = 1;
+    while(NRF_RADIO->EVENTS_DISABLED == 0);
+
+    NRF_RADIO->EVENTS_READY = 0;
+    NRF_RADIO->EVENTS_END = 0;
+}
+
+extern "C" MICROBIT_RAMFUNC void mesh_RADIO_IRQHandler(void)
 {
+    MicroBitMeshRadio *radio = MicroBitMeshRadio::instance;
 
     if(NRF_RADIO->EVENTS_END)
     {
-
-        // immediately start timer for maximum determinism
-        NRF_TIMER0->TASKS_CLEAR = 1;
-        NRF_TIMER0->TASKS_START=1;
         NRF_RADIO->EVENTS_END = 0;
-        if(NRF_RADIO->CRCSTATUS == 1)
+
+        if (NRF_RADIO->STATE == RADIO_STATE_STATE_TxIdle)
+        {
+            NRF_TIMER0->TASKS_STOP = 1;
+            NRF_TIMER0->TASKS_CLEAR = 1;
+
+            radio->recordTransmit(*(uint8_t *) NRF_RADIO->PACKETPTR, radio->getState() != MICROBIT_MESH_RADIO_STATE_TX);
+
+            // We have just finished originating or relaying a frame. Either release it, or hand it on to higher layers.
+            if (radio->getState() == MICROBIT_MESH_RADIO_STATE_TX)
+                radio->transmitComplete();
+            else
+                radio->queueRxBuf();
+
+            NRF_RADIO->PACKETPTR = (uint32_t) &radio->getRxBuf()->length;
+
+            // Return to the receiver. The READY event will restart reception, and rearm the relay timer.
+            NRF_RADIO->SHORTS = MESH_SHORTS_RX;
+            NRF_RADIO->TASKS_DISABLE = 1;
+            return;
+        }
+
+        bool valid = NRF_RADIO->CRCSTATUS == 1;
+        bool fresh = valid && radio->compareSeqNo(radio->getRxBuf()->origin, radio->getRxBuf()->seqNo);
+
+        radio->hopping.recordReceive(radio->getChannel(), valid);
+        radio->recordReceive(valid, valid && !fresh);
+
+        if(fresh)
         {
-            if(MicroBitMeshRadio::instance->compareSeqNo(MicroBitMeshRadio::instance->getRxBuf()->seqNo)){
 #if DEBUG
-                NRF_GPIO->OUT = 1 << 2;
+            NRF_GPIO->OUT = 1 << 2;
 #endif
+            // TIMER0 was started by the END event itself, so capturing it now tells us precisely how long ago
+            // the frame ended, independent of our interrupt latency.
+            NRF_TIMER0->TASKS_CAPTURE[1] = 1;
+            CODAL_TIMESTAMP rxEnd = system_timer_current_time_us() - NRF_TIMER0->CC[1];
+
+            // Associate this packet's rssi value with the data just transferred by DMA receive
+            radio->setRSSI(-((int)NRF_RADIO->RSSISAMPLE));
+            radio->setFloodTiming(rxEnd, radio->getRxBuf());
+            radio->setNetworkTime(radio->getRxBuf());
+            radio->learnRoute(radio->getRxBuf());
+            radio->learnNeighbour(radio->getRxBuf());
+
+            if (radio->shouldRelay(radio->getRxBuf()))
+            {
+                radio->setState(MICROBIT_MESH_RADIO_STATE_RELAY);
+
+                // Prepare the frame for the next hop, and turn the radio around. TIMER0 will start the transmission
+                // through PPI once the relay delay has expired. Further END events must not restart the timer until we're done.
+                radio->getRxBuf()->hops++;
+                NRF_PPI->CHENCLR = 1 << MESH_PPI_RX_END_TIMER_START;
+                NRF_RADIO->SHORTS = MESH_SHORTS_RELAY;
                 NRF_RADIO->TASKS_DISABLE = 1;
-                MicroBitMeshRadio::instance->setBlockTransmit(true);
-                int sample = (int)NRF_RADIO->RSSISAMPLE;
-
-                // Associate this packet's rssi value with the data just
-                // transferred by DMA receive
-                MicroBitMeshRadio::instance->setRSSI(-sample);
-            } else {
-                // cancel timer
+            }
+            else
+            {
+                // The flood ends here, or others are better placed to carry it. Deliver the frame and keep listening.
                 NRF_TIMER0->TASKS_STOP = 1;
                 NRF_TIMER0->TASKS_CLEAR = 1;
-                NRF_RADIO->TASKS_DISABLE = 1;
-            }
 
+                radio->queueRxBuf();
+                NRF_RADIO->PACKETPTR = (uint32_t) &radio->getRxBuf()->length;
+                NRF_RADIO->EVENTS_ADDRESS = 0;
+                NRF_RADIO->TASKS_START = 1;
+            }
         }
         else
         {
-            // cancel timer
+            // Either a corrupt frame, or one we've already seen. Cancel the relay and keep listening.
             NRF_TIMER0->TASKS_STOP = 1;
             NRF_TIMER0->TASKS_CLEAR = 1;
-            NRF_RADIO->TASKS_DISABLE = 1;
-            MicroBitMeshRadio::instance->setRSSI(0);
-            // Now move on to the next buffer, if possible.
-            // The queued packet will get the rssi value set above.
-            MicroBitMeshRadio::instance->queueRxBuf();
-
-            // Set the new buffer for DMA
-            NRF_RADIO->PACKETPTR = (uint32_t) MicroBitMeshRadio::instance->getRxBuf();
-            MicroBitMeshRadio::instance->setBlockTransmit(false);
+            NRF_RADIO->EVENTS_ADDRESS = 0;
+            NRF_RADIO->TASKS_START = 1;
         }
-
-        // Start listening and wait for the END event
-        NRF_RADIO->TASKS_START = 1;
-    } else {
-        // cancel timer
-//        NRF_TIMER0->TASKS_STOP = 1;
-//        NRF_TIMER0->TASKS_CLEAR = 1;
     }
-    if(NRF_RADIO->EVENTS_TXREADY)
-    {
-        NRF_RADIO->EVENTS_TXREADY = 0;
 
-        NRF_RADIO->SHORTS &= ~RADIO_SHORTS_DISABLED_TXEN_Msk;
-        NRF_RADIO->SHORTS |=  RADIO_SHORTS_DISABLED_RXEN_Msk;
-    }
-    if(NRF_RADIO->EVENTS_RXREADY)
+    if(NRF_RADIO->EVENTS_READY)
     {
-        NRF_RADIO->EVENTS_RXREADY = 0;
-
-        NRF_RADIO->SHORTS |=  RADIO_SHORTS_DISABLED_TXEN_Msk;
-        NRF_RADIO->SHORTS &= ~RADIO_SHORTS_DISABLED_RXEN_Msk;
-
-        // Start listening and wait for the END event
-        NRF_RADIO->TASKS_START = 1;
-    }
+        NRF_RADIO->EVENTS_READY = 0;
 
+        if (NRF_RADIO->STATE == RADIO_STATE_STATE_RxIdle)
+        {
+            // Start listening and wait for the END event
+            NRF_PPI->CHENSET = 1 << MESH_PPI_RX_END_TIMER_START;
+            radio->setState(MICROBIT_MESH_RADIO_STATE_RX);
+            NRF_RADIO->EVENTS_ADDRESS = 0;
+            NRF_RADIO->TASKS_START = 1;
 
-}
-extern "C" void mesh_TIMER0_IRQHandler(void)
-{
 #if DEBUG
-    NRF_GPIO->OUT = 0 << 2;
+            NRF_GPIO->OUT = 0 << 2;
 #endif
-    if(NRF_TIMER0->EVENTS_COMPARE[0]) {
-        NRF_RADIO->TASKS_START = 1;
-        NRF_TIMER0->EVENTS_COMPARE[0] = 0;
-//        NRF_TIMER0->TASKS_STOP = 1;
-//        NRF_TIMER0->TASKS_CLEAR = 1;
-
-        // Now move on to the next buffer, if possible.
-        // The queued packet will get the rssi value set above.
-        MicroBitMeshRadio::instance->queueRxBuf();
+        }
+        else if (NRF_RADIO->STATE == RADIO_STATE_STATE_TxIdle && radio->getState() == MICROBIT_MESH_RADIO_STATE_TX)
+        {
+            // We're originating a flood. There's no slot to wait for, so start transmitting immediately.
+            radio->setTransmitTime(radio->getTxBuf());
+            NRF_RADIO->PACKETPTR = (uint32_t) &radio->getTxBuf()->length;
+            NRF_RADIO->TASKS_START = 1;
+        }
+    }
 
-        // Set the new buffer for DMA
-        NRF_RADIO->PACKETPTR = (uint32_t) MicroBitMeshRadio::instance->getRxBuf();
-        MicroBitMeshRadio::instance->setBlockTransmit(false);
+    // Start the next queued transmission, if any, provided we're idle listening. If a frame has started to arrive
+    // we leave it be, and try again once it has been dealt with.
+    if (radio->getState() == MICROBIT_MESH_RADIO_STATE_RX && (NRF_RADIO->STATE == RADIO_STATE_STATE_Rx || NRF_RADIO->STATE == RADIO_STATE_STATE_RxIdle) && NRF_RADIO->EVENTS_ADDRESS == 0 && radio->transmitReady())
+    {
+        radio->setState(MICROBIT_MESH_RADIO_STATE_TX);
+        NRF_PPI->CHENCLR = 1 << MESH_PPI_RX_END_TIMER_START;
+        NRF_RADIO->SHORTS = MESH_SHORTS_RELAY;
+        NRF_RADIO->TASKS_DISABLE = 1;
     }
 }
 
@@ -164,19 +224,44 @@ extern "C" void mesh_TIMER0_IRQHandler(void)
   * @note This class is demand activated, as a result most resources are only
   *       committed if send/recv or event registrations calls are made.
   */
-MicroBitMeshRadio::MicroBitMeshRadio(uint16_t id) : datagram(*this), event (*this)
+MicroBitMeshRadio::MicroBitMeshRadio(uint16_t id) : datagram(*this), event (*this), fragment(*this), aggregate(*this)
 {
     this->id = id;
     this->status = 0;
     this->band  = MICROBIT_MESH_RADIO_DEFAULT_FREQUENCY;
     this->power = MICROBIT_MESH_RADIO_DEFAULT_TX_POWER;
     this->group = MICROBIT_MESH_RADIO_DEFAULT_GROUP;
+    this->rate = MICROBIT_RADIO_DEFAULT_DATA_RATE;
     this->queueDepth = 0;
     this->rssi = 0;
     this->rxQueue = NULL;
     this->rxBuf = NULL;
-    this->blockTransmit = false;
+    this->state = MICROBIT_MESH_RADIO_STATE_RX;
+    this->txQueue = NULL;
+    this->txQueueDepth = 0;
     this->currentSeqNo = 0;
+    this->ttl = MICROBIT_MESH_RADIO_DEFAULT_TTL;
+
+    // Derive a compact identifier from our serial number. Zero is reserved to mark unused origin records.
+    uint32_t serial = microbit_serial_number();
+    this->protocol.originId = (uint16_t)(serial ^ (serial >> 16));
+    if (this->protocol.originId == 0)
+        this->protocol.originId = 1;
+    this->lastHops = 0;
+    this->floodStart = 0;
+    this->dutyPeriod = 0;
+    this->dutyWindow = 0;
+    this->windowAnchor = 0;
+    this->syncRoot = 0;
+    this->syncSamples = 0;
+    this->syncPeriod = 0;
+    this->syncSkew = 0;
+    this->syncLocal = 0;
+    this->syncTime = 0;
+    this->channel = MICROBIT_MESH_RADIO_DEFAULT_FREQUENCY;
+    this->hopDwell = MICROBIT_RADIO_HOPPING_DEFAULT_DWELL_MS * 1000;
+    memset(&this->stats, 0, sizeof(this->stats));
+    this->bridge = NULL;
 
     instance = this;
 }
@@ -201,13 +286,59 @@ int MicroBitMeshRadio::setTransmitPower(int power)
     return DEVICE_OK;
 }
 
+/**
+  * Determines the output power level of the transmitter.
+  *
+  * @return a value in the range 0..7, where 0 is the lowest power and 7 is the highest.
+  */
+int MicroBitMeshRadio::getTransmitPower()
+{
+    return power;
+}
+
+/**
+  * Enables or disables adaptive transmit power control. When enabled, the power level is adjusted automatically
+  * to the lowest that achieves the given delivery rate to the other members of the mesh, based on the outcome of
+  * transmissions reported through reportDelivery(). As the mesh floods frames without acknowledgement, the outcome
+  * must be reported by the application, for instance from replies at the application level. The level set by
+  * setTransmitPower() is the starting point, and the loop starts afresh whenever the group is changed.
+  *
+  * @param enable true to enable adaptive power control, false to hold the current level.
+  *
+  * @param target The percentage of transmission attempts that should succeed, in the range 1 - 100.
+  *
+  * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the target is out of range.
+  */
+int MicroBitMeshRadio::setAdaptivePower(bool enable, int target)
+{
+    return powerControl.configure(enable, target, MICROBIT_RADIO_POWER_LEVELS - 1);
+}
+
+/**
+  * Reports the outcome of one or more transmissions to the adaptive transmit power control loop.
+  * Does nothing unless adaptive power control is enabled.
+  *
+  * @param delivered The number of transmission attempts known to have succeeded.
+  *
+  * @param lost The number of transmission attempts known to have failed.
+  *
+  * @param rssi The signal strength of the reply confirming delivery, in dBm as given by getRSSI(), or zero if unknown.
+  */
+void MicroBitMeshRadio::reportDelivery(int delivered, int lost, int rssi)
+{
+    int level = powerControl.update(power, delivered, lost, rssi);
+
+    if (level != power)
+        setTransmitPower(level);
+}
+
 /**
   * Change the transmission and reception band of the radio to the given channel
   *
   * @param band a frequency band in the range 0 - 100. Each step is 1MHz wide, based at 2400MHz.
   *
   * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the value is out of range,
-  *         or DEVICE_NOT_SUPPORTED if the BLE stack is running.
+  *         DEVICE_NOT_SUPPORTED if the BLE stack is running, or DEVICE_BUSY if a flood in progress did not complete.
   */
 int MicroBitMeshRadio::setFrequencyBand(int band)
 {
@@ -217,13 +348,17 @@ int MicroBitMeshRadio::setFrequencyBand(int band)
     if (band < 0 || band > 100)
         return DEVICE_INVALID_PARAMETER;
 
-    // Record our frequency band locally
-    this->band = band;
-
-    if ( NRF_RADIO->FREQUENCY != (uint32_t) band && (status & MICROBIT_RADIO_STATUS_INITIALISED))
+    // Whilst hopping, the schedule decides which band to use.
+    if (!hopping.isEnabled() && NRF_RADIO->FREQUENCY != (uint32_t) band && (status & MICROBIT_RADIO_STATUS_INITIALISED))
     {
-        // We need to restart the radio for the frequency change to take effect
-        NVIC_DisableIRQ(RADIO_IRQn);
+        // We need to restart the radio for the frequency change to take effect. Wait for any relay in progress to complete.
+        if (waitForIdle() != DEVICE_OK)
+            return DEVICE_BUSY;
+
+        this->band = band;
+        this->channel = band;
+
+        NRF_RADIO->SHORTS = RADIO_SHORTS_ADDRESS_RSSISTART_Msk;
         NRF_RADIO->EVENTS_DISABLED = 0;
         NRF_RADIO->TASKS_DISABLE = 1;
         while (NRF_RADIO->EVENTS_DISABLED == 0);
@@ -235,16 +370,120 @@ int MicroBitMeshRadio::setFrequencyBand(int band)
         NRF_RADIO->TASKS_RXEN = 1;
         while (NRF_RADIO->EVENTS_READY == 0);
 
+        NRF_RADIO->EVENTS_READY = 0;
         NRF_RADIO->EVENTS_END = 0;
+        NRF_RADIO->SHORTS = MESH_SHORTS_RX;
         NRF_RADIO->TASKS_START = 1;
 
         NVIC_ClearPendingIRQ(RADIO_IRQn);
         NVIC_EnableIRQ(RADIO_IRQn);
     }
 
+    // Record our frequency band locally
+    this->band = band;
+
+    return DEVICE_OK;
+}
+
+/**
+  * Change the data rate at which frames are sent and received. All members of a mesh must use the same data rate.
+  *
+  * Higher data rates reduce airtime, and so collisions, energy use and the time a flood takes to cross the mesh,
+  * whereas the long range rates greatly extend the distance covered by each hop. Flood timing is derived from
+  * the airtime at the current rate.
+  *
+  * @param rate One of MICROBIT_RADIO_DATA_RATE_1MBIT (the default), MICROBIT_RADIO_DATA_RATE_2MBIT,
+  *             MICROBIT_RADIO_DATA_RATE_LR_500KBIT or MICROBIT_RADIO_DATA_RATE_LR_125KBIT.
+  *
+  * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the value is out of range,
+  *         DEVICE_NOT_SUPPORTED if the BLE stack is running, or DEVICE_BUSY if a flood in progress did not complete.
+  */
+int MicroBitMeshRadio::setDataRate(int rate)
+{
+    if (ble_running())
+        return DEVICE_NOT_SUPPORTED;
+
+    if (rate < MICROBIT_RADIO_DATA_RATE_1MBIT || rate > MICROBIT_RADIO_DATA_RATE_LR_125KBIT)
+        return DEVICE_INVALID_PARAMETER;
+
+    if (status & MICROBIT_RADIO_STATUS_INITIALISED)
+    {
+        // The RADIO must be disabled whilst its mode is changed. Wait for any relay in progress to complete.
+        if (waitForIdle() != DEVICE_OK)
+            return DEVICE_BUSY;
+
+        NRF_RADIO->SHORTS = RADIO_SHORTS_ADDRESS_RSSISTART_Msk;
+
+        if (NRF_RADIO->STATE != RADIO_STATE_STATE_Disabled)
+        {
+            NRF_RADIO->EVENTS_DISABLED = 0;
+            NRF_RADIO->TASKS_DISABLE = 1;
+            while (NRF_RADIO->EVENTS_DISABLED == 0);
+        }
+
+        microbit_radio_set_data_rate(rate, MICROBIT_RADIO_MAX_PACKET_SIZE + MICROBIT_MESH_RADIO_HEADER_SIZE - 1);
+
+        // If we're between receive windows, the change takes effect when the next opens.
+        if (!(status & MICROBIT_MESH_RADIO_STATUS_ASLEEP))
+        {
+            NRF_RADIO->EVENTS_READY = 0;
+            NRF_RADIO->TASKS_RXEN = 1;
+            while (NRF_RADIO->EVENTS_READY == 0);
+
+            NRF_RADIO->EVENTS_READY = 0;
+            NRF_RADIO->EVENTS_END = 0;
+            NRF_RADIO->SHORTS = MESH_SHORTS_RX;
+            NRF_RADIO->TASKS_START = 1;
+        }
+
+        NVIC_ClearPendingIRQ(RADIO_IRQn);
+        NVIC_EnableIRQ(RADIO_IRQn);
+    }
+
+    this->rate = rate;
+
     return DEVICE_OK;
 }
 
+/**
+  * Waits for any flood being relayed or originated to complete, then disables the RADIO interrupt so that no
+  * other can begin whilst the RADIO is reconfigured. The caller must re-enable the interrupt.
+  *
+  * @return DEVICE_OK with the RADIO interrupt disabled, or DEVICE_BUSY if the radio did not return to
+  *         receiving within MICROBIT_MESH_RADIO_IDLE_TIMEOUT_MS.
+  */
+int MicroBitMeshRadio::waitForIdle()
+{
+    CODAL_TIMESTAMP start = system_timer_current_time();
+
+    while (true)
+    {
+        // Floods only start and advance from the RADIO interrupt, so once it is disabled the state cannot leave RX.
+        NVIC_DisableIRQ(RADIO_IRQn);
+
+        if (state == MICROBIT_MESH_RADIO_STATE_RX)
+            return DEVICE_OK;
+
+        NVIC_EnableIRQ(RADIO_IRQn);
+
+        if (system_timer_current_time() - start > MICROBIT_MESH_RADIO_IDLE_TIMEOUT_MS)
+            return DEVICE_BUSY;
+
+        if (fiber_scheduler_running() && __get_IPSR() == 0)
+            schedule();
+    }
+}
+
+/**
+  * Determines the data rate at which frames are sent and received.
+  *
+  * @return One of MICROBIT_RADIO_DATA_RATE_*.
+  */
+int MicroBitMeshRadio::getDataRate()
+{
+    return rate;
+}
+
 /**
   * Retrieve a pointer to the currently allocated receive buffer. This is the area of memory
   * actively being used by the radio hardware to store incoming data.
@@ -258,9 +497,10 @@ SequencedFrameBuffer* MicroBitMeshRadio::getRxBuf()
 
 /**
   * Attempt to queue a buffer received by the radio hardware, if sufficient space is available.
+  * The frame is copied into a buffer trimmed to its length, and the receive buffer kept for the radio hardware to reuse.
   *
-  * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if a replacement receiver buffer
-  *         could not be allocated (either by policy or memory exhaustion).
+  * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if there is no receive buffer, or DEVICE_NO_RESOURCES
+  *         if the frame could not be copied (either by policy or memory exhaustion).
   */
 int MicroBitMeshRadio::queueRxBuf()
 {
@@ -268,23 +508,30 @@ int MicroBitMeshRadio::queueRxBuf()
         return DEVICE_INVALID_PARAMETER;
 
     if (queueDepth >= MICROBIT_RADIO_MAXIMUM_RX_BUFFERS)
+    {
+        stats.rxOverflows++;
         return DEVICE_NO_RESOURCES;
+    }
 
-    // Store the received RSSI value in the frame
+    // Store the received RSSI value and timestamp in the frame
     rxBuf->rssi = getRSSI();
+    rxBuf->timestamp = stats.lastRxTime;
 
-    // Ensure that a replacement buffer is available before queuing.
-    SequencedFrameBuffer *newRxBuf = new SequencedFrameBuffer();
+    // Only the active DMA target needs room for the largest packet, so queue a copy trimmed to the frame's length.
+    SequencedFrameBuffer *copy = MicroBitRadioFramePool::clone(rxBuf);
 
-    if (newRxBuf == NULL)
+    if (copy == NULL)
+    {
+        stats.rxOverflows++;
         return DEVICE_NO_RESOURCES;
+    }
 
     // We add to the tail of the queue to preserve causal ordering.
-    rxBuf->next = NULL;
+    copy->next = NULL;
 
     if (rxQueue == NULL)
     {
-        rxQueue = rxBuf;
+        rxQueue = copy;
     }
     else
     {
@@ -292,18 +539,60 @@ int MicroBitMeshRadio::queueRxBuf()
         while (p->next != NULL)
             p = p->next;
 
-        p->next = rxBuf;
+        p->next = copy;
     }
 
     // Increase our received packet count
     queueDepth++;
 
-    // Allocate a new buffer for the receiver hardware to use. the old on will be passed on to higher layer protocols/apps.
-    rxBuf = newRxBuf;
-
     return DEVICE_OK;
 }
 
+/**
+  * Records the reception of a frame in the link statistics, along with the time at which it was received.
+  *
+  * @param valid true if the frame passed its CRC check, false otherwise.
+  *
+  * @param duplicate true if the frame was valid, but a copy of one already received.
+  *
+  * @note should only be called from RADIO_IRQHandler...
+  */
+void MicroBitMeshRadio::recordReceive(bool valid, bool duplicate)
+{
+    if (!valid)
+    {
+        stats.rxCrcErrors++;
+        return;
+    }
+
+    if (duplicate)
+    {
+        stats.rxDuplicates++;
+        return;
+    }
+
+    stats.rxFrames++;
+    stats.lastRxTime = system_timer_current_time_us();
+}
+
+/**
+  * Records the transmission of a frame in the link statistics.
+  *
+  * @param length The length field of the frame transmitted.
+  *
+  * @param relay true if the frame was relayed on behalf of another node, false if we originated it.
+  *
+  * @note should only be called from RADIO_IRQHandler...
+  */
+void MicroBitMeshRadio::recordTransmit(uint8_t length, bool relay)
+{
+    stats.txFrames++;
+    stats.airtime += getAirtime(length);
+
+    if (relay)
+        stats.txRelays++;
+}
+
 /**
   * Sets the RSSI for the most recent packet.
   * The value is measured in -dbm. The higher the value, the stronger the signal.
@@ -338,6 +627,33 @@ int MicroBitMeshRadio::getRSSI()
     return this->rssi;
 }
 
+/**
+  * Retrieves the link statistics gathered since the radio was enabled, or since they were last reset.
+  *
+  * @param stats The structure to fill in.
+  *
+  * @return DEVICE_OK on success.
+  */
+int MicroBitMeshRadio::getStats(RadioLinkStats &stats)
+{
+    // The counters are updated from interrupt context, so take a consistent snapshot.
+    target_disable_irq();
+    stats = this->stats;
+    target_enable_irq();
+
+    return DEVICE_OK;
+}
+
+/**
+  * Resets all link statistics to zero.
+  */
+void MicroBitMeshRadio::resetStats()
+{
+    target_disable_irq();
+    memset(&stats, 0, sizeof(stats));
+    target_enable_irq();
+}
+
 /**
   * Initialises the radio for use as a multipoint sender/receiver
   *
@@ -368,11 +684,8 @@ int MicroBitMeshRadio::enable()
 
     // Bring up the nrf RADIO module in Nordic's proprietary 1MBps packet radio mode.
     NRF_RADIO->TXPOWER = (uint32_t)MICROBIT_RADIO_POWER_LEVEL[this->power];
-    NRF_RADIO->FREQUENCY = (uint32_t)this->band;
-
-    // Configure for 1Mbps throughput.
-    // This may sound excessive, but running a high data rates reduces the chances of collisions...
-    NRF_RADIO->MODE = RADIO_MODE_MODE_Nrf_1Mbit;
+    this->channel = hopping.isEnabled() ? getHopChannel() : this->band;
+    NRF_RADIO->FREQUENCY = (uint32_t)this->channel;
 
     // Configure the addresses we use for this protocol. We run ANONYMOUSLY at the core.
     // A 40 bit addresses is used. The first 32 bits match the ASCII character code for "uBit".
@@ -389,11 +702,9 @@ int MicroBitMeshRadio::enable()
     NRF_RADIO->TXADDRESS = 0;
     NRF_RADIO->RXADDRESSES = 1;
 
-    // Packet layout configuration. The nrf51822 has a highly capable and flexible RADIO module that, in addition to transmission
-    // and reception of data, also contains a LENGTH field, two optional additional 1 byte fields (S0 and S1) and a CRC calculation.
-    // Configure the packet format for a simple 8 bit length field and no additional fields.
-    NRF_RADIO->PCNF0 = 0x00000008;
-    NRF_RADIO->PCNF1 = 0x02040000 | MICROBIT_RADIO_MAX_PACKET_SIZE;
+    // Configure the modulation and packet format for our data rate. By default this is 1Mbps, which may sound excessive,
+    // but running a high data rates reduces the chances of collisions...
+    microbit_radio_set_data_rate(this->rate, MICROBIT_RADIO_MAX_PACKET_SIZE + MICROBIT_MESH_RADIO_HEADER_SIZE - 1);
 
     // Most communication channels contain some form of checksum - a mathematical calculation taken based on all the data
     // in a packet, that is also sent as part of the packet. When received, this calculation can be repeated, and the results
@@ -409,46 +720,73 @@ int MicroBitMeshRadio::enable()
     NRF_RADIO->DATAWHITEIV = 0x18;
 
     // Set up the RADIO module to read and write from our internal buffer.
-    NRF_RADIO->PACKETPTR = (uint32_t)rxBuf;
-
-    NRF_TIMER0->PRESCALER = 5;
-    NRF_TIMER0->CC[0] = 100; // 200 microseconds
-    NRF_TIMER0->SHORTS |= TIMER_SHORTS_COMPARE0_CLEAR_Msk
-                              | TIMER_SHORTS_COMPARE0_STOP_Msk;
-    NRF_TIMER0->INTENSET=1 << 16;
-    NRF_TIMER0->TASKS_STOP=1;
-    NRF_TIMER0->TASKS_CLEAR=1;
+    NRF_RADIO->PACKETPTR = (uint32_t) &rxBuf->length;
+
+    // Configure TIMER0 as a 1MHz one-shot timer, used to time the relay of received frames.
+    NRF_TIMER0->TASKS_STOP = 1;
+    NRF_TIMER0->TASKS_CLEAR = 1;
+    NRF_TIMER0->MODE = TIMER_MODE_MODE_Timer;
+    NRF_TIMER0->BITMODE = TIMER_BITMODE_BITMODE_32Bit;
+    NRF_TIMER0->PRESCALER = 4;
+    NRF_TIMER0->CC[0] = MICROBIT_MESH_RADIO_RELAY_DELAY_US;
+    NRF_TIMER0->SHORTS = TIMER_SHORTS_COMPARE0_CLEAR_Msk | TIMER_SHORTS_COMPARE0_STOP_Msk;
+    NRF_TIMER0->INTENCLR = 0xFFFFFFFF;
+
+    // Wire up the relay path in hardware, so that its timing is independent of interrupt latency:
+    // The END of a received frame (re)starts TIMER0, and the expiry of TIMER0 starts the transmission of the relayed frame.
+    NRF_PPI->CH[MESH_PPI_RX_END_TIMER_START].EEP = (uint32_t) &NRF_RADIO->EVENTS_END;
+    NRF_PPI->CH[MESH_PPI_RX_END_TIMER_START].TEP = (uint32_t) &NRF_TIMER0->TASKS_CLEAR;
+    NRF_PPI->FORK[MESH_PPI_RX_END_TIMER_START].TEP = (uint32_t) &NRF_TIMER0->TASKS_START;
+    NRF_PPI->CH[MESH_PPI_TIMER_RADIO_START].EEP = (uint32_t) &NRF_TIMER0->EVENTS_COMPARE[0];
+    NRF_PPI->CH[MESH_PPI_TIMER_RADIO_START].TEP = (uint32_t) &NRF_RADIO->TASKS_START;
+    NRF_PPI->CHENSET = (1 << MESH_PPI_RX_END_TIMER_START) | (1 << MESH_PPI_TIMER_RADIO_START);
 
     // Configure the hardware to issue an interrupt whenever a task is complete (e.g. send/receive).
-//    NRF_RADIO->INTENSET = 0x00000008;
     NVIC_SetPriority(RADIO_IRQn, 2);
     NVIC_SetVector(RADIO_IRQn, (uint32_t) mesh_RADIO_IRQHandler);
-    NVIC_SetPriority(TIMER0_IRQn, 2);
-    NVIC_SetVector(TIMER0_IRQn, (uint32_t) mesh_TIMER0_IRQHandler);
 
-    NRF_RADIO->SHORTS |= RADIO_SHORTS_ADDRESS_RSSISTART_Msk
-                             | RADIO_SHORTS_DISABLED_TXEN_Msk;
-    NRF_RADIO->INTENSET |= RADIO_INTENSET_RXREADY_Msk
-                             | RADIO_INTENSET_TXREADY_Msk
-                             | RADIO_INTENSET_END_Msk;
+    NRF_RADIO->SHORTS = MESH_SHORTS_RX;
+    NRF_RADIO->INTENCLR = 0xFFFFFFFF;
+    NRF_RADIO->INTENSET = RADIO_INTENSET_READY_Msk | RADIO_INTENSET_END_Msk;
 
     // Start listening for the next packet
     NRF_RADIO->EVENTS_READY = 0;
     NRF_RADIO->TASKS_RXEN = 1;
     while(NRF_RADIO->EVENTS_READY == 0);
 
+    NRF_RADIO->EVENTS_READY = 0;
     NRF_RADIO->EVENTS_END = 0;
     NVIC_ClearPendingIRQ(RADIO_IRQn);
     NVIC_EnableIRQ(RADIO_IRQn);
-    NVIC_ClearPendingIRQ(TIMER0_IRQn);
-    NVIC_EnableIRQ(TIMER0_IRQn);
     NRF_RADIO->TASKS_START = 1;
 
+    // The schedule's timer handlers and the radio interrupt also update status, so protect our changes from them.
+    target_disable_irq();
+
     // register ourselves for a callback event, in order to empty the receive queue.
     status |= DEVICE_COMPONENT_STATUS_IDLE_TICK;
 
     // Done. Record that our RADIO is configured.
     status |= MICROBIT_RADIO_STATUS_INITIALISED;
+    status &= ~MICROBIT_MESH_RADIO_STATUS_ASLEEP;
+    target_enable_irq();
+
+    MICROBIT_ENERGY_STATE(MICROBIT_ENERGY_RADIO, true);
+
+    // If we're duty cycled, treat this as the start of a receive window until we learn the mesh's schedule.
+    if (status & MICROBIT_MESH_RADIO_STATUS_DUTY_CYCLE)
+    {
+        windowAnchor = system_timer_current_time_us();
+        system_timer_event_after_us(MICROBIT_MESH_RADIO_DUTY_CYCLE_GUARD_US, id, MICROBIT_MESH_RADIO_EVT_TX_SLOT);
+        system_timer_event_after_us(dutyWindow, id, MICROBIT_MESH_RADIO_EVT_WINDOW_CLOSE);
+    }
+
+    if (hopping.isEnabled())
+        system_timer_event_after_us(hopDwell - getHopTime() % hopDwell, id, MICROBIT_MESH_RADIO_EVT_HOP);
+
+    // Send anything queued whilst we were disabled.
+    if (txQueue)
+        NVIC_SetPendingIRQ(RADIO_IRQn);
 
 #if DEBUG
     NRF_GPIO->DIR = 1 << 2;
@@ -472,18 +810,28 @@ int MicroBitMeshRadio::disable()
     if (!(status & MICROBIT_RADIO_STATUS_INITIALISED))
         return DEVICE_OK;
 
-    // Disable interrupts and STOP any ongoing packet reception.
+    // Disable interrupts and STOP any ongoing packet reception or relay.
     NVIC_DisableIRQ(RADIO_IRQn);
+    mesh_radio_power_down();
+    MICROBIT_ENERGY_STATE(MICROBIT_ENERGY_RADIO, false);
+    NRF_PPI->CHENCLR = 1 << MESH_PPI_TIMER_RADIO_START;
+    state = MICROBIT_MESH_RADIO_STATE_RX;
 
-    NRF_RADIO->EVENTS_DISABLED = 0;
-    NRF_RADIO->TASKS_DISABLE = 1;
-    while(NRF_RADIO->EVENTS_DISABLED == 0);
+    // Stop any duty cycled schedule. This will be restarted if we are reenabled.
+    system_timer_cancel_event(id, MICROBIT_MESH_RADIO_EVT_WINDOW_OPEN);
+    system_timer_cancel_event(id, MICROBIT_MESH_RADIO_EVT_WINDOW_CLOSE);
+    system_timer_cancel_event(id, MICROBIT_MESH_RADIO_EVT_TX_SLOT);
+    system_timer_cancel_event(id, MICROBIT_MESH_RADIO_EVT_HOP);
+
+    target_disable_irq();
+    status &= ~MICROBIT_MESH_RADIO_STATUS_ASLEEP;
 
     // deregister ourselves from the callback event used to empty the receive queue.
     status &= ~DEVICE_COMPONENT_STATUS_IDLE_TICK;
 
     // record that the radio is now disabled
     status &= ~MICROBIT_RADIO_STATUS_INITIALISED;
+    target_enable_irq();
 
     return DEVICE_OK;
 }
@@ -500,6 +848,13 @@ int MicroBitMeshRadio::setGroup(uint8_t group)
     if (ble_running())
         return DEVICE_NOT_SUPPORTED;
 
+    // Each group follows its own hopping order, and has its own neighbours.
+    if (group != this->group)
+    {
+        hopping.setGroup(group);
+        powerControl.reset();
+    }
+
     // Record our group id locally
     this->group = group;
 
@@ -515,11 +870,63 @@ int MicroBitMeshRadio::setGroup(uint8_t group)
   */
 void MicroBitMeshRadio::idleCallback()
 {
+    MICROBIT_TRACE_IDLE(CodalComponent::id);
+
     // Walk the list of packets and process each one.
     while(rxQueue)
     {
         SequencedFrameBuffer *p = rxQueue;
 
+        // Sealed frames are opened before anything else sees them, and discarded if they fail.
+        if (p->version == MICROBIT_RADIO_VERSION_SECURE)
+        {
+            // A unicast header stays in the clear for relays to read, but is authenticated with the rest of the frame.
+            int clear = p->protocol == MICROBIT_MESH_RADIO_PROTOCOL_UNICAST ? MICROBIT_MESH_RADIO_UNICAST_HEADER_SIZE : 0;
+            int len = cipher.open(group, p->protocol, p->origin | (p->seqNo << 16), p->payload, p->length - (MICROBIT_MESH_RADIO_HEADER_SIZE - 1), clear);
+
+            if (len < 0)
+            {
+                delete recv();
+                continue;
+            }
+
+            p->length = len + MICROBIT_MESH_RADIO_HEADER_SIZE - 1;
+            p->version = 1;
+        }
+
+        if (bridge)
+        {
+            bridge->forward(p);
+            delete recv();
+            continue;
+        }
+
+        // Unicast frames are delivered only by their destination, as the protocol they carry. Relays just drop them.
+        if (p->protocol == MICROBIT_MESH_RADIO_PROTOCOL_UNICAST)
+        {
+            MeshUnicastHeader h;
+            int len = p->length - (MICROBIT_MESH_RADIO_HEADER_SIZE - 1) - MICROBIT_MESH_RADIO_UNICAST_HEADER_SIZE;
+
+            // Drop frames too short to hold the header before reading it.
+            if (len < 0)
+            {
+                delete recv();
+                continue;
+            }
+
+            memcpy(&h, p->payload, sizeof(MeshUnicastHeader));
+
+            if (h.destination != protocol.originId)
+            {
+                delete recv();
+                continue;
+            }
+
+            p->protocol = h.protocol;
+            p->length -= MICROBIT_MESH_RADIO_UNICAST_HEADER_SIZE;
+            memmove(p->payload, &p->payload[MICROBIT_MESH_RADIO_UNICAST_HEADER_SIZE], len);
+        }
+
         switch (p->protocol)
         {
             case MICROBIT_RADIO_PROTOCOL_DATAGRAM:
@@ -530,6 +937,24 @@ void MicroBitMeshRadio::idleCallback()
                 event.packetReceived();
                 break;
 
+            case MICROBIT_MESH_RADIO_PROTOCOL_DATAGRAM_BATCH:
+                datagram.batchReceived();
+                break;
+
+            case MICROBIT_MESH_RADIO_PROTOCOL_FRAGMENT:
+                fragment.packetReceived();
+                break;
+
+            case MICROBIT_MESH_RADIO_PROTOCOL_AGGREGATE:
+                aggregate.packetReceived();
+                break;
+
+            case MICROBIT_MESH_RADIO_PROTOCOL_TIMESYNC:
+            case MICROBIT_MESH_RADIO_PROTOCOL_ROUTE:
+                // Already accounted for as the frame was received.
+                delete recv();
+                break;
+
             default:
                 Event(DEVICE_ID_RADIO_DATA_READY, p->protocol);
         }
@@ -544,6 +969,18 @@ void MicroBitMeshRadio::idleCallback()
     }
 }
 
+/**
+  * Hands every frame received to the given bridge, in place of the protocol handlers, or stops doing so.
+  *
+  * @param bridge The bridge to forward frames to, or NULL to deliver them as normal.
+  *
+  * @note called by MicroBitRadioBridge::start() and MicroBitRadioBridge::stop().
+  */
+void MicroBitMeshRadio::setBridge(MicroBitRadioBridge *bridge)
+{
+    this->bridge = bridge;
+}
+
 /**
   * Determines the number of packets ready to be processed.
   *
@@ -584,14 +1021,19 @@ SequencedFrameBuffer* MicroBitMeshRadio::recv()
 }
 
 /**
-  * Transmits the given buffer onto the broadcast radio.
-  * The call will wait until the transmission of the packet has completed before returning.
+  * Queues the given buffer for transmission onto the broadcast radio, as the originator of a new flood.
+  * The call returns immediately. The frame is sent by the radio interrupt handler as soon as the radio is
+  * not busy receiving or relaying, and a MICROBIT_MESH_RADIO_EVT_TX_COMPLETE event is raised once it has gone.
   *
-  * @param data The packet contents to transmit.
+  * @param buffer The packet contents to transmit. The contents are copied, so the buffer may be reused immediately.
   *
-  * @return DEVICE_OK on success, or DEVICE_NOT_SUPPORTED if the BLE stack is running.
+  * @param ttl The hop limit to give the frame, or zero to use the limit set by setTTL(). A limit of one reaches
+  *        immediate neighbours only. Defaults to zero.
+  *
+  * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the buffer is invalid or too long to seal, DEVICE_NO_RESOURCES
+  *         if the transmit queue is full or memory is exhausted, or DEVICE_NOT_SUPPORTED if the BLE stack is running.
   */
-int MicroBitMeshRadio::send(SequencedFrameBuffer *buffer)
+int MicroBitMeshRadio::send(SequencedFrameBuffer *buffer, int ttl)
 {
     if (ble_running())
         return DEVICE_NOT_SUPPORTED;
@@ -599,66 +1041,1030 @@ int MicroBitMeshRadio::send(SequencedFrameBuffer *buffer)
     if (buffer == NULL)
         return DEVICE_INVALID_PARAMETER;
 
-    if (buffer->length > MICROBIT_RADIO_MAX_PACKET_SIZE + MICROBIT_RADIO_HEADER_SIZE - 1)
+    if (buffer->length > MICROBIT_RADIO_MAX_PACKET_SIZE + MICROBIT_MESH_RADIO_HEADER_SIZE - 1 || ttl < 0 || ttl > 255)
         return DEVICE_INVALID_PARAMETER;
 
-    // Wait until the mesh is finished dealing with meshing.
-    while(this->blockTransmit);
-    // Now disable the Radio interrupt. We want to wait until the trasmission completes.
-    NVIC_DisableIRQ(RADIO_IRQn);
-    this->currentSeqNo++;
-    buffer->seqNo = this->currentSeqNo;
+    if (txQueueDepth >= MICROBIT_MESH_RADIO_MAXIMUM_TX_BUFFERS)
+        return DEVICE_NO_RESOURCES;
 
-    // Turn off the transceiver.
-    NRF_RADIO->EVENTS_DISABLED = 0;
-    NRF_RADIO->TASKS_DISABLE = 1;
-    while(NRF_RADIO->EVENTS_DISABLED == 0);
+    // Time synchronization and route advertisements are read by every relay as they pass, so are never sealed.
+    bool secure = cipher.isEnabled(group) && buffer->protocol != MICROBIT_MESH_RADIO_PROTOCOL_TIMESYNC && buffer->protocol != MICROBIT_MESH_RADIO_PROTOCOL_ROUTE;
 
-    // Configure the radio to send the buffer provided.
-    NRF_RADIO->PACKETPTR = (uint32_t) buffer;
+    if (secure && buffer->length + MICROBIT_RADIO_CIPHER_OVERHEAD > MICROBIT_RADIO_MAX_PACKET_SIZE + MICROBIT_MESH_RADIO_HEADER_SIZE - 1)
+        return DEVICE_INVALID_PARAMETER;
 
-    // Turn on the transmitter, and wait for it to signal that it's ready to use.
-    NRF_RADIO->EVENTS_READY = 0;
-    NRF_RADIO->TASKS_TXEN = 1;
-    while (NRF_RADIO->EVENTS_READY == 0);
+    // The queued copy is trimmed to the frame's length, and the header filled in below.
+    SequencedFrameBuffer *p;
 
-    // Start transmission and wait for end of packet.
-    NRF_RADIO->TASKS_START = 1;
-    NRF_RADIO->EVENTS_END = 0;
-    while(NRF_RADIO->EVENTS_END == 0);
+    if (secure)
+    {
+        p = (SequencedFrameBuffer *) MicroBitRadioFramePool::allocate(offsetof(SequencedFrameBuffer, length) + buffer->length + MICROBIT_RADIO_CIPHER_OVERHEAD + 1);
 
-    // Return the radio to using the default receive buffer
-    NRF_RADIO->PACKETPTR = (uint32_t) rxBuf;
+        if (p)
+            memcpy(p, buffer, offsetof(SequencedFrameBuffer, payload));
+    }
+    else
+    {
+        p = MicroBitRadioFramePool::clone(buffer);
+    }
 
-    // Turn off the transmitter.
-    NRF_RADIO->EVENTS_DISABLED = 0;
-    NRF_RADIO->TASKS_DISABLE = 1;
-    while(NRF_RADIO->EVENTS_DISABLED == 0);
+    if (p == NULL)
+        return DEVICE_NO_RESOURCES;
 
-    // Start listening for the next packet
-    NRF_RADIO->EVENTS_READY = 0;
+    this->currentSeqNo++;
+    p->origin = this->protocol.originId;
+    p->seqNo = this->currentSeqNo;
+    p->hops = 0;
+    p->ttl = ttl ? ttl : this->ttl;
+    p->next = NULL;
+
+    if (secure)
+    {
+        // The payload is bound to its originator and sequence number, and any unicast header, which relays leave untouched.
+        int clear = p->protocol == MICROBIT_MESH_RADIO_PROTOCOL_UNICAST ? MICROBIT_MESH_RADIO_UNICAST_HEADER_SIZE : 0;
+        int len = cipher.seal(group, p->protocol, p->origin | (p->seqNo << 16), buffer->payload, buffer->length - (MICROBIT_MESH_RADIO_HEADER_SIZE - 1), clear, p->payload);
+
+        if (len < 0)
+        {
+            delete p;
+            return len;
+        }
+
+        p->length = len + MICROBIT_MESH_RADIO_HEADER_SIZE - 1;
+        p->version = MICROBIT_RADIO_VERSION_SECURE;
+    }
+
+    // Protect shared resource from ISR activity
+    NVIC_DisableIRQ(RADIO_IRQn);
+
+    // We add to the tail of the queue to preserve causal ordering.
+    if (txQueue == NULL)
+    {
+        txQueue = p;
+    }
+    else
+    {
+        SequencedFrameBuffer *q = txQueue;
+        while (q->next != NULL)
+            q = q->next;
+
+        q->next = p;
+    }
+
+    txQueueDepth++;
+
+    // Allow ISR access to shared resource, and prompt it to start transmitting if it is idle.
+    NVIC_SetPendingIRQ(RADIO_IRQn);
+    NVIC_EnableIRQ(RADIO_IRQn);
+
+    return DEVICE_OK;
+}
+
+/**
+  * Determines the number of frames waiting to be transmitted.
+  *
+  * @return The number of frames in the transmit queue, including any currently being sent.
+  */
+int MicroBitMeshRadio::txPending()
+{
+    return txQueueDepth;
+}
+
+/**
+  * Retrieve a pointer to the frame at the head of the transmit queue.
+  *
+  * @return a pointer to the next frame to transmit, or NULL if the queue is empty.
+  */
+SequencedFrameBuffer* MicroBitMeshRadio::getTxBuf()
+{
+    return txQueue;
+}
+
+/**
+  * Determines if the frame at the head of the transmit queue may be sent now.
+  * Frames may be sent whilst we're listening, but if we're duty cycled, only at the start of a receive window.
+  *
+  * @return true if transmission may start.
+  *
+  * @note should only be called from RADIO_IRQHandler...
+  */
+bool MicroBitMeshRadio::transmitReady()
+{
+    if (txQueue == NULL || !(status & MICROBIT_RADIO_STATUS_INITIALISED) || (status & MICROBIT_MESH_RADIO_STATUS_ASLEEP))
+        return false;
+
+    // Only start a flood if it can complete before the mesh hops to another channel.
+    if (hopping.isEnabled())
+    {
+        uint32_t flood = ((uint32_t)ttl + 1) * (getAirtime(txQueue->length) + MICROBIT_MESH_RADIO_RELAY_DELAY_US);
+
+        if (hopDwell - getHopTime() % hopDwell < flood)
+            return false;
+    }
+
+    if (!(status & MICROBIT_MESH_RADIO_STATUS_DUTY_CYCLE))
+        return true;
+
+    // Only one flood is originated per window, so that receivers can use it to align their schedule.
+    // The window timer handlers may preempt us, so the slot is claimed atomically.
+    bool slot = false;
+
+    target_disable_irq();
+    if (status & MICROBIT_MESH_RADIO_STATUS_TX_SLOT)
+    {
+        status &= ~MICROBIT_MESH_RADIO_STATUS_TX_SLOT;
+        slot = true;
+    }
+    target_enable_irq();
+
+    return slot;
+}
+
+/**
+  * Releases the frame at the head of the transmit queue, once it has been sent.
+  *
+  * @note should only be called from RADIO_IRQHandler...
+  */
+void MicroBitMeshRadio::transmitComplete()
+{
+    SequencedFrameBuffer *p = txQueue;
+
+    if (p == NULL)
+        return;
+
+    // As the originator, the start of our own transmission is the reference time for the flood.
+    floodStart = system_timer_current_time_us() - getAirtime(p->length);
+
+    txQueue = p->next;
+    txQueueDepth--;
+    delete p;
+
+    Event(id, MICROBIT_MESH_RADIO_EVT_TX_COMPLETE);
+}
+
+/**
+  * Determines the current activity of the radio.
+  *
+  * @return MICROBIT_MESH_RADIO_STATE_RX, MICROBIT_MESH_RADIO_STATE_RELAY or MICROBIT_MESH_RADIO_STATE_TX.
+  */
+uint8_t MicroBitMeshRadio::getState()
+{
+    return state;
+}
+
+/**
+  * Records the current activity of the radio.
+  *
+  * @param state The new state.
+  *
+  * @note should only be called from RADIO_IRQHandler...
+  */
+void MicroBitMeshRadio::setState(uint8_t state)
+{
+    this->state = state;
+}
+
+/**
+  * Determines if a received frame is new, or a duplicate of one we have already seen.
+  * A record of the latest sequence number heard from each originator is kept, compared so
+  * that wraparound of the 8 bit sequence number is handled. If the frame is new, the record is updated.
+  *
+  * @param origin The originator of the frame.
+  *
+  * @param seqNo The sequence number of the frame.
+  *
+  * @return true if the frame is new and should be processed, false if it should be discarded.
+  *
+  * @note should only be called from RADIO_IRQHandler...
+  */
+bool MicroBitMeshRadio::compareSeqNo(uint16_t origin, uint8_t seqNo)
+{
+    return protocol.compareSeqNo(origin, seqNo, (uint32_t) system_timer_current_time());
+}
+
+/**
+  * Applies the hop limit, relay policy and unicast routing to a newly accepted frame.
+  *
+  * @param frame The frame just received.
+  *
+  * @return true if this node should relay the frame, false if it should only be delivered.
+  *
+  * @note should only be called from RADIO_IRQHandler, immediately after compareSeqNo() accepts the frame.
+  */
+bool MicroBitMeshRadio::shouldRelay(SequencedFrameBuffer *frame)
+{
+    int roll = protocol.relayProbability < 100 ? (int) microbit_random_range(MICROBIT_RANDOM_STREAM_RADIO, 100) : 0;
+
+    return protocol.shouldRelay(frame->protocol, frame->payload, frame->hops, frame->ttl, (uint32_t) system_timer_current_time(), roll);
+}
+
+/**
+  * Records the distance back to the originator of a newly accepted frame, as the route to use
+  * for unicast frames sent to it.
+  *
+  * @param frame The frame just received.
+  *
+  * @note should only be called from RADIO_IRQHandler, immediately after compareSeqNo() accepts the frame.
+  */
+void MicroBitMeshRadio::learnRoute(SequencedFrameBuffer *frame)
+{
+    protocol.learnRoute(frame->origin, frame->hops);
+}
+
+/**
+  * Updates the neighbour table with a newly accepted frame, and the signal strength it was received with.
+  *
+  * @param frame The frame just received.
+  *
+  * @note should only be called from RADIO_IRQHandler, immediately after compareSeqNo() accepts the frame and setRSSI().
+  */
+void MicroBitMeshRadio::learnNeighbour(SequencedFrameBuffer *frame)
+{
+    protocol.learnNeighbour(frame->origin, frame->seqNo, frame->hops, this->rssi, (uint32_t) system_timer_current_time());
+}
+
+/**
+  * Retrieves the nodes heard directly within MICROBIT_MESH_RADIO_NEIGHBOUR_TIMEOUT_MS, and the quality of our link
+  * from each. Neighbours are learned passively, from the floods they originate.
+  *
+  * @param neighbours The array to fill in.
+  *
+  * @param max The number of entries in the array.
+  *
+  * @return The number of entries filled in, or DEVICE_INVALID_PARAMETER if the array is invalid.
+  */
+int MicroBitMeshRadio::getNeighbours(MeshNeighbour *neighbours, int max)
+{
+    if (neighbours == NULL || max < 0)
+        return DEVICE_INVALID_PARAMETER;
+
+    NVIC_DisableIRQ(RADIO_IRQn);
+    int count = protocol.getNeighbours(neighbours, max, (uint32_t) system_timer_current_time());
+    NVIC_EnableIRQ(RADIO_IRQn);
+
+    return count;
+}
+
+/**
+  * Determines the number of hops to the given node, as learned from the floods it originates.
+  *
+  * @param destination The originator id of the node.
+  *
+  * @return The number of hops, where 1 is a direct neighbour, or DEVICE_NO_DATA if no flood has been heard
+  *         from it within MICROBIT_MESH_RADIO_ROUTE_TIMEOUT_MS.
+  */
+int MicroBitMeshRadio::getRouteDistance(uint16_t destination)
+{
+    NVIC_DisableIRQ(RADIO_IRQn);
+    MeshOriginRecord *r = protocol.getRoute(destination, (uint32_t) system_timer_current_time());
+    int distance = r ? r->distance : DEVICE_NO_DATA;
+    NVIC_EnableIRQ(RADIO_IRQn);
+
+    return distance;
+}
+
+/**
+  * Forgets the route to the given node. Frames sent to it are flooded until a flood from it is next heard.
+  * Should be called when a unicast exchange with the node fails, such as when an application level
+  * acknowledgement does not arrive.
+  *
+  * @param destination The originator id of the node.
+  */
+void MicroBitMeshRadio::reportRouteFailure(uint16_t destination)
+{
+    NVIC_DisableIRQ(RADIO_IRQn);
+    protocol.forgetRoute(destination);
+    NVIC_EnableIRQ(RADIO_IRQn);
+}
+
+/**
+  * Queues the given buffer for transmission to a single node. If a route to the node is known, the frame is only
+  * relayed by the nodes on the route, otherwise it is flooded. Either way, only the destination delivers it.
+  * The call returns immediately, as for send().
+  *
+  * @param destination The originator id of the node to send to.
+  *
+  * @param buffer The packet contents to transmit. The payload is limited to MICROBIT_RADIO_MAX_PACKET_SIZE -
+  *        MICROBIT_MESH_RADIO_UNICAST_HEADER_SIZE bytes. The contents are copied, so the buffer may be reused immediately.
+  *
+  * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the buffer or destination is invalid, DEVICE_NO_RESOURCES
+  *         if the transmit queue is full or memory is exhausted, or DEVICE_NOT_SUPPORTED if the BLE stack is running.
+  */
+int MicroBitMeshRadio::sendTo(uint16_t destination, SequencedFrameBuffer *buffer)
+{
+    if (buffer == NULL || destination == 0 || destination == protocol.originId)
+        return DEVICE_INVALID_PARAMETER;
+
+    int len = buffer->length - (MICROBIT_MESH_RADIO_HEADER_SIZE - 1);
+
+    if (len < 0 || len > MICROBIT_RADIO_MAX_PACKET_SIZE - MICROBIT_MESH_RADIO_UNICAST_HEADER_SIZE)
+        return DEVICE_INVALID_PARAMETER;
+
+    SequencedFrameBuffer buf;
+    MeshUnicastHeader h;
+
+    NVIC_DisableIRQ(RADIO_IRQn);
+    h.budget = protocol.getBudget(destination, (uint32_t) system_timer_current_time());
+    NVIC_EnableIRQ(RADIO_IRQn);
+
+    h.destination = destination;
+    h.protocol = buffer->protocol;
+
+    buf.length = buffer->length + MICROBIT_MESH_RADIO_UNICAST_HEADER_SIZE;
+    buf.version = buffer->version;
+    buf.group = buffer->group;
+    buf.protocol = MICROBIT_MESH_RADIO_PROTOCOL_UNICAST;
+    memcpy(buf.payload, &h, sizeof(MeshUnicastHeader));
+    memcpy(&buf.payload[MICROBIT_MESH_RADIO_UNICAST_HEADER_SIZE], buffer->payload, len);
+
+    return send(&buf);
+}
+
+/**
+  * Periodically floods an empty frame, so that the rest of the mesh keeps its route to this node up to date.
+  * This is only needed by nodes that receive unicast frames but send little themselves, such as a gateway
+  * collecting telemetry. Any other flood from the node serves the same purpose.
+  *
+  * @param period The interval between advertisements, in milliseconds, or zero to stop advertising.
+  *
+  * @return DEVICE_OK on success.
+  */
+int MicroBitMeshRadio::setRouteAdvertisement(uint32_t period)
+{
+    system_timer_cancel_event(id, MICROBIT_MESH_RADIO_EVT_ROUTE_ADVERTISE);
+
+    if (period == 0)
+        return DEVICE_OK;
+
+    if (EventModel::defaultEventBus && !(status & MICROBIT_MESH_RADIO_STATUS_ROUTE_LISTENER))
+    {
+        EventModel::defaultEventBus->listen(id, MICROBIT_MESH_RADIO_EVT_ROUTE_ADVERTISE, this, &MicroBitMeshRadio::onRouteAdvertisement, MESSAGE_BUS_LISTENER_IMMEDIATE);
+
+        target_disable_irq();
+        status |= MICROBIT_MESH_RADIO_STATUS_ROUTE_LISTENER;
+        target_enable_irq();
+    }
+
+    system_timer_event_every(period, id, MICROBIT_MESH_RADIO_EVT_ROUTE_ADVERTISE);
+
+    return DEVICE_OK;
+}
+
+/**
+  * Event handler, used to originate route advertisement floods.
+  */
+void MicroBitMeshRadio::onRouteAdvertisement(Event)
+{
+    if (!(status & MICROBIT_RADIO_STATUS_INITIALISED))
+        return;
+
+    SequencedFrameBuffer buf;
+
+    buf.length = MICROBIT_MESH_RADIO_HEADER_SIZE - 1;
+    buf.version = 1;
+    buf.group = 0;
+    buf.protocol = MICROBIT_MESH_RADIO_PROTOCOL_ROUTE;
+
+    send(&buf);
+}
+
+/**
+  * Sets the hop limit given to floods originated by this node.
+  *
+  * @param ttl The maximum number of hops a flood may travel from this node, in the range 1..255.
+  * A value of 1 means only direct neighbours will receive our floods.
+  *
+  * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the value is out of range.
+  */
+int MicroBitMeshRadio::setTTL(int ttl)
+{
+    if (ttl < 1 || ttl > 255)
+        return DEVICE_INVALID_PARAMETER;
+
+    this->ttl = ttl;
+
+    return DEVICE_OK;
+}
+
+/**
+  * Configures the policy this node uses to decide whether to relay new frames. By default, within the hop
+  * limit, every new frame is relayed. In dense meshes this wastes airtime, which can be reclaimed by
+  * relaying only a proportion of frames, or by not relaying when neighbours are evidently doing so.
+  *
+  * @param probability The percentage of new frames that are relayed, in the range 0..100.
+  *
+  * @param copyThreshold If non-zero, frames are not relayed if at least this many redundant copies of the
+  *        previous flood from the same originator were heard. Zero disables this check.
+  *
+  * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if either value is out of range.
+  */
+int MicroBitMeshRadio::setRelayPolicy(int probability, int copyThreshold)
+{
+    if (probability < 0 || probability > 100 || copyThreshold < 0 || copyThreshold > 255)
+        return DEVICE_INVALID_PARAMETER;
+
+    this->protocol.relayProbability = probability;
+    this->protocol.relayCopyThreshold = copyThreshold;
+
+    return DEVICE_OK;
+}
+
+/**
+  * Configures the link quality this node needs to one of its neighbours in order to relay floods. A node whose links
+  * to all its neighbours are weaker than this is at the edge of the mesh, where its relays are heard unreliably and
+  * reach few nodes that don't already have the frame, so it only delivers them. By default, there is no such requirement.
+  *
+  * @param rssi The signal strength a neighbour must be heard with, in dBm, or MICROBIT_MESH_RADIO_RELAY_RSSI_ANY.
+  *
+  * @param pdr The percentage of a neighbour's floods that must be heard directly, or MICROBIT_MESH_RADIO_RELAY_PDR_ANY.
+  *
+  * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if either value is out of range.
+  */
+int MicroBitMeshRadio::setRelayLinkThreshold(int rssi, int pdr)
+{
+    if (rssi < -128 || rssi > 0 || pdr < 0 || pdr > 100)
+        return DEVICE_INVALID_PARAMETER;
+
+    this->protocol.relayRssiThreshold = rssi;
+    this->protocol.relayPdrThreshold = pdr;
+
+    return DEVICE_OK;
+}
+
+/**
+  * Determines the identifier used by this node as the originator of the floods it sends.
+  *
+  * @return The originator id of this node.
+  */
+uint16_t MicroBitMeshRadio::getOriginId()
+{
+    return protocol.originId;
+}
+
+/**
+  * Records the timing of a newly accepted frame, and derives the time at which the originator
+  * started the flood. As every hop of a flood takes exactly the same time (the airtime of the frame
+  * plus MICROBIT_MESH_RADIO_RELAY_DELAY_US), the hop count carried in the frame is sufficient
+  * to compute this reference without any additional synchronisation traffic.
+  *
+  * @param rxEnd The local time, in microseconds, at which the frame finished arriving.
+  *
+  * @param frame The frame just received.
+  *
+  * @note should only be called from RADIO_IRQHandler...
+  */
+void MicroBitMeshRadio::setFloodTiming(CODAL_TIMESTAMP rxEnd, SequencedFrameBuffer *frame)
+{
+    uint32_t airtime = getAirtime(frame->length);
+
+    // Hop h of a flood starts transmitting at t0 + h * (airtime + delay), and we hear the end of it one airtime later.
+    lastHops = frame->hops;
+    floodStart = rxEnd - airtime - (CODAL_TIMESTAMP)frame->hops * (airtime + MICROBIT_MESH_RADIO_RELAY_DELAY_US);
+
+    // Floods are only started a guard time into a receive window, so this also tells us when the window opened.
+    if (status & MICROBIT_MESH_RADIO_STATUS_DUTY_CYCLE)
+        windowAnchor = floodStart - MICROBIT_MESH_RADIO_DUTY_CYCLE_GUARD_US;
+}
+
+/**
+  * Updates our estimate of the network clock from a synchronization frame. The flood timing
+  * for the frame must already have been recorded using setFloodTiming().
+  *
+  * @param frame The synchronization frame just received.
+  *
+  * @note should only be called from RADIO_IRQHandler...
+  */
+void MicroBitMeshRadio::setNetworkTime(SequencedFrameBuffer *frame)
+{
+    if (frame->protocol != MICROBIT_MESH_RADIO_PROTOCOL_TIMESYNC || frame->length < MICROBIT_MESH_RADIO_HEADER_SIZE - 1 + sizeof(CODAL_TIMESTAMP))
+        return;
+
+    // The root follows nobody.
+    if (status & MICROBIT_MESH_RADIO_STATUS_TIMESYNC_ROOT)
+        return;
+
+    CODAL_TIMESTAMP rootTime;
+    memcpy(&rootTime, frame->payload, sizeof(CODAL_TIMESTAMP));
+
+    // Follow the lowest numbered root we can hear, so that competing roots converge on one.
+    if (frame->origin != syncRoot)
+    {
+        if (isTimeSynchronized() && frame->origin > syncRoot)
+            return;
+
+        syncRoot = frame->origin;
+        syncSamples = 0;
+        syncSkew = 0;
+    }
+
+    // Compare the time elapsed on each clock since the last synchronization flood to estimate the drift between them.
+    if (syncSamples > 0 && floodStart > syncLocal)
+    {
+        int64_t localElapsed = (int64_t)(floodStart - syncLocal);
+        int64_t rootElapsed = (int64_t)(rootTime - syncTime);
+        int64_t skew = ((rootElapsed - localElapsed) * 1000000000LL) / localElapsed;
+
+        if (skew > -MICROBIT_MESH_RADIO_TIMESYNC_MAX_SKEW_PPB && skew < MICROBIT_MESH_RADIO_TIMESYNC_MAX_SKEW_PPB)
+            syncSkew = syncSamples == 1 ? (int32_t)skew : syncSkew + ((int32_t)skew - syncSkew) / 4;
+    }
+
+    // The root's blacklist follows the timestamp, along with the pass through the schedule from which it applies.
+    if (frame->length >= MICROBIT_MESH_RADIO_HEADER_SIZE - 1 + sizeof(CODAL_TIMESTAMP) + 2 * sizeof(uint32_t))
+    {
+        uint32_t blacklist;
+        uint32_t epoch;
+        memcpy(&blacklist, &frame->payload[sizeof(CODAL_TIMESTAMP)], sizeof(uint32_t));
+        memcpy(&epoch, &frame->payload[sizeof(CODAL_TIMESTAMP) + sizeof(uint32_t)], sizeof(uint32_t));
+        hopping.setBlacklist(blacklist, epoch);
+    }
+
+    if (syncSamples < 255)
+        syncSamples++;
+
+    syncLocal = floodStart;
+    syncTime = rootTime;
+}
+
+/**
+  * Determines the time at which the most recently received flood was started by its originator.
+  * All nodes that received the same flood share a common estimate of this time, which may be used
+  * as a network wide time reference.
+  *
+  * @return The estimated start time of the last flood, in microseconds on the local system timer,
+  *         or 0 if no flood has yet been received.
+  */
+CODAL_TIMESTAMP MicroBitMeshRadio::getFloodStartTime()
+{
+    return floodStart;
+}
+
+/**
+  * Determines the number of times the most recently received frame was relayed before reaching us.
+  *
+  * @return The hop count of the last frame received, where 0 indicates the frame was heard directly from its originator.
+  */
+int MicroBitMeshRadio::getHopCount()
+{
+    return lastHops;
+}
+
+/**
+  * Configures a duty cycled listening schedule. Rather than leaving the receiver on permanently, the radio
+  * wakes for a short receive window once every period, and is powered down otherwise.
+  *
+  * Windows are kept aligned across the mesh using the time reference carried by each flood. To make this work,
+  * floods are only originated at the start of a window: whilst duty cycling is active, queued frames are held
+  * back until the next window opens, and only one is sent per window.
+  *
+  * @param period The interval between the start of successive receive windows, in milliseconds, or zero to leave the receiver on permanently.
+  *
+  * @param window The length of each receive window, in milliseconds. This should be long enough for a flood to propagate across the whole mesh.
+  *
+  * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the window is zero, not shorter than the period, or
+  *         no longer than MICROBIT_MESH_RADIO_DUTY_CYCLE_GUARD_US.
+  */
+int MicroBitMeshRadio::setDutyCycle(uint32_t period, uint32_t window)
+{
+    if (period > 0 && (window == 0 || window >= period || window * 1000 <= MICROBIT_MESH_RADIO_DUTY_CYCLE_GUARD_US))
+        return DEVICE_INVALID_PARAMETER;
+
+    // Stop any schedule already in progress.
+    system_timer_cancel_event(id, MICROBIT_MESH_RADIO_EVT_WINDOW_OPEN);
+    system_timer_cancel_event(id, MICROBIT_MESH_RADIO_EVT_WINDOW_CLOSE);
+    system_timer_cancel_event(id, MICROBIT_MESH_RADIO_EVT_TX_SLOT);
+
+    if (period == 0)
+    {
+        // Return to always on operation, waking the receiver if necessary.
+        // The radio interrupt tests and clears the transmit slot, so update status atomically with respect to it.
+        target_disable_irq();
+        bool asleep = status & MICROBIT_MESH_RADIO_STATUS_ASLEEP;
+
+        // Release anything that was held back waiting for a window.
+        status &= ~(MICROBIT_MESH_RADIO_STATUS_DUTY_CYCLE | MICROBIT_MESH_RADIO_STATUS_ASLEEP | MICROBIT_MESH_RADIO_STATUS_TX_SLOT);
+        target_enable_irq();
+
+        if (asleep)
+        {
+            NRF_RADIO->SHORTS = MESH_SHORTS_RX;
+            NRF_RADIO->TASKS_RXEN = 1;
+            MICROBIT_ENERGY_STATE(MICROBIT_ENERGY_RADIO, true);
+        }
+
+        NVIC_SetPendingIRQ(RADIO_IRQn);
+        dutyPeriod = 0;
+        dutyWindow = 0;
+        return DEVICE_OK;
+    }
+
+    if (EventModel::defaultEventBus && !(status & MICROBIT_MESH_RADIO_STATUS_SCHEDULE_LISTENER))
+    {
+        EventModel::defaultEventBus->listen(id, MICROBIT_MESH_RADIO_EVT_WINDOW_OPEN, this, &MicroBitMeshRadio::onWindowOpen, MESSAGE_BUS_LISTENER_IMMEDIATE);
+        EventModel::defaultEventBus->listen(id, MICROBIT_MESH_RADIO_EVT_WINDOW_CLOSE, this, &MicroBitMeshRadio::onWindowClose, MESSAGE_BUS_LISTENER_IMMEDIATE);
+        EventModel::defaultEventBus->listen(id, MICROBIT_MESH_RADIO_EVT_TX_SLOT, this, &MicroBitMeshRadio::onTransmitSlot, MESSAGE_BUS_LISTENER_IMMEDIATE);
+
+        target_disable_irq();
+        status |= MICROBIT_MESH_RADIO_STATUS_SCHEDULE_LISTENER;
+        target_enable_irq();
+    }
+
+    dutyPeriod = period * 1000;
+    dutyWindow = window * 1000;
+
+    target_disable_irq();
+    status |= MICROBIT_MESH_RADIO_STATUS_DUTY_CYCLE;
+    target_enable_irq();
+
+    // If we're already running, start a new window now. Otherwise, this will happen when we are enabled.
+    if (status & MICROBIT_RADIO_STATUS_INITIALISED)
+    {
+        windowAnchor = system_timer_current_time_us();
+
+        if (status & MICROBIT_MESH_RADIO_STATUS_ASLEEP)
+            onWindowOpen(Event(id, MICROBIT_MESH_RADIO_EVT_WINDOW_OPEN, CREATE_ONLY));
+        else
+        {
+            system_timer_event_after_us(MICROBIT_MESH_RADIO_DUTY_CYCLE_GUARD_US, id, MICROBIT_MESH_RADIO_EVT_TX_SLOT);
+            system_timer_event_after_us(dutyWindow, id, MICROBIT_MESH_RADIO_EVT_WINDOW_CLOSE);
+        }
+    }
+
+    return DEVICE_OK;
+}
+
+/**
+  * Determines if the receiver is currently listening, or is powered down between duty cycled receive windows.
+  *
+  * @return true if the radio is enabled and in a receive window (or not duty cycled), false otherwise.
+  */
+bool MicroBitMeshRadio::isListening()
+{
+    return (status & MICROBIT_RADIO_STATUS_INITIALISED) && !(status & MICROBIT_MESH_RADIO_STATUS_ASLEEP);
+}
+
+/**
+  * Schedules the opening of the next duty cycled receive window, based on the current window anchor.
+  */
+void MicroBitMeshRadio::scheduleWindow()
+{
+    CODAL_TIMESTAMP now = system_timer_current_time_us();
+    CODAL_TIMESTAMP next;
+
+    // Find the first window start after the current time.
+    if (windowAnchor > now)
+        next = windowAnchor - ((windowAnchor - now) / dutyPeriod) * dutyPeriod;
+    else
+        next = windowAnchor + ((now - windowAnchor) / dutyPeriod + 1) * dutyPeriod;
+
+    system_timer_event_after_us(next - now, id, MICROBIT_MESH_RADIO_EVT_WINDOW_OPEN);
+}
+
+/**
+  * Event handler, called at the start of each duty cycled receive window.
+  * Powers up the receiver, and schedules the end of the window.
+  */
+void MicroBitMeshRadio::onWindowOpen(Event)
+{
+    if (!(status & MICROBIT_MESH_RADIO_STATUS_DUTY_CYCLE) || !(status & MICROBIT_RADIO_STATUS_INITIALISED))
+        return;
+
+    target_disable_irq();
+    status &= ~MICROBIT_MESH_RADIO_STATUS_ASLEEP;
+    target_enable_irq();
+
+    // The READY event will start reception and rearm the relay timer.
+    NRF_RADIO->SHORTS = MESH_SHORTS_RX;
     NRF_RADIO->TASKS_RXEN = 1;
-    while(NRF_RADIO->EVENTS_READY == 0);
+    MICROBIT_ENERGY_STATE(MICROBIT_ENERGY_RADIO, true);
 
-    NRF_RADIO->EVENTS_END = 0;
-    NRF_RADIO->TASKS_START = 1;
+    system_timer_event_after_us(MICROBIT_MESH_RADIO_DUTY_CYCLE_GUARD_US, id, MICROBIT_MESH_RADIO_EVT_TX_SLOT);
+    system_timer_event_after_us(dutyWindow, id, MICROBIT_MESH_RADIO_EVT_WINDOW_CLOSE);
+}
+
+/**
+  * Event handler, called at the end of each duty cycled receive window.
+  * Powers down the receiver, unless it is busy relaying, and schedules the next window.
+  */
+void MicroBitMeshRadio::onWindowClose(Event)
+{
+    if (!(status & MICROBIT_MESH_RADIO_STATUS_DUTY_CYCLE) || !(status & MICROBIT_RADIO_STATUS_INITIALISED))
+        return;
+
+    // Never cut a flood short. Try again shortly.
+    if (state != MICROBIT_MESH_RADIO_STATE_RX)
+    {
+        system_timer_event_after_us(MICROBIT_MESH_RADIO_DUTY_CYCLE_EXTEND_US, id, MICROBIT_MESH_RADIO_EVT_WINDOW_CLOSE);
+        return;
+    }
+
+    NVIC_DisableIRQ(RADIO_IRQn);
+    mesh_radio_power_down();
+    MICROBIT_ENERGY_STATE(MICROBIT_ENERGY_RADIO, false);
+
+    target_disable_irq();
+    status |= MICROBIT_MESH_RADIO_STATUS_ASLEEP;
+    status &= ~MICROBIT_MESH_RADIO_STATUS_TX_SLOT;
+    target_enable_irq();
 
-    // Re-enable the Radio interrupt.
     NVIC_ClearPendingIRQ(RADIO_IRQn);
     NVIC_EnableIRQ(RADIO_IRQn);
 
+    scheduleWindow();
+}
+
+/**
+  * Event handler, called a guard time after the start of each duty cycled receive window.
+  * Allows the next queued flood to be originated.
+  */
+void MicroBitMeshRadio::onTransmitSlot(Event)
+{
+    if (!(status & MICROBIT_MESH_RADIO_STATUS_DUTY_CYCLE) || (status & MICROBIT_MESH_RADIO_STATUS_ASLEEP))
+        return;
+
+    target_disable_irq();
+    status |= MICROBIT_MESH_RADIO_STATUS_TX_SLOT;
+    target_enable_irq();
+
+    NVIC_SetPendingIRQ(RADIO_IRQn);
+}
+
+/**
+  * Configures the mesh to hop between several frequency bands, rather than using a single band.
+  *
+  * Hopping slots are aligned to the network clock, so a root must be established with setTimeSyncRoot(). Until the
+  * clock is available, we dwell on each channel in turn for a full pass of the schedule, so as to hear the root.
+  * Floods are only originated where they can complete before the end of the current slot. Reception statistics
+  * are kept for each channel (see hopping). The root blacklists channels suffering heavy loss, and distributes its
+  * blacklist with the network clock.
+  *
+  * @param channels The frequency bands to hop between, each in the range 0 - 100, or NULL to disable hopping.
+  *
+  * @param count The number of channels, up to MICROBIT_RADIO_HOPPING_MAX_CHANNELS.
+  *
+  * @param dwell The length of each slot, in milliseconds. This should be long enough for several floods to propagate across the mesh.
+  *
+  * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the parameters are out of range,
+  *         or DEVICE_NOT_SUPPORTED if the BLE stack is running.
+  */
+int MicroBitMeshRadio::setHopping(const uint8_t *channels, int count, uint32_t dwell)
+{
+    if (ble_running())
+        return DEVICE_NOT_SUPPORTED;
+
+    if (dwell == 0)
+        return DEVICE_INVALID_PARAMETER;
+
+    int result = hopping.setChannels(channels, count, group);
+
+    if (result != DEVICE_OK)
+        return result;
+
+    system_timer_cancel_event(id, MICROBIT_MESH_RADIO_EVT_HOP);
+    hopDwell = dwell * 1000;
+
+    if (hopping.isEnabled() && EventModel::defaultEventBus && !(status & MICROBIT_MESH_RADIO_STATUS_HOP_LISTENER))
+    {
+        EventModel::defaultEventBus->listen(id, MICROBIT_MESH_RADIO_EVT_HOP, this, &MicroBitMeshRadio::onHop, MESSAGE_BUS_LISTENER_IMMEDIATE);
+
+        target_disable_irq();
+        status |= MICROBIT_MESH_RADIO_STATUS_HOP_LISTENER;
+        target_enable_irq();
+    }
+
+    // Retune straight away, either to the schedule or back to our fixed band.
+    if (status & MICROBIT_RADIO_STATUS_INITIALISED)
+        onHop(Event(id, MICROBIT_MESH_RADIO_EVT_HOP, CREATE_ONLY));
+
     return DEVICE_OK;
 }
-void MicroBitMeshRadio::setBlockTransmit(bool transmit) {
-    this->blockTransmit = transmit;
+
+/**
+  * Determines the frequency band currently in use.
+  *
+  * @return The band set by setFrequencyBand(), or if hopping, the band of the current slot.
+  */
+int MicroBitMeshRadio::getChannel()
+{
+    return channel;
 }
 
-bool MicroBitMeshRadio::compareSeqNo(int newSeq) {
-    bool isGood = MicroBitMeshRadio::instance->getRxBuf()->seqNo < newSeq;
-    if(isGood) {
-        this->currentSeqNo = newSeq;
+/**
+  * Determines the time against which hopping slots are measured: the network clock if we have one,
+  * otherwise our own.
+  *
+  * @return The current time, in microseconds.
+  */
+CODAL_TIMESTAMP MicroBitMeshRadio::getHopTime()
+{
+    return isTimeSynchronized() ? getNetworkTime() : system_timer_current_time_us();
+}
+
+/**
+  * Determines the frequency band to use now, according to the hopping schedule.
+  *
+  * @return The frequency band to use.
+  */
+uint8_t MicroBitMeshRadio::getHopChannel()
+{
+    uint32_t slot = getHopTime() / hopDwell;
+
+    if (isTimeSynchronized())
+        return hopping.getChannel(slot);
+
+    // Without the network clock we can't follow the schedule. Dwell on each channel for a little over a full pass,
+    // so that the root will visit it whilst we are listening.
+    return hopping.getChannel(slot / (hopping.getChannelCount() + 1));
+}
+
+/**
+  * Event handler, called at the end of each hopping slot to retune the radio.
+  */
+void MicroBitMeshRadio::onHop(Event)
+{
+    if (!(status & MICROBIT_RADIO_STATUS_INITIALISED))
+        return;
+
+    // Never cut a frame short. Try again shortly.
+    if (state != MICROBIT_MESH_RADIO_STATE_RX || NRF_RADIO->EVENTS_ADDRESS)
+    {
+        system_timer_event_after_us(MICROBIT_MESH_RADIO_HOP_DEFER_US, id, MICROBIT_MESH_RADIO_EVT_HOP);
+        return;
+    }
+
+    uint8_t c = band;
+
+    if (hopping.isEnabled())
+    {
+        CODAL_TIMESTAMP now = getHopTime();
+
+        // The root judges the channels once per pass through the schedule, on behalf of the whole mesh. A change takes
+        // effect only after two more synchronization floods, which carry it to everyone else.
+        if ((status & MICROBIT_MESH_RADIO_STATUS_TIMESYNC_ROOT) && ((now / hopDwell) % hopping.getChannelCount()) == 0)
+            hopping.updateBlacklist(now / hopDwell, (uint32_t)(2 * (CODAL_TIMESTAMP)syncPeriod * 1000 / (hopDwell * hopping.getChannelCount())) + 1);
+
+        c = getHopChannel();
+        system_timer_event_after_us(hopDwell - now % hopDwell, id, MICROBIT_MESH_RADIO_EVT_HOP);
+    }
+
+    if (c != channel)
+    {
+        channel = c;
+
+        // The new frequency takes effect as the receiver next ramps up. If we're between receive windows, that's
+        // when the next opens. Otherwise, cycle the receiver now; the READY event will restart reception.
+        NVIC_DisableIRQ(RADIO_IRQn);
+        NRF_RADIO->FREQUENCY = (uint32_t) c;
+
+        if (!(status & MICROBIT_MESH_RADIO_STATUS_ASLEEP))
+        {
+            NRF_RADIO->SHORTS = MESH_SHORTS_RX;
+            NRF_RADIO->TASKS_DISABLE = 1;
+        }
+
+        NVIC_EnableIRQ(RADIO_IRQn);
     }
-    return isGood;
+
+    // Anything held back for want of time in the last slot may go now.
+    NVIC_SetPendingIRQ(RADIO_IRQn);
+}
+
+/**
+  * Makes this micro:bit the root of the network clock, or stops it from being so.
+  *
+  * The root periodically originates a synchronization flood, stamped with its local time as transmission begins.
+  * Every receiver compares this with its own estimate of when the flood started, and so tracks both the offset
+  * and the drift of its clock against the root's. If more than one root is active, the one with the lowest
+  * origin identifier is followed.
+  *
+  * @param period The interval between synchronization floods, in milliseconds, or zero to stop acting as root.
+  *
+  * @return DEVICE_OK on success.
+  */
+int MicroBitMeshRadio::setTimeSyncRoot(uint32_t period)
+{
+    system_timer_cancel_event(id, MICROBIT_MESH_RADIO_EVT_TIMESYNC);
+
+    if (period == 0)
+    {
+        target_disable_irq();
+        status &= ~MICROBIT_MESH_RADIO_STATUS_TIMESYNC_ROOT;
+        target_enable_irq();
+
+        syncRoot = 0;
+        syncPeriod = 0;
+        return DEVICE_OK;
+    }
+
+    if (EventModel::defaultEventBus && !(status & MICROBIT_MESH_RADIO_STATUS_TIMESYNC_LISTENER))
+    {
+        EventModel::defaultEventBus->listen(id, MICROBIT_MESH_RADIO_EVT_TIMESYNC, this, &MicroBitMeshRadio::onTimeSync, MESSAGE_BUS_LISTENER_IMMEDIATE);
+
+        target_disable_irq();
+        status |= MICROBIT_MESH_RADIO_STATUS_TIMESYNC_LISTENER;
+        target_enable_irq();
+    }
+
+    target_disable_irq();
+    status |= MICROBIT_MESH_RADIO_STATUS_TIMESYNC_ROOT;
+    target_enable_irq();
+    syncRoot = protocol.originId;
+    syncPeriod = period;
+    system_timer_event_every(period, id, MICROBIT_MESH_RADIO_EVT_TIMESYNC);
+
+    return DEVICE_OK;
+}
+
+/**
+  * Determines the current time on the network clock, maintained by the root set with setTimeSyncRoot().
+  *
+  * @return The network time in microseconds, or 0 if no root has been heard within MICROBIT_MESH_RADIO_TIMESYNC_TIMEOUT_MS.
+  */
+CODAL_TIMESTAMP MicroBitMeshRadio::getNetworkTime()
+{
+    if (status & MICROBIT_MESH_RADIO_STATUS_TIMESYNC_ROOT)
+        return system_timer_current_time_us();
+
+    if (!isTimeSynchronized())
+        return 0;
+
+    // Take a consistent snapshot, as the ISR may update the estimate at any time.
+    NVIC_DisableIRQ(RADIO_IRQn);
+    CODAL_TIMESTAMP local = syncLocal;
+    CODAL_TIMESTAMP root = syncTime;
+    int32_t skew = syncSkew;
+    NVIC_EnableIRQ(RADIO_IRQn);
+
+    int64_t elapsed = (int64_t)(system_timer_current_time_us() - local);
+
+    return root + elapsed + (elapsed * skew) / 1000000000LL;
+}
+
+/**
+  * Determines if the network clock is available.
+  *
+  * @return true if we are the root, or have recently heard from it, false otherwise.
+  */
+bool MicroBitMeshRadio::isTimeSynchronized()
+{
+    if (status & MICROBIT_MESH_RADIO_STATUS_TIMESYNC_ROOT)
+        return true;
+
+    return syncRoot != 0 && syncSamples > 0 && system_timer_current_time_us() - syncLocal < (CODAL_TIMESTAMP)MICROBIT_MESH_RADIO_TIMESYNC_TIMEOUT_MS * 1000;
+}
+
+/**
+  * Stamps a synchronization frame we originate with the current time, as its transmission begins.
+  *
+  * @param frame The frame about to be transmitted.
+  *
+  * @note should only be called from RADIO_IRQHandler...
+  */
+void MicroBitMeshRadio::setTransmitTime(SequencedFrameBuffer *frame)
+{
+    if (frame == NULL || frame->protocol != MICROBIT_MESH_RADIO_PROTOCOL_TIMESYNC)
+        return;
+
+    // The transmitter is already ramped up, so the frame goes out as soon as we trigger START.
+    CODAL_TIMESTAMP now = system_timer_current_time_us();
+    memcpy(frame->payload, &now, sizeof(CODAL_TIMESTAMP));
+}
+
+/**
+  * Event handler, used by the network time root to originate synchronization floods.
+  */
+void MicroBitMeshRadio::onTimeSync(Event)
+{
+    if (!(status & MICROBIT_MESH_RADIO_STATUS_TIMESYNC_ROOT) || !(status & MICROBIT_RADIO_STATUS_INITIALISED))
+        return;
+
+    SequencedFrameBuffer buf;
+
+    // The timestamp itself is filled in as the frame is transmitted.
+    // It is followed by our channel blacklist and its epoch, so the whole mesh skips the same channels at the same time.
+    uint32_t blacklist = hopping.getBlacklist();
+    uint32_t epoch = hopping.getBlacklistEpoch();
+
+    buf.length = sizeof(CODAL_TIMESTAMP) + 2 * sizeof(uint32_t) + MICROBIT_MESH_RADIO_HEADER_SIZE - 1;
+    buf.version = 1;
+    buf.group = 0;
+    buf.protocol = MICROBIT_MESH_RADIO_PROTOCOL_TIMESYNC;
+    memset(buf.payload, 0, sizeof(CODAL_TIMESTAMP));
+    memcpy(&buf.payload[sizeof(CODAL_TIMESTAMP)], &blacklist, sizeof(uint32_t));
+    memcpy(&buf.payload[sizeof(CODAL_TIMESTAMP) + sizeof(uint32_t)], &epoch, sizeof(uint32_t));
+
+    send(&buf);
+}
+
+/**
+  * Calculates the time taken to transmit a frame of the given length, at the current data rate.
+  *
+  * @param length The length field of the frame.
+  *
+  * @return The airtime of the frame, in microseconds.
+  */
+uint32_t MicroBitMeshRadio::getAirtime(uint8_t length)
+{
+    return microbit_radio_airtime(rate, length);
 }
 
 /**
@@ -674,11 +2080,15 @@ int MicroBitMeshRadio::setSleep(bool doSleep)
         if ( status & MICROBIT_RADIO_STATUS_INITIALISED)
         {
             disable();
+            target_disable_irq();
             status |= MICROBIT_RADIO_STATUS_DEEPSLEEP_INIT;
+            target_enable_irq();
         }
         else if ( NVIC_GetEnableIRQ(RADIO_IRQn))
         {
-            status |=  MICROBIT_RADIO_STATUS_DEEPSLEEP_IRQ;
+            target_disable_irq();
+            status |= MICROBIT_RADIO_STATUS_DEEPSLEEP_IRQ;
+            target_enable_irq();
             NVIC_DisableIRQ(RADIO_IRQn);
         }
     }
@@ -686,12 +2096,16 @@ int MicroBitMeshRadio::setSleep(bool doSleep)
     {
         if ( status & MICROBIT_RADIO_STATUS_DEEPSLEEP_INIT)
         {
+            target_disable_irq();
             status &= ~MICROBIT_RADIO_STATUS_DEEPSLEEP_INIT;
+            target_enable_irq();
             enable();
         }
         else if ( status & MICROBIT_RADIO_STATUS_DEEPSLEEP_IRQ)
         {
+            target_disable_irq();
             status &= ~MICROBIT_RADIO_STATUS_DEEPSLEEP_IRQ;
+            target_enable_irq();
             NVIC_EnableIRQ(RADIO_IRQn);
         }
     }
@@ -0,0 +1,409 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "MicroBitConfig.h"
+#include "MicroBitMeshRadio.h"
+#include "MicroBitRandom.h"
+#include "EventModel.h"
+#include "Timer.h"
+#include "CodalFiber.h"
+
+#if MICROBIT_MESH_RADIO_AGGREGATE_HISTOGRAM_SIZE > MICROBIT_RADIO_MAX_PACKET_SIZE || MICROBIT_MESH_RADIO_AGGREGATE_SCALAR_SIZE > MICROBIT_RADIO_MAX_PACKET_SIZE
+    #error "MICROBIT_RADIO_MAX_PACKET_SIZE is too small to carry a partial aggregation result"
+#endif
+
+using namespace codal;
+
+/**
+  * Constructor.
+  *
+  * @param r The underlying radio module used to send and receive data.
+  */
+MicroBitMeshRadioAggregate::MicroBitMeshRadioAggregate(MicroBitMeshRadio &r) : radio(r)
+{
+    memset(&this->query, 0, sizeof(this->query));
+    memset(&this->partial, 0, sizeof(this->partial));
+    this->parent = 0;
+    this->deadline = 0;
+    this->nextQueryId = 0;
+    this->reading = 0;
+    this->hasReading = false;
+    this->active = false;
+    this->listening = false;
+}
+
+/**
+  * Registers our internal event handlers, if not already done.
+  */
+void MicroBitMeshRadioAggregate::listen()
+{
+    if (listening || EventModel::defaultEventBus == NULL)
+        return;
+
+    EventModel::defaultEventBus->listen(DEVICE_ID_RADIO, MICROBIT_MESH_RADIO_EVT_AGGREGATE_FORWARD, this, &MicroBitMeshRadioAggregate::onForward);
+    EventModel::defaultEventBus->listen(DEVICE_ID_RADIO, MICROBIT_MESH_RADIO_EVT_AGGREGATE_REPORT, this, &MicroBitMeshRadioAggregate::onReport);
+    listening = true;
+}
+
+/**
+  * Sets the reading this node contributes to queries. A MICROBIT_MESH_RADIO_EVT_AGGREGATE_QUERY event is raised
+  * as each query arrives, so the reading can be brought up to date before it is reported.
+  *
+  * @param value The reading.
+  */
+void MicroBitMeshRadioAggregate::setReading(int32_t value)
+{
+    // Queries can arrive at any node, so be ready to take part in them without the application having to ask.
+    listen();
+
+    reading = value;
+    hasReading = true;
+}
+
+/**
+  * Withdraws this node's reading. The node still passes on the results of others.
+  */
+void MicroBitMeshRadioAggregate::clearReading()
+{
+    hasReading = false;
+}
+
+/**
+  * Merges a reading into a partial result.
+  */
+void MicroBitMeshRadioAggregate::add(MeshAggregateResult &result, int32_t value)
+{
+    if (result.count < 0xFFFF)
+        result.count++;
+
+    if (query.flags & MICROBIT_MESH_RADIO_AGGREGATE_FLAG_HISTOGRAM)
+    {
+        int64_t bucket = value < query.low ? 0 : ((int64_t)value - query.low) / query.width;
+
+        if (bucket >= MICROBIT_MESH_RADIO_AGGREGATE_BUCKETS)
+            bucket = MICROBIT_MESH_RADIO_AGGREGATE_BUCKETS - 1;
+
+        if (result.histogram[bucket] < 0xFFFF)
+            result.histogram[bucket]++;
+    }
+    else
+    {
+        result.sum += value;
+
+        if (value < result.min)
+            result.min = value;
+
+        if (value > result.max)
+            result.max = value;
+    }
+}
+
+/**
+  * Starts taking part in a query: resets our partial result, and schedules passing the
+  * query on and reporting our result.
+  */
+void MicroBitMeshRadioAggregate::begin()
+{
+    uint32_t now = (uint32_t) system_timer_current_time();
+
+    system_timer_cancel_event(DEVICE_ID_RADIO, MICROBIT_MESH_RADIO_EVT_AGGREGATE_FORWARD);
+    system_timer_cancel_event(DEVICE_ID_RADIO, MICROBIT_MESH_RADIO_EVT_AGGREGATE_REPORT);
+
+    // Our own reading is added as we report, so that it can be updated in response to the query.
+    memset(&partial, 0, sizeof(partial));
+    partial.min = INT32_MAX;
+    partial.max = INT32_MIN;
+    active = true;
+
+    if (parent == 0)
+    {
+        system_timer_event_after(deadline - now, DEVICE_ID_RADIO, MICROBIT_MESH_RADIO_EVT_AGGREGATE_REPORT);
+        return;
+    }
+
+    Event(DEVICE_ID_RADIO, MICROBIT_MESH_RADIO_EVT_AGGREGATE_QUERY);
+
+    if (query.depth < MICROBIT_MESH_RADIO_AGGREGATE_MAX_DEPTH)
+        system_timer_event_after(1 + microbit_random_range(MICROBIT_RANDOM_STREAM_RADIO, MICROBIT_MESH_RADIO_AGGREGATE_JITTER_MS), DEVICE_ID_RADIO, MICROBIT_MESH_RADIO_EVT_AGGREGATE_FORWARD);
+
+    // Report at a random point in the first half of our depth's slot, which ends as our parent's begins.
+    uint32_t slot = query.slot;
+    int32_t delay = (int32_t)(deadline - now) - (int32_t)(query.depth * slot) + (int32_t) microbit_random_range(MICROBIT_RANDOM_STREAM_RADIO, slot / 2 + 1);
+
+    system_timer_event_after(delay > 0 ? delay : 1, DEVICE_ID_RADIO, MICROBIT_MESH_RADIO_EVT_AGGREGATE_REPORT);
+}
+
+/**
+  * Handles a received query, joining the tree if the query is new.
+  */
+void MicroBitMeshRadioAggregate::queryReceived(SequencedFrameBuffer *packet)
+{
+    MeshAggregateQuery q;
+    memcpy(&q, packet->payload, sizeof(MeshAggregateQuery));
+
+    // Each node joins a query once, under the first neighbour it hears it from, and ignores our own being passed back.
+    if ((q.root == query.root && q.queryId == query.queryId) || q.root == radio.getOriginId())
+        return;
+
+    if (q.slot == 0 || q.depth >= MICROBIT_MESH_RADIO_AGGREGATE_MAX_DEPTH || ((q.flags & MICROBIT_MESH_RADIO_AGGREGATE_FLAG_HISTOGRAM) && q.width == 0))
+        return;
+
+    listen();
+
+    query = q;
+    query.depth++;
+    parent = packet->origin;
+    deadline = (uint32_t) system_timer_current_time() + q.remaining;
+
+    begin();
+}
+
+/**
+  * Handles a received partial result, merging it into ours if it was sent to us.
+  */
+void MicroBitMeshRadioAggregate::partialReceived(SequencedFrameBuffer *packet)
+{
+    MeshAggregatePartial p;
+    int len = packet->length - (MICROBIT_MESH_RADIO_HEADER_SIZE - 1);
+    bool histogram = query.flags & MICROBIT_MESH_RADIO_AGGREGATE_FLAG_HISTOGRAM;
+
+    memcpy(&p, packet->payload, sizeof(MeshAggregatePartial));
+
+    if (!active || p.root != query.root || p.queryId != query.queryId || p.parent != radio.getOriginId())
+        return;
+
+    if (len < (histogram ? MICROBIT_MESH_RADIO_AGGREGATE_HISTOGRAM_SIZE : MICROBIT_MESH_RADIO_AGGREGATE_SCALAR_SIZE) || p.count == 0)
+        return;
+
+    uint8_t *data = &packet->payload[MICROBIT_MESH_RADIO_AGGREGATE_PARTIAL_SIZE];
+
+    partial.count = min((int)partial.count + p.count, 0xFFFF);
+
+    if (histogram)
+    {
+        for (int i = 0; i < MICROBIT_MESH_RADIO_AGGREGATE_BUCKETS; i++)
+        {
+            uint16_t n;
+            memcpy(&n, &data[i * sizeof(uint16_t)], sizeof(uint16_t));
+            partial.histogram[i] = min((int)partial.histogram[i] + n, 0xFFFF);
+        }
+    }
+    else
+    {
+        int32_t v[3];
+        memcpy(v, data, sizeof(v));
+        partial.sum += v[0];
+
+        if (v[1] < partial.min)
+            partial.min = v[1];
+
+        if (v[2] > partial.max)
+            partial.max = v[2];
+    }
+}
+
+/**
+  * Passes the query on to our neighbours, with the time remaining until the root's window closes.
+  *
+  * @return DEVICE_OK on success, DEVICE_INVALID_STATE if the window has closed, or an error returned by MicroBitMeshRadio::send().
+  */
+int MicroBitMeshRadioAggregate::forward()
+{
+    int32_t remaining = (int32_t)(deadline - (uint32_t) system_timer_current_time());
+
+    if (!active || remaining <= 0)
+        return DEVICE_INVALID_STATE;
+
+    SequencedFrameBuffer buf;
+
+    query.remaining = remaining;
+
+    buf.length = MICROBIT_MESH_RADIO_AGGREGATE_QUERY_SIZE + MICROBIT_MESH_RADIO_HEADER_SIZE - 1;
+    buf.version = 1;
+    buf.group = 0;
+    buf.protocol = MICROBIT_MESH_RADIO_PROTOCOL_AGGREGATE;
+    memcpy(buf.payload, &query, sizeof(MeshAggregateQuery));
+
+    // Queries and results go to immediate neighbours only. Passing them on is up to the neighbours themselves.
+    return radio.send(&buf, 1);
+}
+
+/**
+  * Event handler, called to pass the query on to our neighbours.
+  */
+void MicroBitMeshRadioAggregate::onForward(Event)
+{
+    forward();
+}
+
+/**
+  * Event handler, called at our reporting slot to send our partial result to our parent, or at the end of
+  * the window if we are the root.
+  */
+void MicroBitMeshRadioAggregate::onReport(Event)
+{
+    if (!active)
+        return;
+
+    if (hasReading)
+        add(partial, reading);
+
+    active = false;
+
+    if (parent == 0)
+    {
+        Event(DEVICE_ID_RADIO, MICROBIT_MESH_RADIO_EVT_AGGREGATED);
+        return;
+    }
+
+    SequencedFrameBuffer buf;
+    MeshAggregatePartial p;
+    bool histogram = query.flags & MICROBIT_MESH_RADIO_AGGREGATE_FLAG_HISTOGRAM;
+    int len = histogram ? MICROBIT_MESH_RADIO_AGGREGATE_HISTOGRAM_SIZE : MICROBIT_MESH_RADIO_AGGREGATE_SCALAR_SIZE;
+
+    p.type = MICROBIT_MESH_RADIO_AGGREGATE_TYPE_PARTIAL;
+    p.queryId = query.queryId;
+    p.root = query.root;
+    p.parent = parent;
+    p.count = partial.count;
+
+    buf.length = len + MICROBIT_MESH_RADIO_HEADER_SIZE - 1;
+    buf.version = 1;
+    buf.group = 0;
+    buf.protocol = MICROBIT_MESH_RADIO_PROTOCOL_AGGREGATE;
+    memcpy(buf.payload, &p, sizeof(MeshAggregatePartial));
+
+    if (histogram)
+    {
+        memcpy(&buf.payload[MICROBIT_MESH_RADIO_AGGREGATE_PARTIAL_SIZE], partial.histogram, sizeof(partial.histogram));
+    }
+    else
+    {
+        int32_t v[3] = { partial.sum, partial.min, partial.max };
+        memcpy(&buf.payload[MICROBIT_MESH_RADIO_AGGREGATE_PARTIAL_SIZE], v, sizeof(v));
+    }
+
+    radio.send(&buf, 1);
+}
+
+/**
+  * Issues a query as root, and waits for its window to close.
+  */
+int MicroBitMeshRadioAggregate::issue(MeshAggregateResult &result, uint8_t flags, int low, int width, uint32_t window)
+{
+    // Every depth needs long enough for the query to reach it, and for its children to report.
+    if (window < (MICROBIT_MESH_RADIO_AGGREGATE_MAX_DEPTH + 1) * 2 * MICROBIT_MESH_RADIO_AGGREGATE_JITTER_MS || window > 0xFFFF)
+        return DEVICE_INVALID_PARAMETER;
+
+    if (active)
+        return DEVICE_BUSY;
+
+    listen();
+
+    query.type = MICROBIT_MESH_RADIO_AGGREGATE_TYPE_QUERY;
+    query.queryId = ++nextQueryId;
+    query.root = radio.getOriginId();
+    query.depth = 0;
+    query.flags = flags;
+    query.slot = window / (MICROBIT_MESH_RADIO_AGGREGATE_MAX_DEPTH + 1);
+    query.low = low;
+    query.width = width;
+    parent = 0;
+    deadline = (uint32_t) system_timer_current_time() + window;
+
+    begin();
+
+    int r = forward();
+
+    if (r != DEVICE_OK)
+    {
+        system_timer_cancel_event(DEVICE_ID_RADIO, MICROBIT_MESH_RADIO_EVT_AGGREGATE_REPORT);
+        active = false;
+        return r;
+    }
+
+    fiber_wait_for_event(DEVICE_ID_RADIO, MICROBIT_MESH_RADIO_EVT_AGGREGATED);
+
+    result = partial;
+    return DEVICE_OK;
+}
+
+/**
+  * Gathers the count, sum, minimum and maximum of the readings of every node that can be reached within
+  * MICROBIT_MESH_RADIO_AGGREGATE_MAX_DEPTH hops, including our own. Blocks the calling fiber until the window closes.
+  *
+  * @param result The structure to fill in.
+  *
+  * @param window The time allowed for results to be gathered, in milliseconds. Larger windows allow more time for each depth.
+  *
+  * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the window is out of range, DEVICE_BUSY if a
+  *         query is already in progress, or an error returned by MicroBitMeshRadio::send().
+  */
+int MicroBitMeshRadioAggregate::gather(MeshAggregateResult &result, uint32_t window)
+{
+    return issue(result, 0, 0, 1, window);
+}
+
+/**
+  * Gathers a histogram of the readings of every node that can be reached within MICROBIT_MESH_RADIO_AGGREGATE_MAX_DEPTH
+  * hops, including our own. Readings below the first bucket are counted in it, as are those above the last in the last.
+  * Blocks the calling fiber until the window closes.
+  *
+  * @param result The structure to fill in.
+  *
+  * @param low The smallest reading counted into the first bucket.
+  *
+  * @param width The range of readings counted into each bucket.
+  *
+  * @param window The time allowed for results to be gathered, in milliseconds.
+  *
+  * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if a parameter is out of range, DEVICE_BUSY if a
+  *         query is already in progress, or an error returned by MicroBitMeshRadio::send().
+  */
+int MicroBitMeshRadioAggregate::gatherHistogram(MeshAggregateResult &result, int low, int width, uint32_t window)
+{
+    if (low < INT16_MIN || low > INT16_MAX || width <= 0 || width > 0xFFFF)
+        return DEVICE_INVALID_PARAMETER;
+
+    return issue(result, MICROBIT_MESH_RADIO_AGGREGATE_FLAG_HISTOGRAM, low, width, window);
+}
+
+/**
+  * Protocol handler callback. This is called when the radio receives a packet marked as an aggregation packet.
+  *
+  * This function processes this packet, joining queries and merging partial results.
+  */
+void MicroBitMeshRadioAggregate::packetReceived()
+{
+    SequencedFrameBuffer *packet = radio.recv();
+    int len = packet->length - (MICROBIT_MESH_RADIO_HEADER_SIZE - 1);
+
+    if (len >= MICROBIT_MESH_RADIO_AGGREGATE_QUERY_SIZE && packet->payload[0] == MICROBIT_MESH_RADIO_AGGREGATE_TYPE_QUERY)
+        queryReceived(packet);
+
+    if (len >= MICROBIT_MESH_RADIO_AGGREGATE_PARTIAL_SIZE && packet->payload[0] == MICROBIT_MESH_RADIO_AGGREGATE_TYPE_PARTIAL)
+        partialReceived(packet);
+
+    delete packet;
+}
@@ -24,6 +24,9 @@ DEALINGS IN THE SOFTWARE.
 */
 
 #include "MicroBitMeshRadio.h"
+#include "EventModel.h"
+#include "Timer.h"
+#include <stddef.h>
 
 using namespace codal;
 
@@ -50,6 +53,8 @@ using namespace codal;
 MicroBitMeshRadioDatagram::MicroBitMeshRadioDatagram(MicroBitMeshRadio &r) : radio(r)
 {
     this->rxQueue = NULL;
+    this->txBatch = NULL;
+    this->batchDeadline = 0;
 }
 
 /**
@@ -107,42 +112,135 @@ PacketBuffer MicroBitMeshRadioDatagram::recv()
 /**
   * Transmits the given buffer onto the broadcast radio.
   *
-  * This is a synchronous call that will wait until the transmission of the packet
-  * has completed before returning.
+  * The packet is queued for transmission, and this call returns immediately. A MICROBIT_MESH_RADIO_EVT_TX_COMPLETE
+  * event is raised once it has been sent.
   *
   * @param buffer The packet contents to transmit.
   *
   * @param len The number of bytes to transmit.
   *
-  * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the buffer is invalid,
-  *         or the number of bytes to transmit is greater than `MICROBIT_MESH_RADIO_MAX_PACKET_SIZE + MICROBIT_MESH_RADIO_HEADER_SIZE`.
+  * @return DEVICE_OK on success, DEVICE_NO_RESOURCES if the transmit queue is full, or DEVICE_INVALID_PARAMETER if the buffer is invalid,
+  *         or the number of bytes to transmit is greater than `MICROBIT_RADIO_MAX_PACKET_SIZE`.
   */
 int MicroBitMeshRadioDatagram::send(uint8_t *buffer, int len)
 {
-    if (buffer == NULL || len < 0 || len > MICROBIT_RADIO_MAX_PACKET_SIZE + MICROBIT_MESH_RADIO_HEADER_SIZE - 1)
+    if (buffer == NULL || len < 0 || len > MICROBIT_RADIO_MAX_PACKET_SIZE)
         return DEVICE_INVALID_PARAMETER;
 
-    SequencedFrameBuffer buf;
+    // Datagrams too large to share a frame are always sent on their own.
+    if (batchDeadline == 0 || len > MICROBIT_RADIO_MAX_PACKET_SIZE - MICROBIT_MESH_RADIO_DATAGRAM_BATCH_ITEM_HEADER)
+    {
+        SequencedFrameBuffer buf;
 
-    buf.length = len + MICROBIT_MESH_RADIO_HEADER_SIZE - 1;
-    buf.version = 1;
-    buf.group = 0;
-    buf.protocol = MICROBIT_MESH_RADIO_PROTOCOL_DATAGRAM;
-    memcpy(buf.payload, buffer, len);
+        buf.length = len + MICROBIT_MESH_RADIO_HEADER_SIZE - 1;
+        buf.version = 1;
+        buf.group = 0;
+        buf.protocol = MICROBIT_MESH_RADIO_PROTOCOL_DATAGRAM;
+        memcpy(buf.payload, buffer, len);
+
+        // Preserve ordering with anything we're holding.
+        flush();
+
+        return radio.send(&buf);
+    }
+
+    // If this datagram won't fit alongside those already held, send those first.
+    if (txBatch && txBatch->length - (MICROBIT_MESH_RADIO_HEADER_SIZE - 1) + MICROBIT_MESH_RADIO_DATAGRAM_BATCH_ITEM_HEADER + len > MICROBIT_RADIO_MAX_PACKET_SIZE)
+        flush();
+
+    if (txBatch == NULL)
+    {
+        txBatch = new SequencedFrameBuffer();
 
-    return radio.send(&buf);
+        if (txBatch == NULL)
+            return DEVICE_NO_RESOURCES;
+
+        txBatch->length = MICROBIT_MESH_RADIO_HEADER_SIZE - 1;
+        txBatch->version = 1;
+        txBatch->group = 0;
+        txBatch->protocol = MICROBIT_MESH_RADIO_PROTOCOL_DATAGRAM_BATCH;
+
+        system_timer_event_after(batchDeadline, DEVICE_ID_RADIO, MICROBIT_MESH_RADIO_EVT_DATAGRAM_FLUSH);
+    }
+
+    uint8_t *p = txBatch->payload + txBatch->length - (MICROBIT_MESH_RADIO_HEADER_SIZE - 1);
+    *p++ = len;
+    memcpy(p, buffer, len);
+    txBatch->length += MICROBIT_MESH_RADIO_DATAGRAM_BATCH_ITEM_HEADER + len;
+
+    // Send as soon as there is no room for anything more.
+    if (txBatch->length - (MICROBIT_MESH_RADIO_HEADER_SIZE - 1) + MICROBIT_MESH_RADIO_DATAGRAM_BATCH_ITEM_HEADER >= MICROBIT_RADIO_MAX_PACKET_SIZE)
+        return flush();
+
+    return DEVICE_OK;
+}
+
+/**
+  * Enables or disables aggregation of outgoing datagrams. Every datagram sent normally costs a flood of its own
+  * across the whole mesh. When aggregation is enabled, small datagrams are instead packed together into a single frame,
+  * which is sent when it is full, or once the oldest datagram in it has waited for the given deadline.
+  * Receivers split the frame back into individual datagrams, so this is transparent to recv().
+  *
+  * @param deadline The longest time, in milliseconds, a datagram may be held awaiting others. Zero disables aggregation,
+  *        and sends any datagrams already held.
+  *
+  * @return DEVICE_OK on success.
+  */
+int MicroBitMeshRadioDatagram::setAggregation(uint32_t deadline)
+{
+    if (deadline && batchDeadline == 0 && EventModel::defaultEventBus)
+        EventModel::defaultEventBus->listen(DEVICE_ID_RADIO, MICROBIT_MESH_RADIO_EVT_DATAGRAM_FLUSH, this, &MicroBitMeshRadioDatagram::onFlushDeadline);
+
+    if (deadline == 0 && batchDeadline && EventModel::defaultEventBus)
+        EventModel::defaultEventBus->ignore(DEVICE_ID_RADIO, MICROBIT_MESH_RADIO_EVT_DATAGRAM_FLUSH, this, &MicroBitMeshRadioDatagram::onFlushDeadline);
+
+    batchDeadline = deadline;
+
+    if (deadline == 0)
+        flush();
+
+    return DEVICE_OK;
+}
+
+/**
+  * Sends any aggregated datagrams immediately, without waiting for the frame to fill or the deadline to expire.
+  *
+  * @return DEVICE_OK on success, or the error returned by MicroBitMeshRadio::send().
+  */
+int MicroBitMeshRadioDatagram::flush()
+{
+    if (txBatch == NULL)
+        return DEVICE_OK;
+
+    SequencedFrameBuffer *p = txBatch;
+    txBatch = NULL;
+
+    system_timer_cancel_event(DEVICE_ID_RADIO, MICROBIT_MESH_RADIO_EVT_DATAGRAM_FLUSH);
+
+    int result = radio.send(p);
+    delete p;
+
+    return result;
+}
+
+/**
+  * Event handler, called when aggregated datagrams have waited for the configured deadline.
+  */
+void MicroBitMeshRadioDatagram::onFlushDeadline(Event)
+{
+    flush();
 }
 
 /**
   * Transmits the given string onto the broadcast radio.
   *
-  * This is a synchronous call that will wait until the transmission of the packet
-  * has completed before returning.
+  * The packet is queued for transmission, and this call returns immediately. A MICROBIT_MESH_RADIO_EVT_TX_COMPLETE
+  * event is raised once it has been sent.
   *
   * @param data The packet contents to transmit.
   *
-  * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the buffer is invalid,
-  *         or the number of bytes to transmit is greater than `MICROBIT_MESH_RADIO_MAX_PACKET_SIZE + MICROBIT_MESH_RADIO_HEADER_SIZE`.
+  * @return DEVICE_OK on success, DEVICE_NO_RESOURCES if the transmit queue is full, or DEVICE_INVALID_PARAMETER if the buffer is invalid,
+  *         or the number of bytes to transmit is greater than `MICROBIT_RADIO_MAX_PACKET_SIZE`.
   */
 int MicroBitMeshRadioDatagram::send(PacketBuffer data)
 {
@@ -152,19 +250,69 @@ int MicroBitMeshRadioDatagram::send(PacketBuffer data)
 /**
   * Transmits the given string onto the broadcast radio.
   *
-  * This is a synchronous call that will wait until the transmission of the packet
-  * has completed before returning.
+  * The packet is queued for transmission, and this call returns immediately. A MICROBIT_MESH_RADIO_EVT_TX_COMPLETE
+  * event is raised once it has been sent.
   *
   * @param data The packet contents to transmit.
   *
-  * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the buffer is invalid,
-  *         or the number of bytes to transmit is greater than `MICROBIT_MESH_RADIO_MAX_PACKET_SIZE + MICROBIT_MESH_RADIO_HEADER_SIZE`.
+  * @return DEVICE_OK on success, DEVICE_NO_RESOURCES if the transmit queue is full, or DEVICE_INVALID_PARAMETER if the buffer is invalid,
+  *         or the number of bytes to transmit is greater than `MICROBIT_RADIO_MAX_PACKET_SIZE`.
   */
 int MicroBitMeshRadioDatagram::send(ManagedString data)
 {
     return send((uint8_t *)data.toCharArray(), data.length());
 }
 
+/**
+  * Transmits the given buffer to a single node, along the route to it if one is known (see MicroBitMeshRadio::sendTo()).
+  * Datagrams sent this way are never aggregated.
+  *
+  * @param destination The originator id of the node to send to.
+  *
+  * @param buffer The packet contents to transmit.
+  *
+  * @param len The number of bytes to transmit.
+  *
+  * @return DEVICE_OK on success, DEVICE_NO_RESOURCES if the transmit queue is full, or DEVICE_INVALID_PARAMETER if the buffer
+  *         or destination is invalid, or the number of bytes to transmit is greater than
+  *         `MICROBIT_RADIO_MAX_PACKET_SIZE - MICROBIT_MESH_RADIO_UNICAST_HEADER_SIZE`.
+  */
+int MicroBitMeshRadioDatagram::sendTo(uint16_t destination, uint8_t *buffer, int len)
+{
+    if (buffer == NULL || len < 0 || len > MICROBIT_RADIO_MAX_PACKET_SIZE - MICROBIT_MESH_RADIO_UNICAST_HEADER_SIZE)
+        return DEVICE_INVALID_PARAMETER;
+
+    SequencedFrameBuffer buf;
+
+    buf.length = len + MICROBIT_MESH_RADIO_HEADER_SIZE - 1;
+    buf.version = 1;
+    buf.group = 0;
+    buf.protocol = MICROBIT_MESH_RADIO_PROTOCOL_DATAGRAM;
+    memcpy(buf.payload, buffer, len);
+
+    // Preserve ordering with anything we're holding.
+    flush();
+
+    return radio.sendTo(destination, &buf);
+}
+
+/**
+  * Transmits the given buffer to a single node, along the route to it if one is known (see MicroBitMeshRadio::sendTo()).
+  * Datagrams sent this way are never aggregated.
+  *
+  * @param destination The originator id of the node to send to.
+  *
+  * @param data The packet contents to transmit.
+  *
+  * @return DEVICE_OK on success, DEVICE_NO_RESOURCES if the transmit queue is full, or DEVICE_INVALID_PARAMETER if the buffer
+  *         or destination is invalid, or the number of bytes to transmit is greater than
+  *         `MICROBIT_RADIO_MAX_PACKET_SIZE - MICROBIT_MESH_RADIO_UNICAST_HEADER_SIZE`.
+  */
+int MicroBitMeshRadioDatagram::sendTo(uint16_t destination, PacketBuffer data)
+{
+    return sendTo(destination, (uint8_t *)data.getBytes(), data.length());
+}
+
 /**
   * Protocol handler callback. This is called when the radio receives a packet marked as a datagram.
   *
@@ -172,7 +320,57 @@ int MicroBitMeshRadioDatagram::send(ManagedString data)
   */
 void MicroBitMeshRadioDatagram::packetReceived()
 {
-    SequencedFrameBuffer *packet = radio.recv();
+    queuePacket(radio.recv());
+}
+
+/**
+  * Protocol handler callback. This is called when the radio receives a packet containing aggregated datagrams.
+  *
+  * This function splits the packet into its individual datagrams, and queues each for user reception.
+  */
+void MicroBitMeshRadioDatagram::batchReceived()
+{
+    SequencedFrameBuffer *batch = radio.recv();
+    uint8_t *p = batch->payload;
+    int size = batch->length - (MICROBIT_MESH_RADIO_HEADER_SIZE - 1);
+    uint8_t *end = batch->payload + (size < MICROBIT_RADIO_MAX_PACKET_SIZE ? size : MICROBIT_RADIO_MAX_PACKET_SIZE);
+
+    while (p < end)
+    {
+        int len = *p++;
+
+        // Discard anything malformed.
+        if (p + len > end)
+            break;
+
+        // Each datagram is held in a block just large enough for it.
+        SequencedFrameBuffer *packet = (SequencedFrameBuffer *) MicroBitRadioFramePool::allocate(offsetof(SequencedFrameBuffer, payload) + len);
+
+        if (packet == NULL)
+            break;
+
+        // Each datagram inherits the header of the frame that carried it.
+        memcpy(&packet->length, &batch->length, MICROBIT_MESH_RADIO_HEADER_SIZE);
+        packet->length = len + MICROBIT_MESH_RADIO_HEADER_SIZE - 1;
+        packet->protocol = MICROBIT_MESH_RADIO_PROTOCOL_DATAGRAM;
+        packet->rssi = batch->rssi;
+        memcpy(packet->payload, p, len);
+
+        queuePacket(packet);
+        p += len;
+    }
+
+    delete batch;
+}
+
+/**
+  * Adds the given packet to the tail of the receive queue, and signals its arrival.
+  * If the queue is full, the packet is discarded.
+  *
+  * @param packet The packet to queue.
+  */
+void MicroBitMeshRadioDatagram::queuePacket(SequencedFrameBuffer *packet)
+{
     int queueDepth = 0;
 
     // We add to the tail of the queue to preserve causal ordering.
@@ -191,7 +389,7 @@ void MicroBitMeshRadioDatagram::packetReceived()
             queueDepth++;
         }
 
-        if (queueDepth >= MICROBIT_MESH_RADIO_MAXIMUM_RX_BUFFERS)
+        if (queueDepth >= MICROBIT_MESH_RADIO_DATAGRAM_MAXIMUM_RX_BUFFERS)
         {
             delete packet;
             return;
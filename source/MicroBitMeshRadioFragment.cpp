@@ -0,0 +1,368 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 British Broadcasting Corporation.
+This software is provided by Lancaster University by arrangement with the BBC.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "MicroBitConfig.h"
+#include "MicroBitMeshRadio.h"
+#include "EventModel.h"
+#include "Timer.h"
+#include "CodalFiber.h"
+
+using namespace codal;
+
+/**
+  * Constructor.
+  *
+  * @param r The underlying radio module used to send and receive data.
+  */
+MicroBitMeshRadioFragment::MicroBitMeshRadioFragment(MicroBitMeshRadio &r) : radio(r)
+{
+    this->txMsgId = 0;
+    this->listening = false;
+    memset(this->txResend, 0, sizeof(this->txResend));
+    memset(this->rxBuffers, 0, sizeof(this->rxBuffers));
+}
+
+/**
+  * Registers our internal event handlers, if not already done.
+  */
+void MicroBitMeshRadioFragment::listen()
+{
+    if (listening || EventModel::defaultEventBus == NULL)
+        return;
+
+    EventModel::defaultEventBus->listen(DEVICE_ID_RADIO, MICROBIT_MESH_RADIO_EVT_FRAGMENT_TIMEOUT, this, &MicroBitMeshRadioFragment::onTimeout);
+    EventModel::defaultEventBus->listen(DEVICE_ID_RADIO, MICROBIT_MESH_RADIO_EVT_FRAGMENT_RESEND, this, &MicroBitMeshRadioFragment::onResend);
+    listening = true;
+}
+
+/**
+  * Transmits a single fragment of txMessage, waiting for space in the transmit queue if necessary.
+  *
+  * @param index The index of the fragment to transmit.
+  *
+  * @return DEVICE_OK on success, or the error returned by MicroBitMeshRadio::send().
+  */
+int MicroBitMeshRadioFragment::sendFragment(int index)
+{
+    SequencedFrameBuffer buf;
+    int count = (txMessage.length() + MICROBIT_MESH_RADIO_FRAGMENT_DATA_SIZE - 1) / MICROBIT_MESH_RADIO_FRAGMENT_DATA_SIZE;
+    int offset = index * MICROBIT_MESH_RADIO_FRAGMENT_DATA_SIZE;
+    int len = min(txMessage.length() - offset, MICROBIT_MESH_RADIO_FRAGMENT_DATA_SIZE);
+
+    buf.length = MICROBIT_MESH_RADIO_FRAGMENT_HEADER_SIZE + len + MICROBIT_MESH_RADIO_HEADER_SIZE - 1;
+    buf.version = 1;
+    buf.group = 0;
+    buf.protocol = MICROBIT_MESH_RADIO_PROTOCOL_FRAGMENT;
+    buf.payload[0] = MICROBIT_MESH_RADIO_FRAGMENT_TYPE_DATA;
+    buf.payload[1] = txMsgId;
+    buf.payload[2] = index;
+    buf.payload[3] = count;
+    memcpy(&buf.payload[MICROBIT_MESH_RADIO_FRAGMENT_HEADER_SIZE], txMessage.getBytes() + offset, len);
+
+    int result;
+
+    while ((result = radio.send(&buf)) == DEVICE_NO_RESOURCES)
+        fiber_sleep(MICROBIT_MESH_RADIO_FRAGMENT_TX_BACKOFF_MS);
+
+    return result;
+}
+
+/**
+  * Transmits the given buffer onto the mesh, as a sequence of fragments.
+  *
+  * This call blocks the calling fiber until every fragment has been queued for transmission.
+  *
+  * @param buffer The message to transmit.
+  *
+  * @param len The number of bytes to transmit.
+  *
+  * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the buffer is invalid,
+  *         or the number of bytes to transmit is greater than `MICROBIT_MESH_RADIO_FRAGMENT_MAX_SIZE`.
+  */
+int MicroBitMeshRadioFragment::send(uint8_t *buffer, int len)
+{
+    if (buffer == NULL || len <= 0 || len > MICROBIT_MESH_RADIO_FRAGMENT_MAX_SIZE)
+        return DEVICE_INVALID_PARAMETER;
+
+    return send(PacketBuffer(buffer, len));
+}
+
+/**
+  * Transmits the given buffer onto the mesh, as a sequence of fragments.
+  *
+  * This call blocks the calling fiber until every fragment has been queued for transmission.
+  *
+  * @param data The message to transmit.
+  *
+  * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the buffer is invalid,
+  *         or the number of bytes to transmit is greater than `MICROBIT_MESH_RADIO_FRAGMENT_MAX_SIZE`.
+  */
+int MicroBitMeshRadioFragment::send(PacketBuffer data)
+{
+    if (data.length() <= 0 || data.length() > MICROBIT_MESH_RADIO_FRAGMENT_MAX_SIZE)
+        return DEVICE_INVALID_PARAMETER;
+
+    listen();
+
+    // Retain this message, replacing the last, so we can answer re-requests for it.
+    txMessage = data;
+    txMsgId++;
+    memset(txResend, 0, sizeof(txResend));
+
+    int count = (data.length() + MICROBIT_MESH_RADIO_FRAGMENT_DATA_SIZE - 1) / MICROBIT_MESH_RADIO_FRAGMENT_DATA_SIZE;
+
+    for (int i = 0; i < count; i++)
+    {
+        int result = sendFragment(i);
+
+        if (result != DEVICE_OK)
+            return result;
+    }
+
+    return DEVICE_OK;
+}
+
+/**
+  * Retrieves the oldest fully reassembled message.
+  *
+  * @return the message received, or an empty PacketBuffer if no message is available.
+  */
+PacketBuffer MicroBitMeshRadioFragment::recv()
+{
+    MeshReassemblyBuffer *oldest = NULL;
+
+    for (int i = 0; i < MICROBIT_MESH_RADIO_FRAGMENT_REASSEMBLY_BUFFERS; i++)
+    {
+        MeshReassemblyBuffer *b = &rxBuffers[i];
+
+        if (b->origin && b->complete && (oldest == NULL || (int32_t)(b->lastSeen - oldest->lastSeen) < 0))
+            oldest = b;
+    }
+
+    if (oldest == NULL)
+        return PacketBuffer::EmptyPacket;
+
+    PacketBuffer packet(oldest->data, oldest->length);
+
+    free(oldest->data);
+    memset(oldest, 0, sizeof(MeshReassemblyBuffer));
+
+    return packet;
+}
+
+/**
+  * Protocol handler callback. This is called when the radio receives a packet marked as a fragment.
+  *
+  * This function processes this packet, reassembling messages and answering re-requests.
+  */
+void MicroBitMeshRadioFragment::packetReceived()
+{
+    SequencedFrameBuffer *packet = radio.recv();
+    int len = packet->length - (MICROBIT_MESH_RADIO_HEADER_SIZE - 1);
+
+    if (len > MICROBIT_MESH_RADIO_FRAGMENT_HEADER_SIZE && packet->payload[0] == MICROBIT_MESH_RADIO_FRAGMENT_TYPE_DATA)
+        dataReceived(packet);
+
+    if (len >= MICROBIT_MESH_RADIO_FRAGMENT_NACK_SIZE && packet->payload[0] == MICROBIT_MESH_RADIO_FRAGMENT_TYPE_NACK)
+        nackReceived(packet);
+
+    delete packet;
+}
+
+/**
+  * Handles a received data fragment, adding it to the appropriate reassembly buffer.
+  */
+void MicroBitMeshRadioFragment::dataReceived(SequencedFrameBuffer *packet)
+{
+    uint8_t msgId = packet->payload[1];
+    uint8_t index = packet->payload[2];
+    uint8_t count = packet->payload[3];
+    int len = packet->length - (MICROBIT_MESH_RADIO_HEADER_SIZE - 1) - MICROBIT_MESH_RADIO_FRAGMENT_HEADER_SIZE;
+
+    if (count == 0 || count > MICROBIT_MESH_RADIO_FRAGMENT_MAX_FRAGMENTS || index >= count)
+        return;
+
+    // Only the last fragment of a message may be short.
+    if (len > MICROBIT_MESH_RADIO_FRAGMENT_DATA_SIZE || (index < count - 1 && len != MICROBIT_MESH_RADIO_FRAGMENT_DATA_SIZE))
+        return;
+
+    MeshReassemblyBuffer *b = NULL;
+    MeshReassemblyBuffer *victim = NULL;
+
+    for (int i = 0; i < MICROBIT_MESH_RADIO_FRAGMENT_REASSEMBLY_BUFFERS; i++)
+    {
+        MeshReassemblyBuffer *r = &rxBuffers[i];
+
+        if (r->origin == packet->origin && r->msgId == msgId)
+        {
+            b = r;
+            break;
+        }
+
+        // Prefer a free buffer, otherwise the least recently active incomplete one. Completed messages are never displaced.
+        if (r->origin == 0)
+            victim = r;
+        else if (!r->complete && (victim == NULL || (victim->origin && (int32_t)(r->lastSeen - victim->lastSeen) < 0)))
+            victim = r;
+    }
+
+    if (b == NULL)
+    {
+        if (victim == NULL)
+            return;
+
+        if (victim->data)
+            free(victim->data);
+
+        memset(victim, 0, sizeof(MeshReassemblyBuffer));
+
+        victim->data = (uint8_t *) malloc(count * MICROBIT_MESH_RADIO_FRAGMENT_DATA_SIZE);
+
+        if (victim->data == NULL)
+            return;
+
+        victim->origin = packet->origin;
+        victim->msgId = msgId;
+        victim->count = count;
+        b = victim;
+    }
+
+    if (b->complete || b->count != count)
+        return;
+
+    b->lastSeen = system_timer_current_time();
+
+    if (b->received[index / 8] & (1 << (index % 8)))
+        return;
+
+    b->received[index / 8] |= (1 << (index % 8));
+    memcpy(b->data + index * MICROBIT_MESH_RADIO_FRAGMENT_DATA_SIZE, &packet->payload[MICROBIT_MESH_RADIO_FRAGMENT_HEADER_SIZE], len);
+
+    if (index == count - 1)
+        b->length = index * MICROBIT_MESH_RADIO_FRAGMENT_DATA_SIZE + len;
+
+    for (int i = 0; i < count; i++)
+        if (!(b->received[i / 8] & (1 << (i % 8))))
+        {
+            // Still incomplete. Ensure we check back later, in case the rest never arrives.
+            listen();
+            system_timer_cancel_event(DEVICE_ID_RADIO, MICROBIT_MESH_RADIO_EVT_FRAGMENT_TIMEOUT);
+            system_timer_event_after(MICROBIT_MESH_RADIO_FRAGMENT_TIMEOUT_MS, DEVICE_ID_RADIO, MICROBIT_MESH_RADIO_EVT_FRAGMENT_TIMEOUT);
+            return;
+        }
+
+    b->complete = true;
+    Event(DEVICE_ID_RADIO, MICROBIT_MESH_RADIO_EVT_FRAGMENTED);
+}
+
+/**
+  * Handles a received re-request, scheduling retransmission of any fragments of ours that are missing.
+  */
+void MicroBitMeshRadioFragment::nackReceived(SequencedFrameBuffer *packet)
+{
+    uint16_t origin = packet->payload[2] | (packet->payload[3] << 8);
+
+    if (origin != radio.getOriginId() || packet->payload[1] != txMsgId || txMessage.length() <= 0)
+        return;
+
+    // Merge requests from all receivers, and retransmit from fiber context.
+    for (int i = 0; i < MICROBIT_MESH_RADIO_FRAGMENT_BITMAP_SIZE; i++)
+        txResend[i] |= packet->payload[4 + i];
+
+    Event(DEVICE_ID_RADIO, MICROBIT_MESH_RADIO_EVT_FRAGMENT_RESEND);
+}
+
+/**
+  * Event handler, called periodically while messages are being reassembled, to re-request missing fragments.
+  */
+void MicroBitMeshRadioFragment::onTimeout(Event)
+{
+    CODAL_TIMESTAMP now = system_timer_current_time();
+    bool pending = false;
+
+    for (int i = 0; i < MICROBIT_MESH_RADIO_FRAGMENT_REASSEMBLY_BUFFERS; i++)
+    {
+        MeshReassemblyBuffer *b = &rxBuffers[i];
+
+        if (b->origin == 0 || b->complete)
+            continue;
+
+        if (now - b->lastSeen < MICROBIT_MESH_RADIO_FRAGMENT_TIMEOUT_MS)
+        {
+            pending = true;
+            continue;
+        }
+
+        if (b->retries >= MICROBIT_MESH_RADIO_FRAGMENT_MAX_RETRIES)
+        {
+            free(b->data);
+            memset(b, 0, sizeof(MeshReassemblyBuffer));
+            continue;
+        }
+
+        SequencedFrameBuffer buf;
+
+        buf.length = MICROBIT_MESH_RADIO_FRAGMENT_NACK_SIZE + MICROBIT_MESH_RADIO_HEADER_SIZE - 1;
+        buf.version = 1;
+        buf.group = 0;
+        buf.protocol = MICROBIT_MESH_RADIO_PROTOCOL_FRAGMENT;
+        buf.payload[0] = MICROBIT_MESH_RADIO_FRAGMENT_TYPE_NACK;
+        buf.payload[1] = b->msgId;
+        buf.payload[2] = b->origin & 0xFF;
+        buf.payload[3] = b->origin >> 8;
+
+        memset(&buf.payload[4], 0, MICROBIT_MESH_RADIO_FRAGMENT_BITMAP_SIZE);
+        for (int j = 0; j < b->count; j++)
+            if (!(b->received[j / 8] & (1 << (j % 8))))
+                buf.payload[4 + j / 8] |= (1 << (j % 8));
+
+        radio.send(&buf);
+
+        b->retries++;
+        b->lastSeen = now;
+        pending = true;
+    }
+
+    if (pending)
+        system_timer_event_after(MICROBIT_MESH_RADIO_FRAGMENT_TIMEOUT_MS, DEVICE_ID_RADIO, MICROBIT_MESH_RADIO_EVT_FRAGMENT_TIMEOUT);
+}
+
+/**
+  * Event handler, called to retransmit fragments which have been re-requested.
+  */
+void MicroBitMeshRadioFragment::onResend(Event)
+{
+    int count = (txMessage.length() + MICROBIT_MESH_RADIO_FRAGMENT_DATA_SIZE - 1) / MICROBIT_MESH_RADIO_FRAGMENT_DATA_SIZE;
+
+    for (int i = 0; i < count; i++)
+    {
+        if (txResend[i / 8] & (1 << (i % 8)))
+        {
+            // Clear before sending, so that requests arriving meanwhile are honoured.
+            txResend[i / 8] &= ~(1 << (i % 8));
+            sendFragment(i);
+        }
+    }
+}
@@ -0,0 +1,392 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "MicroBitNeoPixel.h"
+#include "MicroBitHeapStats.h"
+#include "CodalFiber.h"
+#include "ErrorNo.h"
+#include "Event.h"
+#include "codal_target_hal.h"
+#include "nrf.h"
+#include <string.h>
+
+using namespace codal;
+
+// Waveform timing. With a 16MHz PWM clock and a period of 20 counts, each PWM value sends one bit in 1.25us, with a
+// high time of 0.375us for a '0' and 0.8125us for a '1'. The top bit selects the polarity that starts each period high.
+#define NEOPIXEL_COUNTERTOP             20
+#define NEOPIXEL_T0H                    (6 | 0x8000)
+#define NEOPIXEL_T1H                    (13 | 0x8000)
+#define NEOPIXEL_LOW                    (0 | 0x8000)
+
+#define NEOPIXEL_CHUNK_WORDS            (CONFIG_MICROBIT_NEOPIXEL_CHUNK_PIXELS * 24)
+#define NEOPIXEL_RESET_WORDS            ((CONFIG_MICROBIT_NEOPIXEL_RESET_US * 4 + 4) / 5)
+
+MicroBitNeoPixel *MicroBitNeoPixel::queue = NULL;
+uint16_t *MicroBitNeoPixel::sequence = NULL;
+volatile int MicroBitNeoPixel::sequencesLeft = 0;
+
+/**
+ * Constructor. The pin is driven low, and both frame buffers are cleared.
+ *
+ * @param pin The pin the strip is connected to.
+ * @param length The number of pixels in the strip.
+ * @param bytesPerPixel 3 for RGB pixels, or 4 for RGBW pixels.
+ * @param id The ID of this component, used for its events.
+ */
+MicroBitNeoPixel::MicroBitNeoPixel(NRF52Pin &pin, int length, int bytesPerPixel, uint16_t id) : pin(pin)
+{
+    this->id = id;
+    this->status = 0;
+    this->back = 0;
+    this->bytesPerPixel = bytesPerPixel == 4 ? 4 : 3;
+    this->length = 0;
+    this->position = 0;
+    this->next = NULL;
+    this->buffer[0] = NULL;
+    this->buffer[1] = NULL;
+
+    int size = length * this->bytesPerPixel;
+    uint8_t *b = length > 0 && length <= 0xFFFF ? (uint8_t *) malloc(2 * size) : NULL;
+
+    if (b)
+    {
+        MICROBIT_HEAP_TRACK(MICROBIT_HEAP_TAG_OTHER, b);
+        memset(b, 0, 2 * size);
+
+        this->buffer[0] = b;
+        this->buffer[1] = b + size;
+        this->length = length;
+    }
+
+    pin.setDigitalValue(0);
+}
+
+/**
+ * Destructor. Waits for any frame being sent to complete.
+ */
+MicroBitNeoPixel::~MicroBitNeoPixel()
+{
+    waitForIdle();
+    free(buffer[0]);
+}
+
+/**
+ * Allocates the sequence buffers and configures the PPI and EGU resources, if this has not already been done.
+ *
+ * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if there is insufficient memory.
+ */
+int MicroBitNeoPixel::enable()
+{
+    if (sequence)
+        return DEVICE_OK;
+
+    uint16_t *s = (uint16_t *) malloc(2 * NEOPIXEL_CHUNK_WORDS * sizeof(uint16_t));
+
+    if (s == NULL)
+        return DEVICE_NO_RESOURCES;
+
+    MICROBIT_HEAP_TRACK(MICROBIT_HEAP_TAG_OTHER, s);
+
+    // The PWM2 interrupt vector belongs to the general purpose PWM driver, so sequence end events are delivered through EGU4.
+    NRF_EGU4->EVENTS_TRIGGERED[0] = 0;
+    NRF_EGU4->EVENTS_TRIGGERED[1] = 0;
+    NRF_EGU4->INTENSET = 0x03;
+    NVIC_ClearPendingIRQ(SWI4_EGU4_IRQn);
+    NVIC_EnableIRQ(SWI4_EGU4_IRQn);
+
+    for (int i = 0; i < 2; i++)
+    {
+        NRF_PPI->CH[MICROBIT_NEOPIXEL_PPI_CHANNEL_BASE + i].EEP = (uint32_t) &NRF_PWM2->EVENTS_SEQEND[i];
+        NRF_PPI->CH[MICROBIT_NEOPIXEL_PPI_CHANNEL_BASE + i].TEP = (uint32_t) &NRF_EGU4->TASKS_TRIGGER[i];
+    }
+
+    NRF_PPI->CHENSET = 0x03 << MICROBIT_NEOPIXEL_PPI_CHANNEL_BASE;
+
+    sequence = s;
+    return DEVICE_OK;
+}
+
+/**
+ * Expands the next bytes of the front buffer of the strip being sent into one of the sequence buffers.
+ *
+ * @param index The sequence buffer to fill, 0 or 1.
+ */
+void MicroBitNeoPixel::refill(int index)
+{
+    MicroBitNeoPixel *s = queue;
+    uint8_t *front = s->buffer[s->back ^ 1];
+    uint32_t size = s->length * s->bytesPerPixel;
+    uint16_t *out = sequence + index * NEOPIXEL_CHUNK_WORDS;
+    uint16_t *end = out + NEOPIXEL_CHUNK_WORDS;
+
+    while (out < end && s->position < size)
+    {
+        uint8_t b = front[s->position++];
+
+        for (uint8_t mask = 0x80; mask; mask >>= 1)
+            *out++ = (b & mask) ? NEOPIXEL_T1H : NEOPIXEL_T0H;
+    }
+
+    // Anything beyond the end of the frame holds the line low, which forms the reset period.
+    while (out < end)
+        *out++ = NEOPIXEL_LOW;
+}
+
+/**
+ * Starts sending the front buffer of the strip at the head of the queue.
+ *
+ * @note must be called with interrupts disabled, or from the EGU interrupt.
+ */
+void MicroBitNeoPixel::begin()
+{
+    MicroBitNeoPixel *s = queue;
+    int words = s->length * s->bytesPerPixel * 8 + NEOPIXEL_RESET_WORDS;
+    int loops = (words + 2 * NEOPIXEL_CHUNK_WORDS - 1) / (2 * NEOPIXEL_CHUNK_WORDS);
+
+    s->position = 0;
+    sequencesLeft = 2 * loops;
+    refill(0);
+    refill(1);
+
+    // Each loop plays sequence 0 then sequence 1. Whichever has just ended is refilled while the other plays.
+    NRF_PWM2->PSEL.OUT[0] = s->pin.name;
+    NRF_PWM2->ENABLE = 1;
+    NRF_PWM2->MODE = PWM_MODE_UPDOWN_Up;
+    NRF_PWM2->PRESCALER = PWM_PRESCALER_PRESCALER_DIV_1;
+    NRF_PWM2->COUNTERTOP = NEOPIXEL_COUNTERTOP;
+    NRF_PWM2->DECODER = (PWM_DECODER_LOAD_Common << PWM_DECODER_LOAD_Pos) | (PWM_DECODER_MODE_RefreshCount << PWM_DECODER_MODE_Pos);
+    NRF_PWM2->LOOP = loops;
+
+    for (int i = 0; i < 2; i++)
+    {
+        NRF_PWM2->SEQ[i].PTR = (uint32_t) (sequence + i * NEOPIXEL_CHUNK_WORDS);
+        NRF_PWM2->SEQ[i].CNT = NEOPIXEL_CHUNK_WORDS;
+        NRF_PWM2->SEQ[i].REFRESH = 0;
+        NRF_PWM2->SEQ[i].ENDDELAY = 0;
+        NRF_PWM2->EVENTS_SEQEND[i] = 0;
+    }
+
+    NRF_PWM2->SHORTS = PWM_SHORTS_LOOPSDONE_STOP_Msk;
+    NRF_PWM2->EVENTS_LOOPSDONE = 0;
+    NRF_PWM2->EVENTS_STOPPED = 0;
+    NRF_PWM2->TASKS_SEQSTART[0] = 1;
+}
+
+/**
+ * Releases the pin of the strip just sent, raises its MICROBIT_NEOPIXEL_EVT_SENT event, and starts the next.
+ *
+ * @note should only be called from the EGU interrupt.
+ */
+void MicroBitNeoPixel::finish()
+{
+    MicroBitNeoPixel *s = queue;
+
+    // The stop task follows the final sequence end within one PWM period.
+    while (!NRF_PWM2->EVENTS_STOPPED);
+
+    NRF_PWM2->EVENTS_STOPPED = 0;
+    NRF_PWM2->SHORTS = 0;
+    NRF_PWM2->ENABLE = 0;
+    NRF_PWM2->PSEL.OUT[0] = 0xFFFFFFFF;
+
+    queue = s->next;
+    s->next = NULL;
+    s->status &= ~MICROBIT_NEOPIXEL_STATUS_QUEUED;
+
+    if (queue)
+        begin();
+
+    Event(s->id, MICROBIT_NEOPIXEL_EVT_SENT);
+}
+
+/**
+ * Called each time a PWM sequence has been played.
+ *
+ * @param index The sequence that has ended, 0 or 1.
+ *
+ * @note should only be called from SWI4_EGU4_IRQHandler...
+ */
+void MicroBitNeoPixel::onSequenceEnd(int index)
+{
+    if (queue == NULL)
+        return;
+
+    sequencesLeft--;
+
+    if (sequencesLeft == 0)
+        finish();
+    else if (sequencesLeft >= 2)
+        refill(index);
+}
+
+/**
+ * Determines the number of pixels in the strip.
+ *
+ * @return The number of pixels, or 0 if the frame buffers could not be allocated.
+ */
+int MicroBitNeoPixel::getLength()
+{
+    return length;
+}
+
+/**
+ * Provides direct access to the back buffer, for drawing the next frame. Each pixel is stored as green, red,
+ * blue (and white) bytes, in the order the strip expects them. The buffer changes each time show() is called.
+ *
+ * @return The back buffer, or NULL if the frame buffers could not be allocated.
+ */
+uint8_t *MicroBitNeoPixel::getBuffer()
+{
+    return buffer[back];
+}
+
+/**
+ * Sets the colour of a pixel in the back buffer.
+ *
+ * @param index The pixel to set, from 0.
+ * @param red The red component, 0-255.
+ * @param green The green component, 0-255.
+ * @param blue The blue component, 0-255.
+ * @param white The white component, 0-255, which is ignored by RGB pixels.
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if index is out of range.
+ */
+int MicroBitNeoPixel::setPixel(int index, uint8_t red, uint8_t green, uint8_t blue, uint8_t white)
+{
+    if (index < 0 || index >= length)
+        return DEVICE_INVALID_PARAMETER;
+
+    uint8_t *p = buffer[back] + index * bytesPerPixel;
+
+    p[0] = green;
+    p[1] = red;
+    p[2] = blue;
+
+    if (bytesPerPixel == 4)
+        p[3] = white;
+
+    return DEVICE_OK;
+}
+
+/**
+ * Sets every pixel in the back buffer to off.
+ */
+void MicroBitNeoPixel::clear()
+{
+    if (length)
+        memset(buffer[back], 0, length * bytesPerPixel);
+}
+
+/**
+ * Makes the back buffer the next frame to be sent, and returns without waiting for it to be sent. If the
+ * previous frame of this strip is still being sent, waits for that to complete first. The new back buffer
+ * holds a copy of the frame just shown, so it can be updated incrementally.
+ *
+ * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if the strip's buffers could not be allocated.
+ */
+int MicroBitNeoPixel::show()
+{
+    if (length == 0 || enable() != DEVICE_OK)
+        return DEVICE_NO_RESOURCES;
+
+    waitForIdle();
+
+    memcpy(buffer[back ^ 1], buffer[back], length * bytesPerPixel);
+    back ^= 1;
+
+    target_disable_irq();
+
+    status |= MICROBIT_NEOPIXEL_STATUS_QUEUED;
+
+    if (queue == NULL)
+    {
+        queue = this;
+        begin();
+    }
+    else
+    {
+        MicroBitNeoPixel *p = queue;
+
+        while (p->next)
+            p = p->next;
+
+        p->next = this;
+    }
+
+    target_enable_irq();
+
+    return DEVICE_OK;
+}
+
+/**
+ * Determines if a frame of this strip is waiting to be, or is being, sent.
+ *
+ * @return true if a frame is in flight, false otherwise.
+ */
+bool MicroBitNeoPixel::isBusy()
+{
+    return (status & MICROBIT_NEOPIXEL_STATUS_QUEUED) != 0;
+}
+
+/**
+ * Blocks the calling fiber until any frame of this strip in flight has been sent.
+ */
+void MicroBitNeoPixel::waitForIdle()
+{
+    if (!fiber_scheduler_running())
+    {
+        while (isBusy());
+        return;
+    }
+
+    while (true)
+    {
+        // Register for the event before testing, so that a frame completing in between is not missed.
+        target_disable_irq();
+
+        if (!isBusy())
+        {
+            target_enable_irq();
+            return;
+        }
+
+        fiber_wake_on_event(id, MICROBIT_NEOPIXEL_EVT_SENT);
+        target_enable_irq();
+
+        schedule();
+    }
+}
+
+extern "C" void SWI4_EGU4_IRQHandler(void)
+{
+    for (int i = 0; i < 2; i++)
+    {
+        if (NRF_EGU4->EVENTS_TRIGGERED[i])
+        {
+            NRF_EGU4->EVENTS_TRIGGERED[i] = 0;
+            MicroBitNeoPixel::onSequenceEnd(i);
+        }
+    }
+}
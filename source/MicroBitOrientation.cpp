@@ -0,0 +1,254 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "MicroBitOrientation.h"
+#include "CodalFiber.h"
+#include "CodalCompat.h"
+#include "ErrorNo.h"
+
+using namespace codal;
+
+/**
+ * Constructor.
+ *
+ * @param accelerometer The accelerometer to sample.
+ * @param compass The compass to sample. This should be calibrated for the heading to be meaningful.
+ * @param id The ID of this component, used for its events.
+ */
+MicroBitOrientation::MicroBitOrientation(Accelerometer &accelerometer, Compass &compass, uint16_t id) : accelerometer(accelerometer), compass(compass)
+{
+    this->id = id;
+    this->q.w = 1.0f;
+    this->q.x = this->q.y = this->q.z = 0.0f;
+    this->pitch = 0.0f;
+    this->roll = 0.0f;
+    this->heading = 0.0f;
+    this->gain = CONFIG_MICROBIT_ORIENTATION_GAIN;
+    this->period = CONFIG_MICROBIT_ORIENTATION_PERIOD_MS;
+}
+
+/**
+ * Destructor. Updates are stopped, waiting for the update fiber to exit if necessary.
+ */
+MicroBitOrientation::~MicroBitOrientation()
+{
+    stop();
+
+    while (status & MICROBIT_ORIENTATION_STATUS_FIBER)
+        fiber_sleep(period);
+}
+
+/**
+ * Starts updating the orientation at a fixed rate.
+ *
+ * @return DEVICE_OK on success.
+ */
+int MicroBitOrientation::start()
+{
+    status |= MICROBIT_ORIENTATION_STATUS_RUNNING;
+
+    if (!(status & MICROBIT_ORIENTATION_STATUS_FIBER))
+    {
+        status |= MICROBIT_ORIENTATION_STATUS_FIBER;
+        create_fiber(updateFiber, this);
+    }
+
+    return DEVICE_OK;
+}
+
+/**
+ * Stops updating the orientation. The last values remain available.
+ */
+void MicroBitOrientation::stop()
+{
+    status &= ~MICROBIT_ORIENTATION_STATUS_RUNNING;
+}
+
+/**
+ * Sets the period between updates.
+ *
+ * @param period The period, in milliseconds.
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if period is zero.
+ */
+int MicroBitOrientation::setPeriod(uint32_t period)
+{
+    if (period == 0)
+        return DEVICE_INVALID_PARAMETER;
+
+    this->period = period;
+    return DEVICE_OK;
+}
+
+/**
+ * Determines the period between updates, in milliseconds.
+ */
+uint32_t MicroBitOrientation::getPeriod()
+{
+    return period;
+}
+
+/**
+ * Sets the weight given to each new measurement.
+ *
+ * @param gain A value greater than 0 and at most 1. 1 disables smoothing.
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if gain is out of range.
+ */
+int MicroBitOrientation::setGain(float gain)
+{
+    if (gain <= 0.0f || gain > 1.0f)
+        return DEVICE_INVALID_PARAMETER;
+
+    this->gain = gain;
+    return DEVICE_OK;
+}
+
+/**
+ * Samples both sensors and updates the orientation now. This is normally done by the update fiber.
+ *
+ * @return DEVICE_OK on success.
+ */
+int MicroBitOrientation::update()
+{
+    Sample3D a = accelerometer.getSample(NORTH_EAST_DOWN);
+    Sample3D m = compass.getSample(NORTH_EAST_DOWN);
+
+    // Measure roll and pitch from gravity, then the heading from the field projected onto the horizontal plane.
+    // This is the same tilt compensation as Compass::heading(), so the results agree.
+    float phi = atan2f(a.y, a.z);
+    float sinPhi = sinf(phi);
+    float cosPhi = cosf(phi);
+    float theta = atan2f(-a.x, a.y * sinPhi + a.z * cosPhi);
+    float sinTheta = sinf(theta);
+    float cosTheta = cosf(theta);
+    float psi = atan2f(m.z * sinPhi - m.y * cosPhi, m.x * cosTheta + m.y * sinTheta * sinPhi + m.z * sinTheta * cosPhi);
+
+    // Convert the measurement to a quaternion (yaw, pitch, roll order).
+    float cr = cosf(phi / 2), sr = sinf(phi / 2);
+    float cp = cosf(theta / 2), sp = sinf(theta / 2);
+    float cy = cosf(psi / 2), sy = sinf(psi / 2);
+
+    MicroBitQuaternion t;
+    t.w = cr * cp * cy + sr * sp * sy;
+    t.x = sr * cp * cy - cr * sp * sy;
+    t.y = cr * sp * cy + sr * cp * sy;
+    t.z = cr * cp * sy - sr * sp * cy;
+
+    if (!(status & MICROBIT_ORIENTATION_STATUS_VALID))
+    {
+        q = t;
+        status |= MICROBIT_ORIENTATION_STATUS_VALID;
+    }
+    else
+    {
+        // Blend towards the measurement along the shorter path, then renormalise.
+        float g = (q.w * t.w + q.x * t.x + q.y * t.y + q.z * t.z) < 0.0f ? -gain : gain;
+
+        q.w = (1.0f - gain) * q.w + g * t.w;
+        q.x = (1.0f - gain) * q.x + g * t.x;
+        q.y = (1.0f - gain) * q.y + g * t.y;
+        q.z = (1.0f - gain) * q.z + g * t.z;
+
+        float n = sqrtf(q.w * q.w + q.x * q.x + q.y * q.y + q.z * q.z);
+
+        if (n > 0.0f)
+        {
+            q.w /= n;
+            q.x /= n;
+            q.y /= n;
+            q.z /= n;
+        }
+    }
+
+    // Cache the angles, so that readers need not derive them.
+    float s = 2.0f * (q.w * q.y - q.z * q.x);
+
+    roll = atan2f(2.0f * (q.w * q.x + q.y * q.z), 1.0f - 2.0f * (q.x * q.x + q.y * q.y)) * 180.0f / PI;
+    pitch = asinf(s > 1.0f ? 1.0f : s < -1.0f ? -1.0f : s) * 180.0f / PI;
+    heading = atan2f(2.0f * (q.w * q.z + q.x * q.y), 1.0f - 2.0f * (q.y * q.y + q.z * q.z)) * 180.0f / PI;
+
+    if (heading < 0.0f)
+        heading += 360.0f;
+
+    Event(id, MICROBIT_ORIENTATION_EVT_DATA_UPDATE);
+
+    return DEVICE_OK;
+}
+
+/**
+ * Determines if an orientation is available.
+ */
+bool MicroBitOrientation::isValid()
+{
+    return (status & MICROBIT_ORIENTATION_STATUS_VALID) != 0;
+}
+
+/**
+ * Determines the current orientation, as the rotation from the north-east-down frame to the device.
+ */
+MicroBitQuaternion MicroBitOrientation::getQuaternion()
+{
+    return q;
+}
+
+/**
+ * Determines the current pitch, in degrees (-90..90).
+ */
+float MicroBitOrientation::getPitch()
+{
+    return pitch;
+}
+
+/**
+ * Determines the current roll, in degrees (-180..180).
+ */
+float MicroBitOrientation::getRoll()
+{
+    return roll;
+}
+
+/**
+ * Determines the current tilt compensated heading, in degrees clockwise from magnetic north (0..360).
+ */
+float MicroBitOrientation::getHeading()
+{
+    return heading;
+}
+
+/**
+ * Entry point of the update fiber.
+ *
+ * @param orientation The MicroBitOrientation instance to update.
+ */
+void MicroBitOrientation::updateFiber(void *orientation)
+{
+    MicroBitOrientation *o = (MicroBitOrientation *)orientation;
+
+    while (o->status & MICROBIT_ORIENTATION_STATUS_RUNNING)
+    {
+        o->update();
+        fiber_sleep(o->period);
+    }
+
+    o->status &= ~MICROBIT_ORIENTATION_STATUS_FIBER;
+}
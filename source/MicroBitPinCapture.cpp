@@ -0,0 +1,249 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "MicroBitPinCapture.h"
+#include "ErrorNo.h"
+#include "nrf.h"
+
+using namespace codal;
+
+MicroBitPinCapture* MicroBitPinCapture::instance = NULL;
+
+/**
+ * Constructor.
+ *
+ * @param pin The pin to capture.
+ * @param timer A timer dedicated to capture.
+ * @param buffer The ring buffer to store edges in.
+ * @param capacity The number of edges buffer can hold.
+ * @param id The ID of this component, used for its events.
+ */
+MicroBitPinCapture::MicroBitPinCapture(NRF52Pin &pin, NRFLowLevelTimer &timer, uint32_t *buffer, int capacity, uint16_t id) : pin(pin), timer(timer)
+{
+    this->id = id;
+    this->buffer = buffer;
+    this->capacity = capacity;
+    this->head = 0;
+    this->count = 0;
+    this->watermark = CONFIG_MICROBIT_PIN_CAPTURE_WATERMARK;
+    this->overruns = 0;
+}
+
+/**
+ * Destructor. Capture is stopped.
+ */
+MicroBitPinCapture::~MicroBitPinCapture()
+{
+    stop();
+}
+
+/**
+ * Starts capturing edges. The timer is restarted from zero.
+ *
+ * @param watermark The number of edges that triggers MICROBIT_PIN_CAPTURE_EVT_DATA.
+ * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if watermark is out of range, or DEVICE_BUSY if
+ * another MicroBitPinCapture is running.
+ */
+int MicroBitPinCapture::start(int watermark)
+{
+    if (watermark < 1 || watermark > capacity || buffer == NULL)
+        return DEVICE_INVALID_PARAMETER;
+
+    if (instance != NULL && instance != this)
+        return DEVICE_BUSY;
+
+    stop();
+
+    instance = this;
+    this->watermark = watermark;
+    head = 0;
+    count = 0;
+    overruns = 0;
+    status &= ~MICROBIT_PIN_CAPTURE_STATUS_SIGNALLED;
+
+    // Record the starting level. Every edge then toggles it, as GPIOTE reports both edges alike.
+    if (pin.getDigitalValue())
+        status |= MICROBIT_PIN_CAPTURE_STATUS_LEVEL;
+    else
+        status &= ~MICROBIT_PIN_CAPTURE_STATUS_LEVEL;
+
+    // Free running 32 bit timer at 1MHz, with no interrupts of its own.
+    NRF_TIMER_Type *t = timer.timer;
+    t->TASKS_STOP = 1;
+    t->INTENCLR = 0xFFFFFFFF;
+    t->SHORTS = 0;
+    t->MODE = TIMER_MODE_MODE_Timer;
+    t->BITMODE = TIMER_BITMODE_BITMODE_32Bit;
+    t->PRESCALER = 4;
+    t->TASKS_CLEAR = 1;
+
+    NRF_EGU3->EVENTS_TRIGGERED[MICROBIT_PIN_CAPTURE_EGU_CHANNEL] = 0;
+    NRF_EGU3->INTENSET = 1 << MICROBIT_PIN_CAPTURE_EGU_CHANNEL;
+    NVIC_ClearPendingIRQ(SWI3_EGU3_IRQn);
+    NVIC_EnableIRQ(SWI3_EGU3_IRQn);
+
+    // Each edge captures the timer, and triggers the event generator to collect the result.
+    NRF_GPIOTE->EVENTS_IN[MICROBIT_PIN_CAPTURE_GPIOTE_CHANNEL] = 0;
+    NRF_GPIOTE->CONFIG[MICROBIT_PIN_CAPTURE_GPIOTE_CHANNEL] = 0x00030001 | (pin.name << 8);
+
+    NRF_PPI->CH[MICROBIT_PIN_CAPTURE_PPI_CHANNEL].EEP = (uint32_t) &NRF_GPIOTE->EVENTS_IN[MICROBIT_PIN_CAPTURE_GPIOTE_CHANNEL];
+    NRF_PPI->CH[MICROBIT_PIN_CAPTURE_PPI_CHANNEL].TEP = (uint32_t) &t->TASKS_CAPTURE[0];
+    NRF_PPI->FORK[MICROBIT_PIN_CAPTURE_PPI_CHANNEL].TEP = (uint32_t) &NRF_EGU3->TASKS_TRIGGER[MICROBIT_PIN_CAPTURE_EGU_CHANNEL];
+    NRF_PPI->CHENSET = 1 << MICROBIT_PIN_CAPTURE_PPI_CHANNEL;
+
+    t->TASKS_START = 1;
+    status |= MICROBIT_PIN_CAPTURE_STATUS_RUNNING;
+
+    return DEVICE_OK;
+}
+
+/**
+ * Stops capturing edges, and releases the hardware. Edges already captured remain available.
+ */
+void MicroBitPinCapture::stop()
+{
+    if (!(status & MICROBIT_PIN_CAPTURE_STATUS_RUNNING))
+        return;
+
+    NRF_PPI->CHENCLR = 1 << MICROBIT_PIN_CAPTURE_PPI_CHANNEL;
+    NRF_PPI->FORK[MICROBIT_PIN_CAPTURE_PPI_CHANNEL].TEP = 0;
+    NRF_GPIOTE->CONFIG[MICROBIT_PIN_CAPTURE_GPIOTE_CHANNEL] = 0;
+
+    NRF_EGU3->INTENCLR = 1 << MICROBIT_PIN_CAPTURE_EGU_CHANNEL;
+    NVIC_DisableIRQ(SWI3_EGU3_IRQn);
+
+    timer.timer->TASKS_STOP = 1;
+
+    status &= ~MICROBIT_PIN_CAPTURE_STATUS_RUNNING;
+    instance = NULL;
+}
+
+/**
+ * Determines if edges are being captured.
+ */
+bool MicroBitPinCapture::isRunning()
+{
+    return (status & MICROBIT_PIN_CAPTURE_STATUS_RUNNING) != 0;
+}
+
+/**
+ * Determines the current time on the capture timebase, in microseconds.
+ */
+uint32_t MicroBitPinCapture::getTime()
+{
+    timer.timer->TASKS_CAPTURE[1] = 1;
+    return timer.timer->CC[1] & MICROBIT_PIN_CAPTURE_TIME_MASK;
+}
+
+/**
+ * Determines the number of edges waiting to be read.
+ */
+int MicroBitPinCapture::available()
+{
+    return count;
+}
+
+/**
+ * Removes the oldest edges from the ring buffer. Each is the time of the edge in microseconds from start()
+ * (MICROBIT_PIN_CAPTURE_TIME_MASK), with MICROBIT_PIN_CAPTURE_LEVEL_HIGH set for a rising edge.
+ *
+ * @param edges The array to copy edges into.
+ * @param length The maximum number of edges to copy.
+ * @return The number of edges copied.
+ */
+int MicroBitPinCapture::read(uint32_t *edges, int length)
+{
+    int copied = 0;
+
+    target_disable_irq();
+
+    int n = min(length, (int) count);
+    int tail = (head - count + capacity) % capacity;
+
+    while (copied < n)
+    {
+        edges[copied++] = buffer[tail];
+        tail = (tail + 1) % capacity;
+    }
+
+    count -= n;
+
+    // Signal again once another batch has arrived.
+    if (count < watermark)
+        status &= ~MICROBIT_PIN_CAPTURE_STATUS_SIGNALLED;
+
+    target_enable_irq();
+
+    return copied;
+}
+
+/**
+ * Determines the number of edges lost because the ring buffer was full.
+ */
+uint32_t MicroBitPinCapture::getOverruns()
+{
+    return overruns;
+}
+
+/**
+ * Records the edge just captured by the timer.
+ *
+ * @note should only be called from SWI3_EGU3_IRQHandler...
+ */
+void MicroBitPinCapture::onEdge()
+{
+    uint32_t edge = timer.timer->CC[0] & MICROBIT_PIN_CAPTURE_TIME_MASK;
+
+    status ^= MICROBIT_PIN_CAPTURE_STATUS_LEVEL;
+
+    if (status & MICROBIT_PIN_CAPTURE_STATUS_LEVEL)
+        edge |= MICROBIT_PIN_CAPTURE_LEVEL_HIGH;
+
+    if (count == capacity)
+    {
+        overruns++;
+        return;
+    }
+
+    buffer[head] = edge;
+    head = (head + 1) % capacity;
+    count++;
+
+    if (count >= watermark && !(status & MICROBIT_PIN_CAPTURE_STATUS_SIGNALLED))
+    {
+        status |= MICROBIT_PIN_CAPTURE_STATUS_SIGNALLED;
+        Event(id, MICROBIT_PIN_CAPTURE_EVT_DATA);
+    }
+}
+
+extern "C" void SWI3_EGU3_IRQHandler(void)
+{
+    if (NRF_EGU3->EVENTS_TRIGGERED[MICROBIT_PIN_CAPTURE_EGU_CHANNEL])
+    {
+        NRF_EGU3->EVENTS_TRIGGERED[MICROBIT_PIN_CAPTURE_EGU_CHANNEL] = 0;
+
+        if (MicroBitPinCapture::instance)
+            MicroBitPinCapture::instance->onEdge();
+    }
+}
@@ -24,6 +24,8 @@ DEALINGS IN THE SOFTWARE.
 
 #include "MicroBitPowerManager.h"
 #include "MicroBit.h"
+#include "MicroBitIrqDispatcher.h"
+#include "MicroBitSchedulerTrace.h"
 
 static const uint8_t UIPM_I2C_NOP[3] = {0,0,0};
 
@@ -61,6 +63,13 @@ MicroBitPowerManager::MicroBitPowerManager(MicroBitI2C &i2c, MicroBitIO &ioPins,
     this->id = id;
 
     memset( &powerData, 0, sizeof(powerData) );
+    memset( &statistics, 0, sizeof(statistics) );
+    statisticsStart = 0;
+    telemetryTime = 0;
+    memset( wakeTasks, 0, sizeof(wakeTasks) );
+    memset( suspended, 0, sizeof(suspended) );
+    wakeTasksTime = 0;
+    suspendedReason = deepSleepCallbackEnd;
 
     // Indicate we'd like to receive periodic callbacks both in idle and interrupt context.
     // Also, be pessimistic about the interface chip in use, until we obtain version information.
@@ -75,6 +84,9 @@ MicroBitPowerManager::MicroBitPowerManager(MicroBitI2C &i2c, MicroBitIO &ioPins,
  */
 MicroBitPowerSource MicroBitPowerManager::getPowerSource()
 {
+    if (useTelemetry())
+        return powerSource;
+
     ManagedBuffer b;
     b = readProperty(MICROBIT_UIPM_PROPERTY_POWER_SOURCE);
 
@@ -136,6 +148,9 @@ MicroBitVersion MicroBitPowerManager::getVersion()
  */
 MicroBitUSBStatus MicroBitPowerManager::getUSBStatus()
 {
+    if (useTelemetry())
+        return usbStatus;
+
     ManagedBuffer b;
     b = readProperty(MICROBIT_UIPM_PROPERTY_USB_STATE);
 
@@ -151,6 +166,9 @@ uint32_t MicroBitPowerManager::getPowerConsumption()
 
 MicroBitPowerData MicroBitPowerManager::getPowerData()
 {
+    if (useTelemetry())
+        return powerData;
+
     ManagedBuffer b;
     b = readProperty(MICROBIT_UIPM_PROPERTY_POWER_CONSUMPTION);
 
@@ -158,10 +176,73 @@ MicroBitPowerData MicroBitPowerManager::getPowerData()
     memcpy( &powerData.vinMicroVolts, &b[3+4], 4 );
     
     powerData.estimatedPowerConsumption = (float)abs( (float)powerData.vinMicroVolts - (float)powerData.batteryMicroVolts );
+    sampleEnergy();
 
     return powerData;
 }
 
+/**
+ * Reads the power source, USB status and power data from the interface chip in a single burst,
+ * and records them in the powerSource, usbStatus and powerData member variables.
+ * note: This will query the USB interface chip via I2C, and wait for completion.
+ *
+ * @return DEVICE_OK on success, or DEVICE_I2C_ERROR if the interface chip did not respond.
+ */
+int MicroBitPowerManager::updateTelemetry()
+{
+    ManagedBuffer source;
+    ManagedBuffer usb;
+    ManagedBuffer power;
+
+    // The UIPM protocol has no multi-property read, so issue the requests back to back while the interface chip is awake.
+    source = readProperty(MICROBIT_UIPM_PROPERTY_POWER_SOURCE);
+    usb = readProperty(MICROBIT_UIPM_PROPERTY_USB_STATE);
+    power = readProperty(MICROBIT_UIPM_PROPERTY_POWER_CONSUMPTION);
+
+    if (source.length() < 4 || usb.length() < 4 || power.length() < 11)
+    {
+        telemetryTime = 0;
+        return DEVICE_I2C_ERROR;
+    }
+
+    powerSource = (MicroBitPowerSource)source[3];
+    usbStatus = (MicroBitUSBStatus)usb[3];
+
+    memcpy( &powerData.batteryMicroVolts, &power[3], 4 );
+    memcpy( &powerData.vinMicroVolts, &power[3+4], 4 );
+    powerData.estimatedPowerConsumption = (float)abs( (float)powerData.vinMicroVolts - (float)powerData.batteryMicroVolts );
+    sampleEnergy();
+
+    // Avoid zero, which marks the snapshot as invalid.
+    telemetryTime = system_timer_current_time() | 1;
+
+    return DEVICE_OK;
+}
+
+/**
+ * Discards any cached power telemetry, so that the next request queries the interface chip.
+ */
+void MicroBitPowerManager::invalidateTelemetry()
+{
+    telemetryTime = 0;
+}
+
+/**
+ * Determines if the cached power telemetry may be used, refreshing it if it has expired.
+ *
+ * @return true if the powerSource, usbStatus and powerData member variables are current, false if the caller should query the interface chip itself.
+ */
+bool MicroBitPowerManager::useTelemetry()
+{
+    if (CONFIG_MICROBIT_POWER_TELEMETRY_CACHE_TIME == 0)
+        return false;
+
+    if (telemetryTime && system_timer_current_time() - telemetryTime < CONFIG_MICROBIT_POWER_TELEMETRY_CACHE_TIME)
+        return true;
+
+    return updateTelemetry() == DEVICE_OK;
+}
+
 /**
  * Perform a NULL opertion I2C transaction with the interface chip if needed.
  * This is used to awken the KL27 interface chip from light sleep, 
@@ -341,8 +422,25 @@ void MicroBitPowerManager::off()
  */
 void MicroBitPowerManager::idleCallback()
 {
+    MICROBIT_TRACE_IDLE(CodalComponent::id);
+
     static int activeCount = 0;
 
+    // The IRQ line is serviced on demand by a dispatcher.
+    if (status & MICROBIT_USB_INTERFACE_IRQ_DISPATCHED)
+    {
+        status &= ~DEVICE_COMPONENT_STATUS_IDLE_TICK;
+        return;
+    }
+
+    // Once the event bus is available, service the IRQ line on demand rather than polling it here.
+    if (EventModel::defaultEventBus && !(status & MICROBIT_USB_INTERFACE_IRQ_EVENTS))
+    {
+        enableInterfaceEvents();
+        status &= ~DEVICE_COMPONENT_STATUS_IDLE_TICK;
+        return;
+    }
+
     // Do nothing if there is a transaction in progress.
     if (status & MICROBIT_USB_INTERFACE_AWAITING_RESPONSE || !io.irq1.isActive())
     {
@@ -362,15 +460,46 @@ void MicroBitPowerManager::idleCallback()
     readInterfaceRequest();
 }
 
+/**
+ * Enable edge events on the combined IRQ line, such that requests from the USB interface chip are
+ * serviced without polling.
+ *
+ * The line is shared with the motion sensors, whose drivers only read its level, so edge events do not disturb them.
+ * Deep sleep borrows the line's SENSE setting to wake on it, and restores edge events afterwards.
+ */
+void MicroBitPowerManager::enableInterfaceEvents()
+{
+    if (!(status & MICROBIT_USB_INTERFACE_IRQ_EVENTS))
+        EventModel::defaultEventBus->listen(io.irq1.id, DEVICE_PIN_EVT_FALL, this, &MicroBitPowerManager::onInterfaceIrq);
+
+    status |= MICROBIT_USB_INTERFACE_IRQ_EVENTS;
+    io.irq1.eventOn(DEVICE_PIN_EVENT_ON_EDGE);
+}
+
+/**
+ * Event handler, called when the combined IRQ line is asserted.
+ * Services any request from the USB interface chip, if the line remains asserted.
+ */
+void MicroBitPowerManager::onInterfaceIrq(Event)
+{
+    // Ensure the line is held low for a little before servicing, as other sensors
+    // are much more likley to be the source of the IRQ.
+    fiber_sleep(MICROBIT_USB_INTERFACE_IRQ_HOLD_TIME);
+
+    readInterfaceRequest();
+}
+
 /**
  * Service any IRQ requests raised by the USB interface chip.
+ *
+ * @return true if a request was read from the USB interface chip, false otherwise.
  */
-void MicroBitPowerManager::readInterfaceRequest()
+bool MicroBitPowerManager::readInterfaceRequest()
 {
     // Do nothing if there is a transaction in progress.
     if (status & MICROBIT_USB_INTERFACE_AWAITING_RESPONSE || !io.irq1.isActive())
     {
-        return;
+        return false;
     }
 
     // Determine if the KL27 is trying to indicate an event
@@ -382,6 +511,9 @@ void MicroBitPowerManager::readInterfaceRequest()
         // We have a valid frame.
         if(response[0] == MICROBIT_UIPM_COMMAND_READ_RESPONSE && response[1] == MICROBIT_UIPM_PROPERTY_KL27_USER_EVENT && response[2] == 1)
         {
+            // Any KL27 event may indicate a change in power source or USB state.
+            invalidateTelemetry();
+
             // The frame is for us - process the event.
             switch (response[3])
             {
@@ -407,8 +539,64 @@ void MicroBitPowerManager::readInterfaceRequest()
             // The frame is not for us - forward the event to a Flash Manager if it has been registered
             DMESG("UIPM: RECEIVED UNKNWON FRAME");
         }
-        
+
+        return true;
     }
+
+    return false;
+}
+
+/**
+ * Indicates that the combined IRQ line is arbitrated by a MicroBitIrqDispatcher, using irqAwaitingResponse()
+ * and irqInterfaceRequest() as its sources. The line is then no longer polled or listened to here.
+ *
+ * @param dispatched true if the line is serviced by a dispatcher, false otherwise.
+ */
+void MicroBitPowerManager::setIrqDispatched(bool dispatched)
+{
+    if (dispatched)
+    {
+        if (status & MICROBIT_USB_INTERFACE_IRQ_EVENTS)
+            EventModel::defaultEventBus->ignore(io.irq1.id, DEVICE_PIN_EVT_FALL, this, &MicroBitPowerManager::onInterfaceIrq);
+
+        status &= ~MICROBIT_USB_INTERFACE_IRQ_EVENTS;
+        status |= MICROBIT_USB_INTERFACE_IRQ_DISPATCHED;
+    }
+    else
+    {
+        // Fall back to polling in the idle thread, until the event bus listener is reinstated.
+        status &= ~MICROBIT_USB_INTERFACE_IRQ_DISPATCHED;
+        status |= DEVICE_COMPONENT_STATUS_IDLE_TICK;
+    }
+}
+
+/**
+ * MicroBitIrqDispatcher source, claiming the combined IRQ line while a subsystem awaits a response
+ * from the USB interface chip. This requires no I2C transaction, so should be checked first.
+ *
+ * @param context The MicroBitPowerManager instance.
+ * @return MICROBIT_IRQ_DEFERRED if a response is awaited, MICROBIT_IRQ_NONE otherwise.
+ */
+int MicroBitPowerManager::irqAwaitingResponse(void *context)
+{
+    MicroBitPowerManager *power = (MicroBitPowerManager *) context;
+
+    // The subsystem waiting polls the line itself, and re-raises the edge once its transaction is complete.
+    return (power->status & MICROBIT_USB_INTERFACE_AWAITING_RESPONSE) ? MICROBIT_IRQ_DEFERRED : MICROBIT_IRQ_NONE;
+}
+
+/**
+ * MicroBitIrqDispatcher source, servicing any request raised by the USB interface chip.
+ * This requires a complete UIPM transaction, so should be checked last.
+ *
+ * @param context The MicroBitPowerManager instance.
+ * @return MICROBIT_IRQ_HANDLED if a request was read, MICROBIT_IRQ_NONE otherwise.
+ */
+int MicroBitPowerManager::irqInterfaceRequest(void *context)
+{
+    MicroBitPowerManager *power = (MicroBitPowerManager *) context;
+
+    return power->readInterfaceRequest() ? MICROBIT_IRQ_HANDLED : MICROBIT_IRQ_NONE;
 }
 
 /**
@@ -440,6 +628,21 @@ void MicroBitPowerManager::awaitingPacket(bool awaiting)
         status |= MICROBIT_USB_INTERFACE_AWAITING_RESPONSE;
     else
         status &= ~MICROBIT_USB_INTERFACE_AWAITING_RESPONSE;
+
+    // If the line is still asserted once a transaction completes, the interface chip may have a request of its own
+    // that arrived during the transaction. There will be no further edge, so raise the event ourselves.
+    if (!awaiting && (status & (MICROBIT_USB_INTERFACE_IRQ_EVENTS | MICROBIT_USB_INTERFACE_IRQ_DISPATCHED)) && io.irq1.isActive())
+        Event(io.irq1.id, DEVICE_PIN_EVT_FALL);
+}
+
+/**
+ * Determines if edge events are raised on the combined IRQ line, either for us or for a MicroBitIrqDispatcher.
+ *
+ * @return true if a falling edge of the line raises DEVICE_PIN_EVT_FALL, false if it is only polled.
+ */
+bool MicroBitPowerManager::interfaceEventsEnabled()
+{
+    return (status & (MICROBIT_USB_INTERFACE_IRQ_EVENTS | MICROBIT_USB_INTERFACE_IRQ_DISPATCHED)) != 0;
 }
 
 /**
@@ -472,10 +675,15 @@ void MicroBitPowerManager::deepSleep()
     if (!fiber_scheduler_running())
     {
         simpleDeepSleep();
+        resumeAll();
         return;
     }
 
     deepSleepWait();
+
+    // Partial wake ups only run wake up tasks, so continue to sleep.
+    while (status & MICROBIT_POWER_PARTIAL_WAKE)
+        deepSleepWait();
 }
 
 /**
@@ -531,15 +739,25 @@ bool MicroBitPowerManager::deepSleep(uint32_t milliSeconds, bool interruptable )
         if (!fiber_scheduler_running())
         {
             simpleDeepSleep( true /*wakeOnTime*/, wakeUpTime, true /*wakeUpSources*/, NULL /*wakeUpPin*/);
+            resumeAll();
             return false;
         }
 
-        eventValue++;
+        // Skip the value reserved for the wake up scheduler.
+        if (++eventValue == MICROBIT_POWER_EVT_WAKE_TASKS)
+            eventValue++;
+
         int result = system_timer_event_after( milliSeconds, id, eventValue, CODAL_TIMER_EVENT_FLAGS_WAKEUP);
         if ( result == DEVICE_OK)
         {
             deepSleepWait();
 
+            // Partial wake ups only run wake up tasks, so continue to sleep.
+            while ((status & MICROBIT_POWER_PARTIAL_WAKE) && wakeUpTime > system_timer_current_time_us() + 1000)
+                deepSleepWait();
+
+            resumeAll();
+
             CODAL_TIMESTAMP awake = system_timer_current_time_us();
 
             // Timed wake-up is usually < 20ms early here
@@ -595,6 +813,243 @@ void MicroBitPowerManager::deepSleepAsync()
 }
 
 
+/**
+  * Registers a recurring task that must wake the device from deep sleep.
+  * When the task is due, an event with the given id and value is raised.
+  *
+  * Each run may be delayed by up to the given slack so that it can share a single wake up with
+  * other tasks, reducing the number of times the device leaves deep sleep.
+  *
+  * @param id The id of the event to raise. Must be non-zero.
+  * @param value The value of the event to raise.
+  * @param period The time between runs, in milliseconds. The first run is one period from now.
+  * @param slack The time each run may be delayed to coalesce with other tasks, in milliseconds.
+  * @param components The components the task needs, or NULL if the device should fully resume from deep sleep.
+  * If every task due on a timed wake up lists its components, only those are resumed, and the device returns to
+  * deep sleep as soon as the scheduler is idle. The array must remain valid while the task is registered.
+  * @param componentCount The number of entries in components.
+  *
+  * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if id or period is zero, or DEVICE_NO_RESOURCES if all
+  * CONFIG_MICROBIT_POWER_WAKE_TASKS tasks are in use. Registering an existing id and value updates its schedule.
+  */
+int MicroBitPowerManager::scheduleWakeUp(uint16_t id, uint16_t value, uint32_t period, uint32_t slack, CodalComponent **components, int componentCount)
+{
+    MicroBitWakeTask *task = NULL;
+    bool active = false;
+
+    if (id == 0 || period == 0)
+        return DEVICE_INVALID_PARAMETER;
+
+    for (int i = 0; i < CONFIG_MICROBIT_POWER_WAKE_TASKS; i++)
+    {
+        if (wakeTasks[i].id == 0)
+        {
+            if (task == NULL)
+                task = &wakeTasks[i];
+        }
+        else
+        {
+            active = true;
+
+            if (wakeTasks[i].id == id && wakeTasks[i].value == value)
+                task = &wakeTasks[i];
+        }
+    }
+
+    if (task == NULL)
+        return DEVICE_NO_RESOURCES;
+
+    // Register for our timer the first time a task is added.
+    if (!active && EventModel::defaultEventBus)
+        EventModel::defaultEventBus->listen(this->id, MICROBIT_POWER_EVT_WAKE_TASKS, this, &MicroBitPowerManager::onWakeTasks);
+
+    task->id = id;
+    task->value = value;
+    task->period = period;
+    task->slack = slack;
+    task->due = system_timer_current_time() + period;
+    task->components = components;
+    task->componentCount = components ? componentCount : 0;
+
+    scheduleWakeTasks();
+
+    return DEVICE_OK;
+}
+
+/**
+  * Removes a recurring task previously registered with scheduleWakeUp().
+  *
+  * @param id The id of the task's event.
+  * @param value The value of the task's event.
+  *
+  * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if no such task is registered.
+  */
+int MicroBitPowerManager::cancelWakeUp(uint16_t id, uint16_t value)
+{
+    for (int i = 0; i < CONFIG_MICROBIT_POWER_WAKE_TASKS; i++)
+    {
+        if (wakeTasks[i].id == id && wakeTasks[i].value == value && id != 0)
+        {
+            wakeTasks[i].id = 0;
+            scheduleWakeTasks();
+            return DEVICE_OK;
+        }
+    }
+
+    return DEVICE_INVALID_PARAMETER;
+}
+
+/**
+  * Arms a single wake up timer for the next group of recurring tasks.
+  * The timer fires at the latest time that keeps every task within its slack,
+  * so that all tasks due by then can be run together.
+  */
+void MicroBitPowerManager::scheduleWakeTasks()
+{
+    CODAL_TIMESTAMP now = system_timer_current_time();
+    CODAL_TIMESTAMP wakeUpTime = 0;
+    bool active = false;
+
+    system_timer_cancel_event(id, MICROBIT_POWER_EVT_WAKE_TASKS);
+    wakeTasksTime = 0;
+
+    for (int i = 0; i < CONFIG_MICROBIT_POWER_WAKE_TASKS; i++)
+    {
+        if (wakeTasks[i].id)
+        {
+            CODAL_TIMESTAMP deadline = wakeTasks[i].due + wakeTasks[i].slack;
+
+            if (!active || deadline < wakeUpTime)
+                wakeUpTime = deadline;
+
+            active = true;
+        }
+    }
+
+    if (!active)
+    {
+        if (EventModel::defaultEventBus)
+            EventModel::defaultEventBus->ignore(this->id, MICROBIT_POWER_EVT_WAKE_TASKS, this, &MicroBitPowerManager::onWakeTasks);
+
+        return;
+    }
+
+    uint32_t delay = wakeUpTime > now ? wakeUpTime - now : 1;
+
+    if (system_timer_event_after(delay, id, MICROBIT_POWER_EVT_WAKE_TASKS, CODAL_TIMER_EVENT_FLAGS_WAKEUP) == DEVICE_OK)
+        wakeTasksTime = system_timer_current_time_us() + (CODAL_TIMESTAMP) 1000 * delay;
+}
+
+/**
+  * Determines which components to resume after a timed wake up from deep sleep.
+  * A partial wake up is used only if the wake up scheduler's timer woke us, and every task due
+  * declares the components it needs.
+  *
+  * @param wakeUpTime The time the device was due to wake, in microseconds.
+  * @param needed Bitmap of indexes into CodalComponent::components, set for each component to resume.
+  *
+  * @return true if only the components in needed should be resumed, false to resume all components.
+  */
+bool MicroBitPowerManager::selectWakeComponents(CODAL_TIMESTAMP wakeUpTime, uint32_t *needed)
+{
+    // Another timer event is due first, so the wake up is not ours.
+    if (wakeTasksTime == 0 || wakeUpTime + 1000 < wakeTasksTime)
+        return false;
+
+    CODAL_TIMESTAMP now = wakeTasksTime / 1000;
+
+    for (int i = 0; i < CONFIG_MICROBIT_POWER_WAKE_TASKS; i++)
+    {
+        MicroBitWakeTask *task = &wakeTasks[i];
+
+        if (task->id == 0 || task->due > now)
+            continue;
+
+        if (task->components == NULL)
+            return false;
+
+        for (int c = 0; c < task->componentCount; c++)
+        {
+            for (int j = 0; j < DEVICE_COMPONENT_COUNT; j++)
+            {
+                if (CodalComponent::components[j] && CodalComponent::components[j] == task->components[c])
+                    needed[j / 32] |= 1UL << (j % 32);
+            }
+        }
+    }
+
+    // We need ourselves to run the tasks and manage the next sleep.
+    for (int j = 0; j < DEVICE_COMPONENT_COUNT; j++)
+    {
+        if (CodalComponent::components[j] == this)
+            needed[j / 32] |= 1UL << (j % 32);
+    }
+
+    return true;
+}
+
+/**
+  * Invokes the deep sleep callback of each component in the given bitmap.
+  *
+  * @param reason The deep sleep callback reason to pass.
+  * @param components Bitmap of indexes into CodalComponent::components.
+  */
+void MicroBitPowerManager::deepSleepComponents(deepSleepCallbackReason reason, uint32_t *components)
+{
+    for (int i = 0; i < DEVICE_COMPONENT_COUNT; i++)
+    {
+        if (CodalComponent::components[i] && (components[i / 32] & (1UL << (i % 32))))
+            CodalComponent::components[i]->deepSleepCallback(reason, NULL);
+    }
+}
+
+/**
+  * Resumes any components left in deep sleep by a partial wake up for a wake up task.
+  * Code that runs during a partial wake up and needs the rest of the device should call this first.
+  */
+void MicroBitPowerManager::resumeAll()
+{
+    if (!(status & MICROBIT_POWER_PARTIAL_WAKE))
+        return;
+
+    status &= ~MICROBIT_POWER_PARTIAL_WAKE;
+    deepSleepComponents(suspendedReason, suspended);
+    memset(suspended, 0, sizeof(suspended));
+
+    setPowerLED(false /*doSleep*/);
+    powerUpTime = system_timer_current_time();
+}
+
+/**
+  * Event handler, called when the wake up scheduler timer fires.
+  * Raises the events of all tasks that are due, and rearms the timer.
+  */
+void MicroBitPowerManager::onWakeTasks(Event)
+{
+    CODAL_TIMESTAMP now = system_timer_current_time();
+
+    for (int i = 0; i < CONFIG_MICROBIT_POWER_WAKE_TASKS; i++)
+    {
+        MicroBitWakeTask *task = &wakeTasks[i];
+
+        if (task->id && task->due <= now)
+        {
+            // Keep to the task's nominal schedule, unless we have fallen a whole period behind.
+            task->due += task->period;
+            if (task->due <= now)
+                task->due = now + task->period;
+
+            Event(task->id, task->value);
+        }
+    }
+
+    scheduleWakeTasks();
+
+    // Return to deep sleep once the tasks are complete.
+    if (status & MICROBIT_POWER_PARTIAL_WAKE)
+        prepareDeepSleep();
+}
+
 /**
   * Enable power down during deepSleep
   * The default is enabled.
@@ -639,7 +1094,8 @@ bool MicroBitPowerManager::waitingForDeepSleep()
   */
 bool MicroBitPowerManager::readyForDeepSleep()
 {
-    if ( system_timer_current_time() - powerUpTime < CONFIG_MINIMUM_POWER_ON_TIME)
+    // A partial wake up has no minimum power on time, as most of the device is still asleep.
+    if ( !(status & MICROBIT_POWER_PARTIAL_WAKE) && system_timer_current_time() - powerUpTime < CONFIG_MINIMUM_POWER_ON_TIME)
         return false;
 
     return powerDownIsEnabled();
@@ -793,8 +1249,12 @@ int MicroBitPowerManager::simpleDeepSleep( bool wakeOnTime, CODAL_TIMESTAMP wake
     // Configure for sleep mode
     setPowerLED( true /*doSleep*/);
 
-    // Update peripheral drivers
-    CodalComponent::deepSleepAll( wakeUpSources ? deepSleepCallbackBeginWithWakeUps : deepSleepCallbackBegin, NULL);
+    // Update peripheral drivers, other than any left asleep by a partial wake up.
+    uint32_t awake[(DEVICE_COMPONENT_COUNT + 31) / 32];
+    for (int i = 0; i < (DEVICE_COMPONENT_COUNT + 31) / 32; i++)
+        awake[i] = ~suspended[i];
+
+    deepSleepComponents( wakeUpSources ? deepSleepCallbackBeginWithWakeUps : deepSleepCallbackBegin, awake);
 
     CODAL_TIMESTAMP tickStart;
     CODAL_TIMESTAMP timeStart = system_timer_deepsleep_begin( tickStart);
@@ -842,6 +1302,9 @@ int MicroBitPowerManager::simpleDeepSleep( bool wakeOnTime, CODAL_TIMESTAMP wake
                         - 13;  // __WFI() latency
 
     uint64_t sleepTicks = 0;
+    MicroBitWakeUpReason reason = WAKEUP_OTHER;
+
+    MICROBIT_ENERGY_STATE(MICROBIT_ENERGY_CPU, false);
 
     while ( true)
     {
@@ -850,7 +1313,10 @@ int MicroBitPowerManager::simpleDeepSleep( bool wakeOnTime, CODAL_TIMESTAMP wake
         if ( wakeOnTime)
         {
             if ( sleepTicks >= totalTicks)
+            {
+                reason = WAKEUP_TIMER;
                 break;
+            }
             uint64_t remain64 = totalTicks - sleepTicks;
             remain = remain64 > ticksMax ? ticksMax : remain64;
         }
@@ -878,7 +1344,9 @@ int MicroBitPowerManager::simpleDeepSleep( bool wakeOnTime, CODAL_TIMESTAMP wake
 
         if ( timer_irq_channels == 0)
         {
-            break; // It must be another interrupt
+            // It must be another interrupt
+            reason = io.irq1.isActive() ? WAKEUP_INTERFACE : WAKEUP_OTHER;
+            break;
         }
 
         timer_irq_channels = 0;
@@ -887,6 +1355,10 @@ int MicroBitPowerManager::simpleDeepSleep( bool wakeOnTime, CODAL_TIMESTAMP wake
     // Disable DETECT events 
     io.irq1.setDetect(GPIO_PIN_CNF_SENSE_Disabled);
 
+    // Restore edge events, if we or a dispatcher use them to service the USB interface chip.
+    if (status & (MICROBIT_USB_INTERFACE_IRQ_EVENTS | MICROBIT_USB_INTERFACE_IRQ_DISPATCHED))
+        io.irq1.eventOn(DEVICE_PIN_EVENT_ON_EDGE);
+
     if ( !wakeUpSources)
     {
         if ( wakeUpPin)
@@ -908,12 +1380,163 @@ int MicroBitPowerManager::simpleDeepSleep( bool wakeOnTime, CODAL_TIMESTAMP wake
 
     sysTimer->timer->INTENSET = saveIntenset;
 
-    // Configure for running mode.
-    CodalComponent::deepSleepAll( wakeUpSources ? deepSleepCallbackEndWithWakeUps : deepSleepCallbackEnd, NULL);
+    // The system timer has now caught up with the time spent asleep.
+    MICROBIT_ENERGY_STATE(MICROBIT_ENERGY_CPU, true);
 
-    setPowerLED(false /*doSleep*/);
+    // Configure for running mode. For a timed wake up that only runs wake up tasks, resume just the components they need.
+    deepSleepCallbackReason endReason = wakeUpSources ? deepSleepCallbackEndWithWakeUps : deepSleepCallbackEnd;
+    uint32_t needed[(DEVICE_COMPONENT_COUNT + 31) / 32];
+    memset(needed, 0, sizeof(needed));
 
-    powerUpTime = system_timer_current_time();
+    if (reason == WAKEUP_TIMER && selectWakeComponents(wakeUpTime, needed))
+    {
+        deepSleepComponents(endReason, needed);
+
+        for (int i = 0; i < (DEVICE_COMPONENT_COUNT + 31) / 32; i++)
+            suspended[i] = ~needed[i];
+
+        suspendedReason = endReason;
+        status |= MICROBIT_POWER_PARTIAL_WAKE;
+    }
+    else
+    {
+        CodalComponent::deepSleepAll( endReason, NULL);
+        memset(suspended, 0, sizeof(suspended));
+        status &= ~MICROBIT_POWER_PARTIAL_WAKE;
+
+        setPowerLED(false /*doSleep*/);
+
+        powerUpTime = system_timer_current_time();
+    }
+
+    statistics.deepSleepTime += sleepTicks * usPerTick;
+    statistics.deepSleepCount++;
+    statistics.wakeUps[reason]++;
+
+    // Power may have changed while we slept.
+    invalidateTelemetry();
 
     return DEVICE_OK;
 }
+
+/**
+ * For library use.
+ * Waits for an event or interrupt while the scheduler is idle, recording the time spent for getStatistics().
+ */
+void MicroBitPowerManager::waitForEvent()
+{
+    CODAL_TIMESTAMP start = system_timer_current_time_us();
+
+    MICROBIT_ENERGY_STATE(MICROBIT_ENERGY_CPU, false);
+    target_wait_for_event();
+    MICROBIT_ENERGY_STATE(MICROBIT_ENERGY_CPU, true);
+
+    statistics.idleTime += system_timer_current_time_us() - start;
+    statistics.idleCount++;
+}
+
+/**
+ * Determines the time spent active, idle and in deep sleep since the statistics were last reset,
+ * along with the reasons for waking from deep sleep.
+ *
+ * @return the current power state statistics.
+ */
+MicroBitPowerStatistics MicroBitPowerManager::getStatistics()
+{
+    MicroBitPowerStatistics s = statistics;
+    CODAL_TIMESTAMP elapsed = system_timer_current_time_us() - statisticsStart;
+
+    // Whatever time is not accounted for as idle or asleep was spent running.
+    s.activeTime = elapsed > s.idleTime + s.deepSleepTime ? elapsed - s.idleTime - s.deepSleepTime : 0;
+
+    return s;
+}
+
+/**
+ * Resets the power state statistics.
+ */
+void MicroBitPowerManager::resetStatistics()
+{
+    memset( &statistics, 0, sizeof(statistics) );
+    statisticsStart = system_timer_current_time_us();
+}
+
+/**
+ * Passes the supply voltage in the most recent power telemetry to the energy accounts.
+ * The battery voltage is used when running from battery alone, and VIN otherwise.
+ */
+void MicroBitPowerManager::sampleEnergy()
+{
+    uint32_t microVolts = powerSource == PWR_BATT_ONLY ? powerData.batteryMicroVolts : powerData.vinMicroVolts;
+
+    microbit_energy_sample(microVolts / 1000);
+}
+
+/**
+ * Estimates the energy used by each subsystem since the accounts were last reset.
+ * The supply voltage is read from the interface chip first, so that time spent active since the last reading is costed at a current figure.
+ *
+ * @param report The structure to fill in.
+ *
+ * @return DEVICE_OK on success, or DEVICE_NOT_SUPPORTED if CONFIG_MICROBIT_ENERGY_ACCOUNTING is disabled.
+ */
+int MicroBitPowerManager::getEnergyUsage(MicroBitEnergyReport &report)
+{
+#if CONFIG_ENABLED(CONFIG_MICROBIT_ENERGY_ACCOUNTING)
+    if (updateTelemetry() != DEVICE_OK)
+        microbit_energy_sample(0);
+#endif
+
+    return microbit_energy_get_report(report);
+}
+
+/**
+ * Clears the energy accounts of all subsystems.
+ */
+void MicroBitPowerManager::resetEnergyUsage()
+{
+    microbit_energy_reset();
+}
+
+/**
+ * Sets the current a subsystem is modelled as drawing while active, for example from a calibration against a meter.
+ *
+ * @param subsystem One of MICROBIT_ENERGY_*.
+ * @param microAmps The current drawn, in microamps.
+ *
+ * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the subsystem is unknown, or DEVICE_NOT_SUPPORTED if CONFIG_MICROBIT_ENERGY_ACCOUNTING is disabled.
+ */
+int MicroBitPowerManager::setEnergyModel(int subsystem, uint32_t microAmps)
+{
+    return microbit_energy_set_current(subsystem, microAmps);
+}
+
+/**
+ * Writes the energy used by each subsystem to the data log as a single row, with columns energy_<subsystem>_mj,
+ * energy_total_mj and supply_mv.
+ *
+ * @param log The data log to write to.
+ *
+ * @return DEVICE_OK on success, DEVICE_NOT_SUPPORTED if CONFIG_MICROBIT_ENERGY_ACCOUNTING is disabled, or an error from the log.
+ */
+int MicroBitPowerManager::logEnergyUsage(MicroBitLog &log)
+{
+    MicroBitEnergyReport report;
+    int result = getEnergyUsage(report);
+
+    if (result != DEVICE_OK)
+        return result;
+
+    log.beginRow();
+
+    for (int i = 0; i < MICROBIT_ENERGY_SUBSYSTEMS; i++)
+    {
+        ManagedString key = ManagedString("energy_") + report.subsystems[i].name + "_mj";
+        log.logData(key.toCharArray(), (double) report.subsystems[i].energy / 1000.0, 3);
+    }
+
+    log.logData("energy_total_mj", (double) report.energy / 1000.0, 3);
+    log.logData("supply_mv", (int) report.milliVolts);
+
+    return log.endRow();
+}
@@ -28,7 +28,18 @@ DEALINGS IN THE SOFTWARE.
 #include "CodalComponent.h"
 #include "ErrorNo.h"
 #include "CodalFiber.h"
+#include "EventModel.h"
+#include "Timer.h"
 #include "nrf.h"
+#include "MicroBitSchedulerTrace.h"
+#include "MicroBitRadioBridge.h"
+#include "MicroBitEventTrace.h"
+#include "MicroBitEnergy.h"
+
+#if MICROBIT_RADIO_TIMESLOT_SUPPORTED
+#include "nrf_soc.h"
+#include "nrf_sdh_soc.h"
+#endif
 
 using namespace codal;
 
@@ -52,15 +63,96 @@ const uint8_t MICROBIT_RADIO_POWER_LEVEL[] = {0xD8, 0xEC, 0xF0, 0xF4, 0xF8, 0xFC
   * BLE to cohabit with other protocols. Future work to allow this colocation would be benefical, and would also allow for the
   * creation of wireless BLE bridges.
   *
-  * NOTE: This API does not contain any form of encryption, authentication or authorisation. Its purpose is solely for use as a
-  * teaching aid to demonstrate how simple communications operates, and to provide a sandpit through which learning can take place.
-  * For serious applications, BLE should be considered a substantially more secure alternative.
+  * NOTE: By default this API does not contain any form of encryption, authentication or authorisation. Giving a group a key
+  * through cipher.setKey() encrypts and authenticates every frame sent to it, so that frames from anyone without the key (or
+  * replayed) are discarded. There is no key exchange, so keys must be distributed by other means. For serious applications,
+  * BLE should be considered a substantially more secure alternative.
   */
 
 MicroBitRadio* MicroBitRadio::instance = NULL;
 
-extern "C" void RADIO_IRQHandler(void)
+namespace codal {
+
+/**
+  * Configures the modulation and packet format of the RADIO for the given data rate.
+  * The RADIO must be disabled.
+  *
+  * @param rate The data rate to use, one of MICROBIT_RADIO_DATA_RATE_*.
+  *
+  * @param maxLength The largest value of the length field of frames to be received.
+  */
+void microbit_radio_set_data_rate(uint8_t rate, uint8_t maxLength)
 {
+    // Packet layout configuration. The nrf51822 has a highly capable and flexible RADIO module that, in addition to transmission
+    // and reception of data, also contains a LENGTH field, two optional additional 1 byte fields (S0 and S1) and a CRC calculation.
+    // Configure the packet format for a simple 8 bit length field and no additional fields, with data whitening and a 40 bit address.
+    uint32_t pcnf0 = 8 << RADIO_PCNF0_LFLEN_Pos;
+    uint32_t balen = 4;
+
+    switch (rate)
+    {
+        case MICROBIT_RADIO_DATA_RATE_2MBIT:
+            // A 16 bit preamble gives receivers time to lock on at the higher rate.
+            NRF_RADIO->MODE = RADIO_MODE_MODE_Nrf_2Mbit;
+            pcnf0 |= RADIO_PCNF0_PLEN_16bit << RADIO_PCNF0_PLEN_Pos;
+            break;
+
+        case MICROBIT_RADIO_DATA_RATE_LR_500KBIT:
+        case MICROBIT_RADIO_DATA_RATE_LR_125KBIT:
+            // The coded PHY adds a long preamble, a coding indicator and a terminator after both the address and the CRC.
+            // Its address is fixed at 32 bits.
+            NRF_RADIO->MODE = rate == MICROBIT_RADIO_DATA_RATE_LR_500KBIT ? RADIO_MODE_MODE_Ble_LR500Kbit : RADIO_MODE_MODE_Ble_LR125Kbit;
+            pcnf0 |= (RADIO_PCNF0_PLEN_LongRange << RADIO_PCNF0_PLEN_Pos) | (2 << RADIO_PCNF0_CILEN_Pos) | (3 << RADIO_PCNF0_TERMLEN_Pos);
+            balen = 3;
+            break;
+
+        default:
+            NRF_RADIO->MODE = RADIO_MODE_MODE_Nrf_1Mbit;
+            break;
+    }
+
+    NRF_RADIO->PCNF0 = pcnf0;
+    NRF_RADIO->PCNF1 = RADIO_PCNF1_WHITEEN_Msk | (balen << RADIO_PCNF1_BALEN_Pos) | maxLength;
+}
+
+/**
+  * Calculates the time taken to transmit a frame, from the start of its preamble to the end of its CRC.
+  *
+  * @param rate The data rate in use, one of MICROBIT_RADIO_DATA_RATE_*.
+  *
+  * @param length The length field of the frame.
+  *
+  * @return The airtime of the frame, in microseconds.
+  */
+uint32_t microbit_radio_airtime(uint8_t rate, uint8_t length)
+{
+    switch (rate)
+    {
+        case MICROBIT_RADIO_DATA_RATE_2MBIT:
+            // A 2 byte preamble, 5 byte address, the length byte, the frame itself and a 2 byte CRC, at 4us per byte.
+            return ((uint32_t)length + 10) * 4;
+
+        case MICROBIT_RADIO_DATA_RATE_LR_500KBIT:
+            // An 80us preamble, then the address, coding indicator and first terminator, always sent at 125kbit/s (376us).
+            // Then the length byte, the frame and CRC at 16us per byte, and a 6us terminator.
+            return 382 + ((uint32_t)length + 3) * 16;
+
+        case MICROBIT_RADIO_DATA_RATE_LR_125KBIT:
+            // As above, but with the length byte, the frame and CRC at 64us per byte, and a 24us terminator.
+            return 400 + ((uint32_t)length + 3) * 64;
+
+        default:
+            // A 1 byte preamble, 5 byte address, the length byte, the frame itself and a 2 byte CRC, at 8us per byte.
+            return ((uint32_t)length + 9) * 8;
+    }
+}
+
+}
+
+extern "C" MICROBIT_RAMFUNC void RADIO_IRQHandler(void)
+{
+    MICROBIT_EVENT_TRACE(MICROBIT_EVENT_TRACE_RADIO_IRQ, NRF_RADIO->EVENTS_READY | NRF_RADIO->EVENTS_END << 1, 0);
+
     if(NRF_RADIO->EVENTS_READY)
     {
         NRF_RADIO->EVENTS_READY = 0;
@@ -72,31 +164,129 @@ extern "C" void RADIO_IRQHandler(void)
     if(NRF_RADIO->EVENTS_END)
     {
         NRF_RADIO->EVENTS_END = 0;
-        if(NRF_RADIO->CRCSTATUS == 1)
-        {
-            int sample = (int)NRF_RADIO->RSSISAMPLE;
 
-            // Associate this packet's rssi value with the data just
-            // transferred by DMA receive
-            MicroBitRadio::instance->setRSSI(-sample);
+        MICROBIT_EVENT_TRACE(MICROBIT_EVENT_TRACE_RADIO_RX, NRF_RADIO->RXMATCH | NRF_RADIO->CRCSTATUS << 8, NRF_RADIO->RSSISAMPLE);
 
-            // Now move on to the next buffer, if possible.
-            // The queued packet will get the rssi value set above.
-            MicroBitRadio::instance->queueRxBuf();
+        // Whilst capturing, every frame heard is recorded, but only those sent to our own group (address 0) are processed further.
+        if (MicroBitRadio::instance->capture.isEnabled())
+            MicroBitRadio::instance->capture.record(&MicroBitRadio::instance->getRxBuf()->length, NRF_RADIO->RXMATCH, NRF_RADIO->RSSISAMPLE, NRF_RADIO->CRCSTATUS == 1);
 
-            // Set the new buffer for DMA
-            NRF_RADIO->PACKETPTR = (uint32_t) MicroBitRadio::instance->getRxBuf();
-        }
-        else
+        if (NRF_RADIO->RXMATCH == 0)
         {
-            MicroBitRadio::instance->setRSSI(0);
+            MicroBitRadio::instance->recordReceive(NRF_RADIO->CRCSTATUS == 1);
+            MicroBitRadio::instance->setHopTiming(NRF_RADIO->CRCSTATUS == 1);
+
+            if(NRF_RADIO->CRCSTATUS == 1)
+            {
+                int sample = (int)NRF_RADIO->RSSISAMPLE;
+
+                // Associate this packet's rssi value with the data just
+                // transferred by DMA receive
+                MicroBitRadio::instance->setRSSI(-sample);
+
+                // Now move on to the next buffer, if possible.
+                // The queued packet will get the rssi value set above.
+                MicroBitRadio::instance->queueRxBuf();
+
+                // Set the new buffer for DMA
+                NRF_RADIO->PACKETPTR = (uint32_t) &MicroBitRadio::instance->getRxBuf()->length;
+            }
+            else
+            {
+                MicroBitRadio::instance->setRSSI(0);
+            }
         }
 
         // Start listening and wait for the END event
         NRF_RADIO->TASKS_START = 1;
     }
+
+    MICROBIT_EVENT_TRACE(MICROBIT_EVENT_TRACE_RADIO_IRQ | MICROBIT_EVENT_TRACE_END, 0, 0);
+}
+
+#if MICROBIT_RADIO_TIMESLOT_SUPPORTED
+
+static nrf_radio_request_t timeslot_request;
+static nrf_radio_signal_callback_return_param_t timeslot_action;
+
+/**
+  * Builds a request for the earliest timeslot the SoftDevice can give us.
+  *
+  * @return The request, which remains valid until the next call.
+  */
+static nrf_radio_request_t *timeslot_request_earliest()
+{
+    timeslot_request.request_type = NRF_RADIO_REQ_TYPE_EARLIEST;
+    timeslot_request.params.earliest.hfclk = NRF_RADIO_HFCLK_CFG_XTAL_GUARANTEED;
+    timeslot_request.params.earliest.priority = NRF_RADIO_PRIORITY_NORMAL;
+    timeslot_request.params.earliest.length_us = MICROBIT_RADIO_TIMESLOT_LENGTH_US;
+    timeslot_request.params.earliest.timeout_us = MICROBIT_RADIO_TIMESLOT_TIMEOUT_US;
+
+    return &timeslot_request;
+}
+
+/**
+  * Timeslot signal handler. Called by the SoftDevice, at the highest interrupt priority, as timeslots start and end,
+  * and in place of RADIO_IRQHandler and the TIMER0 interrupt whilst a timeslot is in progress.
+  */
+static nrf_radio_signal_callback_return_param_t *timeslot_signal_handler(uint8_t signal)
+{
+    MicroBitRadio *radio = MicroBitRadio::instance;
+
+    timeslot_action.callback_action = NRF_RADIO_SIGNAL_CALLBACK_ACTION_NONE;
+
+    switch (signal)
+    {
+        case NRF_RADIO_CALLBACK_SIGNAL_TYPE_START:
+            // TIMER0 is ours for the duration of the timeslot, counting microseconds from its start.
+            // Use it to warn us as the end of the timeslot approaches.
+            NRF_TIMER0->INTENSET = TIMER_INTENSET_COMPARE0_Msk;
+            NRF_TIMER0->CC[0] = MICROBIT_RADIO_TIMESLOT_LENGTH_US - MICROBIT_RADIO_TIMESLOT_MARGIN_US;
+            NVIC_EnableIRQ(TIMER0_IRQn);
+
+            radio->timeslotStart();
+            break;
+
+        case NRF_RADIO_CALLBACK_SIGNAL_TYPE_RADIO:
+            RADIO_IRQHandler();
+            radio->timeslotService();
+            break;
+
+        case NRF_RADIO_CALLBACK_SIGNAL_TYPE_TIMER0:
+            // Ask to keep the RADIO for a while longer. The SoftDevice will refuse if BLE needs it.
+            NRF_TIMER0->EVENTS_COMPARE[0] = 0;
+            timeslot_action.callback_action = NRF_RADIO_SIGNAL_CALLBACK_ACTION_EXTEND;
+            timeslot_action.params.extend.length_us = MICROBIT_RADIO_TIMESLOT_LENGTH_US;
+            break;
+
+        case NRF_RADIO_CALLBACK_SIGNAL_TYPE_EXTEND_SUCCEEDED:
+            NRF_TIMER0->CC[0] += MICROBIT_RADIO_TIMESLOT_LENGTH_US;
+            break;
+
+        case NRF_RADIO_CALLBACK_SIGNAL_TYPE_EXTEND_FAILED:
+            // Hand the RADIO back, and queue up for the next gap.
+            radio->timeslotEnd();
+            timeslot_action.callback_action = NRF_RADIO_SIGNAL_CALLBACK_ACTION_REQUEST_AND_END;
+            timeslot_action.params.request.p_next = timeslot_request_earliest();
+            break;
+    }
+
+    return &timeslot_action;
 }
 
+/**
+  * SoftDevice SoC event handler. Renews our timeslot request if it could not be met.
+  */
+static void timeslot_soc_handler(uint32_t sys_evt, void *)
+{
+    if (MicroBitRadio::instance && (sys_evt == NRF_EVT_RADIO_BLOCKED || sys_evt == NRF_EVT_RADIO_CANCELED))
+        MicroBitRadio::instance->timeslotRenew();
+}
+
+NRF_SDH_SOC_OBSERVER( microbit_radio_soc_observer, 0, timeslot_soc_handler, NULL);
+
+#endif
+
 /**
   * Constructor.
   *
@@ -112,10 +302,20 @@ MicroBitRadio::MicroBitRadio(uint16_t id) : datagram(*this), event (*this)
     this->band  = MICROBIT_RADIO_DEFAULT_FREQUENCY;
     this->power = MICROBIT_RADIO_DEFAULT_TX_POWER;
     this->group = MICROBIT_RADIO_DEFAULT_GROUP;
-    this->queueDepth = 0;
+    this->rate = MICROBIT_RADIO_DEFAULT_DATA_RATE;
     this->rssi = 0;
-    this->rxQueue = NULL;
-    this->rxBuf = NULL;
+    this->rxRing = NULL;
+    this->rxHead = 0;
+    this->rxTail = 0;
+    this->channel = MICROBIT_RADIO_DEFAULT_FREQUENCY;
+    this->hopDwell = MICROBIT_RADIO_HOPPING_DEFAULT_DWELL_MS * 1000;
+    this->hopOrigin = 0;
+    this->hopActive = 0;
+    memset(&this->stats, 0, sizeof(this->stats));
+    this->txPending = NULL;
+    this->bridge = NULL;
+    this->inTimeslot = false;
+    this->reconfigure = false;
 
     instance = this;
 }
@@ -132,26 +332,82 @@ int MicroBitRadio::setTransmitPower(int power)
     if (power < 0 || power >= MICROBIT_RADIO_POWER_LEVELS)
         return DEVICE_INVALID_PARAMETER;
 
+    int access = hardwareAccess();
+
+    if (access == DEVICE_NOT_SUPPORTED)
+        return access;
+
     // Record our power locally
     this->power = power;
 
-    NRF_RADIO->TXPOWER = (uint32_t)MICROBIT_RADIO_POWER_LEVEL[power];
+    if (access == DEVICE_OK)
+        NRF_RADIO->TXPOWER = (uint32_t)MICROBIT_RADIO_POWER_LEVEL[power];
+    else
+        requestReconfigure();
 
     return DEVICE_OK;
 }
 
+/**
+  * Determines the output power level of the transmitter.
+  *
+  * @return a value in the range 0..7, where 0 is the lowest power and 7 is the highest.
+  */
+int MicroBitRadio::getTransmitPower()
+{
+    return power;
+}
+
+/**
+  * Enables or disables adaptive transmit power control. When enabled, the power level is adjusted automatically
+  * to the lowest that achieves the given delivery rate to the other members of the group, based on the outcome of
+  * transmissions reported through reportDelivery(). Reliable datagrams (see MicroBitRadioDatagram::sendReliable())
+  * report their acknowledgements automatically. The level set by setTransmitPower() is the starting point,
+  * and the loop starts afresh whenever the group is changed.
+  *
+  * @param enable true to enable adaptive power control, false to hold the current level.
+  *
+  * @param target The percentage of transmission attempts that should succeed, in the range 1 - 100.
+  *
+  * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the target is out of range.
+  */
+int MicroBitRadio::setAdaptivePower(bool enable, int target)
+{
+    return powerControl.configure(enable, target, MICROBIT_RADIO_POWER_LEVELS - 1);
+}
+
+/**
+  * Reports the outcome of one or more transmissions to the adaptive transmit power control loop.
+  * Does nothing unless adaptive power control is enabled.
+  *
+  * @param delivered The number of transmission attempts known to have succeeded.
+  *
+  * @param lost The number of transmission attempts known to have failed.
+  *
+  * @param rssi The signal strength of the reply confirming delivery, in dBm as given by getRSSI(), or zero if unknown.
+  */
+void MicroBitRadio::reportDelivery(int delivered, int lost, int rssi)
+{
+    int level = powerControl.update(power, delivered, lost, rssi);
+
+    if (level != power)
+        setTransmitPower(level);
+}
+
 /**
   * Change the transmission and reception band of the radio to the given channel
   *
   * @param band a frequency band in the range 0 - 100. Each step is 1MHz wide, based at 2400MHz.
   *
   * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the value is out of range,
-  *         or DEVICE_NOT_SUPPORTED if the BLE stack is running.
+  *         or DEVICE_NOT_SUPPORTED if the BLE stack is running and the RADIO cannot be shared.
   */
 int MicroBitRadio::setFrequencyBand(int band)
 {
-    if (ble_running())
-        return DEVICE_NOT_SUPPORTED;
+    int access = hardwareAccess();
+
+    if (access == DEVICE_NOT_SUPPORTED)
+        return access;
 
     if (band < 0 || band > 100)
         return DEVICE_INVALID_PARAMETER;
@@ -159,31 +415,401 @@ int MicroBitRadio::setFrequencyBand(int band)
     // Record our frequency band locally
     this->band = band;
 
-    if ( NRF_RADIO->FREQUENCY != (uint32_t) band && (status & MICROBIT_RADIO_STATUS_INITIALISED))
+    if (access != DEVICE_OK)
+        requestReconfigure();
+
+    // Whilst hopping, the schedule decides which band to use.
+    else if (!hopping.isEnabled() && NRF_RADIO->FREQUENCY != (uint32_t) band && (status & MICROBIT_RADIO_STATUS_INITIALISED))
+        tune(band);
+
+    return DEVICE_OK;
+}
+
+/**
+  * Determines how the RADIO hardware may be used.
+  *
+  * @return DEVICE_OK if we may use the hardware freely, DEVICE_BUSY if it is shared with the BLE stack and
+  *         may only be used within timeslots, or DEVICE_NOT_SUPPORTED if the BLE stack is running and the
+  *         hardware cannot be shared.
+  */
+int MicroBitRadio::hardwareAccess()
+{
+    if (!ble_running())
+        return DEVICE_OK;
+
+#if MICROBIT_RADIO_TIMESLOT_SUPPORTED
+    return DEVICE_BUSY;
+#else
+    return DEVICE_NOT_SUPPORTED;
+#endif
+}
+
+/**
+  * Asks for any change in settings to be applied to the hardware at the next opportunity within a timeslot.
+  */
+void MicroBitRadio::requestReconfigure()
+{
+    reconfigure = true;
+
+    // Whilst a timeslot is in progress, the SoftDevice passes the RADIO interrupt on to our signal handler.
+    if (inTimeslot)
+        NVIC_SetPendingIRQ(RADIO_IRQn);
+}
+
+/**
+  * Change the data rate at which frames are sent and received. All members of a group must use the same data rate.
+  *
+  * Higher data rates reduce airtime, and so collisions and energy use, whereas the long range rates greatly extend
+  * the distance over which frames can be received.
+  *
+  * @param rate One of MICROBIT_RADIO_DATA_RATE_1MBIT (the default), MICROBIT_RADIO_DATA_RATE_2MBIT,
+  *             MICROBIT_RADIO_DATA_RATE_LR_500KBIT or MICROBIT_RADIO_DATA_RATE_LR_125KBIT.
+  *
+  * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the value is out of range,
+  *         or DEVICE_NOT_SUPPORTED if the BLE stack is running and the RADIO cannot be shared.
+  */
+int MicroBitRadio::setDataRate(int rate)
+{
+    int access = hardwareAccess();
+
+    if (access == DEVICE_NOT_SUPPORTED)
+        return access;
+
+    if (rate < MICROBIT_RADIO_DATA_RATE_1MBIT || rate > MICROBIT_RADIO_DATA_RATE_LR_125KBIT)
+        return DEVICE_INVALID_PARAMETER;
+
+    this->rate = rate;
+
+    if (access != DEVICE_OK)
+        requestReconfigure();
+
+    // The RADIO must be restarted for the change to take effect.
+    else if (status & MICROBIT_RADIO_STATUS_INITIALISED)
+        tune(channel);
+
+    return DEVICE_OK;
+}
+
+/**
+  * Determines the data rate at which frames are sent and received.
+  *
+  * @return One of MICROBIT_RADIO_DATA_RATE_*.
+  */
+int MicroBitRadio::getDataRate()
+{
+    return rate;
+}
+
+/**
+  * Calculates the time taken to transmit a frame at the current data rate.
+  *
+  * @param length The length field of the frame.
+  *
+  * @return The airtime of the frame, in microseconds.
+  */
+uint32_t MicroBitRadio::getAirtime(uint8_t length)
+{
+    return microbit_radio_airtime(rate, length);
+}
+
+/**
+  * Restarts the radio on the given frequency band.
+  *
+  * @param channel The frequency band to use.
+  */
+void MicroBitRadio::tune(uint8_t channel)
+{
+    this->channel = channel;
+
+    // We need to restart the radio for the frequency change to take effect
+    NVIC_DisableIRQ(RADIO_IRQn);
+    NRF_RADIO->EVENTS_DISABLED = 0;
+    NRF_RADIO->TASKS_DISABLE = 1;
+    while (NRF_RADIO->EVENTS_DISABLED == 0);
+
+    NRF_RADIO->FREQUENCY = (uint32_t) channel;
+    microbit_radio_set_data_rate(rate, MICROBIT_RADIO_MAX_PACKET_SIZE);
+
+    // Reenable the radio to wait for the next packet
+    NRF_RADIO->EVENTS_READY = 0;
+    NRF_RADIO->TASKS_RXEN = 1;
+    while (NRF_RADIO->EVENTS_READY == 0);
+
+    NRF_RADIO->EVENTS_END = 0;
+    NRF_RADIO->TASKS_START = 1;
+
+    NVIC_ClearPendingIRQ(RADIO_IRQn);
+    NVIC_EnableIRQ(RADIO_IRQn);
+}
+
+/**
+  * Configures the radio to hop between several frequency bands, rather than using a single band.
+  *
+  * Time is divided into slots, and all members of a group visit the given channels in the same pseudo random order,
+  * one per slot. Receivers align their slots to the transmissions they hear. Reception statistics are kept
+  * for each channel (see hopping), but every channel stays in the schedule, as the group has no means to agree on which to drop.
+  *
+  * @param channels The frequency bands to hop between, each in the range 0 - 100, or NULL to disable hopping.
+  *
+  * @param count The number of channels, up to MICROBIT_RADIO_HOPPING_MAX_CHANNELS.
+  *
+  * @param dwell The length of each slot, in milliseconds.
+  *
+  * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the parameters are out of range,
+  *         or DEVICE_NOT_SUPPORTED if the BLE stack is running.
+  */
+int MicroBitRadio::setHopping(const uint8_t *channels, int count, uint32_t dwell)
+{
+    if (ble_running())
+        return DEVICE_NOT_SUPPORTED;
+
+    if (dwell * 1000 <= 2 * MICROBIT_RADIO_HOPPING_GUARD_US)
+        return DEVICE_INVALID_PARAMETER;
+
+    int result = hopping.setChannels(channels, count, group);
+
+    if (result != DEVICE_OK)
+        return result;
+
+    system_timer_cancel_event(MICROBIT_ID_RADIO_INTERNAL, MICROBIT_RADIO_EVT_HOP);
+
+    if (!hopping.isEnabled())
     {
-        // We need to restart the radio for the frequency change to take effect
-        NVIC_DisableIRQ(RADIO_IRQn);
-        NRF_RADIO->EVENTS_DISABLED = 0;
-        NRF_RADIO->TASKS_DISABLE = 1;
-        while (NRF_RADIO->EVENTS_DISABLED == 0);
+        // Return to our fixed band.
+        if (channel != band && (status & MICROBIT_RADIO_STATUS_INITIALISED))
+            tune(band);
 
-        NRF_RADIO->FREQUENCY = (uint32_t) band;
+        return DEVICE_OK;
+    }
 
-        // Reenable the radio to wait for the next packet
-        NRF_RADIO->EVENTS_READY = 0;
-        NRF_RADIO->TASKS_RXEN = 1;
-        while (NRF_RADIO->EVENTS_READY == 0);
+    if (EventModel::defaultEventBus && !(status & MICROBIT_RADIO_STATUS_HOP_LISTENER))
+    {
+        EventModel::defaultEventBus->listen(MICROBIT_ID_RADIO_INTERNAL, MICROBIT_RADIO_EVT_HOP, this, &MicroBitRadio::onHop, MESSAGE_BUS_LISTENER_IMMEDIATE);
+        status |= MICROBIT_RADIO_STATUS_HOP_LISTENER;
+    }
 
-        NRF_RADIO->EVENTS_END = 0;
-        NRF_RADIO->TASKS_START = 1;
+    // Start out searching for the schedule of our group.
+    CODAL_TIMESTAMP now = system_timer_current_time_us();
+    hopDwell = dwell * 1000;
+    hopOrigin = now;
+    hopActive = now - (CODAL_TIMESTAMP)MICROBIT_RADIO_HOPPING_SYNC_TIMEOUT_MS * 1000;
 
-        NVIC_ClearPendingIRQ(RADIO_IRQn);
-        NVIC_EnableIRQ(RADIO_IRQn);
+    if (status & MICROBIT_RADIO_STATUS_INITIALISED)
+    {
+        tune(getHopChannel(now));
+        scheduleHop();
+    }
+
+    return DEVICE_OK;
+}
+
+/**
+  * Starts capturing every frame heard on the current channel from the given groups, or from every group in turn,
+  * in addition to our own. Frames are timestamped as they are received and recorded into capture, from which they
+  * may be exported in bulk using capture.exportTo(). Frames sent to our own group continue to be processed as normal.
+  *
+  * The RADIO can listen to eight groups at once. When capturing from every group, it moves on to the next seven
+  * every MICROBIT_RADIO_CAPTURE_SCAN_DWELL_MS.
+  *
+  * @param groups The groups to capture, or NULL to capture every group in turn.
+  *
+  * @param count The number of groups, up to MICROBIT_RADIO_CAPTURE_MAX_GROUPS.
+  *
+  * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the parameters are out of range,
+  *         DEVICE_NO_RESOURCES if there is insufficient memory, or DEVICE_NOT_SUPPORTED if the BLE stack
+  *         is running and the RADIO cannot be shared.
+  */
+int MicroBitRadio::startCapture(const uint8_t *groups, int count)
+{
+    int access = hardwareAccess();
+
+    if (access == DEVICE_NOT_SUPPORTED)
+        return access;
+
+    int result = capture.start(groups, count, group);
+
+    if (result != DEVICE_OK)
+        return result;
+
+    system_timer_cancel_event(MICROBIT_ID_RADIO_INTERNAL, MICROBIT_RADIO_EVT_CAPTURE_SCAN);
+
+    if (capture.isScanning())
+    {
+        if (EventModel::defaultEventBus && !(status & MICROBIT_RADIO_STATUS_CAPTURE_LISTENER))
+        {
+            EventModel::defaultEventBus->listen(MICROBIT_ID_RADIO_INTERNAL, MICROBIT_RADIO_EVT_CAPTURE_SCAN, this, &MicroBitRadio::onCaptureScan, MESSAGE_BUS_LISTENER_IMMEDIATE);
+            status |= MICROBIT_RADIO_STATUS_CAPTURE_LISTENER;
+        }
+
+        system_timer_event_after(MICROBIT_RADIO_CAPTURE_SCAN_DWELL_MS, MICROBIT_ID_RADIO_INTERNAL, MICROBIT_RADIO_EVT_CAPTURE_SCAN);
     }
 
+    // Capture is only useful with the radio listening, so bring it up if need be.
+    if (!(status & MICROBIT_RADIO_STATUS_INITIALISED))
+        return enable();
+
+    if (access == DEVICE_OK)
+        setAddresses();
+    else
+        requestReconfigure();
+
+    return DEVICE_OK;
+}
+
+/**
+  * Stops capturing frames from other groups. Frames already captured may still be exported.
+  *
+  * @return DEVICE_OK on success, or DEVICE_NOT_SUPPORTED if the BLE stack is running and the RADIO cannot be shared.
+  */
+int MicroBitRadio::stopCapture()
+{
+    int access = hardwareAccess();
+
+    if (access == DEVICE_NOT_SUPPORTED)
+        return access;
+
+    system_timer_cancel_event(MICROBIT_ID_RADIO_INTERNAL, MICROBIT_RADIO_EVT_CAPTURE_SCAN);
+    capture.stop();
+
+    if (!(status & MICROBIT_RADIO_STATUS_INITIALISED))
+        return DEVICE_OK;
+
+    if (access == DEVICE_OK)
+        setAddresses();
+    else
+        requestReconfigure();
+
     return DEVICE_OK;
 }
 
+/**
+  * Event handler, called periodically whilst capturing from every group, to move on to the next set of groups.
+  */
+void MicroBitRadio::onCaptureScan(Event)
+{
+    if (!capture.isScanning())
+        return;
+
+    capture.nextWindow();
+
+    if (status & MICROBIT_RADIO_STATUS_INITIALISED)
+    {
+        if (hardwareAccess() == DEVICE_OK)
+            setAddresses();
+        else
+            requestReconfigure();
+    }
+
+    system_timer_event_after(MICROBIT_RADIO_CAPTURE_SCAN_DWELL_MS, MICROBIT_ID_RADIO_INTERNAL, MICROBIT_RADIO_EVT_CAPTURE_SCAN);
+}
+
+/**
+  * Determines the frequency band currently in use.
+  *
+  * @return The band set by setFrequencyBand(), or if hopping, the band of the current slot.
+  */
+int MicroBitRadio::getChannel()
+{
+    return channel;
+}
+
+/**
+  * Determines the frequency band to use at the given time, according to the hopping schedule.
+  *
+  * @param t The time, in local microseconds.
+  *
+  * @return The frequency band to use.
+  */
+uint8_t MicroBitRadio::getHopChannel(CODAL_TIMESTAMP t)
+{
+    uint32_t slot = (t - hopOrigin) / hopDwell;
+
+    if (t - hopActive < (CODAL_TIMESTAMP)MICROBIT_RADIO_HOPPING_SYNC_TIMEOUT_MS * 1000)
+        return hopping.getChannel(slot);
+
+    // We've lost the schedule. Dwell on each channel for a little over a full pass, so that anyone transmitting
+    // within range will visit it whilst we are listening.
+    return hopping.getChannel(slot / (hopping.getChannelCount() + 1));
+}
+
+/**
+  * Schedules the end of the current hopping slot.
+  */
+void MicroBitRadio::scheduleHop()
+{
+    CODAL_TIMESTAMP now = system_timer_current_time_us();
+    CODAL_TIMESTAMP elapsed = (now - hopOrigin) % hopDwell;
+
+    system_timer_cancel_event(MICROBIT_ID_RADIO_INTERNAL, MICROBIT_RADIO_EVT_HOP);
+    system_timer_event_after_us(hopDwell - elapsed, MICROBIT_ID_RADIO_INTERNAL, MICROBIT_RADIO_EVT_HOP);
+}
+
+/**
+  * Event handler, called at the end of each hopping slot to retune the radio.
+  */
+void MicroBitRadio::onHop(Event)
+{
+    if (!hopping.isEnabled() || !(status & MICROBIT_RADIO_STATUS_INITIALISED))
+        return;
+
+    // A transmission is in progress. Let it finish, it will have been started well clear of the slot boundary.
+    if (!NVIC_GetEnableIRQ(RADIO_IRQn))
+    {
+        system_timer_event_after_us(MICROBIT_RADIO_HOPPING_GUARD_US / 4, MICROBIT_ID_RADIO_INTERNAL, MICROBIT_RADIO_EVT_HOP);
+        return;
+    }
+
+    CODAL_TIMESTAMP now = system_timer_current_time_us();
+
+    // Channels are never blacklisted here. Each receiver would judge them on what it alone hears, and the group would
+    // soon disagree on the schedule. MicroBitRadio has no way to share a blacklist, so only the statistics are kept.
+    uint8_t c = getHopChannel(now);
+
+    if (c != channel)
+        tune(c);
+
+    scheduleHop();
+}
+
+/**
+  * Records the reception of a frame, and if we are not yet following the hopping schedule of our group,
+  * adopts that of the sender.
+  *
+  * @param valid true if the frame passed its CRC check, false otherwise.
+  *
+  * @note should only be called from RADIO_IRQHandler...
+  */
+void MicroBitRadio::setHopTiming(bool valid)
+{
+    if (!hopping.isEnabled())
+        return;
+
+    hopping.recordReceive(channel, valid);
+
+    if (!valid)
+        return;
+
+    CODAL_TIMESTAMP now = system_timer_current_time_us();
+
+    if (now - hopActive >= (CODAL_TIMESTAMP)MICROBIT_RADIO_HOPPING_SYNC_TIMEOUT_MS * 1000)
+    {
+        int position = hopping.getPosition(channel);
+
+        // The sender is somewhere within its slot for this channel. Assume the middle, which is within half a slot of
+        // the truth, and as transmissions avoid the ends of slots, is good enough to keep hearing it.
+        if (position >= 0)
+        {
+            hopOrigin = now - ((CODAL_TIMESTAMP)position * hopDwell + hopDwell / 2);
+            hopActive = now;
+            scheduleHop();
+        }
+
+        return;
+    }
+
+    hopActive = now;
+}
+
 /**
   * Retrieve a pointer to the currently allocated receive buffer. This is the area of memory
   * actively being used by the radio hardware to store incoming data.
@@ -192,55 +818,64 @@ int MicroBitRadio::setFrequencyBand(int band)
   */
 FrameBuffer* MicroBitRadio::getRxBuf()
 {
-    return rxBuf;
+    if (rxRing == NULL)
+        return NULL;
+
+    return &rxRing[rxHead];
 }
 
 /**
   * Attempt to queue a buffer received by the radio hardware, if sufficient space is available.
+  * The radio hardware should then be pointed at the buffer given by getRxBuf().
   *
-  * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if a replacement receiver buffer
-  *         could not be allocated (either by policy or memory exhaustion).
+  * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if the receive queue is full,
+  *         in which case the current receive buffer will be reused.
+  *
+  * @note should only be called from RADIO_IRQHandler...
   */
 int MicroBitRadio::queueRxBuf()
 {
-    if (rxBuf == NULL)
+    if (rxRing == NULL)
         return DEVICE_INVALID_PARAMETER;
 
-    if (queueDepth >= MICROBIT_RADIO_MAXIMUM_RX_BUFFERS)
-        return DEVICE_NO_RESOURCES;
+    uint8_t next = (rxHead + 1) % MICROBIT_RADIO_RX_RING_SIZE;
 
-    // Store the received RSSI value in the frame
-    rxBuf->rssi = getRSSI();
+    if (next == rxTail)
+    {
+        stats.rxOverflows++;
+        return DEVICE_NO_RESOURCES;
+    }
 
-    // Ensure that a replacement buffer is available before queuing.
-    FrameBuffer *newRxBuf = new FrameBuffer();
+    // Store the received RSSI value and timestamp in the frame
+    rxRing[rxHead].rssi = getRSSI();
+    rxRing[rxHead].timestamp = stats.lastRxTime;
 
-    if (newRxBuf == NULL)
-        return DEVICE_NO_RESOURCES;
+    // Publish the slot only once it is complete. We are the only writer of rxHead, and recv() the only writer of rxTail,
+    // so no locking is required.
+    __DMB();
+    rxHead = next;
 
-    // We add to the tail of the queue to preserve causal ordering.
-    rxBuf->next = NULL;
+    return DEVICE_OK;
+}
 
-    if (rxQueue == NULL)
+/**
+  * Records the reception of a frame in the link statistics, along with the time at which it was received.
+  *
+  * @param valid true if the frame passed its CRC check, false otherwise.
+  *
+  * @note should only be called from RADIO_IRQHandler...
+  */
+void MicroBitRadio::recordReceive(bool valid)
+{
+    if (valid)
     {
-        rxQueue = rxBuf;
+        stats.rxFrames++;
+        stats.lastRxTime = system_timer_current_time_us();
     }
     else
     {
-        FrameBuffer *p = rxQueue;
-        while (p->next != NULL)
-            p = p->next;
-
-        p->next = rxBuf;
+        stats.rxCrcErrors++;
     }
-
-    // Increase our received packet count
-    queueDepth++;
-
-    // Allocate a new buffer for the receiver hardware to use. the old on will be passed on to higher layer protocols/apps.
-    rxBuf = newRxBuf;
-
-    return DEVICE_OK;
 }
 
 /**
@@ -278,40 +913,55 @@ int MicroBitRadio::getRSSI()
 }
 
 /**
-  * Initialises the radio for use as a multipoint sender/receiver
+  * Retrieves the link statistics gathered since the radio was enabled, or since they were last reset.
   *
-  * @return DEVICE_OK on success, DEVICE_NOT_SUPPORTED if the BLE stack is running.
+  * @param stats The structure to fill in.
+  *
+  * @return DEVICE_OK on success.
   */
-int MicroBitRadio::enable()
+int MicroBitRadio::getStats(RadioLinkStats &stats)
 {
-    // If the device is already initialised, then there's nothing to do.
-    if (status & MICROBIT_RADIO_STATUS_INITIALISED)
-        return DEVICE_OK;
-
-    // Only attempt to enable this radio mode if BLE is disabled.
-    if (ble_running())
-        return DEVICE_NOT_SUPPORTED;
+    // The counters are updated from interrupt context, so take a consistent snapshot.
+    target_disable_irq();
+    stats = this->stats;
+    target_enable_irq();
 
-    // If this is the first time we've been enable, allocate out receive buffers.
-    if (rxBuf == NULL)
-        rxBuf = new FrameBuffer();
+    return DEVICE_OK;
+}
 
-    if (rxBuf == NULL)
-        return DEVICE_NO_RESOURCES;
+/**
+  * Resets all link statistics to zero.
+  */
+void MicroBitRadio::resetStats()
+{
+    target_disable_irq();
+    memset(&stats, 0, sizeof(stats));
+    target_enable_irq();
+}
 
-    // Enable the High Frequency clock on the processor. This is a pre-requisite for
-    // the RADIO module. Without this clock, no communication is possible.
-    NRF_CLOCK->EVENTS_HFCLKSTARTED = 0;
-    NRF_CLOCK->TASKS_HFCLKSTART = 1;
-    while (NRF_CLOCK->EVENTS_HFCLKSTARTED == 0);
+/**
+  * Programs the address matching of the RADIO hardware, for our group and any groups being captured.
+  */
+void MicroBitRadio::setAddresses()
+{
+    // Logical address 0 is always our own group. Whilst capturing, the remaining addresses share our base address,
+    // each with the prefix of another group.
+    NRF_RADIO->BASE1 = MICROBIT_RADIO_BASE_ADDRESS;
+    NRF_RADIO->PREFIX0 = capture.isEnabled() ? capture.getPrefix(0) : (uint32_t)this->group;
+    NRF_RADIO->PREFIX1 = capture.isEnabled() ? capture.getPrefix(1) : 0;
+    NRF_RADIO->RXADDRESSES = capture.isEnabled() ? capture.getAddressMask() : 1;
+}
 
+/**
+  * Programs the RADIO hardware with our current settings, and starts reception.
+  * The RADIO must be disabled, and its interrupt not yet enabled.
+  */
+void MicroBitRadio::configure()
+{
     // Bring up the nrf RADIO module in Nordic's proprietary 1MBps packet radio mode.
     NRF_RADIO->TXPOWER = (uint32_t)MICROBIT_RADIO_POWER_LEVEL[this->power];
-    NRF_RADIO->FREQUENCY = (uint32_t)this->band;
-
-    // Configure for 1Mbps throughput.
-    // This may sound excessive, but running a high data rates reduces the chances of collisions...
-    NRF_RADIO->MODE = RADIO_MODE_MODE_Nrf_1Mbit;
+    this->channel = (hopping.isEnabled() && !(status & MICROBIT_RADIO_STATUS_TIMESLOT)) ? getHopChannel(system_timer_current_time_us()) : this->band;
+    NRF_RADIO->FREQUENCY = (uint32_t)this->channel;
 
     // Configure the addresses we use for this protocol. We run ANONYMOUSLY at the core.
     // A 40 bit addresses is used. The first 32 bits match the ASCII character code for "uBit".
@@ -320,19 +970,16 @@ int MicroBitRadio::enable()
     // address matching for us, and only generate an interrupt when a packet matching our group is received.
     NRF_RADIO->BASE0 = MICROBIT_RADIO_BASE_ADDRESS;
 
-    // Join the default group. This will configure the remaining byte in the RADIO hardware module.
-    setGroup(this->group);
+    // Join our group. This will configure the remaining byte in the RADIO hardware module.
+    setAddresses();
 
     // The RADIO hardware module supports the use of multiple addresses, but as we're running anonymously, we only need one.
     // Configure the RADIO module to use the default address (address 0) for both send and receive operations.
     NRF_RADIO->TXADDRESS = 0;
-    NRF_RADIO->RXADDRESSES = 1;
 
-    // Packet layout configuration. The nrf51822 has a highly capable and flexible RADIO module that, in addition to transmission
-    // and reception of data, also contains a LENGTH field, two optional additional 1 byte fields (S0 and S1) and a CRC calculation.
-    // Configure the packet format for a simple 8 bit length field and no additional fields.
-    NRF_RADIO->PCNF0 = 0x00000008;
-    NRF_RADIO->PCNF1 = 0x02040000 | MICROBIT_RADIO_MAX_PACKET_SIZE;
+    // Configure the modulation and packet format for our data rate. By default this is 1Mbps, which may sound excessive,
+    // but running a high data rates reduces the chances of collisions...
+    microbit_radio_set_data_rate(this->rate, MICROBIT_RADIO_MAX_PACKET_SIZE);
 
     // Most communication channels contain some form of checksum - a mathematical calculation taken based on all the data
     // in a packet, that is also sent as part of the packet. When received, this calculation can be repeated, and the results
@@ -348,7 +995,7 @@ int MicroBitRadio::enable()
     NRF_RADIO->DATAWHITEIV = 0x18;
 
     // Set up the RADIO module to read and write from our internal buffer.
-    NRF_RADIO->PACKETPTR = (uint32_t)rxBuf;
+    NRF_RADIO->PACKETPTR = (uint32_t) &getRxBuf()->length;
 
     // Configure the hardware to issue an interrupt whenever a task is complete (e.g. send/receive).
     NRF_RADIO->INTENSET = 0x00000008;
@@ -364,6 +1011,65 @@ int MicroBitRadio::enable()
 
     NRF_RADIO->EVENTS_END = 0;
     NRF_RADIO->TASKS_START = 1;
+}
+
+/**
+  * Initialises the radio for use as a multipoint sender/receiver.
+  *
+  * If the BLE stack is running, the RADIO hardware is shared with it using the SoftDevice timeslot API.
+  *
+  * @return DEVICE_OK on success, DEVICE_NOT_SUPPORTED if the BLE stack is running and the RADIO cannot be shared.
+  */
+int MicroBitRadio::enable()
+{
+    // If the device is already initialised, then there's nothing to do.
+    if (status & MICROBIT_RADIO_STATUS_INITIALISED)
+        return DEVICE_OK;
+
+    // If BLE is running, we can only share the RADIO with it.
+    int access = hardwareAccess();
+
+    if (access == DEVICE_NOT_SUPPORTED)
+        return access;
+
+    // If this is the first time we've been enable, allocate out receive buffers.
+    if (rxRing == NULL)
+        rxRing = new FrameBuffer[MICROBIT_RADIO_RX_RING_SIZE];
+
+    if (rxRing == NULL)
+        return DEVICE_NO_RESOURCES;
+
+#if MICROBIT_RADIO_TIMESLOT_SUPPORTED
+    if (access == DEVICE_BUSY)
+    {
+        // The SoftDevice owns the RADIO, and will lend it to us between BLE events. The hardware is configured
+        // afresh at the start of each timeslot, and the high frequency clock is started for us.
+        if (sd_radio_session_open(timeslot_signal_handler) != NRF_SUCCESS)
+            return DEVICE_NOT_SUPPORTED;
+
+        status |= MICROBIT_RADIO_STATUS_TIMESLOT;
+
+        if (sd_radio_request(timeslot_request_earliest()) != NRF_SUCCESS)
+        {
+            status &= ~MICROBIT_RADIO_STATUS_TIMESLOT;
+            sd_radio_session_close();
+            return DEVICE_NOT_SUPPORTED;
+        }
+
+        status |= DEVICE_COMPONENT_STATUS_IDLE_TICK;
+        status |= MICROBIT_RADIO_STATUS_INITIALISED;
+
+        return DEVICE_OK;
+    }
+#endif
+
+    // Enable the High Frequency clock on the processor. This is a pre-requisite for
+    // the RADIO module. Without this clock, no communication is possible.
+    NRF_CLOCK->EVENTS_HFCLKSTARTED = 0;
+    NRF_CLOCK->TASKS_HFCLKSTART = 1;
+    while (NRF_CLOCK->EVENTS_HFCLKSTARTED == 0);
+
+    configure();
 
     // register ourselves for a callback event, in order to empty the receive queue.
     status |= DEVICE_COMPONENT_STATUS_IDLE_TICK;
@@ -371,23 +1077,49 @@ int MicroBitRadio::enable()
     // Done. Record that our RADIO is configured.
     status |= MICROBIT_RADIO_STATUS_INITIALISED;
 
+    // The receiver stays powered up whenever we own the RADIO. When sharing it with BLE, this is only during timeslots.
+    MICROBIT_ENERGY_STATE(MICROBIT_ENERGY_RADIO, true);
+
+    if (hopping.isEnabled())
+        scheduleHop();
+
     return DEVICE_OK;
 }
 
 /**
   * Disables the radio for use as a multipoint sender/receiver.
   *
-  * @return DEVICE_OK on success, DEVICE_NOT_SUPPORTED if the BLE stack is running.
+  * @return DEVICE_OK on success, DEVICE_NOT_SUPPORTED if the BLE stack is running and the RADIO cannot be shared.
   */
 int MicroBitRadio::disable()
 {
     // Only attempt to enable.disable the radio if the protocol is alreayd running.
-    if (ble_running())
+    if (hardwareAccess() == DEVICE_NOT_SUPPORTED)
         return DEVICE_NOT_SUPPORTED;
 
     if (!(status & MICROBIT_RADIO_STATUS_INITIALISED))
         return DEVICE_OK;
 
+    MICROBIT_ENERGY_STATE(MICROBIT_ENERGY_RADIO, false);
+
+#if MICROBIT_RADIO_TIMESLOT_SUPPORTED
+    if (status & MICROBIT_RADIO_STATUS_TIMESLOT)
+    {
+        // Closing the session ends any timeslot in progress, and the SoftDevice takes back the RADIO.
+        status &= ~MICROBIT_RADIO_STATUS_TIMESLOT;
+        sd_radio_session_close();
+
+        inTimeslot = false;
+        txPending = NULL;
+        Event(MICROBIT_ID_RADIO_INTERNAL, MICROBIT_RADIO_EVT_TX_DONE);
+
+        status &= ~DEVICE_COMPONENT_STATUS_IDLE_TICK;
+        status &= ~MICROBIT_RADIO_STATUS_INITIALISED;
+
+        return DEVICE_OK;
+    }
+#endif
+
     // Disable interrupts and STOP any ongoing packet reception.
     NVIC_DisableIRQ(RADIO_IRQn);
 
@@ -395,6 +1127,8 @@ int MicroBitRadio::disable()
     NRF_RADIO->TASKS_DISABLE = 1;
     while(NRF_RADIO->EVENTS_DISABLED == 0);
 
+    system_timer_cancel_event(MICROBIT_ID_RADIO_INTERNAL, MICROBIT_RADIO_EVT_HOP);
+
     // deregister ourselves from the callback event used to empty the receive queue.
     status &= ~DEVICE_COMPONENT_STATUS_IDLE_TICK;
 
@@ -409,18 +1143,31 @@ int MicroBitRadio::disable()
   *
   * @param group The group to join. A micro:bit can only listen to one group ID at any time.
   *
-  * @return DEVICE_OK on success, or DEVICE_NOT_SUPPORTED if the BLE stack is running.
+  * @return DEVICE_OK on success, or DEVICE_NOT_SUPPORTED if the BLE stack is running and the RADIO cannot be shared.
   */
 int MicroBitRadio::setGroup(uint8_t group)
 {
-    if (ble_running())
-        return DEVICE_NOT_SUPPORTED;
+    int access = hardwareAccess();
+
+    if (access == DEVICE_NOT_SUPPORTED)
+        return access;
+
+    // Each group follows its own hopping order.
+    if (group != this->group)
+    {
+        hopping.setGroup(group);
+        capture.setGroup(group);
+        powerControl.reset();
+    }
 
     // Record our group id locally
     this->group = group;
 
     // Also append it to the address of this device, to allow the RADIO module to filter for us.
-    NRF_RADIO->PREFIX0 = (uint32_t)group;
+    if (access == DEVICE_OK)
+        setAddresses();
+    else
+        requestReconfigure();
 
     return DEVICE_OK;
 }
@@ -431,10 +1178,19 @@ int MicroBitRadio::setGroup(uint8_t group)
   */
 void MicroBitRadio::idleCallback()
 {
+    MICROBIT_TRACE_IDLE(CodalComponent::id);
+
+    FrameBuffer *p;
+
     // Walk the list of packets and process each one.
-    while(rxQueue)
+    while((p = peek()) != NULL)
     {
-        FrameBuffer *p = rxQueue;
+        if (bridge)
+        {
+            bridge->forward(p);
+            release();
+            continue;
+        }
 
         switch (p->protocol)
         {
@@ -446,20 +1202,37 @@ void MicroBitRadio::idleCallback()
                 event.packetReceived();
                 break;
 
+            case MICROBIT_RADIO_PROTOCOL_EVENTBUS_BATCH:
+                event.batchReceived();
+                break;
+
+            case MICROBIT_RADIO_PROTOCOL_DATAGRAM_ARQ:
+                datagram.reliableReceived();
+                break;
+
             default:
                 Event(DEVICE_ID_RADIO_DATA_READY, p->protocol);
         }
 
-        // If the packet was processed, it will have been recv'd, and taken from the queue.
-        // If this was a packet for an unknown protocol, it will still be there, so simply free it.
-        if (p == rxQueue)
-        {
-            recv();
-            delete p;
-        }
+        // If the packet was processed, it will have been recv'd or released, and taken from the queue.
+        // If this was a packet for an unknown protocol, it will still be there, so simply release it.
+        if (peek() == p)
+            release();
     }
 }
 
+/**
+  * Hands every frame received to the given bridge, in place of the protocol handlers, or stops doing so.
+  *
+  * @param bridge The bridge to forward frames to, or NULL to deliver them as normal.
+  *
+  * @note called by MicroBitRadioBridge::start() and MicroBitRadioBridge::stop().
+  */
+void MicroBitRadio::setBridge(MicroBitRadioBridge *bridge)
+{
+    this->bridge = bridge;
+}
+
 /**
   * Determines the number of packets ready to be processed.
   *
@@ -467,7 +1240,7 @@ void MicroBitRadio::idleCallback()
   */
 int MicroBitRadio::dataReady()
 {
-    return queueDepth;
+    return (rxHead + MICROBIT_RADIO_RX_RING_SIZE - rxTail) % MICROBIT_RADIO_RX_RING_SIZE;
 }
 
 /**
@@ -482,52 +1255,87 @@ int MicroBitRadio::dataReady()
   */
 FrameBuffer* MicroBitRadio::recv()
 {
-    FrameBuffer *p = rxQueue;
+    FrameBuffer *p = peek();
 
-    if (p)
-    {
-         // Protect shared resource from ISR activity
-        NVIC_DisableIRQ(RADIO_IRQn);
+    if (p == NULL)
+        return NULL;
 
-        rxQueue = rxQueue->next;
-        queueDepth--;
+    // Hand the caller a copy of their own, trimmed to its length, so the slot can be reused straight away.
+    FrameBuffer *copy = MicroBitRadioFramePool::clone(p);
 
-        // Allow ISR access to shared resource
-        NVIC_EnableIRQ(RADIO_IRQn);
-    }
+    release();
 
-    return p;
+    return copy;
 }
 
 /**
-  * Transmits the given buffer onto the broadcast radio.
-  * The call will wait until the transmission of the packet has completed before returning.
+  * Retrieves the next packet from the receive buffer, without copying or dequeuing it.
   *
-  * @param data The packet contents to transmit.
+  * The buffer returned remains owned by the radio, and is valid only until release() is called.
+  * This avoids any memory allocation, and may be used in place of recv() by protocol handlers.
   *
-  * @return DEVICE_OK on success, or DEVICE_NOT_SUPPORTED if the BLE stack is running.
+  * @return The buffer containing the packet. If no data is available, NULL is returned.
   */
-int MicroBitRadio::send(FrameBuffer *buffer)
+FrameBuffer* MicroBitRadio::peek()
 {
-    if (ble_running())
-        return DEVICE_NOT_SUPPORTED;
+    while (rxRing != NULL && rxTail != rxHead)
+    {
+        FrameBuffer *p = &rxRing[rxTail];
 
-    if (buffer == NULL)
-        return DEVICE_INVALID_PARAMETER;
+        if (p->version != MICROBIT_RADIO_VERSION_SECURE)
+            return p;
 
-    if (buffer->length > MICROBIT_RADIO_MAX_PACKET_SIZE + MICROBIT_RADIO_HEADER_SIZE - 1)
-        return DEVICE_INVALID_PARAMETER;
+        // Sealed frames are opened in place the first time they are looked at, or discarded if they fail.
+        int len = cipher.open(group, p->protocol, 0, p->payload, p->length - (MICROBIT_RADIO_HEADER_SIZE - 1), 0);
 
-    // Firstly, disable the Radio interrupt. We want to wait until the trasmission completes.
-    NVIC_DisableIRQ(RADIO_IRQn);
+        if (len >= 0)
+        {
+            p->length = len + MICROBIT_RADIO_HEADER_SIZE - 1;
+            p->version = 1;
+            return p;
+        }
+
+        release();
+    }
+
+    return NULL;
+}
+
+/**
+  * Returns the buffer lent out by peek() to the radio, making it available for reception.
+  * Does nothing if no data is available.
+  */
+void MicroBitRadio::release()
+{
+    if (rxRing == NULL || rxTail == rxHead)
+        return;
 
+    // Ensure we're done with the slot before the ISR may reuse it.
+    __DMB();
+    rxTail = (rxTail + 1) % MICROBIT_RADIO_RX_RING_SIZE;
+}
+
+/**
+  * Transmits the given frame, waiting for the transmission to complete, and then resumes reception.
+  * The RADIO interrupt must be disabled, or the caller running at a higher priority.
+  *
+  * @param buffer The frame to transmit.
+  */
+void MicroBitRadio::transmit(FrameBuffer *buffer)
+{
     // Turn off the transceiver.
     NRF_RADIO->EVENTS_DISABLED = 0;
     NRF_RADIO->TASKS_DISABLE = 1;
     while(NRF_RADIO->EVENTS_DISABLED == 0);
 
     // Configure the radio to send the buffer provided.
-    NRF_RADIO->PACKETPTR = (uint32_t) buffer;
+    NRF_RADIO->PACKETPTR = (uint32_t) &buffer->length;
+
+    if (hopping.isEnabled() && !(status & MICROBIT_RADIO_STATUS_TIMESLOT))
+    {
+        channel = getHopChannel(hopActive);
+        NRF_RADIO->FREQUENCY = (uint32_t) channel;
+    }
 
     // Turn on the transmitter, and wait for it to signal that it's ready to use.
     NRF_RADIO->EVENTS_READY = 0;
@@ -539,8 +1347,11 @@ int MicroBitRadio::send(FrameBuffer *buffer)
     NRF_RADIO->EVENTS_END = 0;
     while(NRF_RADIO->EVENTS_END == 0);
 
+    stats.txFrames++;
+    stats.airtime += getAirtime(buffer->length);
+
     // Return the radio to using the default receive buffer
-    NRF_RADIO->PACKETPTR = (uint32_t) rxBuf;
+    NRF_RADIO->PACKETPTR = (uint32_t) &getRxBuf()->length;
 
     // Turn off the transmitter.
     NRF_RADIO->EVENTS_DISABLED = 0;
@@ -554,6 +1365,212 @@ int MicroBitRadio::send(FrameBuffer *buffer)
 
     NRF_RADIO->EVENTS_END = 0;
     NRF_RADIO->TASKS_START = 1;
+}
+
+/**
+  * Called at the start of a timeslot granted by the SoftDevice. Configures the RADIO, and starts reception.
+  *
+  * @note should only be called from the timeslot signal handler...
+  */
+void MicroBitRadio::timeslotStart()
+{
+    inTimeslot = true;
+    reconfigure = false;
+
+    MICROBIT_ENERGY_STATE(MICROBIT_ENERGY_RADIO, true);
+
+    configure();
+    timeslotService();
+}
+
+/**
+  * Called when a timeslot granted by the SoftDevice is about to end. Stops the RADIO.
+  *
+  * @note should only be called from the timeslot signal handler...
+  */
+void MicroBitRadio::timeslotEnd()
+{
+    inTimeslot = false;
+
+    NVIC_DisableIRQ(RADIO_IRQn);
+    NRF_RADIO->EVENTS_DISABLED = 0;
+    NRF_RADIO->TASKS_DISABLE = 1;
+    while(NRF_RADIO->EVENTS_DISABLED == 0);
+
+    MICROBIT_ENERGY_STATE(MICROBIT_ENERGY_RADIO, false);
+}
+
+/**
+  * Called when a timeslot we asked for could not be granted. Asks again, provided we still want one.
+  *
+  * @note should only be called from the SoC event handler...
+  */
+void MicroBitRadio::timeslotRenew()
+{
+#if MICROBIT_RADIO_TIMESLOT_SUPPORTED
+    if (status & MICROBIT_RADIO_STATUS_TIMESLOT)
+        sd_radio_request(timeslot_request_earliest());
+#endif
+}
+
+/**
+  * Called within a timeslot whenever the RADIO needs attention. Applies any change in settings,
+  * and transmits any frame awaiting transmission, if enough time remains.
+  *
+  * @note should only be called from the timeslot signal handler...
+  */
+void MicroBitRadio::timeslotService()
+{
+    if (!inTimeslot)
+        return;
+
+    if (reconfigure)
+    {
+        reconfigure = false;
+
+        NRF_RADIO->EVENTS_DISABLED = 0;
+        NRF_RADIO->TASKS_DISABLE = 1;
+        while(NRF_RADIO->EVENTS_DISABLED == 0);
+
+        configure();
+    }
+
+    if (txPending == NULL)
+        return;
+
+    // Leave the frame for the next timeslot if it might overrun this one. TIMER0 counts from the start of the timeslot,
+    // and CC[0] holds the time at which we must start to give it up.
+    NRF_TIMER0->TASKS_CAPTURE[1] = 1;
+
+    if (NRF_TIMER0->CC[0] - NRF_TIMER0->CC[1] < getAirtime(MICROBIT_RADIO_MAX_PACKET_SIZE + MICROBIT_RADIO_HEADER_SIZE - 1) + MICROBIT_RADIO_TIMESLOT_TX_MARGIN_US)
+        return;
+
+    transmit(txPending);
+    txPending = NULL;
+
+    Event(MICROBIT_ID_RADIO_INTERNAL, MICROBIT_RADIO_EVT_TX_DONE);
+}
+
+/**
+  * Transmits the given buffer onto the broadcast radio.
+  * The call will wait until the transmission of the packet has completed before returning.
+  *
+  * When sharing the RADIO with the BLE stack, the frame is transmitted in the next timeslot.
+  *
+  * @param data The packet contents to transmit.
+  *
+  * @return DEVICE_OK on success, DEVICE_NOT_SUPPORTED if the BLE stack is running and the RADIO cannot be shared,
+  *         or DEVICE_BUSY if the RADIO is shared and no timeslot was granted within MICROBIT_RADIO_TIMESLOT_TX_TIMEOUT_MS.
+  */
+int MicroBitRadio::send(FrameBuffer *buffer)
+{
+    int access = hardwareAccess();
+
+    if (access == DEVICE_NOT_SUPPORTED)
+        return access;
+
+    if (buffer == NULL)
+        return DEVICE_INVALID_PARAMETER;
+
+    if (buffer->length > MICROBIT_RADIO_MAX_PACKET_SIZE + MICROBIT_RADIO_HEADER_SIZE - 1)
+        return DEVICE_INVALID_PARAMETER;
+
+    FrameBuffer sealed;
+
+    if (cipher.isEnabled(group))
+    {
+        // The CCM peripheral is only ours while the RADIO is not shared with the BLE stack.
+        if (access != DEVICE_OK)
+            return DEVICE_NOT_SUPPORTED;
+
+        if (buffer->length + MICROBIT_RADIO_CIPHER_OVERHEAD > MICROBIT_RADIO_MAX_PACKET_SIZE + MICROBIT_RADIO_HEADER_SIZE - 1)
+            return DEVICE_INVALID_PARAMETER;
+
+        int len = cipher.seal(group, buffer->protocol, 0, buffer->payload, buffer->length - (MICROBIT_RADIO_HEADER_SIZE - 1), 0, sealed.payload);
+
+        if (len < 0)
+            return len;
+
+        sealed.length = len + MICROBIT_RADIO_HEADER_SIZE - 1;
+        sealed.version = MICROBIT_RADIO_VERSION_SECURE;
+        sealed.group = buffer->group;
+        sealed.protocol = buffer->protocol;
+        buffer = &sealed;
+    }
+
+    if (status & MICROBIT_RADIO_STATUS_TIMESLOT)
+    {
+        // Hand the frame to the timeslot signal handler, and wait for it to go. If a timeslot is in progress,
+        // prompt the handler to send it straight away.
+        CODAL_TIMESTAMP deadline = system_timer_current_time() + MICROBIT_RADIO_TIMESLOT_TX_TIMEOUT_MS;
+        bool sleep = fiber_scheduler_running() && __get_IPSR() == 0;
+
+        txPending = buffer;
+
+        if (inTimeslot)
+            NVIC_SetPendingIRQ(RADIO_IRQn);
+
+        // The handler raises TX_DONE once the frame has gone. The same event, raised at the deadline, wakes us to give up.
+        if (sleep)
+            system_timer_event_after(MICROBIT_RADIO_TIMESLOT_TX_TIMEOUT_MS, MICROBIT_ID_RADIO_INTERNAL, MICROBIT_RADIO_EVT_TX_DONE);
+
+        while (true)
+        {
+            // Register for the event before testing, so that a frame sent in between is not missed.
+            target_disable_irq();
+
+            if (txPending == NULL || !(status & MICROBIT_RADIO_STATUS_TIMESLOT))
+            {
+                target_enable_irq();
+                break;
+            }
+
+            if (system_timer_current_time() >= deadline)
+            {
+                // Withdraw the frame, so the handler never reads it once we've returned.
+                txPending = NULL;
+                target_enable_irq();
+
+                if (sleep)
+                    system_timer_cancel_event(MICROBIT_ID_RADIO_INTERNAL, MICROBIT_RADIO_EVT_TX_DONE);
+
+                return DEVICE_BUSY;
+            }
+
+            if (sleep)
+                fiber_wake_on_event(MICROBIT_ID_RADIO_INTERNAL, MICROBIT_RADIO_EVT_TX_DONE);
+
+            target_enable_irq();
+
+            if (sleep)
+                schedule();
+        }
+
+        if (sleep)
+            system_timer_cancel_event(MICROBIT_ID_RADIO_INTERNAL, MICROBIT_RADIO_EVT_TX_DONE);
+
+        return DEVICE_OK;
+    }
+
+    if (access != DEVICE_OK)
+        return DEVICE_NOT_SUPPORTED;
+
+    if (hopping.isEnabled())
+    {
+        // Don't start so close to the end of a slot that receivers will have moved on by the time we're done.
+        CODAL_TIMESTAMP elapsed = (system_timer_current_time_us() - hopOrigin) % hopDwell;
+
+        if (hopDwell - elapsed < MICROBIT_RADIO_HOPPING_GUARD_US)
+            system_timer_wait_us(hopDwell - elapsed);
+
+        // Whoever hears us will follow our schedule, so we're following it too.
+        hopActive = system_timer_current_time_us();
+    }
+
+    // Firstly, disable the Radio interrupt. We want to wait until the trasmission completes.
+    NVIC_DisableIRQ(RADIO_IRQn);
+
+    transmit(buffer);
 
     // Re-enable the Radio interrupt.
     NVIC_ClearPendingIRQ(RADIO_IRQn);
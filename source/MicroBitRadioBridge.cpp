@@ -0,0 +1,310 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "MicroBitRadioBridge.h"
+#include "ErrorNo.h"
+#include "CodalCompat.h"
+
+using namespace codal;
+
+/**
+  * Constructor.
+  *
+  * Creates an idle bridge.
+  *
+  * @param serial The serial port to the host.
+  *
+  * @param queue The transmit queue in front of that serial port.
+  *
+  * @param id The unique EventModel id of this component. Defaults to MICROBIT_ID_RADIO_BRIDGE.
+  */
+MicroBitRadioBridge::MicroBitRadioBridge(NRF52Serial &serial, MicroBitSerialQueue &queue, uint16_t id) : serial(serial), queue(queue)
+{
+    this->id = id;
+    this->status = 0;
+    this->radio = NULL;
+    this->mesh = NULL;
+    this->inputLength = 0;
+    this->overflow = false;
+    memset(&stats, 0, sizeof(stats));
+}
+
+/**
+  * Switches the serial port to the bridge baud rate, and starts taking frames from the radio.
+  */
+int MicroBitRadioBridge::begin(int baud)
+{
+    serial.setBaud(baud);
+    serial.setRxBufferSize(255);
+
+    inputLength = 0;
+    overflow = false;
+    status |= MICROBIT_RADIO_BRIDGE_STATUS_ENABLED | DEVICE_COMPONENT_STATUS_IDLE_TICK;
+
+    return DEVICE_OK;
+}
+
+/**
+  * Starts bridging the given radio, which should already be enabled.
+  *
+  * @param radio The radio to bridge.
+  *
+  * @param baud The baud rate to use on the serial port. Defaults to MICROBIT_RADIO_BRIDGE_BAUD.
+  *
+  * @return DEVICE_OK on success, or DEVICE_BUSY if a radio is already being bridged.
+  */
+int MicroBitRadioBridge::start(MicroBitRadio &radio, int baud)
+{
+    if (isEnabled())
+        return DEVICE_BUSY;
+
+    this->radio = &radio;
+    radio.setBridge(this);
+
+    return begin(baud);
+}
+
+/**
+  * Starts bridging the given mesh radio, which should already be enabled. Frames are forwarded as they are
+  * received, relays included, before unicast frames are filtered by destination.
+  *
+  * @param radio The mesh radio to bridge.
+  *
+  * @param baud The baud rate to use on the serial port. Defaults to MICROBIT_RADIO_BRIDGE_BAUD.
+  *
+  * @return DEVICE_OK on success, or DEVICE_BUSY if a radio is already being bridged.
+  */
+int MicroBitRadioBridge::start(MicroBitMeshRadio &radio, int baud)
+{
+    if (isEnabled())
+        return DEVICE_BUSY;
+
+    this->mesh = &radio;
+    radio.setBridge(this);
+
+    return begin(baud);
+}
+
+/**
+  * Stops bridging. The radio returns to delivering frames to its own protocols.
+  */
+void MicroBitRadioBridge::stop()
+{
+    if (radio)
+        radio->setBridge(NULL);
+
+    if (mesh)
+        mesh->setBridge(NULL);
+
+    radio = NULL;
+    mesh = NULL;
+    status &= ~(MICROBIT_RADIO_BRIDGE_STATUS_ENABLED | DEVICE_COMPONENT_STATUS_IDLE_TICK);
+}
+
+/**
+  * Determines if a radio is being bridged.
+  *
+  * @return true if bridging, false otherwise.
+  */
+bool MicroBitRadioBridge::isEnabled()
+{
+    return status & MICROBIT_RADIO_BRIDGE_STATUS_ENABLED;
+}
+
+/**
+  * Frames and queues a record for the host.
+  *
+  * @param type The record type, one of MICROBIT_RADIO_BRIDGE_TYPE_*.
+  *
+  * @param frame The frame, starting with its length field.
+  *
+  * @param rssi The received signal strength of the frame, in -dBm.
+  *
+  * @param timestamp The time at which the frame was received, in local microseconds.
+  */
+void MicroBitRadioBridge::forward(uint8_t type, const uint8_t *frame, uint8_t rssi, CODAL_TIMESTAMP timestamp)
+{
+    uint8_t record[MICROBIT_RADIO_BRIDGE_MAX_RECORD];
+    uint8_t encoded[MICROBIT_RADIO_BRIDGE_MAX_ENCODED];
+    int len = min((int)frame[0] + 1, MICROBIT_RADIO_BRIDGE_MAX_FRAME);
+    uint32_t t = (uint32_t) timestamp;
+
+    record[0] = type;
+    record[1] = overflow ? MICROBIT_RADIO_BRIDGE_FLAG_DROPPED : 0;
+    record[2] = rssi;
+    memcpy(&record[3], &t, sizeof(uint32_t));
+    memcpy(&record[MICROBIT_RADIO_BRIDGE_HEADER_SIZE], frame, len);
+    len += MICROBIT_RADIO_BRIDGE_HEADER_SIZE;
+
+    // COBS: each zero is replaced by the distance to the next, so that the only zero sent is the terminator.
+    int code = 0;
+    int out = 1;
+
+    for (int i = 0; i < len; i++)
+    {
+        if (record[i] != 0)
+            encoded[out++] = record[i];
+
+        if (record[i] == 0 || out - code == 0xFF)
+        {
+            encoded[code] = out - code;
+            code = out++;
+        }
+    }
+
+    encoded[code] = out - code;
+    encoded[out++] = 0;
+
+    // Drop whole records rather than wait for the serial port, so the radio's receive queue never backs up.
+    if (queue.send(encoded, out) == out)
+    {
+        overflow = false;
+        stats.forwarded++;
+    }
+    else
+    {
+        overflow = true;
+        stats.dropped++;
+    }
+}
+
+/**
+  * Forwards a frame received by the bridged radio to the host.
+  *
+  * @param frame The frame just taken from the radio's receive queue.
+  *
+  * @note called by MicroBitRadio::idleCallback() whilst bridging.
+  */
+void MicroBitRadioBridge::forward(FrameBuffer *frame)
+{
+    // Received signal strengths are held as (negative) dBm, and sent as their magnitude.
+    forward(MICROBIT_RADIO_BRIDGE_TYPE_RADIO, &frame->length, -(int8_t)frame->rssi, frame->timestamp);
+}
+
+/**
+  * Forwards a frame received by the bridged mesh radio to the host.
+  *
+  * @param frame The frame just taken from the radio's receive queue.
+  *
+  * @note called by MicroBitMeshRadio::idleCallback() whilst bridging.
+  */
+void MicroBitRadioBridge::forward(SequencedFrameBuffer *frame)
+{
+    forward(MICROBIT_RADIO_BRIDGE_TYPE_MESH, &frame->length, -frame->rssi, frame->timestamp);
+}
+
+/**
+  * Decodes and transmits a complete record received from the host.
+  *
+  * @param len The number of encoded bytes in input, excluding the terminating zero.
+  */
+void MicroBitRadioBridge::inject(int len)
+{
+    uint8_t record[MICROBIT_RADIO_BRIDGE_MAX_ENCODED];
+    int n = 0;
+
+    // Undo the COBS framing. A code of 0xFF is a full block, not followed by a zero.
+    for (int i = 0; i < len;)
+    {
+        int code = input[i++];
+
+        if (code == 0 || i + code - 1 > len)
+        {
+            stats.errors++;
+            return;
+        }
+
+        for (int j = 1; j < code; j++)
+            record[n++] = input[i++];
+
+        if (code != 0xFF && i < len)
+            record[n++] = 0;
+    }
+
+    // The frame must be exactly as long as its length field says, and at least as long as its header.
+    int type = n ? record[0] : 0;
+    int header = type == MICROBIT_RADIO_BRIDGE_TYPE_MESH ? MICROBIT_MESH_RADIO_HEADER_SIZE : MICROBIT_RADIO_HEADER_SIZE;
+    int result = DEVICE_INVALID_PARAMETER;
+
+    if (n >= 1 + header && record[1] + 2 == n)
+    {
+        if (type == MICROBIT_RADIO_BRIDGE_TYPE_RADIO && radio)
+        {
+            FrameBuffer buf;
+            memcpy(&buf.length, &record[1], n - 1);
+            result = radio->send(&buf);
+        }
+
+        if (type == MICROBIT_RADIO_BRIDGE_TYPE_MESH && mesh)
+        {
+            SequencedFrameBuffer buf;
+            memcpy(&buf.length, &record[1], n - 1);
+            result = mesh->send(&buf);
+        }
+    }
+
+    if (result == DEVICE_OK)
+        stats.injected++;
+    else
+        stats.errors++;
+}
+
+/**
+  * Retrieves the statistics of the bridge, since it was constructed.
+  *
+  * @param stats The structure to fill in.
+  */
+void MicroBitRadioBridge::getStats(RadioBridgeStats &stats)
+{
+    stats = this->stats;
+}
+
+/**
+  * Reads and injects records from the host when the scheduler is idle.
+  */
+void MicroBitRadioBridge::idleCallback()
+{
+    int c;
+
+    while ((c = serial.read(ASYNC)) >= 0)
+    {
+        if (c == 0)
+        {
+            if (inputLength > 0 && inputLength <= sizeof(input))
+                inject(inputLength);
+
+            inputLength = 0;
+        }
+        else if (inputLength < sizeof(input))
+        {
+            input[inputLength++] = c;
+        }
+        else if (inputLength == sizeof(input))
+        {
+            // Discard records too long to be valid, up to the next terminator.
+            stats.errors++;
+            inputLength++;
+        }
+    }
+}
@@ -0,0 +1,319 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 British Broadcasting Corporation.
+This software is provided by Lancaster University by arrangement with the BBC.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "MicroBitConfig.h"
+#include "MicroBitRadioCapture.h"
+#include "MicroBitRadio.h"
+#include "ErrorNo.h"
+#include "Timer.h"
+#include "nrf.h"
+
+using namespace codal;
+
+/**
+  * Constructor.
+  *
+  * Creates an idle capture. No memory is allocated until capture is started.
+  */
+MicroBitRadioCapture::MicroBitRadioCapture()
+{
+    buffer = NULL;
+    head = 0;
+    tail = 0;
+    count = 1;
+    groups[0] = 0;
+    enabled = false;
+    scanning = false;
+    overflow = false;
+    captured = 0;
+    dropped = 0;
+}
+
+/**
+  * Fills the logical addresses other than our own with the next groups in turn.
+  *
+  * @param from The group at which to start.
+  */
+void MicroBitRadioCapture::fill(uint8_t from)
+{
+    for (count = 1; count < MICROBIT_RADIO_CAPTURE_ADDRESSES; count++)
+    {
+        if (from == groups[0])
+            from++;
+
+        groups[count] = from++;
+    }
+}
+
+/**
+  * Starts capturing frames. Any records still awaiting export are discarded.
+  *
+  * @param list The groups to capture, in addition to our own, or NULL to capture every group in turn.
+  *
+  * @param n The number of groups in the list, up to MICROBIT_RADIO_CAPTURE_MAX_GROUPS.
+  *
+  * @param own The group to which this micro:bit belongs.
+  *
+  * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the list is invalid,
+  *         or DEVICE_NO_RESOURCES if the ring could not be allocated.
+  */
+int MicroBitRadioCapture::start(const uint8_t *list, int n, uint8_t own)
+{
+    if (list != NULL && (n < 0 || n > MICROBIT_RADIO_CAPTURE_MAX_GROUPS))
+        return DEVICE_INVALID_PARAMETER;
+
+    if (buffer == NULL)
+    {
+        buffer = (uint8_t *) malloc(MICROBIT_RADIO_CAPTURE_BUFFER_SIZE);
+
+        if (buffer == NULL)
+            return DEVICE_NO_RESOURCES;
+    }
+
+    // The ISR may still be recording, so stop it before resetting the ring.
+    enabled = false;
+    __DMB();
+
+    head = 0;
+    tail = 0;
+    overflow = false;
+    captured = 0;
+    dropped = 0;
+    groups[0] = own;
+    scanning = list == NULL;
+
+    if (scanning)
+    {
+        fill(0);
+    }
+    else
+    {
+        count = 1;
+
+        for (int i = 0; i < n; i++)
+            if (list[i] != own)
+                groups[count++] = list[i];
+    }
+
+    __DMB();
+    enabled = true;
+
+    return DEVICE_OK;
+}
+
+/**
+  * Stops capturing frames. Records already captured remain in the ring, and may still be exported.
+  */
+void MicroBitRadioCapture::stop()
+{
+    enabled = false;
+    scanning = false;
+    count = 1;
+}
+
+/**
+  * Determines if capture is in progress.
+  *
+  * @return true if frames are being captured, false otherwise.
+  */
+bool MicroBitRadioCapture::isEnabled()
+{
+    return enabled;
+}
+
+/**
+  * Determines if every group is being captured in turn.
+  *
+  * @return true if scanning, false otherwise.
+  */
+bool MicroBitRadioCapture::isScanning()
+{
+    return scanning;
+}
+
+/**
+  * Updates the group to which this micro:bit belongs, which is always captured.
+  *
+  * @param own The new group.
+  */
+void MicroBitRadioCapture::setGroup(uint8_t own)
+{
+    // Our old group takes the place of our new one, if it was being captured.
+    for (int i = 1; i < count; i++)
+        if (groups[i] == own)
+            groups[i] = groups[0];
+
+    groups[0] = own;
+}
+
+/**
+  * When scanning, moves on to the next set of groups.
+  */
+void MicroBitRadioCapture::nextWindow()
+{
+    if (scanning)
+        fill(groups[MICROBIT_RADIO_CAPTURE_ADDRESSES - 1] + 1);
+}
+
+/**
+  * Determines the value of the RADIO PREFIX0 or PREFIX1 register, which hold the groups of logical addresses 0 - 3 and 4 - 7.
+  *
+  * @param n The register, 0 or 1.
+  *
+  * @return The register value.
+  */
+uint32_t MicroBitRadioCapture::getPrefix(int n)
+{
+    uint32_t prefix = 0;
+
+    for (int i = 4 * n + 3; i >= 4 * n; i--)
+        prefix = (prefix << 8) | (i < count ? groups[i] : 0);
+
+    return prefix;
+}
+
+/**
+  * Determines the value of the RADIO RXADDRESSES register.
+  *
+  * @return A bitmask, where bit n enables logical address n.
+  */
+uint32_t MicroBitRadioCapture::getAddressMask()
+{
+    return (1 << count) - 1;
+}
+
+/**
+  * Records a frame into the ring, or counts it as dropped if there is no space.
+  *
+  * @param frame The frame as received by the RADIO, starting with its length field.
+  *
+  * @param address The logical address on which the frame was received.
+  *
+  * @param rssi The received signal strength of the frame, in -dBm.
+  *
+  * @param valid true if the frame passed its CRC check, false otherwise.
+  *
+  * @note should only be called from RADIO_IRQHandler...
+  */
+void MicroBitRadioCapture::record(const uint8_t *frame, uint32_t address, uint8_t rssi, bool valid)
+{
+    if (!enabled || address >= count)
+        return;
+
+    // A corrupt length field may claim more than the RADIO was permitted to store.
+    int length = frame[0] < MICROBIT_RADIO_MAX_PACKET_SIZE + MICROBIT_RADIO_HEADER_SIZE - 1 ? frame[0] : MICROBIT_RADIO_MAX_PACKET_SIZE + MICROBIT_RADIO_HEADER_SIZE - 1;
+    uint32_t size = MICROBIT_RADIO_CAPTURE_HEADER_SIZE + 1 + length;
+
+    if (MICROBIT_RADIO_CAPTURE_BUFFER_SIZE - (head - tail) < size)
+    {
+        dropped++;
+        overflow = true;
+        return;
+    }
+
+    uint32_t timestamp = (uint32_t) system_timer_current_time_us();
+    uint8_t header[MICROBIT_RADIO_CAPTURE_HEADER_SIZE];
+
+    header[0] = MICROBIT_RADIO_CAPTURE_SYNC;
+    header[1] = (valid ? MICROBIT_RADIO_CAPTURE_FLAG_CRC_OK : 0) | (overflow ? MICROBIT_RADIO_CAPTURE_FLAG_DROPPED : 0);
+    header[2] = rssi;
+    header[3] = groups[address];
+    header[4] = timestamp;
+    header[5] = timestamp >> 8;
+    header[6] = timestamp >> 16;
+    header[7] = timestamp >> 24;
+
+    uint32_t p = head;
+
+    for (int i = 0; i < MICROBIT_RADIO_CAPTURE_HEADER_SIZE; i++)
+        buffer[p++ & (MICROBIT_RADIO_CAPTURE_BUFFER_SIZE - 1)] = header[i];
+
+    for (int i = 0; i <= length; i++)
+        buffer[p++ & (MICROBIT_RADIO_CAPTURE_BUFFER_SIZE - 1)] = frame[i];
+
+    // Publish the record only once it is complete. We are the only writer of head, and exportTo() the only writer of tail,
+    // so no locking is required.
+    __DMB();
+    head = p;
+
+    overflow = false;
+    captured++;
+}
+
+/**
+  * Sends all records awaiting export over the given serial port, as a raw binary stream.
+  * Records are not split into calls of their own, so a reader should synchronise on MICROBIT_RADIO_CAPTURE_SYNC.
+  *
+  * @param serial The serial port to use.
+  *
+  * @return The number of bytes sent, or an error from Serial::send().
+  */
+int MicroBitRadioCapture::exportTo(NRF52Serial &serial)
+{
+    int total = 0;
+
+    if (buffer == NULL)
+        return 0;
+
+    // Send at most two blocks: up to the end of the ring, then any that has wrapped around to its start.
+    for (int pass = 0; pass < 2; pass++)
+    {
+        uint32_t pending = head - tail;
+        uint32_t offset = tail & (MICROBIT_RADIO_CAPTURE_BUFFER_SIZE - 1);
+        uint32_t length = pending < MICROBIT_RADIO_CAPTURE_BUFFER_SIZE - offset ? pending : MICROBIT_RADIO_CAPTURE_BUFFER_SIZE - offset;
+
+        if (length == 0)
+            break;
+
+        int sent = serial.send(buffer + offset, length);
+
+        if (sent < 0)
+            return total ? total : sent;
+
+        tail += sent;
+        total += sent;
+
+        if ((uint32_t)sent < length)
+            break;
+    }
+
+    return total;
+}
+
+/**
+  * Retrieves the statistics of the current capture.
+  *
+  * @param stats The structure to fill in.
+  *
+  * @return DEVICE_OK on success.
+  */
+int MicroBitRadioCapture::getStats(RadioCaptureStats &stats)
+{
+    stats.captured = captured;
+    stats.dropped = dropped;
+    stats.pending = head - tail;
+
+    return DEVICE_OK;
+}
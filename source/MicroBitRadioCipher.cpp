@@ -0,0 +1,359 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "MicroBitRadioCipher.h"
+#include "MicroBitDevice.h"
+#include "MicroBitHeapStats.h"
+#include "MicroBitRandom.h"
+#include "ErrorNo.h"
+#include "nrf.h"
+#include <string.h>
+
+using namespace codal;
+
+// The CCM configuration structure: key, 39 bit packet counter, direction bit and initialisation vector.
+struct RadioCipherConfig
+{
+    uint8_t     key[MICROBIT_RADIO_CIPHER_KEY_SIZE];
+    uint8_t     counter[8];
+    uint8_t     direction;
+    uint8_t     iv[8];
+} __attribute__((packed));
+
+// The CCM data structure for a packet, as read and written by EasyDMA: a header byte (which is authenticated), the
+// length of the payload, a reserved byte, and the payload.
+#define CIPHER_PACKET_HEADER_SIZE       3
+
+// The layout of the work area. The scratch area needs 16 bytes more than the largest packet.
+#define CIPHER_CONFIG_OFFSET            0
+#define CIPHER_IN_OFFSET                36
+#define CIPHER_OUT_OFFSET               (CIPHER_IN_OFFSET + 256)
+#define CIPHER_SCRATCH_OFFSET           (CIPHER_OUT_OFFSET + 256)
+#define CIPHER_WORK_SIZE                (CIPHER_SCRATCH_OFFSET + MICROBIT_RADIO_CIPHER_MAX_LENGTH + 17)
+
+/**
+  * Constructor. No keys are held, so frames are sent in the clear.
+  */
+MicroBitRadioCipher::MicroBitRadioCipher()
+{
+    memset(keys, 0, sizeof(keys));
+    memset(senders, 0, sizeof(senders));
+    work = NULL;
+    session = 0;
+    counter = 0;
+    clock = 0;
+    rejected = 0;
+}
+
+/**
+  * Finds the key of a group.
+  *
+  * @return The key, or NULL if the group has none.
+  */
+RadioCipherKey *MicroBitRadioCipher::findKey(uint8_t group)
+{
+    for (int i = 0; i < CONFIG_MICROBIT_RADIO_CIPHER_KEYS; i++)
+        if (keys[i].used && keys[i].group == group)
+            return &keys[i];
+
+    return NULL;
+}
+
+/**
+  * Sets or removes the key of a group. Frames sent to a group with a key are sealed, and sealed frames received
+  * from it are opened; frames for other groups are sent and received in the clear, as before.
+  *
+  * @param group The group of interest.
+  * @param key The 16 byte key, or NULL to remove the key of the group.
+  *
+  * @return DEVICE_OK on success, DEVICE_NO_RESOURCES if CONFIG_MICROBIT_RADIO_CIPHER_KEYS groups already have a
+  * key or there is insufficient memory, or DEVICE_NOT_SUPPORTED if the BLE stack is running.
+  */
+int MicroBitRadioCipher::setKey(uint8_t group, const uint8_t *key)
+{
+    RadioCipherKey *k = findKey(group);
+
+    if (key == NULL)
+    {
+        if (k)
+            memset(k, 0, sizeof(RadioCipherKey));
+
+        return DEVICE_OK;
+    }
+
+    // The CCM peripheral belongs to the SoftDevice while it is enabled.
+    if (ble_running())
+        return DEVICE_NOT_SUPPORTED;
+
+    if (work == NULL)
+    {
+        work = (uint8_t *) malloc(CIPHER_WORK_SIZE);
+
+        if (work == NULL)
+            return DEVICE_NO_RESOURCES;
+
+        MICROBIT_HEAP_TRACK(MICROBIT_HEAP_TAG_RADIO, work);
+
+        // A fresh session for each start of the device, so that our counters never repeat a nonce under the same key.
+        while (session == 0)
+            microbit_random_entropy((uint8_t *) &session, sizeof(session));
+    }
+
+    for (int i = 0; k == NULL && i < CONFIG_MICROBIT_RADIO_CIPHER_KEYS; i++)
+        if (!keys[i].used)
+            k = &keys[i];
+
+    if (k == NULL)
+        return DEVICE_NO_RESOURCES;
+
+    memcpy(k->key, key, MICROBIT_RADIO_CIPHER_KEY_SIZE);
+    k->group = group;
+    k->used = true;
+
+    return DEVICE_OK;
+}
+
+/**
+  * Determines if a group has a key.
+  */
+bool MicroBitRadioCipher::isEnabled(uint8_t group)
+{
+    return findKey(group) != NULL;
+}
+
+/**
+  * Runs the CCM peripheral over the input area, into the output area.
+  *
+  * @param key The key to use.
+  * @param session The session identifier of the sender.
+  * @param counter The frame counter of the sender.
+  * @param context Up to 24 bits of further data identifying the frame, which is bound into the nonce.
+  * @param clear The bytes of the frame left in the clear, which are bound into the nonce.
+  * @param clearLength The number of clear bytes, up to MICROBIT_RADIO_CIPHER_CLEAR_MAX.
+  * @param decrypt true to decrypt and authenticate, false to encrypt.
+  *
+  * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if decrypting and the frame failed authentication.
+  */
+int MicroBitRadioCipher::crypt(RadioCipherKey *key, uint32_t session, uint32_t counter, uint32_t context, const uint8_t *clear, int clearLength, bool decrypt)
+{
+    RadioCipherConfig *cnf = (RadioCipherConfig *) &work[CIPHER_CONFIG_OFFSET];
+
+    // The nonce is the sender's counter, and an IV of its session combined with the clear bytes, the frame context and
+    // the group. The counter alone keeps the nonces of a session distinct, so the clear bytes can share the IV with it.
+    memcpy(cnf->key, key->key, MICROBIT_RADIO_CIPHER_KEY_SIZE);
+    memset(cnf->counter, 0, sizeof(cnf->counter));
+    memcpy(cnf->counter, &counter, sizeof(counter));
+    cnf->direction = 0;
+    memcpy(cnf->iv, &session, sizeof(session));
+    for (int i = 0; i < clearLength; i++)
+        cnf->iv[i] ^= clear[i];
+    cnf->iv[4] = context;
+    cnf->iv[5] = context >> 8;
+    cnf->iv[6] = context >> 16;
+    cnf->iv[7] = key->group;
+
+    NRF_CCM->ENABLE = CCM_ENABLE_ENABLE_Enabled << CCM_ENABLE_ENABLE_Pos;
+    NRF_CCM->MODE = ((decrypt ? CCM_MODE_MODE_Decryption : CCM_MODE_MODE_Encryption) << CCM_MODE_MODE_Pos) |
+                    (CCM_MODE_DATARATE_2Mbit << CCM_MODE_DATARATE_Pos) |
+                    (CCM_MODE_LENGTH_Extended << CCM_MODE_LENGTH_Pos);
+    NRF_CCM->MAXPACKETSIZE = MICROBIT_RADIO_CIPHER_MAX_LENGTH;
+    NRF_CCM->CNFPTR = (uint32_t) cnf;
+    NRF_CCM->INPTR = (uint32_t) &work[CIPHER_IN_OFFSET];
+    NRF_CCM->OUTPTR = (uint32_t) &work[CIPHER_OUT_OFFSET];
+    NRF_CCM->SCRATCHPTR = (uint32_t) &work[CIPHER_SCRATCH_OFFSET];
+    NRF_CCM->SHORTS = CCM_SHORTS_ENDKSGEN_CRYPT_Msk;
+
+    NRF_CCM->EVENTS_ENDKSGEN = 0;
+    NRF_CCM->EVENTS_ENDCRYPT = 0;
+    NRF_CCM->EVENTS_ERROR = 0;
+    NRF_CCM->TASKS_KSGEN = 1;
+
+    while (NRF_CCM->EVENTS_ENDCRYPT == 0 && NRF_CCM->EVENTS_ERROR == 0);
+
+    bool ok = NRF_CCM->EVENTS_ENDCRYPT && (!decrypt || NRF_CCM->MICSTATUS);
+
+    NRF_CCM->SHORTS = 0;
+    NRF_CCM->ENABLE = CCM_ENABLE_ENABLE_Disabled << CCM_ENABLE_ENABLE_Pos;
+
+    // Don't leave the key lying around in the work area.
+    memset(cnf->key, 0, MICROBIT_RADIO_CIPHER_KEY_SIZE);
+
+    return ok ? DEVICE_OK : DEVICE_INVALID_PARAMETER;
+}
+
+/**
+  * Seals a payload, encrypting and authenticating it.
+  *
+  * @param group The group the frame is being sent to. Must have a key.
+  * @param protocol The protocol field of the frame, which is authenticated.
+  * @param context Up to 24 bits of further header data of the frame to authenticate, or 0.
+  * @param in The payload to seal.
+  * @param length The length of the payload.
+  * @param clear The number of bytes at the start of the payload to leave in the clear, up to MICROBIT_RADIO_CIPHER_CLEAR_MAX.
+  * They are authenticated, but not encrypted.
+  * @param out The buffer to store the sealed payload in, which must have room for length + MICROBIT_RADIO_CIPHER_OVERHEAD bytes.
+  * It may not be the same as in.
+  *
+  * @return The length of the sealed payload, DEVICE_INVALID_PARAMETER if the lengths are out of range,
+  * DEVICE_NOT_SUPPORTED if the group has no key or the BLE stack is running.
+  */
+int MicroBitRadioCipher::seal(uint8_t group, uint8_t protocol, uint32_t context, const uint8_t *in, int length, int clear, uint8_t *out)
+{
+    RadioCipherKey *k = findKey(group);
+    int n = length - clear;
+
+    if (k == NULL || ble_running())
+        return DEVICE_NOT_SUPPORTED;
+
+    if (clear < 0 || clear > MICROBIT_RADIO_CIPHER_CLEAR_MAX || n < 0 || n + MICROBIT_RADIO_CIPHER_MIC_SIZE > MICROBIT_RADIO_CIPHER_MAX_LENGTH)
+        return DEVICE_INVALID_PARAMETER;
+
+    // Start a new session rather than let the counter wrap.
+    if (counter == 0xFFFFFFFF)
+    {
+        session = 0;
+        counter = 0;
+
+        while (session == 0)
+            microbit_random_entropy((uint8_t *) &session, sizeof(session));
+    }
+
+    uint32_t c = counter++;
+    uint8_t *packet = &work[CIPHER_IN_OFFSET];
+
+    packet[0] = protocol;
+    packet[1] = n;
+    packet[2] = 0;
+    memcpy(&packet[CIPHER_PACKET_HEADER_SIZE], &in[clear], n);
+
+    crypt(k, session, c, context, in, clear, false);
+
+    memcpy(out, in, clear);
+    memcpy(&out[clear], &session, sizeof(session));
+    memcpy(&out[clear + 4], &c, sizeof(c));
+    memcpy(&out[clear + MICROBIT_RADIO_CIPHER_NONCE_SIZE], &work[CIPHER_OUT_OFFSET + CIPHER_PACKET_HEADER_SIZE], n + MICROBIT_RADIO_CIPHER_MIC_SIZE);
+
+    return length + MICROBIT_RADIO_CIPHER_OVERHEAD;
+}
+
+/**
+  * Determines if a frame counter is newer than any seen before from its session, and if so records it.
+  *
+  * @return true if the frame should be accepted, false if it is a replay.
+  */
+bool MicroBitRadioCipher::accept(uint8_t group, uint32_t session, uint32_t counter)
+{
+    RadioCipherSender *s = NULL;
+    RadioCipherSender *oldest = &senders[0];
+
+    for (int i = 0; i < CONFIG_MICROBIT_RADIO_CIPHER_SENDERS; i++)
+    {
+        if (senders[i].session == session && senders[i].group == group)
+        {
+            s = &senders[i];
+            break;
+        }
+
+        if (senders[i].lastUsed < oldest->lastUsed)
+            oldest = &senders[i];
+    }
+
+    if (s && counter <= s->counter)
+        return false;
+
+    // A session we don't remember replaces the one heard from least recently.
+    if (s == NULL)
+    {
+        s = oldest;
+        s->session = session;
+        s->group = group;
+    }
+
+    s->counter = counter;
+    s->lastUsed = ++clock;
+
+    return true;
+}
+
+/**
+  * Opens a sealed payload in place, checking its authenticity and that it is not a replay.
+  *
+  * @param group The group the frame was received on.
+  * @param protocol The protocol field of the frame.
+  * @param context The further header data given to seal().
+  * @param data The sealed payload, which is replaced by the plaintext.
+  * @param length The length of the sealed payload.
+  * @param clear The number of bytes at the start of the payload that were left in the clear.
+  *
+  * @return The length of the plaintext payload, DEVICE_INVALID_PARAMETER if the frame failed authentication or is a
+  * replay, or DEVICE_NOT_SUPPORTED if the group has no key or the BLE stack is running.
+  */
+int MicroBitRadioCipher::open(uint8_t group, uint8_t protocol, uint32_t context, uint8_t *data, int length, int clear)
+{
+    RadioCipherKey *k = findKey(group);
+    int n = length - clear - MICROBIT_RADIO_CIPHER_NONCE_SIZE;
+
+    if (k == NULL || ble_running())
+        return DEVICE_NOT_SUPPORTED;
+
+    if (clear < 0 || clear > MICROBIT_RADIO_CIPHER_CLEAR_MAX || n < MICROBIT_RADIO_CIPHER_MIC_SIZE || n > MICROBIT_RADIO_CIPHER_MAX_LENGTH)
+    {
+        rejected++;
+        return DEVICE_INVALID_PARAMETER;
+    }
+
+    uint32_t s, c;
+    uint8_t *packet = &work[CIPHER_IN_OFFSET];
+
+    memcpy(&s, &data[clear], sizeof(s));
+    memcpy(&c, &data[clear + 4], sizeof(c));
+
+    packet[0] = protocol;
+    packet[1] = n;
+    packet[2] = 0;
+    memcpy(&packet[CIPHER_PACKET_HEADER_SIZE], &data[clear + MICROBIT_RADIO_CIPHER_NONCE_SIZE], n);
+
+    // Only a frame that is authentic may update the replay state, so a forgery cannot lock out its claimed sender.
+    if (crypt(k, s, c, context, data, clear, true) != DEVICE_OK || !accept(group, s, c))
+    {
+        rejected++;
+        return DEVICE_INVALID_PARAMETER;
+    }
+
+    n -= MICROBIT_RADIO_CIPHER_MIC_SIZE;
+    memcpy(&data[clear], &work[CIPHER_OUT_OFFSET + CIPHER_PACKET_HEADER_SIZE], n);
+
+    return clear + n;
+}
+
+/**
+  * Determines the number of sealed frames rejected, as they failed authentication or were replayed, and resets the count.
+  */
+uint32_t MicroBitRadioCipher::getRejected()
+{
+    uint32_t r = rejected;
+    rejected = 0;
+
+    return r;
+}
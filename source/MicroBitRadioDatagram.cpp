@@ -24,6 +24,9 @@ DEALINGS IN THE SOFTWARE.
 */
 
 #include "MicroBitRadio.h"
+#include "MicroBitDevice.h"
+#include "EventModel.h"
+#include "Timer.h"
 
 using namespace codal;
 
@@ -49,7 +52,19 @@ using namespace codal;
 */
 MicroBitRadioDatagram::MicroBitRadioDatagram(MicroBitRadio &r) : radio(r)
 {
-    this->rxQueue = NULL;
+    this->rxQueueHead = 0;
+    this->rxQueueDepth = 0;
+    this->nextTicket = 1;
+    this->peerVictim = 0;
+    this->arqListening = false;
+    memset(this->arqSlots, 0, sizeof(this->arqSlots));
+    memset(this->arqPeers, 0, sizeof(this->arqPeers));
+
+    // Derive a compact address from our serial number. Zero is reserved to mark unused records.
+    uint32_t serial = microbit_serial_number();
+    this->address = (uint16_t)(serial ^ (serial >> 16));
+    if (this->address == 0)
+        this->address = 1;
 }
 
 /**
@@ -66,19 +81,18 @@ MicroBitRadioDatagram::MicroBitRadioDatagram(MicroBitRadio &r) : radio(r)
   */
 int MicroBitRadioDatagram::recv(uint8_t *buf, int len)
 {
-    if (buf == NULL || rxQueue == NULL || len < 0)
+    if (buf == NULL || rxQueueDepth == 0 || len < 0)
         return DEVICE_INVALID_PARAMETER;
 
     // Take the first buffer from the queue.
-    FrameBuffer *p = rxQueue;
-    rxQueue = rxQueue->next;
+    PacketData *p = dequeuePacket();
 
-    int l = min(len, p->length - (MICROBIT_RADIO_HEADER_SIZE - 1));
+    int l = min(len, (int) p->length);
 
     // Fill in the buffer provided, if possible.
     memcpy(buf, p->payload, l);
 
-    delete p;
+    PacketBuffer::release(p);
     return l;
 }
 
@@ -92,16 +106,58 @@ int MicroBitRadioDatagram::recv(uint8_t *buf, int len)
   */
 PacketBuffer MicroBitRadioDatagram::recv()
 {
-    if (rxQueue == NULL)
+    PacketData *p = dequeuePacket();
+
+    if (p == NULL)
         return PacketBuffer::EmptyPacket;
 
-    FrameBuffer *p = rxQueue;
-    rxQueue = rxQueue->next;
+    // The packet was built in its final form as it arrived, so is handed over without copying.
+    return PacketBuffer(p);
+}
+
+/**
+  * Retrieves several packets at once, in order of arrival. The receive queue is detached in a single
+  * pass, so draining it costs one call rather than one per packet, and each packet is handed over without copying.
+  *
+  * @param out An array of PacketBuffers into which the packets received are placed.
+  *
+  * @param max The number of PacketBuffers in the array.
+  *
+  * @return The number of packets retrieved, which may be zero, or DEVICE_INVALID_PARAMETER if the array is invalid.
+  *
+  * @code
+  * PacketBuffer packets[MICROBIT_RADIO_MAXIMUM_RX_BUFFERS];
+  * int n = uBit.radio.datagram.recv(packets, MICROBIT_RADIO_MAXIMUM_RX_BUFFERS);
+  *
+  * for (int i = 0; i < n; i++)
+  *     process(packets[i]);
+  * @endcode
+  */
+int MicroBitRadioDatagram::recv(PacketBuffer *out, int max)
+{
+    PacketData *packets[MICROBIT_RADIO_MAXIMUM_RX_BUFFERS];
+
+    if (out == NULL || max < 0)
+        return DEVICE_INVALID_PARAMETER;
+
+    // Detach as much of the queue as the caller can take in one short critical section...
+    target_disable_irq();
+
+    int count = min(max, (int) rxQueueDepth);
+
+    for (int i = 0; i < count; i++)
+        packets[i] = rxQueue[(rxQueueHead + i) % MICROBIT_RADIO_MAXIMUM_RX_BUFFERS];
+
+    rxQueueHead = (rxQueueHead + count) % MICROBIT_RADIO_MAXIMUM_RX_BUFFERS;
+    rxQueueDepth -= count;
+
+    target_enable_irq();
 
-    PacketBuffer packet(p->payload, p->length - (MICROBIT_RADIO_HEADER_SIZE - 1), p->rssi);
+    // ... and only then wrap the packets up for the caller.
+    for (int i = 0; i < count; i++)
+        out[i] = PacketBuffer(packets[i]);
 
-    delete p;
-    return packet;
+    return count;
 }
 
 /**
@@ -119,7 +175,7 @@ PacketBuffer MicroBitRadioDatagram::recv()
   */
 int MicroBitRadioDatagram::send(uint8_t *buffer, int len)
 {
-    if (buffer == NULL || len < 0 || len > MICROBIT_RADIO_MAX_PACKET_SIZE + MICROBIT_RADIO_HEADER_SIZE - 1)
+    if (buffer == NULL || len < 0 || len > MICROBIT_RADIO_MAX_PACKET_SIZE)
         return DEVICE_INVALID_PARAMETER;
 
     FrameBuffer buf;
@@ -172,33 +228,328 @@ int MicroBitRadioDatagram::send(ManagedString data)
   */
 void MicroBitRadioDatagram::packetReceived()
 {
-    FrameBuffer *packet = radio.recv();
-    int queueDepth = 0;
+    FrameBuffer *p = radio.peek();
+
+    if (p == NULL)
+        return;
+
+    // Copy the payload straight from the radio's receive buffer into a form a PacketBuffer can adopt,
+    // and hand the receive buffer back.
+    int len = p->length - (MICROBIT_RADIO_HEADER_SIZE - 1);
+    PacketData *packet = PacketBuffer::allocate(p->payload, len < MICROBIT_RADIO_MAX_PACKET_SIZE ? len : MICROBIT_RADIO_MAX_PACKET_SIZE, p->rssi);
+
+    radio.release();
+
+    if (packet)
+        queuePacket(packet);
+}
+
+/**
+  * Adds the given packet to the tail of the receive queue, and signals its arrival.
+  * If the queue is full, the packet is discarded.
+  *
+  * @param packet The packet to queue. The queue takes over the caller's reference.
+  */
+void MicroBitRadioDatagram::queuePacket(PacketData *packet)
+{
+    if (rxQueueDepth >= MICROBIT_RADIO_MAXIMUM_RX_BUFFERS)
+    {
+        PacketBuffer::release(packet);
+        return;
+    }
 
     // We add to the tail of the queue to preserve causal ordering.
-    packet->next = NULL;
+    rxQueue[(rxQueueHead + rxQueueDepth) % MICROBIT_RADIO_MAXIMUM_RX_BUFFERS] = packet;
+    rxQueueDepth++;
+
+    Event(DEVICE_ID_RADIO, MICROBIT_RADIO_EVT_DATAGRAM);
+}
+
+/**
+  * Removes the packet at the head of the receive queue.
+  *
+  * @return The packet, whose reference passes to the caller, or NULL if the queue is empty.
+  */
+PacketData *MicroBitRadioDatagram::dequeuePacket()
+{
+    if (rxQueueDepth == 0)
+        return NULL;
+
+    PacketData *p = rxQueue[rxQueueHead];
+
+    rxQueueHead = (rxQueueHead + 1) % MICROBIT_RADIO_MAXIMUM_RX_BUFFERS;
+    rxQueueDepth--;
+
+    return p;
+}
 
-    if (rxQueue == NULL)
+/**
+  * Determines our address, as used for reliable delivery.
+  *
+  * @return The address of this micro:bit, derived from its serial number.
+  */
+uint16_t MicroBitRadioDatagram::getAddress()
+{
+    return address;
+}
+
+/**
+  * Finds the sequence state for the given peer, creating it if necessary.
+  *
+  * @param peer The address of the peer.
+  *
+  * @return The peer record.
+  */
+RadioArqPeer *MicroBitRadioDatagram::getPeer(uint16_t peer)
+{
+    RadioArqPeer *record = NULL;
+
+    for (int i = 0; i < MICROBIT_RADIO_ARQ_PEERS; i++)
     {
-        rxQueue = packet;
+        if (arqPeers[i].address == peer)
+            return &arqPeers[i];
+
+        if (arqPeers[i].address == 0 && record == NULL)
+            record = &arqPeers[i];
     }
-    else
+
+    if (record == NULL)
+    {
+        record = &arqPeers[peerVictim];
+        peerVictim = (peerVictim + 1) % MICROBIT_RADIO_ARQ_PEERS;
+    }
+
+    // Start from a random sequence number, so that a peer still holding state from a previous conversation
+    // is unlikely to mistake our new datagrams for duplicates.
+    record->address = peer;
+    record->txSeqNo = microbit_random_range(MICROBIT_RANDOM_STREAM_RADIO, 256);
+    record->rxSeqNo = 0;
+    record->rxSeen = 0;
+
+    return record;
+}
+
+/**
+  * Transmits a reliable datagram, or an acknowledgement.
+  *
+  * @param type MICROBIT_RADIO_ARQ_TYPE_DATA or MICROBIT_RADIO_ARQ_TYPE_ACK.
+  *
+  * @param destination The address the frame is for.
+  *
+  * @param seqNo The sequence number of the datagram.
+  *
+  * @param payload The datagram contents, or NULL for an acknowledgement.
+  *
+  * @param len The length of the payload.
+  *
+  * @return DEVICE_OK on success, or the error returned by MicroBitRadio::send().
+  */
+int MicroBitRadioDatagram::sendArqFrame(uint8_t type, uint16_t destination, uint8_t seqNo, uint8_t *payload, int len)
+{
+    FrameBuffer buf;
+
+    buf.length = MICROBIT_RADIO_ARQ_HEADER_SIZE + len + MICROBIT_RADIO_HEADER_SIZE - 1;
+    buf.version = 1;
+    buf.group = 0;
+    buf.protocol = MICROBIT_RADIO_PROTOCOL_DATAGRAM_ARQ;
+    buf.payload[0] = type;
+    buf.payload[1] = address & 0xFF;
+    buf.payload[2] = address >> 8;
+    buf.payload[3] = destination & 0xFF;
+    buf.payload[4] = destination >> 8;
+    buf.payload[5] = seqNo;
+
+    if (len)
+        memcpy(&buf.payload[MICROBIT_RADIO_ARQ_HEADER_SIZE], payload, len);
+
+    return radio.send(&buf);
+}
+
+/**
+  * Transmits the given buffer to a single micro:bit, retransmitting it until it is acknowledged.
+  *
+  * Up to MICROBIT_RADIO_ARQ_WINDOW datagrams may be outstanding to each destination. Retransmissions back off
+  * exponentially. Once the datagram is acknowledged, a MICROBIT_RADIO_ID_DATAGRAM_DELIVERED event is raised,
+  * or if MICROBIT_RADIO_ARQ_MAX_RETRIES retransmissions go unacknowledged, a MICROBIT_RADIO_ID_DATAGRAM_FAILED event.
+  * In either case, the event value is the ticket returned by this call. The datagram is received through recv() as usual.
+  *
+  * @param destination The address of the recipient, as returned by its getAddress().
+  *
+  * @param buffer The packet contents to transmit.
+  *
+  * @param len The number of bytes to transmit, up to MICROBIT_RADIO_ARQ_MAX_PAYLOAD.
+  *
+  * @return A positive ticket identifying the datagram on success, DEVICE_INVALID_PARAMETER if the parameters are invalid,
+  *         or DEVICE_NO_RESOURCES if too many datagrams are already outstanding.
+  */
+int MicroBitRadioDatagram::sendReliable(uint16_t destination, uint8_t *buffer, int len)
+{
+    if (buffer == NULL || len < 0 || len > MICROBIT_RADIO_ARQ_MAX_PAYLOAD || destination == 0 || destination == address)
+        return DEVICE_INVALID_PARAMETER;
+
+    RadioArqSlot *slot = NULL;
+    int outstanding = 0;
+
+    for (int i = 0; i < MICROBIT_RADIO_ARQ_TX_SLOTS; i++)
+    {
+        if (arqSlots[i].ticket == 0)
+        {
+            if (slot == NULL)
+                slot = &arqSlots[i];
+        }
+        else if (arqSlots[i].destination == destination)
+        {
+            outstanding++;
+        }
+    }
+
+    if (slot == NULL || outstanding >= MICROBIT_RADIO_ARQ_WINDOW)
+        return DEVICE_NO_RESOURCES;
+
+    if (!arqListening && EventModel::defaultEventBus)
+    {
+        EventModel::defaultEventBus->listen(MICROBIT_ID_RADIO_INTERNAL, MICROBIT_RADIO_EVT_ARQ_TIMER, this, &MicroBitRadioDatagram::onArqTimer);
+        arqListening = true;
+    }
+
+    RadioArqPeer *peer = getPeer(destination);
+
+    slot->ticket = nextTicket;
+    slot->destination = destination;
+    slot->seqNo = ++peer->txSeqNo;
+    slot->retries = 0;
+    slot->length = len;
+    slot->deadline = system_timer_current_time() + MICROBIT_RADIO_ARQ_TIMEOUT_MS;
+    memcpy(slot->payload, buffer, len);
+
+    // Tickets double as event values, so never issue zero (MICROBIT_EVT_ANY).
+    if (++nextTicket == 0)
+        nextTicket = 1;
+
+    sendArqFrame(MICROBIT_RADIO_ARQ_TYPE_DATA, destination, slot->seqNo, slot->payload, len);
+
+    system_timer_cancel_event(MICROBIT_ID_RADIO_INTERNAL, MICROBIT_RADIO_EVT_ARQ_TIMER);
+    system_timer_event_after(MICROBIT_RADIO_ARQ_TIMEOUT_MS / 2, MICROBIT_ID_RADIO_INTERNAL, MICROBIT_RADIO_EVT_ARQ_TIMER);
+
+    return slot->ticket;
+}
+
+/**
+  * Event handler, called periodically whilst datagrams await acknowledgement, to retransmit them.
+  */
+void MicroBitRadioDatagram::onArqTimer(Event)
+{
+    CODAL_TIMESTAMP now = system_timer_current_time();
+    bool pending = false;
+
+    for (int i = 0; i < MICROBIT_RADIO_ARQ_TX_SLOTS; i++)
     {
-        FrameBuffer *p = rxQueue;
-        while (p->next != NULL)
+        RadioArqSlot *slot = &arqSlots[i];
+
+        if (slot->ticket == 0)
+            continue;
+
+        if (now >= slot->deadline)
         {
-            p = p->next;
-            queueDepth++;
+            if (slot->retries >= MICROBIT_RADIO_ARQ_MAX_RETRIES)
+            {
+                uint16_t ticket = slot->ticket;
+                slot->ticket = 0;
+
+                radio.reportDelivery(0, slot->retries + 1);
+
+                Event(MICROBIT_RADIO_ID_DATAGRAM_FAILED, ticket);
+                continue;
+            }
+
+            // Back off exponentially, with some jitter so that competing senders drift apart.
+            slot->retries++;
+            slot->deadline = now + (MICROBIT_RADIO_ARQ_TIMEOUT_MS << slot->retries) + microbit_random_range(MICROBIT_RANDOM_STREAM_RADIO, MICROBIT_RADIO_ARQ_TIMEOUT_MS);
+
+            sendArqFrame(MICROBIT_RADIO_ARQ_TYPE_DATA, slot->destination, slot->seqNo, slot->payload, slot->length);
         }
 
-        if (queueDepth >= MICROBIT_RADIO_MAXIMUM_RX_BUFFERS)
+        pending = true;
+    }
+
+    if (pending)
+        system_timer_event_after(MICROBIT_RADIO_ARQ_TIMEOUT_MS / 2, MICROBIT_ID_RADIO_INTERNAL, MICROBIT_RADIO_EVT_ARQ_TIMER);
+}
+
+/**
+  * Protocol handler callback. This is called when the radio receives a reliable datagram or an acknowledgement.
+  *
+  * Datagrams addressed to us are acknowledged, and unless they are duplicates, queued for user reception.
+  */
+void MicroBitRadioDatagram::reliableReceived()
+{
+    FrameBuffer *p = radio.peek();
+    int len = p->length - (MICROBIT_RADIO_HEADER_SIZE - 1) - MICROBIT_RADIO_ARQ_HEADER_SIZE;
+    uint8_t type = p->payload[0];
+    uint16_t source = p->payload[1] | (p->payload[2] << 8);
+    uint16_t destination = p->payload[3] | (p->payload[4] << 8);
+    uint8_t seqNo = p->payload[5];
+
+    if (len < 0 || len > MICROBIT_RADIO_ARQ_MAX_PAYLOAD || destination != address || source == 0)
+    {
+        radio.release();
+        return;
+    }
+
+    if (type == MICROBIT_RADIO_ARQ_TYPE_ACK)
+    {
+        int rssi = (int8_t) p->rssi;
+        radio.release();
+
+        for (int i = 0; i < MICROBIT_RADIO_ARQ_TX_SLOTS; i++)
         {
-            delete packet;
-            return;
+            if (arqSlots[i].ticket && arqSlots[i].destination == source && arqSlots[i].seqNo == seqNo)
+            {
+                uint16_t ticket = arqSlots[i].ticket;
+                arqSlots[i].ticket = 0;
+
+                // Every retransmission before this one was lost.
+                radio.reportDelivery(1, arqSlots[i].retries, rssi);
+
+                Event(MICROBIT_RADIO_ID_DATAGRAM_DELIVERED, ticket);
+                break;
+            }
         }
 
-        p->next = packet;
+        return;
     }
 
-    Event(DEVICE_ID_RADIO, MICROBIT_RADIO_EVT_DATAGRAM);
+    if (type != MICROBIT_RADIO_ARQ_TYPE_DATA)
+    {
+        radio.release();
+        return;
+    }
+
+    // Determine if we've seen this datagram before, using a sliding window of recent sequence numbers.
+    RadioArqPeer *peer = getPeer(source);
+    int8_t age = (int8_t)(peer->rxSeqNo - seqNo);
+    bool duplicate = false;
+
+    if (age < 0 || age >= 32 || peer->rxSeen == 0)
+    {
+        // Newer than anything seen, or too old to judge (in which case the peer has most likely restarted).
+        peer->rxSeen = (age < 0 && -age < 32 && peer->rxSeen) ? (peer->rxSeen << -age) | 1 : 1;
+        peer->rxSeqNo = seqNo;
+    }
+    else
+    {
+        duplicate = (peer->rxSeen & (1UL << age)) != 0;
+        peer->rxSeen |= (1UL << age);
+    }
+
+    // Present the datagram to recv() just as any other.
+    PacketData *packet = duplicate ? NULL : PacketBuffer::allocate(&p->payload[MICROBIT_RADIO_ARQ_HEADER_SIZE], len, p->rssi);
+
+    radio.release();
+
+    // Always acknowledge, as a duplicate means our last acknowledgement was lost.
+    sendArqFrame(MICROBIT_RADIO_ARQ_TYPE_ACK, source, seqNo, NULL, 0);
+
+    if (packet)
+        queuePacket(packet);
 }
@@ -24,6 +24,8 @@ DEALINGS IN THE SOFTWARE.
 */
 
 #include "MicroBitRadio.h"
+#include "EventModel.h"
+#include "Timer.h"
 
 using namespace codal;
 
@@ -52,6 +54,10 @@ using namespace codal;
 MicroBitRadioEvent::MicroBitRadioEvent(MicroBitRadio &r) : radio(r)
 {
     this->suppressForwarding = false;
+    this->batchInterval = 0;
+    this->coalesce = false;
+    this->batchCount = 0;
+    this->batchDropped = 0;
 }
 
 /**
@@ -137,6 +143,110 @@ int MicroBitRadioEvent::ignore(uint16_t id, uint16_t value, EventModel &eventBus
 }
 
 
+/**
+  * Enables or disables batching of forwarded events. Normally, every event forwarded costs a radio frame of its own,
+  * sent synchronously as the event is raised. When batching is enabled, events are instead collected and sent several
+  * to a frame, when the frame is full or once the oldest has waited for the given interval. Only the id and value
+  * of each event are carried.
+  *
+  * @param interval The longest time, in milliseconds, an event may be held awaiting others. Zero disables batching,
+  *        and sends any events already held.
+  *
+  * @param coalesce If true, an event replaces any held event with the same id, so only the latest value of each is sent.
+  *
+  * @return DEVICE_OK on success.
+  */
+int MicroBitRadioEvent::setBatching(uint32_t interval, bool coalesce)
+{
+    if (interval && batchInterval == 0 && EventModel::defaultEventBus)
+        EventModel::defaultEventBus->listen(MICROBIT_ID_RADIO_INTERNAL, MICROBIT_RADIO_EVT_EVENT_FLUSH, this, &MicroBitRadioEvent::onFlushDeadline);
+
+    if (interval == 0 && batchInterval && EventModel::defaultEventBus)
+        EventModel::defaultEventBus->ignore(MICROBIT_ID_RADIO_INTERNAL, MICROBIT_RADIO_EVT_EVENT_FLUSH, this, &MicroBitRadioEvent::onFlushDeadline);
+
+    this->batchInterval = interval;
+    this->coalesce = coalesce;
+
+    if (interval == 0)
+        flush();
+
+    return DEVICE_OK;
+}
+
+/**
+  * Sends any batched events immediately.
+  *
+  * @return DEVICE_OK on success, or the error returned by MicroBitRadio::send().
+  */
+int MicroBitRadioEvent::flush()
+{
+    FrameBuffer buf;
+
+    // Events may be added from interrupt context, so take the batch atomically.
+    target_disable_irq();
+
+    int count = batchCount;
+    memcpy(buf.payload, batch, count * MICROBIT_RADIO_EVENT_BATCH_ITEM_SIZE);
+    batchCount = 0;
+
+    target_enable_irq();
+
+    system_timer_cancel_event(MICROBIT_ID_RADIO_INTERNAL, MICROBIT_RADIO_EVT_EVENT_FLUSH);
+
+    if (count == 0)
+        return DEVICE_OK;
+
+    buf.length = count * MICROBIT_RADIO_EVENT_BATCH_ITEM_SIZE + MICROBIT_RADIO_HEADER_SIZE - 1;
+    buf.version = 1;
+    buf.group = 0;
+    buf.protocol = MICROBIT_RADIO_PROTOCOL_EVENTBUS_BATCH;
+
+    return radio.send(&buf);
+}
+
+/**
+  * Determines how many events have been discarded because they were raised while the batch was full and
+  * awaiting transmission.
+  *
+  * @return The number of events dropped since this MicroBitRadioEvent was created.
+  */
+uint32_t MicroBitRadioEvent::getDroppedEvents()
+{
+    return batchDropped;
+}
+
+/**
+  * Event handler, called when batched events have waited for the configured interval.
+  */
+void MicroBitRadioEvent::onFlushDeadline(Event)
+{
+    flush();
+}
+
+/**
+  * Protocol handler callback. This is called when the radio receives a packet containing a batch of events.
+  *
+  * This function fires each event contained inside onto the default EventModel.
+  */
+void MicroBitRadioEvent::batchReceived()
+{
+    // Take a copy of the events, and hand the buffer straight back to the radio.
+    FrameBuffer *p = radio.peek();
+    uint16_t events[MICROBIT_RADIO_EVENT_BATCH_SIZE * 2];
+    int len = p->length - (MICROBIT_RADIO_HEADER_SIZE - 1);
+    int count = (len < MICROBIT_RADIO_MAX_PACKET_SIZE ? len : MICROBIT_RADIO_MAX_PACKET_SIZE) / MICROBIT_RADIO_EVENT_BATCH_ITEM_SIZE;
+
+    memcpy(events, p->payload, count * MICROBIT_RADIO_EVENT_BATCH_ITEM_SIZE);
+    radio.release();
+
+    suppressForwarding = true;
+
+    for (int i = 0; i < count; i++)
+        Event e(events[2*i], events[2*i+1]);
+
+    suppressForwarding = false;
+}
+
 /**
   * Protocol handler callback. This is called when the radio receives a packet marked as using the event protocol.
   *
@@ -144,14 +254,16 @@ int MicroBitRadioEvent::ignore(uint16_t id, uint16_t value, EventModel &eventBus
   */
 void MicroBitRadioEvent::packetReceived()
 {
-    FrameBuffer *p = radio.recv();
-    Event *e = (Event *) p->payload;
+    // Take a copy of the event, and hand the buffer straight back to the radio.
+    FrameBuffer *p = radio.peek();
+    Event e;
+
+    memcpy(&e, p->payload, sizeof(Event));
+    radio.release();
 
     suppressForwarding = true;
-    e->fire();
+    e.fire();
     suppressForwarding = false;
-
-    delete p;
 }
 
 /**
@@ -164,6 +276,56 @@ void MicroBitRadioEvent::eventReceived(Event e)
     if(suppressForwarding)
         return;
 
+    if (batchInterval)
+    {
+        bool full = false;
+        bool first;
+
+        target_disable_irq();
+
+        int i = 0;
+
+        // When coalescing, the latest value of an event replaces any still waiting to be sent.
+        if (coalesce)
+            while (i < batchCount && batch[2*i] != e.source)
+                i++;
+        else
+            i = batchCount;
+
+        first = batchCount == 0;
+
+        // A full batch stays full until the flush fiber takes it, so anything new in the meantime is dropped.
+        if (i == batchCount && batchCount >= MICROBIT_RADIO_EVENT_BATCH_SIZE)
+        {
+            batchDropped++;
+            target_enable_irq();
+            return;
+        }
+
+        if (i == batchCount)
+        {
+            batchCount++;
+            full = batchCount == MICROBIT_RADIO_EVENT_BATCH_SIZE;
+        }
+
+        batch[2*i] = e.source;
+        batch[2*i+1] = e.value;
+
+        target_enable_irq();
+
+        // This listener is immediate, and may run in interrupt context, so never send from here.
+        // Hand a full batch to the flush handler, which runs on its own fiber.
+        if (full)
+        {
+            system_timer_cancel_event(MICROBIT_ID_RADIO_INTERNAL, MICROBIT_RADIO_EVT_EVENT_FLUSH);
+            Event(MICROBIT_ID_RADIO_INTERNAL, MICROBIT_RADIO_EVT_EVENT_FLUSH);
+        }
+        else if (first)
+            system_timer_event_after(batchInterval, MICROBIT_ID_RADIO_INTERNAL, MICROBIT_RADIO_EVT_EVENT_FLUSH);
+
+        return;
+    }
+
     FrameBuffer buf;
 
     buf.length = sizeof(Event) + MICROBIT_RADIO_HEADER_SIZE - 1;
@@ -0,0 +1,295 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 British Broadcasting Corporation.
+This software is provided by Lancaster University by arrangement with the BBC.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "MicroBitRadioFramePool.h"
+#include "MicroBitRadio.h"
+#include "MicroBitMeshRadio.h"
+#include "MicroBitHeapStats.h"
+#include <stddef.h>
+
+using namespace codal;
+
+/**
+ * A fixed capacity pool of blocks in two size classes, from which FrameBuffer and SequencedFrameBuffer objects are allocated.
+ *
+ * Radio frames are allocated and freed at a high rate, often in interrupt context. Taking them from a pool
+ * rather than the general heap makes allocation O(1) and safe from interrupt context, and prevents the heap from
+ * fragmenting over time.
+ *
+ * Full sized blocks hold a frame of the largest packet size. Frames that are queued once received are cloned into
+ * a block just large enough for their length, so that a large maximum packet size costs RAM only for the frames that use it.
+ */
+
+// Every block is large enough for the largest frame type, rounded up to keep blocks word aligned.
+#define FRAME_POOL_BLOCK_SIZE       (((sizeof(SequencedFrameBuffer) > sizeof(FrameBuffer) ? sizeof(SequencedFrameBuffer) : sizeof(FrameBuffer)) + 7) & ~7)
+
+// Small blocks hold the header of the largest frame type, and a short payload.
+#define FRAME_POOL_SMALL_BLOCK_SIZE ((offsetof(SequencedFrameBuffer, payload) + MICROBIT_RADIO_FRAME_POOL_SMALL_PAYLOAD + 7) & ~7)
+
+// The small blocks follow the full sized blocks, in the same allocation.
+#define FRAME_POOL_SMALL_OFFSET     (MICROBIT_RADIO_FRAME_POOL_SIZE * FRAME_POOL_BLOCK_SIZE)
+#define FRAME_POOL_STORAGE_SIZE     (FRAME_POOL_SMALL_OFFSET + MICROBIT_RADIO_FRAME_POOL_SMALL_SIZE * FRAME_POOL_SMALL_BLOCK_SIZE)
+
+struct FramePoolBlock
+{
+    FramePoolBlock  *next;                          // Linkage, whilst the block is free.
+};
+
+static uint8_t *pool = NULL;                        // Storage for all blocks, allocated on first use.
+static FramePoolBlock *freeList = NULL;             // The full sized blocks currently available.
+static FramePoolBlock *smallFreeList = NULL;        // The small blocks currently available.
+static RadioFramePoolStats poolStats = {MICROBIT_RADIO_FRAME_POOL_SIZE, 0, 0, MICROBIT_RADIO_FRAME_POOL_SMALL_SIZE, 0, 0, 0};
+
+/**
+  * Allocates a block from the pool.
+  *
+  * @param size The size of the object to be held, which may be no larger than the largest radio frame.
+  *
+  * @return A pointer to the block, or NULL if the pool is exhausted or the size too large.
+  *
+  * @note A small block is used if the size allows and one is free, and a full sized block otherwise.
+  */
+void *MicroBitRadioFramePool::allocate(size_t size)
+{
+    if (size > FRAME_POOL_BLOCK_SIZE)
+        return NULL;
+
+    // Reserve storage for the whole pool in one go, so the heap sees a single long lived allocation.
+    // This happens in thread context, as the radios allocate their first frame when enabled.
+    if (pool == NULL)
+    {
+        uint8_t *storage = (uint8_t *) malloc(FRAME_POOL_STORAGE_SIZE);
+
+        if (storage == NULL)
+            return NULL;
+
+        MICROBIT_HEAP_TRACK(MICROBIT_HEAP_TAG_RADIO, storage);
+
+        for (int i = MICROBIT_RADIO_FRAME_POOL_SIZE - 1; i >= 0; i--)
+        {
+            FramePoolBlock *b = (FramePoolBlock *) &storage[i * FRAME_POOL_BLOCK_SIZE];
+            b->next = freeList;
+            freeList = b;
+        }
+
+        for (int i = MICROBIT_RADIO_FRAME_POOL_SMALL_SIZE - 1; i >= 0; i--)
+        {
+            FramePoolBlock *b = (FramePoolBlock *) &storage[FRAME_POOL_SMALL_OFFSET + i * FRAME_POOL_SMALL_BLOCK_SIZE];
+            b->next = smallFreeList;
+            smallFreeList = b;
+        }
+
+        pool = storage;
+    }
+
+    target_disable_irq();
+
+    FramePoolBlock *b = NULL;
+
+    if (size <= FRAME_POOL_SMALL_BLOCK_SIZE && smallFreeList)
+    {
+        b = smallFreeList;
+        smallFreeList = b->next;
+
+        poolStats.smallInUse++;
+        if (poolStats.smallInUse > poolStats.smallHighWater)
+            poolStats.smallHighWater = poolStats.smallInUse;
+    }
+    else if (freeList)
+    {
+        b = freeList;
+        freeList = b->next;
+
+        poolStats.inUse++;
+        if (poolStats.inUse > poolStats.highWater)
+            poolStats.highWater = poolStats.inUse;
+    }
+    else
+    {
+        poolStats.failures++;
+    }
+
+    target_enable_irq();
+
+    return b;
+}
+
+/**
+  * Allocates a small block from the pool, for use by storage other than radio frames, such as PacketBuffer.
+  *
+  * @param size The size of the object to be held.
+  *
+  * @return A pointer to the block, or NULL if the size is too large, no small block is free or the pool is not yet in use.
+  *
+  * @note Unlike allocate(), this never reserves the pool's storage, never takes a full sized block and is not counted
+  *       as a failure when refused, so callers are expected to fall back to the heap.
+  */
+void *MicroBitRadioFramePool::allocateSmall(size_t size)
+{
+    if (pool == NULL || size > FRAME_POOL_SMALL_BLOCK_SIZE)
+        return NULL;
+
+    target_disable_irq();
+
+    FramePoolBlock *b = smallFreeList;
+
+    if (b)
+    {
+        smallFreeList = b->next;
+
+        poolStats.smallInUse++;
+        if (poolStats.smallInUse > poolStats.smallHighWater)
+            poolStats.smallHighWater = poolStats.smallInUse;
+    }
+
+    target_enable_irq();
+
+    return b;
+}
+
+/**
+  * Determines if a block of memory was allocated from the pool.
+  *
+  * @param block The memory to test.
+  *
+  * @return true if the memory lies within the pool, false otherwise.
+  */
+bool MicroBitRadioFramePool::contains(const void *block)
+{
+    return pool != NULL && (const uint8_t *) block >= pool && (const uint8_t *) block < pool + FRAME_POOL_STORAGE_SIZE;
+}
+
+/**
+  * Returns a block to the pool.
+  *
+  * @param block A block previously returned by allocate(), or NULL.
+  */
+void MicroBitRadioFramePool::release(void *block)
+{
+    if (block == NULL)
+        return;
+
+    FramePoolBlock *b = (FramePoolBlock *) block;
+
+    target_disable_irq();
+
+    // The size class of a block is given by where it lies in the pool.
+    if ((uint8_t *) block >= pool + FRAME_POOL_SMALL_OFFSET)
+    {
+        b->next = smallFreeList;
+        smallFreeList = b;
+        poolStats.smallInUse--;
+    }
+    else
+    {
+        b->next = freeList;
+        freeList = b;
+        poolStats.inUse--;
+    }
+
+    target_enable_irq();
+}
+
+/**
+  * Copies a frame into a block trimmed to its length. The payload beyond the length is not copied, and must not be used.
+  *
+  * @param frame The frame to copy.
+  *
+  * @return The copy, to be released with delete, or NULL if the pool is exhausted.
+  */
+FrameBuffer *MicroBitRadioFramePool::clone(const FrameBuffer *frame)
+{
+    size_t size = offsetof(FrameBuffer, length) + frame->length + 1;
+
+    if (size > sizeof(FrameBuffer))
+        size = sizeof(FrameBuffer);
+
+    FrameBuffer *copy = (FrameBuffer *) allocate(size);
+
+    if (copy)
+        memcpy(copy, frame, size);
+
+    return copy;
+}
+
+/**
+  * Copies a frame into a block trimmed to its length. The payload beyond the length is not copied, and must not be used.
+  *
+  * @param frame The frame to copy.
+  *
+  * @return The copy, to be released with delete, or NULL if the pool is exhausted.
+  */
+SequencedFrameBuffer *MicroBitRadioFramePool::clone(const SequencedFrameBuffer *frame)
+{
+    size_t size = offsetof(SequencedFrameBuffer, length) + frame->length + 1;
+
+    if (size > sizeof(SequencedFrameBuffer))
+        size = sizeof(SequencedFrameBuffer);
+
+    SequencedFrameBuffer *copy = (SequencedFrameBuffer *) allocate(size);
+
+    if (copy)
+        memcpy(copy, frame, size);
+
+    return copy;
+}
+
+/**
+  * Retrieves the usage statistics of the pool.
+  *
+  * @param stats The structure to fill in.
+  */
+void MicroBitRadioFramePool::getStats(RadioFramePoolStats &stats)
+{
+    target_disable_irq();
+    stats = poolStats;
+    target_enable_irq();
+}
+
+/**
+  * FrameBuffers are allocated from the MicroBitRadioFramePool. On exhaustion, new returns NULL.
+  */
+void *FrameBuffer::operator new(size_t size) noexcept
+{
+    return MicroBitRadioFramePool::allocate(size);
+}
+
+void FrameBuffer::operator delete(void *p)
+{
+    MicroBitRadioFramePool::release(p);
+}
+
+/**
+  * SequencedFrameBuffers are allocated from the MicroBitRadioFramePool. On exhaustion, new returns NULL.
+  */
+void *SequencedFrameBuffer::operator new(size_t size) noexcept
+{
+    return MicroBitRadioFramePool::allocate(size);
+}
+
+void SequencedFrameBuffer::operator delete(void *p)
+{
+    MicroBitRadioFramePool::release(p);
+}
@@ -0,0 +1,319 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 British Broadcasting Corporation.
+This software is provided by Lancaster University by arrangement with the BBC.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "MicroBitConfig.h"
+#include "MicroBitRadioHopping.h"
+#include "ErrorNo.h"
+
+using namespace codal;
+
+/**
+  * Constructor.
+  *
+  * Creates an empty schedule, with hopping disabled.
+  */
+MicroBitRadioHopping::MicroBitRadioHopping()
+{
+    setChannels(NULL, 0, 0);
+}
+
+/**
+  * Configures the channels to hop across. Any statistics and blacklist are reset.
+  *
+  * @param list The frequency bands to use, each in the range 0 - 100, or NULL to disable hopping.
+  *
+  * @param n The number of channels in the list, up to MICROBIT_RADIO_HOPPING_MAX_CHANNELS.
+  *
+  * @param group The radio group, used to derive the hopping order.
+  *
+  * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the list is invalid.
+  */
+int MicroBitRadioHopping::setChannels(const uint8_t *list, int n, uint8_t group)
+{
+    if (n < 0 || n > MICROBIT_RADIO_HOPPING_MAX_CHANNELS || (n > 0 && list == NULL))
+        return DEVICE_INVALID_PARAMETER;
+
+    for (int i = 0; i < n; i++)
+    {
+        if (list[i] > 100)
+            return DEVICE_INVALID_PARAMETER;
+
+        // Each channel may only appear once, so that a channel identifies its place in the sequence.
+        for (int j = 0; j < i; j++)
+            if (list[j] == list[i])
+                return DEVICE_INVALID_PARAMETER;
+    }
+
+    memcpy(channels, list, n);
+    count = n;
+
+    setGroup(group);
+
+    return DEVICE_OK;
+}
+
+/**
+  * Derives the hopping order for the given radio group. Any statistics and blacklist are reset.
+  *
+  * @param group The radio group.
+  */
+void MicroBitRadioHopping::setGroup(uint8_t group)
+{
+    memcpy(sequence, channels, count);
+    blacklist = 0;
+    pending = 0;
+    epoch = 0;
+
+    memset(penalty, 0, sizeof(penalty));
+    memset(sampled, 0, sizeof(sampled));
+    memset(corrupt, 0, sizeof(corrupt));
+    memset(received, 0, sizeof(received));
+    memset(errors, 0, sizeof(errors));
+
+    // Shuffle the list, using a simple generator seeded by the group so that every member reaches the same order.
+    uint32_t seed = 0x1234567 + group;
+
+    for (int i = count - 1; i > 0; i--)
+    {
+        seed = seed * 1103515245 + 12345;
+        int j = (seed >> 16) % (i + 1);
+
+        uint8_t t = sequence[i];
+        sequence[i] = sequence[j];
+        sequence[j] = t;
+    }
+}
+
+/**
+  * Determines if hopping is enabled.
+  *
+  * @return true if a channel list has been configured, false otherwise.
+  */
+bool MicroBitRadioHopping::isEnabled()
+{
+    return count > 0;
+}
+
+/**
+  * Determines the number of channels (and hence slots) in one pass through the schedule.
+  *
+  * @return The number of channels configured.
+  */
+int MicroBitRadioHopping::getChannelCount()
+{
+    return count;
+}
+
+/**
+  * Determines the channel to use in the given time slot, skipping any that are blacklisted.
+  *
+  * @param slot The time slot number.
+  *
+  * @return The frequency band to use.
+  */
+uint8_t MicroBitRadioHopping::getChannel(uint32_t slot)
+{
+    int position = slot % count;
+    uint32_t mask = slot / count >= epoch ? pending : blacklist;
+
+    // Hand the slot on to the next usable channel. Blacklisting always leaves at least one.
+    for (int i = 0; i < count; i++)
+    {
+        int p = (position + i) % count;
+
+        if (!(mask & (1 << p)))
+            return sequence[p];
+    }
+
+    return sequence[position];
+}
+
+/**
+  * Determines where in the sequence a given channel is visited, ignoring the blacklist.
+  *
+  * @param channel The frequency band.
+  *
+  * @return The position of the channel in the sequence, or -1 if it is not part of the schedule.
+  */
+int MicroBitRadioHopping::getPosition(uint8_t channel)
+{
+    for (int i = 0; i < count; i++)
+        if (sequence[i] == channel)
+            return i;
+
+    return -1;
+}
+
+/**
+  * Records the reception of a frame.
+  *
+  * @param channel The frequency band on which the frame was received.
+  *
+  * @param valid true if the frame passed its CRC check, false otherwise.
+  *
+  * @note may be called from interrupt context.
+  */
+void MicroBitRadioHopping::recordReceive(uint8_t channel, bool valid)
+{
+    int p = getPosition(channel);
+
+    if (p < 0)
+        return;
+
+    if (sampled[p] < 0xFFFF)
+        sampled[p]++;
+
+    if (valid)
+    {
+        received[p]++;
+    }
+    else
+    {
+        errors[p]++;
+
+        if (corrupt[p] < 0xFFFF)
+            corrupt[p]++;
+    }
+}
+
+/**
+  * Judges each channel on the frames heard since it was last judged, blacklisting those with excessive loss
+  * and rehabilitating those that have served their time. Should be called once per pass through the schedule,
+  * by the one device whose blacklist the others follow. Does nothing while an earlier change is yet to take effect.
+  *
+  * @param slot The current time slot number.
+  *
+  * @param delay The number of passes through the schedule before any change takes effect, at least
+  *        MICROBIT_RADIO_HOPPING_BLACKLIST_DELAY.
+  */
+void MicroBitRadioHopping::updateBlacklist(uint32_t slot, uint32_t delay)
+{
+    uint32_t pass = slot / count;
+
+    if (pass < epoch)
+        return;
+
+    uint32_t mask = pending;
+
+    for (int i = 0; i < count; i++)
+    {
+        if (mask & (1 << i))
+        {
+            if (penalty[i] > 0)
+                penalty[i]--;
+
+            if (penalty[i] == 0)
+                mask &= ~(1 << i);
+
+            continue;
+        }
+
+        if (sampled[i] < MICROBIT_RADIO_HOPPING_MIN_SAMPLES)
+            continue;
+
+        int usable = count - __builtin_popcount(mask);
+
+        if (corrupt[i] * 100 > sampled[i] * MICROBIT_RADIO_HOPPING_LOSS_THRESHOLD && usable > MICROBIT_RADIO_HOPPING_MIN_CHANNELS)
+        {
+            mask |= (1 << i);
+            penalty[i] = MICROBIT_RADIO_HOPPING_BLACKLIST_CYCLES;
+        }
+
+        sampled[i] = 0;
+        corrupt[i] = 0;
+    }
+
+    if (mask != pending)
+        setBlacklist(mask, pass + (delay > MICROBIT_RADIO_HOPPING_BLACKLIST_DELAY ? delay : MICROBIT_RADIO_HOPPING_BLACKLIST_DELAY));
+}
+
+/**
+  * Determines the most recently decided blacklist, which applies from getBlacklistEpoch().
+  *
+  * @return A bitmask, where bit n represents position n of the sequence.
+  */
+uint32_t MicroBitRadioHopping::getBlacklist()
+{
+    return pending;
+}
+
+/**
+  * Determines the pass through the schedule from which getBlacklist() applies.
+  *
+  * @return The pass number, being the slot number divided by getChannelCount().
+  */
+uint32_t MicroBitRadioHopping::getBlacklistEpoch()
+{
+    return epoch;
+}
+
+/**
+  * Adopts a blacklist determined elsewhere, for instance by the node coordinating a mesh.
+  *
+  * @param mask A bitmask, where bit n represents position n of the sequence.
+  *
+  * @param epoch The pass through the schedule from which the blacklist applies.
+  */
+void MicroBitRadioHopping::setBlacklist(uint32_t mask, uint32_t epoch)
+{
+    // Never accept a blacklist that leaves nothing to hop to.
+    mask &= (1 << count) - 1;
+
+    if (__builtin_popcount(mask) >= count || (mask == pending && epoch == this->epoch))
+        return;
+
+    // A new epoch is only decided once the last has passed, so the blacklist it replaces is already in effect.
+    // Switch to the new one in an order that never exposes the new mask before its epoch.
+    if (epoch != this->epoch)
+    {
+        blacklist = pending;
+        this->epoch = 0xFFFFFFFF;
+    }
+
+    pending = mask;
+    this->epoch = epoch;
+}
+
+/**
+  * Retrieves the reception statistics of a channel.
+  *
+  * @param position The position of the channel in the sequence, in the range 0 .. getChannelCount() - 1.
+  *
+  * @param stats The structure to fill in.
+  *
+  * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the position is out of range.
+  */
+int MicroBitRadioHopping::getStats(int position, RadioChannelStats &stats)
+{
+    if (position < 0 || position >= count)
+        return DEVICE_INVALID_PARAMETER;
+
+    stats.channel = sequence[position];
+    stats.blacklisted = (pending & (1 << position)) != 0;
+    stats.received = received[position];
+    stats.errors = errors[position];
+
+    return DEVICE_OK;
+}
@@ -0,0 +1,136 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 British Broadcasting Corporation.
+This software is provided by Lancaster University by arrangement with the BBC.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "MicroBitConfig.h"
+#include "MicroBitRadioPowerControl.h"
+#include "ErrorNo.h"
+
+using namespace codal;
+
+/**
+  * Constructor.
+  *
+  * Creates a loop that is disabled.
+  */
+MicroBitRadioPowerControl::MicroBitRadioPowerControl()
+{
+    enabled = false;
+    target = MICROBIT_RADIO_POWER_CONTROL_DEFAULT_TARGET;
+    maxLevel = 0;
+    reset();
+}
+
+/**
+  * Enables or disables the loop. Any observations gathered so far are discarded.
+  *
+  * @param enable true to enable the loop, false to disable it.
+  *
+  * @param target The percentage of transmission attempts that should succeed, in the range 1 - 100.
+  *
+  * @param maxLevel The highest power level the loop may choose.
+  *
+  * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the target is out of range.
+  */
+int MicroBitRadioPowerControl::configure(bool enable, int target, int maxLevel)
+{
+    if (target < 1 || target > 100 || maxLevel < 0)
+        return DEVICE_INVALID_PARAMETER;
+
+    this->enabled = enable;
+    this->target = target;
+    this->maxLevel = maxLevel;
+    reset();
+
+    return DEVICE_OK;
+}
+
+/**
+  * Discards any observations gathered so far, for instance when the set of peers changes.
+  */
+void MicroBitRadioPowerControl::reset()
+{
+    weakest = 0;
+    attempts = 0;
+    losses = 0;
+}
+
+/**
+  * Determines if the loop is active.
+  *
+  * @return true if enabled, false otherwise.
+  */
+bool MicroBitRadioPowerControl::isEnabled()
+{
+    return enabled;
+}
+
+/**
+  * Records the outcome of one or more transmission attempts, and determines the power level to use next.
+  *
+  * @param level The power level currently in use.
+  *
+  * @param delivered The number of attempts known to have succeeded.
+  *
+  * @param lost The number of attempts known to have failed.
+  *
+  * @param rssi The signal strength of the reply confirming delivery, in dBm, or zero if unknown.
+  *
+  * @return The power level to use, which is unchanged if the loop is disabled.
+  */
+int MicroBitRadioPowerControl::update(int level, int delivered, int lost, int rssi)
+{
+    if (!enabled || delivered < 0 || lost < 0)
+        return level;
+
+    attempts += delivered + lost;
+    losses += lost;
+
+    // Signal strength is tracked as a positive attenuation, where larger values are weaker.
+    if (rssi < 0 && -rssi > weakest)
+        weakest = -rssi;
+
+    // Nothing got through at all. Don't wait for the rest of the window to find out we're out of range.
+    if (delivered == 0 && lost > 0)
+    {
+        reset();
+        return level < maxLevel ? level + 1 : level;
+    }
+
+    if (attempts < MICROBIT_RADIO_POWER_CONTROL_WINDOW)
+        return level;
+
+    bool met = (uint32_t)(attempts - losses) * 100 >= (uint32_t)attempts * target;
+    bool margin = weakest != 0 && weakest < MICROBIT_RADIO_POWER_CONTROL_RSSI_THRESHOLD;
+
+    reset();
+
+    if (!met && level < maxLevel)
+        return level + 1;
+
+    if (met && margin && level > 0)
+        return level - 1;
+
+    return level;
+}
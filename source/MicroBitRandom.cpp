@@ -0,0 +1,176 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "MicroBitRandom.h"
+#include "MicroBitDevice.h"
+#include "codal_target_hal.h"
+#include "nrf.h"
+
+#ifdef SOFTDEVICE_PRESENT
+#include "nrf_soc.h"
+#endif
+
+using namespace codal;
+
+MicroBitRandomState codal::microbit_random_state[MICROBIT_RANDOM_STREAM_COUNT] = {
+    { { 0xBBC5EED0, 0x9E3779B9, 0x7F4A7C15, 0x85EBCA6B } },
+    { { 0xBBC5EED1, 0xC2B2AE35, 0x27D4EB2F, 0x165667B1 } },
+    { { 0xBBC5EED2, 0xD3A2646C, 0xFD7046C5, 0xB55A4F09 } },
+};
+
+#if CONFIG_MICROBIT_RANDOM_POOL_SIZE > 0
+static uint8_t entropy_pool[CONFIG_MICROBIT_RANDOM_POOL_SIZE];
+static volatile uint16_t entropy_count = 0;
+
+/**
+  * Starts the RNG refilling the entropy pool in the background, if it is not full and the RNG is ours to use.
+  */
+static void microbit_random_refill()
+{
+    if (entropy_count < CONFIG_MICROBIT_RANDOM_POOL_SIZE && !ble_running())
+    {
+        NRF_RNG->INTENSET = RNG_INTENSET_VALRDY_Msk;
+        NVIC_EnableIRQ(RNG_IRQn);
+        NRF_RNG->TASKS_START = 1;
+    }
+}
+
+extern "C" void RNG_IRQHandler(void)
+{
+    NRF_RNG->EVENTS_VALRDY = 0;
+
+    if (entropy_count < CONFIG_MICROBIT_RANDOM_POOL_SIZE)
+        entropy_pool[entropy_count++] = NRF_RNG->VALUE;
+
+    // Stop once full to save power, or if the SoftDevice has since taken the RNG for itself.
+    if (entropy_count >= CONFIG_MICROBIT_RANDOM_POOL_SIZE || ble_running())
+    {
+        NRF_RNG->TASKS_STOP = 1;
+        NRF_RNG->INTENCLR = RNG_INTENCLR_VALRDY_Msk;
+    }
+}
+#endif
+
+/**
+  * Reads a single byte from the RNG, waiting for it to be generated.
+  * Must only be used whilst Bluetooth is not running.
+  */
+static uint8_t microbit_random_hardware_byte()
+{
+    // Interrupts are disabled to keep the pool's interrupt handler from taking this value.
+    target_disable_irq();
+
+    bool running = NRF_RNG->INTENSET & RNG_INTENSET_VALRDY_Msk;
+
+    NRF_RNG->EVENTS_VALRDY = 0;
+    NRF_RNG->TASKS_START = 1;
+
+    while (NRF_RNG->EVENTS_VALRDY == 0);
+
+    uint8_t v = (uint8_t) NRF_RNG->VALUE;
+    NRF_RNG->EVENTS_VALRDY = 0;
+    NVIC_ClearPendingIRQ(RNG_IRQn);
+
+    // Leave the RNG running only if the pool is refilling. Otherwise disable it to save power.
+    if (!running)
+        NRF_RNG->TASKS_STOP = 1;
+
+    target_enable_irq();
+
+    return v;
+}
+
+/**
+  * Seeds every pseudo random stream from a single 32 bit value. Each stream is given a distinct state.
+  *
+  * @param seed The value to seed from.
+  */
+void codal::microbit_random_seed(uint32_t seed)
+{
+    // Expand the seed with splitmix32, which never yields an all zero state from consecutive outputs.
+    for (int i = 0; i < MICROBIT_RANDOM_STREAM_COUNT; i++)
+    {
+        for (int j = 0; j < 4; j++)
+        {
+            uint32_t z = (seed += 0x9E3779B9);
+            z = (z ^ (z >> 16)) * 0x85EBCA6B;
+            z = (z ^ (z >> 13)) * 0xC2B2AE35;
+            microbit_random_state[i].s[j] = z ^ (z >> 16);
+        }
+    }
+}
+
+/**
+  * Reads true random bytes from the hardware random number generator, via the entropy pool if one is
+  * configured, or the SoftDevice whilst Bluetooth is running.
+  *
+  * This is slow relative to the pseudo random streams, and intended for seeding and key generation.
+  *
+  * @param buffer The buffer to fill.
+  * @param len The number of bytes to read.
+  *
+  * @return The number of bytes read, which is less than len only if the entropy pool or SoftDevice has
+  * run short and is unable to supply them without blocking an interrupt handler.
+  */
+int codal::microbit_random_entropy(uint8_t *buffer, int len)
+{
+    int n = 0;
+
+#ifdef SOFTDEVICE_PRESENT
+    if (ble_running())
+    {
+        while (n < len)
+        {
+            uint8_t available = 0;
+            sd_rand_application_bytes_available_get(&available);
+
+            int chunk = available < len - n ? available : len - n;
+
+            if (chunk > 0 && sd_rand_application_vector_get(buffer + n, chunk) == NRF_SUCCESS)
+                n += chunk;
+            else if (__get_IPSR() != 0)
+                break;
+        }
+
+        return n;
+    }
+#endif
+
+#if CONFIG_MICROBIT_RANDOM_POOL_SIZE > 0
+    target_disable_irq();
+
+    while (n < len && entropy_count > 0)
+        buffer[n++] = entropy_pool[--entropy_count];
+
+    target_enable_irq();
+
+    if (entropy_count < CONFIG_MICROBIT_RANDOM_POOL_SIZE / 2)
+        microbit_random_refill();
+#endif
+
+    while (n < len)
+        buffer[n++] = microbit_random_hardware_byte();
+
+    return n;
+}
@@ -0,0 +1,304 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "MicroBitSchedulerTrace.h"
+#include "CodalDmesg.h"
+#include "ErrorNo.h"
+#include "Timer.h"
+#include "codal_target_hal.h"
+#include <string.h>
+
+using namespace codal;
+
+#if CONFIG_ENABLED(CONFIG_MICROBIT_SCHEDULER_TRACE)
+
+static MicroBitTraceRecord trace_buffer[CONFIG_MICROBIT_SCHEDULER_TRACE_SIZE];
+static uint32_t trace_count = 0;                                                  // Records written since the last reset.
+static MicroBitIdleStats idle_stats[CONFIG_MICROBIT_SCHEDULER_TRACE_COMPONENTS];
+static MicroBitSchedulerStats scheduler_stats;
+
+// Writes a line of the dump to the serial port, or to DMESG.
+#define TRACE_PRINT(fmt, ...) do { if (serial) serial->printf(fmt "\r\n", ##__VA_ARGS__); else DMESG(fmt, ##__VA_ARGS__); } while(0)
+
+/**
+  * Constructor. Starts timing.
+  *
+  * @param id The id of the component whose idle callback is being timed.
+  */
+MicroBitIdleTrace::MicroBitIdleTrace(uint16_t id)
+{
+    this->id = id;
+    this->start = (uint32_t) system_timer_current_time_us();
+}
+
+/**
+  * Destructor. Records the time taken.
+  */
+MicroBitIdleTrace::~MicroBitIdleTrace()
+{
+    uint32_t t = (uint32_t) system_timer_current_time_us() - start;
+    MicroBitIdleStats *s = NULL;
+
+    for (int i = 0; i < CONFIG_MICROBIT_SCHEDULER_TRACE_COMPONENTS && s == NULL; i++)
+    {
+        if (idle_stats[i].id == id || idle_stats[i].calls == 0)
+        {
+            s = &idle_stats[i];
+            s->id = id;
+        }
+    }
+
+    if (s)
+    {
+        s->calls++;
+        s->totalTime += t;
+
+        if (t > s->maxTime)
+            s->maxTime = t;
+    }
+
+    if (t >= CONFIG_MICROBIT_SCHEDULER_TRACE_THRESHOLD)
+        microbit_trace_record(MICROBIT_TRACE_IDLE_CALLBACK, id, start, t);
+}
+
+/**
+  * Adds a record to the trace buffer.
+  *
+  * @param type One of MICROBIT_TRACE_*.
+  * @param source The component or reason the record relates to.
+  * @param start The time the operation began, in microseconds since reset.
+  * @param value A duration in microseconds, or a count, as given by the type.
+  */
+void codal::microbit_trace_record(uint16_t type, uint16_t source, uint32_t start, uint32_t value)
+{
+    target_disable_irq();
+
+    MicroBitTraceRecord *r = &trace_buffer[trace_count % CONFIG_MICROBIT_SCHEDULER_TRACE_SIZE];
+    trace_count++;
+
+    r->time = start;
+    r->type = type;
+    r->source = source;
+    r->value = value;
+
+    target_enable_irq();
+}
+
+/**
+  * Records the outcome of a scheduler idle pass.
+  *
+  * @param reason One of MICROBIT_TRACE_WAIT_*.
+  * @param start The time the pass began waiting, in microseconds since reset.
+  */
+void codal::microbit_trace_wait(int reason, uint32_t start)
+{
+    uint32_t t = (uint32_t) system_timer_current_time_us() - start;
+
+    if (reason < 0 || reason >= MICROBIT_TRACE_WAIT_COUNT)
+        return;
+
+    scheduler_stats.waits[reason]++;
+    scheduler_stats.waitTime += t;
+
+    // A wait that returns within a few microseconds found an event already pending, so the processor never slept.
+    if (reason != MICROBIT_TRACE_WAIT_DEEPSLEEP && t < 10)
+        scheduler_stats.immediateWakes++;
+
+    // Only the exceptions are interesting enough to trace individually.
+    if (reason != MICROBIT_TRACE_WAIT_EVENT)
+        microbit_trace_record(MICROBIT_TRACE_WAIT, reason, start, t);
+}
+
+/**
+  * Records a sleeping fiber being scheduled.
+  *
+  * @param deadline The time the fiber asked to be woken, in microseconds since reset.
+  */
+void codal::microbit_trace_wake(uint32_t deadline)
+{
+    uint32_t now = (uint32_t) system_timer_current_time_us();
+    uint32_t late = (int32_t)(now - deadline) > 0 ? now - deadline : 0;
+
+    scheduler_stats.wakes++;
+    scheduler_stats.wakeLatencyTotal += late;
+
+    if (late > scheduler_stats.wakeLatencyMax)
+        scheduler_stats.wakeLatencyMax = late;
+
+    // Fibers are woken on a scheduler tick, so anything within a tick of the deadline is expected.
+    if (late > SCHEDULER_TICK_PERIOD_US)
+        microbit_trace_record(MICROBIT_TRACE_WAKE, 0, deadline, late);
+}
+
+/**
+  * Samples the depth of the event queue: the events held back by listeners that are still busy with an earlier one.
+  *
+  * @param bus The message bus to sample.
+  */
+void codal::microbit_trace_queue(MessageBus &bus)
+{
+    uint16_t busy = 0;
+    uint16_t queued = 0;
+
+    for (Listener *l = bus.elementAt(0); l != NULL; l = l->next)
+    {
+        if (l->flags & MESSAGE_BUS_LISTENER_BUSY)
+            busy++;
+
+        for (EventQueueItem *e = l->evt_queue; e != NULL; e = e->next)
+            queued++;
+    }
+
+    if (queued > scheduler_stats.queueDepth)
+    {
+        scheduler_stats.queueDepth = queued;
+        microbit_trace_record(MICROBIT_TRACE_QUEUE, busy, (uint32_t) system_timer_current_time_us(), queued);
+    }
+
+    if (busy > scheduler_stats.busyListeners)
+        scheduler_stats.busyListeners = busy;
+}
+
+/**
+  * Retrieves the idle callback summary of a component.
+  *
+  * @param n The index of the component, in order of its first idle callback.
+  *
+  * @return The summary, or NULL if n is out of range.
+  */
+MicroBitIdleStats *codal::microbit_trace_get_idle_stats(int n)
+{
+    if (n < 0 || n >= CONFIG_MICROBIT_SCHEDULER_TRACE_COMPONENTS || idle_stats[n].calls == 0)
+        return NULL;
+
+    return &idle_stats[n];
+}
+
+/**
+  * Retrieves the scheduler summary.
+  *
+  * @return The summary.
+  */
+MicroBitSchedulerStats *codal::microbit_trace_get_scheduler_stats()
+{
+    return &scheduler_stats;
+}
+
+/**
+  * Clears the trace buffer and all summaries.
+  */
+void codal::microbit_trace_reset()
+{
+    target_disable_irq();
+
+    trace_count = 0;
+    memset(idle_stats, 0, sizeof(idle_stats));
+    memset(&scheduler_stats, 0, sizeof(scheduler_stats));
+
+    target_enable_irq();
+}
+
+/**
+  * Writes the summaries and the trace buffer, oldest record first, to the given serial port or to DMESG.
+  *
+  * @param serial The serial port to write to, or NULL to write to DMESG.
+  *
+  * @return DEVICE_OK on success.
+  */
+int codal::microbit_trace_dump(Serial *serial)
+{
+    MicroBitSchedulerStats *s = &scheduler_stats;
+
+    for (int i = 0; i < CONFIG_MICROBIT_SCHEDULER_TRACE_COMPONENTS && idle_stats[i].calls; i++)
+    {
+        MicroBitIdleStats *c = &idle_stats[i];
+        TRACE_PRINT("TRACE idle id=%d calls=%d total_us=%d mean_us=%d max_us=%d", (int)c->id, (int)c->calls,
+            (int)c->totalTime, (int)(c->totalTime / c->calls), (int)c->maxTime);
+    }
+
+    TRACE_PRINT("TRACE sched wait=%d deepsleep=%d ble_connected=%d not_ready=%d immediate=%d wait_us=%d wakes=%d wake_mean_us=%d wake_max_us=%d queue_max=%d busy_max=%d",
+        (int)s->waits[MICROBIT_TRACE_WAIT_EVENT], (int)s->waits[MICROBIT_TRACE_WAIT_DEEPSLEEP], (int)s->waits[MICROBIT_TRACE_WAIT_BLE_CONNECTED],
+        (int)s->waits[MICROBIT_TRACE_WAIT_NOT_READY], (int)s->immediateWakes, (int)s->waitTime, (int)s->wakes,
+        s->wakes ? (int)(s->wakeLatencyTotal / s->wakes) : 0, (int)s->wakeLatencyMax, (int)s->queueDepth, (int)s->busyListeners);
+
+    uint32_t count = trace_count;
+    uint32_t first = count > CONFIG_MICROBIT_SCHEDULER_TRACE_SIZE ? count - CONFIG_MICROBIT_SCHEDULER_TRACE_SIZE : 0;
+
+    for (uint32_t i = first; i < count; i++)
+    {
+        MicroBitTraceRecord r = trace_buffer[i % CONFIG_MICROBIT_SCHEDULER_TRACE_SIZE];
+        TRACE_PRINT("TRACE t=%d type=%d source=%d value=%d", (int)r.time, (int)r.type, (int)r.source, (int)r.value);
+    }
+
+    return DEVICE_OK;
+}
+
+#else
+
+MicroBitIdleTrace::MicroBitIdleTrace(uint16_t id)
+{
+    this->id = id;
+    this->start = 0;
+}
+
+MicroBitIdleTrace::~MicroBitIdleTrace()
+{
+}
+
+void codal::microbit_trace_record(uint16_t, uint16_t, uint32_t, uint32_t)
+{
+}
+
+void codal::microbit_trace_wait(int, uint32_t)
+{
+}
+
+void codal::microbit_trace_wake(uint32_t)
+{
+}
+
+void codal::microbit_trace_queue(MessageBus &)
+{
+}
+
+MicroBitIdleStats *codal::microbit_trace_get_idle_stats(int)
+{
+    return NULL;
+}
+
+MicroBitSchedulerStats *codal::microbit_trace_get_scheduler_stats()
+{
+    return NULL;
+}
+
+void codal::microbit_trace_reset()
+{
+}
+
+int codal::microbit_trace_dump(Serial *)
+{
+    return DEVICE_NOT_SUPPORTED;
+}
+
+#endif
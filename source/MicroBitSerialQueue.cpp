@@ -0,0 +1,274 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "MicroBitSerialQueue.h"
+#include "MicroBitHeapStats.h"
+#include "MicroBitSchedulerTrace.h"
+#include "CodalFiber.h"
+#include "ErrorNo.h"
+#include "codal_target_hal.h"
+#include "nrf.h"
+#include <string.h>
+
+using namespace codal;
+
+/**
+  * Constructor.
+  *
+  * @param serial The serial port to send to.
+  */
+MicroBitSerialQueue::MicroBitSerialQueue(Serial &serial) : serial(serial)
+{
+    this->id = MICROBIT_ID_SERIAL_QUEUE;
+    this->buffer[0] = NULL;
+    this->buffer[1] = NULL;
+    this->length[0] = 0;
+    this->length[1] = 0;
+    this->sent = 0;
+    this->filling = 0;
+    this->dropped = 0;
+}
+
+/**
+  * Allocates the queue buffers, if this has not already been done.
+  *
+  * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if there is insufficient memory.
+  */
+int MicroBitSerialQueue::allocate()
+{
+    if (buffer[0])
+        return DEVICE_OK;
+
+    // Allocation is not safe in interrupt context, so DMESG output from an interrupt handler is never the first use.
+    if (__get_IPSR() != 0)
+        return DEVICE_NO_RESOURCES;
+
+    uint8_t *b = (uint8_t *) malloc(2 * CONFIG_MICROBIT_SERIAL_QUEUE_SIZE);
+
+    if (b == NULL)
+        return DEVICE_NO_RESOURCES;
+
+    MICROBIT_HEAP_TRACK(MICROBIT_HEAP_TAG_OTHER, b);
+
+    serial.setTxBufferSize(CONFIG_MICROBIT_SERIAL_QUEUE_SIZE > 255 ? 255 : CONFIG_MICROBIT_SERIAL_QUEUE_SIZE);
+
+    target_disable_irq();
+    buffer[1] = b + CONFIG_MICROBIT_SERIAL_QUEUE_SIZE;
+    buffer[0] = b;
+    target_enable_irq();
+
+    status |= DEVICE_COMPONENT_STATUS_IDLE_TICK;
+
+    return DEVICE_OK;
+}
+
+/**
+  * Appends data to the filling buffer, if there is room for all of it.
+  *
+  * @return DEVICE_OK on success, DEVICE_NO_RESOURCES if the data would not fit.
+  */
+int MicroBitSerialQueue::append(const uint8_t *data, int len, const uint8_t *tail, int tailLen)
+{
+    int result = DEVICE_OK;
+
+    if (allocate() != DEVICE_OK)
+    {
+        dropped += len + tailLen;
+        return DEVICE_NO_RESOURCES;
+    }
+
+    target_disable_irq();
+
+    uint8_t *b = buffer[filling];
+    uint16_t &l = length[filling];
+
+    if (l + len + tailLen <= CONFIG_MICROBIT_SERIAL_QUEUE_SIZE)
+    {
+        memcpy(b + l, data, len);
+        memcpy(b + l + len, tail, tailLen);
+        l += len + tailLen;
+    }
+    else
+    {
+        dropped += len + tailLen;
+        result = DEVICE_NO_RESOURCES;
+    }
+
+    target_enable_irq();
+
+    // The serial port can only be driven from thread context. Anything queued from an interrupt is sent when next idle.
+    if (__get_IPSR() == 0)
+        drain();
+
+    return result;
+}
+
+/**
+  * Queues data to be sent. Safe to call from interrupt context.
+  *
+  * @param data The data to send.
+  * @param len The number of bytes to send.
+  *
+  * @return len on success, DEVICE_INVALID_PARAMETER if data is NULL or len is negative, or DEVICE_NO_RESOURCES
+  * if the queue is full, in which case none of the data is queued.
+  */
+int MicroBitSerialQueue::send(const uint8_t *data, int len)
+{
+    if (data == NULL || len < 0)
+        return DEVICE_INVALID_PARAMETER;
+
+#if CONFIG_ENABLED(CONFIG_MICROBIT_SERIAL_QUEUE)
+    int result = append(data, len, NULL, 0);
+    return result == DEVICE_OK ? len : result;
+#else
+    return serial.send((uint8_t *)data, len);
+#endif
+}
+
+/**
+  * Queues a line of text to be sent, followed by a carriage return and line feed. The line and its
+  * terminator are queued, or dropped, together. Safe to call from interrupt context.
+  *
+  * @param data The line to send, without a terminator.
+  * @param len The number of bytes in the line.
+  *
+  * @return len + 2 on success, DEVICE_INVALID_PARAMETER if data is NULL or len is negative, or DEVICE_NO_RESOURCES
+  * if the queue is full, in which case none of the line is queued.
+  */
+int MicroBitSerialQueue::sendLine(const uint8_t *data, int len)
+{
+    if (data == NULL || len < 0)
+        return DEVICE_INVALID_PARAMETER;
+
+#if CONFIG_ENABLED(CONFIG_MICROBIT_SERIAL_QUEUE)
+    int result = append(data, len, (const uint8_t *)"\r\n", 2);
+    return result == DEVICE_OK ? len + 2 : result;
+#else
+    serial.send((uint8_t *)data, len);
+    serial.send((uint8_t *)"\r\n", 2);
+    return len + 2;
+#endif
+}
+
+/**
+  * Hands as much queued data as possible to the serial port. Called whenever data is queued from thread
+  * context, and when the scheduler is idle.
+  */
+void MicroBitSerialQueue::drain()
+{
+    // ASYNC sends never deschedule, but guard against re-entry from DMESG output within the serial driver.
+    if (buffer[0] == NULL || status & MICROBIT_SERIAL_QUEUE_STATUS_DRAINING)
+        return;
+
+    status |= MICROBIT_SERIAL_QUEUE_STATUS_DRAINING;
+
+    while (true)
+    {
+        int draining = filling ^ 1;
+
+        if (sent < length[draining])
+        {
+            int n = serial.send(buffer[draining] + sent, length[draining] - sent, ASYNC);
+
+            // The serial port's transmit buffer is full, or it is in use by another fiber. Try again later.
+            if (n <= 0)
+                break;
+
+            sent += n;
+
+            if (sent < length[draining])
+                break;
+        }
+
+        // The draining buffer is empty. Swap, if there is anything more to send.
+        target_disable_irq();
+
+        length[draining] = 0;
+        sent = 0;
+
+        bool more = length[filling] > 0;
+        if (more)
+            filling = draining;
+
+        target_enable_irq();
+
+        if (!more)
+            break;
+    }
+
+    status &= ~MICROBIT_SERIAL_QUEUE_STATUS_DRAINING;
+}
+
+/**
+  * Blocks the calling fiber until all queued data has been handed to the serial port.
+  */
+void MicroBitSerialQueue::flush()
+{
+    drain();
+
+    while (length[0] || length[1])
+    {
+        fiber_sleep(1);
+        drain();
+    }
+}
+
+/**
+  * Determines the number of bytes dropped because the queue was full, and resets the count.
+  *
+  * @return The number of bytes dropped since the last call.
+  */
+uint32_t MicroBitSerialQueue::getDropped()
+{
+    target_disable_irq();
+    uint32_t d = dropped;
+    dropped = 0;
+    target_enable_irq();
+
+    return d;
+}
+
+/**
+  * Drains the queue when the scheduler is idle.
+  */
+void MicroBitSerialQueue::idleCallback()
+{
+    MICROBIT_TRACE_IDLE(id);
+
+    drain();
+}
+
+/**
+  * Destructor.
+  */
+MicroBitSerialQueue::~MicroBitSerialQueue()
+{
+    status &= ~DEVICE_COMPONENT_STATUS_IDLE_TICK;
+
+    if (buffer[0])
+    {
+        MICROBIT_HEAP_UNTRACK(MICROBIT_HEAP_TAG_OTHER, buffer[0]);
+        free(buffer[0]);
+    }
+}
@@ -22,6 +22,7 @@ DEALINGS IN THE SOFTWARE.
 #include "MicroBitThermometer.h"
 #include "codal-core/inc/driver-models/Timer.h"
 #include "nrf.h"
+#include "MicroBitSchedulerTrace.h"
 
 #ifdef SOFTDEVICE_PRESENT
 #include "MicroBitDevice.h"
@@ -31,6 +32,8 @@ DEALINGS IN THE SOFTWARE.
 
 using namespace codal;
 
+MicroBitThermometer* MicroBitThermometer::instance = NULL;
+
 /*
  * The underlying Nordic libraries that support BLE do not compile cleanly with the stringent GCC settings we employ
  * If we're compiling under GCC, then we suppress any warnings generated from this code (but not the rest of the DAL)
@@ -55,6 +58,11 @@ MicroBitThermometer::MicroBitThermometer(uint16_t id)
     this->sampleTime = 0;
     this->offset = 0;
     this->temperature = 0;
+    this->accumulator = 0;
+    this->conversions = 0;
+    this->oversample = CONFIG_MICROBIT_THERMOMETER_OVERSAMPLE;
+
+    MicroBitThermometer::instance = this;
 }
 
 /**
@@ -88,7 +96,7 @@ int MicroBitThermometer::updateSample()
     status |= DEVICE_COMPONENT_STATUS_IDLE_TICK;
 
     // check if we need to update our sample...
-    if(isSampleNeeded())
+    if(isSampleNeeded() && !(status & MICROBIT_THERMOMETER_STATUS_CONVERTING))
     {
         int32_t processorTemperature = 0;
 
@@ -101,9 +109,25 @@ int MicroBitThermometer::updateSample()
         {
             // If Bluetooth is enabled, we need to go through the Nordic software to safely do this
             sd_temp_get(&processorTemperature);
+            recordSample(processorTemperature);
         }
         else
 #endif
+        if (status & MICROBIT_THERMOMETER_STATUS_VALID)
+        {
+            // We already have a reading to report, so start a conversion in the background rather than wait for it.
+            status |= MICROBIT_THERMOMETER_STATUS_CONVERTING;
+            accumulator = 0;
+            conversions = 0;
+
+            NRF_TEMP->EVENTS_DATARDY = 0;
+            NRF_TEMP->INTENSET = TEMP_INTENSET_DATARDY_Msk;
+            NVIC_ClearPendingIRQ(TEMP_IRQn);
+            NVIC_EnableIRQ(TEMP_IRQn);
+
+            NRF_TEMP->TASKS_START = 1;
+        }
+        else
         {
             // Othwerwise, we access the information directly...
             NRF_TEMP->TASKS_START = 1;
@@ -113,27 +137,74 @@ int MicroBitThermometer::updateSample()
             processorTemperature = NRF_TEMP->TEMP;
 
             NRF_TEMP->TASKS_STOP = 1;
-        }
 
+            recordSample(processorTemperature);
+        }
+    }
 
-        // Record our reading...
-        temperature = processorTemperature / 4;
+    return DEVICE_OK;
+};
 
-        // Schedule our next sample.
-        sampleTime = system_timer_current_time() + samplePeriod;
+/**
+  * Called when a background conversion completes. Starts another if oversampling,
+  * otherwise records the sample.
+  *
+  * @note should only be called from TEMP_IRQHandler...
+  */
+void MicroBitThermometer::conversionComplete()
+{
+    accumulator += (int32_t) NRF_TEMP->TEMP;
+    conversions++;
 
-        // Send an event to indicate that we'e updated our temperature.
-        Event e(id, MICROBIT_THERMOMETER_EVT_UPDATE);
+    if (conversions < oversample)
+    {
+        NRF_TEMP->TASKS_START = 1;
+        return;
     }
 
-    return DEVICE_OK;
-};
+    NRF_TEMP->TASKS_STOP = 1;
+    NRF_TEMP->INTENCLR = TEMP_INTENCLR_DATARDY_Msk;
+
+    status &= ~MICROBIT_THERMOMETER_STATUS_CONVERTING;
+    recordSample(accumulator / conversions);
+}
+
+/**
+  * Records a new sample, schedules the next and raises MICROBIT_THERMOMETER_EVT_UPDATE.
+  *
+  * @param value the sample, in quarters of a degree celsius.
+  */
+void MicroBitThermometer::recordSample(int32_t value)
+{
+    // Record our reading...
+    temperature = value / 4;
+    status |= MICROBIT_THERMOMETER_STATUS_VALID;
+
+    // Schedule our next sample.
+    sampleTime = system_timer_current_time() + samplePeriod;
+
+    // Send an event to indicate that we'e updated our temperature.
+    Event e(id, MICROBIT_THERMOMETER_EVT_UPDATE);
+}
+
+extern "C" void TEMP_IRQHandler(void)
+{
+    if (NRF_TEMP->EVENTS_DATARDY)
+    {
+        NRF_TEMP->EVENTS_DATARDY = 0;
+
+        if (MicroBitThermometer::instance)
+            MicroBitThermometer::instance->conversionComplete();
+    }
+}
 
 /**
   * Periodic callback from MicroBit idle thread.
   */
 void MicroBitThermometer::idleCallback()
 {
+    MICROBIT_TRACE_IDLE(CodalComponent::id);
+
     updateSample();
 }
 
@@ -195,3 +266,28 @@ int MicroBitThermometer::getCalibration()
 {
     return offset;
 }
+
+/**
+  * Sets the number of conversions averaged into each sample.
+  * Conversions are taken back to back by the hardware in the background, so this costs no processor time.
+  *
+  * @param count the number of conversions, from 1 to 255.
+  *
+  * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if count is out of range.
+  */
+int MicroBitThermometer::setOversampling(int count)
+{
+    if (count < 1 || count > 255)
+        return DEVICE_INVALID_PARAMETER;
+
+    oversample = count;
+    return DEVICE_OK;
+}
+
+/**
+  * Determines the number of conversions averaged into each sample.
+  */
+int MicroBitThermometer::getOversampling()
+{
+    return oversample;
+}
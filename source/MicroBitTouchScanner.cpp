@@ -0,0 +1,516 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "MicroBitTouchScanner.h"
+#include "ErrorNo.h"
+#include "Event.h"
+#include "codal_target_hal.h"
+#include "nrf.h"
+#include <string.h>
+
+using namespace codal;
+
+// The timer runs at 4MHz, and is cleared at the start of each scan.
+#define TOUCH_SCANNER_PRESCALER         2
+#define TOUCH_SCANNER_TICKS_PER_US      4
+
+// The capture register used to timestamp the release of each pass. Registers 1 to MICROBIT_TOUCH_SCANNER_MAX_WIDTH
+// hold the rising edge of each pin.
+#define TOUCH_SCANNER_CC_NOW            5
+#define TOUCH_SCANNER_NO_EDGE           0xFFFFFFFF
+
+MicroBitTouchScanner* MicroBitTouchScanner::instance = NULL;
+
+static void touch_scanner_irq(uint16_t mask)
+{
+    if ((mask & 0x01) && MicroBitTouchScanner::instance)
+        MicroBitTouchScanner::instance->onCompare();
+}
+
+static inline NRF_GPIO_Type *touch_scanner_port(NRF52Pin *pin)
+{
+    return pin->name < 32 ? NRF_P0 : NRF_P1;
+}
+
+/**
+ * Constructor.
+ *
+ * @param timer A timer dedicated to scanning.
+ * @param id The ID of this component.
+ */
+MicroBitTouchScanner::MicroBitTouchScanner(NRFLowLevelTimer &timer, uint16_t id) : timer(timer)
+{
+    this->id = id;
+    this->count = 0;
+    this->pass = 0;
+    this->passLength = 0;
+    this->phase = MICROBIT_TOUCH_SCANNER_PHASE_IDLE;
+    this->debounce = CONFIG_MICROBIT_TOUCH_SCANNER_DEBOUNCE;
+    this->period = CONFIG_MICROBIT_TOUCH_SCANNER_PERIOD;
+    this->releaseTime = 0;
+    this->releaseMask[0] = 0;
+    this->releaseMask[1] = 0;
+
+    memset(channels, 0, sizeof(channels));
+
+    // Take the configured channels in order, until either set runs out.
+    int g = 0;
+    int p = 0;
+
+    for (int i = 0; i < 32; i++)
+    {
+        if ((MICROBIT_TOUCH_SCANNER_GPIOTE_CHANNELS & (1UL << i)) && g < MICROBIT_TOUCH_SCANNER_MAX_WIDTH)
+            gpiote[g++] = i;
+
+        if ((MICROBIT_TOUCH_SCANNER_PPI_CHANNELS & (1UL << i)) && p < MICROBIT_TOUCH_SCANNER_MAX_WIDTH)
+            ppi[p++] = i;
+    }
+
+    this->width = g < p ? g : p;
+}
+
+/**
+ * Destructor. Scanning is stopped.
+ */
+MicroBitTouchScanner::~MicroBitTouchScanner()
+{
+    stop();
+}
+
+/**
+ * Adds a pin to the set scanned. This can be done while scanning.
+ *
+ * @param pin The pin to add.
+ * @param id The id events for this pin are raised on. Defaults to the pin's own id.
+ * @param threshold The rise time above the pin's untouched baseline that counts as a touch, in 0.25us ticks.
+ *
+ * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the pin is already added, or DEVICE_NO_RESOURCES
+ * if CONFIG_MICROBIT_TOUCH_SCANNER_MAX_PINS pins have been added.
+ */
+int MicroBitTouchScanner::addPin(NRF52Pin &pin, uint16_t id, int threshold)
+{
+    if (threshold <= 0 || threshold > 0xFFFF)
+        return DEVICE_INVALID_PARAMETER;
+
+    for (int i = 0; i < count; i++)
+        if (channels[i].pin == &pin)
+            return DEVICE_INVALID_PARAMETER;
+
+    if (count == CONFIG_MICROBIT_TOUCH_SCANNER_MAX_PINS)
+        return DEVICE_NO_RESOURCES;
+
+    // Leave the pin as a digital input. The scanner drives it directly from then on.
+    pin.getDigitalValue(PullMode::None);
+
+    MicroBitTouchChannel &c = channels[count];
+    c.id = id ? id : pin.id;
+    c.threshold = threshold;
+    c.raw = 0;
+    c.filtered = 0;
+    c.baseline = 0;
+    c.changing = 0;
+    c.pressed = false;
+    c.pin = &pin;
+
+    // Publish the channel last, so that a scan in progress sees either none or all of it.
+    target_disable_irq();
+    count++;
+    target_enable_irq();
+
+    return DEVICE_OK;
+}
+
+/**
+ * Removes a pin from the set scanned, leaving it as an input.
+ *
+ * @param pin The pin to remove.
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the pin has not been added.
+ */
+int MicroBitTouchScanner::removePin(NRF52Pin &pin)
+{
+    int i = 0;
+
+    while (i < count && channels[i].pin != &pin)
+        i++;
+
+    if (i == count)
+        return DEVICE_INVALID_PARAMETER;
+
+    target_disable_irq();
+
+    for (; i < count - 1; i++)
+        channels[i] = channels[i + 1];
+
+    count--;
+    channels[count].pin = NULL;
+
+    // The pin may have been part of the pass in progress, so was perhaps being held low.
+    touch_scanner_port(&pin)->DIRCLR = 1UL << (pin.name & 31);
+
+    target_enable_irq();
+
+    return DEVICE_OK;
+}
+
+/**
+ * Starts scanning. Each pin's baseline is taken from its first reading, so pins should be untouched when scanning starts.
+ *
+ * @return DEVICE_OK on success, DEVICE_NOT_SUPPORTED if no GPIOTE or PPI channels are configured, or DEVICE_BUSY
+ * if another MicroBitTouchScanner is running.
+ */
+int MicroBitTouchScanner::start()
+{
+    if (width == 0)
+        return DEVICE_NOT_SUPPORTED;
+
+    if (instance != NULL && instance != this)
+        return DEVICE_BUSY;
+
+    stop();
+
+    instance = this;
+
+    for (int i = 0; i < count; i++)
+    {
+        channels[i].baseline = 0;
+        channels[i].changing = 0;
+        channels[i].pressed = false;
+    }
+
+    // Free running 32 bit timer, interrupting only on compare 0. Every other register is used for capture.
+    NRF_TIMER_Type *t = timer.timer;
+    t->TASKS_STOP = 1;
+    t->INTENCLR = 0xFFFFFFFF;
+    t->SHORTS = 0;
+    t->MODE = TIMER_MODE_MODE_Timer;
+    t->BITMODE = TIMER_BITMODE_BITMODE_32Bit;
+    t->PRESCALER = TOUCH_SCANNER_PRESCALER;
+    t->TASKS_CLEAR = 1;
+
+    // The rising edge of each parallel measurement captures the timer into its own register.
+    for (int k = 0; k < width; k++)
+    {
+        NRF_GPIOTE->CONFIG[gpiote[k]] = 0;
+        NRF_PPI->CH[ppi[k]].EEP = (uint32_t) &NRF_GPIOTE->EVENTS_IN[gpiote[k]];
+        NRF_PPI->CH[ppi[k]].TEP = (uint32_t) &t->TASKS_CAPTURE[k + 1];
+        NRF_PPI->CHENSET = 1UL << ppi[k];
+    }
+
+    timer.timer_pointer = touch_scanner_irq;
+    t->EVENTS_COMPARE[0] = 0;
+    t->INTENSET = TIMER_INTENSET_COMPARE0_Msk;
+    timer.enableIRQ();
+
+    status |= MICROBIT_TOUCH_SCANNER_STATUS_RUNNING;
+
+    target_disable_irq();
+    discharge(0);
+    t->TASKS_START = 1;
+    target_enable_irq();
+
+    return DEVICE_OK;
+}
+
+/**
+ * Stops scanning, and releases the hardware. The pins are left as inputs.
+ */
+void MicroBitTouchScanner::stop()
+{
+    if (!(status & MICROBIT_TOUCH_SCANNER_STATUS_RUNNING))
+        return;
+
+    target_disable_irq();
+
+    timer.timer->INTENCLR = 0xFFFFFFFF;
+    timer.timer->TASKS_STOP = 1;
+
+    for (int k = 0; k < width; k++)
+    {
+        NRF_PPI->CHENCLR = 1UL << ppi[k];
+        NRF_GPIOTE->CONFIG[gpiote[k]] = 0;
+    }
+
+    releaseAll();
+
+    phase = MICROBIT_TOUCH_SCANNER_PHASE_IDLE;
+    status &= ~MICROBIT_TOUCH_SCANNER_STATUS_RUNNING;
+    instance = NULL;
+
+    target_enable_irq();
+}
+
+/**
+ * Configures and discharges the pins of the pass starting at the given pin, ready to be measured.
+ */
+void MicroBitTouchScanner::discharge(int first)
+{
+    NRF_TIMER_Type *t = timer.timer;
+
+    pass = first;
+    passLength = count - first < width ? count - first : width;
+    releaseMask[0] = 0;
+    releaseMask[1] = 0;
+
+    for (int k = 0; k < width; k++)
+    {
+        // GPIOTE holds a pin in event mode as an input, so it must let go of the pin for it to be driven low.
+        NRF_GPIOTE->CONFIG[gpiote[k]] = 0;
+        NRF_GPIOTE->EVENTS_IN[gpiote[k]] = 0;
+        t->CC[k + 1] = TOUCH_SCANNER_NO_EDGE;
+
+        if (k < passLength)
+        {
+            NRF52Pin *pin = channels[first + k].pin;
+            uint32_t bit = 1UL << (pin->name & 31);
+
+            touch_scanner_port(pin)->OUTCLR = bit;
+            touch_scanner_port(pin)->PIN_CNF[pin->name & 31] = GPIO_PIN_CNF_DIR_Output << GPIO_PIN_CNF_DIR_Pos;
+            releaseMask[pin->name < 32 ? 0 : 1] |= bit;
+        }
+    }
+
+    t->TASKS_CAPTURE[TOUCH_SCANNER_CC_NOW] = 1;
+    t->CC[0] = t->CC[TOUCH_SCANNER_CC_NOW] + CONFIG_MICROBIT_TOUCH_SCANNER_DISCHARGE_US * TOUCH_SCANNER_TICKS_PER_US;
+    phase = MICROBIT_TOUCH_SCANNER_PHASE_DISCHARGE;
+}
+
+/**
+ * Releases the pins of the current pass, and starts timing them.
+ */
+void MicroBitTouchScanner::release()
+{
+    NRF_TIMER_Type *t = timer.timer;
+
+    // Placing each pin in event mode releases it as an input, and arms the capture of its rising edge as the pull-up
+    // resistor charges it. The pins are released within a few cycles of each other, and of the timestamp.
+    target_disable_irq();
+    t->TASKS_CAPTURE[TOUCH_SCANNER_CC_NOW] = 1;
+
+    for (int k = 0; k < passLength && pass + k < count; k++)
+        NRF_GPIOTE->CONFIG[gpiote[k]] = 0x00010001 | (channels[pass + k].pin->name << 8);
+
+    target_enable_irq();
+
+    // Leave the pins as inputs once GPIOTE lets go of them again.
+    NRF_P0->DIRCLR = releaseMask[0];
+    NRF_P1->DIRCLR = releaseMask[1];
+
+    releaseTime = t->CC[TOUCH_SCANNER_CC_NOW];
+    t->CC[0] = releaseTime + CONFIG_MICROBIT_TOUCH_SCANNER_TIMEOUT_US * TOUCH_SCANNER_TICKS_PER_US;
+    phase = MICROBIT_TOUCH_SCANNER_PHASE_MEASURE;
+}
+
+/**
+ * Returns every pin to an input.
+ */
+void MicroBitTouchScanner::releaseAll()
+{
+    for (int i = 0; i < count; i++)
+        touch_scanner_port(channels[i].pin)->DIRCLR = 1UL << (channels[i].pin->name & 31);
+}
+
+/**
+ * Collects the rise times of the current pass.
+ */
+void MicroBitTouchScanner::collect()
+{
+    NRF_TIMER_Type *t = timer.timer;
+    uint32_t timeout = CONFIG_MICROBIT_TOUCH_SCANNER_TIMEOUT_US * TOUCH_SCANNER_TICKS_PER_US;
+
+    for (int k = 0; k < passLength && pass + k < count; k++)
+    {
+        uint32_t edge = t->CC[k + 1];
+        uint32_t rise = edge == TOUCH_SCANNER_NO_EDGE ? timeout : edge - releaseTime;
+
+        channels[pass + k].raw = rise < timeout ? rise : timeout;
+    }
+}
+
+/**
+ * Filters the readings of every pin, and raises an event for each that has changed state.
+ */
+void MicroBitTouchScanner::process()
+{
+    for (int i = 0; i < count; i++)
+    {
+        MicroBitTouchChannel &c = channels[i];
+        int32_t reading = c.raw << 4;
+
+        if (c.baseline == 0)
+        {
+            c.filtered = reading;
+            c.baseline = reading;
+            continue;
+        }
+
+        c.filtered += (reading - c.filtered) >> CONFIG_MICROBIT_TOUCH_SCANNER_FILTER_SHIFT;
+
+        // Release at half the touch threshold, so that a reading near the threshold does not chatter.
+        int32_t delta = (c.filtered - c.baseline) >> 4;
+        bool touched = delta > (c.pressed ? c.threshold / 2 : c.threshold);
+
+        if (!touched && !c.pressed)
+            c.baseline += (c.filtered - c.baseline) >> CONFIG_MICROBIT_TOUCH_SCANNER_BASELINE_SHIFT;
+
+        if (touched == c.pressed)
+        {
+            c.changing = 0;
+            continue;
+        }
+
+        if (++c.changing >= debounce)
+        {
+            c.pressed = touched;
+            c.changing = 0;
+            Event(c.id, c.pressed ? MICROBIT_TOUCH_SCANNER_EVT_DOWN : MICROBIT_TOUCH_SCANNER_EVT_UP);
+        }
+    }
+}
+
+/**
+ * Advances the scan. Called on each compare event of the timer.
+ *
+ * @note should only be called from the timer interrupt...
+ */
+void MicroBitTouchScanner::onCompare()
+{
+    NRF_TIMER_Type *t = timer.timer;
+
+    switch (phase)
+    {
+        case MICROBIT_TOUCH_SCANNER_PHASE_DISCHARGE:
+            release();
+            break;
+
+        case MICROBIT_TOUCH_SCANNER_PHASE_MEASURE:
+            collect();
+
+            if (pass + width < count)
+            {
+                discharge(pass + width);
+                break;
+            }
+
+            process();
+
+            // Wait for the start of the next scan, or start it straight away if this one overran.
+            t->TASKS_CAPTURE[TOUCH_SCANNER_CC_NOW] = 1;
+
+            if (t->CC[TOUCH_SCANNER_CC_NOW] + TOUCH_SCANNER_TICKS_PER_US * 10 < (uint32_t) period * 1000 * TOUCH_SCANNER_TICKS_PER_US)
+            {
+                t->CC[0] = (uint32_t) period * 1000 * TOUCH_SCANNER_TICKS_PER_US;
+                phase = MICROBIT_TOUCH_SCANNER_PHASE_IDLE;
+                break;
+            }
+
+            // Fall through.
+
+        default:
+            t->TASKS_CLEAR = 1;
+
+            if (count)
+            {
+                discharge(0);
+            }
+            else
+            {
+                t->CC[0] = (uint32_t) period * 1000 * TOUCH_SCANNER_TICKS_PER_US;
+                phase = MICROBIT_TOUCH_SCANNER_PHASE_IDLE;
+            }
+            break;
+    }
+}
+
+/**
+ * Sets the time between the start of each scan.
+ *
+ * @param period The scan period, in milliseconds.
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if period is less than 1ms or more than 1000ms.
+ */
+int MicroBitTouchScanner::setPeriod(int period)
+{
+    if (period < 1 || period > 1000)
+        return DEVICE_INVALID_PARAMETER;
+
+    this->period = period;
+    return DEVICE_OK;
+}
+
+/**
+ * Determines the time between the start of each scan, in milliseconds.
+ */
+int MicroBitTouchScanner::getPeriod()
+{
+    return period;
+}
+
+/**
+ * Sets the number of consecutive scans that must agree before a pin changes state.
+ *
+ * @param scans The number of scans, from 1 to 255.
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if scans is out of range.
+ */
+int MicroBitTouchScanner::setDebounce(int scans)
+{
+    if (scans < 1 || scans > 255)
+        return DEVICE_INVALID_PARAMETER;
+
+    debounce = scans;
+    return DEVICE_OK;
+}
+
+/**
+ * Determines the filtered rise time of a pin above its untouched baseline.
+ *
+ * @param pin The pin of interest.
+ *
+ * @return The rise time above baseline in 0.25us ticks (which may be negative), or 0 if the pin has not been added.
+ */
+int MicroBitTouchScanner::getValue(NRF52Pin &pin)
+{
+    for (int i = 0; i < count; i++)
+        if (channels[i].pin == &pin)
+            return (channels[i].filtered - channels[i].baseline) >> 4;
+
+    return 0;
+}
+
+/**
+ * Determines if a pin is touched, after debouncing.
+ *
+ * @param pin The pin of interest.
+ *
+ * @return true if the pin is touched, false otherwise.
+ */
+bool MicroBitTouchScanner::isPressed(NRF52Pin &pin)
+{
+    for (int i = 0; i < count; i++)
+        if (channels[i].pin == &pin)
+            return channels[i].pressed;
+
+    return false;
+}
@@ -23,6 +23,9 @@ DEALINGS IN THE SOFTWARE.
 */
 
 #include "MicroBitUSBFlashManager.h"
+#include "MicroBitEnergy.h"
+#include "CodalFiber.h"
+#include "EventModel.h"
 
 static const KeyValueTableEntry usbFlashPropertyLengthData[] = {
     {MICROBIT_USB_FLASH_FILENAME_CMD, 12},
@@ -575,6 +578,8 @@ ManagedBuffer MicroBitUSBFlashManager::_transact(ManagedBuffer request, int resp
     int tx_attempts = 0;
     int rx_attempts = 0;
 
+    MICROBIT_ENERGY_SCOPE(MICROBIT_ENERGY_FLASH);
+
     ManagedBuffer b(max(responseLength, 3));
 
     while(tx_attempts < MICROBIT_USB_FLASH_MAX_TX_RETRIES)
@@ -595,14 +600,12 @@ ManagedBuffer MicroBitUSBFlashManager::_transact(ManagedBuffer request, int resp
         // (DAPLink workaround)
         if (request[0] == MICROBIT_USB_FLASH_ERASE_CMD)
             fiber_sleep(status & MICROBIT_USB_FLASH_100MS_AFTER_ERASE ? 100 : 20);
-        else
-            fiber_sleep(1);
 
         while(rx_attempts < MICROBIT_USB_FLASH_MAX_RX_RETRIES)
         {
             rx_attempts++;
 
-            if(io.irq1.isActive())
+            if(awaitResponse(MICROBIT_USB_FLASH_RX_TIMEOUT_US))
             {
                 b.fill(0);
                 int r = i2cBus.read(MICROBIT_USB_FLASH_I2C_ADDRESS, &b[0], b.length(), false);
@@ -624,7 +627,11 @@ ManagedBuffer MicroBitUSBFlashManager::_transact(ManagedBuffer request, int resp
                         bool busy = (status & MICROBIT_USB_FLASH_BUSY_FLAG_SUPPORTED) ? b[0] == 0x20 && b[1] == 0x39 : b[0] == 0x00 || (b[0] == 0x20 && (b[1] == request[0] || b[1] == 0x00));
 
                         if (busy)
+                        {
+                            // Give the interface chip time to complete the operation before asking again.
                             rx_attempts = 0;
+                            fiber_sleep(1);
+                        }
                         else
                             break;
                     }
@@ -635,8 +642,6 @@ ManagedBuffer MicroBitUSBFlashManager::_transact(ManagedBuffer request, int resp
                     break;
                 }
             }
-
-            fiber_sleep(1);
         }
     }
 
@@ -645,6 +650,84 @@ ManagedBuffer MicroBitUSBFlashManager::_transact(ManagedBuffer request, int resp
     return ManagedBuffer();
 }
 
+/**
+ * Waits for the interface chip to signal that a response is ready, by asserting the combined IRQ line.
+ * The calling fiber sleeps until the line falls, or the timeout expires.
+ * @param timeout the maximum time to wait, in microseconds.
+ * @return true if the IRQ line is asserted, false if the timeout expired.
+ */
+bool MicroBitUSBFlashManager::awaitResponse(uint32_t timeout)
+{
+    CODAL_TIMESTAMP start = system_timer_current_time_us();
+
+    // The power manager (or a dispatcher) raises edge events on the line once the event bus is up. Sharing them is safe:
+    // the motion sensors only ever read the level of the line, and the power manager restores edge detection after
+    // borrowing the line's SENSE setting to wake from sleep. Until then, we can only poll.
+    bool sleep = fiber_scheduler_running() && EventModel::defaultEventBus && power.interfaceEventsEnabled();
+
+    if (sleep)
+    {
+        if (!(status & MICROBIT_USB_FLASH_IRQ_LISTENER))
+        {
+            EventModel::defaultEventBus->listen(io.irq1.id, DEVICE_PIN_EVT_FALL, this, &MicroBitUSBFlashManager::onInterfaceIrq, MESSAGE_BUS_LISTENER_IMMEDIATE);
+            status |= MICROBIT_USB_FLASH_IRQ_LISTENER;
+        }
+
+        // The same event, raised at the deadline, wakes us to give up.
+        status |= MICROBIT_USB_FLASH_AWAITING_RESPONSE;
+        system_timer_event_after_us(timeout, id, MICROBIT_USB_FLASH_EVT_RESPONSE);
+    }
+
+    while (true)
+    {
+        // Register for the event before testing, so that an edge in between is not missed.
+        target_disable_irq();
+
+        if (io.irq1.isActive())
+        {
+            target_enable_irq();
+            break;
+        }
+
+        if (system_timer_current_time_us() - start > timeout)
+        {
+            target_enable_irq();
+
+            if (sleep)
+            {
+                status &= ~MICROBIT_USB_FLASH_AWAITING_RESPONSE;
+                system_timer_cancel_event(id, MICROBIT_USB_FLASH_EVT_RESPONSE);
+            }
+
+            return false;
+        }
+
+        if (sleep)
+            fiber_wake_on_event(id, MICROBIT_USB_FLASH_EVT_RESPONSE);
+
+        target_enable_irq();
+
+        schedule();
+    }
+
+    if (sleep)
+    {
+        status &= ~MICROBIT_USB_FLASH_AWAITING_RESPONSE;
+        system_timer_cancel_event(id, MICROBIT_USB_FLASH_EVT_RESPONSE);
+    }
+
+    return true;
+}
+
+/**
+ * Event handler, called when the combined IRQ line is asserted. Wakes any fiber in awaitResponse().
+ */
+void MicroBitUSBFlashManager::onInterfaceIrq(Event)
+{
+    if (status & MICROBIT_USB_FLASH_AWAITING_RESPONSE)
+        Event(id, MICROBIT_USB_FLASH_EVT_RESPONSE);
+}
+
 /**
  * Performs a flash storage transaction with the interface chip.
  * @param command Identifier of a command to issue (one byte write operation).
@@ -23,6 +23,7 @@ SOFTWARE.
 */
 
 #include "MicroSynth.h"
+#include "Timer.h"
 
 #if CONFIG_ENABLED(CODAL_POLYSYNTH)
 
@@ -98,6 +99,25 @@ inline float StateVariableFilter::process(float x, FilterType f)
     }
 }
 
+void StateVariableFilter::process(float* buf, int num, FilterType f)
+{
+    // keep the filter state in registers for the duration of the block
+    const float g = g_, g1 = g1_, d = d_;
+    float s1 = s1_, s2 = s2_;
+    for (int i = 0; i < num; ++i) {
+        const float hp = (buf[i] - g1*s1 - s2)*d;
+        const float v1 = g*hp;
+        const float bp = v1 + s1;
+        s1 = bp + v1;
+        const float v2 = g*bp;
+        const float lp = v2 + s2;
+        s2 = lp + v2;
+        buf[i] = f == FilterType::HPF ? hp : f == FilterType::BPF ? bp : lp;
+    }
+    s1_ = s1;
+    s2_ = s2;
+}
+
 void StateVariableFilter::reset()
 {
     s1_ = s2_ = 0.f;
@@ -125,6 +145,37 @@ inline float ADSREnv::process()
     return cur_;
 }
 
+void ADSREnv::process(float* out, int num)
+{
+    int i = 0;
+    while (i < num) {
+        if (state_ == State::Done) break;
+        if (phase_ >= 1.f) {
+            phase_ = 0.f;
+            int next_state = static_cast<int>(state_) + 1;
+            state_ = static_cast<State>(next_state);
+            start_val_ = levels_[next_state];
+            if (state_ == State::Done) {
+                cur_ = start_val_;
+                break;
+            }
+            phase_inc_ = inc_[next_state];
+        }
+        // render the rest of the current segment as a plain linear ramp
+        const float start = start_val_;
+        const float span = levels_[static_cast<int>(state_) + 1] - start;
+        const float inc = phase_inc_;
+        float phase = phase_;
+        for (; i < num && phase < 1.f; ++i) {
+            phase += inc;
+            out[i] = start + span*phase;
+        }
+        phase_ = phase;
+        cur_ = out[i - 1];
+    }
+    for (; i < num; ++i) out[i] = 0.f;
+}
+
 inline void ADSREnv::gate(bool g)
 {
     start_val_ = cur_;
@@ -138,6 +189,11 @@ inline bool ADSREnv::done() const
     return state_ == State::Done;
 }
 
+inline bool ADSREnv::attacking() const
+{
+    return state_ == State::A;
+}
+
 void ADSREnv::set(float a, float d, float s, float r)
 {
     const float r_SR = 1.f/SynthSampleRate_f;
@@ -197,6 +253,52 @@ inline float Oscillator::processPM(float pm)
     }
 }
 
+void Oscillator::shape(float* buf, int num) const
+{
+    // buf holds the raw phase, already in saw form
+    switch (wave_) {
+    case OscType::Saw:
+        break;
+    case OscType::Pulse: {
+        const float pw = pw_;
+        for (int i = 0; i < num; ++i) buf[i] = (buf[i] > pw ? 1.f : -1.f) + pw;
+        break;
+    }
+    case OscType::Triangle:
+    default:
+        for (int i = 0; i < num; ++i) buf[i] = fabsf(buf[i])*2.f - 1.f;
+        break;
+    }
+}
+
+void Oscillator::process(float* out, int num)
+{
+    float acc = acc_;
+    const float delta = delta_;
+    for (int i = 0; i < num; ++i) {
+        out[i] = acc;
+        acc += delta;
+        if (acc > 1.f) acc -= 2.f;
+    }
+    acc_ = acc;
+    shape(out, num);
+}
+
+void Oscillator::processPM(const float* pm, float* out, int num)
+{
+    float acc = acc_;
+    const float delta = delta_;
+    for (int i = 0; i < num; ++i) {
+        const float p = pm[i];
+        out[i] = acc;
+        acc += delta + p;
+        if (acc > 1.f) acc -= 2.f;
+        else if (acc < -1.f) acc += 2.f;
+    }
+    acc_ = acc;
+    shape(out, num);
+}
+
 inline void Oscillator::setFreq(float f)
 {
     delta_ = 2.f*f/SynthSampleRate_f;
@@ -237,19 +339,43 @@ Voice::Voice()
     vibLfo_.setType(OscType::Triangle);
 }
 
-inline float Voice::process()
+float Voice::oscbuf_[SynthBlockSize];
+float Voice::envbuf_[SynthBlockSize];
+
+void Voice::render(float* buf, int num)
 {
-    const float env = env_.process();
-    const float osc1 = osc_[0].process();
-    const float gate = stopping_ ? 0.f : 1.f;
+    const SynthPreset& p = *preset_;
+    // oscillator block: osc1 into oscbuf_, then osc2 phase modulated by osc1 into envbuf_
+    osc_[0].process(oscbuf_, num);
+    const float fm = p.fmAmount;
+    for (int i = 0; i < num; ++i) envbuf_[i] = fm*oscbuf_[i];
+    osc_[1].processPM(envbuf_, envbuf_, num);
+    const float vol1 = p.osc1Vol, vol2 = p.osc2Vol;
+    const float noise_scale = p.noise*1.f/std::numeric_limits<int32_t>::max();
+    int32_t noise = noise_;
+    for (int i = 0; i < num; ++i) {
+        noise = 1664525*noise + 1013904223;
+        oscbuf_[i] = oscbuf_[i]*vol1 + envbuf_[i]*vol2 + noise_scale*noise;
+    }
+    noise_ = noise;
+
+    // filter block
+    filter_.process(oscbuf_, num, p.filterType);
+
+    // envelope block: the adsr always runs, as it also drives the filter and voice lifetime
+    env_.process(envbuf_, num);
+    if (p.ampGate) {
+        const float gate = stopping_ ? 0.f : 1.f;
+        float g = smoothedGate_;
+        for (int i = 0; i < num; ++i) {
+            g += (gate - g)*0.005f;
+            envbuf_[i] = g;
+        }
+        smoothedGate_ = g;
+    }
 
-    smoothedGate_ += (gate - smoothedGate_)*0.005f;
-    const float amp_env = preset_->ampGate ? smoothedGate_ : env;
-    auto oscs = osc1*preset_->osc1Vol + osc_[1].processPM(preset_->fmAmount*osc1)*preset_->osc2Vol;
-    noise_ = 1664525*noise_ + 1013904223;
-    const float noise = preset_->noise*noise_*1.f/std::numeric_limits<int32_t>::max();
-    auto out = gain_*amp_env*filter_.process(oscs + noise, preset_->filterType);
-    return out;
+    const float gain = gain_;
+    for (int i = 0; i < num; ++i) buf[i] += gain*envbuf_[i]*oscbuf_[i];
 }
 
 void Voice::process(float* buf, int num)
@@ -267,14 +393,16 @@ void Voice::process(float* buf, int num)
     filter_.set(filt_freq, preset_->filterReso);
     osc_[0].setPW(preset_->osc1Pw + preset_->osc1Pwm*lfo);
     osc_[1].setPW(preset_->osc2Pw + preset_->osc2Pwm*lfo);
-    for (int i = 0; i < num; ++i) {
-        buf[i] += process();
+    for (int i = 0; i < num; i += SynthBlockSize) {
+        render(buf + i, min(num - i, SynthBlockSize));
     }
     // check if it's time to move amp envelope to release
     if (gateLength_ >= 0) gateLength_ -= min(gateLength_, SynthBlockSize);
     if (!stopping_ && gateLength_ == 0) detrig();
     // check if amp envelope has died out and deactivate voice if so
-    if (env_.done() || (preset_->ampGate && smoothedGate_ < 1e-3)) note_ = -1;
+    const bool decaying = preset_->ampGate ? stopping_ : !env_.attacking();
+    if (env_.done() || (decaying && getLevel() < SynthVoiceSilence)) note_ = -1;
+    ++age_;
 }
 
 void Voice::trig(int8_t note, float velocity, const SynthPreset* preset, int length)
@@ -284,6 +412,7 @@ void Voice::trig(int8_t note, float velocity, const SynthPreset* preset, int len
     note_ = note;
     gateLength_ = length;
     smoothedGate_ = 0.f;
+    age_ = 0;
     apply_preset();
     gain_ = preset_->gain*velocity;
     env_.reset();
@@ -306,6 +435,22 @@ bool Voice::isStopping() const
     return stopping_;
 }
 
+float Voice::getLevel() const
+{
+    if (preset_ == nullptr) return 0.f;
+    return gain_*(preset_->ampGate ? smoothedGate_ : env_.value());
+}
+
+uint32_t Voice::getAge() const
+{
+    return age_;
+}
+
+void Voice::kill()
+{
+    note_ = -1;
+}
+
 int PolySynth::findVoice(int8_t note)
 {
     for (int i = 0; i < numVoices_; ++i) {
@@ -316,15 +461,35 @@ int PolySynth::findVoice(int8_t note)
 
 Voice& PolySynth::alloc(int /*note*/)
 {
-    // find first free note
+    // find first free note, as long as another voice still fits in the cpu budget
+    Voice* free_voice = nullptr;
+    int active = 0;
+    for (int i = 0; i < numVoices_; ++i) {
+        if (voice_[i].getNote() != -1) ++active;
+        else if (free_voice == nullptr) free_voice = &voice_[i];
+    }
+    if (free_voice != nullptr && active < maxVoices_) return *free_voice;
+    // or else we steal a voice
+    return victim();
+}
+
+Voice& PolySynth::victim()
+{
+    // prefer the quietest voice in release, otherwise the oldest held note
+    Voice* best = nullptr;
     for (int i = 0; i < numVoices_; ++i) {
-        if (voice_[i].getNote() == -1) return voice_[i];
+        Voice& v = voice_[i];
+        if (v.getNote() == -1) continue;
+        if (best == nullptr || (v.isStopping() && !best->isStopping())) {
+            best = &v;
+        } else if (v.isStopping() == best->isStopping()) {
+            if (v.isStopping() ? v.getLevel() < best->getLevel() : v.getAge() > best->getAge()) best = &v;
+        }
     }
-    // or else we steal the first voice. should probably do something better...
-    return voice_[0];
+    return best != nullptr ? *best : voice_[0];
 }
 
-PolySynth::PolySynth(int num_voices) : numVoices_(num_voices)
+PolySynth::PolySynth(int num_voices) : numVoices_(num_voices), maxVoices_(num_voices)
 {
     voice_ = new Voice[numVoices_];
     SynthTables::init();
@@ -348,15 +513,40 @@ void PolySynth::noteOff(int8_t note)
     if (ind != -1) voice_[ind].detrig();
 }
 
+int PolySynth::getVoiceLimit() const
+{
+    return maxVoices_;
+}
+
 void PolySynth::process_noclip(float* buf, int num)
 {
     // clear mixing buffer
     memset(buf, 0, num*sizeof(float));
 
+    const CODAL_TIMESTAMP start = system_timer_current_time_us();
+    int active = 0;
     for (int i = 0; i < numVoices_; ++i) {
         Voice& v = voice_[i];
         if (v.getNote() == -1) continue;
         v.process(buf, num);
+        ++active;
+    }
+    if (active == 0 || num == 0) return;
+
+    // track the cost of a voice, scaled to a full block, and derive how many voices fit in the budget
+    const float elapsed = static_cast<float>(system_timer_current_time_us() - start);
+    const float cost = elapsed*SynthBlockSize/(static_cast<float>(active)*num);
+    voiceCost_ += (cost - voiceCost_)*0.1f;
+    const float budget = SynthCpuBudget*SynthBlockSize*1000000.f/SynthSampleRate_f;
+    const float fit = voiceCost_ > 0.f ? budget/voiceCost_ : static_cast<float>(numVoices_);
+    maxVoices_ = fit >= numVoices_ ? numVoices_ : max(static_cast<int>(fit), 1);
+
+    // shed voices if we're over budget, so the next block makes its deadline
+    for (int i = 0; i < numVoices_ && active > maxVoices_; ++i) {
+        Voice& v = victim();
+        if (v.getNote() == -1) break;
+        v.kill();
+        --active;
     }
 }
 
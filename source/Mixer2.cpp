@@ -23,10 +23,13 @@ DEALINGS IN THE SOFTWARE.
 */
 
 #include "Mixer2.h"
+#include "MicroBitConfig.h"
+#include "AudioBufferPool.h"
 #include "StreamNormalizer.h"
 #include "ErrorNo.h"
 #include "Timer.h"
 #include "CodalDmesg.h"
+#include "MicroBitHeapStats.h"
 
 using namespace codal;
 
@@ -49,8 +52,17 @@ Mixer2::Mixer2(float sampleRate, int sampleRange, int format)
     this->orMask = 0;
     this->silenceLevel = 0.0f;
     this->silent = true;
+    this->paused = false;
     this->silenceStartTime = 0;
     this->silenceEndTime = 0;
+    this->baseRate = sampleRate;
+    this->maxDivider = 1;
+    this->divider = 1;
+    this->outputLatency = 0;
+#if CONFIG_ENABLED(CONFIG_AUDIO_STATS)
+    this->stats.reset();
+    this->activeChannels = 0;
+#endif
 
     // Attempt to configure output format to requested value
     this->setFormat(format);
@@ -65,10 +77,274 @@ Mixer2::~Mixer2()
         MixerChannel *n = channels;
         channels = n->next;
         n->stream->disconnect();
+        MICROBIT_HEAP_UNTRACK(MICROBIT_HEAP_TAG_AUDIO, n);
         delete n;
     }
 }
 
+//
+// Resampling strategies used by mixKernel.
+//
+#define MIXER_KERNEL_UNITY          0       // Input and output rates match.
+#define MIXER_KERNEL_DECIMATE       1       // Output every ratio'th input sample.
+#define MIXER_KERNEL_EXPAND         2       // Output each input sample ratio times.
+#define MIXER_KERNEL_RESAMPLE       3       // Nearest neighbour, using a fixed point phase accumulator.
+#define MIXER_KERNEL_INTERPOLATE    4       // Linear interpolation, using a fixed point phase accumulator.
+
+/**
+ * Inner loop for a native 8 or 16 bit input format.
+ * @tparam T The C type of one input sample.
+ * @tparam mode The resampling strategy, one of the MIXER_KERNEL_ constants.
+ */
+template <typename T, int mode>
+MICROBIT_RAMFUNC void Mixer2::mixKernel(MixerSample *out, int len, MixerChannel *ch)
+{
+    T *in = (T *) ch->in;
+
+#if CONFIG_ENABLED(CONFIG_MIXER_FIXED_POINT)
+    // Combine the normalising gain and channel volume into a single multiplier, with 16 fractional bits.
+    float g = ch->gain * ch->volume * 65536.0f;
+    int32_t gain = g > 2147483647.0f ? 2147483647 : (int32_t) g;
+    int32_t offset = (int32_t) ch->offset;
+
+    #define MIXER_KERNEL_SAMPLE(x) (int32_t)(((int64_t)((x) + offset) * gain) >> (16 - CONFIG_MIXER_FIXED_POINT_BITS))
+#else
+    // (v + offset) * gain * volume, folded into a single multiply-accumulate.
+    float gain = ch->gain * ch->volume;
+    float offset = ch->offset * gain;
+
+    #define MIXER_KERNEL_SAMPLE(x) ((x) * gain + offset)
+#endif
+
+    if (mode == MIXER_KERNEL_UNITY || mode == MIXER_KERNEL_DECIMATE)
+    {
+        int step = mode == MIXER_KERNEL_UNITY ? 1 : ch->ratio;
+        T *s = in + (int) ch->position;
+        int n = len;
+
+        while (n >= 4)
+        {
+            out[0] += MIXER_KERNEL_SAMPLE(s[0]);
+            out[1] += MIXER_KERNEL_SAMPLE(s[step]);
+            out[2] += MIXER_KERNEL_SAMPLE(s[2*step]);
+            out[3] += MIXER_KERNEL_SAMPLE(s[3*step]);
+            out += 4;
+            s += 4*step;
+            n -= 4;
+        }
+
+        while (n--)
+        {
+            *out++ += MIXER_KERNEL_SAMPLE(*s);
+            s += step;
+        }
+
+        ch->position += len * step;
+    }
+    else if (mode == MIXER_KERNEL_EXPAND)
+    {
+        // Track the input sample and the output phase within it exactly, so that no error accumulates.
+        int ratio = ch->ratio;
+        int i = (int) ch->position;
+        int phase = (int)((ch->position - i) * ratio + 0.5f);
+
+        while (len)
+        {
+            MixerSample v = MIXER_KERNEL_SAMPLE(in[i]);
+
+            while (len && phase < ratio)
+            {
+                *out++ += v;
+                phase++;
+                len--;
+            }
+
+            if (phase == ratio)
+            {
+                phase = 0;
+                i++;
+            }
+        }
+
+        ch->position = i + (float) phase / ratio;
+    }
+    else
+    {
+        // Step through the input in fixed point, with 16 fractional bits.
+        uint32_t position = (uint32_t)(ch->position * 65536.0f);
+        uint32_t skip = (uint32_t)(ch->skip * 65536.0f);
+
+        if (mode == MIXER_KERNEL_INTERPOLATE)
+        {
+            // Interpolate between each sample and the one before it, using the last sample of the previous buffer at the start.
+            // This delays the channel by one input sample, but needs no look ahead beyond the current buffer.
+            while (len--)
+            {
+                uint32_t i = position >> 16;
+                int32_t b = in[i];
+                int32_t a = i ? in[i-1] : ch->previous;
+                int32_t x = a + (((b - a) * (int32_t)((position & 0xFFFF) >> 1)) >> 15);
+
+                *out++ += MIXER_KERNEL_SAMPLE(x);
+                position += skip;
+            }
+
+            uint32_t consumed = position >> 16;
+            uint32_t count = ch->buffer.length() / sizeof(T);
+
+            if (consumed)
+                ch->previous = in[(consumed < count ? consumed : count) - 1];
+        }
+        else
+        {
+            while (len--)
+            {
+                *out++ += MIXER_KERNEL_SAMPLE(in[position >> 16]);
+                position += skip;
+            }
+        }
+
+        ch->position = position / 65536.0f;
+    }
+
+    #undef MIXER_KERNEL_SAMPLE
+}
+
+/**
+ * Inner loop for any input format, reading each sample through StreamNormalizer.
+ */
+MICROBIT_RAMFUNC void Mixer2::mixGeneric(MixerSample *out, int len, MixerChannel *ch)
+{
+    SampleReadFn read = StreamNormalizer::readSample[ch->format];
+
+    while (len--)
+    {
+        uint8_t *d = ch->in + (int)(ch->position * ch->bytesPerSample);
+
+#if CONFIG_ENABLED(CONFIG_MIXER_FIXED_POINT)
+        float g = ch->gain * ch->volume * (1 << CONFIG_MIXER_FIXED_POINT_BITS);
+        *out += (int32_t)((read(d) + ch->offset) * g);
+#else
+        float v = read(d);
+        v += ch->offset;
+        v *= ch->gain;
+        v *= ch->volume;
+        *out += v;
+#endif
+
+        ch->position += ch->skip;
+        out++;
+    }
+}
+
+/**
+ * Chooses the inner loop used to mix a channel, based on its input format and whether it is resampled.
+ * Must be called whenever the channel's format or skip changes.
+ */
+void Mixer2::selectKernel(MixerChannel *c)
+{
+    int mode = c->interpolate ? MIXER_KERNEL_INTERPOLATE : MIXER_KERNEL_RESAMPLE;
+    int decimate = (int) c->skip;
+    int expand = (int) (1.0f / c->skip + 0.5f);
+    float error = c->skip * expand - 1.0f;
+
+    c->ratio = 1;
+
+    // Prefer exact integer ratio strategies where they apply.
+    if (c->skip == 1.0f)
+    {
+        mode = MIXER_KERNEL_UNITY;
+    }
+    else if (decimate > 1 && c->skip == (float) decimate)
+    {
+        mode = MIXER_KERNEL_DECIMATE;
+        c->ratio = decimate;
+    }
+    else if (!c->interpolate && expand > 1 && error < 0.0001f && error > -0.0001f)
+    {
+        mode = MIXER_KERNEL_EXPAND;
+        c->ratio = expand;
+    }
+
+    #define MIXER_SELECT_KERNEL(T) \
+        switch (mode) \
+        { \
+            case MIXER_KERNEL_UNITY: c->kernel = mixKernel<T, MIXER_KERNEL_UNITY>; break; \
+            case MIXER_KERNEL_DECIMATE: c->kernel = mixKernel<T, MIXER_KERNEL_DECIMATE>; break; \
+            case MIXER_KERNEL_EXPAND: c->kernel = mixKernel<T, MIXER_KERNEL_EXPAND>; break; \
+            case MIXER_KERNEL_INTERPOLATE: c->kernel = mixKernel<T, MIXER_KERNEL_INTERPOLATE>; break; \
+            default: c->kernel = mixKernel<T, MIXER_KERNEL_RESAMPLE>; \
+        }
+
+    switch (c->format)
+    {
+        case DATASTREAM_FORMAT_8BIT_UNSIGNED:
+            MIXER_SELECT_KERNEL(uint8_t);
+            break;
+
+        case DATASTREAM_FORMAT_8BIT_SIGNED:
+            MIXER_SELECT_KERNEL(int8_t);
+            break;
+
+        case DATASTREAM_FORMAT_16BIT_UNSIGNED:
+            MIXER_SELECT_KERNEL(uint16_t);
+            break;
+
+        case DATASTREAM_FORMAT_16BIT_SIGNED:
+            MIXER_SELECT_KERNEL(int16_t);
+            break;
+
+        default:
+            c->kernel = mixGeneric;
+    }
+
+    #undef MIXER_SELECT_KERNEL
+}
+
+/**
+ * Writes the accumulator to an output buffer of native 8 or 16 bit samples.
+ * @tparam T The C type of one output sample.
+ */
+template <typename T>
+void Mixer2::packSamples(uint8_t *w, int len)
+{
+    T *out = (T *) w;
+    MixerSample *r = mix;
+
+    bool isUnsigned = (outputFormat == DATASTREAM_FORMAT_16BIT_UNSIGNED || outputFormat == DATASTREAM_FORMAT_8BIT_UNSIGNED);
+    float scale = volume * outputRange / CONFIG_MIXER_INTERNAL_RANGE;
+    int offset = isUnsigned ? outputRange/2 : 0;
+    int lo = isUnsigned ? 0 : -outputRange/2;
+    int hi = isUnsigned ? outputRange : outputRange/2;
+
+#if CONFIG_ENABLED(CONFIG_MIXER_FIXED_POINT)
+    int32_t fixedScale = (int32_t)(scale * 65536.0f);
+#endif
+
+    while(len--)
+    {
+#if CONFIG_ENABLED(CONFIG_MIXER_FIXED_POINT)
+        int s = (int32_t)(((int64_t)*r * fixedScale) >> (16 + CONFIG_MIXER_FIXED_POINT_BITS));
+#else
+        int s = (int)(*r * scale);
+#endif
+        s += offset;
+
+        // Clamp output range.
+        if (s < lo)
+            s = lo;
+
+        if (s > hi)
+            s = hi;
+
+        // Apply any requested bit mask
+        s |= orMask;
+
+        *out++ = (T) s;
+        r++;
+    }
+}
+
 void Mixer2::configureChannel(MixerChannel *c)
 {
     c->volume = 1.0f;
@@ -80,6 +356,8 @@ void Mixer2::configureChannel(MixerChannel *c)
 
     if (c->format == DATASTREAM_FORMAT_8BIT_UNSIGNED || c->format == DATASTREAM_FORMAT_16BIT_UNSIGNED)
         c->offset = c->range * -0.5f;       
+
+    selectKernel(c);
 }
 
 /**
@@ -92,13 +370,22 @@ void Mixer2::configureChannel(MixerChannel *c)
 MixerChannel *Mixer2::addChannel(DataSource &stream, float sampleRate, int sampleRange)
 {
     MixerChannel *c = new MixerChannel();
+    MICROBIT_HEAP_TRACK(MICROBIT_HEAP_TAG_AUDIO, c);
     c->stream = &stream;
     c->range = sampleRange;
     c->rate = sampleRate ? sampleRate : outputRate;
     c->pullRequests = 0;
+    c->mixer = this;
     c->in = NULL;
     c->end = NULL;
     c->position = 0;
+    c->interpolate = CONFIG_MIXER_DEFAULT_INTERPOLATION;
+    c->previous = 0;
+    c->startTime = 0;
+#if CONFIG_ENABLED(CONFIG_AUDIO_STATS)
+    c->stats.reset();
+    c->requestTime = 0;
+#endif
 
     configureChannel(c);
 
@@ -111,6 +398,21 @@ MixerChannel *Mixer2::addChannel(DataSource &stream, float sampleRate, int sampl
     return c;
 }
 
+/**
+ * Finds the channel connected to the given stream.
+ *
+ * @param stream The DataSource feeding the channel.
+ * @return The channel, or NULL if the stream is not connected to the mixer.
+ */
+MixerChannel *Mixer2::getChannel(DataSource &stream)
+{
+    for (MixerChannel *ch = channels; ch; ch = ch->next)
+        if (ch->stream == &stream)
+            return ch;
+
+    return NULL;
+}
+
 int Mixer2::removeChannel( MixerChannel * channel )
 {
     DMESG( "Unsupported operation! Channel retained!" );
@@ -122,20 +424,40 @@ ManagedBuffer Mixer2::pull()
     // Take a local timestamp, in case we need to compute a time when a pice of audio will be played out of the speaker
     CODAL_TIMESTAMP pullTime = system_timer_current_time_us();
 
+#if CONFIG_ENABLED(CONFIG_AUDIO_STATS)
+    uint32_t period = (uint32_t) ((CONFIG_MIXER_BUFFER_SIZE / bytesPerSampleOut) * 1000000.0f / outputRate);
+    CODAL_TIMESTAMP statsStart = stats.begin(period);
+    activeChannels = 0;
+#endif
+
     // If we have no channels, just return an empty buffer.
     if (!channels)
     {
+        if (emptyBuffer.length() == 0)
+        {
+            emptyBuffer = ManagedBuffer(CONFIG_MIXER_BUFFER_SIZE);
+            emptyBuffer.fill(0);
+        }
+
+#if CONFIG_ENABLED(CONFIG_AUDIO_STATS)
+        stats.end(statsStart);
+#endif
         downStream->pullRequest();
-        return ManagedBuffer(CONFIG_MIXER_BUFFER_SIZE);
+        return emptyBuffer;
     }
 
-    // Clear the accumulator buffer
-    for (int i=0; i<CONFIG_MIXER_BUFFER_SIZE/bytesPerSampleOut; i++)
-        mix[i] = 0.0f;
-
     MixerChannel *next;
     bool silence = true;
 
+    // Determine when the buffer we're about to render will be heard, so that scheduled channels can start part way through it.
+    int samples = CONFIG_MIXER_BUFFER_SIZE / bytesPerSampleOut;
+    uint32_t duration = (uint32_t) (samples * 1000000.0f / outputRate);
+    CODAL_TIMESTAMP playTime = pullTime + (outputLatency ? outputLatency : duration);
+
+    // Follow the content with the output rate, but only while nothing can be heard.
+    if (silent && maxDivider > 1)
+        adaptSampleRate();
+
     for (MixerChannel *ch = channels; ch; ch = next) {
         next = ch->next; // save next in case the current channel gets deleted
 
@@ -149,13 +471,35 @@ ManagedBuffer Mixer2::pull()
                 continue;
         }
 
-        float *out = &mix[0];
-        float *end = &mix[CONFIG_MIXER_BUFFER_SIZE/bytesPerSampleOut];
-        int inputFormat = ch->format;
+        // Skip channels that have no data buffered or waiting.
+        if (ch->pullRequests == 0 && ch->position * ch->bytesPerSample >= ch->buffer.length())
+            continue;
+
+        MixerSample *out = &mix[0];
+        MixerSample *end = &mix[CONFIG_MIXER_BUFFER_SIZE/bytesPerSampleOut];
+
+        // Hold back a channel that is scheduled to start later, then start it at the sample that is heard at that time.
+        if (ch->startTime)
+        {
+            if (ch->startTime >= playTime + duration)
+                continue;
+
+            if (ch->startTime > playTime)
+                out += min(samples - 1, (int) ((ch->startTime - playTime) * outputRate / 1000000.0f));
+
+            ch->startTime = 0;
+        }
 
         // Check if we need to recalculate skip after a channel rate change
         if( ch->skip == 0.0f )
+        {
             ch->skip = ch->rate / outputRate;
+            selectKernel(ch);
+        }
+
+#if CONFIG_ENABLED(CONFIG_AUDIO_STATS)
+        activeChannels++;
+#endif
 
         while (out < end)
         {
@@ -165,25 +509,25 @@ ManagedBuffer Mixer2::pull()
             int inLen = ((ch->buffer.length() / ch->bytesPerSample) - ch->position) / ch->skip;
             int len =  min(outLen, inLen);
 
-            if (len)
-                silence = false;
-
-            uint8_t *d = ch->in;
-
-            while(len)
+            // Muted channels consume their input without mixing it.
+            if (len && ch->volume == 0.0f)
+            {
+                ch->position += len * ch->skip;
+                out += len;
+            }
+            else if (len)
             {
-                d = ch->in + (int)(ch->position * ch->bytesPerSample);
+                // Clear the accumulator the first time any channel has samples to mix.
+                if (silence)
+                {
+                    for (int i=0; i<CONFIG_MIXER_BUFFER_SIZE/bytesPerSampleOut; i++)
+                        mix[i] = 0;
 
-                float v = StreamNormalizer::readSample[inputFormat](d);
-                v += ch->offset;
-                v *= ch->gain;    
-                v *= ch->volume;    
-                *out += v;
- 
-                ch->position += ch->skip;
+                    silence = false;
+                }
 
-                out++;
-                len--;
+                ch->kernel(out, len, ch);
+                out += len;
             }
 
             // Check if we've completed an input buffer. If so, pull down another if available.
@@ -191,10 +535,24 @@ ManagedBuffer Mixer2::pull()
             if (inLen < outLen)
             {
                 if (ch->pullRequests == 0)
+                {
+#if CONFIG_ENABLED(CONFIG_AUDIO_STATS)
+                    ch->stats.underruns++;
+                    stats.underruns++;
+#endif
                     break;
+                }
 
                 ch->pullRequests--;
+#if CONFIG_ENABLED(CONFIG_AUDIO_STATS)
+                ch->stats.age(ch->requestTime);
+                CODAL_TIMESTAMP channelStart = ch->stats.begin();
                 ch->buffer = ch->stream->pull();
+                ch->stats.end(channelStart);
+                ch->requestTime = ch->pullRequests ? system_timer_current_time_us() : 0;
+#else
+                ch->buffer = ch->stream->pull();
+#endif
                 ch->in = &ch->buffer[0];
                 ch->position = 0;
                 ch->end = ch->in + ch->buffer.length();
@@ -205,13 +563,6 @@ ManagedBuffer Mixer2::pull()
         }
     }       
 
-    // If we have silence, set output level to predefined value.
-    if (silence && silenceLevel != 0.0f)
-    {
-        for (int i=0; i<CONFIG_MIXER_BUFFER_SIZE/bytesPerSampleOut; i++)
-            mix[i] = silenceLevel;
-    }
-
     if (this->silent != silence)
     {
         this->silent = silence;
@@ -230,48 +581,76 @@ ManagedBuffer Mixer2::pull()
         }
     }
 
+    // If we have silence, return the predefined output level, rendering it the first time it is needed.
+    if (silence)
+    {
+        if (silenceBuffer.length() == 0)
+        {
+            for (int i=0; i<CONFIG_MIXER_BUFFER_SIZE/bytesPerSampleOut; i++)
+#if CONFIG_ENABLED(CONFIG_MIXER_FIXED_POINT)
+                mix[i] = (int32_t)(silenceLevel * (1 << CONFIG_MIXER_FIXED_POINT_BITS));
+#else
+                mix[i] = silenceLevel;
+#endif
+            silenceBuffer = ManagedBuffer(CONFIG_MIXER_BUFFER_SIZE);
+        }
+        else
+        {
+#if CONFIG_ENABLED(CONFIG_AUDIO_STATS)
+            stats.end(statsStart);
+#endif
+            downStream->pullRequest();
+            return silenceBuffer;
+        }
+    }
+
     // Scale and pack to our output format
-    ManagedBuffer output = ManagedBuffer(CONFIG_MIXER_BUFFER_SIZE);
+    ManagedBuffer output = silence ? silenceBuffer : AudioBufferPool::allocate(CONFIG_MIXER_BUFFER_SIZE);
     uint8_t *w = &output[0];
-    float *r = mix;
-
     int len = output.length() / bytesPerSampleOut;
-    float scale = volume * outputRange / CONFIG_MIXER_INTERNAL_RANGE;
-    int offset = (outputFormat == DATASTREAM_FORMAT_16BIT_UNSIGNED || outputFormat == DATASTREAM_FORMAT_8BIT_UNSIGNED) ? outputRange/2 : 0;
-    float lo = (outputFormat == DATASTREAM_FORMAT_16BIT_UNSIGNED || outputFormat == DATASTREAM_FORMAT_8BIT_UNSIGNED) ? 0 : -outputRange/2;
-    float hi = (outputFormat == DATASTREAM_FORMAT_16BIT_UNSIGNED || outputFormat == DATASTREAM_FORMAT_8BIT_UNSIGNED) ? outputRange : outputRange/2;
 
-    while(len--)
+    switch (outputFormat)
     {
-        float sample = *r * scale;
-        sample += offset;
-        
-        // Clamp output range. Would be nice to use apply some compression here, 
-        // but we don't really want ot use more CPU than we already do.
-        if (sample < lo)
-            sample = lo;
+        case DATASTREAM_FORMAT_8BIT_UNSIGNED:
+            packSamples<uint8_t>(w, len);
+            break;
 
-        if (sample > hi)
-            sample = hi;
+        case DATASTREAM_FORMAT_8BIT_SIGNED:
+            packSamples<int8_t>(w, len);
+            break;
 
-        // Apply any requested bit mask
-        int s = (int)sample;
-        s |= orMask;
+        case DATASTREAM_FORMAT_16BIT_SIGNED:
+            packSamples<int16_t>(w, len);
+            break;
 
-        // Write out the sample.
-        StreamNormalizer::writeSample[outputFormat](w, s);
-        w += bytesPerSampleOut;
-        r++;
+        default:
+            packSamples<uint16_t>(w, len);
     }
 
     // Return the buffer and we're done.
+#if CONFIG_ENABLED(CONFIG_AUDIO_STATS)
+    stats.end(statsStart);
+#endif
     downStream->pullRequest();
     return output;
 }
 
 int MixerChannel::pullRequest()
 {
+#if CONFIG_ENABLED(CONFIG_AUDIO_STATS)
+    if (pullRequests == 0)
+        requestTime = system_timer_current_time_us();
+#endif
+
     pullRequests++;
+
+    // If the mixer's output has been paused during silence, request that it be restarted.
+    if (mixer && mixer->paused)
+    {
+        mixer->paused = false;
+        Event(DEVICE_ID_MIXER, DEVICE_MIXER_EVT_WAKE);
+    }
+
     return DEVICE_OK;
 }
 
@@ -297,6 +676,7 @@ int Mixer2::setFormat(int format)
     {
         this->outputFormat = format;
         this->bytesPerSampleOut = DATASTREAM_FORMAT_BYTES_PER_SAMPLE(format);
+        invalidateSilence();
 
         return DEVICE_OK;
     }
@@ -317,6 +697,7 @@ Mixer2::setVolume(int volume)
         return DEVICE_INVALID_PARAMETER;
 
     this->volume = (float)volume / 1023.f;
+    invalidateSilence();
     return DEVICE_OK;
 }
 
@@ -338,6 +719,7 @@ Mixer2::getVolume()
 int Mixer2::setSampleRange(uint16_t sampleRange)
 {
     this->outputRange = (float)sampleRange;
+    invalidateSilence();
     return DEVICE_OK;
 }
 
@@ -352,7 +734,10 @@ int Mixer2::setSampleRate(float sampleRate)
     
     // Recompute the sub/super sampling constants for each channel.    
     for (MixerChannel *c = channels; c; c=c->next)
+    {
         c->skip = c->rate / outputRate;
+        selectKernel(c);
+    }
 
     return DEVICE_OK;
 }
@@ -386,6 +771,7 @@ float Mixer2::getSampleRate()
 int Mixer2::setOrMask(uint32_t mask)
 {
     orMask = mask;
+    invalidateSilence();
     return DEVICE_OK;
 }
 
@@ -402,6 +788,7 @@ int Mixer2::setSilenceLevel(float level)
         return DEVICE_INVALID_PARAMETER;
 
     silenceLevel = level - 512.0f;
+    invalidateSilence();
     return DEVICE_OK;
 }
 
@@ -435,4 +822,193 @@ CODAL_TIMESTAMP Mixer2::getSilenceStartTime()
 CODAL_TIMESTAMP Mixer2::getSilenceEndTime()
 {
     return silenceEndTime;
-}
\ No newline at end of file
+}
+
+/**
+ * Records that the downstream sink has stopped pulling from the mixer, for example to save power during silence.
+ * While paused, the first pull request received on any channel raises a DEVICE_MIXER_EVT_WAKE event,
+ * so that the sink can be restarted.
+ *
+ * @param paused true if the downstream sink is paused, false if it is pulling normally.
+ */
+void Mixer2::setPaused(bool paused)
+{
+    this->paused = paused;
+}
+
+/**
+ * Determines if the downstream sink has been recorded as paused.
+ *
+ * @return true if paused, false otherwise.
+ */
+bool Mixer2::isPaused()
+{
+    return paused;
+}
+
+/**
+ * Lets the output sample rate follow the channels being mixed, rather than remaining fixed.
+ *
+ * Whenever the mixer is silent and a channel has data to mix, the output rate is set to the lowest
+ * baseRate / n, for n up to maxDivider, that is no lower than the rate of any channel with data.
+ * Rendering fewer samples for low rate content saves CPU time, and downstream DMA and interrupts.
+ * Changes are only made during silence, so are never heard. A DEVICE_MIXER_EVT_RATE event is raised
+ * after each change, so that the downstream component can follow it; listeners should be registered
+ * with MESSAGE_BUS_LISTENER_IMMEDIATE, so that they are called before the next buffer is delivered.
+ *
+ * @param baseRate The highest output rate, in samples per second.
+ * @param maxDivider The largest divider that may be applied to baseRate. 1 fixes the output rate at baseRate.
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if either parameter is out of range.
+ */
+int Mixer2::setAdaptiveSampleRate(float baseRate, int maxDivider)
+{
+    if (baseRate <= 0.0f || maxDivider < 1)
+        return DEVICE_INVALID_PARAMETER;
+
+    this->baseRate = baseRate;
+    this->maxDivider = maxDivider;
+
+    // Start from the full rate. The first sound to be mixed selects the rate it needs.
+    if (divider != 1 || outputRate != baseRate)
+    {
+        divider = 1;
+        setSampleRate(baseRate);
+        Event(DEVICE_ID_MIXER, DEVICE_MIXER_EVT_RATE);
+    }
+
+    return DEVICE_OK;
+}
+
+/**
+ * Determines the divider of the adaptive base rate currently applied to the output.
+ *
+ * @return the divider in use, or 1 if the output sample rate is not adaptive.
+ */
+int Mixer2::getSampleRateDivider()
+{
+    return divider;
+}
+
+/**
+ * Chooses the adaptive output rate for the channels that have data, while the mixer is silent.
+ */
+void Mixer2::adaptSampleRate()
+{
+    float required = 0.0f;
+
+    for (MixerChannel *ch = channels; ch; ch = ch->next)
+    {
+        if (ch->format == DATASTREAM_FORMAT_UNKNOWN || (ch->pullRequests == 0 && ch->position * ch->bytesPerSample >= ch->buffer.length()))
+            continue;
+
+        if (ch->rate > required)
+            required = ch->rate;
+    }
+
+    // Keep the current rate until there is something to play.
+    if (required == 0.0f)
+        return;
+
+    int d = (int) (baseRate / required);
+
+    if (d > maxDivider)
+        d = maxDivider;
+
+    if (d < 1)
+        d = 1;
+
+    if (d != divider)
+    {
+        divider = d;
+        setSampleRate(baseRate / d);
+        Event(DEVICE_ID_MIXER, DEVICE_MIXER_EVT_RATE);
+    }
+}
+
+/**
+ * Discards any pre-rendered silence, following a change in output configuration.
+ */
+void Mixer2::invalidateSilence()
+{
+    silenceBuffer = ManagedBuffer();
+}
+/**
+ * Defines the time between a pull from the mixer and the first sample of the buffer it returns
+ * being heard, used to place channels scheduled with MixerChannel::setStartTime().
+ *
+ * @param latency The latency in microseconds, or zero to use the duration of one buffer, which matches
+ * a downstream component that double buffers, pulling each buffer as the previous one starts to play.
+ * @return DEVICE_OK on success.
+ */
+int Mixer2::setOutputLatency(uint32_t latency)
+{
+    this->outputLatency = latency;
+    return DEVICE_OK;
+}
+
+/**
+ * Determines the number of channels attached to the mixer.
+ *
+ * @return the number of channels, whether or not they are currently producing audio.
+ */
+int Mixer2::getChannelCount()
+{
+    int count = 0;
+
+    for (MixerChannel *ch = channels; ch; ch = ch->next)
+        count++;
+
+    return count;
+}
+
+#if CONFIG_ENABLED(CONFIG_AUDIO_STATS)
+/**
+ * Provides the statistics of the mixer itself.
+ * Pull times include the time taken by all upstream components to render the buffers that were mixed,
+ * and a pull is late if it arrived over a quarter of a buffer after it was due.
+ *
+ * @return the statistics of the mixer.
+ */
+AudioStageStats &Mixer2::getStats()
+{
+    return stats;
+}
+
+/**
+ * Determines the number of channels mixed into the most recent buffer.
+ *
+ * @return the number of channels that contributed samples.
+ */
+int Mixer2::getActiveChannelCount()
+{
+    return activeChannels;
+}
+
+/**
+ * Clears the statistics of the mixer and all of its channels.
+ */
+void Mixer2::resetStats()
+{
+    stats.reset();
+
+    for (MixerChannel *ch = channels; ch; ch = ch->next)
+        ch->stats.reset();
+}
+
+/**
+ * Writes the statistics of the mixer and each of its channels to DMESG.
+ */
+void Mixer2::printStats()
+{
+    int i = 0;
+
+    DMESG("mixer: channels %d active %d", getChannelCount(), activeChannels);
+    stats.print("mixer");
+
+    for (MixerChannel *ch = channels; ch; ch = ch->next)
+    {
+        DMESG("channel %d: rate %d", i++, (int) ch->rate);
+        ch->stats.print("channel");
+    }
+}
+#endif
@@ -24,6 +24,7 @@ DEALINGS IN THE SOFTWARE.
 
 #include "NRF52FlashManager.h"
 #include "Timer.h"
+#include "CodalFiber.h"
 #include "nrf.h"
 
 #ifdef SOFTDEVICE_PRESENT
@@ -42,6 +43,8 @@ using namespace codal;
 extern "C" void btle_set_user_evt_handler(void (*func)(uint32_t));
 
 static volatile bool flash_op_complete = false;
+static volatile bool flash_op_failed = false;
+static volatile bool flash_op_active = false;
 
 /*
  * When SoftDevice is present,
@@ -55,10 +58,69 @@ static void nvmc_event_handler(uint32_t sys_evt, void *)
 {
     if (sys_evt == NRF_EVT_FLASH_OPERATION_SUCCESS)
         flash_op_complete = true;
+
+    if (sys_evt == NRF_EVT_FLASH_OPERATION_ERROR)
+    {
+        flash_op_failed = true;
+        flash_op_complete = true;
+    }
 }
 
 NRF_SDH_SOC_OBSERVER( nrf52flash_soc_observer, 0, nvmc_event_handler, NULL);
 
+/*
+ * Determine if the caller may yield to the scheduler while waiting for the SoftDevice.
+ * This is only possible from fiber context, once the scheduler is running.
+ */
+static bool flash_can_yield()
+{
+    return fiber_scheduler_running() && __get_IPSR() == 0;
+}
+
+/*
+ * Wait for the given number of milliseconds, letting other fibers run if possible.
+ */
+static void flash_wait_ms(int ms)
+{
+    if (flash_can_yield())
+        fiber_sleep(ms);
+    else
+        system_timer_wait_ms(ms);
+}
+
+/*
+ * Have the SoftDevice erase the page at the given address (if data is NULL) or write the given words,
+ * and wait for the operation to complete.
+ *
+ * The SoftDevice accepts one operation at a time. Operations issued by other fibers while one is in
+ * progress wait their turn, and are then submitted as soon as it completes. Other fibers are scheduled
+ * while the operation is in progress. The operation is retried if the SoftDevice was unable to complete it.
+ */
+static void sd_flash_operation(uint32_t address, uint32_t *data, uint32_t length, uint32_t pageSize)
+{
+    while (flash_op_active)
+        flash_wait_ms(1);
+
+    flash_op_active = true;
+
+    do {
+        flash_op_complete = false;
+        flash_op_failed = false;
+
+        while ((data ? sd_flash_write((uint32_t *) address, data, length) : sd_flash_page_erase(address / pageSize)) != NRF_SUCCESS)
+            flash_wait_ms(10);
+
+        // Wait for SoftDevice to diable the operation when it completes...
+        while(!flash_op_complete)
+        {
+            if (flash_can_yield())
+                schedule();
+        }
+    } while (flash_op_failed);
+
+    flash_op_active = false;
+}
+
 #endif
 
 
@@ -115,20 +177,7 @@ NRF52FlashManager::write(uint32_t address, uint32_t *data, uint32_t length)
     sd_softdevice_is_enabled(&sd_enabled);
 
     if (sd_enabled)
-    {
-        flash_op_complete = false;
-
-        while(1)
-        {
-            if (sd_flash_write((uint32_t *) address, data, length) == NRF_SUCCESS)
-                break;
-
-            system_timer_wait_ms(10);
-        }
-
-        // Wait for SoftDevice to diable the write operation when it completes...
-        while(!flash_op_complete);
-    }
+        sd_flash_operation(address, data, length, pageSize);
     else
 #endif
     {
@@ -166,18 +215,7 @@ NRF52FlashManager::erase(uint32_t page)
     sd_softdevice_is_enabled(&sd_enabled);
     
     if (sd_enabled)
-    {
-        flash_op_complete = false;
-        while(1)
-        {
-            if (sd_flash_page_erase(page / pageSize) == NRF_SUCCESS)
-                break;
-
-            system_timer_wait_ms(10);
-        }
-        // Wait for SoftDevice to diable the write operation when it completes...
-        while(!flash_op_complete);
-    }
+        sd_flash_operation(page, NULL, 0, pageSize);
     else   
 #endif
     {
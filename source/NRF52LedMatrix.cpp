@@ -28,9 +28,14 @@ DEALINGS IN THE SOFTWARE.
   * A LEDMatrix represents the LED matrix array on the micro:bit.
   */
 #include "NRF52LedMatrix.h"
+#include "MicroBitConfig.h"
 #include "NRF52Pin.h"
 #include "CodalDmesg.h"
 #include "ErrorNo.h"
+#include "Timer.h"
+#include "MicroBitEventTrace.h"
+#include "MicroBitEnergy.h"
+#include <math.h>
 
 using namespace codal;
 
@@ -61,6 +66,18 @@ NRF52LEDMatrix::NRF52LEDMatrix(NRFLowLevelTimer &displayTimer, const MatrixMap &
     instance = this;
     lightLevel = 0;
     this->mode = mode;
+    this->blackAndWhite = (mode == DISPLAY_MODE_BLACK_AND_WHITE || mode == DISPLAY_MODE_BLACK_AND_WHITE_LIGHT_SENSE);
+    this->pixelIndex = (uint16_t *) malloc(matrixMap.rows * matrixMap.columns * sizeof(uint16_t));
+    this->frontBuffer = NULL;
+    this->frameTable = NULL;
+    this->frameLit = 0;
+    this->gamma = CONFIG_NRF52_LED_MATRIX_GAMMA;
+    this->timerPeriod = 0;
+    this->slotPeriod = 0;
+    this->lightSenseTime = 0;
+    memset(levels, 0, sizeof(levels));
+    this->pendingBuffer = NULL;
+    updatePixelIndex();
 
     // Validate that we can deliver the requested display.
     if (matrixMap.columns <= NRF52_LED_MATRIX_MAXIMUM_COLUMNS)
@@ -103,6 +120,9 @@ void NRF52LEDMatrix::setDisplayMode(DisplayMode mode)
         status &= ~NRF52_LEDMATRIX_STATUS_RESET;
     }
 
+    uint32_t previousPeriod = timerPeriod;
+    bool previousBlackAndWhite = blackAndWhite;
+
     // Determine the number of timeslots we'll need.
     timeslots = matrixMap.rows;
 
@@ -114,8 +134,14 @@ void NRF52LEDMatrix::setDisplayMode(DisplayMode mode)
     
     timer.setCompare(0, timerPeriod);
     timer.timer->TASKS_CLEAR = 1;
+    slotPeriod = timerPeriod;
 
     this->mode = mode;
+    this->blackAndWhite = (mode == DISPLAY_MODE_BLACK_AND_WHITE || mode == DISPLAY_MODE_BLACK_AND_WHITE_LIGHT_SENSE);
+
+    // This is also called from render() after each light sense strobe, when nothing changes. Only rebuild if we must.
+    if (timerPeriod != previousPeriod || blackAndWhite != previousBlackAndWhite)
+        updateLevels();
 }
 
 /**
@@ -140,6 +166,48 @@ DisplayMode NRF52LEDMatrix::getDisplayMode()
 void NRF52LEDMatrix::rotateTo(DisplayRotation rotation)
 {
     this->rotation = rotation;
+    updatePixelIndex();
+}
+
+/**
+ * Rebuilds pixelIndex for the current rotation, so that render() need only look pixels up.
+ */
+void NRF52LEDMatrix::updatePixelIndex()
+{
+    uint16_t *index = pixelIndex;
+
+    if (index == NULL)
+        return;
+
+    // Entries are ordered by row, then column: the order in which render() visits them.
+    for (int row = 0; row < matrixMap.rows; row++)
+    {
+        MatrixPoint *p = (MatrixPoint *)matrixMap.map + row;
+
+        for (int column = 0; column < matrixMap.columns; column++)
+        {
+            switch (this->rotation)
+            {
+              case MATRIX_DISPLAY_ROTATION_90:
+                *index++ = p->x * width + width - 1 - p->y;
+                break;
+              case MATRIX_DISPLAY_ROTATION_180:
+                *index++ = (height - 1 - p->y) * width + width - 1 - p->x;
+                break;
+              case MATRIX_DISPLAY_ROTATION_270:
+                *index++ = (height - 1 - p->x) * width + p->y;
+                break;
+              default:
+                *index++ = p->y * width + p->x;
+                break;
+            }
+
+            p += matrixMap.rows;
+        }
+    }
+
+    // Any double buffered frame must be worked out again, once the new mapping is complete.
+    status |= NRF52_LEDMATRIX_STATUS_FRAME_DIRTY;
 }
 
 /**
@@ -208,17 +276,24 @@ void NRF52LEDMatrix::disable()
 
     status &= ~NRF52_LEDMATRIX_STATUS_LIGHTREADY;
 
+    MICROBIT_ENERGY_STATE(MICROBIT_ENERGY_DISPLAY, false);
+
     enabled = false;
 }
 
 /**
  * Configure the next frame to be drawn.
  */
-void NRF52LEDMatrix::render()
+MICROBIT_RAMFUNC void NRF52LEDMatrix::render()
 {
     uint8_t *screenBuffer = image.getBitmap();
     uint32_t value;
 
+    MICROBIT_EVENT_TRACE(MICROBIT_EVENT_TRACE_LED_RENDER, strobeRow, timerPeriod);
+
+    if (status & NRF52_LEDMATRIX_STATUS_DOUBLE_BUFFER)
+        screenBuffer = frontBuffer;
+
     if (strobeRow < matrixMap.rows)
     {
         // We just completed a normal diplay strobe. 
@@ -231,6 +306,16 @@ void NRF52LEDMatrix::render()
         lightLevel = 255 - ((255 * timer.timer->CC[1]) / (timerPeriod * NRF52_LED_MATRIX_LIGHTSENSE_STROBES));
         status |= NRF52_LEDMATRIX_STATUS_LIGHTREADY;
 
+        // If light sensing was only enabled because of a call to readLightLevel(), stop once nobody is reading it.
+        if ((status & NRF52_LEDMATRIX_STATUS_AUTO_LIGHT_SENSE) && system_timer_current_time() - lightSenseTime > CONFIG_NRF52_LED_MATRIX_LIGHT_SENSE_TIMEOUT)
+        {
+            status &= ~NRF52_LEDMATRIX_STATUS_AUTO_LIGHT_SENSE;
+            mode = (mode == DISPLAY_MODE_GREYSCALE_LIGHT_SENSE) ? DISPLAY_MODE_GREYSCALE : DISPLAY_MODE_BLACK_AND_WHITE;
+
+            // Without the light sense timeslot, continue from the first row.
+            strobeRow = matrixMap.rows - 1;
+        }
+
         // Restore the hardware configuration into LED drive mode.
         status |= NRF52_LEDMATRIX_STATUS_RESET;
         setDisplayMode(mode);
@@ -242,58 +327,88 @@ void NRF52LEDMatrix::render()
     // Move on to the next row.
     strobeRow = (strobeRow + 1) % timeslots;
 
+    // Flip to any newly presented frame at the start of a refresh, so that the whole refresh shows a single frame.
+    if (strobeRow == 0 && (status & NRF52_LEDMATRIX_STATUS_SWAP_PENDING))
+    {
+        uint8_t *b = frontBuffer;
+        frontBuffer = pendingBuffer;
+        pendingBuffer = b;
+        screenBuffer = frontBuffer;
+
+        status &= ~NRF52_LEDMATRIX_STATUS_SWAP_PENDING;
+        status |= NRF52_LEDMATRIX_STATUS_FRAME_DIRTY;
+    }
+
+    // A double buffered frame only changes here, so its timings need only be worked out once, rather than every refresh.
+    if (strobeRow == 0 && (status & NRF52_LEDMATRIX_STATUS_DOUBLE_BUFFER))
+        updateFrameTable();
+
     if(strobeRow < matrixMap.rows)
     {
-        // Common case - configure timer values.
-        MatrixPoint *p = (MatrixPoint *)matrixMap.map + strobeRow;
+        // Common case - configure timer values, from the pixels mapped to this row at the current rotation.
+        const uint16_t *index = pixelIndex + strobeRow * matrixMap.columns;
+        const uint16_t *frame = frameTable + strobeRow * matrixMap.columns;
+        bool buffered = status & NRF52_LEDMATRIX_STATUS_DOUBLE_BUFFER;
+        uint32_t lit = 0;
+        uint32_t period = timerPeriod;
 
         for (int column = 0; column < matrixMap.columns; column++)
         {
-            switch ( this->rotation)
-            {
-              case MATRIX_DISPLAY_ROTATION_0:
-                value = screenBuffer[ p->y * width + p->x];
-                break;
-              case MATRIX_DISPLAY_ROTATION_90:
-                value = screenBuffer[ p->x * width + width - 1 - p->y];
-                break;
-              case MATRIX_DISPLAY_ROTATION_180:
-                value = screenBuffer[ (height - 1 - p->y) * width + width - 1 - p->x];
-                break;
-              case MATRIX_DISPLAY_ROTATION_270:
-                value = screenBuffer[ ( height - 1 - p->x) * width + p->y];
-                break;
-              default:
-                value = screenBuffer[ p->y * width + p->x];
-                break;
-            }
-
-            // Clip pixels to full or zero brightness if in black and white mode.
-            if (mode == DISPLAY_MODE_BLACK_AND_WHITE || mode == DISPLAY_MODE_BLACK_AND_WHITE_LIGHT_SENSE)
-                value = value ? 255 : 0;
-
-            value = value * quantum;
+            // Brightness, gamma and black and white clipping are all folded into the level table.
+            value = buffered ? frame[column] : levels[screenBuffer[index[column]]];
             timer.timer->CC[column+1] = value;
+            lit |= value;
 
             // Set the initial polarity of the column output to HIGH if the pixel brightness is >0. LOW otherwise.
             if (value)
                 NRF_GPIOTE->CONFIG[gpiote[column]] &= ~0x00100000;
             else
                 NRF_GPIOTE->CONFIG[gpiote[column]] |= 0x00100000;
-            
-            p += matrixMap.rows;
         }
 
-        // Enable the drive pin, and start the timer.
-        matrixMap.rowPins[strobeRow]->setDigitalValue(1);
+        if (lit)
+        {
+            // Enable the drive pin, and start the timer.
+            matrixMap.rowPins[strobeRow]->setDigitalValue(1);
+            MICROBIT_ENERGY_STATE(MICROBIT_ENERGY_DISPLAY, true);
+        }
+        else
+        {
+            // Nothing to show on this row. Rather than strobe it, and any unlit rows that follow, wait out their
+            // timeslots in one go. Lit rows keep the same timing, so neither brightness nor refresh rate change.
+            int slots = 1;
+
+            MICROBIT_ENERGY_STATE(MICROBIT_ENERGY_DISPLAY, false);
+
+            while (strobeRow + 1 < matrixMap.rows && isRowDark(strobeRow + 1, screenBuffer))
+            {
+                strobeRow++;
+                slots++;
+            }
+
+            // If the whole display is dark, drop the refresh rate until there is something to show.
+            if (slots == timeslots)
+                slots *= CONFIG_NRF52_LED_MATRIX_IDLE_FRAMES;
+
+            period = timerPeriod * slots;
+        }
+
+        if (period != slotPeriod)
+        {
+            timer.setCompare(0, period);
+            slotPeriod = period;
+        }
     }
     else
     {
         // Perform Light sensing. This is tricky, as we need to reconfigure the timer, PPI and GPIOTE channels to
         // sense and capture the voltage on the LED rows, rather than drive them.
         
+        MICROBIT_ENERGY_STATE(MICROBIT_ENERGY_DISPLAY, false);
+
         // Extend the refresh period to allow for reasonable accuracy.
         timer.setCompare(0, timerPeriod * NRF52_LED_MATRIX_LIGHTSENSE_STROBES);
+        slotPeriod = timerPeriod * NRF52_LED_MATRIX_LIGHTSENSE_STROBES;
        
         // Disable GPIOTE control on the columns pins, and set all column pins to HIGH.
         // n.b. we don't use GPIOTE to do this drive as we need to reuse the channels anyway...
@@ -315,6 +430,8 @@ void NRF52LEDMatrix::render()
     
     timer.timer->TASKS_CLEAR = 1;
     timer.timer->TASKS_START = 1;
+
+    MICROBIT_EVENT_TRACE(MICROBIT_EVENT_TRACE_LED_RENDER | MICROBIT_EVENT_TRACE_END, strobeRow, 0);
 }
 
 /**
@@ -347,10 +464,76 @@ int NRF52LEDMatrix::setBrightness(int b)
 
     // Recalculate our quantum based on the new brightness setting.
     quantum = (timerPeriod * brightness) / (256 * 255);
+    updateLevels();
 
     return DEVICE_OK;
 }
 
+/**
+ * Defines the gamma applied to greyscale pixel values, so that they can be made to appear evenly spaced in brightness.
+ * Pixel values are mapped through a table, so this adds no work to each refresh.
+ *
+ * @param gamma The exponent applied to normalised pixel values. 1.0 is linear; around 2.2 appears perceptually uniform.
+ * @return DEVICE_OK, or DEVICE_INVALID_PARAMETER if gamma is not positive.
+ */
+int NRF52LEDMatrix::setGamma(float gamma)
+{
+    if (gamma <= 0.0f)
+        return DEVICE_INVALID_PARAMETER;
+
+    this->gamma = gamma;
+    updateLevels();
+
+    return DEVICE_OK;
+}
+
+/**
+ * Determines the gamma applied to greyscale pixel values.
+ */
+float NRF52LEDMatrix::getGamma()
+{
+    return gamma;
+}
+
+/**
+ * Determines if a row has no lit pixels, and so need not be strobed.
+ */
+bool NRF52LEDMatrix::isRowDark(int row, const uint8_t *screenBuffer)
+{
+    const uint16_t *index = pixelIndex + row * matrixMap.columns;
+
+    if (status & NRF52_LEDMATRIX_STATUS_DOUBLE_BUFFER)
+        return !(frameLit & (1 << row));
+
+    for (int column = 0; column < matrixMap.columns; column++)
+        if (levels[screenBuffer[index[column]]])
+            return false;
+
+    return true;
+}
+
+/**
+ * Rebuilds levels for the current brightness, mode and gamma, so that render() need only look the timings up.
+ */
+void NRF52LEDMatrix::updateLevels()
+{
+    levels[0] = 0;
+
+    for (int v = 1; v < 256; v++)
+    {
+        // Black and white mode shows any lit pixel at full brightness.
+        int p = blackAndWhite ? 255 : v;
+
+        if (gamma == 1.0f)
+            levels[v] = p * quantum;
+        else
+            levels[v] = (uint16_t) (255 * quantum * powf(p / 255.0f, gamma) + 0.5f);
+    }
+
+    // Any double buffered frame must be worked out again, once the new levels are complete.
+    status |= NRF52_LEDMATRIX_STATUS_FRAME_DIRTY;
+}
+
 /**
  * Determines the last ambient light level sensed.
  *
@@ -359,17 +542,21 @@ int NRF52LEDMatrix::setBrightness(int b)
 int 
 NRF52LEDMatrix::readLightLevel()
 {
-    // Auto-enable light sensing if it is currently disabled
+    // Auto-enable light sensing if it is currently disabled. It is disabled again once readings are no longer being taken.
+    lightSenseTime = system_timer_current_time();
+
     if (mode == DisplayMode::DISPLAY_MODE_BLACK_AND_WHITE)
     {
         setDisplayMode(DisplayMode::DISPLAY_MODE_BLACK_AND_WHITE_LIGHT_SENSE);
         status &= ~NRF52_LEDMATRIX_STATUS_LIGHTREADY;
+        status |= NRF52_LEDMATRIX_STATUS_AUTO_LIGHT_SENSE;
     }
 
     if (mode == DisplayMode::DISPLAY_MODE_GREYSCALE)
     {
         setDisplayMode(DisplayMode::DISPLAY_MODE_GREYSCALE_LIGHT_SENSE);
         status &= ~NRF52_LEDMATRIX_STATUS_LIGHTREADY;
+        status |= NRF52_LEDMATRIX_STATUS_AUTO_LIGHT_SENSE;
     }
 
     // if we've just enabled light sensing, ensure we have a valid reading before returning.
@@ -406,4 +593,131 @@ int NRF52LEDMatrix::setSleep(bool doSleep)
 NRF52LEDMatrix::~NRF52LEDMatrix()
 {
     this->status &= ~DEVICE_COMPONENT_STATUS_SYSTEM_TICK;
-}
\ No newline at end of file
+    setDoubleBuffering(false);
+    free(pixelIndex);
+}
+
+/**
+ * Enables or disables double buffering.
+ *
+ * When double buffered, the display shows the frame most recently passed to it with swap(), rather than
+ * the live contents of image. Fibers can therefore draw into image at any time without partial updates
+ * appearing on the display.
+ *
+ * @param enable true to double buffer, false to display image directly.
+ * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if the frame buffers could not be allocated.
+ */
+int NRF52LEDMatrix::setDoubleBuffering(bool enable)
+{
+    int size = width * height;
+
+    if (enable == isDoubleBuffered())
+        return DEVICE_OK;
+
+    if (enable)
+    {
+        uint8_t *buffers = (uint8_t *) malloc(size * 2);
+        uint16_t *table = (uint16_t *) malloc(matrixMap.rows * matrixMap.columns * sizeof(uint16_t));
+
+        if (buffers == NULL || table == NULL)
+        {
+            free(buffers);
+            free(table);
+            return DEVICE_NO_RESOURCES;
+        }
+
+        // Start by showing whatever is currently displayed.
+        memcpy(buffers, image.getBitmap(), size);
+        memcpy(buffers + size, image.getBitmap(), size);
+
+        frontBuffer = buffers;
+        pendingBuffer = buffers + size;
+        frameTable = table;
+        status |= NRF52_LEDMATRIX_STATUS_FRAME_DIRTY;
+        updateFrameTable();
+        status |= NRF52_LEDMATRIX_STATUS_DOUBLE_BUFFER;
+    }
+    else
+    {
+        // The buffers were allocated together, starting from the lower address.
+        uint8_t *buffers = frontBuffer < pendingBuffer ? frontBuffer : pendingBuffer;
+        uint16_t *table = frameTable;
+
+        target_disable_irq();
+        status &= ~(NRF52_LEDMATRIX_STATUS_DOUBLE_BUFFER | NRF52_LEDMATRIX_STATUS_SWAP_PENDING);
+        frontBuffer = NULL;
+        pendingBuffer = NULL;
+        frameTable = NULL;
+        target_enable_irq();
+
+        free(buffers);
+        free(table);
+    }
+
+    return DEVICE_OK;
+}
+
+/**
+ * Determines if the display is double buffered.
+ */
+bool NRF52LEDMatrix::isDoubleBuffered()
+{
+    return status & NRF52_LEDMATRIX_STATUS_DOUBLE_BUFFER;
+}
+
+/**
+ * Presents the current contents of image, when double buffered.
+ * The image is copied straight away, so may be drawn into again as soon as this returns. It is displayed
+ * from the start of the next refresh, so a frame is never shown partly updated.
+ * If a frame from a previous call has not yet been displayed, it is replaced.
+ *
+ * @return DEVICE_OK on success, or DEVICE_NOT_SUPPORTED if double buffering is not enabled.
+ */
+int NRF52LEDMatrix::swap()
+{
+    if (!isDoubleBuffered())
+        return DEVICE_NOT_SUPPORTED;
+
+    // The display interrupt flips the buffers, so hold it off while the pending frame is written.
+    target_disable_irq();
+    memcpy(pendingBuffer, image.getBitmap(), width * height);
+    status |= NRF52_LEDMATRIX_STATUS_SWAP_PENDING;
+    target_enable_irq();
+
+    return DEVICE_OK;
+}
+
+/**
+ * Determines if a frame passed to swap() is waiting for the next refresh.
+ */
+bool NRF52LEDMatrix::isSwapPending()
+{
+    return status & NRF52_LEDMATRIX_STATUS_SWAP_PENDING;
+}
+/**
+ * Rebuilds frameTable and frameLit from the front buffer, if it has changed since they were last built.
+ * Called at the start of each refresh when double buffered, so that rows of an unchanged frame are simply loaded.
+ */
+void NRF52LEDMatrix::updateFrameTable()
+{
+    if (!(status & NRF52_LEDMATRIX_STATUS_FRAME_DIRTY) || frameTable == NULL)
+        return;
+
+    uint16_t *entry = frameTable;
+    const uint16_t *index = pixelIndex;
+    uint32_t lit = 0;
+
+    for (int row = 0; row < matrixMap.rows; row++)
+    {
+        for (int column = 0; column < matrixMap.columns; column++)
+        {
+            *entry = levels[frontBuffer[*index++]];
+
+            if (*entry++)
+                lit |= 1 << row;
+        }
+    }
+
+    frameLit = lit;
+    status &= ~NRF52_LEDMATRIX_STATUS_FRAME_DIRTY;
+}
@@ -25,6 +25,7 @@ DEALINGS IN THE SOFTWARE.
 
 #include "PacketBuffer.h"
 #include "ErrorNo.h"
+#include "MicroBitRadioFramePool.h"
 
 using namespace codal;
 
@@ -80,6 +81,23 @@ PacketBuffer::PacketBuffer(uint8_t *data, int length, int rssi)
     this->init(data, length, rssi);
 }
 
+/**
+  * Constructor.
+  * Creates a PacketBuffer that takes ownership of existing packet data, without copying it.
+  *
+  * @param data The packet data to adopt, as returned by allocate(). The caller's reference passes to
+  *             the PacketBuffer, so its reference count is not incremented.
+  *
+  * @code
+  * PacketData *d = PacketBuffer::allocate(buf, 3);
+  * PacketBuffer p(d);              // Refers to d, which is freed along with the last PacketBuffer to refer to it.
+  * @endcode
+  */
+PacketBuffer::PacketBuffer(PacketData *data)
+{
+    ptr = data;
+}
+
 /**
   * Copy Constructor.
   * Add ourselves as a reference to an existing PacketBuffer.
@@ -107,19 +125,48 @@ PacketBuffer::PacketBuffer(const PacketBuffer &buffer)
   * @param rssi The radio signal strength at the time this packet was recieved.
   */
 void PacketBuffer::init(uint8_t *data, int length, int rssi)
+{
+    ptr = allocate(data, length, rssi);
+}
+
+/**
+  * Allocates packet data of the given size, holding a single reference, which a PacketBuffer may later adopt.
+  * This allows a packet to be built in place, and handed on without further allocation or copying.
+  *
+  * @param data The data with which to fill the buffer, or NULL to leave it uninitialised.
+  *
+  * @param length The length of the buffer to create.
+  *
+  * @param rssi The radio signal strength at the time this packet was recieved. Defaults to 0.
+  *
+  * @return The packet data, or NULL if insufficient memory is available.
+  *
+  * @note Short packets are held in the radio frame pool once the radio is in use, so must be released with release().
+  */
+PacketData *PacketBuffer::allocate(uint8_t *data, int length, int rssi)
 {
     if (length < 0)
         length = 0;
 
-    ptr = (PacketData *) malloc(sizeof(PacketData) + length);
-    ptr->init();
+    // Short packets are held in a small block of the radio frame pool when one is free, to keep them off the heap.
+    PacketData *p = (PacketData *) MicroBitRadioFramePool::allocateSmall(sizeof(PacketData) + length);
 
-    ptr->length = length;
-    ptr->rssi = rssi;
+    if (p == NULL)
+        p = (PacketData *) malloc(sizeof(PacketData) + length);
+
+    if (p == NULL)
+        return NULL;
+
+    p->init();
+
+    p->length = length;
+    p->rssi = rssi;
 
     // Copy in the data buffer, if provided.
     if (data)
-        memcpy(ptr->payload, data, length);
+        memcpy(p->payload, data, length);
+
+    return p;
 }
 
 /**
@@ -129,7 +176,24 @@ void PacketBuffer::init(uint8_t *data, int length, int rssi)
   */
 PacketBuffer::~PacketBuffer()
 {
-    ptr->decr();
+    release(ptr);
+}
+
+/**
+  * Releases a reference to packet data, returning its storage to wherever it was allocated from once no references remain.
+  *
+  * Packet data returned by allocate() must be released through this method, rather than RefCounted::decr(),
+  * as it may be held in the radio frame pool rather than the heap.
+  *
+  * @param data The packet data to release.
+  */
+void PacketBuffer::release(PacketData *data)
+{
+    // Reference counts hold two per reference, plus a low bit that is always set.
+    if (data->refCount == ((1 << 1) | 1) && MicroBitRadioFramePool::contains(data))
+        MicroBitRadioFramePool::release(data);
+    else
+        data->decr();
 }
 
 /**
@@ -157,7 +221,7 @@ PacketBuffer& PacketBuffer::operator = (const PacketBuffer &p)
     if(ptr == p.ptr)
         return *this;
 
-    ptr->decr();
+    release(ptr);
     ptr = p.ptr;
     ptr->incr();
 
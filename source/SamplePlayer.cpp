@@ -0,0 +1,363 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "SamplePlayer.h"
+#include "AudioBufferPool.h"
+#include "MicroBitFileSystem.h"
+#include "EventModel.h"
+#include "ErrorNo.h"
+
+using namespace codal;
+
+// IMA ADPCM step sizes, indexed by stepIndex.
+static const uint16_t imaStepTable[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45, 50, 55, 60, 66, 73, 80, 88, 97, 107, 118,
+    130, 143, 157, 173, 190, 209, 230, 253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963, 1060,
+    1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484,
+    7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+// IMA ADPCM adjustments to stepIndex, indexed by the magnitude of each code.
+static const int8_t imaIndexTable[8] = { -1, -1, -1, -1, 2, 4, 6, 8 };
+
+/**
+ * Constructor.
+ *
+ * @param id The ID of this component, used for its events.
+ */
+SamplePlayer::SamplePlayer(uint16_t id)
+{
+    this->id = id;
+    this->downStream = NULL;
+    this->data = NULL;
+    this->fd = -1;
+    this->length = 0;
+    this->position = 0;
+    this->encoding = SAMPLE_PLAYER_ENCODING_PCM8;
+    this->sampleRate = CONFIG_SAMPLE_PLAYER_DEFAULT_SAMPLE_RATE;
+    this->predictor = 0;
+    this->stepIndex = 0;
+
+    // File system reads are performed in fiber context.
+    if (EventModel::defaultEventBus)
+        EventModel::defaultEventBus->listen(id, SAMPLE_PLAYER_EVT_REFILL, this, &SamplePlayer::onRefill);
+}
+
+/**
+ * Destructor.
+ */
+SamplePlayer::~SamplePlayer()
+{
+    if (EventModel::defaultEventBus)
+        EventModel::defaultEventBus->ignore(id, SAMPLE_PLAYER_EVT_REFILL, this, &SamplePlayer::onRefill);
+
+    release();
+}
+
+/**
+ * Starts playing samples held in memory, such as a const array linked into flash.
+ * The data is not copied, and so must remain valid until playback completes.
+ * Any sound currently playing is stopped.
+ *
+ * @param data The encoded samples.
+ * @param length The length of the encoded samples, in bytes.
+ * @param encoding The encoding of the samples, e.g. SAMPLE_PLAYER_ENCODING_PCM8.
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the encoding is not supported.
+ */
+int SamplePlayer::play(const uint8_t *data, int length, int encoding)
+{
+    if (data == NULL || length <= 0 || encoding < SAMPLE_PLAYER_ENCODING_PCM8 || encoding > SAMPLE_PLAYER_ENCODING_IMA_ADPCM)
+        return DEVICE_INVALID_PARAMETER;
+
+    stop();
+
+    this->data = data;
+    this->length = length;
+    this->position = 0;
+    this->encoding = encoding;
+    this->predictor = 0;
+    this->stepIndex = 0;
+    status |= SAMPLE_PLAYER_STATUS_PLAYING;
+
+    int len = min(encodedBlockSize(), length);
+    position = len;
+    decode(data, len);
+
+    return DEVICE_OK;
+}
+
+/**
+ * Starts playing samples held in a file in MicroBitFileSystem::defaultFileSystem.
+ * Any sound currently playing is stopped.
+ *
+ * @param filename The name of the file.
+ * @param encoding The encoding of the samples, e.g. SAMPLE_PLAYER_ENCODING_PCM8.
+ *
+ * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the file cannot be opened or the encoding is not supported,
+ * or DEVICE_NOT_SUPPORTED if there is no file system.
+ */
+int SamplePlayer::play(const char *filename, int encoding)
+{
+    if (MicroBitFileSystem::defaultFileSystem == NULL)
+        return DEVICE_NOT_SUPPORTED;
+
+    if (filename == NULL || encoding < SAMPLE_PLAYER_ENCODING_PCM8 || encoding > SAMPLE_PLAYER_ENCODING_IMA_ADPCM)
+        return DEVICE_INVALID_PARAMETER;
+
+    stop();
+
+    int f = MicroBitFileSystem::defaultFileSystem->open(filename, MB_READ);
+
+    if (f < 0)
+        return DEVICE_INVALID_PARAMETER;
+
+    this->fd = f;
+    this->data = NULL;
+    this->length = 0;
+    this->position = 0;
+    this->encoding = encoding;
+    this->predictor = 0;
+    this->stepIndex = 0;
+    status |= SAMPLE_PLAYER_STATUS_PLAYING | SAMPLE_PLAYER_STATUS_FILE;
+
+    // We are in fiber context, so the first block can be read straight away.
+    onRefill(Event(id, SAMPLE_PLAYER_EVT_REFILL, CREATE_ONLY));
+
+    return DEVICE_OK;
+}
+
+/**
+ * Stops playback. A SAMPLE_PLAYER_EVT_DONE event is raised if a sound was playing.
+ */
+void SamplePlayer::stop()
+{
+    if (release())
+        Event(id, SAMPLE_PLAYER_EVT_DONE);
+}
+
+/**
+ * Stops playback and releases the file being played, if any.
+ *
+ * @return true if a sound was playing.
+ */
+bool SamplePlayer::release()
+{
+    bool playing = status & SAMPLE_PLAYER_STATUS_PLAYING;
+
+    if (fd >= 0 && MicroBitFileSystem::defaultFileSystem)
+        MicroBitFileSystem::defaultFileSystem->close(fd);
+
+    fd = -1;
+    data = NULL;
+    next = ManagedBuffer();
+    status &= ~(SAMPLE_PLAYER_STATUS_PLAYING | SAMPLE_PLAYER_STATUS_FILE);
+
+    return playing;
+}
+
+/**
+ * Determines if a sound is being played.
+ *
+ * @return true if playing, false otherwise.
+ */
+bool SamplePlayer::isPlaying()
+{
+    return status & SAMPLE_PLAYER_STATUS_PLAYING;
+}
+
+/**
+ * Defines the sample rate of the samples being played.
+ * This should match the rate of the mixer channel the player is attached to.
+ *
+ * @param sampleRate The sample rate, in Hz.
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the rate is not positive.
+ */
+int SamplePlayer::setSampleRate(float sampleRate)
+{
+    if (sampleRate <= 0.0f)
+        return DEVICE_INVALID_PARAMETER;
+
+    this->sampleRate = sampleRate;
+    return DEVICE_OK;
+}
+
+/**
+ * Determines the sample rate of the samples being played.
+ */
+float SamplePlayer::getSampleRate()
+{
+    return sampleRate;
+}
+
+/**
+ * Determines the number of encoded bytes that make up one output block.
+ */
+int SamplePlayer::encodedBlockSize()
+{
+    // Each output sample is two bytes. PCM has one sample per byte, and IMA ADPCM two.
+    return encoding == SAMPLE_PLAYER_ENCODING_IMA_ADPCM ? CONFIG_SAMPLE_PLAYER_BLOCK_SIZE / 4 : CONFIG_SAMPLE_PLAYER_BLOCK_SIZE / 2;
+}
+
+/**
+ * Prepares the block to be provided by the next pull(), and announces it downstream.
+ * Playback is completed if there are no more samples.
+ *
+ * @param encoded The next encoded bytes, or NULL if there are none.
+ * @param len The number of encoded bytes available.
+ */
+void SamplePlayer::decode(const uint8_t *encoded, int len)
+{
+    if (encoded == NULL || len <= 0)
+    {
+        stop();
+        return;
+    }
+
+    int samples = encoding == SAMPLE_PLAYER_ENCODING_IMA_ADPCM ? len * 2 : len;
+    ManagedBuffer b = AudioBufferPool::allocate(samples * 2);
+    int16_t *out = (int16_t *) &b[0];
+
+    if (encoding == SAMPLE_PLAYER_ENCODING_PCM8)
+    {
+        for (int i = 0; i < len; i++)
+            *out++ = (int16_t) ((encoded[i] - 128) << 8);
+    }
+    else if (encoding == SAMPLE_PLAYER_ENCODING_PCM8_SIGNED)
+    {
+        for (int i = 0; i < len; i++)
+            *out++ = (int16_t) (((int8_t) encoded[i]) << 8);
+    }
+    else
+    {
+        int p = predictor;
+        int index = stepIndex;
+
+        for (int i = 0; i < samples; i++)
+        {
+            int code = (i & 1) ? encoded[i >> 1] >> 4 : encoded[i >> 1] & 0x0F;
+            int step = imaStepTable[index];
+            int diff = step >> 3;
+
+            if (code & 4)
+                diff += step;
+            if (code & 2)
+                diff += step >> 1;
+            if (code & 1)
+                diff += step >> 2;
+
+            p += (code & 8) ? -diff : diff;
+            p = max(-32768, min(p, 32767));
+
+            index += imaIndexTable[code & 7];
+            index = max(0, min(index, 88));
+
+            *out++ = (int16_t) p;
+        }
+
+        predictor = p;
+        stepIndex = index;
+    }
+
+    next = b;
+
+    if (downStream)
+        downStream->pullRequest();
+}
+
+/**
+ * Reads and decodes the next block from the file being played. Called in fiber context via the event bus.
+ */
+void SamplePlayer::onRefill(Event)
+{
+    if (!(status & SAMPLE_PLAYER_STATUS_FILE) || fd < 0 || MicroBitFileSystem::defaultFileSystem == NULL)
+        return;
+
+    uint8_t encoded[CONFIG_SAMPLE_PLAYER_BLOCK_SIZE / 2];
+    int len = MicroBitFileSystem::defaultFileSystem->read(fd, encoded, encodedBlockSize());
+
+    // Playback may have been stopped, or restarted, while we were reading.
+    if (!(status & SAMPLE_PLAYER_STATUS_FILE))
+        return;
+
+    position += max(len, 0);
+    decode(len > 0 ? encoded : NULL, len);
+}
+
+/**
+ * Provide the next available ManagedBuffer to our downstream caller, if available.
+ */
+ManagedBuffer SamplePlayer::pull()
+{
+    ManagedBuffer output = next;
+    next = ManagedBuffer();
+
+    // Prepare the following block. Memory can be decoded right away, but files are read in fiber context.
+    if (output.length() > 0 && (status & SAMPLE_PLAYER_STATUS_PLAYING))
+    {
+        if (status & SAMPLE_PLAYER_STATUS_FILE)
+        {
+            Event(id, SAMPLE_PLAYER_EVT_REFILL);
+        }
+        else
+        {
+            int len = min(encodedBlockSize(), (int) (length - position));
+            const uint8_t *encoded = len > 0 ? data + position : NULL;
+
+            position += max(len, 0);
+            decode(encoded, len);
+        }
+    }
+
+    return output;
+}
+
+/**
+ * Define a downstream component for data stream.
+ *
+ * @sink The component that data will be delivered to, when it is available
+ */
+void SamplePlayer::connect(DataSink &sink)
+{
+    this->downStream = &sink;
+
+    if (next.length() > 0)
+        downStream->pullRequest();
+}
+
+/**
+ * Determines if this source is connected to a downstream component.
+ */
+bool SamplePlayer::isConnected()
+{
+    return this->downStream != NULL;
+}
+
+/**
+ * Determines the data format of the output, which is always DATASTREAM_FORMAT_16BIT_SIGNED.
+ */
+int SamplePlayer::getFormat()
+{
+    return DATASTREAM_FORMAT_16BIT_SIGNED;
+}
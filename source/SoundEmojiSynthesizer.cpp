@@ -28,9 +28,13 @@ DEALINGS IN THE SOFTWARE.
 #include "CodalUtil.h"
 #include "ErrorNo.h"
 #include "MicroBitAudio.h"
+#include "AudioBufferPool.h"
+#include "MicroBitHeapStats.h"
 
 using namespace codal;
 
+uint16_t *SoundEmojiSynthesizer::sineTable = NULL;
+
 /**
   * Class definition for a Synthesizer.
   * A Synthesizer generates a tone waveform based on a number of overlapping waveforms.
@@ -47,6 +51,9 @@ SoundEmojiSynthesizer::SoundEmojiSynthesizer(uint16_t id, int sampleRate) : Coda
 
     this->samplesToWrite = 0;
     this->samplesWritten = 0;
+#if CONFIG_ENABLED(CONFIG_AUDIO_STATS)
+    this->stats.reset();
+#endif
 
     setSampleRate(sampleRate);
     setSampleRange(1023);
@@ -112,6 +119,8 @@ int SoundEmojiSynthesizer::play(ManagedBuffer sound)
     if (sound.length() < (int) sizeof(SoundEffect))
         return DEVICE_INVALID_PARAMETER;
 
+    prepareTones(sound);
+
     // If a playout is already in progress, block until it has been scheduled.
     lock.wait();
 
@@ -129,6 +138,11 @@ int SoundEmojiSynthesizer::play(ManagedBuffer sound)
         status |= EMOJI_SYNTHESIZER_STATUS_ACTIVE;
         downStream->pullRequest();
     }
+    else
+    {
+        // Restart the audio output, if it was stopped during silence.
+        MicroBitAudio::requestActivation();
+    }
 
     return DEVICE_OK;
 }
@@ -138,6 +152,14 @@ void SoundEmojiSynthesizer::stop() {
         status |= EMOJI_SYNTHESIZER_STATUS_STOPPING;
 }
 
+/**
+* Determines if a sound effect is scheduled or being played.
+* @return true if this synthesizer is busy, false if a call to play() would start immediately.
+*/
+bool SoundEmojiSynthesizer::isPlaying() {
+    return effectBuffer.length() > 0 || lock.getWaitCount() > 0;
+}
+
 /**
  * Schedules the next sound effect as defined in the effectBuffer, if available.
  * @return true if we've just completed a buffer of effects, false otherwise.
@@ -195,6 +217,9 @@ bool SoundEmojiSynthesizer::nextSoundEffect()
  */
 ManagedBuffer SoundEmojiSynthesizer::pull()
 {
+#if CONFIG_ENABLED(CONFIG_AUDIO_STATS)
+    CODAL_TIMESTAMP statsStart = stats.begin();
+#endif
     ManagedBuffer output = buffer2;
 
     // If the last DMA buffer was only partially filled, try to fill it.
@@ -220,6 +245,12 @@ ManagedBuffer SoundEmojiSynthesizer::pull()
             Event(id, DEVICE_SOUND_EMOJI_SYNTHESIZER_EVT_PLAYBACK_COMPLETE);
     }
 
+#if CONFIG_ENABLED(CONFIG_AUDIO_STATS)
+    if (output.length() == 0 && effectBuffer.length() > 0)
+        stats.underruns++;
+
+    stats.end(statsStart);
+#endif
     return output;
 }
 
@@ -271,7 +302,7 @@ ManagedBuffer SoundEmojiSynthesizer::fillOutputBuffer()
             }
             else
             {
-                buffer = ManagedBuffer(bufferSize);
+                buffer = AudioBufferPool::allocate(bufferSize);
                 sample = (uint16_t *) &buffer[0];
             }
 
@@ -298,29 +329,18 @@ ManagedBuffer SoundEmojiSynthesizer::fillOutputBuffer()
             for (int i = 1; i < EMOJI_SYNTHESIZER_TONE_EFFECTS; i++)
                 stepEndPosition = min(stepEndPosition, effectStepEnd[i]);
 
-            // Write samples until the end of the next effect-step
-            while (samplesWritten < stepEndPosition)
+            // Write samples until the end of the next effect-step, or until we've filled the requested buffer
+            int count = min(stepEndPosition - samplesWritten, (int) (bufferEnd - sample));
+            if (count > 0)
             {
-                // Stop processing when we've filled the requested buffer
-                if (sample == bufferEnd)
-                    return buffer;
-
-                // Synthesize a sample
-                float s = effect->tone.tonePrint(effect->tone.parameter, (int) position);
-
-                // Apply volume scaling and OR mask (if specified).
-                *sample = ((uint16_t) ((s * gain) + offset)) | orMask;
-
-                // Move on our pointers.
-                sample++;
-                samplesWritten++;
-                position += skip;
-
-                // Keep our toneprint pointer in range
-                while(position > EMOJI_SYNTHESIZER_TONE_WIDTH_F)
-                    position -= EMOJI_SYNTHESIZER_TONE_WIDTH_F;
+                renderTone(sample, count, skip, gain, offset);
+                sample += count;
+                samplesWritten += count;
             }
 
+            if (samplesWritten < stepEndPosition)
+                return buffer;
+
             // Invoke the effect function for any effects that are due.
             for (int i = 0; i < EMOJI_SYNTHESIZER_TONE_EFFECTS; i++)
             {
@@ -357,6 +377,113 @@ ManagedBuffer SoundEmojiSynthesizer::fillOutputBuffer()
     return buffer;
 }
 
+/**
+ * Render samples of the current effect's toneprint at a fixed frequency and volume.
+ * Known toneprints are rendered by a specialised loop; any other uses the toneprint function.
+ *
+ * @param sample The buffer to write samples to.
+ * @param count The number of samples to write.
+ * @param skip The toneprint phase increment per sample.
+ * @param gain The volume scaling to apply to each sample.
+ * @param offset The offset to add to each sample after scaling.
+ */
+void SoundEmojiSynthesizer::renderTone(uint16_t *sample, int count, float skip, float gain, float offset)
+{
+    TonePrintFunction tonePrint = effect->tone.tonePrint;
+    void *parameter = effect->tone.parameter;
+    uint16_t mask = orMask;
+
+    // Bring the phase and its increment into the toneprint, then move to fixed point.
+    while (position >= EMOJI_SYNTHESIZER_TONE_WIDTH_F)
+        position -= EMOJI_SYNTHESIZER_TONE_WIDTH_F;
+    while (position < 0)
+        position += EMOJI_SYNTHESIZER_TONE_WIDTH_F;
+    while (skip >= EMOJI_SYNTHESIZER_TONE_WIDTH_F)
+        skip -= EMOJI_SYNTHESIZER_TONE_WIDTH_F;
+    while (skip < 0)
+        skip += EMOJI_SYNTHESIZER_TONE_WIDTH_F;
+
+    uint32_t phase = (uint32_t) (position * EMOJI_SYNTHESIZER_PHASE_SCALE_F);
+    uint32_t delta = (uint32_t) (skip * EMOJI_SYNTHESIZER_PHASE_SCALE_F);
+    uint16_t *end = sample + count;
+
+    // The specialised kernels match the toneprints in Synthesizer, which take no parameter.
+    if (parameter != NULL)
+        tonePrint = NULL;
+
+    if (tonePrint == Synthesizer::SquareWaveTone)
+    {
+        uint16_t high = ((uint16_t) ((1023.0f * gain) + offset)) | mask;
+        uint16_t low = ((uint16_t) offset) | mask;
+
+        for (; sample < end; sample++, phase += delta)
+            *sample = (phase >> EMOJI_SYNTHESIZER_PHASE_BITS) < EMOJI_SYNTHESIZER_TONE_WIDTH / 2 ? high : low;
+    }
+    else if (tonePrint == Synthesizer::SawtoothTone)
+    {
+        for (; sample < end; sample++, phase += delta)
+            *sample = ((uint16_t) (((phase >> EMOJI_SYNTHESIZER_PHASE_BITS) * gain) + offset)) | mask;
+    }
+    else if (tonePrint == Synthesizer::TriangleTone)
+    {
+        for (; sample < end; sample++, phase += delta)
+        {
+            int p = phase >> EMOJI_SYNTHESIZER_PHASE_BITS;
+            int s = p < EMOJI_SYNTHESIZER_TONE_WIDTH / 2 ? p * 2 : (EMOJI_SYNTHESIZER_TONE_WIDTH - 1 - p) * 2;
+            *sample = ((uint16_t) ((s * gain) + offset)) | mask;
+        }
+    }
+    else if (tonePrint == Synthesizer::SineTone && sineTable)
+    {
+        const uint16_t *table = sineTable;
+
+        for (; sample < end; sample++, phase += delta)
+            *sample = ((uint16_t) ((table[phase >> EMOJI_SYNTHESIZER_PHASE_BITS] * gain) + offset)) | mask;
+    }
+    else
+    {
+        // Noise, and any toneprint we don't know, is defined by its function.
+        tonePrint = effect->tone.tonePrint;
+
+        for (; sample < end; sample++, phase += delta)
+            *sample = ((uint16_t) ((tonePrint(parameter, phase >> EMOJI_SYNTHESIZER_PHASE_BITS) * gain) + offset)) | mask;
+    }
+
+    position = phase / EMOJI_SYNTHESIZER_PHASE_SCALE_F;
+}
+
+/**
+ * Builds the shared sine wavetable from Synthesizer::SineTone, if any effect in the given buffer needs it.
+ * This is done when an effect is scheduled, so that no allocation takes place in interrupt context.
+ *
+ * @param sound A buffer containing an array of one or more SoundEffects.
+ */
+void SoundEmojiSynthesizer::prepareTones(ManagedBuffer sound)
+{
+    if (sineTable)
+        return;
+
+    SoundEffect *fx = (SoundEffect *) &sound[0];
+    int effects = sound.length() / sizeof(SoundEffect);
+
+    for (int i = 0; i < effects; i++)
+    {
+        if (fx[i].tone.tonePrint == Synthesizer::SineTone)
+        {
+            uint16_t *table = (uint16_t *) malloc(EMOJI_SYNTHESIZER_TONE_WIDTH * sizeof(uint16_t));
+            if (table == NULL)
+                return;
+            MICROBIT_HEAP_TRACK(MICROBIT_HEAP_TAG_AUDIO, table);
+
+            for (int p = 0; p < EMOJI_SYNTHESIZER_TONE_WIDTH; p++)
+                table[p] = Synthesizer::SineTone(NULL, p);
+
+            sineTable = table;
+            return;
+        }
+    }
+}
+
 /**
  * Determine the sample rate currently in use by this Synthesizer.
  * @return the current sample rate, in Hz.
@@ -31,14 +31,32 @@ DEALINGS IN THE SOFTWARE.
 #include "SoundSynthesizerEffects.h"
 #include "ManagedString.h"
 #include "CodalDmesg.h"
+#include "MicroBitRandom.h"
 
 #define CLAMP(lo, v, hi) ((v) = ((v) < (lo) ? (lo) : (v) > (hi) ? (hi) : (v)))
 
 /**
   * Default Constructor.
+  *
+  * @param synth The synthesizer used to play sound expressions.
+  * @param mixer The mixer to attach further synthesizers to, so that sounds can overlap. If NULL, sounds are always played in turn on synth.
   */
-SoundExpressions::SoundExpressions(SoundEmojiSynthesizer &synth): synth(synth)
-{}
+SoundExpressions::SoundExpressions(SoundEmojiSynthesizer &synth, Mixer2 *mixer): synth(synth), mixer(mixer)
+{
+    voices[0] = &synth;
+    channels[0] = NULL;
+    for (int i = 1; i < CONFIG_SOUND_EXPRESSION_VOICES; i++)
+    {
+        voices[i] = NULL;
+        channels[i] = NULL;
+    }
+
+#if CONFIG_SOUND_EXPRESSION_CACHE_SIZE > 0
+    cacheTime = 0;
+    for (int i = 0; i < CONFIG_SOUND_EXPRESSION_CACHE_SIZE; i++)
+        cache[i].lastUsed = 0;
+#endif
+}
 
 /**
   * Destructor.
@@ -47,6 +65,40 @@ SoundExpressions::SoundExpressions(SoundEmojiSynthesizer &synth): synth(synth)
   */
 SoundExpressions::~SoundExpressions()
 {
+    for (int i = 1; i < CONFIG_SOUND_EXPRESSION_VOICES; i++)
+    {
+        if (channels[i])
+            mixer->removeChannel(channels[i]);
+
+        delete voices[i];
+    }
+}
+
+/**
+ * Selects a synthesizer to play the next sound on.
+ * This is the first one that is idle, creating and attaching a new one to the mixer if needed.
+ * If every synthesizer is busy, the primary synthesizer is used, and the sound queues behind it.
+ */
+SoundEmojiSynthesizer &SoundExpressions::allocate()
+{
+    for (int i = 0; i < CONFIG_SOUND_EXPRESSION_VOICES; i++)
+    {
+        if (voices[i] == NULL)
+        {
+            if (mixer == NULL)
+                break;
+
+            voices[i] = new SoundEmojiSynthesizer(DEVICE_ID_SOUND_EMOJI_SYNTHESIZER_0 + i);
+            voices[i]->allowEmptyBuffers(true);
+            channels[i] = mixer->addChannel(*voices[i]);
+            return *voices[i];
+        }
+
+        if (!voices[i]->isPlaying())
+            return *voices[i];
+    }
+
+    return synth;
 }
 
 /**
@@ -55,8 +107,10 @@ SoundExpressions::~SoundExpressions()
  */
 void SoundExpressions::play(ManagedBuffer sound, uint16_t event)
 {
-    fiber_wake_on_event(synth.id, event);
-    playAsync(sound);
+    SoundEmojiSynthesizer &voice = allocate();
+
+    fiber_wake_on_event(voice.id, event);
+    voice.play(sound);
     schedule();
 }
 
@@ -66,18 +120,99 @@ void SoundExpressions::play(ManagedBuffer sound, uint16_t event)
  */
 void SoundExpressions::playAsync(ManagedBuffer sound)
 {
-    synth.play(sound);
+    allocate().play(sound);
+}
+
+/**
+ * Plays a sound encoded as an array of one or more SoundEffect structures, starting at the given time.
+ * Does not block unless a sound effect is already queued.
+ */
+void SoundExpressions::playAsync(ManagedBuffer sound, CODAL_TIMESTAMP time)
+{
+    SoundEmojiSynthesizer &voice = allocate();
+    MixerChannel *channel = mixer ? mixer->getChannel(voice) : NULL;
+
+    // Only an idle voice can be held back, without also delaying the sound it is playing.
+    if (channel && !voice.isPlaying())
+        channel->setStartTime(time);
+
+    voice.play(sound);
 }
 
 void SoundExpressions::play(ManagedString sound, uint16_t event) {
-    fiber_wake_on_event(synth.id, event);
-    playAsync(sound);
-    schedule();
+    ManagedBuffer b = createSoundEffects(sound);
+    if (b.length() == 0) {
+        return;
+    }
+    play(b, event);
 }
 
 void SoundExpressions::playAsync(ManagedString sound) {
-    // Sound is either encoded data or a name of a built-in sound for which we have the data.
-    sound = lookupBuiltIn(sound);
+    ManagedBuffer b = createSoundEffects(sound);
+    if (b.length() == 0) {
+        return;
+    }
+    playAsync(b);
+}
+
+void SoundExpressions::playAsync(ManagedString sound, CODAL_TIMESTAMP time) {
+    ManagedBuffer b = createSoundEffects(sound);
+    if (b.length() == 0) {
+        return;
+    }
+    playAsync(b, time);
+}
+
+ManagedBuffer SoundExpressions::createSoundEffects(ManagedString sound) {
+    // Sound is either encoded data or a name of a built-in sound for which we have precompiled effects.
+    int effectCount = 0;
+    const SoundExpressionEffect *effects = lookupBuiltIn(sound, effectCount);
+
+    // Hold a reference to any compiled expression until its effects have been built.
+    ManagedBuffer compiled;
+    if (effects == NULL) {
+        compiled = lookupCompiled(sound);
+        if (compiled.length() == 0) {
+            return ManagedBuffer();
+        }
+        effects = (const SoundExpressionEffect *) &compiled[0];
+        effectCount = compiled.length() / sizeof(SoundExpressionEffect);
+    }
+
+    // The synthesizer updates effects as it plays them, so each play gets its own buffer.
+    ManagedBuffer b(sizeof(SoundEffect) * effectCount);
+    SoundEffect *fx = (SoundEffect *) &b[0];
+    for (int i = 0; i < effectCount; ++i) {
+        buildSoundEffect(&effects[i], fx++);
+    }
+    return b;
+}
+
+ManagedBuffer SoundExpressions::lookupCompiled(ManagedString sound) {
+#if CONFIG_SOUND_EXPRESSION_CACHE_SIZE > 0
+    SoundExpressionCacheEntry *victim = &cache[0];
+    for (int i = 0; i < CONFIG_SOUND_EXPRESSION_CACHE_SIZE; ++i) {
+        SoundExpressionCacheEntry *entry = &cache[i];
+        if (entry->lastUsed && entry->sound == sound) {
+            entry->lastUsed = ++cacheTime;
+            return entry->effects;
+        }
+        if (entry->lastUsed < victim->lastUsed) {
+            victim = entry;
+        }
+    }
+
+    // Invalid expressions are cached too (as an empty buffer), so they are not reparsed on every play.
+    victim->sound = sound;
+    victim->effects = compileSoundExpression(sound);
+    victim->lastUsed = ++cacheTime;
+    return victim->effects;
+#else
+    return compileSoundExpression(sound);
+#endif
+}
+
+ManagedBuffer SoundExpressions::compileSoundExpression(ManagedString sound) {
     const unsigned soundLen = sound.length();
     const char *soundChars = sound.toCharArray();
 
@@ -85,22 +220,22 @@ void SoundExpressions::playAsync(ManagedString sound) {
     const unsigned charsPerEffect = 72;
     const unsigned effectCount = (soundLen + 1) / (charsPerEffect + 1);
     const unsigned expectedLength = effectCount * (charsPerEffect + 1) - 1;
-    if (soundLen != expectedLength) {
-        return;
+    if (effectCount == 0 || soundLen != expectedLength) {
+        return ManagedBuffer();
     }
-    
-    ManagedBuffer b(sizeof(SoundEffect) * effectCount);
-    SoundEffect *fx = (SoundEffect *) &b[0];
+
+    ManagedBuffer b(sizeof(SoundExpressionEffect) * effectCount);
+    SoundExpressionEffect *effect = (SoundExpressionEffect *) &b[0];
     for (unsigned i = 0; i < effectCount; ++i)  {
         const int start = i * charsPerEffect + i;
         if (start > 0 && soundChars[start - 1] != ',') {
-            return;
+            return ManagedBuffer();
         }
-        if (!parseSoundExpression(&soundChars[start], fx++)) {
-            return;
+        if (!parseSoundExpression(&soundChars[start], effect++)) {
+            return ManagedBuffer();
         }
     }
-    synth.play(b);
+    return b;
 }
 
 int SoundExpressions::parseDigits(const char *input, const int digits) {
@@ -122,68 +257,90 @@ int SoundExpressions::parseDigits(const char *input, const int digits) {
 }
 
 void SoundExpressions::stop() {
-    synth.stop();
+    for (int i = 0; i < CONFIG_SOUND_EXPRESSION_VOICES; i++) {
+        if (voices[i]) {
+            voices[i]->stop();
+        }
+    }
 }
 
 int SoundExpressions::applyRandom(int value, int rand) {
     if (value < 0 || rand < 0) {
         return -1;
     }
-    const int delta = random(rand * 2 + 1) - rand;
+    const int delta = (int) microbit_random_range(MICROBIT_RANDOM_STREAM_AUDIO, rand * 2 + 1) - rand;
     return abs(value + delta);
 }
 
-bool SoundExpressions::parseSoundExpression(const char *soundChars, SoundEffect *fx) {
+bool SoundExpressions::parseSoundExpression(const char *soundChars, SoundExpressionEffect *effect) {
     // Encoded as a sequence of zero padded decimal strings.
     // This encoding is worth reconsidering if we can!
     // The ADSR effect (and perhaps others in future) has two parameters which cannot be expressed.
 
     // 72 chars total
     //  [0] 0-4 wave
-    int wave = parseDigits(&soundChars[0], 1);
+    effect->wave = parseDigits(&soundChars[0], 1);
     //  [1] 0000-1023 volume
-    int effectVolume = parseDigits(&soundChars[1], 4);
+    effect->volume = parseDigits(&soundChars[1], 4);
     //  [5] 0000-9999 frequency
-    int frequency = parseDigits(&soundChars[5], 4);
+    effect->frequency = parseDigits(&soundChars[5], 4);
     //  [9] 0000-9999 duration
-    int duration = parseDigits(&soundChars[9], 4);
+    effect->duration = parseDigits(&soundChars[9], 4);
     // [13] 00 shape (specific known values)
-    int shape = parseDigits(&soundChars[13], 2);
+    effect->shape = parseDigits(&soundChars[13], 2);
     // [15] XXX unused/bug. This was startFrequency but we use frequency above.
     // [18] 0000-9999 end frequency
-    int endFrequency = parseDigits(&soundChars[18], 4);
+    effect->endFrequency = parseDigits(&soundChars[18], 4);
     // [22] XXXX unused. This was start volume but we use volume above.
     // [26] 0000-1023 end volume
-    int endVolume = parseDigits(&soundChars[26], 4);
+    effect->endVolume = parseDigits(&soundChars[26], 4);
     // [30] 0000-9999 steps
-    int steps = parseDigits(&soundChars[30], 4);
+    effect->steps = parseDigits(&soundChars[30], 4);
     // [34] 00-03 fx choice
-    int fxChoice = parseDigits(&soundChars[34], 2);
+    effect->fxChoice = parseDigits(&soundChars[34], 2);
     // [36] 0000-9999 fxParam
-    int fxParam = parseDigits(&soundChars[36], 4);
+    effect->fxParam = parseDigits(&soundChars[36], 4);
     // [40] 0000-9999 fxnSteps
-    int fxnSteps = parseDigits(&soundChars[40], 4);
+    effect->fxnSteps = parseDigits(&soundChars[40], 4);
 
     // Details that encoded randomness to be applied when frame is used:
-    // Can the randomness cause any parameters to go out of range?
     // [44] 0000-9999 frequency random
-    frequency = applyRandom(frequency, parseDigits(&soundChars[44], 4));
+    effect->frequencyRandom = parseDigits(&soundChars[44], 4);
     // [48] 0000-9999 end frequency random
-    endFrequency = applyRandom(endFrequency, parseDigits(&soundChars[48], 4));
+    effect->endFrequencyRandom = parseDigits(&soundChars[48], 4);
     // [52] 0000-9999 volume random
-    effectVolume = applyRandom(effectVolume, parseDigits(&soundChars[52], 4));
+    effect->volumeRandom = parseDigits(&soundChars[52], 4);
     // [56] 0000-9999 end volume random
-    endVolume = applyRandom(endVolume, parseDigits(&soundChars[56], 4));
+    effect->endVolumeRandom = parseDigits(&soundChars[56], 4);
     // [60] 0000-9999 duration random
-    duration = applyRandom(duration, parseDigits(&soundChars[60], 4));
+    effect->durationRandom = parseDigits(&soundChars[60], 4);
     // [64] 0000-9999 fxParamRandom
-    fxParam = applyRandom(fxParam, parseDigits(&soundChars[64], 4));
+    effect->fxParamRandom = parseDigits(&soundChars[64], 4);
     // [68] 0000-9999 fxnStepsRandom
-    fxnSteps = applyRandom(fxnSteps, parseDigits(&soundChars[68], 4));
+    effect->fxnStepsRandom = parseDigits(&soundChars[68], 4);
 
-    if (frequency == -1 || endFrequency == -1 || effectVolume == -1 || endVolume == -1 || duration == -1 || fxParam == -1 || fxnSteps == -1) {
+    // Any field that has randomness applied to it must be valid.
+    if (effect->frequency < 0 || effect->endFrequency < 0 || effect->volume < 0 || effect->endVolume < 0 || effect->duration < 0 || effect->fxParam < 0 || effect->fxnSteps < 0 ||
+        effect->frequencyRandom < 0 || effect->endFrequencyRandom < 0 || effect->volumeRandom < 0 || effect->endVolumeRandom < 0 || effect->durationRandom < 0 || effect->fxParamRandom < 0 || effect->fxnStepsRandom < 0) {
         return false;
     }
+    return true;
+}
+
+void SoundExpressions::buildSoundEffect(const SoundExpressionEffect *effect, SoundEffect *fx) {
+    // Randomness is applied each time an effect is built, so every play of a compiled expression varies as it would when parsed.
+    // Can the randomness cause any parameters to go out of range?
+    const int wave = effect->wave;
+    const int shape = effect->shape;
+    const int steps = effect->steps;
+    const int fxChoice = effect->fxChoice;
+    int frequency = applyRandom(effect->frequency, effect->frequencyRandom);
+    int endFrequency = applyRandom(effect->endFrequency, effect->endFrequencyRandom);
+    int effectVolume = applyRandom(effect->volume, effect->volumeRandom);
+    int endVolume = applyRandom(effect->endVolume, effect->endVolumeRandom);
+    int duration = applyRandom(effect->duration, effect->durationRandom);
+    int fxParam = applyRandom(effect->fxParam, effect->fxParamRandom);
+    int fxnSteps = applyRandom(effect->fxnSteps, effect->fxnStepsRandom);
 
     float volumeScaleFactor = 1.0f;
 
@@ -301,51 +458,118 @@ bool SoundExpressions::parseSoundExpression(const char *soundChars, SoundEffect
             fx->effects[2].parameter[0] = (float) fxParam;
             break;
     }
-    return true;
 }
 
-// Names and data for each built-in sound expression.
+// Names and precompiled effects for each built-in sound expression.
+// Each table is the decoded form of the sound expression string given above it, with fields in the order of SoundExpressionEffect.
 static ManagedString giggle("giggle");
-static ManagedString giggleData("010230988019008440044008881023001601003300240000000000000000000000000000,110232570087411440044008880352005901003300010000000000000000010000000000,310232729021105440288908880091006300000000240700020000000000003000000000,310232729010205440288908880091006300000000240700020000000000003000000000,310232729011405440288908880091006300000000240700020000000000003000000000");
+// "010230988019008440044008881023001601003300240000000000000000000000000000,110232570087411440044008880352005901003300010000000000000000010000000000,310232729021105440288908880091006300000000240700020000000000003000000000,310232729010205440288908880091006300000000240700020000000000003000000000,310232729011405440288908880091006300000000240700020000000000003000000000"
+static const SoundExpressionEffect giggleEffects[] = {
+    { 0, 1023, 988, 190, 8, 440, 1023, 16, 1, 33, 24, 0, 0, 0, 0, 0, 0, 0 },
+    { 1, 1023, 2570, 874, 11, 440, 352, 59, 1, 33, 1, 0, 0, 0, 0, 100, 0, 0 },
+    { 3, 1023, 2729, 211, 5, 2889, 91, 63, 0, 0, 24, 700, 200, 0, 0, 30, 0, 0 },
+    { 3, 1023, 2729, 102, 5, 2889, 91, 63, 0, 0, 24, 700, 200, 0, 0, 30, 0, 0 },
+    { 3, 1023, 2729, 114, 5, 2889, 91, 63, 0, 0, 24, 700, 200, 0, 0, 30, 0, 0 }
+};
 static ManagedString happy("happy");
-static ManagedString happyData("010231992066911440044008880262002800001800020500000000000000010000000000,002322129029508440240408880000000400022400110000000000000000007500000000,000002129029509440240408880145000400022400110000000000000000007500000000");
+// "010231992066911440044008880262002800001800020500000000000000010000000000,002322129029508440240408880000000400022400110000000000000000007500000000,000002129029509440240408880145000400022400110000000000000000007500000000"
+static const SoundExpressionEffect happyEffects[] = {
+    { 0, 1023, 1992, 669, 11, 440, 262, 28, 0, 18, 2, 500, 0, 0, 0, 100, 0, 0 },
+    { 0, 232, 2129, 295, 8, 2404, 0, 4, 0, 224, 11, 0, 0, 0, 0, 75, 0, 0 },
+    { 0, 0, 2129, 295, 9, 2404, 145, 4, 0, 224, 11, 0, 0, 0, 0, 75, 0, 0 }
+};
 static ManagedString hello("hello");
-static ManagedString helloData("310230673019702440118708881023012800000000240000000000000000000000000000,300001064001602440098108880000012800000100040000000000000000000000000000,310231064029302440098108881023012800000100040000000000000000000000000000");
+// "310230673019702440118708881023012800000000240000000000000000000000000000,300001064001602440098108880000012800000100040000000000000000000000000000,310231064029302440098108881023012800000100040000000000000000000000000000"
+static const SoundExpressionEffect helloEffects[] = {
+    { 3, 1023, 673, 197, 2, 1187, 1023, 128, 0, 0, 24, 0, 0, 0, 0, 0, 0, 0 },
+    { 3, 0, 1064, 16, 2, 981, 0, 128, 0, 1, 4, 0, 0, 0, 0, 0, 0, 0 },
+    { 3, 1023, 1064, 293, 2, 981, 1023, 128, 0, 1, 4, 0, 0, 0, 0, 0, 0, 0 }
+};
 static ManagedString mysterious("mysterious");
-static ManagedString mysteriousData("400002390033100440240408880477000400022400110400000000000000008000000000,405512845385000440044008880000012803010500160000000000000000085000500015");
+// "400002390033100440240408880477000400022400110400000000000000008000000000,405512845385000440044008880000012803010500160000000000000000085000500015"
+static const SoundExpressionEffect mysteriousEffects[] = {
+    { 4, 0, 2390, 331, 0, 2404, 477, 4, 0, 224, 11, 400, 0, 0, 0, 80, 0, 0 },
+    { 4, 551, 2845, 3850, 0, 440, 0, 128, 3, 105, 16, 0, 0, 0, 0, 850, 50, 15 }
+};
 static ManagedString sad("sad");
-static ManagedString sadData("310232226070801440162408881023012800000100240000000000000000000000000000,310231623093602440093908880000012800000100240000000000000000000000000000");
+// "310232226070801440162408881023012800000100240000000000000000000000000000,310231623093602440093908880000012800000100240000000000000000000000000000"
+static const SoundExpressionEffect sadEffects[] = {
+    { 3, 1023, 2226, 708, 1, 1624, 1023, 128, 0, 1, 24, 0, 0, 0, 0, 0, 0, 0 },
+    { 3, 1023, 1623, 936, 2, 939, 0, 128, 0, 1, 24, 0, 0, 0, 0, 0, 0, 0 }
+};
 static ManagedString slide("slide");
-static ManagedString slideData("105202325022302440240408881023012801020000110400000000000000010000000000,010232520091002440044008881023012801022400110400000000000000010000000000");
+// "105202325022302440240408881023012801020000110400000000000000010000000000,010232520091002440044008881023012801022400110400000000000000010000000000"
+static const SoundExpressionEffect slideEffects[] = {
+    { 1, 520, 2325, 223, 2, 2404, 1023, 128, 1, 200, 11, 400, 0, 0, 0, 100, 0, 0 },
+    { 0, 1023, 2520, 910, 2, 440, 1023, 128, 1, 224, 11, 400, 0, 0, 0, 100, 0, 0 }
+};
 static ManagedString soaring("soaring");
-static ManagedString soaringData("210234009530905440599908881023002202000400020250000000000000020000000000,402233727273014440044008880000003101024400030000000000000000000000000000");
+// "210234009530905440599908881023002202000400020250000000000000020000000000,402233727273014440044008880000003101024400030000000000000000000000000000"
+static const SoundExpressionEffect soaringEffects[] = {
+    { 2, 1023, 4009, 5309, 5, 5999, 1023, 22, 2, 4, 2, 250, 0, 0, 0, 200, 0, 0 },
+    { 4, 223, 3727, 2730, 14, 440, 0, 31, 1, 244, 3, 0, 0, 0, 0, 0, 0, 0 }
+};
 static ManagedString spring("spring");
-static ManagedString springData("306590037116312440058708880807003400000000240000000000000000050000000000,010230037116313440058708881023003100000000240000000000000000050000000000");
+// "306590037116312440058708880807003400000000240000000000000000050000000000,010230037116313440058708881023003100000000240000000000000000050000000000"
+static const SoundExpressionEffect springEffects[] = {
+    { 3, 659, 37, 1163, 12, 587, 807, 34, 0, 0, 24, 0, 0, 0, 0, 500, 0, 0 },
+    { 0, 1023, 37, 1163, 13, 587, 1023, 31, 0, 0, 24, 0, 0, 0, 0, 500, 0, 0 }
+};
 static ManagedString twinkle("twinkle");
-static ManagedString twinkleData("010180007672209440075608880855012800000000240000000000000000000000000000");
+// "010180007672209440075608880855012800000000240000000000000000000000000000"
+static const SoundExpressionEffect twinkleEffects[] = {
+    { 0, 1018, 7, 6722, 9, 756, 855, 128, 0, 0, 24, 0, 0, 0, 0, 0, 0, 0 }
+};
 static ManagedString yawn("yawn");
-static ManagedString yawnData("200002281133202440150008881023012801024100240400030000000000010000000000,005312520091002440044008880636012801022400110300000000000000010000000000,008220784019008440044008880681001600005500240000000000000000005000000000,004790784019008440044008880298001600000000240000000000000000005000000000,003210784019008440044008880108001600003300080000000000000000005000000000");
-
-ManagedString SoundExpressions::lookupBuiltIn(ManagedString sound) {
-    if (sound == giggle)
-        return giggleData;
-    if (sound == happy)
-        return happyData;
-    if (sound == hello)
-        return helloData;
-    if (sound == mysterious)
-        return mysteriousData;
-    if (sound == sad)
-        return sadData;
-    if (sound == slide)
-        return slideData;
-    if (sound == soaring)
-        return soaringData;
-    if (sound == spring)
-        return springData;
-    if (sound == twinkle)
-        return twinkleData;
-    if (sound == yawn)
-        return yawnData;
-    return sound;
+// "200002281133202440150008881023012801024100240400030000000000010000000000,005312520091002440044008880636012801022400110300000000000000010000000000,008220784019008440044008880681001600005500240000000000000000005000000000,004790784019008440044008880298001600000000240000000000000000005000000000,003210784019008440044008880108001600003300080000000000000000005000000000"
+static const SoundExpressionEffect yawnEffects[] = {
+    { 2, 0, 2281, 1332, 2, 1500, 1023, 128, 1, 241, 24, 400, 300, 0, 0, 100, 0, 0 },
+    { 0, 531, 2520, 910, 2, 440, 636, 128, 1, 224, 11, 300, 0, 0, 0, 100, 0, 0 },
+    { 0, 822, 784, 190, 8, 440, 681, 16, 0, 55, 24, 0, 0, 0, 0, 50, 0, 0 },
+    { 0, 479, 784, 190, 8, 440, 298, 16, 0, 0, 24, 0, 0, 0, 0, 50, 0, 0 },
+    { 0, 321, 784, 190, 8, 440, 108, 16, 0, 33, 8, 0, 0, 0, 0, 50, 0, 0 }
+};
+
+const SoundExpressionEffect *SoundExpressions::lookupBuiltIn(ManagedString sound, int &count) {
+    if (sound == giggle) {
+        count = sizeof(giggleEffects) / sizeof(SoundExpressionEffect);
+        return giggleEffects;
+    }
+    if (sound == happy) {
+        count = sizeof(happyEffects) / sizeof(SoundExpressionEffect);
+        return happyEffects;
+    }
+    if (sound == hello) {
+        count = sizeof(helloEffects) / sizeof(SoundExpressionEffect);
+        return helloEffects;
+    }
+    if (sound == mysterious) {
+        count = sizeof(mysteriousEffects) / sizeof(SoundExpressionEffect);
+        return mysteriousEffects;
+    }
+    if (sound == sad) {
+        count = sizeof(sadEffects) / sizeof(SoundExpressionEffect);
+        return sadEffects;
+    }
+    if (sound == slide) {
+        count = sizeof(slideEffects) / sizeof(SoundExpressionEffect);
+        return slideEffects;
+    }
+    if (sound == soaring) {
+        count = sizeof(soaringEffects) / sizeof(SoundExpressionEffect);
+        return soaringEffects;
+    }
+    if (sound == spring) {
+        count = sizeof(springEffects) / sizeof(SoundExpressionEffect);
+        return springEffects;
+    }
+    if (sound == twinkle) {
+        count = sizeof(twinkleEffects) / sizeof(SoundExpressionEffect);
+        return twinkleEffects;
+    }
+    if (sound == yawn) {
+        count = sizeof(yawnEffects) / sizeof(SoundExpressionEffect);
+        return yawnEffects;
+    }
+    return NULL;
 }
\ No newline at end of file
@@ -31,6 +31,8 @@ DEALINGS IN THE SOFTWARE.
 #include "Synthesizer.h"
 #include "CodalDmesg.h"
 #include "MicroBitAudio.h"
+#include "AudioBufferPool.h"
+#include "MicroBitSchedulerTrace.h"
 
 using namespace codal;
 
@@ -50,6 +52,12 @@ SoundOutputPin::SoundOutputPin(Mixer2 &mix, int id) : codal::Pin(id, 0, PIN_CAPA
     this->bufferWritePos = outputBuffer.getBytes();
     this->position = 0.0f;
     this->volume = 0;
+    this->toneVolume = 0;
+    this->toneSkip = 0;
+    this->tonePhase = 0;
+#if CONFIG_ENABLED(CONFIG_AUDIO_STATS)
+    this->stats.reset();
+#endif
 
     // Enable lazy periodic callback and optimised silence generation.
     CodalComponent::status |= DEVICE_COMPONENT_STATUS_IDLE_TICK;
@@ -213,16 +221,10 @@ void SoundOutputPin::updateOutputBuffer(bool all)
     uint32_t samplePeriodUs = (1000000 / SOUND_OUTPUT_PIN_SAMPLE_RATE);
     uint32_t skip = _periodUs / samplePeriodUs;
 
-    while(bufferWritePos < endPosition)
+    if (bufferWritePos < endPosition)
     {
-        *bufferWritePos = position < skip / 2 ? this->volume : 0;
-        position++;
-
-        // Keep our toneprint pointer in range
-        if(position > skip)
-            position = 0;
-
-        bufferWritePos++;
+        position = renderSquareWave(bufferWritePos, endPosition - bufferWritePos, (uint32_t) position, skip, this->volume);
+        bufferWritePos = endPosition;
     }
 #endif
 
@@ -231,35 +233,134 @@ void SoundOutputPin::updateOutputBuffer(bool all)
     _value = value;
 }
 
+/**
+ * Render a square wave, one run of equal samples at a time.
+ * A period is skip + 1 samples long, and is high for the first skip / 2 of them.
+ *
+ * @param buffer the buffer to write to.
+ * @param length the number of samples to write.
+ * @param phase the position within the period of the first sample.
+ * @param skip the period of the wave in samples, less one.
+ * @param level the value of high samples.
+ *
+ * @return the position within the period following the last sample written.
+ */
+uint32_t SoundOutputPin::renderSquareWave(uint8_t *buffer, int length, uint32_t phase, uint32_t skip, int level)
+{
+    uint32_t period = skip + 1;
+    uint32_t high = skip / 2;
+
+    // If the period has just become shorter, finish the current (low) sample before wrapping.
+    if (phase >= period)
+        phase = period - 1;
+
+    if (level == 0 || high == 0)
+    {
+        memset(buffer, 0, length);
+        return (phase + length) % period;
+    }
+
+    while (length > 0)
+    {
+        bool isHigh = phase < high;
+        int run = min(length, (int) ((isHigh ? high : period) - phase));
+
+        memset(buffer, isHigh ? level : 0, run);
+        buffer += run;
+        length -= run;
+        phase += run;
+
+        if (phase >= period)
+            phase = 0;
+    }
+
+    return phase;
+}
+
+/**
+ * Provides a buffer of whole periods of the current tone, starting and ending at the current position.
+ * The buffer is only rendered again when the tone changes.
+ *
+ * @return the tone buffer, or an empty buffer if the period of the tone is too long to fit.
+ */
+ManagedBuffer SoundOutputPin::steadyTone()
+{
+    uint32_t samplePeriodUs = (1000000 / SOUND_OUTPUT_PIN_SAMPLE_RATE);
+    uint32_t skip = _periodUs / samplePeriodUs;
+    uint32_t period = skip + 1;
+    uint32_t phase = (uint32_t) position;
+
+    if (period > SOUND_OUTPUT_PIN_BUFFER_SIZE || phase >= period)
+        return ManagedBuffer();
+
+    if (toneBuffer.length() == 0 || toneVolume != volume || toneSkip != skip || tonePhase != phase)
+    {
+        int length = (SOUND_OUTPUT_PIN_BUFFER_SIZE / period) * period;
+
+        toneBuffer = ManagedBuffer(length);
+        renderSquareWave(toneBuffer.getBytes(), length, phase, skip, volume);
+
+        toneVolume = volume;
+        toneSkip = skip;
+        tonePhase = phase;
+    }
+
+    return toneBuffer;
+}
+
 /**
  * Disable the synthesizer during long periods of silence, for efficiency.
  */
 void SoundOutputPin::idleCallback()
 {
+    MICROBIT_TRACE_IDLE(CodalComponent::id);
+
     if ((CodalComponent::status & SOUND_OUTPUT_PIN_STATUS_ACTIVE) && (this->volume == 0) && (system_timer_current_time() - this->timeOfLastUpdate > CONFIG_SOUND_OUTPUT_PIN_SILENCE_GATE))
         CodalComponent::status &= ~SOUND_OUTPUT_PIN_STATUS_ACTIVE;
 
     // If our volume is non-zero and we're not active, then restart to synthesizer.
     if (!(CodalComponent::status & SOUND_OUTPUT_PIN_STATUS_ACTIVE) && this->volume > 0)
+    {
         CodalComponent::status |= SOUND_OUTPUT_PIN_STATUS_ACTIVE;
+
+        // Restart the audio output, if it was stopped during silence.
+        if (CodalComponent::status & SOUND_OUTPUT_PIN_STATUS_ENABLED)
+            MicroBitAudio::requestActivation();
+    }
 }
 
 ManagedBuffer SoundOutputPin::pull()
 {
+#if CONFIG_ENABLED(CONFIG_AUDIO_STATS)
+    CODAL_TIMESTAMP statsStart = stats.begin();
+#endif
     ManagedBuffer result;
 
     if (CodalComponent::status & SOUND_OUTPUT_PIN_STATUS_ACTIVE)
     {
-        result = outputBuffer;
+#if !CONFIG_ENABLED(CONFIG_SOUND_OUTPUT_PIN_TONEPRINT)
+        // If the tone hasn't changed since the last pull, nothing has been written to the output buffer.
+        // Hand out whole periods of the tone from a buffer that is only rendered when the tone changes.
+        if (bufferWritePos == outputBuffer.getBytes())
+            result = steadyTone();
+#endif
 
-        updateOutputBuffer(true);
-        outputBuffer = ManagedBuffer(SOUND_OUTPUT_PIN_BUFFER_SIZE);
+        if (result.length() == 0)
+        {
+            result = outputBuffer;
+
+            updateOutputBuffer(true);
+            outputBuffer = AudioBufferPool::allocate(SOUND_OUTPUT_PIN_BUFFER_SIZE);
+        }
     }
 
     this->bufferWritePos = outputBuffer.getBytes();
     this->timeOfLastPull = system_timer_current_time();
     channel->pullRequest();
 
+#if CONFIG_ENABLED(CONFIG_AUDIO_STATS)
+    stats.end(statsStart);
+#endif
     return result;
 }
 
@@ -0,0 +1,345 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "SpectrumAnalyzer.h"
+#include "StreamNormalizer.h"
+#include "EventModel.h"
+#include "ErrorNo.h"
+#include <math.h>
+
+using namespace codal;
+
+/**
+ * Constructor.
+ *
+ * @param source The component that will provide audio data.
+ * @param sampleRate The sample rate of the source, in Hz.
+ * @param windowSize The number of samples in each analysis window. Must be a power of two from 16 to 1024.
+ * @param id The ID of this component, used for its events.
+ */
+SpectrumAnalyzer::SpectrumAnalyzer(DataSource &source, float sampleRate, int windowSize, uint16_t id) : upstream(source)
+{
+    this->id = id;
+    this->sampleRate = sampleRate;
+    this->windowPosition = 0;
+    this->peakBin = 0;
+
+    // Round the window down to a supported power of two.
+    windowBits = 4;
+    while (windowBits < 10 && (1 << (windowBits + 1)) <= windowSize)
+        windowBits++;
+
+    this->windowSize = 1 << windowBits;
+
+    int half = this->windowSize / 2;
+    window = (int16_t *) malloc(this->windowSize * sizeof(int16_t));
+    re = (int16_t *) malloc(this->windowSize * sizeof(int16_t));
+    im = (int16_t *) malloc(this->windowSize * sizeof(int16_t));
+    cosTable = (int16_t *) malloc(half * sizeof(int16_t));
+    sinTable = (int16_t *) malloc(half * sizeof(int16_t));
+    power = (uint32_t *) malloc(half * sizeof(uint32_t));
+
+    for (int k = 0; k < half; k++)
+    {
+        float a = 2.0f * (float) M_PI * k / this->windowSize;
+        cosTable[k] = (int16_t) (cosf(a) * 32767.0f);
+        sinTable[k] = (int16_t) (sinf(a) * 32767.0f);
+        power[k] = 0;
+    }
+
+    for (int b = 0; b < CONFIG_SPECTRUM_ANALYZER_BANDS; b++)
+        clearBand(b);
+
+    // Transform each window in fiber context. Should we fall behind, windows are simply dropped.
+    if (EventModel::defaultEventBus)
+        EventModel::defaultEventBus->listen(id, SPECTRUM_ANALYZER_EVT_PROCESS, this, &SpectrumAnalyzer::onProcess, MESSAGE_BUS_LISTENER_DROP_IF_BUSY);
+
+    upstream.connect(*this);
+}
+
+/**
+ * Destructor.
+ */
+SpectrumAnalyzer::~SpectrumAnalyzer()
+{
+    if (EventModel::defaultEventBus)
+        EventModel::defaultEventBus->ignore(id, SPECTRUM_ANALYZER_EVT_PROCESS, this, &SpectrumAnalyzer::onProcess);
+
+    free(window);
+    free(re);
+    free(im);
+    free(cosTable);
+    free(sinTable);
+    free(power);
+}
+
+/**
+ * Callback provided when data is ready.
+ */
+int SpectrumAnalyzer::pullRequest()
+{
+    ManagedBuffer b = upstream.pull();
+
+    int format = upstream.getFormat();
+    int bytesPerSample = DATASTREAM_FORMAT_BYTES_PER_SAMPLE(format);
+    int samples = b.length() / bytesPerSample;
+    int shift = 16 - 8 * bytesPerSample;
+    int offset = 0;
+    uint8_t *data = &b[0];
+    SampleReadFn read = StreamNormalizer::readSample[format];
+
+    if (format == DATASTREAM_FORMAT_8BIT_UNSIGNED || format == DATASTREAM_FORMAT_16BIT_UNSIGNED)
+        offset = 1 << (8 * bytesPerSample - 1);
+
+    for (int i = 0; i < samples; i++)
+    {
+        int v = read(data) - offset;
+        window[windowPosition++] = (int16_t) (shift >= 0 ? v << shift : v >> -shift);
+        data += bytesPerSample;
+
+        if (windowPosition == windowSize)
+        {
+            windowPosition = 0;
+
+            // Hand the window over to be transformed, unless the last one is still in progress.
+            if (!(status & SPECTRUM_ANALYZER_STATUS_BUSY))
+            {
+                memcpy(re, window, windowSize * sizeof(int16_t));
+                status |= SPECTRUM_ANALYZER_STATUS_BUSY;
+                Event(id, SPECTRUM_ANALYZER_EVT_PROCESS);
+            }
+        }
+    }
+
+    return DEVICE_OK;
+}
+
+/**
+ * Performs an in place, scaled, radix-2 decimation in time FFT of re and im.
+ * Each stage halves its outputs, so the result is the transform divided by windowSize, which cannot overflow.
+ */
+void SpectrumAnalyzer::transform()
+{
+    // Reorder the input into bit reversed order.
+    for (int i = 1, j = 0; i < windowSize; i++)
+    {
+        int bit = windowSize >> 1;
+        while (j & bit)
+        {
+            j ^= bit;
+            bit >>= 1;
+        }
+        j |= bit;
+
+        if (i < j)
+        {
+            int16_t t = re[i]; re[i] = re[j]; re[j] = t;
+            t = im[i]; im[i] = im[j]; im[j] = t;
+        }
+    }
+
+    // Butterflies, in Q15: (a, b) -> ((a + wb) / 2, (a - wb) / 2), with w = exp(-2 pi i k / N).
+    for (int len = 2, step = windowSize >> 1; len <= windowSize; len <<= 1, step >>= 1)
+    {
+        int half = len >> 1;
+
+        for (int start = 0; start < windowSize; start += len)
+        {
+            for (int k = 0; k < half; k++)
+            {
+                int a = start + k;
+                int b = a + half;
+                int32_t c = cosTable[k * step];
+                int32_t s = sinTable[k * step];
+
+                int32_t tr = (re[b] * c + im[b] * s) >> 15;
+                int32_t ti = (im[b] * c - re[b] * s) >> 15;
+                int32_t ar = re[a];
+                int32_t ai = im[a];
+
+                re[a] = (int16_t) ((ar + tr) >> 1);
+                im[a] = (int16_t) ((ai + ti) >> 1);
+                re[b] = (int16_t) ((ar - tr) >> 1);
+                im[b] = (int16_t) ((ai - ti) >> 1);
+            }
+        }
+    }
+}
+
+/**
+ * Transforms the pending window, and updates the band energies. Called in fiber context via the event bus.
+ */
+void SpectrumAnalyzer::onProcess(Event)
+{
+    int half = windowSize / 2;
+
+    // Apply a Hann window, 0.5 - 0.5 cos(2 pi n / N), using the cosine table by symmetry about N / 2.
+    for (int n = 0; n < windowSize; n++)
+    {
+        int32_t c = n < half ? cosTable[n] : -cosTable[n - half];
+        int32_t w = (32767 - c) >> 1;
+        re[n] = (int16_t) ((re[n] * w) >> 15);
+        im[n] = 0;
+    }
+
+    transform();
+
+    uint32_t peak = 0;
+    peakBin = 0;
+
+    for (int k = 0; k < half; k++)
+    {
+        power[k] = (uint32_t) (re[k] * re[k]) + (uint32_t) (im[k] * im[k]);
+
+        if (k > 0 && power[k] > peak)
+        {
+            peak = power[k];
+            peakBin = k;
+        }
+    }
+
+    // The window has been consumed, so the next may be gathered.
+    status &= ~SPECTRUM_ANALYZER_STATUS_BUSY;
+
+    for (int b = 0; b < CONFIG_SPECTRUM_ANALYZER_BANDS; b++)
+    {
+        SpectrumBand &band = bands[b];
+
+        if (band.highBin == 0)
+            continue;
+
+        uint64_t total = 0;
+        for (int k = band.lowBin; k <= band.highBin; k++)
+            total += power[k];
+
+        band.energy = (uint32_t) (total / (band.highBin - band.lowBin + 1));
+
+        if (!band.high && band.energy > band.threshold)
+        {
+            band.high = true;
+            Event(id, SPECTRUM_ANALYZER_EVT_BAND_HIGH + b);
+        }
+        else if (band.high && band.energy < band.threshold / 2)
+        {
+            band.high = false;
+            Event(id, SPECTRUM_ANALYZER_EVT_BAND_LOW + b);
+        }
+    }
+
+    Event(id, SPECTRUM_ANALYZER_EVT_FRAME);
+}
+
+/**
+ * Defines a frequency band to monitor.
+ *
+ * @param band The index of the band, below CONFIG_SPECTRUM_ANALYZER_BANDS.
+ * @param lowFrequency The lowest frequency of the band, in Hz.
+ * @param highFrequency The highest frequency of the band, in Hz.
+ * @param threshold The mean bin energy above which SPECTRUM_ANALYZER_EVT_BAND_HIGH + band is raised.
+ * SPECTRUM_ANALYZER_EVT_BAND_LOW + band is raised once the energy falls below half of this.
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the band or its frequencies are out of range.
+ */
+int SpectrumAnalyzer::setBand(int band, int lowFrequency, int highFrequency, uint32_t threshold)
+{
+    float resolution = getResolution();
+    int low = (int) (lowFrequency / resolution + 0.5f);
+    int high = (int) (highFrequency / resolution + 0.5f);
+
+    if (band < 0 || band >= CONFIG_SPECTRUM_ANALYZER_BANDS || lowFrequency < 0 || high < low || high >= windowSize / 2)
+        return DEVICE_INVALID_PARAMETER;
+
+    // Bin 0 is DC, and never part of a band.
+    bands[band].lowBin = max(low, 1);
+    bands[band].highBin = max(high, 1);
+    bands[band].threshold = threshold;
+    bands[band].energy = 0;
+    bands[band].high = false;
+
+    return DEVICE_OK;
+}
+
+/**
+ * Stops monitoring a frequency band.
+ *
+ * @param band The index of the band.
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the band is out of range.
+ */
+int SpectrumAnalyzer::clearBand(int band)
+{
+    if (band < 0 || band >= CONFIG_SPECTRUM_ANALYZER_BANDS)
+        return DEVICE_INVALID_PARAMETER;
+
+    memset(&bands[band], 0, sizeof(SpectrumBand));
+
+    return DEVICE_OK;
+}
+
+/**
+ * Determines the mean bin energy of a band in the last spectrum.
+ *
+ * @param band The index of the band.
+ * @return The energy, or DEVICE_INVALID_PARAMETER if the band is out of range.
+ */
+int SpectrumAnalyzer::getBandEnergy(int band)
+{
+    if (band < 0 || band >= CONFIG_SPECTRUM_ANALYZER_BANDS)
+        return DEVICE_INVALID_PARAMETER;
+
+    return bands[band].energy;
+}
+
+/**
+ * Determines the power of a single bin of the last spectrum.
+ *
+ * @param bin The bin, below windowSize / 2. Bin k is centred on k * sampleRate / windowSize Hz.
+ * @return The squared magnitude of the bin, or 0 if the bin is out of range.
+ */
+uint32_t SpectrumAnalyzer::getPower(int bin)
+{
+    if (bin < 0 || bin >= windowSize / 2)
+        return 0;
+
+    return power[bin];
+}
+
+/**
+ * Determines the frequency of the strongest component of the last spectrum, ignoring DC.
+ *
+ * @return The centre frequency of the strongest bin, in Hz.
+ */
+int SpectrumAnalyzer::getPeakFrequency()
+{
+    return (int) (peakBin * getResolution());
+}
+
+/**
+ * Determines the width of each bin of the spectrum.
+ *
+ * @return The frequency resolution, in Hz.
+ */
+float SpectrumAnalyzer::getResolution()
+{
+    return sampleRate / windowSize;
+}
@@ -0,0 +1,233 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "StreamDecimator.h"
+#include "StreamNormalizer.h"
+#include "AudioBufferPool.h"
+#include "ErrorNo.h"
+
+using namespace codal;
+
+/**
+ * Determines if the given buffer is referenced only by the caller, and so may be overwritten.
+ * Taking a reference with leakData() means a buffer held only by the caller shows a count of two references.
+ */
+static bool isExclusive(ManagedBuffer &b)
+{
+    BufferData *data = b.leakData();
+    bool exclusive = data->refCount == ((2 << 1) | 1);
+    data->decr();
+
+    return exclusive;
+}
+
+/**
+ * Constructor.
+ *
+ * @param source The component that will provide data.
+ * @param gain The gain to apply to each sample.
+ * @param normalize True if the DC offset of the input should be removed.
+ * @param format The format of the output: DATASTREAM_FORMAT_8BIT_SIGNED or DATASTREAM_FORMAT_16BIT_SIGNED.
+ * @param decimation The number of input samples to combine into each output sample (1 for none).
+ */
+StreamDecimator::StreamDecimator(DataSource &source, float gain, bool normalize, int format, int decimation) : upstream(source)
+{
+    this->downStream = NULL;
+    this->outputFormat = format == DATASTREAM_FORMAT_16BIT_SIGNED ? DATASTREAM_FORMAT_16BIT_SIGNED : DATASTREAM_FORMAT_8BIT_SIGNED;
+    this->decimation = max(decimation, 1);
+    this->normalize = normalize;
+    this->zeroOffset = 0;
+    this->calibrated = false;
+
+    setGain(gain);
+
+    // Register with our upstream component
+    source.connect(*this);
+}
+
+/**
+ * Callback provided when data is ready.
+ */
+int StreamDecimator::pullRequest()
+{
+    if (downStream)
+        return downStream->pullRequest();
+
+    return DEVICE_OK;
+}
+
+/**
+ * Provide the next available ManagedBuffer to our downstream caller, if available.
+ */
+ManagedBuffer StreamDecimator::pull()
+{
+    ManagedBuffer input = upstream.pull();
+
+    int inputFormat = upstream.getFormat();
+    int inputBytes = DATASTREAM_FORMAT_BYTES_PER_SAMPLE(inputFormat);
+    int outputBytes = DATASTREAM_FORMAT_BYTES_PER_SAMPLE(outputFormat);
+    int samples = input.length() / (inputBytes * decimation);
+
+    if (samples <= 0)
+        return ManagedBuffer();
+
+    // Each output sample is written no further into the buffer than the first input sample it is made from,
+    // so if nobody else can see the input we work in place.
+    bool inPlace = outputBytes <= inputBytes && isExclusive(input);
+    ManagedBuffer output = inPlace ? input : AudioBufferPool::allocate(samples * outputBytes);
+
+    uint8_t *in = &input[0];
+    uint8_t *out = &output[0];
+    SampleReadFn read = StreamNormalizer::readSample[inputFormat];
+    int32_t offset = normalize ? zeroOffset * decimation : 0;
+    int32_t scale = gain / decimation;
+    int32_t lo = outputFormat == DATASTREAM_FORMAT_8BIT_SIGNED ? -128 : -32768;
+    int32_t hi = outputFormat == DATASTREAM_FORMAT_8BIT_SIGNED ? 127 : 32767;
+    int64_t total = 0;
+
+    // Until we have an estimate of the DC offset, take it from the first buffer.
+    if (normalize && !calibrated)
+    {
+        for (int i = 0; i < samples * decimation; i++)
+            total += read(in + i * inputBytes);
+
+        zeroOffset = (int32_t) (total / (samples * decimation));
+        offset = zeroOffset * decimation;
+        calibrated = true;
+        total = 0;
+    }
+
+    for (int i = 0; i < samples; i++)
+    {
+        int32_t sum = 0;
+
+        if (inputFormat == DATASTREAM_FORMAT_16BIT_SIGNED)
+        {
+            int16_t *s = (int16_t *) in;
+            for (int j = 0; j < decimation; j++)
+                sum += s[j];
+        }
+        else
+        {
+            for (int j = 0; j < decimation; j++)
+                sum += read(in + j * inputBytes);
+        }
+
+        in += decimation * inputBytes;
+        total += sum;
+
+        int32_t v = (int32_t) (((int64_t) (sum - offset) * scale) >> 16);
+        v = min(max(v, lo), hi);
+
+        if (outputFormat == DATASTREAM_FORMAT_8BIT_SIGNED)
+            *(int8_t *) out = v;
+        else
+            *(int16_t *) out = v;
+
+        out += outputBytes;
+    }
+
+    // Track slow drift in the DC offset.
+    if (normalize)
+        zeroOffset += ((int32_t) (total / (samples * decimation)) - zeroOffset) / 4;
+
+    if (inPlace)
+        output.truncate(samples * outputBytes);
+
+    return output;
+}
+
+/**
+ * Define a downstream component for data stream.
+ *
+ * @param sink The component that data will be delivered to, when it is availiable
+ */
+void StreamDecimator::connect(DataSink &sink)
+{
+    this->downStream = &sink;
+}
+
+/**
+ * Determines if this source is connected to a downstream component.
+ *
+ * @return true if a downstream is connected.
+ */
+bool StreamDecimator::isConnected()
+{
+    return this->downStream != NULL;
+}
+
+/**
+ * Determine the data format of the buffers streamed out of this component.
+ */
+int StreamDecimator::getFormat()
+{
+    return outputFormat;
+}
+
+/**
+ * Defines the gain applied to each sample.
+ *
+ * @param gain The new gain.
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the gain is negative.
+ */
+int StreamDecimator::setGain(float gain)
+{
+    if (gain < 0)
+        return DEVICE_INVALID_PARAMETER;
+
+    this->gain = (int32_t) (gain * 65536.0f);
+    return DEVICE_OK;
+}
+
+/**
+ * Determines the gain applied to each sample.
+ */
+float StreamDecimator::getGain()
+{
+    return gain / 65536.0f;
+}
+
+/**
+ * Defines the number of input samples combined into each output sample.
+ *
+ * @param decimation The new decimation factor, 1 or more.
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the factor is out of range.
+ */
+int StreamDecimator::setDecimation(int decimation)
+{
+    if (decimation < 1)
+        return DEVICE_INVALID_PARAMETER;
+
+    this->decimation = decimation;
+    return DEVICE_OK;
+}
+
+/**
+ * Determines the number of input samples combined into each output sample.
+ */
+int StreamDecimator::getDecimation()
+{
+    return decimation;
+}
@@ -35,7 +35,7 @@ DEALINGS IN THE SOFTWARE.
 
 
 const uint16_t MicroBitAccelerometerService::serviceUUID               = 0x0753;
-const uint16_t MicroBitAccelerometerService::charUUID[ mbbs_cIdxCOUNT] = { 0xca4b, 0xfb24 };
+const uint16_t MicroBitAccelerometerService::charUUID[ mbbs_cIdxCOUNT] = { 0xca4b, 0xfb24, 0xca4c };
 
 
 /**
@@ -61,23 +61,36 @@ MicroBitAccelerometerService::MicroBitAccelerometerService( BLEDevice &_ble, cod
     CreateCharacteristic( mbbs_cIdxDATA, charUUID[ mbbs_cIdxDATA],
                          (uint8_t *)accelerometerDataCharacteristicBuffer,
                          sizeof(accelerometerDataCharacteristicBuffer), sizeof(accelerometerDataCharacteristicBuffer),
-                         microbit_propREAD | microbit_propNOTIFY);
+                         microbit_propREAD_LIVE | microbit_propNOTIFY);
 
     CreateCharacteristic( mbbs_cIdxPERIOD, charUUID[ mbbs_cIdxPERIOD],
                          (uint8_t *)&accelerometerPeriodCharacteristicBuffer,
                          sizeof(accelerometerPeriodCharacteristicBuffer), sizeof(accelerometerPeriodCharacteristicBuffer),
                          microbit_propREAD | microbit_propWRITE);
 
-    if ( getConnected())
-        listen( true);
+    // Each notification carries as many samples as the negotiated MTU allows, so its length varies.
+    CreateCharacteristic( mbbs_cIdxBATCH, charUUID[ mbbs_cIdxBATCH],
+                         (uint8_t *)batch.data(),
+                         0, MICROBIT_BLE_MAX_PAYLOAD,
+                         microbit_propREAD | microbit_propNOTIFY);
+
+    ActivateIfConnected();
 }
 
 
-void MicroBitAccelerometerService::readXYZ()
+/**
+  * Helper function to read the values, and add them to the batch characteristic if it is in use.
+  * @return true if the batch characteristic should be sent.
+  */
+bool MicroBitAccelerometerService::readXYZ()
 {
-    accelerometerDataCharacteristicBuffer[0] = accelerometer.getX();
-    accelerometerDataCharacteristicBuffer[1] = accelerometer.getY();
-    accelerometerDataCharacteristicBuffer[2] = accelerometer.getZ();
+    Sample3D sample = accelerometer.getSample();
+
+    accelerometerDataCharacteristicBuffer[0] = sample.x;
+    accelerometerDataCharacteristicBuffer[1] = sample.y;
+    accelerometerDataCharacteristicBuffer[2] = sample.z;
+
+    return notifyChrValueEnabled( mbbs_cIdxBATCH) && batch.add( sample.x, sample.y, sample.z);
 }
 
 
@@ -91,6 +104,7 @@ void MicroBitAccelerometerService::listen( bool yes)
         if ( yes)
         {
             // Ensure accelerometer is being updated
+            batch.reset();
             readXYZ();
             accelerometerPeriodCharacteristicBuffer = accelerometer.getPeriod();
             EventModel::defaultEventBus->listen(MICROBIT_ID_ACCELEROMETER, MICROBIT_ACCELEROMETER_EVT_DATA_UPDATE, this, &MicroBitAccelerometerService::accelerometerUpdate, MESSAGE_BUS_LISTENER_IMMEDIATE);
@@ -104,23 +118,37 @@ void MicroBitAccelerometerService::listen( bool yes)
 
 
 /**
-  * Invoked when BLE connects.
+  * Invoked when a client first uses the service on a connection.
   */
-void MicroBitAccelerometerService::onConnect( const microbit_ble_evt_t *p_ble_evt)
+void MicroBitAccelerometerService::onActivate()
 {
     listen( true);
 }
 
 
 /**
-  * Invoked when BLE disconnects.
+  * Invoked when the connection the service was activated on closes.
   */
-void MicroBitAccelerometerService::onDisconnect( const microbit_ble_evt_t *p_ble_evt)
+void MicroBitAccelerometerService::onDeactivate()
 {
     listen( false);
 }
 
 
+/**
+  * Callback. Invoked when a live value is read, with MICROBIT_BLE_LAZY_SERVICES enabled.
+  * The first read activates the service before we get here, so the value is current.
+  */
+void MicroBitAccelerometerService::onDataRead( microbit_onDataRead_t *params)
+{
+    if ( params->handle == valueHandle( mbbs_cIdxDATA))
+    {
+        params->data    = (const uint8_t *) accelerometerDataCharacteristicBuffer;
+        params->length  = sizeof( accelerometerDataCharacteristicBuffer);
+    }
+}
+
+
 /**
   * Callback. Invoked when any of our attributes are written via BLE.
   */
@@ -146,8 +174,12 @@ void MicroBitAccelerometerService::accelerometerUpdate(MicroBitEvent)
 {
     if ( getConnected())
     {
-        readXYZ();
+        bool send = readXYZ();
         notifyChrValue( mbbs_cIdxDATA, (uint8_t *)accelerometerDataCharacteristicBuffer, sizeof(accelerometerDataCharacteristicBuffer));
+
+        // If the SoftDevice has no room for the batch yet, keep collecting and try again on the next sample.
+        if ( send && notifyChrValue( mbbs_cIdxBATCH, batch.data(), batch.length()))
+            batch.reset();
     }
 }
 
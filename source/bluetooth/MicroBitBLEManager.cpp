@@ -53,6 +53,7 @@ DEALINGS IN THE SOFTWARE.
 #include "nrf_pwr_mgmt.h"
 #include "nrf_power.h"
 #include "nrf_bootloader_info.h"
+#include "crc32.h"
 
 #include "nrf_log.h"
 #include "nrf_log_ctrl.h"
@@ -69,9 +70,15 @@ DEALINGS IN THE SOFTWARE.
 #include "MicroBitDevice.h"
 #include "MicroBitEventService.h"
 #include "MicroBitPartialFlashingService.h"
+#include "MicroBitThermometer.h"
+#include "MicroBitLog.h"
+#include "MicroBitPowerManager.h"
+#include "Accelerometer.h"
+#include "MicroBitHeapStats.h"
 
 #include "CodalDmesg.h"
 #include "nrf_log_backend_dmesg.h"
+#include "MicroBitSchedulerTrace.h"
 
 
 #define MICROBIT_PAIRING_FADE_SPEED 4
@@ -127,13 +134,56 @@ MicroBitBLEManager *MicroBitBLEManager::manager = NULL; // Singleton reference t
 #define microbit_ble_OBSERVER_PRIO           3
 #define microbit_ble_CONN_CFG_TAG            1
 
+// nrf_ble_gatt rejects MTUs larger than the SDK configuration allows.
+#if MICROBIT_BLE_ATT_MTU < NRF_SDH_BLE_GATT_MAX_MTU_SIZE
+#define microbit_ble_ATT_MTU                 MICROBIT_BLE_ATT_MTU
+#else
+#define microbit_ble_ATT_MTU                 NRF_SDH_BLE_GATT_MAX_MTU_SIZE
+#endif
+
 
 static int                  m_power         = MICROBIT_BLE_DEFAULT_TX_POWER;
 static uint8_t              m_adv_handle    = BLE_GAP_ADV_SET_HANDLE_NOT_SET;
 static uint8_t              m_enc_advdata[ BLE_GAP_ADV_SET_DATA_SIZE_MAX];
+static uint16_t             m_enc_advlen;
+static ble_gap_adv_params_t m_adv_params;                   // The parameters of the micro:bit's own advertising (set 0).
+static bool                 m_adv_primary;                  // true between advertise() and stopAdvertising().
+static CODAL_TIMESTAMP      m_adv_primary_end;              // When the micro:bit's own advertising times out, or 0 for never.
+static uint16_t             m_adv_primary_dwell = MICROBIT_BLE_ADVERTISING_DWELL;
+
+// Additional advertising sets. The SoftDevice supports only one, so they are rotated through m_adv_handle.
+typedef struct
+{
+    uint8_t     data[ 2][ MICROBIT_BLE_ADVERTISING_DATA_MAX];   // Double buffered, so that a running set can be updated.
+    uint8_t     buffer;                                     // The index of the buffer in use.
+    uint16_t    length;                                     // 0 if the set is not in use.
+    uint16_t    interval;                                   // in milliseconds.
+    uint16_t    dwell;                                      // in milliseconds.
+    bool        extended;
+} microbit_ble_adv_set_t;
+
+static microbit_ble_adv_set_t   m_adv_sets[ MICROBIT_BLE_ADVERTISING_SETS];
+static int                      m_adv_current = -1;         // The set on m_adv_handle while rotating, or -1 for none.
+static CODAL_TIMESTAMP          m_adv_switched;             // When m_adv_current was started.
 
 static volatile int         m_pending;
 
+#if CONFIG_ENABLED(MICROBIT_BLE_DEFER_FLASH_CLEAN)
+static pm_evt_t             m_flash_clean_evt;              // The PM_EVT_STORAGE_FULL held back while connected.
+static volatile bool        m_flash_clean_pending = false;
+#endif
+
+// Connection parameters for each MICROBIT_BLE_CONNECTION_ mode, in units of 1.25ms (intervals) and 10ms (timeout).
+static const ble_gap_conn_params_t microbit_ble_conn_params[] =
+{
+    { 8,  16,  0, 400 },        // MICROBIT_BLE_CONNECTION_DEFAULT: 10-20ms, 4s supervision timeout
+    { 6,  12,  0, 400 },        // MICROBIT_BLE_CONNECTION_BULK: 7.5-15ms, 4s supervision timeout
+    { 80, 160, 4, 600 }         // MICROBIT_BLE_CONNECTION_IDLE: 100-200ms, 4 events latency, 6s supervision timeout
+};
+
+// The mode given to ble_conn_params at init, which it negotiates on each new connection.
+static int                  m_conn_mode_init = MICROBIT_BLE_CONNECTION_DEFAULT;
+
 NRF_BLE_GATT_DEF( m_gatt);
 
 
@@ -148,11 +198,20 @@ static void passkeyDisplayCallback( microbit_gaphandle_t handle, ManagedString p
 static void microbit_ble_evt_handler(ble_evt_t const * p_ble_evt, void * p_context);
 static void microbit_ble_pm_evt_handler(pm_evt_t const * p_evt);
 static void microbit_ble_evt_handler(ble_evt_t const * p_ble_evt, void * p_context);
+static void microbit_ble_gatt_evt_handler(nrf_ble_gatt_t * p_gatt, nrf_ble_gatt_evt_t const * p_evt);
 
 static void microbit_dfu_init(void);
 
+static uint32_t microbit_ble_database_hash();
+
 static void microbit_ble_configureAdvertising( bool connectable, bool discoverable, bool whitelist, uint16_t interval_ms, int timeout_seconds);
 
+static int  microbit_ble_adv_count();
+static bool microbit_ble_adv_ready( int set);
+static int  microbit_ble_adv_next( int set);
+static void microbit_ble_adv_apply( int set, bool start);
+static void microbit_ble_adv_schedule();
+
 #if CONFIG_ENABLED(MICROBIT_BLE_EDDYSTONE_URL) || CONFIG_ENABLED(MICROBIT_BLE_EDDYSTONE_UID)
 static void microbit_ble_configureAdvertising( bool connectable, bool discoverable, bool whitelist, uint16_t interval_ms, int timeout_seconds,
                                                uint8_t *frameData, uint16_t frameSize);
@@ -279,6 +338,20 @@ void MicroBitBLEManager::init( ManagedString deviceName, ManagedString serialNum
     ble_cfg.gap_cfg.device_name_cfg.max_len     = gapName.length();
     MICROBIT_BLE_ECHK( sd_ble_cfg_set( BLE_GAP_CFG_DEVICE_NAME, &ble_cfg, ram_start));
 
+    // Size the SoftDevice ATT buffers for the MTU we will negotiate.
+    memset(&ble_cfg, 0, sizeof(ble_cfg));
+    ble_cfg.conn_cfg.conn_cfg_tag                            = microbit_ble_CONN_CFG_TAG;
+    ble_cfg.conn_cfg.params.gatt_conn_cfg.att_mtu            = microbit_ble_ATT_MTU;
+    MICROBIT_BLE_ECHK( sd_ble_cfg_set( BLE_CONN_CFG_GATT, &ble_cfg, ram_start));
+
+#if MICROBIT_BLE_HVN_TX_QUEUE_SIZE > 1
+    // Allow several notifications to be queued per connection event.
+    memset(&ble_cfg, 0, sizeof(ble_cfg));
+    ble_cfg.conn_cfg.conn_cfg_tag                            = microbit_ble_CONN_CFG_TAG;
+    ble_cfg.conn_cfg.params.gatts_conn_cfg.hvn_tx_queue_size = MICROBIT_BLE_HVN_TX_QUEUE_SIZE;
+    MICROBIT_BLE_ECHK( sd_ble_cfg_set( BLE_CONN_CFG_GATTS, &ble_cfg, ram_start));
+#endif
+
     MICROBIT_BLE_ECHK( nrf_sdh_ble_enable(&ram_start));
     NRF_SDH_BLE_OBSERVER( microbit_ble_observer, microbit_ble_OBSERVER_PRIO, microbit_ble_evt_handler, NULL);
 
@@ -375,16 +448,18 @@ void MicroBitBLEManager::init( ManagedString deviceName, ManagedString serialNum
 
     // Set up GAP
     // Configure for high speed mode where possible.
-    ble_gap_conn_params_t   gap_conn_params;
-    memset(&gap_conn_params, 0, sizeof(gap_conn_params));
-    gap_conn_params.min_conn_interval = 8;      // 10 ms
-    gap_conn_params.max_conn_interval = 16;     // 20 ms
-    gap_conn_params.slave_latency     = 0;
-    gap_conn_params.conn_sup_timeout  = 400;    // 4s
+    // Prefer the parameters of the resting connection mode; bulkTransfer() and setConnectionMode() renegotiate them.
+    ble_gap_conn_params_t   gap_conn_params = microbit_ble_conn_params[ connectionMode];
+    activeConnectionMode = m_conn_mode_init = connectionMode;
     MICROBIT_BLE_ECHK( sd_ble_gap_ppcp_set( &gap_conn_params));
     
     // Set up GATT
-    MICROBIT_BLE_ECHK( nrf_ble_gatt_init( &m_gatt, NULL));
+    // nrf_ble_gatt performs the ATT MTU exchange and data length update on each connection.
+    MICROBIT_BLE_ECHK( nrf_ble_gatt_init( &m_gatt, microbit_ble_gatt_evt_handler));
+    MICROBIT_BLE_ECHK( nrf_ble_gatt_att_mtu_periph_set( &m_gatt, microbit_ble_ATT_MTU));
+#if !defined(S112) && !defined(S312)
+    MICROBIT_BLE_ECHK( nrf_ble_gatt_data_length_set( &m_gatt, BLE_CONN_HANDLE_INVALID, MICROBIT_BLE_DATA_LENGTH));
+#endif
         
     if ( enableBonding)
     {
@@ -430,7 +505,9 @@ void MicroBitBLEManager::init( ManagedString deviceName, ManagedString serialNum
 
 #if CONFIG_ENABLED(MICROBIT_BLE_PARTIAL_FLASHING)
     MICROBIT_DEBUG_DMESG( "PARTIAL_FLASHING");
-    new MicroBitPartialFlashingService( *this, messageBus, *storage);
+    MicroBitPartialFlashingService *partialFlashing = new MicroBitPartialFlashingService( *this, messageBus, *storage);
+    MICROBIT_HEAP_TRACK(MICROBIT_HEAP_TAG_BLE, partialFlashing);
+    (void)partialFlashing;
 #endif
 
 #if CONFIG_ENABLED(MICROBIT_BLE_DEVICE_INFORMATION_SERVICE)
@@ -456,12 +533,19 @@ void MicroBitBLEManager::init( ManagedString deviceName, ManagedString serialNum
 
 #if CONFIG_ENABLED(MICROBIT_BLE_EVENT_SERVICE)
     MICROBIT_DEBUG_DMESG( "EVENT_SERVICE");
-    new MicroBitEventService( *this, messageBus);
+    MicroBitEventService *eventService = new MicroBitEventService( *this, messageBus);
+    MICROBIT_HEAP_TRACK(MICROBIT_HEAP_TAG_BLE, eventService);
+    (void)eventService;
 #else
     (void)messageBus;
 #endif
 
-    servicesChanged();
+    // Bonded peers cache our GATT database, so only ask them to rediscover it when its layout differs from the one
+    // we last saw. The application adds its own services after init() returns, so the idle callback checks the
+    // layout once the first peer connects.
+    target_disable_irq();
+    this->status |= MICROBIT_BLE_STATUS_DATABASE_CHECK | DEVICE_COMPONENT_STATUS_IDLE_TICK;
+    target_enable_irq();
     
     // Setup advertising.
     microbit_ble_configureAdvertising( connectable, discoverable, whitelist,
@@ -490,7 +574,9 @@ void MicroBitBLEManager::init( ManagedString deviceName, ManagedString serialNum
 #endif
         advertise();
 
+    target_disable_irq();
     this->status |= DEVICE_COMPONENT_RUNNING;
+    target_enable_irq();
 }
 
 
@@ -584,7 +670,9 @@ bool MicroBitBLEManager::pairingComplete( int event)
             this->pairingStatus = MICROBIT_BLE_PAIR_COMPLETE | MICROBIT_BLE_PAIR_SUCCESSFUL;
             if ( MICROBIT_BLE_DISCONNECT_AFTER_PAIRING_DELAY > 0)
             {
+                target_disable_irq();
                 this->status |= MICROBIT_BLE_STATUS_DISCONNECT;
+                target_enable_irq();
                 fiber_add_idle_component(this);
             }
             break;
@@ -620,9 +708,13 @@ bool MicroBitBLEManager::pairingComplete( int event)
 /**
  * Periodic callback in thread context.
  * We use this here purely to safely issue a disconnect operation after a pairing operation is complete.
+ *
+ * The SoftDevice and peer manager event handlers also update status, so every change made here runs with interrupts disabled.
  */
 void MicroBitBLEManager::idleCallback()
 {
+    MICROBIT_TRACE_IDLE(CodalComponent::id);
+
     if ( this->status & MICROBIT_BLE_STATUS_DISCONNECT)
     {
         if ( (system_timer_current_time() - pairingTime) >= MICROBIT_BLE_DISCONNECT_AFTER_PAIRING_DELAY)
@@ -630,10 +722,59 @@ void MicroBitBLEManager::idleCallback()
             MICROBIT_DEBUG_DMESG( "%d:MicroBitBLEManager::idleCallback", (int)system_timer_current_time());
             MICROBIT_DEBUG_DMESG( "MICROBIT_BLE_STATUS_DISCONNECT");
             ble_conn_state_for_each_connected( microbit_ble_for_each_connected_disconnect, NULL);
+            target_disable_irq();
             this->status &= ~MICROBIT_BLE_STATUS_DISCONNECT;
+            target_enable_irq();
         }
     }
 
+    if ( this->status & MICROBIT_BLE_STATUS_BULK)
+    {
+        if ( (system_timer_current_time() - bulkTime) >= MICROBIT_BLE_BULK_TIMEOUT)
+        {
+            target_disable_irq();
+            this->status &= ~MICROBIT_BLE_STATUS_BULK;
+            if ( !(this->status & MICROBIT_BLE_STATUS_IDLE_USERS))
+                this->status &= ~DEVICE_COMPONENT_STATUS_IDLE_TICK;
+            target_enable_irq();
+            applyConnectionMode( connectionMode);
+        }
+    }
+
+    if ( this->status & MICROBIT_BLE_STATUS_ADV_SETS)
+        microbit_ble_adv_schedule();
+
+    if ( (this->status & MICROBIT_BLE_STATUS_DATABASE_CHECK) && getConnected())
+    {
+        target_disable_irq();
+        this->status &= ~MICROBIT_BLE_STATUS_DATABASE_CHECK;
+        if ( !(this->status & MICROBIT_BLE_STATUS_IDLE_USERS))
+            this->status &= ~DEVICE_COMPONENT_STATUS_IDLE_TICK;
+        target_enable_irq();
+
+        checkDatabaseHash();
+    }
+
+#if CONFIG_ENABLED(MICROBIT_BLE_DEFER_FLASH_CLEAN)
+    if ( this->status & MICROBIT_BLE_STATUS_FLASH_CLEAN)
+    {
+        if ( !getConnected() || (system_timer_current_time() - flashCleanTime) >= MICROBIT_BLE_FLASH_CLEAN_TIMEOUT)
+        {
+            MICROBIT_DEBUG_DMESG( "MICROBIT_BLE_STATUS_FLASH_CLEAN");
+            target_disable_irq();
+            this->status &= ~MICROBIT_BLE_STATUS_FLASH_CLEAN;
+            if ( !(this->status & MICROBIT_BLE_STATUS_IDLE_USERS))
+                this->status &= ~DEVICE_COMPONENT_STATUS_IDLE_TICK;
+            target_enable_irq();
+
+            // The peer manager retries the writes that found storage full once collection completes.
+            pm_evt_t evt = m_flash_clean_evt;
+            m_flash_clean_pending = false;
+            pm_handler_flash_clean( &evt);
+        }
+    }
+#endif
+
     if ( this->status & MICROBIT_BLE_STATUS_SHUTDOWN)
     {
         //MICROBIT_DEBUG_DMESG( "MicroBitBLEManager::idleCallback");
@@ -650,7 +791,14 @@ void MicroBitBLEManager::idleCallback()
 void MicroBitBLEManager::advertise()
 {
     MICROBIT_DEBUG_DMESG( "advertise");
-    MICROBIT_BLE_ECHK( sd_ble_gap_adv_start( m_adv_handle, microbit_ble_CONN_CFG_TAG));
+
+    m_adv_primary     = true;
+    m_adv_primary_end = m_adv_params.duration ? system_timer_current_time() + m_adv_params.duration * 10 : 0;
+
+    if ( !microbit_ble_adv_count())
+        MICROBIT_BLE_ECHK( sd_ble_gap_adv_start( m_adv_handle, microbit_ble_CONN_CFG_TAG));
+    else if ( m_adv_current <= 0 && microbit_ble_adv_ready( 0))
+        microbit_ble_adv_apply( 0, true);
 }
 
 
@@ -660,7 +808,313 @@ void MicroBitBLEManager::advertise()
 void MicroBitBLEManager::stopAdvertising()
 {
     MICROBIT_DEBUG_DMESG( "stopAdvertising");
-    MICROBIT_BLE_ECHK( sd_ble_gap_adv_stop( m_adv_handle));
+
+    m_adv_primary = false;
+
+    if ( !microbit_ble_adv_count())
+        MICROBIT_BLE_ECHK( sd_ble_gap_adv_stop( m_adv_handle));
+    else if ( m_adv_current == 0)
+        microbit_ble_adv_apply( microbit_ble_adv_next( 0), true);
+}
+
+
+/**
+  * Adds an advertising set, which is broadcast in turn with the micro:bit's own advertising and any other sets.
+  * The SoftDevice runs one advertising set at a time, so the sets are rotated, each broadcasting for its dwell time.
+  * Additional sets are not connectable, and keep being broadcast while the micro:bit is connected.
+  *
+  * @param data the advertising data, as a sequence of AD structures (length, type, value).
+  * @param length the length of the data, up to 31 bytes, or MICROBIT_BLE_ADVERTISING_DATA_MAX for extended advertising.
+  * @param interval_ms the advertising interval used while the set is broadcast, in milliseconds.
+  * @param dwell_ms the time the set is broadcast for before moving to the next, in milliseconds.
+  * @param extended true to use BLE 5 extended advertising, which carries larger payloads but is only seen by BLE 5 scanners.
+  *
+  * @return the identifier of the set (1 or more), DEVICE_INVALID_PARAMETER, DEVICE_NOT_SUPPORTED if extended
+  * advertising is not available, or DEVICE_NO_RESOURCES if MICROBIT_BLE_ADVERTISING_SETS sets are already in use.
+  */
+int MicroBitBLEManager::addAdvertisingSet(const uint8_t *data, int length, uint16_t interval_ms, uint16_t dwell_ms, bool extended)
+{
+#ifdef BLE_GAP_ADV_SET_DATA_SIZE_EXTENDED_MAX_SUPPORTED
+    int maxLength = extended ? min( MICROBIT_BLE_ADVERTISING_DATA_MAX, BLE_GAP_ADV_SET_DATA_SIZE_EXTENDED_MAX_SUPPORTED) : BLE_GAP_ADV_SET_DATA_SIZE_MAX;
+#else
+    if ( extended)
+        return DEVICE_NOT_SUPPORTED;
+
+    int maxLength = BLE_GAP_ADV_SET_DATA_SIZE_MAX;
+#endif
+
+    if ( data == NULL || length <= 0 || length > min( maxLength, MICROBIT_BLE_ADVERTISING_DATA_MAX))
+        return DEVICE_INVALID_PARAMETER;
+
+    int set = 0;
+    for ( int i = 0; i < MICROBIT_BLE_ADVERTISING_SETS && !set; i++)
+        if ( m_adv_sets[i].length == 0)
+            set = i + 1;
+
+    if ( !set)
+        return DEVICE_NO_RESOURCES;
+
+    microbit_ble_adv_set_t *s = &m_adv_sets[ set - 1];
+    s->buffer   = 0;
+    memcpy( s->data[ 0], data, length);
+    s->length   = length;
+    s->interval = interval_ms;
+    s->dwell    = dwell_ms;
+    s->extended = extended;
+
+    if ( !(this->status & MICROBIT_BLE_STATUS_ADV_SETS))
+    {
+        // Start rotating. If our own advertising is running, it keeps its turn until its dwell time is up.
+        target_disable_irq();
+        this->status |= MICROBIT_BLE_STATUS_ADV_SETS | DEVICE_COMPONENT_STATUS_IDLE_TICK;
+        target_enable_irq();
+        m_adv_current  = microbit_ble_adv_ready( 0) ? 0 : -1;
+        m_adv_switched = system_timer_current_time();
+    }
+
+    if ( m_adv_current < 0)
+        microbit_ble_adv_apply( set, true);
+
+    return set;
+}
+
+
+/**
+  * Replaces the data broadcast by an advertising set. A set that is being broadcast is updated in place, without restarting it.
+  *
+  * @param set the identifier returned by addAdvertisingSet().
+  * @param data the advertising data, as a sequence of AD structures.
+  * @param length the length of the data, within the limit of the set's advertising type.
+  *
+  * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER.
+  */
+int MicroBitBLEManager::updateAdvertisingSet(int set, const uint8_t *data, int length)
+{
+    if ( set < 1 || set > MICROBIT_BLE_ADVERTISING_SETS || m_adv_sets[ set - 1].length == 0)
+        return DEVICE_INVALID_PARAMETER;
+
+    microbit_ble_adv_set_t *s = &m_adv_sets[ set - 1];
+    int maxLength = s->extended ? MICROBIT_BLE_ADVERTISING_DATA_MAX : min( BLE_GAP_ADV_SET_DATA_SIZE_MAX, MICROBIT_BLE_ADVERTISING_DATA_MAX);
+
+    if ( data == NULL || length <= 0 || length > maxLength)
+        return DEVICE_INVALID_PARAMETER;
+
+    // The SoftDevice reads the data of a running set, so fill the other buffer, then hand it over.
+    // A running set accepts new data buffers without being stopped, as long as they differ from the ones in use.
+    uint8_t next = s->buffer ^ 1;
+    memcpy( s->data[ next], data, length);
+
+    if ( m_adv_current == set)
+    {
+        ble_gap_adv_data_t gap_adv_data;
+        memset( &gap_adv_data, 0, sizeof( gap_adv_data));
+        gap_adv_data.adv_data.p_data = s->data[ next];
+        gap_adv_data.adv_data.len    = length;
+
+        if ( sd_ble_gap_adv_set_configure( &m_adv_handle, &gap_adv_data, NULL) != NRF_SUCCESS)
+        {
+            s->buffer = next;
+            s->length = length;
+            microbit_ble_adv_apply( set, true);
+            return DEVICE_OK;
+        }
+    }
+
+    s->buffer = next;
+    s->length = length;
+
+    return DEVICE_OK;
+}
+
+
+/**
+  * Changes how often, and for how long in each rotation, an advertising set is broadcast.
+  *
+  * @param set the identifier returned by addAdvertisingSet(), or 0 for the micro:bit's own advertising.
+  * For set 0 only the dwell time is used; its interval is chosen by the function that configured it.
+  * @param interval_ms the advertising interval used while the set is broadcast, in milliseconds.
+  * @param dwell_ms the time the set is broadcast for before moving to the next, in milliseconds.
+  *
+  * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER.
+  */
+int MicroBitBLEManager::setAdvertisingSetInterval(int set, uint16_t interval_ms, uint16_t dwell_ms)
+{
+    if ( set == 0)
+    {
+        m_adv_primary_dwell = dwell_ms;
+        return DEVICE_OK;
+    }
+
+    if ( set < 1 || set > MICROBIT_BLE_ADVERTISING_SETS || m_adv_sets[ set - 1].length == 0)
+        return DEVICE_INVALID_PARAMETER;
+
+    m_adv_sets[ set - 1].interval = interval_ms;
+    m_adv_sets[ set - 1].dwell    = dwell_ms;
+
+    if ( m_adv_current == set)
+        microbit_ble_adv_apply( set, true);
+
+    return DEVICE_OK;
+}
+
+
+/**
+  * Stops broadcasting an advertising set, and frees it for reuse.
+  *
+  * @param set the identifier returned by addAdvertisingSet().
+  *
+  * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER.
+  */
+int MicroBitBLEManager::removeAdvertisingSet(int set)
+{
+    if ( set < 1 || set > MICROBIT_BLE_ADVERTISING_SETS || m_adv_sets[ set - 1].length == 0)
+        return DEVICE_INVALID_PARAMETER;
+
+    m_adv_sets[ set - 1].length = 0;
+
+    if ( microbit_ble_adv_count())
+    {
+        if ( m_adv_current == set)
+            microbit_ble_adv_apply( microbit_ble_adv_next( set), true);
+
+        return DEVICE_OK;
+    }
+
+    // That was the last one. Leave our own advertising configured on the handle, as it was before the rotation began.
+    target_disable_irq();
+    this->status &= ~MICROBIT_BLE_STATUS_ADV_SETS;
+    if ( !(this->status & MICROBIT_BLE_STATUS_IDLE_USERS))
+        this->status &= ~DEVICE_COMPONENT_STATUS_IDLE_TICK;
+    target_enable_irq();
+
+    microbit_ble_adv_apply( 0, microbit_ble_adv_ready( 0));
+    m_adv_current = -1;
+
+    return DEVICE_OK;
+}
+
+
+// The length of the advertising data carrying a MicroBitBLETelemetry.
+#define MICROBIT_BLE_TELEMETRY_ADV_LENGTH   ( 4 + sizeof( MicroBitBLETelemetry))
+
+/**
+  * Encodes telemetry as a manufacturer specific data AD structure of MICROBIT_BLE_TELEMETRY_ADV_LENGTH bytes.
+  */
+static void microbit_ble_telemetry_encode( uint8_t *data, const MicroBitBLETelemetry *telemetry)
+{
+    data[0] = MICROBIT_BLE_TELEMETRY_ADV_LENGTH - 1;
+    data[1] = BLE_GAP_AD_TYPE_MANUFACTURER_SPECIFIC_DATA;
+    data[2] = MICROBIT_BLE_TELEMETRY_COMPANY_ID & 0xFF;
+    data[3] = MICROBIT_BLE_TELEMETRY_COMPANY_ID >> 8;
+    memcpy( data + 4, telemetry, sizeof( MicroBitBLETelemetry));
+}
+
+
+/**
+  * Starts broadcasting sensor readings in a MicroBitBLETelemetry advertising set, so that a scanner can
+  * monitor many micro:bits without connecting to each. The readings are refreshed every period_ms, and the
+  * advertising data is replaced in place, without restarting advertising.
+  *
+  * @param accelerometer the accelerometer to report.
+  * @param thermometer the thermometer to report.
+  * @param log the data log whose fill level is reported, or NULL.
+  * @param power the power manager used to read the battery voltage, or NULL.
+  * @param period_ms how often the readings are refreshed, in milliseconds.
+  * @param interval_ms the advertising interval used while the readings are broadcast, in milliseconds.
+  *
+  * @return DEVICE_OK on success, or an error code from addAdvertisingSet().
+  */
+int MicroBitBLEManager::startTelemetry(Accelerometer &accelerometer, MicroBitThermometer &thermometer, MicroBitLog *log, MicroBitPowerManager *power,
+                                       uint16_t period_ms, uint16_t interval_ms)
+{
+    if ( period_ms == 0)
+        return DEVICE_INVALID_PARAMETER;
+
+    if ( telemetrySet)
+        stopTelemetry();
+
+    telemetryAccelerometer = &accelerometer;
+    telemetryThermometer   = &thermometer;
+    telemetryLog           = log;
+    telemetryPower         = power;
+
+    memset( &telemetry, 0, sizeof( telemetry));
+    telemetry.version = MICROBIT_BLE_TELEMETRY_VERSION;
+    telemetry.serial  = microbit_serial_number();
+    telemetry.logFill = 0xFF;
+
+    // Start with what is known without waiting on the sensors; the first refresh fills in the rest.
+    uint8_t data[ MICROBIT_BLE_TELEMETRY_ADV_LENGTH];
+    microbit_ble_telemetry_encode( data, &telemetry);
+
+    int set = addAdvertisingSet( data, sizeof( data), interval_ms);
+    if ( set < 0)
+        return set;
+
+    telemetrySet = set;
+
+    EventModel::defaultEventBus->listen( MICROBIT_ID_BLE, MICROBIT_BLE_EVT_TELEMETRY, this, &MicroBitBLEManager::onTelemetryTimer);
+    system_timer_event_every( period_ms, MICROBIT_ID_BLE, MICROBIT_BLE_EVT_TELEMETRY);
+    MicroBitEvent( MICROBIT_ID_BLE, MICROBIT_BLE_EVT_TELEMETRY);
+
+    return DEVICE_OK;
+}
+
+
+/**
+  * Stops broadcasting sensor readings started by startTelemetry().
+  *
+  * @return DEVICE_OK on success, or DEVICE_INVALID_STATE if telemetry is not running.
+  */
+int MicroBitBLEManager::stopTelemetry()
+{
+    if ( !telemetrySet)
+        return DEVICE_INVALID_STATE;
+
+    system_timer_cancel_event( MICROBIT_ID_BLE, MICROBIT_BLE_EVT_TELEMETRY);
+    EventModel::defaultEventBus->ignore( MICROBIT_ID_BLE, MICROBIT_BLE_EVT_TELEMETRY, this, &MicroBitBLEManager::onTelemetryTimer);
+
+    removeAdvertisingSet( telemetrySet);
+    telemetrySet = 0;
+
+    return DEVICE_OK;
+}
+
+
+/**
+  * Refreshes the readings broadcast by startTelemetry(). Runs in its own fiber, as reading the battery waits on I2C.
+  */
+void MicroBitBLEManager::onTelemetryTimer(MicroBitEvent)
+{
+    if ( !telemetrySet)
+        return;
+
+    Sample3D a = telemetryAccelerometer->getSample();
+
+    telemetry.temperature     = telemetryThermometer->getTemperature();
+    telemetry.acceleration[0] = max( -128, min( 127, a.x / 16));
+    telemetry.acceleration[1] = max( -128, min( 127, a.y / 16));
+    telemetry.acceleration[2] = max( -128, min( 127, a.z / 16));
+
+    if ( telemetryLog)
+    {
+        int fill = telemetryLog->getFillLevel();
+        telemetry.logFill = fill < 0 ? 0xFF : fill;
+    }
+
+    if ( telemetryPower)
+        telemetry.battery = telemetryPower->getPowerData().batteryMicroVolts / 1000;
+
+    // The set may have been stopped while we waited on the sensors.
+    if ( !telemetrySet)
+        return;
+
+    telemetry.sequence++;
+
+    uint8_t data[ MICROBIT_BLE_TELEMETRY_ADV_LENGTH];
+    microbit_ble_telemetry_encode( data, &telemetry);
+
+    updateAdvertisingSet( telemetrySet, data, sizeof( data));
 }
 
 
@@ -671,6 +1125,13 @@ void MicroBitBLEManager::onDisconnect()
 {
     MICROBIT_DEBUG_DMESG( "onDisconnect");
         
+    target_disable_irq();
+    this->status &= ~MICROBIT_BLE_STATUS_BULK;
+    if ( !(this->status & MICROBIT_BLE_STATUS_IDLE_USERS))
+        this->status &= ~DEVICE_COMPONENT_STATUS_IDLE_TICK;
+    target_enable_irq();
+    activeConnectionMode = m_conn_mode_init;
+
     MicroBitEvent(MICROBIT_ID_BLE, MICROBIT_BLE_EVT_DISCONNECTED);
     
     if ( advertiseOnDisconnect && ble_conn_state_peripheral_conn_count() == 0)
@@ -689,6 +1150,125 @@ bool MicroBitBLEManager::getConnected()
 }
 
 
+/**
+ * Sets the connection mode used when no bulk transfer is in progress, and requests it from the
+ * connected device. The connection parameters are negotiated, so the device may choose others.
+ *
+ * @param mode MICROBIT_BLE_CONNECTION_DEFAULT, MICROBIT_BLE_CONNECTION_BULK or MICROBIT_BLE_CONNECTION_IDLE.
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the mode is not recognised.
+ */
+int MicroBitBLEManager::setConnectionMode(int mode)
+{
+    if ( mode < MICROBIT_BLE_CONNECTION_DEFAULT || mode > MICROBIT_BLE_CONNECTION_IDLE)
+        return DEVICE_INVALID_PARAMETER;
+
+    connectionMode = mode;
+
+    if ( !(this->status & MICROBIT_BLE_STATUS_BULK))
+        applyConnectionMode( mode);
+
+    return DEVICE_OK;
+}
+
+
+/**
+ * Determines the connection mode last requested from the connected device.
+ *
+ * @return MICROBIT_BLE_CONNECTION_DEFAULT, MICROBIT_BLE_CONNECTION_BULK or MICROBIT_BLE_CONNECTION_IDLE.
+ */
+int MicroBitBLEManager::getConnectionMode()
+{
+    return activeConnectionMode;
+}
+
+
+/**
+ * Determines the connection mode used when no bulk transfer is in progress.
+ *
+ * @return the mode last given to setConnectionMode(), or MICROBIT_BLE_CONNECTION_MODE.
+ */
+int MicroBitBLEManager::getRestingConnectionMode()
+{
+    return connectionMode;
+}
+
+
+/**
+ * Indicates that a bulk transfer is in progress. The connection is switched to MICROBIT_BLE_CONNECTION_BULK,
+ * and returns to the mode set by setConnectionMode() MICROBIT_BLE_BULK_TIMEOUT milliseconds after the last call.
+ */
+void MicroBitBLEManager::bulkTransfer()
+{
+    bulkTime = system_timer_current_time();
+
+    // Services may call this from SoftDevice event context, so test and set the flag with interrupts disabled.
+    target_disable_irq();
+    bool started = this->status & MICROBIT_BLE_STATUS_BULK;
+
+    // The idle callback returns us to the resting mode once the transfer is over.
+    this->status |= MICROBIT_BLE_STATUS_BULK | DEVICE_COMPONENT_STATUS_IDLE_TICK;
+    target_enable_irq();
+
+    if ( !started)
+        applyConnectionMode( MICROBIT_BLE_CONNECTION_BULK);
+}
+
+
+/**
+ * Holds back garbage collection of the bond storage until the connection closes,
+ * or MICROBIT_BLE_FLASH_CLEAN_TIMEOUT milliseconds have passed.
+ *
+ * @note for internal use only. Called from the peer manager event handler.
+ */
+void MicroBitBLEManager::deferFlashClean()
+{
+    // The idle callback also updates status, and may be interrupted by us, so test and set the flag with interrupts disabled.
+    target_disable_irq();
+
+    if ( this->status & MICROBIT_BLE_STATUS_FLASH_CLEAN)
+    {
+        target_enable_irq();
+        return;
+    }
+
+    // The idle callback runs the collection once the connection has closed.
+    flashCleanTime = system_timer_current_time();
+    this->status |= MICROBIT_BLE_STATUS_FLASH_CLEAN | DEVICE_COMPONENT_STATUS_IDLE_TICK;
+    target_enable_irq();
+
+    MICROBIT_DEBUG_DMESG( "deferFlashClean");
+}
+
+
+/**
+ * Requests the connection parameters and PHY of the given mode from the connected device.
+ *
+ * @param mode the connection mode to request.
+ */
+void MicroBitBLEManager::applyConnectionMode(int mode)
+{
+    ble_conn_state_conn_handle_list_t list = ble_conn_state_periph_handles();
+    bool changed = mode != activeConnectionMode;
+
+    activeConnectionMode = mode;
+
+    if ( list.len == 0 || !changed)
+        return;
+
+    ble_gap_conn_params_t params = microbit_ble_conn_params[ mode];
+    ble_gap_phys_t phys;
+    phys.tx_phys = phys.rx_phys = mode == MICROBIT_BLE_CONNECTION_BULK ? BLE_GAP_PHY_2MBPS : BLE_GAP_PHY_AUTO;
+
+    for ( uint32_t i = 0; i < list.len; i++)
+    {
+        // Let ble_conn_params negotiate, so that it does not later revert to the parameters given at init.
+        MICROBIT_BLE_ECHK( ble_conn_params_change_conn_params( list.conn_handles[i], &params));
+        MICROBIT_BLE_ECHK( sd_ble_gap_phy_update( list.conn_handles[i], &phys));
+    }
+}
+
+
 #if CONFIG_ENABLED(MICROBIT_BLE_EDDYSTONE_URL)
 /**
   * Set the content of Eddystone URL frames
@@ -1043,6 +1623,10 @@ bool MicroBitBLEManager::prepareForShutdown()
 {
     bool shutdownOK = true;
         
+    // Stop rotating any additional advertising sets, so the idle callback doesn't restart them.
+    target_disable_irq();
+    this->status &= ~MICROBIT_BLE_STATUS_ADV_SETS;
+    target_enable_irq();
     sd_ble_gap_adv_stop( m_adv_handle);
     setAdvertiseOnDisconnect( false);
 
@@ -1107,6 +1691,29 @@ int MicroBitBLEManager::setSleep(bool doSleep)
 }
 
 
+/**
+ * Compares the layout of the GATT database with the one last seen, and if it differs,
+ * asks bonded peers to rediscover our services. Without storage, we can't tell, so always ask.
+ *
+ * @note for internal use only. Called from the idle callback once the first peer connects, by which time all services have been added.
+ */
+void MicroBitBLEManager::checkDatabaseHash()
+{
+    databaseHash = microbit_ble_database_hash();
+    KeyValuePair *storedHash = storage ? storage->get( "gattHash") : NULL;
+
+    if ( storedHash == NULL || memcmp( storedHash->value, &databaseHash, sizeof( databaseHash)) != 0)
+    {
+        servicesChanged();
+
+        if ( storage)
+            storage->put( "gattHash", (uint8_t *) &databaseHash, sizeof( databaseHash));
+    }
+
+    delete storedHash;
+}
+
+
 /**
 * Ensure service changed indication pending for all peers
 */
@@ -1163,6 +1770,74 @@ void MicroBitBLEManager::servicesChanged()
 }
 
 
+/**
+ * Computes a hash of the GATT database layout: the handle, full UUID and permissions of every attribute, in order,
+ * and the value of each characteristic declaration, which holds the characteristic's properties.
+ * This serves the same purpose as the Bluetooth 5.1 Database Hash, which the SoftDevice doesn't provide.
+ *
+ * @return a CRC32 of the layout.
+ */
+static uint32_t microbit_ble_database_hash()
+{
+    uint32_t crc = 0;
+
+    for ( uint16_t handle = BLE_GATT_HANDLE_START; handle != 0; handle++)
+    {
+        ble_uuid_t          uuid;
+        ble_gatts_attr_md_t md;
+
+        if ( sd_ble_gatts_attr_get( handle, &uuid, &md) != NRF_SUCCESS)
+            break;
+
+        uint8_t entry[ 2 + 16 + 5];
+        uint8_t length = 0;
+
+        entry[0] = handle & 0xFF;
+        entry[1] = handle >> 8;
+        sd_ble_uuid_encode( &uuid, &length, &entry[2]);
+        length += 2;
+
+        entry[length++] = md.read_perm.sm | (md.read_perm.lv << 4);
+        entry[length++] = md.write_perm.sm | (md.write_perm.lv << 4);
+        entry[length++] = md.vlen | (md.vloc << 1) | (md.rd_auth << 3) | (md.wr_auth << 4);
+        crc = crc32_compute( entry, length, &crc);
+
+        // A characteristic declaration holds the properties, value handle and UUID of its characteristic.
+        if ( uuid.type == BLE_UUID_TYPE_BLE && uuid.uuid == BLE_UUID_CHARACTERISTIC)
+        {
+            uint8_t declaration[ 1 + 2 + 16];
+            ble_gatts_value_t value;
+
+            memset( &value, 0, sizeof( value));
+            value.len = sizeof( declaration);
+            value.p_value = declaration;
+
+            if ( sd_ble_gatts_value_get( BLE_CONN_HANDLE_INVALID, handle, &value) == NRF_SUCCESS)
+                crc = crc32_compute( declaration, value.len, &crc);
+        }
+    }
+
+    MICROBIT_DEBUG_DMESG( "database hash %x", (unsigned int) crc);
+    return crc;
+}
+
+
+/**
+ * Converts an advertising interval to the SoftDevice's 625us units, within the range it accepts.
+ *
+ * @param interval_ms Advertising interval in milliseconds.
+ */
+static uint32_t microbit_ble_adv_interval( uint16_t interval_ms)
+{
+    uint32_t interval = ( 1000 * (uint32_t) interval_ms) / 625;
+
+    if ( interval < BLE_GAP_ADV_INTERVAL_MIN) interval = BLE_GAP_ADV_INTERVAL_MIN;
+    if ( interval > BLE_GAP_ADV_INTERVAL_MAX) interval = BLE_GAP_ADV_INTERVAL_MAX;
+
+    return interval;
+}
+
+
 /**
  * Function to configure advertising
  *
@@ -1184,9 +1859,7 @@ static void microbit_ble_configureAdvertising( bool connectable, bool discoverab
     gap_adv_params.properties.type  = connectable
                                     ? BLE_GAP_ADV_TYPE_CONNECTABLE_SCANNABLE_UNDIRECTED
                                     : BLE_GAP_ADV_TYPE_NONCONNECTABLE_SCANNABLE_UNDIRECTED;
-    gap_adv_params.interval         = ( 1000 * interval_ms) / 625;  // 625 us units
-    if ( gap_adv_params.interval < BLE_GAP_ADV_INTERVAL_MIN) gap_adv_params.interval = BLE_GAP_ADV_INTERVAL_MIN;
-    if ( gap_adv_params.interval > BLE_GAP_ADV_INTERVAL_MAX) gap_adv_params.interval = BLE_GAP_ADV_INTERVAL_MAX;
+    gap_adv_params.interval         = microbit_ble_adv_interval( interval_ms);
     gap_adv_params.duration         = timeout_seconds * 100;              //10 ms units
     gap_adv_params.filter_policy    = whitelist
                                     ? BLE_GAP_ADV_FP_FILTER_BOTH
@@ -1199,7 +1872,13 @@ static void microbit_ble_configureAdvertising( bool connectable, bool discoverab
     gap_adv_data.adv_data.len       = BLE_GAP_ADV_SET_DATA_SIZE_MAX;
     MICROBIT_BLE_ECHK( ble_advdata_encode( p_advdata, gap_adv_data.adv_data.p_data, &gap_adv_data.adv_data.len));
     NRF_LOG_HEXDUMP_INFO( gap_adv_data.adv_data.p_data, gap_adv_data.adv_data.len);
-    MICROBIT_BLE_ECHK( sd_ble_gap_adv_set_configure( &m_adv_handle, &gap_adv_data, &gap_adv_params));
+
+    m_adv_params = gap_adv_params;
+    m_enc_advlen = gap_adv_data.adv_data.len;
+
+    // While additional sets are being rotated, our own advertising is configured on the handle when its turn comes.
+    if ( !microbit_ble_adv_count())
+        MICROBIT_BLE_ECHK( sd_ble_gap_adv_set_configure( &m_adv_handle, &gap_adv_data, &gap_adv_params));
 }
 
 
@@ -1250,6 +1929,141 @@ static void microbit_ble_configureAdvertising( bool connectable, bool discoverab
 #endif
 
 
+/**
+ * Determines the number of additional advertising sets in use.
+ */
+static int microbit_ble_adv_count()
+{
+    int count = 0;
+
+    for ( int i = 0; i < MICROBIT_BLE_ADVERTISING_SETS; i++)
+        if ( m_adv_sets[i].length)
+            count++;
+
+    return count;
+}
+
+
+/**
+ * Determines if an advertising set can take its turn in the rotation.
+ *
+ * @param set 0 for our own advertising, or the identifier of an additional set.
+ */
+static bool microbit_ble_adv_ready( int set)
+{
+    if ( set > 0)
+        return m_adv_sets[ set - 1].length > 0;
+
+    if ( !m_adv_primary || ( m_adv_primary_end && system_timer_current_time() >= m_adv_primary_end))
+        return false;
+
+    // Connectable advertising can't run alongside a peripheral connection.
+    return m_adv_params.properties.type != BLE_GAP_ADV_TYPE_CONNECTABLE_SCANNABLE_UNDIRECTED
+        || ble_conn_state_peripheral_conn_count() == 0;
+}
+
+
+/**
+ * Finds the next advertising set to take its turn in the rotation.
+ *
+ * @param set the current set, or -1 to start from set 0.
+ *
+ * @return the next set, which may be the current one, or -1 if none is ready.
+ */
+static int microbit_ble_adv_next( int set)
+{
+    for ( int i = 1; i <= MICROBIT_BLE_ADVERTISING_SETS + 1; i++)
+    {
+        int next = ( set + i) % ( MICROBIT_BLE_ADVERTISING_SETS + 1);
+
+        if ( microbit_ble_adv_ready( next))
+            return next;
+    }
+
+    return -1;
+}
+
+
+/**
+ * Configures an advertising set on m_adv_handle, replacing the one that was there.
+ *
+ * @param set 0 for our own advertising, the identifier of an additional set, or -1 for none.
+ * @param start true to start advertising the set.
+ */
+static void microbit_ble_adv_apply( int set, bool start)
+{
+    // The handle can only be reconfigured while it isn't advertising. It may not be, so ignore the result.
+    sd_ble_gap_adv_stop( m_adv_handle);
+
+    m_adv_current  = set;
+    m_adv_switched = system_timer_current_time();
+
+    if ( set < 0)
+        return;
+
+    ble_gap_adv_params_t    gap_adv_params;
+    ble_gap_adv_data_t      gap_adv_data;
+    memset( &gap_adv_data, 0, sizeof( gap_adv_data));
+
+    if ( set == 0)
+    {
+        gap_adv_params = m_adv_params;
+
+        // Each turn restarts the SoftDevice's timeout, so give it only what is left of ours.
+        if ( start && m_adv_primary_end)
+            gap_adv_params.duration = max( 1, (int) ( m_adv_primary_end - m_adv_switched) / 10);
+
+        gap_adv_data.adv_data.p_data = m_enc_advdata;
+        gap_adv_data.adv_data.len    = m_enc_advlen;
+    }
+    else
+    {
+        microbit_ble_adv_set_t *s = &m_adv_sets[ set - 1];
+
+        memset( &gap_adv_params, 0, sizeof( gap_adv_params));
+#ifdef BLE_GAP_ADV_SET_DATA_SIZE_EXTENDED_MAX_SUPPORTED
+        gap_adv_params.properties.type  = s->extended
+                                        ? BLE_GAP_ADV_TYPE_EXTENDED_NONCONNECTABLE_NONSCANNABLE_UNDIRECTED
+                                        : BLE_GAP_ADV_TYPE_NONCONNECTABLE_NONSCANNABLE_UNDIRECTED;
+#else
+        gap_adv_params.properties.type  = BLE_GAP_ADV_TYPE_NONCONNECTABLE_NONSCANNABLE_UNDIRECTED;
+#endif
+        gap_adv_params.interval         = microbit_ble_adv_interval( s->interval);
+        gap_adv_params.filter_policy    = BLE_GAP_ADV_FP_ANY;
+        gap_adv_params.primary_phy      = BLE_GAP_PHY_1MBPS;
+        gap_adv_params.secondary_phy    = BLE_GAP_PHY_1MBPS;
+
+        gap_adv_data.adv_data.p_data    = s->data[ s->buffer];
+        gap_adv_data.adv_data.len       = s->length;
+    }
+
+    MICROBIT_BLE_ECHK( sd_ble_gap_adv_set_configure( &m_adv_handle, &gap_adv_data, &gap_adv_params));
+
+    if ( start)
+        MICROBIT_BLE_ECHK( sd_ble_gap_adv_start( m_adv_handle, microbit_ble_CONN_CFG_TAG));
+}
+
+
+/**
+ * Moves the rotation on to the next advertising set once the current one has had its dwell time.
+ * Called from the idle callback while MICROBIT_BLE_STATUS_ADV_SETS is set.
+ */
+static void microbit_ble_adv_schedule()
+{
+    uint16_t dwell = m_adv_current > 0 ? m_adv_sets[ m_adv_current - 1].dwell : m_adv_primary_dwell;
+
+    if ( m_adv_current >= 0 && microbit_ble_adv_ready( m_adv_current) && system_timer_current_time() - m_adv_switched < dwell)
+        return;
+
+    int next = microbit_ble_adv_next( m_adv_current);
+
+    if ( next == m_adv_current && next > 0)
+        m_adv_switched = system_timer_current_time();
+    else if ( next >= 0 || m_adv_current >= 0)
+        microbit_ble_adv_apply( next, true);
+}
+
+
 /**
   * Callback when a BLE connection is established.
   */
@@ -1259,11 +2073,34 @@ static void bleConnectionCallback( microbit_gaphandle_t handle)
     
     if ( handle != BLE_CONN_HANDLE_INVALID)
         sd_ble_gap_tx_power_set( BLE_GAP_TX_POWER_ROLE_CONN, handle, MICROBIT_BLE_POWER_LEVEL[ m_power]);
+
+    // New connections start from the parameters given at init, so request any mode set since.
+    if ( MicroBitBLEManager::manager)
+        MicroBitBLEManager::manager->setConnectionMode( MicroBitBLEManager::manager->getRestingConnectionMode());
     
     MicroBitEvent(MICROBIT_ID_BLE, MICROBIT_BLE_EVT_CONNECTED);
 }
 
 
+/**
+  * Callback when nrf_ble_gatt has negotiated the ATT MTU or data length of a connection.
+  */
+static void microbit_ble_gatt_evt_handler(nrf_ble_gatt_t * p_gatt, nrf_ble_gatt_evt_t const * p_evt)
+{
+    switch ( p_evt->evt_id)
+    {
+        case NRF_BLE_GATT_EVT_ATT_MTU_UPDATED:
+            MICROBIT_DEBUG_DMESG( "ATT MTU %d", (int) p_evt->params.att_mtu_effective);
+            MicroBitBLEService::setATTMTU( p_evt->params.att_mtu_effective);
+            break;
+
+        case NRF_BLE_GATT_EVT_DATA_LENGTH_UPDATED:
+            MICROBIT_DEBUG_DMESG( "data length %d", (int) p_evt->params.data_length);
+            break;
+    }
+}
+
+
 static void passkeyDisplayCallback( microbit_gaphandle_t handle, ManagedString passKey)
 {
     MICROBIT_DEBUG_DMESG( "passkeyDisplayCallback %d", (int) handle);
@@ -1288,6 +2125,9 @@ static void microbit_ble_evt_handler(ble_evt_t const * p_ble_evt, void * p_conte
     {
         case BLE_GAP_EVT_DISCONNECTED:
         {
+            MicroBitBLEService::setATTMTU( BLE_GATT_ATT_MTU_DEFAULT);
+            MicroBitBLEService::setConnectionInterval( 0);
+
             if ( MicroBitBLEManager::manager)
                 MicroBitBLEManager::manager->onDisconnect();
             break;
@@ -1295,9 +2135,16 @@ static void microbit_ble_evt_handler(ble_evt_t const * p_ble_evt, void * p_conte
         case BLE_GAP_EVT_CONNECTED:
         {
             MICROBIT_DEBUG_DMESG( "BLE_GAP_EVT_CONNECTED %d", ble_conn_state_conn_count());
+            MicroBitBLEService::setConnectionInterval( p_ble_evt->evt.gap_evt.params.connected.conn_params.max_conn_interval);
             bleConnectionCallback( p_ble_evt->evt.gap_evt.conn_handle);
             break;
         }
+        case BLE_GAP_EVT_CONN_PARAM_UPDATE:
+        {
+            MICROBIT_DEBUG_DMESG( "BLE_GAP_EVT_CONN_PARAM_UPDATE %d", (int) p_ble_evt->evt.gap_evt.params.conn_param_update.conn_params.max_conn_interval);
+            MicroBitBLEService::setConnectionInterval( p_ble_evt->evt.gap_evt.params.conn_param_update.conn_params.max_conn_interval);
+            break;
+        }
         case BLE_GAP_EVT_PHY_UPDATE_REQUEST:
         {
             ble_gap_phys_t const phys =
@@ -1347,7 +2194,23 @@ static void microbit_ble_pm_evt_handler(pm_evt_t const * p_evt)
     //MICROBIT_DEBUG_DMESG( "%d:microbit_ble_pm_evt_handler %d", (int)system_timer_current_time(), (int) p_evt->evt_id);
 
     pm_handler_on_pm_evt( p_evt);
-    pm_handler_flash_clean( p_evt);
+
+#if CONFIG_ENABLED(MICROBIT_BLE_DEFER_FLASH_CLEAN)
+    // Garbage collection rewrites whole flash pages while the connection is live, and the writes that
+    // found storage full are stuck behind it. Hold it back, and let the idle callback run it later.
+    if ( p_evt->evt_id == PM_EVT_STORAGE_FULL && MicroBitBLEManager::manager && ble_conn_state_peripheral_conn_count() > 0)
+    {
+        if ( !m_flash_clean_pending)
+        {
+            m_flash_clean_evt = *p_evt;
+            m_flash_clean_pending = true;
+        }
+
+        MicroBitBLEManager::manager->deferFlashClean();
+    }
+    else
+#endif
+        pm_handler_flash_clean( p_evt);
 
     switch ( p_evt->evt_id)
     {
@@ -1449,7 +2312,9 @@ static bool microbit_ble_shutdown_handler(nrf_pwr_mgmt_evt_t event)
             if ( MicroBitBLEManager::manager)
             {
                 // Use idleCallback rather than a timer to restart the shutdown
+                target_disable_irq();
                 MicroBitBLEManager::manager->status |= MICROBIT_BLE_STATUS_SHUTDOWN;
+                target_enable_irq();
                 fiber_add_idle_component( MicroBitBLEManager::manager);
                 
                 shutdownOK = MicroBitBLEManager::manager->prepareForShutdown();
@@ -0,0 +1,132 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+/**
+  * Class definition for MicroBitBLESampleBatch.
+  * Collects sensor samples into a single characteristic value, for the BLE sensor services.
+  */
+#include "MicroBitConfig.h"
+
+#if CONFIG_ENABLED(DEVICE_BLE)
+
+#include "MicroBitBLESampleBatch.h"
+#include "MicroBitBLEService.h"
+#include "CodalCompat.h"
+#include <string.h>
+#include "Timer.h"
+
+/**
+  * Constructor.
+  * Create an empty batch.
+  *
+  * @param recordSize the size of each record, including its time offset. Defaults to a 3D sample.
+  */
+MicroBitBLESampleBatch::MicroBitBLESampleBatch( uint16_t recordSize)
+{
+    setRecordSize( recordSize);
+}
+
+/**
+  * Changes the size of each record, and discards any samples held.
+  *
+  * @param recordSize the size of each record, including its time offset.
+  */
+void MicroBitBLESampleBatch::setRecordSize( uint16_t recordSize)
+{
+    record = max( recordSize, MICROBIT_BLE_SAMPLE_BATCH_OFFSET);
+    reset();
+}
+
+/**
+  * Discards any samples held, and restarts the pacing interval.
+  */
+void MicroBitBLESampleBatch::reset()
+{
+    samples = 0;
+    start = 0;
+    sent = system_timer_current_time();
+}
+
+/**
+  * Determines if the batch holds as many samples as fit in a single notification.
+  */
+bool MicroBitBLESampleBatch::full()
+{
+    int payload = min( (int) MicroBitBLEService::getMaxPayload(), (int) sizeof( buffer));
+
+    return MICROBIT_BLE_SAMPLE_BATCH_HEADER + ( samples + 1) * record > payload;
+}
+
+/**
+  * Adds a sample to the batch.
+  *
+  * @param x the X value of the sample.
+  * @param y the Y value of the sample.
+  * @param z the Z value of the sample.
+  *
+  * @return true if the batch should now be sent: either it is full, or at least one connection
+  * interval has passed since the last batch was sent.
+  */
+bool MicroBitBLESampleBatch::add( int16_t x, int16_t y, int16_t z)
+{
+    int16_t values[ 3] = { x, y, z };
+
+    return add( values);
+}
+
+/**
+  * Adds a sample to the batch.
+  *
+  * @param values the values of the sample: the record size less MICROBIT_BLE_SAMPLE_BATCH_OFFSET bytes.
+  *
+  * @return true if the batch should now be sent: either it is full, or at least one connection
+  * interval has passed since the last batch was sent.
+  */
+bool MicroBitBLESampleBatch::add( const void *values)
+{
+    CODAL_TIMESTAMP now = system_timer_current_time();
+
+    // If a full batch could not be sent, start afresh rather than lose the newest samples.
+    if ( full() || ( samples && now - start > 0xFFFF))
+        samples = 0;
+
+    if ( samples == 0)
+    {
+        uint32_t time = (uint32_t) now;
+
+        start = now;
+        memcpy( buffer, &time, MICROBIT_BLE_SAMPLE_BATCH_HEADER);
+    }
+
+    uint8_t *p = buffer + MICROBIT_BLE_SAMPLE_BATCH_HEADER + samples * record;
+    uint16_t offset = (uint16_t) ( now - start);
+
+    memcpy( p, &offset, MICROBIT_BLE_SAMPLE_BATCH_OFFSET);
+    memcpy( p + MICROBIT_BLE_SAMPLE_BATCH_OFFSET, values, record - MICROBIT_BLE_SAMPLE_BATCH_OFFSET);
+    samples++;
+
+    return full() || now - sent >= MicroBitBLEService::getConnectionInterval();
+}
+
+#endif
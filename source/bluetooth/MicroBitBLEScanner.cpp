@@ -0,0 +1,404 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "MicroBitConfig.h"
+
+#if CONFIG_ENABLED(DEVICE_BLE) && CONFIG_ENABLED(MICROBIT_BLE_SCANNER)
+
+#if defined(S113)
+#error "MicroBitBLEScanner needs a SoftDevice with the observer role. S113 is peripheral only."
+#endif
+
+#include "MicroBitBLEScanner.h"
+#include "MicroBitBLETypes.h"
+#include "MicroBitEvent.h"
+
+#include "nrf_sdh_ble.h"
+#include "app_util.h"
+#include "MicroBitSchedulerTrace.h"
+
+MicroBitBLEScanner *MicroBitBLEScanner::scanner = NULL;
+
+// AD types searched by the filters.
+#define MICROBIT_BLE_SCANNER_AD_UUID16_MORE         0x02
+#define MICROBIT_BLE_SCANNER_AD_UUID16_COMPLETE     0x03
+#define MICROBIT_BLE_SCANNER_AD_SERVICE_DATA16      0x16
+#define MICROBIT_BLE_SCANNER_AD_MANUFACTURER        0xFF
+
+/**
+  * Constructor.
+  *
+  * @param id the event bus id to raise MICROBIT_BLE_SCANNER_EVT_REPORTS on. Defaults to MICROBIT_ID_BLE_SCANNER.
+  */
+MicroBitBLEScanner::MicroBitBLEScanner( uint16_t id)
+{
+    this->id = id;
+    this->status |= DEVICE_COMPONENT_STATUS_IDLE_TICK;
+
+    filterCount     = 0;
+    rssiThreshold   = -128;
+    duplicateWindow = 1000;
+    batchCount      = 8;
+    batchPeriod     = 500;
+
+    memset( seen, 0, sizeof( seen));
+    seenNext = 0;
+
+    head     = 0;
+    tail     = 0;
+    notified = false;
+    dropped  = 0;
+    scanning = false;
+
+    scanData.p_data = buffer;
+    scanData.len    = sizeof( buffer);
+
+    scanner = this;
+}
+
+/**
+  * Destructor.
+  */
+MicroBitBLEScanner::~MicroBitBLEScanner()
+{
+    stop();
+
+    if ( scanner == this)
+        scanner = NULL;
+}
+
+/**
+  * Starts scanning, once MicroBitBLEManager has been initialised.
+  *
+  * @param interval_ms the time between the start of each scan window, in milliseconds.
+  * @param window_ms the time spent listening in each interval, in milliseconds. Equal to the interval for continuous scanning.
+  *
+  * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the window is longer than the interval,
+  * or DEVICE_NOT_SUPPORTED if the SoftDevice refuses to scan.
+  */
+int MicroBitBLEScanner::start( uint16_t interval_ms, uint16_t window_ms)
+{
+    if ( window_ms == 0 || window_ms > interval_ms)
+        return DEVICE_INVALID_PARAMETER;
+
+    stop();
+
+    memset( &params, 0, sizeof( params));
+    params.active        = 0;
+    params.filter_policy = BLE_GAP_SCAN_FP_ACCEPT_ALL;
+    params.scan_phys     = BLE_GAP_PHY_1MBPS;
+    params.interval      = max( BLE_GAP_SCAN_INTERVAL_MIN, min( BLE_GAP_SCAN_INTERVAL_MAX, ( 1000 * (int) interval_ms) / 625));   // 625 us units
+    params.window        = max( BLE_GAP_SCAN_WINDOW_MIN, min( (int) params.interval, ( 1000 * (int) window_ms) / 625));
+    params.timeout       = BLE_GAP_SCAN_TIMEOUT_UNLIMITED;
+
+    scanData.p_data = buffer;
+    scanData.len    = sizeof( buffer);
+
+    if ( MICROBIT_BLE_ECHK( sd_ble_gap_scan_start( &params, &scanData)) != NRF_SUCCESS)
+        return DEVICE_NOT_SUPPORTED;
+
+    scanning = true;
+    return DEVICE_OK;
+}
+
+/**
+  * Stops scanning. Reports already received can still be read.
+  *
+  * @return DEVICE_OK.
+  */
+int MicroBitBLEScanner::stop()
+{
+    if ( scanning)
+    {
+        scanning = false;
+        sd_ble_gap_scan_stop();
+    }
+
+    return DEVICE_OK;
+}
+
+/**
+  * Determines if the scanner is running.
+  */
+bool MicroBitBLEScanner::isScanning()
+{
+    return scanning;
+}
+
+/**
+  * Adds a filter. Once any filter is set, only advertisements that match at least one are reported.
+  *
+  * @param type MICROBIT_BLE_SCANNER_FILTER_SERVICE or MICROBIT_BLE_SCANNER_FILTER_MANUFACTURER.
+  * @param value the 16 bit service UUID or company identifier to match.
+  *
+  * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER, or DEVICE_NO_RESOURCES if MICROBIT_BLE_SCANNER_FILTERS are in use.
+  */
+int MicroBitBLEScanner::addFilter( int type, uint16_t value)
+{
+    if ( type != MICROBIT_BLE_SCANNER_FILTER_SERVICE && type != MICROBIT_BLE_SCANNER_FILTER_MANUFACTURER)
+        return DEVICE_INVALID_PARAMETER;
+
+    if ( filterCount >= MICROBIT_BLE_SCANNER_FILTERS)
+        return DEVICE_NO_RESOURCES;
+
+    filters[ filterCount].type  = type;
+    filters[ filterCount].value = value;
+    filterCount++;
+
+    return DEVICE_OK;
+}
+
+/**
+  * Removes all filters, so that every advertisement is reported.
+  */
+void MicroBitBLEScanner::clearFilters()
+{
+    filterCount = 0;
+}
+
+/**
+  * Sets the weakest signal to report. Advertisements received with a lower RSSI are ignored.
+  *
+  * @param rssi the threshold in dBm, or -128 to report everything (the default).
+  */
+void MicroBitBLEScanner::setRSSIThreshold( int8_t rssi)
+{
+    rssiThreshold = rssi;
+}
+
+/**
+  * Sets how long repeats of the same advertisement from the same device are suppressed for.
+  *
+  * @param window_ms the suppression time in milliseconds, or 0 to report every advertisement. Defaults to 1000.
+  */
+void MicroBitBLEScanner::setDuplicateWindow( uint16_t window_ms)
+{
+    duplicateWindow = window_ms;
+    memset( seen, 0, sizeof( seen));
+}
+
+/**
+  * Sets when MICROBIT_BLE_SCANNER_EVT_REPORTS is raised: once count reports are waiting, or period_ms after
+  * the oldest waiting report arrived, whichever is sooner.
+  *
+  * @param count the number of reports to wait for, from 1 to MICROBIT_BLE_SCANNER_QUEUE_SIZE. Defaults to 8.
+  * @param period_ms the longest time a report waits before the event is raised. Defaults to 500.
+  *
+  * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER.
+  */
+int MicroBitBLEScanner::setBatch( int count, uint16_t period_ms)
+{
+    if ( count < 1 || count > MICROBIT_BLE_SCANNER_QUEUE_SIZE)
+        return DEVICE_INVALID_PARAMETER;
+
+    batchCount  = count;
+    batchPeriod = period_ms;
+
+    return DEVICE_OK;
+}
+
+/**
+  * Determines the number of reports waiting to be read.
+  */
+int MicroBitBLEScanner::available()
+{
+    return ( head + MICROBIT_BLE_SCANNER_QUEUE_SIZE + 1 - tail) % ( MICROBIT_BLE_SCANNER_QUEUE_SIZE + 1);
+}
+
+/**
+  * Reads waiting reports, oldest first.
+  *
+  * @param reports the array to copy reports into.
+  * @param max the size of the array.
+  *
+  * @return the number of reports copied.
+  */
+int MicroBitBLEScanner::read( MicroBitBLEScanReport *reports, int max)
+{
+    int count = 0;
+
+    // Clear the flag first, so a report arriving while we copy raises a new event.
+    notified = false;
+
+    while ( count < max && tail != head)
+    {
+        reports[ count++] = queue[ tail];
+        __DMB();
+        tail = ( tail + 1) % ( MICROBIT_BLE_SCANNER_QUEUE_SIZE + 1);
+    }
+
+    return count;
+}
+
+/**
+  * Raises MICROBIT_BLE_SCANNER_EVT_REPORTS once the oldest waiting report has waited for the batch period.
+  */
+void MicroBitBLEScanner::idleCallback()
+{
+    MICROBIT_TRACE_IDLE(CodalComponent::id);
+
+    if ( !notified && tail != head && (uint32_t) system_timer_current_time() - queue[ tail].time >= batchPeriod)
+        notify();
+}
+
+/**
+  * Raises MICROBIT_BLE_SCANNER_EVT_REPORTS, unless it has been raised since reports were last read.
+  */
+void MicroBitBLEScanner::notify()
+{
+    if ( notified)
+        return;
+
+    notified = true;
+    MicroBitEvent( id, MICROBIT_BLE_SCANNER_EVT_REPORTS);
+}
+
+/**
+  * Determines if advertising data matches any of the filters.
+  */
+bool MicroBitBLEScanner::matches( const uint8_t *data, int length)
+{
+    if ( filterCount == 0)
+        return true;
+
+    for ( int i = 0; i + 1 < length; i += data[i] + 1)
+    {
+        int size = data[i];
+        if ( size == 0 || i + 1 + size > length)
+            break;
+
+        uint8_t type = data[ i + 1];
+        const uint8_t *value = &data[ i + 2];
+        int valueLength = size - 1;
+
+        for ( int f = 0; f < filterCount; f++)
+        {
+            if ( filters[f].type == MICROBIT_BLE_SCANNER_FILTER_SERVICE)
+            {
+                if ( type == MICROBIT_BLE_SCANNER_AD_UUID16_MORE || type == MICROBIT_BLE_SCANNER_AD_UUID16_COMPLETE)
+                {
+                    for ( int u = 0; u + 1 < valueLength; u += 2)
+                        if ( uint16_decode( &value[u]) == filters[f].value)
+                            return true;
+                }
+                else if ( type == MICROBIT_BLE_SCANNER_AD_SERVICE_DATA16 && valueLength >= 2 && uint16_decode( value) == filters[f].value)
+                    return true;
+            }
+            else if ( type == MICROBIT_BLE_SCANNER_AD_MANUFACTURER && valueLength >= 2 && uint16_decode( value) == filters[f].value)
+                return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+  * Determines if an advertisement repeats one seen within the duplicate window, and remembers it if not.
+  */
+bool MicroBitBLEScanner::duplicate( const ble_gap_evt_adv_report_t *report, uint32_t now)
+{
+    if ( duplicateWindow == 0)
+        return false;
+
+    // FNV-1a over the address and data. A collision only suppresses one report for one window.
+    uint32_t hash = 2166136261u;
+
+    for ( int i = 0; i < BLE_GAP_ADDR_LEN; i++)
+        hash = ( hash ^ report->peer_addr.addr[i]) * 16777619u;
+
+    for ( int i = 0; i < report->data.len; i++)
+        hash = ( hash ^ report->data.p_data[i]) * 16777619u;
+
+    for ( int i = 0; i < MICROBIT_BLE_SCANNER_DUPLICATES; i++)
+    {
+        if ( seen[i].hash == hash && seen[i].time && now - seen[i].time < duplicateWindow)
+            return true;
+    }
+
+    seen[ seenNext].hash = hash;
+    seen[ seenNext].time = now ? now : 1;
+    seenNext = ( seenNext + 1) % MICROBIT_BLE_SCANNER_DUPLICATES;
+
+    return false;
+}
+
+/**
+  * Filters and queues an advertisement report, then resumes scanning.
+  * Called in SoftDevice event context.
+  *
+  * @param report the report from the SoftDevice.
+  */
+void MicroBitBLEScanner::onAdvReport( const ble_gap_evt_adv_report_t *report)
+{
+    uint32_t now = (uint32_t) system_timer_current_time();
+
+    if ( report->rssi >= rssiThreshold
+        && report->data.len <= BLE_GAP_ADV_SET_DATA_SIZE_MAX
+        && matches( report->data.p_data, report->data.len)
+        && !duplicate( report, now))
+    {
+        uint8_t next = ( head + 1) % ( MICROBIT_BLE_SCANNER_QUEUE_SIZE + 1);
+
+        if ( next == tail)
+        {
+            dropped++;
+        }
+        else
+        {
+            MicroBitBLEScanReport *r = &queue[ head];
+
+            r->time        = now;
+            memcpy( r->address, report->peer_addr.addr, BLE_GAP_ADDR_LEN);
+            r->addressType = report->peer_addr.addr_type;
+            r->rssi        = report->rssi;
+            r->length      = report->data.len;
+            memcpy( r->data, report->data.p_data, report->data.len);
+
+            // The report must be complete before read() can see it.
+            __DMB();
+            head = next;
+
+            if ( available() >= batchCount)
+                notify();
+        }
+    }
+
+    // The SoftDevice pauses scanning after each report, until it is given the buffer back.
+    if ( scanning)
+    {
+        scanData.p_data = buffer;
+        scanData.len    = sizeof( buffer);
+        sd_ble_gap_scan_start( NULL, &scanData);
+    }
+}
+
+static void microbit_ble_scanner_on_ble_evt( ble_evt_t const * p_ble_evt, void * p_context)
+{
+    if ( p_ble_evt->header.evt_id == BLE_GAP_EVT_ADV_REPORT && MicroBitBLEScanner::scanner)
+        MicroBitBLEScanner::scanner->onAdvReport( &p_ble_evt->evt.gap_evt.params.adv_report);
+}
+
+NRF_SDH_BLE_OBSERVER( microbit_ble_scanner_obs, MICROBIT_BLE_SCANNER_OBSERVER_PRIO, microbit_ble_scanner_on_ble_evt, NULL);
+
+#endif
@@ -44,6 +44,9 @@ DEALINGS IN THE SOFTWARE.
 const uint8_t MicroBitBLEService::bs_base_uuid[ 16] =
 { 0xe9,0x5d,0x00,0x00,0x25,0x1d,0x47,0x0a,0xa0,0x62,0xfa,0x19,0x22,0xdf,0xa9,0xa8 };
 
+uint16_t MicroBitBLEService::bs_att_mtu = BLE_GATT_ATT_MTU_DEFAULT;
+uint16_t MicroBitBLEService::bs_conn_interval = 0;
+
 /**
   * Constructor.
   * Create a representation of a BLEService
@@ -51,7 +54,11 @@ const uint8_t MicroBitBLEService::bs_base_uuid[ 16] =
   */
 MicroBitBLEService::MicroBitBLEService() :
     bs_uuid_type(0),
-    bs_service_handle(0)
+    bs_service_handle(0),
+    bs_deferred(false),
+    bs_active(false),
+    bs_last_handle(0),
+    bs_value_bytes(0)
 {
     MicroBitBLEServices::getShared()->AddService( this);
 }
@@ -87,6 +94,13 @@ void MicroBitBLEService::CreateService( uint16_t uuid)
     MICROBIT_DEBUG_DMESG( "MicroBitBLEService::CreateService( %x) = %d", (unsigned int) uuid, (int) bs_service_handle);
 }
 
+
+void MicroBitBLEService::DeferEvents()
+{
+    bs_deferred = true;
+    MicroBitBLEServices::getShared()->StartDeferred();
+}
+
                       
 void MicroBitBLEService::CreateCharacteristic(
     int             idx,
@@ -131,6 +145,12 @@ void MicroBitBLEService::CreateCharacteristic(
     //ble_gatts_char_pf_t         *p_presentation_format;
     
     MICROBIT_BLE_ECHK( characteristic_add( bs_service_handle, &params, ( ble_gatts_char_handles_t *) charHandles( idx)));
+
+    MicroBitBLEServices::getShared()->AddCharacteristic( this, idx);
+
+    microbit_charhandles_t *h = charHandles( idx);
+    bs_last_handle  = max( (int) bs_last_handle, max( max( (int) h->value, (int) h->desc), max( (int) h->cccd, (int) h->sccd)));
+    bs_value_bytes += max_len;
     
     MICROBIT_DEBUG_DMESG( "MicroBitBLEService::CreateCharacteristic( %x) = %d %d %d %d",
           (unsigned int) uuid,
@@ -156,9 +176,9 @@ bool MicroBitBLEService::getConnected()
                                             
 int MicroBitBLEService::charHandleToIdx( uint16_t handle, microbit_charattr_t *type)
 {
-    int charCount = characteristicCount();
-    
-    for ( int idx = 0; idx < charCount; idx++)
+    int idx;
+
+    if ( MicroBitBLEServices::getShared()->FindHandle( handle, &idx) == this)
     {
         microbit_charhandles_t *p = charHandles( idx);
         
@@ -182,6 +202,9 @@ bool MicroBitBLEService::onBleEvent( microbit_ble_evt_t const * p_ble_evt)
       case BLE_GAP_EVT_CONNECTED:
           //TODO: store handle and connected flag?
           onConnect( p_ble_evt);
+#if !CONFIG_ENABLED(MICROBIT_BLE_LAZY_SERVICES)
+          activate();
+#endif
           break;
 
       case BLE_GAP_EVT_DISCONNECTED:
@@ -190,6 +213,12 @@ bool MicroBitBLEService::onBleEvent( microbit_ble_evt_t const * p_ble_evt)
 
           for ( int idx = 0; idx < characteristicCount(); idx++)
               characteristicPtr( idx)->setCCCD(0);
+
+          if ( bs_active)
+          {
+              bs_active = false;
+              onDeactivate();
+          }
           break;
 
       case BLE_GATTS_EVT_RW_AUTHORIZE_REQUEST:
@@ -200,6 +229,10 @@ bool MicroBitBLEService::onBleEvent( microbit_ble_evt_t const * p_ble_evt)
           onHVC( p_ble_evt);
           break;
 
+      case BLE_GATTS_EVT_HVN_TX_COMPLETE:
+          onHVNTxComplete( p_ble_evt);
+          break;
+
       case BLE_GATTS_EVT_WRITE:
           onWrite( p_ble_evt);
           break;
@@ -224,6 +257,35 @@ void MicroBitBLEService::onDisconnect( const microbit_ble_evt_t *p_ble_evt)
     MICROBIT_DEBUG_DMESG( "MicroBitBLEService::onDisconnect");
 }
 
+
+void MicroBitBLEService::onActivate()
+{
+}
+
+
+void MicroBitBLEService::onDeactivate()
+{
+}
+
+
+void MicroBitBLEService::activate()
+{
+    if ( !bs_active)
+    {
+        bs_active = true;
+        onActivate();
+    }
+}
+
+
+void MicroBitBLEService::ActivateIfConnected()
+{
+#if !CONFIG_ENABLED(MICROBIT_BLE_LAZY_SERVICES)
+    if ( getConnected())
+        activate();
+#endif
+}
+
                       
 void MicroBitBLEService::onWrite( const microbit_ble_evt_t *p_ble_evt)
 {
@@ -241,6 +303,7 @@ void MicroBitBLEService::onWrite( const microbit_ble_evt_t *p_ble_evt)
     if ( type == microbit_charattrCCCD && p_evt_write->len == 2)
         characteristicPtr( idx)->setCCCD( uint16_decode( p_evt_write->data));
 
+    activate();
     onDataWritten( p_evt_write);
 }
 
@@ -300,6 +363,8 @@ void MicroBitBLEService::onAuthorizeRead( const microbit_ble_evt_t *p_ble_evt)
         return;
     }
     
+    activate();
+
     microbit_onDataRead_t params;
     params.handle = req->handle;
     params.offset = req->offset;
@@ -354,4 +419,13 @@ void MicroBitBLEService::onConfirmation( const microbit_ble_evt_hvc_t *params)
 {
 }
 
+void MicroBitBLEService::onHVNTxComplete( const microbit_ble_evt_t *p_ble_evt)
+{
+    onNotificationComplete( &p_ble_evt->evt.gatts_evt.params.hvn_tx_complete);
+}
+
+void MicroBitBLEService::onNotificationComplete( const microbit_ble_evt_hvn_tx_complete_t *params)
+{
+}
+
 #endif
@@ -36,7 +36,13 @@ DEALINGS IN THE SOFTWARE.
 #include "MicroBitBLEService.h"
 #include "MicroBitBLEServices.h"
 
+#include "MicroBitFiber.h"
+#include "MicroBitEvent.h"
+#include "CodalDmesg.h"
+#include "MicroBitHeapStats.h"
+
 #include "nrf_sdh_ble.h"
+#include "ble_conn_state.h"
 
 
 /**
@@ -51,7 +57,10 @@ MicroBitBLEServices *MicroBitBLEServices::getShared()
     static MicroBitBLEServices *shared = NULL;
     
     if ( !shared)
+    {
         shared = new MicroBitBLEServices();
+        MICROBIT_HEAP_TRACK(MICROBIT_HEAP_TAG_BLE, shared);
+    }
 
     return shared;
 }
@@ -63,7 +72,11 @@ MicroBitBLEServices *MicroBitBLEServices::getShared()
   * @param _ble An instance of MicroBitBLEManager.
   */
 MicroBitBLEServices::MicroBitBLEServices() :
-    bs_services_count(0)
+    bs_services_count(0),
+    bs_ranges_count(0),
+    bs_deferred_head(0),
+    bs_deferred_tail(0),
+    bs_deferred_fiber(false)
 {
 }
 
@@ -98,12 +111,133 @@ void MicroBitBLEServices::RemoveService( MicroBitBLEService *service)
         
         bs_services_count = count;
     }
+
+    int ranges = 0;
+
+    for ( int i = 0; i < bs_ranges_count; i++)
+    {
+        if ( bs_ranges[ i].service != service)
+            bs_ranges[ ranges++] = bs_ranges[ i];
+    }
+
+    bs_ranges_count = ranges;
+
+    // Anything still queued for the service is dropped by the deferred fiber.
+    for ( int i = 0; i < MICROBIT_BLE_SERVICES_DEFER_QUEUE + 1; i++)
+    {
+        if ( bs_deferred[ i].service == service)
+            bs_deferred[ i].service = NULL;
+    }
+}
+
+
+/**
+  * Adds the attribute handles of a newly created characteristic to the routing table.
+  * @param service the service that owns the characteristic.
+  * @param idx the index of the characteristic in the service.
+  */
+void MicroBitBLEServices::AddCharacteristic( MicroBitBLEService *service, int idx)
+{
+    if ( bs_ranges_count >= MICROBIT_BLE_SERVICES_CHARACTERISTICS_MAX)
+        microbit_panic( DEVICE_OOM);
+
+    microbit_charhandles_t *p = service->charHandles( idx);
+
+    if ( p->value == BLE_GATT_HANDLE_INVALID)
+        return;
+
+    // The characteristic declaration immediately precedes its value, and the descriptors follow it.
+    bs_handle_range_t range;
+    range.start   = p->value - 1;
+    range.end     = max( max( p->value, p->desc), max( p->cccd, p->sccd));
+    range.service = service;
+    range.idx     = idx;
+
+    // Handles are allocated in increasing order, so this is almost always an append.
+    int i = bs_ranges_count;
+    while ( i > 0 && bs_ranges[ i - 1].start > range.start)
+    {
+        bs_ranges[ i] = bs_ranges[ i - 1];
+        i--;
+    }
+
+    bs_ranges[ i] = range;
+    bs_ranges_count++;
+}
+
+
+/**
+  * Finds the characteristic that an attribute handle belongs to.
+  * @param handle the attribute handle.
+  * @param idx set to the index of the characteristic in its service.
+  * @return the service that owns the attribute, or NULL if it isn't one of ours.
+  */
+MicroBitBLEService *MicroBitBLEServices::FindHandle( uint16_t handle, int *idx)
+{
+    int low = 0;
+    int high = bs_ranges_count - 1;
+
+    while ( low <= high)
+    {
+        int mid = ( low + high) / 2;
+
+        if ( handle < bs_ranges[ mid].start)
+            high = mid - 1;
+        else if ( handle > bs_ranges[ mid].end)
+            low = mid + 1;
+        else
+        {
+            *idx = bs_ranges[ mid].idx;
+            return bs_ranges[ mid].service;
+        }
+    }
+
+    return NULL;
 }
 
 
 void MicroBitBLEServices::onBleEvent( ble_evt_t const * p_ble_evt)
 {
     //MICROBIT_DEBUG_DMESG("MicroBitBLEServices::onBleEvent 0x%x", (unsigned int) p_ble_evt->header.evt_id);
+
+    uint16_t handle = BLE_GATT_HANDLE_INVALID;
+
+    switch ( p_ble_evt->header.evt_id)
+    {
+        case BLE_GATTS_EVT_WRITE:
+            handle = p_ble_evt->evt.gatts_evt.params.write.handle;
+            break;
+
+        case BLE_GATTS_EVT_HVC:
+            handle = p_ble_evt->evt.gatts_evt.params.hvc.handle;
+            break;
+
+        case BLE_GATTS_EVT_RW_AUTHORIZE_REQUEST:
+            if ( p_ble_evt->evt.gatts_evt.params.authorize_request.type == BLE_GATTS_AUTHORIZE_TYPE_READ)
+                handle = p_ble_evt->evt.gatts_evt.params.authorize_request.request.read.handle;
+            else if ( p_ble_evt->evt.gatts_evt.params.authorize_request.type == BLE_GATTS_AUTHORIZE_TYPE_WRITE)
+                handle = p_ble_evt->evt.gatts_evt.params.authorize_request.request.write.handle;
+            break;
+    }
+
+    // Attribute events go straight to the service that owns the attribute.
+    if ( handle != BLE_GATT_HANDLE_INVALID)
+    {
+        int idx;
+        MicroBitBLEService *service = FindHandle( handle, &idx);
+
+        if ( service == NULL)
+            return;
+
+        // Authorize requests need a prompt reply, so only writes and confirmations are deferred.
+        if ( service->getDeferred()
+            && p_ble_evt->header.evt_id != BLE_GATTS_EVT_RW_AUTHORIZE_REQUEST
+            && Defer( service, p_ble_evt))
+            return;
+
+        service->onBleEvent( p_ble_evt);
+        return;
+    }
     
     for ( int i = 0; i < bs_services_count; i++)
     {
@@ -113,6 +247,105 @@ void MicroBitBLEServices::onBleEvent( ble_evt_t const * p_ble_evt)
 }
 
 
+
+/**
+  * Writes the attribute table and characteristic value RAM used by each service to DMESG.
+  */
+void MicroBitBLEServices::Report()
+{
+    int attributes = 0;
+    int bytes = 0;
+
+    for ( int i = 0; i < bs_services_count; i++)
+    {
+        MicroBitBLEService *s = bs_services[ i];
+
+        DMESG( "BLE service %d: %d attributes, %d value bytes, %s", i, s->getAttributeCount(), s->getValueBytes(), s->getActive() ? "active" : "idle");
+        attributes += s->getAttributeCount();
+        bytes += s->getValueBytes();
+    }
+
+    DMESG( "BLE services: %d attributes, %d value bytes", attributes, bytes);
+}
+
+
+/**
+  * Starts the fiber that handles events for services that defer them, if it is not already running.
+  */
+void MicroBitBLEServices::StartDeferred()
+{
+    if ( !bs_deferred_fiber)
+    {
+        bs_deferred_fiber = true;
+        create_fiber( deferredFiber, this);
+    }
+}
+
+
+/**
+  * Queues an event for a service that defers its handling to a fiber.
+  * Called from SoftDevice event context, which is the only producer.
+  * @return true if the event was queued, or false if it must be handled immediately.
+  */
+bool MicroBitBLEServices::Defer( MicroBitBLEService *service, microbit_ble_evt_t const * p_ble_evt)
+{
+    uint8_t head = bs_deferred_head;
+    uint8_t next = ( head + 1) % ( MICROBIT_BLE_SERVICES_DEFER_QUEUE + 1);
+
+    if ( !bs_deferred_fiber || next == bs_deferred_tail || p_ble_evt->header.evt_len > sizeof( bs_deferred[ head].evt))
+        return false;
+
+    bs_deferred[ head].service = service;
+    memcpy( bs_deferred[ head].evt, p_ble_evt, p_ble_evt->header.evt_len);
+
+    // The entry must be complete before the fiber can see it.
+    __DMB();
+    bs_deferred_head = next;
+
+    MicroBitEvent( MICROBIT_ID_BLE_SERVICES, MICROBIT_BLE_SERVICES_EVT_DEFERRED);
+    return true;
+}
+
+
+/**
+  * Handles queued events, then waits for more. The fiber is the only consumer.
+  */
+void MicroBitBLEServices::deferredFiber( void *param)
+{
+    MicroBitBLEServices *services = ( MicroBitBLEServices *) param;
+
+    while ( true)
+    {
+        while ( services->bs_deferred_tail != services->bs_deferred_head)
+        {
+            bs_deferred_t *d = &services->bs_deferred[ services->bs_deferred_tail];
+            microbit_ble_evt_t const * p_ble_evt = ( microbit_ble_evt_t const *) d->evt;
+
+            // Connection events aren't deferred, so drop anything left over from a link that has since closed.
+            if ( d->service && ble_conn_state_status( p_ble_evt->evt.gatts_evt.conn_handle) == BLE_CONN_STATUS_CONNECTED)
+                d->service->onBleEvent( p_ble_evt);
+
+            __DMB();
+            services->bs_deferred_tail = ( services->bs_deferred_tail + 1) % ( MICROBIT_BLE_SERVICES_DEFER_QUEUE + 1);
+        }
+
+        // Register for the event before testing again, so that an event queued in between is not missed.
+        target_disable_irq();
+
+        if ( services->bs_deferred_tail != services->bs_deferred_head)
+        {
+            target_enable_irq();
+            continue;
+        }
+
+        fiber_wake_on_event( MICROBIT_ID_BLE_SERVICES, MICROBIT_BLE_SERVICES_EVT_DEFERRED);
+        target_enable_irq();
+
+        schedule();
+    }
+}
+
+
 static void microbit_ble_services_on_ble_evt( ble_evt_t const * p_ble_evt, void * p_context)
 {
     MicroBitBLEServices::getShared()->onBleEvent( p_ble_evt);
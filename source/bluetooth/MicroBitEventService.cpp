@@ -35,6 +35,10 @@ DEALINGS IN THE SOFTWARE.
 #include "MicroBitEventService.h"
 #include "ExternalEvents.h"
 #include "MicroBitFiber.h"
+#include "CodalDmesg.h"
+
+#include "ble.h"
+#include "MicroBitSchedulerTrace.h"
 
 
 const uint16_t MicroBitEventService::serviceUUID               = 0x93af;
@@ -53,17 +57,28 @@ MicroBitEventService::MicroBitEventService(BLEDevice &_ble, EventModel &_message
     // Initialise our characteristic values.
     clientEventBuffer.type = 0x00;
     clientEventBuffer.reason = 0x00;
-    microBitEventBuffer = microBitRequirementsBuffer = clientRequirementsBuffer = clientEventBuffer;
+    microBitEventBuffer[0] = microBitRequirementsBuffer = clientRequirementsBuffer = clientEventBuffer;
     
     messageBusListenerOffset = 0;
 
+    eventQueueHead = 0;
+    eventQueueTail = 0;
+    sending = false;
+    sendPending = false;
+    overflowCount = 0;
+    overflowing = false;
+
     // Register the base UUID and create the service.
     RegisterBaseUUID( bs_base_uuid);
     CreateService( serviceUUID);
 
+    // Writes raise events and register listeners, so handle them in a fiber.
+    DeferEvents();
+
+    // Each notification carries as many queued events as fit in the negotiated MTU.
     CreateCharacteristic( mbbs_cIdxMEVENT, charUUID[ mbbs_cIdxMEVENT],
-                        (uint8_t *)&microBitEventBuffer,
-                         sizeof(EventServiceEvent), sizeof(EventServiceEvent),
+                        (uint8_t *)microBitEventBuffer,
+                         sizeof(EventServiceEvent), sizeof(microBitEventBuffer),
                          microbit_propREAD | microbit_propNOTIFY);
 
     CreateCharacteristic( mbbs_cIdxCEVENT, charUUID[ mbbs_cIdxCEVENT],
@@ -126,13 +141,110 @@ void MicroBitEventService::onDataWritten( const microbit_ble_evt_write_t *params
   */
 void MicroBitEventService::onMicroBitEvent(MicroBitEvent evt)
 {
-    EventServiceEvent *e = &microBitEventBuffer;
+    if ( !getConnected())
+        return;
 
-    if ( getConnected())
+    if ( !notifyChrValueEnabled( mbbs_cIdxMEVENT))
     {
-        e->type = evt.source;
-        e->reason = evt.value;
-        notifyChrValue( mbbs_cIdxMEVENT, (const uint8_t *)e, sizeof(EventServiceEvent));
+        // The client is reading rather than subscribing, so only the latest event is of interest.
+        eventQueueTail = eventQueueHead;
+        microBitEventBuffer[0].type = evt.source;
+        microBitEventBuffer[0].reason = evt.value;
+        setChrValue( mbbs_cIdxMEVENT, (const uint8_t *)microBitEventBuffer, sizeof(EventServiceEvent));
+        return;
+    }
+
+    uint16_t next = ( eventQueueHead + 1) % ( MICROBIT_BLE_EVENT_SERVICE_QUEUE_SIZE + 1);
+
+    if ( next == eventQueueTail)
+    {
+        overflowCount++;
+
+        // Drops come in bursts, each of which is only worth logging once. getOverflowCount() has the total.
+        if ( !overflowing)
+            MICROBIT_DEBUG_DMESG( "MicroBitEventService: queue full, dropping events");
+
+        overflowing = true;
+    }
+    else
+    {
+        overflowing = false;
+        eventQueue[ eventQueueHead].type = evt.source;
+        eventQueue[ eventQueueHead].reason = evt.value;
+        eventQueueHead = next;
+    }
+
+    sendEvents();
+}
+
+/**
+  * Callback. Invoked when queued notifications have been transmitted, freeing space for more.
+  */
+void MicroBitEventService::onNotificationComplete( const microbit_ble_evt_hvn_tx_complete_t *params)
+{
+    // This event is raised for the notifications of every service, so only act if we have something to do.
+    if ( eventQueueTail != eventQueueHead)
+        sendEvents();
+}
+
+/**
+  * Sends queued events, packing as many as fit into each notification, until the queue is empty
+  * or the SoftDevice has no room for more.
+  */
+void MicroBitEventService::sendEvents()
+{
+    // This may be called from the SoftDevice event interrupt while a fiber is part way through sending.
+    // If so, leave the fiber to make another pass once it has finished.
+    target_disable_irq();
+    bool busy = sending;
+    sending = true;
+    sendPending = busy;
+    target_enable_irq();
+
+    if ( busy)
+        return;
+
+    microbit_gaphandle_t connection = getConnectionHandle();
+    int capacity = min( (int) getMaxPayload(), (int) sizeof(microBitEventBuffer)) / (int) sizeof(EventServiceEvent);
+
+    while (1)
+    {
+        // The SoftDevice copies notification data as it is queued, so events are removed from the queue straight away.
+        while ( eventQueueTail != eventQueueHead)
+        {
+            uint16_t tail = eventQueueTail;
+            uint16_t length = 0;
+
+            while ( length < capacity && tail != eventQueueHead)
+            {
+                microBitEventBuffer[ length++] = eventQueue[ tail];
+                tail = ( tail + 1) % ( MICROBIT_BLE_EVENT_SERVICE_QUEUE_SIZE + 1);
+            }
+
+            length *= sizeof(EventServiceEvent);
+
+            ble_gatts_hvx_params_t hvx_params;
+            hvx_params.handle = valueHandle( mbbs_cIdxMEVENT);
+            hvx_params.type   = BLE_GATT_HVX_NOTIFICATION;
+            hvx_params.offset = 0;
+            hvx_params.p_len  = &length;
+            hvx_params.p_data = (const uint8_t *)microBitEventBuffer;
+
+            // NRF_ERROR_RESOURCES means the queue is full; we continue on BLE_GATTS_EVT_HVN_TX_COMPLETE.
+            if ( sd_ble_gatts_hvx( connection, &hvx_params) != NRF_SUCCESS)
+                break;
+
+            eventQueueTail = tail;
+        }
+
+        target_disable_irq();
+        bool again = sendPending;
+        sendPending = false;
+        sending = again;
+        target_enable_irq();
+
+        if ( !again)
+            break;
     }
 }
 
@@ -142,9 +254,12 @@ void MicroBitEventService::onMicroBitEvent(MicroBitEvent evt)
   */
 void MicroBitEventService::idleCallback()
 {
+    MICROBIT_TRACE_IDLE(CodalComponent::id);
+
     if ( !getConnected() && messageBusListenerOffset > 0)
     {
         messageBusListenerOffset = 0;
+        eventQueueTail = eventQueueHead;
         messageBus.ignore(MICROBIT_ID_ANY, MICROBIT_EVT_ANY, this, &MicroBitEventService::onMicroBitEvent);
     }
 }
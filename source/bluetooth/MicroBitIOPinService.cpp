@@ -33,6 +33,10 @@ DEALINGS IN THE SOFTWARE.
 
 #include "MicroBitIOPinService.h"
 #include "MicroBitFiber.h"
+#include "EventModel.h"
+#include "Timer.h"
+#include <stdlib.h>
+#include "MicroBitSchedulerTrace.h"
 
 const uint16_t MicroBitIOPinService::serviceUUID               = 0x127b;
 const uint16_t MicroBitIOPinService::charUUID[ mbbs_cIdxCOUNT] = { 0x5899, 0xb9fe, 0xd822, 0x8d00 };
@@ -53,6 +57,15 @@ MicroBitIOPinService::MicroBitIOPinService(BLEDevice &_ble, MicroBitIO &_io) :
     ioPinServiceIOCharacteristicBuffer = 0;
     memset(ioPinServiceIOData, 0, sizeof(ioPinServiceIOData));
     memset(ioPinServicePWMCharacteristicBuffer, 0, sizeof(ioPinServicePWMCharacteristicBuffer));    // Create the AD characteristic, that defines whether each pin is treated as analogue or digital
+    memset(analogData, 0, sizeof(analogData));
+
+    edgeInputs = 0;
+    digitalChanged = 0;
+    analogChanged = 0;
+    analogScan = NULL;
+    analogCount = 0;
+    analogScanSupported = true;
+    analogScanTime = 0;
     
     // Register the base UUID and create the service.
     RegisterBaseUUID( bs_base_uuid);
@@ -81,6 +94,9 @@ MicroBitIOPinService::MicroBitIOPinService(BLEDevice &_ble, MicroBitIO &_io) :
                          0, sizeof(ioPinServiceDataCharacteristicBuffer),
                          microbit_propREAD | microbit_propWRITE | microbit_propNOTIFY | microbit_propREADAUTH);
 
+    if (EventModel::defaultEventBus)
+        EventModel::defaultEventBus->listen(MICROBIT_ID_IO_PIN_SERVICE, MICROBIT_ANALOG_SCAN_EVT_COMPLETE, this, &MicroBitIOPinService::onAnalogScan);
+
     fiber_add_idle_component(this);
 }
 
@@ -126,6 +142,130 @@ int MicroBitIOPinService::isActiveInput(int i)
     return ((ioPinServiceIOCharacteristicBuffer & (1 << i)) != 0);
 }
 
+/**
+  * Enables edge events on the pins configured as digital inputs, and builds the list of pins
+  * configured as analog inputs to scan. Called whenever the IO or AD configuration changes.
+  */
+void MicroBitIOPinService::configureInputs()
+{
+    if (analogScan)
+        analogScan->stop();
+
+    analogCount = 0;
+    analogScanSupported = true;
+    analogScanTime = 0;
+
+    for (int i=0; i < MICROBIT_IO_PIN_SERVICE_PINCOUNT; i++)
+    {
+        uint32_t mask = 1 << i;
+        bool edge = isDigital(i) && isActiveInput(i);
+
+        if (edge && !(edgeInputs & mask))
+        {
+            // Drop the pin into input mode, and have it tell us when it changes rather than polling it.
+            edgePin(i).eventOn(DEVICE_PIN_EVENT_ON_EDGE);
+
+            if (EventModel::defaultEventBus)
+            {
+                EventModel::defaultEventBus->listen(edgePin(i).id, DEVICE_PIN_EVT_RISE, this, &MicroBitIOPinService::onPinEvent, MESSAGE_BUS_LISTENER_IMMEDIATE);
+                EventModel::defaultEventBus->listen(edgePin(i).id, DEVICE_PIN_EVT_FALL, this, &MicroBitIOPinService::onPinEvent, MESSAGE_BUS_LISTENER_IMMEDIATE);
+            }
+
+            edgeInputs |= mask;
+            digitalChanged |= mask;
+        }
+
+        if (!edge && (edgeInputs & mask))
+        {
+            if (EventModel::defaultEventBus)
+            {
+                EventModel::defaultEventBus->ignore(edgePin(i).id, DEVICE_PIN_EVT_RISE, this, &MicroBitIOPinService::onPinEvent);
+                EventModel::defaultEventBus->ignore(edgePin(i).id, DEVICE_PIN_EVT_FALL, this, &MicroBitIOPinService::onPinEvent);
+            }
+
+            edgePin(i).eventOn(DEVICE_PIN_EVENT_NONE);
+            edgeInputs &= ~mask;
+        }
+
+        if (isAnalog(i) && isActiveInput(i) && analogCount < CONFIG_MICROBIT_ANALOG_SCAN_MAX_PINS)
+        {
+            analogPins[analogCount] = &edgePin(i);
+            analogPinIndex[analogCount] = i;
+            analogCount++;
+        }
+    }
+}
+
+/**
+  * Callback. Invoked on a rising or falling edge of a digital input.
+  */
+void MicroBitIOPinService::onPinEvent(MicroBitEvent e)
+{
+    for (int i=0; i < MICROBIT_IO_PIN_SERVICE_PINCOUNT; i++)
+    {
+        if (edgePin(i).id == e.source)
+        {
+            digitalChanged |= 1 << i;
+            return;
+        }
+    }
+}
+
+/**
+  * Starts a scan of the pins configured as analog inputs.
+  */
+void MicroBitIOPinService::startAnalogScan()
+{
+    analogScanTime = system_timer_current_time() + MICROBIT_IO_PIN_SERVICE_ANALOG_PERIOD;
+
+    if (analogScanSupported)
+    {
+        if (analogScan == NULL)
+            analogScan = new MicroBitAnalogScan(*NRF52Pin::adc, MICROBIT_ID_IO_PIN_SERVICE);
+
+        int result = analogScan->start(analogPins, analogCount, analogSamples, 1);
+
+        if (result == DEVICE_OK || result == DEVICE_BUSY)
+            return;
+
+        // A pin without an ADC channel cannot join the scan list, so fall back to sampling each pin in turn.
+        analogScanSupported = false;
+    }
+
+    for (int k = 0; k < analogCount; k++)
+        analogUpdate(analogPinIndex[k], analogPins[k]->getAnalogValue());
+}
+
+/**
+  * Callback. Invoked when a scan of the analog inputs has completed.
+  */
+void MicroBitIOPinService::onAnalogScan(MicroBitEvent)
+{
+    if (analogScan == NULL || !analogScan->isComplete())
+        return;
+
+    analogScan->stop();
+
+    for (int k = 0; k < analogCount; k++)
+        analogUpdate(analogPinIndex[k], analogSamples[k]);
+}
+
+/**
+  * Records a new sample from an analog input, marking the pin as changed if it differs
+  * from the value last sent by at least MICROBIT_IO_PIN_SERVICE_ANALOG_THRESHOLD.
+  *
+  * @param i the enumeration of the pin
+  * @param value the sample, in the range 0..1023
+  */
+void MicroBitIOPinService::analogUpdate(int i, int value)
+{
+    value = max(0, min(value, 1023)) >> 2;
+    analogData[i] = value;
+
+    if (abs(value - (int) ioPinServiceIOData[i]) >= MICROBIT_IO_PIN_SERVICE_ANALOG_THRESHOLD)
+        analogChanged |= 1 << i;
+}
+
 /**
  * Scans through all pins that our BLE client have registered an interest in. 
  * For each pin that has changed value, update the BLE characteristic, and NOTIFY our client.
@@ -134,16 +274,29 @@ int MicroBitIOPinService::updateBLEInputs(bool updateAll)
 {
     int pairs = 0;
 
+    // Take the set of changed pins atomically, as edges are recorded from interrupt context.
+    target_disable_irq();
+    uint32_t changed = digitalChanged | analogChanged;
+    digitalChanged = 0;
+    target_enable_irq();
+    analogChanged = 0;
+
     for (int i=0; i < MICROBIT_IO_PIN_SERVICE_PINCOUNT; i++)
     {
-        if (isActiveInput(i))
+        uint32_t mask = 1 << i;
+
+        if (isActiveInput(i) && (updateAll || (changed & mask)))
         {
             uint8_t value;
 
+            changed &= ~mask;
+
             if (isDigital(i))
                	value = edgePin(i).getDigitalValue();
-            else
+            else if (updateAll)
                	value = edgePin(i).getAnalogValue() >> 2;
+            else
+                value = analogData[i];
 
             // If the data has changed, send an update.
             if (updateAll || value != ioPinServiceIOData[i])
@@ -160,7 +313,25 @@ int MicroBitIOPinService::updateBLEInputs(bool updateAll)
             }
         }
     }
-    
+
+    // Any changes that did not fit are sent next time.
+    for (int i=0; i < MICROBIT_IO_PIN_SERVICE_PINCOUNT; i++)
+    {
+        if ((changed & (1 << i)) && isActiveInput(i))
+        {
+            if (isDigital(i))
+            {
+                target_disable_irq();
+                digitalChanged |= 1 << i;
+                target_enable_irq();
+            }
+            else
+            {
+                analogChanged |= 1 << i;
+            }
+        }
+    }
+
     return pairs;
 }
 
@@ -179,14 +350,7 @@ void MicroBitIOPinService::onDataWritten( const microbit_ble_evt_write_t *params
         setChrValue( mbbs_cIdxIO, (const uint8_t *)&ioPinServiceIOCharacteristicBuffer, sizeof(ioPinServiceIOCharacteristicBuffer));
 
         // Also, drop any selected pins into input mode, so we can pick up changes later
-        for (int i=0; i < MICROBIT_IO_PIN_SERVICE_PINCOUNT; i++)
-        {
-            if(isDigital(i) && isActiveInput(i))
-                edgePin(i).getDigitalValue();
-
-            if(isAnalog(i) && isActiveInput(i))
-                edgePin(i).getAnalogValue();
-        }
+        configureInputs();
     }
 
     // Check for writes to the IO configuration characteristic
@@ -199,14 +363,7 @@ void MicroBitIOPinService::onDataWritten( const microbit_ble_evt_write_t *params
         setChrValue( mbbs_cIdxADC, (const uint8_t *)&ioPinServiceADCharacteristicBuffer, sizeof(ioPinServiceADCharacteristicBuffer));
 
         // Also, drop any selected pins into input mode, so we can pick up changes later
-        for (int i=0; i < MICROBIT_IO_PIN_SERVICE_PINCOUNT; i++)
-        {
-            if(isDigital(i) && isActiveInput(i))
-               edgePin(i).getDigitalValue();
-
-            if(isAnalog(i) && isActiveInput(i))
-               edgePin(i).getAnalogValue();
-        }
+        configureInputs();
     }
 
     // Check for writes to the PWM Control characteristic
@@ -287,8 +444,17 @@ void MicroBitIOPinService::onDataRead( microbit_onDataRead_t *params)
  */
 void MicroBitIOPinService::idleCallback()
 {
+    MICROBIT_TRACE_IDLE(CodalComponent::id);
+
     if ( getConnected())
     {
+        // Digital inputs are marked as changed by their edge events, and analog inputs by a periodic scan.
+        if ( analogCount && system_timer_current_time() >= analogScanTime)
+            startAnalogScan();
+
+        if ( !digitalChanged && !analogChanged)
+            return;
+
         int pairs = updateBLEInputs( false);
         // If there's any data, issue a BLE notification.
         if ( pairs)
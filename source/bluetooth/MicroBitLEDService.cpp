@@ -35,7 +35,7 @@ DEALINGS IN THE SOFTWARE.
 
 
 const uint16_t MicroBitLEDService::serviceUUID               = 0xd91d;
-const uint16_t MicroBitLEDService::charUUID[ mbbs_cIdxCOUNT] = { 0x7b77, 0x93ee, 0x0d2d };
+const uint16_t MicroBitLEDService::charUUID[ mbbs_cIdxCOUNT] = { 0x7b77, 0x93ee, 0x0d2d, 0x1b4f };
 
 /**
   * Constructor.
@@ -50,10 +50,18 @@ MicroBitLEDService::MicroBitLEDService( BLEDevice &_ble, MicroBitDisplay &_displ
     memclr( matrixValue, sizeof( matrixValue));
     textValue[0]    = 0;
     speedValue      = MICROBIT_DEFAULT_SCROLL_SPEED;
+    memclr( frame, sizeof( frame));
+    frameStreaming  = false;
+    framePending    = false;
+    frameScheduled  = false;
+    frameTime       = 0;
     
     // Register the base UUID and create the service.
     RegisterBaseUUID( bs_base_uuid);
     CreateService( serviceUUID);
+
+    // Writes drive the display and allocate strings, so handle them in a fiber.
+    DeferEvents();
     
     // Add each of our characteristics.
     CreateCharacteristic( mbbs_cIdxMATRIX, charUUID[ mbbs_cIdxMATRIX],
@@ -70,6 +78,15 @@ MicroBitLEDService::MicroBitLEDService( BLEDevice &_ble, MicroBitDisplay &_displ
                          (uint8_t *)&speedValue,
                          sizeof(speedValue), sizeof(speedValue),
                          microbit_propWRITE | microbit_propREAD);
+
+    // Frames are streamed without responses, so several can arrive in each connection event.
+    CreateCharacteristic( mbbs_cIdxFRAME,  charUUID[ mbbs_cIdxFRAME],
+                         frameValue,
+                         0, sizeof(frameValue),
+                         microbit_propWRITE_WITHOUT);
+
+    if (EventModel::defaultEventBus)
+        EventModel::defaultEventBus->listen(MICROBIT_ID_BLE_LED_SERVICE, MICROBIT_BLE_LED_EVT_PRESENT, this, &MicroBitLEDService::onPresent);
 }
 
 
@@ -80,9 +97,42 @@ void MicroBitLEDService::onDataWritten( const microbit_ble_evt_write_t *params)
 {
     uint8_t *data = (uint8_t *)params->data;
 
-    if (params->handle == valueHandle( mbbs_cIdxMATRIX) && params->len > 0 && params->len < 6)
+    if (params->handle == valueHandle( mbbs_cIdxFRAME) && params->len > 0)
+    {
+        if (!frameStreaming)
+        {
+            // Start the stream from the image on display, shown with per pixel brightness.
+            display.stopAnimation();
+            display.setDisplayMode(DISPLAY_MODE_GREYSCALE);
+
+            for (int i=0; i<25; i++)
+                frame[i] = display.image.getPixelValue(i % 5, i / 5);
+
+            frameStreaming = true;
+        }
+
+        uint8_t type = data[0] & ~MICROBIT_BLE_LED_FRAME_HOLD;
+
+        if (type == MICROBIT_BLE_LED_FRAME_RUN && params->len >= 2)
+        {
+            for (int i=2, p=data[1]; i<params->len && p<25; i++, p++)
+                frame[p] = data[i];
+        }
+        else if (type == MICROBIT_BLE_LED_FRAME_PAIRS)
+        {
+            for (int i=1; i+1<params->len; i+=2)
+                if (data[i] < 25)
+                    frame[data[i]] = data[i+1];
+        }
+
+        if (!(data[0] & MICROBIT_BLE_LED_FRAME_HOLD))
+            presentFrame();
+    }
+
+    else if (params->handle == valueHandle( mbbs_cIdxMATRIX) && params->len > 0 && params->len < 6)
     {
        // interrupt any animation that might be currently going on
+       frameStreaming = false;
        display.stopAnimation();
        for (int y=0; y<params->len; y++)
             for (int x=0; x<5; x++)
@@ -96,6 +146,7 @@ void MicroBitLEDService::onDataWritten( const microbit_ble_evt_write_t *params)
         ManagedString s((char *)params->data, params->len);
 
         // interrupt any animation that might be currently going on
+        frameStreaming = false;
         display.stopAnimation();
 
         // Start the string scrolling and we're done.
@@ -111,6 +162,47 @@ void MicroBitLEDService::onDataWritten( const microbit_ble_evt_write_t *params)
 }
 
 
+/**
+  * Shows the frame built from the stream, unless one was shown less than a connection interval ago.
+  * In that case it is shown once the interval has passed, by which time it may have been replaced.
+  */
+void MicroBitLEDService::presentFrame()
+{
+    CODAL_TIMESTAMP now = system_timer_current_time();
+    CODAL_TIMESTAMP interval = max(1, (int) getConnectionInterval());
+
+    framePending = true;
+
+    if (now - frameTime < interval)
+    {
+        if (!frameScheduled)
+        {
+            frameScheduled = true;
+            system_timer_event_after(interval - (now - frameTime), MICROBIT_ID_BLE_LED_SERVICE, MICROBIT_BLE_LED_EVT_PRESENT);
+        }
+        return;
+    }
+
+    for (int i=0; i<25; i++)
+        display.image.setPixelValue(i % 5, i / 5, frame[i]);
+
+    framePending = false;
+    frameTime = now;
+}
+
+
+/**
+  * Shows a frame held back by presentFrame().
+  */
+void MicroBitLEDService::onPresent( MicroBitEvent)
+{
+    frameScheduled = false;
+
+    if (framePending && frameStreaming)
+        presentFrame();
+}
+
+
 /**
   * Callback. Invoked when any of our attributes are read via BLE.
   * Set  params->data and params->length to update the value
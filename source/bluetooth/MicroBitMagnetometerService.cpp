@@ -36,7 +36,7 @@ DEALINGS IN THE SOFTWARE.
 
 
 const uint16_t MicroBitMagnetometerService::serviceUUID               = 0xf2d8;
-const uint16_t MicroBitMagnetometerService::charUUID[ mbbs_cIdxCOUNT] = { 0xfb11, 0x9715, 0x386c, 0xB358 };
+const uint16_t MicroBitMagnetometerService::charUUID[ mbbs_cIdxCOUNT] = { 0xfb11, 0x9715, 0x386c, 0xB358, 0xfb12 };
 
 
 /**
@@ -64,12 +64,12 @@ MicroBitMagnetometerService::MicroBitMagnetometerService(BLEDevice &_ble, codal:
     CreateCharacteristic( mbbs_cIdxDATA, charUUID[ mbbs_cIdxDATA],
                          (uint8_t *)magnetometerDataCharacteristicBuffer,
                          sizeof(magnetometerDataCharacteristicBuffer), sizeof(magnetometerDataCharacteristicBuffer),
-                         microbit_propREAD | microbit_propNOTIFY);
+                         microbit_propREAD_LIVE | microbit_propNOTIFY);
 
     CreateCharacteristic( mbbs_cIdxBEARING, charUUID[ mbbs_cIdxBEARING],
                          (uint8_t *)&magnetometerBearingCharacteristicBuffer,
                          sizeof(magnetometerBearingCharacteristicBuffer), sizeof(magnetometerBearingCharacteristicBuffer),
-                         microbit_propREAD | microbit_propNOTIFY);
+                         microbit_propREAD_LIVE | microbit_propNOTIFY);
 
     CreateCharacteristic( mbbs_cIdxPERIOD, charUUID[ mbbs_cIdxPERIOD],
                          (uint8_t *)&magnetometerPeriodCharacteristicBuffer,
@@ -81,25 +81,35 @@ MicroBitMagnetometerService::MicroBitMagnetometerService(BLEDevice &_ble, codal:
                          sizeof(magnetometerCalibrationCharacteristicBuffer), sizeof(magnetometerCalibrationCharacteristicBuffer),
                          microbit_propWRITE | microbit_propNOTIFY);
 
-    if ( getConnected())
-        listen( true);
+    // Each notification carries as many samples as the negotiated MTU allows, so its length varies.
+    CreateCharacteristic( mbbs_cIdxBATCH, charUUID[ mbbs_cIdxBATCH],
+                         (uint8_t *)batch.data(),
+                         0, MICROBIT_BLE_MAX_PAYLOAD,
+                         microbit_propREAD | microbit_propNOTIFY);
+
+    ActivateIfConnected();
 }
 
 
 /**
- * Fetch magnetometer values to characteristic buffers
+ * Fetch magnetometer values to characteristic buffers, and add them to the batch characteristic if it is in use.
+ * @return true if the batch characteristic should be sent.
  */
-void MicroBitMagnetometerService::read()
+bool MicroBitMagnetometerService::read()
 {
-    magnetometerDataCharacteristicBuffer[0] = compass.getX();
-    magnetometerDataCharacteristicBuffer[1] = compass.getY();
-    magnetometerDataCharacteristicBuffer[2] = compass.getZ();
+    Sample3D sample = compass.getSample();
+
+    magnetometerDataCharacteristicBuffer[0] = sample.x;
+    magnetometerDataCharacteristicBuffer[1] = sample.y;
+    magnetometerDataCharacteristicBuffer[2] = sample.z;
     magnetometerPeriodCharacteristicBuffer  = compass.getPeriod();
 
     if ( compass.isCalibrated())
     {
         magnetometerBearingCharacteristicBuffer = (uint16_t) compass.heading();
     }
+
+    return notifyChrValueEnabled( mbbs_cIdxBATCH) && batch.add( sample.x, sample.y, sample.z);
 }
 
 
@@ -113,6 +123,7 @@ void MicroBitMagnetometerService::listen( bool yes)
         if ( yes)
         {
             // Ensure compass is being updated
+            batch.reset();
             read();
             EventModel::defaultEventBus->listen(MICROBIT_ID_COMPASS, MICROBIT_COMPASS_EVT_DATA_UPDATE,        this, &MicroBitMagnetometerService::compassEvents, MESSAGE_BUS_LISTENER_IMMEDIATE);
             EventModel::defaultEventBus->listen(MICROBIT_ID_COMPASS, MICROBIT_COMPASS_EVT_CONFIG_NEEDED,      this, &MicroBitMagnetometerService::compassEvents);
@@ -127,21 +138,19 @@ void MicroBitMagnetometerService::listen( bool yes)
 
 
 /**
-  * Invoked when BLE connects.
+  * Invoked when a client first uses the service on a connection.
   */
-void MicroBitMagnetometerService::onConnect( const microbit_ble_evt_t *p_ble_evt)
+void MicroBitMagnetometerService::onActivate()
 {
-    //MICROBIT_DEBUG_DMESG( "MicroBitMagnetometerService::onConnect");
     listen( true);
 }
 
 
 /**
-  * Invoked when BLE disconnects.
+  * Invoked when the connection the service was activated on closes.
   */
-void MicroBitMagnetometerService::onDisconnect( const microbit_ble_evt_t *p_ble_evt)
+void MicroBitMagnetometerService::onDeactivate()
 {
-    //MICROBIT_DEBUG_DMESG( "MicroBitMagnetometerService::onDisconnect");
     listen( false);
 }
 
@@ -175,6 +184,25 @@ void MicroBitMagnetometerService::compassEvents(MicroBitEvent e)
 }    
 
 
+/**
+  * Callback. Invoked when a live value is read, with MICROBIT_BLE_LAZY_SERVICES enabled.
+  * The first read activates the service before we get here, so the value is current.
+  */
+void MicroBitMagnetometerService::onDataRead( microbit_onDataRead_t *params)
+{
+    if ( params->handle == valueHandle( mbbs_cIdxDATA))
+    {
+        params->data    = (const uint8_t *) magnetometerDataCharacteristicBuffer;
+        params->length  = sizeof( magnetometerDataCharacteristicBuffer);
+    }
+    else if ( params->handle == valueHandle( mbbs_cIdxBEARING))
+    {
+        params->data    = (const uint8_t *) &magnetometerBearingCharacteristicBuffer;
+        params->length  = sizeof( magnetometerBearingCharacteristicBuffer);
+    }
+}
+
+
 /**
   * Callback. Invoked when any of our attributes are written via BLE.
   */
@@ -206,7 +234,7 @@ void MicroBitMagnetometerService::magnetometerUpdate()
     if ( getConnected())
     {
         //MICROBIT_DEBUG_DMESG( "MicroBitMagnetometerService::magnetometerUpdate");
-        read();
+        bool send = read();
 
         setChrValue( mbbs_cIdxPERIOD, (const uint8_t *)&magnetometerPeriodCharacteristicBuffer, sizeof(magnetometerPeriodCharacteristicBuffer));
         notifyChrValue( mbbs_cIdxDATA,(uint8_t *)magnetometerDataCharacteristicBuffer, sizeof(magnetometerDataCharacteristicBuffer));
@@ -215,6 +243,10 @@ void MicroBitMagnetometerService::magnetometerUpdate()
         {
             notifyChrValue( mbbs_cIdxBEARING,(uint8_t *)&magnetometerBearingCharacteristicBuffer, sizeof(magnetometerBearingCharacteristicBuffer));
         }
+
+        // If the SoftDevice has no room for the batch yet, keep collecting and try again on the next sample.
+        if ( send && notifyChrValue( mbbs_cIdxBATCH, batch.data(), batch.length()))
+            batch.reset();
     }
 }
 
@@ -68,7 +68,7 @@ MicroBitPartialFlashingService::MicroBitPartialFlashingService( BLEDevice &_ble,
 
     CreateCharacteristic( mbbs_cIdxCTRL, charUUID[ mbbs_cIdxCTRL],
                          characteristicValue,
-                         sizeof(characteristicValue), sizeof(characteristicValue),
+                         20, sizeof(characteristicValue),
                          microbit_propWRITE_WITHOUT | microbit_propNOTIFY);
 
     // Set up listener for SD writing
@@ -135,7 +135,8 @@ void MicroBitPartialFlashingService::onDataWritten(const microbit_ble_evt_write_
           packetCount = 0;
           blockPacketCount = 0;
           blockNum = 0;
-          offset = 0;
+          blockHead = blockTail = 0;
+          blockCount = 0;
 
           break;
         }
@@ -145,6 +146,44 @@ void MicroBitPartialFlashingService::onDataWritten(const microbit_ble_evt_write_
           flashData(data);
           break;
         }
+        case PAGE_HASH:
+        {
+          /*
+           * Return the CRC32 of consecutive pages from the given address, so that clients need only send pages that
+           * have changed. The COUNT byte is optional, and defaults to one. Up to three hashes fit in a packet at the
+           * default ATT MTU, more if a larger MTU has been negotiated. Hashes are returned for the pages up to the end
+           * of the application region.
+           * +-----------+----------+--------+          +-----------+----------+----------------+
+           * | 1 Byte    | 4 Bytes  | 1 Byte |          | 1 Byte    | 4 Bytes  | 4 Bytes each   |
+           * +-----------+----------+--------+   -->    +-----------+----------+----------------+
+           * | PAGE_HASH | ADDRESS  | COUNT  |          | PAGE_HASH | ADDRESS  | CRC32 ...      |
+           * +-----------+----------+--------+          +-----------+----------+----------------+
+           */
+          uint32_t address = params->len >= 5 ? (data[1] << 24) | (data[2] << 16) | (data[3] << 8) | data[4] : 1;
+          int count = params->len >= 6 ? min(max(data[5], 1), (min((int) getMaxPayload(), MICROBIT_BLE_MAX_PAYLOAD) - 5) / 4) : 1;
+          uint32_t crc;
+          uint8_t buffer[ MICROBIT_BLE_MAX_PAYLOAD];
+          int length = 5;
+
+          for (int i = 0; i < count && MicroBitMemoryMap::getPageHash(address + i * MICROBIT_CODEPAGESIZE, crc) == MICROBIT_OK; i++)
+          {
+            buffer[length++] = (crc & 0xFF000000) >> 24;
+            buffer[length++] = (crc & 0x00FF0000) >> 16;
+            buffer[length++] = (crc & 0x0000FF00) >>  8;
+            buffer[length++] = (crc & 0x000000FF);
+          }
+
+          if (length == 5)
+          {
+            uint8_t flashNotificationBuffer[] = {PAGE_HASH, 0xAA};
+            notifyChrValue( mbbs_cIdxCTRL, (const uint8_t *)flashNotificationBuffer, sizeof(flashNotificationBuffer));
+            break;
+          }
+
+          memcpy(buffer, data, 5);
+          notifyChrValue( mbbs_cIdxCTRL, (const uint8_t *)buffer, length);
+          break;
+        }
         case END_OF_TRANSMISSION:
         {
           /* Start of embedded source isn't always on a page border so client must
@@ -160,7 +199,10 @@ void MicroBitPartialFlashingService::onDataWritten(const microbit_ble_evt_write_
           /*
            * Return the version of the Partial Flashing Service and the current BLE mode (application / pairing)
            */
-          uint8_t flashNotificationBuffer[] = {MICROBIT_STATUS, PARTIAL_FLASHING_VERSION, MicroBitBLEManager::manager->getCurrentMode()};
+          /*
+           * The fourth byte is the number of blocks the client may have in flight. Its presence also indicates support for PAGE_HASH.
+           */
+          uint8_t flashNotificationBuffer[] = {MICROBIT_STATUS, PARTIAL_FLASHING_VERSION, MicroBitBLEManager::manager->getCurrentMode(), MICROBIT_PARTIAL_FLASHING_WINDOW};
           MICROBIT_DEBUG_DMESGF( "MICROBIT_STATUS version %d mode %d", (int)flashNotificationBuffer[1], (int)flashNotificationBuffer[2]);
           notifyChrValue( mbbs_cIdxCTRL, (const uint8_t *)flashNotificationBuffer, sizeof(flashNotificationBuffer));
           break;
@@ -198,6 +240,9 @@ void MicroBitPartialFlashingService::onDataWritten(const microbit_ble_evt_write_
   */
 void MicroBitPartialFlashingService::flashData(uint8_t *data)
 {
+        // Keep the connection in its fastest mode while a transfer is in progress.
+        MicroBitBLEManager::manager->bulkTransfer();
+
         MICROBIT_DEBUG_DMESGF( "flashData");
         MICROBIT_DEBUG_DMESGF( "  %x %x %x %x", (int) data[0], (int) data[1], (int) data[2], (int) data[3]);
         MICROBIT_DEBUG_DMESGF( "  %x %x %x %x", (int) data[4], (int) data[5], (int) data[6], (int) data[7]);
@@ -209,6 +254,8 @@ void MicroBitPartialFlashingService::flashData(uint8_t *data)
         // Buffer 4 packets
         // When buffer is full trigger partialFlashingEvent
         // When write is complete notify app and repeat
+        // Clients may send up to MICROBIT_PARTIAL_FLASHING_WINDOW blocks before waiting for their notifications.
+        // On a packet error, clients resend from the block in error, numbered from the next block's packet number.
         // +-----------+---------+---------+----------+
         // | 1 Byte    | 2 Bytes | 1 Byte  | 16 Bytes |
         // +-----------+---------+---------+----------+
@@ -225,7 +272,7 @@ void MicroBitPartialFlashingService::flashData(uint8_t *data)
           */
         if (packetNum != packetCount)
         {
-          if ( packetNum < packetCount ? packetCount - packetNum < 8 : packetNum - packetCount > 248 )
+          if ( packetNum < packetCount ? packetCount - packetNum < 4 * (MICROBIT_PARTIAL_FLASHING_WINDOW + 1) : packetNum - packetCount > 256 - 4 * (MICROBIT_PARTIAL_FLASHING_WINDOW + 1) )
             return; // packet is from a previous batch
 
           MICROBIT_DEBUG_DMESGF( "packet error");
@@ -238,10 +285,17 @@ void MicroBitPartialFlashingService::flashData(uint8_t *data)
           return;
         }
 
+        // A client must not have more blocks in flight than the window allows.
+        if (blockNum == 0 && blockCount == MICROBIT_PARTIAL_FLASHING_WINDOW)
+          return;
+
         packetCount++;
 
-        // Add to block
-        memcpy(block + (4*blockNum), data + 4, 16);
+        // Add to block. Unused space in the final block remains erased.
+        if (blockNum == 0)
+          memset(block[blockHead].data, 0xFF, sizeof(block[blockHead].data));
+
+        memcpy(block[blockHead].data + (4*blockNum), data + 4, 16);
 
         MICROBIT_DEBUG_DMESG( "blockNum %d", (int) blockNum);
     
@@ -250,14 +304,14 @@ void MicroBitPartialFlashingService::flashData(uint8_t *data)
             // blockNum is 0: set up offset
             case 0:
                 {
-                    offset = ((data[1] << 8) | data[2] << 0);
+                    block[blockHead].offset = ((data[1] << 8) | data[2] << 0);
                     blockNum++;
                     break;
                 }
             // blockNum is 1: complete the offset
             case 1:
                 {
-                    offset |= ((data[1] << 24) | data[2] << 16);
+                    block[blockHead].offset |= ((data[1] << 24) | data[2] << 16);
                     blockNum++;
                     break;
                 }
@@ -265,7 +319,9 @@ void MicroBitPartialFlashingService::flashData(uint8_t *data)
             case 3:
                 {
                     MICROBIT_DEBUG_DMESG( "Fire write event");
-                    // Fire write event
+                    // Queue the block, and fire write event
+                    blockHead = (blockHead + 1) % MICROBIT_PARTIAL_FLASHING_WINDOW;
+                    blockCount++;
                     MicroBitEvent evt(MICROBIT_ID_PARTIAL_FLASHING, FLASH_DATA );
                     // Reset blockNum
                     blockNum = 0;
@@ -352,7 +408,12 @@ void MicroBitPartialFlashingService::partialFlashingEvent(MicroBitEvent e)
   switch(e.value){
     case FLASH_DATA:
     {
-      MICROBIT_DEBUG_DMESG( "FLASH_DATA offset %x", (unsigned int) offset);
+      if (blockCount == 0)
+        break;
+
+      FlashBlock *b = &block[blockTail];
+
+      MICROBIT_DEBUG_DMESG( "FLASH_DATA offset %x", (unsigned int) b->offset);
       /*
        * Set flashIncomplete flag if not already set to boot into BLE mode
        * upon a failed flash.
@@ -372,6 +433,7 @@ void MicroBitPartialFlashingService::partialFlashingEvent(MicroBitEvent e)
                     if(*(page + i) != 0xFFFFFFFF) {
                         DMESG( "Erase page at %x", page);
                         flash.erase_page(page);
+                        MicroBitMemoryMap::invalidatePage((uint32_t) page);
                         break; // If page has been erased we can skip the remaining bytes
                     }
                 }
@@ -381,7 +443,7 @@ void MicroBitPartialFlashingService::partialFlashingEvent(MicroBitEvent e)
        }
        delete flashIncomplete;
 
-      uint32_t *flashPointer   = (uint32_t *)(offset);
+      uint32_t *flashPointer   = (uint32_t *)(b->offset);
 
       // If the pointer is on a page boundary check if it needs erasing
       if(!((uint32_t)flashPointer % MICROBIT_CODEPAGESIZE)) {
@@ -389,18 +451,23 @@ void MicroBitPartialFlashingService::partialFlashingEvent(MicroBitEvent e)
           for(uint32_t i = 0; i < (MICROBIT_CODEPAGESIZE / sizeof(uint32_t)); i++) {
             if(*(flashPointer + i) != 0xFFFFFFFF) {
                 flash.erase_page(flashPointer);
+                MicroBitMemoryMap::invalidatePage((uint32_t) flashPointer);
                 break; // If page has been erased we can skip the remaining bytes
             }
           }
 
       }
 
-      // Create a pointer to the data block
-      uint32_t *blockPointer;
-      blockPointer = block;
-
       // Write to flash
-      flash.flash_burn(flashPointer, blockPointer, 16);
+      flash.flash_burn(flashPointer, b->data, 16);
+      MicroBitMemoryMap::invalidate();
+      MicroBitMemoryMap::invalidatePage((uint32_t) flashPointer);
+
+      // Release the block for reuse. blockCount is also updated by the BLE event handler.
+      blockTail = (blockTail + 1) % MICROBIT_PARTIAL_FLASHING_WINDOW;
+      target_disable_irq();
+      blockCount--;
+      target_enable_irq();
 
       // Update flash control buffer to send next packet
       uint8_t flashNotificationBuffer[] = {FLASH_DATA, 0xFF};
@@ -409,13 +476,13 @@ void MicroBitPartialFlashingService::partialFlashingEvent(MicroBitEvent e)
     }
     case END_OF_TRANSMISSION:
     {
-      MICROBIT_DEBUG_DMESG( "END_OF_TRANSMISSION offset %x", (unsigned int) offset);
-      // Write final packet
-      uint32_t *blockPointer;
-      uint32_t *flashPointer   = (uint32_t *) offset;
-
-      blockPointer = block;
-      flash.flash_burn(flashPointer, blockPointer, 16);
+      MICROBIT_DEBUG_DMESG( "END_OF_TRANSMISSION offset %x", (unsigned int) block[blockHead].offset);
+      // Write final packet, if a block was left incomplete
+      if (blockNum > 0)
+      {
+        flash.flash_burn((uint32_t *) block[blockHead].offset, block[blockHead].data, 16);
+        MicroBitMemoryMap::invalidatePage(block[blockHead].offset);
+      }
 
       // Set no validation
       setDefaultBootloaderSettings();
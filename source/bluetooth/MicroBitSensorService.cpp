@@ -0,0 +1,225 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+/**
+  * Class definition for the MicroBit BLE Sensor Service.
+  * Provides a BLE service that samples several sensors on a common clock, and notifies them as packed records.
+  */
+#include "MicroBitConfig.h"
+
+#if CONFIG_ENABLED(DEVICE_BLE)
+
+#include "MicroBitSensorService.h"
+#include "MicroBitFiber.h"
+#include "Timer.h"
+
+
+const uint16_t MicroBitSensorService::serviceUUID               = 0x5e50;
+const uint16_t MicroBitSensorService::charUUID[ mbbs_cIdxCOUNT] = { 0x5e51, 0x5e52, 0x5e53 };
+
+
+/**
+  * Determines the size of a record holding the given sensors, including its time offset.
+  */
+static uint16_t recordSize( uint8_t sensors)
+{
+    uint16_t size = MICROBIT_BLE_SAMPLE_BATCH_OFFSET;
+
+    if ( sensors & MICROBIT_SENSOR_SERVICE_TEMPERATURE)
+        size += 1;
+    if ( sensors & MICROBIT_SENSOR_SERVICE_BUTTONS)
+        size += 1;
+    if ( sensors & MICROBIT_SENSOR_SERVICE_ACCELEROMETER)
+        size += 6;
+    if ( sensors & MICROBIT_SENSOR_SERVICE_MAGNETOMETER)
+        size += 6;
+
+    return size;
+}
+
+
+/**
+  * Constructor.
+  * Create a representation of the SensorService
+  * @param _ble The instance of a BLE device that we're running on.
+  * @param _accelerometer An instance of Accelerometer.
+  * @param _compass An instance of Compass.
+  * @param _thermometer An instance of MicroBitThermometer.
+  * @param _buttonA The button reported in bit 0 of the button state.
+  * @param _buttonB The button reported in bit 1 of the button state.
+  */
+MicroBitSensorService::MicroBitSensorService( BLEDevice &_ble, codal::Accelerometer &_accelerometer, codal::Compass &_compass,
+                                              MicroBitThermometer &_thermometer, codal::Button &_buttonA, codal::Button &_buttonB) :
+    accelerometer(_accelerometer), compass(_compass), thermometer(_thermometer), buttonA(_buttonA), buttonB(_buttonB),
+    batch( recordSize( MICROBIT_SENSOR_SERVICE_ALL))
+{
+    // Initialise our characteristic values.
+    sensorPeriodCharacteristicBuffer = MICROBIT_BLE_SENSOR_PERIOD;
+    sensorSelectCharacteristicBuffer = MICROBIT_SENSOR_SERVICE_ALL;
+    clockEvent = allocateNotifyEvent();
+
+    // Register the base UUID and create the service.
+    RegisterBaseUUID( bs_base_uuid);
+    CreateService( serviceUUID);
+
+    // Each notification carries as many records as the negotiated MTU allows, so its length varies.
+    CreateCharacteristic( mbbs_cIdxDATA, charUUID[ mbbs_cIdxDATA],
+                         (uint8_t *)batch.data(),
+                         0, MICROBIT_BLE_MAX_PAYLOAD,
+                         microbit_propREAD | microbit_propNOTIFY);
+
+    CreateCharacteristic( mbbs_cIdxPERIOD, charUUID[ mbbs_cIdxPERIOD],
+                         (uint8_t *)&sensorPeriodCharacteristicBuffer,
+                         sizeof(sensorPeriodCharacteristicBuffer), sizeof(sensorPeriodCharacteristicBuffer),
+                         microbit_propREAD | microbit_propWRITE);
+
+    CreateCharacteristic( mbbs_cIdxSENSORS, charUUID[ mbbs_cIdxSENSORS],
+                         (uint8_t *)&sensorSelectCharacteristicBuffer,
+                         sizeof(sensorSelectCharacteristicBuffer), sizeof(sensorSelectCharacteristicBuffer),
+                         microbit_propREAD | microbit_propWRITE);
+
+    // Writes restart the clock and resize the batch, which the sample callback is using, so handle them in a fiber.
+    DeferEvents();
+
+    ActivateIfConnected();
+}
+
+
+/**
+  * Starts or stops the sample clock.
+  */
+void MicroBitSensorService::listen( bool yes)
+{
+    if (EventModel::defaultEventBus)
+    {
+        system_timer_cancel_event( DEVICE_ID_NOTIFY, clockEvent);
+
+        if ( yes)
+        {
+            batch.reset();
+            EventModel::defaultEventBus->listen(DEVICE_ID_NOTIFY, clockEvent, this, &MicroBitSensorService::sample, MESSAGE_BUS_LISTENER_DROP_IF_BUSY);
+            system_timer_event_every( sensorPeriodCharacteristicBuffer, DEVICE_ID_NOTIFY, clockEvent);
+        }
+        else
+        {
+            EventModel::defaultEventBus->ignore(DEVICE_ID_NOTIFY, clockEvent, this, &MicroBitSensorService::sample);
+        }
+    }
+}
+
+
+/**
+  * Invoked when a client first uses the service on a connection.
+  */
+void MicroBitSensorService::onActivate()
+{
+    listen( true);
+}
+
+
+/**
+  * Invoked when the connection the service was activated on closes.
+  */
+void MicroBitSensorService::onDeactivate()
+{
+    listen( false);
+}
+
+
+/**
+  * Callback. Invoked when any of our attributes are written via BLE.
+  */
+void MicroBitSensorService::onDataWritten( const microbit_ble_evt_write_t *params)
+{
+    if (params->handle == valueHandle( mbbs_cIdxPERIOD) && params->len >= sizeof(sensorPeriodCharacteristicBuffer))
+    {
+        uint16_t period;
+        memcpy(&period, params->data, sizeof(period));
+
+        if ( period > 0)
+            sensorPeriodCharacteristicBuffer = period;
+
+        setChrValue( mbbs_cIdxPERIOD, (const uint8_t *)&sensorPeriodCharacteristicBuffer, sizeof(sensorPeriodCharacteristicBuffer));
+    }
+    else if (params->handle == valueHandle( mbbs_cIdxSENSORS) && params->len >= sizeof(sensorSelectCharacteristicBuffer))
+    {
+        uint8_t sensors = params->data[0] & MICROBIT_SENSOR_SERVICE_ALL;
+
+        if ( sensors)
+            sensorSelectCharacteristicBuffer = sensors;
+
+        batch.setRecordSize( recordSize( sensorSelectCharacteristicBuffer));
+        setChrValue( mbbs_cIdxSENSORS, (const uint8_t *)&sensorSelectCharacteristicBuffer, sizeof(sensorSelectCharacteristicBuffer));
+    }
+    else
+    {
+        return;
+    }
+
+    // Restart the clock, so that the records in each batch share a period and a layout.
+    if ( getActive())
+        listen( true);
+}
+
+
+/**
+  * Sample clock callback. Reads every selected sensor, and sends the batch when it is due.
+  */
+void MicroBitSensorService::sample(MicroBitEvent)
+{
+    if ( !getConnected() || !notifyChrValueEnabled( mbbs_cIdxDATA))
+        return;
+
+    uint8_t values[ 14];
+    uint8_t *p = values;
+    uint8_t sensors = sensorSelectCharacteristicBuffer;
+
+    if ( sensors & MICROBIT_SENSOR_SERVICE_TEMPERATURE)
+        *p++ = (int8_t) thermometer.getTemperature();
+
+    if ( sensors & MICROBIT_SENSOR_SERVICE_BUTTONS)
+        *p++ = ( buttonA.isPressed() ? 0x01 : 0) | ( buttonB.isPressed() ? 0x02 : 0);
+
+    if ( sensors & MICROBIT_SENSOR_SERVICE_ACCELEROMETER)
+    {
+        Sample3D a = accelerometer.getSample();
+        int16_t xyz[3] = { (int16_t) a.x, (int16_t) a.y, (int16_t) a.z };
+        memcpy( p, xyz, sizeof( xyz));
+        p += sizeof( xyz);
+    }
+
+    if ( sensors & MICROBIT_SENSOR_SERVICE_MAGNETOMETER)
+    {
+        Sample3D m = compass.getSample();
+        int16_t xyz[3] = { (int16_t) m.x, (int16_t) m.y, (int16_t) m.z };
+        memcpy( p, xyz, sizeof( xyz));
+        p += sizeof( xyz);
+    }
+
+    // If the SoftDevice has no room for the batch yet, keep collecting and try again on the next sample.
+    if ( batch.add( values) && notifyChrValue( mbbs_cIdxDATA, batch.data(), batch.length()))
+        batch.reset();
+}
+
+#endif
@@ -59,15 +59,14 @@ MicroBitTemperatureService::MicroBitTemperatureService( BLEDevice &_ble, MicroBi
     CreateCharacteristic( mbbs_cIdxDATA, charUUID[ mbbs_cIdxDATA],
                          (uint8_t *)&temperatureDataCharacteristicBuffer,
                          sizeof(temperatureDataCharacteristicBuffer), sizeof(temperatureDataCharacteristicBuffer),
-                         microbit_propREAD | microbit_propNOTIFY);
+                         microbit_propREAD_LIVE | microbit_propNOTIFY);
 
     CreateCharacteristic( mbbs_cIdxPERIOD, charUUID[ mbbs_cIdxPERIOD],
                          (uint8_t *)&temperaturePeriodCharacteristicBuffer,
                          sizeof(temperaturePeriodCharacteristicBuffer), sizeof(temperaturePeriodCharacteristicBuffer),
                          microbit_propREAD | microbit_propWRITE);
 
-    if ( getConnected())
-        listen( true);
+    ActivateIfConnected();
 }
 
 
@@ -94,23 +93,37 @@ void MicroBitTemperatureService::listen( bool yes)
 
 
 /**
-  * Invoked when BLE connects.
+  * Invoked when a client first uses the service on a connection.
   */
-void MicroBitTemperatureService::onConnect( const microbit_ble_evt_t *p_ble_evt)
+void MicroBitTemperatureService::onActivate()
 {
     listen( true);
 }
 
 
 /**
-  * Invoked when BLE disconnects.
+  * Invoked when the connection the service was activated on closes.
   */
-void MicroBitTemperatureService::onDisconnect( const microbit_ble_evt_t *p_ble_evt)
+void MicroBitTemperatureService::onDeactivate()
 {
     listen( false);
 }
 
 
+/**
+  * Callback. Invoked when a live value is read, with MICROBIT_BLE_LAZY_SERVICES enabled.
+  * The first read activates the service before we get here, so the value is current.
+  */
+void MicroBitTemperatureService::onDataRead( microbit_onDataRead_t *params)
+{
+    if ( params->handle == valueHandle( mbbs_cIdxDATA))
+    {
+        params->data    = (const uint8_t *) &temperatureDataCharacteristicBuffer;
+        params->length  = sizeof( temperatureDataCharacteristicBuffer);
+    }
+}
+
+
 /**
   * Callback. Invoked when any of our attributes are written via BLE.
   */
@@ -38,6 +38,9 @@ DEALINGS IN THE SOFTWARE.
 #include "MicroBitFiber.h"
 #include "ErrorNo.h"
 #include "NotifyEvents.h"
+#include "MicroBitHeapStats.h"
+
+#include "ble.h"
 
 
 const uint8_t  MicroBitUARTService::base_uuid[ 16] =
@@ -61,7 +64,8 @@ const uint16_t MicroBitUARTService::charUUID[ mbbs_cIdxCOUNT] = { 0x0003, 0x0002
 const uint16_t MicroBitUARTService::charUUID[ mbbs_cIdxCOUNT] = { 0x0002, 0x0003 };
 #endif 
 
-#define MICROBIT_UART_S_ATTRSIZE            20
+// The largest characteristic value; each packet carries as much as the negotiated ATT MTU allows.
+#define MICROBIT_UART_S_ATTRSIZE            MICROBIT_BLE_MAX_PAYLOAD
 
 /**
  * Constructor for the UARTService.
@@ -71,7 +75,7 @@ const uint16_t MicroBitUARTService::charUUID[ mbbs_cIdxCOUNT] = { 0x0002, 0x0003
  *
  * @note defaults to 20
  */
-MicroBitUARTService::MicroBitUARTService(BLEDevice &_ble, uint8_t rxBufferSize, uint8_t txBufferSize)
+MicroBitUARTService::MicroBitUARTService(BLEDevice &_ble, uint16_t rxBufferSize, uint16_t txBufferSize)
 {
     // Initialise our characteristic values.
     txBufferHead = 0;
@@ -83,6 +87,7 @@ MicroBitUARTService::MicroBitUARTService(BLEDevice &_ble, uint8_t rxBufferSize,
     // Allocate memory for rxBuffer, rx characteristic, txBuffer, tx characteristic
     int size = rxBufferSize + txBufferSize + 2 * MICROBIT_UART_S_ATTRSIZE;
     rxBuffer = (uint8_t *)malloc(size);
+    MICROBIT_HEAP_TRACK(MICROBIT_HEAP_TAG_BLE, rxBuffer);
     txBuffer = rxBuffer + rxBufferSize + MICROBIT_UART_S_ATTRSIZE;
     
     memclr( rxBuffer, size);
@@ -96,6 +101,7 @@ MicroBitUARTService::MicroBitUARTService(BLEDevice &_ble, uint8_t rxBufferSize,
     this->txBufferSize = txBufferSize;
 
     txValueSize  = 0;
+    txNotifyPending = 0;
 
     waitingForEmpty = false;
 
@@ -112,7 +118,7 @@ MicroBitUARTService::MicroBitUARTService(BLEDevice &_ble, uint8_t rxBufferSize,
     CreateCharacteristic( mbbs_cIdxTX, charUUID[ mbbs_cIdxTX],
                           txBuffer + txBufferSize,
                           0, MICROBIT_UART_S_ATTRSIZE,
-                          microbit_propINDICATE);
+                          microbit_propINDICATE | ( CONFIG_ENABLED(MICROBIT_BLE_UART_NOTIFY) ? microbit_propNOTIFY : 0));
 }
 
 
@@ -122,6 +128,7 @@ MicroBitUARTService::MicroBitUARTService(BLEDevice &_ble, uint8_t rxBufferSize,
 void MicroBitUARTService::onDisconnect( const microbit_ble_evt_t *p_ble_evt)
 {
     txValueSize = txBufferTail = txBufferHead = 0;
+    txNotifyPending = 0;
 
     if ( waitingForEmpty)
         MicroBitEvent(MICROBIT_ID_NOTIFY, MICROBIT_UART_S_EVT_TX_EMPTY);
@@ -145,6 +152,24 @@ void MicroBitUARTService::onConfirmation( const microbit_ble_evt_hvc_t *params)
 }
 
 
+/**
+  * A callback function for whenever queued notifications have been transmitted
+  */
+void MicroBitUARTService::onNotificationComplete( const microbit_ble_evt_hvn_tx_complete_t *params)
+{
+    // This event is raised for the notifications of every service, so only act if we have something to do.
+    if ( txNotifyPending == 0 && txBufferTail == txBufferHead)
+        return;
+
+    txNotifyPending = params->count < txNotifyPending ? txNotifyPending - params->count : 0;
+
+    bool async = !waitingForEmpty;
+    MicroBitEvent(MICROBIT_ID_NOTIFY, MICROBIT_UART_S_EVT_TX_EMPTY);
+    if ( async)
+        sendNext();
+}
+
+
 /**
   * A callback function for whenever a Bluetooth device writes to our RX characteristic.
   */
@@ -152,67 +177,79 @@ void MicroBitUARTService::onDataWritten(const microbit_ble_evt_write_t *params)
 {
     if (params->handle == valueHandle( mbbs_cIdxRX))
     {
-        uint16_t bytesWritten = params->len;
-
-        for(int byteIterator = 0; byteIterator <  bytesWritten; byteIterator++)
+        int head = rxBufferHead;
+        int space = (rxBufferTail + rxBufferSize - head - 1) % rxBufferSize;
+        int length = min( (int) params->len, space);
+
+        // Copy the packet into the ring in at most two contiguous pieces.
+        int first = min( length, rxBufferSize - head);
+        memcpy( rxBuffer + head, params->data, first);
+        memcpy( rxBuffer, params->data + first, length - first);
+
+        //fire an event if there is a match to block any waiting fibers
+        int delimLength = this->delimeters.length();
+        for (int i = 0; i < delimLength; i++)
         {
-            int newHead = (rxBufferHead + 1) % rxBufferSize;
-
-            if(newHead != rxBufferTail)
+            if (memchr( params->data, this->delimeters.charAt(i), length))
             {
-                char c = params->data[byteIterator];
-
-                int delimeterOffset = 0;
-                int delimLength = this->delimeters.length();
-
-                //iterate through our delimeters (if any) to see if there is a match
-                while(delimeterOffset < delimLength)
-                {
-                    //fire an event if there is to block any waiting fibers
-                    if(this->delimeters.charAt(delimeterOffset) == c)
-                        MicroBitEvent(MICROBIT_ID_BLE_UART, MICROBIT_UART_S_EVT_DELIM_MATCH);
-
-                    delimeterOffset++;
-                }
-
-                rxBuffer[rxBufferHead] = c;
+                MicroBitEvent(MICROBIT_ID_BLE_UART, MICROBIT_UART_S_EVT_DELIM_MATCH);
+                break;
+            }
+        }
 
-                rxBufferHead = newHead;
+        rxBufferHead = (head + length) % rxBufferSize;
 
-                if(rxBufferHead == rxBuffHeadMatch)
-                {
-                    rxBuffHeadMatch = -1;
-                    MicroBitEvent(MICROBIT_ID_BLE_UART, MICROBIT_UART_S_EVT_HEAD_MATCH);
-                }
+        // Raise the head match event if the awaited position is within the data just received.
+        if (rxBuffHeadMatch >= 0 && length > 0)
+        {
+            int offset = (rxBuffHeadMatch - head + rxBufferSize) % rxBufferSize;
+            if (offset > 0 && offset <= length)
+            {
+                rxBuffHeadMatch = -1;
+                MicroBitEvent(MICROBIT_ID_BLE_UART, MICROBIT_UART_S_EVT_HEAD_MATCH);
             }
-            else
-                MicroBitEvent(MICROBIT_ID_BLE_UART, MICROBIT_UART_S_EVT_RX_FULL);
         }
+
+        if (length < params->len)
+            MicroBitEvent(MICROBIT_ID_BLE_UART, MICROBIT_UART_S_EVT_RX_FULL);
     }
 }
 
 /**
-  * An internal method that copies values from a circular buffer to a linear buffer.
+  * An internal method that finds the first received character matching one of the given delimeters.
   *
-  * @param circularBuff a pointer to the source circular buffer
-  * @param circularBuffSize the size of the circular buffer
-  * @param linearBuff a pointer to the destination linear buffer
-  * @param tailPosition the tail position in the circular buffer you want to copy from
-  * @param headPosition the head position in the circular buffer you want to copy to
+  * @param delimeters the characters to match against
   *
-  * @note this method assumes that the linear buffer has the appropriate amount of
-  *       memory to contain the copy operation
+  * @return the offset of the match from the start of the unread data, or -1 if there is no match.
   */
-void MicroBitUARTService::circularCopy(uint8_t *circularBuff, uint8_t circularBuffSize, uint8_t *linearBuff, uint16_t tailPosition, uint16_t headPosition)
+int MicroBitUARTService::findDelimeter(ManagedString delimeters)
 {
-    int toBuffIndex = 0;
+    int tail = rxBufferTail;
+    int head = rxBufferHead;
+    int offset = 0;
 
-    while(tailPosition != headPosition)
+    // Search the unread data as at most two contiguous spans, nearest first.
+    while (tail != head)
     {
-        linearBuff[toBuffIndex++] = circularBuff[tailPosition];
+        int end = (head > tail) ? head : rxBufferSize;
+        int length = end - tail;
+        const uint8_t *match = NULL;
+
+        for (int i = 0; i < delimeters.length(); i++)
+        {
+            const uint8_t *m = (const uint8_t *) memchr( rxBuffer + tail, delimeters.charAt(i), match ? match - (rxBuffer + tail) : length);
+            if (m)
+                match = m;
+        }
+
+        if (match)
+            return offset + (match - (rxBuffer + tail));
 
-        tailPosition = (tailPosition + 1) % circularBuffSize;
+        offset += length;
+        tail = end % rxBufferSize;
     }
+
+    return -1;
 }
 
 /**
@@ -272,7 +309,7 @@ int MicroBitUARTService::getc(MicroBitSerialMode mode)
   *                         device.
   *
   * @return the number of characters written, or MICROBIT_NOT_SUPPORTED if there is
-  *         no connected device, or the connected device has not enabled indications.
+  *         no connected device, or the connected device has not enabled indications or notifications.
   */
 int MicroBitUARTService::putc(char c, MicroBitSerialMode mode)
 {
@@ -297,19 +334,23 @@ int MicroBitUARTService::putc(char c, MicroBitSerialMode mode)
   *                         device.
   *
   * @return the number of characters written, or MICROBIT_NOT_SUPPORTED if there is
-  *         no connected device, or the connected device has not enabled indications.
+  *         no connected device, or the connected device has not enabled indications or notifications.
   */
 int MicroBitUARTService::send(const uint8_t *buf, int length, MicroBitSerialMode mode)
 {
     if(length < 1 || mode == SYNC_SPINWAIT)
         return MICROBIT_INVALID_PARAMETER;
 
-    if( !getConnected() || !indicateChrValueEnabled( mbbs_cIdxTX))
+    if( !getConnected() || !txEnabled())
         return MICROBIT_NOT_SUPPORTED;
 
+    // More than one packet's worth of data is a bulk transfer, so ask for a faster connection.
+    if ( length + txBufferedSize() > getMaxPayload() && MicroBitBLEManager::manager)
+        MicroBitBLEManager::manager->bulkTransfer();
+
     int bytesWritten = 0;
 
-    while ( getConnected() && indicateChrValueEnabled( mbbs_cIdxTX))
+    while ( getConnected() && txEnabled())
     {
         // Add new data that fits in the tx buffer
         while ( bytesWritten < length)
@@ -351,13 +392,17 @@ bool MicroBitUARTService::sendNext()
     if ( txValueSize != 0 || txBufferTail == txBufferHead)
         return false;
 
-    if( !getConnected() || !indicateChrValueEnabled( mbbs_cIdxTX))
+    if( !getConnected() || !txEnabled())
         return false;
 
+    if ( notifyMode())
+        return sendNotifications();
+
     // Duplicate the next tx data into the attribute buffer
     uint8_t *value = txBuffer + txBufferSize;
+    int payload = min( (int) getMaxPayload(), MICROBIT_UART_S_ATTRSIZE);
     int txBufferNext = txBufferTail;
-    while ( txValueSize < MICROBIT_UART_S_ATTRSIZE && txBufferNext != txBufferHead)
+    while ( txValueSize < payload && txBufferNext != txBufferHead)
     {
         value[ txValueSize++] = txBuffer[ txBufferNext];
         txBufferNext = ( txBufferNext + 1) % txBufferSize;
@@ -367,6 +412,67 @@ bool MicroBitUARTService::sendNext()
     return true;
 }
 
+/**
+  * An internal method that queues notifications from the tx buffer until it is empty
+  * or the SoftDevice queue is full.
+  * @return true if at least one notification is queued
+  */
+bool MicroBitUARTService::sendNotifications()
+{
+    microbit_gaphandle_t connection = getConnectionHandle();
+    uint8_t *value = txBuffer + txBufferSize;
+    uint16_t payload = min( (int) getMaxPayload(), MICROBIT_UART_S_ATTRSIZE);
+    bool sent = false;
+
+    // The SoftDevice copies notification data as it is queued, so tx buffer space is freed
+    // straight away rather than on confirmation.
+    while ( txBufferTail != txBufferHead)
+    {
+        uint16_t length = 0;
+        int txBufferNext = txBufferTail;
+        while ( length < payload && txBufferNext != txBufferHead)
+        {
+            value[ length++] = txBuffer[ txBufferNext];
+            txBufferNext = ( txBufferNext + 1) % txBufferSize;
+        }
+
+        ble_gatts_hvx_params_t hvx_params;
+        hvx_params.handle = valueHandle( mbbs_cIdxTX);
+        hvx_params.type   = BLE_GATT_HVX_NOTIFICATION;
+        hvx_params.offset = 0;
+        hvx_params.p_len  = &length;
+        hvx_params.p_data = value;
+
+        // NRF_ERROR_RESOURCES means the queue is full; we continue on BLE_GATTS_EVT_HVN_TX_COMPLETE.
+        if ( sd_ble_gatts_hvx( connection, &hvx_params) != NRF_SUCCESS)
+            break;
+
+        txBufferTail = txBufferNext;
+        txNotifyPending++;
+        sent = true;
+    }
+
+    return sent;
+}
+
+/**
+  * Determines if the connected device has subscribed to the TX characteristic.
+  * @return true if indications or notifications are enabled.
+  */
+bool MicroBitUARTService::txEnabled()
+{
+    return indicateChrValueEnabled( mbbs_cIdxTX) || notifyMode();
+}
+
+/**
+  * Determines if data should be sent with notifications, rather than indications.
+  * @return true if the connected device has enabled notifications and not indications.
+  */
+bool MicroBitUARTService::notifyMode()
+{
+    return CONFIG_ENABLED(MICROBIT_BLE_UART_NOTIFY) && notifyChrValueEnabled( mbbs_cIdxTX) && !indicateChrValueEnabled( mbbs_cIdxTX);
+}
+
 /**
   * Copies characters into the buffer used for Transmitting to the central device.
   *
@@ -384,7 +490,7 @@ bool MicroBitUARTService::sendNext()
   *                         device.
   *
   * @return the number of characters written, or MICROBIT_NOT_SUPPORTED if there is
-  *         no connected device, or the connected device has not enabled indications.
+  *         no connected device, or the connected device has not enabled indications or notifications.
   */
 int MicroBitUARTService::send(ManagedString s, MicroBitSerialMode mode)
 {
@@ -417,27 +523,24 @@ int MicroBitUARTService::read(uint8_t *buf, int len, MicroBitSerialMode mode)
 
     int i = 0;
 
-    if(mode == ASYNC)
+    while(i < len)
     {
-        int c;
+        const uint8_t *data;
+        int span = min( readSpan(&data), len - i);
 
-        while(i < len && (c = getc(mode)) >= 0)
+        if(span > 0)
         {
-            buf[i] = c;
-            i++;
+            memcpy(buf + i, data, span);
+            consume(span);
+            i += span;
+            continue;
         }
-    }
 
-    if(mode == SYNC_SLEEP)
-    {
-        if(len > rxBufferedSize())
-            eventAfter(len - rxBufferedSize(), mode);
+        if(mode == ASYNC)
+            break;
 
-        while(i < len)
-        {
-            buf[i] = (char)getc(mode);
-            i++;
-        }
+        // Wait for as much of the remainder as the buffer can hold.
+        eventAfter(min(len - i, rxBufferSize - 1), mode);
     }
 
     return i;
@@ -463,16 +566,32 @@ int MicroBitUARTService::read(uint8_t *buf, int len, MicroBitSerialMode mode)
   */
 ManagedString MicroBitUARTService::read(int len, MicroBitSerialMode mode)
 {
-    uint8_t buf[len + 1];
+    if(len < 1 || mode == SYNC_SPINWAIT)
+        return ManagedString();
+
+    if(mode == SYNC_SLEEP && len < rxBufferSize && len > rxBufferedSize())
+        eventAfter(len - rxBufferedSize(), mode);
 
-    memclr(&buf, len + 1);
+    // The data is usually contiguous in the buffer, so can be copied straight into the string.
+    const uint8_t *data;
+    int span = readSpan(&data);
+
+    if(span >= len || (mode == ASYNC && span > 0 && span == rxBufferedSize()))
+    {
+        span = min(span, len);
+        ManagedString s((const char *)data, span);
+        consume(span);
+        return s;
+    }
+
+    uint8_t buf[len];
 
     int ret = read(buf, len, mode);
 
     if(ret < 1)
         return ManagedString();
 
-    return ManagedString((const char *)buf);
+    return ManagedString((const char *)buf, ret);
 }
 
 /**
@@ -498,50 +617,42 @@ ManagedString MicroBitUARTService::readUntil(ManagedString delimeters, MicroBitS
     if(mode == SYNC_SPINWAIT)
         return MICROBIT_INVALID_PARAMETER;
 
-    int localTail = rxBufferTail;
-    int preservedTail = rxBufferTail;
-
-    int foundIndex = -1;
-
-    //ASYNC mode just iterates through our stored characters checking for any matches.
-    while(localTail != rxBufferHead && foundIndex  == -1)
-    {
-        //we use localTail to prevent modification of the actual tail.
-        char c = rxBuffer[localTail];
-
-        for(int delimeterIterator = 0; delimeterIterator < delimeters.length(); delimeterIterator++)
-            if(delimeters.charAt(delimeterIterator) == c)
-                foundIndex = localTail;
-
-        localTail = (localTail + 1) % rxBufferSize;
-    }
+    int foundIndex = findDelimeter(delimeters);
 
     //if our mode is SYNC_SLEEP, we set up an event to be fired when we see a
     //matching character.
-    if(mode == SYNC_SLEEP && foundIndex == -1)
+    while(mode == SYNC_SLEEP && foundIndex == -1)
     {
         eventOn(delimeters, mode);
 
-        foundIndex = rxBufferHead - 1;
-
         this->delimeters = ManagedString();
+
+        foundIndex = findDelimeter(delimeters);
     }
 
     if(foundIndex >= 0)
     {
-        //calculate our local buffer size
-        int localBuffSize = (preservedTail > foundIndex) ? (rxBufferSize - preservedTail) + foundIndex : foundIndex - preservedTail;
+        const uint8_t *data;
+        int span = readSpan(&data);
+        ManagedString result;
 
-        uint8_t localBuff[localBuffSize + 1];
-
-        memclr(&localBuff, localBuffSize + 1);
+        if(span >= foundIndex)
+        {
+            result = ManagedString((const char *)data, foundIndex);
+        }
+        else
+        {
+            uint8_t localBuff[foundIndex];
 
-        circularCopy(rxBuffer, rxBufferSize, localBuff, preservedTail, foundIndex);
+            memcpy(localBuff, data, span);
+            memcpy(localBuff + span, rxBuffer, foundIndex - span);
+            result = ManagedString((const char *)localBuff, foundIndex);
+        }
 
         //plus one for the character we listened for...
-        rxBufferTail = (rxBufferTail + localBuffSize + 1) % rxBufferSize;
+        consume(foundIndex + 1);
 
-        return ManagedString((char *)localBuff, localBuffSize);
+        return result;
     }
 
     return ManagedString();
@@ -646,4 +757,39 @@ int MicroBitUARTService::txBufferedSize()
     return txBufferHead - txBufferTail;
 }
 
+/**
+  * Provides direct access to the received data at the front of our rxBuff, without copying it.
+  * Data that wraps around the end of the buffer is returned by a further call, once this region has
+  * been released with consume().
+  *
+  * @param data set to point to the first unread character.
+  *
+  * @return the number of contiguous characters available at data, or 0 if there are none.
+  */
+int MicroBitUARTService::readSpan(const uint8_t **data)
+{
+    int tail = rxBufferTail;
+    int head = rxBufferHead;
+
+    *data = rxBuffer + tail;
+
+    return (head >= tail) ? head - tail : rxBufferSize - tail;
+}
+
+/**
+  * Releases characters from the front of our rxBuff, typically after processing them through readSpan().
+  *
+  * @param len the number of characters to release.
+  *
+  * @return the number of characters released, which is less than len if fewer were buffered.
+  */
+int MicroBitUARTService::consume(int len)
+{
+    len = max(0, min(len, rxBufferedSize()));
+
+    rxBufferTail = (rxBufferTail + len) % rxBufferSize;
+
+    return len;
+}
+
 #endif
@@ -53,6 +53,50 @@ namespace MicroBitUtility
 };
 
 
+/**
+ * Run length encode a block of data, as described for requestTypeLogStream in MicroBitUtilityTypes.h
+ * @param in the data to encode
+ * @param inLen the length of the data
+ * @param out buffer for the encoded data
+ * @param outLen the size of the buffer
+ * @param consumed set to the number of bytes of data encoded, which may be less than inLen if the buffer is full
+ * @return the length of the encoded data
+ */
+static int rleEncode( const uint8_t *in, int inLen, uint8_t *out, int outLen, int *consumed)
+{
+    int i = 0;
+    int o = 0;
+
+    while ( i < inLen)
+    {
+        int run = 1;
+        while ( i + run < inLen && run < 255 && in[ i + run] == in[ i])
+            run++;
+
+        if ( run > 3 || in[i] == streamRLEEscape)
+        {
+            if ( o + 3 > outLen)
+                break;
+
+            out[ o++] = streamRLEEscape;
+            out[ o++] = run;
+            out[ o++] = in[i];
+            i += run;
+        }
+        else
+        {
+            if ( o + 1 > outLen)
+                break;
+
+            out[ o++] = in[ i++];
+        }
+    }
+
+    *consumed = i;
+    return o;
+}
+
+
 //TODO How to choose service and characteristic IDs?
 const uint16_t MicroBitUtilityService::serviceUUID               = 0x0001;
 const uint16_t MicroBitUtilityService::charUUID[ mbbs_cIdxCOUNT] = { 0x0002 };
@@ -76,6 +120,11 @@ class MicroBitUtilityWorkspace
     uint8_t   replyLength;
     uint8_t   jobLow;
     bool      lock;
+    bool      streamOpen;               // true once a requestTypeLogStream has positioned the cursor.
+    volatile bool waiting;              // true while a stream waits for the SoftDevice to send queued notifications.
+
+    MicroBitLogCursor cursor;           // Retained across requests, so that sequential reads stream from the log.
+    uint8_t   raw[ 2 * sizeof( reply.data)];    // Data read ahead from the log, for run length encoding.
 
     /**
      * Constructor.
@@ -96,6 +145,8 @@ class MicroBitUtilityWorkspace
         replyState = replyStateClear;
         replyLength = 0;
         jobLow = 0;
+        streamOpen = false;
+        waiting = false;
     }
 
     /**
@@ -162,7 +213,10 @@ class MicroBitUtilityWorkspace
 MicroBitUtilityService *MicroBitUtilityService::createShared( BLEDevice &_ble, EventModel &_messageBus, MicroBitStorage &_storage, MicroBitLog &_log)
 {
     if ( !shared)
+    {
         shared = new MicroBitUtilityService( _ble, _messageBus, _storage, _log);
+        MICROBIT_HEAP_TRACK(MICROBIT_HEAP_TAG_BLE, shared);
+    }
     return shared;
 }
 
@@ -233,6 +287,7 @@ void MicroBitUtilityService::onDataWritten(const microbit_ble_evt_write_t *param
             workspace = new MicroBitUtilityWorkspace();
             if ( !workspace)
                 return;
+            MICROBIT_HEAP_TRACK(MICROBIT_HEAP_TAG_BLE, workspace);
         }
         
         workspace->setRequest( params->data, params->len);
@@ -241,6 +296,20 @@ void MicroBitUtilityService::onDataWritten(const microbit_ble_evt_write_t *param
 }
 
 
+/**
+ * Callback. Invoked when queued notifications have been transmitted.
+ * Resume a log stream that was waiting for space in the SoftDevice queue.
+ */
+void MicroBitUtilityService::onNotificationComplete( const microbit_ble_evt_hvn_tx_complete_t *params)
+{
+    if ( workspace && workspace->waiting)
+    {
+        workspace->waiting = false;
+        MicroBitEvent evt( MICROBIT_ID_UTILITY, MICROBIT_ID_UTILITY_PROCESS);
+    }
+}
+
+
 /**
  * Callback. Invoked when a registered event occurs.
  */
@@ -310,6 +379,15 @@ int MicroBitUtilityService::processRequest()
             case requestTypeLogRead:
                 result = processLogRead();
                 break;
+            case requestTypeLogStream:
+                result = processLogStream();
+                break;
+            case requestTypeLogSync:
+                result = processLogSync();
+                break;
+            case requestTypeLogCRC:
+                result = processLogCRC();
+                break;
             default:
                 break;
         }
@@ -321,7 +399,8 @@ int MicroBitUtilityService::processRequest()
         workspace->lock = false;
     }
     
-    if ( workspace && workspace->request.type != requestTypeNone)
+    // A stream waiting for queued notifications is resumed by onNotificationComplete instead.
+    if ( workspace && workspace->request.type != requestTypeNone && !workspace->waiting)
         MicroBitEvent evt( MICROBIT_ID_UTILITY, MICROBIT_ID_UTILITY_PROCESS);
     return result;
 }
@@ -355,9 +434,21 @@ int MicroBitUtilityService::processLogRead()
     {
         if ( workspace->replyState == replyStateClear)
         {
-            int block = min( request->batchlen, sizeof( reply_t) - offsetof( reply_t, data));
-            int result = log.readData(workspace->reply.data, request->index, block, (DataFormat) request->format, request->length);
-            if ( result)
+            // Fill as much of the negotiated MTU as the reply buffer allows.
+            int payload = min( (int) getMaxPayload(), (int) sizeof( reply_t)) - offsetof( reply_t, data);
+            int block = min( request->batchlen, payload);
+            MicroBitLogCursor &cursor = workspace->cursor;
+
+            if ( !cursor.isOpen( (DataFormat) request->format, request->length))
+                log.openCursor( cursor, (DataFormat) request->format, request->length);
+
+            cursor.seek( request->index);
+
+            int result = log.read( cursor, workspace->reply.data, block);
+            if ( result >= 0 && result < block)
+                result = DEVICE_INVALID_PARAMETER;
+
+            if ( result < 0)
                 workspace->setReplyError( result);
             else
                 workspace->setReplyReady( block);
@@ -382,4 +473,129 @@ int MicroBitUtilityService::processLogRead()
     return DEVICE_OK;
 }
 
+
+/**
+ * Process request typeLogStream
+ * @return DEVICE_OK if finished, or DEVICE_BUSY to resume when queued notifications have been sent
+ */
+int MicroBitUtilityService::processLogStream()
+{
+    requestLogStream_t *request = (requestLogStream_t *) &workspace->request;
+    MicroBitLogCursor &cursor = workspace->cursor;
+
+    if ( !workspace->streamOpen)
+    {
+        workspace->streamOpen = true;
+
+        int result = log.openCursor( cursor, (DataFormat) request->format, request->length);
+        if ( result == DEVICE_OK && request->index > cursor.getLength())
+            result = DEVICE_INVALID_PARAMETER;
+
+        if ( result != DEVICE_OK)
+            workspace->setReplyError( result);
+
+        cursor.seek( request->index);
+    }
+
+    // Nothing can be sent if the client has not subscribed, and no notification will complete to resume us.
+    if ( !notifyChrValueEnabled( mbbs_cIdxCTRL))
+        return DEVICE_OK;
+
+    // Keep the connection in its fastest mode while the stream is in progress.
+    if ( MicroBitBLEManager::manager)
+        MicroBitBLEManager::manager->bulkTransfer();
+
+    // Set before sending, so that a notification completing while we queue more is not missed.
+    workspace->waiting = true;
+
+    while ( true)
+    {
+        if ( workspace->replyState == replyStateClear)
+        {
+            int payload = min( (int) getMaxPayload(), (int) sizeof( reply_t)) - offsetof( reply_t, data);
+            int block = min( (int) ( cursor.getLength() - cursor.getIndex()), payload);
+            int result;
+
+            if ( request->flags & streamFlagRLE)
+            {
+                // Read ahead, then rewind the cursor to just after the data that fitted once encoded.
+                // The rewind is within the cursor's block, so does not access the log again.
+                uint32_t index = cursor.getIndex();
+                int consumed = 0;
+
+                result = log.read( cursor, workspace->raw, min( (int) ( cursor.getLength() - index), (int) sizeof( workspace->raw)));
+                if ( result > 0)
+                {
+                    block = rleEncode( workspace->raw, result, workspace->reply.data, payload, &consumed);
+                    cursor.seek( index + consumed);
+                }
+            }
+            else
+            {
+                result = log.read( cursor, workspace->reply.data, block);
+            }
+
+            if ( result < 0)
+                workspace->setReplyError( result);
+            else
+                workspace->setReplyReady( result > 0 ? block : 0);
+        }
+
+        // A reply with no data marks the end of the stream.
+        bool last = workspace->replyState == replyStateError || workspace->replyLength == 0;
+
+        if ( sendReply( &workspace->reply, offsetof(reply_t, data) + workspace->replyLength) != DEVICE_OK)
+            return DEVICE_BUSY;
+
+        workspace->replyState = replyStateClear;
+
+        if ( last)
+        {
+            workspace->waiting = false;
+            return DEVICE_OK;
+        }
+    }
+}
+
+
+/**
+ * Process request typeLogSync
+ * @return DEVICE_OK if finished
+ */
+int MicroBitUtilityService::processLogSync()
+{
+    if ( workspace->replyState == replyStateClear)
+    {
+        requestLog_t *request = (requestLog_t *) &workspace->request;
+        uint32_t state[2];
+
+        state[0] = log.getSequence();
+        state[1] = log.getDataLength( (DataFormat) request->format);
+        memcpy( workspace->reply.data, state, sizeof( state));
+        workspace->setReplyReady( sizeof( state));
+    }
+    return sendReply( &workspace->reply, offsetof(reply_t, data) + workspace->replyLength);
+}
+
+
+/**
+ * Process request typeLogCRC
+ * @return DEVICE_OK if finished
+ */
+int MicroBitUtilityService::processLogCRC()
+{
+    if ( workspace->replyState == replyStateClear)
+    {
+        requestLogRead_t *request = (requestLogRead_t *) &workspace->request;
+        uint32_t crc;
+
+        int result = log.getCRC( crc, request->index, request->batchlen, (DataFormat) request->format, request->length);
+        if ( result == DEVICE_OK)
+            workspace->setReply( crc);
+        else
+            workspace->setReplyError( result);
+    }
+    return sendReply( &workspace->reply, offsetof(reply_t, data) + workspace->replyLength);
+}
+
 #endif
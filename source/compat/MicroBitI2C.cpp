@@ -23,6 +23,8 @@ DEALINGS IN THE SOFTWARE.
 */
 
 #include "MicroBitI2C.h"
+#include "CodalDmesg.h"
+#include "Timer.h"
 
 using namespace codal;
 
@@ -36,6 +38,7 @@ using namespace codal;
   * @param device
   */
  MicroBitI2C::MicroBitI2C(NRF52Pin &sda, NRF52Pin &scl) : NRF52I2C(sda, scl) {
+    resetStats();
  }
 
 /**
@@ -48,6 +51,7 @@ using namespace codal;
   * @param device
   */
  MicroBitI2C::MicroBitI2C(PinName sda, PinName scl) : NRF52I2C(*new NRF52Pin(sda, sda, PIN_CAPABILITY_ALL), *new NRF52Pin(scl, scl, PIN_CAPABILITY_ALL)) {
+    resetStats();
  }
 
 /**
@@ -60,4 +64,153 @@ using namespace codal;
   * @param device
   */
  MicroBitI2C::MicroBitI2C(PinNumber sda, PinNumber scl) : NRF52I2C(*new NRF52Pin(sda, sda, PIN_CAPABILITY_ALL), *new NRF52Pin(scl, scl, PIN_CAPABILITY_ALL)) {
+    resetStats();
  }
+
+#if CONFIG_ENABLED(CONFIG_MICROBIT_I2C_STATS)
+
+CODAL_TIMESTAMP MicroBitI2C::begin()
+{
+    depth++;
+    return system_timer_current_time_us();
+}
+
+void MicroBitI2C::end(uint16_t address, int bytes, CODAL_TIMESTAMP start, int result)
+{
+    uint32_t t = (uint32_t) (system_timer_current_time_us() - start);
+    MicroBitI2CStats *s = NULL;
+
+    depth--;
+    if (depth > 0)
+        return;
+
+    for (int i = 0; i < CONFIG_MICROBIT_I2C_STATS_ADDRESSES && s == NULL; i++)
+    {
+        if (stats[i].address == address || stats[i].transactions == 0)
+        {
+            s = &stats[i];
+            s->address = address;
+        }
+    }
+
+    MicroBitI2CStats *targets[] = {&total, s};
+
+    for (MicroBitI2CStats *e : targets)
+    {
+        if (e == NULL)
+            continue;
+
+        e->transactions++;
+        e->bytes += bytes;
+        e->busyTime += t;
+        if (t > e->maxTime)
+            e->maxTime = t;
+        if (result != DEVICE_OK)
+            e->errors++;
+    }
+}
+
+int MicroBitI2C::write(uint16_t address, uint8_t *data, int len, bool repeated)
+{
+    CODAL_TIMESTAMP start = begin();
+    int result = NRF52I2C::write(address, data, len, repeated);
+    end(address, len, start, result);
+
+    return result;
+}
+
+int MicroBitI2C::read(uint16_t address, uint8_t *data, int len, bool repeated)
+{
+    CODAL_TIMESTAMP start = begin();
+    int result = NRF52I2C::read(address, data, len, repeated);
+    end(address, len, start, result);
+
+    return result;
+}
+
+int MicroBitI2C::writeRegister(uint16_t address, uint8_t reg, uint8_t value)
+{
+    CODAL_TIMESTAMP start = begin();
+    int result = NRF52I2C::writeRegister(address, reg, value);
+    end(address, 2, start, result);
+
+    return result;
+}
+
+int MicroBitI2C::readRegister(uint16_t address, uint8_t reg, uint8_t *data, int length, bool repeated)
+{
+    CODAL_TIMESTAMP start = begin();
+    int result = NRF52I2C::readRegister(address, reg, data, length, repeated);
+    end(address, length + 1, start, result);
+
+    return result;
+}
+
+MicroBitI2CStats *MicroBitI2C::getStats(uint16_t address)
+{
+    if (address == 0)
+        return &total;
+
+    for (int i = 0; i < CONFIG_MICROBIT_I2C_STATS_ADDRESSES; i++)
+        if (stats[i].address == address && stats[i].transactions)
+            return &stats[i];
+
+    return NULL;
+}
+
+int MicroBitI2C::getUtilisation()
+{
+    uint32_t elapsed = (uint32_t) (system_timer_current_time_us() - windowStart);
+
+    if (elapsed == 0)
+        return 0;
+
+    return (int) (((uint64_t) total.busyTime * 10000) / elapsed);
+}
+
+void MicroBitI2C::resetStats()
+{
+    memset(&total, 0, sizeof(total));
+    memset(stats, 0, sizeof(stats));
+    windowStart = system_timer_current_time_us();
+    depth = 0;
+}
+
+void MicroBitI2C::printStats(const char *name)
+{
+    int u = getUtilisation();
+
+    DMESG("%s: transactions %d errors %d bytes %d busy %d us (%d.%d%%) max %d us", name, (int) total.transactions, (int) total.errors,
+        (int) total.bytes, (int) total.busyTime, u / 100, (u / 10) % 10, (int) total.maxTime);
+
+    for (int i = 0; i < CONFIG_MICROBIT_I2C_STATS_ADDRESSES; i++)
+    {
+        MicroBitI2CStats &s = stats[i];
+
+        if (s.transactions)
+            DMESG("%s 0x%x: transactions %d errors %d bytes %d busy %d us mean %d us max %d us", name, (int) s.address, (int) s.transactions,
+                (int) s.errors, (int) s.bytes, (int) s.busyTime, (int) (s.busyTime / s.transactions), (int) s.maxTime);
+    }
+}
+
+#else
+
+MicroBitI2CStats *MicroBitI2C::getStats(uint16_t)
+{
+    return NULL;
+}
+
+int MicroBitI2C::getUtilisation()
+{
+    return 0;
+}
+
+void MicroBitI2C::resetStats()
+{
+}
+
+void MicroBitI2C::printStats(const char *)
+{
+}
+
+#endif